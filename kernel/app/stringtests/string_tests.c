@@ -283,6 +283,172 @@ static void validate_memset(void)
     }
 }
 
+/* byte at a time references for the scanning routines */
+enum {
+    STR_STRLEN,
+    STR_MEMCHR,
+    STR_MEMCMP,
+    STR_STRCHR,
+    STR_STRCMP,
+    STR_ROUTINES
+};
+
+static const char *str_routine_names[STR_ROUTINES] = {
+    "strlen", "memchr", "memcmp", "strchr", "strcmp",
+};
+
+static size_t c_strlen(const char *s)
+{
+    const char *p = s;
+    while (*p)
+        p++;
+    return p - s;
+}
+
+static void *c_memchr(const void *s, int c, size_t n)
+{
+    const unsigned char *p = s;
+    for (; n; n--, p++) {
+        if (*p == (unsigned char)c)
+            return (void *)p;
+    }
+    return NULL;
+}
+
+static int c_memcmp(const void *a, const void *b, size_t n)
+{
+    const unsigned char *l = a, *r = b;
+    for (; n; n--, l++, r++) {
+        if (*l != *r)
+            return *l - *r;
+    }
+    return 0;
+}
+
+static char *c_strchr(const char *s, int c)
+{
+    for (;; s++) {
+        if (*s == (char)c)
+            return (char *)s;
+        if (!*s)
+            return NULL;
+    }
+}
+
+static int c_strcmp(const char *l, const char *r)
+{
+    for (; *l == *r && *l; l++, r++)
+        ;
+    return *(const unsigned char *)l - *(const unsigned char *)r;
+}
+
+/* run routine over a and b, len bytes long with a terminator after, with
+ * the reference or libc. the result is folded into something comparable. */
+static long run_str_routine(int routine, bool libc, const char *a, const char *b, size_t len)
+{
+    switch (routine) {
+        case STR_STRLEN:
+            return libc ? strlen(a) : c_strlen(a);
+        case STR_MEMCHR:
+            return (const char *)(libc ? memchr(a, 0, len + 1) : c_memchr(a, 0, len + 1)) - a;
+        case STR_MEMCMP: {
+            int r = libc ? memcmp(a, b, len) : c_memcmp(a, b, len);
+            return (r > 0) - (r < 0);
+        }
+        case STR_STRCHR: {
+            const char *r = libc ? strchr(a, 'z') : c_strchr(a, 'z');
+            return r ? r - a : -1;
+        }
+        case STR_STRCMP: {
+            int r = libc ? strcmp(a, b) : c_strcmp(a, b);
+            return (r > 0) - (r < 0);
+        }
+    }
+    return 0;
+}
+
+/* a string of len bytes without a 'z' in it, terminated */
+static void fill_str(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 'a' + i % 25;
+    buf[len] = 0;
+}
+
+static volatile long str_sink;
+
+static void bench_strings(void)
+{
+    static const size_t lens[] = { 16, 64, 256, 4096, 65536 };
+    const uint64_t total = 64*1024*1024;
+
+    printf("string routines speed test\n");
+    thread_sleep(200); // let the debug string clear the serial port
+
+    for (size_t l = 0; l < countof(lens); l++) {
+        size_t len = lens[l];
+        size_t iterations = total / len;
+        fill_str(src, len);
+        fill_str(src2, len);
+
+        for (int routine = 0; routine < STR_ROUTINES; routine++) {
+            lk_bigtime_t t[2];
+            for (int libc = 0; libc < 2; libc++) {
+                lk_bigtime_t t0 = current_time_hires();
+                for (size_t i = 0; i < iterations; i++) {
+                    /* the barrier keeps the calls from being hoisted out */
+                    str_sink += run_str_routine(routine, libc, (const char *)src,
+                                                (const char *)src2, len);
+                    __asm__ volatile("" ::: "memory");
+                }
+                t[libc] = current_time_hires() - t0;
+                if (t[libc] == 0)
+                    t[libc] = 1;
+            }
+            printf("%s len %zu: c %llu bytes/sec, libc %llu bytes/sec\n",
+                   str_routine_names[routine], len,
+                   total * 1000000ULL / t[0], total * 1000000ULL / t[1]);
+        }
+    }
+}
+
+static void validate_strings(void)
+{
+    const size_t maxsize = 256;
+
+    printf("testing string routines for correctness\n");
+
+    for (int routine = 0; routine < STR_ROUTINES; routine++) {
+        printf("%s\n", str_routine_names[routine]);
+        for (size_t align = 0; align < 64; align++) {
+            for (size_t len = 0; len < maxsize; len++) {
+                char *a = (char *)src + align;
+                char *b = (char *)src2 + (align * 7) % 64;
+                fill_str((uint8_t *)a, len);
+                fill_str((uint8_t *)b, len);
+
+                /* equal, then differing at the end, the middle and the start,
+                 * both ways round, with 'z' to find where b differs */
+                for (size_t pos = 0; pos < 4; pos++) {
+                    size_t at = (pos == 1) ? len - 1 : (pos == 2) ? len / 2 : 0;
+                    if (pos > 0) {
+                        if (len == 0)
+                            break;
+                        a[at] = (pos & 1) ? 'z' : 0x80 + at % 128;
+                    }
+                    long expected = run_str_routine(routine, false, a, b, len);
+                    long actual = run_str_routine(routine, true, a, b, len);
+                    if (expected != actual) {
+                        printf("error! %s align %zu, len %zu, pos %zu: %ld vs %ld\n",
+                               str_routine_names[routine], align, len, pos, actual, expected);
+                    }
+                    fill_str((uint8_t *)a, len);
+                }
+            }
+        }
+    }
+}
+
 #if defined(WITH_LIB_CONSOLE)
 #include <lib/console.h>
 
@@ -314,12 +480,16 @@ usage:
             validate_memcpy();
         } else if (!strcmp(argv[2].str, "memset")) {
             validate_memset();
+        } else if (!strcmp(argv[2].str, "strings")) {
+            validate_strings();
         }
     } else if (!strcmp(argv[1].str, "bench")) {
         if (!strcmp(argv[2].str, "memcpy")) {
             bench_memcpy();
         } else if (!strcmp(argv[2].str, "memset")) {
             bench_memset();
+        } else if (!strcmp(argv[2].str, "strings")) {
+            bench_strings();
         }
     } else {
         goto usage;
@@ -335,7 +505,7 @@ out:
 }
 
 STATIC_COMMAND_START
-STATIC_COMMAND("string", "memcpy tests", &string_tests)
+STATIC_COMMAND("string", "memcpy, memset and string routine tests", &string_tests)
 STATIC_COMMAND_END(stringtests);
 
 #endif
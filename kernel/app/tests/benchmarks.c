@@ -122,6 +122,91 @@ __NO_INLINE static void bench_memcpy(void)
     free(buf);
 }
 
+#if ARCH_X86_64
+#include <arch/x86/string.h>
+
+/* compare the variants memcpy() and memset() choose between, for a large
+ * buffer and for copies of a few cache lines */
+__NO_INLINE static void x86_bench_memcpy_variant(const char *name,
+                                                 void *(*fn)(void *, const void *, size_t),
+                                                 size_t size, uint iter)
+{
+    uint8_t *buf = calloc(1, BUFSIZE);
+
+    uint count = arch_cycle_count();
+    for (uint i = 0; i < iter; i++) {
+        fn(buf, buf + BUFSIZE / 2, size);
+    }
+    count = arch_cycle_count() - count;
+
+    uint64_t bytes_cycle = (size * iter * 1000ULL) / count;
+    printf("took %u cycles to %s %zu bytes %u times, %llu.%03llu bytes/cycle\n",
+           count, name, size, iter, bytes_cycle / 1000, bytes_cycle % 1000);
+
+    free(buf);
+}
+
+__NO_INLINE static void x86_bench_memset_variant(const char *name,
+                                                 void *(*fn)(void *, int, size_t),
+                                                 size_t size, uint iter)
+{
+    uint8_t *buf = malloc(BUFSIZE);
+
+    uint count = arch_cycle_count();
+    for (uint i = 0; i < iter; i++) {
+        fn(buf, 0, size);
+    }
+    count = arch_cycle_count() - count;
+
+    uint64_t bytes_cycle = (size * iter * 1000ULL) / count;
+    printf("took %u cycles to %s %zu bytes %u times, %llu.%03llu bytes/cycle\n",
+           count, name, size, iter, bytes_cycle / 1000, bytes_cycle % 1000);
+
+    free(buf);
+}
+
+/* clear the buffer a page at a time, with and without non-temporal stores */
+__NO_INLINE static void x86_bench_zero_pages(bool non_temporal)
+{
+    uint8_t *buf = memalign(PAGE_SIZE, BUFSIZE);
+
+    uint count = arch_cycle_count();
+    for (uint i = 0; i < ITER / 4; i++) {
+        for (size_t off = 0; off < BUFSIZE; off += PAGE_SIZE) {
+            if (non_temporal)
+                arch_zero_page(buf + off);
+            else
+                memset(buf + off, 0, PAGE_SIZE);
+        }
+    }
+    count = arch_cycle_count() - count;
+
+    uint64_t bytes_cycle = (BUFSIZE * (ITER / 4) * 1000ULL) / count;
+    printf("took %u cycles to clear %u bytes a page at a time with %s %u times, %llu.%03llu bytes/cycle\n",
+           count, BUFSIZE, non_temporal ? "arch_zero_page" : "memset", ITER / 4,
+           bytes_cycle / 1000, bytes_cycle % 1000);
+
+    free(buf);
+}
+
+static void x86_bench_string_variants(void)
+{
+    printf("string features: erms %d fsrm %d\n",
+           !!(x86_string_features & X86_STRING_ERMS), !!(x86_string_features & X86_STRING_FSRM));
+
+    x86_bench_memcpy_variant("memcpy_quad", memcpy_quad, BUFSIZE / 2, ITER);
+    x86_bench_memcpy_variant("memcpy_erms", memcpy_erms, BUFSIZE / 2, ITER);
+    x86_bench_memcpy_variant("memcpy_quad", memcpy_quad, 200, ITER * 64);
+    x86_bench_memcpy_variant("memcpy_erms", memcpy_erms, 200, ITER * 64);
+    x86_bench_memset_variant("memset_quad", memset_quad, BUFSIZE, ITER);
+    x86_bench_memset_variant("memset_erms", memset_erms, BUFSIZE, ITER);
+    x86_bench_memset_variant("memset_quad", memset_quad, 200, ITER * 64);
+    x86_bench_memset_variant("memset_erms", memset_erms, 200, ITER * 64);
+    x86_bench_zero_pages(false);
+    x86_bench_zero_pages(true);
+}
+#endif // ARCH_X86_64
+
 #if ARCH_ARM
 __NO_INLINE static void arm_bench_cset_stm(void)
 {
@@ -226,6 +311,12 @@ void benchmarks(void)
     bench_cset_uint64_t();
     bench_cset_wide();
 
+    crypto_benchmarks();
+
+#if ARCH_X86_64
+    x86_bench_string_variants();
+#endif
+
 #if ARCH_ARM
     arm_bench_cset_stm();
 
@@ -0,0 +1,51 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <app/tests.h>
+#include <arch/ops.h>
+#include <lib/crypto/cryptolib.h>
+#include <lib/crypto/hash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t kHashBufSize = 1024 * 1024;
+static const uint kHashIter = 16;
+
+static void print_rate(const char* name, uint count) {
+    uint64_t bytes_cycle = (kHashBufSize * kHashIter * 1000ULL) / count;
+    printf("took %u cycles to %s a buffer of size %zu %u times, %llu.%03llu bytes/cycle\n",
+           count, name, kHashBufSize, kHashIter, bytes_cycle / 1000, bytes_cycle % 1000);
+}
+
+// Hash256 uses the cpu's SHA-256 instructions where it has them, so compare
+// it with cryptolib's portable code on the same buffer.
+__NO_INLINE static void bench_sha256(void) {
+    uint8_t* buf = static_cast<uint8_t*>(calloc(1, kHashBufSize));
+    if (!buf)
+        return;
+
+    uint count = arch_cycle_count();
+    for (uint i = 0; i < kHashIter; i++) {
+        crypto::Hash256 hash(buf, static_cast<int>(kHashBufSize));
+    }
+    count = arch_cycle_count() - count;
+    print_rate("Hash256", count);
+
+    uint8_t digest[clSHA256_DIGEST_SIZE];
+    count = arch_cycle_count();
+    for (uint i = 0; i < kHashIter; i++) {
+        clSHA256(buf, static_cast<int>(kHashBufSize), digest);
+    }
+    count = arch_cycle_count() - count;
+    print_rate("clSHA256", count);
+
+    free(buf);
+}
+
+void crypto_benchmarks(void) {
+    bench_sha256();
+}
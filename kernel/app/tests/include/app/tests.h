@@ -19,6 +19,8 @@ int port_tests(void);
 void printf_tests(void);
 void clock_tests(void);
 void benchmarks(void);
+void crypto_benchmarks(void);
+int vm_benchmarks(int argc, const cmd_args *argv);
 int fibo(int argc, const cmd_args *argv);
 int spinner(int argc, const cmd_args *argv);
 int ref_counted_tests(int argc, const cmd_args *argv);
@@ -13,6 +13,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/benchmarks.c \
     $(LOCAL_DIR)/cache_tests.c \
     $(LOCAL_DIR)/clock_tests.c \
+    $(LOCAL_DIR)/crypto_benchmarks.cpp \
     $(LOCAL_DIR)/fibo.c \
     $(LOCAL_DIR)/float.c \
     $(LOCAL_DIR)/float_instructions.S \
@@ -24,6 +25,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/sleep_tests.c \
     $(LOCAL_DIR)/tests.c \
     $(LOCAL_DIR)/thread_tests.c \
+    $(LOCAL_DIR)/vm_benchmarks.cpp \
     $(LOCAL_DIR)/alloc_checker_tests.cpp \
 
 
@@ -172,6 +172,49 @@ static int mutex_zerotimeout_thread(void *arg)
     return err;
 }
 
+static int mutex_inherit_thread(void *arg)
+{
+    mutex_t *m = (mutex_t *)arg;
+
+    mutex_acquire(m);
+    mutex_release(m);
+
+    return 0;
+}
+
+static void mutex_inherit_test(void)
+{
+    printf("testing mutex priority inheritance\n");
+
+    thread_t *current_thread = get_current_thread();
+    mutex_t m;
+    mutex_init(&m);
+
+    thread_set_priority(LOW_PRIORITY);
+    mutex_acquire(&m);
+
+    thread_t *t = thread_create("mutex inherit tester", &mutex_inherit_thread, &m, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(t);
+    thread_sleep(100);
+
+    /* the waiter should be blocked on the mutex, lending us its priority */
+    if (current_thread->priority != HIGH_PRIORITY)
+        panic("mutex holder running at priority %d, expected %d\n",
+              current_thread->priority, HIGH_PRIORITY);
+
+    mutex_release(&m);
+
+    if (current_thread->priority != LOW_PRIORITY)
+        panic("mutex holder still at priority %d after release, expected %d\n",
+              current_thread->priority, LOW_PRIORITY);
+
+    thread_join(t, NULL, INFINITE_TIME);
+    thread_set_priority(DEFAULT_PRIORITY);
+    mutex_destroy(&m);
+
+    printf("done with mutex priority inheritance test\n");
+}
+
 int mutex_test(void)
 {
     static mutex_t imutex = MUTEX_INITIAL_VALUE(imutex);
@@ -218,10 +261,12 @@ int mutex_test(void)
         thread_join(threads[i], NULL, INFINITE_TIME);
     }
 
-    printf("done with mutex tests\n");
-
     mutex_destroy(&timeout_mutex);
 
+    mutex_inherit_test();
+
+    printf("done with mutex tests\n");
+
     return 0;
 }
 
@@ -0,0 +1,163 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <app/tests.h>
+#include <arch/ops.h>
+#include <err.h>
+#include <kernel/event.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The same measurements as the userspace vm-bench, from inside the kernel so
+// they leave out the syscall and user copy costs. All in the kernel aspace.
+
+static void print_rate(const char* what, size_t count, const char* unit, lk_bigtime_t us) {
+    if (us == 0)
+        us = 1;
+    printf("%-24s %8zu %-8s %10llu ns/%s %10llu %s/s\n", what, count, unit,
+           us * 1000 / count, unit, count * 1000000ULL / us, unit);
+}
+
+// touch every page of a fresh demand paged region
+static lk_bigtime_t fault_pages(size_t pages) {
+    VmAspace* aspace = VmAspace::kernel_aspace();
+    void* ptr;
+    if (aspace->Alloc("vm bench", pages * PAGE_SIZE, &ptr, 0, 0, 0) != NO_ERROR)
+        return 0;
+
+    lk_bigtime_t t = current_time_hires();
+    for (size_t i = 0; i < pages; i++)
+        static_cast<volatile uint8_t*>(ptr)[i * PAGE_SIZE] = 1;
+    t = current_time_hires() - t;
+
+    aspace->FreeRegion(reinterpret_cast<vaddr_t>(ptr));
+    return t;
+}
+
+__NO_INLINE static void bench_faults(void) {
+    static const size_t kPages[] = {16, 256, 4096};
+    for (size_t pages : kPages) {
+        print_rate("fault", pages, "page", fault_pages(pages));
+    }
+}
+
+// map and unmap one page of a vm object, count times each
+__NO_INLINE static void bench_map_unmap(void) {
+    static const size_t kRegions[] = {1, 64, 1024};
+    VmAspace* aspace = VmAspace::kernel_aspace();
+    auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, PAGE_SIZE);
+    if (!vmo)
+        return;
+
+    for (size_t count : kRegions) {
+        void** ptrs = static_cast<void**>(calloc(count, sizeof(void*)));
+        if (!ptrs)
+            return;
+
+        size_t mapped = 0;
+        lk_bigtime_t t = current_time_hires();
+        for (; mapped < count; mapped++) {
+            if (aspace->MapObject(vmo, "vm bench", 0, PAGE_SIZE, &ptrs[mapped], 0,
+                                  VMM_FLAG_COMMIT, 0) != NO_ERROR)
+                break;
+        }
+        t = current_time_hires() - t;
+        if (mapped)
+            print_rate("map", mapped, "region", t);
+
+        t = current_time_hires();
+        for (size_t i = 0; i < mapped; i++)
+            aspace->FreeRegion(reinterpret_cast<vaddr_t>(ptrs[i]));
+        t = current_time_hires() - t;
+        if (mapped)
+            print_rate("unmap", mapped, "region", t);
+
+        free(ptrs);
+    }
+}
+
+__NO_INLINE static void bench_vmo_read_write(void) {
+    static const size_t kSize = 16 * 1024 * 1024;
+    static const size_t kChunk = 64 * 1024;
+    auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, kSize);
+    uint8_t* buf = static_cast<uint8_t*>(malloc(kChunk));
+    if (!vmo || !buf) {
+        free(buf);
+        return;
+    }
+    memset(buf, 0x5a, kChunk);
+
+    // the first pass commits the pages, the second is the copy alone
+    for (int pass = 0; pass < 2; pass++) {
+        lk_bigtime_t t = current_time_hires();
+        size_t bytes;
+        for (size_t off = 0; off < kSize; off += kChunk)
+            vmo->Write(buf, off, kChunk, &bytes);
+        t = current_time_hires() - t;
+        print_rate(pass ? "vmo write" : "vmo write (commit)", kSize / 1024, "KB", t);
+    }
+
+    lk_bigtime_t t = current_time_hires();
+    size_t bytes;
+    for (size_t off = 0; off < kSize; off += kChunk)
+        vmo->Read(buf, off, kChunk, &bytes);
+    t = current_time_hires() - t;
+    print_rate("vmo read", kSize / 1024, "KB", t);
+
+    free(buf);
+}
+
+// every thread faults in its own region, all at once
+static const size_t kScalePages = 1024;
+
+static int fault_thread(void* arg) {
+    event_t* go = static_cast<event_t*>(arg);
+    event_wait(go);
+    return fault_pages(kScalePages) ? 0 : -1;
+}
+
+__NO_INLINE static void bench_fault_scaling(void) {
+    uint max = arch_max_num_cpus();
+    for (uint n = 1; n <= max; n *= 2) {
+        event_t go;
+        event_init(&go, false, 0);
+        thread_t* threads[SMP_MAX_CPUS];
+        for (uint i = 0; i < n; i++) {
+            threads[i] = thread_create("vm bench", fault_thread, &go, DEFAULT_PRIORITY,
+                                       DEFAULT_STACK_SIZE);
+            if (!threads[i]) {
+                n = i;
+                break;
+            }
+            thread_resume(threads[i]);
+        }
+
+        lk_bigtime_t t = current_time_hires();
+        event_signal(&go, true);
+        for (uint i = 0; i < n; i++)
+            thread_join(threads[i], NULL, INFINITE_TIME);
+        t = current_time_hires() - t;
+        event_destroy(&go);
+
+        char what[32];
+        snprintf(what, sizeof(what), "fault x%u threads", n);
+        print_rate(what, n * kScalePages, "page", t);
+    }
+}
+
+int vm_benchmarks(int argc, const cmd_args* argv) {
+    bench_faults();
+    bench_map_unmap();
+    bench_vmo_read_write();
+    bench_fault_scaling();
+    return 0;
+}
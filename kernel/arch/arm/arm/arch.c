@@ -11,6 +11,7 @@
 #include <err.h>
 #include <trace.h>
 #include <stdio.h>
+#include <string.h>
 #include <reg.h>
 #include <arch.h>
 #include <arch/ops.h>
@@ -430,3 +431,8 @@ void arch_enter_uspace(vaddr_t entry_point, vaddr_t user_stack_top, void *thread
     arm_uspace_entry(thread_arg, kernel_stack_top, &user_stack_top, spsr, entry_point);
     __UNREACHABLE;
 }
+
+void arch_zero_page(void *ptr)
+{
+    memset(ptr, 0, PAGE_SIZE);
+}
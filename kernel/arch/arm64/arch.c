@@ -7,6 +7,7 @@
 
 #include <debug.h>
 #include <stdlib.h>
+#include <string.h>
 #include <arch.h>
 #include <arch/ops.h>
 #include <arch/arm64.h>
@@ -141,3 +142,7 @@ void arm64_secondary_entry(ulong asm_cpu_num)
 }
 #endif
 
+void arch_zero_page(void *ptr)
+{
+    memset(ptr, 0, PAGE_SIZE);
+}
@@ -30,3 +30,33 @@ status_t arch_copy_to_user(void *dst, const void *src, size_t len)
             _arm64_copy_to_user(dst, src, len, &thr->arch.data_fault_resume);
     return status;
 }
+
+status_t arch_copy_from_user_fixed(void *dst, const void *src, size_t len)
+{
+    return arch_copy_from_user(dst, src, len);
+}
+
+status_t arch_copy_to_user_fixed(void *dst, const void *src, size_t len)
+{
+    return arch_copy_to_user(dst, src, len);
+}
+
+status_t arch_copy_from_user_many(const user_copy_vec_t *vec, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        status_t status = arch_copy_from_user(vec[i].dst, vec[i].src, vec[i].len);
+        if (status != NO_ERROR)
+            return status;
+    }
+    return NO_ERROR;
+}
+
+status_t arch_copy_to_user_many(const user_copy_vec_t *vec, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        status_t status = arch_copy_to_user(vec[i].dst, vec[i].src, vec[i].len);
+        if (status != NO_ERROR)
+            return status;
+    }
+    return NO_ERROR;
+}
@@ -116,7 +116,7 @@ status_t x86_bootstrap16_prep(
 
     bootstrap_data->phys_bootstrap_pml4 =
             vmm_get_arch_aspace(bootstrap_aspace)->pt_phys;
-    bootstrap_data->phys_kernel_pml4 = x86_get_cr3();
+    bootstrap_data->phys_kernel_pml4 = x86_get_cr3() & ~(ulong)X86_CR3_PCID_MASK;
     memcpy(bootstrap_data->phys_gdtr,
            &_gdtr_phys,
            sizeof(bootstrap_data->phys_gdtr));
@@ -115,11 +115,13 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
 
     // The docs recommend waiting 200us for cores to boot.  We do a bit more
     // work before the cores report in, so wait longer (up to 1 second).
-    for (int tries_left = 200;
+    // Poll finely, since they all come up at about the same time and any
+    // slack here is added straight onto boot.
+    for (int tries_left = 1000;
          aps_still_booting != 0 && tries_left > 0;
          --tries_left) {
 
-        thread_sleep(5);
+        thread_sleep(1);
     }
 
     uint failed_aps = (uint)atomic_swap(&aps_still_booting, 0);
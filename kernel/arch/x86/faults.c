@@ -16,6 +16,10 @@
 
 #include <lib/user_copy.h>
 
+#if WITH_LIB_KTRACE
+#include <lib/ktrace.h>
+#endif
+
 #if WITH_LIB_MAGENTA
 #include <magenta/exception.h>
 
@@ -268,6 +272,12 @@ void x86_exception_handler(x86_iframe_t *frame)
     // deliver the interrupt
     enum handler_return ret = INT_NO_RESCHEDULE;
 
+#if WITH_LIB_KTRACE
+    bool is_irq = frame->vector >= X86_INT_PLATFORM_BASE;
+    if (is_irq)
+        ktrace(MX_KTRACE_TAG_IRQ_ENTER, frame->vector, 0);
+#endif
+
     switch (frame->vector) {
         case X86_INT_INVALID_OP:
             x86_invop_handler(frame);
@@ -312,6 +322,13 @@ void x86_exception_handler(x86_iframe_t *frame)
             apic_issue_eoi();
             break;
         }
+#if ARCH_X86_64 && WITH_LIB_KTRACE
+        case X86_INT_APIC_PMI: {
+            x86_pmi_handler(frame);
+            apic_issue_eoi();
+            break;
+        }
+#endif
 #if WITH_SMP
         case X86_INT_IPI_GENERIC: {
             ret = x86_ipi_generic_handler();
@@ -333,6 +350,11 @@ void x86_exception_handler(x86_iframe_t *frame)
             x86_unhandled_exception(frame);
     }
 
+#if WITH_LIB_KTRACE
+    if (is_irq)
+        ktrace(MX_KTRACE_TAG_IRQ_EXIT, frame->vector, 0);
+#endif
+
     /* if we came from user space, check to see if we have any signals to handle */
     if (unlikely(from_user)) {
         /* in the case of receiving a kill signal, this function may not return,
@@ -11,6 +11,7 @@
 #include <assert.h>
 
 #include <arch/ops.h>
+#include <arch/x86/string.h>
 
 #define LOCAL_TRACE 0
 
@@ -21,6 +22,8 @@ uint32_t max_ext_cpuid = 0;
 
 static int initialized = 0;
 
+uint8_t x86_string_features = 0;
+
 void x86_feature_init(void)
 {
     if (atomic_swap(&initialized, 1)) {
@@ -54,6 +57,14 @@ void x86_feature_init(void)
         cpuid_c(i, 0, &_cpuid_ext[index].a, &_cpuid_ext[index].b, &_cpuid_ext[index].c, &_cpuid_ext[index].d);
     }
 
+    /* let the string routines pick their variants */
+    uint8_t string_features = 0;
+    if (x86_feature_test(X86_FEATURE_ERMS))
+        string_features |= X86_STRING_ERMS;
+    if (x86_feature_test(X86_FEATURE_FSRM))
+        string_features |= X86_STRING_FSRM;
+    x86_string_features = string_features;
+
 #if LK_DEBUGLEVEL > 1
     x86_feature_debug();
 #endif
@@ -109,9 +120,12 @@ void x86_feature_debug(void)
         { X86_FEATURE_FXSR, "fxsr" },
         { X86_FEATURE_XSAVE, "xsave" },
         { X86_FEATURE_AESNI, "aesni" },
+        { X86_FEATURE_SHA, "sha" },
         { X86_FEATURE_TSC_ADJUST, "tsc_adj" },
         { X86_FEATURE_SMEP, "smep" },
         { X86_FEATURE_SMAP, "smap" },
+        { X86_FEATURE_ERMS, "erms" },
+        { X86_FEATURE_FSRM, "fsrm" },
         { X86_FEATURE_RDRAND, "rdrand" },
         { X86_FEATURE_RDSEED, "rdseed" },
         { X86_FEATURE_PKU, "pku" },
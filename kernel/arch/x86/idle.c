@@ -0,0 +1,118 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <compiler.h>
+#include <debug.h>
+#include <trace.h>
+#include <arch/ops.h>
+#include <arch/x86.h>
+#include <arch/x86/feature.h>
+#include <arch/x86/mp.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <platform.h>
+
+#define LOCAL_TRACE 0
+
+/* mwait C-states are numbered from C1, and the hint is the state less one in
+ * bits 7:4 with the sub-state in bits 3:0 */
+#define MWAIT_MAX_CSTATE 7
+#define MWAIT_HINT(cstate) (((cstate) - 1u) << 4)
+
+/* have mwait return on an interrupt even with interrupts masked */
+#define MWAIT_EXT_INTR_BREAK 1u
+
+/* how long, in ms, a cpu has to expect to stay idle before a C-state is worth
+ * entering. deliberately well above what current parts need to pay back the
+ * cost of getting in and out. */
+static const lk_time_t mwait_residency[MWAIT_MAX_CSTATE + 1] = {
+    [1] = 0, [2] = 1, [3] = 2, [4] = 5, [5] = 10, [6] = 20, [7] = 50,
+};
+
+static bool idle_mwait;
+
+/* C-states with at least one sub-state, by the cpuid mwait leaf */
+static uint8_t mwait_cstates;
+
+void x86_idle_init(void)
+{
+    /* mwait has to be able to break on an interrupt with them masked, or a
+     * wakeup could slip in between checking for one and going to sleep */
+    idle_mwait = x86_feature_test(X86_FEATURE_MON) &&
+                 x86_feature_test(X86_FEATURE_MWAIT_INTR);
+    if (!idle_mwait)
+        return;
+
+    mwait_cstates = 1u << 1;
+
+    /* below C1 the local apic timer may stop, and nothing here moves the
+     * deadline to a timer that keeps running */
+    if (!x86_feature_test(X86_FEATURE_ARAT))
+        return;
+
+    const struct cpuid_leaf *leaf = x86_get_cpuid_leaf(X86_CPUID_MWAIT);
+    for (uint cstate = 2; cstate <= MWAIT_MAX_CSTATE; cstate++) {
+        if ((leaf->d >> (cstate * 4)) & 0xf)
+            mwait_cstates |= 1u << cstate;
+    }
+
+    LTRACEF("mwait C-states %#x\n", mwait_cstates);
+}
+
+/* the deepest C-state worth entering for the time this cpu expects to idle */
+static uint32_t mwait_hint(lk_time_t idle)
+{
+    uint best = 1;
+
+    for (uint cstate = 2; cstate <= MWAIT_MAX_CSTATE; cstate++) {
+        if ((mwait_cstates & (1u << cstate)) && idle >= mwait_residency[cstate])
+            best = cstate;
+    }
+    return MWAIT_HINT(best);
+}
+
+bool x86_idle_wake(struct x86_percpu *percpu)
+{
+    int state = X86_IDLE_MWAIT;
+
+    return atomic_cmpxchg(&percpu->idle_state, &state, X86_IDLE_WAKE);
+}
+
+void arch_idle(void)
+{
+    /* don't halt if local interrupts are disabled */
+    if (arch_ints_disabled())
+        return;
+
+    if (!idle_mwait) {
+        x86_hlt();
+        return;
+    }
+
+    struct x86_percpu *percpu = x86_get_percpu();
+
+    arch_disable_ints();
+
+    uint32_t hint = mwait_hint(timer_idle_time(current_time()));
+
+    /* once idle_state reads X86_IDLE_MWAIT other cpus stop sending
+     * reschedule IPIs and store X86_IDLE_WAKE to it instead, which the
+     * monitor catches. one that lands before the monitor is armed is seen
+     * by the check. */
+    atomic_swap(&percpu->idle_state, X86_IDLE_MWAIT);
+    x86_monitor(&percpu->idle_state);
+    if (percpu->idle_state == X86_IDLE_MWAIT)
+        x86_mwait(hint, MWAIT_EXT_INTR_BREAK);
+
+    /* from here on wakeups are IPIs again */
+    int state = atomic_swap(&percpu->idle_state, X86_IDLE_BUSY);
+
+    /* take whatever interrupt broke the mwait */
+    arch_enable_ints();
+
+    if (state == X86_IDLE_WAKE)
+        thread_preempt();
+}
@@ -24,6 +24,13 @@ struct arch_thread {
     /* buffer to save fpu state */
     vaddr_t *extended_register_state;
     uint8_t extended_register_buffer[X86_MAX_EXTENDED_REGISTER_SIZE + 64];
+    /* the cpu the state was last saved or restored on, -1 if none */
+    int extended_register_cpu;
+
+    /* times the state was saved on a context switch, and how many of those
+     * found it in use rather than in its initial state */
+    ulong extended_register_saves;
+    ulong extended_register_in_use;
 
     /* if non-NULL, address to return to on page fault */
     void *page_fault_resume;
@@ -32,6 +32,14 @@ struct arch_aspace {
     /* if not NULL, pointer to the port IO permissions for this address space */
     void *io_bitmap_ptr;
     spin_lock_t io_bitmap_lock;
+
+    /* mask of the cpus that currently have this aspace loaded */
+    volatile int active_cpus;
+
+    /* process-context identifier tagging this aspace's TLB entries, 0 if
+     * none, and the mask of cpus whose TLB may still hold entries for it */
+    uint16_t pcid;
+    volatile int pcid_cpus;
 };
 
 __END_CDECLS
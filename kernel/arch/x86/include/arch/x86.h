@@ -44,6 +44,9 @@ typedef struct x86_32_iframe x86_iframe_t;
 typedef struct x86_64_iframe x86_iframe_t;
 #endif
 
+/* performance counter overflow, which takes a ktrace cpu sample */
+void x86_pmi_handler(x86_iframe_t *frame);
+
 struct x86_32_context_switch_frame {
     uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
     uint32_t eflags;
@@ -168,6 +171,14 @@ static inline void x86_clts(void) {__asm__ __volatile__ ("clts"); }
 static inline void x86_hlt(void) {__asm__ __volatile__ ("hlt"); }
 static inline void x86_sti(void) {__asm__ __volatile__ ("sti"); }
 static inline void x86_cli(void) {__asm__ __volatile__ ("cli"); }
+static inline void x86_monitor(volatile void *addr)
+{
+    __asm__ __volatile__ ("monitor" :: "a" (addr), "c" (0), "d" (0));
+}
+static inline void x86_mwait(uint32_t hint, uint32_t extensions)
+{
+    __asm__ __volatile__ ("mwait" :: "a" (hint), "c" (extensions) : "memory");
+}
 static inline void x86_ltr(uint16_t sel)
 {
     __asm__ __volatile__ ("ltr %%ax" :: "a" (sel));
@@ -25,8 +25,11 @@ struct cpuid_leaf {
 
 enum x86_cpuid_leaf_num {
     X86_CPUID_BASE = 0,
+    X86_CPUID_MWAIT = 0x5,
+    X86_CPUID_PERFMON = 0xa,
     X86_CPUID_TOPOLOGY = 0xb,
     X86_CPUID_XSAVE = 0xd,
+    X86_CPUID_TSC = 0x15,
 
     X86_CPUID_EXT_BASE = 0x80000000,
     X86_CPUID_ADDR_WIDTH = 0x80000008,
@@ -90,7 +93,9 @@ void x86_feature_debug(void);
 
 /* add feature bits to test here */
 #define X86_FEATURE_SSE3         X86_CPUID_BIT(0x1, 2, 0)
+#define X86_FEATURE_MON          X86_CPUID_BIT(0x1, 2, 3)
 #define X86_FEATURE_SSSE3        X86_CPUID_BIT(0x1, 2, 9)
+#define X86_FEATURE_PCID         X86_CPUID_BIT(0x1, 2, 17)
 #define X86_FEATURE_SSE4_1       X86_CPUID_BIT(0x1, 2, 19)
 #define X86_FEATURE_SSE4_2       X86_CPUID_BIT(0x1, 2, 20)
 #define X86_FEATURE_TSC_DEADLINE X86_CPUID_BIT(0x1, 2, 24)
@@ -103,12 +108,18 @@ void x86_feature_debug(void);
 #define X86_FEATURE_FXSR         X86_CPUID_BIT(0x1, 3, 24)
 #define X86_FEATURE_SSE          X86_CPUID_BIT(0x1, 3, 25)
 #define X86_FEATURE_SSE2         X86_CPUID_BIT(0x1, 3, 26)
+#define X86_FEATURE_MWAIT_INTR   X86_CPUID_BIT(0x5, 2, 1)
+#define X86_FEATURE_ARAT         X86_CPUID_BIT(0x6, 0, 2)
 #define X86_FEATURE_TSC_ADJUST   X86_CPUID_BIT(0x7, 1, 1)
 #define X86_FEATURE_AVX2         X86_CPUID_BIT(0x7, 1, 5)
 #define X86_FEATURE_SMEP         X86_CPUID_BIT(0x7, 1, 7)
+#define X86_FEATURE_ERMS         X86_CPUID_BIT(0x7, 1, 9)
+#define X86_FEATURE_INVPCID      X86_CPUID_BIT(0x7, 1, 10)
 #define X86_FEATURE_RDSEED       X86_CPUID_BIT(0x7, 1, 18)
 #define X86_FEATURE_SMAP         X86_CPUID_BIT(0x7, 1, 20)
+#define X86_FEATURE_SHA          X86_CPUID_BIT(0x7, 1, 29)
 #define X86_FEATURE_PKU          X86_CPUID_BIT(0x7, 2, 3)
+#define X86_FEATURE_FSRM         X86_CPUID_BIT(0x7, 3, 4)
 #define X86_FEATURE_SYSCALL      X86_CPUID_BIT(0x80000001, 3, 11)
 #define X86_FEATURE_NX           X86_CPUID_BIT(0x80000001, 3, 20)
 #define X86_FEATURE_HUGE_PAGE    X86_CPUID_BIT(0x80000001, 3, 26)
@@ -57,11 +57,19 @@ struct x86_percpu {
     /* CPU number */
     uint8_t cpu_num;
 
+    /* X86_IDLE_*, lets another cpu wake this one out of mwait with a store
+     * instead of an IPI. fits in the padding before default_tss. */
+    volatile int idle_state;
+
     /* This CPU's default TSS */
     tss_t __ALIGNED(16) default_tss;
 
     /* The IDT for this CPU */
     struct idt idt;
+
+    /* the thread whose extended register state is in this cpu's registers
+     * and matches what was last saved for it, if any */
+    struct thread *extended_register_owner;
 #ifdef ARCH_X86_64
     /* Reserved space for interrupt stacks */
     uint8_t interrupt_stacks[NUM_ASSIGNED_IST_ENTRIES][PAGE_SIZE];
@@ -77,11 +85,26 @@ STATIC_ASSERT(__offsetof(struct x86_percpu, default_tss) == PERCPU_DEFAULT_TSS_O
 /* needs to be run very early in the boot process from start.S and as each cpu is brought up */
 void x86_init_percpu(uint8_t cpu_num);
 
+/* values of x86_percpu.idle_state */
+#define X86_IDLE_BUSY   0 /* running, or idling in hlt */
+#define X86_IDLE_MWAIT  1 /* monitoring idle_state in mwait */
+#define X86_IDLE_WAKE   2 /* told to reschedule while in mwait */
+
+/* pick the idle instruction and C-states once the cpuid leaves are cached */
+void x86_idle_init(void);
+
+/* wake the cpu if it is idling in mwait. returns false if it wasn't, in which
+ * case it needs an IPI instead. */
+bool x86_idle_wake(struct x86_percpu *percpu);
+
 /* used to set the bootstrap processor's apic_id once the APIC is initialized */
 void x86_set_local_apic_id(uint32_t apic_id);
 
 int x86_apic_id_to_cpu_num(uint32_t apic_id);
 
+/* returns INVALID_APIC_ID if cpu_num is not a cpu in the system */
+uint32_t x86_cpu_num_to_apic_id(uint cpu_num);
+
 // Allocate all of the necessary structures for all of the APs to run.
 status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count);
 
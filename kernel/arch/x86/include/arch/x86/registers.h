@@ -20,9 +20,12 @@
 #define X86_CR4_PGE                     0x00000080 /* page global enable */
 #define X86_CR4_OSFXSR                  0x00000200 /* os supports fxsave */
 #define X86_CR4_OSXMMEXPT               0x00000400 /* os supports xmm exception */
+#define X86_CR4_PCIDE                   0x00020000 /* process-context identifiers */
 #define X86_CR4_OSXSAVE                 0x00040000 /* os supports xsave */
 #define X86_CR4_SMEP                    0x00100000 /* SMEP protection enabling */
 #define X86_CR4_SMAP                    0x00200000 /* SMAP protection enabling */
+#define X86_CR3_PCID_MASK               0x00000fff /* pcid of the loaded page table */
+#define X86_CR3_NOFLUSH                 0x8000000000000000 /* keep pcid's tlb entries on load */
 #define X86_EFER_SCE                    0x00000001 /* enable SYSCALL */
 #define X86_EFER_LME                    0x00000100 /* long mode enable */
 #define X86_EFER_LMA                    0x00000400 /* long mode active */
@@ -0,0 +1,36 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+/* bits of x86_string_features, which memcpy(), memmove() and memset() look at
+ * to pick a variant */
+#define X86_STRING_ERMS (1 << 0)    /* enhanced rep movsb/stosb */
+#define X86_STRING_FSRM (1 << 1)    /* fast short rep movsb */
+
+/* without FSRM, rep movsb/stosb only beats rep movsq/stosq from about here */
+#define X86_STRING_ERMS_MIN 256
+
+#ifndef ASSEMBLY
+
+#include <compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+/* set up by x86_feature_init(), 0 until then */
+extern uint8_t x86_string_features;
+
+/* the variants behind memcpy() and memset(), for benchmarks to compare */
+void *memcpy_quad(void *dest, const void *src, size_t n);
+void *memcpy_erms(void *dest, const void *src, size_t n);
+void *memset_quad(void *s, int c, size_t n);
+void *memset_erms(void *s, int c, size_t n);
+
+__END_CDECLS
+
+#endif // ASSEMBLY
@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 
 #pragma once
+#include <arch/user_copy.h>
 #include <compiler.h>
 
 __BEGIN_CDECLS
@@ -28,4 +29,20 @@ status_t _x86_copy_to_user(
         bool smap_avail,
         void **fault_return);
 
+/* Copy a single value of 1, 2, 4 or 8 bytes, in either direction. The caller
+ * checks the user address. */
+status_t _x86_copy_user_fixed_1(void *dst, const void *src, bool smap_avail,
+                                void **fault_return);
+status_t _x86_copy_user_fixed_2(void *dst, const void *src, bool smap_avail,
+                                void **fault_return);
+status_t _x86_copy_user_fixed_4(void *dst, const void *src, bool smap_avail,
+                                void **fault_return);
+status_t _x86_copy_user_fixed_8(void *dst, const void *src, bool smap_avail,
+                                void **fault_return);
+
+/* Copy every piece of vec, in either direction. The caller checks the user
+ * addresses. */
+status_t _x86_copy_user_many(const user_copy_vec_t *vec, size_t count,
+                             bool smap_avail, void **fault_return);
+
 __END_CDECLS
@@ -236,8 +236,21 @@ static status_t apic_timer_set_divide_value(uint8_t v) {
     return NO_ERROR;
 }
 
+// What each cpu last wrote to its LVT timer register, so rearming a TSC
+// deadline only has to write the MSR.
+static uint32_t lvt_timer[SMP_MAX_CPUS];
+
+static void apic_timer_set_lvt(uint32_t timer_config) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    *LVT_TIMER_ADDR = timer_config;
+    lvt_timer[arch_curr_cpu_num()] = timer_config;
+}
+
 static void apic_timer_init(void) {
-    *LVT_TIMER_ADDR = LVT_VECTOR(X86_INT_APIC_TIMER) | LVT_MASKED;
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, 0);
+    apic_timer_set_lvt(LVT_VECTOR(X86_INT_APIC_TIMER) | LVT_MASKED);
+    arch_interrupt_restore(state, 0);
 }
 
 // Racy; primarily useful for calibrating the timer.
@@ -248,14 +261,14 @@ uint32_t apic_timer_current_count(void) {
 void apic_timer_mask(void) {
     spin_lock_saved_state_t state;
     arch_interrupt_save(&state, 0);
-    *LVT_TIMER_ADDR |= LVT_MASKED;
+    apic_timer_set_lvt(*LVT_TIMER_ADDR | LVT_MASKED);
     arch_interrupt_restore(state, 0);
 }
 
 void apic_timer_unmask(void) {
     spin_lock_saved_state_t state;
     arch_interrupt_save(&state, 0);
-    *LVT_TIMER_ADDR &= ~LVT_MASKED;
+    apic_timer_set_lvt(*LVT_TIMER_ADDR & ~LVT_MASKED);
     arch_interrupt_restore(state, 0);
 }
 
@@ -274,7 +287,7 @@ status_t apic_timer_set_oneshot(uint32_t count, uint8_t divisor, bool masked) {
     uint32_t timer_config = LVT_VECTOR(X86_INT_APIC_TIMER) |
             LVT_TIMER_MODE_ONESHOT;
     if (masked) {
-        timer_config |= masked;
+        timer_config |= LVT_MASKED;
     }
 
     spin_lock_saved_state_t state;
@@ -285,7 +298,7 @@ status_t apic_timer_set_oneshot(uint32_t count, uint8_t divisor, bool masked) {
         goto cleanup;
     }
     *INIT_COUNT_ADDR = count;
-    *LVT_TIMER_ADDR = timer_config;
+    apic_timer_set_lvt(timer_config);
 cleanup:
     arch_interrupt_restore(state, 0);
     return status;
@@ -297,14 +310,20 @@ void apic_timer_set_tsc_deadline(uint64_t deadline, bool masked) {
     uint32_t timer_config = LVT_VECTOR(X86_INT_APIC_TIMER) |
             LVT_TIMER_MODE_TSC_DEADLINE;
     if (masked) {
-        timer_config |= masked;
+        timer_config |= LVT_MASKED;
     }
 
     spin_lock_saved_state_t state;
     arch_interrupt_save(&state, 0);
 
+    // The MSR ignores writes until the timer is in TSC deadline mode, and
+    // the switch has to be visible before the MSR write, which doesn't order
+    // against the MMIO write on its own.
+    if (lvt_timer[arch_curr_cpu_num()] != timer_config) {
+        apic_timer_set_lvt(timer_config);
+        __asm__ volatile("mfence" ::: "memory");
+    }
     write_msr(IA32_TSC_DEADLINE_MSR, deadline);
-    *LVT_TIMER_ADDR = timer_config;
 
     arch_interrupt_restore(state, 0);
 }
@@ -319,12 +338,20 @@ status_t apic_timer_set_periodic(uint32_t count, uint8_t divisor) {
         goto cleanup;
     }
     *INIT_COUNT_ADDR = count;
-    *LVT_TIMER_ADDR = LVT_VECTOR(X86_INT_APIC_TIMER) | LVT_TIMER_MODE_PERIODIC;
+    apic_timer_set_lvt(LVT_VECTOR(X86_INT_APIC_TIMER) | LVT_TIMER_MODE_PERIODIC);
 cleanup:
     arch_interrupt_restore(state, 0);
     return status;
 }
 
+void apic_pmi_mask(void) {
+    *LVT_PERF_ADDR = LVT_VECTOR(X86_INT_APIC_PMI) | LVT_MASKED;
+}
+
+void apic_pmi_unmask(void) {
+    *LVT_PERF_ADDR = LVT_VECTOR(X86_INT_APIC_PMI);
+}
+
 // TODO: Where should this declaration go
 extern enum handler_return platform_handle_timer_tick(void);
 enum handler_return apic_timer_interrupt_handler(void) {
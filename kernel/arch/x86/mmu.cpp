@@ -322,7 +322,68 @@ static inline bool page_aligned(vaddr_t vaddr) {
     return (vaddr & (page_size<Level>() - 1)) == 0;
 }
 
+#if ARCH_X86_64
+/* Process-context identifiers tag TLB entries with the aspace they belong to,
+ * so switching between user aspaces doesn't throw the TLB away. PCID 0 is
+ * shared by the kernel aspace and any user aspaces that find the others all
+ * taken, and is always flushed when loaded. */
+#define X86_PCID_COUNT 4096
+
+static bool g_pcid_enabled;
+static bool g_invpcid_supported;
+
+static spin_lock_t pcid_lock = SPIN_LOCK_INITIAL_VALUE;
+static uint64_t pcid_bitmap[X86_PCID_COUNT / 64] = { 1 }; /* pcid 0 is reserved */
+
+static uint16_t pcid_alloc(void) {
+    uint16_t pcid = 0;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&pcid_lock, state);
+    for (uint i = 0; i < countof(pcid_bitmap); i++) {
+        if (~pcid_bitmap[i]) {
+            uint bit = __builtin_ctzll(~pcid_bitmap[i]);
+            pcid_bitmap[i] |= 1ULL << bit;
+            pcid = (uint16_t)(i * 64 + bit);
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pcid_lock, state);
+
+    return pcid;
+}
+
+static void pcid_free(uint16_t pcid) {
+    if (pcid == 0)
+        return;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&pcid_lock, state);
+    pcid_bitmap[pcid / 64] &= ~(1ULL << (pcid % 64));
+    spin_unlock_irqrestore(&pcid_lock, state);
+}
+
+#define INVPCID_TYPE_ADDRESS 0
+#define INVPCID_TYPE_CONTEXT 1
+#define INVPCID_TYPE_ALL_GLOBAL 2
+
+static inline void x86_invpcid(uint64_t type, uint16_t pcid, vaddr_t vaddr) {
+    struct {
+        uint64_t pcid;
+        uint64_t vaddr;
+    } desc = { pcid, vaddr };
+    __asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(type) : "memory");
+}
+#endif
+
 static void tlb_global_invalidate() {
+#if ARCH_X86_64
+    if (g_invpcid_supported) {
+        x86_invpcid(INVPCID_TYPE_ALL_GLOBAL, 0, 0);
+        return;
+    }
+#endif
+
     /* See Intel 3A section 4.10.4.1 */
     ulong cr4 = x86_get_cr4();
     if (likely(cr4 & X86_CR4_PGE)) {
@@ -333,59 +394,165 @@ static void tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct tlb_invalidate_page_context {
+/* TLB invalidations collected over a single map, unmap or protect operation,
+ * so the whole operation costs one round of IPIs instead of one per page.
+ * Past TLB_PENDING_MAX pages it is cheaper to flush the whole TLB. */
+#define TLB_PENDING_MAX 32
+
+struct PendingTlbInvalidation {
+    /* the aspace being modified, NULL for the early boot page tables */
+    arch_aspace_t* aspace;
+    /* the top-level page table physical address being modified */
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+
+    /* flush the whole TLB rather than the individual pages */
+    bool full_shootdown;
+    /* at least one of the mappings is global */
+    bool contains_global;
+
+    uint count;
+    struct {
+        vaddr_t vaddr;
+        enum page_table_levels level;
+        bool global_page;
+    } items[TLB_PENDING_MAX];
+
+    /* page tables unlinked by the operation, which can't be freed until no
+     * cpu can be walking through them */
+    struct list_node freed_tables;
 };
-static void tlb_invalidate_page_task(void* raw_context) {
+
+static void tlb_pending_init(PendingTlbInvalidation* pending, arch_aspace_t* aspace, ulong cr3) {
+    pending->aspace = aspace;
+    pending->target_cr3 = cr3;
+    pending->full_shootdown = false;
+    pending->contains_global = false;
+    pending->count = 0;
+    list_initialize(&pending->freed_tables);
+}
+
+static void tlb_pending_enqueue(PendingTlbInvalidation* pending, vaddr_t vaddr,
+                                enum page_table_levels level, bool global_page) {
+    if (global_page)
+        pending->contains_global = true;
+
+#if X86_PAGING_LEVELS > 3
+    /* a top level entry covers too much to go page by page */
+    if (level == PML4_L) {
+        pending->full_shootdown = true;
+        pending->contains_global = true;
+    }
+#endif
+
+    if (pending->full_shootdown)
+        return;
+
+    if (pending->count == TLB_PENDING_MAX) {
+        pending->full_shootdown = true;
+        return;
+    }
+
+    pending->items[pending->count].vaddr = vaddr;
+    pending->items[pending->count].level = level;
+    pending->items[pending->count].global_page = global_page;
+    pending->count++;
+}
+
+/* Task used for invalidating the pending TLB entries on each CPU */
+static void tlb_invalidate_pending_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    PendingTlbInvalidation* pending = (PendingTlbInvalidation*)raw_context;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
-        /* This invalidation doesn't apply to this CPU, ignore it */
+    bool current_aspace = (pending->target_cr3 == (cr3 & ~(ulong)X86_CR3_PCID_MASK));
+
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
+            tlb_global_invalidate();
+        } else if (current_aspace) {
+#if ARCH_X86_64
+            if (g_invpcid_supported) {
+                x86_invpcid(INVPCID_TYPE_CONTEXT, cr3 & X86_CR3_PCID_MASK, 0);
+                return;
+            }
+#endif
+            /* reloading cr3 drops every non-global entry of the current pcid */
+            x86_set_cr3(cr3);
+        }
         return;
     }
 
-    switch (context->level) {
+    for (uint i = 0; i < pending->count; i++) {
+        if (!current_aspace && !pending->items[i].global_page) {
+            /* This invalidation doesn't apply to this CPU, ignore it */
+            continue;
+        }
+
+        switch (pending->items[i].level) {
 #if X86_PAGING_LEVELS > 3
-        case PML4_L:
-            tlb_global_invalidate();
-            break;
+            case PML4_L:
+                tlb_global_invalidate();
+                break;
 #endif
 #if X86_PAGING_LEVELS > 2
-        case PDP_L:
+            case PDP_L:
 #endif
-        case PD_L:
-        case PT_L:
-            __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-            break;
+            case PD_L:
+            case PT_L:
+                __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)pending->items[i].vaddr));
+                break;
+        }
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
- *
- * @param cr3 The top-level page table physical address we are performing an invalidation on
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * @brief Execute the invalidations collected in pending and free any page
+ * tables it was holding on to
  *
- * TODO(teisenbe): Optimize this.  This is horrible inefficient on several
- * levels.  We can easily check what CPUs are currently using this page table,
- * and so cut out the spurious IPIs.  We should also change this to pool
- * invalidations from a single "transaction" and then only execute a single
- * mp_sync_exec for that transaction, rather than one per page.
+ * Global mappings and the kernel aspaces are shot down on every CPU. User
+ * aspaces only need to interrupt the CPUs that have them loaded; a CPU that
+ * switches to the aspace afterwards loads the updated tables with its cr3.
+ * With PCIDs, CPUs that ran the aspace earlier may still hold entries tagged
+ * with its pcid, so they are made to flush them the next time they load it.
  */
-void x86_tlb_invalidate_page(ulong cr3, vaddr_t vaddr, enum page_table_levels level,
-                             bool global_page) {
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
-    };
-    mp_sync_exec(MP_CPU_ALL, tlb_invalidate_page_task, &task_context);
+static void x86_tlb_invalidate(PendingTlbInvalidation* pending) {
+#if ARCH_X86_64
+    /* invlpg only drops the paging structure caches of the current pcid, and
+     * every user pcid may be caching the shared kernel tables */
+    if (g_pcid_enabled && !list_is_empty(&pending->freed_tables) &&
+        (!pending->aspace || (pending->aspace->flags & ARCH_ASPACE_FLAG_KERNEL))) {
+        pending->full_shootdown = true;
+        pending->contains_global = true;
+    }
+#endif
+
+    if (pending->count > 0 || pending->full_shootdown) {
+        mp_cpu_mask_t targets = MP_CPU_ALL;
+        if (!pending->contains_global && pending->aspace &&
+            !(pending->aspace->flags & ARCH_ASPACE_FLAG_KERNEL)) {
+            /* order the page table updates before reading the masks, pairing
+             * with the atomic updates in arch_mmu_context_switch */
+            smp_mb();
+#if ARCH_X86_64
+            /* this has to come before sampling the active cpus, so that a cpu
+             * loading the aspace concurrently either flushes or gets an IPI */
+            if (pending->aspace->pcid != 0)
+                atomic_and(&pending->aspace->pcid_cpus, 0);
+#endif
+            targets = (mp_cpu_mask_t)pending->aspace->active_cpus;
+        }
+
+        if (targets != 0)
+            mp_sync_exec(targets, tlb_invalidate_pending_task, pending);
+    }
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&pending->freed_tables, vm_page_t, node)))
+        pmm_free_page(page);
+
+    pending->full_shootdown = false;
+    pending->contains_global = false;
+    pending->count = 0;
 }
 
 struct MappingCursor {
@@ -395,7 +562,7 @@ struct MappingCursor {
 };
 
 template <int Level>
-static void update_entry(ulong cr3, vaddr_t vaddr, pt_entry_t* pte, paddr_t paddr,
+static void update_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte, paddr_t paddr,
                          arch_flags_t flags) {
 
     DEBUG_ASSERT(pte);
@@ -409,12 +576,12 @@ static void update_entry(ulong cr3, vaddr_t vaddr, pt_entry_t* pte, paddr_t padd
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        x86_tlb_invalidate_page(cr3, vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
+        tlb_pending_enqueue(pending, vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
     }
 }
 
 template <int Level>
-static void unmap_entry(ulong cr3, vaddr_t vaddr, pt_entry_t* pte, bool flush) {
+static void unmap_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte, bool flush) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
@@ -423,7 +590,7 @@ static void unmap_entry(ulong cr3, vaddr_t vaddr, pt_entry_t* pte, bool flush) {
 
     /* attempt to invalidate the page */
     if (flush && IS_PAGE_PRESENT(olde)) {
-        x86_tlb_invalidate_page(cr3, vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
+        tlb_pending_enqueue(pending, vaddr, (page_table_levels)Level, is_kernel_address(vaddr));
     }
 }
 
@@ -443,7 +610,7 @@ static pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 template <int Level>
-static status_t x86_mmu_split(ulong cr3, vaddr_t vaddr, pt_entry_t* pte) {
+static status_t x86_mmu_split(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte) {
     static_assert(Level != PT_L, "tried splitting PT_L");
 #if X86_PAGING_LEVELS > 3
     // This can't easily be a static assert without duplicating
@@ -482,14 +649,14 @@ static status_t x86_mmu_split(ulong cr3, vaddr_t vaddr, pt_entry_t* pte) {
         pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        update_entry<Level - 1>(cr3, new_vaddr, e, new_paddr, flags);
+        update_entry<Level - 1>(pending, new_vaddr, e, new_paddr, flags);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + page_size<Level>());
 
     flags = get_x86_intermediate_arch_flags();
-    update_entry<Level>(cr3, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    update_entry<Level>(pending, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
     return NO_ERROR;
 }
 
@@ -576,7 +743,7 @@ status_t x86_mmu_get_mapping<PT_L>(pt_entry_t* table, vaddr_t vaddr,
  *
  * Level must be MAX_PAGING_LEVEL when invoked.
  *
- * @param cr3 The top-level paging structure's physical address
+ * @param pending Collects the TLB invalidations the operation requires
  * @param table The top-level paging structure's virtual address
  * @param start_cursor A cursor describing the range of address space to
  * unmap within table
@@ -586,7 +753,7 @@ status_t x86_mmu_get_mapping<PT_L>(pt_entry_t* table, vaddr_t vaddr,
  * @return true if at least one page was unmapped at this level
  */
 template <int Level>
-static bool x86_mmu_remove_mapping(ulong cr3, pt_entry_t* table, const MappingCursor& start_cursor,
+static bool x86_mmu_remove_mapping(PendingTlbInvalidation* pending, pt_entry_t* table, const MappingCursor& start_cursor,
                                    MappingCursor* new_cursor) {
     static_assert(Level >= 0, "level too low");
     static_assert(Level < X86_PAGING_LEVELS, "level too high");
@@ -621,7 +788,7 @@ static bool x86_mmu_remove_mapping(ulong cr3, pt_entry_t* table, const MappingCu
             bool vaddr_level_aligned = page_aligned<Level>(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                unmap_entry<Level>(cr3, new_cursor->vaddr, e, true);
+                unmap_entry<Level>(pending, new_cursor->vaddr, e, true);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -631,7 +798,7 @@ static bool x86_mmu_remove_mapping(ulong cr3, pt_entry_t* table, const MappingCu
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            status_t status = x86_mmu_split<Level>(cr3, page_vaddr, e);
+            status_t status = x86_mmu_split<Level>(pending, page_vaddr, e);
             if (status != NO_ERROR) {
                 panic("Need to implement recovery from split failure");
             }
@@ -640,7 +807,7 @@ static bool x86_mmu_remove_mapping(ulong cr3, pt_entry_t* table, const MappingCu
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         bool lower_unmapped = x86_mmu_remove_mapping<Level - 1>(
-                cr3, next_table, *new_cursor, &cursor);
+                pending, next_table, *new_cursor, &cursor);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -660,8 +827,9 @@ static bool x86_mmu_remove_mapping(ulong cr3, pt_entry_t* table, const MappingCu
             }
         }
         if (unmap_page_table) {
-            unmap_entry<Level>(cr3, new_cursor->vaddr, e, false);
-            pmm_free_page(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
+            unmap_entry<Level>(pending, new_cursor->vaddr, e, false);
+            vm_page_t* page = paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table));
+            list_add_tail(&pending->freed_tables, &page->node);
             unmapped = true;
         }
         *new_cursor = cursor;
@@ -675,7 +843,7 @@ static bool x86_mmu_remove_mapping(ulong cr3, pt_entry_t* table, const MappingCu
 
 // Base case of x86_remove_mapping for smallest page size
 template <>
-bool x86_mmu_remove_mapping<PT_L>(ulong cr3, pt_entry_t* table, const MappingCursor& start_cursor,
+bool x86_mmu_remove_mapping<PT_L>(PendingTlbInvalidation* pending, pt_entry_t* table, const MappingCursor& start_cursor,
                                   MappingCursor* new_cursor) {
 
     LTRACEF("%016lx %016lx\n", start_cursor.vaddr, start_cursor.size);
@@ -688,7 +856,7 @@ bool x86_mmu_remove_mapping<PT_L>(ulong cr3, pt_entry_t* table, const MappingCur
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            unmap_entry<PT_L>(cr3, new_cursor->vaddr, e, true);
+            unmap_entry<PT_L>(pending, new_cursor->vaddr, e, true);
             unmapped = true;
         }
 
@@ -704,7 +872,7 @@ bool x86_mmu_remove_mapping<PT_L>(ulong cr3, pt_entry_t* table, const MappingCur
  *
  * Level must be MAX_PAGING_LEVEL when invoked.
  *
- * @param cr3 The top-level paging structure's physical address
+ * @param pending Collects the TLB invalidations the operation requires
  * @param table The top-level paging structure's virtual address
  * @param start_cursor A cursor describing the range of address space to
  * act on within table
@@ -716,7 +884,7 @@ bool x86_mmu_remove_mapping<PT_L>(ulong cr3, pt_entry_t* table, const MappingCur
  * @return ERR_NO_MEMORY if intermediate page tables could not be allocated
  */
 template <int Level>
-static status_t x86_mmu_add_mapping(ulong cr3, pt_entry_t* table, uint mmu_flags,
+static status_t x86_mmu_add_mapping(PendingTlbInvalidation* pending, pt_entry_t* table, uint mmu_flags,
                                     const MappingCursor& start_cursor, MappingCursor* new_cursor) {
     static_assert(Level >= 0, "level too low");
     static_assert(Level < X86_PAGING_LEVELS, "level too high");
@@ -748,7 +916,7 @@ static status_t x86_mmu_add_mapping(ulong cr3, pt_entry_t* table, uint mmu_flags
         if (level_supports_large_pages && !IS_PAGE_PRESENT(*e) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            update_entry<Level>(cr3, new_cursor->vaddr, table + index, new_cursor->paddr,
+            update_entry<Level>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                 arch_flags | X86_MMU_PG_PS);
 
             new_cursor->paddr += ps;
@@ -766,12 +934,12 @@ static status_t x86_mmu_add_mapping(ulong cr3, pt_entry_t* table, uint mmu_flags
 
                 LTRACEF_LEVEL(2, "new table %p at level %u\n", m, Level);
 
-                update_entry<Level>(cr3, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
+                update_entry<Level>(pending, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
                                     interm_arch_flags);
             }
 
             MappingCursor cursor;
-            ret = x86_mmu_add_mapping<Level - 1>(cr3, get_next_table_from_entry(*e), mmu_flags,
+            ret = x86_mmu_add_mapping<Level - 1>(pending, get_next_table_from_entry(*e), mmu_flags,
                                                  *new_cursor, &cursor);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
@@ -788,7 +956,7 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(cr3, table, cursor, &result);
+            x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(pending, table, cursor, &result);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -797,7 +965,7 @@ err:
 
 // Base case of x86_mmu_add_mapping for smallest page size
 template <>
-status_t x86_mmu_add_mapping<PT_L>(ulong cr3, pt_entry_t* table, uint mmu_flags,
+status_t x86_mmu_add_mapping<PT_L>(PendingTlbInvalidation* pending, pt_entry_t* table, uint mmu_flags,
                                    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
 
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -813,7 +981,7 @@ status_t x86_mmu_add_mapping<PT_L>(ulong cr3, pt_entry_t* table, uint mmu_flags,
             return ERR_ALREADY_EXISTS;
         }
 
-        update_entry<PT_L>(cr3, new_cursor->vaddr, table + index, new_cursor->paddr, arch_flags);
+        update_entry<PT_L>(pending, new_cursor->vaddr, table + index, new_cursor->paddr, arch_flags);
 
         new_cursor->paddr += PAGE_SIZE;
         new_cursor->vaddr += PAGE_SIZE;
@@ -829,7 +997,7 @@ status_t x86_mmu_add_mapping<PT_L>(ulong cr3, pt_entry_t* table, uint mmu_flags,
  *
  * Level must be MAX_PAGING_LEVEL when invoked.
  *
- * @param cr3 The top-level paging structure's physical address
+ * @param pending Collects the TLB invalidations the operation requires
  * @param table The top-level paging structure's virtual address
  * @param start_cursor A cursor describing the range of address space to
  * act on within table
@@ -837,7 +1005,7 @@ status_t x86_mmu_add_mapping<PT_L>(ulong cr3, pt_entry_t* table, uint mmu_flags,
  * completed.  Must be non-null.
  */
 template <int Level>
-static status_t x86_mmu_update_mapping(ulong cr3, pt_entry_t* table, uint mmu_flags,
+static status_t x86_mmu_update_mapping(PendingTlbInvalidation* pending, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
                                        MappingCursor* new_cursor) {
     static_assert(Level >= 0, "level too low");
@@ -866,7 +1034,7 @@ static status_t x86_mmu_update_mapping(ulong cr3, pt_entry_t* table, uint mmu_fl
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                update_entry<Level>(cr3, new_cursor->vaddr, e, paddr_from_pte<Level>(*e),
+                update_entry<Level>(pending, new_cursor->vaddr, e, paddr_from_pte<Level>(*e),
                                     arch_flags | X86_MMU_PG_PS);
 
                 new_cursor->vaddr += ps;
@@ -876,7 +1044,7 @@ static status_t x86_mmu_update_mapping(ulong cr3, pt_entry_t* table, uint mmu_fl
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = x86_mmu_split<Level>(cr3, page_vaddr, e);
+            ret = x86_mmu_split<Level>(pending, page_vaddr, e);
             if (ret != NO_ERROR) {
                 goto err;
             }
@@ -884,7 +1052,7 @@ static status_t x86_mmu_update_mapping(ulong cr3, pt_entry_t* table, uint mmu_fl
 
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
-        ret = x86_mmu_update_mapping<Level - 1>(cr3, next_table, mmu_flags, *new_cursor, &cursor);
+        ret = x86_mmu_update_mapping<Level - 1>(pending, next_table, mmu_flags, *new_cursor, &cursor);
         *new_cursor = cursor;
         if (ret != NO_ERROR) {
             goto err;
@@ -901,7 +1069,7 @@ err:
 
 // Base case of x86_update_mapping for smallest page size
 template <>
-status_t x86_mmu_update_mapping<PT_L>(ulong cr3, pt_entry_t* table, uint mmu_flags,
+status_t x86_mmu_update_mapping<PT_L>(PendingTlbInvalidation* pending, pt_entry_t* table, uint mmu_flags,
                                       const MappingCursor& start_cursor,
                                       MappingCursor* new_cursor) {
 
@@ -919,7 +1087,7 @@ status_t x86_mmu_update_mapping<PT_L>(ulong cr3, pt_entry_t* table, uint mmu_fla
             // TODO: Cleanup
             return ERR_NOT_FOUND;
         }
-        update_entry<PT_L>(cr3, new_cursor->vaddr, e, paddr_from_pte<PT_L>(*e), arch_flags);
+        update_entry<PT_L>(pending, new_cursor->vaddr, e, paddr_from_pte<PT_L>(*e), arch_flags);
 
         new_cursor->vaddr += PAGE_SIZE;
         new_cursor->size -= PAGE_SIZE;
@@ -944,8 +1112,12 @@ int arch_mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, size_t count) {
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
 
+    PendingTlbInvalidation pending;
+    tlb_pending_init(&pending, aspace, aspace->pt_phys);
+
     MappingCursor result;
-    x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(aspace->pt_phys, aspace->pt_virt, start, &result);
+    x86_mmu_remove_mapping<MAX_PAGING_LEVEL>(&pending, aspace->pt_virt, start, &result);
+    x86_tlb_invalidate(&pending);
     DEBUG_ASSERT(result.size == 0);
     return NO_ERROR;
 }
@@ -967,9 +1139,13 @@ int arch_mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, size_t cou
     MappingCursor start = {
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
+    PendingTlbInvalidation pending;
+    tlb_pending_init(&pending, aspace, aspace->pt_phys);
+
     MappingCursor result;
-    status_t status = x86_mmu_add_mapping<MAX_PAGING_LEVEL>(aspace->pt_phys, aspace->pt_virt, flags,
+    status_t status = x86_mmu_add_mapping<MAX_PAGING_LEVEL>(&pending, aspace->pt_virt, flags,
                                                             start, &result);
+    x86_tlb_invalidate(&pending);
     if (status != NO_ERROR) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -991,9 +1167,13 @@ int arch_mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count, uint fl
     MappingCursor start = {
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
+    PendingTlbInvalidation pending;
+    tlb_pending_init(&pending, aspace, aspace->pt_phys);
+
     MappingCursor result;
-    status_t status = x86_mmu_update_mapping<MAX_PAGING_LEVEL>(aspace->pt_phys, aspace->pt_virt,
+    status_t status = x86_mmu_update_mapping<MAX_PAGING_LEVEL>(&pending, aspace->pt_virt,
                                                                flags, start, &result);
+    x86_tlb_invalidate(&pending);
     if (status != NO_ERROR) {
         return status;
     }
@@ -1007,7 +1187,10 @@ void x86_mmu_early_init() {
 
 #if ARCH_X86_64
     /* unmap the lower identity mapping */
-    unmap_entry<PML4_L>(x86_get_cr3(), 0, &pml4[0], true);
+    PendingTlbInvalidation pending;
+    tlb_pending_init(&pending, NULL, x86_get_cr3());
+    unmap_entry<PML4_L>(&pending, 0, &pml4[0], true);
+    x86_tlb_invalidate(&pending);
 #else
     /* unmap the lower identity mapping */
     for (uint i = 0; i < (1 * GB) / (4 * MB); i++) {
@@ -1076,6 +1259,14 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
     }
     aspace->io_bitmap_ptr = NULL;
     spin_lock_init(&aspace->io_bitmap_lock);
+    aspace->active_cpus = 0;
+
+    aspace->pcid = 0;
+    aspace->pcid_cpus = 0;
+#if ARCH_X86_64
+    if (g_pcid_enabled && !(flags & ARCH_ASPACE_FLAG_KERNEL))
+        aspace->pcid = pcid_alloc();
+#endif
 
     return NO_ERROR;
 }
@@ -1108,16 +1299,39 @@ status_t arch_mmu_destroy_aspace(arch_aspace_t* aspace) {
 
     pmm_free_page(paddr_to_vm_page(aspace->pt_phys));
 
+#if ARCH_X86_64
+    /* the next aspace to get this pcid starts out with an empty cpu mask, so
+     * every cpu flushes whatever we left behind before using it */
+    pcid_free(aspace->pcid);
+#endif
+
     aspace->magic = 0;
 
     return NO_ERROR;
 }
 
 void arch_mmu_context_switch(arch_aspace_t *old_aspace, arch_aspace_t *aspace) {
+    int cpu_bit = 1 << arch_curr_cpu_num();
+
+    /* keep track of which cpus have each aspace loaded, for TLB shootdowns */
+    if (old_aspace != NULL)
+        atomic_and(&old_aspace->active_cpus, ~cpu_bit);
+
     if (aspace != NULL) {
+        atomic_or(&aspace->active_cpus, cpu_bit);
         DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
         LTRACEF_LEVEL(3, "switching to aspace %p, pt 0x%lx\n", aspace, aspace->pt_phys);
-        x86_set_cr3(aspace->pt_phys);
+        ulong cr3 = aspace->pt_phys;
+#if ARCH_X86_64
+        if (aspace->pcid != 0) {
+            /* keep the entries this cpu already has for the aspace, unless a
+             * shootdown has cleared our bit since they were loaded */
+            cr3 |= aspace->pcid;
+            if (atomic_or(&aspace->pcid_cpus, cpu_bit) & cpu_bit)
+                cr3 |= X86_CR3_NOFLUSH;
+        }
+#endif
+        x86_set_cr3(cr3);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt 0x%lx\n", kernel_pt_phys);
         x86_set_cr3(kernel_pt_phys);
@@ -1202,6 +1416,15 @@ void x86_mmu_percpu_init(void) {
     ulong cr4 = x86_get_cr4();
     if (x86_feature_test(X86_FEATURE_SMEP)) cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP)) cr4 |= X86_CR4_SMAP;
+#if ARCH_X86_64
+    /* PCIDs need the kernel page table, which is loaded with pcid 0 */
+    if (x86_feature_test(X86_FEATURE_PCID)) {
+        DEBUG_ASSERT((x86_get_cr3() & X86_CR3_PCID_MASK) == 0);
+        cr4 |= X86_CR4_PCIDE;
+        g_pcid_enabled = true;
+        g_invpcid_supported = x86_feature_test(X86_FEATURE_INVPCID);
+    }
+#endif
     x86_set_cr4(cr4);
 
     /* Set NXE bit in MSR_EFER*/
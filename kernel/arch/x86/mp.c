@@ -95,6 +95,9 @@ void x86_init_percpu(uint8_t cpu_num)
 #endif
 
     x86_feature_init();
+    if (cpu_num == 0) {
+        x86_idle_init();
+    }
     x86_extended_register_init();
     x86_extended_register_enable_feature(X86_EXTENDED_REGISTER_SSE);
     x86_extended_register_enable_feature(X86_EXTENDED_REGISTER_AVX);
@@ -168,6 +171,17 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id)
     return -1;
 }
 
+uint32_t x86_cpu_num_to_apic_id(uint cpu_num)
+{
+    if (cpu_num >= x86_num_cpus) {
+        return INVALID_APIC_ID;
+    }
+    if (cpu_num == 0) {
+        return bp_percpu.apic_id;
+    }
+    return ap_percpus[cpu_num - 1].apic_id;
+}
+
 #if WITH_SMP
 status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
 {
@@ -208,8 +222,11 @@ status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
             if (ipi != MP_IPI_RESCHEDULE) {
                 DEBUG_ASSERT(percpu->apic_id != INVALID_APIC_ID);
             }
-            /* Make sure the CPU is actually up before sending the IPI */
-            if (percpu->apic_id != INVALID_APIC_ID) {
+            /* Make sure the CPU is actually up before sending the IPI, and
+             * that a reschedule can't be done by a store to an idle cpu */
+            if (ipi == MP_IPI_RESCHEDULE && x86_idle_wake(percpu)) {
+                /* woken by the store */
+            } else if (percpu->apic_id != INVALID_APIC_ID) {
                 apic_send_ipi(vector, percpu->apic_id, DELIVERY_MODE_FIXED);
             }
         }
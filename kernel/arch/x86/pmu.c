@@ -0,0 +1,125 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/****************************************************************************
+ * Cycle sampling with the architectural performance counters, for ktrace's
+ * SAMPLE group.  General purpose counter 0 counts unhalted core cycles from
+ * minus the period, and its overflow interrupt records where the cpu was
+ * and restarts it.
+ ****************************************************************************/
+
+#include <arch/ops.h>
+#include <arch/x86.h>
+#include <arch/x86/apic.h>
+#include <arch/x86/descriptor.h>
+#include <arch/x86/feature.h>
+#include <err.h>
+#include <trace.h>
+
+#if WITH_LIB_KTRACE
+#include <lib/ktrace.h>
+
+#define LOCAL_TRACE 0
+
+#define IA32_PMC0                   0x0c1
+#define IA32_PERFEVTSEL0            0x186
+#define IA32_PERF_GLOBAL_CTRL       0x38f
+#define IA32_PERF_GLOBAL_OVF_CTRL   0x390
+
+#define PERFEVTSEL_USR      (1u << 16)
+#define PERFEVTSEL_OS       (1u << 17)
+#define PERFEVTSEL_INT      (1u << 20)
+#define PERFEVTSEL_EN       (1u << 22)
+
+/* the unhalted core cycles architectural event */
+#define EVENT_CORE_CYCLES   0x3c
+
+/* the same on every cpu, set before any starts sampling */
+static uint64_t sample_period;
+
+static uint pmu_version(void)
+{
+    const struct cpuid_leaf *leaf = x86_get_cpuid_leaf(X86_CPUID_PERFMON);
+    if (!leaf) {
+        return 0;
+    }
+    uint version = leaf->a & 0xff;
+    uint counters = (leaf->a >> 8) & 0xff;
+    uint events = (leaf->a >> 24) & 0xff;
+    /* an ebx bit set means the event is not available */
+    if (counters == 0 || events == 0 || (leaf->b & 1)) {
+        return 0;
+    }
+    return version;
+}
+
+/* counts up to overflow; wrmsr sign extends the low 32 bits, so the period
+ * is limited to 31 bits to load the whole counter */
+static void pmc0_load(void)
+{
+    write_msr(IA32_PMC0, -sample_period & 0xffffffffu);
+}
+
+status_t arch_pmu_sample_start(uint64_t period)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    uint version = pmu_version();
+    if (version == 0) {
+        return ERR_NOT_SUPPORTED;
+    }
+    if (period == 0 || period > INT32_MAX) {
+        return ERR_INVALID_ARGS;
+    }
+    sample_period = period;
+
+    write_msr(IA32_PERFEVTSEL0, 0);
+    pmc0_load();
+    apic_pmi_unmask();
+    if (version >= 2) {
+        write_msr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+        write_msr(IA32_PERF_GLOBAL_CTRL, read_msr(IA32_PERF_GLOBAL_CTRL) | 1);
+    }
+    write_msr(IA32_PERFEVTSEL0, EVENT_CORE_CYCLES | PERFEVTSEL_USR | PERFEVTSEL_OS |
+                                PERFEVTSEL_INT | PERFEVTSEL_EN);
+
+    LTRACEF("sampling every %llu cycles\n", period);
+    return NO_ERROR;
+}
+
+void arch_pmu_sample_stop(void)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    uint version = pmu_version();
+    if (version == 0) {
+        return;
+    }
+    write_msr(IA32_PERFEVTSEL0, 0);
+    apic_pmi_mask();
+    if (version >= 2) {
+        write_msr(IA32_PERF_GLOBAL_CTRL, read_msr(IA32_PERF_GLOBAL_CTRL) & ~1ull);
+        write_msr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    }
+}
+
+void x86_pmi_handler(x86_iframe_t *frame)
+{
+    bool user = SELECTOR_PL(frame->cs) != 0;
+    ktrace_sample(frame->ip, frame->rbp, user);
+
+    /* a stop may have raced with this interrupt, leave it stopped */
+    if (!(read_msr(IA32_PERFEVTSEL0) & PERFEVTSEL_EN)) {
+        return;
+    }
+    pmc0_load();
+    if (pmu_version() >= 2) {
+        write_msr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    }
+    apic_pmi_unmask();
+}
+
+#endif // WITH_LIB_KTRACE
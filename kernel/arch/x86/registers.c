@@ -17,6 +17,11 @@
  * 4) FXSAVE (can only save FPU/SSE registers)
  * 5) none (will not save any extended registers, will not allow enabling
  *          features that use extended registers.)
+ *
+ * The kernel itself is built without floating point or vector instructions,
+ * so a thread without a user address space never changes these registers.
+ * Context switches skip saving and restoring for those threads, and skip
+ * restoring a thread whose state is still in this cpu's registers.
  ****************************************************************************/
 
 #include <arch/ops.h>
@@ -114,6 +119,9 @@ static void x86_extended_register_cpu_init(void)
         xsetbv(0, X86_XSAVE_STATE_X87);
     }
 
+    /* whatever was in the registers is gone */
+    x86_get_percpu()->extended_register_owner = NULL;
+
     /* Enable the FPU */
     __UNUSED bool enabled = x86_extended_register_enable_feature(
             X86_EXTENDED_REGISTER_X87);
@@ -313,13 +321,8 @@ void x86_extended_register_save_state(void *register_state)
     }
 }
 
-void x86_extended_register_restore_state(void *register_state)
+static void restore_state(void *register_state)
 {
-    /* The idle threads have no extended register state */
-    if (unlikely(!register_state)) {
-        return;
-    }
-
     if (xsaves_supported) {
         xrstors(register_state, ~0ULL);
     } else if (xsave_supported) {
@@ -329,13 +332,53 @@ void x86_extended_register_restore_state(void *register_state)
     }
 }
 
+void x86_extended_register_restore_state(void *register_state)
+{
+    /* The idle threads have no extended register state */
+    if (unlikely(!register_state)) {
+        return;
+    }
+
+    restore_state(register_state);
+    x86_get_percpu()->extended_register_owner = NULL;
+}
+
+/* threads that never run in user mode keep their initial state */
+static inline bool uses_extended_registers(thread_t *t)
+{
+    return t->aspace && t->arch.extended_register_state;
+}
+
 void x86_extended_register_context_switch(
         thread_t *old_thread, thread_t *new_thread)
 {
-    if (likely(old_thread)) {
+    struct x86_percpu *percpu = x86_get_percpu();
+    int cpu = percpu->cpu_num;
+
+    if (likely(old_thread) && uses_extended_registers(old_thread)) {
+        /* XINUSE, the components not in their initial state */
+        if (xgetbv_1_supported && xgetbv(1)) {
+            old_thread->arch.extended_register_in_use++;
+        }
+        old_thread->arch.extended_register_saves++;
+
         x86_extended_register_save_state(old_thread->arch.extended_register_state);
+        old_thread->arch.extended_register_cpu = cpu;
+        percpu->extended_register_owner = old_thread;
+    }
+
+    if (!uses_extended_registers(new_thread)) {
+        return;
     }
-    x86_extended_register_restore_state(new_thread->arch.extended_register_state);
+    /* back on the cpu it left with nothing else loaded since */
+    if (percpu->extended_register_owner == new_thread &&
+        new_thread->arch.extended_register_cpu == cpu) {
+        return;
+    }
+
+    restore_state(new_thread->arch.extended_register_state);
+    new_thread->arch.extended_register_cpu = cpu;
+    percpu->extended_register_owner = new_thread;
 }
 
 static void read_xsave_state_info(void)
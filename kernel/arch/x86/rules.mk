@@ -74,6 +74,7 @@ MODULE_SRCS += \
 	$(LOCAL_DIR)/feature.c \
 	$(LOCAL_DIR)/gdt.S \
 	$(LOCAL_DIR)/header.S \
+	$(LOCAL_DIR)/idle.c \
 	$(LOCAL_DIR)/idt.c \
 	$(LOCAL_DIR)/ioapic.c \
 	$(LOCAL_DIR)/ioport.c \
@@ -88,10 +89,16 @@ MODULE_SRCS += \
 
 ifeq ($(SUBARCH),x86-64)
 MODULE_SRCS += \
+	$(LOCAL_DIR)/pmu.c \
 	$(SUBARCH_DIR)/syscall.S \
 	$(SUBARCH_DIR)/user_copy.S
 endif
 
+# frame pointers, so that ktrace cpu samples get whole kernel call chains
+ifeq ($(KERNEL_FRAME_POINTERS),1)
+KERNEL_COMPILEFLAGS += -fno-omit-frame-pointer
+endif
+
 include $(LOCAL_DIR)/toolchain.mk
 
 # Enable SMP for x86-64
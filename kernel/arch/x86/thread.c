@@ -61,6 +61,9 @@ void arch_thread_initialize(thread_t *t, vaddr_t entry_point)
             x86_extended_register_size());
     t->arch.extended_register_state = (vaddr_t *)buf;
     x86_extended_register_init_state(t->arch.extended_register_state);
+    t->arch.extended_register_cpu = -1;
+    t->arch.extended_register_saves = 0;
+    t->arch.extended_register_in_use = 0;
 
     // set the stack pointer
     t->arch.sp = (vaddr_t)frame;
@@ -78,6 +81,8 @@ void arch_dump_thread(thread_t *t)
         dprintf(INFO, "\tarch: ");
         dprintf(INFO, "sp 0x%lx\n", t->arch.sp);
     }
+    dprintf(INFO, "\tarch: extended register saves %lu, in use %lu\n",
+            t->arch.extended_register_saves, t->arch.extended_register_in_use);
 }
 
 #if ARCH_X86_32
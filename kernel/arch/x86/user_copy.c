@@ -82,3 +82,76 @@ bool _x86_usercopy_can_write(const void *base, size_t len)
 {
     return can_access(base, len, true);
 }
+
+static status_t copy_user_fixed(void *dst, const void *src, size_t len)
+{
+    DEBUG_ASSERT(!ac_flag());
+
+    bool smap_avail = x86_feature_test(X86_FEATURE_SMAP);
+    void **fault_return = &get_current_thread()->arch.page_fault_resume;
+    status_t status;
+    switch (len) {
+    case 1:
+        status = _x86_copy_user_fixed_1(dst, src, smap_avail, fault_return);
+        break;
+    case 2:
+        status = _x86_copy_user_fixed_2(dst, src, smap_avail, fault_return);
+        break;
+    case 4:
+        status = _x86_copy_user_fixed_4(dst, src, smap_avail, fault_return);
+        break;
+    case 8:
+        status = _x86_copy_user_fixed_8(dst, src, smap_avail, fault_return);
+        break;
+    default:
+        return ERR_INVALID_ARGS;
+    }
+
+    DEBUG_ASSERT(!ac_flag());
+    return status;
+}
+
+status_t arch_copy_from_user_fixed(void *dst, const void *src, size_t len)
+{
+    if (!can_access(src, len, false))
+        return ERR_INVALID_ARGS;
+    return copy_user_fixed(dst, src, len);
+}
+
+status_t arch_copy_to_user_fixed(void *dst, const void *src, size_t len)
+{
+    if (!can_access(dst, len, true))
+        return ERR_INVALID_ARGS;
+    return copy_user_fixed(dst, src, len);
+}
+
+static status_t copy_user_many(const user_copy_vec_t *vec, size_t count)
+{
+    DEBUG_ASSERT(!ac_flag());
+
+    bool smap_avail = x86_feature_test(X86_FEATURE_SMAP);
+    thread_t *thr = get_current_thread();
+    status_t status = _x86_copy_user_many(vec, count, smap_avail,
+                                          &thr->arch.page_fault_resume);
+
+    DEBUG_ASSERT(!ac_flag());
+    return status;
+}
+
+status_t arch_copy_from_user_many(const user_copy_vec_t *vec, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!can_access(vec[i].src, vec[i].len, false))
+            return ERR_INVALID_ARGS;
+    }
+    return copy_user_many(vec, count);
+}
+
+status_t arch_copy_to_user_many(const user_copy_vec_t *vec, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!can_access(vec[i].dst, vec[i].len, true))
+            return ERR_INVALID_ARGS;
+    }
+    return copy_user_many(vec, count);
+}
@@ -15,6 +15,7 @@
 #include <reg.h>
 #include <kernel/thread.h>
 #include <kernel/debug.h>
+#include <kernel/mp.h>
 #include <lk/init.h>
 #include <dev/interrupt.h>
 #include <arch/ops.h>
@@ -88,6 +89,40 @@ static struct int_handler_struct *get_int_handler(unsigned int vector, uint cpu)
         return &int_handler_table_shared[vector - GIC_MAX_PER_CPU_INT];
 }
 
+static status_t arm_gic_set_target_locked(u_int irq, u_int cpu_mask, u_int enable_mask);
+static int arm_gic_max_cpu(void);
+
+/* shared interrupts someone has picked the cpus for, which the default
+ * spreading leaves alone */
+static unsigned long gic_affinity_fixed[BITMAP_NUM_WORDS(MAX_INT)];
+
+/* the cpu the next shared interrupt to get a handler is sent to */
+static uint gic_spread_cpu;
+
+/* GICv2 targets cpu interfaces 0-7, which are numbered as the cpus are */
+#define GIC_MAX_TARGET_CPU 8
+
+/* By default each shared interrupt goes to the next online cpu in turn as it
+ * gets a handler, rather than all of them to cpu 0. Cpus still coming up are
+ * skipped, so interrupts registered early in boot stay on the boot cpu. */
+static void arm_gic_spread_locked(unsigned int vector)
+{
+    if (arm_gic_max_cpu() == 0 || bitmap_test(gic_affinity_fixed, vector))
+        return;
+
+    mp_cpu_mask_t online = mp_get_online_mask() & ((1u << GIC_MAX_TARGET_CPU) - 1);
+    if (!online)
+        return;
+
+    uint cpu = gic_spread_cpu;
+    do {
+        cpu = (cpu + 1) % GIC_MAX_TARGET_CPU;
+    } while (!(online & (1u << cpu)));
+    gic_spread_cpu = cpu;
+
+    arm_gic_set_target_locked(vector, 0xff, 1u << cpu);
+}
+
 void register_int_handler(unsigned int vector, int_handler handler, void *arg)
 {
     struct int_handler_struct *h;
@@ -102,6 +137,8 @@ void register_int_handler(unsigned int vector, int_handler handler, void *arg)
 
     if (arm_gic_interrupt_change_allowed(vector)) {
         h = get_int_handler(vector, cpu);
+        if (vector >= GIC_MAX_PER_CPU_INT && handler && !h->handler)
+            arm_gic_spread_locked(vector);
         h->handler = handler;
         h->arg = arg;
     }
@@ -312,6 +349,33 @@ status_t unmask_interrupt(unsigned int vector)
     return NO_ERROR;
 }
 
+status_t set_interrupt_affinity(unsigned int vector, mp_cpu_mask_t cpu_mask)
+{
+    if (vector < GIC_MAX_PER_CPU_INT || vector >= MAX_INT)
+        return ERR_INVALID_ARGS;
+
+    cpu_mask &= (1u << GIC_MAX_TARGET_CPU) - 1;
+    if (!cpu_mask)
+        return ERR_INVALID_ARGS;
+
+    /* with a single cpu interface the target registers read as zero and
+     * ignore writes, everything goes to cpu 0 */
+    if (arm_gic_max_cpu() == 0)
+        return (cpu_mask & 1) ? NO_ERROR : ERR_NOT_SUPPORTED;
+
+    spin_lock_saved_state_t state;
+    spin_lock_save(&gicd_lock, &state, GICD_LOCK_FLAGS);
+
+    if (arm_gic_interrupt_change_allowed(vector)) {
+        bitmap_set(gic_affinity_fixed, vector, 1);
+        arm_gic_set_target_locked(vector, 0xff, cpu_mask);
+    }
+
+    spin_unlock_restore(&gicd_lock, state, GICD_LOCK_FLAGS);
+
+    return NO_ERROR;
+}
+
 unsigned int remap_interrupt(unsigned int vector)
 {
     return vector;
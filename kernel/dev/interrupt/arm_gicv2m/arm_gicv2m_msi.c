@@ -6,6 +6,7 @@
 // https://opensource.org/licenses/MIT
 
 
+#include <dev/interrupt.h>
 #include <dev/interrupt/arm_gicv2m.h>
 #include <dev/interrupt/arm_gicv2m_msi.h>
 #include <dev/pcie_irqs.h>
@@ -167,4 +168,25 @@ void arm_gicv2m_mask_unmask_msi(const pcie_msi_block_t* block,
     else      unmask_interrupt(block->base_irq_id + msi_id);
 }
 
+status_t arm_gicv2m_get_msi_cpu_target(const pcie_msi_block_t* block,
+                                       uint                    msi_id,
+                                       uint                    cpu_num,
+                                       uint64_t*               out_tgt_addr) {
+    DEBUG_ASSERT(block && block->allocated);
+    DEBUG_ASSERT(msi_id < block->num_irq);
+    DEBUG_ASSERT(out_tgt_addr);
+
+    if (cpu_num >= SMP_MAX_CPUS)
+        return ERR_INVALID_ARGS;
+
+    /* Each MSI is an SPI at the distributor, which is what gets steered.  The
+     * doorbell the device writes to stays the same. */
+    status_t ret = set_interrupt_affinity(block->base_irq_id + msi_id, 1u << cpu_num);
+    if (ret != NO_ERROR)
+        return ret;
+
+    *out_tgt_addr = block->tgt_addr;
+    return NO_ERROR;
+}
+
 #endif  // WITH_DEV_PCIE
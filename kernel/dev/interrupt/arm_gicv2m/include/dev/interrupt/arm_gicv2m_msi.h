@@ -48,4 +48,12 @@ void arm_gicv2m_mask_unmask_msi(const pcie_msi_block_t* block,
                                 uint                    msi_id,
                                 bool                    mask);
 
+/**
+ * @see platform_get_msi_cpu_target_t in dev/pcie/pcie_irqs.h
+ */
+status_t arm_gicv2m_get_msi_cpu_target(const pcie_msi_block_t* block,
+                                       uint                    msi_id,
+                                       uint                    cpu_num,
+                                       uint64_t*               out_tgt_addr);
+
 #endif  // WITH_DEV_PCIE
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <compiler.h>
+#include <kernel/mp.h>
 #include <stdbool.h>
 #include <sys/types.h>
 
@@ -23,4 +24,8 @@ bool is_valid_interrupt(unsigned int vector, uint32_t flags);
 
 unsigned int remap_interrupt(unsigned int vector);
 
+// Send a shared interrupt to the cpus in cpu_mask. Platforms that can't
+// steer it return ERR_NOT_SUPPORTED.
+status_t set_interrupt_affinity(unsigned int vector, mp_cpu_mask_t cpu_mask);
+
 __END_CDECLS
@@ -619,5 +619,5 @@ static void pcnet_init_hook(uint level)
     class_netif_add(device_get_by_name(netif, pcnet0));
 }
 
-LK_INIT_HOOK(pcnet, &pcnet_init_hook, LK_INIT_LEVEL_PLATFORM);
+LK_INIT_HOOK_DEFERRED(pcnet, &pcnet_init_hook, LK_INIT_LEVEL_PLATFORM);
 
@@ -145,6 +145,13 @@ typedef struct pcie_init_info {
      * platform is incapable of masking individual MSI handlers.
      */
     platform_mask_unmask_msi_t mask_unmask_msi;
+
+    /**
+     * Routine for steering a single MSI-X vector to a given CPU.  May be NULL
+     * if the platform cannot target MSIs at individual CPUs, in which case
+     * pcie_set_irq_affinity is not supported.
+     */
+    platform_get_msi_cpu_target_t get_msi_cpu_target;
 } pcie_init_info_t;
 
 /* Function table registered by a device driver.  Method requirements and device
@@ -217,6 +224,8 @@ typedef struct pcie_device_state {
     uint8_t                       class_id;  // The device's class ID, as read from config.
     uint8_t                       subclass;  // The device's subclass, as read from config.
     uint8_t                       prog_if;   // The device's programming interface (from cfg)
+    uint8_t                       rev_id;    // The device's revision ID, as read from config
+    uint8_t                       header_type; // The raw header type, as read from config
     uint                          bus_id;    // The bus ID this bridge/device exists on
     uint                          dev_id;    // The device ID of this bridge/device
     uint                          func_id;   // The function ID of this bridge/device
@@ -282,8 +291,17 @@ typedef struct pcie_device_state {
             pcie_msi_block_t   irq_block;
         } msi;
 
-        /* TODO(johngro) : Add MSI-X state */
-        struct { } msi_x;
+        /* MSI-X state.  The vector table lives in one of the device's BARs, and
+         * is only mapped while the device is in MSI-X mode. */
+        struct {
+            pcie_cap_msix_t*                   cfg;
+            uint                               max_irqs;
+            uint                               table_bar;
+            uint32_t                           table_offset;
+            void*                              table_mapping;
+            volatile pcie_msix_vector_entry_t* vector_table;
+            pcie_msi_block_t                   irq_block;
+        } msi_x;
     } irq;
 
 } pcie_device_state_t;
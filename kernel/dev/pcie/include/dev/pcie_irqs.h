@@ -207,6 +207,25 @@ typedef void (*platform_mask_unmask_msi_t)(const pcie_msi_block_t* block,
                                            uint                    msi_id,
                                            bool                    mask);
 
+/**
+ * Callback definition used for steering a single IRQ in a block of MSI-X IRQs
+ * to a chosen CPU.
+ *
+ * @param block A pointer to a block of MSIs allocated using a platform supplied
+ *        platform_alloc_msi_block_t callback.
+ * @param msi_id The ID (indexed from 0) within the block of MSIs to steer.
+ * @param cpu_num The CPU which should receive the IRQ.
+ * @param out_tgt_addr Upon success, the target address which the device should
+ *        write (along with the block's target data + msi_id) in order to
+ *        deliver the IRQ to cpu_num.
+ *
+ * @return A status code indicating the success or failure of the operation.
+ */
+typedef status_t (*platform_get_msi_cpu_target_t)(const pcie_msi_block_t* block,
+                                                  uint                    msi_id,
+                                                  uint                    cpu_num,
+                                                  uint64_t*               out_tgt_addr);
+
 /**
  * Structure used internally to hold the state of a registered handler.
  */
@@ -355,6 +374,36 @@ status_t pcie_mask_unmask_irq(struct pcie_device_state* dev,
                               uint                      irq_id,
                               bool                      mask);
 
+/**
+ * Steer the specified IRQ for the given device to a single CPU.
+ *
+ * Only IRQs in MSI-X mode can be steered individually; each MSI-X vector has
+ * its own target address.  The binding lasts until the device leaves MSI-X
+ * mode.  Until then, new vectors target whichever CPU the platform picked when
+ * the block was allocated.
+ *
+ * @param dev A pointer to the pci device to configure.
+ * @param irq_id The ID of the IRQ to steer.
+ * @param cpu_num The CPU which should receive the IRQ.
+ *
+ * @return A status_t indicating the success or failure of the operation.
+ * Status codes may include (but are not limited to)...
+ *
+ * ++ ERR_NOT_MOUNTED
+ *    The device has become unplugged and is waiting to be released.
+ * ++ ERR_BAD_STATE
+ *    The device is in DISABLED IRQ mode.
+ * ++ ERR_INVALID_ARGS
+ *    The irq_id parameter is out of range for the currently configured mode,
+ *    or cpu_num is not a CPU the platform can target.
+ * ++ ERR_NOT_SUPPORTED
+ *    The device is not in MSI-X mode, or the platform cannot target
+ *    individual CPUs.
+ */
+status_t pcie_set_irq_affinity(struct pcie_device_state* dev,
+                               uint                      irq_id,
+                               uint                      cpu_num);
+
 /**
  * Mask the specified IRQ for the given device.
  *
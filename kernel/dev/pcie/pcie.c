@@ -183,7 +183,7 @@ static status_t pcie_enumerate_bars(pcie_device_state_t* dev) {
     DEBUG_ASSERT(is_mutex_held(&dev->dev_lock));
 
     pcie_config_t* cfg  = dev->cfg;
-    uint8_t header_type = pcie_read8(&cfg->base.header_type) & PCI_HEADER_TYPE_MASK;
+    uint8_t header_type = dev->header_type & PCI_HEADER_TYPE_MASK;
     uint bar_count;
 
     static_assert(PCIE_MAX_BAR_REGS >= PCIE_BAR_REGS_PER_DEVICE);
@@ -266,6 +266,8 @@ static status_t pcie_scan_init_device(pcie_device_state_t*     dev,
     dev->class_id   = pcie_read8(&cfg->base.base_class);
     dev->subclass   = pcie_read8(&cfg->base.sub_class);
     dev->prog_if    = pcie_read8(&cfg->base.program_interface);
+    dev->rev_id     = pcie_read8(&cfg->base.revision_id_0);
+    dev->header_type = pcie_read8(&cfg->base.header_type);
     dev->bus_id     = bus_id;
     dev->dev_id     = dev_id;
     dev->func_id    = func_id;
@@ -417,34 +419,40 @@ static void pcie_scan_bus(pcie_bridge_state_t* bridge) {
             if (!bridge->managed_bus_id && !dev_id && !func_id)
                 continue;
 
-            /* If we can find the config, and it has a valid vendor ID, go ahead
-             * and scan it looking for a valid function. */
-            uint64_t cfg_phys;
-            pcie_config_t* cfg = pcie_get_config(bridge->dev.bus_drv, &cfg_phys,
-                                                 bridge->managed_bus_id, dev_id, func_id);
-            bool good_device = cfg && (pcie_read16(&cfg->base.vendor_id) != PCIE_INVALID_VENDOR_ID);
-            if (good_device) {
-                /* Don't scan the function again if we have already discovered
-                 * it.  If this function happens to be a bridge, go ahead and
-                 * look under it for new devices. */
-                uint ndx    = (dev_id * PCIE_MAX_FUNCTIONS_PER_DEVICE) + func_id;
-                DEBUG_ASSERT(ndx < countof(bridge->downstream));
-
-                pcie_device_state_t* downstream = bridge->downstream[ndx];
-                if (!downstream) {
+            uint ndx = (dev_id * PCIE_MAX_FUNCTIONS_PER_DEVICE) + func_id;
+            DEBUG_ASSERT(ndx < countof(bridge->downstream));
+
+            /* Don't scan the function again if we have already discovered it,
+             * or read its config to find out what it is; the device state has
+             * what we need.  If this function happens to be a bridge, go ahead
+             * and look under it for new devices. */
+            pcie_device_state_t* downstream = bridge->downstream[ndx];
+            bool    good_device;
+            uint8_t header_type = 0;
+            if (downstream) {
+                pcie_bridge_state_t* downstream_bridge = pcie_downcast_to_bridge(downstream);
+                if (downstream_bridge)
+                    pcie_scan_bus(downstream_bridge);
+                good_device = true;
+                header_type = downstream->header_type;
+            } else {
+                /* If we can find the config, and it has a valid vendor ID, go
+                 * ahead and scan it looking for a valid function. */
+                uint64_t cfg_phys;
+                pcie_config_t* cfg = pcie_get_config(bridge->dev.bus_drv, &cfg_phys,
+                                                     bridge->managed_bus_id, dev_id, func_id);
+                good_device = cfg &&
+                              (pcie_read16(&cfg->base.vendor_id) != PCIE_INVALID_VENDOR_ID);
+                if (good_device) {
+                    header_type = pcie_read8(&cfg->base.header_type);
                     pcie_scan_function(bridge, cfg, cfg_phys, dev_id, func_id);
-                } else {
-                    pcie_bridge_state_t* downstream_bridge = pcie_downcast_to_bridge(downstream);
-                    if (downstream_bridge)
-                        pcie_scan_bus(downstream_bridge);
                 }
             }
 
             /* If this was function zero, and there is either no device, or the
              * config's header type indicates that this is not a multi-function
              * device, then just move on to the next device. */
-            if (!func_id &&
-               (!good_device || !(pcie_read8(&cfg->base.header_type) & PCI_HEADER_TYPE_MULTI_FN)))
+            if (!func_id && (!good_device || !(header_type & PCI_HEADER_TYPE_MULTI_FN)))
                 break;
         }
     }
@@ -773,8 +781,8 @@ static status_t pcie_start_device(pcie_device_state_t* dev) {
         /* Device failed to start.*/
         TRACEF("Failed to start %04hx:%04hx at %02x:%02x.%01x claimed by driver "
                "\"%s\" (result %d)\n",
-               pcie_read16(&dev->cfg->base.vendor_id),
-               pcie_read16(&dev->cfg->base.device_id),
+               dev->vendor_id,
+               dev->device_id,
                dev->bus_id,
                dev->dev_id,
                dev->func_id,
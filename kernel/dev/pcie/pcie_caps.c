@@ -328,6 +328,61 @@ static status_t pcie_parse_msi_caps(pcie_device_state_t* dev,
     return NO_ERROR;
 }
 
+/*
+ * PCI Local Bus Specification 3.0 Section 6.8.2
+ */
+static status_t pcie_parse_msix_caps(pcie_device_state_t* dev,
+                                     void*                hdr,
+                                     uint                 version,
+                                     uint                 space_left) {
+    DEBUG_ASSERT(dev);
+
+    /* Zero out the devices MSI-X IRQ state */
+    memset(&dev->irq.msi_x, 0, sizeof(dev->irq.msi_x));
+
+    /* Make sure we have enough space to hold the whole structure. */
+    if (space_left < sizeof(pcie_cap_msix_t)) {
+        TRACEF("Device %02x:%02x.%01x (%04hx:%04hx) has illegally positioned MSI-X "
+               "capability structure.  Structure is %zu bytes long, but only %u "
+               "bytes remain in ECAM standard config.\n",
+               dev->bus_id, dev->dev_id, dev->func_id,
+               dev->vendor_id, dev->device_id,
+               sizeof(pcie_cap_msix_t), space_left);
+        return ERR_NOT_VALID;
+    }
+
+    pcie_cap_msix_t* msix_cap   = (pcie_cap_msix_t*)hdr;
+    uint16_t         ctrl       = pcie_read16(&msix_cap->ctrl);
+    uint32_t         bir_offset = pcie_read32(&msix_cap->vector_table_bir_offset);
+    uint             table_bar  = PCIE_CAP_MSIX_BIR(bir_offset);
+
+    /* Sanity check the BAR indicator for the vector table */
+    if (table_bar >= PCIE_MAX_BAR_REGS) {
+        TRACEF("Device %02x:%02x.%01x (%04hx:%04hx) has invalid BAR indicator (%u) "
+               "for its MSI-X vector table.\n",
+               dev->bus_id, dev->dev_id, dev->func_id,
+               dev->vendor_id, dev->device_id, table_bar);
+        return ERR_NOT_VALID;
+    }
+
+    /* Success!
+     *
+     * Make sure that MSI-X is disabled and that the function is masked.  Then
+     * record our capabilities in the device's bookkeeping and we are done.
+     * The vector table itself is mapped when the device enters MSI-X mode,
+     * since its BAR may not have been allocated yet.
+     */
+    pcie_write16(&msix_cap->ctrl, PCIE_CAP_MSIX_CTRL_SET_ENB(0,
+                                  PCIE_CAP_MSIX_CTRL_SET_FUNC_MASK(1, ctrl)));
+
+    dev->irq.msi_x.cfg          = msix_cap;
+    dev->irq.msi_x.max_irqs     = MIN(PCIE_CAP_MSIX_CTRL_GET_TABLE_SIZE(ctrl), PCIE_MAX_MSIX_IRQS);
+    dev->irq.msi_x.table_bar    = table_bar;
+    dev->irq.msi_x.table_offset = PCIE_CAP_MSIX_OFFSET(bir_offset);
+
+    return NO_ERROR;
+}
+
 /*
  * Advanced Capabilities for Conventional PCI ECN
  */
@@ -587,7 +642,7 @@ static const pcie_caps_parse_table_entry_t PCIE_STANDARD_CAPS_PARSE_TABLE[] = {
     PTE(PCIE_CAP_ID_AGP_8X,                   NULL),
     PTE(PCIE_CAP_ID_SECURE_DEVICE,            NULL),
     PTE(PCIE_CAP_ID_PCI_EXPRESS,              pcie_parse_pci_express_caps),
-    PTE(PCIE_CAP_ID_MSIX,                     NULL),
+    PTE(PCIE_CAP_ID_MSIX,                     pcie_parse_msix_caps),
     PTE(PCIE_CAP_ID_SATA_DATA_NDX_CFG,        NULL),
     PTE(PCIE_CAP_ID_ADVANCED_FEATURES,        pcie_parse_pci_advanced_features),
     PTE(PCIE_CAP_ID_ENHANCED_ALLOCATION,      NULL),
@@ -525,12 +525,13 @@ static enum handler_return pcie_msi_irq_handler(void *arg) {
     return (irq_ret & PCIE_IRQRET_RESCHED) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
 
-static void pcie_free_msi_block(pcie_device_state_t* dev) {
+static void pcie_free_msi_block(pcie_device_state_t* dev, pcie_msi_block_t* block) {
     DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(block);
     pcie_bus_driver_state_t* bus_drv = dev->bus_drv;
 
     /* If no block has been allocated, there is nothing to do */
-    if (!dev->irq.msi.irq_block.allocated)
+    if (!block->allocated)
         return;
 
     DEBUG_ASSERT(bus_drv->register_msi_handler);
@@ -538,7 +539,7 @@ static void pcie_free_msi_block(pcie_device_state_t* dev) {
 
     /* Mask the IRQ at the platform interrupt controller level if we can, and
      * unregister any registered handler. */
-    const pcie_msi_block_t* b = &dev->irq.msi.irq_block;
+    const pcie_msi_block_t* b = block;
     for (uint i = 0; i < b->num_irq; i++) {
         if (bus_drv->mask_unmask_msi)
             bus_drv->mask_unmask_msi(b, i, true);
@@ -550,8 +551,8 @@ static void pcie_free_msi_block(pcie_device_state_t* dev) {
     DEBUG_ASSERT(bus_drv->free_msi_block);
 
     /* Give the block of IRQs back to the plaform */
-    bus_drv->free_msi_block(&dev->irq.msi.irq_block);
-    DEBUG_ASSERT(!dev->irq.msi.irq_block.allocated);
+    bus_drv->free_msi_block(block);
+    DEBUG_ASSERT(!block->allocated);
 }
 
 static void pcie_set_msi_multi_message_enb(pcie_device_state_t* dev, uint requested_irqs) {
@@ -580,7 +581,7 @@ static void pcie_leave_msi_irq_mode(pcie_device_state_t* dev) {
     /* Return any allocated irq block to the platform, unregistering with
      * the interrupt controller and synchronizing with the dispatchers in
      * the process. */
-    pcie_free_msi_block(dev);
+    pcie_free_msi_block(dev, &dev->irq.msi.irq_block);
 
     /* Reset our common state, free any allocated handlers */
     pcie_reset_common_irq_bookkeeping(dev);
@@ -659,6 +660,298 @@ bailout:
     return res;
 }
 
+/******************************************************************************
+ *
+ * MSI-X IRQ mode routines.
+ *
+ ******************************************************************************/
+static inline void pcie_set_msix_ctrl(pcie_device_state_t* dev, bool enb, bool func_mask) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->irq.msi_x.cfg);
+
+    volatile uint16_t* ctrl_reg = &dev->irq.msi_x.cfg->ctrl;
+    pcie_write16(ctrl_reg, PCIE_CAP_MSIX_CTRL_SET_ENB(enb,
+                           PCIE_CAP_MSIX_CTRL_SET_FUNC_MASK(func_mask, pcie_read16(ctrl_reg))));
+}
+
+static inline void pcie_mask_unmask_msix_vector(pcie_device_state_t* dev,
+                                                uint                 irq_id,
+                                                bool                 mask) {
+    DEBUG_ASSERT(dev->irq.msi_x.vector_table);
+    DEBUG_ASSERT(irq_id < dev->irq.msi_x.max_irqs);
+
+    volatile uint32_t* ctrl_reg = &dev->irq.msi_x.vector_table[irq_id].vector_ctrl;
+    uint32_t val = pcie_read32(ctrl_reg);
+    if (mask) val |=  PCIE_MSIX_VECTOR_CTRL_MASKED;
+    else      val &= ~PCIE_MSIX_VECTOR_CTRL_MASKED;
+    pcie_write32(ctrl_reg, val);
+}
+
+static inline bool pcie_mask_unmask_msix_irq_locked(pcie_device_state_t* dev,
+                                                    uint                 irq_id,
+                                                    bool                 mask) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->irq.mode == PCIE_IRQ_MODE_MSI_X);
+    DEBUG_ASSERT(irq_id < dev->irq.handler_count);
+    DEBUG_ASSERT(dev->irq.handlers);
+
+    pcie_irq_handler_state_t* hstate = &dev->irq.handlers[irq_id];
+    DEBUG_ASSERT(spin_lock_held(&hstate->lock));
+
+    /* MSI-X vectors can always be masked in the vector table */
+    pcie_mask_unmask_msix_vector(dev, irq_id, mask);
+
+    bool ret = hstate->masked;
+    hstate->masked = mask;
+    return ret;
+}
+
+static inline status_t pcie_mask_unmask_msix_irq(pcie_device_state_t* dev,
+                                                 uint                 irq_id,
+                                                 bool                 mask) {
+    spin_lock_saved_state_t irq_state;
+
+    if (irq_id >= dev->irq.handler_count)
+        return ERR_INVALID_ARGS;
+
+    DEBUG_ASSERT(dev->irq.handlers);
+
+    spin_lock_irqsave(&dev->irq.handlers[irq_id].lock, irq_state);
+    pcie_mask_unmask_msix_irq_locked(dev, irq_id, mask);
+    spin_unlock_irqrestore(&dev->irq.handlers[irq_id].lock, irq_state);
+
+    return NO_ERROR;
+}
+
+/* Program the target of a single vector.  The vector must be masked. */
+static void pcie_set_msix_target(pcie_device_state_t* dev,
+                                 uint                 irq_id,
+                                 uint64_t             tgt_addr,
+                                 uint32_t             tgt_data) {
+    DEBUG_ASSERT(dev->irq.msi_x.vector_table);
+    DEBUG_ASSERT(irq_id < dev->irq.msi_x.max_irqs);
+
+    volatile pcie_msix_vector_entry_t* entry = &dev->irq.msi_x.vector_table[irq_id];
+    DEBUG_ASSERT(pcie_read32(&entry->vector_ctrl) & PCIE_MSIX_VECTOR_CTRL_MASKED);
+
+    pcie_write32(&entry->addr,       (uint32_t)(tgt_addr & 0xFFFFFFFF));
+    pcie_write32(&entry->addr_upper, (uint32_t)(tgt_addr >> 32));
+    pcie_write32(&entry->data,       tgt_data);
+}
+
+static enum handler_return pcie_msix_irq_handler(void *arg) {
+    DEBUG_ASSERT(arg);
+    pcie_irq_handler_state_t* hstate = (pcie_irq_handler_state_t*)arg;
+    pcie_device_state_t*      dev    = hstate->dev;
+
+    /* No need to save IRQ state; we are in an IRQ handler at the moment. */
+    spin_lock(&hstate->lock);
+
+    /* Mask our IRQ while we dispatch. */
+    bool was_masked = pcie_mask_unmask_msix_irq_locked(dev, hstate->pci_irq_id, true);
+
+    /* If the IRQ was masked or the handler removed by the time we got here,
+     * leave the IRQ masked, unlock and get out. */
+    if (was_masked || !hstate->handler) {
+        spin_unlock(&hstate->lock);
+        return INT_NO_RESCHEDULE;
+    }
+
+    /* Dispatch */
+    pcie_irq_handler_retval_t irq_ret = hstate->handler(dev, hstate->pci_irq_id, hstate->ctx);
+
+    /* Re-enable the IRQ if asked to do so */
+    if (!(irq_ret & PCIE_IRQRET_MASK))
+        pcie_mask_unmask_msix_irq_locked(dev, hstate->pci_irq_id, false);
+
+    /* Unlock and request a reschedule if asked to do so */
+    spin_unlock(&hstate->lock);
+    return (irq_ret & PCIE_IRQRET_RESCHED) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
+
+static status_t pcie_map_msix_table(pcie_device_state_t* dev) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(!dev->irq.msi_x.table_mapping);
+
+    /* The vector table lives in one of the device's MMIO BARs, which must have
+     * been allocated by now. */
+    const pcie_bar_info_t* bar = pcie_get_bar_info(dev, dev->irq.msi_x.table_bar);
+    size_t table_size = dev->irq.msi_x.max_irqs * sizeof(pcie_msix_vector_entry_t);
+    if (!bar || !bar->is_mmio || (dev->irq.msi_x.table_offset + table_size > bar->size)) {
+        TRACEF("Device %02x:%02x.%01x has no usable BAR %u for its MSI-X vector table\n",
+               dev->bus_id, dev->dev_id, dev->func_id, dev->irq.msi_x.table_bar);
+        return ERR_BAD_STATE;
+    }
+
+    paddr_t table_pa = bar->bus_addr + dev->irq.msi_x.table_offset;
+    paddr_t map_pa   = ROUNDDOWN(table_pa, PAGE_SIZE);
+    size_t  map_size = ROUNDUP(table_pa + table_size - map_pa, PAGE_SIZE);
+
+    status_t res = vmm_alloc_physical(dev->bus_drv->aspace,
+                                      "pcie_msix",
+                                      map_size,
+                                      &dev->irq.msi_x.table_mapping,
+                                      PAGE_SIZE_SHIFT,
+                                      map_pa,
+                                      0 /* vmm flags */,
+                                      ARCH_MMU_FLAG_UNCACHED_DEVICE |
+                                      ARCH_MMU_FLAG_PERM_NO_EXECUTE);
+    if (res != NO_ERROR) {
+        dev->irq.msi_x.table_mapping = NULL;
+        return res;
+    }
+
+    dev->irq.msi_x.vector_table = (volatile pcie_msix_vector_entry_t*)
+        ((uint8_t*)dev->irq.msi_x.table_mapping + (table_pa - map_pa));
+
+    /* The table is only reachable with memory space decoding enabled. */
+    pcie_modify_cmd_internal(dev, 0, PCI_COMMAND_MEM_EN);
+
+    return NO_ERROR;
+}
+
+static void pcie_leave_msix_irq_mode(pcie_device_state_t* dev) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->bus_drv);
+    DEBUG_ASSERT(dev->irq.msi_x.cfg);
+
+    /* Disable MSI-X and mask the function, then mask each vector and zero
+     * out its target. */
+    pcie_set_msix_ctrl(dev, false, true);
+    if (dev->irq.msi_x.vector_table) {
+        for (uint i = 0; i < dev->irq.msi_x.max_irqs; i++) {
+            pcie_mask_unmask_msix_vector(dev, i, true);
+            pcie_set_msix_target(dev, i, 0x0, 0x0);
+        }
+    }
+
+    /* Return any allocated irq block to the platform, unregistering with
+     * the interrupt controller and synchronizing with the dispatchers in
+     * the process. */
+    pcie_free_msi_block(dev, &dev->irq.msi_x.irq_block);
+
+    if (dev->irq.msi_x.table_mapping) {
+        vmm_free_region(dev->bus_drv->aspace, (vaddr_t)dev->irq.msi_x.table_mapping);
+        dev->irq.msi_x.table_mapping = NULL;
+        dev->irq.msi_x.vector_table  = NULL;
+    }
+
+    /* Reset our common state, free any allocated handlers */
+    pcie_reset_common_irq_bookkeeping(dev);
+}
+
+static status_t pcie_enter_msix_irq_mode(pcie_device_state_t* dev,
+                                         uint                 requested_irqs) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->bus_drv);
+    DEBUG_ASSERT(requested_irqs);
+
+    status_t res = NO_ERROR;
+
+    /* We cannot go into MSI-X mode if we don't support MSI-X at all, or we
+     * don't support the number of IRQs requested */
+    if (!dev->irq.msi_x.cfg             ||
+        !dev->bus_drv->alloc_msi_block  ||
+        (requested_irqs > dev->irq.msi_x.max_irqs))
+        return ERR_NOT_SUPPORTED;
+
+    DEBUG_ASSERT(dev->bus_drv->free_msi_block &&
+                 dev->bus_drv->register_msi_handler);
+
+    /* Map the vector table so we can program it */
+    res = pcie_map_msix_table(dev);
+    if (res != NO_ERROR)
+        goto bailout;
+
+    /* Ask the platform for a chunk of MSI compatible IRQs.  MSI-X targets are
+     * always allowed to be 64 bit. */
+    DEBUG_ASSERT(!dev->irq.msi_x.irq_block.allocated);
+    res = dev->bus_drv->alloc_msi_block(requested_irqs,
+                                        true,  /* can_target_64bit */
+                                        true,  /* is_msix */
+                                        &dev->irq.msi_x.irq_block);
+    if (res != NO_ERROR) {
+        LTRACEF("Failed to allocate a block of %u MSI-X IRQs for device "
+                "%02x:%02x.%01x (res %d)\n",
+                requested_irqs, dev->bus_id, dev->dev_id, dev->func_id, res);
+        goto bailout;
+    }
+
+    /* Allocate our handler table */
+    res = pcie_alloc_irq_handlers(dev, requested_irqs);
+    if (res != NO_ERROR)
+        goto bailout;
+
+    /* Record our new IRQ mode */
+    dev->irq.mode = PCIE_IRQ_MODE_MSI_X;
+
+    /* Make sure MSI-X is disabled and the function masked while we program the
+     * vector table.  Every vector starts out masked and targeting the block's
+     * default destination; unused vectors are left masked with no target. */
+    pcie_set_msix_ctrl(dev, false, true);
+    const pcie_msi_block_t* b = &dev->irq.msi_x.irq_block;
+    DEBUG_ASSERT(dev->irq.handler_count <= b->num_irq);
+    for (uint i = 0; i < dev->irq.msi_x.max_irqs; ++i) {
+        pcie_mask_unmask_msix_vector(dev, i, true);
+        if (i < dev->irq.handler_count) {
+            dev->irq.handlers[i].masked = true;
+            pcie_set_msix_target(dev, i, b->tgt_addr, b->tgt_data + i);
+        } else {
+            pcie_set_msix_target(dev, i, 0x0, 0x0);
+        }
+    }
+
+    /* Register each IRQ with the dispatcher */
+    for (uint i = 0; i < dev->irq.handler_count; ++i) {
+        dev->bus_drv->register_msi_handler(b,
+                                           i,
+                                           pcie_msix_irq_handler,
+                                           dev->irq.handlers + i);
+    }
+
+    /* Enable MSI-X and unmask the function.  Individual vectors stay masked
+     * until they are unmasked through the API. */
+    pcie_set_msix_ctrl(dev, true, false);
+
+bailout:
+    if (res != NO_ERROR)
+        pcie_leave_msix_irq_mode(dev);
+
+    return res;
+}
+
+static status_t pcie_set_msix_irq_affinity(pcie_device_state_t* dev,
+                                           uint                 irq_id,
+                                           uint                 cpu_num) {
+    DEBUG_ASSERT(dev);
+    DEBUG_ASSERT(dev->irq.mode == PCIE_IRQ_MODE_MSI_X);
+
+    pcie_bus_driver_state_t* bus_drv = dev->bus_drv;
+    const pcie_msi_block_t*  b       = &dev->irq.msi_x.irq_block;
+
+    if (!bus_drv->get_msi_cpu_target)
+        return ERR_NOT_SUPPORTED;
+
+    uint64_t tgt_addr;
+    status_t res = bus_drv->get_msi_cpu_target(b, irq_id, cpu_num, &tgt_addr);
+    if (res != NO_ERROR)
+        return res;
+
+    /* Mask the vector while its target is rewritten, then restore its
+     * previous mask state. */
+    pcie_irq_handler_state_t* hstate = &dev->irq.handlers[irq_id];
+    spin_lock_saved_state_t   irq_state;
+
+    spin_lock_irqsave(&hstate->lock, irq_state);
+    pcie_mask_unmask_msix_vector(dev, irq_id, true);
+    pcie_set_msix_target(dev, irq_id, tgt_addr, b->tgt_data + irq_id);
+    if (!hstate->masked)
+        pcie_mask_unmask_msix_vector(dev, irq_id, false);
+    spin_unlock_irqrestore(&hstate->lock, irq_state);
+
+    return NO_ERROR;
+}
+
 /******************************************************************************
  *
  * Internal implementation of the Kernel facing API.
@@ -709,8 +1002,15 @@ status_t pcie_query_irq_mode_capabilities_internal(const pcie_device_state_t* de
         if (!bus_drv->alloc_msi_block)
             return ERR_NOT_SUPPORTED;
 
-        /* TODO(johngro) : finish MSI-X implementation. */
-        return ERR_NOT_SUPPORTED;
+        /* If the device supports MSI-X, it will have a pointer to the control
+         * structure in config. */
+        if (!dev->irq.msi_x.cfg)
+            return ERR_NOT_SUPPORTED;
+
+        /* MSI-X vectors can always be masked in the vector table. */
+        out_caps->max_irqs = dev->irq.msi_x.max_irqs;
+        out_caps->per_vector_masking_supported = true;
+        break;
 
     default:
         return ERR_INVALID_ARGS;
@@ -768,10 +1068,14 @@ status_t pcie_set_irq_mode_internal(pcie_device_state_t*    dev,
             DEBUG_ASSERT(!dev->irq.registered_handler_count);
             return NO_ERROR;
 
-        /* Right now, there should be no way to get into MSI-X mode */
         case PCIE_IRQ_MODE_MSI_X:
-            DEBUG_ASSERT(false);
-            return ERR_NOT_SUPPORTED;
+            DEBUG_ASSERT(dev->irq.msi_x.cfg);
+            DEBUG_ASSERT(dev->irq.msi_x.irq_block.allocated);
+
+            pcie_leave_msix_irq_mode(dev);
+
+            DEBUG_ASSERT(!dev->irq.registered_handler_count);
+            return NO_ERROR;
 
         default:
             /* mode is not one of the valid enum values, this should be impossible */
@@ -792,7 +1096,7 @@ status_t pcie_set_irq_mode_internal(pcie_device_state_t*    dev,
     switch (mode) {
     case PCIE_IRQ_MODE_LEGACY: return pcie_enter_legacy_irq_mode(dev, requested_irqs);
     case PCIE_IRQ_MODE_MSI:    return pcie_enter_msi_irq_mode   (dev, requested_irqs);
-    case PCIE_IRQ_MODE_MSI_X:  return ERR_NOT_SUPPORTED;
+    case PCIE_IRQ_MODE_MSI_X:  return pcie_enter_msix_irq_mode  (dev, requested_irqs);
     default:                   return ERR_INVALID_ARGS;
     }
 }
@@ -866,7 +1170,7 @@ status_t pcie_mask_unmask_irq_internal(pcie_device_state_t* dev,
     switch (dev->irq.mode) {
     case PCIE_IRQ_MODE_LEGACY: return pcie_mask_unmask_legacy_irq(dev, mask);
     case PCIE_IRQ_MODE_MSI:    return pcie_mask_unmask_msi_irq(dev, irq_id, mask);
-    case PCIE_IRQ_MODE_MSI_X:  return ERR_NOT_SUPPORTED;
+    case PCIE_IRQ_MODE_MSI_X:  return pcie_mask_unmask_msix_irq(dev, irq_id, mask);
     default:
         DEBUG_ASSERT(false); /* This should be un-possible! */
         return ERR_INTERNAL;
@@ -875,6 +1179,30 @@ status_t pcie_mask_unmask_irq_internal(pcie_device_state_t* dev,
     return NO_ERROR;
 }
 
+status_t pcie_set_irq_affinity_internal(pcie_device_state_t* dev,
+                                        uint                 irq_id,
+                                        uint                 cpu_num) {
+    DEBUG_ASSERT(dev && dev->plugged_in);
+    DEBUG_ASSERT(is_mutex_held(&dev->dev_lock));
+
+    /* Cannot steer IRQs while in the DISABLED state */
+    if (dev->irq.mode == PCIE_IRQ_MODE_DISABLED)
+        return ERR_BAD_STATE;
+
+    DEBUG_ASSERT(dev->irq.handlers);
+    DEBUG_ASSERT(dev->irq.handler_count);
+
+    /* Make sure that the IRQ ID is within range */
+    if (irq_id >= dev->irq.handler_count)
+        return ERR_INVALID_ARGS;
+
+    /* Only MSI-X vectors have a target of their own. */
+    if (dev->irq.mode != PCIE_IRQ_MODE_MSI_X)
+        return ERR_NOT_SUPPORTED;
+
+    return pcie_set_msix_irq_affinity(dev, irq_id, cpu_num);
+}
+
 /******************************************************************************
  *
  * Kernel API; prototypes in dev/pcie_irqs.h
@@ -967,6 +1295,21 @@ status_t pcie_mask_unmask_irq(pcie_device_state_t* dev,
     return ret;
 }
 
+status_t pcie_set_irq_affinity(pcie_device_state_t* dev,
+                               uint                 irq_id,
+                               uint                 cpu_num) {
+    DEBUG_ASSERT(dev);
+    status_t ret;
+
+    MUTEX_ACQUIRE(dev, dev_lock);
+    ret = dev->plugged_in
+        ? pcie_set_irq_affinity_internal(dev, irq_id, cpu_num)
+        : ERR_NOT_MOUNTED;
+    MUTEX_RELEASE(dev, dev_lock);
+
+    return ret;
+}
+
 /******************************************************************************
  *
  * Internal API; prototypes in pcie_priv.h
@@ -1030,6 +1373,7 @@ status_t pcie_init_irqs(pcie_bus_driver_state_t* bus_drv, const pcie_init_info_t
     bus_drv->free_msi_block       = init_info->free_msi_block;
     bus_drv->register_msi_handler = init_info->register_msi_handler;
     bus_drv->mask_unmask_msi      = init_info->mask_unmask_msi;
+    bus_drv->get_msi_cpu_target   = init_info->get_msi_cpu_target;
 
     return NO_ERROR;
 }
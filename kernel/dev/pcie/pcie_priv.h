@@ -237,6 +237,7 @@ typedef struct pcie_bus_driver_state {
     platform_free_msi_block_t       free_msi_block;
     platform_register_msi_handler_t register_msi_handler;
     platform_mask_unmask_msi_t      mask_unmask_msi;
+    platform_get_msi_cpu_target_t   get_msi_cpu_target;
 } pcie_bus_driver_state_t;
 
 /******************************************************************************
@@ -309,6 +310,11 @@ status_t pcie_mask_unmask_irq_internal(
         uint                 irq_id,
         bool                 mask);
 
+status_t pcie_set_irq_affinity_internal(
+        pcie_device_state_t* dev,
+        uint                 irq_id,
+        uint                 cpu_num);
+
 status_t pcie_init_device_irq_state(pcie_device_state_t* dev, pcie_bridge_state_t* upstream);
 status_t pcie_init_irqs(pcie_bus_driver_state_t* drv, const pcie_init_info_t* init_info);
 void     pcie_shutdown_irqs(pcie_bus_driver_state_t* drv);
@@ -13,7 +13,7 @@
 #include <err.h>
 #include <kernel/thread.h>
 #include <kernel/event.h>
-#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <kernel/vm.h>
 #include <lib/bio.h>
 #include <dev/virtio.h>
@@ -49,6 +49,11 @@ struct virtio_blk_req {
 #define VIRTIO_BLK_F_TOPOLOGY (1<<10)
 #define VIRTIO_BLK_F_CONFIG_WCE (1<<11)
 
+/* the ones this driver uses */
+#define VIRTIO_BLK_FEATURES \
+    (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | \
+     (1u << VIRTIO_RING_F_INDIRECT_DESC) | (1u << VIRTIO_RING_F_EVENT_IDX))
+
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
 #define VIRTIO_BLK_T_FLUSH      4
@@ -60,24 +65,50 @@ struct virtio_blk_req {
 static enum handler_return virtio_block_irq_driver_callback(struct virtio_device *dev, uint ring, const struct vring_used_elem *e);
 static ssize_t virtio_bdev_read_block(struct bdev *bdev, void *buf, bnum_t block, uint count);
 static ssize_t virtio_bdev_write_block(struct bdev *bdev, const void *buf, bnum_t block, uint count);
+static status_t virtio_bdev_submit(struct bdev *bdev, bio_request_t *req);
 static status_t virtio_block_init(struct virtio_device *dev, uint32_t host_features);
 
+#define RING_SIZE 256
+
+/* the most data descriptors in one request, so one request can't take more
+ * than a quarter of the ring */
+#define MAX_REQUEST_SEGS (RING_SIZE / 4 - 2)
+
+/* with indirect descriptors a request takes one ring descriptor, which points
+ * to a table of all of them, sized and aligned so it's physically contiguous */
+#define INDIRECT_TABLE_SIZE (MAX_REQUEST_SEGS + 2)
+typedef struct vring_desc virtio_block_indirect_t[INDIRECT_TABLE_SIZE];
+
+/* the header and status of one request in flight. These are indexed by the
+ * head descriptor of the request's chain, and are aligned so none crosses a
+ * page boundary. */
+struct virtio_block_txn {
+    struct virtio_blk_req req;
+    uint8_t status;
+    bio_request_t *bio;
+} __ALIGNED(32);
+
 struct virtio_block_dev {
     struct virtio_device *dev;
 
-    mutex_t lock;
-    event_t io_event;
+    /* guards the ring and txns, taken from the irq handler */
+    spin_lock_t lock;
+
+    /* signaled when descriptors are freed, for submitters waiting on a full ring */
+    event_t desc_event;
 
     /* bio block device */
     bdev_t bdev;
 
-    /* one blk_req structure for io, not crossing a page boundary */
-    struct virtio_blk_req *blk_req;
-    paddr_t blk_req_phys;
+    struct virtio_block_txn *txns;
+
+    /* a table per ring descriptor, if the device takes indirect descriptors */
+    virtio_block_indirect_t *indirect;
 
-    /* one uint8_t response word */
-    uint8_t blk_response;
-    paddr_t blk_response_phys;
+    /* limits on a request's data descriptors, from the device's seg_max and
+     * size_max */
+    size_t max_segs;
+    size_t max_seg_size;
 };
 
 VIRTIO_DEV_CLASS(block, VIRTIO_DEV_ID_BLOCK, NULL, virtio_block_init, NULL);
@@ -91,25 +122,18 @@ static status_t virtio_block_init(struct virtio_device *dev, uint32_t host_featu
     if (!bdev)
         return ERR_NO_MEMORY;
 
-    mutex_init(&bdev->lock);
-    event_init(&bdev->io_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    spin_lock_init(&bdev->lock);
+    event_init(&bdev->desc_event, true, 0);
 
     bdev->dev = dev;
     dev->priv = bdev;
 
-    bdev->blk_req = memalign(sizeof(struct virtio_blk_req), sizeof(struct virtio_blk_req));
-#if WITH_KERNEL_VM
-    bdev->blk_req_phys = vaddr_to_paddr(bdev->blk_req);
-#else
-    bdev->blk_req_phys = (paddr_t)bdev->blk_req;
-#endif
-    LTRACEF("blk_req structure at %p (0x%lx phys)\n", bdev->blk_req, bdev->blk_req_phys);
-
-#if WITH_KERNEL_VM
-    bdev->blk_response_phys = vaddr_to_paddr(&bdev->blk_response);
-#else
-    bdev->blk_response_phys = (paddr_t)&bdev->blk_response;
-#endif
+    bdev->txns = memalign(sizeof(struct virtio_block_txn), RING_SIZE * sizeof(struct virtio_block_txn));
+    if (!bdev->txns) {
+        free(bdev);
+        return ERR_NO_MEMORY;
+    }
+    LTRACEF("txns at %p\n", bdev->txns);
 
     /* make sure the device is reset */
     virtio_reset_device(dev);
@@ -124,10 +148,25 @@ static status_t virtio_block_init(struct virtio_device *dev, uint32_t host_featu
     /* ack and set the driver status bit */
     virtio_status_acknowledge_driver(dev);
 
-    // XXX check features bits and ack/nak them
+    host_features = virtio_negotiate_features(dev, host_features, VIRTIO_BLK_FEATURES);
+
+    bdev->indirect = NULL;
+    if (host_features & (1u << VIRTIO_RING_F_INDIRECT_DESC)) {
+        bdev->indirect = memalign(sizeof(virtio_block_indirect_t),
+                                  RING_SIZE * sizeof(virtio_block_indirect_t));
+        if (!bdev->indirect)
+            LTRACEF("no memory for indirect tables, using the ring\n");
+    }
+
+    bdev->max_segs = MAX_REQUEST_SEGS;
+    if ((host_features & VIRTIO_BLK_F_SEG_MAX) && config->seg_max > 0)
+        bdev->max_segs = MIN(bdev->max_segs, config->seg_max);
+    bdev->max_seg_size = SIZE_MAX;
+    if ((host_features & VIRTIO_BLK_F_SIZE_MAX) && config->size_max > 0)
+        bdev->max_seg_size = config->size_max;
 
     /* allocate a virtio ring */
-    status_t err = virtio_alloc_ring(dev, 0, 256);
+    status_t err = virtio_alloc_ring(dev, 0, RING_SIZE);
     if (err < 0)
         panic("failed to allocate virtio ring\n");
 
@@ -148,6 +187,7 @@ static status_t virtio_block_init(struct virtio_device *dev, uint32_t host_featu
     /* override our block device hooks */
     bdev->bdev.read_block = &virtio_bdev_read_block;
     bdev->bdev.write_block = &virtio_bdev_write_block;
+    bdev->bdev.submit = &virtio_bdev_submit;
 
     bio_register_device(&bdev->bdev);
 
@@ -162,143 +202,306 @@ static enum handler_return virtio_block_irq_driver_callback(struct virtio_device
 
     LTRACEF("dev %p, ring %u, e %p, id %u, len %u\n", dev, ring, e, e->id, e->len);
 
+    spin_lock(&bdev->lock);
+
+    struct virtio_block_txn *txn = &bdev->txns[e->id];
+    bio_request_t *req = txn->bio;
+    uint8_t status = txn->status;
+    txn->bio = NULL;
+
     /* parse our descriptor chain, add back to the free queue */
-    uint16_t i = e->id;
-    for (;;) {
-        int next;
-        struct vring_desc *desc = virtio_desc_index_to_desc(dev, ring, i);
+    virtio_free_desc_chain(dev, ring, e->id);
 
-        //virtio_dump_desc(desc);
+    spin_unlock(&bdev->lock);
 
-        if (desc->flags & VRING_DESC_F_NEXT) {
-            next = desc->next;
-        } else {
-            /* end of chain */
-            next = -1;
-        }
+    /* wake anyone waiting for room in the ring */
+    event_signal(&bdev->desc_event, false);
+
+    LTRACEF("status 0x%hhx\n", status);
+
+    DEBUG_ASSERT(req);
+    req->result = (status == VIRTIO_BLK_S_OK) ? (ssize_t)(req->count * bdev->bdev.block_size) : ERR_IO;
+    req->callback(req);
+
+    return INT_RESCHEDULE;
+}
 
-        virtio_free_desc(dev, ring, i);
+/* find the physically contiguous run of the buffer at va, up to len bytes and
+ * the device's segment size. Returns ERR_INVALID_ARGS if va isn't mapped. */
+static status_t virtio_block_next_seg(struct virtio_block_dev *bdev, vaddr_t va, size_t len,
+                                      paddr_t *pa_out, size_t *seg_len_out)
+{
+#if WITH_KERNEL_VM
+    paddr_t pa = vaddr_to_paddr((void *)va);
+    if (pa == 0)
+        return ERR_INVALID_ARGS;
 
-        if (next < 0)
+    size_t seg_len = MIN(PAGE_ALIGN(va + 1) - va, len);
+
+    /* extend over following pages as long as they're physically adjacent */
+    while (seg_len < len && seg_len < bdev->max_seg_size) {
+        paddr_t next_pa = vaddr_to_paddr((void *)(va + seg_len));
+        if (next_pa != pa + seg_len)
             break;
-        i = next;
+        seg_len += MIN(PAGE_SIZE, len - seg_len);
     }
+#else
+    paddr_t pa = (paddr_t)va;
+    size_t seg_len = len;
+#endif
+    *pa_out = pa;
+    *seg_len_out = MIN(seg_len, bdev->max_seg_size);
+    return NO_ERROR;
+}
 
-    /* signal our event */
-    event_signal(&bdev->io_event, false);
-
-    return INT_RESCHEDULE;
+/* count the data descriptors needed for the buffer, checking that all of it
+ * is mapped */
+static status_t virtio_block_count_segs(struct virtio_block_dev *bdev, vaddr_t va, size_t len,
+                                        size_t *segs_out)
+{
+    size_t segs = 0;
+    while (len > 0) {
+        paddr_t pa;
+        size_t seg_len;
+        status_t err = virtio_block_next_seg(bdev, va, len, &pa, &seg_len);
+        if (err < 0)
+            return err;
+
+        segs++;
+        va += seg_len;
+        len -= seg_len;
+    }
+    *segs_out = segs;
+    return NO_ERROR;
 }
 
-ssize_t virtio_block_read_write(struct virtio_device *dev, void *buf, off_t offset, size_t len, bool write)
+/* fill in an indirect table for the request: the header, a descriptor per
+ * segment of the buffer as already checked by virtio_block_count_segs(), then
+ * the status, chained in order. Returns how many there are. */
+static uint virtio_block_fill_indirect(struct virtio_block_dev *bdev, struct virtio_block_txn *txn,
+                                       struct vring_desc *desc, vaddr_t va, size_t len, bool write)
 {
-    struct virtio_block_dev *bdev = (struct virtio_block_dev *)dev->priv;
+    uint n = 0;
+
+#if WITH_KERNEL_VM
+    desc[n].addr = vaddr_to_paddr(&txn->req);
+#else
+    desc[n].addr = (uint64_t)(uintptr_t)&txn->req;
+#endif
+    desc[n].len = sizeof(struct virtio_blk_req);
+    desc[n].flags = VRING_DESC_F_NEXT;
+    desc[n].next = n + 1;
+    n++;
 
+    while (len > 0) {
+        paddr_t pa;
+        size_t seg_len;
+        __UNUSED status_t err = virtio_block_next_seg(bdev, va, len, &pa, &seg_len);
+        DEBUG_ASSERT(err == NO_ERROR);
+        DEBUG_ASSERT(n < INDIRECT_TABLE_SIZE - 1);
+
+        desc[n].addr = (uint64_t)pa;
+        desc[n].len = seg_len;
+        desc[n].flags = (write ? 0 : VRING_DESC_F_WRITE) | VRING_DESC_F_NEXT;
+        desc[n].next = n + 1;
+        n++;
+
+        va += seg_len;
+        len -= seg_len;
+    }
+
+#if WITH_KERNEL_VM
+    desc[n].addr = vaddr_to_paddr(&txn->status);
+#else
+    desc[n].addr = (uint64_t)(uintptr_t)&txn->status;
+#endif
+    desc[n].len = 1;
+    desc[n].flags = VRING_DESC_F_WRITE;
+    desc[n].next = 0;
+    n++;
+
+    return n;
+}
+
+/* put the request on the ring, with the lock held and enough free descriptors */
+static void virtio_block_queue_locked(struct virtio_block_dev *bdev, bio_request_t *req, size_t len)
+{
+    struct virtio_device *dev = bdev->dev;
+    bool write = req->write;
     uint16_t i;
     struct vring_desc *desc;
-    paddr_t pa;
-    vaddr_t va = (vaddr_t)buf;
+    vaddr_t va = (vaddr_t)req->buf;
 
-    LTRACEF("dev %p, buf %p, offset 0x%llx, len %zu\n", dev, buf, offset, len);
-
-    mutex_acquire(&bdev->lock);
+    if (bdev->indirect) {
+        /* the whole request goes in this descriptor's table */
+        i = virtio_alloc_desc(dev, 0);
+        DEBUG_ASSERT(i != 0xffff);
+        desc = NULL;
+    } else {
+        /* the header, then the buffer's segments get inserted before the status */
+        desc = virtio_alloc_desc_chain(dev, 0, 2, &i);
+        DEBUG_ASSERT(desc);
+        LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
+    }
 
     /* set up the request */
-    bdev->blk_req->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
-    bdev->blk_req->ioprio = 0;
-    bdev->blk_req->sector = offset / 512;
+    struct virtio_block_txn *txn = &bdev->txns[i];
+    txn->req.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    txn->req.ioprio = 0;
+    txn->req.sector = ((uint64_t)req->block * bdev->bdev.block_size) / 512;
+    txn->status = 0xff;
+    txn->bio = req;
     LTRACEF("blk_req type %u ioprio %u sector %llu\n",
-            bdev->blk_req->type, bdev->blk_req->ioprio, bdev->blk_req->sector);
+            txn->req.type, txn->req.ioprio, txn->req.sector);
 
-    /* put together a transfer */
-    desc = virtio_alloc_desc_chain(dev, 0, 3, &i);
-    LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
+    if (bdev->indirect) {
+        uint count = virtio_block_fill_indirect(bdev, txn, bdev->indirect[i], va, len, write);
+        virtio_set_indirect(dev, 0, i, bdev->indirect[i], count);
+        virtio_submit_chain(dev, 0, i);
+        return;
+    }
 
     // XXX not cache safe.
     // At the moment only tested on arm qemu, which doesn't emulate cache.
 
     /* set up the descriptor pointing to the head */
-    desc->addr = bdev->blk_req_phys;
-    desc->len = sizeof(struct virtio_blk_req);
-    desc->flags |= VRING_DESC_F_NEXT;
-
-    /* set up the descriptor pointing to the buffer */
-    desc = virtio_desc_index_to_desc(dev, 0, desc->next);
 #if WITH_KERNEL_VM
-    /* translate the first buffer */
-    pa = vaddr_to_paddr((void *)va);
-    // XXX check for error
-    desc->addr = (uint64_t)pa;
-    /* desc->len is filled in below */
+    desc->addr = vaddr_to_paddr(&txn->req);
 #else
-    desc->addr = (uint64_t)(uintptr_t)buf;
-    desc->len = len;
+    desc->addr = (uint64_t)(uintptr_t)&txn->req;
 #endif
-    desc->flags |= write ? 0 : VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
+    desc->len = sizeof(struct virtio_blk_req);
     desc->flags |= VRING_DESC_F_NEXT;
 
-#if WITH_KERNEL_VM
-    /* see if we need to add more descriptors due to scatter gather */
-    paddr_t next_pa = PAGE_ALIGN(pa + 1);
-    desc->len = MIN(next_pa - pa, len);
-    LTRACEF("first descriptor va 0x%lx desc->addr 0x%llx desc->len %u\n", va, desc->addr, desc->len);
-    len -= desc->len;
+    /* one descriptor per physically contiguous segment of the buffer, already
+     * checked by virtio_block_count_segs() */
     while (len > 0) {
-        /* amount of source buffer handled by this iteration of the loop */
-        size_t len_tohandle = MIN(len, PAGE_SIZE);
-
-        /* translate the next page in the buffer */
-        va = PAGE_ALIGN(va + 1);
-        pa = vaddr_to_paddr((void *)va);
-        // XXX check for error
-        LTRACEF("va now 0x%lx, pa 0x%lx, next_pa 0x%lx, remaining len %zu\n", va, pa, next_pa, len);
-
-        /* is the new translated physical address contiguous to the last one? */
-        if (next_pa == pa) {
-            LTRACEF("extending last one by %zu bytes\n", len_tohandle);
-            desc->len += len_tohandle;
-        } else {
-            uint16_t next_i = virtio_alloc_desc(dev, 0);
-            struct vring_desc *next_desc = virtio_desc_index_to_desc(dev, 0, next_i);
-            DEBUG_ASSERT(next_desc);
-
-            LTRACEF("doesn't extend, need new desc, allocated desc %i (%p)\n", next_i, next_desc);
-
-            /* fill this descriptor in and put it after the last one but before the response descriptor */
-            next_desc->addr = (uint64_t)pa;
-            next_desc->len = len_tohandle;
-            next_desc->flags = write ? 0 : VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
-            next_desc->flags |= VRING_DESC_F_NEXT;
-            next_desc->next = desc->next;
-            desc->next = next_i;
-
-            desc = next_desc;
-        }
-        len -= len_tohandle;
-        next_pa += PAGE_SIZE;
+        paddr_t pa;
+        size_t seg_len;
+        __UNUSED status_t err = virtio_block_next_seg(bdev, va, len, &pa, &seg_len);
+        DEBUG_ASSERT(err == NO_ERROR);
+
+        uint16_t next_i = virtio_alloc_desc(dev, 0);
+        struct vring_desc *next_desc = virtio_desc_index_to_desc(dev, 0, next_i);
+
+        LTRACEF("segment va 0x%lx pa 0x%lx len %zu, desc %u\n", va, pa, seg_len, next_i);
+
+        next_desc->addr = (uint64_t)pa;
+        next_desc->len = seg_len;
+        next_desc->flags = write ? 0 : VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
+        next_desc->flags |= VRING_DESC_F_NEXT;
+        next_desc->next = desc->next;
+        desc->next = next_i;
+
+        desc = next_desc;
+        va += seg_len;
+        len -= seg_len;
     }
-#endif
 
     /* set up the descriptor pointing to the response */
     desc = virtio_desc_index_to_desc(dev, 0, desc->next);
-    desc->addr = bdev->blk_response_phys;
+#if WITH_KERNEL_VM
+    desc->addr = vaddr_to_paddr(&txn->status);
+#else
+    desc->addr = (uint64_t)(uintptr_t)&txn->status;
+#endif
     desc->len = 1;
     desc->flags = VRING_DESC_F_WRITE;
 
     /* submit the transfer */
     virtio_submit_chain(dev, 0, i);
+}
 
-    /* kick it off */
-    virtio_kick(dev, 0);
+static status_t virtio_bdev_submit(struct bdev *_bdev, bio_request_t *req)
+{
+    struct virtio_block_dev *bdev = containerof(_bdev, struct virtio_block_dev, bdev);
+
+    LTRACEF("dev %p, %s buf %p, block 0x%x, count %u\n", bdev, req->write ? "write" : "read",
+            req->buf, req->block, req->count);
 
-    /* wait for the transfer to complete */
-    event_wait(&bdev->io_event);
+    size_t len = req->count * bdev->bdev.block_size;
 
-    LTRACEF("status 0x%hhx\n", bdev->blk_response);
+    /* the header, status and a descriptor per contiguous segment of the buffer */
+    size_t segs;
+    status_t err = virtio_block_count_segs(bdev, (vaddr_t)req->buf, len, &segs);
+    if (err < 0)
+        return err;
+    if (segs > bdev->max_segs)
+        return ERR_TOO_BIG;
+    size_t descs = bdev->indirect ? 1 : segs + 2;
 
-    mutex_release(&bdev->lock);
+    /* wait for room in the ring, leaving the rest of it to requests already queued */
+    spin_lock_saved_state_t state;
+    for (;;) {
+        spin_lock_irqsave(&bdev->lock, state);
+        if (bdev->dev->ring[0].free_count >= descs)
+            break;
+        event_unsignal(&bdev->desc_event);
+        spin_unlock_irqrestore(&bdev->lock, state);
 
-    return len;
+        event_wait(&bdev->desc_event);
+    }
+
+    virtio_block_queue_locked(bdev, req, len);
+
+    /* kick it off, under the lock since it keeps track of the last kick */
+    virtio_kick(bdev->dev, 0);
+
+    spin_unlock_irqrestore(&bdev->lock, state);
+
+    return NO_ERROR;
+}
+
+static void virtio_block_sync_callback(bio_request_t *req)
+{
+    event_signal((event_t *)req->cookie, false);
+}
+
+/* synchronous transfers are queued like any other and waited for. A buffer
+ * too fragmented for one request goes in pieces that are sure to fit. */
+static ssize_t virtio_block_read_write(struct virtio_block_dev *dev, void *buf, bnum_t block, uint count, bool write)
+{
+    event_t done;
+    event_init(&done, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    size_t piece = (dev->max_segs / 2) * MIN(dev->max_seg_size, PAGE_SIZE);
+    uint max_count = MAX(piece / dev->bdev.block_size, 1u);
+    ssize_t total = 0;
+
+    while (count > 0) {
+        bio_request_t req = {
+            .write = write,
+            .buf = buf,
+            .block = block,
+            .count = count,
+            .callback = virtio_block_sync_callback,
+            .cookie = &done,
+        };
+
+        status_t err = virtio_bdev_submit(&dev->bdev, &req);
+        if (err == ERR_TOO_BIG && count > max_count) {
+            req.count = max_count;
+            err = virtio_bdev_submit(&dev->bdev, &req);
+        }
+        if (err < 0) {
+            total = err;
+            break;
+        }
+        event_wait(&done);
+        if (req.result < 0) {
+            total = req.result;
+            break;
+        }
+
+        buf = (uint8_t *)buf + req.result;
+        block += req.count;
+        count -= req.count;
+        total += req.result;
+    }
+
+    event_destroy(&done);
+
+    return total;
 }
 
 static ssize_t virtio_bdev_read_block(struct bdev *bdev, void *buf, bnum_t block, uint count)
@@ -307,12 +510,7 @@ static ssize_t virtio_bdev_read_block(struct bdev *bdev, void *buf, bnum_t block
 
     LTRACEF("dev %p, buf %p, block 0x%x, count %u\n", bdev, buf, block, count);
 
-    if (virtio_block_read_write(dev->dev, buf, (off_t)block * dev->bdev.block_size,
-                                count * dev->bdev.block_size, false) == 0) {
-        return count * dev->bdev.block_size;
-    } else {
-        return ERR_IO;
-    }
+    return virtio_block_read_write(dev, buf, block, count, false);
 }
 
 static ssize_t virtio_bdev_write_block(struct bdev *bdev, const void *buf, bnum_t block, uint count)
@@ -321,11 +519,5 @@ static ssize_t virtio_bdev_write_block(struct bdev *bdev, const void *buf, bnum_
 
     LTRACEF("dev %p, buf %p, block 0x%x, count %u\n", bdev, buf, block, count);
 
-    if (virtio_block_read_write(dev->dev, (void *)buf, (off_t)block * dev->bdev.block_size,
-                                count * dev->bdev.block_size, true) == 0) {
-        return count * dev->bdev.block_size;
-    } else {
-        return ERR_IO;
-    }
+    return virtio_block_read_write(dev, (void *)buf, block, count, true);
 }
-
@@ -447,7 +447,7 @@ static status_t virtio_gpu_init(struct virtio_device *dev, uint32_t host_feature
     /* ack and set the driver status bit */
     virtio_status_acknowledge_driver(dev);
 
-    // XXX check features bits and ack/nak them
+    virtio_negotiate_features(dev, host_features, 1u << VIRTIO_RING_F_EVENT_IDX);
 
     /* allocate a virtio ring */
     virtio_alloc_ring(dev, 0, 16);
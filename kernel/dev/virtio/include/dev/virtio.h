@@ -50,6 +50,9 @@ struct virtio_device {
 
     void *priv; /* a place for the driver to put private data */
 
+    /* features the driver and the host agreed on */
+    uint32_t features;
+
     enum handler_return (*irq_driver_callback)(struct virtio_device *dev, uint ring, const struct vring_used_elem *e);
     enum handler_return (*config_change_callback)(struct virtio_device *dev);
 
@@ -62,6 +65,11 @@ void virtio_reset_device(struct virtio_device *dev);
 void virtio_status_acknowledge_driver(struct virtio_device *dev);
 void virtio_status_driver_ok(struct virtio_device *dev);
 
+/* accept the features in wanted that the host offers, before DRIVER_OK.
+ * returns the features in use. */
+uint32_t virtio_negotiate_features(struct virtio_device *dev, uint32_t host_features,
+                                   uint32_t wanted);
+
 /* api used by devices to interact with the virtio bus */
 status_t virtio_alloc_ring(struct virtio_device *dev, uint index, uint16_t len) __NONNULL();
 
@@ -85,9 +93,17 @@ static inline struct vring_desc *virtio_desc_index_to_desc(struct virtio_device
 
 void virtio_dump_desc(const struct vring_desc *desc);
 
+/* with VIRTIO_RING_F_INDIRECT_DESC, make the descriptor at desc_index stand
+ * for the count descriptors in table, chained by index within it. table has to
+ * be physically contiguous, and stay put until the chain is used. */
+void virtio_set_indirect(struct virtio_device *dev, uint ring_index, uint16_t desc_index,
+                         struct vring_desc *table, uint count);
+
 /* submit a chain to the avail list */
 void virtio_submit_chain(struct virtio_device *dev, uint ring_index, uint16_t desc_index);
 
+/* notify the device of new chains on the ring. with VIRTIO_RING_F_EVENT_IDX
+ * the notification is skipped unless the device asked for one. */
 void virtio_kick(struct virtio_device *dev, uint ring_idnex);
 
 /* class driver registration */
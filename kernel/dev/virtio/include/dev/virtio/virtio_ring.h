@@ -101,6 +101,9 @@ struct vring {
 
     uint16_t last_used;
 
+    /* avail index as of the last kick, for event index suppression */
+    uint16_t kicked_idx;
+
     struct vring_desc *desc;
 
     struct vring_avail *avail;
@@ -145,6 +148,7 @@ static inline void vring_init(struct vring *vr, unsigned int num, void *p,
     vr->free_list = 0xffff;
     vr->free_count = 0;
     vr->last_used = 0;
+    vr->kicked_idx = 0;
     vr->desc = p;
     vr->avail = p + num*sizeof(struct vring_desc);
     vr->used = (void *)(((unsigned long)&vr->avail->ring[num] + sizeof(uint16_t)
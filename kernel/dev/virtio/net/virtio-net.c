@@ -61,6 +61,10 @@ struct virtio_net_hdr {
 #define VIRTIO_NET_F_MQ                     (1<<22)
 #define VIRTIO_NET_F_CTRL_MAC_ADDR          (1<<23)
 
+/* the ones this driver uses */
+#define VIRTIO_NET_FEATURES \
+    (VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | (1u << VIRTIO_RING_F_EVENT_IDX))
+
 #define VIRTIO_NET_S_LINK_UP                (1<<0)
 #define VIRTIO_NET_S_ANNOUNCE               (1<<1)
 
@@ -91,7 +95,7 @@ struct virtio_net_dev {
 
 static enum handler_return virtio_net_irq_driver_callback(struct virtio_device *dev, uint ring, const struct vring_used_elem *e);
 static int virtio_net_rx_worker(void *arg);
-static status_t virtio_net_queue_rx(struct virtio_net_dev *ndev, pktbuf_t *p);
+static status_t virtio_net_queue_rx(struct virtio_net_dev *ndev, pktbuf_t *p, bool kick);
 static status_t virtio_net_init(struct virtio_device *dev, uint32_t host_features);
 
 VIRTIO_DEV_CLASS(net, VIRTIO_DEV_ID_NET, NULL, virtio_net_init, NULL);
@@ -148,8 +152,8 @@ static status_t virtio_net_init(struct virtio_device *dev, uint32_t host_feature
     /* ack and set the driver status bit */
     virtio_status_acknowledge_driver(dev);
 
-    // XXX check features bits and ack/nak them
     dump_feature_bits(host_features);
+    virtio_negotiate_features(dev, host_features, VIRTIO_NET_FEATURES);
 
     /* set our irq handler */
     dev->irq_driver_callback = &virtio_net_irq_driver_callback;
@@ -180,9 +184,10 @@ status_t virtio_net_start(void)
     for (uint i = 0; i < RX_RING_SIZE - 1; i++) {
         pktbuf_t *p = pktbuf_alloc();
         if (p) {
-            virtio_net_queue_rx(the_ndev, p);
+            virtio_net_queue_rx(the_ndev, p, false);
         }
     }
+    virtio_net_kick_rx(the_ndev);
 
     return NO_ERROR;
 }
@@ -278,7 +283,18 @@ static status_t virtio_net_queue_tx(struct virtio_net_dev *ndev, const void *buf
     return err;
 }
 
-static status_t virtio_net_queue_rx(struct virtio_net_dev *ndev, pktbuf_t *p)
+static void virtio_net_kick_rx(struct virtio_net_dev *ndev)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&ndev->lock, state);
+
+    virtio_kick(ndev->dev, RING_RX);
+
+    spin_unlock_irqrestore(&ndev->lock, state);
+}
+
+/* kick or not, so a batch of buffers can go to the device with one kick */
+static status_t virtio_net_queue_rx(struct virtio_net_dev *ndev, pktbuf_t *p, bool kick)
 {
     struct virtio_device *vdev = ndev->dev;
 
@@ -313,7 +329,8 @@ static status_t virtio_net_queue_rx(struct virtio_net_dev *ndev, pktbuf_t *p)
     virtio_submit_chain(vdev, RING_RX, i);
 
     /* kick it off */
-    virtio_kick(vdev, RING_RX);
+    if (kick)
+        virtio_kick(vdev, RING_RX);
 
     spin_unlock_irqrestore(&ndev->lock, state);
 
@@ -403,8 +420,12 @@ static int virtio_net_rx_worker(void *arg)
 
             spin_unlock_irqrestore(&ndev->lock, state);
 
-            if (!p)
-                break; /* nothing left in the queue, go back to waiting */
+            if (!p) {
+                /* nothing left in the queue, give the device back its
+                 * buffers and go back to waiting */
+                virtio_net_kick_rx(ndev);
+                break;
+            }
 
             LTRACEF("got packet len %u\n", p->dlen);
 
@@ -416,7 +437,7 @@ static int virtio_net_rx_worker(void *arg)
             }
 
             /* requeue the pktbuf in the rx queue */
-            virtio_net_queue_rx(ndev, p);
+            virtio_net_queue_rx(ndev, p, false);
         }
     }
     return 0;
@@ -78,18 +78,31 @@ static enum handler_return virtio_mmio_irq(void *arg)
             struct vring *ring = &dev->ring[r];
             LTRACEF("ring %u: used flags 0x%hhx idx 0x%hhx last_used %u\n", r, ring->used->flags, ring->used->idx, ring->last_used);
 
-            uint cur_idx = ring->used->idx;
-            for (uint i = ring->last_used; i != (cur_idx & ring->num_mask); i = (i + 1) & ring->num_mask) {
-                LTRACEF("looking at idx %u\n", i);
-
-                // process chain
-                struct vring_used_elem *used_elem = &ring->used->ring[i];
-                LTRACEF("id %u, len %u\n", used_elem->id, used_elem->len);
-
-                DEBUG_ASSERT(dev->irq_driver_callback);
-                ret |= dev->irq_driver_callback(dev, r, used_elem);
-
-                ring->last_used = (ring->last_used + 1) & ring->num_mask;
+            uint16_t cur_idx;
+            for (;;) {
+                cur_idx = ring->used->idx;
+                for (uint i = ring->last_used; i != (cur_idx & ring->num_mask); i = (i + 1) & ring->num_mask) {
+                    LTRACEF("looking at idx %u\n", i);
+
+                    // process chain
+                    struct vring_used_elem *used_elem = &ring->used->ring[i];
+                    LTRACEF("id %u, len %u\n", used_elem->id, used_elem->len);
+
+                    DEBUG_ASSERT(dev->irq_driver_callback);
+                    ret |= dev->irq_driver_callback(dev, r, used_elem);
+
+                    ring->last_used = (ring->last_used + 1) & ring->num_mask;
+                }
+
+                if (!(dev->features & (1u << VIRTIO_RING_F_EVENT_IDX)))
+                    break;
+
+                /* ask for an interrupt on the next completion only, and pick
+                 * up any that raced with asking */
+                vring_used_event(ring) = cur_idx;
+                DSB;
+                if (ring->used->idx == cur_idx)
+                    break;
             }
         }
     }
@@ -254,6 +267,22 @@ struct vring_desc *virtio_alloc_desc_chain(struct virtio_device *dev, uint ring_
     return last;
 }
 
+void virtio_set_indirect(struct virtio_device *dev, uint ring_index, uint16_t desc_index,
+                         struct vring_desc *table, uint count)
+{
+    DEBUG_ASSERT(dev->features & (1u << VIRTIO_RING_F_INDIRECT_DESC));
+
+    struct vring_desc *desc = virtio_desc_index_to_desc(dev, ring_index, desc_index);
+
+#if WITH_KERNEL_VM
+    desc->addr = vaddr_to_paddr(table);
+#else
+    desc->addr = (uint64_t)(uintptr_t)table;
+#endif
+    desc->len = count * sizeof(struct vring_desc);
+    desc->flags = VRING_DESC_F_INDIRECT;
+}
+
 void virtio_submit_chain(struct virtio_device *dev, uint ring_index, uint16_t desc_index)
 {
     LTRACEF("dev %p, ring %u, desc %u\n", dev, ring_index, desc_index);
@@ -274,6 +303,19 @@ void virtio_kick(struct virtio_device *dev, uint ring_index)
 {
     LTRACEF("dev %p, ring %u\n", dev, ring_index);
 
+    if (dev->features & (1u << VIRTIO_RING_F_EVENT_IDX)) {
+        struct vring *ring = &dev->ring[ring_index];
+        uint16_t new_idx = ring->avail->idx;
+        uint16_t old_idx = ring->kicked_idx;
+        ring->kicked_idx = new_idx;
+
+        /* the new avail index has to be out before reading how far the
+         * device has got, or it could go to sleep on the old one */
+        DSB;
+        if (!vring_need_event(vring_avail_event(ring), new_idx, old_idx))
+            return;
+    }
+
     dev->mmio_config->queue_notify = ring_index;
     DSB;
 }
@@ -357,6 +399,19 @@ void virtio_status_acknowledge_driver(struct virtio_device *dev)
     dev->mmio_config->status |= VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
 }
 
+uint32_t virtio_negotiate_features(struct virtio_device *dev, uint32_t host_features,
+                                   uint32_t wanted)
+{
+    dev->features = host_features & wanted;
+
+    dev->mmio_config->guest_features_sel = 0;
+    dev->mmio_config->guest_features = dev->features;
+
+    LTRACEF("dev %p, features 0x%x\n", dev, dev->features);
+
+    return dev->features;
+}
+
 void virtio_status_driver_ok(struct virtio_device *dev)
 {
     dev->mmio_config->status |= VIRTIO_STATUS_DRIVER_OK;
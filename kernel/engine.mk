@@ -21,6 +21,7 @@ BUILDDIR_SUFFIX ?=
 DEBUG ?= 2
 ENABLE_BUILD_LISTFILES ?= false
 ENABLE_BUILD_SYSROOT ?= false
+ENABLE_LOCK_STATS ?= false
 CLANG ?= 0
 USE_GOLD ?= true
 LKNAME ?= magenta
@@ -51,6 +51,11 @@ void arch_clean_invalidate_cache_range(addr_t start, size_t len);
 void arch_invalidate_cache_range(addr_t start, size_t len);
 void arch_sync_cache_range(addr_t start, size_t len);
 
+/* Clear a page, without pulling it into the cache where the cpu can tell
+ * it not to. For clearing pages in bulk, which won't all be touched again
+ * soon. */
+void arch_zero_page(void *ptr);
+
 /* Used to suspend work on a CPU until it is further shutdown.
  * This will only be invoked with interrupts disabled.  This function
  * must not re-enter the scheduler.
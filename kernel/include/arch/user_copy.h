@@ -39,4 +39,49 @@ status_t arch_copy_from_user(void *dst, const void *src, size_t len);
  */
 status_t arch_copy_to_user(void *dst, const void *src, size_t len);
 
+/*
+ * @brief Copy a single 1, 2, 4 or 8 byte value from userspace
+ *
+ * Same as arch_copy_from_user, but limited to sizes that can be moved with a
+ * single load so that architectures can skip the general copy setup.
+ *
+ * @return NO_ERROR on success
+ */
+status_t arch_copy_from_user_fixed(void *dst, const void *src, size_t len);
+
+/*
+ * @brief Copy a single 1, 2, 4 or 8 byte value to userspace
+ *
+ * @return NO_ERROR on success
+ */
+status_t arch_copy_to_user_fixed(void *dst, const void *src, size_t len);
+
+/* One piece of a batched copy, see arch_copy_from_user_many(). */
+typedef struct user_copy_vec {
+    void *dst;
+    const void *src;
+    size_t len;
+} user_copy_vec_t;
+
+/*
+ * @brief Copy several small buffers from userspace in one go
+ *
+ * Every src is validated before anything is copied, and user access is
+ * opened once for the whole batch. On failure the kernel side buffers may
+ * have been partly written.
+ *
+ * @return NO_ERROR on success
+ */
+status_t arch_copy_from_user_many(const user_copy_vec_t *vec, size_t count);
+
+/*
+ * @brief Copy several small buffers to userspace in one go
+ *
+ * Every dst is validated before anything is copied. On failure some of the
+ * user buffers may already have been written.
+ *
+ * @return NO_ERROR on success
+ */
+status_t arch_copy_to_user_many(const user_copy_vec_t *vec, size_t count);
+
 __END_CDECLS
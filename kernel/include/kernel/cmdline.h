@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <compiler.h>
 
 __BEGIN_CDECLS
@@ -26,4 +27,8 @@ const char* cmdline_get(const char* key);
 // return true otherwise
 bool cmdline_get_bool(const char* key, bool _default);
 
+// return _default if key not found or its value is not a number
+// return key's value parsed as an unsigned number (as by strtoul() with base 0) otherwise
+uint32_t cmdline_get_uint32(const char* key, uint32_t _default);
+
 __END_CDECLS
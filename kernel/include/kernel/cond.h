@@ -30,6 +30,10 @@ typedef struct cond {
 void cond_init(cond_t *cond);
 void cond_destroy(cond_t *cond);
 status_t cond_wait_timeout(cond_t *cond, mutex_t *mutex, lk_time_t timeout);
+/* interruptable may return early with ERR_INTERRUPTED if the thread is killed, with the mutex
+ * held again either way */
+status_t cond_wait_timeout_etc(cond_t *cond, mutex_t *mutex, lk_time_t timeout,
+                               bool interruptable);
 void cond_signal(cond_t *cond);
 void cond_broadcast(cond_t *cond);
 
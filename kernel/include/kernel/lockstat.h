@@ -0,0 +1,43 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <arch/spinlock.h>
+#include <compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+__BEGIN_CDECLS
+
+/*
+ * Lock statistics, built in with ENABLE_LOCK_STATS=true.
+ *
+ * Locks are counted by class, which is named by a "file:line" string: where
+ * a mutex was initialized, or where a spin lock is taken since a spin lock is
+ * only a word. Times are in cycles. The lockstat console command shows the
+ * classes with the most time spent waiting.
+ */
+
+#if WITH_LOCK_STATS
+
+#define __LOCKSTAT_STR2(x) #x
+#define __LOCKSTAT_STR(x) __LOCKSTAT_STR2(x)
+#define LOCKSTAT_SITE (__FILE__ ":" __LOCKSTAT_STR(__LINE__))
+
+/* a mutex of class site was taken, after waiting wait cycles if contended */
+void lockstat_mutex_acquired(const char *site, bool contended, uint32_t wait);
+/* and let go of after hold cycles */
+void lockstat_mutex_released(const char *site, uint32_t hold);
+
+/* spin_lock() and friends turn into these, interrupts already disabled */
+void lockstat_spin_lock(spin_lock_t *lock, const char *site);
+int lockstat_spin_trylock(spin_lock_t *lock, const char *site);
+void lockstat_spin_unlock(spin_lock_t *lock);
+
+#endif // WITH_LOCK_STATS
+
+__END_CDECLS
@@ -12,6 +12,7 @@
 #include <compiler.h>
 #include <debug.h>
 #include <stdint.h>
+#include <kernel/lockstat.h>
 #include <kernel/thread.h>
 
 __BEGIN_CDECLS;
@@ -23,22 +24,44 @@ typedef struct mutex {
     thread_t *holder;
     int count;
     wait_queue_t wait;
+    /* node in the holder's list of held mutexes, for priority inheritance */
+    struct list_node holder_node;
+#if WITH_LOCK_STATS
+    /* the lock class, where the mutex was initialized */
+    const char *lockstat_site;
+    uint32_t lockstat_acquired_at;
+#endif
 } mutex_t;
 
+#if WITH_LOCK_STATS
+#define MUTEX_LOCKSTAT_INITIAL_VALUE .lockstat_site = LOCKSTAT_SITE,
+#else
+#define MUTEX_LOCKSTAT_INITIAL_VALUE
+#endif
+
 #define MUTEX_INITIAL_VALUE(m) \
 { \
     .magic = MUTEX_MAGIC, \
     .holder = NULL, \
     .count = 0, \
     .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
+    .holder_node = LIST_INITIAL_CLEARED_VALUE, \
+    MUTEX_LOCKSTAT_INITIAL_VALUE \
 }
 
 /* Rules for Mutexes:
  * - Mutexes are only safe to use from thread context.
  * - Mutexes are non-recursive.
+ * - Mutexes implement priority inheritance: while a thread is blocked
+ *   acquiring a mutex, the holder (and anything the holder is itself blocked
+ *   behind) runs at no less than the blocked thread's priority.
 */
 
 void mutex_init(mutex_t *);
+#if WITH_LOCK_STATS
+void mutex_init_lockstat(mutex_t *, const char *site);
+#define mutex_init(m) mutex_init_lockstat(m, LOCKSTAT_SITE)
+#endif
 void mutex_destroy(mutex_t *);
 status_t mutex_acquire_timeout(mutex_t *, lk_time_t); /* try to acquire the mutex with a timeout value */
 status_t mutex_release(mutex_t *);
@@ -0,0 +1,61 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <compiler.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <kernel/thread.h>
+
+__BEGIN_CDECLS;
+
+/* scheduler event types */
+enum {
+    SCHED_TRACE_ENQUEUE = 0,    /* thread made ready on a cpu's run queue */
+    SCHED_TRACE_DISPATCH,       /* thread picked to run */
+    SCHED_TRACE_PREEMPT,        /* running thread went back to a run queue */
+    SCHED_TRACE_BLOCK,          /* running thread blocked or went to sleep */
+    SCHED_TRACE_EXIT,           /* running thread exited */
+};
+
+/* a single scheduler event. each cpu records into its own ring, with
+ * interrupts disabled, so no locking is needed on the write side. readers
+ * stop recording and wait for the events in progress to finish first. */
+struct sched_trace_record {
+    lk_bigtime_t timestamp;     /* current_time_hires() */
+    const struct thread *thread;
+    uint32_t cycles;            /* arch_cycle_count() at the time of the event */
+    uint32_t arg;               /* DISPATCH: us spent ready, 0 if unknown */
+    uint32_t sched_cycles;      /* DISPATCH: cycles spent in the scheduler */
+    uint8_t event;
+    uint8_t cpu;                /* cpu whose run queue the event concerns */
+    uint16_t queue_depth;       /* ready threads queued on that cpu */
+};
+
+#if SCHED_TRACE
+
+#ifndef SCHED_TRACE_LEN
+#define SCHED_TRACE_LEN 256
+#endif
+
+extern volatile bool sched_trace_enable;
+
+void sched_trace_add(uint event, const struct thread *t, uint cpu, uint queue_depth,
+                     uint32_t arg, uint32_t sched_cycles);
+void sched_trace_dump(void);
+void sched_trace_reset(void);
+
+#else // !SCHED_TRACE
+
+#define sched_trace_enable (false)
+
+static inline void sched_trace_dump(void) {}
+static inline void sched_trace_reset(void) {}
+
+#endif
+
+__END_CDECLS;
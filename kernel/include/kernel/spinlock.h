@@ -9,9 +9,16 @@
 
 #include <compiler.h>
 #include <arch/spinlock.h>
+#include <kernel/lockstat.h>
 
 __BEGIN_CDECLS
 
+#if WITH_LOCK_STATS
+/* counted against the line taking the lock */
+#define spin_lock(lock) lockstat_spin_lock(lock, LOCKSTAT_SITE)
+#define spin_trylock(lock) lockstat_spin_trylock(lock, LOCKSTAT_SITE)
+#define spin_unlock(lock) lockstat_spin_unlock(lock)
+#else
 /* interrupts should already be disabled */
 static inline void spin_lock(spin_lock_t *lock)
 {
@@ -29,6 +36,7 @@ static inline void spin_unlock(spin_lock_t *lock)
 {
     arch_spin_unlock(lock);
 }
+#endif
 
 static inline void spin_lock_init(spin_lock_t *lock)
 {
@@ -52,6 +60,13 @@ static inline bool spin_lock_held(spin_lock_t *lock)
 #define SPIN_LOCK_FLAG_INTERRUPTS ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS
 
 /* same as spin lock, but save disable and save interrupt state first */
+#if WITH_LOCK_STATS
+#define spin_lock_save(lock, statep, flags) \
+    do { \
+        arch_interrupt_save(statep, flags); \
+        lockstat_spin_lock(lock, LOCKSTAT_SITE); \
+    } while (0)
+#else
 static inline void spin_lock_save(
     spin_lock_t *lock,
     spin_lock_saved_state_t *statep,
@@ -60,6 +75,7 @@ static inline void spin_lock_save(
     arch_interrupt_save(statep, flags);
     spin_lock(lock);
 }
+#endif
 
 /* restore interrupt state before unlocking */
 static inline void spin_unlock_restore(
@@ -27,6 +27,7 @@ __BEGIN_CDECLS;
 /* debug-enable runtime checks */
 #if LK_DEBUGLEVEL > 1
 #define THREAD_STATS 1
+#define SCHED_TRACE 1
 #define THREAD_STACK_BOUNDS_CHECK 1
 #ifndef THREAD_STACK_PADDING_SIZE
 #define THREAD_STACK_PADDING_SIZE 256
@@ -42,6 +43,28 @@ enum thread_state {
     THREAD_DEATH,
 };
 
+/* what a thread is blocked on, for accounting. set by the code about to block
+ * with thread_set_wait_reason(), anything else is counted as other. */
+enum thread_wait_reason {
+    THREAD_WAIT_OTHER = 0,
+    THREAD_WAIT_SLEEP,
+    THREAD_WAIT_MUTEX,
+    THREAD_WAIT_FUTEX,
+    THREAD_WAIT_PORT,
+    THREAD_WAIT_HANDLE, /* waiting on handle signals: pipes, events, ... */
+    THREAD_WAIT_REASONS,
+};
+
+/* the accounting of a thread's time by state, in microseconds, and of how
+ * often it has left the cpu */
+struct thread_time_stats {
+    lk_bigtime_t runtime_us;
+    lk_bigtime_t ready_us;
+    lk_bigtime_t blocked_us[THREAD_WAIT_REASONS];
+    uint64_t context_switches;
+    uint64_t preemptions; /* of the switches, those while still runnable */
+};
+
 typedef int (*thread_start_routine)(void *arg);
 typedef void (*thread_trampoline_routine)(void) __NO_RETURN;
 typedef void (*thread_exit_callback_t)(void *arg);
@@ -78,15 +101,41 @@ typedef struct thread {
 
     /* active bits */
     struct list_node queue_node;
-    int priority;
+    int priority; /* effective priority, including any inherited priority */
+    int base_priority; /* priority set at creation or by thread_set_priority() */
+    /* highest priority lent to this thread from outside the kernel mutex code,
+     * such as by waiters on a user PI futex it owns. 0 if none. */
+    int inherited_priority;
     enum thread_state state;
     int remaining_quantum;
     unsigned int flags;
     unsigned int signals;
 #if WITH_SMP
     int curr_cpu;
+    int last_cpu; /* cpu the thread last ran on, for wakeup placement */
     int pinned_cpu; /* only run on pinned_cpu if >= 0 */
+    uint32_t cpu_affinity; /* otherwise only on these cpus, a bit per cpu */
 #endif
+    /* deadline scheduling, see thread_set_deadline(). deadline_period_us is
+     * 0 for threads scheduled by priority. deadline_abs_us and
+     * deadline_budget_us are the current period's deadline and the runtime
+     * left in it as of deadline_charged_us, and deadline_replenish_us when
+     * a throttled thread's next period starts, 0 if it isn't throttled. */
+    lk_bigtime_t deadline_runtime_us;
+    lk_bigtime_t deadline_rel_us;
+    lk_bigtime_t deadline_period_us;
+    lk_bigtime_t deadline_abs_us;
+    int64_t deadline_budget_us;
+    lk_bigtime_t deadline_charged_us;
+    lk_bigtime_t deadline_replenish_us;
+    uint deadline_cpu;
+    /* about to block until the threads it wakes get back to it, so they are
+     * better off queued on its own cpu and run in its place. only touched by
+     * the thread itself. */
+    bool sync_wakeup;
+    /* how late, in ms, the timeouts of this thread's sleeps and waits may
+     * fire so they can share a wakeup with other timers. 0 for none. */
+    lk_time_t timer_slack;
 
     /* pointer to the kernel address space this thread is associated with */
 #if WITH_KERNEL_VM
@@ -99,10 +148,29 @@ typedef struct thread {
      * THREAD_RUNNING state, this excludes the time it has accrued since it
      * left the scheduler. */
     lk_bigtime_t runtime_us;
+    /* time spent in a run queue and blocked or sleeping, by wait reason */
+    lk_bigtime_t ready_us;
+    lk_bigtime_t blocked_us[THREAD_WAIT_REASONS];
+    /* when the thread last became ready, or blocked, 0 if it is neither */
+    lk_bigtime_t ready_since_us;
+    lk_bigtime_t blocked_since_us;
+    uint8_t wait_reason;
+    uint8_t blocked_reason;
+    uint64_t context_switches;
+    uint64_t preemptions;
+#if SCHED_TRACE
+    /* when the thread last entered a run queue, 0 if tracing was off */
+    lk_bigtime_t ready_time_us;
+#endif
 
     /* if blocked, a pointer to the wait queue */
     struct wait_queue *blocking_wait_queue;
 
+    /* priority inheritance: the kernel mutexes this thread holds and, if
+     * blocked acquiring one, the mutex it is waiting for */
+    struct list_node held_mutexes;
+    struct mutex *blocking_mutex;
+
     /* return code if woken up abnornmally from suspend, sleep, or block */
     status_t blocked_status;
 
@@ -144,13 +212,19 @@ typedef struct thread {
 
 #if WITH_SMP
 #define thread_curr_cpu(t) ((t)->curr_cpu)
+#define thread_last_cpu(t) ((t)->last_cpu)
 #define thread_pinned_cpu(t) ((t)->pinned_cpu)
+#define thread_cpu_affinity(t) ((t)->cpu_affinity)
 #define thread_set_curr_cpu(t,c) ((t)->curr_cpu = (c))
+#define thread_set_last_cpu(t,c) ((t)->last_cpu = (c))
 #define thread_set_pinned_cpu(t, c) ((t)->pinned_cpu = (c))
 #else
 #define thread_curr_cpu(t) (0)
+#define thread_last_cpu(t) (0)
 #define thread_pinned_cpu(t) (-1)
+#define thread_cpu_affinity(t) (1u)
 #define thread_set_curr_cpu(t,c) do {} while(0)
+#define thread_set_last_cpu(t,c) do {} while(0)
 #define thread_set_pinned_cpu(t, c) do {} while(0)
 #endif
 
@@ -193,6 +267,23 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout);
 status_t thread_detach_and_resume(thread_t *t);
 status_t thread_set_real_time(thread_t *t);
 
+/* run t ahead of every priority, earliest deadline first, for runtime_us in
+ * every period_us, due deadline_us into the period. a thread that runs out of
+ * runtime waits for its next period. fails with ERR_NO_RESOURCES if no cpu
+ * has that much time left to reserve. a runtime_us of 0 goes back to
+ * scheduling t by priority. */
+status_t thread_set_deadline(thread_t *t, lk_bigtime_t runtime_us,
+                             lk_bigtime_t deadline_us, lk_bigtime_t period_us);
+void thread_get_deadline(thread_t *t, lk_bigtime_t *runtime_us,
+                         lk_bigtime_t *deadline_us, lk_bigtime_t *period_us);
+
+/* only run t on the cpus in affinity, a bit per cpu. bits past the last cpu
+ * are ignored, and ERR_INVALID_ARGS returned if that leaves none. a
+ * deadline thread moves its reservation if it has to, and fails with
+ * ERR_NO_RESOURCES if none of the cpus has room. a pinned thread ignores
+ * its affinity until it is unpinned. */
+status_t thread_set_cpu_affinity(thread_t *t, uint32_t affinity);
+
 /* wait for at least delay amount of time. interruptable may return early with ERR_INTERRUPTED
  * if thread is signalled for kill.
  */
@@ -204,16 +295,28 @@ static inline status_t thread_sleep(lk_time_t delay) { return thread_sleep_etc(d
 /* deliver a kill signal to a thread */
 void thread_kill(thread_t *t, bool block);
 
-/* process pending signals, may never return because of kill signal */
-void thread_process_pending_signals(void);
+/* the accounting of t so far, including its time in its current state */
+void thread_get_time_stats(thread_t *t, struct thread_time_stats *stats);
 
 void dump_thread(thread_t *t);
 void arch_dump_thread(thread_t *t);
 void dump_all_threads(void);
+void dump_run_queues(void);
+
+/* priority inheritance, thread lock must be held.
+ * thread_inherit_priority_locked() raises t, and whatever t is blocked
+ * behind, to at least priority.
+ * thread_update_priority_locked() recomputes the priority of t from its base
+ * priority, t->inherited_priority and the waiters of the mutexes it holds,
+ * and passes any change on to the holder of the mutex t is blocked on.
+ */
+void thread_inherit_priority_locked(thread_t *t, int priority);
+void thread_update_priority_locked(thread_t *t);
 
 /* scheduler routines */
 void thread_yield(void); /* give up the cpu voluntarily */
 void thread_preempt(void); /* get preempted (inserted into head of run queue) */
+void thread_preempt_if_needed(void); /* get preempted only if a higher priority thread is ready here */
 void thread_block(void); /* block on something and reschedule */
 void thread_unblock(thread_t *t, bool resched); /* go back in the run queue */
 
@@ -228,6 +331,40 @@ enum handler_return thread_timer_tick(void);
 thread_t *get_current_thread(void);
 void set_current_thread(thread_t *);
 
+/* process pending signals, may never return because of kill signal.
+ * the pending check is inlined as it sits on every return to user space. */
+void thread_process_pending_signals_slow(void);
+
+static inline void thread_process_pending_signals(void)
+{
+    if (unlikely(get_current_thread()->signals != 0))
+        thread_process_pending_signals_slow();
+}
+
+/* mark the current thread as about to wait on the threads it wakes up, so
+ * that they are queued to run on this cpu in its place. the flag should stay
+ * set until the thread has blocked so the scheduler can switch straight to
+ * the thread it woke. */
+static inline void thread_set_sync_wakeup(bool sync)
+{
+    get_current_thread()->sync_wakeup = sync;
+}
+
+static inline bool thread_get_sync_wakeup(void)
+{
+    return get_current_thread()->sync_wakeup;
+}
+
+/* set what the current thread's next blocks are for, returning the previous
+ * reason so that it can be put back afterwards */
+static inline enum thread_wait_reason thread_set_wait_reason(enum thread_wait_reason reason)
+{
+    thread_t *t = get_current_thread();
+    enum thread_wait_reason old = (enum thread_wait_reason)t->wait_reason;
+    t->wait_reason = (uint8_t)reason;
+    return old;
+}
+
 /* scheduler lock */
 extern spin_lock_t thread_lock;
 
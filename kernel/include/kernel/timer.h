@@ -30,6 +30,9 @@ typedef struct timer {
 
     timer_callback callback;
     void *arg;
+
+    /* set while the callback is running, see timer_cancel_sync() */
+    volatile bool running;
 } timer_t;
 
 #define TIMER_INITIAL_VALUE(t) \
@@ -40,22 +43,35 @@ typedef struct timer {
     .periodic_time = 0, \
     .callback = NULL, \
     .arg = NULL, \
+    .running = false, \
 }
 
 /* Rules for Timers:
  * - Timer callbacks occur from interrupt context
  * - Timers may be programmed or canceled from interrupt or thread context
  * - Timers may be canceled or reprogrammed from within their callback
- * - Timers currently are dispatched from a 10ms periodic tick
+ * - Timers are kept in a per cpu timing wheel, and the hardware timer is
+ *   programmed for the next pending event rather than a periodic tick
 */
 void timer_initialize(timer_t *);
 void timer_set_oneshot(timer_t *, lk_time_t delay, timer_callback, void *arg);
+void timer_set_oneshot_slack(timer_t *, lk_time_t delay, lk_time_t slack,
+                             timer_callback, void *arg);
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 void timer_cancel(timer_t *);
 
+/* Cancel a timer and wait for its callback to finish if it is running on
+ * another cpu, after which the timer's memory may be reused. Must be called
+ * from thread context, not from the callback, and without holding anything
+ * the callback takes.
+ */
+void timer_cancel_sync(timer_t *);
+
 void timer_transition_off_cpu(uint old_cpu);
 void timer_thaw_percpu(void);
 
+lk_time_t timer_idle_time(lk_time_t now);
+
 __END_CDECLS;
 
 #endif
@@ -70,12 +70,20 @@ typedef struct vm_page {
 
     uint8_t state;
     uint8_t flags;
+    uint8_t arena; /* index of the owning arena in the pmm's arena table */
+    uint8_t order; /* order of the free buddy block this page heads, if any */
+    uint16_t pin_count; /* users of the page outside of its vm object's lock */
 } vm_page_t;
 
+/* vm_page_t::flags */
+#define VM_PAGE_FLAG_FREE_ON_UNPIN (0x1) /* removed from its vm object while pinned */
+#define VM_PAGE_FLAG_IDLE (0x2) /* unmapped and untouched since the page store last scanned it */
+
 enum vm_page_state {
     VM_PAGE_STATE_FREE,
     VM_PAGE_STATE_ALLOC,
     VM_PAGE_STATE_MMU, /* allocated to serve arch-specific mmu purposes */
+    VM_PAGE_STATE_CACHED, /* free, but held in a per cpu page cache or the zeroed pool */
 };
 
 /* kernel address space */
@@ -108,12 +116,18 @@ static inline bool is_user_address(vaddr_t va) {
 }
 
 /* physical allocator */
+
+/* free pages in an arena are kept in buddy lists of naturally aligned blocks of
+ * 2^order pages, up to 2^PMM_MAX_ORDER pages (4MB with 4k pages) */
+#define PMM_MAX_ORDER 10
+
 typedef struct pmm_arena {
     struct list_node node;
     const char* name;
 
     uint flags;
     uint priority;
+    uint numa_node; /* node the memory is attached to, 0 if the platform doesn't know */
 
     paddr_t base;
     size_t size;
@@ -121,17 +135,32 @@ typedef struct pmm_arena {
     size_t free_count;
 
     struct vm_page* page_array;
-    struct list_node free_list;
+    struct list_node free_list[PMM_MAX_ORDER + 1];
+    size_t free_blocks[PMM_MAX_ORDER + 1];
 } pmm_arena_t;
 
 #define PMM_ARENA_FLAG_KMAP (0x1) /* this arena is already mapped and useful for kallocs */
 
+/* numa nodes the pmm tells apart; arenas on higher nodes are counted as node 0 */
+#define PMM_MAX_NODES 8
+
 /* Add a pre-filled memory arena to the physical allocator. */
 status_t pmm_add_arena(pmm_arena_t* arena) __NONNULL((1));
 
+/* Tell the pmm which numa node a cpu sits on. Allocations made on the cpu are
+ * served from arenas on its node first. Cpus default to node 0.
+ */
+void pmm_set_cpu_node(uint cpu_num, uint node);
+
 /* flags for allocation routines below */
 #define PMM_ALLOC_FLAG_ANY (0x0)  /* no restrictions on which arena to allocate from */
 #define PMM_ALLOC_FLAG_KMAP (0x1) /* allocate only from arenas marked KMAP */
+#define PMM_ALLOC_FLAG_ZEROED (0x2) /* pages are returned zero filled, implies KMAP */
+/* allocate only from arenas on numa node n, rather than from the current cpu's node first and
+ * then any other */
+#define PMM_ALLOC_FLAG_NODE_SHIFT 8
+#define PMM_ALLOC_FLAG_NODE_MASK (0xff << PMM_ALLOC_FLAG_NODE_SHIFT)
+#define PMM_ALLOC_FLAG_NODE(n) ((((uint)(n)) + 1) << PMM_ALLOC_FLAG_NODE_SHIFT)
 
 /* Allocate count pages of physical memory, adding to the tail of the passed list.
  * The list must be initialized.
@@ -174,6 +203,15 @@ void* pmm_alloc_kpage(paddr_t* pa);
 
 size_t pmm_free_kpages(void* ptr, size_t count);
 
+/* Returns true while the pmm is running short of free pages.
+ */
+bool pmm_memory_low(void);
+
+/* Block until pmm_memory_low() no longer returns low.
+ * Meant for a single watcher thread that passes the state on to everyone else.
+ */
+void pmm_wait_memory_state_change(bool low);
+
 /* physical to virtual */
 void* paddr_to_kvaddr(paddr_t pa);
 
@@ -207,6 +245,7 @@ status_t vmm_reserve_space(vmm_aspace_t* aspace, const char* name, size_t size,
 /* For region creation routines */
 #define VMM_FLAG_VALLOC_SPECIFIC (1 << 0) /* allocate at specific address */
 #define VMM_FLAG_COMMIT (1 << 1)          /* commit memory up front (no demand paging) */
+#define VMM_FLAG_SEQUENTIAL (1 << 2)      /* expect sequential access, fault in pages ahead */
 
 /* allocate a region of virtual space that maps a physical piece of address space.
    the physical pages that back this are not allocated from the pmm. */
@@ -256,6 +295,8 @@ void vmm_set_active_aspace(vmm_aspace_t* aspace);
 #define VMM_PF_FLAG_USER (1u << 1)
 #define VMM_PF_FLAG_INSTRUCTION (1u << 2)
 #define VMM_PF_FLAG_NOT_PRESENT (1u << 3)
+/* not from the hardware: fail with ERR_NOT_READY rather than block for a page source */
+#define VMM_PF_FLAG_NO_WAIT (1u << 4)
 status_t vmm_page_fault_handler(vaddr_t addr, uint flags);
 
 __END_CDECLS
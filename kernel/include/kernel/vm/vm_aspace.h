@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <kernel/mutex.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_region_tree.h>
 #include <utils/intrusive_double_list.h>
 #include <utils/ref_counted.h>
 #include <utils/ref_ptr.h>
@@ -44,10 +45,31 @@ public:
     arch_aspace_t& arch_aspace() { return arch_aspace_; }
     bool is_user() const { return (flags_ & TYPE_MASK) == TYPE_USER; }
 
+    // bytes of address space covered by regions, and bytes of vm object pages currently mapped
+    // into them; kept up to date as regions come and go and pages are mapped and unmapped
+    void GetMemoryUsage(size_t* mapped_bytes, size_t* committed_bytes) const;
+
     // map a vm object at a given offset
     status_t MapObject(utils::RefPtr<VmObject> vmo, const char* name, uint64_t offset, size_t size,
                        void** ptr, uint8_t align_pow2, uint vmm_flags, uint arch_mmu_flags);
 
+    // one of the mappings for MapObjects, with the arguments of MapObject; ptr is the address
+    // going in with VMM_FLAG_VALLOC_SPECIFIC and the address mapped at coming out
+    struct MapObjectArgs {
+        utils::RefPtr<VmObject> vmo;
+        const char* name = "unnamed";
+        uint64_t offset = 0;
+        size_t size = 0;
+        void* ptr = nullptr;
+        uint8_t align_pow2 = 0;
+        uint vmm_flags = 0;
+        uint arch_mmu_flags = 0;
+    };
+
+    // map several vm objects in one acquisition of the aspace lock, either all of them or,
+    // if any fails, none
+    status_t MapObjects(MapObjectArgs* args, size_t count);
+
     // common routines, mostly used by internal kernel code
 
     // create a blank map of vm address space
@@ -68,6 +90,15 @@ public:
     // return a pointer to a region based on virtual address
     utils::RefPtr<VmRegion> FindRegion(vaddr_t vaddr);
 
+    // find the vm object mapped at vaddr and the offset into it that vaddr
+    // maps, returning ERR_NOT_FOUND if there is none
+    status_t LookupObject(vaddr_t vaddr, utils::RefPtr<VmObject>* object, uint64_t* offset);
+
+    // same as LookupObject, but only if all of [vaddr, vaddr + len) is mapped by the same region,
+    // cached and writable from user mode
+    status_t LookupWritableObject(vaddr_t vaddr, size_t len, utils::RefPtr<VmObject>* object,
+                                  uint64_t* offset);
+
     // free the region at a given address
     status_t FreeRegion(vaddr_t vaddr);
 
@@ -99,20 +130,25 @@ private:
     friend utils::RefPtr<VmAspace>;
     friend status_t vmm_free_aspace(vmm_aspace_t* _aspace);
 
+    // regions take our lock to pull pages out of their mappings on behalf of their object
+    friend class VmRegion;
+
     // internal page fault routine, friended to be only called by vmm_page_fault_handler
     status_t PageFault(vaddr_t va, uint flags);
     friend status_t vmm_page_fault_handler(vaddr_t va, uint flags);
 
     // private internal routines
     status_t AddRegion(const utils::RefPtr<VmRegion>& r);
+    void InsertRegionLocked(const utils::RefPtr<VmRegion>& r, VmRegion* next);
+    void RemoveRegionLocked(VmRegion* r);
+    status_t CheckMapObjectArgs(MapObjectArgs* args);
+    status_t MapObjectLocked(MapObjectArgs* args, VmRegion** region);
     utils::RefPtr<VmRegion> AllocRegion(const char* name, size_t size, vaddr_t vaddr,
                                         uint8_t align_pow2, uint32_t vmm_flags,
                                         uint arch_mmu_flags);
-    vaddr_t AllocSpot(size_t size, uint8_t align_pow2, uint arch_mmu_flags,
-                      RegionList::iterator* after);
+    vaddr_t AllocSpot(size_t size, uint8_t align_pow2, uint arch_mmu_flags, VmRegion** next);
     utils::RefPtr<VmRegion> FindRegionLocked(vaddr_t vaddr);
-    bool CheckGap(const RegionList::iterator& prev,
-                  const RegionList::iterator& next,
+    bool CheckGap(const VmRegion* prev, const VmRegion* next,
                   vaddr_t* pva, vaddr_t align, size_t region_size, uint arch_mmu_flags);
 
     // magic
@@ -127,10 +163,17 @@ private:
 
     mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
 
-    // sorted list of regions
-    // TODO(johngro) : This should be some form of O(log) tree.
+    // sorted list of regions, holding the references to them
     RegionList regions_;
 
+    // the same regions indexed by address, for O(log n) lookups and free
+    // space searches
+    VmRegionTree region_tree_;
+
+    // running totals for GetMemoryUsage(), protected by lock_
+    size_t mapped_bytes_ = 0;
+    size_t committed_pages_ = 0;
+
     // architecturally specific part of the aspace
     arch_aspace_t arch_aspace_ = {};
 
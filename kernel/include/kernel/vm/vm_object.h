@@ -7,14 +7,29 @@
 #pragma once
 
 #include <assert.h>
+#include <kernel/cond.h>
 #include <kernel/mutex.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_page_list.h>
+#include <kernel/vm/vm_region.h>
 #include <list.h>
 #include <stdint.h>
-#include <utils/array.h>
+#include <utils/intrusive_double_list.h>
 #include <utils/ref_counted.h>
 #include <utils/ref_ptr.h>
 
+// Where the contents of the pages of a paged object come from, see VmObject::CreatePaged()
+class VmPageSource : public utils::RefCounted<VmPageSource> {
+public:
+    virtual ~VmPageSource() {}
+
+    // ask for the page at offset to be supplied with VmObject::SupplyPages(). called with the
+    // object's lock held, so it mustn't block or call back into the object. ERR_NOT_READY means
+    // it can't take the request now but may by the time it's made again; any other error fails
+    // the fault.
+    virtual status_t RequestPage(uint64_t offset) = 0;
+};
+
 // The base vm object that holds a range of bytes of data
 //
 // Can be created without mapping and used as a container of data, or mappable
@@ -22,12 +37,63 @@
 
 class VmObject : public utils::RefCounted<VmObject> {
 public:
-    static utils::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size);
+    // options for Create()
+    // back large page aligned chunks of the object with physically contiguous, aligned runs so
+    // regions can map them with large pages, falling back to single pages when memory is fragmented
+    static const uint32_t CREATE_LARGE_PAGES = (1u << 0);
+
+    // size of the runs used by CREATE_LARGE_PAGES objects, the smallest large page size of the
+    // supported architectures
+    static const uint64_t LARGE_PAGE_SIZE = (2 * 1024 * 1024);
+    static const uint8_t LARGE_PAGE_SIZE_SHIFT = 21;
+
+    static utils::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                          uint32_t options = 0);
+
+    // create an object whose pages are filled in by source rather than zeroed
+    //
+    // Faulting on a page that isn't there asks source for it and blocks until it's supplied or
+    // failed with SupplyPages(), or the thread is killed. A request that goes unanswered is made
+    // again every PAGE_REQUEST_RETRY ms, and the fault fails once source can't take requests at
+    // all. Page faults wait with the address space unlocked, see WaitForPage().
+    static utils::RefPtr<VmObject> CreatePaged(uint32_t pmm_alloc_flags, uint64_t size,
+                                               utils::RefPtr<VmPageSource> source);
+
+    static const lk_time_t PAGE_REQUEST_RETRY = 1000;
 
     status_t Resize(uint64_t size);
 
+    // create a copy-on-write clone of size bytes of this object starting at the page aligned
+    // offset
+    //
+    // The clone shares our pages until it faults them in or commits them, at which point it takes
+    // a private copy. Before one of our pages is written, decommitted or replaced, every clone
+    // still sharing it is handed a copy of it first, so the clone keeps seeing the contents from
+    // when it was made. Fails with ERR_BAD_STATE while the object has slices, whose mappings of
+    // our pages can't be found to make them read only.
+    status_t CreateCowClone(uint64_t offset, uint64_t size, utils::RefPtr<VmObject>* clone);
+
+    // create an object that is a window onto size bytes of this one starting at the page aligned
+    // offset
+    //
+    // The slice has no pages of its own: reads, writes, commits and faults all go to our pages, so
+    // mapping it maps them. While any slice of an object exists, pages can't be decommitted from or
+    // moved into it, since that would leave them mapped through the slice.
+    utils::RefPtr<VmObject> CreateSlice(uint64_t offset, uint64_t size);
+
+    bool is_slice() const { return is_slice_; }
+
+    // whether a clone may still be sharing our pages, in which case regions only map them writable
+    // for a write fault, which hands the clones their copies first
+    bool has_clones();
+    bool is_paged() const { return page_source_ != nullptr; }
+
     uint64_t size() const { return size_; }
 
+    // number of pages currently backing the object, not counting any it still shares with a
+    // parent
+    size_t CommittedPageCount();
+
     // add a page to the object
     status_t AddPage(vm_page_t* p, uint64_t offset);
 
@@ -37,11 +103,63 @@ public:
     // find a contiguous run of physical pages to back the range of the object
     int64_t CommitRangeContiguous(uint64_t offset, uint64_t len, uint8_t alignment_log2 = 0);
 
+    // unmap the pages backing the range from every region mapping them and return them to the
+    // pmm, returning the number of bytes freed
+    //
+    // Later accesses fault in fresh zeroed pages, or for a clone, go back to seeing whatever its
+    // parent holds.
+    int64_t DecommitRange(uint64_t offset, uint64_t len);
+
+    // move the pages backing [src_offset, src_offset + len) of src into this object at offset, in
+    // place of the ones there, which are decommitted. all of it must be page aligned, and src must
+    // be unmapped and have every page of the range committed.
+    //
+    // Fails without touching src if it can't take all of the pages. ERR_NO_MEMORY past that point
+    // means the pages not yet moved were lost, along with what this object held there.
+    status_t TakePages(VmObject* src, uint64_t src_offset, uint64_t offset, uint64_t len);
+
+    // fill in the pages of the page aligned range of a paged object that aren't there with len
+    // bytes copied from the user pointer data, waking the faults waiting for them. pages already
+    // there are left alone. a null data fails the faults waiting on the range instead.
+    status_t SupplyPages(uint64_t offset, uint64_t len, const void* data);
+
     // get a pointer to a page at a given offset
     vm_page_t* GetPage(uint64_t offset);
 
     // fault in a page at a given offset with PF_FLAGS
-    vm_page_t* FaultPage(uint64_t offset, uint pf_flags);
+    //
+    // With VMM_PF_FLAG_NO_WAIT, a page that has to come from a page source fails the fault with
+    // ERR_NOT_READY instead, for the caller to drop its own locks, WaitForPage() and fault again.
+    status_t FaultPage(uint64_t offset, uint pf_flags, vm_page_t** page);
+
+    // wait for the page source behind offset to supply the page there, asking it for the page if
+    // nobody has yet. returns ERR_INTERRUPTED if the thread is killed while waiting.
+    status_t WaitForPage(uint64_t offset);
+
+    // if the large page sized chunk at offset is backed by one aligned physical run, return the
+    // base of the run in pa
+    bool GetLargePage(uint64_t offset, paddr_t* pa);
+
+    bool large_pages() const { return (options_ & CREATE_LARGE_PAGES) != 0; }
+
+    // whether the page store may compress pages of the object that go untouched, see
+    // vm_page_store.h. it may unless told otherwise, and telling it not to brings back the pages
+    // it already holds.
+    bool compressible();
+    status_t SetCompressible(bool compressible);
+
+    // keep the pages of the object where they are for good, for when their physical addresses
+    // have been handed out
+    void KeepPagesInPlace();
+
+    // fault in and pin count pages starting at the page aligned offset, for a device to be
+    // pointed at. pinned pages stay allocated, even once decommitted, until they are handed to
+    // UnpinPages(), which has to happen before the object goes away.
+    status_t PinPages(uint64_t offset, size_t count, vm_page_t** pages);
+    void UnpinPages(vm_page_t* const* pages, size_t count);
+
+    // number of pages of the object held compressed in the page store, and the heap they take up
+    void GetCompressedCount(size_t* pages, size_t* bytes);
 
     // read/write operators against kernel pointers only
     status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read);
@@ -59,17 +177,70 @@ private:
     VmObject& operator=(VmObject& o) = delete;
 
     // private constructor (use Create())
-    explicit VmObject(uint32_t pmm_alloc_flags);
+    VmObject(uint32_t pmm_alloc_flags, uint32_t options);
 
     // private destructor, only called from refptr
     ~VmObject();
     friend utils::RefPtr<VmObject>;
 
+    // Create() without putting the object on the page store's list, for objects it never scans
+    static utils::RefPtr<VmObject> CreateUntracked(uint32_t pmm_alloc_flags, uint64_t size,
+                                                   uint32_t options);
+
     // fault in a page at a given offset with PF_FLAGS
-    vm_page_t* FaultPageLocked(uint64_t offset, uint pf_flags);
+    //
+    // Drops the lock while allocating and filling a new page, so the caller has to be prepared for
+    // the object to change underneath it.
+    status_t FaultPageLocked(uint64_t offset, uint pf_flags, vm_page_t** page);
+
+    // ask the page source for the page at index and wait for it, with the lock dropped
+    status_t WaitForPageLocked(size_t index);
+
+    // allocate a page for FaultPageLocked to install at offset, copied from whatever an ancestor
+    // holds there or zeroed; called without the lock held
+    status_t AllocFaultPage(uint64_t offset, uint pf_flags, vm_page_t** page);
+
+    // one scan of the page store over the object: compress the pages that stayed idle since the
+    // last scan, and mark the rest idle, unmapping them so that the next touch clears the mark.
+    // returns the number of pages compressed.
+    friend class VmPageStore;
+    size_t ScanIdlePages();
+
+    // replace the compressed page at index with a fresh page holding its contents
+    vm_page_t* DecompressPageLocked(size_t index);
+
+    // decompress every compressed page with an index in [start, end)
+    status_t DecompressRangeLocked(size_t start, size_t end);
+
+    // back the empty large page chunk containing index with a single contiguous run, dropping the
+    // lock while allocating it
+    bool CommitLargePageLocked(size_t index);
+
+    // pinning keeps a page from being freed while it's used with the lock dropped. a page that is
+    // decommitted while pinned is freed by the last unpin instead.
+    void PinPageLocked(vm_page_t* p);
+    void UnpinPage(vm_page_t* p);
+
+    // hand each clone still sharing a page of the range a copy of it, ahead of the page being
+    // changed. with VMM_PF_FLAG_WRITE in pf_flags, pages we don't hold yet are faulted in to copy,
+    // since writing them would; otherwise only the ones we hold matter. called without lock_ held.
+    status_t CopyPagesToClones(uint64_t offset, uint64_t len, uint pf_flags);
+
+    // whether the clone is still sharing the page at parent_offset into its parent
+    bool SharesParentPageLocked(uint64_t parent_offset);
 
-    // internal page list routine
-    void AddPageToArray(size_t index, vm_page_t* p);
+    // find and pin the page an ancestor of a clone holds for offset into this object, returning
+    // the ancestor to unpin it with in owner. page is null if no ancestor has one.
+    status_t PinParentPage(uint64_t offset, uint pf_flags, VmObject** owner, vm_page_t** page);
+
+    // track the regions mapping the object, so that pages can be pulled out from under them
+    friend class VmRegion;
+    void AddMapping(VmRegion* r);
+    void RemoveMapping(VmRegion* r);
+
+    // internal page list routines
+    status_t AddPageLocked(size_t index, vm_page_t* p);
+    size_t PageCount() const;
 
     // internal read/write routine that takes a templated copy function to help share some code
     template <typename T>
@@ -90,11 +261,59 @@ private:
     // members
     uint64_t size_ = 0;
     uint32_t pmm_alloc_flags_ = PMM_ALLOC_FLAG_ANY;
+    uint32_t options_ = 0;
     mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
 
-    // array of page pointers, one per page offset into the object
-    utils::Array<vm_page_t*> page_array_;
+    // pages backing the object, by page offset into the object
+    VmPageList page_list_;
+
+    // pages the page store has compressed in place of ones in page_list_, and the heap they take
+    // up; only ever held by objects that can be scanned
+    VmCompressedPageList compressed_list_;
+    size_t compressed_bytes_ = 0;
+    bool compressible_ = true;
+    bool pages_in_place_ = false;
+
+    // for copy-on-write clones and slices, the object we were created from and where in it we
+    // start; set at creation and not changed after
+    utils::RefPtr<VmObject> parent_;
+    uint64_t parent_offset_ = 0;
+    bool is_slice_ = false;
+
+    // number of slices of this object, which keep its pages from being pulled out
+    uint32_t slice_count_ = 0;
+
+    // the clones made of this object, which may be sharing its pages, and our node on our parent's
+    // list if we're one. clone_lock_ guards the list and is taken before lock_ and the clones'.
+    mutex_t clone_lock_ = MUTEX_INITIAL_VALUE(clone_lock_);
+    struct CloneListTraits {
+        static utils::DoublyLinkedListNodeState<VmObject*>& node_state(VmObject& obj) {
+            return obj.clone_list_node_state_;
+        }
+    };
+    utils::DoublyLinkedList<VmObject*, CloneListTraits> clone_list_;
+    utils::DoublyLinkedListNodeState<VmObject*> clone_list_node_state_;
+
+    // for paged objects, where missing pages come from. set at creation and not changed after.
+    utils::RefPtr<VmPageSource> page_source_;
+
+    // the requests to page_source_ waiting to be answered, one per page however many faults are
+    // waiting on it, and the condition they wait on
+    struct PageRequest;
+    list_node page_requests_ = LIST_INITIAL_VALUE(page_requests_);
+    cond_t page_supplied_ = COND_INITIAL_VALUE(page_supplied_);
+
+    // regions mapping the object
+    utils::DoublyLinkedList<VmRegion*, VmRegionObjectListTraits> mapping_list_;
+
+    // our node in the page store's list of objects, protected by the store's lock
+    friend struct VmObjectStoreListTraits;
+    utils::DoublyLinkedListNodeState<VmObject*> store_list_node_state_;
+};
 
-    // list of all allocated pages
-    list_node page_list_ = LIST_INITIAL_VALUE(page_list_);
+// For use by the page store to track the objects it scans.
+struct VmObjectStoreListTraits {
+    inline static utils::DoublyLinkedListNodeState<VmObject*>& node_state(VmObject& obj) {
+        return obj.store_list_node_state_;
+    }
 };
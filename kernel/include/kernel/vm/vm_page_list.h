@@ -0,0 +1,168 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <err.h>
+#include <kernel/vm.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct VmCompressedPage;
+
+// Sparse map of page index to T, used by VmObject to track the pages backing
+// it and the ones it holds compressed in the page store.
+//
+// Implemented as a radix tree with 64 slots per node that grows in height as
+// higher indices are used, so memory use follows the number and spread of
+// the pages present rather than the size of the object. Empty nodes are
+// freed as pages are removed. The list does not own the pages it points to.
+// Locking is up to the caller.
+template <typename T>
+class VmSparsePageList {
+public:
+    VmSparsePageList() = default;
+    ~VmSparsePageList();
+
+    bool is_empty() const { return count_ == 0; }
+    size_t count() const { return count_; }
+
+    // page at index, or nullptr
+    T* Lookup(size_t index) const;
+
+    // returns ERR_ALREADY_EXISTS if index is taken, ERR_NO_MEMORY if a node
+    // could not be allocated
+    status_t Insert(size_t index, T* p);
+
+    // remove and return the page at index, or nullptr if there wasn't one
+    T* Remove(size_t index);
+
+    // call func(index, page) for every page with an index in [start, end), in
+    // index order; stops early and returns the error if func returns one
+    template <typename F>
+    status_t ForEveryPageInRange(size_t start, size_t end, F func) const {
+        if (!root_ || start >= end)
+            return NO_ERROR;
+        return ForEveryPage(root_, height_, 0, start, end, func);
+    }
+
+    template <typename F>
+    status_t ForEveryPage(F func) const {
+        return ForEveryPageInRange(0, SIZE_MAX, func);
+    }
+
+    // remove every page with an index in [start, end), calling func(index, page) on each in
+    // index order
+    template <typename F>
+    void RemovePagesInRange(size_t start, size_t end, F func) {
+        while (start < end) {
+            // find the first page left in the range, stopping the walk there
+            size_t index = 0;
+            T* p = nullptr;
+            ForEveryPageInRange(start, end, [&index, &p](size_t i, T* page) {
+                index = i;
+                p = page;
+                return ERR_CANCELLED;
+            });
+            if (!p)
+                break;
+
+            Remove(index);
+            func(index, p);
+            start = index + 1;
+        }
+    }
+
+    // remove every page, calling func(index, page) on each in index order
+    template <typename F>
+    void RemoveAllPages(F func) {
+        if (root_)
+            RemoveAll(root_, height_, 0, func);
+        root_ = nullptr;
+        height_ = 0;
+        count_ = 0;
+    }
+
+private:
+    // nocopy
+    VmSparsePageList(const VmSparsePageList&) = delete;
+    VmSparsePageList& operator=(const VmSparsePageList&) = delete;
+
+    static const uint kShift = 6;
+    static const size_t kFanout = 1u << kShift;
+    static const size_t kMask = kFanout - 1;
+
+    // slots hold child nodes in interior nodes and pages in the bottom level
+    struct Node {
+        void* slots[kFanout] = {};
+        uint count = 0;
+    };
+
+    // number of bits of index covered below a node at the given height,
+    // where height 1 holds pages directly
+    static uint ShiftForHeight(uint height) { return (height - 1) * kShift; }
+
+    // width of the index range covered by the whole tree, or SIZE_MAX if it
+    // covers every index
+    static size_t Capacity(uint height) {
+        uint bits = height * kShift;
+        return (bits >= sizeof(size_t) * 8) ? SIZE_MAX : ((size_t)1 << bits);
+    }
+
+    static T* Remove(Node* node, uint height, size_t index, bool* node_empty);
+    static void FreeNodes(Node* node, uint height);
+
+    template <typename F>
+    static status_t ForEveryPage(const Node* node, uint height, size_t base, size_t start,
+                                 size_t end, F& func) {
+        uint shift = ShiftForHeight(height);
+        size_t first = (start > base) ? ((start - base) >> shift) : 0;
+
+        for (size_t i = first; i < kFanout; i++) {
+            void* slot = node->slots[i];
+            size_t slot_base = base + (i << shift);
+            if (slot_base >= end)
+                break;
+            if (!slot)
+                continue;
+
+            status_t err;
+            if (height == 1)
+                err = func(slot_base, static_cast<T*>(slot));
+            else
+                err = ForEveryPage(static_cast<const Node*>(slot), height - 1, slot_base, start,
+                                   end, func);
+            if (err != NO_ERROR)
+                return err;
+        }
+        return NO_ERROR;
+    }
+
+    template <typename F>
+    static void RemoveAll(Node* node, uint height, size_t base, F& func) {
+        uint shift = ShiftForHeight(height);
+
+        for (size_t i = 0; i < kFanout; i++) {
+            void* slot = node->slots[i];
+            if (!slot)
+                continue;
+
+            size_t slot_base = base + (i << shift);
+            if (height == 1)
+                func(slot_base, static_cast<T*>(slot));
+            else
+                RemoveAll(static_cast<Node*>(slot), height - 1, slot_base, func);
+        }
+        delete node;
+    }
+
+    Node* root_ = nullptr;
+    uint height_ = 0;
+    size_t count_ = 0;
+};
+
+using VmPageList = VmSparsePageList<vm_page_t>;
+using VmCompressedPageList = VmSparsePageList<VmCompressedPage>;
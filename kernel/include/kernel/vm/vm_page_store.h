@@ -0,0 +1,60 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <kernel/vm.h>
+#include <stddef.h>
+#include <stdint.h>
+
+class VmObject;
+
+// A page's contents held compressed in the page store, in place of the page
+struct VmCompressedPage;
+
+// Compressed in-memory store for the pages of vm objects that have gone untouched for a while.
+//
+// When enabled with the kernel.page-store option, a background thread scans the objects that
+// allow it every kernel.page-store-idle-sec seconds. It unmaps their pages and marks them idle,
+// and compresses the pages that are still idle by its next scan into the kernel heap, freeing
+// them. Faulting on a compressed page decompresses it into a fresh page.
+//
+// Only plain anonymous objects are scanned: not paged objects, clones, slices or objects with
+// slices, objects with large pages, objects mapped into the kernel, or objects whose physical
+// addresses have been handed out. Pinned pages are skipped.
+class VmPageStore {
+public:
+    static bool enabled();
+
+    // compress a copy of the page, returning nullptr if it wouldn't save enough to be worth it or
+    // there's no memory for it. the page isn't touched.
+    static VmCompressedPage* Compress(vm_page_t* p);
+
+    // fill the page with what c holds
+    static void Decompress(const VmCompressedPage* c, vm_page_t* p);
+
+    static void Free(VmCompressedPage* c);
+
+    // bytes of kernel heap c takes up
+    static size_t StoredSize(const VmCompressedPage* c);
+
+    // objects are tracked from creation to destruction while the store is enabled
+    static void AddObject(VmObject* o);
+    static void RemoveObject(VmObject* o);
+
+    // scan every tracked object once, as the background thread does
+    static void ScanObjects();
+
+    struct Stats {
+        size_t stored_pages;  // held compressed now
+        size_t stored_bytes;  // heap they take up
+        size_t compressed;    // pages taken into the store
+        size_t decompressed;  // pages faulted back out of it
+        size_t rejected;      // idle pages that didn't compress well enough
+        size_t scans;
+    };
+    static void GetStats(Stats* stats);
+};
@@ -7,7 +7,9 @@
 #pragma once
 
 #include <assert.h>
+#include <kernel/vm/vm_region_tree.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <utils/intrusive_double_list.h>
 #include <utils/ref_counted.h>
 #include <utils/ref_ptr.h>
@@ -26,10 +28,22 @@ public:
     vaddr_t base() const { return base_; }
     size_t size() const { return size_; }
     uint arch_mmu_flags() const { return arch_mmu_flags_; }
+    bool sequential() const { return sequential_; }
+
+    // whether the region is in a user address space, rather than the kernel's
+    bool in_user_aspace() const;
+
+    // the object the region maps and the offset into it the region starts at,
+    // protected by the address space lock
+    const utils::RefPtr<VmObject>& object() const { return object_; }
+    uint64_t object_offset() const { return object_offset_; }
 
     // set base address
     void set_base(vaddr_t vaddr) { base_ = vaddr; }
 
+    // mark the region as accessed sequentially, so faults commit pages ahead of them
+    void set_sequential(bool sequential) { sequential_ = sequential; }
+
     void Dump() const;
 
     // set the object that this region backs
@@ -47,10 +61,21 @@ public:
     // unmap the region of memory in the container address space
     int Unmap();
 
+    // disconnect from the object and the address space's accounting like Unmap(), but leave
+    // the page tables to the caller, which unmaps many regions at once
+    void Detach();
+
+    // unmap whatever part of the object range [offset, offset + len) this region maps, if the
+    // region is still mapped. takes the address space lock.
+    void UnmapObjectRange(uint64_t offset, uint64_t len);
+
     // change mapping permissions
     status_t Protect(uint arch_mmu_flags);
 
     // page fault in an address into the region
+    //
+    // Returns ERR_NOT_READY if the page has to come from a page source, for the caller to
+    // VmObject::WaitForPage() on object() without the address space lock and fault again.
     status_t PageFault(vaddr_t va, uint pf_flags);
 
 private:
@@ -61,6 +86,24 @@ private:
     VmRegion(const VmRegion&) = delete;
     VmRegion& operator=(const VmRegion&) = delete;
 
+    // map the large page sized chunk covering offset with a single large page, if both the
+    // region and the backing object allow it
+    status_t MapLargePage(size_t offset);
+
+    // note that pages of the object were mapped in or out of the region, keeping our count and
+    // the address space's total up to date
+    void AccountCommittedPages(ssize_t delta);
+
+    // the mmu flags to map the object's pages with for a fault with pf_flags. while a clone may be
+    // sharing them, only a write fault, which hands it its copy first, maps them writable.
+    uint MapFlags(uint pf_flags) const;
+
+    // map the neighbors of a page that was just faulted in
+    void FaultAround(vaddr_t va, uint pf_flags);
+
+    // number of pages FaultAround considers, including the faulting one
+    static const size_t FAULT_AROUND_PAGES = 16;
+
     // magic value
     static const uint32_t MAGIC = 0x564d5247; // VMRG
     uint32_t magic_ = MAGIC;
@@ -72,6 +115,15 @@ private:
     // cached mapping flags (read/write/user/etc)
     uint arch_mmu_flags_;
 
+    bool sequential_ = false;
+
+    // set while the region is mapped into its address space and on its object's mapping list,
+    // protected by the address space lock
+    bool mapped_ = false;
+
+    // number of object pages mapped into the region, protected by the address space lock
+    size_t committed_pages_ = 0;
+
     // pointer back to our member address space
     utils::RefPtr<VmAspace> aspace_;
 
@@ -80,4 +132,20 @@ private:
     uint64_t object_offset_ = 0;
 
     char name_[32];
+
+    // our node in the address space's region tree
+    friend class VmRegionTree;
+    VmRegionTree::NodeState tree_state_;
+
+    // our node in the object's list of regions mapping it, protected by the object lock
+    friend struct VmRegionObjectListTraits;
+    utils::DoublyLinkedListNodeState<VmRegion*> object_list_node_state_;
+};
+
+// For use by VmObject to track the regions mapping it. (We don't use the default traits since
+// those are taken by the address space's region list.)
+struct VmRegionObjectListTraits {
+    inline static utils::DoublyLinkedListNodeState<VmRegion*>& node_state(VmRegion& obj) {
+        return obj.object_list_node_state_;
+    }
 };
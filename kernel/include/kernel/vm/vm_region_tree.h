@@ -0,0 +1,82 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+class VmRegion;
+
+// Red-black tree of the regions in an address space, keyed by base address.
+// Each node also tracks the size of the unmapped gap just below its region,
+// and the largest such gap in its subtree, so that lookups and free space
+// searches are O(log n).
+//
+// The tree is intrusive and does not hold references; the owning address
+// space keeps the regions alive. Regions must not overlap, and a region's
+// base and size must not change while it is in the tree. Locking is up to
+// the caller.
+class VmRegionTree {
+public:
+    // per region tree state, embedded in VmRegion
+    struct NodeState {
+        VmRegion* parent_ = nullptr;
+        VmRegion* left_ = nullptr;
+        VmRegion* right_ = nullptr;
+        bool red_ = false;
+        size_t gap_ = 0;     // unmapped space between the previous region and this one
+        size_t max_gap_ = 0; // largest gap_ in this subtree
+    };
+
+    // base is the bottom of the address space, used for the gap below the
+    // lowest region
+    explicit VmRegionTree(vaddr_t base) : base_(base) {}
+
+    bool is_empty() const { return root_ == nullptr; }
+
+    void Insert(VmRegion* r);
+    void Erase(VmRegion* r);
+
+    // region containing va, or nullptr
+    VmRegion* Find(vaddr_t va) const;
+
+    // lowest region with base above va, or nullptr
+    VmRegion* UpperBound(vaddr_t va) const;
+
+    // lowest region with base at or above va that has at least size bytes of
+    // unmapped space just below it, or nullptr
+    VmRegion* FindGap(vaddr_t va, size_t size) const;
+
+    // neighbors in address order, nullptr off either end
+    VmRegion* Prev(const VmRegion* r) const;
+    VmRegion* Next(const VmRegion* r) const;
+
+    // highest region, or nullptr if empty
+    VmRegion* Last() const;
+
+private:
+    // nocopy
+    VmRegionTree(const VmRegionTree&) = delete;
+    VmRegionTree& operator=(const VmRegionTree&) = delete;
+
+    static NodeState& node(VmRegion* r);
+    static const NodeState& node(const VmRegion* r);
+    static bool IsRed(const VmRegion* r) { return r && node(r).red_; }
+    static VmRegion* FindGap(VmRegion* n, vaddr_t va, size_t size);
+
+    size_t GapBefore(const VmRegion* r) const;
+    void Recompute(VmRegion* r);
+    void RecomputeToRoot(VmRegion* r);
+    void RotateLeft(VmRegion* x);
+    void RotateRight(VmRegion* x);
+    void Transplant(VmRegion* u, VmRegion* v);
+    void InsertFixup(VmRegion* z);
+    void EraseFixup(VmRegion* x, VmRegion* parent);
+
+    vaddr_t base_;
+    VmRegion* root_ = nullptr;
+};
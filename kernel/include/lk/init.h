@@ -42,6 +42,9 @@ enum lk_init_flags {
     LK_INIT_FLAG_ALL_CPUS        = LK_INIT_FLAG_PRIMARY_CPU | LK_INIT_FLAG_SECONDARY_CPUS,
     LK_INIT_FLAG_CPU_SUSPEND     = 0x4,
     LK_INIT_FLAG_CPU_RESUME      = 0x8,
+    /* run on a worker thread once the rest of boot is done, see
+     * LK_INIT_HOOK_DEFERRED */
+    LK_INIT_FLAG_DEFERRED        = 0x10,
 };
 
 void lk_init_level(enum lk_init_flags flags, uint start_level, uint stop_level);
@@ -75,4 +78,10 @@ struct lk_init_struct {
 #define LK_INIT_HOOK(_name, _hook, _level) \
     LK_INIT_HOOK_FLAGS(_name, _hook, _level, LK_INIT_FLAG_PRIMARY_CPU)
 
+/* for hooks nothing else in boot depends on: they are passed over at their
+ * level and instead called, still in level order, from a thread started after
+ * the last level, so they overlap with userspace coming up */
+#define LK_INIT_HOOK_DEFERRED(_name, _hook, _level) \
+    LK_INIT_HOOK_FLAGS(_name, _hook, _level, LK_INIT_FLAG_PRIMARY_CPU | LK_INIT_FLAG_DEFERRED)
+
 __END_CDECLS
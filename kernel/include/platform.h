@@ -35,6 +35,8 @@ typedef enum {
 
 lk_time_t current_time(void);
 lk_bigtime_t current_time_hires(void);
+/* the same clock in nanoseconds, at whatever resolution the platform has */
+uint64_t current_time_ns(void);
 
 /* super early platform initialization, before almost everything */
 void platform_early_init(void);
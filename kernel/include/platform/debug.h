@@ -16,6 +16,9 @@
 __BEGIN_CDECLS
 
 void platform_dputc(char c);
+// Write a string, which the platform may queue and send from its uart's
+// interrupt rather than waiting for the uart.
+void platform_dputs(const char *str, size_t len);
 int platform_dgetc(char *c, bool wait);
 
 // Should be available even if the system has panicked.
@@ -4,6 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <stdlib.h>
 #include <string.h>
 #include <kernel/cmdline.h>
 
@@ -80,3 +81,16 @@ bool cmdline_get_bool(const char* key, bool _default) {
     }
     return true;
 }
+
+uint32_t cmdline_get_uint32(const char* key, uint32_t _default) {
+    const char* value = cmdline_get(key);
+    if ((value == NULL) || (*value == 0)) {
+        return _default;
+    }
+    char* end;
+    unsigned long result = strtoul(value, &end, 0);
+    if (*end != 0) {
+        return _default;
+    }
+    return (uint32_t)result;
+}
@@ -30,18 +30,34 @@ void cond_destroy(cond_t *cond)
 }
 
 status_t cond_wait_timeout(cond_t *cond, mutex_t *mutex, lk_time_t timeout)
+{
+    return cond_wait_timeout_etc(cond, mutex, timeout, false);
+}
+
+status_t cond_wait_timeout_etc(cond_t *cond, mutex_t *mutex, lk_time_t timeout,
+                               bool interruptable)
 {
     DEBUG_ASSERT(cond->magic == COND_MAGIC);
     DEBUG_ASSERT(mutex->magic == MUTEX_MAGIC);
 
+    thread_t *current_thread = get_current_thread();
+
     THREAD_LOCK(state);
 
+    // if we've been killed and going in interruptable, abort here
+    if (interruptable && unlikely((current_thread->signals & THREAD_SIGNAL_KILL))) {
+        THREAD_UNLOCK(state);
+        return ERR_INTERRUPTED;
+    }
+
     // We specifically want reschedule=false here, otherwise the
     // combination of releasing the mutex and enqueuing the current thread
     // would not be atomic, which would mean that we could miss wakeups.
     mutex_release_internal(mutex, /* reschedule= */ false);
 
+    current_thread->interruptable = interruptable;
     status_t result = wait_queue_block(&cond->wait, timeout);
+    current_thread->interruptable = false;
 
     mutex_acquire_timeout_internal(mutex, INFINITE_TIME);
 
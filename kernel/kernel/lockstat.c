@@ -0,0 +1,248 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/lockstat.h>
+
+#include <arch/ops.h>
+#include <debug.h>
+#include <err.h>
+#include <lk/init.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* this is what spin_lock() and friends turn into, so no taking locks, and
+ * nothing but atomics on the shared table */
+
+#define LOCKSTAT_CLASSES 1024
+/* spin locks a cpu may have nested at once and still have their hold times
+ * counted */
+#define LOCKSTAT_MAX_HELD 8
+
+struct lockstat_class {
+    const char *site;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait;
+    uint64_t hold;
+    uint32_t max_wait;
+    uint32_t max_hold;
+};
+
+static struct lockstat_class classes[LOCKSTAT_CLASSES];
+/* acquisitions that found the table full */
+static uint64_t lockstat_dropped;
+
+struct lockstat_held {
+    spin_lock_t *lock;
+    struct lockstat_class *class;
+    uint32_t acquired_at;
+};
+
+static struct {
+    struct lockstat_held held[LOCKSTAT_MAX_HELD];
+    uint count;
+} held_locks[SMP_MAX_CPUS];
+
+/* nothing is counted until the cpu number can be trusted */
+static bool lockstat_enabled;
+
+static void lockstat_init(uint level)
+{
+    lockstat_enabled = true;
+}
+
+LK_INIT_HOOK(lockstat, lockstat_init, LK_INIT_LEVEL_THREADING);
+
+static struct lockstat_class *lockstat_class(const char *site)
+{
+    if (!site)
+        site = "(unknown)";
+
+    uint start = (uint)(((uintptr_t)site >> 3) % LOCKSTAT_CLASSES);
+    for (uint i = 0; i < LOCKSTAT_CLASSES; i++) {
+        struct lockstat_class *c = &classes[(start + i) % LOCKSTAT_CLASSES];
+        const char *found = __atomic_load_n(&c->site, __ATOMIC_RELAXED);
+        if (found == site)
+            return c;
+        if (found == NULL) {
+            const char *expected = NULL;
+            if (__atomic_compare_exchange_n(&c->site, &expected, site, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED) ||
+                expected == site)
+                return c;
+        }
+    }
+    __atomic_fetch_add(&lockstat_dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void lockstat_count_acquire(struct lockstat_class *c, bool contended, uint32_t wait)
+{
+    __atomic_fetch_add(&c->acquisitions, 1, __ATOMIC_RELAXED);
+    if (!contended)
+        return;
+    __atomic_fetch_add(&c->contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->wait, wait, __ATOMIC_RELAXED);
+    /* racy, but only ever loses to another large value */
+    if (wait > c->max_wait)
+        c->max_wait = wait;
+}
+
+static void lockstat_count_release(struct lockstat_class *c, uint32_t hold)
+{
+    __atomic_fetch_add(&c->hold, hold, __ATOMIC_RELAXED);
+    if (hold > c->max_hold)
+        c->max_hold = hold;
+}
+
+void lockstat_mutex_acquired(const char *site, bool contended, uint32_t wait)
+{
+    if (!lockstat_enabled)
+        return;
+
+    struct lockstat_class *c = lockstat_class(site);
+    if (c)
+        lockstat_count_acquire(c, contended, wait);
+}
+
+void lockstat_mutex_released(const char *site, uint32_t hold)
+{
+    if (!lockstat_enabled)
+        return;
+
+    struct lockstat_class *c = lockstat_class(site);
+    if (c)
+        lockstat_count_release(c, hold);
+}
+
+static void lockstat_spin_held(spin_lock_t *lock, const char *site, bool contended,
+                               uint32_t wait)
+{
+    struct lockstat_class *c = lockstat_class(site);
+    if (!c)
+        return;
+    lockstat_count_acquire(c, contended, wait);
+
+    /* some spin locks are taken with interrupts on, and an interrupt taking
+     * another mustn't get in the middle of this */
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+    uint cpu = arch_curr_cpu_num();
+    if (held_locks[cpu].count < LOCKSTAT_MAX_HELD) {
+        struct lockstat_held *h = &held_locks[cpu].held[held_locks[cpu].count++];
+        h->lock = lock;
+        h->class = c;
+        h->acquired_at = arch_cycle_count();
+    }
+    arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void lockstat_spin_lock(spin_lock_t *lock, const char *site)
+{
+    if (!lockstat_enabled) {
+        arch_spin_lock(lock);
+        return;
+    }
+
+    if (arch_spin_trylock(lock) == 0) {
+        lockstat_spin_held(lock, site, false, 0);
+        return;
+    }
+
+    uint32_t start = arch_cycle_count();
+    arch_spin_lock(lock);
+    lockstat_spin_held(lock, site, true, arch_cycle_count() - start);
+}
+
+int lockstat_spin_trylock(spin_lock_t *lock, const char *site)
+{
+    int ret = arch_spin_trylock(lock);
+    if (ret == 0 && lockstat_enabled)
+        lockstat_spin_held(lock, site, false, 0);
+    return ret;
+}
+
+void lockstat_spin_unlock(spin_lock_t *lock)
+{
+    if (lockstat_enabled) {
+        /* locks taken before counting started, or nested too deep, aren't
+         * found, and only go uncounted */
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+        uint cpu = arch_curr_cpu_num();
+        for (uint i = held_locks[cpu].count; i-- > 0;) {
+            struct lockstat_held *h = &held_locks[cpu].held[i];
+            if (h->lock != lock)
+                continue;
+            lockstat_count_release(h->class, arch_cycle_count() - h->acquired_at);
+            memmove(h, h + 1, (held_locks[cpu].count - i - 1) * sizeof(*h));
+            held_locks[cpu].count--;
+            break;
+        }
+        arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+    }
+    arch_spin_unlock(lock);
+}
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+
+static void lockstat_reset(void)
+{
+    for (uint i = 0; i < LOCKSTAT_CLASSES; i++) {
+        struct lockstat_class *c = &classes[i];
+        c->acquisitions = c->contended = c->wait = c->hold = 0;
+        c->max_wait = c->max_hold = 0;
+    }
+    lockstat_dropped = 0;
+}
+
+static int cmd_lockstat(int argc, const cmd_args *argv)
+{
+    if (argc >= 2 && !strcmp(argv[1].str, "reset")) {
+        lockstat_reset();
+        return 0;
+    }
+    if (argc >= 2 && argv[1].u == 0) {
+        printf("usage: %s [<count>|reset]\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+    uint count = argc >= 2 ? (uint)argv[1].u : 20;
+
+    /* the classes with the most time spent waiting, a pass for each */
+    static bool shown[LOCKSTAT_CLASSES];
+    memset(shown, 0, sizeof(shown));
+
+    printf("%12s %10s %14s %10s %14s %10s  %s\n", "acquired", "contended", "wait cycles",
+           "max wait", "hold cycles", "max hold", "class");
+    for (uint n = 0; n < count; n++) {
+        struct lockstat_class *best = NULL;
+        for (uint i = 0; i < LOCKSTAT_CLASSES; i++) {
+            struct lockstat_class *c = &classes[i];
+            if (shown[i] || !c->site || !c->acquisitions)
+                continue;
+            if (!best || c->wait > best->wait ||
+                (c->wait == best->wait && c->hold > best->hold))
+                best = c;
+        }
+        if (!best)
+            break;
+        shown[best - classes] = true;
+        printf("%12llu %10llu %14llu %10u %14llu %10u  %s\n", best->acquisitions,
+               best->contended, best->wait, best->max_wait, best->hold, best->max_hold,
+               best->site);
+    }
+    if (lockstat_dropped)
+        printf("%llu acquisitions not counted, table full\n", lockstat_dropped);
+    return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("lockstat", "lock contention by class", &cmd_lockstat)
+STATIC_COMMAND_END(lockstat);
+
+#endif // WITH_LIB_CONSOLE
@@ -63,6 +63,11 @@ void mp_reschedule(mp_cpu_mask_t target, uint flags)
 
     LTRACEF("local %d, post mask target now 0x%x\n", local_cpu, target);
 
+    /* callers usually pass the exact set of cpus they queued work on, which
+     * is frequently only the local cpu */
+    if (target == 0)
+        return;
+
     arch_mp_send_ipi(target, MP_IPI_RESCHEDULE);
 }
 
@@ -19,15 +19,91 @@
 #include <debug.h>
 #include <assert.h>
 #include <err.h>
+#include <kernel/cmdline.h>
 #include <kernel/thread.h>
+#include <lk/init.h>
+#include <platform.h>
+
+#if WITH_SMP
+/* how long a contended acquire may spin while the holder runs on another cpu
+ * before blocking, tunable with kernel.mutex-spin-us */
+#define MUTEX_SPIN_DEFAULT_US 10
+static uint32_t mutex_spin_max_us = MUTEX_SPIN_DEFAULT_US;
+
+static void mutex_spin_init(uint level)
+{
+    mutex_spin_max_us = cmdline_get_uint32("kernel.mutex-spin-us", MUTEX_SPIN_DEFAULT_US);
+}
+
+LK_INIT_HOOK(mutex_spin, &mutex_spin_init, LK_INIT_LEVEL_THREADING);
+
+/*
+ * Spin while the mutex is held by a thread running on another cpu, on the
+ * theory that a short critical section will end sooner than a block and
+ * reschedule would take. Gives up as soon as the mutex is free, the holder
+ * stops running, someone else is already queued or the spin budget is spent.
+ *
+ * This is done without the thread lock, so everything here is a hint. Between
+ * loading the holder and looking at it, the holder can release the mutex and
+ * exit, and its thread structure can be freed or handed to a new thread from
+ * the thread cache. The reads of it may then be stale, but they stay safe:
+ * kernel heap memory lives in the physmap and is never unmapped. The holder
+ * is loaded again afterwards, and what was read is only used if the mutex
+ * still names the same thread.
+ */
+static void mutex_spin(mutex_t *m)
+{
+    uint32_t max_us = mutex_spin_max_us;
+    if (max_us == 0)
+        return;
+
+    uint cpu = arch_curr_cpu_num();
+    lk_bigtime_t deadline = 0;
+
+    for (uint i = 0; ; i++) {
+        /* free, or being handed over to a waiter we could not bypass anyway */
+        if (*(volatile int *)&m->count != 1)
+            return;
+
+        thread_t *holder = *(thread_t * volatile *)&m->holder;
+        if (!holder)
+            return;
+        bool running = *(volatile enum thread_state *)&holder->state == THREAD_RUNNING;
+        int holder_cpu = thread_curr_cpu(holder);
+        smp_rmb();
+        if (*(thread_t * volatile *)&m->holder == holder &&
+            (!running || (uint)holder_cpu == cpu))
+            return;
+
+        /* only check the clock every so often */
+        if ((i % 64) == 0) {
+            lk_bigtime_t now = current_time_hires();
+            if (deadline == 0)
+                deadline = now + max_us;
+            else if (now >= deadline)
+                return;
+        }
+
+        arch_spinloop_pause();
+    }
+}
+#endif
 
 /**
  * @brief  Initialize a mutex_t
  */
-void mutex_init(mutex_t *m)
+void (mutex_init)(mutex_t *m)
+{
+    *m = (mutex_t)MUTEX_INITIAL_VALUE(*m);
+}
+
+#if WITH_LOCK_STATS
+void mutex_init_lockstat(mutex_t *m, const char *site)
 {
     *m = (mutex_t)MUTEX_INITIAL_VALUE(*m);
+    m->lockstat_site = site;
 }
+#endif
 
 /**
  * @brief  Destroy a mutex_t
@@ -46,6 +122,11 @@ void mutex_destroy(mutex_t *m)
 #endif
 
     THREAD_LOCK(state);
+    if (m->holder != 0) {
+        list_delete(&m->holder_node);
+        thread_update_priority_locked(m->holder);
+        m->holder = 0;
+    }
     m->magic = 0;
     m->count = 0;
     wait_queue_destroy(&m->wait, true);
@@ -54,8 +135,21 @@ void mutex_destroy(mutex_t *m)
 
 status_t mutex_acquire_timeout_internal(mutex_t *m, lk_time_t timeout)
 {
+    thread_t *current_thread = get_current_thread();
+
     if (unlikely(++m->count > 1)) {
+        /* lend our priority to the holder for as long as we wait. the holder
+         * may be briefly unset while the mutex is handed to a woken waiter,
+         * which then picks us up when it takes ownership below. */
+        if (timeout != 0) {
+            current_thread->blocking_mutex = m;
+            thread_inherit_priority_locked(m->holder, current_thread->priority);
+        }
+
+        enum thread_wait_reason reason = thread_set_wait_reason(THREAD_WAIT_MUTEX);
         status_t ret = wait_queue_block(&m->wait, timeout);
+        thread_set_wait_reason(reason);
+        current_thread->blocking_mutex = NULL;
         if (unlikely(ret < NO_ERROR)) {
             /* if the acquisition timed out, back out the acquire and exit */
             if (likely(ret == ERR_TIMED_OUT)) {
@@ -65,6 +159,10 @@ status_t mutex_acquire_timeout_internal(mutex_t *m, lk_time_t timeout)
                  * count variable dangerous.
                  */
                 m->count--;
+
+                /* the holder no longer inherits anything from us */
+                if (m->holder)
+                    thread_update_priority_locked(m->holder);
             }
             /* if there was a general error, it may have been destroyed out from
              * underneath us, so just exit (which is really an invalid state anyway)
@@ -73,7 +171,12 @@ status_t mutex_acquire_timeout_internal(mutex_t *m, lk_time_t timeout)
         }
     }
 
-    m->holder = get_current_thread();
+    m->holder = current_thread;
+    list_add_tail(&current_thread->held_mutexes, &m->holder_node);
+
+    /* inherit from anyone still waiting behind us */
+    if (unlikely(m->count > 1))
+        thread_update_priority_locked(current_thread);
 
     return NO_ERROR;
 }
@@ -98,15 +201,40 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout)
               get_current_thread(), get_current_thread()->name, m);
 #endif
 
+#if WITH_LOCK_STATS
+    bool contended = m->count > 0;
+    uint32_t start = arch_cycle_count();
+#endif
+
+#if WITH_SMP
+    /* zero timeout is a try-acquire, which should not wait at all */
+    if (timeout != 0 && m->count > 0)
+        mutex_spin(m);
+#endif
+
     THREAD_LOCK(state);
     status_t ret = mutex_acquire_timeout_internal(m, timeout);
     THREAD_UNLOCK(state);
+
+#if WITH_LOCK_STATS
+    if (ret == NO_ERROR) {
+        m->lockstat_acquired_at = arch_cycle_count();
+        lockstat_mutex_acquired(m->lockstat_site, contended, m->lockstat_acquired_at - start);
+    }
+#endif
     return ret;
 }
 
 void mutex_release_internal(mutex_t *m, bool reschedule)
 {
+    thread_t *holder = m->holder;
+
     m->holder = 0;
+    list_delete(&m->holder_node);
+
+    /* give up whatever we inherited through this mutex */
+    if (unlikely(holder->priority != holder->base_priority))
+        thread_update_priority_locked(holder);
 
     if (unlikely(--m->count >= 1)) {
         /* release a thread */
@@ -128,6 +256,10 @@ status_t mutex_release(mutex_t *m)
     }
 #endif
 
+#if WITH_LOCK_STATS
+    lockstat_mutex_released(m->lockstat_site, arch_cycle_count() - m->lockstat_acquired_at);
+#endif
+
     THREAD_LOCK(state);
     mutex_release_internal(m, true);
     THREAD_UNLOCK(state);
@@ -26,9 +26,15 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/semaphore.c \
 	$(LOCAL_DIR)/mp.c \
 	$(LOCAL_DIR)/port.c \
+	$(LOCAL_DIR)/sched_trace.c \
 	$(LOCAL_DIR)/cmdline.c \
 
 
+ifeq ($(call TOBOOL,$(ENABLE_LOCK_STATS)),true)
+KERNEL_DEFINES += WITH_LOCK_STATS=1
+MODULE_SRCS += $(LOCAL_DIR)/lockstat.c
+endif
+
 ifeq ($(WITH_KERNEL_VM),1)
 MODULE_DEPS += kernel/vm
 else
@@ -0,0 +1,205 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/**
+ * @file
+ * @brief  Per cpu ring buffers of scheduler events.
+ *
+ * Recording is off by default and is switched on from the kernel console
+ * with "schedtrace on". Each cpu only ever writes to its own ring, so the
+ * cost of an event is a timestamp and a few stores.
+ */
+
+#include <kernel/sched_trace.h>
+
+#include <arch/ops.h>
+#include <assert.h>
+#include <debug.h>
+#include <err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <string.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+
+#if SCHED_TRACE
+
+struct sched_trace_ring {
+    /* set while this cpu is recording an event, so the rings can be left
+     * alone by writers before they are read or cleared */
+    volatile uint writing;
+    uint head;
+    uint count;
+    struct sched_trace_record records[SCHED_TRACE_LEN];
+} __CPU_ALIGN;
+
+static struct sched_trace_ring sched_trace_rings[SMP_MAX_CPUS];
+
+volatile bool sched_trace_enable;
+
+void sched_trace_add(uint event, const struct thread *t, uint cpu, uint queue_depth,
+                     uint32_t arg, uint32_t sched_cycles)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    struct sched_trace_ring *ring = &sched_trace_rings[arch_curr_cpu_num()];
+
+    /* recording may have been stopped since the caller looked, in which case
+     * the ring may be being read */
+    ring->writing = 1;
+    smp_mb();
+    if (!sched_trace_enable) {
+        ring->writing = 0;
+        return;
+    }
+
+    struct sched_trace_record *r = &ring->records[ring->head];
+
+    r->timestamp = current_time_hires();
+    r->cycles = arch_cycle_count();
+    r->thread = t;
+    r->arg = arg;
+    r->sched_cycles = sched_cycles;
+    r->event = event;
+    r->cpu = cpu;
+    r->queue_depth = (queue_depth > 0xffff) ? 0xffff : queue_depth;
+
+    ring->head = (ring->head + 1) % SCHED_TRACE_LEN;
+    if (ring->count < SCHED_TRACE_LEN)
+        ring->count++;
+
+    smp_mb();
+    ring->writing = 0;
+}
+
+/* stop recording and wait out the events being recorded, returning whether
+ * recording was on */
+static bool sched_trace_stop(void)
+{
+    bool enabled = sched_trace_enable;
+    sched_trace_enable = false;
+    smp_mb();
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        while (sched_trace_rings[cpu].writing)
+            arch_spinloop_pause();
+    }
+    smp_mb();
+
+    return enabled;
+}
+
+static const char *sched_trace_event_name(uint event)
+{
+    switch (event) {
+        case SCHED_TRACE_ENQUEUE:
+            return "enqueue";
+        case SCHED_TRACE_DISPATCH:
+            return "dispatch";
+        case SCHED_TRACE_PREEMPT:
+            return "preempt";
+        case SCHED_TRACE_BLOCK:
+            return "block";
+        case SCHED_TRACE_EXIT:
+            return "exit";
+        default:
+            return "unknown";
+    }
+}
+
+void sched_trace_reset(void)
+{
+    bool enabled = sched_trace_stop();
+
+    memset(sched_trace_rings, 0, sizeof(sched_trace_rings));
+
+    smp_mb();
+    sched_trace_enable = enabled;
+}
+
+void sched_trace_dump(void)
+{
+    /* stop recording while we walk the rings */
+    bool enabled = sched_trace_stop();
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct sched_trace_ring *ring = &sched_trace_rings[cpu];
+        if (ring->count == 0)
+            continue;
+
+        uint32_t max_latency = 0;
+        uint64_t total_latency = 0;
+        uint dispatches = 0;
+
+        printf("cpu %u: %u events\n", cpu, ring->count);
+        uint index = (ring->head + SCHED_TRACE_LEN - ring->count) % SCHED_TRACE_LEN;
+        for (uint i = 0; i < ring->count; i++) {
+            const struct sched_trace_record *r = &ring->records[index];
+            index = (index + 1) % SCHED_TRACE_LEN;
+
+            printf("\t%llu.%06llu cyc %10u: %-8s thread %p cpu %u depth %u",
+                   r->timestamp / 1000000, r->timestamp % 1000000, r->cycles,
+                   sched_trace_event_name(r->event), r->thread, r->cpu, r->queue_depth);
+            if (r->event == SCHED_TRACE_DISPATCH) {
+                printf(" ready %u us, sched %u cycles", r->arg, r->sched_cycles);
+                if (r->arg > max_latency)
+                    max_latency = r->arg;
+                total_latency += r->arg;
+                dispatches++;
+            }
+            printf("\n");
+        }
+
+        if (dispatches > 0) {
+            printf("cpu %u: %u dispatches, ready latency avg %llu us, max %u us\n",
+                   cpu, dispatches, total_latency / dispatches, max_latency);
+        }
+    }
+
+    smp_mb();
+    sched_trace_enable = enabled;
+}
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+
+static int cmd_schedtrace(int argc, const cmd_args *argv)
+{
+    if (argc < 2) {
+usage:
+        printf("usage:\n");
+        printf("\t%s on|off   start or stop recording scheduler events\n", argv[0].str);
+        printf("\t%s dump     print the recorded events of every cpu\n", argv[0].str);
+        printf("\t%s reset    discard the recorded events\n", argv[0].str);
+        printf("\t%s queues   print the depth of each cpu's run queue\n", argv[0].str);
+        return -1;
+    }
+
+    if (!strcmp(argv[1].str, "on")) {
+        sched_trace_enable = true;
+    } else if (!strcmp(argv[1].str, "off")) {
+        sched_trace_enable = false;
+    } else if (!strcmp(argv[1].str, "dump")) {
+        sched_trace_dump();
+    } else if (!strcmp(argv[1].str, "reset")) {
+        sched_trace_reset();
+    } else if (!strcmp(argv[1].str, "queues")) {
+        dump_run_queues();
+    } else {
+        printf("unrecognized command\n");
+        goto usage;
+    }
+
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("schedtrace", "scheduler event tracing", &cmd_schedtrace)
+STATIC_COMMAND_END(schedtrace);
+
+#endif // WITH_LIB_CONSOLE
+
+#endif // SCHED_TRACE
@@ -22,13 +22,20 @@
 #include <string.h>
 #include <printf.h>
 #include <err.h>
+#include <kernel/cmdline.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/debug.h>
+#include <kernel/sched_trace.h>
 #include <kernel/mp.h>
+#include <kernel/mutex.h>
 #include <platform.h>
 #include <target.h>
 #include <lib/heap.h>
+#include <lk/init.h>
+#if WITH_LIB_KTRACE
+#include <lib/ktrace.h>
+#endif
 #if WITH_KERNEL_VM
 #include <kernel/vm.h>
 #endif
@@ -48,12 +55,53 @@ static struct list_node thread_list;
 /* master thread spinlock */
 spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* per cpu run queues. each cpu schedules from its own queue first and only
+ * looks at other cpus' queues when it has nothing better to run locally.
+ *
+ * each queue has its own lock, held whenever the queue is looked at or
+ * changed. that is all the deadline timer and the preemption check after a
+ * wakeup take, since they only deal with one cpu's queue. threads still come
+ * and go from the queues under the thread lock as well, since their state and
+ * the wait queues they leave are protected by it, and the summaries below and
+ * the deadline_bw reservations are protected by it alone. the thread lock is
+ * taken before a queue's lock, and two queues' locks are only held together
+ * under the thread lock. */
+struct run_queue {
+    spin_lock_t lock;
+    struct list_node queue[NUM_PRIORITIES];
+    uint32_t bitmap;
+    /* number of ready threads queued */
+    uint count;
+    /* priority of the thread currently running on this cpu */
+    int curr_priority;
+    /* most recent thread queued here by a thread about to block on it, to
+     * be switched to directly when the waker blocks. only a hint: it is
+     * never dereferenced, just compared against the head of its queue. */
+    thread_t *handoff;
+    int handoff_priority;
+    /* ready deadline threads, by absolute deadline, and those throttled until
+     * their next period, by when it starts. only runnable ones are counted. */
+    struct list_node deadline_queue;
+    struct list_node deadline_throttled;
+    /* share of the cpu reserved by the deadline threads assigned to it, in
+     * units of 1 / (1 << DEADLINE_BW_SHIFT) */
+    uint64_t deadline_bw;
+    /* when the deadline thread running here runs out of runtime, 0 if a
+     * deadline thread isn't running */
+    lk_bigtime_t deadline_expiry_us;
+} __CPU_ALIGN;
+
+static struct run_queue run_queue[SMP_MAX_CPUS];
+
+/* which cpus have a thread queued at each priority, and which priorities have
+ * a thread queued on any cpu. a cpu only looks in other cpus' queues when
+ * something above its own best is queued somewhere, and then only in the
+ * queues that hold it. */
+static mp_cpu_mask_t run_queue_cpus[NUM_PRIORITIES];
+static uint32_t run_queue_priorities;
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-STATIC_ASSERT(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * 8);
+STATIC_ASSERT(NUM_PRIORITIES <= sizeof(run_queue[0].bitmap) * 8);
 
 /* the idle thread(s) (statically allocated) */
 #if WITH_SMP
@@ -64,18 +112,475 @@ static thread_t _idle_thread;
 #define idle_thread(cpu) (&_idle_thread)
 #endif
 
+/* per cpu caches of the stacks and structures of reaped threads, so that
+ * creating a thread mostly stays off the heap. only stacks of the default
+ * size are kept, up to kernel.thread-cache of each per cpu. threads that exit
+ * detached are still running on theirs until the final reschedule, so they
+ * go back to the heap through heap_delayed_free() as before. */
+#define THREAD_CACHE_DEFAULT_DEPTH 8
+
+#if THREAD_STACK_BOUNDS_CHECK
+#define THREAD_CACHE_STACK_SIZE (DEFAULT_STACK_SIZE + THREAD_STACK_PADDING_SIZE)
+#else
+#define THREAD_CACHE_STACK_SIZE DEFAULT_STACK_SIZE
+#endif
+
+struct thread_cache_list {
+    void *free; /* chained through their first word */
+    uint count;
+};
+
+enum {
+    THREAD_CACHE_STACKS,
+    THREAD_CACHE_STRUCTS,
+    THREAD_CACHE_LISTS,
+};
+
+struct thread_cache {
+    spin_lock_t lock;
+    struct thread_cache_list lists[THREAD_CACHE_LISTS];
+} __CPU_ALIGN;
+
+static struct thread_cache thread_cache[SMP_MAX_CPUS];
+static uint thread_cache_depth; /* nothing is cached until it is set */
+
 /* local routines */
 static void thread_resched(void);
 static int idle_thread_routine(void *) __NO_RETURN;
 static void thread_exit_locked(thread_t *current_thread, int retcode) __NO_RETURN;
+static enum handler_return deadline_timer_tick(timer_t *timer, lk_time_t now, void *arg);
+static void remove_from_run_queue(thread_t *t);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-/* preemption timer */
+/* preemption timer. it only runs while the current thread has something of
+ * the same or higher priority queued behind it on the local cpu, so a cpu
+ * that is idle or running a single thread takes no scheduler ticks. */
 static timer_t preempt_timer[SMP_MAX_CPUS];
+static bool preempt_timer_running[SMP_MAX_CPUS];
 #endif
 
+/* deadline scheduling. a deadline thread runs ahead of every priority, for
+ * its runtime in every period, and each cpu runs the ones assigned to it
+ * earliest deadline first. threads are assigned to a cpu when their
+ * parameters are set, and only as long as the cpu's reserved share stays
+ * within DEADLINE_MAX_BW, which leaves the rest of its time to everything
+ * else. as in a constant bandwidth server, a thread that has used up its
+ * runtime is throttled until its next period rather than eat into anyone
+ * else's share, and one that wakes with more runtime left than it could use
+ * at its reserved rate before its deadline starts a new period instead.
+ * runtime is enforced with a per cpu timer, so to timer resolution. */
+#define DEADLINE_BW_SHIFT 20
+#define DEADLINE_MAX_BW ((95ull << DEADLINE_BW_SHIFT) / 100)
+#define DEADLINE_MIN_RUNTIME_US 1000ull
+#define DEADLINE_MAX_PERIOD_US 10000000ull
+
+static timer_t deadline_timer[SMP_MAX_CPUS];
+
+static bool thread_is_deadline(thread_t *t)
+{
+    return t->deadline_period_us != 0;
+}
+
+/* the cpus t may be queued on */
+static mp_cpu_mask_t thread_allowed_cpus(thread_t *t)
+{
+    int pinned = thread_pinned_cpu(t);
+    return (pinned >= 0) ? (1u << pinned) : thread_cpu_affinity(t);
+}
+
+static bool thread_is_realtime(thread_t *t)
+{
+    return (t->flags & THREAD_FLAG_REAL_TIME) && t->priority > DEFAULT_PRIORITY;
+}
+
+static bool thread_is_idle(thread_t *t)
+{
+    return !!(t->flags & THREAD_FLAG_IDLE);
+}
+
+/* threads that aren't time sliced: deadline threads are held to their
+ * runtime by the deadline timer instead */
+static bool thread_is_real_time_or_idle(thread_t *t)
+{
+    return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE)) || thread_is_deadline(t);
+}
+
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+static inline int run_queue_highest_priority(const struct run_queue *rq)
+{
+    if (rq->bitmap == 0)
+        return -1;
+
+    return HIGHEST_PRIORITY - __builtin_clz(rq->bitmap)
+           - (sizeof(rq->bitmap) * 8 - NUM_PRIORITIES);
+}
+
+static inline void run_queue_set_priority(struct run_queue *rq, int priority)
+{
+    uint cpu = (uint)(rq - run_queue);
+
+    rq->bitmap |= (1u << priority);
+    run_queue_cpus[priority] |= (1u << cpu);
+    run_queue_priorities |= (1u << priority);
+}
+
+/* once rq's queue at priority has emptied */
+static inline void run_queue_clear_priority(struct run_queue *rq, int priority)
+{
+    uint cpu = (uint)(rq - run_queue);
+
+    rq->bitmap &= ~(1u << priority);
+    run_queue_cpus[priority] &= ~(1u << cpu);
+    if (!run_queue_cpus[priority])
+        run_queue_priorities &= ~(1u << priority);
+}
+
+/* whether something queued on cpu should run ahead of current, which is
+ * running there */
+static bool run_queue_preempts(uint cpu, thread_t *current)
+{
+    struct run_queue *rq = &run_queue[cpu];
+
+    thread_t *t = list_peek_head_type(&rq->deadline_queue, thread_t, queue_node);
+    if (t)
+        return !thread_is_deadline(current) || t->deadline_abs_us < current->deadline_abs_us;
+
+    return !thread_is_deadline(current) && run_queue_highest_priority(rq) > current->priority;
+}
+
+#if WITH_SMP
+/* pick the cpu whose run queue a ready thread should go into, out of those
+ * its affinity allows.
+ *
+ * a thread being requeued by the cpu it is running on stays local, as does
+ * one woken by a thread that is about to block waiting for it. otherwise a
+ * thread being woken goes back to the cpu it last ran on if that cpu is idle,
+ * to keep its cache warm, otherwise to any idle cpu, and only then to its
+ * last cpu even though it is busy. */
+static uint find_cpu_for_thread(thread_t *t)
+{
+    uint local_cpu = arch_curr_cpu_num();
+    thread_t *current_thread = get_current_thread();
+
+    if (thread_is_deadline(t))
+        return t->deadline_cpu;
+
+    if (t->pinned_cpu >= 0)
+        return t->pinned_cpu;
+
+    /* a thread whose cpus have all gone offline runs wherever it can */
+    mp_cpu_mask_t active = t->cpu_affinity & mp_get_active_mask();
+    if (!active)
+        active = mp_get_active_mask();
+    bool local_ok = active & (1u << local_cpu);
+
+    if (t == current_thread && local_ok)
+        return local_cpu;
+
+    /* the waker hands its cpu straight over */
+    if (current_thread->sync_wakeup && !thread_is_real_time_or_idle(current_thread) && local_ok)
+        return local_cpu;
+
+    mp_cpu_mask_t idle = mp_get_idle_mask() & active;
+    int last_cpu = t->last_cpu;
+    uint cpu;
+
+    if (last_cpu >= 0 && (idle & (1u << last_cpu))) {
+        cpu = last_cpu;
+    } else if (idle) {
+        cpu = (idle & (1u << local_cpu)) ? local_cpu : (uint)__builtin_ctz(idle);
+    } else {
+        /* every cpu is busy. go back to the last cpu if the thread would
+         * preempt what is running there, otherwise to whichever cpu is running
+         * the lowest priority work below it. if nothing qualifies the thread
+         * just waits in its last cpu's queue. */
+        mp_cpu_mask_t candidates = active & ~mp_get_realtime_mask();
+        if (last_cpu >= 0 && (candidates & (1u << last_cpu)) &&
+            run_queue[last_cpu].curr_priority < t->priority)
+            return last_cpu;
+
+        int best_priority = t->priority;
+        int best_cpu = -1;
+        while (candidates) {
+            uint i = __builtin_ctz(candidates);
+            candidates &= ~(1u << i);
+            if (run_queue[i].curr_priority < best_priority) {
+                best_priority = run_queue[i].curr_priority;
+                best_cpu = i;
+            }
+        }
+        if (best_cpu >= 0)
+            return best_cpu;
+
+        if (last_cpu >= 0 && (active & (1u << last_cpu)))
+            return last_cpu;
+        return local_ok ? local_cpu : (uint)__builtin_ctz(active);
+    }
+
+    /* the chosen cpu is about to have work, so stop treating it as idle.
+     * this spreads a burst of wakeups across the idle cpus instead of
+     * piling them all onto the first one. */
+    mp_set_cpu_busy(cpu);
+    return cpu;
+}
+#else
+static inline uint find_cpu_for_thread(thread_t *t)
+{
+    return 0;
+}
+#endif
+
+/* start or stop the preemption timer depending on whether the thread running
+ * on this cpu has anything to share its time with */
+static void preempt_timer_update(uint cpu, thread_t *current)
+{
+    DEBUG_ASSERT(spin_lock_held(&run_queue[cpu].lock));
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    bool needed = !thread_is_real_time_or_idle(current) &&
+                  run_queue_highest_priority(&run_queue[cpu]) >= current->priority;
+
+    if (needed == preempt_timer_running[cpu])
+        return;
+
+#if DEBUG_THREAD_CONTEXT_SWITCH
+    dprintf(ALWAYS, "preempt_timer_update: %s preempt, cpu %u, current %p (%s)\n",
+            needed ? "start" : "stop", cpu, current, current->name);
+#endif
+    if (needed)
+        timer_set_periodic(&preempt_timer[cpu], 10, (timer_callback)thread_timer_tick, NULL);
+    else
+        timer_cancel(&preempt_timer[cpu]);
+    preempt_timer_running[cpu] = needed;
+#endif
+}
+
+#if SCHED_TRACE
+static void sched_trace_enqueue(thread_t *t, uint cpu)
+{
+    if (likely(!sched_trace_enable)) {
+        t->ready_time_us = 0;
+        return;
+    }
+
+    t->ready_time_us = current_time_hires();
+    sched_trace_add(SCHED_TRACE_ENQUEUE, t, cpu, run_queue[cpu].count, 0, 0);
+}
+
+/* record the switch away from oldthread and to newthread. start_cycles is the
+ * cycle count on entry to the scheduler. */
+static void sched_trace_switch(thread_t *oldthread, thread_t *newthread, uint cpu,
+                               lk_bigtime_t now, uint32_t start_cycles)
+{
+    if (likely(!sched_trace_enable))
+        return;
+
+    uint event;
+    switch (oldthread->state) {
+        case THREAD_READY:
+            event = SCHED_TRACE_PREEMPT;
+            break;
+        case THREAD_DEATH:
+            event = SCHED_TRACE_EXIT;
+            break;
+        default:
+            event = SCHED_TRACE_BLOCK;
+            break;
+    }
+    sched_trace_add(event, oldthread, cpu, run_queue[cpu].count, 0, 0);
+
+    uint32_t latency = 0;
+    if (newthread->ready_time_us != 0 && now > newthread->ready_time_us)
+        latency = (uint32_t)MIN(now - newthread->ready_time_us, UINT32_MAX);
+    sched_trace_add(SCHED_TRACE_DISPATCH, newthread, cpu, run_queue[cpu].count,
+                    latency, arch_cycle_count() - start_cycles);
+}
+#else
+static inline void sched_trace_enqueue(thread_t *t, uint cpu) {}
+static inline void sched_trace_switch(thread_t *oldthread, thread_t *newthread, uint cpu,
+                                      lk_bigtime_t now, uint32_t start_cycles) {}
+#endif
+
+/* per thread accounting: a thread entering a run queue stops being blocked
+ * and starts being ready, and the switch onto a cpu ends that in turn */
+static void thread_account_ready(thread_t *t)
+{
+    lk_bigtime_t now = current_time_hires();
+    if (t->blocked_since_us) {
+        t->blocked_us[t->blocked_reason] += now - t->blocked_since_us;
+        t->blocked_since_us = 0;
+    }
+    t->ready_since_us = now;
+}
+
+static void thread_account_switch(thread_t *oldthread, thread_t *newthread, lk_bigtime_t now)
+{
+    oldthread->runtime_us += now - oldthread->last_started_running_us;
+    oldthread->context_switches++;
+    if (oldthread->state == THREAD_READY) {
+        oldthread->preemptions++;
+    } else if (oldthread->state == THREAD_BLOCKED || oldthread->state == THREAD_SLEEPING) {
+        oldthread->blocked_since_us = now;
+        oldthread->blocked_reason = (oldthread->state == THREAD_SLEEPING) ?
+                                    THREAD_WAIT_SLEEP : oldthread->wait_reason;
+    }
+
+    if (newthread->ready_since_us) {
+        newthread->ready_us += now - newthread->ready_since_us;
+        newthread->ready_since_us = 0;
+    }
+    newthread->last_started_running_us = now;
+}
+
+static uint64_t deadline_bw(thread_t *t)
+{
+    return (t->deadline_runtime_us << DEADLINE_BW_SHIFT) / t->deadline_period_us;
+}
+
+/* keep the list sorted by deadline, or by replenish time for the throttled
+ * list, with ties in the order they were queued */
+static void deadline_list_insert(struct list_node *list, thread_t *t, bool throttled)
+{
+    lk_bigtime_t key = throttled ? t->deadline_replenish_us : t->deadline_abs_us;
+
+    thread_t *entry;
+    list_for_every_entry(list, entry, thread_t, queue_node) {
+        if (key < (throttled ? entry->deadline_replenish_us : entry->deadline_abs_us)) {
+            list_add_before(&entry->queue_node, &t->queue_node);
+            return;
+        }
+    }
+    list_add_tail(list, &t->queue_node);
+}
+
+static void deadline_start_period(thread_t *t, lk_bigtime_t start)
+{
+    t->deadline_abs_us = start + t->deadline_rel_us;
+    t->deadline_budget_us = t->deadline_runtime_us;
+    t->deadline_replenish_us = 0;
+}
+
+/* take the time a running deadline thread has had since it was last charged
+ * out of its runtime */
+static void deadline_charge(thread_t *t, lk_bigtime_t now)
+{
+    if (now > t->deadline_charged_us) {
+        t->deadline_budget_us -= now - t->deadline_charged_us;
+        t->deadline_charged_us = now;
+    }
+}
+
+/* set cpu's deadline timer for whichever comes first, the running deadline
+ * thread running out of runtime or a throttled thread's next period */
+static void deadline_timer_update(uint cpu, lk_bigtime_t now)
+{
+    struct run_queue *rq = &run_queue[cpu];
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    lk_bigtime_t next = rq->deadline_expiry_us;
+
+    thread_t *t = list_peek_head_type(&rq->deadline_throttled, thread_t, queue_node);
+    if (t && (!next || t->deadline_replenish_us < next))
+        next = t->deadline_replenish_us;
+
+    timer_cancel(&deadline_timer[cpu]);
+    if (!next)
+        return;
+
+    lk_time_t delay = (next > now) ? (lk_time_t)((next - now + 999) / 1000) : 1;
+    timer_set_oneshot(&deadline_timer[cpu], delay, deadline_timer_tick, (void *)(uintptr_t)cpu);
+}
+
+/* queue a ready deadline thread on its cpu, starting a new period or
+ * throttling it first if it needs it */
+static uint deadline_enqueue(thread_t *t)
+{
+    uint cpu = t->deadline_cpu;
+    struct run_queue *rq = &run_queue[cpu];
+
+    spin_lock(&rq->lock);
+
+    lk_bigtime_t now = current_time_hires();
+
+    if (t == get_current_thread()) {
+        /* being requeued while it runs */
+        deadline_charge(t, now);
+    } else if (now >= t->deadline_abs_us ||
+               (lk_bigtime_t)MAX(t->deadline_budget_us, 0) * t->deadline_period_us >
+               (t->deadline_abs_us - now) * t->deadline_runtime_us) {
+        /* waking up */
+        deadline_start_period(t, now);
+    }
+
+    thread_account_ready(t);
+
+    if (t->deadline_budget_us <= 0) {
+        lk_bigtime_t next = t->deadline_abs_us - t->deadline_rel_us + t->deadline_period_us;
+        if (next > now) {
+            t->deadline_replenish_us = next;
+            deadline_list_insert(&rq->deadline_throttled, t, true);
+            deadline_timer_update(cpu, now);
+            spin_unlock(&rq->lock);
+            return cpu;
+        }
+        deadline_start_period(t, now);
+    }
+
+    deadline_list_insert(&rq->deadline_queue, t, false);
+    rq->count++;
+    sched_trace_enqueue(t, cpu);
+
+    spin_unlock(&rq->lock);
+
+    return cpu;
+}
+
+/* only the queue's own lock is needed here, since the throttled threads it
+ * moves are only touched under that lock while they sit in the queue */
+static enum handler_return deadline_timer_tick(timer_t *timer, lk_time_t now_ms, void *arg)
+{
+    uint cpu = (uint)(uintptr_t)arg;
+    struct run_queue *rq = &run_queue[cpu];
+    bool resched = false;
+
+    spin_lock(&rq->lock);
+
+    lk_bigtime_t now = current_time_hires();
+
+    /* the throttled threads whose next period has come */
+    thread_t *t;
+    while ((t = list_peek_head_type(&rq->deadline_throttled, thread_t, queue_node)) &&
+           t->deadline_replenish_us <= now) {
+        list_delete(&t->queue_node);
+        deadline_start_period(t, t->deadline_replenish_us);
+        deadline_list_insert(&rq->deadline_queue, t, false);
+        rq->count++;
+        sched_trace_enqueue(t, cpu);
+        resched = true;
+    }
+
+    /* the running thread is out of runtime, and is throttled when the
+     * reschedule requeues it */
+    if (rq->deadline_expiry_us && rq->deadline_expiry_us <= now) {
+        rq->deadline_expiry_us = 0;
+        resched = true;
+    }
+
+    deadline_timer_update(cpu, now);
+
+    spin_unlock(&rq->lock);
+
+    if (!resched)
+        return INT_NO_RESCHEDULE;
+    if (cpu == arch_curr_cpu_num())
+        return INT_RESCHEDULE;
+    mp_reschedule(1u << cpu, 0);
+    return INT_NO_RESCHEDULE;
+}
+
+/* both insert routines return the cpu whose queue the thread landed on, so
+ * that the caller can decide which cpus need a reschedule ipi */
+static uint insert_in_run_queue_head(thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
@@ -83,11 +588,35 @@ static void insert_in_run_queue_head(thread_t *t)
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    list_add_head(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    if (thread_is_deadline(t))
+        return deadline_enqueue(t);
+
+    uint cpu = find_cpu_for_thread(t);
+    struct run_queue *rq = &run_queue[cpu];
+    spin_lock(&rq->lock);
+    list_add_head(&rq->queue[t->priority], &t->queue_node);
+    run_queue_set_priority(rq, t->priority);
+    rq->count++;
+
+    thread_t *current_thread = get_current_thread();
+    if (current_thread->sync_wakeup && cpu == arch_curr_cpu_num() && t != current_thread) {
+        rq->handoff = t;
+        rq->handoff_priority = t->priority;
+    }
+
+    thread_account_ready(t);
+    sched_trace_enqueue(t, cpu);
+
+    /* a thread queued behind the running one may need the preemption timer */
+    if (cpu == arch_curr_cpu_num() && t != get_current_thread())
+        preempt_timer_update(cpu, get_current_thread());
+
+    spin_unlock(&rq->lock);
+
+    return cpu;
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static uint insert_in_run_queue_tail(thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
@@ -95,17 +624,122 @@ static void insert_in_run_queue_tail(thread_t *t)
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    list_add_tail(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    if (thread_is_deadline(t))
+        return deadline_enqueue(t);
+
+    uint cpu = find_cpu_for_thread(t);
+    struct run_queue *rq = &run_queue[cpu];
+    spin_lock(&rq->lock);
+    list_add_tail(&rq->queue[t->priority], &t->queue_node);
+    run_queue_set_priority(rq, t->priority);
+    rq->count++;
+
+    thread_account_ready(t);
+    sched_trace_enqueue(t, cpu);
+
+    /* a thread queued behind the running one may need the preemption timer */
+    if (cpu == arch_curr_cpu_num() && t != get_current_thread())
+        preempt_timer_update(cpu, get_current_thread());
+
+    spin_unlock(&rq->lock);
+
+    return cpu;
+}
+
+static thread_t *run_queue_remove_head(struct run_queue *rq, int priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    thread_t *t = list_remove_head_type(&rq->queue[priority], thread_t, queue_node);
+    rq->count--;
+
+    if (list_is_empty(&rq->queue[priority]))
+        run_queue_clear_priority(rq, priority);
+
+    return t;
 }
 
 static void init_thread_struct(thread_t *t, const char *name)
 {
     memset(t, 0, sizeof(thread_t));
     t->magic = THREAD_MAGIC;
+    thread_set_last_cpu(t, -1);
     thread_set_pinned_cpu(t, -1);
+#if WITH_SMP
+    t->cpu_affinity = UINT32_MAX;
+#endif
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
+    list_initialize(&t->held_mutexes);
+}
+
+static void thread_cache_init(uint level)
+{
+    thread_cache_depth = cmdline_get_uint32("kernel.thread-cache", THREAD_CACHE_DEFAULT_DEPTH);
+}
+
+LK_INIT_HOOK(thread_cache, &thread_cache_init, LK_INIT_LEVEL_THREADING);
+
+static void *thread_cache_alloc(uint which, size_t size)
+{
+    void *ptr = NULL;
+    if (thread_cache_depth > 0) {
+        struct thread_cache *cache = &thread_cache[arch_curr_cpu_num()];
+        struct thread_cache_list *list = &cache->lists[which];
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        ptr = list->free;
+        if (ptr) {
+            list->free = *(void **)ptr;
+            list->count--;
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+    }
+    return ptr ? ptr : malloc(size);
+}
+
+static void thread_cache_free(uint which, void *ptr)
+{
+    struct thread_cache *cache = &thread_cache[arch_curr_cpu_num()];
+    struct thread_cache_list *list = &cache->lists[which];
+    bool cached = false;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    if (list->count < thread_cache_depth) {
+        *(void **)ptr = list->free;
+        list->free = ptr;
+        list->count++;
+        cached = true;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    if (!cached)
+        free(ptr);
+}
+
+static void *thread_alloc_stack(size_t stack_size)
+{
+    if (stack_size != THREAD_CACHE_STACK_SIZE)
+        return malloc(stack_size);
+    return thread_cache_alloc(THREAD_CACHE_STACKS, stack_size);
+}
+
+/* free the stack and structure of a thread that isn't running, if they were
+ * allocated by thread_create_etc() */
+static void thread_free_resources(thread_t *t)
+{
+    if (t->flags & THREAD_FLAG_FREE_STACK && t->stack) {
+        if (t->stack_size == THREAD_CACHE_STACK_SIZE) {
+            thread_cache_free(THREAD_CACHE_STACKS, t->stack);
+        } else {
+            free(t->stack);
+        }
+    }
+
+    if (t->flags & THREAD_FLAG_FREE_STRUCT)
+        thread_cache_free(THREAD_CACHE_STRUCTS, t);
 }
 
 static void initial_thread_func(void) __NO_RETURN;
@@ -163,7 +797,7 @@ thread_t *thread_create_etc(
     unsigned int flags = 0;
 
     if (!t) {
-        t = malloc(sizeof(thread_t));
+        t = thread_cache_alloc(THREAD_CACHE_STRUCTS, sizeof(thread_t));
         if (!t)
             return NULL;
         flags |= THREAD_FLAG_FREE_STRUCT;
@@ -174,6 +808,7 @@ thread_t *thread_create_etc(
     t->entry = entry;
     t->arg = arg;
     t->priority = priority;
+    t->base_priority = priority;
     t->state = THREAD_SUSPENDED;
     t->signals = 0;
     t->blocking_wait_queue = NULL;
@@ -190,10 +825,10 @@ thread_t *thread_create_etc(
         stack_size += THREAD_STACK_PADDING_SIZE;
         flags |= THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK;
 #endif
-        t->stack = malloc(stack_size);
+        t->stack = thread_alloc_stack(stack_size);
         if (!t->stack) {
             if (flags & THREAD_FLAG_FREE_STRUCT)
-                free(t);
+                thread_cache_free(THREAD_CACHE_STRUCTS, t);
             return NULL;
         }
         flags |= THREAD_FLAG_FREE_STACK;
@@ -250,31 +885,226 @@ status_t thread_set_real_time(thread_t *t)
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
     THREAD_LOCK(state);
-#if PLATFORM_HAS_DYNAMIC_TIMER
+    t->flags |= THREAD_FLAG_REAL_TIME;
     if (t == get_current_thread()) {
         /* if we're currently running, cancel the preemption timer. */
-        timer_cancel(&preempt_timer[arch_curr_cpu_num()]);
+        uint cpu = arch_curr_cpu_num();
+        spin_lock(&run_queue[cpu].lock);
+        preempt_timer_update(cpu, t);
+        spin_unlock(&run_queue[cpu].lock);
     }
-#endif
-    t->flags |= THREAD_FLAG_REAL_TIME;
     THREAD_UNLOCK(state);
 
     return NO_ERROR;
 }
 
-static bool thread_is_realtime(thread_t *t)
+/* the active cpu t may reserve bw of, the one with the least reserved so
+ * far, or -1 if none has room */
+static int deadline_find_cpu(thread_t *t, uint64_t bw)
 {
-    return (t->flags & THREAD_FLAG_REAL_TIME) && t->priority > DEFAULT_PRIORITY;
+    mp_cpu_mask_t allowed = mp_get_active_mask() & thread_allowed_cpus(t);
+    int best_cpu = -1;
+
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        if (!(allowed & (1u << cpu)))
+            continue;
+        uint64_t reserved = run_queue[cpu].deadline_bw;
+        if (reserved + bw > DEADLINE_MAX_BW)
+            continue;
+        if (best_cpu < 0 || reserved < run_queue[best_cpu].deadline_bw)
+            best_cpu = cpu;
+    }
+
+    return best_cpu;
 }
 
-static bool thread_is_idle(thread_t *t)
+/**
+ * @brief Schedule a thread by deadline
+ *
+ * The thread gets runtime_us of cpu time in every period_us, to be used
+ * within deadline_us of the start of each period, ahead of any thread
+ * scheduled by priority. It is assigned to a cpu which has that much time
+ * left to reserve, and is throttled until its next period if it tries to
+ * run longer.
+ *
+ * @param t Thread to schedule
+ * @param runtime_us Time it may run in each period, or 0 to go back to
+ * scheduling it by priority
+ * @param deadline_us When in each period it must have had its runtime
+ * @param period_us How often it gets its runtime
+ *
+ * @return NO_ERROR on success, ERR_INVALID_ARGS if the parameters are
+ * out of order or out of range, ERR_NO_RESOURCES if no cpu has room.
+ */
+status_t thread_set_deadline(thread_t *t, lk_bigtime_t runtime_us,
+                             lk_bigtime_t deadline_us, lk_bigtime_t period_us)
 {
-    return !!(t->flags & THREAD_FLAG_IDLE);
+    if (!t)
+        return ERR_INVALID_ARGS;
+    if (runtime_us != 0 &&
+        (runtime_us < DEADLINE_MIN_RUNTIME_US || runtime_us > deadline_us ||
+         deadline_us > period_us || period_us > DEADLINE_MAX_PERIOD_US))
+        return ERR_INVALID_ARGS;
+
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    status_t status = NO_ERROR;
+    bool resched = false;
+
+    THREAD_LOCK(state);
+
+    if (t->state == THREAD_DEATH) {
+        status = ERR_BAD_STATE;
+        goto out;
+    }
+
+    /* take it off the old terms before moving it to the new ones */
+    /* under the thread lock a ready thread is always in some queue, though a
+     * deadline thread may be moving between its cpu's lists */
+    bool queued = (t->state == THREAD_READY);
+    if (queued)
+        remove_from_run_queue(t);
+
+    uint64_t old_bw = 0;
+    if (thread_is_deadline(t)) {
+        old_bw = deadline_bw(t);
+        run_queue[t->deadline_cpu].deadline_bw -= old_bw;
+    }
+
+    if (runtime_us == 0) {
+        t->deadline_period_us = 0;
+    } else {
+        uint64_t bw = (runtime_us << DEADLINE_BW_SHIFT) / period_us;
+        int cpu = deadline_find_cpu(t, bw);
+        if (cpu < 0) {
+            if (old_bw)
+                run_queue[t->deadline_cpu].deadline_bw += old_bw;
+            status = ERR_NO_RESOURCES;
+        } else {
+            lk_bigtime_t now = current_time_hires();
+            t->deadline_runtime_us = runtime_us;
+            t->deadline_rel_us = deadline_us;
+            t->deadline_period_us = period_us;
+            t->deadline_cpu = cpu;
+            t->deadline_charged_us = now;
+            deadline_start_period(t, now);
+            run_queue[cpu].deadline_bw += bw;
+        }
+    }
+
+    if (queued) {
+        uint cpu = insert_in_run_queue_head(t);
+        mp_reschedule(1u << cpu, 0);
+    } else if (t->state == THREAD_RUNNING) {
+        /* have it requeued, onto its new cpu if it has one */
+        if (t == get_current_thread())
+            resched = true;
+        else
+            mp_reschedule(1u << thread_curr_cpu(t), 0);
+    }
+
+out:
+    THREAD_UNLOCK(state);
+
+    if (resched)
+        thread_preempt();
+
+    return status;
 }
 
-static bool thread_is_real_time_or_idle(thread_t *t)
+void thread_get_deadline(thread_t *t, lk_bigtime_t *runtime_us,
+                         lk_bigtime_t *deadline_us, lk_bigtime_t *period_us)
 {
-    return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE));
+    THREAD_LOCK(state);
+    bool deadline = thread_is_deadline(t);
+    *runtime_us = deadline ? t->deadline_runtime_us : 0;
+    *deadline_us = deadline ? t->deadline_rel_us : 0;
+    *period_us = deadline ? t->deadline_period_us : 0;
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief Restrict the cpus a thread runs on
+ *
+ * @param t Thread to restrict
+ * @param affinity The cpus it may run on, a bit per cpu
+ *
+ * @return NO_ERROR on success, ERR_INVALID_ARGS if affinity names no cpu,
+ * ERR_NO_RESOURCES if t is a deadline thread and none of the cpus can take
+ * its reservation.
+ */
+status_t thread_set_cpu_affinity(thread_t *t, uint32_t affinity)
+{
+    if (!t)
+        return ERR_INVALID_ARGS;
+
+    uint num_cpus = arch_max_num_cpus();
+    if (num_cpus < 32)
+        affinity &= (1u << num_cpus) - 1;
+    if (!affinity)
+        return ERR_INVALID_ARGS;
+
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+#if WITH_SMP
+    status_t status = NO_ERROR;
+
+    THREAD_LOCK(state);
+
+    if (t->state == THREAD_DEATH) {
+        status = ERR_BAD_STATE;
+        goto out;
+    }
+
+    /* under the thread lock a ready thread is always in some queue, though a
+     * deadline thread may be moving between its cpu's lists */
+    bool queued = (t->state == THREAD_READY);
+    if (queued)
+        remove_from_run_queue(t);
+
+    uint32_t old_affinity = t->cpu_affinity;
+    t->cpu_affinity = affinity;
+
+    /* a deadline thread's reservation has to move with it */
+    if (thread_is_deadline(t) && !(thread_allowed_cpus(t) & (1u << t->deadline_cpu))) {
+        uint64_t bw = deadline_bw(t);
+        run_queue[t->deadline_cpu].deadline_bw -= bw;
+        int cpu = deadline_find_cpu(t, bw);
+        if (cpu < 0) {
+            t->cpu_affinity = old_affinity;
+            cpu = t->deadline_cpu;
+            status = ERR_NO_RESOURCES;
+        }
+        t->deadline_cpu = cpu;
+        run_queue[cpu].deadline_bw += bw;
+    }
+
+    if (queued) {
+        uint cpu = insert_in_run_queue_head(t);
+        mp_reschedule(1u << cpu, 0);
+    } else if (t->state == THREAD_RUNNING) {
+        uint curr_cpu = thread_curr_cpu(t);
+        bool move = thread_is_deadline(t) ? curr_cpu != t->deadline_cpu
+                                          : !(thread_allowed_cpus(t) & (1u << curr_cpu));
+        if (move && t == get_current_thread()) {
+            /* hand ourselves to one of the new cpus */
+            t->state = THREAD_READY;
+            uint cpu = insert_in_run_queue_head(t);
+            mp_reschedule(1u << cpu, 0);
+            thread_resched();
+        } else if (move) {
+            /* the cpu it is on requeues it when it reschedules */
+            mp_reschedule(1u << curr_cpu, 0);
+        }
+    }
+
+out:
+    THREAD_UNLOCK(state);
+
+    return status;
+#else
+    return NO_ERROR;
+#endif
 }
 
 /**
@@ -297,13 +1127,12 @@ status_t thread_resume(thread_t *t)
     THREAD_LOCK(state);
     if (t->state == THREAD_SUSPENDED) {
         t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
+        uint cpu = insert_in_run_queue_head(t);
         if (!ints_disabled) /* HACK, don't resced into bootstrap thread before idle thread is set up */
             resched = true;
+        mp_reschedule(1u << cpu, 0);
     }
 
-    mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
-
     THREAD_UNLOCK(state);
 
     if (resched)
@@ -360,11 +1189,7 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout)
     THREAD_UNLOCK(state);
 
     /* free its stack and the thread structure itself */
-    if (t->flags & THREAD_FLAG_FREE_STACK && t->stack)
-        free(t->stack);
-
-    if (t->flags & THREAD_FLAG_FREE_STRUCT)
-        free(t);
+    thread_free_resources(t);
 
     return NO_ERROR;
 }
@@ -397,6 +1222,12 @@ __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode
     current_thread->state = THREAD_DEATH;
     current_thread->retcode = retcode;
 
+    /* give back any cpu time it had reserved */
+    if (thread_is_deadline(current_thread)) {
+        run_queue[current_thread->deadline_cpu].deadline_bw -= deadline_bw(current_thread);
+        current_thread->deadline_period_us = 0;
+    }
+
     /* if we're detached, then do our teardown here */
     if (current_thread->flags & THREAD_FLAG_DETACHED) {
         /* remove it from the master thread list */
@@ -447,11 +1278,7 @@ void thread_forget(thread_t *t)
 
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
-    if (t->flags & THREAD_FLAG_FREE_STACK && t->stack)
-        free(t->stack);
-
-    if (t->flags & THREAD_FLAG_FREE_STRUCT)
-        free(t);
+    thread_free_resources(t);
 }
 
 /**
@@ -529,7 +1356,7 @@ void thread_kill(thread_t *t, bool block)
             if (t->interruptable) {
                 t->state = THREAD_READY;
                 t->blocked_status = ERR_INTERRUPTED;
-                insert_in_run_queue_head(t);
+                mp_reschedule(1u << insert_in_run_queue_head(t), 0);
             }
             break;
         case THREAD_DEATH:
@@ -546,12 +1373,10 @@ done:
     THREAD_UNLOCK(state);
 }
 
-/* check for any pending signals and handle them */
-void thread_process_pending_signals(void)
+/* handle the pending signals thread_process_pending_signals() found */
+void thread_process_pending_signals_slow(void)
 {
     thread_t *current_thread = get_current_thread();
-    if (likely(current_thread->signals == 0))
-        return;
 
     /* grab the thread lock so we can safely look at the signal mask */
     THREAD_LOCK(state);
@@ -573,32 +1398,142 @@ __NO_RETURN static int idle_thread_routine(void *arg)
         arch_idle();
 }
 
-static thread_t *get_top_thread(int cpu)
+/* take a ready thread out of whichever run queue it is sitting in */
+static void remove_from_run_queue(thread_t *t)
 {
-    thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+    DEBUG_ASSERT(t->state == THREAD_READY);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    while (local_run_queue_bitmap) {
-        /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * 8 - NUM_PRIORITIES);
+    if (thread_is_deadline(t)) {
+        struct run_queue *rq = &run_queue[t->deadline_cpu];
+        spin_lock(&rq->lock);
+        DEBUG_ASSERT(list_in_list(&t->queue_node));
+        list_delete(&t->queue_node);
+        if (!t->deadline_replenish_us)
+            rq->count--;
+        t->deadline_replenish_us = 0;
+        spin_unlock(&rq->lock);
+        return;
+    }
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
-#if WITH_SMP
-            if (newthread->pinned_cpu < 0 || newthread->pinned_cpu == cpu)
-#endif
-            {
-                list_delete(&newthread->queue_node);
+    mp_cpu_mask_t cpus = run_queue_cpus[t->priority];
+    while (cpus) {
+        struct run_queue *rq = &run_queue[__builtin_ctz(cpus)];
+        cpus &= cpus - 1;
+
+        spin_lock(&rq->lock);
+        thread_t *entry;
+        list_for_every_entry(&rq->queue[t->priority], entry, thread_t, queue_node) {
+            if (entry == t) {
+                list_delete(&t->queue_node);
+                rq->count--;
+                if (list_is_empty(&rq->queue[t->priority]))
+                    run_queue_clear_priority(rq, t->priority);
+                spin_unlock(&rq->lock);
+                return;
+            }
+        }
+        spin_unlock(&rq->lock);
+    }
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+    panic("thread %p (%s) is ready but not in any run queue\n", t, t->name);
+}
+
+#if WITH_SMP
+/* look through the other cpus' run queues for a thread with a priority higher
+ * than min_priority that is allowed to run on cpu. threads pinned to another
+ * cpu, or whose affinity leaves this one out, are skipped. only the queues
+ * holding such a priority are visited, so when nothing beats the local queue
+ * this is a check of one word. */
+static thread_t *steal_thread(uint cpu, int min_priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-                return newthread;
+    uint32_t priorities = run_queue_priorities;
+    if (min_priority >= 0)
+        priorities &= ~((2u << min_priority) - 1);
+
+    while (priorities) {
+        int pri = (int)(sizeof(priorities) * 8 - 1) - __builtin_clz(priorities);
+        priorities &= ~(1u << pri);
+
+        mp_cpu_mask_t cpus = run_queue_cpus[pri] & ~(1u << cpu);
+        while (cpus) {
+            struct run_queue *rq = &run_queue[__builtin_ctz(cpus)];
+            cpus &= cpus - 1;
+
+            spin_lock(&rq->lock);
+            thread_t *t;
+            list_for_every_entry(&rq->queue[pri], t, thread_t, queue_node) {
+                if (thread_allowed_cpus(t) & (1u << cpu)) {
+                    list_delete(&t->queue_node);
+                    rq->count--;
+                    if (list_is_empty(&rq->queue[pri]))
+                        run_queue_clear_priority(rq, pri);
+                    spin_unlock(&rq->lock);
+                    return t;
+                }
             }
+            spin_unlock(&rq->lock);
         }
+    }
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+    return NULL;
+}
+#endif
+
+/* if the current thread is blocking right after waking a thread to run in
+ * its place, take that thread out of the queue so it can be switched to
+ * without going through the usual selection. the hint only counts while the
+ * thread is still at the head of its queue and nothing more important is
+ * waiting on this cpu. */
+static thread_t *take_handoff_thread(uint cpu, thread_t *current_thread)
+{
+    struct run_queue *rq = &run_queue[cpu];
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    thread_t *t = rq->handoff;
+    int priority = rq->handoff_priority;
+
+    rq->handoff = NULL;
+
+    if (!t || !current_thread->sync_wakeup || current_thread->state != THREAD_BLOCKED)
+        return NULL;
+    if (!list_is_empty(&rq->deadline_queue))
+        return NULL;
+    if (priority < run_queue_highest_priority(rq))
+        return NULL;
+    if (list_peek_head_type(&rq->queue[priority], thread_t, queue_node) != t)
+        return NULL;
+
+    return run_queue_remove_head(rq, priority);
+}
+
+static thread_t *get_top_thread(uint cpu)
+{
+    struct run_queue *rq = &run_queue[cpu];
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    /* deadline threads come first, and never move between cpus */
+    thread_t *t = list_remove_head_type(&rq->deadline_queue, thread_t, queue_node);
+    if (t) {
+        rq->count--;
+        return t;
     }
+
+    int local_priority = run_queue_highest_priority(rq);
+
+#if WITH_SMP
+    /* prefer our own queue, but take a higher priority thread from another
+     * cpu if one is waiting. this is also how an idle cpu picks up work. */
+    thread_t *stolen = steal_thread(cpu, local_priority);
+    if (stolen)
+        return stolen;
+#endif
+
+    if (local_priority >= 0)
+        return run_queue_remove_head(rq, local_priority);
+
     /* no threads to run, select the idle thread for this cpu */
     return idle_thread(cpu);
 }
@@ -620,6 +1555,7 @@ void thread_resched(void)
 
     thread_t *current_thread = get_current_thread();
     uint cpu = arch_curr_cpu_num();
+    uint32_t start_cycles = sched_trace_enable ? arch_cycle_count() : 0;
 
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
@@ -627,7 +1563,12 @@ void thread_resched(void)
 
     THREAD_STATS_INC(reschedules);
 
-    newthread = get_top_thread(cpu);
+    spin_lock(&run_queue[cpu].lock);
+
+    newthread = take_handoff_thread(cpu, current_thread);
+    bool handoff = (newthread != NULL);
+    if (!handoff)
+        newthread = get_top_thread(cpu);
 
     DEBUG_ASSERT(newthread);
 
@@ -635,12 +1576,49 @@ void thread_resched(void)
 
     oldthread = current_thread;
 
-    if (newthread == oldthread)
+    run_queue[cpu].curr_priority = thread_is_deadline(newthread) ? NUM_PRIORITIES : newthread->priority;
+    preempt_timer_update(cpu, newthread);
+
+    /* bill the outgoing deadline thread and time the incoming one's runtime */
+    if (thread_is_deadline(oldthread) || thread_is_deadline(newthread) ||
+        run_queue[cpu].deadline_expiry_us) {
+        lk_bigtime_t now = current_time_hires();
+        if (thread_is_deadline(oldthread))
+            deadline_charge(oldthread, now);
+        if (thread_is_deadline(newthread)) {
+            newthread->deadline_charged_us = now;
+            run_queue[cpu].deadline_expiry_us = now + MAX(newthread->deadline_budget_us, 0);
+        } else {
+            run_queue[cpu].deadline_expiry_us = 0;
+        }
+        deadline_timer_update(cpu, now);
+    }
+
+    spin_unlock(&run_queue[cpu].lock);
+
+    if (newthread == oldthread) {
+        /* straight back off the run queue, nothing worth counting */
+        newthread->ready_since_us = 0;
+#if WITH_SMP
+        /* a wakeup aimed at this cpu marks it busy, but another cpu may have
+         * taken the thread first. the idle thread picking itself again means
+         * the cpu is still idle. */
+        if (thread_is_idle(newthread))
+            mp_set_cpu_idle(cpu);
+#endif
         return;
+    }
 
     lk_bigtime_t now = current_time_hires();
-    oldthread->runtime_us += now - oldthread->last_started_running_us;
-    newthread->last_started_running_us = now;
+    thread_account_switch(oldthread, newthread, now);
+
+    /* a thread run in place of its waker gets what is left of the waker's
+     * timeslice on top of its own, since it is doing the waker's work */
+    if (handoff && oldthread->remaining_quantum > 0) {
+        newthread->remaining_quantum = MAX(newthread->remaining_quantum, 0) +
+                                       oldthread->remaining_quantum;
+        oldthread->remaining_quantum = 0;
+    }
 
     /* set up quantum for the new thread if it was consumed */
     if (newthread->remaining_quantum <= 0) {
@@ -650,6 +1628,7 @@ void thread_resched(void)
     /* mark the cpu ownership of the threads */
     thread_set_curr_cpu(oldthread, -1);
     thread_set_curr_cpu(newthread, cpu);
+    thread_set_last_cpu(newthread, cpu);
 
 #if WITH_SMP
     if (thread_is_idle(newthread)) {
@@ -677,27 +1656,9 @@ void thread_resched(void)
 #endif
 
     KEVLOG_THREAD_SWITCH(oldthread, newthread);
-
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    if (thread_is_real_time_or_idle(newthread)) {
-        if (!thread_is_real_time_or_idle(oldthread)) {
-            /* if we're switching from a non real time to a real time, cancel
-             * the preemption timer. */
-#if DEBUG_THREAD_CONTEXT_SWITCH
-            dprintf(ALWAYS, "arch_context_switch: stop preempt, cpu %d, old %p (%s), new %p (%s)\n",
-                    cpu, oldthread, oldthread->name, newthread, newthread->name);
-#endif
-            timer_cancel(&preempt_timer[cpu]);
-        }
-    } else if (thread_is_real_time_or_idle(oldthread)) {
-        /* if we're switching from a real time (or idle thread) to a regular one,
-         * set up a periodic timer to run our preemption tick. */
-#if DEBUG_THREAD_CONTEXT_SWITCH
-        dprintf(ALWAYS, "arch_context_switch: start preempt, cpu %d, old %p (%s), new %p (%s)\n",
-                cpu, oldthread, oldthread->name, newthread, newthread->name);
-#endif
-        timer_set_periodic(&preempt_timer[cpu], 10, (timer_callback)thread_timer_tick, NULL);
-    }
+    sched_trace_switch(oldthread, newthread, cpu, now, start_cycles);
+#if WITH_LIB_KTRACE
+    ktrace(MX_KTRACE_TAG_CONTEXT_SWITCH, oldthread->state, (uintptr_t)newthread);
 #endif
 
     /* set some optional target debug leds */
@@ -810,16 +1771,73 @@ void thread_preempt(void)
     /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
     current_thread->state = THREAD_READY;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
+        uint cpu;
         if (current_thread->remaining_quantum > 0)
-            insert_in_run_queue_head(current_thread);
+            cpu = insert_in_run_queue_head(current_thread);
         else
-            insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+            cpu = insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+        /* its affinity may have moved it off this cpu */
+        mp_reschedule(1u << cpu, 0);
     }
     thread_resched();
 
     THREAD_UNLOCK(state);
 }
 
+/**
+ * @brief  Let a higher priority thread run, if one is waiting
+ *
+ * For use after waking threads without rescheduling. If one of them was
+ * queued on this cpu and outranks the current thread, the current thread is
+ * preempted as by thread_preempt(). Otherwise it keeps running, and threads
+ * of its own priority or below wait for it to block or use up its quantum.
+ * Threads queued on other cpus have already been sent a reschedule ipi.
+ */
+void thread_preempt_if_needed(void)
+{
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
+
+    if (thread_is_idle(current_thread))
+        return;
+
+    /* usually nothing was queued here that outranks us, which only takes a
+     * look at the local queue to find out */
+    spin_lock_saved_state_t irq_state;
+    arch_interrupt_save(&irq_state, SPIN_LOCK_FLAG_INTERRUPTS);
+    uint cpu = arch_curr_cpu_num();
+    spin_lock(&run_queue[cpu].lock);
+    bool preempts = run_queue_preempts(cpu, current_thread);
+    spin_unlock(&run_queue[cpu].lock);
+    arch_interrupt_restore(irq_state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (!preempts)
+        return;
+
+    THREAD_LOCK(state);
+
+    cpu = arch_curr_cpu_num();
+    spin_lock(&run_queue[cpu].lock);
+    preempts = run_queue_preempts(cpu, current_thread);
+    spin_unlock(&run_queue[cpu].lock);
+
+    if (preempts) {
+        THREAD_STATS_INC(preempts);
+        KEVLOG_THREAD_PREEMPT(current_thread);
+
+        current_thread->state = THREAD_READY;
+        if (current_thread->remaining_quantum > 0)
+            insert_in_run_queue_head(current_thread);
+        else
+            insert_in_run_queue_tail(current_thread);
+        thread_resched();
+    }
+
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief  Suspend thread until woken.
  *
@@ -851,8 +1869,8 @@ void thread_unblock(thread_t *t, bool resched)
     DEBUG_ASSERT(!thread_is_idle(t));
 
     t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-    mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+    uint cpu = insert_in_run_queue_head(t);
+    mp_reschedule(1u << cpu, 0);
     if (resched)
         thread_resched();
 }
@@ -888,10 +1906,16 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
 
     t->state = THREAD_READY;
     t->blocked_status = NO_ERROR;
-    insert_in_run_queue_head(t);
+    uint cpu = insert_in_run_queue_head(t);
 
     spin_unlock(&thread_lock);
 
+    /* only preempt the local cpu if the thread was queued here */
+    if (cpu != arch_curr_cpu_num()) {
+        mp_reschedule(1u << cpu, 0);
+        return INT_NO_RESCHEDULE;
+    }
+
     return INT_RESCHEDULE;
 }
 
@@ -928,7 +1952,8 @@ status_t thread_sleep_etc(lk_time_t delay, bool interruptable)
         goto out;
     }
 
-    timer_set_oneshot(&timer, delay, thread_sleep_handler, (void *)current_thread);
+    timer_set_oneshot_slack(&timer, delay, current_thread->timer_slack,
+                            thread_sleep_handler, (void *)current_thread);
     current_thread->state = THREAD_SLEEPING;
     current_thread->blocked_status = NO_ERROR;
 
@@ -964,6 +1989,7 @@ void thread_construct_first(thread_t *t, const char *name)
 
     init_thread_struct(t, name);
     t->priority = HIGHEST_PRIORITY;
+    t->base_priority = HIGHEST_PRIORITY;
     t->state = THREAD_RUNNING;
     t->flags = THREAD_FLAG_DETACHED;
     t->signals = 0;
@@ -988,8 +2014,15 @@ void thread_init_early(void)
     DEBUG_ASSERT(arch_curr_cpu_num() == 0);
 
     /* initialize the run queues */
-    for (i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&run_queue[cpu].lock);
+        for (i=0; i < NUM_PRIORITIES; i++)
+            list_initialize(&run_queue[cpu].queue[i]);
+        run_queue[cpu].bitmap = 0;
+        run_queue[cpu].count = 0;
+        list_initialize(&run_queue[cpu].deadline_queue);
+        list_initialize(&run_queue[cpu].deadline_throttled);
+    }
 
     /* initialize the thread list */
     list_initialize(&thread_list);
@@ -1006,6 +2039,10 @@ void thread_init_early(void)
  */
 void thread_init(void)
 {
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        timer_initialize(&deadline_timer[i]);
+    }
+
 #if PLATFORM_HAS_DYNAMIC_TIMER
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         timer_initialize(&preempt_timer[i]);
@@ -1031,6 +2068,91 @@ void thread_set_exit_callback(thread_t *t, thread_exit_callback_t cb, void *cb_a
     t->exit_callback_arg = cb_arg;
 }
 
+/* the priority t should be running at: its base priority, raised to that of
+ * anything lent to it and of the threads waiting on the mutexes it holds */
+static int thread_compute_priority(thread_t *t)
+{
+    int priority = MAX(t->base_priority, t->inherited_priority);
+
+    mutex_t *m;
+    list_for_every_entry(&t->held_mutexes, m, mutex_t, holder_node) {
+        thread_t *waiter;
+        list_for_every_entry(&m->wait.list, waiter, thread_t, queue_node) {
+            priority = MAX(priority, waiter->priority);
+        }
+    }
+
+    return priority;
+}
+
+/* move t to a new effective priority, fixing up whatever run queue or cpu
+ * state depends on it */
+static void thread_set_effective_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (t->priority == priority)
+        return;
+
+    /* a deadline thread's priority only counts once it goes back to being
+     * scheduled by priority */
+    if (thread_is_deadline(t)) {
+        t->priority = priority;
+        return;
+    }
+
+    switch (t->state) {
+        case THREAD_READY: {
+            remove_from_run_queue(t);
+            t->priority = priority;
+            uint cpu = insert_in_run_queue_tail(t);
+            mp_reschedule(1u << cpu, 0);
+            break;
+        }
+        case THREAD_RUNNING: {
+            t->priority = priority;
+            uint cpu = thread_curr_cpu(t);
+            spin_lock(&run_queue[cpu].lock);
+            run_queue[cpu].curr_priority = priority;
+            if (cpu == arch_curr_cpu_num())
+                preempt_timer_update(cpu, t);
+            spin_unlock(&run_queue[cpu].lock);
+            if (cpu != arch_curr_cpu_num()) {
+                /* let the other cpu notice if it now has something better to run */
+                mp_reschedule(1u << cpu, 0);
+            }
+            break;
+        }
+        default:
+            /* blocked or not yet running, picked up the next time it is queued */
+            t->priority = priority;
+            break;
+    }
+}
+
+void thread_inherit_priority_locked(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    while (t && t->priority < priority) {
+        thread_set_effective_priority(t, priority);
+        t = t->blocking_mutex ? t->blocking_mutex->holder : NULL;
+    }
+}
+
+void thread_update_priority_locked(thread_t *t)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    while (t) {
+        int priority = thread_compute_priority(t);
+        if (priority == t->priority)
+            break;
+        thread_set_effective_priority(t, priority);
+        t = t->blocking_mutex ? t->blocking_mutex->holder : NULL;
+    }
+}
+
 /**
  * @brief Change priority of current thread
  *
@@ -1046,7 +2168,8 @@ void thread_set_priority(int priority)
         priority = IDLE_PRIORITY + 1;
     if (priority > HIGHEST_PRIORITY)
         priority = HIGHEST_PRIORITY;
-    current_thread->priority = priority;
+    current_thread->base_priority = priority;
+    current_thread->priority = thread_compute_priority(current_thread);
 
     current_thread->state = THREAD_READY;
     insert_in_run_queue_head(current_thread);
@@ -1078,6 +2201,7 @@ void thread_become_idle(void)
 
     /* mark ourself as idle */
     t->priority = IDLE_PRIORITY;
+    t->base_priority = IDLE_PRIORITY;
     t->flags |= THREAD_FLAG_IDLE;
     thread_set_pinned_cpu(t, arch_curr_cpu_num());
 
@@ -1160,6 +2284,31 @@ static const char *thread_state_to_str(enum thread_state state)
     }
 }
 
+/**
+ * @brief  Get the time accounting of a thread.
+ *
+ * The time in whatever state the thread is in now is counted up to now.
+ */
+void thread_get_time_stats(thread_t *t, struct thread_time_stats *stats)
+{
+    THREAD_LOCK(state);
+
+    lk_bigtime_t now = current_time_hires();
+    stats->runtime_us = t->runtime_us;
+    if (t->state == THREAD_RUNNING)
+        stats->runtime_us += now - t->last_started_running_us;
+    stats->ready_us = t->ready_us;
+    if (t->ready_since_us)
+        stats->ready_us += now - t->ready_since_us;
+    memcpy(stats->blocked_us, t->blocked_us, sizeof(stats->blocked_us));
+    if (t->blocked_since_us)
+        stats->blocked_us[t->blocked_reason] += now - t->blocked_since_us;
+    stats->context_switches = t->context_switches;
+    stats->preemptions = t->preemptions;
+
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief  Dump debugging info about the specified thread.
  */
@@ -1179,6 +2328,14 @@ void dump_thread(thread_t *t)
             thread_state_to_str(t->state), t->priority, t->remaining_quantum);
 #endif
     dprintf(INFO, "\truntime_us %lld, runtime_s %lld\n", runtime, runtime / 1000000);
+    if (thread_is_deadline(t)) {
+        dprintf(INFO, "\tdeadline cpu %u, runtime %llu, deadline %llu, period %llu, "
+                "current deadline %llu, runtime left %lld\n",
+                t->deadline_cpu, t->deadline_runtime_us, t->deadline_rel_us,
+                t->deadline_period_us, t->deadline_abs_us, t->deadline_budget_us);
+    }
+    dprintf(INFO, "\tready_us %lld, context switches %llu, preemptions %llu\n",
+            t->ready_us, t->context_switches, t->preemptions);
     dprintf(INFO, "\tstack %p, stack_size %zd\n", t->stack, t->stack_size);
     dprintf(INFO, "\tentry %p, arg %p, flags 0x%x %s%s%s%s%s%s\n", t->entry, t->arg, t->flags,
             (t->flags & THREAD_FLAG_DETACHED) ? "Dt" :"",
@@ -1222,6 +2379,44 @@ void dump_all_threads(void)
     THREAD_UNLOCK(state);
 }
 
+void dump_run_queues(void)
+{
+    THREAD_LOCK(state);
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        struct run_queue *rq = &run_queue[cpu];
+        spin_lock(&rq->lock);
+        printf("cpu %u: %u ready, bitmap 0x%08x, running priority %d, deadline bw %llu%%\n",
+               cpu, rq->count, rq->bitmap, rq->curr_priority,
+               (rq->deadline_bw * 100) >> DEADLINE_BW_SHIFT);
+        thread_t *t;
+        if (!list_is_empty(&rq->deadline_queue)) {
+            printf("\tdeadline:");
+            list_for_every_entry(&rq->deadline_queue, t, thread_t, queue_node) {
+                printf(" %p (%s) @%llu", t, t->name, t->deadline_abs_us);
+            }
+            printf("\n");
+        }
+        if (!list_is_empty(&rq->deadline_throttled)) {
+            printf("\tthrottled:");
+            list_for_every_entry(&rq->deadline_throttled, t, thread_t, queue_node) {
+                printf(" %p (%s) until %llu", t, t->name, t->deadline_replenish_us);
+            }
+            printf("\n");
+        }
+        for (int pri = HIGHEST_PRIORITY; pri >= LOWEST_PRIORITY; pri--) {
+            if (!(rq->bitmap & (1u << pri)))
+                continue;
+            printf("\tpri %2d:", pri);
+            list_for_every_entry(&rq->queue[pri], t, thread_t, queue_node) {
+                printf(" %p (%s)", t, t->name);
+            }
+            printf("\n");
+        }
+        spin_unlock(&rq->lock);
+    }
+    THREAD_UNLOCK(state);
+}
+
 /** @} */
 
 
@@ -1293,7 +2488,8 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout)
     /* if the timeout is nonzero or noninfinite, set a callback to yank us out of the queue */
     if (timeout != INFINITE_TIME) {
         timer_initialize(&timer);
-        timer_set_oneshot(&timer, timeout, wait_queue_timeout_handler, (void *)current_thread);
+        timer_set_oneshot_slack(&timer, timeout, current_thread->timer_slack,
+                                wait_queue_timeout_handler, (void *)current_thread);
     }
 
     thread_resched();
@@ -1347,8 +2543,8 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
             current_thread->state = THREAD_READY;
             insert_in_run_queue_head(current_thread);
         }
-        insert_in_run_queue_head(t);
-        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+        uint cpu = insert_in_run_queue_head(t);
+        mp_reschedule(1u << cpu, 0);
         if (reschedule) {
             thread_resched();
         }
@@ -1394,7 +2590,9 @@ int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue
         insert_in_run_queue_head(current_thread);
     }
 
-    /* pop all the threads off the wait queue into the run queue */
+    /* pop all the threads off the wait queue into the run queue, collecting
+     * the cpus they landed on so that a single ipi covers all of them */
+    mp_cpu_mask_t resched_mask = 0;
     while ((t = list_remove_head_type(&wait->list, thread_t, queue_node))) {
         wait->count--;
         DEBUG_ASSERT(t->state == THREAD_BLOCKED);
@@ -1402,14 +2600,14 @@ int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue
         t->blocked_status = wait_queue_error;
         t->blocking_wait_queue = NULL;
 
-        insert_in_run_queue_head(t);
+        resched_mask |= 1u << insert_in_run_queue_head(t);
         ret++;
     }
 
     DEBUG_ASSERT(wait->count == 0);
 
     if (ret > 0) {
-        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+        mp_reschedule(resched_mask, 0);
         if (reschedule) {
             thread_resched();
         }
@@ -1463,8 +2661,8 @@ status_t thread_unblock_from_wait_queue(thread_t *t, status_t wait_queue_error)
     t->blocking_wait_queue = NULL;
     t->state = THREAD_READY;
     t->blocked_status = wait_queue_error;
-    insert_in_run_queue_head(t);
-    mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+    uint cpu = insert_in_run_queue_head(t);
+    mp_reschedule(1u << cpu, 0);
 
     return NO_ERROR;
 }
@@ -34,8 +34,38 @@
 
 spin_lock_t timer_lock;
 
+/* Each cpu keeps its timers in a hierarchical timing wheel. Level 0 has one
+ * slot per millisecond, and every level above it has slots that are
+ * TIMER_WHEEL_SLOTS times coarser. A timer is placed in the lowest level
+ * whose range reaches its deadline, and is moved down a level (cascaded)
+ * when the wheel reaches the start of its slot. Insertion and removal are
+ * O(1), and the next deadline is found with a few bitmap scans, which lets
+ * the hardware timer be programmed for exactly the next event instead of
+ * ticking. */
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 6 /* enough levels to cover all of lk_time_t */
+#define TIMER_WHEEL_SHIFT(level) ((level) * TIMER_WHEEL_SLOT_BITS)
+
+STATIC_ASSERT(TIMER_WHEEL_SHIFT(TIMER_WHEEL_LEVELS) >= sizeof(lk_time_t) * 8);
+
+struct timer_wheel_level {
+    /* set bits mark slots that may hold timers. timer_cancel does not know
+     * which slot a timer was in, so a bit may be stale and is cleared the
+     * next time the slot is found to be empty. */
+    uint64_t bitmap;
+    struct list_node slot[TIMER_WHEEL_SLOTS];
+};
+
 struct timer_state {
-    struct list_node timer_queue;
+    /* every timer due at or before wheel_time has been dispatched */
+    lk_time_t wheel_time;
+
+    /* the event the hardware timer is currently programmed for, if any */
+    bool deadline_set;
+    lk_time_t deadline;
+
+    struct timer_wheel_level level[TIMER_WHEEL_LEVELS];
 } __CPU_ALIGN;
 
 static struct timer_state timers[SMP_MAX_CPUS];
@@ -50,30 +80,165 @@ void timer_initialize(timer_t *timer)
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
-static void insert_timer_in_queue(uint cpu, timer_t *timer)
+/* distance between the slots of time a and time b at a given level */
+static inline uint32_t timer_wheel_slot_delta(lk_time_t a, lk_time_t b, uint level)
+{
+    uint shift = TIMER_WHEEL_SHIFT(level);
+
+    return ((a >> shift) - (b >> shift)) & (UINT32_MAX >> shift);
+}
+
+/* put a timer in the wheel. timers due before earliest are treated as due
+ * at earliest, which is the next slot the wheel will dispatch. */
+static void timer_wheel_insert(struct timer_state *ts, timer_t *timer, lk_time_t earliest)
 {
-    timer_t *entry;
+    lk_time_t when = timer->scheduled_time;
+    if (TIME_LT(when, earliest))
+        when = earliest;
 
+    uint level;
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (timer_wheel_slot_delta(when, ts->wheel_time, level) < TIMER_WHEEL_SLOTS)
+            break;
+    }
+
+    uint slot = (when >> TIMER_WHEEL_SHIFT(level)) & (TIMER_WHEEL_SLOTS - 1);
+    list_add_tail(&ts->level[level].slot[slot], &timer->node);
+    ts->level[level].bitmap |= (1ull << slot);
+}
+
+static void insert_timer_in_queue(uint cpu, timer_t *timer)
+{
     DEBUG_ASSERT(arch_ints_disabled());
 
     LTRACEF("timer %p, cpu %u, scheduled %u, periodic %u\n", timer, cpu, timer->scheduled_time, timer->periodic_time);
 
-    list_for_every_entry(&timers[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
-            return;
+    timer_wheel_insert(&timers[cpu], timer, timers[cpu].wheel_time + 1);
+}
+
+/* find the next time the wheel has work to do: either a level 0 slot with
+ * timers in it, or the start of a higher level slot that needs cascading.
+ * returns false if the wheel is empty. */
+static bool timer_wheel_next_event(struct timer_state *ts, lk_time_t *next)
+{
+    bool found = false;
+    lk_time_t best = 0;
+
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        struct timer_wheel_level *l = &ts->level[level];
+        uint shift = TIMER_WHEEL_SHIFT(level);
+        uint first = ((ts->wheel_time >> shift) + 1) & (TIMER_WHEEL_SLOTS - 1);
+
+        while (l->bitmap) {
+            /* rotate so that bit 0 is the slot after the current one */
+            uint64_t rotated = (l->bitmap >> first) |
+                               (first ? (l->bitmap << (TIMER_WHEEL_SLOTS - first)) : 0);
+            uint ahead = __builtin_ctzll(rotated);
+            uint slot = (first + ahead) & (TIMER_WHEEL_SLOTS - 1);
+
+            if (list_is_empty(&l->slot[slot])) {
+                l->bitmap &= ~(1ull << slot);
+                continue;
+            }
+
+            lk_time_t when = ((ts->wheel_time >> shift) + ahead + 1) << shift;
+            if (!found || TIME_LT(when, best)) {
+                best = when;
+                found = true;
+            }
+            break;
+        }
+    }
+
+    *next = best;
+    return found;
+}
+
+/* move the wheel to now without dispatching anything, which is only allowed
+ * if nothing is due in between. keeps timers set after a long idle stretch
+ * from being placed relative to a stale wheel position. */
+static void timer_wheel_catch_up(struct timer_state *ts, lk_time_t now)
+{
+    lk_time_t next;
+
+    if (TIME_GT(now, ts->wheel_time) &&
+        (!timer_wheel_next_event(ts, &next) || TIME_GT(next, now)))
+        ts->wheel_time = now;
+}
+
+/* push the timers in the slots starting at the current wheel time down to
+ * the lower levels */
+static void timer_wheel_cascade(struct timer_state *ts)
+{
+    lk_time_t now = ts->wheel_time;
+
+    for (uint level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        uint shift = TIMER_WHEEL_SHIFT(level);
+        if (now & ((1u << shift) - 1))
+            continue;
+
+        uint slot = (now >> shift) & (TIMER_WHEEL_SLOTS - 1);
+        struct timer_wheel_level *l = &ts->level[level];
+        if (!(l->bitmap & (1ull << slot)))
+            continue;
+
+        timer_t *timer;
+        while ((timer = list_remove_head_type(&l->slot[slot], timer_t, node)))
+            timer_wheel_insert(ts, timer, now);
+        l->bitmap &= ~(1ull << slot);
+    }
+}
+
+/* program the hardware timer for the next event on this cpu, if it changed */
+static void timer_reprogram(uint cpu, lk_time_t now)
+{
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    struct timer_state *ts = &timers[cpu];
+    lk_time_t next;
+
+    if (!timer_wheel_next_event(ts, &next)) {
+        if (ts->deadline_set) {
+            LTRACEF("clearing old hw timer, nothing in the queue\n");
+            platform_stop_timer();
+            ts->deadline_set = false;
         }
+        return;
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&timers[cpu].timer_queue, &timer->node);
+    if (ts->deadline_set && ts->deadline == next)
+        return;
+
+    lk_time_t delay = TIME_GT(next, now) ? next - now : 0;
+
+    LTRACEF("setting new timer for %u msecs\n", (uint)delay);
+    platform_set_oneshot_timer(timer_tick, NULL, delay);
+    ts->deadline_set = true;
+    ts->deadline = next;
+#endif
+}
+
+/* Pick the time in [when, when + slack] with the most low zero bits. Timers
+ * that are allowed to be late all round to the same few boundaries, so ones
+ * with nearby deadlines end up in the same slot and fire on one interrupt. */
+static lk_time_t timer_apply_slack(lk_time_t when, lk_time_t slack)
+{
+    lk_time_t latest = when + slack;
+    lk_time_t diff = when ^ latest;
+
+    if (slack == 0 || diff == 0)
+        return when;
+
+    uint bit = 31 - __builtin_clz(diff);
+    return latest & ~((1u << bit) - 1);
 }
 
-static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_callback callback, void *arg)
+static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, lk_time_t slack,
+                      timer_callback callback, void *arg)
 {
     lk_time_t now;
 
-    LTRACEF("timer %p, delay %u, period %u, callback %p, arg %p\n", timer, delay, period, callback, arg);
+    LTRACEF("timer %p, delay %u, period %u, slack %u, callback %p, arg %p\n",
+            timer, delay, period, slack, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
@@ -85,7 +250,7 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
     delay += 1;
 
     now = current_time();
-    timer->scheduled_time = now + delay;
+    timer->scheduled_time = timer_apply_slack(now + delay, slack);
     timer->periodic_time = period;
     timer->callback = callback;
     timer->arg = arg;
@@ -96,15 +261,9 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
     spin_lock_irqsave(&timer_lock, state);
 
     uint cpu = arch_curr_cpu_num();
+    timer_wheel_catch_up(&timers[cpu], now);
     insert_timer_in_queue(cpu, timer);
-
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    if (list_peek_head_type(&timers[cpu].timer_queue, timer_t, node) == timer) {
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
-#endif
+    timer_reprogram(cpu, now);
 
     spin_unlock_irqrestore(&timer_lock, state);
 }
@@ -124,10 +283,28 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
  *   enum handler_return callback(struct timer *, lk_time_t now, void *arg) { ... }
  */
 void timer_set_oneshot(timer_t *timer, lk_time_t delay, timer_callback callback, void *arg)
+{
+    timer_set_oneshot_slack(timer, delay, 0, callback, arg);
+}
+
+/**
+ * @brief  Set up a timer that executes once, and may do so late
+ *
+ * Like timer_set_oneshot(), except that the callback may be put off by up
+ * to slack ms so that it can share an interrupt with other timers.
+ *
+ * @param  timer The timer to use
+ * @param  delay The delay, in ms, before the timer is executed
+ * @param  slack How many ms late the timer may be executed
+ * @param  callback  The function to call when the timer expires
+ * @param  arg  The argument to pass to the callback
+ */
+void timer_set_oneshot_slack(timer_t *timer, lk_time_t delay, lk_time_t slack,
+                             timer_callback callback, void *arg)
 {
     if (delay == 0)
         delay = 1;
-    timer_set(timer, delay, 0, callback, arg);
+    timer_set(timer, delay, 0, slack, callback, arg);
 }
 
 /**
@@ -148,7 +325,25 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 {
     if (period == 0)
         period = 1;
-    timer_set(timer, period, period, callback, arg);
+    timer_set(timer, period, period, 0, callback, arg);
+}
+
+/* take a timer out of the queue and keep a running periodic callback from
+ * putting it back. called with timer_lock held. */
+static void timer_cancel_locked(timer_t *timer)
+{
+    if (list_in_list(&timer->node))
+        list_delete(&timer->node);
+
+    /* to keep it from being reinserted into the queue if called from
+     * periodic timer callback.
+     */
+    timer->periodic_time = 0;
+    timer->callback = NULL;
+    timer->arg = NULL;
+
+    /* see if we've just removed the next event on this cpu */
+    timer_reprogram(arch_curr_cpu_num(), current_time());
 }
 
 /**
@@ -160,44 +355,32 @@ void timer_cancel(timer_t *timer)
 
     spin_lock_saved_state_t state;
     spin_lock_irqsave(&timer_lock, state);
+    timer_cancel_locked(timer);
+    spin_unlock_irqrestore(&timer_lock, state);
+}
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    uint cpu = arch_curr_cpu_num();
-
-    timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-#endif
+/**
+ * @brief  Cancel a pending timer and wait out a running callback
+ */
+void timer_cancel_sync(timer_t *timer)
+{
+    DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
+    DEBUG_ASSERT(!arch_ints_disabled());
 
-    if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+    for (;;) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&timer_lock, state);
+        timer_cancel_locked(timer);
+        bool running = timer->running;
+        spin_unlock_irqrestore(&timer_lock, state);
 
-    /* to keep it from being reinserted into the queue if called from
-     * periodic timer callback.
-     */
-    timer->periodic_time = 0;
-    timer->callback = NULL;
-    timer->arg = NULL;
+        if (!running)
+            return;
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    /* see if we've just modified the head of the timer queue */
-    timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (newhead == NULL) {
-        LTRACEF("clearing old hw timer, nothing in the queue\n");
-        platform_stop_timer();
-    } else if (newhead != oldhead) {
-        lk_time_t delay;
-        lk_time_t now = current_time();
-
-        if (TIME_LT(newhead->scheduled_time, now))
-            delay = 0;
-        else
-            delay = newhead->scheduled_time - now;
-
-        LTRACEF("setting new timer to %u\n", (uint) delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
+        /* the callback may set the timer again, so cancel once more after */
+        while (timer->running)
+            arch_spinloop_pause();
     }
-#endif
-
-    spin_unlock_irqrestore(&timer_lock, state);
 }
 
 /* called at interrupt time to process any pending timers */
@@ -217,60 +400,65 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
     spin_lock(&timer_lock);
 
+    struct timer_state *ts = &timers[cpu];
+
+    /* the hardware timer is no longer armed once it has fired */
+    ts->deadline_set = false;
+
     for (;;) {
         /* see if there's an event to process */
-        timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-        if (likely(timer == 0))
-            break;
-        LTRACEF("next item on timer queue %p at %u now %u (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
-        if (likely(TIME_LT(now, timer->scheduled_time)))
+        lk_time_t next;
+        if (!timer_wheel_next_event(ts, &next) || TIME_GT(next, now)) {
+            ts->wheel_time = now;
             break;
+        }
 
-        /* process it */
-        LTRACEF("timer %p\n", timer);
-        DEBUG_ASSERT(timer && timer->magic == TIMER_MAGIC);
-        list_delete(&timer->node);
+        ts->wheel_time = next;
+        timer_wheel_cascade(ts);
+
+        uint slot = next & (TIMER_WHEEL_SLOTS - 1);
+        while ((timer = list_remove_head_type(&ts->level[0].slot[slot], timer_t, node))) {
+            LTRACEF("next item on timer queue %p at %u now %u (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
 
-        /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
+            /* process it */
+            LTRACEF("timer %p\n", timer);
+            DEBUG_ASSERT(timer && timer->magic == TIMER_MAGIC);
 
-        LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
+            /* we pulled it off the list, release the list lock to handle it */
+            timer->running = true;
+            spin_unlock(&timer_lock);
 
-        THREAD_STATS_INC(timers);
+            LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
 
-        bool periodic = timer->periodic_time > 0;
+            THREAD_STATS_INC(timers);
 
-        LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
-        KEVLOG_TIMER_CALL(timer->callback, timer->arg);
-        if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
-            ret = INT_RESCHEDULE;
+            bool periodic = timer->periodic_time > 0;
 
-        DEBUG_ASSERT(arch_ints_disabled());
-        /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+            LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
+            KEVLOG_TIMER_CALL(timer->callback, timer->arg);
+            if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
+                ret = INT_RESCHEDULE;
 
-        /* if it was a periodic timer and it hasn't been requeued
-         * by the callback put it back in the list
-         */
-        if (periodic && !list_in_list(&timer->node) && timer->periodic_time > 0) {
-            LTRACEF("periodic timer, period %u\n", timer->periodic_time);
-            timer->scheduled_time = now + timer->periodic_time;
-            insert_timer_in_queue(cpu, timer);
+            DEBUG_ASSERT(arch_ints_disabled());
+            /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
+            spin_lock(&timer_lock);
+            timer->running = false;
+
+            /* if it was a periodic timer and it hasn't been requeued
+             * by the callback put it back in the list
+             */
+            if (periodic && !list_in_list(&timer->node) && timer->periodic_time > 0) {
+                LTRACEF("periodic timer, period %u\n", timer->periodic_time);
+                timer->scheduled_time = now + timer->periodic_time;
+                insert_timer_in_queue(cpu, timer);
+            }
         }
+        ts->level[0].bitmap &= ~(1ull << slot);
     }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (timer) {
-        /* has to be the case or it would have fired already */
-        DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
-
-        lk_time_t delay = timer->scheduled_time - now;
-
-        LTRACEF("setting new timer for %u msecs for event %p\n", (uint)delay, timer);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
+    timer_reprogram(cpu, now);
 
     /* we're done manipulating the timer queue */
     spin_unlock(&timer_lock);
@@ -293,29 +481,22 @@ void timer_transition_off_cpu(uint old_cpu)
     spin_lock_irqsave(&timer_lock, state);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&timers[old_cpu].timer_queue, timer_t, node);
+    lk_time_t now = current_time();
+    timer_wheel_catch_up(&timers[cpu], now);
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe(&timers[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
-        insert_timer_in_queue(cpu, entry);
-    }
-
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    timer_t *new_head = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (new_head != old_head) {
-        lk_time_t now = current_time();
-        lk_time_t delay = 0;
-        if (TIME_LT(now, new_head->scheduled_time)) {
-            delay = new_head->scheduled_time - now;
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        struct timer_wheel_level *l = &timers[old_cpu].level[level];
+        for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            timer_t *entry;
+            while ((entry = list_remove_head_type(&l->slot[slot], timer_t, node)))
+                insert_timer_in_queue(cpu, entry);
         }
-
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
+        l->bitmap = 0;
     }
-#endif
+    timers[old_cpu].deadline_set = false;
+
+    timer_reprogram(cpu, now);
 
     spin_unlock_irqrestore(&timer_lock, state);
 }
@@ -330,26 +511,48 @@ void timer_thaw_percpu(void)
 
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *t = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (t) {
-        lk_time_t now = current_time();
-        lk_time_t delay = 0;
-        if (TIME_LT(now, t->scheduled_time)) {
-            delay = t->scheduled_time - now;
-        }
-        LTRACEF("rescheduling timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
+    /* whatever the hardware was programmed with has been lost */
+    timers[cpu].deadline_set = false;
+    timer_reprogram(cpu, current_time());
 
     spin_unlock(&timer_lock);
 #endif
 }
 
+/* How long this cpu can expect to sit idle before its next timer event, for
+ * picking how deeply to sleep. INFINITE_TIME if it has none. Only meaningful
+ * with interrupts disabled, since a timer set after this could be earlier. */
+lk_time_t timer_idle_time(lk_time_t now)
+{
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    /* the hardware timer is always programmed for the next event, so its
+     * deadline is good enough without taking the lock to scan the wheel */
+    const struct timer_state *ts = &timers[arch_curr_cpu_num()];
+    if (!ts->deadline_set)
+        return INFINITE_TIME;
+
+    lk_time_t deadline = ts->deadline;
+    return TIME_GT(deadline, now) ? deadline - now : 0;
+#else
+    /* a periodic tick is never far away */
+    return 0;
+#endif
+}
+
 void timer_init(void)
 {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
+    lk_time_t now = current_time();
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&timers[i].timer_queue);
+        timers[i].wheel_time = now;
+        timers[i].deadline_set = false;
+        for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            timers[i].level[level].bitmap = 0;
+            for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                list_initialize(&timers[i].level[level].slot[slot]);
+        }
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
     /* register for a periodic timer tick */
@@ -6,13 +6,18 @@
 // https://opensource.org/licenses/MIT
 
 #include "vm_priv.h"
+#include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
 #include <kernel/auto_lock.h>
+#include <kernel/event.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <lib/console.h>
 #include <list.h>
+#include <lk/init.h>
 #include <pow2.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,24 +40,332 @@ static mutex_t lock = MUTEX_INITIAL_VALUE(lock);
 #define ADDRESS_IN_ARENA(address, arena) \
     ((address) >= (arena)->base && (address) <= (arena)->base + (arena)->size - 1)
 
+/* memory pressure. memory counts as low once less than PMM_LOW_MEMORY_PERCENT
+ * of the arenas' pages are free, and stays low until PMM_LOW_MEMORY_CLEAR_PERCENT
+ * are free again, so that watchers don't see it flap around the threshold.
+ * pages sitting in the cpu caches and the zeroed pools are free as far as this
+ * goes, since any allocation can have them. they move in and out of the arenas
+ * in the middle of operations, so the state is only looked at once each alloc
+ * or free is done. */
+#define PMM_LOW_MEMORY_PERCENT 5
+#define PMM_LOW_MEMORY_CLEAR_PERCENT 10
+
+static size_t total_pages;
+/* free pages in the arenas, protected by the pmm lock */
+static size_t free_pages;
+/* pages in the cpu caches and the zeroed pools, which have locks of their own */
+static volatile long long cached_pages;
+static volatile bool memory_low;
+static spin_lock_t memory_state_lock = SPIN_LOCK_INITIAL_VALUE;
+static event_t memory_state_event =
+    EVENT_INITIAL_VALUE(memory_state_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+static void update_free_pages_locked(ssize_t delta) {
+    free_pages += delta;
+}
+
+static inline void update_cached_pages(long long delta) {
+    atomic_add_64(&cached_pages, delta);
+}
+
+static size_t count_free_pages() {
+    return free_pages + (size_t)atomic_load_64(&cached_pages);
+}
+
+/* whether memory would go low, or stop being low, at free free pages */
+static bool memory_state_changes(size_t free) {
+    if (memory_low)
+        return free >= total_pages / 100 * PMM_LOW_MEMORY_CLEAR_PERCENT;
+    return free < total_pages / 100 * PMM_LOW_MEMORY_PERCENT;
+}
+
+/* called after each alloc or free. only takes a lock when the state flips. */
+static void update_memory_state() {
+    if (!memory_state_changes(count_free_pages()))
+        return;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&memory_state_lock, state);
+    size_t free = count_free_pages();
+    if (memory_state_changes(free)) {
+        LTRACEF("memory %s, %zu of %zu pages free\n", memory_low ? "ok" : "low", free,
+                total_pages);
+        memory_low = !memory_low;
+        event_signal(&memory_state_event, false);
+    }
+    spin_unlock_irqrestore(&memory_state_lock, state);
+}
+
 static inline bool page_is_free(const vm_page_t* page) {
     return page->state == VM_PAGE_STATE_FREE;
 }
 
-paddr_t vm_page_to_paddr(const vm_page_t* page) {
-    pmm_arena_t* a;
-    list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
-        if (PAGE_BELONGS_TO_ARENA(page, a)) {
-            return PAGE_ADDRESS_FROM_ARENA(page, a);
+/* vm_page_t::order for pages that don't head a free block */
+#define PMM_ORDER_NONE 0xff
+
+static inline size_t arena_base_pfn(const pmm_arena_t* a) {
+    return a->base >> PAGE_SIZE_SHIFT;
+}
+
+static void buddy_add(pmm_arena_t* a, size_t index, uint order) {
+    vm_page_t* head = &a->page_array[index];
+    head->order = (uint8_t)order;
+    list_add_head(&a->free_list[order], &head->node);
+    a->free_blocks[order]++;
+}
+
+static void buddy_remove(pmm_arena_t* a, vm_page_t* head) {
+    DEBUG_ASSERT(head->order <= PMM_MAX_ORDER);
+    list_delete(&head->node);
+    a->free_blocks[head->order]--;
+    head->order = PMM_ORDER_NONE;
+}
+
+/* return the naturally aligned block of 2^order pages at index to the arena,
+ * merging it with its buddy for as long as the buddy is free as well */
+static void free_block(pmm_arena_t* a, size_t index, uint order) {
+    size_t base_pfn = arena_base_pfn(a);
+    size_t page_count = a->size / PAGE_SIZE;
+
+    for (size_t i = 0; i < (1UL << order); i++) {
+        vm_page_t* p = &a->page_array[index + i];
+        p->state = VM_PAGE_STATE_FREE;
+        p->order = PMM_ORDER_NONE;
+    }
+    a->free_count += 1UL << order;
+    update_free_pages_locked(1L << order);
+
+    while (order < PMM_MAX_ORDER) {
+        size_t buddy_pfn = (base_pfn + index) ^ (1UL << order);
+        if (buddy_pfn < base_pfn || buddy_pfn - base_pfn >= page_count)
+            break;
+
+        vm_page_t* buddy = &a->page_array[buddy_pfn - base_pfn];
+        if (!page_is_free(buddy) || buddy->order != order)
+            break;
+
+        buddy_remove(a, buddy);
+        index = MIN(index, buddy_pfn - base_pfn);
+        order++;
+    }
+
+    buddy_add(a, index, order);
+}
+
+/* return an arbitrary run of pages as the largest aligned blocks that fit */
+static void free_run(pmm_arena_t* a, size_t index, size_t count) {
+    size_t base_pfn = arena_base_pfn(a);
+
+    while (count > 0) {
+        uint order = 0;
+        while (order < PMM_MAX_ORDER && ((base_pfn + index) & ((2UL << order) - 1)) == 0 &&
+               (2UL << order) <= count)
+            order++;
+
+        free_block(a, index, order);
+        index += 1UL << order;
+        count -= 1UL << order;
+    }
+}
+
+/* take a naturally aligned block of 2^order pages out of the arena, splitting a
+ * larger block if there's none of the right size. returns the index of the
+ * first page, or -1 if the arena has no block that big. */
+static ssize_t alloc_block(pmm_arena_t* a, uint order) {
+    uint o = order;
+    while (o <= PMM_MAX_ORDER && list_is_empty(&a->free_list[o]))
+        o++;
+    if (o > PMM_MAX_ORDER)
+        return -1;
+
+    vm_page_t* head = list_peek_head_type(&a->free_list[o], vm_page_t, node);
+    buddy_remove(a, head);
+
+    size_t index = head - a->page_array;
+    while (o > order) {
+        o--;
+        buddy_add(a, index + (1UL << o), o);
+    }
+
+    for (size_t i = 0; i < (1UL << order); i++) {
+        DEBUG_ASSERT(page_is_free(&a->page_array[index + i]));
+        a->page_array[index + i].state = VM_PAGE_STATE_ALLOC;
+    }
+    a->free_count -= 1UL << order;
+    update_free_pages_locked(-(1L << order));
+
+    return index;
+}
+
+/* allocate the free page at index, splitting up the block that holds it */
+static void alloc_free_page(pmm_arena_t* a, size_t index) {
+    size_t base_pfn = arena_base_pfn(a);
+
+    DEBUG_ASSERT(page_is_free(&a->page_array[index]));
+
+    /* find the head of the block */
+    uint order;
+    size_t head;
+    for (order = 0;; order++) {
+        DEBUG_ASSERT(order <= PMM_MAX_ORDER);
+        size_t head_pfn = (base_pfn + index) & ~((1UL << order) - 1);
+        if (head_pfn < base_pfn)
+            continue;
+        head = head_pfn - base_pfn;
+        if (a->page_array[head].order == order)
+            break;
+    }
+
+    /* split it down to the one page, handing back the halves we don't want */
+    buddy_remove(a, &a->page_array[head]);
+    while (order > 0) {
+        order--;
+        size_t half = 1UL << order;
+        if (index < head + half) {
+            buddy_add(a, head + half, order);
+        } else {
+            buddy_add(a, head, order);
+            head += half;
+        }
+    }
+
+    a->page_array[index].state = VM_PAGE_STATE_ALLOC;
+    a->free_count--;
+    update_free_pages_locked(-1);
+}
+
+/* numa. arenas are tagged with the node their memory is attached to, and
+ * allocations try the arenas of the current cpu's node before the others,
+ * unless the caller names a node with PMM_ALLOC_FLAG_NODE(), in which case
+ * only that node's arenas will do. */
+static uint8_t cpu_node[SMP_MAX_CPUS];
+static uint node_count = 1;
+
+static uint current_node() {
+    return cpu_node[arch_curr_cpu_num()];
+}
+
+/* the node an allocation has to come from, or -1 if any will do */
+static int required_node(uint alloc_flags) {
+    return (int)((alloc_flags & PMM_ALLOC_FLAG_NODE_MASK) >> PMM_ALLOC_FLAG_NODE_SHIFT) - 1;
+}
+
+/* the node whose arenas an allocation tries first */
+static uint preferred_node(uint alloc_flags) {
+    int node = required_node(alloc_flags);
+    return (node >= 0) ? (uint)node : current_node();
+}
+
+static bool arena_usable(const pmm_arena_t* a, uint alloc_flags) {
+    /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+    if ((alloc_flags & PMM_ALLOC_FLAG_KMAP) && (a->flags & PMM_ARENA_FLAG_KMAP) == 0)
+        return false;
+
+    int node = required_node(alloc_flags);
+    return node < 0 || a->numa_node == (uint)node;
+}
+
+/* per cpu caches of free pages, so the common single page alloc and free paths
+ * stay off the global pmm lock. pages move between a cache and the arenas in
+ * batches. caches only hold pages from KMAP arenas on their cpu's node, so
+ * that any allocation made on the cpu without a node of its own can be served
+ * out of them. */
+#define PMM_CPU_CACHE_BATCH 16
+#define PMM_CPU_CACHE_MAX (PMM_CPU_CACHE_BATCH * 4)
+
+struct pmm_cpu_cache {
+    spin_lock_t lock;
+    struct list_node pages;
+    size_t count;
+} __CPU_ALIGN;
+
+static pmm_cpu_cache cpu_cache[SMP_MAX_CPUS];
+static bool cpu_cache_initialized;
+
+/* pools of free pages zeroed ahead of time by a low priority thread, one per
+ * node, so that PMM_ALLOC_FLAG_ZEROED allocations usually don't have to clear
+ * the page themselves. pool pages are KMAP and marked CACHED, so they are
+ * handed back to the arenas along with the cpu caches when memory runs short.
+ * the zeroer is kicked once a pool drops below the low water mark. */
+#define PMM_ZEROED_POOL_TARGET 256
+#define PMM_ZEROED_POOL_LOW (PMM_ZEROED_POOL_TARGET / 2)
+
+struct pmm_zeroed_pool {
+    struct list_node pages;
+    size_t count;
+};
+
+static spin_lock_t zeroed_lock = SPIN_LOCK_INITIAL_VALUE;
+static pmm_zeroed_pool zeroed_pool[PMM_MAX_NODES];
+static event_t zeroer_event = EVENT_INITIAL_VALUE(zeroer_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+/* arenas by index, so a page can find its arena without walking the arena list */
+#define PMM_MAX_ARENAS 32
+
+static pmm_arena_t* arena_table[PMM_MAX_ARENAS];
+static size_t arena_table_count;
+
+/* page frame table, mapping a physical address to the arena that holds it.
+ * the first level covers physical memory in 1GB chunks. each chunk that has
+ * memory in it points at a byte per page holding the arena index plus one,
+ * or zero if no arena covers that page. addresses above the table fall back
+ * to walking the arena list. */
+#define PMM_PFT_CHUNK_SHIFT 30
+#define PMM_PFT_CHUNK_PAGES (1UL << (PMM_PFT_CHUNK_SHIFT - PAGE_SIZE_SHIFT))
+#define PMM_PFT_CHUNKS 1024
+
+static uint8_t* page_frame_table[PMM_PFT_CHUNKS];
+
+static void pft_add_arena(const pmm_arena_t* arena, uint8_t index) {
+    for (paddr_t pa = arena->base; pa <= arena->base + arena->size - 1; pa += PAGE_SIZE) {
+        size_t chunk = pa >> PMM_PFT_CHUNK_SHIFT;
+        if (chunk >= PMM_PFT_CHUNKS)
+            break;
+
+        if (!page_frame_table[chunk]) {
+            page_frame_table[chunk] = (uint8_t*)boot_alloc_mem(PMM_PFT_CHUNK_PAGES);
+            memset(page_frame_table[chunk], 0, PMM_PFT_CHUNK_PAGES);
         }
+
+        page_frame_table[chunk][(pa >> PAGE_SIZE_SHIFT) % PMM_PFT_CHUNK_PAGES] =
+            (uint8_t)(index + 1);
     }
-    return -1;
+}
+
+static pmm_arena_t* page_to_arena(const vm_page_t* page) {
+    if (page->arena >= arena_table_count)
+        return nullptr;
+
+    pmm_arena_t* a = arena_table[page->arena];
+    if (!PAGE_BELONGS_TO_ARENA(page, a))
+        return nullptr;
+    return a;
+}
+
+paddr_t vm_page_to_paddr(const vm_page_t* page) {
+    pmm_arena_t* a = page_to_arena(page);
+    if (!a)
+        return -1;
+    return PAGE_ADDRESS_FROM_ARENA(page, a);
 }
 
 vm_page_t* paddr_to_vm_page(paddr_t addr) {
+    size_t chunk = addr >> PMM_PFT_CHUNK_SHIFT;
+    if (chunk < PMM_PFT_CHUNKS) {
+        if (!page_frame_table[chunk])
+            return NULL;
+
+        uint8_t index = page_frame_table[chunk][(addr >> PAGE_SIZE_SHIFT) % PMM_PFT_CHUNK_PAGES];
+        if (index == 0)
+            return NULL;
+
+        pmm_arena_t* a = arena_table[index - 1];
+        return &a->page_array[(addr - a->base) / PAGE_SIZE];
+    }
+
     pmm_arena_t* a;
     list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
-        if (addr >= a->base && addr <= a->base + a->size - 1) {
+        if (ADDRESS_IN_ARENA(addr, a)) {
             size_t index = (addr - a->base) / PAGE_SIZE;
             return &a->page_array[index];
         }
@@ -68,6 +381,32 @@ status_t pmm_add_arena(pmm_arena_t* arena) {
     DEBUG_ASSERT(IS_PAGE_ALIGNED(arena->size));
     DEBUG_ASSERT(arena->size > 0);
 
+    if (arena_table_count == PMM_MAX_ARENAS) {
+        TRACEF("too many arenas, dropping '%s'\n", arena->name);
+        return ERR_NO_RESOURCES;
+    }
+
+    /* the first arena sets up the cpu caches and zeroed pools, before anything can be
+     * allocated */
+    if (!cpu_cache_initialized) {
+        for (auto& cache : cpu_cache) {
+            spin_lock_init(&cache.lock);
+            list_initialize(&cache.pages);
+            cache.count = 0;
+        }
+        for (auto& pool : zeroed_pool) {
+            list_initialize(&pool.pages);
+            pool.count = 0;
+        }
+        cpu_cache_initialized = true;
+    }
+
+    if (arena->numa_node >= PMM_MAX_NODES) {
+        TRACEF("arena '%s' on node %u, counting it as node 0\n", arena->name, arena->numa_node);
+        arena->numa_node = 0;
+    }
+    node_count = MAX(node_count, arena->numa_node + 1);
+
     /* walk the arena list and add arena based on priority order */
     pmm_arena_t* a;
     list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
@@ -84,7 +423,10 @@ done_add:
 
     /* zero out some of the structure */
     arena->free_count = 0;
-    list_initialize(&arena->free_list);
+    for (uint i = 0; i <= PMM_MAX_ORDER; i++) {
+        list_initialize(&arena->free_list[i]);
+        arena->free_blocks[i] = 0;
+    }
 
     /* allocate an array of pages to back this one */
     size_t page_count = arena->size / PAGE_SIZE;
@@ -93,51 +435,292 @@ done_add:
     /* initialize all of the pages */
     memset(arena->page_array, 0, page_count * sizeof(vm_page_t));
 
-    /* add them to the free list */
+    uint8_t index = (uint8_t)arena_table_count++;
+    arena_table[index] = arena;
+    pft_add_arena(arena, index);
+
     for (size_t i = 0; i < page_count; i++) {
         vm_page_t* p = &arena->page_array[i];
 
-        list_add_tail(&arena->free_list, &p->node);
-
-        arena->free_count++;
+        p->state = VM_PAGE_STATE_ALLOC;
+        p->arena = index;
+        p->order = PMM_ORDER_NONE;
     }
 
+    /* add them to the buddy lists */
+    total_pages += page_count;
+    free_run(arena, 0, page_count);
+    update_memory_state();
+
     return NO_ERROR;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
-    AutoLock al(lock);
+static size_t alloc_pages_locked(size_t count, uint alloc_flags, struct list_node* list) {
+    DEBUG_ASSERT(is_mutex_held(&lock));
 
-    /* walk the arenas in order until we find one with a free page */
-    pmm_arena_t* a;
-    list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a->flags & PMM_ARENA_FLAG_KMAP) == 0)
+    size_t allocated = 0;
+
+    /* walk the arenas in order, allocating as many pages as we can from each. the
+     * preferred node's arenas go first and the rest after. */
+    uint local = preferred_node(alloc_flags);
+    for (uint pass = 0; pass < 2 && allocated < count; pass++) {
+        pmm_arena_t* a;
+        list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
+            if (!arena_usable(a, alloc_flags) || (a->numa_node == local) != (pass == 0))
                 continue;
+            while (allocated < count) {
+                ssize_t index = alloc_block(a, 0);
+                if (index < 0)
+                    break;
+
+                list_add_tail(list, &a->page_array[index].node);
+
+                allocated++;
+            }
+            if (allocated == count)
+                break;
         }
-        vm_page_t* page = list_remove_head_type(&a->free_list, vm_page_t, node);
-        if (!page)
-            continue;
+    }
+
+    return allocated;
+}
+
+static void free_page_locked(pmm_arena_t* a, vm_page_t* page) {
+    DEBUG_ASSERT(is_mutex_held(&lock));
+
+    free_block(a, page - a->page_array, 0);
+}
+
+/* return every page held in the cpu caches and the zeroed pool to the arenas */
+static void drain_page_caches_locked() {
+    DEBUG_ASSERT(is_mutex_held(&lock));
+
+    struct list_node zeroed = LIST_INITIAL_VALUE(zeroed);
+    spin_lock_saved_state_t zstate;
+    spin_lock_irqsave(&zeroed_lock, zstate);
+    for (auto& pool : zeroed_pool) {
+        struct list_node* znode;
+        while ((znode = list_remove_head(&pool.pages)))
+            list_add_tail(&zeroed, znode);
+        update_cached_pages(-(long long)pool.count);
+        pool.count = 0;
+    }
+    spin_unlock_irqrestore(&zeroed_lock, zstate);
+
+    vm_page_t* zpage;
+    while ((zpage = list_remove_head_type(&zeroed, vm_page_t, node))) {
+        DEBUG_ASSERT(zpage->state == VM_PAGE_STATE_CACHED);
+        free_page_locked(page_to_arena(zpage), zpage);
+    }
+
+    for (auto& cache : cpu_cache) {
+        struct list_node list = LIST_INITIAL_VALUE(list);
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache.lock, state);
+        struct list_node* node;
+        while ((node = list_remove_head(&cache.pages)))
+            list_add_tail(&list, node);
+        update_cached_pages(-(long long)cache.count);
+        cache.count = 0;
+        spin_unlock_irqrestore(&cache.lock, state);
+
+        vm_page_t* page;
+        while ((page = list_remove_head_type(&list, vm_page_t, node))) {
+            DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+            free_page_locked(page_to_arena(page), page);
+        }
+    }
+}
 
-        a->free_count--;
+static vm_page_t* cpu_cache_alloc() {
+    pmm_cpu_cache* cache = &cpu_cache[arch_curr_cpu_num()];
 
-        DEBUG_ASSERT(page_is_free(page));
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    vm_page_t* page = list_remove_head_type(&cache->pages, vm_page_t, node);
+    if (page) {
+        cache->count--;
+        update_cached_pages(-1);
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
 
+    if (page) {
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
         page->state = VM_PAGE_STATE_ALLOC;
+    }
+    return page;
+}
 
-        if (pa) {
-            /* compute the physical address of the page based on its offset into the arena */
-            *pa = PAGE_ADDRESS_FROM_ARENA(page, a);
+/* move as many pages from list into the current cpu's cache as it has room for.
+ * the pages must come from KMAP arenas. */
+static void cpu_cache_add(struct list_node* list) {
+    pmm_cpu_cache* cache = &cpu_cache[arch_curr_cpu_num()];
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    vm_page_t* page;
+    while (cache->count < PMM_CPU_CACHE_MAX &&
+           (page = list_remove_head_type(list, vm_page_t, node))) {
+        page->state = VM_PAGE_STATE_CACHED;
+        list_add_head(&cache->pages, &page->node);
+        cache->count++;
+        update_cached_pages(1);
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+}
+
+static void zero_page(vm_page_t* page) {
+    void* ptr = paddr_to_kvaddr(vm_page_to_paddr(page));
+    DEBUG_ASSERT(ptr);
+    memset(ptr, 0, PAGE_SIZE);
+}
+
+/* take up to count pages out of node's zeroed pool, appending them to list */
+static size_t zeroed_pool_alloc(size_t count, uint node, struct list_node* list) {
+    pmm_zeroed_pool* pool = &zeroed_pool[node];
+    size_t allocated = 0;
+    bool kick;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&zeroed_lock, state);
+    vm_page_t* page;
+    while (allocated < count && (page = list_remove_head_type(&pool->pages, vm_page_t, node))) {
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(list, &page->node);
+        pool->count--;
+        allocated++;
+    }
+    update_cached_pages(-(long long)allocated);
+    kick = pool->count < PMM_ZEROED_POOL_LOW;
+    spin_unlock_irqrestore(&zeroed_lock, state);
+
+    if (kick)
+        event_signal(&zeroer_event, false);
+
+    return allocated;
+}
+
+static vm_page_t* alloc_page(uint alloc_flags);
+
+static int zeroer_thread(void* arg) {
+    for (;;) {
+        for (uint node = 0; node < node_count; node++) {
+            pmm_zeroed_pool* pool = &zeroed_pool[node];
+            for (;;) {
+                spin_lock_saved_state_t state;
+                spin_lock_irqsave(&zeroed_lock, state);
+                bool full = pool->count >= PMM_ZEROED_POOL_TARGET;
+                spin_unlock_irqrestore(&zeroed_lock, state);
+                if (full)
+                    break;
+
+                /* not pmm_alloc_page(), since the page isn't really allocated and
+                 * the memory state shouldn't see it go */
+                vm_page_t* page = alloc_page(PMM_ALLOC_FLAG_KMAP | PMM_ALLOC_FLAG_NODE(node));
+                if (!page)
+                    break;
+
+                zero_page(page);
+
+                spin_lock_irqsave(&zeroed_lock, state);
+                page->state = VM_PAGE_STATE_CACHED;
+                list_add_tail(&pool->pages, &page->node);
+                pool->count++;
+                update_cached_pages(1);
+                spin_unlock_irqrestore(&zeroed_lock, state);
+            }
         }
 
-        LTRACEF("allocating page %p, pa 0x%lx\n", page, PAGE_ADDRESS_FROM_ARENA(page, a));
+        event_wait(&zeroer_event);
+    }
+
+    return 0;
+}
+
+static void pmm_zeroer_init(uint level) {
+    /* just above idle, so zeroing only soaks up otherwise idle cpu time */
+    thread_t* t = thread_create("pmm zeroer", &zeroer_thread, nullptr, LOWEST_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    if (t)
+        thread_detach_and_resume(t);
+}
 
-        return page;
+LK_INIT_HOOK(pmm_zeroer, pmm_zeroer_init, LK_INIT_LEVEL_THREADING);
+
+static vm_page_t* alloc_page(uint alloc_flags) {
+    /* the cache only holds pages from this cpu's node */
+    uint local = current_node();
+    int required = required_node(alloc_flags);
+    bool use_cache = required < 0 || (uint)required == local;
+
+    vm_page_t* page = use_cache ? cpu_cache_alloc() : nullptr;
+
+    if (!page) {
+        struct list_node list = LIST_INITIAL_VALUE(list);
+
+        AutoLock al(lock);
+
+        /* refill our cache with a batch of local pages, keeping the first for ourselves */
+        if (use_cache && alloc_pages_locked(PMM_CPU_CACHE_BATCH,
+                                            PMM_ALLOC_FLAG_KMAP | PMM_ALLOC_FLAG_NODE(local),
+                                            &list) > 0) {
+            page = list_remove_head_type(&list, vm_page_t, node);
+            cpu_cache_add(&list);
+            /* the cache may have filled up behind our back */
+            vm_page_t* p;
+            while ((p = list_remove_head_type(&list, vm_page_t, node)))
+                free_page_locked(page_to_arena(p), p);
+        } else if (alloc_pages_locked(1, alloc_flags, &list) == 1) {
+            page = list_remove_head_type(&list, vm_page_t, node);
+        } else {
+            /* last resort, the other cpus may be sitting on free pages */
+            drain_page_caches_locked();
+            if (alloc_pages_locked(1, alloc_flags, &list) == 1)
+                page = list_remove_head_type(&list, vm_page_t, node);
+        }
+
+        if (!page) {
+            LTRACEF("failed to allocate page\n");
+            return nullptr;
+        }
     }
 
-    LTRACEF("failed to allocate page\n");
-    return nullptr;
+    DEBUG_ASSERT(page->state == VM_PAGE_STATE_ALLOC);
+
+    return page;
+}
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    vm_page_t* page = nullptr;
+
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        struct list_node list = LIST_INITIAL_VALUE(list);
+        if (zeroed_pool_alloc(1, preferred_node(alloc_flags), &list) == 1) {
+            page = list_remove_head_type(&list, vm_page_t, node);
+        } else {
+            /* the pool ran dry, clear a page ourselves */
+            page = alloc_page(alloc_flags | PMM_ALLOC_FLAG_KMAP);
+            if (page)
+                zero_page(page);
+        }
+    } else {
+        page = alloc_page(alloc_flags);
+    }
+
+    update_memory_state();
+
+    if (!page)
+        return nullptr;
+
+    if (pa) {
+        *pa = vm_page_to_paddr(page);
+    }
+
+    LTRACEF("allocating page %p, pa 0x%lx\n", page, vm_page_to_paddr(page));
+
+    return page;
 }
 
 size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
@@ -146,36 +729,41 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     /* list must be initialized prior to calling this */
     DEBUG_ASSERT(list);
 
-    uint allocated = 0;
     if (count == 0)
         return 0;
 
-    AutoLock al(lock);
-
-    /* walk the arenas in order, allocating as many pages as we can from each */
-    pmm_arena_t* a;
-    list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a->flags & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+    size_t allocated = 0;
+    if (alloc_flags & PMM_ALLOC_FLAG_ZEROED) {
+        allocated = zeroed_pool_alloc(count, preferred_node(alloc_flags), list);
+        if (allocated == count) {
+            update_memory_state();
+            return allocated;
         }
-        while (allocated < count) {
-            vm_page_t* page = list_remove_head_type(&a->free_list, vm_page_t, node);
-            if (!page)
-                return allocated;
-
-            a->free_count--;
-
-            DEBUG_ASSERT(page_is_free(page));
+        alloc_flags |= PMM_ALLOC_FLAG_KMAP;
+    }
 
-            page->state = VM_PAGE_STATE_ALLOC;
-            list_add_tail(list, &page->node);
+    struct list_node fresh = LIST_INITIAL_VALUE(fresh);
+    {
+        AutoLock al(lock);
 
-            allocated++;
+        size_t n = alloc_pages_locked(count - allocated, alloc_flags, &fresh);
+        if (allocated + n < count) {
+            drain_page_caches_locked();
+            alloc_pages_locked(count - allocated - n, alloc_flags, &fresh);
         }
     }
 
+    /* clear whatever the pool couldn't cover outside of the lock */
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&fresh, vm_page_t, node))) {
+        if (alloc_flags & PMM_ALLOC_FLAG_ZEROED)
+            zero_page(page);
+        list_add_tail(list, &page->node);
+        allocated++;
+    }
+
+    update_memory_state();
+
     return allocated;
 }
 
@@ -199,20 +787,18 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
             DEBUG_ASSERT(index < a->size / PAGE_SIZE);
 
             vm_page_t* page = &a->page_array[index];
+            if (page->state == VM_PAGE_STATE_CACHED)
+                drain_page_caches_locked();
             if (!page_is_free(page)) {
                 /* we hit an allocated page */
                 break;
             }
 
-            DEBUG_ASSERT(list_in_list(&page->node));
-
-            list_delete(&page->node);
-            page->state = VM_PAGE_STATE_ALLOC;
+            alloc_free_page(a, index);
 
             if (list)
                 list_add_tail(list, &page->node);
 
-            a->free_count--;
             allocated++;
             address += PAGE_SIZE;
         }
@@ -221,27 +807,53 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
             break;
     }
 
+    update_memory_state();
+
     return allocated;
 }
 
-size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
-                            struct list_node* list) {
-    LTRACEF("count %zu, align %u\n", count, alignment_log2);
+static size_t alloc_contiguous_locked(size_t count, uint alloc_flags, uint8_t alignment_log2,
+                                      paddr_t* pa, struct list_node* list) {
+    DEBUG_ASSERT(is_mutex_held(&lock));
 
-    if (count == 0)
-        return 0;
-    if (alignment_log2 < PAGE_SIZE_SHIFT)
-        alignment_log2 = PAGE_SIZE_SHIFT;
+    pmm_arena_t* a;
 
-    AutoLock al(lock);
+    /* blocks are naturally aligned, so a block of the larger of the size and
+     * the alignment satisfies both. the unused tail is handed straight back. */
+    uint order = PMM_MAX_ORDER + 1;
+    if (count <= (1UL << PMM_MAX_ORDER))
+        order = MAX(alignment_log2 - PAGE_SIZE_SHIFT, log2_uint_roundup((uint)count));
+    uint local = preferred_node(alloc_flags);
+    for (uint pass = 0; pass < 2 && order <= PMM_MAX_ORDER; pass++) {
+        list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
+            if (!arena_usable(a, alloc_flags) || (a->numa_node == local) != (pass == 0))
+                continue;
 
-    pmm_arena_t* a;
-    list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a->flags & PMM_ARENA_FLAG_KMAP) == 0)
+            ssize_t index = alloc_block(a, order);
+            if (index < 0)
                 continue;
+
+            if ((1UL << order) > count)
+                free_run(a, index + count, (1UL << order) - count);
+
+            LTRACEF("found block of order %u at pn %zd\n", order, index);
+
+            if (list) {
+                for (size_t i = 0; i < count; i++)
+                    list_add_tail(list, &a->page_array[index + i].node);
+            }
+            if (pa)
+                *pa = a->base + index * PAGE_SIZE;
+
+            return count;
         }
+    }
+
+    /* no single block will do, but a run of free pages straddling blocks that
+     * are too small on their own might */
+    list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
+        if (!arena_usable(a, alloc_flags))
+            continue;
         /* walk the list starting at alignment boundaries.
          * calculate the starting offset into this arena, based on the
          * base address of the arena to handle the case where the arena
@@ -277,15 +889,10 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
             /* we found a run */
             LTRACEF("found run from pn %lu to %lu\n", start, start + count);
 
-            /* remove the pages from the run out of the free list */
+            /* pull the pages of the run out of their blocks */
             for (paddr_t i = start; i < start + count; i++) {
                 p = &a->page_array[i];
-                DEBUG_ASSERT(page_is_free(p));
-                DEBUG_ASSERT(list_in_list(&p->node));
-
-                list_delete(&p->node);
-                p->state = VM_PAGE_STATE_ALLOC;
-                a->free_count--;
+                alloc_free_page(a, i);
 
                 if (list)
                     list_add_tail(list, &p->node);
@@ -298,10 +905,34 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
         }
     }
 
-    LTRACEF("couldn't find run\n");
     return 0;
 }
 
+size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
+                            struct list_node* list) {
+    LTRACEF("count %zu, align %u\n", count, alignment_log2);
+
+    if (count == 0)
+        return 0;
+    if (alignment_log2 < PAGE_SIZE_SHIFT)
+        alignment_log2 = PAGE_SIZE_SHIFT;
+
+    AutoLock al(lock);
+
+    size_t ret = alloc_contiguous_locked(count, alloc_flags, alignment_log2, pa, list);
+    if (ret == 0) {
+        /* pages sitting in the cpu caches may be breaking up the run */
+        drain_page_caches_locked();
+        ret = alloc_contiguous_locked(count, alloc_flags, alignment_log2, pa, list);
+    }
+
+    update_memory_state();
+
+    if (ret == 0)
+        LTRACEF("couldn't find run\n");
+    return ret;
+}
+
 /* physically allocate a run from arenas marked as KMAP */
 void* pmm_alloc_kpages(size_t count, struct list_node* list, paddr_t* _pa) {
     LTRACEF("count %zu\n", count);
@@ -375,29 +1006,64 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(lock);
-
     uint count = 0;
-    while (!list_is_empty(list)) {
+    struct list_node overflow = LIST_INITIAL_VALUE(overflow);
+
+    /* first try to put the pages in the current cpu's cache */
+    uint cpu = arch_curr_cpu_num();
+    pmm_cpu_cache* cache = &cpu_cache[cpu];
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    while (cache->count < PMM_CPU_CACHE_MAX && !list_is_empty(list)) {
         vm_page_t* page = list_remove_head_type(list, vm_page_t, node);
 
         DEBUG_ASSERT(!list_in_list(&page->node));
         DEBUG_ASSERT(!page_is_free(page));
+        DEBUG_ASSERT(page->state != VM_PAGE_STATE_CACHED);
 
-        /* see which arena this page belongs to and add it */
-        pmm_arena_t* a;
-        list_for_every_entry (&arena_list, a, pmm_arena_t, node) {
-            if (PAGE_BELONGS_TO_ARENA(page, a)) {
-                page->state = VM_PAGE_STATE_FREE;
+        pmm_arena_t* a = page_to_arena(page);
+        if (!a)
+            continue;
 
-                list_add_head(&a->free_list, &page->node);
-                a->free_count++;
-                count++;
-                break;
-            }
+        if ((a->flags & PMM_ARENA_FLAG_KMAP) && a->numa_node == cpu_node[cpu]) {
+            page->state = VM_PAGE_STATE_CACHED;
+            list_add_head(&cache->pages, &page->node);
+            cache->count++;
+            update_cached_pages(1);
+        } else {
+            list_add_tail(&overflow, &page->node);
+        }
+        count++;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    if (list_is_empty(list) && list_is_empty(&overflow)) {
+        update_memory_state();
+        return count;
+    }
+
+    /* the rest goes back to the arenas */
+    AutoLock al(lock);
+
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&overflow, vm_page_t, node))) {
+        free_page_locked(page_to_arena(page), page);
+    }
+
+    while ((page = list_remove_head_type(list, vm_page_t, node))) {
+        DEBUG_ASSERT(!list_in_list(&page->node));
+        DEBUG_ASSERT(!page_is_free(page));
+
+        /* see which arena this page belongs to and add it */
+        pmm_arena_t* a = page_to_arena(page);
+        if (a) {
+            free_page_locked(a, page);
+            count++;
         }
     }
 
+    update_memory_state();
+
     return count;
 }
 
@@ -410,6 +1076,27 @@ size_t pmm_free_page(vm_page_t* page) {
     return pmm_free(&list);
 }
 
+void pmm_set_cpu_node(uint cpu_num, uint node) {
+    if (cpu_num >= SMP_MAX_CPUS || node >= PMM_MAX_NODES)
+        return;
+
+    AutoLock al(lock);
+
+    cpu_node[cpu_num] = (uint8_t)node;
+
+    /* the cpu's cache may hold pages from the node it was thought to be on */
+    drain_page_caches_locked();
+}
+
+bool pmm_memory_low(void) {
+    return memory_low;
+}
+
+void pmm_wait_memory_state_change(bool low) {
+    while (pmm_memory_low() == low)
+        event_wait(&memory_state_event);
+}
+
 static const char* page_state_to_str(const vm_page_t* page) {
     switch (page->state) {
     case VM_PAGE_STATE_FREE:
@@ -418,6 +1105,8 @@ static const char* page_state_to_str(const vm_page_t* page) {
         return "alloc";
     case VM_PAGE_STATE_MMU:
         return "mmu";
+    case VM_PAGE_STATE_CACHED:
+        return "cached";
     default:
         return "unknown";
     }
@@ -429,9 +1118,14 @@ static void dump_page(const vm_page_t* page) {
 }
 
 static void dump_arena(const pmm_arena_t* arena, bool dump_pages) {
-    printf("arena %p: name '%s' base 0x%lx size 0x%zx priority %u flags 0x%x\n", arena, arena->name,
-           arena->base, arena->size, arena->priority, arena->flags);
+    printf("arena %p: name '%s' base 0x%lx size 0x%zx priority %u flags 0x%x node %u\n", arena,
+           arena->name, arena->base, arena->size, arena->priority, arena->flags, arena->numa_node);
     printf("\tpage_array %p, free_count %zu\n", arena->page_array, arena->free_count);
+    printf("\tfree blocks by order:");
+    for (uint i = 0; i <= PMM_MAX_ORDER; i++) {
+        printf(" %u:%zu", i, arena->free_blocks[i]);
+    }
+    printf("\n");
 
     /* dump all of the pages */
     if (dump_pages) {
@@ -483,6 +1177,14 @@ static int cmd_pmm(int argc, const cmd_args* argv) {
     if (!strcmp(argv[1].str, "arenas")) {
         pmm_arena_t* a;
         list_for_every_entry (&arena_list, a, pmm_arena_t, node) { dump_arena(a, false); }
+        for (uint i = 0; i < arch_max_num_cpus(); i++) {
+            printf("cpu %u: node %u, %zu cached pages\n", i, cpu_node[i], cpu_cache[i].count);
+        }
+        for (uint i = 0; i < node_count; i++) {
+            printf("node %u zeroed pool: %zu pages\n", i, zeroed_pool[i].count);
+        }
+        printf("free pages: %zu of %zu, %lld of them cached%s\n", count_free_pages(), total_pages,
+               atomic_load_64(&cached_pages), memory_low ? ", memory low" : "");
     } else if (!strcmp(argv[1].str, "alloc")) {
         if (argc < 3)
             goto notenoughargs;
@@ -19,7 +19,10 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/vm.cpp \
     $(LOCAL_DIR)/vm_aspace.cpp \
     $(LOCAL_DIR)/vm_object.cpp \
+    $(LOCAL_DIR)/vm_page_list.cpp \
+    $(LOCAL_DIR)/vm_page_store.cpp \
     $(LOCAL_DIR)/vm_region.cpp \
+    $(LOCAL_DIR)/vm_region_tree.cpp \
     $(LOCAL_DIR)/vmm.cpp \
     $(LOCAL_DIR)/vm_unittest.cpp \
 
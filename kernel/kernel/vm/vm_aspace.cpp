@@ -103,7 +103,7 @@ static inline size_t trim_to_aspace(VmAspace& aspace, vaddr_t vaddr, size_t size
 }
 
 VmAspace::VmAspace(vaddr_t base, size_t size, uint32_t flags, const char* name)
-    : base_(base), size_(size), flags_(flags) {
+    : base_(base), size_(size), flags_(flags), region_tree_(base) {
 
     DEBUG_ASSERT(size != 0);
     DEBUG_ASSERT(base + size - 1 >= base);
@@ -178,6 +178,7 @@ VmAspace::~VmAspace() {
 
     // we have to have already been destroyed before freeing
     DEBUG_ASSERT(regions_.is_empty());
+    DEBUG_ASSERT(region_tree_.is_empty());
 
     // pop it out of the global aspace list
     {
@@ -196,26 +197,31 @@ status_t VmAspace::Destroy() {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("%p '%s'\n", this, name_);
 
-    // tear down and free all of the regions in our address space
-    mutex_acquire(&lock_);
-    utils::RefPtr<VmRegion> r;
-    while ((r = regions_.pop_front()) != nullptr) {
-        r->Unmap();
-
-        mutex_release(&lock_);
+    // take every region out under the lock, then clear the whole range from
+    // the page tables in one pass, with one round of TLB invalidation instead
+    // of a pass and a round per region
+    RegionList regions;
+    {
+        AutoLock a(lock_);
+        utils::RefPtr<VmRegion> r;
+        while ((r = regions_.pop_front()) != nullptr) {
+            region_tree_.Erase(r.get());
+            mapped_bytes_ -= r->size();
+            r->Detach();
+            regions.push_back(utils::move(r));
+        }
+        if (!regions.is_empty())
+            arch_mmu_unmap(&arch_aspace_, base_, size_ / PAGE_SIZE);
+    }
 
-        // free any resources the region holds
+    // free any resources the regions hold. the references are dropped here,
+    // outside the lock, so the regions don't destruct while it's held.
+    utils::RefPtr<VmRegion> r;
+    while ((r = regions.pop_front()) != nullptr) {
         r->Destroy();
-
-        // Explicitly release the reference.  We don't want to cause the object
-        // to destruct while in the lock.
         r.reset();
-
-        mutex_acquire(&lock_);
     }
 
-    mutex_release(&lock_);
-
     return NO_ERROR;
 }
 
@@ -234,40 +240,34 @@ status_t VmAspace::AddRegion(const utils::RefPtr<VmRegion>& r) {
         return ERR_OUT_OF_RANGE;
     }
 
-    // TODO(johngro) : The operation of finding a place for this region should
-    // be O(log).  Replace the O(n) linked list container used here with some
-    // form of O(log) container, when we have one.
-    //
-    // regions are sorted in ascending base address order.  If this region's
-    // base address is before the end of the last region's end, we will not
-    // find a place for it in the list.
+    // the region has to fit between the regions on either side of its base
     vaddr_t r_end = r->base() + r->size() - 1;
+    VmRegion* next = region_tree_.UpperBound(r->base());
+    VmRegion* prev = next ? region_tree_.Prev(next) : region_tree_.Last();
 
-    // does it fit in front
-    auto iter = regions_.begin();
-    if ((iter == regions_.end()) || r_end < iter->base()) {
-        // empty list or not empty and fits before the first element
-        regions_.insert(iter, r);
-        return NO_ERROR;
+    if ((prev && r->base() <= prev->base() + prev->size() - 1) || (next && r_end >= next->base())) {
+        LTRACEF_LEVEL(2, "couldn't find spot\n");
+        return ERR_NO_MEMORY;
     }
 
-    do {
-        vaddr_t last_end = iter->base() + iter->size() - 1;
-        if (r->base() <= last_end)
-            break;
-
-        ++iter;
-
-        // Does this region fit before the next region?
-        if ((iter == regions_.end()) || (r_end < iter->base())) {
-            regions_.insert(iter, r);
-            return NO_ERROR;
-        }
-    } while (iter != regions_.end());
+    InsertRegionLocked(r, next);
+    return NO_ERROR;
+}
 
+// insert a region into both the list and the tree, just before next
+void VmAspace::InsertRegionLocked(const utils::RefPtr<VmRegion>& r, VmRegion* next) {
+    if (next)
+        regions_.insert(*next, r);
+    else
+        regions_.push_back(r);
+    region_tree_.Insert(r.get());
+    mapped_bytes_ += r->size();
+}
 
-    LTRACEF_LEVEL(2, "couldn't find spot\n");
-    return ERR_NO_MEMORY;
+void VmAspace::RemoveRegionLocked(VmRegion* r) {
+    region_tree_.Erase(r);
+    regions_.erase(*r);
+    mapped_bytes_ -= r->size();
 }
 
 //
@@ -286,20 +286,19 @@ __WEAK vaddr_t arch_mmu_pick_spot(arch_aspace_t* aspace, vaddr_t base,
 //
 //  Returns true if the caller has to stop search
 
-bool VmAspace::CheckGap(const RegionList::iterator& prev,
-                        const RegionList::iterator& next,
+bool VmAspace::CheckGap(const VmRegion* prev, const VmRegion* next,
                         vaddr_t* pva, vaddr_t align, size_t region_size, uint arch_mmu_flags) {
     vaddr_t gap_beg; // first byte of a gap
     vaddr_t gap_end; // last byte of a gap
 
     DEBUG_ASSERT(pva);
 
-    if (prev.IsValid())
+    if (prev)
         gap_beg = prev->base() + prev->size();
     else
         gap_beg = base_;
 
-    if (next.IsValid()) {
+    if (next) {
         if (gap_beg == next->base())
             goto next_gap; // no gap between regions
         gap_end = next->base() - 1;
@@ -310,9 +309,9 @@ bool VmAspace::CheckGap(const RegionList::iterator& prev,
     }
 
     *pva = arch_mmu_pick_spot(&arch_aspace(), gap_beg,
-                              prev.IsValid() ? prev->arch_mmu_flags() : ARCH_MMU_FLAG_INVALID,
+                              prev ? prev->arch_mmu_flags() : ARCH_MMU_FLAG_INVALID,
                               gap_end,
-                              next.IsValid() ? next->arch_mmu_flags() : ARCH_MMU_FLAG_INVALID,
+                              next ? next->arch_mmu_flags() : ARCH_MMU_FLAG_INVALID,
                               align, region_size, arch_mmu_flags);
     if (*pva < gap_beg)
         goto not_found; // address wrapped around
@@ -330,10 +329,10 @@ not_found:
     return true; // not_found: stop search
 }
 
-// search for a spot to allocate for a region of a given size, returning an
-// iterator to the region after it in the list.
+// search for a spot to allocate for a region of a given size, returning the
+// region that will follow it, if any.
 vaddr_t VmAspace::AllocSpot(size_t size, uint8_t align_pow2, uint arch_mmu_flags,
-                            RegionList::iterator* after) {
+                            VmRegion** next) {
     DEBUG_ASSERT(magic_ == MAGIC);
     DEBUG_ASSERT(size > 0 && IS_PAGE_ALIGNED(size));
 
@@ -346,17 +345,23 @@ vaddr_t VmAspace::AllocSpot(size_t size, uint8_t align_pow2, uint arch_mmu_flags
     vaddr_t spot;
 
     // Find the first gap in the address space which can contain a region of the requested size.
-    auto before_iter = regions_.end();
-    auto after_iter  = regions_.begin();
-    do {
-        if (CheckGap(before_iter, after_iter, &spot, align, size, arch_mmu_flags)) {
-            if (after)
-                *after = after_iter;
+    // The tree skips straight to gaps that are at least big enough, but alignment and the arch
+    // may still rule one out, in which case move on to the next.
+    vaddr_t va = base_;
+    for (;;) {
+        VmRegion* after = region_tree_.FindGap(va, size);
+        VmRegion* before = after ? region_tree_.Prev(after) : region_tree_.Last();
+        if (CheckGap(before, after, &spot, align, size, arch_mmu_flags)) {
+            if (next)
+                *next = after;
             return spot;
         }
 
-        before_iter = after_iter++;
-    } while (before_iter.IsValid());
+        // the gap at the top of the address space was the last chance
+        if (!after)
+            break;
+        va = after->base() + 1;
+    }
 
     // couldn't find anything
     return -1;
@@ -386,9 +391,9 @@ utils::RefPtr<VmRegion> VmAspace::AllocRegion(const char* name, size_t size, vad
         }
     } else {
         // allocate a virtual slot for it
-        RegionList::iterator after;
-        vaddr = AllocSpot(size, align_pow2, arch_mmu_flags, &after);
-        LTRACEF_LEVEL(2, "alloc_spot returns 0x%lx, before %p\n", vaddr, after);
+        VmRegion* next;
+        vaddr = AllocSpot(size, align_pow2, arch_mmu_flags, &next);
+        LTRACEF_LEVEL(2, "alloc_spot returns 0x%lx, before %p\n", vaddr, next);
 
         if (vaddr == (vaddr_t)-1) {
             LTRACEF_LEVEL(2, "failed to find spot\n");
@@ -398,7 +403,7 @@ utils::RefPtr<VmRegion> VmAspace::AllocRegion(const char* name, size_t size, vad
         r->set_base(vaddr);
 
         // add it to the region list
-        regions_.insert(after, r);
+        InsertRegionLocked(r, next);
     }
 
     return r;
@@ -409,13 +414,10 @@ utils::RefPtr<VmRegion> VmAspace::FindRegionLocked(vaddr_t vaddr) {
     DEBUG_ASSERT(magic_ == MAGIC);
     DEBUG_ASSERT(is_mutex_held(&lock_));
 
-    // search the region list
-    for (auto iter = regions_.begin(); iter != regions_.end(); ++iter) {
-        if ((vaddr >= iter->base()) && (vaddr <= iter->base() + iter->size() - 1))
-            return iter.CopyPointer();
-    }
-
-    return nullptr;
+    VmRegion* r = region_tree_.Find(vaddr);
+    if (!r)
+        return nullptr;
+    return utils::RefPtr<VmRegion>(r);
 }
 
 // return a ref pointer to a region
@@ -424,64 +426,188 @@ utils::RefPtr<VmRegion> VmAspace::FindRegion(vaddr_t vaddr) {
     return FindRegionLocked(vaddr);
 }
 
-status_t VmAspace::MapObject(utils::RefPtr<VmObject> vmo, const char* name, uint64_t offset,
-                             size_t size, void** ptr, uint8_t align_pow2, uint vmm_flags,
-                             uint arch_mmu_flags) {
+status_t VmAspace::LookupObject(vaddr_t vaddr, utils::RefPtr<VmObject>* object,
+                                uint64_t* offset) {
+    AutoLock a(lock_);
 
-    DEBUG_ASSERT(magic_ == MAGIC);
-    LTRACEF(
-        "aspace %p name '%s' vmo %p, offset 0x%llx size 0x%zx ptr %p align %hhu vmm_flags 0x%x "
-        "arch_mmu_flags 0x%x\n",
-        this, name, vmo.get(), offset, size, ptr ? *ptr : 0, align_pow2, vmm_flags, arch_mmu_flags);
+    VmRegion* r = region_tree_.Find(vaddr);
+    if (!r || !r->object())
+        return ERR_NOT_FOUND;
 
-    size = ROUNDUP(size, PAGE_SIZE);
-    if (size == 0)
+    *object = r->object();
+    *offset = r->object_offset() + (vaddr - r->base());
+    return NO_ERROR;
+}
+
+status_t VmAspace::LookupWritableObject(vaddr_t vaddr, size_t len,
+                                        utils::RefPtr<VmObject>* object, uint64_t* offset) {
+    AutoLock a(lock_);
+
+    VmRegion* r = region_tree_.Find(vaddr);
+    if (!r || !r->object())
+        return ERR_NOT_FOUND;
+
+    uint flags = r->arch_mmu_flags();
+    if (!(flags & ARCH_MMU_FLAG_PERM_USER) || (flags & ARCH_MMU_FLAG_PERM_RO) ||
+        (flags & ARCH_MMU_FLAG_CACHE_MASK) != ARCH_MMU_FLAG_CACHED)
+        return ERR_ACCESS_DENIED;
+    if (len > r->size() - (vaddr - r->base()))
+        return ERR_OUT_OF_RANGE;
+
+    *object = r->object();
+    *offset = r->object_offset() + (vaddr - r->base());
+    return NO_ERROR;
+}
+
+// validate and round MapObject's arguments, outside the lock
+status_t VmAspace::CheckMapObjectArgs(MapObjectArgs* args) {
+    args->size = ROUNDUP(args->size, PAGE_SIZE);
+    if (args->size == 0)
         return ERR_INVALID_ARGS;
-    if (!vmo)
+    if (!args->vmo)
         return ERR_INVALID_ARGS;
-    if (!IS_PAGE_ALIGNED(offset))
+    if (!IS_PAGE_ALIGNED(args->offset))
         return ERR_INVALID_ARGS;
 
-    vaddr_t vaddr = 0;
-    // if they're asking for a specific spot, copy the address
-    if (vmm_flags & VMM_FLAG_VALLOC_SPECIFIC) {
-        // can't ask for a specific spot and then not provide one
-        if (!ptr) {
-            return ERR_INVALID_ARGS;
-        }
-        vaddr = (vaddr_t)*ptr;
-
-        // check that it's page aligned
-        if (!IS_PAGE_ALIGNED(vaddr))
+    // if they're asking for a specific spot, check the address
+    if (args->vmm_flags & VMM_FLAG_VALLOC_SPECIFIC) {
+        if (!IS_PAGE_ALIGNED((vaddr_t)args->ptr))
             return ERR_INVALID_ARGS;
+    } else {
+        args->ptr = nullptr;
     }
 
-    // hold the vmm lock for the rest of the function
-    AutoLock a(lock_);
+    // line large page objects up so that their chunks can be mapped with large pages
+    if (args->vmo->large_pages() && IS_ALIGNED(args->offset, VmObject::LARGE_PAGE_SIZE) &&
+        args->size >= VmObject::LARGE_PAGE_SIZE)
+        args->align_pow2 = MAX(args->align_pow2, VmObject::LARGE_PAGE_SIZE_SHIFT);
+
+    return NO_ERROR;
+}
+
+// map one checked set of arguments, with the lock held; *region is the region added, if
+// there is one, even if committing its pages then fails
+status_t VmAspace::MapObjectLocked(MapObjectArgs* args, VmRegion** region) {
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    *region = nullptr;
 
     // allocate a region and put it in the aspace list
-    auto r = AllocRegion(name, size, vaddr, align_pow2, vmm_flags, arch_mmu_flags);
+    auto r = AllocRegion(args->name, args->size, (vaddr_t)args->ptr, args->align_pow2,
+                         args->vmm_flags, args->arch_mmu_flags);
     if (!r) {
         return ERR_NO_MEMORY;
     }
+    *region = r.get();
 
     // associate the vm object with it
-    r->SetObject(utils::move(vmo), offset);
+    r->SetObject(args->vmo, args->offset);
+    r->set_sequential((args->vmm_flags & VMM_FLAG_SEQUENTIAL) != 0);
 
     // if we're committing it, map the region now
-    if (vmm_flags & VMM_FLAG_COMMIT) {
-        auto err = r->MapRange(0, size, true);
+    if (args->vmm_flags & VMM_FLAG_COMMIT) {
+        auto err = r->MapRange(0, args->size, true);
         if (err < 0)
             return err;
     }
 
+    args->ptr = (void*)r->base();
+    return NO_ERROR;
+}
+
+status_t VmAspace::MapObject(utils::RefPtr<VmObject> vmo, const char* name, uint64_t offset,
+                             size_t size, void** ptr, uint8_t align_pow2, uint vmm_flags,
+                             uint arch_mmu_flags) {
+
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF(
+        "aspace %p name '%s' vmo %p, offset 0x%llx size 0x%zx ptr %p align %hhu vmm_flags 0x%x "
+        "arch_mmu_flags 0x%x\n",
+        this, name, vmo.get(), offset, size, ptr ? *ptr : 0, align_pow2, vmm_flags, arch_mmu_flags);
+
+    // can't ask for a specific spot and then not provide one
+    if ((vmm_flags & VMM_FLAG_VALLOC_SPECIFIC) && !ptr)
+        return ERR_INVALID_ARGS;
+
+    MapObjectArgs args;
+    args.vmo = utils::move(vmo);
+    args.name = name;
+    args.offset = offset;
+    args.size = size;
+    args.ptr = ptr ? *ptr : nullptr;
+    args.align_pow2 = align_pow2;
+    args.vmm_flags = vmm_flags;
+    args.arch_mmu_flags = arch_mmu_flags;
+
+    status_t status = CheckMapObjectArgs(&args);
+    if (status != NO_ERROR)
+        return status;
+
+    // hold the vmm lock for the rest of the function
+    AutoLock a(lock_);
+
+    VmRegion* r;
+    status = MapObjectLocked(&args, &r);
+    if (status != NO_ERROR)
+        return status;
+
     // return the vaddr if requested
     if (ptr)
-        *ptr = (void*)r->base();
+        *ptr = args.ptr;
 
     return NO_ERROR;
 }
 
+status_t VmAspace::MapObjects(MapObjectArgs* args, size_t count) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("aspace %p count %zu\n", this, count);
+
+    for (size_t i = 0; i < count; i++) {
+        status_t status = CheckMapObjectArgs(&args[i]);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    RegionList undo;
+    status_t status = NO_ERROR;
+    {
+        AutoLock a(lock_);
+
+        size_t i;
+        for (i = 0; i < count; i++) {
+            VmRegion* r;
+            status = MapObjectLocked(&args[i], &r);
+            if (status != NO_ERROR) {
+                // take out the region that failed to commit along with those already mapped
+                if (r) {
+                    auto ref = utils::RefPtr<VmRegion>(r);
+                    RemoveRegionLocked(r);
+                    r->Unmap();
+                    undo.push_back(utils::move(ref));
+                }
+                break;
+            }
+        }
+        if (status != NO_ERROR) {
+            while (i-- > 0) {
+                auto r = FindRegionLocked((vaddr_t)args[i].ptr);
+                DEBUG_ASSERT(r);
+                RemoveRegionLocked(r.get());
+                r->Unmap();
+                undo.push_back(utils::move(r));
+            }
+        }
+    }
+
+    // destroy whatever was undone, outside the lock as FreeRegion does
+    while (!undo.is_empty()) {
+        auto r = undo.pop_front();
+        r->Destroy();
+    }
+
+    return status;
+}
+
 status_t VmAspace::ReserveSpace(const char* name, size_t size, vaddr_t vaddr) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("aspace %p name '%s' size 0x%zx vaddr 0x%lx\n", this, name, size, vaddr);
@@ -647,7 +773,7 @@ status_t VmAspace::FreeRegion(vaddr_t vaddr) {
             return ERR_NOT_FOUND;
 
         // remove it from the address space list
-        regions_.erase(*r);
+        RemoveRegionLocked(r.get());
 
         // unmap it
         r->Unmap();
@@ -678,16 +804,41 @@ status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("va 0x%lx, flags 0x%x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(lock_);
+    for (;;) {
+        utils::RefPtr<VmObject> object;
+        uint64_t vmo_offset;
+        {
+            // hold the aspace lock across the page fault operation, which stops any other
+            // operations on the address space from moving the region out from underneath it
+            AutoLock a(lock_);
 
-    auto r = FindRegionLocked(va);
-    if (unlikely(!r))
-        return ERR_NOT_FOUND;
+            auto r = FindRegionLocked(va);
+            if (unlikely(!r))
+                return ERR_NOT_FOUND;
+
+            status_t status = r->PageFault(va, flags);
+            if (status != ERR_NOT_READY)
+                return status;
 
-    return r->PageFault(va, flags);
+            object = r->object();
+            vmo_offset = ROUNDDOWN(va, PAGE_SIZE) - r->base() + r->object_offset();
+        }
+
+        // but not while a page source gets the page to us, which can take a round trip through
+        // a user process, maybe even this one. the region may be gone by the time it's here, so
+        // look it up again.
+        status_t status = object->WaitForPage(vmo_offset);
+        if (status != NO_ERROR)
+            return status;
+    }
+}
+
+void VmAspace::GetMemoryUsage(size_t* mapped_bytes, size_t* committed_bytes) const {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    AutoLock a(lock_);
+    *mapped_bytes = mapped_bytes_;
+    *committed_bytes = committed_pages_ * PAGE_SIZE;
 }
 
 void VmAspace::Dump() const {
@@ -695,8 +846,11 @@ void VmAspace::Dump() const {
     printf("aspace %p: ref %u name '%s' range 0x%lx - 0x%lx size 0x%zx flags 0x%x\n", this,
            ref_count_debug(), name_, base_, base_ + size_ - 1, size_, flags_);
 
-    printf("regions:\n");
     AutoLock a(lock_);
+    printf("mapped 0x%zx bytes, committed 0x%zx bytes\n", mapped_bytes_,
+           committed_pages_ * PAGE_SIZE);
+
+    printf("regions:\n");
     for (const auto& r : regions_) {
         r.Dump();
     }
@@ -11,11 +11,13 @@
 #include <err.h>
 #include <kernel/auto_lock.h>
 #include <kernel/vm.h>
+#include <kernel/vm/vm_page_store.h>
 #include <lib/user_copy.h>
 #include <new.h>
 #include <stdlib.h>
 #include <string.h>
 #include <trace.h>
+#include <utils/unique_ptr.h>
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
@@ -23,7 +25,7 @@ static void ZeroPage(paddr_t pa) {
     void* ptr = paddr_to_kvaddr(pa);
     DEBUG_ASSERT(ptr);
 
-    memset(ptr, 0, PAGE_SIZE);
+    arch_zero_page(ptr);
 }
 
 static void ZeroPage(vm_page_t* p) {
@@ -39,8 +41,26 @@ static size_t OffsetToIndex(uint64_t offset) {
     return static_cast<size_t>(index64);
 }
 
-VmObject::VmObject(uint32_t pmm_alloc_flags)
-    : pmm_alloc_flags_(pmm_alloc_flags) {
+const uint32_t VmObject::CREATE_LARGE_PAGES;
+const uint64_t VmObject::LARGE_PAGE_SIZE;
+const uint8_t VmObject::LARGE_PAGE_SIZE_SHIFT;
+
+static const size_t kLargePageCount = VmObject::LARGE_PAGE_SIZE / PAGE_SIZE;
+
+// how many pages ReadWriteInternal looks up and pins per acquisition of the lock
+static const size_t kReadWriteBatchPages = 16;
+
+const lk_time_t VmObject::PAGE_REQUEST_RETRY;
+
+// a fault's request for a page of a paged object, on the object's list while it waits
+struct VmObject::PageRequest {
+    list_node node = LIST_INITIAL_CLEARED_VALUE;
+    size_t index = 0;
+    bool failed = false;
+};
+
+VmObject::VmObject(uint32_t pmm_alloc_flags, uint32_t options)
+    : pmm_alloc_flags_(pmm_alloc_flags), options_(options) {
     LTRACEF("%p\n", this);
 }
 
@@ -48,42 +68,74 @@ VmObject::~VmObject() {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("%p\n", this);
 
+    // regions hold references to us while they map us
+    DEBUG_ASSERT(mapping_list_.is_empty());
+    DEBUG_ASSERT(slice_count_ == 0);
+    DEBUG_ASSERT(list_is_empty(&page_requests_));
+    DEBUG_ASSERT(clone_list_.is_empty());
+
+    // the page store can't find us once we're off its list
+    VmPageStore::RemoveObject(this);
+
+    // nor can our parent, once we're off its list of clones, so it stops handing us pages
+    if (clone_list_node_state_.InContainer()) {
+        AutoLock a(parent_->clone_lock_);
+        parent_->clone_list_.erase(*this);
+    }
+
+    if (is_slice_) {
+        AutoLock a(parent_->lock_);
+        DEBUG_ASSERT(parent_->slice_count_ > 0);
+        parent_->slice_count_--;
+    }
+
     list_node list;
     list_initialize(&list);
 
     // free all of the pages attached to us
     size_t count = 0;
-    for (size_t i = 0; i < page_array_.size(); i++) {
-        auto p = page_array_[i];
-        if (p) {
-            LTRACEF("freeing page %p (0x%lx)\n", p, vm_page_to_paddr(p));
-
-            // remove it from the object list of pages
-            DEBUG_ASSERT(list_in_list(&p->node));
-            list_delete(&p->node);
-
-            // add to the temporary free list
-            list_add_tail(&list, &p->node);
-            count++;
-        }
-    }
+    page_list_.RemoveAllPages([&list, &count](size_t index, vm_page_t* p) {
+        LTRACEF("freeing page %p (0x%lx)\n", p, vm_page_to_paddr(p));
 
-    DEBUG_ASSERT(list_length(&page_list_) == 0);
+        // add to the temporary free list
+        DEBUG_ASSERT(p->pin_count == 0);
+        DEBUG_ASSERT(!list_in_list(&p->node));
+        list_add_tail(&list, &p->node);
+        count++;
+    });
 
     __UNUSED auto freed = pmm_free(&list);
     DEBUG_ASSERT(freed == count);
 
+    // and what the page store holds for us
+    compressed_list_.RemoveAllPages(
+        [](size_t index, VmCompressedPage* c) { VmPageStore::Free(c); });
+
     // clear our magic value
     magic_ = 0;
 }
 
-utils::RefPtr<VmObject> VmObject::Create(uint32_t pmm_alloc_flags, uint64_t size) {
+utils::RefPtr<VmObject> VmObject::Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                         uint32_t options) {
+    auto vmo = CreateUntracked(pmm_alloc_flags, size, options);
+
+    // objects backed by large pages are never scanned either
+    if (vmo && !vmo->large_pages())
+        VmPageStore::AddObject(vmo.get());
+
+    return vmo;
+}
+
+utils::RefPtr<VmObject> VmObject::CreateUntracked(uint32_t pmm_alloc_flags, uint64_t size,
+                                                  uint32_t options) {
     // there's a max size to keep indexes within range
     if (size > MAX_SIZE)
         return nullptr;
+    if (options & ~CREATE_LARGE_PAGES)
+        return nullptr;
 
     AllocChecker ac;
-    auto vmo = utils::AdoptRef(new (&ac) VmObject(pmm_alloc_flags));
+    auto vmo = utils::AdoptRef(new (&ac) VmObject(pmm_alloc_flags, options));
     if (!ac.check())
         return nullptr;
 
@@ -98,19 +150,360 @@ utils::RefPtr<VmObject> VmObject::Create(uint32_t pmm_alloc_flags, uint64_t size
     return vmo;
 }
 
-void VmObject::Dump() {
+utils::RefPtr<VmObject> VmObject::CreatePaged(uint32_t pmm_alloc_flags, uint64_t size,
+                                              utils::RefPtr<VmPageSource> source) {
+    DEBUG_ASSERT(source);
+
+    auto vmo = CreateUntracked(pmm_alloc_flags, size, 0);
+    if (!vmo)
+        return nullptr;
+
+    vmo->page_source_ = utils::move(source);
+
+    return vmo;
+}
+
+status_t VmObject::CreateCowClone(uint64_t offset, uint64_t size,
+                                  utils::RefPtr<VmObject>* clone) {
     DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("vmo %p, offset 0x%llx, size 0x%llx\n", this, offset, size);
+
+    if (!IS_PAGE_ALIGNED(offset))
+        return ERR_INVALID_ARGS;
+
+    // a clone of a slice is a clone of the object holding the pages, which has a slice
+    if (is_slice_)
+        return ERR_BAD_STATE;
+
+    auto c = CreateUntracked(pmm_alloc_flags_, size, 0);
+    if (!c)
+        return ERR_NO_MEMORY;
+
+    c->parent_ = utils::RefPtr<VmObject>(this);
+    c->parent_offset_ = offset;
+
+    // regions to take our pages away from, so they fault back in read only
+    utils::RefPtr<VmRegion>* regions = nullptr;
+    size_t region_count = 0;
+    {
+        AutoLock cl(clone_lock_);
+        AutoLock a(lock_);
+
+        if (slice_count_ > 0)
+            return ERR_BAD_STATE;
+
+        region_count = mapping_list_.size_slow();
+        if (region_count > 0) {
+            AllocChecker ac;
+            regions = new (&ac) utils::RefPtr<VmRegion>[region_count];
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+
+            size_t i = 0;
+            for (auto& r : mapping_list_)
+                regions[i++] = utils::RefPtr<VmRegion>(&r);
+        }
+
+        // from here on, changing a page of the range hands the clone a copy first
+        clone_list_.push_back(c.get());
+    }
+
+    // pages already mapped writable could be written without a fault telling us to
+    for (size_t i = 0; i < region_count; i++)
+        regions[i]->UnmapObjectRange(offset, size);
+    delete[] regions;
+
+    *clone = utils::move(c);
+    return NO_ERROR;
+}
+
+bool VmObject::has_clones() {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (is_slice_)
+        return parent_->has_clones();
+
+    AutoLock cl(clone_lock_);
+    return !clone_list_.is_empty();
+}
+
+bool VmObject::SharesParentPageLocked(uint64_t parent_offset) {
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    if (parent_offset < parent_offset_ || parent_offset - parent_offset_ >= size_)
+        return false;
+
+    size_t index = OffsetToIndex(parent_offset - parent_offset_);
+    return !page_list_.Lookup(index) && !compressed_list_.Lookup(index);
+}
+
+status_t VmObject::CopyPagesToClones(uint64_t offset, uint64_t len, uint pf_flags) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(!is_slice_);
+    DEBUG_ASSERT(!is_mutex_held(&lock_));
+
+    AutoLock cl(clone_lock_);
+
+    if (clone_list_.is_empty() || offset >= size_)
+        return NO_ERROR;
+
+    uint64_t end = ROUNDUP_PAGE_SIZE((len > size_ - offset) ? size_ : offset + len);
+    for (uint64_t o = ROUNDDOWN(offset, PAGE_SIZE); o < end; o += PAGE_SIZE) {
+        // skip the pages every clone has taken its own copy of already
+        bool shared = false;
+        for (auto& c : clone_list_) {
+            AutoLock a(c.lock_);
+            if (c.SharesParentPageLocked(o)) {
+                shared = true;
+                break;
+            }
+        }
+        if (!shared)
+            continue;
+
+        // the page the clones see through to, which may be one our own parent holds
+        vm_page_t* p = nullptr;
+        {
+            AutoLock a(lock_);
+
+            if (pf_flags & VMM_PF_FLAG_WRITE) {
+                status_t status = FaultPageLocked(o, pf_flags & VMM_PF_FLAG_NO_WAIT, &p);
+                if (status != NO_ERROR)
+                    return status;
+            } else {
+                size_t index = OffsetToIndex(o);
+                p = page_list_.Lookup(index);
+                if (!p && compressed_list_.Lookup(index)) {
+                    p = DecompressPageLocked(index);
+                    if (!p)
+                        return ERR_NO_MEMORY;
+                }
+                if (!p)
+                    continue;
+            }
+            PinPageLocked(p);
+        }
+
+        status_t status = NO_ERROR;
+        for (auto& c : clone_list_) {
+            AutoLock a(c.lock_);
+            if (!c.SharesParentPageLocked(o))
+                continue;
+
+            paddr_t pa;
+            vm_page_t* copy = pmm_alloc_page(c.pmm_alloc_flags_ | PMM_ALLOC_FLAG_KMAP, &pa);
+            if (!copy) {
+                status = ERR_NO_MEMORY;
+                break;
+            }
+            memcpy(paddr_to_kvaddr(pa), paddr_to_kvaddr(vm_page_to_paddr(p)), PAGE_SIZE);
+
+            status = c.AddPageLocked(OffsetToIndex(o - c.parent_offset_), copy);
+            if (status != NO_ERROR) {
+                pmm_free_page(copy);
+                break;
+            }
+        }
+        UnpinPage(p);
+
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    return NO_ERROR;
+}
+
+utils::RefPtr<VmObject> VmObject::CreateSlice(uint64_t offset, uint64_t size) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("vmo %p, offset 0x%llx, size 0x%llx\n", this, offset, size);
+
+    if (!IS_PAGE_ALIGNED(offset))
+        return nullptr;
+    if (offset + size < offset || offset + size > size_)
+        return nullptr;
+
+    // a slice of a slice is a slice of the object that holds the pages
+    if (is_slice_)
+        return parent_->CreateSlice(parent_offset_ + offset, size);
+
+    auto slice = CreateUntracked(pmm_alloc_flags_, size, 0);
+    if (!slice)
+        return nullptr;
 
-    size_t count = 0;
     {
         AutoLock a(lock_);
-        for (size_t i = 0; i < page_array_.size(); i++) {
-            if (page_array_[i])
-                count++;
+        slice_count_++;
+    }
+    slice->parent_ = utils::RefPtr<VmObject>(this);
+    slice->parent_offset_ = offset;
+    slice->is_slice_ = true;
+
+    return slice;
+}
+
+status_t VmObject::PinParentPage(uint64_t offset, uint pf_flags, VmObject** owner,
+                                 vm_page_t** page) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    *page = nullptr;
+
+    // walk up the chain of clones, taking each object's lock in turn
+    VmObject* o = parent_.get();
+    offset += parent_offset_;
+    while (o) {
+        AutoLock a(o->lock_);
+
+        if (offset >= o->size_)
+            return NO_ERROR;
+
+        size_t index = OffsetToIndex(offset);
+        vm_page_t* p = o->page_list_.Lookup(index);
+        // a paged object has the page fetched for us rather than showing through as zeroes, and
+        // one the page store took it from gets it back
+        if (!p && o->page_source_) {
+            status_t status = o->FaultPageLocked(offset, pf_flags & VMM_PF_FLAG_NO_WAIT, &p);
+            if (status != NO_ERROR)
+                return status;
+        } else if (!p && o->compressed_list_.Lookup(index)) {
+            p = o->DecompressPageLocked(index);
+        }
+        if (p) {
+            o->PinPageLocked(p);
+            *owner = o;
+            *page = p;
+            return NO_ERROR;
         }
+
+        offset += o->parent_offset_;
+        o = o->parent_.get();
+    }
+
+    return NO_ERROR;
+}
+
+void VmObject::PinPageLocked(vm_page_t* p) {
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+    DEBUG_ASSERT(p->pin_count < 0xffff);
+
+    p->pin_count++;
+}
+
+void VmObject::UnpinPage(vm_page_t* p) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    bool free_page;
+    {
+        AutoLock a(lock_);
+
+        DEBUG_ASSERT(p->pin_count > 0);
+        free_page = (--p->pin_count == 0) && (p->flags & VM_PAGE_FLAG_FREE_ON_UNPIN);
+        if (free_page)
+            p->flags &= ~VM_PAGE_FLAG_FREE_ON_UNPIN;
+    }
+
+    // decommitted while we had it pinned, so it's ours to free
+    if (free_page)
+        pmm_free_page(p);
+}
+
+status_t VmObject::PinPages(uint64_t offset, size_t count, vm_page_t** pages) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+
+    // a slice's pages are its parent's
+    if (is_slice_) {
+        if (offset >= size_ || count > (ROUNDUP_PAGE_SIZE(size_) - offset) / PAGE_SIZE)
+            return ERR_OUT_OF_RANGE;
+        return parent_->PinPages(parent_offset_ + offset, count, pages);
+    }
+
+    // a device may write to the pages
+    status_t status = CopyPagesToClones(offset, count * PAGE_SIZE, VMM_PF_FLAG_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    size_t pinned = 0;
+    {
+        AutoLock a(lock_);
+
+        for (; pinned < count; pinned++) {
+            // faulting in for write gives a clone its own copy of the page. the lock may be
+            // dropped in here, which is fine for the pages already pinned.
+            vm_page_t* p;
+            status = FaultPageLocked(offset + pinned * PAGE_SIZE, VMM_PF_FLAG_WRITE, &p);
+            if (status != NO_ERROR)
+                break;
+            PinPageLocked(p);
+            pages[pinned] = p;
+        }
+    }
+
+    if (status != NO_ERROR)
+        UnpinPages(pages, pinned);
+    return status;
+}
+
+void VmObject::UnpinPages(vm_page_t* const* pages, size_t count) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (is_slice_) {
+        parent_->UnpinPages(pages, count);
+        return;
+    }
+
+    list_node free_list;
+    list_initialize(&free_list);
+    {
+        AutoLock a(lock_);
+
+        for (size_t n = 0; n < count; n++) {
+            vm_page_t* p = pages[n];
+            DEBUG_ASSERT(p->pin_count > 0);
+            if (--p->pin_count == 0 && (p->flags & VM_PAGE_FLAG_FREE_ON_UNPIN)) {
+                p->flags &= ~VM_PAGE_FLAG_FREE_ON_UNPIN;
+                list_add_tail(&free_list, &p->node);
+            }
+        }
+    }
+
+    // the ones decommitted while pinned are ours to free
+    pmm_free(&free_list);
+}
+
+void VmObject::AddMapping(VmRegion* r) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    AutoLock a(lock_);
+
+    mapping_list_.push_front(r);
+}
+
+void VmObject::RemoveMapping(VmRegion* r) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    AutoLock a(lock_);
+
+    mapping_list_.erase(*r);
+}
+
+void VmObject::Dump() {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    size_t count;
+    size_t compressed;
+    {
+        AutoLock a(lock_);
+        count = page_list_.count();
+        compressed = compressed_list_.count();
     }
     printf("\t\tobject %p: ref %u size 0x%llx, %zu allocated pages\n", this, ref_count_debug(),
            size_, count);
+    if (compressed > 0)
+        printf("\t\t\t%zu pages compressed (%zu bytes)\n", compressed, compressed_bytes_);
+    if (page_source_)
+        printf("\t\t\tpaged by source %p\n", page_source_.get());
+    if (is_slice_)
+        printf("\t\t\tslice of object %p at offset 0x%llx\n", parent_.get(), parent_offset_);
+    else if (parent_)
+        printf("\t\t\tclone of object %p at offset 0x%llx\n", parent_.get(), parent_offset_);
 }
 
 status_t VmObject::Resize(uint64_t s) {
@@ -127,35 +520,88 @@ status_t VmObject::Resize(uint64_t s) {
         return ERR_NOT_SUPPORTED; // TODO: support resizing an existing object
     }
 
-    // compute the number of pages we cover
-    size_t page_count = OffsetToIndex(ROUNDUP_PAGE_SIZE(s));
-
-    // save bytewise size
+    // save bytewise size, the page list grows as pages are added
     size_ = s;
 
-    // allocate a new array
-    DEBUG_ASSERT(!page_array_); // no resizing
-    AllocChecker ac;
-    vm_page_t** pa = new (&ac) vm_page_t* [page_count] {};
-    if (!ac.check())
-        return ERR_NO_MEMORY;
+    return NO_ERROR;
+}
 
-    page_array_.reset(pa, page_count);
+size_t VmObject::CommittedPageCount() {
+    DEBUG_ASSERT(magic_ == MAGIC);
 
-    return NO_ERROR;
+    AutoLock a(lock_);
+    return page_list_.count();
 }
 
-void VmObject::AddPageToArray(size_t index, vm_page_t* p) {
+bool VmObject::compressible() {
     DEBUG_ASSERT(magic_ == MAGIC);
-    DEBUG_ASSERT(is_mutex_held(&lock_));
 
-    DEBUG_ASSERT(page_array_);
-    DEBUG_ASSERT(!page_array_[index]);
-    DEBUG_ASSERT(index < page_array_.size());
-    page_array_[index] = p;
+    // a slice's pages are its parent's
+    if (is_slice_)
+        return parent_->compressible();
+
+    AutoLock a(lock_);
+    return compressible_;
+}
+
+status_t VmObject::SetCompressible(bool compressible) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (is_slice_)
+        return parent_->SetCompressible(compressible);
+
+    AutoLock a(lock_);
+
+    if (compressible && pages_in_place_)
+        return ERR_BAD_STATE;
+
+    compressible_ = compressible;
+    if (compressible)
+        return NO_ERROR;
+
+    return DecompressRangeLocked(0, SIZE_MAX);
+}
+
+void VmObject::KeepPagesInPlace() {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (is_slice_) {
+        parent_->KeepPagesInPlace();
+        return;
+    }
 
+    // pages already compressed can stay that way, since they have no address to hand out until
+    // they're faulted back in
+    AutoLock a(lock_);
+    pages_in_place_ = true;
+    compressible_ = false;
+}
+
+void VmObject::GetCompressedCount(size_t* pages, size_t* bytes) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    AutoLock a(lock_);
+    *pages = compressed_list_.count();
+    *bytes = compressed_bytes_;
+}
+
+size_t VmObject::PageCount() const {
+    return OffsetToIndex(ROUNDUP_PAGE_SIZE(size_));
+}
+
+status_t VmObject::AddPageLocked(size_t index, vm_page_t* p) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    DEBUG_ASSERT(index < PageCount());
     DEBUG_ASSERT(!list_in_list(&p->node));
-    list_add_tail(&page_list_, &p->node);
+
+    // pages come from the pmm with whatever flags their last owner left on them
+    p->flags &= ~VM_PAGE_FLAG_IDLE;
+
+    auto err = page_list_.Insert(index, p);
+    DEBUG_ASSERT(err != ERR_ALREADY_EXISTS);
+    return err;
 }
 
 status_t VmObject::AddPage(vm_page_t* p, uint64_t offset) {
@@ -171,13 +617,15 @@ status_t VmObject::AddPage(vm_page_t* p, uint64_t offset) {
 
     size_t index = OffsetToIndex(offset);
 
-    AddPageToArray(index, p);
-
-    return NO_ERROR;
+    return AddPageLocked(index, p);
 }
 
 vm_page_t* VmObject::GetPage(uint64_t offset) {
     DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (is_slice_)
+        return (offset < size_) ? parent_->GetPage(parent_offset_ + offset) : nullptr;
+
     AutoLock a(lock_);
 
     if (offset >= size_)
@@ -185,51 +633,324 @@ vm_page_t* VmObject::GetPage(uint64_t offset) {
 
     size_t index = OffsetToIndex(offset);
 
-    return page_array_[index];
+    // whoever asks is about to map or use the page, so it's no longer idle
+    vm_page_t* p = page_list_.Lookup(index);
+    if (p)
+        p->flags &= ~VM_PAGE_FLAG_IDLE;
+
+    return p;
 }
 
-vm_page_t* VmObject::FaultPageLocked(uint64_t offset, uint pf_flags) {
+status_t VmObject::AllocFaultPage(uint64_t offset, uint pf_flags, vm_page_t** page) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(!is_mutex_held(&lock_));
+
+    paddr_t pa;
+
+    // take a private copy of whatever page our parent has here
+    if (parent_) {
+        VmObject* owner;
+        vm_page_t* parent_page;
+        status_t status = PinParentPage(offset, pf_flags, &owner, &parent_page);
+        if (status != NO_ERROR)
+            return status;
+        if (parent_page) {
+            vm_page_t* p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_KMAP, &pa);
+            if (p)
+                memcpy(paddr_to_kvaddr(pa), paddr_to_kvaddr(vm_page_to_paddr(parent_page)),
+                       PAGE_SIZE);
+            owner->UnpinPage(parent_page);
+
+            LTRACEF("copied parent page to %p, pa 0x%lx\n", p, p ? pa : 0);
+            *page = p;
+            return p ? NO_ERROR : ERR_NO_MEMORY;
+        }
+    }
+
+    *page = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &pa);
+    return *page ? NO_ERROR : ERR_NO_MEMORY;
+}
+
+status_t VmObject::FaultPageLocked(uint64_t offset, uint pf_flags, vm_page_t** page) {
     DEBUG_ASSERT(magic_ == MAGIC);
     DEBUG_ASSERT(is_mutex_held(&lock_));
 
     LTRACEF("vmo %p, offset 0x%llx, pf_flags 0x%x\n", this, offset, pf_flags);
 
     if (offset >= size_)
-        return nullptr;
+        return ERR_OUT_OF_RANGE;
 
     size_t index = OffsetToIndex(offset);
 
-    vm_page_t* p = page_array_[index];
-    if (p)
-        return p;
+    vm_page_t* p = page_list_.Lookup(index);
+    if (p) {
+        p->flags &= ~VM_PAGE_FLAG_IDLE;
+        *page = p;
+        return NO_ERROR;
+    }
 
-    // allocate a page
-    paddr_t pa;
-    p = pmm_alloc_page(pmm_alloc_flags_, &pa);
-    if (!p)
-        return nullptr;
+    if (compressed_list_.Lookup(index)) {
+        *page = DecompressPageLocked(index);
+        return *page ? NO_ERROR : ERR_NO_MEMORY;
+    }
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
+    if (page_source_) {
+        // the caller may hold locks the source needs to supply the page, so let it drop them
+        // and WaitForPage() itself
+        if (pf_flags & VMM_PF_FLAG_NO_WAIT)
+            return ERR_NOT_READY;
 
-    AddPageToArray(index, p);
+        status_t status = WaitForPageLocked(index);
+        if (status != NO_ERROR)
+            return status;
+        *page = page_list_.Lookup(index);
+        return NO_ERROR;
+    }
 
-    LTRACEF("faulted in page %p, pa 0x%lx\n", p, pa);
+    // try to grab the whole surrounding chunk at once so it can be mapped with a large page
+    if (large_pages() && CommitLargePageLocked(index)) {
+        *page = page_list_.Lookup(index);
+        return NO_ERROR;
+    }
 
-    return p;
+    // allocate and fill the page with the lock dropped, so faults on the rest of the object
+    // don't wait on the zeroing or copying
+    mutex_release(&lock_);
+    status_t status = AllocFaultPage(offset, pf_flags, &p);
+    mutex_acquire(&lock_);
+
+    if (status != NO_ERROR)
+        return status;
+
+    // someone else may have faulted the page in while we were at it, and the page store may
+    // even have taken it since
+    vm_page_t* existing = page_list_.Lookup(index);
+    if (existing) {
+        pmm_free_page(p);
+        existing->flags &= ~VM_PAGE_FLAG_IDLE;
+        *page = existing;
+        return NO_ERROR;
+    }
+    if (compressed_list_.Lookup(index)) {
+        pmm_free_page(p);
+        *page = DecompressPageLocked(index);
+        return *page ? NO_ERROR : ERR_NO_MEMORY;
+    }
+
+    status = AddPageLocked(index, p);
+    if (status != NO_ERROR) {
+        pmm_free_page(p);
+        return status;
+    }
+
+    LTRACEF("faulted in page %p, pa 0x%lx\n", p, vm_page_to_paddr(p));
+
+    *page = p;
+    return NO_ERROR;
+}
+
+status_t VmObject::WaitForPageLocked(size_t index) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+    DEBUG_ASSERT(page_source_);
+
+    for (;;) {
+        if (page_list_.Lookup(index))
+            return NO_ERROR;
+
+        // wait on the request already out for the page if there is one
+        PageRequest* pending = nullptr;
+        PageRequest* r;
+        list_for_every_entry (&page_requests_, r, PageRequest, node) {
+            if (r->index == index) {
+                pending = r;
+                break;
+            }
+        }
+        if (pending && pending->failed)
+            return ERR_IO;
+
+        // or make one. a source that is too busy to take it now gets it again on the retry.
+        PageRequest request;
+        if (!pending) {
+            status_t status = page_source_->RequestPage((uint64_t)index * PAGE_SIZE);
+            if (status != NO_ERROR && status != ERR_NOT_READY) {
+                LTRACEF("page source failed request for index %zu: %d\n", index, status);
+                return status;
+            }
+            request.index = index;
+            list_add_tail(&page_requests_, &request.node);
+        }
+
+        // a killed thread gives up on a source that may never answer
+        status_t status = cond_wait_timeout_etc(&page_supplied_, &lock_, PAGE_REQUEST_RETRY,
+                                                true);
+
+        if (!pending) {
+            list_delete(&request.node);
+            if (request.failed && !page_list_.Lookup(index))
+                return ERR_IO;
+        }
+        if (status == ERR_INTERRUPTED)
+            return status;
+    }
+}
+
+status_t VmObject::FaultPage(uint64_t offset, uint pf_flags, vm_page_t** page) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (is_slice_) {
+        if (offset >= size_)
+            return ERR_OUT_OF_RANGE;
+        return parent_->FaultPage(parent_offset_ + offset, pf_flags, page);
+    }
+
+    // whoever faults for write is about to write the page
+    if (pf_flags & VMM_PF_FLAG_WRITE) {
+        status_t status = CopyPagesToClones(offset, PAGE_SIZE, pf_flags);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    AutoLock a(lock_);
+
+    return FaultPageLocked(offset, pf_flags, page);
+}
+
+status_t VmObject::WaitForPage(uint64_t offset) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    if (is_slice_) {
+        if (offset >= size_)
+            return ERR_OUT_OF_RANGE;
+        return parent_->WaitForPage(parent_offset_ + offset);
+    }
+
+    // find where the page comes from: us, or for a clone, the paged ancestor it shows through
+    // from. if it turns up anywhere on the way, the fault can just be made again.
+    for (VmObject* o = this; o; o = o->parent_.get()) {
+        AutoLock a(o->lock_);
+
+        if (offset >= o->size_)
+            return NO_ERROR;
+
+        size_t index = OffsetToIndex(offset);
+        if (o->page_list_.Lookup(index) || o->compressed_list_.Lookup(index))
+            return NO_ERROR;
+        if (o->page_source_)
+            return o->WaitForPageLocked(index);
+
+        offset += o->parent_offset_;
+    }
+
+    return NO_ERROR;
+}
+
+bool VmObject::CommitLargePageLocked(size_t index) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+    DEBUG_ASSERT(large_pages());
+
+    // only whole chunks that are completely empty
+    size_t start = ROUNDDOWN(index, kLargePageCount);
+    if (start + kLargePageCount > PageCount())
+        return false;
+    auto present = page_list_.ForEveryPageInRange(
+        start, start + kLargePageCount, [](size_t, vm_page_t*) { return ERR_ALREADY_EXISTS; });
+    if (present != NO_ERROR)
+        return false;
+
+    list_node page_list;
+    list_initialize(&page_list);
+
+    // allocate and clear the run with the lock dropped
+    mutex_release(&lock_);
+    size_t allocated = pmm_alloc_contiguous(kLargePageCount, pmm_alloc_flags_,
+                                            LARGE_PAGE_SIZE_SHIFT, nullptr, &page_list);
+    if (allocated == kLargePageCount) {
+        vm_page_t* p;
+        list_for_every_entry (&page_list, p, vm_page_t, node)
+            ZeroPage(p);
+    }
+    mutex_acquire(&lock_);
+
+    if (allocated < kLargePageCount) {
+        LTRACEF("failed to allocate a large page run, falling back to single pages\n");
+        pmm_free(&page_list);
+        return false;
+    }
+
+    // the chunk has to still be empty once we're back
+    present = page_list_.ForEveryPageInRange(
+        start, start + kLargePageCount, [](size_t, vm_page_t*) { return ERR_ALREADY_EXISTS; });
+    if (present != NO_ERROR) {
+        pmm_free(&page_list);
+        return false;
+    }
+
+    for (size_t i = start; i < start + kLargePageCount; i++) {
+        vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, node);
+        DEBUG_ASSERT(p);
+
+        if (AddPageLocked(i, p) != NO_ERROR) {
+            // keep what we managed to add, the rest of the chunk falls back to single pages
+            list_add_head(&page_list, &p->node);
+            pmm_free(&page_list);
+            return false;
+        }
+    }
+
+    DEBUG_ASSERT(list_is_empty(&page_list));
+
+    return true;
 }
 
-vm_page_t* VmObject::FaultPage(uint64_t offset, uint pf_flags) {
+bool VmObject::GetLargePage(uint64_t offset, paddr_t* pa) {
     DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(pa);
+
+    if (!large_pages() || !IS_ALIGNED(offset, LARGE_PAGE_SIZE))
+        return false;
+
     AutoLock a(lock_);
 
-    return FaultPageLocked(offset, pf_flags);
+    size_t start = OffsetToIndex(offset);
+    if (start + kLargePageCount > PageCount())
+        return false;
+
+    vm_page_t* first = page_list_.Lookup(start);
+    if (!first)
+        return false;
+    paddr_t base = vm_page_to_paddr(first);
+    if (!IS_ALIGNED(base, LARGE_PAGE_SIZE))
+        return false;
+
+    // every page in the chunk has to be present and follow on from the first
+    size_t found = 0;
+    auto err = page_list_.ForEveryPageInRange(
+        start, start + kLargePageCount, [base, start, &found](size_t index, vm_page_t* p) {
+            if (vm_page_to_paddr(p) != base + (index - start) * PAGE_SIZE)
+                return ERR_NOT_FOUND;
+            found++;
+            return NO_ERROR;
+        });
+    if (err != NO_ERROR || found != kLargePageCount)
+        return false;
+
+    *pa = base;
+    return true;
 }
 
 int64_t VmObject::CommitRange(uint64_t offset, uint64_t len) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("offset 0x%llx, len 0x%llx\n", offset, len);
 
+    if (is_slice_) {
+        if (!TrimRange(offset, len, size_))
+            return ERR_OUT_OF_RANGE;
+        return parent_->CommitRange(parent_offset_ + offset, len);
+    }
+
     AutoLock a(lock_);
 
     // trim the size
@@ -244,42 +965,85 @@ int64_t VmObject::CommitRange(uint64_t offset, uint64_t len) {
     uint64_t end = ROUNDUP_PAGE_SIZE(offset + len);
     DEBUG_ASSERT(end > offset);
 
-    // make a pass through the list, counting the number of pages we need to allocate
-    size_t count = 0;
-    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        size_t index = OffsetToIndex(o);
+    // pages the page store holds are committed, but not backed the way the caller wants
+    status_t status = DecompressRangeLocked(OffsetToIndex(offset), OffsetToIndex(end));
+    if (status != NO_ERROR)
+        return status;
 
-        if (!page_array_[index])
-            count++;
+    // back any empty chunks we touch with large page runs first, one attempt per chunk
+    bool committed_large = false;
+    if (large_pages()) {
+        for (uint64_t o = ROUNDDOWN(offset, LARGE_PAGE_SIZE); o < end; o += LARGE_PAGE_SIZE) {
+            size_t index = OffsetToIndex(MAX(o, offset));
+
+            if (!page_list_.Lookup(index) && CommitLargePageLocked(index))
+                committed_large = true;
+        }
     }
+
+    // count the pages already there to find the number we need to allocate
+    size_t start_index = OffsetToIndex(offset);
+    size_t end_index = OffsetToIndex(end);
+    size_t present = 0;
+    page_list_.ForEveryPageInRange(start_index, end_index, [&present](size_t, vm_page_t*) {
+        present++;
+        return NO_ERROR;
+    });
+    size_t count = end_index - start_index - present;
     if (count == 0)
-        return 0;
+        return committed_large ? len : 0;
+
+    // clones have to copy whatever their parent holds and paged objects wait for their source,
+    // so go a page at a time
+    if (parent_ || page_source_) {
+        for (size_t index = start_index; index < end_index; index++) {
+            vm_page_t* p;
+            status = FaultPageLocked((uint64_t)index * PAGE_SIZE, VMM_PF_FLAG_WRITE, &p);
+            if (status != NO_ERROR)
+                return status;
+        }
+        return len;
+    }
 
-    // allocate count number of pages
+    // allocate count number of pages, clearing them with the lock dropped
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    mutex_release(&lock_);
+    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &page_list);
+    mutex_acquire(&lock_);
+
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
         return ERR_NO_MEMORY;
     }
 
-    // add them to the appropriate range of the object
-    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        size_t index = OffsetToIndex(o);
+    // add them to the holes in the range of the object, some of which may have been filled or
+    // opened up while we were allocating
+    for (size_t index = start_index; index < end_index; index++) {
+        if (page_list_.Lookup(index) || compressed_list_.Lookup(index))
+            continue;
 
         vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, node);
-        DEBUG_ASSERT(p);
-
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
+        if (!p) {
+            // ran out, fault the rest in one at a time
+            status = FaultPageLocked((uint64_t)index * PAGE_SIZE, VMM_PF_FLAG_WRITE, &p);
+            if (status != NO_ERROR)
+                return status;
+            continue;
+        }
 
-        AddPageToArray(index, p);
+        if (AddPageLocked(index, p) != NO_ERROR) {
+            list_add_head(&page_list, &p->node);
+            pmm_free(&page_list);
+            return ERR_NO_MEMORY;
+        }
     }
 
-    DEBUG_ASSERT(list_is_empty(&page_list));
+    // hand back whatever other faults made redundant
+    if (!list_is_empty(&page_list))
+        pmm_free(&page_list);
 
     return len;
 }
@@ -302,19 +1066,29 @@ int64_t VmObject::CommitRangeContiguous(uint64_t offset, uint64_t len, uint8_t a
     uint64_t end = ROUNDUP_PAGE_SIZE(offset + len);
     DEBUG_ASSERT(end > offset);
 
-    // make a pass through the list, making sure we have an empty run on the object
-    size_t count = 0;
-    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        size_t index = OffsetToIndex(o);
-
-        if (page_array_[index])
-            return ERR_NO_MEMORY;
-
-        count++;
-    }
+    // a fresh run would hide whatever a clone's parent or a page source holds, and a slice
+    // holds no pages
+    if (parent_ || page_source_)
+        return ERR_NOT_SUPPORTED;
+
+    // make sure we have an empty run on the object
+    size_t start_index = OffsetToIndex(offset);
+    size_t count = OffsetToIndex(end) - start_index;
+    auto present = page_list_.ForEveryPageInRange(
+        start_index, start_index + count, [](size_t, vm_page_t*) { return ERR_NO_MEMORY; });
+    if (present != NO_ERROR)
+        return ERR_NO_MEMORY;
+    present = compressed_list_.ForEveryPageInRange(
+        start_index, start_index + count, [](size_t, VmCompressedPage*) { return ERR_NO_MEMORY; });
+    if (present != NO_ERROR)
+        return ERR_NO_MEMORY;
 
     DEBUG_ASSERT(count == len / PAGE_SIZE);
 
+    // a contiguous run is only any use where it is
+    pages_in_place_ = true;
+    compressible_ = false;
+
     // allocate count number of pages
     list_node page_list;
     list_initialize(&page_list);
@@ -330,21 +1104,440 @@ int64_t VmObject::CommitRangeContiguous(uint64_t offset, uint64_t len, uint8_t a
     DEBUG_ASSERT(list_length(&page_list) == allocated);
 
     // add them to the appropriate range of the object
-    for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
-        size_t index = OffsetToIndex(o);
-
+    for (size_t index = start_index; index < start_index + count; index++) {
         vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, node);
         DEBUG_ASSERT(p);
 
         // TODO: remove once pmm returns zeroed pages
         ZeroPage(p);
 
-        AddPageToArray(index, p);
+        if (AddPageLocked(index, p) != NO_ERROR) {
+            list_add_head(&page_list, &p->node);
+            pmm_free(&page_list);
+            return ERR_NO_MEMORY;
+        }
+    }
+
+    return count * PAGE_SIZE;
+}
+
+int64_t VmObject::DecommitRange(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset 0x%llx, len 0x%llx\n", offset, len);
+
+    // clones sharing the pages keep them
+    if (!is_slice_) {
+        status_t status = CopyPagesToClones(offset, len, 0);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    list_node page_list;
+    list_initialize(&page_list);
+
+    // regions to unmap the range from, with references so they stick around once we drop our
+    // lock. a region is only on our list while it's mapped into an address space, which holds a
+    // reference to it, so it's safe to take one here.
+    utils::RefPtr<VmRegion>* regions = nullptr;
+    size_t region_count = 0;
+
+    size_t count = 0;
+    {
+        AutoLock a(lock_);
+
+        // a slice's pages belong to its parent, and a slice's mappings would keep the parent's
+        if (is_slice_)
+            return ERR_NOT_SUPPORTED;
+        if (slice_count_ > 0)
+            return ERR_BAD_STATE;
+
+        // trim the size
+        if (!TrimRange(offset, len, size_))
+            return ERR_OUT_OF_RANGE;
+
+        // was in range, just zero length
+        if (len == 0)
+            return 0;
+
+        // only whole pages can be handed back
+        uint64_t start = ROUNDUP_PAGE_SIZE(offset);
+        uint64_t end = ROUNDDOWN(offset + len, PAGE_SIZE);
+        if (offset + len == size_)
+            end = ROUNDUP_PAGE_SIZE(size_);
+        if (end <= start)
+            return 0;
+        offset = start;
+        len = end - start;
+
+        region_count = mapping_list_.size_slow();
+        if (region_count > 0) {
+            AllocChecker ac;
+            regions = new (&ac) utils::RefPtr<VmRegion>[region_count];
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+
+            size_t i = 0;
+            for (auto& r : mapping_list_)
+                regions[i++] = utils::RefPtr<VmRegion>(&r);
+        }
+
+        // pull the pages out of the object, so nothing new can find them. anything that found
+        // one already is either done with it or holds an address space lock we'll wait on below.
+        page_list_.RemovePagesInRange(OffsetToIndex(start), OffsetToIndex(end),
+                                      [&page_list, &count](size_t index, vm_page_t* p) {
+            count++;
+
+            // whoever has it pinned frees it when they're done with it
+            if (p->pin_count > 0) {
+                p->flags |= VM_PAGE_FLAG_FREE_ON_UNPIN;
+                return;
+            }
+
+            DEBUG_ASSERT(!list_in_list(&p->node));
+            list_add_tail(&page_list, &p->node);
+        });
+
+        // along with what the page store holds for the range
+        compressed_list_.RemovePagesInRange(OffsetToIndex(start), OffsetToIndex(end),
+                                            [this, &count](size_t index, VmCompressedPage* c) {
+            count++;
+            compressed_bytes_ -= VmPageStore::StoredSize(c);
+            VmPageStore::Free(c);
+        });
     }
 
+    // get the pages out of every mapping before they can be reused
+    for (size_t i = 0; i < region_count; i++)
+        regions[i]->UnmapObjectRange(offset, len);
+    delete[] regions;
+
+    pmm_free(&page_list);
+
     return count * PAGE_SIZE;
 }
 
+status_t VmObject::TakePages(VmObject* src, uint64_t src_offset, uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(src != this);
+    LTRACEF("src %p offset 0x%llx, offset 0x%llx, len 0x%llx\n", src, src_offset, offset, len);
+
+    if (!IS_PAGE_ALIGNED(src_offset) || !IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ERR_INVALID_ARGS;
+    if (len == 0)
+        return NO_ERROR;
+    if (large_pages() || is_slice_)
+        return ERR_NOT_SUPPORTED;
+
+    {
+        AutoLock a(lock_);
+        if (offset + len < offset || offset + len > size_)
+            return ERR_OUT_OF_RANGE;
+    }
+
+    size_t count = static_cast<size_t>(len / PAGE_SIZE);
+    AllocChecker ac;
+    utils::unique_ptr<vm_page_t*[]> pages(new (&ac) vm_page_t*[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    // clones of src sharing the pages keep them
+    if (!src->is_slice_) {
+        status_t status = src->CopyPagesToClones(src_offset, len, 0);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    // make sure src can give up every page before pulling any out of it
+    {
+        AutoLock a(src->lock_);
+        if (src_offset + len < src_offset || src_offset + len > ROUNDUP_PAGE_SIZE(src->size_))
+            return ERR_OUT_OF_RANGE;
+        if (!src->mapping_list_.is_empty() || src->slice_count_ > 0)
+            return ERR_BAD_STATE;
+
+        size_t start = OffsetToIndex(src_offset);
+        for (size_t i = 0; i < count; i++) {
+            vm_page_t* p = src->page_list_.Lookup(start + i);
+            // pages the page store took count as committed, so bring them back to move them
+            if (!p && src->compressed_list_.Lookup(start + i)) {
+                p = src->DecompressPageLocked(start + i);
+                if (!p)
+                    return ERR_NO_MEMORY;
+            }
+            if (!p || p->pin_count > 0)
+                return ERR_NOT_FOUND;
+        }
+    }
+
+    // get our pages out of every mapping, so the next access faults in the new ones
+    int64_t err = DecommitRange(offset, len);
+    if (err < 0)
+        return static_cast<status_t>(err);
+
+    {
+        AutoLock a(src->lock_);
+        size_t start = OffsetToIndex(src_offset);
+        for (size_t i = 0; i < count; i++) {
+            pages[i] = src->page_list_.Remove(start + i);
+            DEBUG_ASSERT(pages[i]);
+        }
+    }
+
+    AutoLock a(lock_);
+
+    size_t start = OffsetToIndex(offset);
+    status_t status = NO_ERROR;
+    for (size_t i = 0; i < count; i++) {
+        vm_page_t* p = pages[i];
+        if (status == NO_ERROR) {
+            // a fault may have put a fresh page in since the decommit, so fill that one in
+            // instead, and the page store may have taken it out again
+            VmCompressedPage* c = compressed_list_.Remove(start + i);
+            if (c) {
+                compressed_bytes_ -= VmPageStore::StoredSize(c);
+                VmPageStore::Free(c);
+            }
+            vm_page_t* existing = page_list_.Lookup(start + i);
+            if (!existing) {
+                p->flags &= ~VM_PAGE_FLAG_IDLE;
+                status = page_list_.Insert(start + i, p);
+                if (status == NO_ERROR)
+                    continue;
+            } else {
+                memcpy(paddr_to_kvaddr(vm_page_to_paddr(existing)),
+                       paddr_to_kvaddr(vm_page_to_paddr(p)), PAGE_SIZE);
+            }
+        }
+        pmm_free_page(p);
+    }
+
+    return status;
+}
+
+status_t VmObject::SupplyPages(uint64_t offset, uint64_t len, const void* data) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    LTRACEF("offset 0x%llx, len 0x%llx, data %p\n", offset, len, data);
+
+    if (!page_source_)
+        return ERR_NOT_SUPPORTED;
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ERR_INVALID_ARGS;
+    if (offset + len < offset || offset + len > ROUNDUP_PAGE_SIZE(size_))
+        return ERR_OUT_OF_RANGE;
+
+    size_t start = OffsetToIndex(offset);
+    size_t end = OffsetToIndex(offset + len);
+
+    if (!data) {
+        AutoLock a(lock_);
+
+        PageRequest* r;
+        list_for_every_entry (&page_requests_, r, PageRequest, node) {
+            if (r->index >= start && r->index < end)
+                r->failed = true;
+        }
+        cond_broadcast(&page_supplied_);
+
+        return NO_ERROR;
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    for (size_t index = start; index < end; index++, src += PAGE_SIZE) {
+        {
+            AutoLock a(lock_);
+            if (page_list_.Lookup(index))
+                continue;
+        }
+
+        // fill a fresh page with the lock dropped, since the user copy may fault
+        paddr_t pa;
+        vm_page_t* p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_KMAP, &pa);
+        if (!p)
+            return ERR_NO_MEMORY;
+
+        status_t status = copy_from_user(paddr_to_kvaddr(pa), src, PAGE_SIZE);
+        if (status != NO_ERROR) {
+            pmm_free_page(p);
+            return status;
+        }
+
+        AutoLock a(lock_);
+
+        // it may have been supplied again while we were at it
+        if (page_list_.Lookup(index)) {
+            pmm_free_page(p);
+            continue;
+        }
+
+        status = AddPageLocked(index, p);
+        if (status != NO_ERROR) {
+            pmm_free_page(p);
+            return status;
+        }
+        cond_broadcast(&page_supplied_);
+    }
+
+    return NO_ERROR;
+}
+
+vm_page_t* VmObject::DecompressPageLocked(size_t index) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    VmCompressedPage* c = compressed_list_.Lookup(index);
+    DEBUG_ASSERT(c);
+
+    // decompressing is quick enough to do with the lock held
+    paddr_t pa;
+    vm_page_t* p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_KMAP, &pa);
+    if (!p)
+        return nullptr;
+    VmPageStore::Decompress(c, p);
+
+    if (AddPageLocked(index, p) != NO_ERROR) {
+        pmm_free_page(p);
+        return nullptr;
+    }
+
+    compressed_list_.Remove(index);
+    compressed_bytes_ -= VmPageStore::StoredSize(c);
+    VmPageStore::Free(c);
+
+    LTRACEF("decompressed page %p, pa 0x%lx\n", p, pa);
+
+    return p;
+}
+
+status_t VmObject::DecompressRangeLocked(size_t start, size_t end) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(is_mutex_held(&lock_));
+
+    while (start < end) {
+        size_t index = 0;
+        bool found = false;
+        compressed_list_.ForEveryPageInRange(start, end,
+                                             [&index, &found](size_t i, VmCompressedPage*) {
+            index = i;
+            found = true;
+            return ERR_CANCELLED;
+        });
+        if (!found)
+            break;
+
+        if (!DecompressPageLocked(index))
+            return ERR_NO_MEMORY;
+        start = index + 1;
+    }
+
+    return NO_ERROR;
+}
+
+size_t VmObject::ScanIdlePages() {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(!parent_ && !page_source_ && !large_pages());
+
+    list_node freed;
+    list_initialize(&freed);
+
+    // regions to unmap the pages newly marked idle from, taken as in DecommitRange()
+    utils::RefPtr<VmRegion>* regions = nullptr;
+    size_t region_count = 0;
+
+    // the range of pages newly marked idle
+    size_t first_idle = SIZE_MAX;
+    size_t last_idle = 0;
+
+    size_t compressed = 0;
+    {
+        AutoLock a(lock_);
+
+        // a slice maps our pages without being on our mapping list
+        if (!compressible_ || slice_count_ > 0 || page_list_.is_empty())
+            return 0;
+
+        // the kernel touches its mappings where it can't take a fault
+        for (auto& r : mapping_list_) {
+            if (!r.in_user_aspace())
+                return 0;
+            region_count++;
+        }
+
+        // get the regions before marking anything, since a page marked idle has to be unmapped
+        if (region_count > 0) {
+            AllocChecker ac;
+            regions = new (&ac) utils::RefPtr<VmRegion>[region_count];
+            if (!ac.check())
+                return 0;
+
+            size_t i = 0;
+            for (auto& r : mapping_list_)
+                regions[i++] = utils::RefPtr<VmRegion>(&r);
+        }
+
+        size_t index = 0;
+        for (;;) {
+            vm_page_t* p = nullptr;
+            page_list_.ForEveryPageInRange(index, SIZE_MAX, [&index, &p](size_t i, vm_page_t* page) {
+                index = i;
+                p = page;
+                return ERR_CANCELLED;
+            });
+            if (!p)
+                break;
+
+            // pinned pages are in use outside of the lock
+            if (p->pin_count > 0) {
+                index++;
+                continue;
+            }
+
+            // Anything that has looked the page up since it was marked cleared the mark, and it
+            // was unmapped everywhere after that, so a page that is still idle can be taken out.
+            if (!(p->flags & VM_PAGE_FLAG_IDLE)) {
+                p->flags |= VM_PAGE_FLAG_IDLE;
+                first_idle = MIN(first_idle, index);
+                last_idle = index;
+                index++;
+                continue;
+            }
+
+            VmCompressedPage* c = VmPageStore::Compress(p);
+            if (c && compressed_list_.Insert(index, c) != NO_ERROR) {
+                VmPageStore::Free(c);
+                c = nullptr;
+            }
+            if (!c) {
+                // try again once it has sat idle through another scan
+                p->flags &= ~VM_PAGE_FLAG_IDLE;
+                index++;
+                continue;
+            }
+
+            page_list_.Remove(index);
+            compressed_bytes_ += VmPageStore::StoredSize(c);
+            DEBUG_ASSERT(!list_in_list(&p->node));
+            list_add_tail(&freed, &p->node);
+            compressed++;
+            index++;
+        }
+    }
+
+    // unmap the pages just marked, so the next touch faults and clears the mark
+    if (first_idle <= last_idle) {
+        uint64_t offset = (uint64_t)first_idle * PAGE_SIZE;
+        uint64_t len = (uint64_t)(last_idle - first_idle + 1) * PAGE_SIZE;
+        for (size_t i = 0; i < region_count; i++)
+            regions[i]->UnmapObjectRange(offset, len);
+    }
+    delete[] regions;
+
+    pmm_free(&freed);
+
+    LTRACEF("vmo %p: compressed %zu pages\n", this, compressed);
+
+    return compressed;
+}
+
 // perform some sort of copy in/out on a range of the object using a passed in lambda
 // for the copy routine
 template <typename T>
@@ -354,9 +1547,7 @@ status_t VmObject::ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_
     if (bytes_copied)
         *bytes_copied = 0;
 
-    AutoLock a(lock_);
-
-    // trim the size
+    // trim the size, which is only set at creation
     if (!TrimRange(offset, len, size_))
         return ERR_OUT_OF_RANGE;
 
@@ -364,31 +1555,88 @@ status_t VmObject::ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_
     if (len == 0)
         return 0;
 
-    // walk the list of pages and do the write
-    size_t dest_offset = 0;
-    while (len > 0) {
-        size_t page_offset = offset % PAGE_SIZE;
-        size_t tocopy = MIN(PAGE_SIZE - page_offset, len);
+    if (is_slice_)
+        return parent_->ReadWriteInternal(parent_offset_ + offset, len, bytes_copied, write,
+                                          copyfunc);
 
-        // fault in the page
-        vm_page_t* p = FaultPageLocked(offset, write ? VMM_PF_FLAG_WRITE : 0);
-        if (!p)
-            return ERR_NO_MEMORY;
+    if (write) {
+        status_t status = CopyPagesToClones(offset, len, VMM_PF_FLAG_WRITE);
+        if (status != NO_ERROR)
+            return status;
+    }
 
-        // compute the kernel mapping of this page
-        paddr_t pa = vm_page_to_paddr(p);
-        uint8_t* page_ptr = reinterpret_cast<uint8_t*>(paddr_to_kvaddr(pa));
+    // walk the list of pages and do the write, looking up and pinning a batch of pages per
+    // acquisition of the lock and copying each physically contiguous run of them at once
+    size_t dest_offset = 0;
+    while (len > 0) {
+        vm_page_t* pages[kReadWriteBatchPages];
+        VmObject* owners[kReadWriteBatchPages];
+        size_t page_count = 0;
+        status_t fault_status = NO_ERROR;
+        {
+            AutoLock a(lock_);
+
+            uint64_t batch_offset = offset;
+            size_t batch_len = len;
+            while (page_count < kReadWriteBatchPages && batch_len > 0) {
+                // find the page, reading through to the parent of a clone rather than copying
+                // and faulting it in otherwise. it's pinned so that it sticks around for the copy.
+                VmObject* owner = this;
+                vm_page_t* p = nullptr;
+                if (!write && parent_ && !page_list_.Lookup(OffsetToIndex(batch_offset))) {
+                    fault_status = PinParentPage(batch_offset, 0, &owner, &p);
+                    if (fault_status != NO_ERROR)
+                        break;
+                }
+                if (!p) {
+                    fault_status = FaultPageLocked(batch_offset, write ? VMM_PF_FLAG_WRITE : 0, &p);
+                    if (fault_status != NO_ERROR)
+                        break;
+                    PinPageLocked(p);
+                }
+                pages[page_count] = p;
+                owners[page_count] = owner;
+                page_count++;
+
+                size_t tocopy = MIN(PAGE_SIZE - batch_offset % PAGE_SIZE, batch_len);
+                batch_offset += tocopy;
+                batch_len -= tocopy;
+            }
+        }
+        if (page_count == 0)
+            return fault_status;
+
+        // call the copy routine on the pages' kernel mapping with no locks held, since user
+        // copies may fault
+        status_t err = NO_ERROR;
+        for (size_t i = 0; i < page_count;) {
+            paddr_t pa = vm_page_to_paddr(pages[i]);
+            size_t page_offset = offset % PAGE_SIZE;
+            size_t tocopy = MIN(PAGE_SIZE - page_offset, len);
+            size_t next = i + 1;
+            while (next < page_count && tocopy < len &&
+                   vm_page_to_paddr(pages[next]) == pa + (next - i) * PAGE_SIZE) {
+                tocopy += MIN(PAGE_SIZE, len - tocopy);
+                next++;
+            }
+
+            uint8_t* ptr = reinterpret_cast<uint8_t*>(paddr_to_kvaddr(pa));
+            err = copyfunc(ptr + page_offset, dest_offset, tocopy);
+            if (err < 0)
+                break;
+
+            offset += tocopy;
+            if (bytes_copied)
+                *bytes_copied += tocopy;
+            dest_offset += tocopy;
+            len -= tocopy;
+            i = next;
+        }
 
-        // call the copy routine
-        auto err = copyfunc(page_ptr + page_offset, dest_offset, tocopy);
+        for (size_t i = 0; i < page_count; i++)
+            owners[i]->UnpinPage(pages[i]);
         if (err < 0)
             return err;
-
-        offset += tocopy;
-        if (bytes_copied)
-            *bytes_copied += tocopy;
-        dest_offset += tocopy;
-        len -= tocopy;
     }
 
     return NO_ERROR;
@@ -0,0 +1,147 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/vm/vm_page_list.h>
+
+#include <assert.h>
+#include <new.h>
+
+template <typename T>
+VmSparsePageList<T>::~VmSparsePageList() {
+    // the owner should have taken all the pages back out already
+    DEBUG_ASSERT(count_ == 0);
+
+    if (root_)
+        FreeNodes(root_, height_);
+}
+
+template <typename T>
+void VmSparsePageList<T>::FreeNodes(Node* node, uint height) {
+    if (height > 1) {
+        for (size_t i = 0; i < kFanout; i++) {
+            if (node->slots[i])
+                FreeNodes(static_cast<Node*>(node->slots[i]), height - 1);
+        }
+    }
+    delete node;
+}
+
+template <typename T>
+T* VmSparsePageList<T>::Lookup(size_t index) const {
+    if (!root_ || index >= Capacity(height_))
+        return nullptr;
+
+    const Node* node = root_;
+    for (uint height = height_; height > 1; height--) {
+        node = static_cast<const Node*>(node->slots[(index >> ShiftForHeight(height)) & kMask]);
+        if (!node)
+            return nullptr;
+    }
+    return static_cast<T*>(node->slots[index & kMask]);
+}
+
+template <typename T>
+status_t VmSparsePageList<T>::Insert(size_t index, T* p) {
+    DEBUG_ASSERT(p);
+
+    AllocChecker ac;
+
+    // grow the tree upwards until it covers index, pushing the old root down
+    // into the first slot of the new one
+    if (!root_) {
+        root_ = new (&ac) Node;
+        if (!ac.check())
+            return ERR_NO_MEMORY;
+        height_ = 1;
+    }
+    while (index >= Capacity(height_)) {
+        Node* new_root = new (&ac) Node;
+        if (!ac.check())
+            return ERR_NO_MEMORY;
+
+        new_root->slots[0] = root_;
+        new_root->count = 1;
+        root_ = new_root;
+        height_++;
+    }
+
+    // walk down, filling in any missing interior nodes
+    Node* node = root_;
+    for (uint height = height_; height > 1; height--) {
+        void** slot = &node->slots[(index >> ShiftForHeight(height)) & kMask];
+        if (!*slot) {
+            Node* child = new (&ac) Node;
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+
+            *slot = child;
+            node->count++;
+        }
+        node = static_cast<Node*>(*slot);
+    }
+
+    void** slot = &node->slots[index & kMask];
+    if (*slot)
+        return ERR_ALREADY_EXISTS;
+
+    *slot = p;
+    node->count++;
+    count_++;
+
+    return NO_ERROR;
+}
+
+// remove index from the subtree at node, setting node_empty if that leaves
+// node with nothing in it
+template <typename T>
+T* VmSparsePageList<T>::Remove(Node* node, uint height, size_t index, bool* node_empty) {
+    void** slot = &node->slots[(index >> ShiftForHeight(height)) & kMask];
+    if (!*slot)
+        return nullptr;
+
+    T* p;
+    if (height == 1) {
+        p = static_cast<T*>(*slot);
+    } else {
+        bool child_empty = false;
+        Node* child = static_cast<Node*>(*slot);
+        p = Remove(child, height - 1, index, &child_empty);
+        if (!child_empty)
+            return p;
+
+        delete child;
+    }
+
+    *slot = nullptr;
+    DEBUG_ASSERT(node->count > 0);
+    *node_empty = (--node->count == 0);
+    return p;
+}
+
+template <typename T>
+T* VmSparsePageList<T>::Remove(size_t index) {
+    if (!root_ || index >= Capacity(height_))
+        return nullptr;
+
+    bool root_empty = false;
+    T* p = Remove(root_, height_, index, &root_empty);
+    if (!p)
+        return nullptr;
+
+    DEBUG_ASSERT(count_ > 0);
+    count_--;
+
+    if (root_empty) {
+        delete root_;
+        root_ = nullptr;
+        height_ = 0;
+    }
+
+    return p;
+}
+
+template class VmSparsePageList<vm_page_t>;
+template class VmSparsePageList<VmCompressedPage>;
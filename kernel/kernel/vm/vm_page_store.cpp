@@ -0,0 +1,396 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/vm/vm_page_store.h>
+
+#include "vm_priv.h"
+#include <assert.h>
+#include <err.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <kernel/vm/vm_object.h>
+#include <lib/console.h>
+#include <lk/init.h>
+#include <new.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trace.h>
+#include <utils/intrusive_double_list.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+// Pages are compressed in the LZ4 block format, each on its own.
+struct VmCompressedPage {
+    uint16_t size; // of data, 0 for a page of zeroes
+    uint8_t data[];
+};
+
+// every page of zeroes shares this one
+static VmCompressedPage zero_page;
+
+// a page is only worth keeping compressed if it saves at least a quarter of it
+static const size_t kMaxStoredSize = PAGE_SIZE * 3 / 4;
+
+static const uint32_t kDefaultIdleSec = 30;
+
+static bool store_enabled;
+static lk_time_t scan_interval;
+
+// the objects that may be scanned
+static mutex_t object_lock = MUTEX_INITIAL_VALUE(object_lock);
+static utils::DoublyLinkedList<VmObject*, VmObjectStoreListTraits> objects;
+
+// the compressor's match table and output, too big for a kernel stack
+static const uint kHashBits = 12;
+static mutex_t codec_lock = MUTEX_INITIAL_VALUE(codec_lock);
+static uint16_t match_table[1u << kHashBits];
+static uint8_t scratch[kMaxStoredSize];
+
+static VmPageStore::Stats stats;
+
+static void StatAdd(size_t* stat, ssize_t delta) {
+    __atomic_fetch_add(stat, delta, __ATOMIC_RELAXED);
+}
+
+// the format ends every block with at least five literals, and starts no match in the last
+// twelve bytes
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;
+static const size_t kMatchLimit = 12;
+
+static uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint Hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+static size_t LengthBytes(size_t len) {
+    return (len < 15) ? 0 : (len - 15) / 255 + 1;
+}
+
+static uint8_t* PutLength(uint8_t* op, size_t len) {
+    for (len -= 15; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = static_cast<uint8_t>(len);
+    return op;
+}
+
+// Compress a page into at most dst_len bytes of dst, returning the compressed size or 0 if it
+// doesn't fit. Called with codec_lock held.
+static size_t CompressPage(const uint8_t* src, uint8_t* dst, size_t dst_len) {
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const iend = src + PAGE_SIZE;
+    const uint8_t* const mflimit = iend - kMatchLimit;
+    const uint8_t* const matchlimit = iend - kLastLiterals;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dst_len;
+
+    memset(match_table, 0, sizeof(match_table));
+
+    while (ip < mflimit) {
+        uint h = Hash(Read32(ip));
+        const uint8_t* ref = src + match_table[h];
+        match_table[h] = static_cast<uint16_t>(ip - src);
+        if (ref >= ip || Read32(ref) != Read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        const uint8_t* mp = ip + kMinMatch;
+        const uint8_t* rp = ref + kMinMatch;
+        while (mp < matchlimit && *mp == *rp) {
+            mp++;
+            rp++;
+        }
+
+        // token, literals, offset and match length
+        size_t lit = ip - anchor;
+        size_t mlen = mp - ip - kMinMatch;
+        size_t need = 1 + LengthBytes(lit) + lit + 2 + LengthBytes(mlen);
+        if (need > static_cast<size_t>(oend - op))
+            return 0;
+
+        uint8_t* token = op++;
+        *token = static_cast<uint8_t>(MIN(lit, 15u) << 4);
+        if (lit >= 15)
+            op = PutLength(op, lit);
+        memcpy(op, anchor, lit);
+        op += lit;
+
+        size_t offset = ip - ref;
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+
+        *token |= static_cast<uint8_t>(MIN(mlen, 15u));
+        if (mlen >= 15)
+            op = PutLength(op, mlen);
+
+        ip = mp;
+        anchor = ip;
+    }
+
+    size_t lit = iend - anchor;
+    if (1 + LengthBytes(lit) + lit > static_cast<size_t>(oend - op))
+        return 0;
+    *op++ = static_cast<uint8_t>(MIN(lit, 15u) << 4);
+    if (lit >= 15)
+        op = PutLength(op, lit);
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return op - dst;
+}
+
+static size_t GetLength(const uint8_t** ip, const uint8_t* iend, size_t len) {
+    if (len < 15)
+        return len;
+    uint8_t b;
+    do {
+        if (*ip == iend)
+            return SIZE_MAX;
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+// Decompress a block into a page, returning false if it doesn't come out to exactly a page.
+static bool DecompressPage(const uint8_t* src, size_t src_len, uint8_t* dst) {
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + PAGE_SIZE;
+
+    for (;;) {
+        if (ip == iend)
+            return false;
+        uint token = *ip++;
+
+        size_t lit = GetLength(&ip, iend, token >> 4);
+        if (lit > static_cast<size_t>(iend - ip) || lit > static_cast<size_t>(oend - op))
+            return false;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        // the last sequence is only literals
+        if (ip == iend)
+            return op == oend;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst))
+            return false;
+
+        size_t mlen = GetLength(&ip, iend, token & 15);
+        if (mlen == SIZE_MAX || mlen + kMinMatch > static_cast<size_t>(oend - op))
+            return false;
+        mlen += kMinMatch;
+
+        // the match may overlap what it is copying
+        const uint8_t* match = op - offset;
+        while (mlen--)
+            *op++ = *match++;
+    }
+}
+
+static bool IsZeroPage(const uint8_t* page) {
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(page);
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (words[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+bool VmPageStore::enabled() {
+    return store_enabled;
+}
+
+VmCompressedPage* VmPageStore::Compress(vm_page_t* p) {
+    const uint8_t* src = static_cast<const uint8_t*>(paddr_to_kvaddr(vm_page_to_paddr(p)));
+    DEBUG_ASSERT(src);
+
+    VmCompressedPage* c;
+    if (IsZeroPage(src)) {
+        c = &zero_page;
+    } else {
+        AutoLock a(codec_lock);
+
+        size_t size = CompressPage(src, scratch, sizeof(scratch));
+        if (size == 0) {
+            StatAdd(&stats.rejected, 1);
+            return nullptr;
+        }
+
+        c = static_cast<VmCompressedPage*>(malloc(sizeof(VmCompressedPage) + size));
+        if (!c)
+            return nullptr;
+        c->size = static_cast<uint16_t>(size);
+        memcpy(c->data, scratch, size);
+    }
+
+    StatAdd(&stats.stored_pages, 1);
+    StatAdd(&stats.stored_bytes, StoredSize(c));
+    StatAdd(&stats.compressed, 1);
+
+    return c;
+}
+
+void VmPageStore::Decompress(const VmCompressedPage* c, vm_page_t* p) {
+    uint8_t* dst = static_cast<uint8_t*>(paddr_to_kvaddr(vm_page_to_paddr(p)));
+    DEBUG_ASSERT(dst);
+
+    if (c->size == 0) {
+        arch_zero_page(dst);
+    } else {
+        __UNUSED bool ok = DecompressPage(c->data, c->size, dst);
+        DEBUG_ASSERT(ok);
+    }
+
+    StatAdd(&stats.decompressed, 1);
+}
+
+void VmPageStore::Free(VmCompressedPage* c) {
+    StatAdd(&stats.stored_pages, -1);
+    StatAdd(&stats.stored_bytes, -static_cast<ssize_t>(StoredSize(c)));
+
+    if (c != &zero_page)
+        free(c);
+}
+
+size_t VmPageStore::StoredSize(const VmCompressedPage* c) {
+    return (c == &zero_page) ? 0 : sizeof(VmCompressedPage) + c->size;
+}
+
+void VmPageStore::AddObject(VmObject* o) {
+    if (!store_enabled)
+        return;
+
+    AutoLock a(object_lock);
+    objects.push_back(o);
+}
+
+void VmPageStore::RemoveObject(VmObject* o) {
+    // nothing can add the object once it's being destroyed, so objects that were never added can
+    // skip the lock
+    if (!VmObjectStoreListTraits::node_state(*o).InContainer())
+        return;
+
+    AutoLock a(object_lock);
+    objects.erase(*o);
+}
+
+void VmPageStore::ScanObjects() {
+    // Take references to the objects, so they can be scanned without holding the list lock,
+    // which destroying an object takes. Objects already being destroyed are skipped.
+    utils::RefPtr<VmObject>* refs;
+    size_t count = 0;
+    {
+        AutoLock a(object_lock);
+
+        size_t len = objects.size_slow();
+        if (len == 0)
+            return;
+
+        AllocChecker ac;
+        refs = new (&ac) utils::RefPtr<VmObject>[len];
+        if (!ac.check())
+            return;
+
+        for (auto& o : objects) {
+            if (o.AddRefMaybeInDestructor())
+                refs[count++] = utils::internal::MakeRefPtrNoAdopt(&o);
+        }
+    }
+
+    size_t compressed = 0;
+    for (size_t i = 0; i < count; i++)
+        compressed += refs[i]->ScanIdlePages();
+    delete[] refs;
+
+    StatAdd(&stats.scans, 1);
+    LTRACEF("scanned %zu objects, compressed %zu pages\n", count, compressed);
+}
+
+void VmPageStore::GetStats(Stats* out) {
+    out->stored_pages = __atomic_load_n(&stats.stored_pages, __ATOMIC_RELAXED);
+    out->stored_bytes = __atomic_load_n(&stats.stored_bytes, __ATOMIC_RELAXED);
+    out->compressed = __atomic_load_n(&stats.compressed, __ATOMIC_RELAXED);
+    out->decompressed = __atomic_load_n(&stats.decompressed, __ATOMIC_RELAXED);
+    out->rejected = __atomic_load_n(&stats.rejected, __ATOMIC_RELAXED);
+    out->scans = __atomic_load_n(&stats.scans, __ATOMIC_RELAXED);
+}
+
+static int page_store_thread(void* arg) {
+    for (;;) {
+        thread_sleep(scan_interval);
+        VmPageStore::ScanObjects();
+    }
+
+    return 0;
+}
+
+static void page_store_init(uint level) {
+    if (!cmdline_get_bool("kernel.page-store", false))
+        return;
+
+    uint32_t idle_sec = cmdline_get_uint32("kernel.page-store-idle-sec", kDefaultIdleSec);
+    scan_interval = MAX(idle_sec, 1u) * 1000u;
+
+    // objects created from here on are tracked
+    store_enabled = true;
+
+    // just above idle, like the pmm zeroer
+    thread_t* t = thread_create("page store", &page_store_thread, nullptr, LOWEST_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    if (t)
+        thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(page_store, page_store_init, LK_INIT_LEVEL_THREADING);
+
+static int cmd_page_store(int argc, const cmd_args* argv) {
+    if (argc < 2) {
+    usage:
+        printf("usage:\n");
+        printf("%s stats\n", argv[0].str);
+        printf("%s scan\n", argv[0].str);
+        return ERR_INTERNAL;
+    }
+
+    if (!strcmp(argv[1].str, "stats")) {
+        VmPageStore::Stats s;
+        VmPageStore::GetStats(&s);
+        printf("page store %s, scanning every %u ms\n", store_enabled ? "enabled" : "disabled",
+               scan_interval);
+        printf("%zu pages stored in %zu bytes\n", s.stored_pages, s.stored_bytes);
+        printf("%zu compressed, %zu decompressed, %zu rejected, %zu scans\n", s.compressed,
+               s.decompressed, s.rejected, s.scans);
+    } else if (!strcmp(argv[1].str, "scan")) {
+        VmPageStore::ScanObjects();
+    } else {
+        printf("unknown command\n");
+        goto usage;
+    }
+
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+#if LK_DEBUGLEVEL > 0
+STATIC_COMMAND("pagestore", "compressed page store", &cmd_page_store)
+#endif
+STATIC_COMMAND_END(page_store);
@@ -9,6 +9,7 @@
 #include "vm_priv.h"
 #include <assert.h>
 #include <err.h>
+#include <kernel/auto_lock.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
@@ -48,11 +49,19 @@ status_t VmRegion::Destroy() {
     LTRACEF("%p '%s'\n", this, name_);
 
     // detach from any object we have mapped
+    if (mapped_) {
+        object_->RemoveMapping(this);
+        mapped_ = false;
+    }
     object_.reset();
 
     return NO_ERROR;
 }
 
+bool VmRegion::in_user_aspace() const {
+    return aspace_->is_user();
+}
+
 void VmRegion::Dump() const {
     DEBUG_ASSERT(magic_ == MAGIC);
     printf(
@@ -76,14 +85,66 @@ status_t VmRegion::Protect(uint arch_mmu_flags) {
     return NO_ERROR;
 }
 
-int VmRegion::Unmap() {
+void VmRegion::Detach() {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("%p '%s'\n", this, name_);
 
+    // the object can't reach our mappings anymore
+    if (mapped_) {
+        object_->RemoveMapping(this);
+        mapped_ = false;
+    }
+
+    AccountCommittedPages(-static_cast<ssize_t>(committed_pages_));
+}
+
+int VmRegion::Unmap() {
+    Detach();
+
     // unmap the section of address space we cover
     return arch_mmu_unmap(&aspace_->arch_aspace(), base_, size_ / PAGE_SIZE);
 }
 
+void VmRegion::UnmapObjectRange(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+
+    AutoLock a(aspace_->lock_);
+
+    // we may have been unmapped since the object looked us up
+    if (!mapped_)
+        return;
+
+    // trim to the part of the object we map
+    uint64_t start = MAX(offset, object_offset_);
+    uint64_t end = MIN(offset + len, object_offset_ + size_);
+    if (end <= start)
+        return;
+
+    vaddr_t va = base_ + static_cast<size_t>(start - object_offset_);
+    size_t count = static_cast<size_t>((end - start) / PAGE_SIZE);
+    LTRACEF("%p '%s', unmapping va 0x%lx size 0x%llx\n", this, name_, va, end - start);
+
+    // only the pages that were actually faulted in come off the count
+    size_t present = 0;
+    for (size_t i = 0; i < count; i++) {
+        paddr_t pa;
+        uint page_flags;
+        if (arch_mmu_query(&aspace_->arch_aspace(), va + i * PAGE_SIZE, &pa, &page_flags) >= 0)
+            present++;
+    }
+    AccountCommittedPages(-static_cast<ssize_t>(present));
+
+    arch_mmu_unmap(&aspace_->arch_aspace(), va, count);
+}
+
+void VmRegion::AccountCommittedPages(ssize_t delta) {
+    DEBUG_ASSERT(is_mutex_held(&aspace_->lock_));
+    DEBUG_ASSERT(delta >= 0 || committed_pages_ >= static_cast<size_t>(-delta));
+
+    committed_pages_ += delta;
+    aspace_->committed_pages_ += delta;
+}
+
 status_t VmRegion::SetObject(utils::RefPtr<VmObject> o, uint64_t offset) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("%p '%s', o %p, offset 0x%llx\n", this, name_, &o, offset);
@@ -95,6 +156,10 @@ status_t VmRegion::SetObject(utils::RefPtr<VmObject> o, uint64_t offset) {
     object_ = o;
     object_offset_ = offset;
 
+    // let the object find us if it needs to pull pages back out
+    object_->AddMapping(this);
+    mapped_ = true;
+
     return NO_ERROR;
 }
 
@@ -132,6 +197,40 @@ status_t VmRegion::MapPhysicalRange(size_t offset, size_t len, paddr_t paddr, bo
     return (ret < 0) ? ret : 0;
 }
 
+status_t VmRegion::MapLargePage(size_t offset) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(offset < size_);
+
+    if (!object_ || !object_->large_pages())
+        return ERR_NOT_SUPPORTED;
+
+    // a clone sharing the chunk needs its pages mapped one by one, read only until written
+    if (object_->has_clones())
+        return ERR_NOT_SUPPORTED;
+
+    // the whole chunk has to fit in the region
+    vaddr_t va = ROUNDDOWN(base_ + offset, VmObject::LARGE_PAGE_SIZE);
+    if (va < base_ || va + VmObject::LARGE_PAGE_SIZE - 1 > base_ + size_ - 1)
+        return ERR_OUT_OF_RANGE;
+
+    // and the object has to back it with an aligned run, which also checks that the virtual
+    // and object alignments match
+    paddr_t pa;
+    if (!object_->GetLargePage(object_offset_ + (va - base_), &pa))
+        return ERR_NOT_FOUND;
+
+    LTRACEF_LEVEL(2, "mapping large page pa 0x%lx to va 0x%lx\n", pa, va);
+
+    auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa,
+                            VmObject::LARGE_PAGE_SIZE / PAGE_SIZE, arch_mmu_flags_);
+    if (ret < 0)
+        return ret;
+
+    // the map fails without mapping anything if some of the chunk was already there
+    AccountCommittedPages(VmObject::LARGE_PAGE_SIZE / PAGE_SIZE);
+    return NO_ERROR;
+}
+
 status_t VmRegion::MapRange(size_t offset, size_t len, bool commit) {
     DEBUG_ASSERT(magic_ == MAGIC);
     LTRACEF("region %p '%s', offset 0x%zu, size 0x%zx\n", this, name_, offset, len);
@@ -150,6 +249,19 @@ status_t VmRegion::MapRange(size_t offset, size_t len, bool commit) {
     size_t o;
     for (o = offset; o < offset + len; o += PAGE_SIZE) {
         uint64_t vmo_offset = object_offset_ + o;
+
+        // map whole large page chunks in one go where we can
+        if (object_->large_pages() && IS_ALIGNED(base_ + o, VmObject::LARGE_PAGE_SIZE) &&
+            offset + len - o >= VmObject::LARGE_PAGE_SIZE) {
+            if (commit)
+                object_->CommitRange(vmo_offset, VmObject::LARGE_PAGE_SIZE);
+
+            if (MapLargePage(o) == NO_ERROR) {
+                o += VmObject::LARGE_PAGE_SIZE - PAGE_SIZE;
+                continue;
+            }
+        }
+
         vm_page_t* p = object_->GetPage(vmo_offset);
         if (!p) {
             if (!commit) {
@@ -172,15 +284,72 @@ status_t VmRegion::MapRange(size_t offset, size_t len, bool commit) {
         paddr_t pa = vm_page_to_paddr(p);
         LTRACEF_LEVEL(2, "mapping pa 0x%lx to va 0x%lx\n", pa, va);
 
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, arch_mmu_flags_);
+        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, MapFlags(0));
         if (ret < 0) {
             TRACEF("error %d mapping page at va 0x%lx pa 0x%lx\n", ret, va, pa);
+        } else {
+            AccountCommittedPages(1);
         }
     }
 
     return NO_ERROR;
 }
 
+uint VmRegion::MapFlags(uint pf_flags) const {
+    DEBUG_ASSERT(object_);
+
+    if ((pf_flags & VMM_PF_FLAG_WRITE) || (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_RO) ||
+        !object_->has_clones())
+        return arch_mmu_flags_;
+
+    return arch_mmu_flags_ | ARCH_MMU_FLAG_PERM_RO;
+}
+
+void VmRegion::FaultAround(vaddr_t va, uint pf_flags) {
+    DEBUG_ASSERT(magic_ == MAGIC);
+    DEBUG_ASSERT(object_);
+
+    // sequential regions read ahead of the fault, committing pages as needed; others only pick
+    // up pages the object already has in an aligned window around it
+    const size_t window = FAULT_AROUND_PAGES * PAGE_SIZE;
+    vaddr_t start = sequential_ ? va : ROUNDDOWN(va, window);
+    vaddr_t end = start + window - 1;
+
+    start = MAX(start, base_);
+    if (end < start || end > base_ + size_ - 1)
+        end = base_ + size_ - 1;
+
+    size_t count = (end - start) / PAGE_SIZE + 1;
+    for (size_t i = 0; i < count; i++) {
+        vaddr_t addr = start + i * PAGE_SIZE;
+        if (addr == va)
+            continue;
+
+        uint64_t vmo_offset = addr - base_ + object_offset_;
+        // the neighbors aren't being written yet, so a clone can keep sharing them
+        vm_page_t* p = nullptr;
+        uint flags = (pf_flags & ~VMM_PF_FLAG_WRITE) | VMM_PF_FLAG_NO_WAIT;
+        if (sequential_)
+            object_->FaultPage(vmo_offset, flags, &p);
+        else
+            p = object_->GetPage(vmo_offset);
+        if (!p)
+            continue;
+
+        // anything already mapped here is either this page or being dealt with by its own
+        // fault, so just leave it be
+        paddr_t pa;
+        uint page_flags;
+        if (arch_mmu_query(&aspace_->arch_aspace(), addr, &pa, &page_flags) >= 0)
+            continue;
+
+        pa = vm_page_to_paddr(p);
+        LTRACEF_LEVEL(2, "fault around mapping pa 0x%lx to va 0x%lx\n", pa, addr);
+        if (arch_mmu_map(&aspace_->arch_aspace(), addr, pa, 1, MapFlags(0)) >= 0)
+            AccountCommittedPages(1);
+    }
+}
+
 status_t VmRegion::PageFault(vaddr_t va, uint pf_flags) {
     DEBUG_ASSERT(magic_ == MAGIC);
     DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
@@ -222,13 +391,18 @@ status_t VmRegion::PageFault(vaddr_t va, uint pf_flags) {
         return ERR_NO_MEMORY;
     }
 
-    // fault in or grab an existing page
-    vm_page_t* new_p = object_->FaultPage(vmo_offset, pf_flags);
-    if (!new_p) {
+    // fault in or grab an existing page. one that has to come from a page source is waited for
+    // by the address space, with its lock dropped.
+    vm_page_t* new_p;
+    status_t status = object_->FaultPage(vmo_offset, pf_flags | VMM_PF_FLAG_NO_WAIT, &new_p);
+    if (status == ERR_NOT_READY)
+        return status;
+    if (status != NO_ERROR) {
         TRACEF("ERROR: failed to fault in or grab existing page\n");
         return ERR_NO_MEMORY;
     }
     paddr_t new_pa = vm_page_to_paddr(new_p);
+    uint mmu_flags = MapFlags(pf_flags);
 
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single address
@@ -239,11 +413,11 @@ status_t VmRegion::PageFault(vaddr_t va, uint pf_flags) {
         LTRACEF("queried va, page at pa 0x%lx, flags 0x%x is already there\n", pa, page_flags);
         if (pa == new_pa) {
             // page was already mapped, are the permissions compatible?
-            if (page_flags == arch_mmu_flags_)
+            if (page_flags == mmu_flags)
                 return NO_ERROR;
 
-            // same page, different permission
-            auto ret = arch_mmu_protect(&aspace_->arch_aspace(), va, 1, arch_mmu_flags_);
+            // same page, different permission, such as a write to a page a clone was sharing
+            auto ret = arch_mmu_protect(&aspace_->arch_aspace(), va, 1, mmu_flags);
             if (ret < 0) {
                 TRACEF("failed to modify permissions on existing mapping\n");
                 return ERR_NO_MEMORY;
@@ -258,13 +432,22 @@ status_t VmRegion::PageFault(vaddr_t va, uint pf_flags) {
             return ERR_NOT_SUPPORTED;
         }
     } else {
-        // nothing was mapped there before, map it now
+        // nothing was mapped there before, see if the whole chunk around it can go in as a
+        // large page
+        if (MapLargePage(va - base_) == NO_ERROR)
+            return NO_ERROR;
+
+        // otherwise map just this page
         LTRACEF("mapping pa 0x%lx to va 0x%lx\n", new_pa, va);
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, new_pa, 1, arch_mmu_flags_);
+        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, new_pa, 1, mmu_flags);
         if (ret < 0) {
             TRACEF("failed to map page\n");
             return ERR_NO_MEMORY;
         }
+        AccountCommittedPages(1);
+
+        // save the neighbors a trip through here
+        FaultAround(va, pf_flags);
     }
 
     return NO_ERROR;
@@ -0,0 +1,365 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/vm/vm_region_tree.h>
+
+#include <assert.h>
+#include <kernel/vm/vm_region.h>
+#include <stdlib.h>
+
+VmRegionTree::NodeState& VmRegionTree::node(VmRegion* r) {
+    return r->tree_state_;
+}
+
+const VmRegionTree::NodeState& VmRegionTree::node(const VmRegion* r) {
+    return r->tree_state_;
+}
+
+// unmapped space between r and the region before it, or the bottom of the
+// address space if there is none
+size_t VmRegionTree::GapBefore(const VmRegion* r) const {
+    const VmRegion* prev = Prev(r);
+    vaddr_t start = prev ? prev->base() + prev->size() : base_;
+
+    DEBUG_ASSERT(r->base() >= start);
+    return r->base() - start;
+}
+
+void VmRegionTree::Recompute(VmRegion* r) {
+    NodeState& n = node(r);
+
+    size_t max_gap = n.gap_;
+    if (n.left_)
+        max_gap = MAX(max_gap, node(n.left_).max_gap_);
+    if (n.right_)
+        max_gap = MAX(max_gap, node(n.right_).max_gap_);
+    n.max_gap_ = max_gap;
+}
+
+void VmRegionTree::RecomputeToRoot(VmRegion* r) {
+    for (; r; r = node(r).parent_)
+        Recompute(r);
+}
+
+// rotations only change the subtrees of the two nodes involved, so fix up
+// their max gaps on the spot
+void VmRegionTree::RotateLeft(VmRegion* x) {
+    VmRegion* y = node(x).right_;
+
+    node(x).right_ = node(y).left_;
+    if (node(y).left_)
+        node(node(y).left_).parent_ = x;
+    Transplant(x, y);
+    node(y).left_ = x;
+    node(x).parent_ = y;
+
+    Recompute(x);
+    Recompute(y);
+}
+
+void VmRegionTree::RotateRight(VmRegion* x) {
+    VmRegion* y = node(x).left_;
+
+    node(x).left_ = node(y).right_;
+    if (node(y).right_)
+        node(node(y).right_).parent_ = x;
+    Transplant(x, y);
+    node(y).right_ = x;
+    node(x).parent_ = y;
+
+    Recompute(x);
+    Recompute(y);
+}
+
+// replace the subtree rooted at u with the one rooted at v in u's parent
+void VmRegionTree::Transplant(VmRegion* u, VmRegion* v) {
+    VmRegion* parent = node(u).parent_;
+
+    if (!parent)
+        root_ = v;
+    else if (u == node(parent).left_)
+        node(parent).left_ = v;
+    else
+        node(parent).right_ = v;
+
+    if (v)
+        node(v).parent_ = parent;
+}
+
+void VmRegionTree::Insert(VmRegion* r) {
+    DEBUG_ASSERT(r->size() > 0);
+
+    NodeState& n = node(r);
+    DEBUG_ASSERT(!n.parent_ && !n.left_ && !n.right_ && root_ != r);
+
+    VmRegion* parent = nullptr;
+    VmRegion** link = &root_;
+    while (*link) {
+        parent = *link;
+        link = (r->base() < parent->base()) ? &node(parent).left_ : &node(parent).right_;
+    }
+
+    n.parent_ = parent;
+    n.left_ = n.right_ = nullptr;
+    n.red_ = true;
+    *link = r;
+
+    n.gap_ = GapBefore(r);
+    n.max_gap_ = n.gap_;
+    RecomputeToRoot(parent);
+
+    // the region above us now has a smaller gap below it
+    VmRegion* next = Next(r);
+    if (next) {
+        node(next).gap_ = GapBefore(next);
+        RecomputeToRoot(next);
+    }
+
+    InsertFixup(r);
+}
+
+void VmRegionTree::InsertFixup(VmRegion* z) {
+    while (IsRed(node(z).parent_)) {
+        VmRegion* p = node(z).parent_;
+        VmRegion* g = node(p).parent_;
+
+        if (p == node(g).left_) {
+            VmRegion* u = node(g).right_;
+            if (IsRed(u)) {
+                node(p).red_ = false;
+                node(u).red_ = false;
+                node(g).red_ = true;
+                z = g;
+            } else {
+                if (z == node(p).right_) {
+                    z = p;
+                    RotateLeft(z);
+                    p = node(z).parent_;
+                }
+                node(p).red_ = false;
+                node(g).red_ = true;
+                RotateRight(g);
+            }
+        } else {
+            VmRegion* u = node(g).left_;
+            if (IsRed(u)) {
+                node(p).red_ = false;
+                node(u).red_ = false;
+                node(g).red_ = true;
+                z = g;
+            } else {
+                if (z == node(p).left_) {
+                    z = p;
+                    RotateRight(z);
+                    p = node(z).parent_;
+                }
+                node(p).red_ = false;
+                node(g).red_ = true;
+                RotateLeft(g);
+            }
+        }
+    }
+
+    node(root_).red_ = false;
+}
+
+void VmRegionTree::Erase(VmRegion* z) {
+    DEBUG_ASSERT(node(z).parent_ || root_ == z);
+
+    // the region above z will have a bigger gap below it once z is gone
+    VmRegion* next = Next(z);
+
+    VmRegion* x;
+    VmRegion* x_parent;
+    bool removed_red = node(z).red_;
+
+    if (!node(z).left_) {
+        x = node(z).right_;
+        x_parent = node(z).parent_;
+        Transplant(z, x);
+    } else if (!node(z).right_) {
+        x = node(z).left_;
+        x_parent = node(z).parent_;
+        Transplant(z, x);
+    } else {
+        // splice z's successor into its place
+        VmRegion* y = node(z).right_;
+        while (node(y).left_)
+            y = node(y).left_;
+
+        removed_red = node(y).red_;
+        x = node(y).right_;
+        if (node(y).parent_ == z) {
+            x_parent = y;
+        } else {
+            x_parent = node(y).parent_;
+            Transplant(y, x);
+            node(y).right_ = node(z).right_;
+            node(node(y).right_).parent_ = y;
+        }
+        Transplant(z, y);
+        node(y).left_ = node(z).left_;
+        node(node(y).left_).parent_ = y;
+        node(y).red_ = node(z).red_;
+    }
+
+    node(z) = NodeState();
+
+    RecomputeToRoot(x_parent);
+    if (next) {
+        node(next).gap_ = GapBefore(next);
+        RecomputeToRoot(next);
+    }
+
+    if (!removed_red)
+        EraseFixup(x, x_parent);
+}
+
+void VmRegionTree::EraseFixup(VmRegion* x, VmRegion* parent) {
+    while (x != root_ && !IsRed(x)) {
+        if (x == node(parent).left_) {
+            VmRegion* w = node(parent).right_;
+            if (IsRed(w)) {
+                node(w).red_ = false;
+                node(parent).red_ = true;
+                RotateLeft(parent);
+                w = node(parent).right_;
+            }
+            if (!IsRed(node(w).left_) && !IsRed(node(w).right_)) {
+                node(w).red_ = true;
+                x = parent;
+                parent = node(x).parent_;
+            } else {
+                if (!IsRed(node(w).right_)) {
+                    node(node(w).left_).red_ = false;
+                    node(w).red_ = true;
+                    RotateRight(w);
+                    w = node(parent).right_;
+                }
+                node(w).red_ = node(parent).red_;
+                node(parent).red_ = false;
+                node(node(w).right_).red_ = false;
+                RotateLeft(parent);
+                x = root_;
+            }
+        } else {
+            VmRegion* w = node(parent).left_;
+            if (IsRed(w)) {
+                node(w).red_ = false;
+                node(parent).red_ = true;
+                RotateRight(parent);
+                w = node(parent).left_;
+            }
+            if (!IsRed(node(w).left_) && !IsRed(node(w).right_)) {
+                node(w).red_ = true;
+                x = parent;
+                parent = node(x).parent_;
+            } else {
+                if (!IsRed(node(w).left_)) {
+                    node(node(w).right_).red_ = false;
+                    node(w).red_ = true;
+                    RotateLeft(w);
+                    w = node(parent).left_;
+                }
+                node(w).red_ = node(parent).red_;
+                node(parent).red_ = false;
+                node(node(w).left_).red_ = false;
+                RotateRight(parent);
+                x = root_;
+            }
+        }
+    }
+
+    if (x)
+        node(x).red_ = false;
+}
+
+VmRegion* VmRegionTree::Find(vaddr_t va) const {
+    VmRegion* r = root_;
+    while (r) {
+        if (va < r->base())
+            r = node(r).left_;
+        else if (va > r->base() + r->size() - 1)
+            r = node(r).right_;
+        else
+            return r;
+    }
+    return nullptr;
+}
+
+VmRegion* VmRegionTree::UpperBound(vaddr_t va) const {
+    VmRegion* r = root_;
+    VmRegion* result = nullptr;
+    while (r) {
+        if (r->base() > va) {
+            result = r;
+            r = node(r).left_;
+        } else {
+            r = node(r).right_;
+        }
+    }
+    return result;
+}
+
+VmRegion* VmRegionTree::FindGap(VmRegion* n, vaddr_t va, size_t size) {
+    if (!n || node(n).max_gap_ < size)
+        return nullptr;
+
+    if (n->base() >= va) {
+        VmRegion* r = FindGap(node(n).left_, va, size);
+        if (r)
+            return r;
+        if (node(n).gap_ >= size)
+            return n;
+    }
+
+    return FindGap(node(n).right_, va, size);
+}
+
+VmRegion* VmRegionTree::FindGap(vaddr_t va, size_t size) const {
+    return FindGap(root_, va, size);
+}
+
+VmRegion* VmRegionTree::Prev(const VmRegion* r) const {
+    VmRegion* n = node(r).left_;
+    if (n) {
+        while (node(n).right_)
+            n = node(n).right_;
+        return n;
+    }
+
+    n = node(r).parent_;
+    while (n && r == node(n).left_) {
+        r = n;
+        n = node(n).parent_;
+    }
+    return n;
+}
+
+VmRegion* VmRegionTree::Next(const VmRegion* r) const {
+    VmRegion* n = node(r).right_;
+    if (n) {
+        while (node(n).left_)
+            n = node(n).left_;
+        return n;
+    }
+
+    n = node(r).parent_;
+    while (n && r == node(n).right_) {
+        r = n;
+        n = node(n).parent_;
+    }
+    return n;
+}
+
+VmRegion* VmRegionTree::Last() const {
+    VmRegion* r = root_;
+    if (!r)
+        return nullptr;
+    while (node(r).right_)
+        r = node(r).right_;
+    return r;
+}
@@ -7,9 +7,12 @@
 #include <app/tests.h>
 #include <assert.h>
 #include <err.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <kernel/vm/vm_page_list.h>
+#include <kernel/vm/vm_page_store.h>
 #include <kernel/vm/vm_region.h>
 #include <new.h>
 #include <unittest.h>
@@ -64,6 +67,31 @@ static bool pmm_tests(void* context) {
         EXPECT_EQ(count, ret, "pmm_free_page on a list of pages");
     }
 
+    // allocate an aligned contiguous run, check it, then free it
+    unittest_printf("allocating an aligned contiguous run, then freeing it\n");
+    {
+        list_node list = LIST_INITIAL_VALUE(list);
+
+        static const size_t alloc_count = 37;
+        static const uint8_t alignment_log2 = 20;  // 1MB
+
+        paddr_t pa;
+        auto count = pmm_alloc_contiguous(alloc_count, 0, alignment_log2, &pa, &list);
+        EXPECT_EQ(alloc_count, count, "pmm_alloc_contiguous count");
+        EXPECT_EQ(alloc_count, list_length(&list), "pmm_alloc_contiguous list count");
+        EXPECT_TRUE(IS_ALIGNED(pa, 1UL << alignment_log2), "pmm_alloc_contiguous alignment");
+
+        paddr_t expected = pa;
+        vm_page_t* p;
+        list_for_every_entry (&list, p, vm_page_t, node) {
+            EXPECT_EQ(expected, vm_page_to_paddr(p), "pmm_alloc_contiguous run is contiguous");
+            expected += PAGE_SIZE;
+        }
+
+        auto ret = pmm_free(&list);
+        EXPECT_EQ(alloc_count, ret, "pmm_free on a contiguous run");
+    }
+
     unittest_printf("done with pmm tests\n");
     END_TEST;
 }
@@ -268,6 +296,53 @@ static bool vmm_tests(void* context) {
         aspace.reset();
     }
 
+    unittest_printf("allocating many regions, freeing every other one, then filling the holes\n");
+    {
+        auto aspace = VmAspace::Create(0, "test aspace3");
+
+        static const size_t count = 64;
+        void* ptrs[count];
+        for (size_t i = 0; i < count; i++) {
+            auto err = aspace->Alloc("test", PAGE_SIZE, &ptrs[i], 0, 0, 0);
+            EXPECT_EQ(NO_ERROR, err, "allocating region\n");
+        }
+        for (size_t i = 0; i < count; i++) {
+            auto r = aspace->FindRegion((vaddr_t)ptrs[i]);
+            EXPECT_TRUE(r && r->base() == (vaddr_t)ptrs[i], "finding region\n");
+        }
+
+        for (size_t i = 0; i < count; i += 2) {
+            auto err = aspace->FreeRegion((vaddr_t)ptrs[i]);
+            EXPECT_EQ(NO_ERROR, err, "freeing region\n");
+            EXPECT_FALSE(aspace->FindRegion((vaddr_t)ptrs[i]), "region is gone\n");
+        }
+
+        // a two page region doesn't fit in any of the one page holes
+        void* big;
+        auto err = aspace->Alloc("test", 2 * PAGE_SIZE, &big, 0, 0, 0);
+        EXPECT_EQ(NO_ERROR, err, "allocating region\n");
+        auto r = aspace->FindRegion((vaddr_t)big + PAGE_SIZE);
+        EXPECT_TRUE(r && r->base() == (vaddr_t)big, "two page region is intact\n");
+        for (size_t i = 1; i < count; i += 2) {
+            r = aspace->FindRegion((vaddr_t)ptrs[i]);
+            EXPECT_TRUE(r && r->base() == (vaddr_t)ptrs[i], "finding region\n");
+        }
+
+        // but a one page region does
+        void* small;
+        err = aspace->Alloc("test", PAGE_SIZE, &small, 0, 0, 0);
+        EXPECT_EQ(NO_ERROR, err, "allocating region\n");
+        bool in_hole = false;
+        for (size_t i = 0; i < count; i += 2) {
+            if (small == ptrs[i])
+                in_hole = true;
+        }
+        EXPECT_TRUE(in_hole, "one page region reuses a hole\n");
+
+        aspace->Destroy();
+        aspace.reset();
+    }
+
     unittest_printf("verify there are no test aspaces left around\n");
     DumpAllAspaces();
 
@@ -275,6 +350,23 @@ static bool vmm_tests(void* context) {
     END_TEST;
 }
 
+static const size_t kFaultThreads = 4;
+static const size_t kFaultPages = 64;
+
+// write the thread's own byte into every page of the shared object, faulting the pages in as it
+// goes, racing the other threads doing the same
+static int fault_thread(void* arg) {
+    auto vmo = static_cast<VmObject*>(arg);
+    uint8_t b = static_cast<uint8_t>(get_current_thread()->name[0]);
+
+    for (size_t i = 0; i < kFaultPages; i++) {
+        size_t written;
+        if (vmo->Write(&b, i * PAGE_SIZE + (b - 'a'), 1, &written) != NO_ERROR || written != 1)
+            return -1;
+    }
+    return 0;
+}
+
 static bool vmm_object_tests(void* context) {
     BEGIN_TEST;
     unittest_printf("creating vm object\n");
@@ -458,6 +550,175 @@ static bool vmm_object_tests(void* context) {
         EXPECT_EQ(NO_ERROR, ret, "unmapping object");
     }
 
+    unittest_printf("creating large page vm object, mapping it, demand paged\n");
+    {
+        static const size_t alloc_size = VmObject::LARGE_PAGE_SIZE * 2 + PAGE_SIZE * 3;
+        auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, alloc_size, VmObject::CREATE_LARGE_PAGES);
+        EXPECT_TRUE(vmo, "vmobject creation\n");
+
+        auto ka = VmAspace::kernel_aspace();
+        void* ptr;
+        auto ret = ka->MapObject(vmo, "test", 0, alloc_size, &ptr, 0, 0, PMM_ALLOC_FLAG_ANY);
+        EXPECT_EQ(NO_ERROR, ret, "mapping object");
+        EXPECT_TRUE(IS_ALIGNED(ptr, VmObject::LARGE_PAGE_SIZE), "large page alignment");
+
+        // fill with known pattern and test
+        if (!fill_and_test(ptr, alloc_size))
+            all_ok = false;
+
+        // chunks backed by a single run have to be mapped to the run, whatever the page size
+        for (uint64_t o = 0; o + VmObject::LARGE_PAGE_SIZE <= alloc_size;
+             o += VmObject::LARGE_PAGE_SIZE) {
+            paddr_t run;
+            if (!vmo->GetLargePage(o, &run))
+                continue;
+
+            for (size_t i = 0; i < VmObject::LARGE_PAGE_SIZE; i += PAGE_SIZE) {
+                paddr_t pa;
+                uint flags;
+                auto err = arch_mmu_query(&ka->arch_aspace(), (vaddr_t)ptr + o + i, &pa, &flags);
+                EXPECT_EQ(NO_ERROR, err, "querying large page mapping");
+                EXPECT_EQ(run + i, pa, "large page mapping address");
+            }
+        }
+
+        auto err = ka->FreeRegion((vaddr_t)ptr);
+        EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    }
+
+    unittest_printf("decommitting a mapped vm object\n");
+    {
+        static const size_t alloc_size = PAGE_SIZE * 4;
+
+        auto vmo = VmObject::Create(0, alloc_size);
+        EXPECT_TRUE(vmo, "vmobject creation\n");
+
+        auto ka = VmAspace::kernel_aspace();
+        uint8_t* ptr;
+        auto err = ka->MapObject(vmo, "test", 0, alloc_size, (void**)&ptr, 0, VMM_FLAG_COMMIT,
+                                 PMM_ALLOC_FLAG_ANY);
+        EXPECT_EQ(NO_ERROR, err, "mapping object");
+        memset(ptr, 0x99, alloc_size);
+
+        // only whole pages inside the range go
+        auto ret = vmo->DecommitRange(PAGE_SIZE - 1, PAGE_SIZE * 2 + 2);
+        EXPECT_EQ((int64_t)PAGE_SIZE * 2, ret, "decommitting range");
+        EXPECT_EQ(nullptr, vmo->GetPage(PAGE_SIZE), "decommitted page");
+        EXPECT_EQ(nullptr, vmo->GetPage(PAGE_SIZE * 2), "decommitted page");
+        EXPECT_NEQ(nullptr, vmo->GetPage(0), "page before range");
+        EXPECT_NEQ(nullptr, vmo->GetPage(PAGE_SIZE * 3), "page after range");
+
+        // and they've been pulled out of the mapping too
+        paddr_t pa;
+        uint flags;
+        err = arch_mmu_query(&ka->arch_aspace(), (vaddr_t)ptr + PAGE_SIZE, &pa, &flags);
+        EXPECT_NEQ(NO_ERROR, err, "decommitted page unmapped");
+        err = arch_mmu_query(&ka->arch_aspace(), (vaddr_t)ptr, &pa, &flags);
+        EXPECT_EQ(NO_ERROR, err, "page before range still mapped");
+
+        // reading it back gets fresh pages
+        uint8_t b = 0x99;
+        size_t bytes_read;
+        err = vmo->Read(&b, PAGE_SIZE * 2, 1, &bytes_read);
+        EXPECT_EQ(NO_ERROR, err, "reading from object");
+        EXPECT_EQ(0u, b, "decommitted page reads back zero");
+        EXPECT_EQ(0x99u, ptr[PAGE_SIZE * 3], "page after range kept");
+
+        // a second time there's nothing left to free
+        ret = vmo->DecommitRange(PAGE_SIZE, PAGE_SIZE);
+        EXPECT_EQ(0, ret, "decommitting empty range");
+        ret = vmo->DecommitRange(alloc_size, PAGE_SIZE);
+        EXPECT_EQ(ERR_OUT_OF_RANGE, ret, "decommitting out of range");
+
+        err = ka->FreeRegion((vaddr_t)ptr);
+        EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    }
+
+    unittest_printf("taking pages from one vm object into a mapped one\n");
+    {
+        static const size_t alloc_size = PAGE_SIZE * 4;
+
+        auto src = VmObject::Create(0, PAGE_SIZE * 2);
+        EXPECT_TRUE(src, "vmobject creation\n");
+        auto vmo = VmObject::Create(0, alloc_size);
+        EXPECT_TRUE(vmo, "vmobject creation\n");
+
+        // src has to have every page
+        auto err = vmo->TakePages(src.get(), 0, PAGE_SIZE, PAGE_SIZE * 2);
+        EXPECT_EQ(ERR_NOT_FOUND, err, "taking missing pages");
+
+        auto ka = VmAspace::kernel_aspace();
+        uint8_t* ptr;
+        err = ka->MapObject(vmo, "test", 0, alloc_size, (void**)&ptr, 0, VMM_FLAG_COMMIT,
+                            PMM_ALLOC_FLAG_ANY);
+        EXPECT_EQ(NO_ERROR, err, "mapping object");
+        memset(ptr, 0x99, alloc_size);
+
+        static uint8_t buf[PAGE_SIZE * 2];
+        memset(buf, 0x42, sizeof(buf));
+        size_t bytes_written;
+        err = src->Write(buf, 0, sizeof(buf), &bytes_written);
+        EXPECT_EQ(NO_ERROR, err, "writing to object");
+        vm_page_t* p = src->GetPage(0);
+
+        err = vmo->TakePages(src.get(), 0, PAGE_SIZE - 1, PAGE_SIZE * 2);
+        EXPECT_EQ(ERR_INVALID_ARGS, err, "unaligned offset");
+        err = vmo->TakePages(src.get(), 0, PAGE_SIZE * 3, PAGE_SIZE * 2);
+        EXPECT_EQ(ERR_OUT_OF_RANGE, err, "past the end");
+
+        err = vmo->TakePages(src.get(), 0, PAGE_SIZE, PAGE_SIZE * 2);
+        EXPECT_EQ(NO_ERROR, err, "taking pages");
+        EXPECT_EQ(p, vmo->GetPage(PAGE_SIZE), "page moved over");
+        EXPECT_EQ(nullptr, src->GetPage(0), "page gone from src");
+
+        // the mapping faults the new pages in, and the rest stays as it was
+        EXPECT_EQ(0x99u, ptr[PAGE_SIZE - 1], "page before range kept");
+        EXPECT_EQ(0x42u, ptr[PAGE_SIZE], "new page mapped");
+        EXPECT_EQ(0x42u, ptr[PAGE_SIZE * 3 - 1], "new page mapped");
+        EXPECT_EQ(0x99u, ptr[PAGE_SIZE * 3], "page after range kept");
+
+        err = ka->FreeRegion((vaddr_t)ptr);
+        EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    }
+
+    unittest_printf("faulting in a vm object from several threads\n");
+    {
+        auto vmo = VmObject::Create(0, kFaultPages * PAGE_SIZE);
+        EXPECT_TRUE(vmo, "vmobject creation\n");
+
+        thread_t* threads[kFaultThreads];
+        for (size_t i = 0; i < kFaultThreads; i++) {
+            char name[] = {static_cast<char>('a' + i), 0};
+            threads[i] = thread_create(name, &fault_thread, vmo.get(), DEFAULT_PRIORITY,
+                                       DEFAULT_STACK_SIZE);
+            EXPECT_NEQ(nullptr, threads[i], "creating thread");
+        }
+        for (size_t i = 0; i < kFaultThreads; i++) {
+            if (threads[i])
+                thread_resume(threads[i]);
+        }
+        for (size_t i = 0; i < kFaultThreads; i++) {
+            int ret = -1;
+            if (threads[i])
+                thread_join(threads[i], &ret, INFINITE_TIME);
+            EXPECT_EQ(0, ret, "faulting thread");
+        }
+
+        // every thread's write has to land in the one page that ended up in the object
+        bool all_present = true;
+        for (size_t i = 0; i < kFaultPages; i++) {
+            uint8_t buf[kFaultThreads];
+            size_t bytes_read;
+            status_t err = vmo->Read(buf, i * PAGE_SIZE, sizeof(buf), &bytes_read);
+            EXPECT_EQ(NO_ERROR, err, "reading from object");
+            for (size_t t = 0; t < kFaultThreads; t++) {
+                if (buf[t] != 'a' + t)
+                    all_present = false;
+            }
+        }
+        EXPECT_TRUE(all_present, "racing faults");
+    }
+
     unittest_printf("creating vm object, writing to it\n");
     {
         static const size_t alloc_size = PAGE_SIZE * 16;
@@ -558,8 +819,180 @@ static bool vmm_object_tests(void* context) {
     END_TEST;
 }
 
+static bool vm_page_list_tests(void* context) {
+    BEGIN_TEST;
+
+    // the list never touches the pages, so any unique pointers will do
+    static vm_page_t pages[8];
+    static const size_t indices[] = {
+        0, 1, 63, 64, 4097, 1ul << 20, (1ul << 31) + 5, SIZE_MAX / PAGE_SIZE,
+    };
+    static_assert(countof(pages) == countof(indices), "");
+
+    VmPageList list;
+    EXPECT_TRUE(list.is_empty(), "new list is empty");
+
+    // insert out of order so the tree has to grow above existing pages
+    for (size_t i = countof(indices); i-- > 0;) {
+        EXPECT_EQ(NO_ERROR, list.Insert(indices[i], &pages[i]), "inserting page");
+    }
+    EXPECT_EQ(countof(pages), list.count(), "page count");
+    EXPECT_EQ(ERR_ALREADY_EXISTS, list.Insert(indices[3], &pages[0]), "inserting duplicate");
+
+    for (size_t i = 0; i < countof(indices); i++) {
+        EXPECT_EQ(&pages[i], list.Lookup(indices[i]), "looking up page");
+    }
+    EXPECT_EQ(nullptr, list.Lookup(2), "looking up hole");
+    EXPECT_EQ(nullptr, list.Lookup(4096), "looking up hole");
+
+    // iteration is in index order and respects the range
+    size_t next = 0;
+    bool in_order = true;
+    list.ForEveryPage([&](size_t index, vm_page_t* p) {
+        if (next >= countof(indices) || indices[next] != index || &pages[next] != p)
+            in_order = false;
+        next++;
+        return NO_ERROR;
+    });
+    EXPECT_TRUE(in_order, "iteration order");
+    EXPECT_EQ(countof(indices), next, "iterated every page");
+
+    size_t in_range = 0;
+    list.ForEveryPageInRange(63, 4098, [&](size_t index, vm_page_t* p) {
+        in_range++;
+        return NO_ERROR;
+    });
+    EXPECT_EQ(3u, in_range, "iterating a range");
+
+    // removal frees up the slot again
+    EXPECT_EQ(&pages[4], list.Remove(indices[4]), "removing page");
+    EXPECT_EQ(nullptr, list.Remove(indices[4]), "removing missing page");
+    EXPECT_EQ(nullptr, list.Lookup(indices[4]), "looking up removed page");
+    EXPECT_EQ(countof(pages) - 1, list.count(), "page count after remove");
+
+    size_t removed = 0;
+    list.RemovePagesInRange(1, 4098, [&](size_t index, vm_page_t* p) { removed++; });
+    EXPECT_EQ(3u, removed, "removing a range");
+    EXPECT_EQ(&pages[0], list.Lookup(indices[0]), "page before range kept");
+    EXPECT_EQ(nullptr, list.Lookup(indices[2]), "page in range removed");
+    EXPECT_EQ(&pages[5], list.Lookup(indices[5]), "page after range kept");
+
+    removed = 0;
+    list.RemoveAllPages([&](size_t index, vm_page_t* p) { removed++; });
+    EXPECT_EQ(countof(pages) - 4, removed, "removing all pages");
+    EXPECT_TRUE(list.is_empty(), "list is empty");
+
+    END_TEST;
+}
+
+static bool vm_page_store_tests(void* context) {
+    BEGIN_TEST;
+
+    paddr_t pa;
+    vm_page_t* page = pmm_alloc_page(PMM_ALLOC_FLAG_KMAP, &pa);
+    REQUIRE_NEQ(nullptr, page, "allocating page");
+    vm_page_t* copy = pmm_alloc_page(PMM_ALLOC_FLAG_KMAP, nullptr);
+    REQUIRE_NEQ(nullptr, copy, "allocating page");
+    uint8_t* ptr = static_cast<uint8_t*>(paddr_to_kvaddr(pa));
+    uint8_t* copy_ptr = static_cast<uint8_t*>(paddr_to_kvaddr(vm_page_to_paddr(copy)));
+
+    unittest_printf("compressing a page of zeroes\n");
+    {
+        memset(ptr, 0, PAGE_SIZE);
+        VmCompressedPage* c = VmPageStore::Compress(page);
+        EXPECT_NEQ(nullptr, c, "zero page compressed");
+        if (c) {
+            EXPECT_EQ(0u, VmPageStore::StoredSize(c), "zero pages take no heap");
+            memset(copy_ptr, 0xff, PAGE_SIZE);
+            VmPageStore::Decompress(c, copy);
+            EXPECT_EQ(0, memcmp(ptr, copy_ptr, PAGE_SIZE), "zero page round trip");
+            VmPageStore::Free(c);
+        }
+    }
+
+    unittest_printf("compressing a repetitive page\n");
+    {
+        for (size_t i = 0; i < PAGE_SIZE; i++)
+            ptr[i] = static_cast<uint8_t>((i % 13 == 0) ? i / 13 : 'a' + i % 5);
+        VmCompressedPage* c = VmPageStore::Compress(page);
+        EXPECT_NEQ(nullptr, c, "page compressed");
+        if (c) {
+            EXPECT_LT(VmPageStore::StoredSize(c), static_cast<size_t>(PAGE_SIZE / 2), "page shrank");
+            memset(copy_ptr, 0, PAGE_SIZE);
+            VmPageStore::Decompress(c, copy);
+            EXPECT_EQ(0, memcmp(ptr, copy_ptr, PAGE_SIZE), "page round trip");
+            VmPageStore::Free(c);
+        }
+    }
+
+    unittest_printf("rejecting a page that doesn't compress\n");
+    {
+        uint32_t x = 12345;
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            x = x * 1103515245 + 12345;
+            ptr[i] = static_cast<uint8_t>(x >> 24);
+        }
+        VmCompressedPage* c = VmPageStore::Compress(page);
+        EXPECT_EQ(nullptr, c, "random page rejected");
+        if (c)
+            VmPageStore::Free(c);
+    }
+
+    pmm_free_page(page);
+    pmm_free_page(copy);
+
+    // objects are only scanned with the store enabled at boot
+    if (VmPageStore::enabled()) {
+        unittest_printf("compressing the idle pages of an object\n");
+
+        static const size_t count = 8;
+        auto vmo = VmObject::Create(0, count * PAGE_SIZE);
+        REQUIRE_TRUE(vmo, "vmobject creation");
+
+        static uint8_t buf[PAGE_SIZE];
+        for (size_t i = 0; i < count; i++) {
+            memset(buf, static_cast<int>('a' + i), sizeof(buf));
+            size_t bytes_written;
+            EXPECT_EQ(NO_ERROR, vmo->Write(buf, i * PAGE_SIZE, sizeof(buf), &bytes_written),
+                      "writing to object");
+        }
+
+        // the first scan marks the pages idle, the second takes them
+        VmPageStore::ScanObjects();
+        VmPageStore::ScanObjects();
+
+        size_t pages, bytes;
+        vmo->GetCompressedCount(&pages, &bytes);
+        EXPECT_EQ(count, pages, "idle pages compressed");
+        EXPECT_EQ(0u, vmo->CommittedPageCount(), "pages freed");
+
+        // reading faults them back in
+        bool intact = true;
+        for (size_t i = 0; i < count; i++) {
+            size_t bytes_read;
+            EXPECT_EQ(NO_ERROR, vmo->Read(buf, i * PAGE_SIZE, sizeof(buf), &bytes_read),
+                      "reading from object");
+            if (buf[0] != 'a' + i || buf[PAGE_SIZE - 1] != 'a' + i)
+                intact = false;
+        }
+        EXPECT_TRUE(intact, "contents kept");
+        vmo->GetCompressedCount(&pages, &bytes);
+        EXPECT_EQ(0u, pages, "pages decompressed");
+
+        // opting out keeps them
+        EXPECT_EQ(NO_ERROR, vmo->SetCompressible(false), "opting out");
+        VmPageStore::ScanObjects();
+        VmPageStore::ScanObjects();
+        EXPECT_EQ(count, vmo->CommittedPageCount(), "opted out pages kept");
+    }
+
+    END_TEST;
+}
+
 UNITTEST_START_TESTCASE(vm_tests)
 UNITTEST("pmm tests", pmm_tests)
 UNITTEST("vmm tests", vmm_tests)
 UNITTEST("vm object based test", vmm_object_tests)
+UNITTEST("vm page list tests", vm_page_list_tests)
+UNITTEST("vm page store tests", vm_page_store_tests)
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", NULL, NULL);
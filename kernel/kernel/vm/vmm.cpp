@@ -14,6 +14,9 @@
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_region.h>
 #include <lib/console.h>
+#if WITH_LIB_KTRACE
+#include <lib/ktrace.h>
+#endif
 #include <string.h>
 #include <trace.h>
 
@@ -150,6 +153,9 @@ status_t vmm_page_fault_handler(vaddr_t addr, uint flags) {
     TRACEF("thread %s va 0x%lx, flags 0x%x\n", current_thread->name, addr,
            flags);
 #endif
+#if WITH_LIB_KTRACE
+    ktrace(MX_KTRACE_TAG_PAGE_FAULT, flags, addr);
+#endif
 
     // get the address space object this pointer is in
     VmAspace* aspace = vmm_aspace_to_obj(vaddr_to_aspace((void*)addr));
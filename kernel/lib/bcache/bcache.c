@@ -11,17 +11,42 @@
 #include <string.h>
 #include <sys/types.h>
 #include <debug.h>
+#include <err.h>
 #include <trace.h>
+#include <arch/ops.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <platform.h>
 #include <lib/bcache.h>
 #include <lib/bio.h>
 
 #define LOCAL_TRACE 0
 
+/* Blocks are spread over shards, each with its own lock, hash table and lru,
+ * so callers working on different parts of the device don't contend. Runs of
+ * RUN_BLOCKS consecutive blocks land in the same shard so the write-back
+ * thread can coalesce them into one write. */
+#define NUM_SHARDS      8
+#define NUM_BUCKETS     64
+#define RUN_BLOCKS      8
+
+/* largest read-ahead, in blocks. The window doubles on each sequential miss. */
+#define READAHEAD_MAX   16
+
+/* the write-back thread wakes this often, and writes blocks that have been
+ * dirty for longer than DIRTY_AGE_MAX, or everything once more than half the
+ * cache is dirty */
+#define WRITEBACK_PERIOD    1000 /* ms */
+#define DIRTY_AGE_MAX       5000 /* ms */
+
 struct bcache_block {
-    struct list_node node;
+    struct list_node node;      /* on the shard's free or lru list */
+    struct list_node hash_node; /* on a hash bucket, while it holds a block */
     bnum_t blocknum;
     int ref_count;
     bool is_dirty;
+    lk_time_t dirty_time;
     void *ptr;
 };
 
@@ -31,69 +56,269 @@ struct bcache_stats {
     uint32_t misses;
     uint32_t reads;
     uint32_t writes;
+    uint32_t readaheads;
 };
 
+struct bcache_shard {
+    mutex_t lock;
+
+    struct list_node free_list;
+    struct list_node lru_list;
+    struct list_node buckets[NUM_BUCKETS];
+
+    struct bcache_stats stats;
+} __CPU_ALIGN;
+
 struct bcache {
     bdev_t *dev;
     size_t block_size;
     int count;
-    struct bcache_stats stats;
-
-    struct list_node free_list;
-    struct list_node lru_list;
 
+    struct bcache_shard shards[NUM_SHARDS];
     struct bcache_block *blocks;
+
+    /* the last block accessed, to spot sequential readers. Updated without a
+     * lock; a race only costs a read-ahead. */
+    volatile bnum_t last_block;
+    volatile uint ra_window;
+
+    /* guards ra_buf, used to read a whole read-ahead window at once */
+    mutex_t ra_lock;
+    void *ra_buf;
+
+    /* guards wb_buf, used to write a run of dirty blocks at once */
+    mutex_t wb_lock;
+    void *wb_buf;
+
+    volatile int dirty_count;
+    event_t writeback_event;
+    thread_t *writeback_thread;
+    volatile bool stopping;
 };
 
+static inline struct bcache_shard *block_shard(struct bcache *cache, bnum_t blocknum)
+{
+    return &cache->shards[(blocknum / RUN_BLOCKS) % NUM_SHARDS];
+}
+
+static inline struct list_node *block_bucket(struct bcache_shard *shard, bnum_t blocknum)
+{
+    return &shard->buckets[((blocknum / RUN_BLOCKS / NUM_SHARDS) * RUN_BLOCKS +
+                            blocknum % RUN_BLOCKS) % NUM_BUCKETS];
+}
+
+static int bcache_writeback_thread(void *arg);
+
 bcache_t bcache_create(bdev_t *dev, size_t block_size, int block_count)
 {
     struct bcache *cache;
 
-    cache = malloc(sizeof(struct bcache));
+    cache = memalign(CACHE_LINE, sizeof(struct bcache));
+    if (!cache)
+        return NULL;
+    memset(cache, 0, sizeof(struct bcache));
 
     cache->dev = dev;
     cache->block_size = block_size;
     cache->count = block_count;
-    memset(&cache->stats, 0, sizeof(cache->stats));
+    cache->last_block = (bnum_t)-1;
+
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        struct bcache_shard *shard = &cache->shards[i];
+
+        mutex_init(&shard->lock);
+        list_initialize(&shard->free_list);
+        list_initialize(&shard->lru_list);
+        for (int j = 0; j < NUM_BUCKETS; j++)
+            list_initialize(&shard->buckets[j]);
+    }
 
-    list_initialize(&cache->free_list);
-    list_initialize(&cache->lru_list);
+    mutex_init(&cache->ra_lock);
+    mutex_init(&cache->wb_lock);
+    event_init(&cache->writeback_event, false, EVENT_FLAG_AUTOUNSIGNAL);
 
+    cache->ra_buf = malloc(block_size * READAHEAD_MAX);
+    cache->wb_buf = malloc(block_size * RUN_BLOCKS);
     cache->blocks = malloc(sizeof(struct bcache_block) * block_count);
+    if (!cache->ra_buf || !cache->wb_buf || !cache->blocks)
+        goto err;
+
     int i;
     for (i=0; i < block_count; i++) {
         cache->blocks[i].ref_count = 0;
         cache->blocks[i].is_dirty = false;
         cache->blocks[i].ptr = malloc(block_size);
-        // add to the free list
-        list_add_head(&cache->free_list, &cache->blocks[i].node);
+        if (!cache->blocks[i].ptr)
+            goto err_blocks;
+        // deal the blocks out to the shards' free lists
+        list_add_head(&cache->shards[i % NUM_SHARDS].free_list, &cache->blocks[i].node);
     }
 
+    cache->writeback_thread = thread_create("bcache writeback", bcache_writeback_thread, cache,
+                                            LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!cache->writeback_thread)
+        goto err_blocks;
+    thread_resume(cache->writeback_thread);
+
     return (bcache_t)cache;
+
+err_blocks:
+    while (i-- > 0)
+        free(cache->blocks[i].ptr);
+err:
+    free(cache->blocks);
+    free(cache->wb_buf);
+    free(cache->ra_buf);
+    free(cache);
+    return NULL;
 }
 
-static int flush_block(struct bcache *cache, struct bcache_block *block)
+/* look a block up in its shard's hash, with the shard locked */
+static struct bcache_block *lookup_block(struct bcache_shard *shard, bnum_t blocknum, uint32_t *depth)
 {
+    struct bcache_block *block;
+
+    list_for_every_entry(block_bucket(shard, blocknum), block, struct bcache_block, hash_node) {
+        if (depth)
+            (*depth)++;
+        if (block->blocknum == blocknum)
+            return block;
+    }
+
+    return NULL;
+}
+
+/* find a block if it's already present, and move it to the tail of the lru */
+static struct bcache_block *find_block(struct bcache_shard *shard, bnum_t blocknum)
+{
+    uint32_t depth = 0;
+
+    LTRACEF("num %u\n", blocknum);
+
+    struct bcache_block *block = lookup_block(shard, blocknum, &depth);
+    if (block) {
+        list_delete(&block->node);
+        list_add_tail(&shard->lru_list, &block->node);
+        shard->stats.hits++;
+        shard->stats.depth += depth;
+        return block;
+    }
+
+    shard->stats.misses++;
+    return NULL;
+}
+
+static void set_clean(struct bcache *cache, struct bcache_block *block)
+{
+    if (block->is_dirty) {
+        block->is_dirty = false;
+        atomic_add(&cache->dirty_count, -1);
+    }
+}
+
+static void set_dirty(struct bcache *cache, struct bcache_block *block)
+{
+    if (!block->is_dirty) {
+        block->is_dirty = true;
+        block->dirty_time = current_time();
+        if (atomic_add(&cache->dirty_count, 1) + 1 > cache->count / 2)
+            event_signal(&cache->writeback_event, false);
+    }
+}
+
+/* write the block along with any dirty neighbors in its run, with the
+ * shard locked */
+static int flush_block(struct bcache *cache, struct bcache_shard *shard, struct bcache_block *block)
+{
+    bnum_t run_start = ROUNDDOWN(block->blocknum, RUN_BLOCKS);
+    bnum_t first = block->blocknum;
+    bnum_t last = block->blocknum;
+    struct bcache_block *b;
     int rc;
 
-    rc = bio_write(cache->dev, block->ptr,
-                   (off_t)block->blocknum * cache->block_size,
-                   cache->block_size);
+    while (first > run_start && (b = lookup_block(shard, first - 1, NULL)) && b->is_dirty)
+        first--;
+    while (last + 1 < run_start + RUN_BLOCKS && (b = lookup_block(shard, last + 1, NULL)) && b->is_dirty)
+        last++;
+
+    if (first == last) {
+        rc = bio_write(cache->dev, block->ptr,
+                       (off_t)block->blocknum * cache->block_size,
+                       cache->block_size);
+    } else {
+        mutex_acquire(&cache->wb_lock);
+        for (bnum_t n = first; n <= last; n++) {
+            b = lookup_block(shard, n, NULL);
+            memcpy((uint8_t *)cache->wb_buf + (n - first) * cache->block_size, b->ptr, cache->block_size);
+        }
+        rc = bio_write(cache->dev, cache->wb_buf,
+                       (off_t)first * cache->block_size,
+                       (last - first + 1) * cache->block_size);
+        mutex_release(&cache->wb_lock);
+    }
     if (rc < 0)
         goto exit;
 
-    block->is_dirty = false;
-    cache->stats.writes++;
+    for (bnum_t n = first; n <= last; n++)
+        set_clean(cache, lookup_block(shard, n, NULL));
+    shard->stats.writes++;
     rc = 0;
 exit:
     return (rc);
 }
 
+/* write the shard's blocks that have been dirty longer than DIRTY_AGE_MAX,
+ * or all its dirty blocks with force */
+static int flush_shard(struct bcache *cache, struct bcache_shard *shard, bool force, lk_time_t now)
+{
+    struct bcache_block *block;
+    int err = 0;
+
+    mutex_acquire(&shard->lock);
+    list_for_every_entry(&shard->lru_list, block, struct bcache_block, node) {
+        if (block->is_dirty && (force || now - block->dirty_time >= DIRTY_AGE_MAX)) {
+            err = flush_block(cache, shard, block);
+            if (err)
+                break;
+        }
+    }
+    mutex_release(&shard->lock);
+
+    return err;
+}
+
+static int bcache_writeback_thread(void *arg)
+{
+    struct bcache *cache = arg;
+
+    for (;;) {
+        event_wait_timeout(&cache->writeback_event, WRITEBACK_PERIOD, false);
+        if (cache->stopping)
+            break;
+
+        bool force = cache->dirty_count > cache->count / 2;
+        lk_time_t now = current_time();
+        for (int i = 0; i < NUM_SHARDS; i++) {
+            int err = flush_shard(cache, &cache->shards[i], force, now);
+            if (err)
+                TRACEF("error %d writing back blocks\n", err);
+        }
+    }
+
+    return 0;
+}
+
 void bcache_destroy(bcache_t _cache)
 {
     struct bcache *cache = _cache;
     int i;
 
+    cache->stopping = true;
+    event_signal(&cache->writeback_event, true);
+    thread_join(cache->writeback_thread, NULL, INFINITE_TIME);
+
+    bcache_flush(cache);
+
     for (i=0; i < cache->count; i++) {
         DEBUG_ASSERT(cache->blocks[i].ref_count == 0);
 
@@ -104,63 +329,48 @@ void bcache_destroy(bcache_t _cache)
         free(cache->blocks[i].ptr);
     }
 
-    free(cache);
-}
-
-/* find a block if it's already present */
-static struct bcache_block *find_block(struct bcache *cache, uint blocknum)
-{
-    uint32_t depth = 0;
-    struct bcache_block *block;
-
-    LTRACEF("num %u\n", blocknum);
-
-    block = NULL;
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
-        LTRACEF("looking at entry %p, num %u\n", block, block->blocknum);
-        depth++;
-
-        if (block->blocknum == blocknum) {
-            list_delete(&block->node);
-            list_add_tail(&cache->lru_list, &block->node);
-            cache->stats.hits++;
-            cache->stats.depth += depth;
-            return block;
-        }
-    }
+    for (i = 0; i < NUM_SHARDS; i++)
+        mutex_destroy(&cache->shards[i].lock);
+    mutex_destroy(&cache->ra_lock);
+    mutex_destroy(&cache->wb_lock);
+    event_destroy(&cache->writeback_event);
 
-    cache->stats.misses++;
-    return NULL;
+    free(cache->blocks);
+    free(cache->wb_buf);
+    free(cache->ra_buf);
+    free(cache);
 }
 
-/* allocate a new block */
-static struct bcache_block *alloc_block(struct bcache *cache)
+/* allocate a new block, with the shard locked. It's on the lru but not yet
+ * in the hash. */
+static struct bcache_block *alloc_block(struct bcache *cache, struct bcache_shard *shard)
 {
     int err;
     struct bcache_block *block;
 
     /* pop one off the free list if it's present */
-    block = list_remove_head_type(&cache->free_list, struct bcache_block, node);
+    block = list_remove_head_type(&shard->free_list, struct bcache_block, node);
     if (block) {
         block->ref_count = 0;
-        list_add_tail(&cache->lru_list, &block->node);
+        list_add_tail(&shard->lru_list, &block->node);
         LTRACEF("found block %p on free list\n", block);
         return block;
     }
 
     /* walk the lru, looking for a free block */
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
+    list_for_every_entry(&shard->lru_list, block, struct bcache_block, node) {
         LTRACEF("looking at %p, num %u\n", block, block->blocknum);
         if (block->ref_count == 0) {
             if (block->is_dirty) {
-                err = flush_block(cache, block);
+                err = flush_block(cache, shard, block);
                 if (err)
                     return NULL;
             }
 
-            // add it to the tail of the lru
+            // take it out of the hash and add it to the tail of the lru
+            list_delete(&block->hash_node);
             list_delete(&block->node);
-            list_add_tail(&cache->lru_list, &block->node);
+            list_add_tail(&shard->lru_list, &block->node);
             return block;
         }
     }
@@ -168,34 +378,114 @@ static struct bcache_block *alloc_block(struct bcache *cache)
     return NULL;
 }
 
+/* give a block back to the free list after failing to fill it */
+static void free_block(struct bcache_shard *shard, struct bcache_block *block)
+{
+    list_delete(&block->node);
+    list_add_tail(&shard->free_list, &block->node);
+}
+
+static void insert_block(struct bcache_shard *shard, struct bcache_block *block, bnum_t blocknum)
+{
+    block->blocknum = blocknum;
+    list_add_head(block_bucket(shard, blocknum), &block->hash_node);
+}
+
+/* decide how far to read ahead on a miss of blocknum */
+static uint readahead_window(struct bcache *cache, bnum_t blocknum)
+{
+    uint window = 1;
+
+    if (blocknum == cache->last_block + 1)
+        window = MIN(MAX(cache->ra_window * 2, 2u), READAHEAD_MAX);
+    cache->ra_window = window;
+
+    return MIN(window, cache->dev->block_count - blocknum);
+}
+
+/* read window blocks from blocknum with one request, and cache the ones that
+ * aren't already */
+static void readahead(struct bcache *cache, bnum_t blocknum, uint window)
+{
+    LTRACEF("block %u, window %u\n", blocknum, window);
+
+    mutex_acquire(&cache->ra_lock);
+
+    ssize_t err = bio_read(cache->dev, cache->ra_buf,
+                           (off_t)blocknum * cache->block_size, window * cache->block_size);
+    if (err < (ssize_t)(window * cache->block_size))
+        goto exit;
+
+    for (uint i = 0; i < window; i++) {
+        bnum_t n = blocknum + i;
+        struct bcache_shard *shard = block_shard(cache, n);
+
+        mutex_acquire(&shard->lock);
+        if (!lookup_block(shard, n, NULL)) {
+            struct bcache_block *block = alloc_block(cache, shard);
+            if (block) {
+                memcpy(block->ptr, (uint8_t *)cache->ra_buf + i * cache->block_size, cache->block_size);
+                insert_block(shard, block, n);
+                shard->stats.reads++;
+            }
+        }
+        if (i == 0)
+            shard->stats.readaheads++;
+        mutex_release(&shard->lock);
+    }
+
+exit:
+    mutex_release(&cache->ra_lock);
+}
+
+/* returns the block with its shard locked, or NULL with it unlocked */
 static struct bcache_block *find_or_fill_block(struct bcache *cache, uint blocknum)
 {
     int err;
+    struct bcache_shard *shard = block_shard(cache, blocknum);
 
     LTRACEF("block %u\n", blocknum);
 
     /* see if it's already in the cache */
-    struct bcache_block *block = find_block(cache, blocknum);
+    mutex_acquire(&shard->lock);
+    struct bcache_block *block = find_block(shard, blocknum);
     if (block == NULL) {
         LTRACEF("wasn't allocated\n");
 
+        /* a sequential reader gets the next few blocks read along with this one */
+        uint window = readahead_window(cache, blocknum);
+        if (window > 1) {
+            mutex_release(&shard->lock);
+            readahead(cache, blocknum, window);
+            mutex_acquire(&shard->lock);
+
+            block = lookup_block(shard, blocknum, NULL);
+        }
+    }
+    if (block == NULL) {
         /* allocate a new block and fill it */
-        block = alloc_block(cache);
-        DEBUG_ASSERT(block);
+        block = alloc_block(cache, shard);
+        if (block == NULL) {
+            mutex_release(&shard->lock);
+            return NULL;
+        }
 
         LTRACEF("wasn't allocated, new block %p\n", block);
 
-        block->blocknum = blocknum;
         err = bio_read(cache->dev, block->ptr, (off_t)blocknum * cache->block_size, cache->block_size);
         if (err < 0) {
             /* free the block, return an error */
-            list_add_tail(&cache->free_list, &block->node);
+            free_block(shard, block);
+            mutex_release(&shard->lock);
             return NULL;
         }
+        insert_block(shard, block, blocknum);
 
-        cache->stats.reads++;
+        shard->stats.reads++;
     }
 
+    cache->last_block = blocknum;
+
     DEBUG_ASSERT(block->blocknum == blocknum);
 
     return block;
@@ -214,6 +504,7 @@ int bcache_read_block(bcache_t _cache, void *buf, uint blocknum)
     }
 
     memcpy(buf, block->ptr, cache->block_size);
+    mutex_release(&block_shard(cache, blocknum)->lock);
     return 0;
 }
 
@@ -234,6 +525,7 @@ int bcache_get_block(bcache_t _cache, void **ptr, uint blocknum)
     /* increment the ref count to keep it from being freed */
     block->ref_count++;
     *ptr = block->ptr;
+    mutex_release(&block_shard(cache, blocknum)->lock);
 
     return 0;
 }
@@ -241,16 +533,19 @@ int bcache_get_block(bcache_t _cache, void **ptr, uint blocknum)
 int bcache_put_block(bcache_t _cache, uint blocknum)
 {
     struct bcache *cache = _cache;
+    struct bcache_shard *shard = block_shard(cache, blocknum);
 
     LTRACEF("blocknum %u\n", blocknum);
 
-    struct bcache_block *block = find_block(cache, blocknum);
+    mutex_acquire(&shard->lock);
+    struct bcache_block *block = find_block(shard, blocknum);
 
     /* be pretty hard on the caller for now */
     DEBUG_ASSERT(block);
     DEBUG_ASSERT(block->ref_count > 0);
 
     block->ref_count--;
+    mutex_release(&shard->lock);
 
     return 0;
 }
@@ -259,17 +554,20 @@ int bcache_mark_block_dirty(bcache_t priv, uint blocknum)
 {
     int err;
     struct bcache *cache = priv;
+    struct bcache_shard *shard = block_shard(cache, blocknum);
     struct bcache_block *block;
 
-    block = find_block(cache, blocknum);
+    mutex_acquire(&shard->lock);
+    block = find_block(shard, blocknum);
     if (!block) {
         err = -1;
         goto exit;
     }
 
-    block->is_dirty = true;
+    set_dirty(cache, block);
     err = 0;
 exit:
+    mutex_release(&shard->lock);
     return (err);
 }
 
@@ -277,59 +575,71 @@ int bcache_zero_block(bcache_t priv, uint blocknum)
 {
     int err;
     struct bcache *cache = priv;
+    struct bcache_shard *shard = block_shard(cache, blocknum);
     struct bcache_block *block;
 
-    block = find_block(cache, blocknum);
+    mutex_acquire(&shard->lock);
+    block = find_block(shard, blocknum);
     if (!block) {
-        block = alloc_block(cache);
+        block = alloc_block(cache, shard);
         if (!block) {
             err = -1;
             goto exit;
         }
 
-        block->blocknum = blocknum;
+        insert_block(shard, block, blocknum);
     }
 
     memset(block->ptr, 0, cache->block_size);
-    block->is_dirty = true;
+    set_dirty(cache, block);
     err = 0;
 exit:
+    mutex_release(&shard->lock);
     return (err);
 }
 
 int bcache_flush(bcache_t priv)
 {
-    int err;
     struct bcache *cache = priv;
-    struct bcache_block *block;
+    lk_time_t now = current_time();
 
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
-        if (block->is_dirty) {
-            err = flush_block(cache, block);
-            if (err)
-                goto exit;
-        }
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        int err = flush_shard(cache, &cache->shards[i], true, now);
+        if (err)
+            return err;
     }
 
-    err = 0;
-exit:
-    return (err);
+    return 0;
 }
 
 void bcache_dump(bcache_t priv, const char *name)
 {
     uint32_t finds;
     struct bcache *cache = priv;
+    struct bcache_stats stats = { 0 };
+
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        struct bcache_stats *s = &cache->shards[i].stats;
+
+        stats.hits += s->hits;
+        stats.depth += s->depth;
+        stats.misses += s->misses;
+        stats.reads += s->reads;
+        stats.writes += s->writes;
+        stats.readaheads += s->readaheads;
+    }
 
-    finds = cache->stats.hits + cache->stats.misses;
+    finds = stats.hits + stats.misses;
 
-    printf("%s: hits=%u(%u%%) depth=%u misses=%u(%u%%) reads=%u writes=%u\n",
+    printf("%s: hits=%u(%u%%) depth=%u misses=%u(%u%%) reads=%u writes=%u readaheads=%u dirty=%d\n",
            name,
-           cache->stats.hits,
-           finds ? (cache->stats.hits * 100) / finds : 0,
-           cache->stats.hits ? cache->stats.depth / cache->stats.hits : 0,
-           cache->stats.misses,
-           finds ? (cache->stats.misses * 100) / finds : 0,
-           cache->stats.reads,
-           cache->stats.writes);
+           stats.hits,
+           finds ? (stats.hits * 100) / finds : 0,
+           stats.hits ? stats.depth / stats.hits : 0,
+           stats.misses,
+           finds ? (stats.misses * 100) / finds : 0,
+           stats.reads,
+           stats.writes,
+           stats.readaheads,
+           cache->dirty_count);
 }
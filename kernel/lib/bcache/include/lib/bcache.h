@@ -11,6 +11,10 @@
 
 typedef void *bcache_t;
 
+// The cache may be used from several threads at once. Dirty blocks are
+// written back by a thread of the cache's own after they've aged a few
+// seconds, or sooner once half the cache is dirty, and sequential reads are
+// served by reading ahead.
 bcache_t bcache_create(bdev_t *dev, size_t block_size, int block_count);
 void bcache_destroy(bcache_t);
 
@@ -20,3 +24,10 @@ int bcache_read_block(bcache_t, void *, uint block);
 int bcache_get_block(bcache_t, void **, uint block);
 int bcache_put_block(bcache_t, uint block);
 
+int bcache_mark_block_dirty(bcache_t, uint block);
+int bcache_zero_block(bcache_t, uint block);
+
+// write all dirty blocks now
+int bcache_flush(bcache_t);
+
+void bcache_dump(bcache_t, const char *name);
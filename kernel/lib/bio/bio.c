@@ -282,6 +282,18 @@ static ssize_t bio_default_write_block(struct bdev *dev, const void *buf, bnum_t
     return ERR_NOT_SUPPORTED;
 }
 
+/* default implementation completes the request synchronously with the block hooks */
+static status_t bio_default_submit(struct bdev *dev, bio_request_t *req)
+{
+    if (req->write)
+        req->result = dev->write_block(dev, req->buf, req->block, req->count);
+    else
+        req->result = dev->read_block(dev, req->buf, req->block, req->count);
+
+    req->callback(req);
+    return NO_ERROR;
+}
+
 static void bdev_inc_ref(bdev_t *dev)
 {
     LTRACEF("Add ref \"%s\" %d -> %d\n", dev->name, dev->ref, dev->ref + 1);
@@ -439,6 +451,26 @@ ssize_t bio_erase(bdev_t *dev, off_t offset, size_t len)
     return dev->erase(dev, offset, len);
 }
 
+status_t bio_submit(bdev_t *dev, bio_request_t *req)
+{
+    LTRACEF("dev '%s', %s buf %p, block %u, count %u\n", dev->name,
+            req->write ? "write" : "read", req->buf, req->block, req->count);
+
+    DEBUG_ASSERT(dev && dev->ref > 0);
+    DEBUG_ASSERT(req->buf);
+    DEBUG_ASSERT(req->callback);
+
+    /* range check */
+    req->count = bio_trim_block_range(dev, req->block, req->count);
+    if (req->count == 0) {
+        req->result = 0;
+        req->callback(req);
+        return NO_ERROR;
+    }
+
+    return dev->submit(dev, req);
+}
+
 int bio_ioctl(bdev_t *dev, int request, void *argp)
 {
     LTRACEF("dev '%s', request %08x, argp %p\n", dev->name, request, argp);
@@ -523,6 +555,7 @@ void bio_initialize_bdev(bdev_t *dev,
     dev->write = bio_default_write;
     dev->write_block = bio_default_write_block;
     dev->erase = bio_default_erase;
+    dev->submit = bio_default_submit;
     dev->close = NULL;
 }
 
@@ -26,6 +26,28 @@ typedef struct bio_erase_geometry_info {
     size_t erase_shift;
 } bio_erase_geometry_info_t;
 
+struct bio_request;
+typedef void (*bio_callback_t)(struct bio_request *req);
+
+/* An asynchronous block transfer, see bio_submit(). The caller owns the
+ * request again once its callback has been called. */
+typedef struct bio_request {
+    /* filled in by the caller. Layered devices rebase block before passing
+     * the request down, so it isn't meaningful in the callback. */
+    bool write;
+    void *buf;
+    bnum_t block;
+    uint count;
+    bio_callback_t callback;
+    void *cookie;
+
+    /* set before the callback: the bytes transferred, or an error */
+    ssize_t result;
+
+    /* for the device's use while it owns the request */
+    struct list_node node;
+} bio_request_t;
+
 typedef struct bdev {
     struct list_node node;
     volatile int ref;
@@ -51,6 +73,7 @@ typedef struct bdev {
     ssize_t (*write)(struct bdev *, const void *buf, off_t offset, size_t len);
     ssize_t (*write_block)(struct bdev *, const void *buf, bnum_t block, uint count);
     ssize_t (*erase)(struct bdev *, off_t offset, size_t len);
+    status_t (*submit)(struct bdev *, bio_request_t *req);
     int (*ioctl)(struct bdev *, int request, void *argp);
     void (*close)(struct bdev *);
 } bdev_t;
@@ -65,6 +88,14 @@ ssize_t bio_write_block(bdev_t *dev, const void *buf, bnum_t block, uint count);
 ssize_t bio_erase(bdev_t *dev, off_t offset, size_t len);
 int bio_ioctl(bdev_t *dev, int request, void *argp);
 
+/* Start the transfer in req and return without waiting for it, so a caller
+ * can have several in flight on devices that queue them. req's callback is
+ * called once with req->result set, possibly from interrupt context and
+ * possibly before bio_submit returns, so it must not block. Returns an
+ * error, without calling the callback, if the request can't be started.
+ * Devices without a submit hook complete the request synchronously. */
+status_t bio_submit(bdev_t *dev, bio_request_t *req);
+
 /* register a block device */
 void bio_register_device(bdev_t *dev);
 void bio_unregister_device(bdev_t *dev);
@@ -63,6 +63,14 @@ static ssize_t subdev_erase(struct bdev *_dev, off_t offset, size_t len)
     return bio_erase(subdev->parent, offset + subdev->offset * subdev->dev.block_size, len);
 }
 
+static status_t subdev_submit(struct bdev *_dev, bio_request_t *req)
+{
+    subdev_t *subdev = (subdev_t *)_dev;
+
+    req->block += subdev->offset;
+    return bio_submit(subdev->parent, req);
+}
+
 static void subdev_close(struct bdev *_dev)
 {
     subdev_t *subdev = (subdev_t *)_dev;
@@ -167,6 +175,7 @@ status_t bio_publish_subdevice(const char *parent_dev,
     sub->dev.write = &subdev_write;
     sub->dev.write_block = &subdev_write_block;
     sub->dev.erase = &subdev_erase;
+    sub->dev.submit = &subdev_submit;
     sub->dev.close = &subdev_close;
 
     bio_register_device(&sub->dev);
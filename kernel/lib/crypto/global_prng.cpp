@@ -6,14 +6,18 @@
 
 #include <lib/crypto/global_prng.h>
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <dev/hw_rng.h>
 #include <err.h>
 #include <kernel/auto_lock.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <lib/crypto/cryptolib.h>
 #include <lib/crypto/prng.h>
 #include <new.h>
 #include <lk/init.h>
+#include <string.h>
 
 namespace crypto {
 
@@ -23,19 +27,97 @@ PRNG* GetInstance() {
     static PRNG* global_prng = nullptr;
     static mutex_t lock = MUTEX_INITIAL_VALUE(lock);
 
+    // Only the first callers, before the instance is published, take the lock.
+    PRNG* prng = __atomic_load_n(&global_prng, __ATOMIC_ACQUIRE);
+    if (likely(prng))
+        return prng;
+
     AllocChecker ac;
 
     AutoLock guard(lock);
     if (unlikely(!global_prng)) {
-        global_prng = new (&ac) PRNG(nullptr, 0);
+        prng = new (&ac) PRNG(nullptr, 0);
         ASSERT(ac.check());
+        __atomic_store_n(&global_prng, prng, __ATOMIC_RELEASE);
     }
     return global_prng;
 }
 
-static void EarlyBootSeed(uint level) {
-    PRNG* prng = GetInstance();
+namespace {
+
+// Each cpu draws from its own generator, seeded from the global instance,
+// so concurrent draws on different cpus don't contend. A cpu's generator
+// takes a fresh seed after kReseedBytes of output, and after any entropy
+// is added to the global instance.
+constexpr uint64_t kReseedBytes = 64 * 1024;
+constexpr int kSeedSize = static_cast<int>(PRNG::kMinEntropy);
+
+struct CpuPRNG {
+    spin_lock_t lock;
+    clPRNG_CTX ctx;
+    bool seeded;
+    uint64_t drawn;
+    uint64_t generation;
+} __CPU_ALIGN;
+
+CpuPRNG cpu_prngs[SMP_MAX_CPUS];
+
+// Bumped whenever entropy is added to the global instance.
+uint64_t entropy_generation;
+
+} // namespace
+
+void Draw(void* out, int size) {
+    DEBUG_ASSERT(size >= 0);
+
+    uint8_t seed[kSeedSize];
+    bool have_seed = false;
+    uint64_t seed_generation = 0;
+
+    for (;;) {
+        CpuPRNG* c = &cpu_prngs[arch_curr_cpu_num()];
 
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&c->lock, state);
+
+        uint64_t generation = __atomic_load_n(&entropy_generation, __ATOMIC_ACQUIRE);
+        bool fresh = c->seeded && c->drawn < kReseedBytes && c->generation == generation;
+        if (fresh || have_seed) {
+            if (!fresh) {
+                // we may have moved cpus since drawing the seed, but it's as
+                // good a seed for this cpu as for the last one
+                if (c->seeded) {
+                    clPRNG_entropy(&c->ctx, seed, sizeof(seed));
+                } else {
+                    clPRNG_init(&c->ctx, seed, sizeof(seed));
+                    c->seeded = true;
+                }
+                c->drawn = 0;
+                c->generation = seed_generation;
+            }
+            clPRNG_draw(&c->ctx, out, size);
+            c->drawn += size;
+            spin_unlock_irqrestore(&c->lock, state);
+            break;
+        }
+        spin_unlock_irqrestore(&c->lock, state);
+
+        // Drawing from the global instance can block until it has enough
+        // entropy, so it happens with no per-cpu lock held.
+        seed_generation = __atomic_load_n(&entropy_generation, __ATOMIC_ACQUIRE);
+        GetInstance()->Draw(seed, sizeof(seed));
+        have_seed = true;
+    }
+
+    memset(seed, 0, sizeof(seed));
+}
+
+void AddEntropy(const void* data, int size) {
+    GetInstance()->AddEntropy(data, size);
+    __atomic_add_fetch(&entropy_generation, 1, __ATOMIC_RELEASE);
+}
+
+static void EarlyBootSeed(uint level) {
     uint8_t buf[32] = {0};
     // TODO(security): Have the PRNG reseed based on usage
     size_t fetched = 0;
@@ -53,11 +135,11 @@ static void EarlyBootSeed(uint level) {
         // hardware that we should remove and attempt to do better.  If this
         // fallback is used, it breaks all cryptography used on the system.
         // *CRITICAL*
-        prng->AddEntropy(buf, sizeof(buf));
+        AddEntropy(buf, sizeof(buf));
         return;
     }
     DEBUG_ASSERT(fetched == sizeof(buf));
-    prng->AddEntropy(buf, static_cast<int>(fetched));
+    AddEntropy(buf, static_cast<int>(fetched));
 }
 
 } //namespace GlobalPRNG
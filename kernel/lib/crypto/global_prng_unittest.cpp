@@ -7,6 +7,7 @@
 #include <lib/crypto/global_prng.h>
 
 #include <stdint.h>
+#include <string.h>
 #include <unittest.h>
 
 namespace crypto {
@@ -24,12 +25,36 @@ bool identical(void*) {
     END_TEST;
 }
 
+bool per_cpu_draw(void*) {
+    BEGIN_TEST;
+
+    static const int kDrawSize = 13;
+
+    uint8_t out1[kDrawSize];
+    uint8_t out2[kDrawSize];
+    GlobalPRNG::Draw(out1, sizeof(out1));
+    GlobalPRNG::Draw(out2, sizeof(out2));
+
+    // As in the PRNG tests, kDrawSize is large enough that identical
+    // output means the generator isn't advancing.
+    EXPECT_NEQ(0, memcmp(out1, out2, sizeof(out1)), "global prng output is constant");
+
+    // Adding entropy forces a reseed, after which output still differs.
+    static const char kEntropy[32] = {'a', 'b', 'c'};
+    GlobalPRNG::AddEntropy(kEntropy, sizeof(kEntropy));
+    GlobalPRNG::Draw(out1, sizeof(out1));
+    EXPECT_NEQ(0, memcmp(out1, out2, sizeof(out1)), "global prng output is constant");
+
+    END_TEST;
+}
+
 } // namespace
 
 UNITTEST_START_TESTCASE(global_prng_tests)
 UNITTEST("Identical", identical)
+UNITTEST("PerCpuDraw", per_cpu_draw)
 UNITTEST_END_TESTCASE(global_prng_tests, "global_prng",
-                      "Validate global PRNG singleton",
+                      "Validate global PRNG singleton and per-cpu draws",
                       NULL, NULL);
 
 } // namespace crypto
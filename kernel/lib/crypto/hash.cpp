@@ -9,11 +9,19 @@
 #include <assert.h>
 #include <debug.h>
 #include <lib/crypto/cryptolib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256_arch.h"
 
 namespace crypto {
 
+namespace {
+constexpr size_t kBlockSize = 64;
+} // namespace
+
 Hash256::Hash256()
-    : digest_(0) {
+    : blocks_(Sha256ArchBlocks()), digest_(0) {
 #if LK_DEBUGLEVEL > 0
     finalized_ = false;
 #endif
@@ -30,7 +38,12 @@ Hash256::~Hash256() {}
 
 void Hash256::Update(const void* data, int len) {
     DEBUG_ASSERT(!finalized_);
-    clHASH_update(&ctx_, data, len);
+    DEBUG_ASSERT(len >= 0);
+    if (blocks_) {
+        UpdateBlocks(static_cast<const uint8_t*>(data), len);
+    } else {
+        clHASH_update(&ctx_, data, len);
+    }
 }
 
 void Hash256::Final() {
@@ -39,7 +52,64 @@ void Hash256::Final() {
     finalized_ = true;
 #endif
 
-    digest_ = clHASH_final(&ctx_);
+    if (blocks_) {
+        FinalBlocks();
+    } else {
+        digest_ = clHASH_final(&ctx_);
+    }
+}
+
+// Keeps the same ctx_ fields as cryptolib: a partial block in buf, the total
+// length in count and the hash words in state. Whole blocks are hashed in
+// place rather than copied through buf.
+void Hash256::UpdateBlocks(const uint8_t* data, size_t len) {
+    size_t used = ctx_.count % kBlockSize;
+    ctx_.count += len;
+
+    if (used) {
+        size_t n = MIN(kBlockSize - used, len);
+        memcpy(ctx_.buf + used, data, n);
+        data += n;
+        len -= n;
+        if (used + n < kBlockSize)
+            return;
+        blocks_(ctx_.state, ctx_.buf, 1);
+    }
+
+    size_t blocks = len / kBlockSize;
+    if (blocks) {
+        blocks_(ctx_.state, data, blocks);
+        data += blocks * kBlockSize;
+        len -= blocks * kBlockSize;
+    }
+
+    memcpy(ctx_.buf, data, len);
+}
+
+void Hash256::FinalBlocks() {
+    uint64_t bits = ctx_.count * 8;
+
+    // a one bit, then zeros up to 8 bytes short of a block boundary
+    static const uint8_t kPad[kBlockSize] = {0x80};
+    size_t used = ctx_.count % kBlockSize;
+    size_t pad = (used < kBlockSize - 8 ? kBlockSize - 8 : 2 * kBlockSize - 8) - used;
+    UpdateBlocks(kPad, pad);
+
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++)
+        length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+    UpdateBlocks(length, sizeof(length));
+    DEBUG_ASSERT(ctx_.count % kBlockSize == 0);
+
+    uint8_t* p = ctx_.buf;
+    for (int i = 0; i < 8; i++) {
+        uint32_t word = ctx_.state[i];
+        *p++ = static_cast<uint8_t>(word >> 24);
+        *p++ = static_cast<uint8_t>(word >> 16);
+        *p++ = static_cast<uint8_t>(word >> 8);
+        *p++ = static_cast<uint8_t>(word);
+    }
+    digest_ = ctx_.buf;
 }
 
 } // namespace crypto
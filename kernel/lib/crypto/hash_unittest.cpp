@@ -5,6 +5,8 @@
 // https://opensource.org/licenses/MIT
 
 #include <lib/crypto/hash.h>
+#include <lib/crypto/cryptolib.h>
+#include <string.h>
 #include <unittest.h>
 
 namespace crypto {
@@ -89,11 +91,63 @@ bool compute_hashes(void*) {
     END_TEST;
 }
 
+// The accelerated paths buffer partial blocks and pad the message
+// themselves, so check they agree with cryptolib on lengths and update
+// splits around block boundaries.
+bool matches_portable(void*) {
+    BEGIN_TEST;
+
+    static const int kMaxSize = 300;
+    uint8_t data[kMaxSize];
+    for (int i = 0; i < kMaxSize; i++)
+        data[i] = static_cast<uint8_t>(i * 7 + 3);
+
+    for (int size = 0; size < kMaxSize; size++) {
+        uint8_t expected[clSHA256_DIGEST_SIZE];
+        clSHA256(data, size, expected);
+
+        for (int split = 0; split <= size; split += 13) {
+            Hash256 hash;
+            hash.Update(data, split);
+            hash.Update(data + split, size - split);
+            hash.Final();
+            EXPECT_EQ(0, memcmp(expected, hash.digest(), sizeof(expected)),
+                      "hash differs from cryptolib");
+        }
+    }
+
+    END_TEST;
+}
+
+// One million 'a's, from the same NIST examples.
+bool long_message(void*) {
+    BEGIN_TEST;
+
+    static const uint8_t kExpected[Hash256::kHashSize] = {
+        0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7,
+        0xe2, 0x84, 0xd7, 0x3e, 0x67, 0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97,
+        0x20, 0x0e, 0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0};
+
+    char chunk[1000];
+    memset(chunk, 'a', sizeof(chunk));
+
+    Hash256 hash;
+    for (int i = 0; i < 1000; i++)
+        hash.Update(chunk, sizeof(chunk));
+    hash.Final();
+    EXPECT_EQ(0, memcmp(kExpected, hash.digest(), sizeof(kExpected)),
+              "invalid hash of a million a's");
+
+    END_TEST;
+}
+
 } // namespace
 
 UNITTEST_START_TESTCASE(hash256_tests)
 UNITTEST("Instantiate", instantiate)
 UNITTEST("Compute", compute_hashes)
+UNITTEST("MatchesPortable", matches_portable)
+UNITTEST("LongMessage", long_message)
 UNITTEST_END_TESTCASE(hash256_tests, "sha256", "Test SHA256 implementation Tests",
                       NULL, NULL);
 
@@ -16,6 +16,15 @@ namespace GlobalPRNG {
 // guaranteed to be non-null.
 PRNG* GetInstance();
 
+// Get |size| bytes of pseudo-random output from the calling cpu's
+// generator, which is periodically reseeded from the global PRNG. Blocks
+// like PRNG::Draw until the global PRNG has enough entropy.
+void Draw(void* out, int size);
+
+// Add entropy to the global PRNG. Every cpu's generator reseeds from it
+// before its next draw.
+void AddEntropy(const void* data, int size);
+
 } //namespace GlobalPRNG
 
 } // namespace crypto
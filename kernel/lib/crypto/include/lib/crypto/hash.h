@@ -27,6 +27,9 @@ namespace crypto {
 // hash2.Update("bc", 2);
 // hash2.Final();
 // hash2.digest() returns the hash of "abc".
+//
+// Where the cpu has SHA-256 instructions they are used, otherwise this wraps
+// cryptolib's portable SHA-256.
 class Hash256 {
 public:
     static const size_t kHashSize = 256 / 8;
@@ -42,7 +45,12 @@ private:
     Hash256(const Hash256&) = delete;
     Hash256& operator=(const Hash256&) = delete;
 
+    void UpdateBlocks(const uint8_t* data, size_t len);
+    void FinalBlocks();
+
     clSHA256_CTX ctx_;
+    // The accelerated block function, or nullptr to use ctx_'s own
+    void (*blocks_)(uint32_t state[8], const uint8_t* data, size_t blocks);
     const uint8_t* digest_;
 #if LK_DEBUGLEVEL > 0
     bool finalized_;
@@ -15,7 +15,14 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/hash.cpp \
     $(LOCAL_DIR)/hash_unittest.cpp \
     $(LOCAL_DIR)/prng.cpp \
-    $(LOCAL_DIR)/prng_unittest.cpp
+    $(LOCAL_DIR)/prng_unittest.cpp \
+    $(LOCAL_DIR)/sha256_arch.cpp \
+
+ifeq ($(ARCH),arm64)
+MODULE_SRCS += $(LOCAL_DIR)/arch/arm64/sha256-ce.S
+else ifeq ($(SUBARCH),x86-64)
+MODULE_SRCS += $(LOCAL_DIR)/arch/x86-64/sha256-ni.S
+endif
 
 MODULE_DEPS += lib/unittest
 MODULE_DEPS += lib/cryptolib
@@ -0,0 +1,22 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace crypto {
+
+// Runs the SHA-256 compression function over |blocks| 64 byte blocks of
+// |data|, updating |state|, which holds the eight hash words A to H.
+typedef void (*Sha256BlocksFunc)(uint32_t state[8], const uint8_t* data, size_t blocks);
+
+// Returns a block function using this cpu's SHA-256 instructions, or nullptr
+// if it has none and cryptolib's portable code should be used.
+Sha256BlocksFunc Sha256ArchBlocks();
+
+} // namespace crypto
@@ -6,38 +6,82 @@
 
 #include <lib/debuglog.h>
 
+#include <arch/ops.h>
+#include <assert.h>
 #include <err.h>
+#include <kernel/cmdline.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
+#include <lib/dpc.h>
 #include <lib/user_copy.h>
 #include <lk/init.h>
 #include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define DLOG_SIZE (64 * 1024)
+// Default size of each cpu's ring, settable with kernel.dlog-size
+#define DLOG_DEFAULT_SIZE (64 * 1024)
+#define DLOG_MIN_SIZE (4 * 1024)
+#define DLOG_MAX_SIZE (16 * 1024 * 1024)
 
-static uint8_t DLOG_DATA[DLOG_SIZE];
+#define MAX_DATA_SIZE (DLOG_MAX_ENTRY - sizeof(dlog_record_t))
+
+#define ALIGN8(n) (((n) + 7) & (~7))
 
-static dlog_t DLOG = {
-    .lock = MUTEX_INITIAL_VALUE(DLOG.lock),
-    .size = DLOG_SIZE,
-    .data = DLOG_DATA,
-    .readers = LIST_INITIAL_VALUE(DLOG.readers),
+// Every cpu logs into its own ring, so writers never wait for each other.
+// A cpu writes with interrupts disabled, which makes it the only writer of
+// its ring, and readers never write to the rings at all.
+//
+// Offsets in a ring count bytes written since boot and never wrap; the ring
+// index is the offset masked by the size. |head| is the end of the newest
+// complete record and |tail| the start of the oldest one not yet
+// overwritten. Records are contiguous, so they wrap around the end of the
+// ring, headers included.
+//
+// Readers copy a record out and then check that |tail| hasn't moved past
+// it. The writer moves |tail| before it overwrites anything, so a record
+// that passes the check was copied intact.
+struct dlog_ring {
+    uint8_t* data;
+    size_t mask;
+    uint64_t head;
+    uint64_t tail;
+} __CPU_ALIGN;
+
+static struct dlog_ring dlog_rings[SMP_MAX_CPUS];
+
+// Readers are woken from a dpc rather than by the writers, which would
+// need a lock shared by every cpu.
+static mutex_t dlog_readers_lock = MUTEX_INITIAL_VALUE(dlog_readers_lock);
+static struct list_node dlog_readers = LIST_INITIAL_VALUE(dlog_readers);
+static int dlog_notify_pending;
+
+static void dlog_notify(dpc_t* dpc);
+static dpc_t dlog_notify_dpc = {
+    .func = dlog_notify,
 };
 
-#define MAX_DATA_SIZE (DLOG_MAX_ENTRY - sizeof(dlog_record_t))
+static void ring_copy_in(struct dlog_ring* ring, uint64_t off, const void* src, size_t len) {
+    size_t pos = off & ring->mask;
+    size_t n = MIN(len, ring->mask + 1 - pos);
+    memcpy(ring->data + pos, src, n);
+    memcpy(ring->data, (const uint8_t*)src + n, len - n);
+}
 
-#define ALIGN8(n) (((n) + 7) & (~7))
+static void ring_copy_out(const struct dlog_ring* ring, uint64_t off, void* dst, size_t len) {
+    size_t pos = off & ring->mask;
+    size_t n = MIN(len, ring->mask + 1 - pos);
+    memcpy(dst, ring->data + pos, n);
+    memcpy((uint8_t*)dst + n, ring->data, len - n);
+}
 
-#define REC(ptr, off) ((dlog_record_t*)((ptr) + (off)))
+static bool record_is_sane(const dlog_record_t* rec) {
+    return (rec->datalen <= MAX_DATA_SIZE) &&
+           (rec->next == ALIGN8(rec->datalen + sizeof(dlog_record_t)));
+}
 
-// To avoid complexity with splitting record headers, this is
-// a mostly-circular buffer -- each record has a next index
-// that can be used to advance to the next record, allowing the
-// leftover space not large enough for a full record at the end
-// to be skipped easily.
 status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
-    dlog_t* log = &DLOG;
-
     if (arch_ints_disabled()) {
         return ERR_BAD_STATE;
     }
@@ -49,111 +93,214 @@ status_t dlog_write(uint32_t flags, const void* ptr, size_t len) {
     // Keep record headers uint64 aligned
     size_t sz = ALIGN8(len + sizeof(dlog_record_t));
 
-    mutex_acquire(&log->lock);
+    // With interrupts off nothing else can write to this cpu's ring
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-    // Determine location of new record and next record after it
-    uint32_t dst = log->head;
-    uint32_t end = log->head + sz;
-    uint32_t nxt = end;
-    if ((nxt + DLOG_MAX_ENTRY) > log->size) {
-        nxt = 0;
+    struct dlog_ring* ring = &dlog_rings[arch_curr_cpu_num()];
+    if (!__atomic_load_n(&ring->data, __ATOMIC_ACQUIRE)) {
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        return ERR_BAD_STATE;
     }
 
-    // Advance our tail if we write past it.
-    if (log->head != log->tail) {
-        while ((log->tail >= dst) && (log->tail < end)) {
-            log->tail = REC(log->data, log->tail)->next;
-        }
+    uint64_t head = ring->head;
+    uint64_t tail = ring->tail;
+
+    // Retire the oldest records until the new one fits, and publish the
+    // new tail before any of them is overwritten.
+    if (head + sz - tail > ring->mask + 1) {
+        do {
+            dlog_record_t hdr;
+            ring_copy_out(ring, tail, &hdr, sizeof(hdr));
+            tail += hdr.next;
+        } while (head + sz - tail > ring->mask + 1);
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
     }
 
-    // Notify readers and advance their tails if necessary
+    // Write the new record
+    dlog_record_t hdr = {
+        .next = sz,
+        .datalen = len,
+        .flags = flags,
+        .timestamp = current_time_hires() * 1000ULL,
+    };
+    ring_copy_in(ring, head, &hdr, sizeof(hdr));
+    ring_copy_in(ring, head + sizeof(hdr), ptr, len);
+
+    // Advance the head pointer
+    __atomic_store_n(&ring->head, head + sz, __ATOMIC_RELEASE);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Get the readers woken, unless that's on its way already
+    if (!__atomic_exchange_n(&dlog_notify_pending, 1, __ATOMIC_SEQ_CST)) {
+        dpc_queue(&dlog_notify_dpc, false);
+    }
+    return NO_ERROR;
+}
+
+static void dlog_notify(dpc_t* dpc) {
+    // Clear first: a record written after this gets another notification
+    __atomic_store_n(&dlog_notify_pending, 0, __ATOMIC_SEQ_CST);
+
+    mutex_acquire(&dlog_readers_lock);
     dlog_reader_t* rdr;
-    list_for_every_entry (&log->readers, rdr, dlog_reader_t, node) {
-        if (rdr->tail == log->head) {
-            // Reader view was empty, point reader's tail
-            // at the message we're writing now
-            rdr->tail = dst;
-        } else {
-            // If we're about to overwrite the message at
-            // the reader's tail, advance that tail.
-            // This will never cause the reader view to be "empty".
-            while ((rdr->tail >= dst) && (rdr->tail < end)) {
-                rdr->tail = REC(log->data, rdr->tail)->next;
-            }
-        }
+    list_for_every_entry (&dlog_readers, rdr, dlog_reader_t, node) {
         event_signal(&rdr->event, false);
     }
+    mutex_release(&dlog_readers_lock);
+}
 
-    // Write the new record
-    dlog_record_t* rec = REC(log->data, dst);
-    rec->next = nxt;
-    rec->datalen = len;
-    rec->flags = flags;
-    rec->timestamp = current_time_hires() * 1000ULL;
-    memcpy(rec->data, ptr, len);
+// Copy the record at |*off| in |ring| to |rec|, either just its header or,
+// if |whole|, all of it, in which case |rec| must have room for
+// DLOG_MAX_ENTRY bytes. If the records at |*off| have been overwritten
+// |*off| moves up to the oldest one still there. Returns false if there are
+// no records at or after |*off|.
+static bool ring_read(const struct dlog_ring* ring, uint64_t* off, dlog_record_t* rec,
+                      bool whole) {
+    for (;;) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (*off < tail) {
+            *off = tail;
+        }
+        if (*off >= head) {
+            return false;
+        }
 
-    // Advance the head pointer
-    log->head = nxt;
+        ring_copy_out(ring, *off, rec, sizeof(*rec));
+        // a torn header can only come from an overwritten record, which
+        // the check below catches; just don't copy nonsense lengths
+        bool sane = record_is_sane(rec);
+        if (whole && sane) {
+            ring_copy_out(ring, *off + sizeof(*rec), rec->data, rec->datalen);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) <= *off) {
+            DEBUG_ASSERT(sane);
+            return true;
+        }
+        // Overwritten while we were copying it, try again from the new tail
+    }
+}
 
-    mutex_release(&log->lock);
+// Find the ring holding the oldest record |rdr| hasn't read yet.
+// Returns -1 if there is none.
+static int dlog_reader_next(dlog_reader_t* rdr) {
+    int best = -1;
+    uint64_t best_ts = 0;
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        dlog_record_t hdr;
+        if (ring_read(&dlog_rings[cpu], &rdr->tail[cpu], &hdr, false) &&
+            ((best < 0) || (hdr.timestamp < best_ts))) {
+            best = cpu;
+            best_ts = hdr.timestamp;
+        }
+    }
+    return best;
+}
+
+// Unsignal the reader's event if there's nothing left to read. The check is
+// made again afterwards, since a record may have been written, and its
+// notification sent, in between.
+static void dlog_reader_update_event(dlog_reader_t* rdr) {
+    if (dlog_reader_next(rdr) >= 0) {
+        return;
+    }
+    event_unsignal(&rdr->event);
+    if (dlog_reader_next(rdr) >= 0) {
+        event_signal(&rdr->event, false);
+    }
+}
+
+static status_t dlog_copy_out(void* ptr, const void* src, size_t len, bool user) {
+    if (user) {
+        return copy_to_user(ptr, src, len);
+    }
+    memcpy(ptr, src, len);
     return NO_ERROR;
 }
 
-// TODO: support reading multiple messages at a time
+// Records come out in timestamp order across cpus, except that one whose
+// writer was still busy with it when a later one was read comes after it.
+//
+// One record is read at a time and its size returned, unless the flags have
+// DLOG_FLAG_MANY, in which case as many as fit are read, each at the next
+// 8 byte aligned offset after the one before, and their number returned.
 // TODO: filter with flags
 status_t dlog_read_etc(dlog_reader_t* rdr, uint32_t flags, void* ptr, size_t len, bool user) {
-    dlog_t* log = rdr->log;
     status_t r = ERR_BAD_STATE;
-
-    mutex_acquire(&log->lock);
-    if (rdr->tail != log->head) {
-        dlog_record_t* rec = REC(log->data, rdr->tail);
-        size_t copylen = rec->datalen + sizeof(dlog_record_t);
-        if (copylen > len) {
-            r = ERR_NOT_ENOUGH_BUFFER;
-        } else {
-            if (user) {
-                r = copy_to_user(ptr, rec, copylen);
-                if (r == NO_ERROR) {
-                    r = copylen;
-                }
-            } else {
-                memcpy(ptr, rec, copylen);
-                r = copylen;
-            }
-            rdr->tail = rec->next;
-            if (rdr->tail == log->head) {
-                // Nothing left to read, we're in the "empty" state now.
-                event_unsignal(&rdr->event);
+    union {
+        dlog_record_t rec;
+        uint8_t data[DLOG_MAX_ENTRY];
+    } buf;
+    size_t pos = 0;
+    status_t count = 0;
+
+    mutex_acquire(&rdr->lock);
+    int cpu;
+    while ((cpu = dlog_reader_next(rdr)) >= 0) {
+        uint64_t* off = &rdr->tail[cpu];
+        // Only fails if the ring has been emptied, which it never is
+        __UNUSED bool found = ring_read(&dlog_rings[cpu], off, &buf.rec, true);
+        DEBUG_ASSERT(found);
+
+        size_t copylen = buf.rec.datalen + sizeof(dlog_record_t);
+        if (copylen > len - pos) {
+            // what was read already is returned
+            if (count == 0) {
+                r = ERR_NOT_ENOUGH_BUFFER;
             }
+            break;
+        }
+        r = dlog_copy_out((uint8_t*)ptr + pos, &buf, copylen, user);
+        if (r != NO_ERROR) {
+            break;
+        }
+        *off += buf.rec.next;
+        count++;
+
+        if (!(flags & DLOG_FLAG_MANY)) {
+            r = copylen;
+            break;
+        }
+        r = count;
+        pos = ALIGN8(pos + copylen);
+        if (pos >= len) {
+            break;
         }
     }
-    mutex_release(&log->lock);
+    // Nothing left to read puts us in the "empty" state
+    dlog_reader_update_event(rdr);
+    mutex_release(&rdr->lock);
     return r;
 }
 
 void dlog_reader_init(dlog_reader_t* rdr) {
-    dlog_t* log = &DLOG;
-
-    rdr->log = log;
     event_init(&rdr->event, false, 0);
+    mutex_init(&rdr->lock);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        rdr->tail[cpu] = __atomic_load_n(&dlog_rings[cpu].tail, __ATOMIC_ACQUIRE);
+    }
 
-    mutex_acquire(&log->lock);
-    list_add_tail(&log->readers, &rdr->node);
-    rdr->tail = log->tail;
-    if (log->head != log->tail) {
+    mutex_acquire(&dlog_readers_lock);
+    list_add_tail(&dlog_readers, &rdr->node);
+    mutex_release(&dlog_readers_lock);
+
+    if (dlog_reader_next(rdr) >= 0) {
         event_signal(&rdr->event, false);
     }
-    mutex_release(&log->lock);
 }
 
 void dlog_reader_destroy(dlog_reader_t* rdr) {
-    dlog_t* log = rdr->log;
-
-    mutex_acquire(&log->lock);
+    mutex_acquire(&dlog_readers_lock);
     list_delete(&rdr->node);
+    mutex_release(&dlog_readers_lock);
+
     event_destroy(&rdr->event);
-    mutex_release(&log->lock);
+    mutex_destroy(&rdr->lock);
 }
 
 void dlog_wait(dlog_reader_t* rdr) {
@@ -203,7 +350,32 @@ static int debuglog_reader(void* arg) {
     return NO_ERROR;
 }
 
+// Give every cpu its ring. Until then, which is before interrupts are first
+// enabled anyway, writes fail and callers print directly.
+static void dlog_init_rings(void) {
+    size_t size = cmdline_get_uint32("kernel.dlog-size", DLOG_DEFAULT_SIZE);
+    size = MIN(MAX(size, (size_t)DLOG_MIN_SIZE), (size_t)DLOG_MAX_SIZE);
+    // power of two sizes make ring indexes a mask
+    size_t ring_size = DLOG_MIN_SIZE;
+    while (ring_size < size) {
+        ring_size <<= 1;
+    }
+
+    for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+        struct dlog_ring* ring = &dlog_rings[cpu];
+        uint8_t* data = malloc(ring_size);
+        if (!data) {
+            printf("debuglog: no memory for cpu %u's log\n", cpu);
+            continue;
+        }
+        ring->mask = ring_size - 1;
+        __atomic_store_n(&ring->data, data, __ATOMIC_RELEASE);
+    }
+}
+
 static void dlog_init_hook(uint level) {
+    dlog_init_rings();
+
     thread_t* rthread = thread_create("debuglog-reader", debuglog_reader, NULL,
                                       HIGH_PRIORITY - 1, DEFAULT_STACK_SIZE);
     if (rthread) {
@@ -29,33 +29,27 @@ __BEGIN_CDECLS
 #define DLOG_FLAG_MASK      0x0F00
 
 #define DLOG_FLAG_WAIT      0x80000000
+#define DLOG_FLAG_MANY      0x20000000
 
 #define DLOG_MAX_ENTRY      256
 // clang-format on
 
-typedef struct dlog dlog_t;
 typedef struct dlog_record dlog_record_t;
 typedef struct dlog_reader dlog_reader_t;
 
-struct dlog {
-    mutex_t lock;
-
-    uint32_t size;
-    uint32_t head;
-    uint32_t tail;
-    void* data;
-
-    struct list_node readers;
-};
-
+// The log is a ring per cpu, written without locks by the cpu it belongs
+// to. A reader keeps its own place in every ring and merges them by
+// timestamp as it reads.
 struct dlog_reader {
     struct list_node node;
     event_t event;
-    dlog_t* log;
-    uint32_t tail;
+    mutex_t lock;
+    // offset in each cpu's ring of the next record to read
+    uint64_t tail[SMP_MAX_CPUS];
 };
 
 struct dlog_record {
+    // size of the whole record in the log, header included
     uint32_t next;
     uint16_t datalen;
     uint16_t flags;
@@ -75,4 +69,4 @@ static inline status_t dlog_read_user(dlog_reader_t* rdr, uint32_t flags, void*
 }
 void dlog_wait(dlog_reader_t* rdr);
 
-__END_CDECLS
\ No newline at end of file
+__END_CDECLS
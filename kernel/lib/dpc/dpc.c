@@ -8,29 +8,67 @@
 #include <assert.h>
 #include <err.h>
 #include <list.h>
+#include <stdio.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <lk/init.h>
 
-static spin_lock_t dpc_lock = SPIN_LOCK_INITIAL_VALUE;
-static struct list_node dpc_list = LIST_INITIAL_VALUE(dpc_list);
-static event_t dpc_event = EVENT_INITIAL_VALUE(dpc_event, false, 0);
+// Each cpu has its own queue of dpcs and a thread pinned to it to run them,
+// so deferred interrupt work stays on the cpu that took the interrupt and
+// queueing never contends with other cpus. A cpu's queue is set up the first
+// time something is queued on it, so dpcs can be queued before its thread
+// exists; they run once it starts.
+struct dpc_cpu {
+    spin_lock_t lock;
+    struct list_node list;
+    event_t event;
+    bool initialized;
+    thread_t *thread;
+} __CPU_ALIGN;
+
+static struct dpc_cpu dpc_cpus[SMP_MAX_CPUS];
+
+static void dpc_cpu_init_locked(struct dpc_cpu *c)
+{
+    if (c->initialized)
+        return;
+    list_initialize(&c->list);
+    event_init(&c->event, false, 0);
+    c->initialized = true;
+}
+
+static void dpc_queue_locked(struct dpc_cpu *c, dpc_t *dpc)
+{
+    dpc_cpu_init_locked(c);
+
+    // put the dpc at the tail of the list and signal the worker if it may
+    // be asleep
+    bool was_empty = list_is_empty(&c->list);
+    list_add_tail(&c->list, &dpc->node);
+    if (was_empty)
+        event_signal(&c->event, false);
+}
 
 status_t dpc_queue(dpc_t *dpc, bool reschedule)
 {
     DEBUG_ASSERT(dpc);
     DEBUG_ASSERT(dpc->func);
 
-    spin_lock_saved_state_t state;
-    spin_lock_irqsave(&dpc_lock, state);
+    // with interrupts off we can't move away from the cpu we pick
+    spin_lock_saved_state_t irqstate;
+    arch_interrupt_save(&irqstate, SPIN_LOCK_FLAG_INTERRUPTS);
 
-    // put the dpc at the tail of the list and signal the worker
-    list_add_tail(&dpc_list, &dpc->node);
-    event_signal(&dpc_event, false);
+    struct dpc_cpu *c = &dpc_cpus[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    dpc_queue_locked(c, dpc);
+    spin_unlock(&c->lock);
 
-    spin_unlock_irqrestore(&dpc_lock, state);
+    arch_interrupt_restore(irqstate, SPIN_LOCK_FLAG_INTERRUPTS);
 
     // reschedule here if asked to
     if (reschedule)
@@ -39,38 +77,76 @@ status_t dpc_queue(dpc_t *dpc, bool reschedule)
     return NO_ERROR;
 }
 
+status_t dpc_queue_on(dpc_t *dpc, uint cpu, bool reschedule)
+{
+    DEBUG_ASSERT(dpc);
+    DEBUG_ASSERT(dpc->func);
+
+    if (cpu >= arch_max_num_cpus())
+        return ERR_INVALID_ARGS;
+
+    struct dpc_cpu *c = &dpc_cpus[cpu];
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&c->lock, state);
+    dpc_queue_locked(c, dpc);
+    spin_unlock_irqrestore(&c->lock, state);
+
+    if (reschedule)
+        thread_yield();
+
+    return NO_ERROR;
+}
+
 static int dpc_thread(void *arg)
 {
+    struct dpc_cpu *c = arg;
+    struct list_node list = LIST_INITIAL_VALUE(list);
+
     for (;;) {
         // wait for a dpc to fire
-        __UNUSED status_t err = event_wait(&dpc_event);
+        __UNUSED status_t err = event_wait(&c->event);
         DEBUG_ASSERT(err == NO_ERROR);
 
+        // take everything queued so far in one go
         spin_lock_saved_state_t state;
-        spin_lock_irqsave(&dpc_lock, state);
-
-        // pop a dpc off the list
-        dpc_t *dpc = list_remove_head_type(&dpc_list, dpc_t, node);
-
-        // if the list is now empty, unsignal the event so we block until it is
-        if (!dpc)
-            event_unsignal(&dpc_event);
-
-        spin_unlock_irqrestore(&dpc_lock, state);
-
-        // call the dpc
-        if (dpc && dpc->func)
-            dpc->func(dpc);
+        spin_lock_irqsave(&c->lock, state);
+        struct list_node *node;
+        while ((node = list_remove_head(&c->list)))
+            list_add_tail(&list, node);
+        event_unsignal(&c->event);
+        spin_unlock_irqrestore(&c->lock, state);
+
+        // call the dpcs. Once off the list a dpc may be queued again,
+        // even by its own func.
+        dpc_t *dpc;
+        while ((dpc = list_remove_head_type(&list, dpc_t, node))) {
+            if (dpc->func)
+                dpc->func(dpc);
+        }
     }
 
-
     return 0;
 }
 
 static void dpc_init(unsigned int level)
 {
-    thread_t *t = thread_create("dpc", &dpc_thread, NULL, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    uint cpu = arch_curr_cpu_num();
+    struct dpc_cpu *c = &dpc_cpus[cpu];
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&c->lock, state);
+    dpc_cpu_init_locked(c);
+    spin_unlock_irqrestore(&c->lock, state);
+
+    char name[THREAD_NAME_LENGTH];
+    snprintf(name, sizeof(name), "dpc-%u", cpu);
+    thread_t *t = thread_create(name, &dpc_thread, c, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t)
+        panic("failed to create dpc thread for cpu %u\n", cpu);
+    thread_set_pinned_cpu(t, (int)cpu);
+    c->thread = t;
     thread_detach_and_resume(t);
 }
 
-LK_INIT_HOOK(dpc, dpc_init, LK_INIT_LEVEL_THREADING);
+LK_INIT_HOOK_FLAGS(dpc, dpc_init, LK_INIT_LEVEL_THREADING, LK_INIT_FLAG_ALL_CPUS);
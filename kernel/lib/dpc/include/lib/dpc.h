@@ -21,7 +21,12 @@ typedef struct dpc {
     void *arg;
 } dpc_t;
 
+// Queue |dpc| to be called from the dpc thread of the current cpu.
 status_t dpc_queue(dpc_t *dpc, bool reschedule);
 
+// Queue |dpc| to be called from the dpc thread of |cpu|. If the cpu hasn't
+// started yet it is called once it does.
+status_t dpc_queue_on(dpc_t *dpc, uint cpu, bool reschedule);
+
 __END_CDECLS
 
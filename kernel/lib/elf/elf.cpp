@@ -221,9 +221,10 @@ status_t ToMemFile::ZeroSegment(uint seg_num, size_t seg_offset, size_t len) {
         // TODO: move this logic to using a write method on the vm object directly
 
         // get a pointer to the underlying page in the object
-        auto p = vmo->FaultPage(ROUNDDOWN(offset, PAGE_SIZE), VMM_PF_FLAG_WRITE);
+        vm_page_t* p = nullptr;
+        status_t status = vmo->FaultPage(ROUNDDOWN(offset, PAGE_SIZE), VMM_PF_FLAG_WRITE, &p);
         LTRACEF("page %p\n", p);
-        if (!p) {
+        if (status != NO_ERROR) {
             panic("unhandled bad fault while reading into vm object\n");
         }
 
@@ -800,13 +800,11 @@ void *cmpct_memalign(size_t size, size_t alignment)
     return payload;
 }
 
-void cmpct_free(void *payload)
+static void free_locked(void *payload)
 {
-    if (payload == NULL) return;
     header_t *header = (header_t *)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
     size_t size = header->size;
-    lock();
     header_t *left = header->left;
     if (left != NULL && is_tagged_as_free(left)) {
         // Coalesce with left free object.
@@ -835,9 +833,32 @@ void cmpct_free(void *payload)
             free_memory(header, left, size);
         }
     }
+}
+
+void cmpct_free(void *payload)
+{
+    if (payload == NULL) return;
+    lock();
+    free_locked(payload);
     unlock();
 }
 
+void cmpct_free_many(void **payloads, size_t count)
+{
+    lock();
+    for (size_t i = 0; i < count; i++) {
+        if (payloads[i] != NULL)
+            free_locked(payloads[i]);
+    }
+    unlock();
+}
+
+size_t cmpct_usable_size(void *payload)
+{
+    header_t *header = (header_t *)payload - 1;
+    return header->size - sizeof(header_t);
+}
+
 void *cmpct_realloc(void *payload, size_t size)
 {
     if (payload == NULL) return cmpct_alloc(size);
@@ -14,6 +14,10 @@ __BEGIN_CDECLS;
 void *cmpct_alloc(size_t);
 void *cmpct_realloc(void *, size_t);
 void cmpct_free(void *);
+/* free several allocations under one acquisition of the heap lock */
+void cmpct_free_many(void **, size_t count);
+/* the bytes an allocation actually has room for, at least what was asked for */
+size_t cmpct_usable_size(void *);
 void *cmpct_memalign(size_t size, size_t alignment);
 
 void cmpct_init(void);
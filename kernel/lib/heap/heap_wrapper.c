@@ -14,9 +14,12 @@
 #include <string.h>
 #include <err.h>
 #include <list.h>
+#include <arch/ops.h>
 #include <kernel/spinlock.h>
+#include <lk/init.h>
 #include <lib/console.h>
 #include <lib/page_alloc.h>
+#include <platform.h>
 
 #define LOCAL_TRACE 0
 
@@ -70,6 +73,8 @@ static inline void HEAP_INIT(void)
 #define HEAP_INIT cmpct_init
 #define HEAP_DUMP cmpct_dump
 #define HEAP_TRIM cmpct_trim
+#define HEAP_USABLE_SIZE cmpct_usable_size
+#define HEAP_FREE_MANY cmpct_free_many
 static inline void *HEAP_CALLOC(size_t n, size_t s)
 {
     size_t realsize = n * s;
@@ -121,6 +126,393 @@ static inline void HEAP_TRIM(void) { dlmalloc_trim(0); }
 #error need to select valid heap implementation or provide wrapper
 #endif
 
+#ifdef HEAP_USABLE_SIZE
+/* Per cpu caches of freed small blocks, a list per size class, put in front of
+ * the heap so that most allocations and frees of the common sizes don't touch
+ * its lock. As far as the heap is concerned cached blocks are still allocated.
+ * A size class that fills up gives half of its blocks back to the heap in one
+ * go, and heap_trim() empties the caches. */
+#define HEAP_CACHE_CLASSES 12
+#define HEAP_CACHE_MAX_SIZE 1024
+#define HEAP_CACHE_DEPTH 32
+/* the biggest block taken back, since blocks can be a little larger than asked for */
+#define HEAP_CACHE_MAX_USABLE (HEAP_CACHE_MAX_SIZE + HEAP_CACHE_MAX_SIZE / 4)
+
+static const size_t heap_cache_size[HEAP_CACHE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+};
+
+struct heap_cache_class {
+    void *free; /* chained through their first word */
+    uint count;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t flushes;
+};
+
+struct heap_cache {
+    spin_lock_t lock;
+    struct heap_cache_class classes[HEAP_CACHE_CLASSES];
+} __CPU_ALIGN;
+
+static struct heap_cache heap_cache[SMP_MAX_CPUS];
+static bool heap_cache_enabled;
+
+/* size classes by size / 16, rounding up for allocations and down for frees */
+static uint8_t heap_cache_alloc_class[HEAP_CACHE_MAX_SIZE / 16];
+static uint8_t heap_cache_free_class[HEAP_CACHE_MAX_USABLE / 16 + 1];
+
+static void heap_cache_init(uint level)
+{
+    uint c = 0;
+    for (uint i = 0; i < countof(heap_cache_alloc_class); i++) {
+        while (heap_cache_size[c] < (i + 1) * 16)
+            c++;
+        heap_cache_alloc_class[i] = c;
+    }
+    c = 0;
+    for (uint i = 1; i < countof(heap_cache_free_class); i++) {
+        while (c + 1 < HEAP_CACHE_CLASSES && heap_cache_size[c + 1] <= i * 16)
+            c++;
+        heap_cache_free_class[i] = c;
+    }
+
+    /* the cpu number isn't to be trusted until now */
+    heap_cache_enabled = true;
+}
+
+LK_INIT_HOOK(heap_cache, heap_cache_init, LK_INIT_LEVEL_KERNEL);
+
+static void *heap_cache_alloc(size_t size)
+{
+    if (!heap_cache_enabled || size - 1 >= HEAP_CACHE_MAX_SIZE)
+        return HEAP_MALLOC(size);
+
+    uint c = heap_cache_alloc_class[(size - 1) / 16];
+    struct heap_cache *cache = &heap_cache[arch_curr_cpu_num()];
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    struct heap_cache_class *cls = &cache->classes[c];
+    void *ptr = cls->free;
+    if (ptr) {
+        cls->free = *(void **)ptr;
+        cls->count--;
+        cls->hits++;
+    } else {
+        cls->misses++;
+    }
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    /* blocks come in whole classes so that they can be passed around them */
+    return ptr ? ptr : HEAP_MALLOC(heap_cache_size[c]);
+}
+
+static void heap_cache_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    size_t usable = heap_cache_enabled ? HEAP_USABLE_SIZE(ptr) : 0;
+    if (usable < heap_cache_size[0] || usable > HEAP_CACHE_MAX_USABLE) {
+        HEAP_FREE(ptr);
+        return;
+    }
+
+    uint c = heap_cache_free_class[usable / 16];
+    struct heap_cache *cache = &heap_cache[arch_curr_cpu_num()];
+    void *flush[HEAP_CACHE_DEPTH / 2];
+    size_t flush_count = 0;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache->lock, state);
+    struct heap_cache_class *cls = &cache->classes[c];
+    if (cls->count == HEAP_CACHE_DEPTH) {
+        while (flush_count < countof(flush)) {
+            flush[flush_count++] = cls->free;
+            cls->free = *(void **)cls->free;
+        }
+        cls->count -= flush_count;
+        cls->flushes++;
+    }
+    *(void **)ptr = cls->free;
+    cls->free = ptr;
+    cls->count++;
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    if (flush_count)
+        HEAP_FREE_MANY(flush, flush_count);
+}
+
+static void *heap_cache_calloc(size_t count, size_t size)
+{
+    size_t realsize = count * size;
+    if (realsize > HEAP_CACHE_MAX_SIZE)
+        return HEAP_CALLOC(count, size);
+
+    void *ptr = heap_cache_alloc(realsize);
+    if (likely(ptr))
+        memset(ptr, 0, realsize);
+    return ptr;
+}
+
+/* give every cached block back to the heap */
+static void heap_cache_drain(void)
+{
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct heap_cache *cache = &heap_cache[cpu];
+        for (uint c = 0; c < HEAP_CACHE_CLASSES; c++) {
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&cache->lock, state);
+            void *ptr = cache->classes[c].free;
+            cache->classes[c].free = NULL;
+            cache->classes[c].count = 0;
+            spin_unlock_irqrestore(&cache->lock, state);
+
+            while (ptr) {
+                void *next = *(void **)ptr;
+                HEAP_FREE(ptr);
+                ptr = next;
+            }
+        }
+    }
+}
+
+static void heap_cache_dump(void)
+{
+    printf("	small block caches:\n");
+    printf("		%6s %8s %12s %12s %10s\n", "size", "cached", "hits", "misses", "flushes");
+    for (uint c = 0; c < HEAP_CACHE_CLASSES; c++) {
+        uint64_t cached = 0, hits = 0, misses = 0, flushes = 0;
+        for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            const struct heap_cache_class *cls = &heap_cache[cpu].classes[c];
+            cached += cls->count;
+            hits += cls->hits;
+            misses += cls->misses;
+            flushes += cls->flushes;
+        }
+        printf("		%6zu %8llu %12llu %12llu %10llu\n", heap_cache_size[c], cached, hits, misses,
+               flushes);
+    }
+}
+#else
+static inline void *heap_cache_alloc(size_t size) { return HEAP_MALLOC(size); }
+static inline void *heap_cache_calloc(size_t count, size_t size) { return HEAP_CALLOC(count, size); }
+static inline void heap_cache_free(void *ptr) { HEAP_FREE(ptr); }
+static inline void heap_cache_drain(void) {}
+static inline void heap_cache_dump(void) {}
+#endif
+
+#if LK_DEBUGLEVEL > 1
+/* Sampling allocation site profiler, driven by the heap profile console
+ * command. While on, every Nth allocation has its
+ * size charged to the code that asked for it, and is remembered until it is
+ * freed, so that each site's live bytes can be told apart from its churn.
+ * Everything lives in fixed tables since it can't use the heap it watches;
+ * sampled blocks that don't fit are counted and otherwise ignored. */
+#define HEAP_PROFILE_SITES 512
+#define HEAP_PROFILE_SAMPLES 8192
+#define HEAP_PROFILE_SAMPLE_BUCKETS 1024
+#define HEAP_PROFILE_DEFAULT_RATE 16
+
+struct heap_profile_site {
+    void *caller;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    size_t live;
+    size_t live_bytes;
+};
+
+struct heap_profile_sample {
+    void *ptr;
+    size_t size;
+    uint16_t site;
+    uint16_t next; /* in a bucket chain or the free list, 0 for none */
+};
+
+static bool heap_profile_on;
+static uint heap_profile_rate = HEAP_PROFILE_DEFAULT_RATE;
+static int heap_profile_countdown;
+static lk_time_t heap_profile_start_time;
+static lk_time_t heap_profile_stop_time;
+/* sampled blocks not yet freed; free() only looks them up when there are any */
+static uint heap_profile_live;
+static uint64_t heap_profile_dropped;
+
+static spin_lock_t heap_profile_lock = SPIN_LOCK_INITIAL_VALUE;
+static struct heap_profile_site heap_profile_sites[HEAP_PROFILE_SITES];
+/* entry 0 is never used so that 0 can end chains */
+static struct heap_profile_sample heap_profile_samples[HEAP_PROFILE_SAMPLES];
+static uint16_t heap_profile_buckets[HEAP_PROFILE_SAMPLE_BUCKETS];
+static uint16_t heap_profile_free_sample;
+static uint heap_profile_unused_sample;
+
+static inline uint heap_profile_hash(const void *p)
+{
+    uintptr_t x = (uintptr_t)p;
+    x ^= x >> 17;
+    x *= 0x9e3779b1u;
+    return (uint)(x ^ (x >> 15));
+}
+
+static void heap_profile_reset_locked(void)
+{
+    memset(heap_profile_sites, 0, sizeof(heap_profile_sites));
+    memset(heap_profile_buckets, 0, sizeof(heap_profile_buckets));
+    heap_profile_free_sample = 0;
+    heap_profile_unused_sample = 1;
+    heap_profile_live = 0;
+    heap_profile_dropped = 0;
+    heap_profile_countdown = (int)heap_profile_rate;
+    heap_profile_start_time = current_time();
+    heap_profile_stop_time = 0;
+}
+
+static void heap_profile_record(void *ptr, size_t size, void *caller)
+{
+    if (likely(!heap_profile_on) || !ptr || atomic_add(&heap_profile_countdown, -1) > 1)
+        return;
+    heap_profile_countdown = (int)heap_profile_rate;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&heap_profile_lock, state);
+
+    /* find or claim the caller's site, by open addressing */
+    uint s = heap_profile_hash(caller) % HEAP_PROFILE_SITES;
+    uint probes;
+    for (probes = 0; probes < HEAP_PROFILE_SITES; probes++) {
+        if (heap_profile_sites[s].caller == caller || !heap_profile_sites[s].caller)
+            break;
+        s = (s + 1) % HEAP_PROFILE_SITES;
+    }
+
+    uint16_t n = heap_profile_free_sample;
+    if (n)
+        heap_profile_free_sample = heap_profile_samples[n].next;
+    else if (heap_profile_unused_sample < HEAP_PROFILE_SAMPLES)
+        n = (uint16_t)heap_profile_unused_sample++;
+
+    if (probes == HEAP_PROFILE_SITES || !n) {
+        if (n) {
+            heap_profile_samples[n].next = heap_profile_free_sample;
+            heap_profile_free_sample = n;
+        }
+        heap_profile_dropped++;
+        spin_unlock_irqrestore(&heap_profile_lock, state);
+        return;
+    }
+
+    struct heap_profile_site *site = &heap_profile_sites[s];
+    site->caller = caller;
+    site->allocs++;
+    site->alloc_bytes += size;
+    site->live++;
+    site->live_bytes += size;
+
+    uint b = heap_profile_hash(ptr) % HEAP_PROFILE_SAMPLE_BUCKETS;
+    struct heap_profile_sample *sample = &heap_profile_samples[n];
+    sample->ptr = ptr;
+    sample->size = size;
+    sample->site = (uint16_t)s;
+    sample->next = heap_profile_buckets[b];
+    heap_profile_buckets[b] = n;
+    heap_profile_live++;
+
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+}
+
+static void heap_profile_forget(void *ptr)
+{
+    if (likely(heap_profile_live == 0) || !ptr)
+        return;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&heap_profile_lock, state);
+
+    uint b = heap_profile_hash(ptr) % HEAP_PROFILE_SAMPLE_BUCKETS;
+    for (uint16_t *link = &heap_profile_buckets[b]; *link;
+            link = &heap_profile_samples[*link].next) {
+        uint16_t n = *link;
+        struct heap_profile_sample *sample = &heap_profile_samples[n];
+        if (sample->ptr != ptr)
+            continue;
+
+        struct heap_profile_site *site = &heap_profile_sites[sample->site];
+        site->live--;
+        site->live_bytes -= sample->size;
+
+        *link = sample->next;
+        sample->ptr = NULL;
+        sample->next = heap_profile_free_sample;
+        heap_profile_free_sample = n;
+        heap_profile_live--;
+        break;
+    }
+
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+}
+
+static void heap_profile_start(uint rate)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&heap_profile_lock, state);
+    heap_profile_on = false;
+    heap_profile_rate = rate ? rate : HEAP_PROFILE_DEFAULT_RATE;
+    heap_profile_reset_locked();
+    heap_profile_on = true;
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+}
+
+static void heap_profile_stop(void)
+{
+    if (heap_profile_on) {
+        heap_profile_on = false;
+        heap_profile_stop_time = current_time();
+    }
+}
+
+/* print the sites with the most sampled live bytes first, scaled up by the
+ * sampling rate to estimate the real numbers */
+static void heap_profile_dump(uint max_sites)
+{
+    static struct heap_profile_site sites[HEAP_PROFILE_SITES];
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&heap_profile_lock, state);
+    memcpy(sites, heap_profile_sites, sizeof(sites));
+    uint rate = heap_profile_rate;
+    uint live = heap_profile_live;
+    uint64_t dropped = heap_profile_dropped;
+    lk_time_t end = heap_profile_on ? current_time() : heap_profile_stop_time;
+    lk_time_t elapsed = end - heap_profile_start_time;
+    spin_unlock_irqrestore(&heap_profile_lock, state);
+
+    printf("heap profile: %s, 1 in %u allocations over %u ms, %u live samples, %llu dropped\n",
+           heap_profile_on ? "running" : "stopped", rate, elapsed, live, dropped);
+    printf("%18s %12s %8s %10s %12s\n", "caller", "live bytes", "live", "allocs/s", "alloc bytes");
+
+    /* a selection sort is plenty for a debug command */
+    for (uint printed = 0; printed < max_sites; printed++) {
+        struct heap_profile_site *top = NULL;
+        for (uint i = 0; i < HEAP_PROFILE_SITES; i++) {
+            if (sites[i].caller && (!top || sites[i].live_bytes > top->live_bytes))
+                top = &sites[i];
+        }
+        if (!top)
+            break;
+
+        uint64_t allocs = top->allocs * rate;
+        printf("%18p %12zu %8zu %10llu %12llu\n", top->caller, top->live_bytes * rate,
+               top->live * rate, elapsed ? allocs * 1000 / elapsed : allocs,
+               top->alloc_bytes * rate);
+        top->caller = NULL;
+    }
+}
+#else
+static inline void heap_profile_record(void *ptr, size_t size, void *caller) {}
+static inline void heap_profile_forget(void *ptr) {}
+#endif
+
 static void heap_free_delayed_list(void)
 {
     struct list_node list;
@@ -154,10 +546,16 @@ void heap_trim(void)
         heap_free_delayed_list();
     }
 
+    heap_cache_drain();
     HEAP_TRIM();
 }
 
 void *malloc(size_t size)
+{
+    return heap_malloc_for(size, __GET_CALLER());
+}
+
+void *heap_malloc_for(size_t size, void *caller)
 {
     LTRACEF("size %zd\n", size);
 
@@ -166,9 +564,10 @@ void *malloc(size_t size)
         heap_free_delayed_list();
     }
 
-    void *ptr = HEAP_MALLOC(size);
+    void *ptr = heap_cache_alloc(size);
+    heap_profile_record(ptr, size, caller);
     if (heap_trace)
-        printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
+        printf("caller %p malloc %zu -> %p\n", caller, size, ptr);
     return ptr;
 }
 
@@ -182,6 +581,7 @@ void *memalign(size_t boundary, size_t size)
     }
 
     void *ptr = HEAP_MEMALIGN(boundary, size);
+    heap_profile_record(ptr, size, __GET_CALLER());
     if (heap_trace)
         printf("caller %p memalign %zu, %zu -> %p\n", __GET_CALLER(), boundary, size, ptr);
     return ptr;
@@ -196,7 +596,8 @@ void *calloc(size_t count, size_t size)
         heap_free_delayed_list();
     }
 
-    void *ptr = HEAP_CALLOC(count, size);
+    void *ptr = heap_cache_calloc(count, size);
+    heap_profile_record(ptr, count * size, __GET_CALLER());
     if (heap_trace)
         printf("caller %p calloc %zu, %zu -> %p\n", __GET_CALLER(), count, size, ptr);
     return ptr;
@@ -212,6 +613,10 @@ void *realloc(void *ptr, size_t size)
     }
 
     void *ptr2 = HEAP_REALLOC(ptr, size);
+    if (ptr2) {
+        heap_profile_forget(ptr);
+        heap_profile_record(ptr2, size, __GET_CALLER());
+    }
     if (heap_trace)
         printf("caller %p realloc %p, %zu -> %p\n", __GET_CALLER(), ptr, size, ptr2);
     return ptr2;
@@ -223,7 +628,8 @@ void free(void *ptr)
     if (heap_trace)
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
 
-    HEAP_FREE(ptr);
+    heap_profile_forget(ptr);
+    heap_cache_free(ptr);
 }
 
 /* critical section time delayed free */
@@ -244,6 +650,7 @@ void heap_delayed_free(void *ptr)
 static void heap_dump(void)
 {
     HEAP_DUMP();
+    heap_cache_dump();
 
     printf("\tdelayed free list:\n");
     spin_lock_saved_state_t state;
@@ -336,6 +743,7 @@ usage:
         printf("\t%s alloc <size> [alignment]\n", argv[0].str);
         printf("\t%s realloc <ptr> <size>\n", argv[0].str);
         printf("\t%s free <address>\n", argv[0].str);
+        printf("\t%s profile [start [rate]|stop|<max sites>]\n", argv[0].str);
         return -1;
     }
 
@@ -362,6 +770,14 @@ usage:
         if (argc < 2) goto notenoughargs;
 
         free(argv[2].p);
+    } else if (strcmp(argv[1].str, "profile") == 0) {
+        if (argc >= 3 && strcmp(argv[2].str, "start") == 0) {
+            heap_profile_start((argc >= 4) ? (uint)argv[3].u : 0);
+        } else if (argc >= 3 && strcmp(argv[2].str, "stop") == 0) {
+            heap_profile_stop();
+        } else {
+            heap_profile_dump((argc >= 3) ? (uint)argv[2].u : 20);
+        }
     } else {
         printf("unrecognized command\n");
         goto usage;
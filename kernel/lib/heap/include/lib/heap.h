@@ -20,6 +20,10 @@ void *calloc(size_t count, size_t size) __MALLOC;
 void *realloc(void *ptr, size_t size) __MALLOC;
 void free(void *ptr);
 
+/* malloc() on behalf of |caller|, for allocators built on top of it, such as
+ * operator new, so that heap tracing and profiling name their callers */
+void *heap_malloc_for(size_t size, void *caller) __MALLOC;
+
 void heap_init(void);
 
 /* critical section time delayed free */
@@ -0,0 +1,54 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <compiler.h>
+#include <magenta/syscalls-types.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Binary kernel trace. Every cpu writes fixed size records into its own ring
+// in a vmo that userspace can map or read, for whichever groups of trace
+// points are enabled at the time. A disabled trace point costs a load and a
+// branch.
+//
+// Trace points are placed with ktrace(), tags and record layout are in
+// <magenta/syscalls-types.h>. Code outside lib/magenta and lib/ktrace
+// doesn't always have this module, and guards its trace points with
+// WITH_LIB_KTRACE.
+
+__BEGIN_CDECLS
+
+extern uint32_t ktrace_grpmask;
+
+void ktrace_write(uint32_t tag, uint32_t a, uint64_t b);
+
+static inline void ktrace(uint32_t tag, uint32_t a, uint64_t b) {
+    if (unlikely(__atomic_load_n(&ktrace_grpmask, __ATOMIC_RELAXED) & MX_KTRACE_TAG_GROUP(tag)))
+        ktrace_write(tag, a, b);
+}
+
+// Carry out one of the MX_KTRACE_ACTION_*s other than GET_VMO.
+status_t ktrace_control(uint32_t action, uint32_t options);
+
+// The SAMPLE group. While it's on, the arch has the calling cpu's
+// performance counters interrupt it every period cycles, and calls
+// ktrace_sample() from the interrupt with the interrupted pc and frame
+// pointer. Arches without a PMU driver return ERR_NOT_SUPPORTED.
+status_t arch_pmu_sample_start(uint64_t period);
+void arch_pmu_sample_stop(void);
+void ktrace_sample(uintptr_t pc, uintptr_t fp, bool user);
+
+__END_CDECLS
+
+#ifdef __cplusplus
+#include <kernel/vm/vm_object.h>
+#include <utils/ref_ptr.h>
+
+// The vmo holding the trace, or nullptr if tracing is off at boot.
+utils::RefPtr<VmObject> ktrace_get_vmo();
+#endif
@@ -0,0 +1,309 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <lib/ktrace.h>
+
+#include <arch/ops.h>
+#include <err.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <lib/console.h>
+#include <lk/init.h>
+#include <magenta/user_thread.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Default size of each cpu's ring in KB, settable with ktrace.bufsize
+#define KTRACE_DEFAULT_BUFSIZE 256
+
+// Default cycles between SAMPLE records, settable with ktrace.sample_period
+#define KTRACE_DEFAULT_SAMPLE_PERIOD 1000000
+
+// Most kernel frames a sample walks
+#define KTRACE_SAMPLE_MAX_DEPTH 16
+
+static_assert(sizeof(mx_ktrace_header_t) <= MX_KTRACE_HEADER_SIZE, "ktrace header too big");
+
+// A cpu only writes to its own ring, with interrupts disabled, so records
+// need no locking, and the count of records written is kept here rather
+// than in the shared header page, which only gets the counts on stop.
+struct ktrace_cpu {
+    mx_ktrace_record_t* records;
+    uint64_t written;
+} __CPU_ALIGN;
+
+static ktrace_cpu ktrace_cpus[SMP_MAX_CPUS];
+
+uint32_t ktrace_grpmask;
+
+static mutex_t ktrace_lock = MUTEX_INITIAL_VALUE(ktrace_lock);
+static utils::RefPtr<VmObject> ktrace_vmo;
+static mx_ktrace_header_t* ktrace_hdr;
+static uint64_t ktrace_mask;
+static uint64_t ktrace_sample_period;
+static bool ktrace_sampling;
+
+void ktrace_write(uint32_t tag, uint32_t a, uint64_t b) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    ktrace_cpu* c = &ktrace_cpus[arch_curr_cpu_num()];
+    if (c->records) {
+        mx_ktrace_record_t* rec = &c->records[c->written & ktrace_mask];
+        rec->ts = current_time_hires() * 1000ULL;
+        rec->thread = reinterpret_cast<uintptr_t>(get_current_thread());
+        rec->tag = tag;
+        rec->a = a;
+        rec->b = b;
+        c->written++;
+    }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+__WEAK status_t arch_pmu_sample_start(uint64_t period) {
+    return ERR_NOT_SUPPORTED;
+}
+
+__WEAK void arch_pmu_sample_stop(void) {
+}
+
+void ktrace_sample(uintptr_t pc, uintptr_t fp, bool user) {
+    UserThread* ut = UserThread::GetCurrent();
+    uint32_t koid = ut ? static_cast<uint32_t>(ut->get_koid()) : 0;
+    ktrace_write(MX_KTRACE_TAG_SAMPLE_PC, koid, pc);
+
+    // User memory can't be touched from the interrupt, and kernel frames are
+    // only followed while they stay on this thread's stack, which without
+    // frame pointers ends the walk early but safely.
+    if (user)
+        return;
+    thread_t* t = get_current_thread();
+    uintptr_t lo = reinterpret_cast<uintptr_t>(t->stack);
+    uintptr_t hi = lo + t->stack_size;
+    for (uint32_t depth = 1; depth <= KTRACE_SAMPLE_MAX_DEPTH; depth++) {
+        if (fp < lo || fp > hi - 2 * sizeof(uintptr_t) || (fp & (sizeof(uintptr_t) - 1)))
+            break;
+        const uintptr_t* frame = reinterpret_cast<const uintptr_t*>(fp);
+        if (!frame[1])
+            break;
+        ktrace_write(MX_KTRACE_TAG_SAMPLE_CALLER, depth, frame[1]);
+        // frames only move up the stack
+        if (frame[0] <= fp)
+            break;
+        fp = frame[0];
+    }
+}
+
+static void ktrace_sample_start_task(void* context) {
+    auto err = static_cast<volatile status_t*>(context);
+    status_t r = arch_pmu_sample_start(ktrace_sample_period);
+    if (r != NO_ERROR)
+        *err = r;
+}
+
+static void ktrace_sample_stop_task(void* context) {
+    arch_pmu_sample_stop();
+}
+
+// Every cpu samples or none do.
+static status_t ktrace_sample_start_locked() {
+    if (ktrace_sampling)
+        return NO_ERROR;
+    volatile status_t err = NO_ERROR;
+    mp_sync_exec(MP_CPU_ALL, ktrace_sample_start_task, const_cast<status_t*>(&err));
+    if (err != NO_ERROR) {
+        mp_sync_exec(MP_CPU_ALL, ktrace_sample_stop_task, nullptr);
+        return err;
+    }
+    ktrace_sampling = true;
+    return NO_ERROR;
+}
+
+static void ktrace_sample_stop_locked() {
+    if (!ktrace_sampling)
+        return;
+    mp_sync_exec(MP_CPU_ALL, ktrace_sample_stop_task, nullptr);
+    ktrace_sampling = false;
+}
+
+static void ktrace_sync_task(void* context) {
+}
+
+static void ktrace_stop_locked() {
+    ktrace_sample_stop_locked();
+    __atomic_store_n(&ktrace_grpmask, 0u, __ATOMIC_SEQ_CST);
+    ktrace_hdr->grpmask = 0;
+
+    // Any cpu still busy with a record has interrupts off until it's done,
+    // so once every cpu has run the sync task, the rings are quiet.
+    mp_sync_exec(MP_CPU_ALL, ktrace_sync_task, nullptr);
+
+    for (uint cpu = 0; cpu < ktrace_hdr->num_cpus; cpu++)
+        ktrace_hdr->written[cpu] = ktrace_cpus[cpu].written;
+}
+
+status_t ktrace_control(uint32_t action, uint32_t options) {
+    AutoLock lock(&ktrace_lock);
+
+    if (!ktrace_hdr)
+        return ERR_NOT_SUPPORTED;
+
+    switch (action) {
+    case MX_KTRACE_ACTION_START:
+        if (!options || (options & ~MX_KTRACE_GRP_ALL))
+            return ERR_INVALID_ARGS;
+        if (options & MX_KTRACE_GRP_SAMPLE) {
+            status_t err = ktrace_sample_start_locked();
+            if (err != NO_ERROR)
+                return err;
+        } else {
+            ktrace_sample_stop_locked();
+        }
+        ktrace_hdr->grpmask = options;
+        __atomic_store_n(&ktrace_grpmask, options, __ATOMIC_SEQ_CST);
+        return NO_ERROR;
+
+    case MX_KTRACE_ACTION_STOP:
+        ktrace_stop_locked();
+        return NO_ERROR;
+
+    case MX_KTRACE_ACTION_REWIND:
+        if (__atomic_load_n(&ktrace_grpmask, __ATOMIC_SEQ_CST))
+            return ERR_BAD_STATE;
+        for (uint cpu = 0; cpu < ktrace_hdr->num_cpus; cpu++) {
+            ktrace_cpus[cpu].written = 0;
+            ktrace_hdr->written[cpu] = 0;
+        }
+        return NO_ERROR;
+
+    default:
+        return ERR_INVALID_ARGS;
+    }
+}
+
+utils::RefPtr<VmObject> ktrace_get_vmo() {
+    AutoLock lock(&ktrace_lock);
+    return ktrace_vmo;
+}
+
+static void ktrace_init(uint level) {
+    uint32_t bufsize = cmdline_get_uint32("ktrace.bufsize", KTRACE_DEFAULT_BUFSIZE);
+    if (bufsize == 0)
+        return;
+
+    // a power of two records per cpu, so ring indexes are a mask
+    uint64_t records = (uint64_t)bufsize * 1024 / sizeof(mx_ktrace_record_t);
+    uint64_t records_per_cpu = 1;
+    while (records_per_cpu * 2 <= records)
+        records_per_cpu *= 2;
+
+    uint num_cpus = MIN(arch_max_num_cpus(), MX_KTRACE_MAX_CPUS);
+    size_t ring_size = records_per_cpu * sizeof(mx_ktrace_record_t);
+    size_t size = ROUNDUP(MX_KTRACE_HEADER_SIZE + num_cpus * ring_size, PAGE_SIZE);
+
+    // Writers can be in interrupt handlers, so every page is committed and
+    // mapped up front.
+    auto vmo = VmObject::Create(PMM_ALLOC_FLAG_ANY, size);
+    if (!vmo) {
+        printf("ktrace: no memory for a %zu byte trace buffer\n", size);
+        return;
+    }
+    void* ptr;
+    status_t err = VmAspace::kernel_aspace()->MapObject(vmo, "ktrace", 0, size, &ptr, 0,
+                                                       VMM_FLAG_COMMIT, 0);
+    if (err != NO_ERROR) {
+        printf("ktrace: failed to map the trace buffer: %d\n", err);
+        return;
+    }
+
+    auto hdr = static_cast<mx_ktrace_header_t*>(ptr);
+    memset(hdr, 0, MX_KTRACE_HEADER_SIZE);
+    hdr->magic = MX_KTRACE_MAGIC;
+    hdr->version = MX_KTRACE_VERSION;
+    hdr->num_cpus = num_cpus;
+    hdr->record_size = sizeof(mx_ktrace_record_t);
+    hdr->records_per_cpu = records_per_cpu;
+
+    uint8_t* rings = static_cast<uint8_t*>(ptr) + MX_KTRACE_HEADER_SIZE;
+    for (uint cpu = 0; cpu < num_cpus; cpu++)
+        ktrace_cpus[cpu].records = reinterpret_cast<mx_ktrace_record_t*>(rings + cpu * ring_size);
+    ktrace_mask = records_per_cpu - 1;
+
+    ktrace_sample_period = cmdline_get_uint32("ktrace.sample_period",
+                                              KTRACE_DEFAULT_SAMPLE_PERIOD);
+
+    AutoLock lock(&ktrace_lock);
+    ktrace_vmo = utils::move(vmo);
+    ktrace_hdr = hdr;
+
+    // the other cpus aren't up to start their counters yet
+    uint32_t grpmask = cmdline_get_uint32("ktrace.grpmask", 0) & MX_KTRACE_GRP_ALL &
+                       ~MX_KTRACE_GRP_SAMPLE;
+    if (grpmask) {
+        hdr->grpmask = grpmask;
+        __atomic_store_n(&ktrace_grpmask, grpmask, __ATOMIC_SEQ_CST);
+    }
+}
+
+// after the vm is up, ahead of the threads that could be traced
+LK_INIT_HOOK(ktrace, ktrace_init, LK_INIT_LEVEL_KERNEL);
+
+#if WITH_LIB_CONSOLE
+
+static int cmd_ktrace(int argc, const cmd_args* argv) {
+    if (argc < 2) {
+    usage:
+        printf("usage:\n");
+        printf("%s start <grpmask> : trace the groups in grpmask\n", argv[0].str);
+        printf("%s stop            : stop tracing\n", argv[0].str);
+        printf("%s rewind          : empty the trace buffers, once stopped\n", argv[0].str);
+        printf("%s status          : show what's been traced\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    status_t err;
+    if (!strcmp(argv[1].str, "start")) {
+        if (argc < 3)
+            goto usage;
+        err = ktrace_control(MX_KTRACE_ACTION_START, (uint32_t)argv[2].u);
+    } else if (!strcmp(argv[1].str, "stop")) {
+        err = ktrace_control(MX_KTRACE_ACTION_STOP, 0);
+    } else if (!strcmp(argv[1].str, "rewind")) {
+        err = ktrace_control(MX_KTRACE_ACTION_REWIND, 0);
+    } else if (!strcmp(argv[1].str, "status")) {
+        AutoLock lock(&ktrace_lock);
+        if (!ktrace_hdr) {
+            printf("ktrace is off, see ktrace.bufsize\n");
+            return NO_ERROR;
+        }
+        printf("groups 0x%x, %llu records per cpu\n", ktrace_grpmask,
+               ktrace_hdr->records_per_cpu);
+        for (uint cpu = 0; cpu < ktrace_hdr->num_cpus; cpu++)
+            printf("cpu %u: %llu records written\n", cpu, ktrace_cpus[cpu].written);
+        return NO_ERROR;
+    } else {
+        goto usage;
+    }
+
+    if (err != NO_ERROR)
+        printf("error %d\n", err);
+    return err;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("ktrace", "binary kernel trace", &cmd_ktrace)
+STATIC_COMMAND_END(ktrace);
+
+#endif // WITH_LIB_CONSOLE
@@ -7,6 +7,9 @@
 
 LOCAL_DIR := $(GET_LOCAL_DIR)
 
+ifeq ($(SUBARCH),x86-64)
+include $(LIBC_STRING_C_DIR)/arch/x86-64/rules.mk
+else
 ASM_STRING_OPS := #bcopy bzero memcpy memmove memset
 
 MODULE_SRCS += \
@@ -15,4 +18,4 @@ MODULE_SRCS += \
 
 # filter out the C implementation
 C_STRING_OPS := $(filter-out $(ASM_STRING_OPS),$(C_STRING_OPS))
-
+endif
@@ -23,13 +23,13 @@
 const auto kDP_Map_Perms = ARCH_MMU_FLAG_PERM_NO_EXECUTE | ARCH_MMU_FLAG_PERM_USER;
 const auto kDP_Map_Perms_RO = kDP_Map_Perms | ARCH_MMU_FLAG_PERM_RO;
 
-mx_status_t DataPipe::Create(mx_size_t capacity,
+mx_status_t DataPipe::Create(mx_size_t element_size, mx_size_t capacity, bool shared_cursors,
                              utils::RefPtr<Dispatcher>* producer,
                              utils::RefPtr<Dispatcher>* consumer,
                              mx_rights_t* producer_rights,
                              mx_rights_t* consumer_rights) {
     AllocChecker ac;
-    utils::RefPtr<DataPipe> pipe = utils::AdoptRef(new (&ac) DataPipe(capacity));
+    utils::RefPtr<DataPipe> pipe = utils::AdoptRef(new (&ac) DataPipe(element_size, capacity, shared_cursors));
     if (!ac.check())
         return ERR_NO_MEMORY;
 
@@ -49,8 +49,10 @@ mx_status_t DataPipe::Create(mx_size_t capacity,
     return NO_ERROR;
 }
 
-DataPipe::DataPipe(mx_size_t capacity)
-    : capacity_(capacity),
+DataPipe::DataPipe(mx_size_t element_size, mx_size_t capacity, bool shared_cursors)
+    : element_size_(element_size),
+      capacity_(capacity),
+      shared_cursors_(shared_cursors),
       free_space_(0u) {
     mutex_init(&lock_);
     producer_.state_tracker.set_initial_signals_state(
@@ -77,14 +79,24 @@ bool DataPipe::Init() {
     if (!vmo_)
         return false;
 
-    free_space_ = static_cast<mx_size_t>(vmo_->size());
+    // the ring holds whole elements, so that only whole elements ever go
+    // in and out and none of them gets split by the end of the ring
+    ring_size_ = static_cast<mx_size_t>(vmo_->size());
+    ring_size_ -= ring_size_ % element_size_;
+    free_space_ = ring_size_;
+
+    if (shared_cursors_) {
+        control_vmo_ = VmObject::Create(PMM_ALLOC_FLAG_ANY, PAGE_SIZE);
+        if (!control_vmo_)
+            return false;
+    }
     return true;
 }
 
 mx_size_t DataPipe::ComputeSize(mx_size_t from, mx_size_t to, mx_size_t requested) {
     mx_size_t available;
     if (from >= to) {
-        available = static_cast<mx_size_t>(vmo_->size() - from);
+        available = ring_size_ - from;
     } else {
         available = static_cast<mx_size_t>(to - from);
     }
@@ -97,13 +109,16 @@ mx_status_t DataPipe::MapVMOIfNeeded(EndPoint* ep, utils::RefPtr<VmAspace> aspac
     if (ep->aspace && (ep->aspace != aspace)) {
         // We have been transfered to another process. Unmap and free.
         // TODO(cpu): Do this at a better time.
-        ep->aspace->FreeRegion(reinterpret_cast<vaddr_t>(ep->vad_start));
-        ep->aspace.reset();
+        UnmapLocked(ep);
     }
 
+    // the ring stays mapped in the process once it's there
+    if (ep->aspace)
+        return NO_ERROR;
+
     // For large requests we can use demand page here instead of commit.
     auto perms = ep->read_only ? kDP_Map_Perms_RO : kDP_Map_Perms;
-    auto status = aspace->MapObject(vmo_, "datapipe", 0u, capacity_,
+    auto status = aspace->MapObject(vmo_, "datapipe", 0u, ring_size_,
                                     reinterpret_cast<void**>(&ep->vad_start), 0,
                                     VMM_FLAG_COMMIT, perms);
     if (status < 0)
@@ -113,11 +128,111 @@ mx_status_t DataPipe::MapVMOIfNeeded(EndPoint* ep, utils::RefPtr<VmAspace> aspac
     return NO_ERROR;
 }
 
+void DataPipe::UnmapLocked(EndPoint* ep) {
+    if (!ep->aspace)
+        return;
+
+    ep->aspace->FreeRegion(reinterpret_cast<vaddr_t>(ep->vad_start));
+    if (ep->control_start)
+        ep->aspace->FreeRegion(reinterpret_cast<vaddr_t>(ep->control_start));
+    ep->vad_start = nullptr;
+    ep->control_start = nullptr;
+    ep->aspace.reset();
+}
+
+mx_status_t DataPipe::MapSharedLocked(EndPoint* ep, utils::RefPtr<VmAspace> aspace, void** buffer,
+                                      void** control, mx_size_t* size) {
+    if (!shared_cursors_)
+        return ERR_BAD_STATE;
+    if (!vmo_)
+        return ERR_CHANNEL_CLOSED;
+
+    auto status = MapVMOIfNeeded(ep, utils::move(aspace));
+    if (status < 0)
+        return status;
+
+    // both ends write their own cursor, so the control page is writable for both
+    if (!ep->control_start) {
+        status = ep->aspace->MapObject(control_vmo_, "datapipe control", 0u, PAGE_SIZE,
+                                       reinterpret_cast<void**>(&ep->control_start), 0,
+                                       VMM_FLAG_COMMIT, kDP_Map_Perms);
+        if (status < 0)
+            return status;
+    }
+
+    *buffer = ep->vad_start;
+    *control = ep->control_start;
+    *size = ring_size_;
+    return NO_ERROR;
+}
+
+// Works out the free space from the cursors in the control page. Either end
+// may have put anything at all there, which can only confuse the signals of
+// this one pipe, so the count is just clamped to make sense.
+void DataPipe::LoadSharedCursorsLocked() {
+    DEBUG_ASSERT(shared_cursors_ && vmo_);
+
+    mx_data_pipe_control_t control;
+    size_t read = 0u;
+    if (control_vmo_->Read(&control, 0u, sizeof(control), &read) != NO_ERROR ||
+        read != sizeof(control))
+        return;
+
+    uint64_t used = control.write_count - control.read_count;
+    free_space_ = used >= ring_size_ ? 0u : ring_size_ - static_cast<mx_size_t>(used);
+    free_space_ -= free_space_ % element_size_;
+}
+
+mx_status_t DataPipe::ProducerMap(utils::RefPtr<VmAspace> aspace, void** buffer, void** control,
+                                  mx_size_t* size) {
+    AutoLock al(&lock_);
+
+    if (!consumer_.alive)
+        return ERR_CHANNEL_CLOSED;
+
+    return MapSharedLocked(&producer_, utils::move(aspace), buffer, control, size);
+}
+
+mx_status_t DataPipe::ConsumerMap(utils::RefPtr<VmAspace> aspace, void** buffer, void** control,
+                                  mx_size_t* size) {
+    AutoLock al(&lock_);
+    return MapSharedLocked(&consumer_, utils::move(aspace), buffer, control, size);
+}
+
+mx_status_t DataPipe::ProducerSync() {
+    if (!shared_cursors_)
+        return ERR_BAD_STATE;
+
+    AutoLock al(&lock_);
+
+    if (!consumer_.alive)
+        return ERR_CHANNEL_CLOSED;
+
+    LoadSharedCursorsLocked();
+    UpdateSignals();
+    return NO_ERROR;
+}
+
+mx_status_t DataPipe::ConsumerSync() {
+    if (!shared_cursors_)
+        return ERR_BAD_STATE;
+
+    AutoLock al(&lock_);
+
+    // the ring is dropped once the producer is gone and it is empty
+    if (!vmo_)
+        return ERR_CHANNEL_CLOSED;
+
+    LoadSharedCursorsLocked();
+    UpdateSignals();
+    return NO_ERROR;
+}
+
 void DataPipe::UpdateSignals() {
     if (free_space_ == 0u) {
         producer_.state_tracker.UpdateSatisfied(0u, MX_SIGNAL_WRITABLE);
         consumer_.state_tracker.UpdateSatisfied(MX_SIGNAL_READABLE, 0u);
-    } else if (free_space_ == vmo_->size()) {
+    } else if (free_space_ == ring_size_) {
         producer_.state_tracker.UpdateSatisfied(MX_SIGNAL_WRITABLE, 0u);
         consumer_.state_tracker.UpdateState(0u, MX_SIGNAL_READABLE,
                                             0u, producer_.alive ? 0u : MX_SIGNAL_READABLE);
@@ -128,8 +243,11 @@ void DataPipe::UpdateSignals() {
 }
 
 mx_status_t DataPipe::ProducerWriteFromUser(const void* ptr, mx_size_t* requested) {
-    if (*requested == 0)
+    // only whole elements go in or out
+    if (*requested == 0 || (*requested % element_size_) != 0u)
         return ERR_INVALID_ARGS;
+    if (shared_cursors_)
+        return ERR_BAD_STATE;
 
     AutoLock al(&lock_);
     // |expected| > 0 means there is a pending ProducerWriteBegin().
@@ -154,7 +272,7 @@ mx_status_t DataPipe::ProducerWriteFromUser(const void* ptr, mx_size_t* requeste
     free_space_ -= written;
     producer_.cursor += written;
 
-    if (producer_.cursor == vmo_->size())
+    if (producer_.cursor == ring_size_)
         producer_.cursor = 0u;
 
     UpdateSignals();
@@ -164,8 +282,11 @@ mx_status_t DataPipe::ProducerWriteFromUser(const void* ptr, mx_size_t* requeste
 
 mx_status_t DataPipe::ProducerWriteBegin(utils::RefPtr<VmAspace> aspace,
                                          void** ptr, mx_size_t* requested) {
+    *requested -= *requested % element_size_;
     if (*requested == 0)
         return ERR_INVALID_ARGS;
+    if (shared_cursors_)
+        return ERR_BAD_STATE;
 
     AutoLock al(&lock_);
     // |expected| > 0 means there is a pending ProducerWriteBegin().
@@ -196,14 +317,14 @@ mx_status_t DataPipe::ProducerWriteEnd(mx_size_t written) {
     if (!producer_.expected)
         return ERR_BAD_STATE;
 
-    if (written > producer_.expected)
+    if ((written % element_size_) != 0u || written > producer_.expected)
         return ERR_INVALID_ARGS;
 
     free_space_ -= written;
     producer_.cursor += written;
     producer_.expected = 0u;
 
-    if (producer_.cursor == vmo_->size())
+    if (producer_.cursor == ring_size_)
         producer_.cursor = 0u;
 
     UpdateSignals();
@@ -212,15 +333,18 @@ mx_status_t DataPipe::ProducerWriteEnd(mx_size_t written) {
 }
 
 mx_status_t DataPipe::ConsumerReadFromUser(void* ptr, mx_size_t* requested) {
-    if (*requested == 0)
+    // only whole elements go in or out
+    if (*requested == 0 || (*requested % element_size_) != 0u)
         return ERR_INVALID_ARGS;
+    if (shared_cursors_)
+        return ERR_BAD_STATE;
 
     AutoLock al(&lock_);
     // |expected| > 0 means there is a pending ConsumerReadBegin().
     if (consumer_.expected)
         return ERR_BUSY; // MOJO_RESULT_BUSY
 
-    if (free_space_ == vmo_->size())
+    if (free_space_ == ring_size_)
         return ERR_NOT_READY; // MOJO_RESULT_SHOULD_WAIT
 
     *requested = ComputeSize(consumer_.cursor, producer_.cursor, *requested);
@@ -235,7 +359,7 @@ mx_status_t DataPipe::ConsumerReadFromUser(void* ptr, mx_size_t* requested) {
     free_space_ += read;
     consumer_.cursor += read;
 
-    if (consumer_.cursor == vmo_->size())
+    if (consumer_.cursor == ring_size_)
         consumer_.cursor = 0u;
 
     UpdateSignals();
@@ -245,8 +369,11 @@ mx_status_t DataPipe::ConsumerReadFromUser(void* ptr, mx_size_t* requested) {
 
 mx_status_t DataPipe::ConsumerReadBegin(utils::RefPtr<VmAspace> aspace,
                                         void** ptr, mx_size_t* requested) {
+    *requested -= *requested % element_size_;
     if (*requested == 0)
         return ERR_INVALID_ARGS;
+    if (shared_cursors_)
+        return ERR_BAD_STATE;
 
     AutoLock al(&lock_);
 
@@ -254,7 +381,7 @@ mx_status_t DataPipe::ConsumerReadBegin(utils::RefPtr<VmAspace> aspace,
     if (consumer_.expected)
         return ERR_BUSY; // MOJO_RESULT_BUSY
 
-    if (free_space_ == vmo_->size())
+    if (free_space_ == ring_size_)
         return ERR_NOT_READY; // MOJO_RESULT_SHOULD_WAIT
 
     auto status = MapVMOIfNeeded(&consumer_, utils::move(aspace));
@@ -275,14 +402,14 @@ mx_status_t DataPipe::ConsumerReadEnd(mx_size_t read) {
     if (!consumer_.expected)
         return ERR_BAD_STATE;
 
-    if (read > consumer_.expected)
+    if ((read % element_size_) != 0u || read > consumer_.expected)
         return ERR_INVALID_ARGS;
 
     free_space_ += read;
     consumer_.cursor += read;
     consumer_.expected = 0u;
 
-    if (consumer_.cursor == vmo_->size())
+    if (consumer_.cursor == ring_size_)
         consumer_.cursor = 0u;
 
     UpdateSignals();
@@ -290,18 +417,154 @@ mx_status_t DataPipe::ConsumerReadEnd(mx_size_t read) {
     return NO_ERROR;
 }
 
-void DataPipe::OnProducerDestruction() {
+mx_status_t DataPipe::SumIovecs(const mx_iovec_t* iov, uint32_t iov_count, mx_size_t* total) {
+    mx_size_t sum = 0u;
+    for (uint32_t ix = 0; ix != iov_count; ++ix) {
+        if (iov[ix].size > kMaxDataPipeCapacity - sum)
+            return ERR_TOO_BIG;
+        if (iov[ix].size && !iov[ix].buffer)
+            return ERR_INVALID_ARGS;
+        sum += iov[ix].size;
+    }
+
+    if (sum == 0u || (sum % element_size_) != 0u)
+        return ERR_INVALID_ARGS;
+
+    *total = sum;
+    return NO_ERROR;
+}
+
+mx_status_t DataPipe::CopyToRingFromUser(mx_size_t cursor, const void* ptr, mx_size_t len) {
+    const uint8_t* src = static_cast<const uint8_t*>(ptr);
+    while (len) {
+        mx_size_t chunk = MIN(len, ring_size_ - cursor);
+        size_t written = 0u;
+        status_t status = vmo_->WriteUser(src, cursor, chunk, &written);
+        if (status < 0)
+            return status;
+        if (written != chunk)
+            return ERR_INVALID_ARGS;
+
+        src += chunk;
+        len -= chunk;
+        cursor = 0u;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t DataPipe::CopyFromRingToUser(mx_size_t cursor, void* ptr, mx_size_t len) {
+    uint8_t* dst = static_cast<uint8_t*>(ptr);
+    while (len) {
+        mx_size_t chunk = MIN(len, ring_size_ - cursor);
+        size_t read = 0u;
+        status_t status = vmo_->ReadUser(dst, cursor, chunk, &read);
+        if (status < 0)
+            return status;
+        if (read != chunk)
+            return ERR_INVALID_ARGS;
+
+        dst += chunk;
+        len -= chunk;
+        cursor = 0u;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t DataPipe::ProducerWriteVFromUser(const mx_iovec_t* iov, uint32_t iov_count,
+                                             bool all_or_none, mx_size_t* written) {
+    mx_size_t total;
+    mx_status_t status = SumIovecs(iov, iov_count, &total);
+    if (status != NO_ERROR)
+        return status;
+    if (shared_cursors_)
+        return ERR_BAD_STATE;
+
     AutoLock al(&lock_);
+    // |expected| > 0 means there is a pending ProducerWriteBegin().
+    if (producer_.expected)
+        return ERR_BUSY; // MOJO_RESULT_BUSY
 
-    producer_.alive = false;
+    if (!consumer_.alive)
+        return ERR_CHANNEL_CLOSED; // MOJO_RESULT_FAILED_PRECONDITION
+
+    // both are whole elements, so this is too
+    mx_size_t len = MIN(total, free_space_);
+    if (len == 0u || (all_or_none && len < total))
+        return ERR_NOT_READY; // MOJO_RESULT_SHOULD_WAIT
+
+    // nothing is committed until it has all been copied in
+    mx_size_t cursor = producer_.cursor;
+    mx_size_t remaining = len;
+    for (uint32_t ix = 0; ix != iov_count && remaining; ++ix) {
+        mx_size_t chunk = MIN(iov[ix].size, remaining);
+        status = CopyToRingFromUser(cursor, iov[ix].buffer, chunk);
+        if (status != NO_ERROR)
+            return status;
+
+        cursor = (cursor + chunk) % ring_size_;
+        remaining -= chunk;
+    }
+
+    free_space_ -= len;
+    producer_.cursor = cursor;
+
+    UpdateSignals();
 
-    if (producer_.aspace) {
-        producer_.aspace->FreeRegion(reinterpret_cast<vaddr_t>(producer_.vad_start));
-        producer_.aspace.reset();
+    *written = len;
+    return NO_ERROR;
+}
+
+mx_status_t DataPipe::ConsumerReadVFromUser(const mx_iovec_t* iov, uint32_t iov_count,
+                                            bool all_or_none, mx_size_t* read) {
+    mx_size_t total;
+    mx_status_t status = SumIovecs(iov, iov_count, &total);
+    if (status != NO_ERROR)
+        return status;
+    if (shared_cursors_)
+        return ERR_BAD_STATE;
+
+    AutoLock al(&lock_);
+    // |expected| > 0 means there is a pending ConsumerReadBegin().
+    if (consumer_.expected)
+        return ERR_BUSY; // MOJO_RESULT_BUSY
+
+    mx_size_t len = MIN(total, ring_size_ - free_space_);
+    if (len == 0u || (all_or_none && len < total))
+        return ERR_NOT_READY; // MOJO_RESULT_SHOULD_WAIT
+
+    mx_size_t cursor = consumer_.cursor;
+    mx_size_t remaining = len;
+    for (uint32_t ix = 0; ix != iov_count && remaining; ++ix) {
+        mx_size_t chunk = MIN(iov[ix].size, remaining);
+        status = CopyFromRingToUser(cursor, iov[ix].buffer, chunk);
+        if (status != NO_ERROR)
+            return status;
+
+        cursor = (cursor + chunk) % ring_size_;
+        remaining -= chunk;
     }
 
+    free_space_ += len;
+    consumer_.cursor = cursor;
+
+    UpdateSignals();
+
+    *read = len;
+    return NO_ERROR;
+}
+
+void DataPipe::OnProducerDestruction() {
+    AutoLock al(&lock_);
+
+    producer_.alive = false;
+    UnmapLocked(&producer_);
+
     if (consumer_.alive) {
-        bool is_empty = (free_space_ == vmo_->size());
+        // whatever the producer last wrote is still there for the consumer
+        if (shared_cursors_)
+            LoadSharedCursorsLocked();
+
+        bool is_empty = (free_space_ == ring_size_);
         consumer_.state_tracker.UpdateState(MX_SIGNAL_PEER_CLOSED, 0u,
                                             0u, is_empty ? MX_SIGNAL_READABLE : 0u);
 
@@ -316,11 +579,7 @@ void DataPipe::OnConsumerDestruction() {
 
     consumer_.alive = false;
     vmo_.reset();
-
-    if (consumer_.aspace) {
-        consumer_.aspace->FreeRegion(reinterpret_cast<vaddr_t>(consumer_.vad_start));
-        consumer_.aspace.reset();
-    }
+    UnmapLocked(&consumer_);
 
     if (producer_.alive) {
         producer_.state_tracker.UpdateState(MX_SIGNAL_PEER_CLOSED, MX_SIGNAL_WRITABLE,
@@ -44,6 +44,11 @@ mx_status_t DataPipeConsumerDispatcher::Read(void* buffer, mx_size_t* requested)
     return pipe_->ConsumerReadFromUser(buffer, requested);
 }
 
+mx_status_t DataPipeConsumerDispatcher::ReadV(const mx_iovec_t* iov, uint32_t iov_count,
+                                              bool all_or_none, mx_size_t* read) {
+    return pipe_->ConsumerReadVFromUser(iov, iov_count, all_or_none, read);
+}
+
 mx_status_t DataPipeConsumerDispatcher::BeginRead(utils::RefPtr<VmAspace> aspace,
                                                   void** buffer, mx_size_t* requested) {
     if (*requested > kMaxDataPipeCapacity) {
@@ -56,3 +61,12 @@ mx_status_t DataPipeConsumerDispatcher::BeginRead(utils::RefPtr<VmAspace> aspace
 mx_status_t DataPipeConsumerDispatcher::EndRead(mx_size_t read) {
     return pipe_->ConsumerReadEnd(read);
 }
+
+mx_status_t DataPipeConsumerDispatcher::Map(utils::RefPtr<VmAspace> aspace, void** buffer,
+                                            void** control, mx_size_t* size) {
+    return pipe_->ConsumerMap(utils::move(aspace), buffer, control, size);
+}
+
+mx_status_t DataPipeConsumerDispatcher::Sync() {
+    return pipe_->ConsumerSync();
+}
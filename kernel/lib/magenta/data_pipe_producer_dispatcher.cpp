@@ -48,6 +48,11 @@ mx_status_t DataPipeProducerDispatcher::Write(const void* buffer, mx_size_t* req
     return pipe_->ProducerWriteFromUser(buffer, requested);
 }
 
+mx_status_t DataPipeProducerDispatcher::WriteV(const mx_iovec_t* iov, uint32_t iov_count,
+                                               bool all_or_none, mx_size_t* written) {
+    return pipe_->ProducerWriteVFromUser(iov, iov_count, all_or_none, written);
+}
+
 mx_status_t DataPipeProducerDispatcher::BeginWrite(utils::RefPtr<VmAspace> aspace,
                                                    void** buffer, mx_size_t* requested) {
     if (*requested > kMaxDataPipeCapacity) {
@@ -60,3 +65,12 @@ mx_status_t DataPipeProducerDispatcher::BeginWrite(utils::RefPtr<VmAspace> aspac
 mx_status_t DataPipeProducerDispatcher::EndWrite(mx_size_t written) {
     return pipe_->ProducerWriteEnd(written);
 }
+
+mx_status_t DataPipeProducerDispatcher::Map(utils::RefPtr<VmAspace> aspace, void** buffer,
+                                            void** control, mx_size_t* size) {
+    return pipe_->ProducerMap(utils::move(aspace), buffer, control, size);
+}
+
+mx_status_t DataPipeProducerDispatcher::Sync() {
+    return pipe_->ProducerSync();
+}
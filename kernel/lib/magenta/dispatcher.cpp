@@ -7,20 +7,61 @@
 #include <magenta/dispatcher.h>
 
 #include <arch/ops.h>
+#include <kernel/auto_lock.h>
+#include <kernel/mutex.h>
+
+#include <utils/intrusive_hash_table.h>
 
 static mx_koid_t global_koid = 255ULL;
 
+namespace {
+
+// Every object that has had a handle, by koid. Split into stripes with a
+// lock each so that creating and destroying objects on different cpus
+// rarely contend. Lookups take a reference under the stripe lock, and
+// objects leave the index in ~Dispatcher() under the same lock, so a
+// lookup never sees freed memory; it skips objects whose last reference
+// is already gone.
+//
+// Each stripe also counts the objects of each type that have entered and
+// left it, which are kept under its lock and summed by GetObjectStats().
+constexpr uint32_t kKoidIndexStripes = 16u;
+
+struct KoidIndexStripe {
+    mutex_t lock = MUTEX_INITIAL_VALUE(lock);
+    utils::HashTable<mx_koid_t, Dispatcher*,
+                     utils::DoublyLinkedList<Dispatcher*, Dispatcher::KoidIndexTraits>,
+                     uint32_t, 61u> objects;
+    uint64_t created[MX_OBJ_TYPE_LAST] = {};
+    uint64_t destroyed[MX_OBJ_TYPE_LAST] = {};
+} __CPU_ALIGN;
+
+KoidIndexStripe koid_index[kKoidIndexStripes];
+
+KoidIndexStripe& KoidIndexStripeFor(mx_koid_t koid) {
+    return koid_index[koid % kKoidIndexStripes];
+}
+
+}  // namespace
+
 mx_koid_t Dispatcher::GenerateKernelObjectId() {
     return atomic_add_u64(&global_koid, 1ULL);
 }
 
 Dispatcher::Dispatcher()
     : koid_(GenerateKernelObjectId()),
-      handle_count_(0u) {
+      handle_count_(0u),
+      indexed_type_(MX_OBJ_TYPE_NONE) {
+}
+
+Dispatcher::~Dispatcher() {
+    RemoveFromKoidIndex();
 }
 
 void Dispatcher::add_handle() {
-    atomic_add_relaxed(&handle_count_, 1);
+    // the first handle is when the object becomes visible to usermode
+    if (atomic_add_relaxed(&handle_count_, 1) == 0)
+        AddToKoidIndex();
 }
 
 void Dispatcher::remove_handle() {
@@ -29,3 +70,58 @@ void Dispatcher::remove_handle() {
         on_zero_handles();
     }
 }
+
+void Dispatcher::AddToKoidIndex() {
+    KoidIndexStripe& stripe = KoidIndexStripeFor(koid_);
+    AutoLock lock(&stripe.lock);
+    // an object stays indexed once it's in, even while it has no handles
+    if (!koid_index_node_state_.InContainer()) {
+        // the type can't be had in the destructor, so it's kept for then
+        indexed_type_ = GetType();
+        stripe.created[indexed_type_]++;
+        stripe.objects.insert(this);
+    }
+}
+
+void Dispatcher::RemoveFromKoidIndex() {
+    // Nothing can add us once the last reference is gone, and lookups don't
+    // touch the node, so objects that were never indexed can skip the lock.
+    if (!koid_index_node_state_.InContainer())
+        return;
+
+    KoidIndexStripe& stripe = KoidIndexStripeFor(koid_);
+    AutoLock lock(&stripe.lock);
+    stripe.destroyed[indexed_type_]++;
+    stripe.objects.erase(*this);
+}
+
+// static
+size_t Dispatcher::GetObjectStats(mx_object_stats_t* stats, size_t count) {
+    // type 0 is MX_OBJ_TYPE_NONE, which no object has
+    size_t types = MX_OBJ_TYPE_LAST - 1;
+    if (count > types)
+        count = types;
+
+    for (size_t ix = 0; ix < count; ++ix) {
+        stats[ix] = {};
+        stats[ix].type = static_cast<uint32_t>(ix + 1);
+    }
+    for (KoidIndexStripe& stripe : koid_index) {
+        AutoLock lock(&stripe.lock);
+        for (size_t ix = 0; ix < count; ++ix) {
+            stats[ix].created += stripe.created[ix + 1];
+            stats[ix].destroyed += stripe.destroyed[ix + 1];
+        }
+    }
+    return count;
+}
+
+// static
+utils::RefPtr<Dispatcher> Dispatcher::LookupByKoid(mx_koid_t koid) {
+    KoidIndexStripe& stripe = KoidIndexStripeFor(koid);
+    AutoLock lock(&stripe.lock);
+    Dispatcher* dispatcher = stripe.objects.find(koid);
+    if (!dispatcher || !dispatcher->AddRefMaybeInDestructor())
+        return nullptr;
+    return utils::internal::MakeRefPtrNoAdopt(dispatcher);
+}
@@ -46,10 +46,16 @@ void ExceptionPort::OnDestruction() {
     // TODO(dje): Remember this isn't wired up yet.
 }
 
-IOP_Packet* ExceptionPort::MakePacket(uint64_t key, const mx_exception_report_t* report, mx_size_t size) {
-    auto pk = IOP_Packet::Alloc(size + sizeof(mx_packet_header_t));
-    if (!pk)
+IOP_Packet* ExceptionPort::MakePacket(uint64_t key, const mx_exception_report_t* report, mx_size_t size,
+                                      IOP_PacketHome* home) {
+    IOP_Packet* pk;
+    if (home) {
+        pk = home->Take(size + sizeof(mx_packet_header_t));
+        if (!pk)
+            return nullptr;
+    } else if (io_port_->AllocPacket(size + sizeof(mx_packet_header_t), &pk) != NO_ERROR) {
         return nullptr;
+    }
 
     auto pkt_data = reinterpret_cast<mx_exception_packet_t*>(
         reinterpret_cast<char*>(pk) + sizeof(IOP_Packet));
@@ -62,11 +68,11 @@ IOP_Packet* ExceptionPort::MakePacket(uint64_t key, const mx_exception_report_t*
     return pk;
 }
 
-mx_status_t ExceptionPort::SendReport(const mx_exception_report_t* report) {
+mx_status_t ExceptionPort::SendReport(const mx_exception_report_t* report, IOP_PacketHome* home) {
     LTRACEF("Sending exception report, type %u, pid %llu, tid %llu\n",
             report->header.type, report->context.pid, report->context.tid);
 
-    auto iopk = MakePacket(io_port_key_, report, sizeof(*report));
+    auto iopk = MakePacket(io_port_key_, report, sizeof(*report), home);
     if (!iopk)
         return ERR_NO_MEMORY;
 
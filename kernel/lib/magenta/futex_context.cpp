@@ -11,25 +11,93 @@
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
 #include <trace.h>
+#include <utils/auto_call.h>
 
 #define LOCAL_TRACE 0
 
+// Shared futexes of all processes live here.
+static FutexContext shared_futex_context;
+
+FutexContext* FutexContext::Shared() {
+    return &shared_futex_context;
+}
+
 FutexContext::FutexContext() {
     LTRACE_ENTRY;
 
-    mutex_init(&lock_);
+    for (auto& bucket : buckets_)
+        mutex_init(&bucket.lock);
+    mutex_init(&pi_lock_);
 }
 
 FutexContext::~FutexContext() {
     LTRACE_ENTRY;
 
-    mutex_destroy(&lock_);
+    DEBUG_ASSERT(pi_waiters_.is_empty());
+
+    mutex_destroy(&pi_lock_);
+    for (auto& bucket : buckets_)
+        mutex_destroy(&bucket.lock);
+}
+
+FutexNode* FutexContext::Bucket::Find(const FutexKey& key) {
+    for (auto& head : heads) {
+        if (head.GetKey() == key)
+            return &head;
+    }
+    return nullptr;
+}
+
+FutexNode* FutexContext::Bucket::Erase(const FutexKey& key) {
+    return heads.erase_if([&key](const FutexNode& head) { return head.GetKey() == key; });
+}
+
+FutexContext::Bucket* FutexContext::LockNodeBucket(FutexNode* node) {
+    for (;;) {
+        Bucket* bucket = BucketFor(node->GetKey());
+        mutex_acquire(&bucket->lock);
+        // the key can't change under us now, unless it was changed before we
+        // got the lock and names a futex in another bucket
+        if (BucketFor(node->GetKey()) == bucket)
+            return bucket;
+        mutex_release(&bucket->lock);
+    }
 }
 
 status_t FutexContext::FutexWait(int* value_ptr, int current_value, mx_time_t timeout) {
     LTRACE_ENTRY;
 
-    uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr);
+    return FutexWaitInternal(value_ptr, FutexKey::Private(value_ptr), current_value, nullptr,
+                             timeout);
+}
+
+status_t FutexContext::FutexWaitPi(int* value_ptr, int current_value,
+                                   utils::RefPtr<UserThread> owner, mx_time_t timeout) {
+    LTRACE_ENTRY;
+
+    DEBUG_ASSERT(owner);
+
+    // Waiting for ourselves would never finish.
+    if (owner.get() == UserThread::GetCurrent())
+        return ERR_INVALID_ARGS;
+
+    return FutexWaitInternal(value_ptr, FutexKey::Private(value_ptr), current_value,
+                             utils::move(owner), timeout);
+}
+
+status_t FutexContext::FutexWaitShared(int* value_ptr, utils::RefPtr<VmObject> object,
+                                       uintptr_t offset, int current_value, mx_time_t timeout) {
+    LTRACE_ENTRY;
+
+    // |object| is held until we are off the wait queue, so that no other
+    // object can take its address, and with it our key, meanwhile.
+    return FutexWaitInternal(value_ptr, FutexKey{object.get(), offset}, current_value, nullptr,
+                             timeout);
+}
+
+status_t FutexContext::FutexWaitInternal(int* value_ptr, const FutexKey& futex_key,
+                                         int current_value, utils::RefPtr<UserThread> pi_owner,
+                                         mx_time_t timeout) {
     FutexNode* node;
 
     // FutexWait() checks that the address value_ptr still contains
@@ -38,31 +106,62 @@ status_t FutexContext::FutexWait(int* value_ptr, int current_value, mx_time_t ti
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    AutoLock lock(lock_);
+    Bucket* bucket = BucketFor(futex_key);
+    mutex_acquire(&bucket->lock);
     int value;
     status_t result = magenta_copy_from_user(value_ptr, &value, sizeof(value));
-    if (result != NO_ERROR) return result;
-    if (value != current_value) return ERR_BUSY;
+    if (result == NO_ERROR && value != current_value)
+        result = ERR_BUSY;
+    if (result != NO_ERROR) {
+        mutex_release(&bucket->lock);
+        return result;
+    }
 
     node = UserThread::GetCurrent()->futex_node();
     node->set_hash_key(futex_key);
     node->set_next(nullptr);
     node->set_tail(node);
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(bucket, node);
+
+    if (pi_owner) {
+        AutoLock pi_lock(pi_lock_);
+        UserThread* owner = pi_owner.get();
+        node->set_pi_owner(utils::move(pi_owner), get_current_thread()->priority);
+        pi_waiters_.push_back(node);
+        UpdatePiOwnerLocked(owner);
+    }
 
     // Block current thread
-    result = node->BlockThread(&lock_, timeout);
+    result = node->BlockThread(&bucket->lock, timeout);
+
+    // If FutexRequeue() moved us to another futex, whoever wakes us or times
+    // us out does so holding that futex's bucket lock, so switch to it. This
+    // also makes sure a FutexWake() there is done with our node before we
+    // return and reuse it.
+    if (BucketFor(node->GetKey()) != bucket) {
+        mutex_release(&bucket->lock);
+        bucket = LockNodeBucket(node);
+    }
+
     if (result == NO_ERROR) {
         // All the work necessary for removing us from the hash table was be done by FutexWake()
+        mutex_release(&bucket->lock);
         return NO_ERROR;
     }
-    // If we got a timeout, we need to remove the thread's node from the
+
+    result = RemoveTimedOutLocked(bucket, node);
+    mutex_release(&bucket->lock);
+    return result;
+}
+
+status_t FutexContext::RemoveTimedOutLocked(Bucket* bucket, FutexNode* node) {
+    // We got a timeout, so we need to remove the thread's node from the
     // wait queue, since FutexWake() didn't do that.  We need to re-get the
     // hash table key, because it might have changed if the thread was
     // requeued by FutexRequeue().
-    futex_key = node->GetKey();
-    FutexNode* list_head = futex_table_.find(futex_key);
+    FutexKey futex_key = node->GetKey();
+    FutexNode* list_head = bucket->Find(futex_key);
     FutexNode* test = list_head;
     FutexNode* prev = nullptr;
     while (test) {
@@ -79,13 +178,16 @@ status_t FutexContext::FutexWait(int* value_ptr, int current_value, mx_time_t ti
                 }
             } else {
                 // reset head of futex
-                futex_table_.erase(futex_key);
+                bucket->Erase(futex_key);
                 if (next) {
                     next->set_tail(list_head->tail());
                     DEBUG_ASSERT(next->GetKey() == futex_key);
-                    futex_table_.insert(next);
+                    bucket->Insert(next);
                 }
             }
+            // we are off the list, stop lending our priority out
+            node->set_next(nullptr);
+            ReleasePiLocked(node);
             return ERR_TIMED_OUT;
         }
         prev = test;
@@ -116,14 +218,23 @@ status_t FutexContext::FutexWait(int* value_ptr, int current_value, mx_time_t ti
 status_t FutexContext::FutexWake(int* value_ptr, uint32_t count) {
     LTRACE_ENTRY;
 
-    if (count == 0) return NO_ERROR;
+    return FutexWakeInternal(FutexKey::Private(value_ptr), count);
+}
+
+status_t FutexContext::FutexWakeShared(const VmObject* object, uintptr_t offset, uint32_t count) {
+    LTRACE_ENTRY;
 
-    uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr);
+    return FutexWakeInternal(FutexKey{object, offset}, count);
+}
+
+status_t FutexContext::FutexWakeInternal(const FutexKey& futex_key, uint32_t count) {
+    if (count == 0) return NO_ERROR;
 
     {
-        AutoLock lock(lock_);
+        Bucket* bucket = BucketFor(futex_key);
+        AutoLock lock(&bucket->lock);
 
-        FutexNode* node = futex_table_.erase(futex_key);
+        FutexNode* node = bucket->Erase(futex_key);
         if (!node) {
             // nothing blocked on this futex if we can't find it
             return NO_ERROR;
@@ -131,18 +242,21 @@ status_t FutexContext::FutexWake(int* value_ptr, uint32_t count) {
         DEBUG_ASSERT(node->GetKey() == futex_key);
 
         FutexNode* wake_head = node;
-        node = node->RemoveFromHead(count, futex_key, 0u);
+        // The woken nodes keep their key, which sends a waiter that times out
+        // meanwhile to this bucket lock, see FutexWaitInternal().
+        node = node->RemoveFromHead(count, futex_key, futex_key);
         // node is now the new blocked thread list head
 
         if (node != nullptr) {
             DEBUG_ASSERT(node->GetKey() == futex_key);
-            futex_table_.insert(node);
+            bucket->Insert(node);
         }
 
         // Traversing this list of threads must be done while holding the
-        // lock, because any of these threads might wake up from a timeout
-        // and call FutexWait(), which would clobber the "next" pointer in
-        // the thread's FutexNode.
+        // bucket lock, because any of these threads might wake up from a
+        // timeout and call FutexWait(), which would clobber the "next" pointer
+        // in the thread's FutexNode.
+        ReleasePiLocked(wake_head);
         FutexNode::WakeThreads(wake_head);
     }
 
@@ -156,21 +270,34 @@ status_t FutexContext::FutexRequeue(int* wake_ptr, uint32_t wake_count, int curr
     if ((requeue_ptr == nullptr) && requeue_count)
         return ERR_INVALID_ARGS;
 
-    AutoLock lock(lock_);
+    FutexKey wake_key = FutexKey::Private(wake_ptr);
+    FutexKey requeue_key = FutexKey::Private(requeue_ptr);
+    if (wake_key == requeue_key) return ERR_INVALID_ARGS;
+
+    // Hold the locks of both buckets, always taking the lower one first so
+    // that requeues going opposite ways can't deadlock.
+    Bucket* wake_bucket = BucketFor(wake_key);
+    Bucket* requeue_bucket = BucketFor(requeue_key);
+    AutoLock lock(&MIN(wake_bucket, requeue_bucket)->lock);
+    mutex_t* second_lock = nullptr;
+    if (wake_bucket != requeue_bucket) {
+        second_lock = &MAX(wake_bucket, requeue_bucket)->lock;
+        mutex_acquire(second_lock);
+    }
+    auto release_second = utils::MakeAutoCall([second_lock]() {
+        if (second_lock)
+            mutex_release(second_lock);
+    });
 
     int value;
     status_t result = magenta_copy_from_user(wake_ptr, &value, sizeof(value));
     if (result != NO_ERROR) return result;
     if (value != current_value) return ERR_BUSY;
 
-    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr);
-    uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr);
-    if (wake_key == requeue_key) return ERR_INVALID_ARGS;
-
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
-    // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    // nodes below, because the buckets look at the GetKey field of the
+    // list head nodes for wake_key and requeue_key.
+    FutexNode* node = wake_bucket->Erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
         return NO_ERROR;
@@ -181,7 +308,7 @@ status_t FutexContext::FutexRequeue(int* wake_ptr, uint32_t wake_count, int curr
         wake_head = nullptr;
     } else {
         wake_head = node;
-        node = node->RemoveFromHead(wake_count, wake_key, 0u);
+        node = node->RemoveFromHead(wake_count, wake_key, wake_key);
     }
 
     // node is now the head of wake_ptr futex after possibly removing some threads to wake
@@ -191,30 +318,59 @@ status_t FutexContext::FutexRequeue(int* wake_ptr, uint32_t wake_count, int curr
             FutexNode* requeue_head = node;
             node = node->RemoveFromHead(requeue_count, wake_key, requeue_key);
 
-            // now requeue our nodes to requeue_ptr mutex
+            // now requeue our nodes to requeue_ptr mutex. the owner of that
+            // futex is not known, so requeued PI waiters stop lending priority.
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            QueueNodesLocked(requeue_bucket, requeue_head);
+            ReleasePiLocked(requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_bucket->Insert(node);
     }
 
+    ReleasePiLocked(wake_head);
     FutexNode::WakeThreads(wake_head);
     return NO_ERROR;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    FutexNode* current_head = futex_table_.find(head->GetKey());
+void FutexContext::QueueNodesLocked(Bucket* bucket, FutexNode* head) {
+    FutexNode* current_head = bucket->Find(head->GetKey());
 
     if (!current_head) {
         // The current thread is first to block on this futex, so add it to the hash table.
-        futex_table_.insert(head);
+        bucket->Insert(head);
     } else {
         // push node for current thread at end of list
         current_head->AppendList(head);
     }
 }
+
+void FutexContext::ReleasePiLocked(FutexNode* head) {
+    for (FutexNode* node = head; node != nullptr; node = node->next()) {
+        // only the holder of the node's bucket lock changes its owner, so
+        // this can be checked without |pi_lock_|
+        if (!node->pi_owner())
+            continue;
+
+        AutoLock pi_lock(pi_lock_);
+        pi_waiters_.erase(*node);
+        utils::RefPtr<UserThread> owner = node->take_pi_owner();
+        UpdatePiOwnerLocked(owner.get());
+    }
+}
+
+void FutexContext::UpdatePiOwnerLocked(UserThread* owner) {
+    DEBUG_ASSERT(is_mutex_held(&pi_lock_));
+
+    int priority = 0;
+    for (const auto& node : pi_waiters_) {
+        if (node.pi_owner() == owner && node.pi_priority() > priority)
+            priority = node.pi_priority();
+    }
+
+    owner->SetInheritedPriority(priority);
+}
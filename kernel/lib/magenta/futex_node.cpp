@@ -6,13 +6,15 @@
 
 #include <assert.h>
 #include <err.h>
+#include <kernel/thread.h>
 #include <magenta/futex_node.h>
 #include <magenta/magenta.h>
+#include <magenta/user_thread.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
 
-FutexNode::FutexNode() : next_(nullptr), tail_(nullptr) {
+FutexNode::FutexNode() : hash_key_{nullptr, 0u}, next_(nullptr), tail_(nullptr) {
     LTRACE_ENTRY;
 
     cond_init(&condvar_);
@@ -34,8 +36,8 @@ void FutexNode::AppendList(FutexNode* head) {
 
 // remove up to |count| nodes from our head and return new head
 // the removed nodes remain a valid list after this operation
-FutexNode* FutexNode::RemoveFromHead(uint32_t count, uintptr_t old_hash_key,
-                                     uintptr_t new_hash_key) {
+FutexNode* FutexNode::RemoveFromHead(uint32_t count, const FutexKey& old_hash_key,
+                                     const FutexKey& new_hash_key) {
     if (count == 0) return this;
 
     FutexNode* node = this;
@@ -56,10 +58,22 @@ FutexNode* FutexNode::RemoveFromHead(uint32_t count, uintptr_t old_hash_key,
     return node;
 }
 
+void FutexNode::set_pi_owner(utils::RefPtr<UserThread> owner, int priority) {
+    pi_owner_ = utils::move(owner);
+    pi_priority_ = priority;
+}
+
+utils::RefPtr<UserThread> FutexNode::take_pi_owner() {
+    return utils::move(pi_owner_);
+}
+
 status_t FutexNode::BlockThread(mutex_t* mutex, mx_time_t timeout) {
     lk_time_t t = mx_time_to_lk(timeout);
 
-    return cond_wait_timeout(&condvar_, mutex, t);
+    enum thread_wait_reason reason = thread_set_wait_reason(THREAD_WAIT_FUTEX);
+    status_t result = cond_wait_timeout(&condvar_, mutex, t);
+    thread_set_wait_reason(reason);
+    return result;
 }
 
 void FutexNode::WakeThreads(FutexNode* head) {
@@ -14,6 +14,7 @@
 #include <utils/ref_ptr.h>
 
 #include <magenta/state_tracker.h>
+#include <magenta/syscalls-types.h>
 
 class Handle;
 class VmObject;
@@ -26,7 +27,7 @@ constexpr mx_size_t kMaxDataPipeCapacity = 256 * 1024 * 1024;
 
 class DataPipe : public utils::RefCounted<DataPipe> {
 public:
-    static mx_status_t Create(mx_size_t capacity,
+    static mx_status_t Create(mx_size_t element_size, mx_size_t capacity, bool shared_cursors,
                               utils::RefPtr<Dispatcher>* producer,
                               utils::RefPtr<Dispatcher>* consumer,
                               mx_rights_t* producer_rights,
@@ -40,12 +41,34 @@ public:
     mx_status_t ProducerWriteFromUser(const void* ptr, mx_size_t* requested);
     mx_status_t ConsumerReadFromUser(void* ptr, mx_size_t* requested);
 
+    // Move as many whole elements as there are room or data for between the
+    // ring and the user buffers in |iov| (a kernel copy of the list), going
+    // round the end of the ring as needed. The buffers add up to a whole
+    // number of elements. With |all_or_none| the call fails with
+    // ERR_NOT_READY unless all of it can be done.
+    mx_status_t ProducerWriteVFromUser(const mx_iovec_t* iov, uint32_t iov_count,
+                                       bool all_or_none, mx_size_t* written);
+    mx_status_t ConsumerReadVFromUser(const mx_iovec_t* iov, uint32_t iov_count,
+                                      bool all_or_none, mx_size_t* read);
+
     mx_status_t ProducerWriteBegin(utils::RefPtr<VmAspace> aspace, void** ptr, mx_size_t* requested);
     mx_status_t ProducerWriteEnd(mx_size_t written);
 
     mx_status_t ConsumerReadBegin(utils::RefPtr<VmAspace> aspace, void** ptr, mx_size_t* requested);
     mx_status_t ConsumerReadEnd(mx_size_t read);
 
+    // With shared cursors the ring and a control page holding the cursors
+    // (an mx_data_pipe_control_t) are mapped into both ends, which move data
+    // without the kernel. The kernel only looks at the cursors to update the
+    // signals, when either end asks it to with Sync(), and the copying calls
+    // above fail with ERR_BAD_STATE.
+    mx_status_t ProducerMap(utils::RefPtr<VmAspace> aspace, void** buffer, void** control,
+                            mx_size_t* size);
+    mx_status_t ConsumerMap(utils::RefPtr<VmAspace> aspace, void** buffer, void** control,
+                            mx_size_t* size);
+    mx_status_t ProducerSync();
+    mx_status_t ConsumerSync();
+
     void OnProducerDestruction();
     void OnConsumerDestruction();
 
@@ -55,23 +78,36 @@ private:
         bool read_only = false;
         mx_size_t cursor = 0u;
         char* vad_start = 0u;
+        char* control_start = 0u;
         mx_size_t expected = 0u;
         utils::RefPtr<VmAspace> aspace;
         StateTracker state_tracker;
     };
 
-    DataPipe(mx_size_t capacity);
+    DataPipe(mx_size_t element_size, mx_size_t capacity, bool shared_cursors);
     bool Init();
 
     mx_size_t ComputeSize(mx_size_t from, mx_size_t to, mx_size_t requested);
+    mx_status_t SumIovecs(const mx_iovec_t* iov, uint32_t iov_count, mx_size_t* total);
+    mx_status_t CopyToRingFromUser(mx_size_t cursor, const void* ptr, mx_size_t len);
+    mx_status_t CopyFromRingToUser(mx_size_t cursor, void* ptr, mx_size_t len);
     mx_status_t MapVMOIfNeeded(EndPoint* ep, utils::RefPtr<VmAspace> aspace);
+    mx_status_t MapSharedLocked(EndPoint* ep, utils::RefPtr<VmAspace> aspace, void** buffer,
+                                void** control, mx_size_t* size);
+    void UnmapLocked(EndPoint* ep);
+    void LoadSharedCursorsLocked();
     void UpdateSignals();
 
+    const mx_size_t element_size_;
     const mx_size_t capacity_;
+    const bool shared_cursors_;
 
     mutex_t lock_;
     EndPoint producer_;
     EndPoint consumer_;
     utils::RefPtr<VmObject> vmo_;
+    utils::RefPtr<VmObject> control_vmo_;
+    // the usable part of |vmo_|: a whole number of elements
+    mx_size_t ring_size_;
     mx_size_t free_space_;
 };
@@ -13,6 +13,7 @@
 
 #include <magenta/dispatcher.h>
 #include <magenta/state_tracker.h>
+#include <magenta/syscalls-types.h>
 #include <magenta/types.h>
 
 #include <utils/ref_counted.h>
@@ -32,10 +33,17 @@ public:
     StateTracker* get_state_tracker() final;
 
     mx_status_t Read(void* buffer, mx_size_t* requested);
+    mx_status_t ReadV(const mx_iovec_t* iov, uint32_t iov_count, bool all_or_none,
+                      mx_size_t* read);
 
     mx_status_t BeginRead(utils::RefPtr<VmAspace> aspace, void** buffer, mx_size_t* requested);
     mx_status_t EndRead(mx_size_t read);
 
+    // For pipes with shared cursors, see DataPipe::ConsumerMap().
+    mx_status_t Map(utils::RefPtr<VmAspace> aspace, void** buffer, void** control,
+                    mx_size_t* size);
+    mx_status_t Sync();
+
 private:
     DataPipeConsumerDispatcher(utils::RefPtr<DataPipe> pipe);
 
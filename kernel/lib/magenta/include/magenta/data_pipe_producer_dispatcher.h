@@ -13,6 +13,7 @@
 
 #include <magenta/dispatcher.h>
 #include <magenta/state_tracker.h>
+#include <magenta/syscalls-types.h>
 #include <magenta/types.h>
 
 #include <utils/ref_counted.h>
@@ -32,9 +33,16 @@ public:
     StateTracker* get_state_tracker() final;
 
     mx_status_t Write(const void* buffer, mx_size_t* requested);
+    mx_status_t WriteV(const mx_iovec_t* iov, uint32_t iov_count, bool all_or_none,
+                       mx_size_t* written);
     mx_status_t BeginWrite(utils::RefPtr<VmAspace> aspace, void** buffer, mx_size_t* requested);
     mx_status_t EndWrite(mx_size_t written);
 
+    // For pipes with shared cursors, see DataPipe::ProducerMap().
+    mx_status_t Map(utils::RefPtr<VmAspace> aspace, void** buffer, void** control,
+                    mx_size_t* size);
+    mx_status_t Sync();
+
 private:
     DataPipeProducerDispatcher(utils::RefPtr<DataPipe> pipe);
 
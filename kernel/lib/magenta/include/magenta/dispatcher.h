@@ -15,6 +15,7 @@
 #include <magenta/magenta.h>
 #include <magenta/types.h>
 
+#include <utils/intrusive_double_list.h>
 #include <utils/ref_counted.h>
 #include <utils/ref_ptr.h>
 
@@ -33,16 +34,35 @@ class PciDeviceDispatcher;
 class PciInterruptDispatcher;
 class ProcessDispatcher;
 class ThreadDispatcher;
+class TimerDispatcher;
 class VmObjectDispatcher;
 class WaitSetDispatcher;
 
 class Dispatcher : public utils::RefCounted<Dispatcher> {
 public:
     Dispatcher();
-    virtual ~Dispatcher() {}
+    virtual ~Dispatcher();
 
     mx_koid_t get_koid() const { return koid_; }
 
+    // Finds the live object with |koid|, if it has ever had a handle.
+    static utils::RefPtr<Dispatcher> LookupByKoid(mx_koid_t koid);
+
+    // Fills in up to |count| entries, one per object type from
+    // MX_OBJ_TYPE_PROCESS on, counting the objects of the type that have had
+    // a handle since boot and those of them since destroyed. Returns the
+    // number filled in.
+    static size_t GetObjectStats(mx_object_stats_t* stats, size_t count);
+
+    // Koid index support
+    struct KoidIndexTraits {
+        static utils::DoublyLinkedListNodeState<Dispatcher*>& node_state(Dispatcher& obj) {
+            return obj.koid_index_node_state_;
+        }
+    };
+    mx_koid_t GetKey() const { return koid_; }
+    static mx_koid_t GetHash(mx_koid_t key) { return key; }
+
     void add_handle();
 
     void remove_handle();
@@ -119,10 +139,20 @@ public:
         return nullptr;
     }
 
+    virtual TimerDispatcher* get_timer_dispatcher() {
+        return nullptr;
+    }
+
 protected:
     static mx_koid_t GenerateKernelObjectId();
 
 private:
+    void AddToKoidIndex();
+    void RemoveFromKoidIndex();
+
     const mx_koid_t koid_;
     int handle_count_;
+    // GetType() as of the first handle, for counting the object's destruction
+    mx_obj_type_t indexed_type_;
+    utils::DoublyLinkedListNodeState<Dispatcher*> koid_index_node_state_;
 };
@@ -9,11 +9,12 @@
 #include <kernel/event.h>
 
 #include <magenta/dispatcher.h>
+#include <magenta/object_cache.h>
 #include <magenta/state_tracker.h>
 
 #include <sys/types.h>
 
-class EventDispatcher final : public Dispatcher {
+class EventDispatcher final : public Dispatcher, public CachedObject<EventDispatcher> {
 public:
     static status_t Create(uint32_t options, utils::RefPtr<Dispatcher>* dispatcher,
                            mx_rights_t* rights);
@@ -19,7 +19,11 @@ public:
                               utils::RefPtr<ExceptionPort>* eport);
     ~ExceptionPort();
 
-    mx_status_t SendReport(const mx_exception_report_t* packet);
+    // Queue |report| on the port. If |home| is given the report goes out in
+    // its packet, so that reporting doesn't allocate once it has one.
+    mx_status_t SendReport(const mx_exception_report_t* packet, IOP_PacketHome* home = nullptr);
+
+    IOPortDispatcher* io_port() const { return io_port_.get(); }
 
     void OnProcessExit(ProcessDispatcher* process);
     void OnThreadExit(UserThread* thread);
@@ -32,7 +36,8 @@ private:
 
     void OnDestruction();
 
-    IOP_Packet* MakePacket(uint64_t key, const mx_exception_report_t* report, mx_size_t size);
+    IOP_Packet* MakePacket(uint64_t key, const mx_exception_report_t* report, mx_size_t size,
+                           IOP_PacketHome* home);
 
     void BuildProcessGoneReport(mx_exception_report_t* report, mx_koid_t pid);
     void BuildThreadGoneReport(mx_exception_report_t* report, mx_koid_t pid, mx_koid_t tid);
@@ -9,10 +9,17 @@
 #include <kernel/mutex.h>
 #include <magenta/futex_node.h>
 #include <magenta/types.h>
+#include <utils/intrusive_double_list.h>
+#include <utils/intrusive_single_list.h>
+#include <utils/ref_ptr.h>
+
+class UserThread;
+class VmObject;
 
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
-// to contain all active futexes.
+// to contain all active futexes. Each bucket of the table has its own lock, so operations on
+// futexes in different buckets don't contend with each other.
 // A futex is considered active if there is one or more threads blocked on the futex.
 // After no threads are left blocked on a futex it is removed from the hash table.
 // The value in the futex hash table is the FutexNode object associated with the head
@@ -27,6 +34,10 @@ public:
     FutexContext();
     ~FutexContext();
 
+    // The context futexes shared between processes live in. The other
+    // contexts, one per process, hold the futexes private to their process.
+    static FutexContext* Shared();
+
     // FutexWait first verifies that the integer pointed to by |value_ptr|
     // still equals |current_value|. If the test fails, FutexWait returns FAILED_PRECONDITION.
     // Otherwise it will block the current thread for up to |timeout| nanoseconds,
@@ -34,9 +45,25 @@ public:
     // on the same |value_ptr| futex.
     status_t FutexWait(int* value_ptr, int current_value, mx_time_t timeout);
 
+    // FutexWaitPi is FutexWait for a priority inheriting futex. |current_value| names
+    // |owner|, the thread holding the lock the futex implements. While the current
+    // thread is blocked, |owner| runs at no less than the current thread's priority.
+    // The priority is lent until the waiter is woken, times out or is requeued.
+    status_t FutexWaitPi(int* value_ptr, int current_value, utils::RefPtr<UserThread> owner,
+                         mx_time_t timeout);
+
     // FutexWake will wake up to |count| number of threads blocked on the |value_ptr| futex.
     status_t FutexWake(int* value_ptr, uint32_t count);
 
+    // FutexWaitShared and FutexWakeShared are FutexWait and FutexWake for a
+    // futex that can be shared between processes, for use on Shared(). The
+    // futex is named by |offset| into |object| rather than by its address, so
+    // that every process mapping |object| finds it; |value_ptr| is where the
+    // calling process has it mapped.
+    status_t FutexWaitShared(int* value_ptr, utils::RefPtr<VmObject> object, uintptr_t offset,
+                             int current_value, mx_time_t timeout);
+    status_t FutexWakeShared(const VmObject* object, uintptr_t offset, uint32_t count);
+
     // FutexWait first verifies that the integer pointed to by |wake_ptr|
     // still equals |current_value|. If the test fails, FutexWait returns FAILED_PRECONDITION.
     // Otherwise it will wake up to |wake_count| number of threads blocked on the |wake_ptr| futex.
@@ -50,12 +77,54 @@ private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head);
+    status_t FutexWaitInternal(int* value_ptr, const FutexKey& futex_key, int current_value,
+                               utils::RefPtr<UserThread> pi_owner, mx_time_t timeout);
+    status_t FutexWakeInternal(const FutexKey& futex_key, uint32_t count);
+
+    static constexpr size_t kNumBuckets = 32;
+
+    struct Bucket {
+        // protects |heads| and the blocked thread lists hanging off of them
+        mutex_t lock;
+
+        // the FutexNode at the head of the blocked thread list of each active
+        // futex that hashes to this bucket
+        utils::SinglyLinkedList<FutexNode*> heads;
+
+        FutexNode* Find(const FutexKey& key);
+        FutexNode* Erase(const FutexKey& key);
+        void Insert(FutexNode* head) { heads.push_front(head); }
+    };
+
+    Bucket* BucketFor(const FutexKey& key) {
+        return &buckets_[FutexNode::GetHash(key) % kNumBuckets];
+    }
+
+    // Lock the bucket of the futex |node| is queued on. Its key can be changed
+    // by FutexRequeue() until the lock is held, so this follows it around.
+    Bucket* LockNodeBucket(FutexNode* node);
+
+    // Take |node| off the blocked thread list it is on after a timeout.
+    status_t RemoveTimedOutLocked(Bucket* bucket, FutexNode* node);
+
+    // The *Locked() methods below are called with the bucket lock of the
+    // futexes the nodes are queued on held.
+    void QueueNodesLocked(Bucket* bucket, FutexNode* head);
+
+    // Stop lending priority from the nodes in the list starting at |head|
+    // to the owners of the PI futexes they were waiting on.
+    void ReleasePiLocked(FutexNode* head);
+
+    // Recompute the priority |owner| inherits from PI futex waiters.
+    // Called with |pi_lock_| held.
+    void UpdatePiOwnerLocked(UserThread* owner);
+
+    Bucket buckets_[kNumBuckets];
 
-    // protects futex_table_
-    mutex_t lock_;
+    // protects |pi_waiters_| and the priority PI futex owners inherit. Taken
+    // inside of the bucket locks.
+    mutex_t pi_lock_;
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_;
+    // nodes currently lending priority to a PI futex owner
+    utils::DoublyLinkedList<FutexNode*> pi_waiters_;
 };
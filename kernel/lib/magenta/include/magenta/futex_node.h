@@ -11,14 +11,37 @@
 #include <kernel/wait.h>
 #include <list.h>
 #include <magenta/types.h>
-#include <utils/intrusive_hash_table.h>
+#include <utils/intrusive_double_list.h>
+#include <utils/intrusive_single_list.h>
+#include <utils/ref_ptr.h>
+
+class UserThread;
+
+// Names a futex. A futex private to a process is named by its address, with
+// a null |object|. A shared one is named by the vm object it lives in and
+// its offset into it, so that every process mapping the object finds it.
+// Only private futexes are requeued, so a key only ever changes one word.
+struct FutexKey {
+    const void* object;
+    uintptr_t offset;
+
+    bool operator==(const FutexKey& other) const {
+        return object == other.object && offset == other.offset;
+    }
+    bool operator!=(const FutexKey& other) const { return !(*this == other); }
+
+    static FutexKey Private(const int* value_ptr) {
+        return FutexKey{nullptr, reinterpret_cast<uintptr_t>(value_ptr)};
+    }
+};
 
 // Node for linked list of threads blocked on a futex
 // Intended to be embedded within a UserThread Instance
-class FutexNode : public utils::SinglyLinkedListable<FutexNode*> {
+// The singly linked list node links futex heads into their FutexContext
+// bucket, the doubly linked one links PI waiters together.
+class FutexNode : public utils::SinglyLinkedListable<FutexNode*>,
+                  public utils::DoublyLinkedListable<FutexNode*> {
 public:
-    using HashTable = utils::HashTable<uintptr_t, FutexNode*>;
-
     FutexNode();
     ~FutexNode();
 
@@ -30,8 +53,8 @@ public:
 
     // remove up to |count| nodes from our head and return new head
     // the removed nodes remain a valid list after this operation
-    FutexNode* RemoveFromHead(uint32_t count, uintptr_t old_hash_key,
-                              uintptr_t new_hash_key);
+    FutexNode* RemoveFromHead(uint32_t count, const FutexKey& old_hash_key,
+                              const FutexKey& new_hash_key);
 
     // block the current thread, releasing the given mutex while the thread
     // is blocked
@@ -56,22 +79,38 @@ public:
         tail_ = tail;
     }
 
-    void set_hash_key(uintptr_t key) {
+    void set_hash_key(const FutexKey& key) {
         hash_key_ = key;
     }
 
-    // Trait implementation for utils::HashTable
-    uintptr_t GetKey() const { return hash_key_; }
-    static size_t GetHash(uintptr_t key) { return (key >> 3); }
+    // The owner of the PI futex this node's thread is waiting on, if any,
+    // and the priority the waiter lends it.
+    UserThread* pi_owner() const {
+        return pi_owner_.get();
+    }
+
+    int pi_priority() const {
+        return pi_priority_;
+    }
+
+    void set_pi_owner(utils::RefPtr<UserThread> owner, int priority);
+    utils::RefPtr<UserThread> take_pi_owner();
+
+    // the key a node is found by in its FutexContext bucket, and the hash
+    // the bucket is picked by
+    const FutexKey& GetKey() const { return hash_key_; }
+    static size_t GetHash(const FutexKey& key) {
+        return (key.offset >> 2) ^ (reinterpret_cast<uintptr_t>(key.object) >> 4);
+    }
 
 private:
-    // hash_key_ contains the futex address.  This field has two roles:
+    // hash_key_ names the futex.  This field has two roles:
     //  * It is used by FutexWait() to determine which queue to remove the
     //    thread from when a wait operation times out.
     //  * Additionally, when this FutexNode is the head of a futex wait
-    //    queue, this field is used by the HashTable (because it uses
-    //    intrusive SinglyLinkedLists).
-    uintptr_t hash_key_;
+    //    queue, this field is used to find it in its FutexContext bucket.
+    // It is only changed with the bucket lock of the futex it names held.
+    FutexKey hash_key_;
 
     // condition variable used for blocking our containing thread on
     cond_t condvar_;
@@ -82,4 +121,8 @@ private:
     // tail node of the node list
     // only valid if this node is the list head
     FutexNode* tail_;
+
+    // set while waiting on a PI futex, see FutexContext::FutexWaitPi()
+    utils::RefPtr<UserThread> pi_owner_;
+    int pi_priority_ = 0;
 };
@@ -10,12 +10,11 @@
 
 #include <magenta/types.h>
 #include <magenta/syscalls-types.h>
-#include <utils/intrusive_double_list.h>
 #include <utils/ref_ptr.h>
 
 class Dispatcher;
 
-class Handle final : public utils::DoublyLinkedListable<Handle*> {
+class Handle final {
 public:
     Handle(utils::RefPtr<Dispatcher> dispatcher, mx_rights_t rights);
     Handle(const Handle* rhs, mx_rights_t rights);
@@ -8,20 +8,31 @@
 
 #include <kernel/mutex.h>
 #include <kernel/event.h>
+#include <kernel/spinlock.h>
 
 #include <magenta/dispatcher.h>
 #include <magenta/io_port_observer.h>
 #include <magenta/types.h>
 
 #include <utils/fifo_buffer.h>
+#include <utils/ref_counted.h>
+#include <utils/ref_ptr.h>
+#include <utils/unique_ptr.h>
 #include <sys/types.h>
 
+class IOPortDispatcher;
+struct IOP_Interrupt;
+struct IOP_PacketHome;
+
+// Packets to queue on a port come from the port, see IOPortDispatcher::AllocPacket(),
+// and go back to it with IOPortDispatcher::FreePacket().
 struct IOP_Packet {
     friend struct IOP_PacketListTraits;
 
     static IOP_Packet* Alloc(mx_size_t size);
-    static IOP_Packet* Make(const void* data, mx_size_t size);
-    static IOP_Packet* MakeFromUser(const void* data, mx_size_t size);
+    static IOP_Packet* Make(IOPortDispatcher* port, const void* data, mx_size_t size);
+    static mx_status_t MakeFromUser(IOPortDispatcher* port, const void* data, mx_size_t size,
+                                    IOP_Packet** packet);
     static void Delete(IOP_Packet* packet);
 
     IOP_Packet(mx_size_t data_size) : data_size(data_size) {}
@@ -29,6 +40,12 @@ struct IOP_Packet {
 
     utils::DoublyLinkedListNodeState<IOP_Packet*> iop_lns_;
     mx_size_t data_size;
+    // set for packets belonging to their port's pool
+    bool pooled = false;
+    // set for the packet of a bound interrupt, see IOPortDispatcher::BindInterrupt()
+    IOP_Interrupt* interrupt = nullptr;
+    // set for a packet that goes back to its owner when freed, see IOP_PacketHome
+    utils::RefPtr<IOP_PacketHome> home;
 };
 
 struct IOP_PacketListTraits {
@@ -38,6 +55,47 @@ struct IOP_PacketListTraits {
     }
 };
 
+// An interrupt bound to a port. It fires in irq context, where nothing can be
+// allocated or the port's mutex taken, so it owns the one packet that reports
+// it. Fires while that packet is out are counted into it rather than queued.
+struct IOP_Interrupt : public utils::DoublyLinkedListable<IOP_Interrupt*> {
+    explicit IOP_Interrupt(uint64_t key) : key(key) {}
+    ~IOP_Interrupt();
+
+    const uint64_t key;
+    IOP_Packet* packet = nullptr;
+
+    // the rest is under the port's irq lock
+    // fires since the packet was last filled in, and the time of the first
+    uint64_t fired = 0u;
+    mx_time_t first_fired = 0u;
+    // the packet is pending, queued, handed to a waiter or out with a reader
+    bool busy = false;
+    // unbound while busy, freed when the packet comes back
+    bool unbound = false;
+};
+
+// Where a packet that someone other than a port keeps for reuse lives while
+// it isn't queued, such as the packet a thread reports its exceptions with.
+// Freeing the packet puts it back here rather than deleting it, unless the
+// owner has abandoned the home in the meantime. Owned packets don't count
+// against a port's depth, as each owner has at most one out at a time.
+struct IOP_PacketHome : public utils::RefCounted<IOP_PacketHome> {
+    ~IOP_PacketHome();
+
+    // Take the packet if it's home, or make one of |size| bytes if not.
+    IOP_Packet* Take(mx_size_t size);
+    // Returns false if the packet wasn't wanted back and should be deleted.
+    bool Return(IOP_Packet* packet);
+    // Called by the owner when it goes away.
+    void Abandon();
+
+private:
+    mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
+    IOP_Packet* packet_ = nullptr;
+    bool abandoned_ = false;
+};
+
 class IOPortDispatcher final : public Dispatcher {
 public:
     static status_t Create(uint32_t options,
@@ -49,8 +107,39 @@ public:
     IOPortDispatcher* get_io_port_dispatcher() final { return this; }
     void on_zero_handles() final;
 
+    // Get a packet of |size| bytes to queue on this port. Ports with a pool
+    // hand out packets from it, failing with ERR_NOT_READY once it runs dry.
+    mx_status_t AllocPacket(mx_size_t size, IOP_Packet** packet);
+    void FreePacket(IOP_Packet* packet);
+
     mx_status_t Queue(IOP_Packet* packet);
-    mx_status_t Wait(IOP_Packet** packet);
+
+    // Wait up to |timeout| for packets and take up to |count| of them at
+    // once, as long as they are no bigger than |max_size|. Fails with
+    // ERR_NOT_ENOUGH_BUFFER if the first one is. Each packet goes to exactly
+    // one waiter; threads that block are served in the order they came in.
+    mx_status_t Wait(lk_time_t timeout, mx_size_t max_size, IOP_Packet** packets,
+                     uint32_t count, uint32_t* actual);
+
+    // Give the port a pool of |depth| packets, allocated up front, and bound
+    // its queue to that many. Packets the port would have to drop for lack of
+    // room are counted and reported by an MX_IO_PORT_PKT_TYPE_OVERFLOW packet.
+    // Can only be done once, before anything is queued.
+    mx_status_t SetDepth(uint32_t depth);
+    uint32_t GetDepth();
+
+    // Note that a packet meant for the port was dropped because it was full.
+    void NoteDroppedPacket();
+
+    // Bind an interrupt which the caller then fires with SignalInterrupt(). It
+    // is reported by MX_IO_PORT_PKT_TYPE_INTERRUPT packets, which don't count
+    // against the port's depth. The caller must UnbindInterrupt() it once it
+    // can no longer fire, and keep a reference to the port until then.
+    mx_status_t BindInterrupt(uint64_t key, IOP_Interrupt** interrupt);
+    void UnbindInterrupt(IOP_Interrupt* interrupt);
+
+    // Safe to call in irq context. Returns true if a waiting thread was woken.
+    bool SignalInterrupt(IOP_Interrupt* interrupt);
 
     // Called under the handle table lock.
     mx_status_t Bind(Handle* handle, mx_signals_t signals, uint64_t key);
@@ -61,6 +150,15 @@ public:
 private:
     IOPortDispatcher(uint32_t options);
     void FreePackets_NoLock();
+    void FreePacketLocked(IOP_Packet* packet);
+    void FreeInterruptPacketLocked(IOP_Interrupt* interrupt);
+    IOP_Packet* ReportInterruptLocked(IOP_Interrupt* interrupt);
+    void DrainInterruptsLocked();
+    bool HandOffInterruptLocked(IOP_Interrupt* interrupt);
+    IOP_Packet* PopPacketLocked();
+    void QueueOverflowLocked();
+    bool QueuePacketLocked(IOP_Packet* packet);
+    uint32_t TakePacketsLocked(mx_size_t max_size, IOP_Packet** packets, uint32_t count);
 
     utils::unique_ptr<IOPortObserver> MaybeRemoveObserver(IOP_Packet* packet);
 
@@ -70,6 +168,38 @@ private:
     bool no_clients_;
     utils::DoublyLinkedList<IOPortObserver*, IOPortObserverListTraits> observers_;
     utils::DoublyLinkedList<IOP_Packet*, IOP_PacketListTraits> packets_;
-
-    event_t event_;
+    // number of packets in |packets_|, not counting |overflow_packet_|
+    uint32_t queued_;
+
+    // the packet pool and queue bound, see SetDepth(). 0 for none.
+    uint32_t depth_;
+    utils::unique_ptr<char[]> pool_;
+    utils::DoublyLinkedList<IOP_Packet*, IOP_PacketListTraits> free_packets_;
+
+    // part of the pool, queued when packets get dropped. It is busy from then
+    // until the reader hands it back; drops meanwhile are counted for when it
+    // goes out again.
+    IOP_Packet* overflow_packet_;
+    bool overflow_busy_;
+    uint64_t dropped_;
+
+    // a thread blocked in Wait(). Queue() hands it the next packet directly,
+    // so the thread it wakes never has to race others for it. Interrupts are
+    // handed over the same way.
+    struct Waiter : public utils::DoublyLinkedListable<Waiter*> {
+        mx_size_t max_size = 0u;
+        IOP_Packet* packet = nullptr;
+        IOP_Interrupt* interrupt = nullptr;
+        mx_status_t status = NO_ERROR;
+        event_t event;
+    };
+
+    // guards |waiters_| and the bound interrupts, which are touched in irq
+    // context. Nests inside |lock_|.
+    spin_lock_t irq_lock_;
+    utils::DoublyLinkedList<Waiter*> waiters_;
+    // interrupts which fired while no thread was waiting, to be queued by
+    // the next Wait()
+    utils::DoublyLinkedList<IOP_Interrupt*> pending_interrupts_;
+    bool irq_closed_;
 };
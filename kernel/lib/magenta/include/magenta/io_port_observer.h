@@ -16,6 +16,10 @@
 
 class IOPortDispatcher;
 
+// Queues a packet on |io_port_| each time one of the watched signals of the
+// bound object goes from unsatisfied to satisfied, including once at bind
+// time for any already satisfied. Changes in other signals, or in watched
+// ones that stay up, queue nothing.
 class IOPortObserver final: public StateObserver {
 public:
     enum {
@@ -54,6 +58,9 @@ private:
 
     Handle* handle_;
     mx_signals_t watched_signals_;
+    // the watched signals satisfied as of the last state we saw, under the
+    // state tracker's lock
+    mx_signals_t satisfied_;
     uint64_t key_;
 
     utils::RefPtr<IOPortDispatcher> io_port_;
@@ -19,8 +19,8 @@ class Handle;
 class Dispatcher;
 class ExceptionPort;
 
-// Creates a handle attached to |dispatcher| and with |rights| from a
-// specific arena which makes their addresses come from a fixed range.
+// Creates a handle attached to |dispatcher| and with |rights|, or returns
+// null if out of memory.
 Handle* MakeHandle(utils::RefPtr<Dispatcher> dispatcher, mx_rights_t rights);
 
 // Duplicate a handle created by MakeHandle().
@@ -29,17 +29,15 @@ Handle* DupHandle(Handle* source, mx_rights_t rights);
 // Deletes a |handle| made by MakeHandle() or DupHandle().
 void DeleteHandle(Handle* handle);
 
-// Maps a handle created by MakeHandle() to the 0 to 2^32 range.
-uint32_t MapHandleToU32(Handle* handle);
-
-// Maps an integer obtained by MapHandleToU32() back to a Handle.
-Handle* MapU32ToHandle(uint32_t value);
-
 // Set/get the system exception port.
 mx_status_t SetSystemExceptionPort(utils::RefPtr<ExceptionPort> eport);
 void ResetSystemExceptionPort();
 utils::RefPtr<ExceptionPort> GetSystemExceptionPort();
 
+// Get the event that is signaled while the system is low on memory, or null
+// if it could not be created.
+utils::RefPtr<Dispatcher> GetLowMemoryEvent();
+
 struct handle_delete {
     inline void operator()(Handle* h) const {
         DeleteHandle(h);
@@ -8,30 +8,94 @@
 
 #include <stdint.h>
 
+#include <arch/defines.h>
+#include <kernel/event.h>
 #include <kernel/mutex.h>
 
+#include <magenta/object_cache.h>
 #include <magenta/state_tracker.h>
+#include <magenta/syscalls-types.h>
 
-#include <utils/array.h>
 #include <utils/intrusive_double_list.h>
 #include <utils/ref_counted.h>
+#include <utils/ref_ptr.h>
+#include <utils/unique_ptr.h>
 
 class Handle;
+class VmObject;
 
-struct MessagePacket : public utils::DoublyLinkedListable<utils::unique_ptr<MessagePacket>> {
-    MessagePacket(utils::Array<uint8_t>&& _data,
-                  utils::Array<Handle*>&& _handles)
-        : data(utils::move(_data)),
-          handles(utils::move(_handles)) { }
+// A message queued on a pipe. Small messages are held inline in the packet,
+// and free packets are kept around in per cpu caches, so that passing one
+// doesn't need to touch the heap. Large messages from user mode are held in
+// pages of their own, which can be handed over to the reader.
+class MessagePacket : public utils::DoublyLinkedListable<utils::unique_ptr<MessagePacket>> {
+public:
+    // Makes a packet with room for |data_size| bytes and |num_handles|
+    // handles, for the caller to fill in.
+    static status_t Create(uint32_t data_size, uint32_t num_handles,
+                           utils::unique_ptr<MessagePacket>* msg);
+    // Makes a packet holding a copy of the |data_size| bytes at
+    // |user_data|, with room for |num_handles| handles to fill in.
+    static status_t CreateFromUser(const void* user_data, uint32_t data_size,
+                                   uint32_t num_handles, utils::unique_ptr<MessagePacket>* msg);
     ~MessagePacket();
 
-    utils::Array<uint8_t> data;
-    utils::Array<Handle*> handles;
+    static void operator delete(void* storage);
+
+    uint32_t data_size() const { return data_size_; }
+    // null for packets that keep their data in a vm object, which only
+    // CreateFromUser() makes.
+    uint8_t* data() { return data_; }
+
+    // Copies the data out to |user_data|. Whole pages of data held in a vm
+    // object are moved into the reader's memory when it is page aligned, so
+    // this can only be done once.
+    status_t CopyDataToUser(void* user_data);
 
+    // The transaction id in the first four bytes of the data.
+    uint32_t GetTxid();
+    void SetTxid(uint32_t txid);
+
+    uint32_t num_handles() const { return num_handles_; }
+    Handle** handles() { return handles_; }
+
+    // Give up ownership of the handles so they aren't deleted with the packet.
     void ReturnHandles();
+
+    static constexpr uint32_t kInlineDataSize = 256u;
+    static constexpr uint32_t kInlineHandleCount = 8u;
+    // messages from user mode of at least this size go in a vm object
+    static constexpr uint32_t kVmoDataSize = 4u * PAGE_SIZE;
+
+private:
+    MessagePacket(uint32_t data_size, uint32_t num_handles);
+    static status_t Create(uint32_t data_size, uint32_t num_handles, bool heap_data,
+                           utils::unique_ptr<MessagePacket>* msg);
+
+    MessagePacket(const MessagePacket&) = delete;
+    MessagePacket& operator=(const MessagePacket&) = delete;
+
+    uint32_t data_size_;
+    uint32_t num_handles_;
+    uint8_t* data_;
+    Handle** handles_;
+
+    // the handles and data of messages too big to fit inline, or null
+    void* buffer_ = nullptr;
+    // the data of large messages from user mode, in place of |data_|
+    utils::RefPtr<VmObject> data_vmo_;
+
+    Handle* inline_handles_[kInlineHandleCount];
+    uint8_t inline_data_[kInlineDataSize];
+};
+
+// Room a reader has for one message.
+struct MessageBufferSize {
+    uint32_t num_bytes;
+    uint32_t num_handles;
 };
 
-class MessagePipe : public utils::RefCounted<MessagePipe> {
+class MessagePipe : public utils::RefCounted<MessagePipe>, public CachedObject<MessagePipe> {
 public:
     using MessageList = utils::DoublyLinkedList<utils::unique_ptr<MessagePacket>>;
     MessagePipe(mx_koid_t koid);
@@ -42,15 +106,71 @@ public:
     void OnDispatcherDestruction(size_t side);
 
     status_t Read(size_t side, utils::unique_ptr<MessagePacket>* msg);
-    status_t Write(size_t side, utils::unique_ptr<MessagePacket> msg);
+    // Queues |msg| for the other side. On failure |msg| is left with the
+    // caller, handles and all.
+    status_t Write(size_t side, utils::unique_ptr<MessagePacket>* msg);
+
+    // Moves up to |count| messages to |msgs| under one acquisition of the
+    // lock, the i-th one only if it fits in |sizes[i]|. If the first doesn't
+    // fit, it stays queued, its size is put in |sizes[0]| and the result is
+    // ERR_NOT_ENOUGH_BUFFER.
+    status_t ReadMany(size_t side, MessageBufferSize* sizes, uint32_t count, MessageList* msgs);
+    // Queues all of |msgs| for the other side in order, or on failure leaves
+    // all of them with the caller.
+    status_t WriteMany(size_t side, MessageList* msgs);
+
+    // Writes |msg| like Write(), then waits for the other side to write back
+    // a message with the same transaction id, which is returned in |reply|
+    // without going through the read queue. The id is stamped over the first
+    // four bytes of |msg| so |msg| needs at least that many. On failure to
+    // write, |msg| is left with the caller.
+    status_t Call(size_t side, utils::unique_ptr<MessagePacket>* msg, lk_time_t timeout,
+                  utils::unique_ptr<MessagePacket>* reply);
 
     StateTracker* GetStateTracker(size_t side);
 
+    // Caps the messages waiting to be read on |side|, 0 meaning no cap. Once
+    // a cap is reached the other side stops being WRITABLE and its writes
+    // fail with ERR_NOT_READY until enough has been read.
+    void SetMaxQueuedMessages(size_t side, uint32_t max_messages);
+    void SetMaxQueuedBytes(size_t side, uint32_t max_bytes);
+    void GetQueueLimits(size_t side, uint32_t* max_messages, uint32_t* max_bytes);
+
+    void GetInfo(size_t side, mx_msg_pipe_info_t* info);
+
 private:
+    // Transaction ids handed out by Call() have the top bit set, so that
+    // ordinary messages are only taken for replies if they ask for it.
+    static constexpr uint32_t kTxidCallBit = 0x80000000u;
+
+    // A thread blocked in Call() for its reply.
+    struct CallWaiter : public utils::DoublyLinkedListable<CallWaiter*> {
+        uint32_t txid = 0u;
+        utils::unique_ptr<MessagePacket> reply;
+        event_t event;
+    };
+    using WaiterList = utils::DoublyLinkedList<CallWaiter*>;
+
+    // Hand |msg| to a Call() on |side| waiting for it, if there is one.
+    bool DeliverReplyLocked(size_t side, utils::unique_ptr<MessagePacket>* msg);
+
+    // The read queue of each side, with its length kept track of against the
+    // caps. The other side's WRITABLE signal follows whether it is full.
+    bool QueueFullLocked(size_t side) const;
+    void EnqueueLocked(size_t side, utils::unique_ptr<MessagePacket> msg);
+    utils::unique_ptr<MessagePacket> DequeueLocked(size_t side);
+    void UpdateWritableLocked(size_t side, bool was_full);
+
     const mx_koid_t koid_;
     bool dispatcher_alive_[2];
     MessageList messages_[2];
-    // This lock protects |dispatcher_alive_| and |messages_|.
+    WaiterList waiters_[2];
+    uint32_t next_txid_ = 0u;
+    uint32_t queued_messages_[2] = {};
+    uint64_t queued_bytes_[2] = {};
+    uint32_t max_messages_[2] = {};
+    uint32_t max_bytes_[2] = {};
+    // This lock protects everything above.
     mutex_t lock_;
     StateTracker state_tracker_[2];
 };
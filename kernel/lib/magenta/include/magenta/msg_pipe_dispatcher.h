@@ -12,13 +12,15 @@
 
 #include <magenta/dispatcher.h>
 #include <magenta/msg_pipe.h>
+#include <magenta/object_cache.h>
 #include <magenta/state_tracker.h>
 #include <magenta/types.h>
 
 #include <utils/ref_counted.h>
 #include <utils/unique_ptr.h>
 
-class MessagePipeDispatcher final : public Dispatcher {
+class MessagePipeDispatcher final : public Dispatcher,
+                                    public CachedObject<MessagePipeDispatcher> {
 public:
     static status_t Create(uint32_t flags, utils::RefPtr<Dispatcher>* dispatcher0,
                            utils::RefPtr<Dispatcher>* dispatcher1, mx_rights_t* rights);
@@ -32,8 +34,23 @@ public:
     bool is_reply_pipe() const { return (flags_ & MX_FLAG_REPLY_PIPE) ? true : false; }
 
     status_t BeginRead(uint32_t* message_size, uint32_t* handle_count);
-    status_t AcceptRead(utils::Array<uint8_t>* data, utils::Array<Handle*>* handles);
-    status_t Write(utils::Array<uint8_t> data, utils::Array<Handle*> handles);
+    status_t AcceptRead(utils::unique_ptr<MessagePacket>* msg);
+    // On failure |msg| is left with the caller.
+    status_t Write(utils::unique_ptr<MessagePacket>* msg);
+    // Batched reads and writes, see MessagePipe::ReadMany() and WriteMany().
+    status_t ReadMany(MessageBufferSize* sizes, uint32_t count, MessagePipe::MessageList* msgs);
+    status_t WriteMany(MessagePipe::MessageList* msgs);
+    // Write |msg| and wait for the reply, see MessagePipe::Call().
+    status_t Call(utils::unique_ptr<MessagePacket>* msg, lk_time_t timeout,
+                  utils::unique_ptr<MessagePacket>* reply);
+
+    // Caps on the messages waiting to be read here, see
+    // MessagePipe::SetMaxQueuedMessages().
+    void SetMaxQueuedMessages(uint32_t max_messages);
+    void SetMaxQueuedBytes(uint32_t max_bytes);
+    void GetQueueLimits(uint32_t* max_messages, uint32_t* max_bytes);
+
+    void GetInfo(mx_msg_pipe_info_t* info);
 
 private:
     MessagePipeDispatcher(uint32_t flags, size_t side, utils::RefPtr<MessagePipe> pipe);
@@ -0,0 +1,95 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <arch/ops.h>
+#include <assert.h>
+#include <kernel/spinlock.h>
+#include <new.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Small per cpu caches of free storage for objects of type T, kept in front
+// of the heap for kernel objects that come and go at high rates. Freed blocks
+// go back on the cache of the cpu freeing them, up to kMaxPerCpu of them, and
+// new objects are built in place in them.
+template <typename T, size_t kMaxPerCpu = 32u>
+class ObjectCache {
+public:
+    static void* Alloc() {
+        // we might migrate to another cpu once we've picked a cache, which
+        // costs nothing but some locality
+        Cache* cache = &caches_[arch_curr_cpu_num()];
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        FreeBlock* block = cache->free;
+        if (block) {
+            cache->free = block->next;
+            cache->count--;
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+
+        return block ? block : malloc(sizeof(T));
+    }
+
+    static void Free(void* storage) {
+        if (!storage)
+            return;
+
+        Cache* cache = &caches_[arch_curr_cpu_num()];
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache->lock, state);
+        bool cached = cache->count < kMaxPerCpu;
+        if (cached) {
+            FreeBlock* block = static_cast<FreeBlock*>(storage);
+            block->next = cache->free;
+            cache->free = block;
+            cache->count++;
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+
+        if (!cached)
+            free(storage);
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Cache {
+        spin_lock_t lock;
+        FreeBlock* free;
+        size_t count;
+    } __CPU_ALIGN;
+
+    static_assert(sizeof(T) >= sizeof(FreeBlock), "object too small to cache");
+
+    static Cache caches_[SMP_MAX_CPUS];
+};
+
+template <typename T, size_t kMaxPerCpu>
+typename ObjectCache<T, kMaxPerCpu>::Cache ObjectCache<T, kMaxPerCpu>::caches_[SMP_MAX_CPUS];
+
+// Deriving from CachedObject<T> makes new and delete of T use an ObjectCache.
+// Only T itself can be made this way, not types derived from it.
+template <typename T>
+class CachedObject {
+public:
+    static void* operator new(size_t size, AllocChecker* ac) {
+        DEBUG_ASSERT(size == sizeof(T));
+        void* storage = ObjectCache<T>::Alloc();
+        ac->arm(size, storage != nullptr);
+        return storage;
+    }
+
+    static void operator delete(void* storage) {
+        ObjectCache<T>::Free(storage);
+    }
+};
@@ -0,0 +1,30 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <stdint.h>
+
+#include <kernel/vm/vm_object.h>
+
+#include <magenta/io_port_dispatcher.h>
+
+#include <utils/ref_ptr.h>
+
+// Asks a userspace server for the pages of an object made by
+// mx_pager_create() with an MX_IO_PORT_PKT_TYPE_PAGER packet on its port per
+// page. The server answers with mx_pager_supply().
+class PagerSource final : public VmPageSource {
+public:
+    PagerSource(utils::RefPtr<IOPortDispatcher> io_port, uint64_t key);
+    ~PagerSource() final = default;
+
+    status_t RequestPage(uint64_t offset) final;
+
+private:
+    utils::RefPtr<IOPortDispatcher> io_port_;
+    const uint64_t key_;
+};
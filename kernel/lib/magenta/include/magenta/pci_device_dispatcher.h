@@ -76,6 +76,7 @@ public:
                           mx_rights_t* rights);
     status_t QueryIrqModeCaps(mx_pci_irq_mode_t mode, uint32_t* out_max_irqs);
     status_t SetIrqMode(mx_pci_irq_mode_t mode, uint32_t requested_irq_count);
+    status_t SetIrqAffinity(uint32_t irq_id, uint32_t cpu_num);
 
     bool irqs_maskable() const { return irqs_maskable_; }
 
@@ -8,7 +8,9 @@
 
 #include <dev/pcie.h>
 #include <kernel/event.h>
+#include <kernel/spinlock.h>
 #include <magenta/dispatcher.h>
+#include <magenta/io_port_dispatcher.h>
 #include <magenta/pci_device_dispatcher.h>
 #include <sys/types.h>
 
@@ -31,11 +33,20 @@ public:
 
     status_t InterruptWait();
 
+    // Deliver the interrupt to |port| as packets instead of waking
+    // InterruptWait(). In MSI and MSI-X modes it is left unmasked, and fires
+    // while a packet is out are counted into it. In legacy mode it is masked
+    // when it fires, until InterruptComplete().
+    status_t BindIOPort(utils::RefPtr<IOPortDispatcher> port, uint64_t key);
+    status_t UnbindIOPort();
+    status_t InterruptComplete();
+
 private:
     static pcie_irq_handler_retval_t IrqThunk(struct pcie_device_state* dev,
                                               uint irq_id,
                                               void* ctx);
     PciInterruptDispatcher(uint32_t irq);
+    status_t UnbindIOPortLocked();
 
     uint32_t irq_id_;
     bool     maskable_;
@@ -43,4 +54,11 @@ private:
     mutex_t  lock_;
     mutex_t  wait_lock_;
     utils::RefPtr<PciDeviceDispatcher::PciDeviceWrapper> device_;
+
+    // the port binding, set and cleared under |lock_|. |port_lock_| keeps it
+    // stable for IrqThunk().
+    spin_lock_t port_lock_;
+    utils::RefPtr<IOPortDispatcher> port_;
+    IOP_Interrupt* iop_interrupt_;
+    bool mask_on_fire_;
 };
@@ -56,28 +56,42 @@ public:
     // If this fails, then the object is invalid and should be deleted
     status_t Initialize();
 
-    // Map a |handle| to an integer which can be given to usermode as a
-    // handle value. Uses MapHandleToU32() plus additional mixing.
-    mx_handle_t MapHandleToValue(Handle* handle);
-
     // Maps a handle value into a Handle as long we can verify that
     // it belongs to this process.
     Handle* GetHandle_NoLock(mx_handle_t handle_value);
 
-    // Adds |hadle| to this process handle list. The handle->process_id() is
-    // set to this process id().
-    void AddHandle(HandleUniquePtr handle);
-    void AddHandle_NoLock(HandleUniquePtr handle);
+    // Adds |handle| to this process handle table and returns the value
+    // usermode refers to it by. The handle->process_id() is set to this
+    // process id(). If the table can't grow the handle is deleted and
+    // ERR_NO_MEMORY returned instead.
+    mx_handle_t AddHandle(HandleUniquePtr handle);
+    mx_handle_t AddHandle_NoLock(HandleUniquePtr handle);
+
+    // Adds all |count| |handles|, storing their values in |handle_values|.
+    // Either all of them are added or, if the table can't grow to fit them,
+    // none are and ERR_NO_MEMORY is returned, leaving |handles| untouched.
+    status_t AddHandles_NoLock(HandleUniquePtr* handles, uint32_t count,
+                               mx_handle_t* handle_values);
 
     // Removes the Handle corresponding to |handle_value| from this process
     // handle list.
     HandleUniquePtr RemoveHandle(mx_handle_t handle_value);
     HandleUniquePtr RemoveHandle_NoLock(mx_handle_t handle_value);
 
-    // Puts back the |handle_value| which has not yet been given to another process
-    // back into this process.
-    void UndoRemoveHandle_NoLock(mx_handle_t handle_value);
+    // Removes each of the |count| handles named by |handle_values| at once,
+    // storing it in |handles| or nullptr for values that don't refer to one
+    // of this process' handles. The caller owns what gets removed. Returns
+    // how many were.
+    uint32_t RemoveHandles_NoLock(const mx_handle_t* handle_values, uint32_t count,
+                                  Handle** handles);
+
+    // Puts back the |handle| removed as |handle_value| which has not yet been
+    // given to another process back into this process, under the same value
+    // if it is still free.
+    void UndoRemoveHandle_NoLock(mx_handle_t handle_value, Handle* handle);
 
+    // Looks up the dispatcher and rights of |handle_value| without taking the
+    // handle table lock.
     bool GetDispatcher(mx_handle_t handle_value, utils::RefPtr<Dispatcher>* dispatcher,
                        uint32_t* rights);
 
@@ -98,6 +112,9 @@ public:
     void Kill();
 
     status_t GetInfo(mx_process_info_t* info);
+    status_t GetMemoryInfo(mx_process_memory_info_t* info);
+    // The stats of the live threads and those that have exited, summed.
+    status_t GetThreadStats(mx_thread_stats_t* info);
 
     status_t CreateUserThread(utils::StringPiece name,
                               thread_start_routine entry, void* arg,
@@ -108,9 +125,13 @@ public:
     void ResetExceptionPort();
     utils::RefPtr<ExceptionPort> exception_port();
 
-    // The following two methods can be slow and innacurrate and should only be
-    // called from diagnostics code.
-    uint32_t HandleStats(uint32_t*handle_type, size_t size) const;
+    // Returns the number of handles the process holds, and if |handle_type|
+    // isn't null fills in up to |count| of them by mx_obj_type_t. Doesn't
+    // take any locks, so it's cheap enough to poll.
+    uint32_t HandleStats(uint32_t* handle_type, size_t count) const;
+
+    // This one can be slow and innacurrate and should only be called from
+    // diagnostics code.
     uint32_t ThreadCount() const;
 
     // Look up a process given its koid.
@@ -148,6 +169,9 @@ private:
     // Kill all threads
     void KillAllThreads();
 
+    // Adds |delta| to the count of handles of |handle|'s type.
+    void CountHandle_NoLock(const Handle* handle, int delta);
+
     // Utility routine used with public debug routines.
     char* DebugDumpHandleTypeCount_NoLock() const;
 
@@ -158,6 +182,49 @@ private:
     // Remove a process from the global process list.
     static void RemoveProcess(ProcessDispatcher* process);
 
+    // The handle table is an array of slots, grown a chunk at a time. Chunk k
+    // holds kHandleChunkBase << k slots and never moves once allocated, so
+    // GetDispatcher() can read it without the lock. A handle value names a
+    // slot index along with the generation of the slot, which is bumped every
+    // time a handle leaves it, so stale values of a reused slot don't resolve.
+    // Free slots are kept on a doubly linked list so that
+    // UndoRemoveHandle_NoLock() can take a particular one back.
+    struct HandleSlot {
+        Handle* volatile handle;
+        volatile uint32_t generation;
+        uint32_t next_free;
+        uint32_t prev_free;
+    };
+
+    // Values are the generation and index shifted up past two low bits that
+    // are always 01, mixed with |handle_rand_|, which keeps them positive.
+    static constexpr uint32_t kHandleIndexBits = 18;
+    static constexpr uint32_t kHandleGenerationBits = 29 - kHandleIndexBits;
+    static constexpr uint32_t kHandleIndexMask = (1u << kHandleIndexBits) - 1;
+    static constexpr uint32_t kHandleGenerationMask = (1u << kHandleGenerationBits) - 1;
+    static constexpr uint32_t kMaxHandleCount = 1u << kHandleIndexBits;
+    static constexpr uint32_t kHandleChunkShift = 6;
+    static constexpr uint32_t kHandleChunkBase = 1u << kHandleChunkShift;
+    static constexpr uint32_t kHandleChunkCount = kHandleIndexBits - kHandleChunkShift + 1;
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+    // the slot for |index|, or null if its chunk hasn't been allocated. safe
+    // to call without the lock.
+    HandleSlot* FindSlot(uint32_t index) const;
+    HandleSlot& Slot_NoLock(uint32_t index) const;
+
+    mx_handle_t SlotToValue_NoLock(uint32_t index) const;
+    bool ValueToSlot(mx_handle_t handle_value, uint32_t* index, uint32_t* generation) const;
+    void PushFreeSlot_NoLock(uint32_t index);
+    void UnlinkFreeSlot_NoLock(uint32_t index);
+    status_t GrowHandleTable_NoLock();
+    // takes the handle out of its slot, leaving the caller to sync lookups
+    Handle* UnlinkHandle_NoLock(mx_handle_t handle_value);
+
+    // Wait out any GetDispatcher() calls that may have found a handle just
+    // taken out of the table, after which it is safe to delete.
+    static void SyncHandleLookups();
+
     mx_handle_t handle_rand_ = 0;
 
     // protects thread_list_, as well as the UserThread joined_ and detached_ flags
@@ -169,13 +236,22 @@ private:
     // a ref to the main thread
     utils::RefPtr<UserThread> main_thread_;
 
+    // the stats of the threads gone from thread_list_, also under thread_list_lock_
+    mx_thread_stats_t exited_thread_stats_ = {};
+
     // our address space
     utils::RefPtr<VmAspace> aspace_;
 
-    // our list of handles
+    // our table of handles
     mutable mutex_t handle_table_lock_ =
-        MUTEX_INITIAL_VALUE(handle_table_lock_); // protects |handles_|.
-    utils::DoublyLinkedList<Handle*> handles_;
+        MUTEX_INITIAL_VALUE(handle_table_lock_); // protects the fields below.
+    HandleSlot* volatile handle_chunks_[kHandleChunkCount] = {};
+    uint32_t handle_table_size_ = 0;
+    uint32_t free_slot_head_ = kNoSlot;
+    uint32_t handle_count_ = 0;
+    // handles in the table by mx_obj_type_t, changed atomically under the
+    // lock so that HandleStats() can read them without it
+    mutable int handle_type_count_[MX_OBJ_TYPE_LAST] = {};
 
     StateTracker state_tracker_;
 
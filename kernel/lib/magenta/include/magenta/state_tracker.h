@@ -46,8 +46,9 @@ class WaitEvent;
 //      auto waiter = handle->dispatcher()->get_waiter();
 //      waiter->BindIOPOrt(io_port, key, signals);
 //
-//      IOP_Packet pk;
-//      io_port->Wait(&pk);
+//      IOP_Packet* pk;
+//      uint32_t actual;
+//      io_port->Wait(INFINITE_TIME, size, &pk, 1u, &actual);
 //
 
 class StateTracker {
@@ -64,11 +65,19 @@ public:
     // Set the initial signals state. This is an alternative to provide the initial signals state to
     // the constructor. This does no locking and does not notify anything.
     void set_initial_signals_state(mx_signals_state_t signals_state) {
-        signals_state_ = signals_state;
+        __atomic_store(&signals_state_, &signals_state, __ATOMIC_RELEASE);
     }
 
     bool is_waitable() const { return is_waitable_; }
 
+    // The current signals state, read without taking the lock. It may change right after, so this
+    // is only good for checking whether a wait would finish at once without adding an observer.
+    mx_signals_state_t GetSignalsState() const {
+        mx_signals_state_t signals_state;
+        __atomic_load(&signals_state_, &signals_state, __ATOMIC_ACQUIRE);
+        return signals_state;
+    }
+
     // Add an observer.
     mx_status_t AddObserver(StateObserver* observer);
 
@@ -101,6 +110,7 @@ private:
     // Active observers are elements in |observers_|.
     utils::DoublyLinkedList<StateObserver*, StateObserverListTraits> observers_;
 
-    // mojo-style signaling.
+    // mojo-style signaling. Only changed under |lock_|, but stored atomically so that
+    // GetSignalsState() can read it without it.
     mx_signals_state_t signals_state_;
 };
@@ -0,0 +1,72 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
+#include <lib/dpc.h>
+
+#include <magenta/dispatcher.h>
+#include <magenta/state_tracker.h>
+#include <magenta/types.h>
+
+#include <utils/ref_ptr.h>
+#include <sys/types.h>
+
+// A timer asserts MX_SIGNAL_SIGNALED when it expires, so it can be waited on
+// like any other object, or bound to an io port or added to a wait set to
+// have its expirations delivered there.
+class TimerDispatcher final : public Dispatcher {
+public:
+    static status_t Create(uint32_t options, utils::RefPtr<Dispatcher>* dispatcher,
+                           mx_rights_t* rights);
+
+    ~TimerDispatcher() final;
+    mx_obj_type_t GetType() const final { return MX_OBJ_TYPE_TIMER; }
+    TimerDispatcher* get_timer_dispatcher() final { return this; }
+    StateTracker* get_state_tracker() final { return &state_tracker_; }
+    void on_zero_handles() final;
+
+    // Expire at |deadline|, in current_time_ns() time, and then every
+    // |period| ns if it isn't 0. Each expiry may be put off by up to |slack|
+    // ns so that it can share a wakeup with other timers. Replaces whatever
+    // the timer was set to before, and clears MX_SIGNAL_SIGNALED.
+    status_t Set(mx_time_t deadline, mx_time_t period, mx_time_t slack);
+
+    // Stop the timer and clear MX_SIGNAL_SIGNALED.
+    status_t Cancel();
+
+    status_t UserSignal(uint32_t set_mask, uint32_t clear_mask) final;
+
+private:
+    explicit TimerDispatcher(uint32_t options);
+
+    static enum handler_return TimerCallback(timer_t* timer, lk_time_t now, void* arg);
+    static void ExpiredDpc(dpc_t* dpc);
+    void OnExpired();
+    void ArmLocked(mx_time_t now);
+
+    StateTracker state_tracker_;
+
+    // serializes Set(), Cancel() and expiry, which happens on the dpc thread
+    // since the state tracker can't be updated in irq context.
+    mutex_t lock_;
+    bool armed_;
+    bool closed_;
+    mx_time_t deadline_;
+    mx_time_t period_;
+    mx_time_t slack_;
+    timer_t timer_;
+
+    // guards queueing |dpc_| from the timer callback. While it is queued
+    // |dpc_self_| keeps the dispatcher alive.
+    spin_lock_t dpc_lock_;
+    bool dpc_queued_;
+    dpc_t dpc_;
+    utils::RefPtr<TimerDispatcher> dpc_self_;
+};
@@ -67,10 +67,31 @@ public:
     // Note this takes a specific exception port as an argument because there are several:
     // debugger, thread, process, and system.
     status_t ExceptionHandlerExchange(utils::RefPtr<ExceptionPort> eport, const mx_exception_report_t* report);
-    status_t MarkExceptionHandled(mx_exception_status_t status);
+    // If |io_port| is given, the thread must be waiting on an exception port bound to it.
+    status_t MarkExceptionHandled(mx_exception_status_t status,
+                                  const IOPortDispatcher* io_port = nullptr);
 
     mx_koid_t get_koid() const { return koid_; }
 
+    // Where the thread's time has gone, for MX_INFO_THREAD_STATS.
+    void GetStats(mx_thread_stats_t* info);
+
+    // Set the priority this thread inherits from waiters on PI futexes it owns,
+    // 0 for none.
+    void SetInheritedPriority(int priority);
+
+    // Deadline scheduling, for MX_PROP_THREAD_DEADLINE.
+    status_t SetDeadline(const mx_thread_deadline_t& deadline);
+    void GetDeadline(mx_thread_deadline_t* deadline);
+
+    // The cpus the thread may run on, for MX_PROP_THREAD_AFFINITY.
+    status_t SetAffinity(uint32_t affinity);
+    uint32_t GetAffinity();
+
+    // How late the thread's timeouts may fire, for MX_PROP_THREAD_TIMER_SLACK.
+    void SetTimerSlack(mx_time_t slack);
+    mx_time_t GetTimerSlack();
+
 private:
     UserThread(const UserThread&) = delete;
     UserThread& operator=(const UserThread&) = delete;
@@ -118,6 +139,10 @@ private:
     mx_exception_status_t exception_status_ = MX_EXCEPTION_STATUS_NOT_HANDLED;
     cond_t exception_wait_cond_ = COND_INITIAL_VALUE(exception_wait_cond_);
     mutex_t exception_wait_lock_ = MUTEX_INITIAL_VALUE(exception_wait_lock_);
+    // The port the report went to, while waiting.
+    ExceptionPort* exception_wait_port_ = nullptr;
+    // Where the packet reports are sent in is kept between exceptions.
+    utils::RefPtr<IOP_PacketHome> exception_packet_home_;
 
     // cleanup dpc structure
     dpc_t cleanup_dpc_ = {};
@@ -9,10 +9,15 @@
 #include <magenta/dispatcher.h>
 #include <magenta/state_tracker.h>
 
+#include <kernel/mutex.h>
+#include <kernel/vm/vm_aspace.h>
+
 #include <sys/types.h>
 
+#include <utils/intrusive_double_list.h>
+#include <utils/unique_ptr.h>
+
 class VmObject;
-class VmAspace;
 
 class VmObjectDispatcher : public Dispatcher {
 public:
@@ -27,13 +32,48 @@ public:
     mx_ssize_t Write(const void* user_data, mx_size_t length, uint64_t offset);
     mx_status_t SetSize(uint64_t);
     mx_status_t GetSize(uint64_t* size);
+    mx_status_t GetInfo(mx_vmo_info_t* info);
+    mx_status_t Clone(uint64_t offset, uint64_t size, utils::RefPtr<VmObject>* clone);
+    mx_status_t Slice(uint64_t offset, uint64_t size, utils::RefPtr<VmObject>* slice);
+    mx_status_t RangeOp(uint32_t op, uint64_t offset, uint64_t size);
+
+    // fill in missing pages of an object made by mx_pager_create(), see VmObject::SupplyPages()
+    mx_status_t Supply(uint64_t offset, uint64_t len, const void* user_data);
+
+    // whether the kernel's page store may compress pages of the object that go untouched, see
+    // VmObject::SetCompressible()
+    bool GetCompressible();
+    mx_status_t SetCompressible(bool compressible);
+
+    // physical addresses of count pages starting at the page aligned offset, committing any that
+    // aren't, so a device can be pointed at them. the pages are pinned on behalf of process until
+    // it unpins the same range with UnpinPages(), or the object's last handle is closed, so that
+    // decommitting them can't free them while the device uses them.
+    mx_status_t LookupPages(mx_koid_t process, uint64_t offset, size_t count, mx_paddr_t* pages);
+    mx_status_t UnpinPages(mx_koid_t process, uint64_t offset, size_t count);
 
     // XXX really belongs in process
     mx_status_t Map(utils::RefPtr<VmAspace> aspace, uint32_t vmo_rights, uint64_t offset, mx_size_t len,
                     uintptr_t* ptr, uint32_t flags);
 
+    // the arguments Map() gives VmAspace::MapObject, for mapping several objects at once with
+    // VmAspace::MapObjects
+    mx_status_t GetMapArgs(uint32_t vmo_rights, uint64_t offset, mx_size_t len, uintptr_t ptr,
+                           uint32_t flags, VmAspace::MapObjectArgs* args);
+
 private:
     explicit VmObjectDispatcher(utils::RefPtr<VmObject> vmo);
 
+    // pages pinned by LookupPages()
+    struct PinnedRange : public utils::DoublyLinkedListable<utils::unique_ptr<PinnedRange>> {
+        mx_koid_t process;
+        uint64_t offset;
+        size_t count;
+        utils::unique_ptr<vm_page_t*[]> pages;
+    };
+
     utils::RefPtr<VmObject> vmo_;
+
+    mutex_t lock_;
+    utils::DoublyLinkedList<utils::unique_ptr<PinnedRange>> pinned_;
 };
@@ -18,7 +18,7 @@
 #include <sys/types.h>
 
 #include <utils/intrusive_double_list.h>
-#include <utils/intrusive_hash_table.h>
+#include <utils/intrusive_resizable_hash_table.h>
 #include <utils/ref_ptr.h>
 #include <utils/unique_ptr.h>
 
@@ -59,14 +59,17 @@ public:
             }
         };
 
+        // |options| is a combination of MX_WAIT_SET_ENTRY_* flags.
         static status_t Create(mx_signals_t watched_signals,
                                uint64_t cookie,
+                               uint32_t options,
                                utils::unique_ptr<Entry>* entry);
 
         ~Entry();
 
         // Const, hence these don't care about locking:
         mx_signals_t watched_signals() const { return watched_signals_; }
+        uint32_t options() const { return options_; }
 
         void Init_NoLock(WaitSetDispatcher* wait_set, Handle* handle);
         State GetState_NoLock() const;
@@ -80,12 +83,18 @@ public:
             return triggered_entries_node_state_.InContainer();
         }
 
+        // Called by Wait() once it has reported this entry. Edge triggered and one-shot entries
+        // leave the triggered list until they next become ready (or are rearmed).
+        void Reported_NoLock();
+        // Lets a one-shot entry be reported again, triggering it at once if it is ready.
+        bool Rearm_NoLock();
+
         // Hash table support
         uint64_t GetKey() const { return cookie_; }
         static uint64_t GetHash(uint64_t key) { return key; }
 
     private:
-        Entry(mx_signals_t watched_signals, uint64_t cookie);
+        Entry(mx_signals_t watched_signals, uint64_t cookie, uint32_t options);
         Entry(const Entry&) = delete;
         Entry& operator=(const Entry&) = delete;
 
@@ -94,12 +103,16 @@ public:
         bool OnCancel(Handle* handle, bool* should_remove, bool* call_uninitialize) final;
         void OnDidCancel() final {}
 
-        // Triggers (including adding to the triggered list). It must not already be triggered
-        // (i.e., |is_triggered_| must be false; this will set it to true).
+        // Triggers (including adding to the triggered list). It must not already be in the
+        // triggered list; this will set |is_triggered_| to true.
         bool Trigger_NoLock();
+        void Untrigger_NoLock();
+
+        bool IsReady_NoLock() const;
 
         const mx_signals_t watched_signals_;
         const uint64_t cookie_;
+        const uint32_t options_;
 
         // The members below are all protected by the owning WaitSetDispatcher's mutex (once the
         // entry has an owner).
@@ -111,7 +124,11 @@ public:
         // be non-null even if |handle_| is null if |OnCancel()| has been called.)
         utils::RefPtr<Dispatcher> dispatcher_;
 
+        // An edge triggered or one-shot entry stays triggered, but off the triggered list, from
+        // when it is reported until it stops being ready.
         bool is_triggered_ = false;
+        // Set for a one-shot entry once it has been reported, until it is rearmed.
+        bool disarmed_ = false;
         mx_signals_state_t signals_state_ = {0u, 0u};
 
         utils::DoublyLinkedListNodeState<Entry*> triggered_entries_node_state_;
@@ -133,6 +150,9 @@ public:
     // Removes an entry (previously added using AddEntry()).
     status_t RemoveEntry(uint64_t cookie);
 
+    // Lets a one-shot entry be reported again.
+    status_t RearmEntry(uint64_t cookie);
+
     // Waits on the wait set. Note: This blocks.
     status_t Wait(mx_time_t timeout,
                   uint32_t* num_results,
@@ -176,7 +196,7 @@ private:
     // complicated accounting, both in Wait() and in OnCancel().
     bool cancelled_ = false;
 
-    utils::HashTable<uint64_t, HashPtrType, HashBucketType, uint64_t, 127u> entries_;
+    utils::ResizableHashTable<uint64_t, HashPtrType, HashBucketType> entries_;
     utils::DoublyLinkedList<Entry*, Entry::TriggeredEntriesListTraits> triggered_entries_;
     uint32_t num_triggered_entries_ = 0u;
 };
@@ -9,9 +9,11 @@
 #include <assert.h>
 #include <err.h>
 #include <new.h>
+#include <platform.h>
 
 #include <arch/user_copy.h>
 #include <kernel/auto_lock.h>
+#include <kernel/thread.h>
 #include <lib/user_copy.h>
 
 #include <magenta/state_tracker.h>
@@ -20,6 +22,12 @@
 constexpr mx_rights_t kDefaultIOPortRights =
     MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE;
 
+constexpr uint32_t kMaxIOPortDepth = MX_IO_PORT_MAX_DEPTH;
+
+// Room for a packet of any size userspace can queue. Bigger ones, like
+// exception reports, come from the heap even on ports with a pool.
+constexpr mx_size_t kPoolPacketSize = ROUNDUP(sizeof(IOP_Packet) + MX_IO_PORT_MAX_PKT_SIZE, 8);
+
 IOP_Packet* IOP_Packet::Alloc(mx_size_t size) {
     AllocChecker ac;
     auto mem = new (&ac) char [sizeof(IOP_Packet) + size];
@@ -28,26 +36,32 @@ IOP_Packet* IOP_Packet::Alloc(mx_size_t size) {
     return new (mem) IOP_Packet(size);
 }
 
-IOP_Packet* IOP_Packet::Make(const void* data, mx_size_t size) {
-    auto pk = Alloc(size);
-    if (!pk)
+IOP_Packet* IOP_Packet::Make(IOPortDispatcher* port, const void* data, mx_size_t size) {
+    IOP_Packet* pk;
+    if (port->AllocPacket(size, &pk) != NO_ERROR)
         return nullptr;
     memcpy(reinterpret_cast<char*>(pk) + sizeof(IOP_Packet), data, size);
     return pk;
 }
 
-IOP_Packet* IOP_Packet::MakeFromUser(const void* data, mx_size_t size) {
-    auto pk = Alloc(size);
-    if (!pk)
-        return nullptr;
+mx_status_t IOP_Packet::MakeFromUser(IOPortDispatcher* port, const void* data, mx_size_t size,
+                                     IOP_Packet** packet) {
+    IOP_Packet* pk;
+    mx_status_t status = port->AllocPacket(size, &pk);
+    if (status != NO_ERROR)
+        return status;
 
     auto header = reinterpret_cast<mx_packet_header_t*>(
         reinterpret_cast<char*>(pk) + sizeof(IOP_Packet));
 
-    auto status = magenta_copy_from_user(data, header, size);
+    if (magenta_copy_from_user(data, header, size) != NO_ERROR) {
+        port->FreePacket(pk);
+        return ERR_INVALID_ARGS;
+    }
     header->type = MX_IO_PORT_PKT_TYPE_USER;
 
-    return (status == NO_ERROR) ? pk : nullptr;
+    *packet = pk;
+    return NO_ERROR;
 }
 
 void IOP_Packet::Delete(IOP_Packet* packet) {
@@ -57,12 +71,61 @@ void IOP_Packet::Delete(IOP_Packet* packet) {
 
 bool IOP_Packet::CopyToUser(void* data, mx_size_t* size) {
     if (*size < data_size)
-        return ERR_NOT_ENOUGH_BUFFER;
+        return false;
     *size = data_size;
     return copy_to_user(
         data, reinterpret_cast<char*>(this) + sizeof(IOP_Packet), data_size) == NO_ERROR;
 }
 
+IOP_PacketHome::~IOP_PacketHome() {
+    DEBUG_ASSERT(!packet_);
+    mutex_destroy(&lock_);
+}
+
+IOP_Packet* IOP_PacketHome::Take(mx_size_t size) {
+    {
+        AutoLock al(&lock_);
+        if (packet_) {
+            auto packet = packet_;
+            packet_ = nullptr;
+            packet->data_size = size;
+            return packet;
+        }
+    }
+
+    // the last one hasn't come back yet, or there never was one
+    auto packet = IOP_Packet::Alloc(size);
+    if (packet)
+        packet->home = utils::RefPtr<IOP_PacketHome>(this);
+    return packet;
+}
+
+bool IOP_PacketHome::Return(IOP_Packet* packet) {
+    AutoLock al(&lock_);
+    if (abandoned_ || packet_)
+        return false;
+    packet_ = packet;
+    return true;
+}
+
+void IOP_PacketHome::Abandon() {
+    IOP_Packet* packet;
+    {
+        AutoLock al(&lock_);
+        abandoned_ = true;
+        packet = packet_;
+        packet_ = nullptr;
+    }
+    // the packet holds a reference to us, but so does our owner
+    if (packet)
+        IOP_Packet::Delete(packet);
+}
+
+IOP_Interrupt::~IOP_Interrupt() {
+    if (packet)
+        IOP_Packet::Delete(packet);
+}
+
 mx_status_t IOPortDispatcher::Create(uint32_t options,
                                      utils::RefPtr<Dispatcher>* dispatcher,
                                      mx_rights_t* rights) {
@@ -78,9 +141,15 @@ mx_status_t IOPortDispatcher::Create(uint32_t options,
 
 IOPortDispatcher::IOPortDispatcher(uint32_t options)
     : options_(options),
-      no_clients_(false) {
+      no_clients_(false),
+      queued_(0u),
+      depth_(0u),
+      overflow_packet_(nullptr),
+      overflow_busy_(false),
+      dropped_(0u),
+      irq_closed_(false) {
     mutex_init(&lock_);
-    event_init(&event_, false, EVENT_FLAG_AUTOUNSIGNAL);
+    spin_lock_init(&irq_lock_);
 }
 
 IOPortDispatcher::~IOPortDispatcher() {
@@ -90,60 +159,432 @@ IOPortDispatcher::~IOPortDispatcher() {
 
     DEBUG_ASSERT(observers_.is_empty());
     DEBUG_ASSERT(packets_.is_empty());
+    DEBUG_ASSERT(waiters_.is_empty());
+    DEBUG_ASSERT(pending_interrupts_.is_empty());
+
+    // the pool memory goes with |pool_|
+    free_packets_.clear();
 
-    event_destroy(&event_);
     mutex_destroy(&lock_);
 }
 
 void IOPortDispatcher::FreePackets_NoLock() {
     while (!packets_.is_empty()) {
-        IOP_Packet::Delete(packets_.pop_front());
+        FreePacketLocked(PopPacketLocked());
+    }
+}
+
+mx_status_t IOPortDispatcher::SetDepth(uint32_t depth) {
+    if (depth == 0u)
+        return ERR_INVALID_ARGS;
+    if (depth > kMaxIOPortDepth)
+        return ERR_TOO_BIG;
+
+    // one more for the overflow packet
+    AllocChecker ac;
+    utils::unique_ptr<char[]> pool(new (&ac) char[kPoolPacketSize * (depth + 1u)]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    AutoLock al(&lock_);
+    if (depth_ || queued_)
+        return ERR_BAD_STATE;
+
+    for (uint32_t ix = 0; ix != depth; ++ix) {
+        auto pk = new (pool.get() + ix * kPoolPacketSize) IOP_Packet(0u);
+        pk->pooled = true;
+        free_packets_.push_back(pk);
+    }
+
+    auto ov = new (pool.get() + depth * kPoolPacketSize) IOP_Packet(sizeof(mx_packet_header_t));
+    ov->pooled = true;
+    overflow_packet_ = ov;
+
+    pool_ = utils::move(pool);
+    depth_ = depth;
+    return NO_ERROR;
+}
+
+uint32_t IOPortDispatcher::GetDepth() {
+    AutoLock al(&lock_);
+    return depth_;
+}
+
+mx_status_t IOPortDispatcher::AllocPacket(mx_size_t size, IOP_Packet** packet) {
+    {
+        AutoLock al(&lock_);
+        if (depth_ && size <= MX_IO_PORT_MAX_PKT_SIZE) {
+            if (free_packets_.is_empty())
+                return ERR_NOT_READY;
+            auto pk = free_packets_.pop_front();
+            pk->data_size = size;
+            *packet = pk;
+            return NO_ERROR;
+        }
+    }
+
+    auto pk = IOP_Packet::Alloc(size);
+    if (!pk)
+        return ERR_NO_MEMORY;
+    *packet = pk;
+    return NO_ERROR;
+}
+
+// A packet with a home goes back to it. The packet's reference keeps the home
+// around until it's deleted, so hold one of our own while that happens.
+static void FreeOwnedPacket(IOP_Packet* packet) {
+    utils::RefPtr<IOP_PacketHome> home = packet->home;
+    if (!home->Return(packet))
+        IOP_Packet::Delete(packet);
+}
+
+void IOPortDispatcher::FreePacket(IOP_Packet* packet) {
+    if (packet->home) {
+        FreeOwnedPacket(packet);
+        return;
+    }
+
+    if (!packet->pooled && !packet->interrupt) {
+        IOP_Packet::Delete(packet);
+        return;
+    }
+
+    AutoLock al(&lock_);
+    FreePacketLocked(packet);
+}
+
+void IOPortDispatcher::FreePacketLocked(IOP_Packet* packet) {
+    if (packet->home) {
+        FreeOwnedPacket(packet);
+    } else if (packet->interrupt) {
+        FreeInterruptPacketLocked(packet->interrupt);
+    } else if (!packet->pooled) {
+        IOP_Packet::Delete(packet);
+    } else if (packet == overflow_packet_) {
+        overflow_busy_ = false;
+        if (dropped_ && !no_clients_)
+            QueueOverflowLocked();
+    } else {
+        free_packets_.push_front(packet);
+    }
+}
+
+IOP_Packet* IOPortDispatcher::PopPacketLocked() {
+    auto packet = packets_.pop_front();
+    if (packet->interrupt)
+        return ReportInterruptLocked(packet->interrupt);
+    if (packet != overflow_packet_) {
+        --queued_;
+        return packet;
+    }
+
+    // report the drops up to now; later ones wait for the packet to come back
+    auto header = reinterpret_cast<mx_packet_header_t*>(
+        reinterpret_cast<char*>(packet) + sizeof(IOP_Packet));
+    header->key = 0u;
+    header->type = MX_IO_PORT_PKT_TYPE_OVERFLOW;
+    header->extra = dropped_ > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(dropped_);
+    dropped_ = 0u;
+    return packet;
+}
+
+void IOPortDispatcher::QueueOverflowLocked() {
+    overflow_busy_ = true;
+    QueuePacketLocked(overflow_packet_);
+}
+
+// Give |packet| to the first waiter with room for it, or queue it if there is
+// none. Waiters without room are woken with an error, as they would have got
+// had the packet been there when they came in. Returns true if a thread was
+// woken with the packet.
+bool IOPortDispatcher::QueuePacketLocked(IOP_Packet* packet) {
+    if (packet != overflow_packet_)
+        ++queued_;
+    packets_.push_back(packet);
+
+    // threads only block on an empty queue, so |packet| is next out if
+    // anyone is waiting
+    for (;;) {
+        Waiter* waiter = nullptr;
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&irq_lock_, state);
+        if (!waiters_.is_empty())
+            waiter = waiters_.pop_front();
+        spin_unlock_irqrestore(&irq_lock_, state);
+        if (!waiter)
+            return false;
+
+        if (packet->data_size > waiter->max_size) {
+            waiter->status = ERR_NOT_ENOUGH_BUFFER;
+        } else {
+            // popped like any other so the overflow packet gets filled in
+            waiter->packet = PopPacketLocked();
+        }
+        event_signal(&waiter->event, false);
+        if (waiter->packet)
+            return true;
     }
 }
 
+uint32_t IOPortDispatcher::TakePacketsLocked(mx_size_t max_size, IOP_Packet** packets,
+                                             uint32_t count) {
+    uint32_t n = 0u;
+    while (n != count && !packets_.is_empty() && packets_.front().data_size <= max_size)
+        packets[n++] = PopPacketLocked();
+    return n;
+}
+
+void IOPortDispatcher::NoteDroppedPacket() {
+    AutoLock al(&lock_);
+    if (!overflow_packet_ || no_clients_)
+        return;
+
+    ++dropped_;
+    if (!overflow_busy_)
+        QueueOverflowLocked();
+}
+
 void IOPortDispatcher::on_zero_handles() {
     AutoLock al(&lock_);
     no_clients_ = true;
     FreePackets_NoLock();
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&irq_lock_, state);
+
+    // bound interrupts stop queueing; their owners still unbind them
+    irq_closed_ = true;
+    while (!pending_interrupts_.is_empty())
+        pending_interrupts_.pop_front()->busy = false;
+
+    // waiters hold a handle, so there should be none left; be safe anyway
+    while (!waiters_.is_empty()) {
+        auto waiter = waiters_.pop_front();
+        waiter->status = ERR_HANDLE_CLOSED;
+        event_signal(&waiter->event, false);
+    }
+
+    spin_unlock_irqrestore(&irq_lock_, state);
 }
 
 mx_status_t IOPortDispatcher::Queue(IOP_Packet* packet) {
-    int wake_count = 0;
+    bool woke = false;
     mx_status_t status = NO_ERROR;
     {
         AutoLock al(&lock_);
         if (no_clients_) {
             status = ERR_NOT_AVAILABLE;
+        } else if (depth_ && queued_ >= depth_ && !packet->home) {
+            // only heap packets, too big for the pool, can get here
+            status = ERR_NOT_READY;
         } else {
-            packets_.push_back(packet);
-            wake_count = event_signal_etc(&event_, false, status);
+            woke = QueuePacketLocked(packet);
         }
+
+        if (status != NO_ERROR)
+            FreePacketLocked(packet);
     }
 
-    if (status != NO_ERROR) {
-        IOP_Packet::Delete(packet);
+    if (status != NO_ERROR)
         return status;
+
+    // as in StateTracker, a waker about to block hands off when it does
+    if (woke && !thread_get_sync_wakeup())
+        thread_preempt_if_needed();
+
+    return NO_ERROR;
+}
+
+mx_status_t IOPortDispatcher::Wait(lk_time_t timeout, mx_size_t max_size, IOP_Packet** packets,
+                                   uint32_t count, uint32_t* actual) {
+    DEBUG_ASSERT(count > 0u);
+
+    Waiter waiter;
+    {
+        AutoLock al(&lock_);
+
+        // an interrupt can't fire between the check and the thread going on
+        // the list, or it would be left pending with the thread asleep
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&irq_lock_, state);
+        DrainInterruptsLocked();
+        bool ready = !packets_.is_empty();
+        if (!ready && timeout != 0u) {
+            waiter.max_size = max_size;
+            event_init(&waiter.event, false, 0);
+            waiters_.push_back(&waiter);
+        }
+        spin_unlock_irqrestore(&irq_lock_, state);
+
+        if (ready) {
+            if (packets_.front().data_size > max_size)
+                return ERR_NOT_ENOUGH_BUFFER;
+            *actual = TakePacketsLocked(max_size, packets, count);
+            return NO_ERROR;
+        }
+        if (timeout == 0u)
+            return ERR_TIMED_OUT;
     }
 
-    if (wake_count)
-        thread_yield();
+    enum thread_wait_reason reason = thread_set_wait_reason(THREAD_WAIT_PORT);
+    status_t status = event_wait_timeout(&waiter.event, timeout, true);
+    thread_set_wait_reason(reason);
 
+    {
+        AutoLock al(&lock_);
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&irq_lock_, state);
+        bool listed = waiter.InContainer();
+        if (listed)
+            waiters_.erase(waiter);
+        spin_unlock_irqrestore(&irq_lock_, state);
+
+        // we're off the list once we have been given a packet, an interrupt
+        // or an error. one may have come in after we timed out or were
+        // interrupted.
+        if (waiter.packet) {
+            packets[0] = waiter.packet;
+            *actual = 1u + TakePacketsLocked(max_size, packets + 1, count - 1u);
+            status = NO_ERROR;
+        } else if (waiter.interrupt) {
+            packets[0] = ReportInterruptLocked(waiter.interrupt);
+            *actual = 1u + TakePacketsLocked(max_size, packets + 1, count - 1u);
+            status = NO_ERROR;
+        } else if (!listed) {
+            status = waiter.status;
+        }
+    }
+    event_destroy(&waiter.event);
+
+    return status;
+}
+
+mx_status_t IOPortDispatcher::BindInterrupt(uint64_t key, IOP_Interrupt** interrupt) {
+    AllocChecker ac;
+    utils::unique_ptr<IOP_Interrupt> irq(new (&ac) IOP_Interrupt(key));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    irq->packet = IOP_Packet::Alloc(sizeof(mx_interrupt_packet_t));
+    if (!irq->packet)
+        return ERR_NO_MEMORY;
+    irq->packet->interrupt = irq.get();
+
+    AutoLock al(&lock_);
+    if (no_clients_)
+        return ERR_NOT_AVAILABLE;
+
+    *interrupt = irq.release();
     return NO_ERROR;
 }
 
-mx_status_t IOPortDispatcher::Wait(IOP_Packet** packet) {
-    while (true) {
-        {
-            AutoLock al(&lock_);
-            if (!packets_.is_empty()) {
-                *packet = packets_.pop_front();
-                return NO_ERROR;
-            }
+void IOPortDispatcher::UnbindInterrupt(IOP_Interrupt* interrupt) {
+    bool free_it;
+    {
+        AutoLock al(&lock_);
+
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&irq_lock_, state);
+        interrupt->unbound = true;
+        if (interrupt->InContainer()) {
+            pending_interrupts_.erase(*interrupt);
+            interrupt->busy = false;
+        }
+        free_it = !interrupt->busy;
+        spin_unlock_irqrestore(&irq_lock_, state);
+
+        // if it is queued, take it back rather than report it after the fact.
+        // if a waiter or a reader has it, they free it when they are done.
+        if (!free_it && interrupt->packet->iop_lns_.InContainer()) {
+            packets_.erase(*interrupt->packet);
+            free_it = true;
         }
-        status_t st = event_wait_timeout(&event_, INFINITE_TIME, true);
-        if (st != NO_ERROR)
-            return st;
     }
+
+    if (free_it)
+        delete interrupt;
+}
+
+bool IOPortDispatcher::SignalInterrupt(IOP_Interrupt* interrupt) {
+    mx_time_t now = current_time_hires();
+    bool woke = false;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&irq_lock_, state);
+    if (!irq_closed_ && !interrupt->unbound) {
+        if (interrupt->fired++ == 0u)
+            interrupt->first_fired = now;
+        if (!interrupt->busy) {
+            interrupt->busy = true;
+            woke = HandOffInterruptLocked(interrupt);
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock_, state);
+
+    return woke;
+}
+
+// Give |interrupt| to the first waiter with room for its packet, or leave it
+// pending for the next Wait(). Waiters without room are woken with an error,
+// as in QueuePacketLocked(). Called with |irq_lock_| held.
+bool IOPortDispatcher::HandOffInterruptLocked(IOP_Interrupt* interrupt) {
+    while (!waiters_.is_empty()) {
+        auto waiter = waiters_.pop_front();
+        if (interrupt->packet->data_size > waiter->max_size) {
+            waiter->status = ERR_NOT_ENOUGH_BUFFER;
+            event_signal(&waiter->event, false);
+            continue;
+        }
+        waiter->interrupt = interrupt;
+        event_signal(&waiter->event, false);
+        return true;
+    }
+
+    pending_interrupts_.push_back(interrupt);
+    return false;
+}
+
+// Queue the packets of the interrupts which fired with nobody waiting. They
+// are filled in when they are popped, so they report any fires until then.
+// Called with |lock_| and |irq_lock_| held.
+void IOPortDispatcher::DrainInterruptsLocked() {
+    while (!pending_interrupts_.is_empty())
+        packets_.push_back(pending_interrupts_.pop_front()->packet);
+}
+
+IOP_Packet* IOPortDispatcher::ReportInterruptLocked(IOP_Interrupt* interrupt) {
+    auto payload = reinterpret_cast<mx_interrupt_packet_t*>(
+        reinterpret_cast<char*>(interrupt->packet) + sizeof(IOP_Packet));
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&irq_lock_, state);
+    payload->hdr.key = interrupt->key;
+    payload->hdr.type = MX_IO_PORT_PKT_TYPE_INTERRUPT;
+    payload->hdr.extra =
+        interrupt->fired > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(interrupt->fired);
+    payload->timestamp = interrupt->first_fired;
+    interrupt->fired = 0u;
+    spin_unlock_irqrestore(&irq_lock_, state);
+
+    return interrupt->packet;
+}
+
+// The reader is done with the packet of |interrupt|. Send it out again right
+// away if the interrupt fired since it was filled in.
+void IOPortDispatcher::FreeInterruptPacketLocked(IOP_Interrupt* interrupt) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&irq_lock_, state);
+    interrupt->busy = false;
+    bool free_it = interrupt->unbound;
+    if (!free_it && interrupt->fired && !irq_closed_) {
+        interrupt->busy = true;
+        HandOffInterruptLocked(interrupt);
+    }
+    spin_unlock_irqrestore(&irq_lock_, state);
+
+    if (free_it)
+        delete interrupt;
 }
 
 mx_status_t IOPortDispatcher::Bind(Handle* handle, mx_signals_t signals, uint64_t key) {
@@ -25,11 +25,17 @@ bool SendIOPortPacket(IOPortDispatcher* io_port,
         0u
     };
 
-    auto packet = IOP_Packet::Make(&payload, sizeof(payload));
-    if (!packet)
+    // a full port counts what it had to drop, see IOPortDispatcher::SetDepth()
+    auto packet = IOP_Packet::Make(io_port, &payload, sizeof(payload));
+    if (!packet) {
+      io_port->NoteDroppedPacket();
       return false;
+    }
 
-    return io_port->Queue(packet) == NO_ERROR;
+    mx_status_t status = io_port->Queue(packet);
+    if (status == ERR_NOT_READY)
+      io_port->NoteDroppedPacket();
+    return status == NO_ERROR;
 }
 
 IOPortObserver::IOPortObserver(utils::RefPtr<IOPortDispatcher> io_port,
@@ -39,6 +45,7 @@ IOPortObserver::IOPortObserver(utils::RefPtr<IOPortDispatcher> io_port,
     : state_(NEW),
       handle_(handle),
       watched_signals_(watched_signals),
+      satisfied_(0u),
       key_(key),
       io_port_(utils::move(io_port)) {
 }
@@ -51,8 +58,10 @@ int IOPortObserver::SetState(int state) {
     return atomic_swap(&state_, state);
 }
 
-bool IOPortObserver::OnInitialize(mx_signals_state_t) {
-    return false;
+bool IOPortObserver::OnInitialize(mx_signals_state_t initial_state) {
+    // anything already up counts as an edge, or a message that came in before
+    // the bind would never be reported
+    return MaybeSignal(initial_state);
 }
 
 bool IOPortObserver::OnStateChange(mx_signals_state_t new_state) {
@@ -82,5 +91,9 @@ void IOPortObserver::OnDidCancel() {
 
 bool IOPortObserver::MaybeSignal(mx_signals_state_t state) {
     auto match = state.satisfied & watched_signals_;
-    return match ? SendIOPortPacket(io_port_.get(), key_, match) : false;
+    auto rising = match & ~satisfied_;
+    satisfied_ = match;
+
+    // report all the watched signals that are up, not just the new ones
+    return rising ? SendIOPortPacket(io_port_.get(), key_, match) : false;
 }
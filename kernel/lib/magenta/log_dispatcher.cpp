@@ -51,8 +51,9 @@ status_t LogDispatcher::ReadFromUser(void* ptr, size_t len, uint32_t flags) {
     if (!(flags_ & MX_LOG_FLAG_READABLE)) {
         return ERR_BAD_STATE;
     }
+    uint32_t dlog_flags = (flags & MX_LOG_FLAG_MANY) ? DLOG_FLAG_MANY : 0;
     for (;;) {
-        mx_status_t r = dlog_read_user(&reader_, 0, ptr, len);
+        mx_status_t r = dlog_read_user(&reader_, dlog_flags, ptr, len);
         if ((r == ERR_BAD_STATE) && (flags & MX_LOG_FLAG_WAIT)) {
             dlog_wait(&reader_);
             continue;
@@ -6,18 +6,24 @@
 
 #include <magenta/magenta.h>
 
+#include <new.h>
+#include <stdlib.h>
 #include <trace.h>
 
 #include <kernel/auto_lock.h>
 #include <kernel/mutex.h>
+#include <kernel/thread.h>
+#include <kernel/vm.h>
 
 #include <lk/init.h>
 
 #include <lib/console.h>
 
 #include <magenta/dispatcher.h>
+#include <magenta/event_dispatcher.h>
 #include <magenta/excp_port.h>
 #include <magenta/handle.h>
+#include <magenta/object_cache.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/state_tracker.h>
 
@@ -25,37 +31,66 @@
 #include <magenta/pci_interrupt_dispatcher.h>
 #include <magenta/io_mapping_dispatcher.h>
 
-#include <utils/arena.h>
 #include <utils/intrusive_double_list.h>
 #include <utils/type_support.h>
 
 #define LOCAL_TRACE 0
 
-// This handle limit relects the fact that VMOs have an internal array
-// with entry per memory page. When we switch to a tree of ranges we can
-// up this limit.
-constexpr size_t kMaxHandleCount = 32 * 1024;
+// Handles are carved out of the heap and recycled through small per cpu
+// caches of free handle blocks, so that making and deleting handles doesn't
+// serialize on a global lock. There is no system wide limit on their number.
+constexpr size_t kHandleCacheMax = 64;
 
-// The handle arena and its mutex.
-mutex_t handle_mutex = MUTEX_INITIAL_VALUE(handle_mutex);
-utils::TypedArena<Handle> handle_arena;
+using HandleCache = ObjectCache<Handle, kHandleCacheMax>;
 
 // The system exception port.
 static utils::RefPtr<ExceptionPort> system_exception_port;
 static mutex_t system_exception_mutex = MUTEX_INITIAL_VALUE(system_exception_mutex);
 
+// The low memory event, signaled while the pmm is short of free pages. Set up
+// at init and never changed after.
+static utils::RefPtr<Dispatcher> low_memory_event;
+
+// Mirrors the pmm's memory state onto the low memory event.
+static int low_memory_watcher(void* arg) {
+    auto event = low_memory_event->get_event_dispatcher();
+
+    bool low = false;
+    for (;;) {
+        pmm_wait_memory_state_change(low);
+
+        low = pmm_memory_low();
+        if (low)
+            event->SignalEvent();
+        else
+            event->ResetEvent();
+    }
+
+    return 0;
+}
+
 void magenta_init(uint level) {
-    handle_arena.Init("handles", kMaxHandleCount);
+    mx_rights_t rights;
+    if (EventDispatcher::Create(0, &low_memory_event, &rights) == NO_ERROR) {
+        thread_t* t = thread_create("low memory watcher", &low_memory_watcher, nullptr,
+                                    HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+        if (t)
+            thread_detach_and_resume(t);
+    }
 }
 
 Handle* MakeHandle(utils::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
-    AutoLock lock(&handle_mutex);
-    return handle_arena.New(utils::move(dispatcher), rights);
+    void* storage = HandleCache::Alloc();
+    if (!storage)
+        return nullptr;
+    return new (storage) Handle(utils::move(dispatcher), rights);
 }
 
 Handle* DupHandle(Handle* source, mx_rights_t rights) {
-    AutoLock lock(&handle_mutex);
-    return handle_arena.New(source, rights);
+    void* storage = HandleCache::Alloc();
+    if (!storage)
+        return nullptr;
+    return new (storage) Handle(source, rights);
 }
 
 void DeleteHandle(Handle* handle) {
@@ -79,31 +114,8 @@ void DeleteHandle(Handle* handle) {
     // Calling the handle dtor can cause many things to happen, so it is important
     // to call it outside the lock.
     handle->~Handle();
-    // Setting the memory to zero is critical for the safe operation of the handle
-    // table lookup.
-    memset(handle, 0, sizeof(Handle));
 
-    AutoLock lock(&handle_mutex);
-    handle_arena.RawFree(handle);
-}
-
-bool HandleInRange(void* addr) {
-    AutoLock lock(&handle_mutex);
-    return handle_arena.in_range(addr);
-}
-
-uint32_t MapHandleToU32(Handle* handle) {
-    auto va = reinterpret_cast<char*>(handle) - reinterpret_cast<char*>(handle_arena.start());
-    return static_cast<uint32_t>(va);
-}
-
-Handle* MapU32ToHandle(uint32_t value) {
-    auto va = value + reinterpret_cast<char*>(handle_arena.start());
-    if (value % sizeof(Handle) != 0)
-        return nullptr;
-    if (!HandleInRange(va))
-        return nullptr;
-    return reinterpret_cast<Handle*>(va);
+    HandleCache::Free(handle);
 }
 
 mx_status_t SetSystemExceptionPort(utils::RefPtr<ExceptionPort> eport) {
@@ -124,6 +136,10 @@ utils::RefPtr<ExceptionPort> GetSystemExceptionPort() {
     return system_exception_port;
 }
 
+utils::RefPtr<Dispatcher> GetLowMemoryEvent() {
+    return low_memory_event;
+}
+
 bool magenta_rights_check(mx_rights_t actual, mx_rights_t desired) {
     if ((actual & desired) == desired)
         return true;
@@ -5,12 +5,24 @@
 // https://opensource.org/licenses/MIT
 
 #include <err.h>
+#include <new.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
+#include <kernel/thread.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object.h>
+#include <lib/ktrace.h>
+#include <lib/user_copy.h>
 #include <magenta/handle.h>
 #include <magenta/magenta.h>
 #include <magenta/msg_pipe.h>
+#include <magenta/object_cache.h>
+#include <magenta/process_dispatcher.h>
+#include <magenta/user_copy.h>
 
 namespace {
 
@@ -18,15 +30,173 @@ size_t other_side(size_t side) {
     return side ? 0u : 1u;
 }
 
+// Free packets are recycled through small per cpu caches, the same way as
+// handles are.
+constexpr size_t kPacketCacheMax = 32;
+
+using PacketCache = ObjectCache<MessagePacket, kPacketCacheMax>;
+
 }  // namespace
 
+status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
+                               utils::unique_ptr<MessagePacket>* msg) {
+    return Create(data_size, num_handles, true, msg);
+}
+
+status_t MessagePacket::CreateFromUser(const void* user_data, uint32_t data_size,
+                                       uint32_t num_handles,
+                                       utils::unique_ptr<MessagePacket>* msg) {
+    if (data_size < kVmoDataSize) {
+        status_t status = Create(data_size, num_handles, true, msg);
+        if (status != NO_ERROR)
+            return status;
+        if (data_size && magenta_copy_from_user(user_data, (*msg)->data_, data_size) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        return NO_ERROR;
+    }
+
+    // a single copy into fresh pages, rather than one into a large heap
+    // buffer and another out of it when the message is read
+    if (!is_user_address(reinterpret_cast<vaddr_t>(user_data)))
+        return ERR_INVALID_ARGS;
+
+    utils::unique_ptr<MessagePacket> packet;
+    status_t status = Create(data_size, num_handles, false, &packet);
+    if (status != NO_ERROR)
+        return status;
+
+    packet->data_vmo_ = VmObject::Create(PMM_ALLOC_FLAG_ANY, data_size);
+    if (!packet->data_vmo_)
+        return ERR_NO_MEMORY;
+
+    size_t written;
+    status = packet->data_vmo_->WriteUser(user_data, 0u, data_size, &written);
+    if (status != NO_ERROR || written != data_size)
+        return (status == ERR_NO_MEMORY) ? ERR_NO_MEMORY : ERR_INVALID_ARGS;
+
+    *msg = utils::move(packet);
+    return NO_ERROR;
+}
+
+status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles, bool heap_data,
+                               utils::unique_ptr<MessagePacket>* msg) {
+    void* storage = PacketCache::Alloc();
+    if (!storage)
+        return ERR_NO_MEMORY;
+
+    utils::unique_ptr<MessagePacket> packet(new (storage) MessagePacket(data_size, num_handles));
+
+    if (!heap_data)
+        packet->data_ = nullptr;
+
+    // anything that doesn't fit inline goes in one buffer, handles first
+    bool inline_data = !heap_data || data_size <= kInlineDataSize;
+    bool inline_handles = num_handles <= kInlineHandleCount;
+    if (!inline_data || !inline_handles) {
+        size_t handles_size = inline_handles ? 0 : num_handles * sizeof(Handle*);
+        size_t buffer_size = handles_size + (inline_data ? 0 : data_size);
+        packet->buffer_ = malloc(buffer_size);
+        if (!packet->buffer_) {
+            packet->ReturnHandles();
+            return ERR_NO_MEMORY;
+        }
+
+        uint8_t* buffer = static_cast<uint8_t*>(packet->buffer_);
+        if (!inline_handles) {
+            packet->handles_ = reinterpret_cast<Handle**>(buffer);
+            memset(packet->handles_, 0, handles_size);
+        }
+        if (!inline_data)
+            packet->data_ = buffer + handles_size;
+    }
+
+    *msg = utils::move(packet);
+    return NO_ERROR;
+}
+
+MessagePacket::MessagePacket(uint32_t data_size, uint32_t num_handles)
+    : data_size_(data_size),
+      num_handles_(num_handles),
+      data_(inline_data_),
+      handles_(inline_handles_) {
+    // the creator fills the handles in, until then there are none to delete
+    for (uint32_t ix = 0; ix < kInlineHandleCount; ++ix)
+        inline_handles_[ix] = nullptr;
+}
+
+void MessagePacket::operator delete(void* storage) {
+    PacketCache::Free(storage);
+}
+
 void MessagePacket::ReturnHandles() {
-    handles.reset();
+    num_handles_ = 0u;
 }
 
 MessagePacket::~MessagePacket() {
-    for (size_t ix = 0; ix != handles.size(); ++ix) {
-        DeleteHandle(handles[ix]);
+    for (uint32_t ix = 0; ix != num_handles_; ++ix) {
+        if (handles_[ix])
+            DeleteHandle(handles_[ix]);
+    }
+    free(buffer_);
+}
+
+status_t MessagePacket::CopyDataToUser(void* user_data) {
+    if (!data_vmo_)
+        return copy_to_user(user_data, data_, data_size_);
+
+    // hand whole pages over to a page aligned reader, copying just the rest
+    vaddr_t va = reinterpret_cast<vaddr_t>(user_data);
+    size_t moved = 0u;
+    size_t move_len = ROUNDDOWN(data_size_, PAGE_SIZE);
+    if (IS_PAGE_ALIGNED(va)) {
+        utils::RefPtr<VmObject> object;
+        uint64_t offset;
+        auto aspace = ProcessDispatcher::GetCurrent()->aspace();
+        if (aspace->LookupWritableObject(va, move_len, &object, &offset) == NO_ERROR &&
+            IS_PAGE_ALIGNED(offset)) {
+            status_t status = object->TakePages(data_vmo_.get(), 0u, offset, move_len);
+            if (status == NO_ERROR)
+                moved = move_len;
+            else if (status == ERR_NO_MEMORY)
+                return status;
+        }
+    }
+    if (moved == data_size_)
+        return NO_ERROR;
+
+    uint8_t* rest = static_cast<uint8_t*>(user_data) + moved;
+    if (!is_user_address(reinterpret_cast<vaddr_t>(rest)))
+        return ERR_INVALID_ARGS;
+
+    size_t read;
+    status_t status = data_vmo_->ReadUser(rest, moved, data_size_ - moved, &read);
+    if (status != NO_ERROR || read != data_size_ - moved)
+        return ERR_INVALID_ARGS;
+    return NO_ERROR;
+}
+
+uint32_t MessagePacket::GetTxid() {
+    DEBUG_ASSERT(data_size_ >= sizeof(uint32_t));
+
+    uint32_t txid = 0u;
+    if (data_vmo_) {
+        size_t read;
+        data_vmo_->Read(&txid, 0u, sizeof(txid), &read);
+    } else {
+        memcpy(&txid, data_, sizeof(txid));
+    }
+    return txid;
+}
+
+void MessagePacket::SetTxid(uint32_t txid) {
+    DEBUG_ASSERT(data_size_ >= sizeof(uint32_t));
+
+    if (data_vmo_) {
+        // the page is already there, so this can't fail for lack of memory
+        size_t written;
+        data_vmo_->Write(&txid, 0u, sizeof(txid), &written);
+    } else {
+        memcpy(data_, &txid, sizeof(txid));
     }
 }
 
@@ -48,6 +218,8 @@ MessagePipe::~MessagePipe() {
 
     DEBUG_ASSERT(messages_[0].is_empty());
     DEBUG_ASSERT(messages_[1].is_empty());
+    DEBUG_ASSERT(waiters_[0].is_empty());
+    DEBUG_ASSERT(waiters_[1].is_empty());
 }
 
 void MessagePipe::OnDispatcherDestruction(size_t side) {
@@ -58,6 +230,14 @@ void MessagePipe::OnDispatcherDestruction(size_t side) {
         AutoLock lock(&lock_);
         dispatcher_alive_[side] = false;
         messages_to_destroy.swap(messages_[side]);
+        queued_messages_[side] = 0u;
+        queued_bytes_[side] = 0u;
+
+        // no reply is coming for calls still waiting on the other side
+        while (!waiters_[other].is_empty()) {
+            CallWaiter* waiter = waiters_[other].pop_front();
+            event_signal(&waiter->event, false);
+        }
 
         if (dispatcher_alive_[other]) {
             mx_signals_t other_satisfiable_clear = MX_SIGNAL_WRITABLE;
@@ -77,8 +257,11 @@ status_t MessagePipe::Read(size_t side, utils::unique_ptr<MessagePacket>* msg) {
 
     {
         AutoLock lock(&lock_);
-        *msg = messages_[side].pop_front();
+        bool was_full = QueueFullLocked(side);
+        *msg = DequeueLocked(side);
         other_alive = dispatcher_alive_[other];
+        if (*msg)
+            UpdateWritableLocked(side, was_full);
 
         if (messages_[side].is_empty()) {
             state_tracker_[side].UpdateState(0u, MX_SIGNAL_READABLE, 0u,
@@ -91,24 +274,235 @@ status_t MessagePipe::Read(size_t side, utils::unique_ptr<MessagePacket>* msg) {
     return other_alive ? ERR_BAD_STATE : ERR_CHANNEL_CLOSED;
 }
 
-status_t MessagePipe::Write(size_t side, utils::unique_ptr<MessagePacket> msg) {
+status_t MessagePipe::Write(size_t side, utils::unique_ptr<MessagePacket>* msg) {
     auto other = other_side(side);
 
     AutoLock lock(&lock_);
     bool other_alive = dispatcher_alive_[other];
-    if (!other_alive) {
-        // |msg| will be destroyed but we want to keep the handles alive since
-        // the caller should put them back into the process table.
-        msg->ReturnHandles();
+    if (!other_alive)
         return ERR_BAD_STATE;
-    }
 
-    messages_[other].push_back(utils::move(msg));
+    if (DeliverReplyLocked(other, msg))
+        return NO_ERROR;
+
+    if (QueueFullLocked(other))
+        return ERR_NOT_READY;
+
+    EnqueueLocked(other, utils::move(*msg));
 
     state_tracker_[other].UpdateSatisfied(MX_SIGNAL_READABLE, 0u);
     return NO_ERROR;
 }
 
+status_t MessagePipe::ReadMany(size_t side, MessageBufferSize* sizes, uint32_t count,
+                               MessageList* msgs) {
+    bool other_alive;
+    auto other = other_side(side);
+    uint32_t num_read = 0u;
+
+    {
+        AutoLock lock(&lock_);
+        other_alive = dispatcher_alive_[other];
+        bool was_full = QueueFullLocked(side);
+
+        while (num_read < count && !messages_[side].is_empty()) {
+            const MessagePacket& next = messages_[side].front();
+            if (next.data_size() > sizes[num_read].num_bytes ||
+                next.num_handles() > sizes[num_read].num_handles) {
+                if (num_read == 0u) {
+                    sizes[0].num_bytes = next.data_size();
+                    sizes[0].num_handles = next.num_handles();
+                    return ERR_NOT_ENOUGH_BUFFER;
+                }
+                break;
+            }
+            msgs->push_back(DequeueLocked(side));
+            num_read++;
+        }
+
+        if (num_read)
+            UpdateWritableLocked(side, was_full);
+
+        if (num_read && messages_[side].is_empty()) {
+            state_tracker_[side].UpdateState(0u, MX_SIGNAL_READABLE, 0u,
+                                             !other_alive ? MX_SIGNAL_READABLE : 0u);
+        }
+    }
+
+    if (num_read)
+        return NO_ERROR;
+    return other_alive ? ERR_BAD_STATE : ERR_CHANNEL_CLOSED;
+}
+
+status_t MessagePipe::WriteMany(size_t side, MessageList* msgs) {
+    auto other = other_side(side);
+
+    AutoLock lock(&lock_);
+    if (!dispatcher_alive_[other])
+        return ERR_BAD_STATE;
+
+    // the whole batch goes in if there's any room at all, so a full batch
+    // can overshoot the caps by up to its own size
+    if (QueueFullLocked(other))
+        return ERR_NOT_READY;
+
+    bool queued = false;
+    while (!msgs->is_empty()) {
+        utils::unique_ptr<MessagePacket> msg = msgs->pop_front();
+        if (DeliverReplyLocked(other, &msg))
+            continue;
+        EnqueueLocked(other, utils::move(msg));
+        queued = true;
+    }
+
+    if (queued)
+        state_tracker_[other].UpdateSatisfied(MX_SIGNAL_READABLE, 0u);
+    return NO_ERROR;
+}
+
+bool MessagePipe::DeliverReplyLocked(size_t side, utils::unique_ptr<MessagePacket>* msg) {
+    if (waiters_[side].is_empty() || (*msg)->data_size() < sizeof(uint32_t))
+        return false;
+
+    uint32_t txid = (*msg)->GetTxid();
+    if (!(txid & kTxidCallBit))
+        return false;
+
+    for (auto& waiter : waiters_[side]) {
+        if (waiter.txid != txid)
+            continue;
+
+        ktrace(MX_KTRACE_TAG_MSG_SEND, (*msg)->data_size(), koid_);
+        waiters_[side].erase(waiter);
+        waiter.reply = utils::move(*msg);
+        event_signal(&waiter.event, false);
+        return true;
+    }
+    return false;
+}
+
+status_t MessagePipe::Call(size_t side, utils::unique_ptr<MessagePacket>* msg, lk_time_t timeout,
+                           utils::unique_ptr<MessagePacket>* reply) {
+    auto other = other_side(side);
+
+    if ((*msg)->data_size() < sizeof(uint32_t))
+        return ERR_INVALID_ARGS;
+
+    CallWaiter waiter;
+    event_init(&waiter.event, false, 0);
+
+    {
+        AutoLock lock(&lock_);
+        status_t status = !dispatcher_alive_[other] ? ERR_BAD_STATE :
+                          QueueFullLocked(other) ? ERR_NOT_READY : NO_ERROR;
+        if (status != NO_ERROR) {
+            event_destroy(&waiter.event);
+            return status;
+        }
+
+        waiter.txid = (next_txid_++ & ~kTxidCallBit) | kTxidCallBit;
+        (*msg)->SetTxid(waiter.txid);
+        waiters_[side].push_back(&waiter);
+
+        // we're about to block until the other side answers, so let whoever
+        // is waiting to read the request run here in our place. the flag
+        // stays up until we block so the scheduler switches straight to it.
+        thread_set_sync_wakeup(true);
+        EnqueueLocked(other, utils::move(*msg));
+        state_tracker_[other].UpdateSatisfied(MX_SIGNAL_READABLE, 0u);
+    }
+
+    status_t status = event_wait_timeout(&waiter.event, timeout, true);
+    thread_set_sync_wakeup(false);
+
+    {
+        AutoLock lock(&lock_);
+        // we're off the list once a reply is in or the other side is gone.
+        // the reply may have come in after we timed out or were interrupted.
+        if (waiter.reply)
+            status = NO_ERROR;
+        else if (waiter.InContainer())
+            waiters_[side].erase(waiter);
+        else
+            status = ERR_CHANNEL_CLOSED;
+    }
+    event_destroy(&waiter.event);
+
+    if (status != NO_ERROR)
+        return status;
+
+    *reply = utils::move(waiter.reply);
+    return NO_ERROR;
+}
+
 StateTracker* MessagePipe::GetStateTracker(size_t side) {
     return &state_tracker_[side];
 }
+
+void MessagePipe::SetMaxQueuedMessages(size_t side, uint32_t max_messages) {
+    AutoLock lock(&lock_);
+    bool was_full = QueueFullLocked(side);
+    max_messages_[side] = max_messages;
+    UpdateWritableLocked(side, was_full);
+}
+
+void MessagePipe::SetMaxQueuedBytes(size_t side, uint32_t max_bytes) {
+    AutoLock lock(&lock_);
+    bool was_full = QueueFullLocked(side);
+    max_bytes_[side] = max_bytes;
+    UpdateWritableLocked(side, was_full);
+}
+
+void MessagePipe::GetQueueLimits(size_t side, uint32_t* max_messages, uint32_t* max_bytes) {
+    AutoLock lock(&lock_);
+    *max_messages = max_messages_[side];
+    *max_bytes = max_bytes_[side];
+}
+
+void MessagePipe::GetInfo(size_t side, mx_msg_pipe_info_t* info) {
+    auto other = other_side(side);
+
+    AutoLock lock(&lock_);
+    info->queued_bytes = queued_bytes_[side];
+    info->peer_queued_bytes = queued_bytes_[other];
+    info->queued_messages = queued_messages_[side];
+    info->peer_queued_messages = queued_messages_[other];
+}
+
+bool MessagePipe::QueueFullLocked(size_t side) const {
+    return (max_messages_[side] && queued_messages_[side] >= max_messages_[side]) ||
+           (max_bytes_[side] && queued_bytes_[side] >= max_bytes_[side]);
+}
+
+void MessagePipe::EnqueueLocked(size_t side, utils::unique_ptr<MessagePacket> msg) {
+    ktrace(MX_KTRACE_TAG_MSG_SEND, msg->data_size(), koid_);
+    bool was_full = QueueFullLocked(side);
+    queued_messages_[side]++;
+    queued_bytes_[side] += msg->data_size();
+    messages_[side].push_back(utils::move(msg));
+
+    // a message only goes in below the cap, but it may be the one that hits it
+    UpdateWritableLocked(side, was_full);
+}
+
+utils::unique_ptr<MessagePacket> MessagePipe::DequeueLocked(size_t side) {
+    utils::unique_ptr<MessagePacket> msg = messages_[side].pop_front();
+    if (msg) {
+        ktrace(MX_KTRACE_TAG_MSG_RECV, msg->data_size(), koid_);
+        queued_messages_[side]--;
+        queued_bytes_[side] -= msg->data_size();
+    }
+    return msg;
+}
+
+void MessagePipe::UpdateWritableLocked(size_t side, bool was_full) {
+    auto other = other_side(side);
+    bool full = QueueFullLocked(side);
+    if (full == was_full || !dispatcher_alive_[side] || !dispatcher_alive_[other])
+        return;
+
+    if (full)
+        state_tracker_[other].UpdateSatisfied(0u, MX_SIGNAL_WRITABLE);
+    else
+        state_tracker_[other].UpdateSatisfied(MX_SIGNAL_WRITABLE, 0u);
+}
@@ -69,36 +69,72 @@ status_t MessagePipeDispatcher::BeginRead(uint32_t* message_size, uint32_t* hand
         AutoLock lock(&lock_);
         result = pending_ ? NO_ERROR : pipe_->Read(side_, &pending_);
         if (result == NO_ERROR) {
-            *message_size = static_cast<uint32_t>(pending_->data.size());
-            *handle_count = static_cast<uint32_t>(pending_->handles.size());
+            *message_size = pending_->data_size();
+            *handle_count = pending_->num_handles();
         }
     }
     return result;
 }
 
-status_t MessagePipeDispatcher::AcceptRead(utils::Array<uint8_t>* data,
-                                           utils::Array<Handle*>* handles) {
+status_t MessagePipeDispatcher::AcceptRead(utils::unique_ptr<MessagePacket>* msg) {
     LTRACE_ENTRY;
 
-    utils::unique_ptr<MessagePacket> msg;
-    {
-        AutoLock lock(&lock_);
-        msg = utils::move(pending_);
-        // if there is no message it means another user thread beat us here.
-        if (!msg) return ERR_BAD_STATE;
+    AutoLock lock(&lock_);
+    *msg = utils::move(pending_);
+    // if there is no message it means another user thread beat us here.
+    if (!*msg) return ERR_BAD_STATE;
+    return NO_ERROR;
+}
+
+status_t MessagePipeDispatcher::Write(utils::unique_ptr<MessagePacket>* msg) {
+    LTRACE_ENTRY;
+    return pipe_->Write(side_, msg);
+}
+
+status_t MessagePipeDispatcher::ReadMany(MessageBufferSize* sizes, uint32_t count,
+                                         MessagePipe::MessageList* msgs) {
+    LTRACE_ENTRY;
 
-        *data = utils::move(msg->data);
-        *handles = utils::move(msg->handles);
+    AutoLock lock(&lock_);
+    // a message left behind by BeginRead() is the next one in line
+    if (pending_) {
+        if (pending_->data_size() > sizes[0].num_bytes ||
+            pending_->num_handles() > sizes[0].num_handles) {
+            sizes[0].num_bytes = pending_->data_size();
+            sizes[0].num_handles = pending_->num_handles();
+            return ERR_NOT_ENOUGH_BUFFER;
+        }
+        msgs->push_back(utils::move(pending_));
+        if (count > 1u)
+            pipe_->ReadMany(side_, sizes + 1, count - 1u, msgs);
+        return NO_ERROR;
     }
-    return NO_ERROR;
+    return pipe_->ReadMany(side_, sizes, count, msgs);
 }
 
-status_t MessagePipeDispatcher::Write(utils::Array<uint8_t> data, utils::Array<Handle*> handles) {
+status_t MessagePipeDispatcher::WriteMany(MessagePipe::MessageList* msgs) {
     LTRACE_ENTRY;
-    AllocChecker ac;
-    utils::unique_ptr<MessagePacket> msg(
-        new (&ac) MessagePacket(utils::move(data), utils::move(handles)));
-    if (!ac.check()) return ERR_NO_MEMORY;
+    return pipe_->WriteMany(side_, msgs);
+}
+
+status_t MessagePipeDispatcher::Call(utils::unique_ptr<MessagePacket>* msg, lk_time_t timeout,
+                                     utils::unique_ptr<MessagePacket>* reply) {
+    LTRACE_ENTRY;
+    return pipe_->Call(side_, msg, timeout, reply);
+}
+
+void MessagePipeDispatcher::SetMaxQueuedMessages(uint32_t max_messages) {
+    pipe_->SetMaxQueuedMessages(side_, max_messages);
+}
+
+void MessagePipeDispatcher::SetMaxQueuedBytes(uint32_t max_bytes) {
+    pipe_->SetMaxQueuedBytes(side_, max_bytes);
+}
+
+void MessagePipeDispatcher::GetQueueLimits(uint32_t* max_messages, uint32_t* max_bytes) {
+    pipe_->GetQueueLimits(side_, max_messages, max_bytes);
+}
 
-    return pipe_->Write(side_, utils::move(msg));
+void MessagePipeDispatcher::GetInfo(mx_msg_pipe_info_t* info) {
+    pipe_->GetInfo(side_, info);
 }
@@ -0,0 +1,34 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/pager_source.h>
+
+#include <err.h>
+
+#include <utils/type_support.h>
+
+PagerSource::PagerSource(utils::RefPtr<IOPortDispatcher> io_port, uint64_t key)
+    : io_port_(utils::move(io_port)), key_(key) {}
+
+status_t PagerSource::RequestPage(uint64_t offset) {
+    mx_pager_packet_t payload = {
+        { key_, MX_IO_PORT_PKT_TYPE_PAGER, 0u },
+        offset,
+        PAGE_SIZE,
+    };
+
+    // a full port drops the request, which the fault makes again later
+    auto packet = IOP_Packet::Make(io_port_.get(), &payload, sizeof(payload));
+    if (!packet) {
+        io_port_->NoteDroppedPacket();
+        return ERR_NOT_READY;
+    }
+
+    mx_status_t status = io_port_->Queue(packet);
+    if (status == ERR_NOT_READY)
+        io_port_->NoteDroppedPacket();
+    return status;
+}
@@ -58,16 +58,16 @@ PciDeviceDispatcher::PciDeviceDispatcher(utils::RefPtr<PciDeviceWrapper> device,
     : device_(device) {
     mutex_init(&lock_);
 
+    // The identification fields never change, and were read from config
+    // when the device was found.
     const pcie_device_state_t& dev = *device_->device();
-    const pcie_config_t* cfg = dev.cfg;
-    DEBUG_ASSERT(cfg);
-
-    out_info->vendor_id         = pcie_read16(&cfg->base.vendor_id);
-    out_info->device_id         = pcie_read16(&cfg->base.device_id);
-    out_info->base_class        = pcie_read8 (&cfg->base.base_class);
-    out_info->sub_class         = pcie_read8 (&cfg->base.sub_class);
-    out_info->program_interface = pcie_read8 (&cfg->base.program_interface);
-    out_info->revision_id       = pcie_read8 (&cfg->base.revision_id_0);
+
+    out_info->vendor_id         = dev.vendor_id;
+    out_info->device_id         = dev.device_id;
+    out_info->base_class        = dev.class_id;
+    out_info->sub_class         = dev.subclass;
+    out_info->program_interface = dev.prog_if;
+    out_info->revision_id       = dev.rev_id;
     out_info->bus_id            = static_cast<uint8_t>(dev.bus_id);
     out_info->dev_id            = static_cast<uint8_t>(dev.dev_id);
     out_info->func_id           = static_cast<uint8_t>(dev.func_id);
@@ -225,6 +225,15 @@ status_t PciDeviceDispatcher::SetIrqMode(mx_pci_irq_mode_t mode, uint32_t reques
     return ret;
 }
 
+status_t PciDeviceDispatcher::SetIrqAffinity(uint32_t irq_id, uint32_t cpu_num) {
+    AutoLock lock(&lock_);
+    DEBUG_ASSERT(device_ && device_->device());
+
+    if (!device_->claimed()) return ERR_BAD_STATE;  // Are we not claimed yet?
+
+    return pcie_set_irq_affinity(device_->device(), irq_id, cpu_num);
+}
+
 PciDeviceDispatcher::PciDeviceWrapper::PciDeviceWrapper(pcie_device_state_t* device)
     : device_(device) {
     DEBUG_ASSERT(device_);
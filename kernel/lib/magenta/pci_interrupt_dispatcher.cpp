@@ -13,13 +13,18 @@
 constexpr mx_rights_t kDefaultPciInterruptRights = MX_RIGHT_READ | MX_RIGHT_TRANSFER;
 
 PciInterruptDispatcher::PciInterruptDispatcher(uint32_t irq_id)
-    : irq_id_(irq_id) {
+    : irq_id_(irq_id),
+      iop_interrupt_(nullptr),
+      mask_on_fire_(false) {
     mutex_init(&wait_lock_);
     mutex_init(&lock_);
+    spin_lock_init(&port_lock_);
     event_init(&event_, false, EVENT_FLAG_AUTOUNSIGNAL);
 }
 
 PciInterruptDispatcher::~PciInterruptDispatcher() {
+    DEBUG_ASSERT(!port_);
+
     event_destroy(&event_);
     mutex_destroy(&lock_);
     mutex_destroy(&wait_lock_);
@@ -31,6 +36,19 @@ pcie_irq_handler_retval_t PciInterruptDispatcher::IrqThunk(struct pcie_device_st
     DEBUG_ASSERT(ctx);
     PciInterruptDispatcher* dispatcher = (PciInterruptDispatcher*)ctx;
 
+    // If we are bound to a port, let it know instead.
+    spin_lock(&dispatcher->port_lock_);
+    if (dispatcher->iop_interrupt_) {
+        uint ret = PCIE_IRQRET_NO_ACTION;
+        if (dispatcher->port_->SignalInterrupt(dispatcher->iop_interrupt_))
+            ret |= PCIE_IRQRET_RESCHED;
+        if (dispatcher->mask_on_fire_)
+            ret |= PCIE_IRQRET_MASK;
+        spin_unlock(&dispatcher->port_lock_);
+        return static_cast<pcie_irq_handler_retval_t>(ret);
+    }
+    spin_unlock(&dispatcher->port_lock_);
+
     // Wake up any thread which has been waiting for us to fire.
     event_signal(&dispatcher->event_, false);
 
@@ -89,6 +107,10 @@ void PciInterruptDispatcher::Close() {
         ret = pcie_register_irq_handler(device_->device(), irq_id_, NULL, NULL);
         DEBUG_ASSERT(ret == NO_ERROR);  // This should never fail.
 
+        // With the handler gone, nothing can fire into a port we were bound
+        // to any more.
+        UnbindIOPortLocked();
+
         // Release our reference to our device in order to indicate that we are
         // now closed, then leave the main lock.
         device_ = nullptr;
@@ -107,6 +129,10 @@ status_t PciInterruptDispatcher::InterruptWait() {
         if (!device_)
             return ERR_BAD_HANDLE;
 
+        // Interrupts bound to a port don't wake waiters.
+        if (port_)
+            return ERR_BAD_STATE;
+
         // Try to grab the wait_lock.  If we can't, it's because someone is already
         // waiting on the interrupt.  Right now, we only support a single waiter at
         // a time, so tell the user code that we are busy.
@@ -148,3 +174,78 @@ status_t PciInterruptDispatcher::InterruptWait() {
         return device_ ? NO_ERROR : ERR_CANCELLED;
     }
 }
+
+status_t PciInterruptDispatcher::BindIOPort(utils::RefPtr<IOPortDispatcher> port, uint64_t key) {
+    AutoLock lock(&lock_);
+    if (!device_)
+        return ERR_BAD_HANDLE;
+    if (port_)
+        return ERR_BAD_STATE;
+
+    // Someone blocked in InterruptWait() would never be woken.
+    if (mutex_acquire_timeout(&wait_lock_, 0) != NO_ERROR)
+        return ERR_BUSY;
+    mutex_release(&wait_lock_);
+
+    // Only legacy IRQs are level triggered, and need to stay masked until the
+    // driver has dealt with the device.
+    DEBUG_ASSERT(device_->device() && device_->claimed());
+    pcie_irq_mode_info_t info;
+    status_t result = pcie_get_irq_mode(device_->device(), &info);
+    if (result != NO_ERROR)
+        return result;
+
+    IOP_Interrupt* interrupt;
+    result = port->BindInterrupt(key, &interrupt);
+    if (result != NO_ERROR)
+        return result;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock_, state);
+    port_          = utils::move(port);
+    iop_interrupt_ = interrupt;
+    mask_on_fire_  = (info.mode == PCIE_IRQ_MODE_LEGACY);
+    spin_unlock_irqrestore(&port_lock_, state);
+
+    // Arm the IRQ.  From here on, only InterruptComplete() unmasks it.
+    return maskable_ ? pcie_unmask_irq(device_->device(), irq_id_) : NO_ERROR;
+}
+
+status_t PciInterruptDispatcher::UnbindIOPort() {
+    AutoLock lock(&lock_);
+    if (!device_)
+        return ERR_BAD_HANDLE;
+
+    if (maskable_ && port_)
+        pcie_mask_irq(device_->device(), irq_id_);
+
+    return UnbindIOPortLocked();
+}
+
+status_t PciInterruptDispatcher::UnbindIOPortLocked() {
+    utils::RefPtr<IOPortDispatcher> port;
+    IOP_Interrupt* interrupt;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&port_lock_, state);
+    port           = utils::move(port_);
+    interrupt      = iop_interrupt_;
+    iop_interrupt_ = nullptr;
+    spin_unlock_irqrestore(&port_lock_, state);
+
+    if (!port)
+        return ERR_BAD_STATE;
+
+    port->UnbindInterrupt(interrupt);
+    return NO_ERROR;
+}
+
+status_t PciInterruptDispatcher::InterruptComplete() {
+    AutoLock lock(&lock_);
+    if (!device_)
+        return ERR_BAD_HANDLE;
+    if (!port_)
+        return ERR_BAD_STATE;
+
+    return maskable_ ? pcie_unmask_irq(device_->device(), irq_id_) : NO_ERROR;
+}
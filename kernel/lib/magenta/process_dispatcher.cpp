@@ -12,7 +12,9 @@
 #include <string.h>
 #include <trace.h>
 
+#include <arch/ops.h>
 #include <kernel/auto_lock.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
@@ -28,10 +30,36 @@ static constexpr mx_rights_t kDefaultProcessRights = MX_RIGHT_READ  |
                                                      MX_RIGHT_WRITE |
                                                      MX_RIGHT_TRANSFER;
 
+// How many handles a dying process takes out of its table at a time.
+static constexpr size_t kHandleTeardownBatch = 64;
+
+static void AddThreadStats(mx_thread_stats_t* sum, const mx_thread_stats_t& stats) {
+    sum->runtime += stats.runtime;
+    sum->ready_time += stats.ready_time;
+    sum->blocked_time += stats.blocked_time;
+    sum->futex_time += stats.futex_time;
+    sum->port_time += stats.port_time;
+    sum->handle_time += stats.handle_time;
+    sum->mutex_time += stats.mutex_time;
+    sum->sleep_time += stats.sleep_time;
+    sum->other_time += stats.other_time;
+    sum->context_switches += stats.context_switches;
+    sum->preemptions += stats.preemptions;
+}
+
 mutex_t ProcessDispatcher::global_process_list_mutex_ =
     MUTEX_INITIAL_VALUE(global_process_list_mutex_);
 utils::DoublyLinkedList<ProcessDispatcher*> ProcessDispatcher::global_process_list_;
 
+// Odd while the cpu is inside the lockless part of GetDispatcher(). Handles
+// taken out of a table aren't deleted until every cpu has been seen outside
+// of it, see SyncHandleLookups().
+struct HandleLookupSeq {
+    volatile uint32_t seq;
+} __CPU_ALIGN;
+
+static HandleLookupSeq handle_lookup_seq[SMP_MAX_CPUS];
+
 mx_status_t ProcessDispatcher::Create(utils::StringPiece name,
                                       utils::RefPtr<Dispatcher>* dispatcher,
                                       mx_rights_t* rights) {
@@ -69,7 +97,10 @@ ProcessDispatcher::~ProcessDispatcher() {
     DEBUG_ASSERT(state_ == State::INITIAL || state_ == State::DEAD);
 
     // assert that we have no handles, should have been cleaned up in the -> DEAD transition
-    DEBUG_ASSERT(handles_.is_empty());
+    DEBUG_ASSERT(handle_count_ == 0);
+
+    for (HandleSlot* chunk : handle_chunks_)
+        delete[] chunk;
 
     // remove ourself from the global process list
     RemoveProcess(this);
@@ -219,6 +250,10 @@ void ProcessDispatcher::RemoveThread(UserThread* t) {
     DEBUG_ASSERT(t != nullptr);
     thread_list_.erase(*t);
 
+    mx_thread_stats_t stats;
+    t->GetStats(&stats);
+    AddThreadStats(&exited_thread_stats_, stats);
+
     // drop the ref from the main_thread_ pointer if its being removed
     if (t == main_thread_.get()) {
         main_thread_.reset();
@@ -263,10 +298,41 @@ void ProcessDispatcher::SetState(State s) {
         LTRACEF_LEVEL(2, "cleaning up handle table on proc %p\n", this);
         {
             AutoLock lock(&handle_table_lock_);
-            Handle* handle;
-            while ((handle = handles_.pop_front()) != nullptr) {
-                DeleteHandle(handle);
-            };
+
+            // retire every value first so that new lookups fail, then wait
+            // for the ones already underway before deleting anything
+            for (uint32_t ix = 0; ix < handle_table_size_; ++ix) {
+                HandleSlot& slot = Slot_NoLock(ix);
+                if (slot.handle)
+                    slot.generation = (slot.generation + 1) & kHandleGenerationMask;
+            }
+            SyncHandleLookups();
+        }
+
+        // take the handles out a batch at a time and delete them outside the
+        // lock, since deleting one can do a lot of work. nothing adds handles
+        // to a dead process, so the scan can pick up where it left off.
+        Handle* batch[kHandleTeardownBatch];
+        uint32_t ix = 0;
+        for (;;) {
+            size_t count = 0;
+            {
+                AutoLock lock(&handle_table_lock_);
+                for (; ix < handle_table_size_ && count < kHandleTeardownBatch; ++ix) {
+                    HandleSlot& slot = Slot_NoLock(ix);
+                    if (!slot.handle)
+                        continue;
+                    batch[count++] = slot.handle;
+                    CountHandle_NoLock(slot.handle, -1);
+                    slot.handle = nullptr;
+                    PushFreeSlot_NoLock(ix);
+                    --handle_count_;
+                }
+            }
+            if (count == 0)
+                break;
+            for (size_t i = 0; i < count; ++i)
+                DeleteHandle(batch[i]);
         }
         LTRACEF_LEVEL(2, "done cleaning up handle table on proc %p\n", this);
 
@@ -286,27 +352,158 @@ void ProcessDispatcher::SetState(State s) {
 }
 
 // process handle manipulation routines
-mx_handle_t ProcessDispatcher::MapHandleToValue(Handle* handle) {
-    auto handle_index = MapHandleToU32(handle) + 1;
-    return handle_index ^ handle_rand_;
+ProcessDispatcher::HandleSlot* ProcessDispatcher::FindSlot(uint32_t index) const {
+    // chunk k starts at index (kHandleChunkBase << k) - kHandleChunkBase
+    uint32_t biased = index + kHandleChunkBase;
+    uint32_t chunk = (31u - __builtin_clz(biased)) - kHandleChunkShift;
+    if (chunk >= kHandleChunkCount)
+        return nullptr;
+
+    HandleSlot* slots = handle_chunks_[chunk];
+    if (!slots)
+        return nullptr;
+    return &slots[biased - (kHandleChunkBase << chunk)];
+}
+
+ProcessDispatcher::HandleSlot& ProcessDispatcher::Slot_NoLock(uint32_t index) const {
+    DEBUG_ASSERT(index < handle_table_size_);
+    return *FindSlot(index);
+}
+
+mx_handle_t ProcessDispatcher::SlotToValue_NoLock(uint32_t index) const {
+    uint32_t bits = (Slot_NoLock(index).generation << kHandleIndexBits) | index;
+    return static_cast<mx_handle_t>(((bits << 2) | 1u) ^ handle_rand_);
+}
+
+bool ProcessDispatcher::ValueToSlot(mx_handle_t handle_value, uint32_t* index,
+                                    uint32_t* generation) const {
+    uint32_t value = static_cast<uint32_t>(handle_value ^ handle_rand_);
+    if ((value & 3u) != 1u || (value >> 31) != 0u)
+        return false;
+
+    value >>= 2;
+    *index = value & kHandleIndexMask;
+    *generation = value >> kHandleIndexBits;
+    return true;
+}
+
+void ProcessDispatcher::PushFreeSlot_NoLock(uint32_t index) {
+    HandleSlot& slot = Slot_NoLock(index);
+    slot.prev_free = kNoSlot;
+    slot.next_free = free_slot_head_;
+    if (free_slot_head_ != kNoSlot)
+        Slot_NoLock(free_slot_head_).prev_free = index;
+    free_slot_head_ = index;
+}
+
+void ProcessDispatcher::UnlinkFreeSlot_NoLock(uint32_t index) {
+    HandleSlot& slot = Slot_NoLock(index);
+    if (slot.prev_free != kNoSlot)
+        Slot_NoLock(slot.prev_free).next_free = slot.next_free;
+    else
+        free_slot_head_ = slot.next_free;
+    if (slot.next_free != kNoSlot)
+        Slot_NoLock(slot.next_free).prev_free = slot.prev_free;
+}
+
+status_t ProcessDispatcher::GrowHandleTable_NoLock() {
+    uint32_t old_size = handle_table_size_;
+    if (old_size >= kMaxHandleCount)
+        return ERR_NO_MEMORY;
+
+    // the last chunk is cut short at kMaxHandleCount
+    uint32_t chunk = (31u - __builtin_clz(old_size + kHandleChunkBase)) - kHandleChunkShift;
+    uint32_t count = MIN(kHandleChunkBase << chunk, kMaxHandleCount - old_size);
+
+    AllocChecker ac;
+    HandleSlot* slots = new (&ac) HandleSlot[count];
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    for (uint32_t ix = 0; ix < count; ++ix) {
+        slots[ix].handle = nullptr;
+        slots[ix].generation = 0;
+    }
+
+    // lockless readers may pick up the chunk as soon as it is published
+    smp_wmb();
+    handle_chunks_[chunk] = slots;
+    handle_table_size_ = old_size + count;
+
+    // add the new slots so that the lowest index is handed out first
+    for (uint32_t ix = old_size + count; ix > old_size; --ix)
+        PushFreeSlot_NoLock(ix - 1);
+    return NO_ERROR;
+}
+
+void ProcessDispatcher::SyncHandleLookups() {
+    // pairs with the barrier in GetDispatcher(): either the lookup sees the
+    // slot change or we see its cpu inside the lookup
+    smp_mb();
+
+    for (uint ix = 0; ix < SMP_MAX_CPUS; ++ix) {
+        uint32_t seq = handle_lookup_seq[ix].seq;
+        if (!(seq & 1u))
+            continue;
+        while (handle_lookup_seq[ix].seq == seq)
+            arch_spinloop_pause();
+    }
+
+    smp_mb();
 }
 
 Handle* ProcessDispatcher::GetHandle_NoLock(mx_handle_t handle_value) {
-    auto handle_index = (handle_value ^ handle_rand_) - 1;
-    Handle* handle = MapU32ToHandle(handle_index);
-    if (!handle)
+    uint32_t index, generation;
+    if (!ValueToSlot(handle_value, &index, &generation) || index >= handle_table_size_)
+        return nullptr;
+
+    const HandleSlot& slot = Slot_NoLock(index);
+    if (!slot.handle || slot.generation != generation)
         return nullptr;
-    return (handle->process_id() == get_koid()) ? handle : nullptr;
+
+    DEBUG_ASSERT(slot.handle->process_id() == get_koid());
+    return slot.handle;
 }
 
-void ProcessDispatcher::AddHandle(HandleUniquePtr handle) {
+mx_handle_t ProcessDispatcher::AddHandle(HandleUniquePtr handle) {
     AutoLock lock(&handle_table_lock_);
-    AddHandle_NoLock(utils::move(handle));
+    return AddHandle_NoLock(utils::move(handle));
 }
 
-void ProcessDispatcher::AddHandle_NoLock(HandleUniquePtr handle) {
+mx_handle_t ProcessDispatcher::AddHandle_NoLock(HandleUniquePtr handle) {
+    if (free_slot_head_ == kNoSlot) {
+        status_t status = GrowHandleTable_NoLock();
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    uint32_t index = free_slot_head_;
+    UnlinkFreeSlot_NoLock(index);
+
     handle->set_process_id(get_koid());
-    handles_.push_front(handle.release());
+    CountHandle_NoLock(handle.get(), 1);
+    // the generation has to be visible to lockless readers before the handle
+    smp_wmb();
+    Slot_NoLock(index).handle = handle.release();
+    ++handle_count_;
+
+    return SlotToValue_NoLock(index);
+}
+
+status_t ProcessDispatcher::AddHandles_NoLock(HandleUniquePtr* handles, uint32_t count,
+                                              mx_handle_t* handle_values) {
+    // make room for all of them first so that adding them can't fail halfway
+    while (handle_table_size_ - handle_count_ < count) {
+        status_t status = GrowHandleTable_NoLock();
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        handle_values[ix] = AddHandle_NoLock(utils::move(handles[ix]));
+        DEBUG_ASSERT(handle_values[ix] > 0);
+    }
+    return NO_ERROR;
 }
 
 HandleUniquePtr ProcessDispatcher::RemoveHandle(mx_handle_t handle_value) {
@@ -314,32 +511,131 @@ HandleUniquePtr ProcessDispatcher::RemoveHandle(mx_handle_t handle_value) {
     return RemoveHandle_NoLock(handle_value);
 }
 
+Handle* ProcessDispatcher::UnlinkHandle_NoLock(mx_handle_t handle_value) {
+    uint32_t index, generation;
+    if (!ValueToSlot(handle_value, &index, &generation) || index >= handle_table_size_)
+        return nullptr;
+
+    HandleSlot& slot = Slot_NoLock(index);
+    Handle* handle = slot.handle;
+    if (!handle || slot.generation != generation)
+        return nullptr;
+
+    slot.handle = nullptr;
+    smp_wmb();
+    slot.generation = (slot.generation + 1) & kHandleGenerationMask;
+    PushFreeSlot_NoLock(index);
+    --handle_count_;
+    CountHandle_NoLock(handle, -1);
+
+    return handle;
+}
+
+void ProcessDispatcher::CountHandle_NoLock(const Handle* handle, int delta) {
+    uint32_t type = static_cast<uint32_t>(handle->dispatcher()->GetType());
+    DEBUG_ASSERT(type < MX_OBJ_TYPE_LAST);
+    atomic_add(&handle_type_count_[type], delta);
+}
+
 HandleUniquePtr ProcessDispatcher::RemoveHandle_NoLock(mx_handle_t handle_value) {
-    auto handle = GetHandle_NoLock(handle_value);
+    Handle* handle = UnlinkHandle_NoLock(handle_value);
     if (!handle)
         return nullptr;
-    handles_.erase(*handle);
+
+    // the caller is free to delete the handle once we return
+    SyncHandleLookups();
+
     handle->set_process_id(0u);
 
     return HandleUniquePtr(handle);
 }
 
-void ProcessDispatcher::UndoRemoveHandle_NoLock(mx_handle_t handle_value) {
-    auto handle_index = (handle_value ^ handle_rand_) - 1;
-    Handle* handle = MapU32ToHandle(handle_index);
+uint32_t ProcessDispatcher::RemoveHandles_NoLock(const mx_handle_t* handle_values, uint32_t count,
+                                                 Handle** handles) {
+    uint32_t removed = 0u;
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        handles[ix] = UnlinkHandle_NoLock(handle_values[ix]);
+        if (handles[ix])
+            ++removed;
+    }
+
+    // one wait covers the whole batch
+    if (removed)
+        SyncHandleLookups();
+
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        if (handles[ix])
+            handles[ix]->set_process_id(0u);
+    }
+    return removed;
+}
+
+void ProcessDispatcher::UndoRemoveHandle_NoLock(mx_handle_t handle_value, Handle* handle) {
+    uint32_t index, generation;
+    bool valid = ValueToSlot(handle_value, &index, &generation) && index < handle_table_size_;
+    DEBUG_ASSERT(valid);
+
+    // if nothing took the slot in the meantime, hand the handle back its old value
+    HandleSlot* slot = valid ? &Slot_NoLock(index) : nullptr;
+    if (slot && !slot->handle &&
+        slot->generation == ((generation + 1) & kHandleGenerationMask)) {
+        UnlinkFreeSlot_NoLock(index);
+        slot->generation = generation;
+        handle->set_process_id(get_koid());
+        CountHandle_NoLock(handle, 1);
+        smp_wmb();
+        slot->handle = handle;
+        ++handle_count_;
+        return;
+    }
+
     AddHandle_NoLock(HandleUniquePtr(handle));
 }
 
 bool ProcessDispatcher::GetDispatcher(mx_handle_t handle_value,
                                       utils::RefPtr<Dispatcher>* dispatcher,
                                       uint32_t* rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandle_NoLock(handle_value);
-    if (!handle)
+    uint32_t index, generation;
+    if (!ValueToSlot(handle_value, &index, &generation))
+        return false;
+
+    // Mark this cpu as inside a lookup for as long as it might be looking at
+    // a Handle, so that whoever takes the handle out of the table waits for
+    // us before deleting it. Interrupts stay off so we can't be moved to
+    // another cpu or preempted while the mark is held.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleLookupSeq& lookup = handle_lookup_seq[arch_curr_cpu_num()];
+    lookup.seq = lookup.seq + 1;
+    smp_mb();
+
+    // A slot is only refilled after its generation has moved on, so seeing the
+    // same generation on both sides of reading the handle means the handle
+    // belongs to |handle_value|.
+    bool found = false;
+    utils::RefPtr<Dispatcher> result;
+    uint32_t result_rights = 0;
+    HandleSlot* slot = FindSlot(index);
+    if (slot && slot->generation == generation) {
+        smp_rmb();
+        Handle* handle = slot->handle;
+        smp_rmb();
+        if (handle && slot->generation == generation) {
+            result_rights = handle->rights();
+            result = handle->dispatcher();
+            found = true;
+        }
+    }
+
+    smp_mb();
+    lookup.seq = lookup.seq + 1;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (!found)
         return false;
 
-    *rights = handle->rights();
-    *dispatcher = handle->dispatcher();
+    *rights = result_rights;
+    *dispatcher = utils::move(result);
     return true;
 }
 
@@ -349,6 +645,29 @@ status_t ProcessDispatcher::GetInfo(mx_process_info_t* info) {
     return NO_ERROR;
 }
 
+status_t ProcessDispatcher::GetMemoryInfo(mx_process_memory_info_t* info) {
+    size_t mapped_bytes;
+    size_t committed_bytes;
+    aspace_->GetMemoryUsage(&mapped_bytes, &committed_bytes);
+
+    info->mapped_bytes = mapped_bytes;
+    info->committed_bytes = committed_bytes;
+
+    return NO_ERROR;
+}
+
+status_t ProcessDispatcher::GetThreadStats(mx_thread_stats_t* info) {
+    AutoLock lock(&thread_list_lock_);
+
+    *info = exited_thread_stats_;
+    for (auto& thread : thread_list_) {
+        mx_thread_stats_t stats;
+        thread.GetStats(&stats);
+        AddThreadStats(info, stats);
+    }
+    return NO_ERROR;
+}
+
 status_t ProcessDispatcher::CreateUserThread(utils::StringPiece name,
                                              thread_start_routine entry, void* arg,
                                              utils::RefPtr<UserThread>* user_thread) {
@@ -390,16 +709,13 @@ utils::RefPtr<ExceptionPort> ProcessDispatcher::exception_port() {
     return exception_port_;
 }
 
-uint32_t ProcessDispatcher::HandleStats(uint32_t* handle_type, size_t size) const {
-    AutoLock lock(&handle_table_lock_);
+uint32_t ProcessDispatcher::HandleStats(uint32_t* handle_type, size_t count) const {
     uint32_t total = 0;
-    for (const auto& handle : handles_) {
-        if (handle_type) {
-            uint32_t type = static_cast<uint32_t>(handle.dispatcher()->GetType());
-            if (size > type)
-                ++handle_type[type];
-        }
-        ++total;
+    for (uint32_t type = 0; type < MX_OBJ_TYPE_LAST; ++type) {
+        uint32_t n = static_cast<uint32_t>(atomic_load(&handle_type_count_[type]));
+        if (handle_type && type < count)
+            handle_type[type] = n;
+        total += n;
     }
     return total;
 }
@@ -429,12 +745,10 @@ void ProcessDispatcher::RemoveProcess(ProcessDispatcher* process) {
 // static
 utils::RefPtr<ProcessDispatcher> ProcessDispatcher::LookupProcessById(mx_koid_t koid) {
     LTRACE_ENTRY;
-    AutoLock lock(&global_process_list_mutex_);
-    ProcessDispatcher* process =
-        global_process_list_.find_if([koid](const ProcessDispatcher& p) {
-            return p.get_koid() == koid;
-    });
-    return utils::RefPtr<ProcessDispatcher>(process);
+    utils::RefPtr<Dispatcher> dispatcher = Dispatcher::LookupByKoid(koid);
+    if (!dispatcher)
+        return nullptr;
+    return utils::RefPtr<ProcessDispatcher>(dispatcher->get_process_dispatcher());
 }
 
 utils::RefPtr<UserThread> ProcessDispatcher::LookupThreadById(mx_koid_t koid) {
@@ -465,7 +779,7 @@ char* ProcessDispatcher::DebugDumpHandleTypeCount_NoLock() const {
     static char buf[(MX_OBJ_TYPE_LAST * 4) + 1];
 
     uint32_t types[MX_OBJ_TYPE_LAST] = {0};
-    uint32_t handle_count = HandleStats(types, sizeof(types));
+    uint32_t handle_count = HandleStats(types, countof(types));
 
     snprintf(buf, sizeof(buf), "%3u: %3u %3u %3u %3u %3u %3u %3u %3u %3u",
              handle_count,
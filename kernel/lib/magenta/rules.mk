@@ -28,12 +28,14 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/magenta.cpp \
     $(LOCAL_DIR)/msg_pipe_dispatcher.cpp \
     $(LOCAL_DIR)/msg_pipe.cpp \
+    $(LOCAL_DIR)/pager_source.cpp \
     $(LOCAL_DIR)/pci_device_dispatcher.cpp \
     $(LOCAL_DIR)/pci_interrupt_dispatcher.cpp \
     $(LOCAL_DIR)/pci_io_mapping_dispatcher.cpp \
     $(LOCAL_DIR)/process_dispatcher.cpp \
     $(LOCAL_DIR)/state_tracker.cpp \
     $(LOCAL_DIR)/thread_dispatcher.cpp \
+    $(LOCAL_DIR)/timer_dispatcher.cpp \
     $(LOCAL_DIR)/user_copy.cpp \
     $(LOCAL_DIR)/user_thread.cpp \
     $(LOCAL_DIR)/vm_object_dispatcher.cpp \
@@ -43,6 +45,7 @@ MODULE_SRCS := \
 
 MODULE_DEPS := \
     lib/dpc \
+    lib/ktrace \
     lib/utils \
     dev/udisplay \
 
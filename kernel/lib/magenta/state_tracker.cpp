@@ -31,7 +31,7 @@ mx_status_t StateTracker::AddObserver(StateObserver* observer) {
         awoke_threads = observer->OnInitialize(signals_state_);
     }
     if (awoke_threads)
-        thread_yield();
+        thread_preempt_if_needed();
     return NO_ERROR;
 }
 
@@ -42,31 +42,51 @@ mx_signals_state_t StateTracker::RemoveObserver(StateObserver* observer) {
     return signals_state_;
 }
 
+static mx_signals_state_t ApplyMasks(mx_signals_state_t state,
+                                     mx_signals_t satisfied_set_mask,
+                                     mx_signals_t satisfied_clear_mask,
+                                     mx_signals_t satisfiable_set_mask,
+                                     mx_signals_t satisfiable_clear_mask) {
+    state.satisfied = (state.satisfied & ~satisfied_clear_mask) | satisfied_set_mask;
+    state.satisfiable = (state.satisfiable & ~satisfiable_clear_mask) | satisfiable_set_mask;
+    return state;
+}
+
+static bool SameState(mx_signals_state_t a, mx_signals_state_t b) {
+    return a.satisfied == b.satisfied && a.satisfiable == b.satisfiable;
+}
+
 void StateTracker::UpdateState(mx_signals_t satisfied_set_mask,
                                mx_signals_t satisfied_clear_mask,
                                mx_signals_t satisfiable_set_mask,
                                mx_signals_t satisfiable_clear_mask) {
+    // Most updates, like marking a pipe readable on every write, change nothing. We can tell
+    // without the lock: if the masks are a no-op on the state we read, doing nothing is the same
+    // as applying them just then.
+    auto current = GetSignalsState();
+    if (SameState(current, ApplyMasks(current, satisfied_set_mask, satisfied_clear_mask,
+                                      satisfiable_set_mask, satisfiable_clear_mask)))
+        return;
+
     bool awoke_threads = false;
     {
         AutoLock lock(&lock_);
 
-        auto previous_signals_state = signals_state_;
-        signals_state_.satisfied &= ~satisfied_clear_mask;
-        signals_state_.satisfied |= satisfied_set_mask;
-        signals_state_.satisfiable &= ~satisfiable_clear_mask;
-        signals_state_.satisfiable |= satisfiable_set_mask;
-
-        if (previous_signals_state.satisfied == signals_state_.satisfied &&
-            previous_signals_state.satisfiable == signals_state_.satisfiable)
+        auto signals_state = ApplyMasks(signals_state_, satisfied_set_mask, satisfied_clear_mask,
+                                        satisfiable_set_mask, satisfiable_clear_mask);
+        if (SameState(signals_state_, signals_state))
             return;
+        __atomic_store(&signals_state_, &signals_state, __ATOMIC_RELEASE);
 
         for (auto& observer : observers_) {
             awoke_threads |= observer.OnStateChange(signals_state_);
         }
-
     }
-    if (awoke_threads)
-        thread_yield();
+    // the woken threads run on idle cpus, or here once we block or use up our
+    // quantum, unless they outrank us. a thread that is about to block anyway
+    // gets switched away from then, straight to the thread it woke.
+    if (awoke_threads && !thread_get_sync_wakeup())
+        thread_preempt_if_needed();
 }
 
 void StateTracker::Cancel(Handle* handle) {
@@ -99,5 +119,5 @@ void StateTracker::Cancel(Handle* handle) {
     }
 
     if (awoke_threads)
-        thread_yield();
+        thread_preempt_if_needed();
 }
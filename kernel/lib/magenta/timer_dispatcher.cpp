@@ -0,0 +1,182 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/timer_dispatcher.h>
+
+#include <assert.h>
+#include <err.h>
+#include <new.h>
+#include <platform.h>
+
+#include <kernel/auto_lock.h>
+
+#include <magenta/state_tracker.h>
+
+constexpr mx_rights_t kDefaultTimerRights =
+    MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE;
+
+// The kernel timers count in ms. Periods shorter than that can't be honored.
+constexpr mx_time_t kMinPeriod = 1000000u;
+
+// Farther deadlines are reached in steps, since kernel timer deadlines only
+// compare correctly within half the range of lk_time_t.
+constexpr lk_time_t kMaxDelayMs = 1u << 30;
+
+status_t TimerDispatcher::Create(uint32_t options, utils::RefPtr<Dispatcher>* dispatcher,
+                                 mx_rights_t* rights) {
+    if (options != 0u)
+        return ERR_INVALID_ARGS;
+
+    AllocChecker ac;
+    auto disp = new (&ac) TimerDispatcher(options);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    *rights = kDefaultTimerRights;
+    *dispatcher = utils::AdoptRef<Dispatcher>(disp);
+    return NO_ERROR;
+}
+
+TimerDispatcher::TimerDispatcher(uint32_t options)
+    : state_tracker_(true, mx_signals_state_t{0u, MX_SIGNAL_SIGNALED | MX_SIGNAL_USER_ALL}),
+      armed_(false),
+      closed_(false),
+      deadline_(0u),
+      period_(0u),
+      slack_(0u),
+      dpc_queued_(false) {
+    mutex_init(&lock_);
+    timer_initialize(&timer_);
+    spin_lock_init(&dpc_lock_);
+    dpc_.func = ExpiredDpc;
+    dpc_.arg = this;
+}
+
+TimerDispatcher::~TimerDispatcher() {
+    // the last handle is gone, and with it the timer
+    DEBUG_ASSERT(!armed_);
+    DEBUG_ASSERT(!dpc_queued_);
+    timer_cancel_sync(&timer_);
+    mutex_destroy(&lock_);
+}
+
+void TimerDispatcher::on_zero_handles() {
+    // Nothing can set the timer again, and once its callback is done the
+    // only reference it could have taken is the queued dpc's.
+    AutoLock lock(&lock_);
+    closed_ = true;
+    armed_ = false;
+    timer_cancel_sync(&timer_);
+}
+
+status_t TimerDispatcher::Set(mx_time_t deadline, mx_time_t period, mx_time_t slack) {
+    if (period != 0u && period < kMinPeriod)
+        return ERR_INVALID_ARGS;
+
+    AutoLock lock(&lock_);
+    if (closed_)
+        return ERR_BAD_STATE;
+
+    deadline_ = deadline;
+    period_ = period;
+    slack_ = slack;
+    armed_ = true;
+    state_tracker_.UpdateSatisfied(0u, MX_SIGNAL_SIGNALED);
+    ArmLocked(current_time_ns());
+    return NO_ERROR;
+}
+
+status_t TimerDispatcher::Cancel() {
+    AutoLock lock(&lock_);
+    armed_ = false;
+    timer_cancel_sync(&timer_);
+    state_tracker_.UpdateSatisfied(0u, MX_SIGNAL_SIGNALED);
+    return NO_ERROR;
+}
+
+status_t TimerDispatcher::UserSignal(uint32_t set_mask, uint32_t clear_mask) {
+    state_tracker_.UpdateSatisfied(set_mask, clear_mask);
+    return NO_ERROR;
+}
+
+// Program the kernel timer for the next expiry. The slack lets the kernel
+// timer fire late so it can share an interrupt with others.
+void TimerDispatcher::ArmLocked(mx_time_t now) {
+    timer_cancel_sync(&timer_);
+
+    mx_time_t delay = (deadline_ > now) ? (deadline_ - now + 999999u) / 1000000u : 0u;
+    if (delay > kMaxDelayMs)
+        delay = kMaxDelayMs;
+    mx_time_t slack = slack_ / 1000000u;
+    if (slack > kMaxDelayMs)
+        slack = kMaxDelayMs;
+
+    timer_set_oneshot_slack(&timer_, static_cast<lk_time_t>(delay),
+                            static_cast<lk_time_t>(slack), TimerCallback, this);
+}
+
+enum handler_return TimerDispatcher::TimerCallback(timer_t* timer, lk_time_t now, void* arg) {
+    auto disp = reinterpret_cast<TimerDispatcher*>(arg);
+
+    // There is a handle until on_zero_handles() has waited for us, so the
+    // dispatcher is still referenced.
+    spin_lock(&disp->dpc_lock_);
+    if (!disp->dpc_queued_) {
+        disp->dpc_queued_ = true;
+        disp->dpc_self_ = utils::RefPtr<TimerDispatcher>(disp);
+        dpc_queue(&disp->dpc_, false);
+    }
+    spin_unlock(&disp->dpc_lock_);
+
+    return INT_RESCHEDULE;
+}
+
+void TimerDispatcher::ExpiredDpc(dpc_t* dpc) {
+    auto disp = reinterpret_cast<TimerDispatcher*>(dpc->arg);
+
+    utils::RefPtr<TimerDispatcher> self;
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&disp->dpc_lock_, state);
+    self = utils::move(disp->dpc_self_);
+    disp->dpc_queued_ = false;
+    spin_unlock_irqrestore(&disp->dpc_lock_, state);
+
+    self->OnExpired();
+}
+
+void TimerDispatcher::OnExpired() {
+    AutoLock lock(&lock_);
+    if (!armed_)
+        return;
+
+    // the kernel timer's ms may not line up with ours, and the timer may
+    // have been set again since this expiry was queued
+    mx_time_t now = current_time_ns();
+    if (now < deadline_) {
+        ArmLocked(now);
+        return;
+    }
+
+    if (period_ == 0u) {
+        armed_ = false;
+        state_tracker_.UpdateSatisfied(MX_SIGNAL_SIGNALED, 0u);
+        return;
+    }
+
+    // Drop and raise the signal so that io ports and wait sets see an edge
+    // for every expiry. Expiries missed while the system was busy are
+    // reported as one.
+    state_tracker_.UpdateSatisfied(0u, MX_SIGNAL_SIGNALED);
+    state_tracker_.UpdateSatisfied(MX_SIGNAL_SIGNALED, 0u);
+
+    mx_time_t missed = (now - deadline_) / period_ + 1u;
+    if (missed > (UINT64_MAX - deadline_) / period_) {
+        armed_ = false;
+        return;
+    }
+    deadline_ += missed * period_;
+    ArmLocked(now);
+}
@@ -52,6 +52,8 @@ UserThread::~UserThread() {
     DEBUG_ASSERT_MSG(ret == NO_ERROR, "thread_join returned something other than NO_ERROR\n");
 
     process_->aspace()->FreeRegion(reinterpret_cast<vaddr_t>(user_stack_));
+    if (exception_packet_home_)
+        exception_packet_home_->Abandon();
     cond_destroy(&exception_wait_cond_);
     mutex_destroy(&exception_wait_lock_);
 }
@@ -250,6 +252,69 @@ int UserThread::StartRoutine(void* arg) {
     __UNREACHABLE;
 }
 
+void UserThread::SetInheritedPriority(int priority) {
+    THREAD_LOCK(state);
+    thread_.inherited_priority = priority;
+    thread_update_priority_locked(&thread_);
+    THREAD_UNLOCK(state);
+}
+
+static mx_time_t us_to_mx(lk_bigtime_t us) {
+    return us * 1000u;
+}
+
+status_t UserThread::SetDeadline(const mx_thread_deadline_t& deadline) {
+    // Round the runtime down and the rest up, so the thread never gets more
+    // than it asked for.
+    return thread_set_deadline(&thread_, deadline.runtime / 1000u,
+                               (deadline.deadline + 999u) / 1000u,
+                               (deadline.period + 999u) / 1000u);
+}
+
+void UserThread::GetDeadline(mx_thread_deadline_t* deadline) {
+    lk_bigtime_t runtime_us, deadline_us, period_us;
+    thread_get_deadline(&thread_, &runtime_us, &deadline_us, &period_us);
+    deadline->runtime = us_to_mx(runtime_us);
+    deadline->deadline = us_to_mx(deadline_us);
+    deadline->period = us_to_mx(period_us);
+}
+
+status_t UserThread::SetAffinity(uint32_t affinity) {
+    return thread_set_cpu_affinity(&thread_, affinity);
+}
+
+uint32_t UserThread::GetAffinity() {
+    return thread_cpu_affinity(&thread_);
+}
+
+void UserThread::SetTimerSlack(mx_time_t slack) {
+    // read by the thread as it blocks, a stale value there is harmless
+    mx_time_t ms = slack / 1000000u;
+    thread_.timer_slack = (ms > INT32_MAX) ? INT32_MAX : static_cast<lk_time_t>(ms);
+}
+
+mx_time_t UserThread::GetTimerSlack() {
+    return static_cast<mx_time_t>(thread_.timer_slack) * 1000000u;
+}
+
+void UserThread::GetStats(mx_thread_stats_t* info) {
+    struct thread_time_stats stats;
+    thread_get_time_stats(&thread_, &stats);
+
+    info->runtime = us_to_mx(stats.runtime_us);
+    info->ready_time = us_to_mx(stats.ready_us);
+    info->futex_time = us_to_mx(stats.blocked_us[THREAD_WAIT_FUTEX]);
+    info->port_time = us_to_mx(stats.blocked_us[THREAD_WAIT_PORT]);
+    info->handle_time = us_to_mx(stats.blocked_us[THREAD_WAIT_HANDLE]);
+    info->mutex_time = us_to_mx(stats.blocked_us[THREAD_WAIT_MUTEX]);
+    info->sleep_time = us_to_mx(stats.blocked_us[THREAD_WAIT_SLEEP]);
+    info->other_time = us_to_mx(stats.blocked_us[THREAD_WAIT_OTHER]);
+    info->blocked_time = info->futex_time + info->port_time + info->handle_time +
+                         info->mutex_time + info->sleep_time + info->other_time;
+    info->context_switches = stats.context_switches;
+    info->preemptions = stats.preemptions;
+}
+
 void UserThread::SetState(State state) {
     LTRACEF("thread %p: state %u (%s)\n", this, static_cast<unsigned int>(state), StateToString(state));
 
@@ -284,27 +349,40 @@ utils::RefPtr<ExceptionPort> UserThread::exception_port() {
 status_t UserThread::ExceptionHandlerExchange(utils::RefPtr<ExceptionPort> eport, const mx_exception_report_t* report) {
     LTRACE_ENTRY_OBJ;
     AutoLock lock(&exception_wait_lock_);
+    if (!exception_packet_home_) {
+        // Without one the report is sent in a packet from the port.
+        AllocChecker ac;
+        exception_packet_home_ = utils::AdoptRef(new (&ac) IOP_PacketHome());
+        if (!ac.check())
+            exception_packet_home_.reset();
+    }
     exception_status_ = MX_EXCEPTION_STATUS_WAITING;
+    exception_wait_port_ = eport.get();
     // Send message, wait for reply.
-    status_t status = eport->SendReport(report);
+    status_t status = eport->SendReport(report, exception_packet_home_.get());
     if (status != NO_ERROR) {
         LTRACEF("SendReport returned %d\n", status);
         exception_status_ = MX_EXCEPTION_STATUS_NOT_HANDLED;
+        exception_wait_port_ = nullptr;
         return status;
     }
     status = cond_wait_timeout(&exception_wait_cond_, &exception_wait_lock_, INFINITE_TIME);
     DEBUG_ASSERT(status == NO_ERROR);
     DEBUG_ASSERT(exception_status_ != MX_EXCEPTION_STATUS_WAITING);
+    exception_wait_port_ = nullptr;
     if (exception_status_ != MX_EXCEPTION_STATUS_RESUME)
         return ERR_BUSY; // TODO(dje): what to use here???
     return NO_ERROR;
 }
 
-status_t UserThread::MarkExceptionHandled(mx_exception_status_t status) {
+status_t UserThread::MarkExceptionHandled(mx_exception_status_t status,
+                                          const IOPortDispatcher* io_port) {
     LTRACE_ENTRY_OBJ;
     AutoLock lock(&exception_wait_lock_);
     if (exception_status_ != MX_EXCEPTION_STATUS_WAITING)
         return ERR_NOT_BLOCKED;
+    if (io_port && exception_wait_port_->io_port() != io_port)
+        return ERR_ACCESS_DENIED;
     exception_status_ = status;
     cond_signal(&exception_wait_cond_);
     return NO_ERROR;
@@ -6,6 +6,7 @@
 
 #include <magenta/vm_object_dispatcher.h>
 
+#include <kernel/auto_lock.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 
@@ -31,9 +32,16 @@ status_t VmObjectDispatcher::Create(utils::RefPtr<VmObject> vmo,
 }
 
 VmObjectDispatcher::VmObjectDispatcher(utils::RefPtr<VmObject> vmo)
-    : vmo_(vmo) {}
+    : vmo_(vmo) {
+    mutex_init(&lock_);
+}
 
-VmObjectDispatcher::~VmObjectDispatcher() {}
+VmObjectDispatcher::~VmObjectDispatcher() {
+    // nothing can unpin these any more, and the object can't go away with pages pinned
+    while (auto range = pinned_.pop_front())
+        vmo_->UnpinPages(range->pages.get(), range->count);
+    mutex_destroy(&lock_);
+}
 
 mx_ssize_t VmObjectDispatcher::Read(void* user_data, mx_size_t length, uint64_t offset) {
 
@@ -65,16 +73,132 @@ mx_status_t VmObjectDispatcher::GetSize(uint64_t* size) {
     return NO_ERROR;
 }
 
-mx_status_t VmObjectDispatcher::Map(utils::RefPtr<VmAspace> aspace, uint32_t vmo_rights, uint64_t offset, mx_size_t len,
-                                    uintptr_t* _ptr, uint32_t flags) {
-    DEBUG_ASSERT(aspace);
+mx_status_t VmObjectDispatcher::GetInfo(mx_vmo_info_t* info) {
+    info->size = vmo_->size();
+    info->committed_bytes = static_cast<uint64_t>(vmo_->CommittedPageCount()) * PAGE_SIZE;
+
+    size_t compressed_pages, compressed_bytes;
+    vmo_->GetCompressedCount(&compressed_pages, &compressed_bytes);
+    info->compressed_bytes = static_cast<uint64_t>(compressed_pages) * PAGE_SIZE;
+    info->compressed_stored_bytes = compressed_bytes;
+
+    return NO_ERROR;
+}
+
+mx_status_t VmObjectDispatcher::Clone(uint64_t offset, uint64_t size,
+                                      utils::RefPtr<VmObject>* clone) {
+    if (!IS_PAGE_ALIGNED(offset))
+        return ERR_INVALID_ARGS;
+
+    return vmo_->CreateCowClone(offset, size, clone);
+}
+
+mx_status_t VmObjectDispatcher::Slice(uint64_t offset, uint64_t size,
+                                      utils::RefPtr<VmObject>* slice) {
+    if (!IS_PAGE_ALIGNED(offset))
+        return ERR_INVALID_ARGS;
+    if (offset + size < offset || offset + size > vmo_->size())
+        return ERR_OUT_OF_RANGE;
+
+    *slice = vmo_->CreateSlice(offset, size);
+    if (!*slice)
+        return ERR_NO_MEMORY;
+
+    return NO_ERROR;
+}
+
+mx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t size) {
+    int64_t ret;
+    switch (op) {
+    case MX_VMO_OP_COMMIT:
+        ret = vmo_->CommitRange(offset, size);
+        break;
+    case MX_VMO_OP_DECOMMIT:
+        ret = vmo_->DecommitRange(offset, size);
+        break;
+    default:
+        return ERR_INVALID_ARGS;
+    }
+
+    return (ret < 0) ? static_cast<mx_status_t>(ret) : NO_ERROR;
+}
+
+mx_status_t VmObjectDispatcher::Supply(uint64_t offset, uint64_t len, const void* user_data) {
+    if (user_data && !is_user_address(reinterpret_cast<vaddr_t>(user_data)))
+        return ERR_INVALID_ARGS;
+
+    return vmo_->SupplyPages(offset, len, user_data);
+}
+
+bool VmObjectDispatcher::GetCompressible() {
+    return vmo_->compressible();
+}
 
+mx_status_t VmObjectDispatcher::SetCompressible(bool compressible) {
+    return vmo_->SetCompressible(compressible);
+}
+
+mx_status_t VmObjectDispatcher::LookupPages(mx_koid_t process, uint64_t offset, size_t count,
+                                            mx_paddr_t* pages) {
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+
+    AllocChecker ac;
+    utils::unique_ptr<PinnedRange> range(new (&ac) PinnedRange);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    range->pages.reset(new (&ac) vm_page_t*[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    range->process = process;
+    range->offset = offset;
+    range->count = count;
+
+    // a device may be pointed at the pages, so they can't be moved out from under it
+    vmo_->KeepPagesInPlace();
+
+    mx_status_t status = vmo_->PinPages(offset, count, range->pages.get());
+    if (status != NO_ERROR)
+        return status;
+
+    for (size_t n = 0; n < count; n++)
+        pages[n] = vm_page_to_paddr(range->pages[n]);
+
+    AutoLock lock(&lock_);
+    pinned_.push_front(utils::move(range));
+    return NO_ERROR;
+}
+
+mx_status_t VmObjectDispatcher::UnpinPages(mx_koid_t process, uint64_t offset, size_t count) {
+    utils::unique_ptr<PinnedRange> range;
+    {
+        AutoLock lock(&lock_);
+        range = pinned_.erase_if([process, offset, count](const PinnedRange& r) {
+            return r.process == process && r.offset == offset && r.count == count;
+        });
+    }
+    if (!range)
+        return ERR_NOT_FOUND;
+
+    vmo_->UnpinPages(range->pages.get(), range->count);
+    return NO_ERROR;
+}
+
+mx_status_t VmObjectDispatcher::GetMapArgs(uint32_t vmo_rights, uint64_t offset, mx_size_t len,
+                                           uintptr_t ptr, uint32_t flags,
+                                           VmAspace::MapObjectArgs* args) {
     // add magenta vm flags, test against rights, and convert to vmm flags
     uint vmm_flags = 0;
     if (flags & MX_VM_FLAG_FIXED) {
         // TODO: test against right
         vmm_flags |= VMM_FLAG_VALLOC_SPECIFIC;
     }
+    if (flags & MX_VM_FLAG_MAP_POPULATE) {
+        // commit and map the whole range now rather than on fault
+        vmm_flags |= VMM_FLAG_COMMIT;
+    }
+    if (flags & MX_VM_FLAG_MAP_SEQUENTIAL) {
+        vmm_flags |= VMM_FLAG_SEQUENTIAL;
+    }
 
     // TODO: test the following against rights on the process and vmo handle
     uint arch_mmu_flags = ARCH_MMU_FLAG_PERM_USER;
@@ -99,8 +223,28 @@ mx_status_t VmObjectDispatcher::Map(utils::RefPtr<VmAspace> aspace, uint32_t vmo
     // This is a hack to make it easier to decode crash addresses
     const uint min_align_log2 = 20;
 
-    auto status = aspace->MapObject(vmo_, "unnamed", offset, len, reinterpret_cast<void**>(_ptr), min_align_log2,
-                                    vmm_flags, arch_mmu_flags);
+    args->vmo = vmo_;
+    args->offset = offset;
+    args->size = len;
+    args->ptr = reinterpret_cast<void*>(ptr);
+    args->align_pow2 = min_align_log2;
+    args->vmm_flags = vmm_flags;
+    args->arch_mmu_flags = arch_mmu_flags;
+    return NO_ERROR;
+}
+
+mx_status_t VmObjectDispatcher::Map(utils::RefPtr<VmAspace> aspace, uint32_t vmo_rights, uint64_t offset, mx_size_t len,
+                                    uintptr_t* _ptr, uint32_t flags) {
+    DEBUG_ASSERT(aspace);
+
+    VmAspace::MapObjectArgs args;
+    auto status = GetMapArgs(vmo_rights, offset, len, *_ptr, flags, &args);
+    if (status < 0)
+        return status;
+
+    status = aspace->MapObject(utils::move(args.vmo), args.name, args.offset, args.size,
+                               reinterpret_cast<void**>(_ptr), args.align_pow2, args.vmm_flags,
+                               args.arch_mmu_flags);
     if (status < 0)
         return status;
 
@@ -9,6 +9,7 @@
 #include <assert.h>
 
 #include <arch/ops.h>
+#include <kernel/thread.h>
 
 // static
 bool WaitEvent::HaveContextForResult(Result result) {
@@ -32,7 +33,9 @@ WaitEvent::~WaitEvent() {
 }
 
 WaitEvent::Result WaitEvent::Wait(lk_time_t timeout, uint64_t* context) {
+    enum thread_wait_reason reason = thread_set_wait_reason(THREAD_WAIT_HANDLE);
     status_t status = event_wait_timeout(&event_, timeout, true);
+    thread_set_wait_reason(reason);
     if (status == ERR_INTERRUPTED)
         return Result::INTERRUPTED;
     if (status == ERR_TIMED_OUT)
@@ -13,6 +13,7 @@
 #include <stdint.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/thread.h>
 
 #include <magenta/handle.h>
 #include <magenta/magenta.h>
@@ -27,9 +28,10 @@
 // static
 status_t WaitSetDispatcher::Entry::Create(mx_signals_t watched_signals,
                                           uint64_t cookie,
+                                          uint32_t options,
                                           utils::unique_ptr<Entry>* entry) {
     AllocChecker ac;
-    Entry* e = new (&ac) Entry (watched_signals, cookie);
+    Entry* e = new (&ac) Entry (watched_signals, cookie, options);
     if (!ac.check())
         return ERR_NO_MEMORY;
 
@@ -87,8 +89,47 @@ mx_signals_state_t WaitSetDispatcher::Entry::GetSignalsState_NoLock() const {
     return signals_state_;
 }
 
-WaitSetDispatcher::Entry::Entry(mx_signals_t watched_signals, uint64_t cookie)
-    : watched_signals_(watched_signals), cookie_(cookie) {}
+void WaitSetDispatcher::Entry::Reported_NoLock() {
+    DEBUG_ASSERT(is_mutex_held(&wait_set_->mutex_));
+    DEBUG_ASSERT(InTriggeredEntriesList_NoLock());
+
+    if (!(options_ & (MX_WAIT_SET_ENTRY_EDGE | MX_WAIT_SET_ENTRY_ONESHOT)))
+        return;
+
+    // Stay triggered, so that we aren't reported again while we stay ready.
+    wait_set_->triggered_entries_.erase(*this);
+    DEBUG_ASSERT(wait_set_->num_triggered_entries_ > 0u);
+    wait_set_->num_triggered_entries_--;
+
+    if (options_ & MX_WAIT_SET_ENTRY_ONESHOT)
+        disarmed_ = true;
+}
+
+bool WaitSetDispatcher::Entry::Rearm_NoLock() {
+    DEBUG_ASSERT(is_mutex_held(&wait_set_->mutex_));
+    DEBUG_ASSERT(options_ & MX_WAIT_SET_ENTRY_ONESHOT);
+
+    disarmed_ = false;
+
+    // An entry still being added gets looked at by OnInitialize().
+    if (state_ != State::ADDED || InTriggeredEntriesList_NoLock())
+        return false;
+
+    // A cancelled entry is reported again, like any other that is ready.
+    if (!handle_ || IsReady_NoLock())
+        return Trigger_NoLock();
+
+    is_triggered_ = false;
+    return false;
+}
+
+WaitSetDispatcher::Entry::Entry(mx_signals_t watched_signals, uint64_t cookie, uint32_t options)
+    : watched_signals_(watched_signals), cookie_(cookie), options_(options) {}
+
+bool WaitSetDispatcher::Entry::IsReady_NoLock() const {
+    return (watched_signals_ & signals_state_.satisfied) ||
+           !(watched_signals_ & signals_state_.satisfiable);
+}
 
 bool WaitSetDispatcher::Entry::OnInitialize(mx_signals_state_t initial_state) {
     AutoLock lock(&wait_set_->mutex_);
@@ -98,8 +139,7 @@ bool WaitSetDispatcher::Entry::OnInitialize(mx_signals_state_t initial_state) {
 
     signals_state_ = initial_state;
 
-    if ((watched_signals_ & signals_state_.satisfied) ||
-        !(watched_signals_ & signals_state_.satisfiable))
+    if (IsReady_NoLock())
         return Trigger_NoLock();
 
     return false;
@@ -115,21 +155,14 @@ bool WaitSetDispatcher::Entry::OnStateChange(mx_signals_state_t new_state) {
 
     signals_state_ = new_state;
 
-    if ((watched_signals_ & signals_state_.satisfied) ||
-        !(watched_signals_ & signals_state_.satisfiable)) {
-        if (is_triggered_)
-            return false;  // Already triggered.
+    if (IsReady_NoLock()) {
+        if (is_triggered_ || disarmed_)
+            return false;  // Already triggered, or reported and not rearmed.
         return Trigger_NoLock();
     }
 
-    if (is_triggered_) {
-        DEBUG_ASSERT(InTriggeredEntriesList_NoLock());
-        is_triggered_ = false;
-        wait_set_->triggered_entries_.erase(*this);
-
-        DEBUG_ASSERT(wait_set_->num_triggered_entries_ > 0u);
-        wait_set_->num_triggered_entries_--;
-    }
+    if (is_triggered_)
+        Untrigger_NoLock();
     return false;
 }
 
@@ -160,7 +193,8 @@ bool WaitSetDispatcher::Entry::OnCancel(Handle* handle,
 
     *should_remove = true;
 
-    if (!is_triggered_)
+    // Report the cancellation even if an edge triggered entry was already reported as ready.
+    if (!InTriggeredEntriesList_NoLock() && !disarmed_)
         return Trigger_NoLock();
 
     return false;
@@ -169,7 +203,7 @@ bool WaitSetDispatcher::Entry::OnCancel(Handle* handle,
 bool WaitSetDispatcher::Entry::Trigger_NoLock() {
     DEBUG_ASSERT(is_mutex_held(&wait_set_->mutex_));
 
-    DEBUG_ASSERT(!is_triggered_);
+    DEBUG_ASSERT(!InTriggeredEntriesList_NoLock());
     is_triggered_ = true;
 
     // Signal if necessary.
@@ -184,6 +218,20 @@ bool WaitSetDispatcher::Entry::Trigger_NoLock() {
     return false;
 }
 
+void WaitSetDispatcher::Entry::Untrigger_NoLock() {
+    DEBUG_ASSERT(is_mutex_held(&wait_set_->mutex_));
+
+    DEBUG_ASSERT(is_triggered_);
+    is_triggered_ = false;
+
+    if (InTriggeredEntriesList_NoLock()) {
+        wait_set_->triggered_entries_.erase(*this);
+
+        DEBUG_ASSERT(wait_set_->num_triggered_entries_ > 0u);
+        wait_set_->num_triggered_entries_--;
+    }
+}
+
 // WaitSetDispatcher -------------------------------------------------------------------------------
 
 constexpr mx_rights_t kDefaultWaitSetRights = MX_RIGHT_READ | MX_RIGHT_WRITE;
@@ -209,20 +257,20 @@ WaitSetDispatcher::~WaitSetDispatcher() {
 
         triggered_entries_.clear();
 
-        for (auto& e : entries_) {
+        entries_.for_each([](Entry& e) {
             // If we're being destroyed, every entry in |entries_| should be in the ADDED state (since
             // we can't be in the middle of AddEntry() or RemoveEntry().
             DEBUG_ASSERT(e.GetState_NoLock() == Entry::State::ADDED);
             e.SetState_NoLock(Entry::State::REMOVED);
-        }
+        });
     }
 
     // We can only call RemoveObserver() outside the lock.
-    for (auto& e : entries_) {
+    entries_.for_each([](Entry& e) {
         DEBUG_ASSERT(e.GetState_NoLock() == Entry::State::REMOVED);
         if (e.GetDispatcher_NoLock())
             e.GetDispatcher_NoLock()->get_state_tracker()->RemoveObserver(&e);
-    }
+    });
     entries_.clear();   // Automatically destroys all Entry objects in entries_
 
     state_tracker_.RemoveObserver(this);
@@ -307,6 +355,25 @@ status_t WaitSetDispatcher::RemoveEntry(uint64_t cookie) {
     return NO_ERROR;
 }
 
+status_t WaitSetDispatcher::RearmEntry(uint64_t cookie) {
+    bool awoke_threads = false;
+    {
+        AutoLock lock(&mutex_);
+
+        const auto& entry = entries_.find(cookie);
+        if (!entry)
+            return ERR_NOT_FOUND;
+        if (!(entry->options() & MX_WAIT_SET_ENTRY_ONESHOT))
+            return ERR_BAD_STATE;
+
+        awoke_threads = entry->Rearm_NoLock();
+    }
+    if (awoke_threads)
+        thread_preempt_if_needed();
+
+    return NO_ERROR;
+}
+
 status_t WaitSetDispatcher::Wait(mx_time_t timeout,
                                  uint32_t* num_results,
                                  mx_wait_set_result_t* results,
@@ -316,8 +383,10 @@ status_t WaitSetDispatcher::Wait(mx_time_t timeout,
     lk_time_t lk_timeout = mx_time_to_lk(timeout);
     status_t result = NO_ERROR;
     if (!num_triggered_entries_ && !cancelled_) {
+        enum thread_wait_reason reason = thread_set_wait_reason(THREAD_WAIT_HANDLE);
         result = (lk_timeout == INFINITE_TIME) ? DoWaitInfinite_NoLock()
                                                : DoWaitTimeout_NoLock(lk_timeout);
+        thread_set_wait_reason(reason);
     } // Else the condition is already satisfied.
 
     if (result != NO_ERROR && result != ERR_TIMED_OUT) {
@@ -335,20 +404,25 @@ status_t WaitSetDispatcher::Wait(mx_time_t timeout,
 
     if (num_triggered_entries_ < *num_results)
         *num_results = num_triggered_entries_;
+    *max_results = num_triggered_entries_;
 
-    auto it = triggered_entries_.cbegin();
-    for (uint32_t i = 0; i < *num_results; i++, ++it) {
-        DEBUG_ASSERT(it != triggered_entries_.cend());
+    // Reporting an edge triggered or one-shot entry takes it off the list, so step past each
+    // entry before reporting it.
+    auto it = triggered_entries_.begin();
+    for (uint32_t i = 0; i < *num_results; i++) {
+        DEBUG_ASSERT(it != triggered_entries_.end());
+        auto& e = *it;
+        ++it;
 
-        results[i].cookie = it->GetKey();
+        results[i].cookie = e.GetKey();
         results[i].reserved = 0u;
-        if (it->GetHandle_NoLock()) {
+        if (e.GetHandle_NoLock()) {
             // Not cancelled: satisfied or unsatisfiable.
-            auto st = it->GetSignalsState_NoLock();
-            if ((st.satisfied & it->watched_signals())) {
+            auto st = e.GetSignalsState_NoLock();
+            if ((st.satisfied & e.watched_signals())) {
                 results[i].wait_result = NO_ERROR;
             } else {
-                DEBUG_ASSERT(!(st.satisfiable & it->watched_signals()));
+                DEBUG_ASSERT(!(st.satisfiable & e.watched_signals()));
                 results[i].wait_result = ERR_BAD_STATE;
             }
             results[i].signals_state = st;
@@ -357,9 +431,9 @@ status_t WaitSetDispatcher::Wait(mx_time_t timeout,
             results[i].wait_result = ERR_CANCELLED;
             results[i].signals_state = mx_signals_state_t{0u, 0u};
         }
-    }
 
-    *max_results = num_triggered_entries_;
+        e.Reported_NoLock();
+    }
 
     return NO_ERROR;
 }
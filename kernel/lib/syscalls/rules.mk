@@ -12,6 +12,7 @@ MODULE := $(LOCAL_DIR)
 MODULE_DEPS := \
     lib/console \
     lib/crypto \
+    lib/ktrace \
     lib/magenta \
     lib/user_copy \
 
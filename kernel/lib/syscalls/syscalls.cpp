@@ -4,8 +4,12 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <arch/ops.h>
 #include <err.h>
+#include <lib/console.h>
+#include <lib/ktrace.h>
 #include <lib/user_copy.h>
+#include <lk/init.h>
 
 #include <magenta/magenta.h>
 #include <magenta/state_tracker.h>
@@ -30,10 +34,152 @@ int sys_invalid_syscall(void) {
 
 #define MAGENTA_DDKCALL_DEF(a...) MAGENTA_SYSCALL_DEF(a)
 
-#if ARCH_ARM
+// Syscalls are dispatched through a table indexed by slot, which for the
+// regular calls is their number. The test calls, numbered from 20000, get
+// the slots above those.
+static constexpr uint32_t kSyscallTableSize = 512u;
+static constexpr uint32_t kTestSyscallBase = 20000u;
+static constexpr uint32_t kTestSyscallCount = 16u;
+// one past the test calls, for numbers that don't name a syscall
+static constexpr uint32_t kInvalidSyscallSlot = kSyscallTableSize + kTestSyscallCount;
+static constexpr uint32_t kNumSyscallSlots = kInvalidSyscallSlot + 1;
+
+static constexpr uint32_t syscall_slot(uint64_t num) {
+    return (num < kSyscallTableSize) ? static_cast<uint32_t>(num) :
+           (num - kTestSyscallBase < kTestSyscallCount) ?
+               static_cast<uint32_t>(kSyscallTableSize + num - kTestSyscallBase) :
+           kInvalidSyscallSlot;
+}
+
+using syscall_func = int64_t (*)(uintptr_t a, uintptr_t b, uintptr_t c, uintptr_t d, uintptr_t e,
+                                 uintptr_t f, uintptr_t g, uintptr_t h);
+
+static syscall_func syscall_table[kNumSyscallSlots];
+
+#if SYSCALL_STATS
+static const char* syscall_names[kNumSyscallSlots];
+static uint32_t syscall_numbers[kNumSyscallSlots];
+#endif
+
+static void syscall_table_init(uint level) {
+    for (auto& func : syscall_table)
+        func = reinterpret_cast<syscall_func>(sys_invalid_syscall);
+
+#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...)                               \
+    static_assert(syscall_slot(n) != kInvalidSyscallSlot, "syscall " #name " has no slot");       \
+    syscall_table[syscall_slot(n)] = reinterpret_cast<syscall_func>(sys_##name);                   \
+    SYSCALL_STATS_NAME(n, name)
+#if SYSCALL_STATS
+#define SYSCALL_STATS_NAME(n, name)                                                                \
+    syscall_names[syscall_slot(n)] = #name;                                                        \
+    syscall_numbers[syscall_slot(n)] = n;
+#else
+#define SYSCALL_STATS_NAME(n, name)
+#endif
+#include <magenta/syscalls.inc>
+#undef SYSCALL_STATS_NAME
+}
+
+// ahead of any thread that could make a syscall
+LK_INIT_HOOK(syscall_table, syscall_table_init, LK_INIT_LEVEL_HEAP);
+
+#if SYSCALL_STATS
+
+// Calls and cycles from entry to return (including any time spent blocked)
+// per syscall, with a histogram of the cycles per call in powers of 4 from
+// 256. Counted on every cpu with relaxed atomics, which is fine for
+// builds made to measure.
+struct syscall_counters {
+    uint64_t count;
+    uint64_t cycles;
+    uint32_t histogram[MX_SYSCALL_STATS_BUCKETS];
+};
+
+static syscall_counters syscall_stats[kNumSyscallSlots];
+
+static uint syscall_stats_bucket(uint32_t cycles) {
+    uint bucket = 0;
+    for (cycles >>= 8; cycles && bucket < MX_SYSCALL_STATS_BUCKETS - 1; cycles >>= 2)
+        ++bucket;
+    return bucket;
+}
+
+static void syscall_stats_add(uint32_t slot, uint32_t start_cycles) {
+    uint32_t cycles = arch_cycle_count() - start_cycles;
+    syscall_counters* stats = &syscall_stats[slot];
+    __atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->histogram[syscall_stats_bucket(cycles)], 1, __ATOMIC_RELAXED);
+}
+
+mx_ssize_t syscall_stats_get(mx_syscall_stats_t* stats, size_t max_stats) {
+    size_t count = 0;
+    for (uint32_t slot = 0; slot != kNumSyscallSlots && count != max_stats; ++slot) {
+        if (!syscall_names[slot])
+            continue;
+        const syscall_counters* s = &syscall_stats[slot];
+        mx_syscall_stats_t* out = &stats[count++];
+        out->num = syscall_numbers[slot];
+        out->reserved = 0u;
+        out->count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+        out->cycles = __atomic_load_n(&s->cycles, __ATOMIC_RELAXED);
+        for (uint b = 0; b != MX_SYSCALL_STATS_BUCKETS; ++b)
+            out->histogram[b] = __atomic_load_n(&s->histogram[b], __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+#if WITH_LIB_CONSOLE
+
+static int cmd_syscalls(int argc, const cmd_args* argv) {
+    if (argc > 1 && !strcmp(argv[1].str, "reset")) {
+        memset(syscall_stats, 0, sizeof(syscall_stats));
+        return NO_ERROR;
+    }
+    if (argc > 1) {
+        printf("usage:\n");
+        printf("%s       : dump per syscall counts and cycles\n", argv[0].str);
+        printf("%s reset : clear them\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    printf("%-24s %10s %14s %10s  histogram (cycles <256, <1K, <4K, ...)\n",
+           "syscall", "calls", "cycles", "avg");
+    for (uint32_t slot = 0; slot != kNumSyscallSlots; ++slot) {
+        const syscall_counters* s = &syscall_stats[slot];
+        uint64_t count = s->count;
+        if (!count)
+            continue;
+        printf("%-24s %10llu %14llu %10llu ", syscall_names[slot] ? syscall_names[slot] : "invalid",
+               count, s->cycles, s->cycles / count);
+        for (uint b = 0; b != MX_SYSCALL_STATS_BUCKETS; ++b)
+            printf(" %u", s->histogram[b]);
+        printf("\n");
+    }
+    return NO_ERROR;
+}
 
-using syscall_func = int64_t (*)(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e,
-                                 uint32_t f, uint32_t g, uint32_t h);
+STATIC_COMMAND_START
+STATIC_COMMAND("syscalls", "per syscall counts and cycles", &cmd_syscalls)
+STATIC_COMMAND_END(syscalls);
+
+#endif // WITH_LIB_CONSOLE
+
+#define SYSCALL_STATS_START() uint32_t start_cycles = arch_cycle_count()
+#define SYSCALL_STATS_END(slot) syscall_stats_add(slot, start_cycles)
+
+#else // !SYSCALL_STATS
+
+mx_ssize_t syscall_stats_get(mx_syscall_stats_t* stats, size_t max_stats) {
+    return ERR_NOT_SUPPORTED;
+}
+
+#define SYSCALL_STATS_START() do { } while (0)
+#define SYSCALL_STATS_END(slot) do { } while (0)
+
+#endif // SYSCALL_STATS
+
+#if ARCH_ARM
 
 extern "C" void arm_syscall_handler(struct arm_fault_frame* frame) {
     uint64_t ret = 0;
@@ -53,25 +199,23 @@ extern "C" void arm_syscall_handler(struct arm_fault_frame* frame) {
 
     LTRACEF_LEVEL(2, "arm syscall: num 0x%x, pc 0x%x\n", syscall_num, frame->pc);
 
-    /* build a function pointer to call the routine.
-     * the args are jammed into the function independent of if the function
-     * uses them or not, which is safe for simple arg passing.
-     */
-    syscall_func sfunc;
+    {
+        SYSCALL_STATS_START();
 
-    switch (syscall_num) {
-#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...)                               \
-    case n:                                                                                        \
-        sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
-        break;
-#include <magenta/syscalls.inc>
-        default:
-            sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
-    }
+        /* call the routine.
+         * the args are jammed into the function independent of if the function
+         * uses them or not, which is safe for simple arg passing.
+         */
+        ktrace(MX_KTRACE_TAG_SYSCALL_ENTER, syscall_num, 0);
 
-    /* call the routine */
-    ret = sfunc(frame->r[0], frame->r[1], frame->r[2], frame->r[3], frame->r[4],
-                         frame->r[5], frame->r[6], frame->r[7]);
+        uint32_t slot = syscall_slot(syscall_num);
+        ret = syscall_table[slot](frame->r[0], frame->r[1], frame->r[2], frame->r[3], frame->r[4],
+                                  frame->r[5], frame->r[6], frame->r[7]);
+
+        SYSCALL_STATS_END(slot);
+
+        ktrace(MX_KTRACE_TAG_SYSCALL_EXIT, syscall_num, ret);
+    }
 
     LTRACEF_LEVEL(2, "ret 0x%llx\n", ret);
 
@@ -88,9 +232,6 @@ out:
 #if ARCH_ARM64
 #include <arch/arm64.h>
 
-using syscall_func = int64_t (*)(uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t e,
-                                 uint64_t f, uint64_t g, uint64_t h);
-
 extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, uint32_t syscall_imm, uint64_t pc) {
     uint64_t syscall_num = frame->r[16];
 
@@ -106,25 +247,21 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
 
     LTRACEF_LEVEL(2, "num %llu\n", syscall_num);
 
-    /* build a function pointer to call the routine.
+    SYSCALL_STATS_START();
+
+    /* call the routine.
      * the args are jammed into the function independent of if the function
      * uses them or not, which is safe for simple arg passing.
      */
-    syscall_func sfunc;
+    ktrace(MX_KTRACE_TAG_SYSCALL_ENTER, static_cast<uint32_t>(syscall_num), 0);
 
-    switch (syscall_num) {
-#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...)                               \
-    case n:                                                                                        \
-        sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
-        break;
-#include <magenta/syscalls.inc>
-        default:
-            sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
-    }
+    uint32_t slot = syscall_slot(syscall_num);
+    uint64_t ret = syscall_table[slot](frame->r[0], frame->r[1], frame->r[2], frame->r[3],
+                                       frame->r[4], frame->r[5], frame->r[6], frame->r[7]);
 
-    /* call the routine */
-    uint64_t ret = sfunc(frame->r[0], frame->r[1], frame->r[2], frame->r[3], frame->r[4],
-                         frame->r[5], frame->r[6], frame->r[7]);
+    SYSCALL_STATS_END(slot);
+
+    ktrace(MX_KTRACE_TAG_SYSCALL_EXIT, static_cast<uint32_t>(syscall_num), ret);
 
     LTRACEF_LEVEL(2, "ret 0x%llx\n", ret);
 
@@ -143,9 +280,6 @@ extern "C" void arm64_syscall(struct arm64_iframe_long* frame, bool is_64bit, ui
 #if ARCH_X86_64
 #include <arch/x86.h>
 
-using syscall_func = int64_t (*)(uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t e,
-                                 uint64_t f, uint64_t g, uint64_t h);
-
 extern "C" uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4,
                                    uint64_t arg5, uint64_t arg6, uint64_t arg7, uint64_t arg8,
                                    uint64_t syscall_num, uint64_t ip) {
@@ -162,24 +296,20 @@ extern "C" uint64_t x86_64_syscall(uint64_t arg1, uint64_t arg2, uint64_t arg3,
 
     LTRACEF_LEVEL(2, "t %p syscall num %llu ip 0x%llx\n", get_current_thread(), syscall_num, ip);
 
-    /* build a function pointer to call the routine.
+    SYSCALL_STATS_START();
+
+    /* call the routine.
      * the args are jammed into the function independent of if the function
      * uses them or not, which is safe for simple arg passing.
      */
-    syscall_func sfunc;
+    ktrace(MX_KTRACE_TAG_SYSCALL_ENTER, static_cast<uint32_t>(syscall_num), 0);
 
-    switch (syscall_num) {
-#define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...)                               \
-    case n:                                                                                        \
-        sfunc = reinterpret_cast<syscall_func>(sys_##name);                                        \
-        break;
-#include <magenta/syscalls.inc>
-        default:
-            sfunc = reinterpret_cast<syscall_func>(sys_invalid_syscall);
-    }
+    uint32_t slot = syscall_slot(syscall_num);
+    uint64_t ret = syscall_table[slot](arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8);
+
+    SYSCALL_STATS_END(slot);
 
-    /* call the routine */
-    uint64_t ret = sfunc(arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8);
+    ktrace(MX_KTRACE_TAG_SYSCALL_EXIT, static_cast<uint32_t>(syscall_num), ret);
 
     /* check to see if there are any pending signals */
     thread_process_pending_signals();
@@ -14,6 +14,7 @@
 
 #include <dev/udisplay.h>
 #include <kernel/vm.h>
+#include <lib/ktrace.h>
 #include <lib/user_copy.h>
 
 #include <magenta/interrupt_dispatcher.h>
@@ -22,6 +23,10 @@
 #include <magenta/pci_interrupt_dispatcher.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
+#include <magenta/vm_object_dispatcher.h>
+
+#include <new.h>
+#include <utils/unique_ptr.h>
 
 #include "syscalls_priv.h"
 
@@ -46,11 +51,11 @@ mx_handle_t sys_interrupt_event_create(uint32_t vector, uint32_t flags) {
         return result;
 
     HandleUniquePtr handle(MakeHandle(utils::move(dispatcher), rights));
+    if (!handle)
+        return ERR_NO_MEMORY;
 
     auto up = ProcessDispatcher::GetCurrent();
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_status_t sys_interrupt_event_wait(mx_handle_t handle_value) {
@@ -114,9 +119,8 @@ mx_status_t sys_mmap_device_memory(uintptr_t paddr, uint32_t len, void** out_vad
     return NO_ERROR;
 }
 
-mx_status_t sys_alloc_device_memory(uint32_t len, mx_paddr_t* out_paddr, void** out_vaddr) {
-    LTRACEF("len 0x%x\n", len);
-
+static mx_status_t alloc_device_memory(uint32_t len, uint arch_mmu_flags, mx_paddr_t* out_paddr,
+                                       void** out_vaddr) {
     if (!out_paddr)
         return ERR_INVALID_ARGS;
     if (!out_vaddr)
@@ -124,8 +128,7 @@ mx_status_t sys_alloc_device_memory(uint32_t len, mx_paddr_t* out_paddr, void**
 
     void* vaddr = nullptr;
     auto aspace = ProcessDispatcher::GetCurrent()->aspace();
-    uint arch_mmu_flags =
-        ARCH_MMU_FLAG_PERM_NO_EXECUTE | ARCH_MMU_FLAG_PERM_USER | ARCH_MMU_FLAG_UNCACHED_DEVICE;
+    arch_mmu_flags |= ARCH_MMU_FLAG_PERM_NO_EXECUTE | ARCH_MMU_FLAG_PERM_USER;
 
     status_t res = aspace->AllocContiguous("user_mmio", len, &vaddr,
                                            PAGE_SIZE_SHIFT, VMM_FLAG_COMMIT,
@@ -143,6 +146,98 @@ mx_status_t sys_alloc_device_memory(uint32_t len, mx_paddr_t* out_paddr, void**
     return NO_ERROR;
 }
 
+mx_status_t sys_alloc_device_memory(uint32_t len, mx_paddr_t* out_paddr, void** out_vaddr) {
+    LTRACEF("len 0x%x\n", len);
+
+    return alloc_device_memory(len, ARCH_MMU_FLAG_UNCACHED_DEVICE, out_paddr, out_vaddr);
+}
+
+mx_status_t sys_alloc_device_memory_etc(uint32_t len, mx_cache_policy_t cache_policy,
+                                        mx_paddr_t* out_paddr, void** out_vaddr) {
+    LTRACEF("len 0x%x, cache policy %u\n", len, cache_policy);
+
+    if (cache_policy & ~ARCH_MMU_FLAG_CACHE_MASK)
+        return ERR_INVALID_ARGS;
+
+    return alloc_device_memory(len, cache_policy, out_paddr, out_vaddr);
+}
+
+mx_status_t sys_vm_object_lookup(mx_handle_t handle, uint64_t offset, mx_size_t len,
+                                 mx_paddr_t* pages, mx_size_t max_pages) {
+    LTRACEF("handle %d, offset 0x%llx, len 0x%lx\n", handle, offset, len);
+
+    if (!pages || len == 0 || offset + len < offset)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return ERR_BAD_HANDLE;
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    // a device may both read and write the pages
+    if (!magenta_rights_check(rights, MX_RIGHT_READ | MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    // one address for every page the range touches, the first being that of the page holding
+    // offset rather than offset itself
+    uint64_t start = ROUNDDOWN(offset, PAGE_SIZE);
+    uint64_t count = (ROUNDUP(offset + len, PAGE_SIZE) - start) / PAGE_SIZE;
+    if (count > max_pages)
+        return ERR_NOT_ENOUGH_BUFFER;
+
+    uint64_t size;
+    mx_status_t status = vmo->GetSize(&size);
+    if (status != NO_ERROR)
+        return status;
+    if (count > (ROUNDUP(size, PAGE_SIZE) - MIN(start, ROUNDUP(size, PAGE_SIZE))) / PAGE_SIZE)
+        return ERR_OUT_OF_RANGE;
+
+    AllocChecker ac;
+    utils::unique_ptr<mx_paddr_t[]> paddrs(new (&ac) mx_paddr_t[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    // the pages stay pinned for the device until unpinned with sys_vm_object_unpin()
+    mx_koid_t koid = up->get_koid();
+    status = vmo->LookupPages(koid, start, static_cast<size_t>(count), paddrs.get());
+    if (status != NO_ERROR)
+        return status;
+    if (copy_to_user(reinterpret_cast<uint8_t*>(pages), paddrs.get(),
+                     count * sizeof(mx_paddr_t)) != NO_ERROR) {
+        vmo->UnpinPages(koid, start, static_cast<size_t>(count));
+        return ERR_INVALID_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+mx_status_t sys_vm_object_unpin(mx_handle_t handle, uint64_t offset, mx_size_t len) {
+    LTRACEF("handle %d, offset 0x%llx, len 0x%lx\n", handle, offset, len);
+
+    if (len == 0 || offset + len < offset)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return ERR_BAD_HANDLE;
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    // the same range as was looked up, and only the calling process's pins
+    uint64_t start = ROUNDDOWN(offset, PAGE_SIZE);
+    uint64_t count = (ROUNDUP(offset + len, PAGE_SIZE) - start) / PAGE_SIZE;
+    return vmo->UnpinPages(up->get_koid(), start, static_cast<size_t>(count));
+}
+
 #if ARCH_X86
 extern uint32_t bootloader_fb_base;
 extern uint32_t bootloader_fb_width;
@@ -153,7 +248,13 @@ extern uint32_t bootloader_fb_format;
 
 mx_status_t sys_bootloader_fb_get_info(uint32_t* format, uint32_t* width, uint32_t* height, uint32_t* stride) {
 #if ARCH_X86
-    if (!bootloader_fb_base || copy_to_user_u32(format, bootloader_fb_format) || copy_to_user_u32(width, bootloader_fb_width) || copy_to_user_u32(height, bootloader_fb_height) || copy_to_user_u32(stride, bootloader_fb_stride)) {
+    const user_copy_vec_t info[] = {
+        {format, &bootloader_fb_format, sizeof(*format)},
+        {width, &bootloader_fb_width, sizeof(*width)},
+        {height, &bootloader_fb_height, sizeof(*height)},
+        {stride, &bootloader_fb_stride, sizeof(*stride)},
+    };
+    if (!bootloader_fb_base || copy_to_user_many(info, countof(info))) {
         return ERR_INVALID_ARGS;
     } else {
         return NO_ERROR;
@@ -201,15 +302,12 @@ mx_handle_t sys_pci_get_nth_device(uint32_t index, mx_pcie_get_nth_info_t* out_i
     if (!handle)
         return ERR_NO_MEMORY;
 
-    auto up = ProcessDispatcher::GetCurrent();
-    mx_handle_t handle_value = up->MapHandleToValue(handle.get());
-
     if (copy_to_user(reinterpret_cast<uint8_t*>(out_info),
                      &info, sizeof(*out_info)) != NO_ERROR)
         return ERR_INVALID_ARGS;
 
-    up->AddHandle(utils::move(handle));
-    return handle_value;
+    auto up = ProcessDispatcher::GetCurrent();
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_status_t sys_pci_claim_device(mx_handle_t handle) {
@@ -322,9 +420,7 @@ mx_handle_t sys_pci_map_mmio(mx_handle_t handle, uint32_t bar_num, mx_cache_poli
     if (!handle)
         return ERR_NO_MEMORY;
 
-    mx_handle_t ret_val = up->MapHandleToValue(mmio_handle.get());
-    up->AddHandle(utils::move(mmio_handle));
-    return ret_val;
+    return up->AddHandle(utils::move(mmio_handle));
 }
 
 mx_status_t sys_pci_io_write(mx_handle_t handle, uint32_t bar_num, uint32_t offset, uint32_t len,
@@ -385,9 +481,7 @@ mx_handle_t sys_pci_map_interrupt(mx_handle_t handle_value, int32_t which_irq) {
     if (!handle)
         return ERR_NO_MEMORY;
 
-    mx_handle_t interrupt_handle = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-    return interrupt_handle;
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_status_t sys_pci_interrupt_wait(mx_handle_t handle) {
@@ -413,6 +507,30 @@ mx_status_t sys_pci_interrupt_wait(mx_handle_t handle) {
     return pci_interrupt->InterruptWait();
 }
 
+mx_status_t sys_pci_interrupt_complete(mx_handle_t handle) {
+    /**
+     * Re-arms a legacy PCI interrupt bound to an IO port once the driver has
+     * dealt with the device.  Interrupts in MSI and MSI-X modes are never
+     * masked when bound, so this does nothing for them.
+     * @param handle Handle associated with a PCI interrupt
+     */
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return ERR_BAD_HANDLE;
+
+    auto pci_interrupt = dispatcher->get_pci_interrupt_dispatcher();
+    if (!pci_interrupt)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    return pci_interrupt->InterruptComplete();
+}
+
 mx_handle_t sys_pci_map_config(mx_handle_t handle) {
     /**
      * Fetch an I/O Mapping object which maps the PCI device's mmaped config
@@ -446,9 +564,7 @@ mx_handle_t sys_pci_map_config(mx_handle_t handle) {
     if (!config_handle)
         return ERR_NO_MEMORY;
 
-    mx_handle_t ret_val = up->MapHandleToValue(config_handle.get());
-    up->AddHandle(utils::move(config_handle));
-    return ret_val;
+    return up->AddHandle(utils::move(config_handle));
 }
 
 /**
@@ -516,6 +632,34 @@ mx_status_t sys_pci_set_irq_mode(mx_handle_t handle,
     return pci_device->SetIrqMode(mode, requested_irq_count);
 }
 
+/**
+ * Steers one of a PCI device's IRQs to a cpu.  Only supported in MSI-X mode.
+ * @param handle Handle associated with a PCI device.
+ * @param which_irq The IRQ to steer.
+ * @param cpu_num The cpu which should receive the IRQ.
+ */
+mx_status_t sys_pci_set_irq_affinity(mx_handle_t handle,
+                                     uint32_t which_irq,
+                                     uint32_t cpu_num) {
+    LTRACEF("handle %u\n", handle);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return ERR_BAD_HANDLE;
+
+    auto pci_device = dispatcher->get_pci_device_dispatcher();
+    if (!pci_device)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    return pci_device->SetIrqAffinity(which_irq, cpu_num);
+}
+
 /**
  * Gets info about an I/O mapping object.
  * @param handle Handle associated with an I/O mapping object.
@@ -557,6 +701,39 @@ mx_status_t sys_io_mapping_get_info(mx_handle_t handle, void** out_vaddr, uint64
     return copy_to_user(out_size, &size, sizeof(*out_size));
 }
 
+mx_status_t sys_ktrace_control(uint32_t action, uint32_t options, mx_handle_t* out_handle) {
+    LTRACEF("action %u options 0x%x\n", action, options);
+
+    if (action != MX_KTRACE_ACTION_GET_VMO)
+        return ktrace_control(action, options);
+
+    utils::RefPtr<VmObject> vmo = ktrace_get_vmo();
+    if (!vmo)
+        return ERR_NOT_SUPPORTED;
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    mx_status_t result = VmObjectDispatcher::Create(utils::move(vmo), &dispatcher, &rights);
+    if (result != NO_ERROR)
+        return result;
+
+    // the kernel is the only writer
+    HandleUniquePtr handle(MakeHandle(utils::move(dispatcher), rights & ~MX_RIGHT_WRITE));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    mx_handle_t hv = up->AddHandle(utils::move(handle));
+    if (hv < 0)
+        return hv;
+
+    if (copy_to_user_32(out_handle, hv) != NO_ERROR) {
+        up->RemoveHandle(hv);
+        return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
+}
+
 #if ARCH_X86
 #include <arch/x86/descriptor.h>
 #include <arch/x86/ioport.h>
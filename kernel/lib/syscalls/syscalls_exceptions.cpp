@@ -198,9 +198,7 @@ static mx_handle_t make_process_handle(utils::RefPtr<ProcessDispatcher> process)
     HandleUniquePtr handle(MakeHandle(utils::move(dispatcher), process_rights));
     if (!handle)
         return ERR_NO_MEMORY;
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 static mx_handle_t sys_process_lookup_worker(mx_koid_t pid) {
@@ -245,3 +243,45 @@ mx_handle_t sys_process_debug(mx_handle_t handle, mx_koid_t pid) {
 
     return sys_process_lookup_worker(pid);
 }
+
+// Resume a thread whose exception report was read from |eport|. Holding the
+// port the report went to is the authority here, so a handler needn't get a
+// handle of the process first.
+
+mx_status_t sys_exception_resume(mx_handle_t eport, mx_koid_t pid, mx_koid_t tid,
+                                 mx_exception_status_t excp_status) {
+    LTRACE_ENTRY;
+
+    switch (excp_status)
+    {
+    case MX_EXCEPTION_STATUS_NOT_HANDLED:
+    case MX_EXCEPTION_STATUS_RESUME:
+        break;
+    default:
+        return ERR_INVALID_ARGS;
+    }
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    if (!up->GetDispatcher(eport, &dispatcher, &rights))
+        return ERR_BAD_HANDLE;
+
+    auto ioport = dispatcher->get_io_port_dispatcher();
+    if (!ioport)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    auto process = ProcessDispatcher::LookupProcessById(pid);
+    if (!process)
+        return ERR_INVALID_ARGS;
+
+    auto thread = process->LookupThreadById(tid);
+    if (!thread)
+        return ERR_INVALID_ARGS;
+
+    return thread->MarkExceptionHandled(excp_status, ioport);
+}
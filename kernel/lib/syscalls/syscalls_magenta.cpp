@@ -25,9 +25,12 @@
 #include <magenta/log_dispatcher.h>
 #include <magenta/magenta.h>
 #include <magenta/msg_pipe_dispatcher.h>
+#include <magenta/pager_source.h>
+#include <magenta/pci_interrupt_dispatcher.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/state_tracker.h>
 #include <magenta/thread_dispatcher.h>
+#include <magenta/timer_dispatcher.h>
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
 #include <magenta/vm_object_dispatcher.h>
@@ -49,14 +52,23 @@
 
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 1024u;
+// more than there are syscalls
+constexpr size_t kMaxSyscallStats = 1024u;
+constexpr uint32_t kMaxMessageBatch = MX_MESSAGE_BATCH_MAX;
 
 constexpr uint32_t kMaxWaitHandleCount = 256u;
+// Waits on up to this many handles keep their state on the stack.
+constexpr uint32_t kInlineWaitHandleCount = 8u;
+constexpr uint32_t kMaxIOPortWaitMany = MX_IO_PORT_WAIT_MANY_MAX;
+constexpr uint32_t kMaxVmMapBatch = MX_VM_MAP_BATCH_MAX;
 constexpr mx_size_t kDefaultDataPipeCapacity = 32 * 1024u;
+constexpr uint32_t kMaxDataPipeIovecs = MX_DATA_PIPE_IOVEC_MAX;
 
 constexpr mx_size_t kMaxCPRNGDraw = MX_CPRNG_DRAW_MAX_LEN;
 constexpr mx_size_t kMaxCPRNGSeed = MX_CPRNG_ADD_ENTROPY_MAX_LEN;
 
 constexpr uint32_t kMaxWaitSetWaitResults = 1024u;
+constexpr uint32_t kWaitSetStackResults = 16u;
 
 namespace {
 // TODO(cpu): Move this handler to a common place.
@@ -69,6 +81,23 @@ mx_status_t BadHandle() {
     }
     return ERR_BAD_HANDLE;
 }
+
+// Looks at the signals state of |handle| as it is now, without adding an observer, to see what a
+// wait for |signals| would do: NO_ERROR or ERR_BAD_STATE if it would finish at once as satisfied or
+// unsatisfiable, ERR_NOT_READY if it would have to wait, ERR_NOT_SUPPORTED if it can't be waited on.
+// This saves taking the state tracker's lock twice when the answer is already in.
+status_t PeekWait(Handle* handle, mx_signals_t signals, mx_signals_state_t* signals_state) {
+    auto state_tracker = handle->dispatcher()->get_state_tracker();
+    if (!state_tracker || !state_tracker->is_waitable())
+        return ERR_NOT_SUPPORTED;
+
+    *signals_state = state_tracker->GetSignalsState();
+    if (signals_state->satisfied & signals)
+        return NO_ERROR;
+    if (!(signals_state->satisfiable & signals))
+        return ERR_BAD_STATE;
+    return ERR_NOT_READY;
+}
 }
 
 void sys_exit(int retcode) {
@@ -93,7 +122,7 @@ uint sys_num_cpus(void) {
 }
 
 uint64_t sys_current_time() {
-    return current_time_hires() * 1000;  // microseconds to nanoseconds
+    return current_time_ns();
 }
 
 mx_status_t sys_handle_wait_one(mx_handle_t handle_value,
@@ -106,6 +135,8 @@ mx_status_t sys_handle_wait_one(mx_handle_t handle_value,
 
     status_t result;
     WaitStateObserver wait_state_observer;
+    mx_signals_state_t signals_state;
+    bool finished = false;
 
     {
         auto up = ProcessDispatcher::GetCurrent();
@@ -117,19 +148,30 @@ mx_status_t sys_handle_wait_one(mx_handle_t handle_value,
         if (!magenta_rights_check(handle->rights(), MX_RIGHT_READ))
             return ERR_ACCESS_DENIED;
 
-        result = wait_state_observer.Begin(&event, handle, signals, 0u);
-        if (result != NO_ERROR)
+        result = PeekWait(handle, signals, &signals_state);
+        if (result == ERR_NOT_SUPPORTED)
             return result;
+        if (result == ERR_NOT_READY && timeout == 0ull)
+            result = ERR_TIMED_OUT;
+
+        finished = (result != ERR_NOT_READY);
+        if (!finished) {
+            result = wait_state_observer.Begin(&event, handle, signals, 0u);
+            if (result != NO_ERROR)
+                return result;
+        }
     }
 
-    lk_time_t t = mx_time_to_lk(timeout);
-    if ((timeout > 0ull) && (t == 0u))
-        t = 1u;
+    if (!finished) {
+        lk_time_t t = mx_time_to_lk(timeout);
+        if ((timeout > 0ull) && (t == 0u))
+            t = 1u;
 
-    result = WaitEvent::ResultToStatus(event.Wait(t, nullptr));
+        result = WaitEvent::ResultToStatus(event.Wait(t, nullptr));
 
-    // Regardless of wait outcome, we must call End().
-    auto signals_state = wait_state_observer.End();
+        // Regardless of wait outcome, we must call End().
+        signals_state = wait_state_observer.End();
+    }
 
     if (_signals_state) {
         if (copy_to_user(_signals_state, &signals_state, sizeof(signals_state)) != NO_ERROR)
@@ -162,40 +204,95 @@ mx_status_t sys_handle_wait_many(uint32_t count,
     uint32_t max_size = kMaxWaitHandleCount * sizeof(uint32_t);
     uint32_t bytes_size = static_cast<uint32_t>(sizeof(uint32_t) * count);
 
-    uint8_t* copy;
-    status_t result;
-
-    result = magenta_copy_user_dynamic(_handle_values, &copy, bytes_size, max_size);
-    if (result != NO_ERROR)
-        return result;
-    utils::unique_ptr<int32_t[]> handle_values(reinterpret_cast<mx_handle_t*>(copy));
+    mx_handle_t inline_handle_values[kInlineWaitHandleCount];
+    mx_signals_t inline_signals[kInlineWaitHandleCount];
+    mx_signals_state_t inline_signals_states[kInlineWaitHandleCount];
+    utils::unique_ptr<int32_t[]> handle_values_buffer;
+    utils::unique_ptr<uint32_t[]> signals_buffer;
+    utils::unique_ptr<mx_signals_state_t[]> signals_states_buffer;
 
-    result = magenta_copy_user_dynamic(_signals, &copy, bytes_size, max_size);
-    if (result != NO_ERROR)
-        return result;
-    utils::unique_ptr<uint32_t[]> signals(reinterpret_cast<mx_signals_t*>(copy));
+    mx_handle_t* handle_values = inline_handle_values;
+    mx_signals_t* signals = inline_signals;
+    mx_signals_state_t* signals_states = nullptr;
+    status_t result;
 
-    AllocChecker ac;
-    utils::unique_ptr<WaitStateObserver[]> wait_state_observers(new (&ac) WaitStateObserver[count]);
-    if (!ac.check())
-        return ERR_NO_MEMORY;
+    if (count > kInlineWaitHandleCount) {
+        uint8_t* copy;
+        result = magenta_copy_user_dynamic(_handle_values, &copy, bytes_size, max_size);
+        if (result != NO_ERROR)
+            return result;
+        handle_values_buffer.reset(reinterpret_cast<mx_handle_t*>(copy));
+        handle_values = handle_values_buffer.get();
 
-    utils::unique_ptr<mx_signals_state_t[]> signals_states;
-    if (_signals_states) {
-        signals_states.reset(new (&ac) mx_signals_state_t[count]);
-        if (!ac.check())
-            return ERR_NO_MEMORY;
+        result = magenta_copy_user_dynamic(_signals, &copy, bytes_size, max_size);
+        if (result != NO_ERROR)
+            return result;
+        signals_buffer.reset(reinterpret_cast<mx_signals_t*>(copy));
+        signals = signals_buffer.get();
+
+        if (_signals_states) {
+            AllocChecker ac;
+            signals_states_buffer.reset(new (&ac) mx_signals_state_t[count]);
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+            signals_states = signals_states_buffer.get();
+        }
+    } else {
+        if (copy_from_user(handle_values, _handle_values, bytes_size) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        if (copy_from_user(signals, _signals, bytes_size) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        if (_signals_states)
+            signals_states = inline_signals_states;
     }
 
+    // Observers are only needed once nothing turns out to be ready already.
+    WaitStateObserver inline_observers[kInlineWaitHandleCount];
+    utils::unique_ptr<WaitStateObserver[]> observers_buffer;
+    WaitStateObserver* wait_state_observers = inline_observers;
+
     WaitEvent event;
 
     // We may need to unwind (which can be done outside the lock).
     result = NO_ERROR;
     size_t num_added = 0;
+    // The first handle the wait is already done for, if any, going by the signals as they are.
+    uint32_t ready_index = count;
+    status_t ready_result = ERR_TIMED_OUT;
     {
         auto up = ProcessDispatcher::GetCurrent();
         AutoLock lock(up->handle_table_lock());
 
+        // Check every handle first, and see whether we can finish without adding observers.
+        for (uint32_t ix = 0; ix != count; ++ix) {
+            Handle* handle = up->GetHandle_NoLock(handle_values[ix]);
+            if (!handle)
+                return BadHandle();
+            if (!magenta_rights_check(handle->rights(), MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            mx_signals_state_t signals_state;
+            status_t peek_result = PeekWait(handle, signals[ix], &signals_state);
+            if (peek_result == ERR_NOT_SUPPORTED)
+                return peek_result;
+            if (signals_states)
+                signals_states[ix] = signals_state;
+            if (peek_result != ERR_NOT_READY && ready_index == count) {
+                ready_index = ix;
+                ready_result = peek_result;
+            }
+        }
+
+        if (ready_index != count || timeout == 0ull) {
+            num_added = count;  // Nothing to wait for, so no observers to add.
+        } else if (count > kInlineWaitHandleCount) {
+            AllocChecker ac;
+            observers_buffer.reset(new (&ac) WaitStateObserver[count]);
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+            wait_state_observers = observers_buffer.get();
+        }
+
         for (; num_added != count; ++num_added) {
             Handle* handle = up->GetHandle_NoLock(handle_values[num_added]);
             if (!handle) {
@@ -220,28 +317,36 @@ mx_status_t sys_handle_wait_many(uint32_t count,
         return result;
     }
 
-    lk_time_t t = mx_time_to_lk(timeout);
-    if ((timeout > 0ull) && (t == 0u))
-        t = 1u;
-
     uint64_t context = -1;
-    WaitEvent::Result wait_event_result = event.Wait(t, &context);
-    result = WaitEvent::ResultToStatus(wait_event_result);
-
-    // Regardless of wait outcome, we must call End().
-    for (size_t ix = 0; ix != count; ++ix) {
-        auto s = wait_state_observers[ix].End();
-        if (signals_states)
-            signals_states[ix] = s;
+    bool have_context = false;
+    if (ready_index != count || timeout == 0ull) {
+        result = ready_result;
+        context = ready_index;
+        have_context = (ready_index != count);
+    } else {
+        lk_time_t t = mx_time_to_lk(timeout);
+        if ((timeout > 0ull) && (t == 0u))
+            t = 1u;
+
+        WaitEvent::Result wait_event_result = event.Wait(t, &context);
+        result = WaitEvent::ResultToStatus(wait_event_result);
+        have_context = WaitEvent::HaveContextForResult(wait_event_result);
+
+        // Regardless of wait outcome, we must call End().
+        for (size_t ix = 0; ix != count; ++ix) {
+            auto s = wait_state_observers[ix].End();
+            if (signals_states)
+                signals_states[ix] = s;
+        }
     }
 
-    if (_result_index && WaitEvent::HaveContextForResult(wait_event_result)) {
+    if (_result_index && have_context) {
         if (copy_to_user_u32(_result_index, static_cast<uint32_t>(context)) != NO_ERROR)
             return ERR_INVALID_ARGS;
     }
 
     if (_signals_states) {
-        if (copy_to_user(_signals_states, signals_states.get(),
+        if (copy_to_user(_signals_states, signals_states,
                          sizeof(mx_signals_state_t) * count) != NO_ERROR)
             return ERR_INVALID_ARGS;
     }
@@ -284,10 +389,116 @@ mx_handle_t sys_handle_duplicate(mx_handle_t handle_value, mx_rights_t rights) {
     if (!dest)
         return ERR_NO_MEMORY;
 
-    mx_handle_t dup_hv = up->MapHandleToValue(dest.get());
+    return up->AddHandle(utils::move(dest));
+}
+
+mx_status_t sys_handle_close_many(const mx_handle_t* _handles, uint32_t count) {
+    LTRACEF("count %u\n", count);
+
+    if (count == 0u)
+        return NO_ERROR;
+    if (!_handles)
+        return ERR_INVALID_ARGS;
+    if (count > kMaxMessageHandles)
+        return ERR_TOO_BIG;
+
+    uint8_t* copy;
+    status_t result = magenta_copy_user_dynamic(_handles, &copy, count * sizeof(mx_handle_t),
+                                                kMaxMessageHandles * sizeof(mx_handle_t));
+    if (result != NO_ERROR)
+        return result;
+    utils::unique_ptr<mx_handle_t[]> handle_values(reinterpret_cast<mx_handle_t*>(copy));
+
+    // MX_HANDLE_INVALID entries are skipped rather than bad
+    uint32_t expected = 0u;
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        if (handle_values[ix] != MX_HANDLE_INVALID)
+            ++expected;
+    }
+
+    AllocChecker ac;
+    utils::unique_ptr<Handle*[]> handles(new (&ac) Handle*[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    uint32_t removed;
+    {
+        AutoLock lock(up->handle_table_lock());
+        removed = up->RemoveHandles_NoLock(handle_values.get(), count, handles.get());
+    }
+
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        if (handles[ix])
+            DeleteHandle(handles[ix]);
+    }
+
+    if (removed != expected)
+        return BadHandle();
+    return NO_ERROR;
+}
+
+mx_status_t sys_handle_duplicate_many(const mx_handle_t* _handles, uint32_t count,
+                                      mx_rights_t rights, mx_handle_t* _out) {
+    LTRACEF("count %u\n", count);
+
+    if (count == 0u)
+        return NO_ERROR;
+    if (!_handles || !_out)
+        return ERR_INVALID_ARGS;
+    if (count > kMaxMessageHandles)
+        return ERR_TOO_BIG;
+
+    uint8_t* copy;
+    status_t result = magenta_copy_user_dynamic(_handles, &copy, count * sizeof(mx_handle_t),
+                                                kMaxMessageHandles * sizeof(mx_handle_t));
+    if (result != NO_ERROR)
+        return result;
+    utils::unique_ptr<mx_handle_t[]> handle_values(reinterpret_cast<mx_handle_t*>(copy));
+
+    AllocChecker ac;
+    utils::unique_ptr<HandleUniquePtr[]> dups(new (&ac) HandleUniquePtr[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    {
+        // Any duplicates made before bailing out are deleted with |dups|,
+        // once the lock has been dropped.
+        AutoLock lock(up->handle_table_lock());
+
+        for (uint32_t ix = 0; ix != count; ++ix) {
+            Handle* source = up->GetHandle_NoLock(handle_values[ix]);
+            if (!source)
+                return BadHandle();
+
+            if (!magenta_rights_check(source->rights(), MX_RIGHT_DUPLICATE))
+                return ERR_ACCESS_DENIED;
+            mx_rights_t dup_rights = source->rights();
+            if (rights != MX_RIGHT_SAME_RIGHTS) {
+                if ((source->rights() & rights) != rights)
+                    return ERR_INVALID_ARGS;
+                dup_rights = rights;
+            }
+
+            dups[ix].reset(DupHandle(source, dup_rights));
+            if (!dups[ix])
+                return ERR_NO_MEMORY;
+        }
+
+        // the values of the new handles go back out through |handle_values|
+        result = up->AddHandles_NoLock(dups.get(), count, handle_values.get());
+        if (result != NO_ERROR)
+            return result;
+    }
 
-    up->AddHandle(utils::move(dest));
-    return dup_hv;
+    if (copy_to_user(_out, handle_values.get(), count * sizeof(mx_handle_t)) != NO_ERROR) {
+        // the caller can't learn the new values, so don't leak them
+        for (uint32_t ix = 0; ix != count; ++ix)
+            dups[ix] = up->RemoveHandle(handle_values[ix]);
+        return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
 }
 
 mx_ssize_t sys_handle_get_info(mx_handle_t handle, uint32_t topic, void* _info, mx_size_t info_size) {
@@ -346,48 +557,184 @@ mx_ssize_t sys_handle_get_info(mx_handle_t handle, uint32_t topic, void* _info,
 
             return sizeof(mx_process_info_t);
         }
-        default:
-            return ERR_INVALID_ARGS;
-    }
-}
+        case MX_INFO_PROCESS_MEMORY: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
 
-mx_status_t sys_object_get_property(mx_handle_t handle_value, uint32_t property,
-                                    void* _value, mx_size_t size) {
-    if (!_value)
-        return ERR_INVALID_ARGS;
+            if (info_size < sizeof(mx_process_memory_info_t))
+                return ERR_NOT_ENOUGH_BUFFER;
 
-    auto up = ProcessDispatcher::GetCurrent();
-    utils::RefPtr<Dispatcher> dispatcher;
-    uint32_t rights;
+            auto process = dispatcher->get_process_dispatcher();
+            if (!process)
+                return ERR_WRONG_TYPE;
 
-    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
-        return BadHandle();
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
 
-    // TODO:cpu use 'get-info' rights when avaliable.
-    if (!magenta_rights_check(rights, MX_RIGHT_READ))
-        return ERR_ACCESS_DENIED;
+            mx_process_memory_info_t info;
+            auto err = process->GetMemoryInfo(&info);
+            if (err != NO_ERROR)
+                return err;
 
-    switch (property) {
-        case MX_PROP_BAD_HANDLE_POLICY: {
-            if (size != sizeof(uint32_t))
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), &info, sizeof(info)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return sizeof(mx_process_memory_info_t);
+        }
+        case MX_INFO_VMO: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            if (info_size < sizeof(mx_vmo_info_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+
+            auto vmo = dispatcher->get_vm_object_dispatcher();
+            if (!vmo)
+                return ERR_WRONG_TYPE;
+
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            mx_vmo_info_t info;
+            auto err = vmo->GetInfo(&info);
+            if (err != NO_ERROR)
+                return err;
+
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), &info, sizeof(info)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return sizeof(mx_vmo_info_t);
+        }
+        case MX_INFO_MSG_PIPE: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            if (info_size < sizeof(mx_msg_pipe_info_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+
+            auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
+            if (!msg_pipe)
+                return ERR_WRONG_TYPE;
+
+            mx_msg_pipe_info_t info;
+            msg_pipe->GetInfo(&info);
+
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), &info, sizeof(info)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return sizeof(mx_msg_pipe_info_t);
+        }
+        case MX_INFO_SYSCALL_STATS: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            size_t max_stats = info_size / sizeof(mx_syscall_stats_t);
+            if (max_stats > kMaxSyscallStats)
+                max_stats = kMaxSyscallStats;
+
+            AllocChecker ac;
+            utils::unique_ptr<mx_syscall_stats_t[]> stats(new (&ac) mx_syscall_stats_t[max_stats]);
+            if (!ac.check())
+                return ERR_NO_MEMORY;
+
+            mx_ssize_t count = syscall_stats_get(stats.get(), max_stats);
+            if (count < 0)
+                return count;
+
+            size_t size = count * sizeof(mx_syscall_stats_t);
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), stats.get(), size) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return size;
+        }
+        case MX_INFO_THREAD_STATS: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            if (info_size < sizeof(mx_thread_stats_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+
+            auto thread = dispatcher->get_thread_dispatcher();
+            if (!thread)
+                return ERR_WRONG_TYPE;
+
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            mx_thread_stats_t info;
+            thread->thread()->GetStats(&info);
+
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), &info, sizeof(info)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return sizeof(mx_thread_stats_t);
+        }
+        case MX_INFO_PROCESS_STATS: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            if (info_size < sizeof(mx_thread_stats_t))
                 return ERR_NOT_ENOUGH_BUFFER;
+
             auto process = dispatcher->get_process_dispatcher();
             if (!process)
                 return ERR_WRONG_TYPE;
-            uint32_t value = process->get_bad_handle_policy();
-            if (copy_to_user_u32(reinterpret_cast<uint32_t*>(_value), value) != NO_ERROR)
+
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            mx_thread_stats_t info;
+            auto err = process->GetThreadStats(&info);
+            if (err != NO_ERROR)
+                return err;
+
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), &info, sizeof(info)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return sizeof(mx_thread_stats_t);
+        }
+        case MX_INFO_PROCESS_HANDLE_STATS: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            if (info_size < sizeof(mx_process_handle_stats_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+
+            auto process = dispatcher->get_process_dispatcher();
+            if (!process)
+                return ERR_WRONG_TYPE;
+
+            if (!magenta_rights_check(rights, MX_RIGHT_READ))
+                return ERR_ACCESS_DENIED;
+
+            mx_process_handle_stats_t info = {};
+            process->HandleStats(info.handle_count, countof(info.handle_count));
+
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), &info, sizeof(info)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+
+            return sizeof(mx_process_handle_stats_t);
+        }
+        case MX_INFO_OBJECT_STATS: {
+            if (!_info)
+                return ERR_INVALID_ARGS;
+
+            mx_object_stats_t stats[MX_OBJ_TYPE_LAST];
+            size_t count = Dispatcher::GetObjectStats(stats, info_size / sizeof(stats[0]));
+
+            size_t size = count * sizeof(stats[0]);
+            if (copy_to_user(reinterpret_cast<uint8_t*>(_info), stats, size) != NO_ERROR)
                 return ERR_INVALID_ARGS;
 
+            return size;
         }
         default:
             return ERR_INVALID_ARGS;
     }
-
-    return NO_ERROR;
 }
 
-mx_status_t sys_object_set_property(mx_handle_t handle_value, uint32_t property,
-                                    const void* _value, mx_size_t size) {
+mx_status_t sys_object_get_property(mx_handle_t handle_value, uint32_t property,
+                                    void* _value, mx_size_t size) {
     if (!_value)
         return ERR_INVALID_ARGS;
 
@@ -398,30 +745,262 @@ mx_status_t sys_object_set_property(mx_handle_t handle_value, uint32_t property,
     if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
         return BadHandle();
 
-    // TODO:cpu use 'set-info' rights when avaliable.
+    // TODO:cpu use 'get-info' rights when avaliable.
     if (!magenta_rights_check(rights, MX_RIGHT_READ))
         return ERR_ACCESS_DENIED;
 
-    mx_status_t status = ERR_INVALID_ARGS;
-
     switch (property) {
         case MX_PROP_BAD_HANDLE_POLICY: {
-            if (size < sizeof(uint32_t))
+            if (size != sizeof(uint32_t))
                 return ERR_NOT_ENOUGH_BUFFER;
             auto process = dispatcher->get_process_dispatcher();
             if (!process)
                 return ERR_WRONG_TYPE;
-            uint32_t value = 0;
-            if (copy_from_user_u32(&value, reinterpret_cast<const uint32_t*>(_value)) != NO_ERROR)
+            uint32_t value = process->get_bad_handle_policy();
+            if (copy_to_user_u32(reinterpret_cast<uint32_t*>(_value), value) != NO_ERROR)
                 return ERR_INVALID_ARGS;
-            status = process->set_bad_handle_policy(value);
             break;
         }
-    }
-
-    return status;
-}
-
+        case MX_PROP_MSG_PIPE_MAX_MESSAGES:
+        case MX_PROP_MSG_PIPE_MAX_BYTES: {
+            if (size != sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
+            if (!msg_pipe)
+                return ERR_WRONG_TYPE;
+            uint32_t max_messages, max_bytes;
+            msg_pipe->GetQueueLimits(&max_messages, &max_bytes);
+            uint32_t value = (property == MX_PROP_MSG_PIPE_MAX_MESSAGES) ? max_messages : max_bytes;
+            if (copy_to_user_u32(reinterpret_cast<uint32_t*>(_value), value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            break;
+        }
+        case MX_PROP_IO_PORT_DEPTH: {
+            if (size != sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto ioport = dispatcher->get_io_port_dispatcher();
+            if (!ioport)
+                return ERR_WRONG_TYPE;
+            uint32_t value = ioport->GetDepth();
+            if (copy_to_user_u32(reinterpret_cast<uint32_t*>(_value), value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            break;
+        }
+        case MX_PROP_THREAD_DEADLINE: {
+            if (size != sizeof(mx_thread_deadline_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto thread = dispatcher->get_thread_dispatcher();
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_thread_deadline_t value;
+            thread->thread()->GetDeadline(&value);
+            if (copy_to_user(_value, &value, sizeof(value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            break;
+        }
+        case MX_PROP_THREAD_AFFINITY: {
+            if (size != sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto thread = dispatcher->get_thread_dispatcher();
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            uint32_t value = thread->thread()->GetAffinity();
+            if (copy_to_user_u32(reinterpret_cast<uint32_t*>(_value), value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            break;
+        }
+        case MX_PROP_THREAD_TIMER_SLACK: {
+            if (size != sizeof(mx_time_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto thread = dispatcher->get_thread_dispatcher();
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_time_t value = thread->thread()->GetTimerSlack();
+            if (copy_to_user(_value, &value, sizeof(value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            break;
+        }
+        case MX_PROP_VMO_COMPRESSIBLE: {
+            if (size != sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto vmo = dispatcher->get_vm_object_dispatcher();
+            if (!vmo)
+                return ERR_WRONG_TYPE;
+            uint32_t value = vmo->GetCompressible() ? 1u : 0u;
+            if (copy_to_user_u32(reinterpret_cast<uint32_t*>(_value), value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            break;
+        }
+        default:
+            return ERR_INVALID_ARGS;
+    }
+
+    return NO_ERROR;
+}
+
+mx_status_t sys_object_set_property(mx_handle_t handle_value, uint32_t property,
+                                    const void* _value, mx_size_t size) {
+    if (!_value)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+
+    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
+        return BadHandle();
+
+    // TODO:cpu use 'set-info' rights when avaliable.
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    mx_status_t status = ERR_INVALID_ARGS;
+
+    switch (property) {
+        case MX_PROP_BAD_HANDLE_POLICY: {
+            if (size < sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto process = dispatcher->get_process_dispatcher();
+            if (!process)
+                return ERR_WRONG_TYPE;
+            uint32_t value = 0;
+            if (copy_from_user_u32(&value, reinterpret_cast<const uint32_t*>(_value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            status = process->set_bad_handle_policy(value);
+            break;
+        }
+        case MX_PROP_MSG_PIPE_MAX_MESSAGES:
+        case MX_PROP_MSG_PIPE_MAX_BYTES: {
+            if (size < sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
+            if (!msg_pipe)
+                return ERR_WRONG_TYPE;
+            uint32_t value = 0;
+            if (copy_from_user_u32(&value, reinterpret_cast<const uint32_t*>(_value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            if (property == MX_PROP_MSG_PIPE_MAX_MESSAGES)
+                msg_pipe->SetMaxQueuedMessages(value);
+            else
+                msg_pipe->SetMaxQueuedBytes(value);
+            status = NO_ERROR;
+            break;
+        }
+        case MX_PROP_IO_PORT_DEPTH: {
+            if (size < sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            auto ioport = dispatcher->get_io_port_dispatcher();
+            if (!ioport)
+                return ERR_WRONG_TYPE;
+            uint32_t value = 0;
+            if (copy_from_user_u32(&value, reinterpret_cast<const uint32_t*>(_value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            status = ioport->SetDepth(value);
+            break;
+        }
+        case MX_PROP_THREAD_DEADLINE: {
+            if (size < sizeof(mx_thread_deadline_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
+            auto thread = dispatcher->get_thread_dispatcher();
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_thread_deadline_t value;
+            if (copy_from_user(&value, _value, sizeof(value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            status = thread->thread()->SetDeadline(value);
+            break;
+        }
+        case MX_PROP_THREAD_AFFINITY: {
+            if (size < sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
+            auto thread = dispatcher->get_thread_dispatcher();
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            uint32_t value = 0;
+            if (copy_from_user_u32(&value, reinterpret_cast<const uint32_t*>(_value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            status = thread->thread()->SetAffinity(value);
+            break;
+        }
+        case MX_PROP_THREAD_TIMER_SLACK: {
+            if (size < sizeof(mx_time_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
+            auto thread = dispatcher->get_thread_dispatcher();
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_time_t value;
+            if (copy_from_user(&value, _value, sizeof(value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            thread->thread()->SetTimerSlack(value);
+            status = NO_ERROR;
+            break;
+        }
+        case MX_PROP_VMO_COMPRESSIBLE: {
+            if (size < sizeof(uint32_t))
+                return ERR_NOT_ENOUGH_BUFFER;
+            if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+                return ERR_ACCESS_DENIED;
+            auto vmo = dispatcher->get_vm_object_dispatcher();
+            if (!vmo)
+                return ERR_WRONG_TYPE;
+            uint32_t value = 0;
+            if (copy_from_user_u32(&value, reinterpret_cast<const uint32_t*>(_value)) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            if (value > 1u)
+                return ERR_INVALID_ARGS;
+            status = vmo->SetCompressible(value != 0u);
+            break;
+        }
+    }
+
+    return status;
+}
+
+// Copies |msg| out to user memory and moves its handles into |up|. Whatever
+// is left of the message is dropped if any of that fails.
+static mx_status_t message_copy_out(ProcessDispatcher* up, utils::unique_ptr<MessagePacket> msg,
+                                    void* _bytes, mx_handle_t* _handles) {
+    if (_bytes) {
+        status_t status = msg->CopyDataToUser(_bytes);
+        if (status != NO_ERROR) {
+            // the handles go away with the message
+            return status;
+        }
+    }
+
+    // from here on the handles are ours to place or drop
+    uint32_t num_handles = msg->num_handles();
+    Handle** handle_list = msg->handles();
+    msg->ReturnHandles();
+
+    mx_status_t result = NO_ERROR;
+    for (size_t idx = 0u; idx < num_handles; ++idx) {
+        if (handle_list[idx]->dispatcher()->get_state_tracker())
+            handle_list[idx]->dispatcher()->get_state_tracker()->Cancel(handle_list[idx]);
+        HandleUniquePtr handle(handle_list[idx]);
+
+        // once we fail, the rest of the handles can only be dropped
+        if (result != NO_ERROR)
+            continue;
+
+        mx_handle_t hv = up->AddHandle(utils::move(handle));
+        if (hv < 0) {
+            result = hv;
+        } else if (copy_to_user_32(&_handles[idx], hv) != NO_ERROR) {
+            up->RemoveHandle(hv);
+            result = ERR_INVALID_ARGS;
+        }
+    }
+
+    return result;
+}
+
 mx_status_t sys_message_read(mx_handle_t handle_value, void* _bytes, uint32_t* _num_bytes,
                              mx_handle_t* _handles, uint32_t* _num_handles, uint32_t flags) {
     LTRACEF("handle %d bytes %p num_bytes %p handles %p num_handles %p flags 0x%x\n",
@@ -444,30 +1023,20 @@ mx_status_t sys_message_read(mx_handle_t handle_value, void* _bytes, uint32_t* _
     uint32_t num_bytes = 0;
     uint32_t num_handles = 0;
 
-    if (_num_bytes) {
-        if (copy_from_user_u32(&num_bytes, _num_bytes) != NO_ERROR)
-            return ERR_INVALID_ARGS;
-    }
-
-    if (_num_handles) {
-        if (copy_from_user_u32(&num_handles, _num_handles) != NO_ERROR)
-            return ERR_INVALID_ARGS;
-    }
+    user_copy_vec_t counts[2];
+    size_t num_counts = 0u;
+    if (_num_bytes)
+        counts[num_counts++] = {&num_bytes, _num_bytes, sizeof(num_bytes)};
+    if (_num_handles)
+        counts[num_counts++] = {&num_handles, _num_handles, sizeof(num_handles)};
+    if (copy_from_user_many(counts, num_counts) != NO_ERROR)
+        return ERR_INVALID_ARGS;
 
     if (_bytes != 0u && !_num_bytes)
         return ERR_INVALID_ARGS;
     if (_handles != 0u && !_num_handles)
         return ERR_INVALID_ARGS;
 
-    utils::unique_ptr<uint32_t[]> handles;
-
-    AllocChecker ac;
-    if (num_handles) {
-        handles.reset(new (&ac) uint32_t[num_handles]());
-        if (!ac.check())
-            return ERR_NO_MEMORY;
-    }
-
     uint32_t next_message_size = 0u;
     uint32_t next_message_num_handles = 0u;
     status_t result = msg_pipe->BeginRead(&next_message_size, &next_message_num_handles);
@@ -475,73 +1044,45 @@ mx_status_t sys_message_read(mx_handle_t handle_value, void* _bytes, uint32_t* _
         return result;
 
     // Always set the actual size and handle count so the caller can provide larger buffers.
-    if (_num_bytes) {
-        if (copy_to_user_u32(_num_bytes, next_message_size) != NO_ERROR)
-            return ERR_INVALID_ARGS;
-    }
-    if (_num_handles) {
-        if (copy_to_user_u32(_num_handles, next_message_num_handles) != NO_ERROR)
-            return ERR_INVALID_ARGS;
-    }
+    num_counts = 0u;
+    if (_num_bytes)
+        counts[num_counts++] = {_num_bytes, &next_message_size, sizeof(next_message_size)};
+    if (_num_handles)
+        counts[num_counts++] = {_num_handles, &next_message_num_handles,
+                                sizeof(next_message_num_handles)};
+    if (copy_to_user_many(counts, num_counts) != NO_ERROR)
+        return ERR_INVALID_ARGS;
 
     // If the caller provided buffers are too small, abort the read so the caller can try again.
     if (num_bytes < next_message_size || num_handles < next_message_num_handles)
         return ERR_NOT_ENOUGH_BUFFER;
 
     // OK, now we can accept the message.
-    utils::Array<uint8_t> bytes;
-    utils::Array<Handle*> handle_list;
-
-    result = msg_pipe->AcceptRead(&bytes, &handle_list);
-
-    if (_bytes) {
-        if (copy_to_user(reinterpret_cast<uint8_t*>(_bytes), bytes.get(), num_bytes) != NO_ERROR) {
-            // $$$ free handles.
-            return ERR_INVALID_ARGS;
-        }
-    }
-
-    if (next_message_num_handles != 0u) {
-        for (size_t ix = 0u; ix < next_message_num_handles; ++ix) {
-            auto hv = up->MapHandleToValue(handle_list[ix]);
-            if (copy_to_user_32(&_handles[ix], hv) != NO_ERROR) {
-                // $$$ free handles.
-                return ERR_INVALID_ARGS;
-            }
-        }
-    }
-
-    for (size_t idx = 0u; idx < next_message_num_handles; ++idx) {
-        if (handle_list[idx]->dispatcher()->get_state_tracker())
-            handle_list[idx]->dispatcher()->get_state_tracker()->Cancel(handle_list[idx]);
-        HandleUniquePtr handle(handle_list[idx]);
-        up->AddHandle(utils::move(handle));
-    }
+    utils::unique_ptr<MessagePacket> msg;
+    result = msg_pipe->AcceptRead(&msg);
+    if (result != NO_ERROR)
+        return result;
 
-    return result;
+    return message_copy_out(up, utils::move(msg), _bytes, _handles);
 }
 
-mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint32_t num_bytes,
-                              const mx_handle_t* _handles, uint32_t num_handles, uint32_t flags) {
-    LTRACEF("handle %d bytes %p num_bytes %u handles %p num_handles %u flags 0x%x\n",
-            handle_value, _bytes, num_bytes, _handles, num_handles, flags);
-
-    auto up = ProcessDispatcher::GetCurrent();
-
-    utils::RefPtr<Dispatcher> dispatcher;
-    uint32_t rights;
-    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
-        return BadHandle();
-
-    auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
-    if (!msg_pipe)
-        return ERR_WRONG_TYPE;
+// The handle values of a message being written. Short lists are read onto
+// the stack.
+struct UserHandleValues {
+    mx_handle_t inline_values[MessagePacket::kInlineHandleCount];
+    utils::unique_ptr<mx_handle_t[], utils::free_delete> buffer;
+    mx_handle_t* values = inline_values;
+};
 
+// Builds a message for |msg_pipe| out of user memory, taking its handles out
+// of |up|. The handle values are kept in |handles| for message_undo_write().
+static mx_status_t message_copy_in(ProcessDispatcher* up, MessagePipeDispatcher* msg_pipe,
+                                   const void* _bytes, uint32_t num_bytes,
+                                   const mx_handle_t* _handles, uint32_t num_handles,
+                                   UserHandleValues* handle_values,
+                                   utils::unique_ptr<MessagePacket>* out_msg) {
     bool is_reply_pipe = msg_pipe->is_reply_pipe();
 
-    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
-        return ERR_ACCESS_DENIED;
-
     if (num_bytes != 0u && !_bytes)
         return ERR_INVALID_ARGS;
     if (num_handles != 0u && !_handles)
@@ -552,19 +1093,13 @@ mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint
     if (num_handles > kMaxMessageHandles)
         return ERR_TOO_BIG;
 
-    status_t result;
-    utils::Array<uint8_t> bytes;
-
-    if (num_bytes) {
-        uint8_t* copy;
-        result = magenta_copy_user_dynamic(_bytes, &copy, num_bytes, kMaxMessageSize);
-        if (result != NO_ERROR)
-            return result;
-        bytes.reset(copy, num_bytes);
-    }
+    utils::unique_ptr<MessagePacket> msg;
+    status_t result = MessagePacket::CreateFromUser(_bytes, num_bytes, num_handles, &msg);
+    if (result != NO_ERROR)
+        return result;
 
-    utils::unique_ptr<mx_handle_t[], utils::free_delete> handles;
-    if (num_handles) {
+    mx_handle_t* handles = handle_values->values;
+    if (num_handles > MessagePacket::kInlineHandleCount) {
         void* c_handles;
         status_t status = copy_from_user_dynamic(
             &c_handles, _handles, num_handles * sizeof(_handles[0]), kMaxMessageHandles);
@@ -572,13 +1107,15 @@ mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint
         if (status != NO_ERROR)
             return status;
 
-        handles.reset(static_cast<mx_handle_t*>(c_handles));
+        handle_values->buffer.reset(static_cast<mx_handle_t*>(c_handles));
+        handles = handle_values->values = handle_values->buffer.get();
+    } else if (num_handles) {
+        if (copy_from_user(handles, _handles, num_handles * sizeof(_handles[0])) != NO_ERROR)
+            return ERR_INVALID_ARGS;
     }
 
-    AllocChecker ac;
-    utils::Array<Handle*> handle_list(new (&ac) Handle*[num_handles], num_handles);
-    if (!ac.check())
-        return ERR_NO_MEMORY;
+    // the message owns each handle once it's taken out of the table
+    Handle** handle_list = msg->handles();
 
     {
         // Loop twice, first we collect and validate handles, the second pass
@@ -592,7 +1129,7 @@ mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint
             if (!handle)
                 return BadHandle();
 
-            if (handle->dispatcher() == dispatcher) {
+            if (handle->dispatcher().get() == msg_pipe) {
                 // Found itself, which is only allowed for MX_FLAG_REPLY_PIPE (aka Reply) pipes.
                 if (!is_reply_pipe) {
                     return ERR_NOT_SUPPORTED;
@@ -603,8 +1140,6 @@ mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint
 
             if (!magenta_rights_check(handle->rights(), MX_RIGHT_TRANSFER))
                 return ERR_ACCESS_DENIED;
-
-            handle_list[ix] = handle;
         }
 
         if (is_reply_pipe) {
@@ -619,23 +1154,287 @@ mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint
             // If we've already seen this handle flag an error.
             if (!handle) {
                 // Put back the handles we've already removed.
+                msg->ReturnHandles();
                 for (size_t idx = 0; idx < ix; ++idx) {
-                    up->UndoRemoveHandle_NoLock(handles[idx]);
+                    up->UndoRemoveHandle_NoLock(handles[idx], handle_list[idx]);
                 }
                 // TODO: more specific error?
                 return ERR_INVALID_ARGS;
             }
+            handle_list[ix] = handle;
         }
     }
 
-    result = msg_pipe->Write(utils::move(bytes), utils::move(handle_list));
+    *out_msg = utils::move(msg);
+    return NO_ERROR;
+}
+
+// Puts the handles of a message that couldn't be sent back into |up|.
+static void message_undo_write(ProcessDispatcher* up, const UserHandleValues& handle_values,
+                               MessagePacket* msg) {
+    uint32_t num_handles = msg->num_handles();
+    msg->ReturnHandles();
+
+    AutoLock lock(up->handle_table_lock());
+    for (size_t ix = 0; ix != num_handles; ++ix) {
+        up->UndoRemoveHandle_NoLock(handle_values.values[ix], msg->handles()[ix]);
+    }
+}
+
+mx_status_t sys_message_write(mx_handle_t handle_value, const void* _bytes, uint32_t num_bytes,
+                              const mx_handle_t* _handles, uint32_t num_handles, uint32_t flags) {
+    LTRACEF("handle %d bytes %p num_bytes %u handles %p num_handles %u flags 0x%x\n",
+            handle_value, _bytes, num_bytes, _handles, num_handles, flags);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
+        return BadHandle();
+
+    auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
+    if (!msg_pipe)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    UserHandleValues handle_values;
+    utils::unique_ptr<MessagePacket> msg;
+    status_t result = message_copy_in(up, msg_pipe, _bytes, num_bytes, _handles, num_handles,
+                                      &handle_values, &msg);
+    if (result != NO_ERROR)
+        return result;
+
+    result = msg_pipe->Write(&msg);
 
     if (result != NO_ERROR) {
         // Write failed, put back the handles into this process.
-        AutoLock lock(up->handle_table_lock());
-        for (size_t ix = 0; ix != num_handles; ++ix) {
-            up->UndoRemoveHandle_NoLock(handles[ix]);
+        message_undo_write(up, handle_values, msg.get());
+    }
+
+    return result;
+}
+
+mx_status_t sys_message_call(mx_handle_t handle_value, uint32_t flags, mx_time_t timeout,
+                             const mx_message_call_args_t* _args, uint32_t* _actual_bytes,
+                             uint32_t* _actual_handles) {
+    LTRACEF("handle %d flags 0x%x args %p\n", handle_value, flags, _args);
+
+    if (flags != 0u)
+        return ERR_INVALID_ARGS;
+
+    mx_message_call_args_t args;
+    if (copy_from_user(&args, _args, sizeof(args)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    if (args.rd_num_bytes != 0u && !args.rd_bytes)
+        return ERR_INVALID_ARGS;
+    if (args.rd_num_handles != 0u && !args.rd_handles)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
+        return BadHandle();
+
+    auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
+    if (!msg_pipe)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_READ | MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    // the transaction id goes in the first four bytes
+    if (args.wr_num_bytes < sizeof(uint32_t))
+        return ERR_INVALID_ARGS;
+
+    UserHandleValues handle_values;
+    utils::unique_ptr<MessagePacket> msg;
+    status_t result = message_copy_in(up, msg_pipe, args.wr_bytes, args.wr_num_bytes,
+                                      args.wr_handles, args.wr_num_handles, &handle_values, &msg);
+    if (result != NO_ERROR)
+        return result;
+
+    lk_time_t t = mx_time_to_lk(timeout);
+    if ((timeout > 0ull) && (t == 0u))
+        t = 1u;
+
+    utils::unique_ptr<MessagePacket> reply;
+    result = msg_pipe->Call(&msg, t, &reply);
+    if (msg) {
+        // the request never went out
+        message_undo_write(up, handle_values, msg.get());
+        return result;
+    }
+    if (result != NO_ERROR)
+        return result;
+
+    uint32_t actual_bytes = reply->data_size();
+    uint32_t actual_handles = reply->num_handles();
+    user_copy_vec_t actuals[2];
+    size_t num_actuals = 0u;
+    if (_actual_bytes)
+        actuals[num_actuals++] = {_actual_bytes, &actual_bytes, sizeof(actual_bytes)};
+    if (_actual_handles)
+        actuals[num_actuals++] = {_actual_handles, &actual_handles, sizeof(actual_handles)};
+    if (copy_to_user_many(actuals, num_actuals) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    // the reply is gone from the pipe, so unlike a read a caller with buffers
+    // that are too small can't try again
+    if (args.rd_num_bytes < reply->data_size() || args.rd_num_handles < reply->num_handles())
+        return ERR_NOT_ENOUGH_BUFFER;
+
+    return message_copy_out(up, utils::move(reply), args.rd_bytes, args.rd_handles);
+}
+
+// Copies in the message list of a batched read or write.
+static mx_status_t message_copy_in_vecs(const mx_message_vec_t* _msgs, uint32_t count,
+                                        utils::unique_ptr<mx_message_vec_t[]>* out_vecs) {
+    if (count == 0u || !_msgs)
+        return ERR_INVALID_ARGS;
+    if (count > kMaxMessageBatch)
+        return ERR_TOO_BIG;
+
+    AllocChecker ac;
+    utils::unique_ptr<mx_message_vec_t[]> vecs(new (&ac) mx_message_vec_t[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    if (copy_from_user(vecs.get(), _msgs, count * sizeof(_msgs[0])) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    *out_vecs = utils::move(vecs);
+    return NO_ERROR;
+}
+
+mx_status_t sys_message_read_many(mx_handle_t handle_value, mx_message_vec_t* _msgs,
+                                  uint32_t count, uint32_t* _actual_count, uint32_t flags) {
+    LTRACEF("handle %d msgs %p count %u flags 0x%x\n", handle_value, _msgs, count, flags);
+
+    if (flags != 0u)
+        return ERR_INVALID_ARGS;
+
+    utils::unique_ptr<mx_message_vec_t[]> vecs;
+    mx_status_t result = message_copy_in_vecs(_msgs, count, &vecs);
+    if (result != NO_ERROR)
+        return result;
+
+    MessageBufferSize sizes[kMaxMessageBatch];
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        if (vecs[ix].num_bytes != 0u && !vecs[ix].bytes)
+            return ERR_INVALID_ARGS;
+        if (vecs[ix].num_handles != 0u && !vecs[ix].handles)
+            return ERR_INVALID_ARGS;
+        sizes[ix].num_bytes = vecs[ix].num_bytes;
+        sizes[ix].num_handles = vecs[ix].num_handles;
+    }
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
+        return BadHandle();
+
+    auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
+    if (!msg_pipe)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    MessagePipe::MessageList msgs;
+    result = msg_pipe->ReadMany(sizes, count, &msgs);
+    if (result == ERR_NOT_ENOUGH_BUFFER) {
+        // like a single read, say how big the next message is and leave it
+        if (copy_to_user_u32(&_msgs[0].num_bytes, sizes[0].num_bytes) != NO_ERROR ||
+            copy_to_user_u32(&_msgs[0].num_handles, sizes[0].num_handles) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+        return ERR_NOT_ENOUGH_BUFFER;
+    }
+    if (result != NO_ERROR)
+        return result;
+
+    // the messages are off the pipe now, so after a failure the rest of them
+    // can only be dropped
+    uint32_t num_read = 0u;
+    while (!msgs.is_empty()) {
+        utils::unique_ptr<MessagePacket> msg = msgs.pop_front();
+        if (result == NO_ERROR) {
+            if (copy_to_user_u32(&_msgs[num_read].num_bytes, msg->data_size()) != NO_ERROR ||
+                copy_to_user_u32(&_msgs[num_read].num_handles, msg->num_handles()) != NO_ERROR)
+                result = ERR_INVALID_ARGS;
         }
+        if (result == NO_ERROR)
+            result = message_copy_out(up, utils::move(msg), vecs[num_read].bytes,
+                                      vecs[num_read].handles);
+        num_read++;
+    }
+    if (result != NO_ERROR)
+        return result;
+
+    if (_actual_count) {
+        if (copy_to_user_u32(_actual_count, num_read) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t sys_message_write_many(mx_handle_t handle_value, const mx_message_vec_t* _msgs,
+                                   uint32_t count, uint32_t flags) {
+    LTRACEF("handle %d msgs %p count %u flags 0x%x\n", handle_value, _msgs, count, flags);
+
+    if (flags != 0u)
+        return ERR_INVALID_ARGS;
+
+    utils::unique_ptr<mx_message_vec_t[]> vecs;
+    mx_status_t result = message_copy_in_vecs(_msgs, count, &vecs);
+    if (result != NO_ERROR)
+        return result;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
+        return BadHandle();
+
+    auto msg_pipe = dispatcher->get_message_pipe_dispatcher();
+    if (!msg_pipe)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    AllocChecker ac;
+    utils::unique_ptr<UserHandleValues[]> handle_values(new (&ac) UserHandleValues[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    MessagePipe::MessageList msgs;
+    uint32_t num_built = 0u;
+    for (; num_built != count; ++num_built) {
+        const mx_message_vec_t& vec = vecs[num_built];
+        utils::unique_ptr<MessagePacket> msg;
+        result = message_copy_in(up, msg_pipe, vec.bytes, vec.num_bytes, vec.handles,
+                                 vec.num_handles, &handle_values[num_built], &msg);
+        if (result != NO_ERROR)
+            break;
+        msgs.push_back(utils::move(msg));
+    }
+
+    // all of the messages go out or none of them do
+    if (result == NO_ERROR)
+        result = msg_pipe->WriteMany(&msgs);
+
+    if (result != NO_ERROR) {
+        uint32_t ix = 0u;
+        for (auto& msg : msgs)
+            message_undo_write(up, handle_values[ix++], &msg);
     }
 
     return result;
@@ -665,13 +1464,21 @@ mx_status_t sys_message_pipe_create(mx_handle_t out_handle[2], uint32_t flags) {
         return ERR_NO_MEMORY;
 
     auto up = ProcessDispatcher::GetCurrent();
-    mx_handle_t hv[2] = {up->MapHandleToValue(h0.get()), up->MapHandleToValue(h1.get())};
+    mx_handle_t hv[2];
+    hv[0] = up->AddHandle(utils::move(h0));
+    if (hv[0] < 0)
+        return hv[0];
+    hv[1] = up->AddHandle(utils::move(h1));
+    if (hv[1] < 0) {
+        up->RemoveHandle(hv[0]);
+        return hv[1];
+    }
 
-    if (copy_to_user(out_handle, hv, sizeof(mx_handle_t) * 2) != NO_ERROR)
+    if (copy_to_user(out_handle, hv, sizeof(mx_handle_t) * 2) != NO_ERROR) {
+        up->RemoveHandle(hv[0]);
+        up->RemoveHandle(hv[1]);
         return ERR_INVALID_ARGS;
-
-    up->AddHandle(utils::move(h0));
-    up->AddHandle(utils::move(h1));
+    }
 
     LTRACE_EXIT;
     return NO_ERROR;
@@ -705,9 +1512,7 @@ mx_handle_t sys_thread_create(int (*entry)(void*), void* arg, const char* name,
     if (!handle)
         return ERR_NO_MEMORY;
 
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 void sys_thread_exit() {
@@ -799,9 +1604,7 @@ mx_handle_t sys_process_create(const char* name, uint32_t name_len) {
         return ERR_NO_MEMORY;
 
     auto up = ProcessDispatcher::GetCurrent();
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_status_t sys_process_start(mx_handle_t handle_value, mx_handle_t arg_handle_value, mx_vaddr_t entry) {
@@ -822,8 +1625,9 @@ mx_status_t sys_process_start(mx_handle_t handle_value, mx_handle_t arg_handle_v
     if (!arg_handle_value)
         return ERR_INVALID_ARGS;
 
-    auto arg_nhv = process->MapHandleToValue(arg_handle.get());
-    process->AddHandle(utils::move(arg_handle));
+    auto arg_nhv = process->AddHandle(utils::move(arg_handle));
+    if (arg_nhv < 0)
+        return arg_nhv;
 
     // TODO(cpu) if Start() fails we want to undo RemoveHandle().
 
@@ -846,9 +1650,7 @@ mx_handle_t sys_event_create(uint32_t options) {
 
     auto up = ProcessDispatcher::GetCurrent();
 
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_status_t sys_event_signal(mx_handle_t handle_value) {
@@ -891,6 +1693,66 @@ mx_status_t sys_event_reset(mx_handle_t handle_value) {
     return event->ResetEvent();
 }
 
+mx_handle_t sys_timer_create(uint32_t options) {
+    LTRACEF("options 0x%x\n", options);
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+
+    status_t result = TimerDispatcher::Create(options, &dispatcher, &rights);
+    if (result != NO_ERROR)
+        return result;
+
+    HandleUniquePtr handle(MakeHandle(utils::move(dispatcher), rights));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    return up->AddHandle(utils::move(handle));
+}
+
+mx_status_t sys_timer_set(mx_handle_t handle_value, mx_time_t deadline, mx_time_t period,
+                          mx_time_t slack) {
+    LTRACEF("handle %u deadline %llu period %llu slack %llu\n", handle_value, deadline, period, slack);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+
+    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
+        return BadHandle();
+
+    auto timer = dispatcher->get_timer_dispatcher();
+    if (!timer)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    return timer->Set(deadline, period, slack);
+}
+
+mx_status_t sys_timer_cancel(mx_handle_t handle_value) {
+    LTRACEF("handle %u\n", handle_value);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+
+    if (!up->GetDispatcher(handle_value, &dispatcher, &rights))
+        return BadHandle();
+
+    auto timer = dispatcher->get_timer_dispatcher();
+    if (!timer)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    return timer->Cancel();
+}
+
 mx_status_t sys_object_signal(mx_handle_t handle_value, uint32_t set_mask, uint32_t clear_mask) {
     LTRACEF("handle %u\n", handle_value);
 
@@ -911,14 +1773,93 @@ mx_status_t sys_object_signal(mx_handle_t handle_value, uint32_t set_mask, uint3
     return dispatcher->UserSignal(set_mask, clear_mask);
 }
 
+mx_handle_t sys_object_get_by_koid(mx_koid_t koid) {
+    LTRACEF("koid %llu\n", koid);
+
+    utils::RefPtr<Dispatcher> dispatcher = Dispatcher::LookupByKoid(koid);
+    if (!dispatcher)
+        return ERR_NOT_FOUND;
+
+    // enough to inspect the object, nothing more
+    HandleUniquePtr handle(MakeHandle(utils::move(dispatcher), MX_RIGHT_READ));
+    if (!handle)
+        return ERR_NO_MEMORY;
+    return ProcessDispatcher::GetCurrent()->AddHandle(utils::move(handle));
+}
+
 mx_status_t sys_futex_wait(int* value_ptr, int current_value, mx_time_t timeout) {
     return ProcessDispatcher::GetCurrent()->futex_context()->FutexWait(value_ptr, current_value, timeout);
 }
 
+mx_status_t sys_futex_wait_pi(int* value_ptr, int current_value, mx_time_t timeout) {
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // The value names the thread that owns the futex.
+    mx_handle_t owner_handle = current_value & MX_FUTEX_PI_OWNER_MASK;
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(owner_handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto thread = dispatcher->get_thread_dispatcher();
+    if (!thread)
+        return ERR_WRONG_TYPE;
+
+    // Lending priority is only allowed to threads of the caller's own process.
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+    if (thread->thread()->process() != up)
+        return ERR_ACCESS_DENIED;
+
+    return up->futex_context()->FutexWaitPi(value_ptr, current_value,
+                                            utils::RefPtr<UserThread>(thread->thread()), timeout);
+}
+
 mx_status_t sys_futex_wake(int* value_ptr, uint32_t count) {
     return ProcessDispatcher::GetCurrent()->futex_context()->FutexWake(value_ptr, count);
 }
 
+// Find the vm object and offset that name the shared futex at |value_ptr| in
+// the current process.
+static mx_status_t futex_shared_key(int* value_ptr, utils::RefPtr<VmObject>* object,
+                                    uintptr_t* offset) {
+    vaddr_t va = reinterpret_cast<vaddr_t>(value_ptr);
+    if (!va || (va % sizeof(int)) != 0u)
+        return ERR_INVALID_ARGS;
+
+    uint64_t object_offset;
+    auto aspace = ProcessDispatcher::GetCurrent()->aspace();
+    if (aspace->LookupObject(va, object, &object_offset) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    if (object_offset > UINTPTR_MAX)
+        return ERR_NOT_SUPPORTED;
+
+    *offset = static_cast<uintptr_t>(object_offset);
+    return NO_ERROR;
+}
+
+mx_status_t sys_futex_wait_shared(int* value_ptr, int current_value, mx_time_t timeout) {
+    utils::RefPtr<VmObject> object;
+    uintptr_t offset;
+    mx_status_t status = futex_shared_key(value_ptr, &object, &offset);
+    if (status != NO_ERROR)
+        return status;
+
+    return FutexContext::Shared()->FutexWaitShared(value_ptr, utils::move(object), offset,
+                                                   current_value, timeout);
+}
+
+mx_status_t sys_futex_wake_shared(int* value_ptr, uint32_t count) {
+    utils::RefPtr<VmObject> object;
+    uintptr_t offset;
+    mx_status_t status = futex_shared_key(value_ptr, &object, &offset);
+    if (status != NO_ERROR)
+        return status;
+
+    return FutexContext::Shared()->FutexWakeShared(object.get(), offset, count);
+}
+
 mx_status_t sys_futex_requeue(int* wake_ptr, uint32_t wake_count, int current_value,
                               int* requeue_ptr, uint32_t requeue_count) {
     return ProcessDispatcher::GetCurrent()->futex_context()->FutexRequeue(
@@ -947,10 +1888,7 @@ mx_handle_t sys_vm_object_create(uint64_t size) {
 
     auto up = ProcessDispatcher::GetCurrent();
 
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_ssize_t sys_vm_object_read(mx_handle_t handle, void* data, uint64_t offset, mx_size_t len) {
@@ -1005,42 +1943,294 @@ mx_status_t sys_vm_object_get_size(mx_handle_t handle, uint64_t* _size) {
     if (!up->GetDispatcher(handle, &dispatcher, &rights))
         return BadHandle();
 
-    auto vmo = dispatcher->get_vm_object_dispatcher();
-    if (!vmo)
-        return ERR_WRONG_TYPE;
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    // no rights check, anyone should be able to get the size
+
+    // do the operation
+    uint64_t size = 0;
+    mx_status_t status = vmo->GetSize(&size);
+
+    // copy the size back, even if it failed
+    if (copy_to_user(reinterpret_cast<uint8_t*>(_size), &size, sizeof(size)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    return status;
+}
+
+mx_status_t sys_vm_object_set_size(mx_handle_t handle, uint64_t size) {
+    LTRACEF("handle %d, size 0x%llx\n", handle, size);
+
+    // lookup the dispatcher from handle
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    // do the operation
+    return vmo->SetSize(size);
+}
+
+mx_handle_t sys_vm_object_clone(mx_handle_t handle, uint64_t offset, uint64_t size) {
+    LTRACEF("handle %d, offset 0x%llx, size 0x%llx\n", handle, offset, size);
+
+    // lookup the dispatcher from handle
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    // the clone exposes the contents of the original
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    // create the copy-on-write clone
+    utils::RefPtr<VmObject> clone;
+    mx_status_t result = vmo->Clone(offset, size, &clone);
+    if (result != NO_ERROR)
+        return result;
+
+    // create a Vm Object dispatcher for it
+    utils::RefPtr<Dispatcher> clone_dispatcher;
+    mx_rights_t clone_rights;
+    result = VmObjectDispatcher::Create(utils::move(clone), &clone_dispatcher, &clone_rights);
+    if (result != NO_ERROR)
+        return result;
+
+    // create a handle and attach the dispatcher to it
+    HandleUniquePtr clone_handle(MakeHandle(utils::move(clone_dispatcher), clone_rights));
+    if (!clone_handle)
+        return ERR_NO_MEMORY;
+
+    return up->AddHandle(utils::move(clone_handle));
+}
+
+mx_handle_t sys_vm_object_slice(mx_handle_t handle, uint64_t offset, uint64_t size) {
+    LTRACEF("handle %d, offset 0x%llx, size 0x%llx\n", handle, offset, size);
+
+    // lookup the dispatcher from handle
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    utils::RefPtr<VmObject> slice;
+    mx_status_t result = vmo->Slice(offset, size, &slice);
+    if (result != NO_ERROR)
+        return result;
+
+    utils::RefPtr<Dispatcher> slice_dispatcher;
+    mx_rights_t slice_rights;
+    result = VmObjectDispatcher::Create(utils::move(slice), &slice_dispatcher, &slice_rights);
+    if (result != NO_ERROR)
+        return result;
+
+    // the slice reaches the same pages, so it can't be used for more than the handle it came from
+    slice_rights &= rights;
+
+    HandleUniquePtr slice_handle(MakeHandle(utils::move(slice_dispatcher), slice_rights));
+    if (!slice_handle)
+        return ERR_NO_MEMORY;
+
+    return up->AddHandle(utils::move(slice_handle));
+}
+
+mx_handle_t sys_pager_create(mx_handle_t port_handle, uint64_t key, uint64_t size) {
+    LTRACEF("port handle %d, key 0x%llx, size 0x%llx\n", port_handle, key, size);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(port_handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto ioport = dispatcher->get_io_port_dispatcher();
+    if (!ioport)
+        return ERR_WRONG_TYPE;
+
+    // requests for pages are queued on the port
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    AllocChecker ac;
+    auto source = utils::AdoptRef<VmPageSource>(
+        new (&ac) PagerSource(utils::RefPtr<IOPortDispatcher>(ioport), key));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    utils::RefPtr<VmObject> vmo = VmObject::CreatePaged(0, size, utils::move(source));
+    if (!vmo)
+        return ERR_NO_MEMORY;
+
+    utils::RefPtr<Dispatcher> vmo_dispatcher;
+    mx_rights_t vmo_rights;
+    mx_status_t result = VmObjectDispatcher::Create(utils::move(vmo), &vmo_dispatcher,
+                                                    &vmo_rights);
+    if (result != NO_ERROR)
+        return result;
+
+    HandleUniquePtr handle(MakeHandle(utils::move(vmo_dispatcher), vmo_rights));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    return up->AddHandle(utils::move(handle));
+}
+
+mx_status_t sys_pager_supply(mx_handle_t handle, uint64_t offset, mx_size_t len,
+                             const void* data) {
+    LTRACEF("handle %d, offset 0x%llx, len 0x%lx, data %p\n", handle, offset, len, data);
+
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    return vmo->Supply(offset, len, data);
+}
+
+mx_status_t sys_vm_object_op(mx_handle_t handle, uint32_t op, uint64_t offset, uint64_t size) {
+    LTRACEF("handle %d, op %u, offset 0x%llx, size 0x%llx\n", handle, op, offset, size);
+
+    // lookup the dispatcher from handle
+    auto up = ProcessDispatcher::GetCurrent();
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto vmo = dispatcher->get_vm_object_dispatcher();
+    if (!vmo)
+        return ERR_WRONG_TYPE;
+
+    // committing and decommitting both change the contents of the object
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    // do the operation
+    return vmo->RangeOp(op, offset, size);
+}
+
+mx_status_t sys_cache_flush(const void* addr, mx_size_t len, uint32_t options) {
+    LTRACEF("addr %p, len 0x%lx, options 0x%x\n", addr, len, options);
+
+    if (options == 0 || (options & ~(MX_CACHE_FLUSH_DATA | MX_CACHE_FLUSH_INVALIDATE)))
+        return ERR_INVALID_ARGS;
+
+    vaddr_t start = reinterpret_cast<vaddr_t>(addr);
+    if (len == 0)
+        return NO_ERROR;
+    if (start + len < start || !is_user_address(start) || !is_user_address(start + len - 1))
+        return ERR_INVALID_ARGS;
+
+#if ARCH_X86
+    // devices see what is in the caches, so there is nothing to do
+    return NO_ERROR;
+#else
+    // Work through the kernel's mapping of each page, so that a page being unmapped meanwhile
+    // can't fault us. Invalidating writes dirty lines back first rather than dropping them,
+    // since the page may no longer be the caller's by the time we get to it.
+    auto aspace = ProcessDispatcher::GetCurrent()->aspace();
+    vaddr_t end = start + len;
+    while (start < end) {
+        size_t chunk = MIN(ROUNDDOWN(start, PAGE_SIZE) + PAGE_SIZE, end) - start;
+
+        paddr_t pa;
+        uint flags;
+        if (arch_mmu_query(&aspace->arch_aspace(), start, &pa, &flags) == NO_ERROR &&
+            (flags & ARCH_MMU_FLAG_CACHE_MASK) == ARCH_MMU_FLAG_CACHED) {
+            // pages that aren't memory, such as device registers, have no kernel mapping
+            void* kvaddr = paddr_to_kvaddr(pa);
+            if (kvaddr) {
+                if (options & MX_CACHE_FLUSH_INVALIDATE)
+                    arch_clean_invalidate_cache_range(reinterpret_cast<addr_t>(kvaddr), chunk);
+                else
+                    arch_clean_cache_range(reinterpret_cast<addr_t>(kvaddr), chunk);
+            }
+        }
+        start += chunk;
+    }
+
+    return NO_ERROR;
+#endif
+}
+
+mx_handle_t sys_vm_low_memory_event(void) {
+    LTRACE_ENTRY;
 
-    // no rights check, anyone should be able to get the size
+    utils::RefPtr<Dispatcher> dispatcher = GetLowMemoryEvent();
+    if (!dispatcher)
+        return ERR_NOT_SUPPORTED;
 
-    // do the operation
-    uint64_t size = 0;
-    mx_status_t status = vmo->GetSize(&size);
+    // the event is shared by everyone, so it can be waited on but not signaled
+    HandleUniquePtr handle(MakeHandle(utils::move(dispatcher),
+                                      MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ));
+    if (!handle)
+        return ERR_NO_MEMORY;
 
-    // copy the size back, even if it failed
-    if (copy_to_user(reinterpret_cast<uint8_t*>(_size), &size, sizeof(size)) != NO_ERROR)
-        return ERR_INVALID_ARGS;
+    auto up = ProcessDispatcher::GetCurrent();
 
-    return status;
+    return up->AddHandle(utils::move(handle));
 }
 
-mx_status_t sys_vm_object_set_size(mx_handle_t handle, uint64_t size) {
-    LTRACEF("handle %d, size 0x%llx\n", handle, size);
+// the address space of the process mappings are made into
+static mx_status_t get_map_aspace(ProcessDispatcher* up,
+                                  mx_handle_t proc_handle, utils::RefPtr<VmAspace>* aspace) {
+    if (proc_handle == 0) {
+        // handle 0 is magic for 'current process'
+        // TODO: remove this hack and switch to requiring user to pass the current process handle
+        *aspace = up->aspace();
+        return NO_ERROR;
+    }
 
-    // lookup the dispatcher from handle
-    auto up = ProcessDispatcher::GetCurrent();
-    utils::RefPtr<Dispatcher> dispatcher;
-    uint32_t rights;
-    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+    // get the process dispatcher and convert to aspace
+    utils::RefPtr<Dispatcher> proc_dispatcher;
+    uint32_t proc_rights;
+    if (!up->GetDispatcher(proc_handle, &proc_dispatcher, &proc_rights))
         return BadHandle();
 
-    auto vmo = dispatcher->get_vm_object_dispatcher();
-    if (!vmo)
+    auto process = proc_dispatcher->get_process_dispatcher();
+    if (!process)
         return ERR_WRONG_TYPE;
 
-    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+    if (!magenta_rights_check(proc_rights, MX_RIGHT_WRITE))
         return ERR_ACCESS_DENIED;
 
-    // do the operation
-    return vmo->SetSize(size);
+    // get the address space out of the process dispatcher
+    *aspace = process->aspace();
+    if (!*aspace)
+        return ERR_INVALID_ARGS;
+    return NO_ERROR;
 }
 
 mx_status_t sys_process_vm_map(mx_handle_t proc_handle, mx_handle_t vmo_handle,
@@ -1064,29 +2254,9 @@ mx_status_t sys_process_vm_map(mx_handle_t proc_handle, mx_handle_t vmo_handle,
 
     // get a reffed pointer to the address space in the target process
     utils::RefPtr<VmAspace> aspace;
-    if (proc_handle == 0) {
-        // handle 0 is magic for 'current process'
-        // TODO: remove this hack and switch to requiring user to pass the current process handle
-        aspace = up->aspace();
-    } else {
-        // get the process dispatcher and convert to aspace
-        utils::RefPtr<Dispatcher> proc_dispatcher;
-        uint32_t proc_rights;
-        if (!up->GetDispatcher(proc_handle, &proc_dispatcher, &proc_rights))
-            return BadHandle();
-
-        auto process = proc_dispatcher->get_process_dispatcher();
-        if (!process)
-            return ERR_WRONG_TYPE;
-
-        if (!magenta_rights_check(proc_rights, MX_RIGHT_WRITE))
-            return ERR_ACCESS_DENIED;
-
-        // get the address space out of the process dispatcher
-        aspace = process->aspace();
-        if (!aspace)
-            return ERR_INVALID_ARGS;
-    }
+    mx_status_t status = get_map_aspace(up, proc_handle, &aspace);
+    if (status != NO_ERROR)
+        return status;
 
     // copy the user pointer in
     uintptr_t ptr;
@@ -1094,7 +2264,7 @@ mx_status_t sys_process_vm_map(mx_handle_t proc_handle, mx_handle_t vmo_handle,
         return ERR_INVALID_ARGS;
 
     // do the map call
-    mx_status_t status = vmo->Map(utils::move(aspace), vmo_rights, offset, len, &ptr, flags);
+    status = vmo->Map(utils::move(aspace), vmo_rights, offset, len, &ptr, flags);
     if (status != NO_ERROR)
         return status;
 
@@ -1105,6 +2275,66 @@ mx_status_t sys_process_vm_map(mx_handle_t proc_handle, mx_handle_t vmo_handle,
     return NO_ERROR;
 }
 
+mx_status_t sys_process_vm_map_many(mx_handle_t proc_handle, mx_vm_map_entry_t* _entries,
+                                    uint32_t count, uint32_t flags) {
+    LTRACEF("proc handle %d, entries %p, count %u, flags 0x%x\n",
+            proc_handle, _entries, count, flags);
+
+    if (flags != 0u)
+        return ERR_INVALID_ARGS;
+    if (!_entries || count == 0u)
+        return ERR_INVALID_ARGS;
+    if (count > kMaxVmMapBatch)
+        return ERR_TOO_BIG;
+
+    AllocChecker ac;
+    utils::unique_ptr<mx_vm_map_entry_t[]> entries(new (&ac) mx_vm_map_entry_t[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    utils::unique_ptr<VmAspace::MapObjectArgs[]> args(new (&ac) VmAspace::MapObjectArgs[count]);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    if (copy_from_user(entries.get(), _entries, count * sizeof(_entries[0])) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<VmAspace> aspace;
+    mx_status_t status = get_map_aspace(up, proc_handle, &aspace);
+    if (status != NO_ERROR)
+        return status;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const mx_vm_map_entry_t& e = entries[i];
+
+        utils::RefPtr<Dispatcher> vmo_dispatcher;
+        uint32_t vmo_rights;
+        if (!up->GetDispatcher(e.vmo, &vmo_dispatcher, &vmo_rights))
+            return BadHandle();
+
+        auto vmo = vmo_dispatcher->get_vm_object_dispatcher();
+        if (!vmo)
+            return ERR_WRONG_TYPE;
+
+        status = vmo->GetMapArgs(vmo_rights, e.offset, e.len, e.ptr, e.flags, &args[i]);
+        if (status != NO_ERROR)
+            return status;
+    }
+
+    // map them all under one acquisition of the aspace lock
+    status = aspace->MapObjects(args.get(), count);
+    if (status != NO_ERROR)
+        return status;
+
+    for (uint32_t i = 0; i < count; ++i)
+        entries[i].ptr = reinterpret_cast<uintptr_t>(args[i].ptr);
+    if (copy_to_user(_entries, entries.get(), count * sizeof(_entries[0])) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    return NO_ERROR;
+}
+
 mx_status_t sys_process_vm_unmap(mx_handle_t proc_handle, uintptr_t address, mx_size_t len) {
     LTRACEF("proc handle %d, address 0x%lx, len 0x%lx\n", proc_handle, address, len);
 
@@ -1231,10 +2461,7 @@ int sys_log_create(uint32_t flags) {
 
     auto up = ProcessDispatcher::GetCurrent();
 
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 int sys_log_write(mx_handle_t log_handle, uint32_t len, const void* ptr, uint32_t flags) {
@@ -1299,10 +2526,7 @@ mx_handle_t sys_io_port_create(uint32_t options) {
 
     auto up = ProcessDispatcher::GetCurrent();
 
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_status_t sys_io_port_queue(mx_handle_t handle, const void* packet, mx_size_t size) {
@@ -1328,14 +2552,16 @@ mx_status_t sys_io_port_queue(mx_handle_t handle, const void* packet, mx_size_t
     if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
         return ERR_ACCESS_DENIED;
 
-    auto iopk = IOP_Packet::MakeFromUser(packet, size);
-    if (!iopk)
-        return ERR_NO_MEMORY;
+    IOP_Packet* iopk;
+    mx_status_t status = IOP_Packet::MakeFromUser(ioport, packet, size, &iopk);
+    if (status != NO_ERROR)
+        return status;
 
     return ioport->Queue(iopk);
 }
 
-mx_status_t sys_io_port_wait(mx_handle_t handle, void* packet, mx_size_t size) {
+mx_status_t sys_io_port_wait(mx_handle_t handle, mx_time_t timeout, void* packet,
+                             mx_size_t size) {
     LTRACEF("handle %d\n", handle);
 
     if (!packet)
@@ -1355,15 +2581,69 @@ mx_status_t sys_io_port_wait(mx_handle_t handle, void* packet, mx_size_t size) {
     if (!magenta_rights_check(rights, MX_RIGHT_READ))
         return ERR_ACCESS_DENIED;
 
+    lk_time_t t = mx_time_to_lk(timeout);
+    if ((timeout > 0ull) && (t == 0u))
+        t = 1u;
+
     IOP_Packet* iopk = nullptr;
-    mx_status_t status = ioport->Wait(&iopk);
+    uint32_t actual = 0u;
+    mx_status_t status = ioport->Wait(t, size, &iopk, 1u, &actual);
     if (status < 0)
         return status;
 
-    if (!iopk->CopyToUser(packet, &size))
+    bool copied = iopk->CopyToUser(packet, &size);
+    ioport->FreePacket(iopk);
+    return copied ? NO_ERROR : ERR_INVALID_ARGS;
+}
+
+mx_status_t sys_io_port_wait_many(mx_handle_t handle, mx_time_t timeout, void* _packets,
+                                  mx_size_t packet_size, uint32_t count,
+                                  uint32_t* _actual_count) {
+    LTRACEF("handle %d count %u\n", handle, count);
+
+    if (!_packets || !_actual_count || count == 0u)
+        return ERR_INVALID_ARGS;
+    if (count > kMaxIOPortWaitMany)
+        return ERR_TOO_BIG;
+    if (packet_size < sizeof(mx_packet_header_t))
         return ERR_INVALID_ARGS;
 
-    IOP_Packet::Delete(iopk);
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto ioport = dispatcher->get_io_port_dispatcher();
+    if (!ioport)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    lk_time_t t = mx_time_to_lk(timeout);
+    if ((timeout > 0ull) && (t == 0u))
+        t = 1u;
+
+    IOP_Packet* iopks[kMaxIOPortWaitMany];
+    uint32_t actual = 0u;
+    mx_status_t status = ioport->Wait(t, packet_size, iopks, count, &actual);
+    if (status < 0)
+        return status;
+
+    // packet i goes in slot i; every packet is consumed even if a copy fails
+    auto dst = reinterpret_cast<char*>(_packets);
+    bool copied = true;
+    for (uint32_t ix = 0; ix != actual; ++ix) {
+        mx_size_t size = packet_size;
+        if (copied)
+            copied = iopks[ix]->CopyToUser(dst + ix * packet_size, &size);
+        ioport->FreePacket(iopks[ix]);
+    }
+
+    if (!copied || copy_to_user_u32(_actual_count, actual) != NO_ERROR)
+        return ERR_INVALID_ARGS;
     return NO_ERROR;
 }
 
@@ -1384,6 +2664,7 @@ mx_status_t sys_io_port_bind(mx_handle_t handle, uint64_t key, mx_handle_t sourc
     if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
         return ERR_ACCESS_DENIED;
 
+    utils::RefPtr<Dispatcher> pci_int_d;
     {
         AutoLock lock(up->handle_table_lock());
 
@@ -1393,12 +2674,22 @@ mx_status_t sys_io_port_bind(mx_handle_t handle, uint64_t key, mx_handle_t sourc
         if (!magenta_rights_check(src_handle->rights(), MX_RIGHT_READ))
             return ERR_ACCESS_DENIED;
 
-        if (signals) {
+        // PCI interrupts aren't waitable; they deliver packets themselves,
+        // see below.
+        if (src_handle->dispatcher()->get_pci_interrupt_dispatcher()) {
+            pci_int_d = src_handle->dispatcher();
+        } else if (signals) {
             return ioport->Bind(src_handle, signals, key);
         } else {
             return ioport->Unbind(src_handle, key);
         }
     }
+
+    // Any nonzero |signals| binds the interrupt, and zero unbinds it.
+    auto pci_interrupt = pci_int_d->get_pci_interrupt_dispatcher();
+    if (signals)
+        return pci_interrupt->BindIOPort(utils::RefPtr<IOPortDispatcher>(ioport), key);
+    return pci_interrupt->UnbindIOPort();
 }
 
 mx_handle_t sys_data_pipe_create(uint32_t options, mx_size_t element_size, mx_size_t capacity,
@@ -1408,10 +2699,16 @@ mx_handle_t sys_data_pipe_create(uint32_t options, mx_size_t element_size, mx_si
     if (!_handle)
         return ERR_INVALID_ARGS;
 
-    // TODO(cpu): support different element sizes.
-    if (element_size != 1u)
+    if (options & ~MX_DATA_PIPE_SHARED_CURSORS)
         return ERR_INVALID_ARGS;
 
+    // the ring only ever holds whole elements
+    if (element_size == 0u || (capacity % element_size) != 0u)
+        return ERR_INVALID_ARGS;
+    if (!capacity) {
+        capacity = kDefaultDataPipeCapacity - kDefaultDataPipeCapacity % element_size;
+        capacity = MAX(capacity, element_size);
+    }
 
     utils::RefPtr<Dispatcher> producer_dispatcher;
     mx_rights_t producer_rights;
@@ -1419,7 +2716,8 @@ mx_handle_t sys_data_pipe_create(uint32_t options, mx_size_t element_size, mx_si
     utils::RefPtr<Dispatcher> consumer_dispatcher;
     mx_rights_t consumer_rights;
 
-    mx_status_t result = DataPipe::Create(capacity ? capacity : kDefaultDataPipeCapacity,
+    mx_status_t result = DataPipe::Create(element_size, capacity,
+                                          (options & MX_DATA_PIPE_SHARED_CURSORS) != 0u,
                                           &producer_dispatcher,
                                           &consumer_dispatcher,
                                           &producer_rights,
@@ -1436,14 +2734,20 @@ mx_handle_t sys_data_pipe_create(uint32_t options, mx_size_t element_size, mx_si
         return ERR_NO_MEMORY;
 
     auto up = ProcessDispatcher::GetCurrent();
-    mx_handle_t hv_producer = up->MapHandleToValue(producer_handle.get());
-    mx_handle_t hv_consumer = up->MapHandleToValue(consumer_handle.get());
+    mx_handle_t hv_producer = up->AddHandle(utils::move(producer_handle));
+    if (hv_producer < 0)
+        return hv_producer;
+    mx_handle_t hv_consumer = up->AddHandle(utils::move(consumer_handle));
+    if (hv_consumer < 0) {
+        up->RemoveHandle(hv_producer);
+        return hv_consumer;
+    }
 
-    if (copy_to_user_32(_handle, hv_consumer) != NO_ERROR)
+    if (copy_to_user_32(_handle, hv_consumer) != NO_ERROR) {
+        up->RemoveHandle(hv_producer);
+        up->RemoveHandle(hv_consumer);
         return ERR_INVALID_ARGS;
-
-    up->AddHandle(utils::move(producer_handle));
-    up->AddHandle(utils::move(consumer_handle));
+    }
 
     return hv_producer;
 }
@@ -1506,6 +2810,82 @@ mx_ssize_t sys_data_pipe_read(mx_handle_t handle, uint32_t flags, mx_size_t requ
     return read;
 }
 
+static mx_status_t data_pipe_copy_in_iovecs(uint32_t flags, const mx_iovec_t* _iov,
+                                            uint32_t iov_count, mx_iovec_t* iov) {
+    if (flags & ~MX_DATA_PIPE_ALL_OR_NONE)
+        return ERR_INVALID_ARGS;
+    if (iov_count == 0u || !_iov)
+        return ERR_INVALID_ARGS;
+    if (iov_count > kMaxDataPipeIovecs)
+        return ERR_TOO_BIG;
+
+    if (copy_from_user(iov, _iov, iov_count * sizeof(_iov[0])) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    return NO_ERROR;
+}
+
+mx_ssize_t sys_data_pipe_writev(mx_handle_t handle, uint32_t flags, const mx_iovec_t* _iov,
+                                uint32_t iov_count) {
+    LTRACEF("handle %d count %u\n", handle, iov_count);
+
+    mx_iovec_t iov[kMaxDataPipeIovecs];
+    mx_status_t result = data_pipe_copy_in_iovecs(flags, _iov, iov_count, iov);
+    if (result != NO_ERROR)
+        return result;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto producer = dispatcher->get_data_pipe_producer_dispatcher();
+    if (!producer)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    mx_size_t written;
+    result = producer->WriteV(iov, iov_count, (flags & MX_DATA_PIPE_ALL_OR_NONE) != 0u, &written);
+    if (result < 0)
+        return result;
+
+    return written;
+}
+
+mx_ssize_t sys_data_pipe_readv(mx_handle_t handle, uint32_t flags, const mx_iovec_t* _iov,
+                               uint32_t iov_count) {
+    LTRACEF("handle %d count %u\n", handle, iov_count);
+
+    mx_iovec_t iov[kMaxDataPipeIovecs];
+    mx_status_t result = data_pipe_copy_in_iovecs(flags, _iov, iov_count, iov);
+    if (result != NO_ERROR)
+        return result;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    auto consumer = dispatcher->get_data_pipe_consumer_dispatcher();
+    if (!consumer)
+        return ERR_WRONG_TYPE;
+
+    if (!magenta_rights_check(rights, MX_RIGHT_READ))
+        return ERR_ACCESS_DENIED;
+
+    mx_size_t read;
+    result = consumer->ReadV(iov, iov_count, (flags & MX_DATA_PIPE_ALL_OR_NONE) != 0u, &read);
+    if (result < 0)
+        return result;
+
+    return read;
+}
+
 mx_ssize_t sys_data_pipe_begin_write(mx_handle_t handle, uint32_t flags, mx_size_t requested,
                                      uintptr_t* buffer) {
     LTRACEF("handle %d\n", handle);
@@ -1618,14 +2998,79 @@ mx_status_t sys_data_pipe_end_read(mx_handle_t handle, mx_size_t read) {
     return consumer->EndRead(read);
 }
 
+mx_ssize_t sys_data_pipe_map(mx_handle_t handle, uint32_t flags, uintptr_t* _buffer,
+                             uintptr_t* _control) {
+    LTRACEF("handle %d\n", handle);
+
+    if (!_buffer || !_control || flags != 0u)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    mx_status_t status;
+    uintptr_t buffer = 0u;
+    uintptr_t control = 0u;
+    mx_size_t size = 0u;
+
+    if (auto producer = dispatcher->get_data_pipe_producer_dispatcher()) {
+        if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+            return ERR_ACCESS_DENIED;
+        status = producer->Map(up->aspace(), reinterpret_cast<void**>(&buffer),
+                               reinterpret_cast<void**>(&control), &size);
+    } else if (auto consumer = dispatcher->get_data_pipe_consumer_dispatcher()) {
+        if (!magenta_rights_check(rights, MX_RIGHT_READ))
+            return ERR_ACCESS_DENIED;
+        status = consumer->Map(up->aspace(), reinterpret_cast<void**>(&buffer),
+                               reinterpret_cast<void**>(&control), &size);
+    } else {
+        return ERR_WRONG_TYPE;
+    }
+    if (status != NO_ERROR)
+        return status;
+
+    // the mappings stay until the end goes away or moves to another process
+    if (copy_to_user_uptr(_buffer, buffer) != NO_ERROR ||
+        copy_to_user_uptr(_control, control) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    return size;
+}
+
+mx_status_t sys_data_pipe_sync(mx_handle_t handle) {
+    LTRACEF("handle %d\n", handle);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(handle, &dispatcher, &rights))
+        return BadHandle();
+
+    if (auto producer = dispatcher->get_data_pipe_producer_dispatcher()) {
+        if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+            return ERR_ACCESS_DENIED;
+        return producer->Sync();
+    }
+    if (auto consumer = dispatcher->get_data_pipe_consumer_dispatcher()) {
+        if (!magenta_rights_check(rights, MX_RIGHT_READ))
+            return ERR_ACCESS_DENIED;
+        return consumer->Sync();
+    }
+    return ERR_WRONG_TYPE;
+}
+
 mx_ssize_t sys_cprng_draw(void* buffer, mx_size_t len) {
     if (len > kMaxCPRNGDraw)
         return ERR_INVALID_ARGS;
 
     uint8_t kernel_buf[kMaxCPRNGDraw];
 
-    auto prng = crypto::GlobalPRNG::GetInstance();
-    prng->Draw(kernel_buf, static_cast<int>(len));
+    crypto::GlobalPRNG::Draw(kernel_buf, static_cast<int>(len));
 
     if (copy_to_user(buffer, kernel_buf, len) != NO_ERROR)
         return ERR_INVALID_ARGS;
@@ -1644,8 +3089,7 @@ mx_status_t sys_cprng_add_entropy(void* buffer, mx_size_t len) {
     if (copy_from_user(kernel_buf, buffer, len) != NO_ERROR)
         return ERR_INVALID_ARGS;
 
-    auto prng = crypto::GlobalPRNG::GetInstance();
-    prng->AddEntropy(kernel_buf, static_cast<int>(len));
+    crypto::GlobalPRNG::AddEntropy(kernel_buf, static_cast<int>(len));
 
     // Get rid of the stack copy of the random data
     memset(kernel_buf, 0, sizeof(kernel_buf));
@@ -1665,20 +3109,28 @@ mx_handle_t sys_wait_set_create(void) {
         return ERR_NO_MEMORY;
 
     auto up = ProcessDispatcher::GetCurrent();
-    mx_handle_t hv = up->MapHandleToValue(handle.get());
-    up->AddHandle(utils::move(handle));
-
-    return hv;
+    return up->AddHandle(utils::move(handle));
 }
 
 mx_status_t sys_wait_set_add(mx_handle_t ws_handle_value,
                              mx_handle_t handle_value,
                              mx_signals_t signals,
                              uint64_t cookie) {
-    LTRACEF("wait set handle %d, handle %d\n", ws_handle_value, handle_value);
+    return sys_wait_set_add_etc(ws_handle_value, handle_value, signals, cookie, 0u);
+}
+
+mx_status_t sys_wait_set_add_etc(mx_handle_t ws_handle_value,
+                                 mx_handle_t handle_value,
+                                 mx_signals_t signals,
+                                 uint64_t cookie,
+                                 uint32_t options) {
+    LTRACEF("wait set handle %d, handle %d, options %#x\n", ws_handle_value, handle_value, options);
+
+    if (options & ~(MX_WAIT_SET_ENTRY_EDGE | MX_WAIT_SET_ENTRY_ONESHOT))
+        return ERR_INVALID_ARGS;
 
     utils::unique_ptr<WaitSetDispatcher::Entry> entry;
-    mx_status_t result = WaitSetDispatcher::Entry::Create(signals, cookie, &entry);
+    mx_status_t result = WaitSetDispatcher::Entry::Create(signals, cookie, options, &entry);
     if (result != NO_ERROR)
         return result;
 
@@ -1725,6 +3177,24 @@ mx_status_t sys_wait_set_remove(mx_handle_t ws_handle, uint64_t cookie) {
     return ws_dispatcher->RemoveEntry(cookie);
 }
 
+mx_status_t sys_wait_set_rearm(mx_handle_t ws_handle, uint64_t cookie) {
+    LTRACEF("wait set handle %d\n", ws_handle);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    utils::RefPtr<Dispatcher> dispatcher;
+    uint32_t rights;
+    if (!up->GetDispatcher(ws_handle, &dispatcher, &rights))
+        return BadHandle();
+    auto ws_dispatcher = dispatcher->get_wait_set_dispatcher();
+    if (!ws_dispatcher)
+        return ERR_WRONG_TYPE;
+    if (!magenta_rights_check(rights, MX_RIGHT_WRITE))
+        return ERR_ACCESS_DENIED;
+
+    return ws_dispatcher->RearmEntry(cookie);
+}
+
 mx_status_t sys_wait_set_wait(mx_handle_t ws_handle,
                               mx_time_t timeout,
                               uint32_t* _num_results,
@@ -1736,17 +3206,19 @@ mx_status_t sys_wait_set_wait(mx_handle_t ws_handle,
     if (copy_from_user_u32(&num_results, _num_results) != NO_ERROR)
         return ERR_INVALID_ARGS;
 
-    utils::unique_ptr<mx_wait_set_result_t[]> results;
-    if (num_results > 0u) {
+    // The usual few results fit on the stack; we only allocate for big batches.
+    mx_wait_set_result_t stack_results[kWaitSetStackResults];
+    utils::unique_ptr<mx_wait_set_result_t[]> heap_results;
+    mx_wait_set_result_t* results = stack_results;
+    if (num_results > kWaitSetStackResults) {
         if (num_results > kMaxWaitSetWaitResults)
             return ERR_TOO_BIG;
 
-        // TODO(vtl): It kind of sucks that we always have to allocate the indicated maximum size
-        // here (namely, |num_results|).
         AllocChecker ac;
-        results.reset(new (&ac) mx_wait_set_result_t[num_results]);
+        heap_results.reset(new (&ac) mx_wait_set_result_t[num_results]);
         if (!ac.check())
             return ERR_NO_MEMORY;
+        results = heap_results.get();
     }
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -1762,12 +3234,12 @@ mx_status_t sys_wait_set_wait(mx_handle_t ws_handle,
         return ERR_ACCESS_DENIED;
 
     uint32_t max_results = 0u;
-    mx_status_t result = ws_dispatcher->Wait(timeout, &num_results, results.get(), &max_results);
+    mx_status_t result = ws_dispatcher->Wait(timeout, &num_results, results, &max_results);
     if (result == NO_ERROR) {
         if (copy_to_user_u32(_num_results, num_results) != NO_ERROR)
             return ERR_INVALID_ARGS;
         if (num_results > 0u) {
-            if (copy_to_user(_results, results.get(), num_results * sizeof(mx_wait_set_result_t)) !=
+            if (copy_to_user(_results, results, num_results * sizeof(mx_wait_set_result_t)) !=
                     NO_ERROR)
             return ERR_INVALID_ARGS;
         }
@@ -8,9 +8,14 @@
 
 #include <magenta/types.h>
 #include <magenta/syscalls-types.h>
+#include <stddef.h>
 
 // Please don't put CDECLS here. We want the stricter declaration matching
 // rules of C++.
 #define MAGENTA_DDKCALL_DEF(a...) MAGENTA_SYSCALL_DEF(a)
 #define MAGENTA_SYSCALL_DEF(nargs64, nargs32, n, ret, name, args...) ret sys_##name(args);
 #include <magenta/syscalls.inc>
+
+// Fills in up to |max_stats| records of per syscall counts, returning how
+// many, or ERR_NOT_SUPPORTED if the kernel isn't built with SYSCALL_STATS.
+mx_ssize_t syscall_stats_get(mx_syscall_stats_t* stats, size_t max_stats);
@@ -14,6 +14,8 @@ __BEGIN_CDECLS
 
 #define copy_to_user arch_copy_to_user
 #define copy_from_user arch_copy_from_user
+#define copy_to_user_many arch_copy_to_user_many
+#define copy_from_user_many arch_copy_from_user_many
 
 /**
  * @brief Copies data from userspace into a newly allocated buffer
@@ -40,7 +42,7 @@ status_t copy_from_user_dynamic(
 // Convenience functions for common data types
 #define MAKE_COPY_TO_USER(name, type) \
     static inline status_t name(type *dst, type value) { \
-        return copy_to_user(dst, &value, sizeof(type)); \
+        return arch_copy_to_user_fixed(dst, &value, sizeof(type)); \
     }
 
 MAKE_COPY_TO_USER(copy_to_user_u8, uint8_t);
@@ -55,7 +57,7 @@ MAKE_COPY_TO_USER(copy_to_user_iptr, intptr_t);
 
 #define MAKE_COPY_FROM_USER(name, type) \
     static inline status_t name(type *dst, const type *src) { \
-        return copy_from_user(dst, src, sizeof(type)); \
+        return arch_copy_from_user_fixed(dst, src, sizeof(type)); \
     }
 
 MAKE_COPY_FROM_USER(copy_from_user_u8, uint8_t);
@@ -4,6 +4,7 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
@@ -14,6 +15,7 @@
 #include <lib/console.h>
 #include <lk/init.h>
 #include <platform.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +24,7 @@
 #include <magenta/msg_pipe_dispatcher.h>
 #include <magenta/process_dispatcher.h>
 #include <magenta/processargs.h>
+#include <magenta/vdso-constants.h>
 #include <magenta/vm_object_dispatcher.h>
 
 #include "code-start.h"
@@ -56,6 +59,35 @@ static utils::RefPtr<VmObject> make_vmo_from_memory(const void* data,
     return vmo;
 }
 
+#if ARCH_X86_64
+extern "C" bool get_tsc_ns_conversion(uint64_t* mult, uint32_t* shift);
+#endif
+
+// Fill in the vDSO's data page, which every process maps read-only.
+static bool write_vdso_constants(utils::RefPtr<VmObject> vmo) {
+#ifdef VDSO_DATA_START
+    static_assert(offsetof(vdso_constants_t, max_num_cpus) ==
+                  VDSO_CONSTANTS_MAX_NUM_CPUS, "");
+    static_assert(offsetof(vdso_constants_t, tsc_ns_shift) ==
+                  VDSO_CONSTANTS_TSC_NS_SHIFT, "");
+    static_assert(offsetof(vdso_constants_t, tsc_ns_mult) ==
+                  VDSO_CONSTANTS_TSC_NS_MULT, "");
+
+    vdso_constants_t constants = {};
+    constants.max_num_cpus = arch_max_num_cpus();
+#if ARCH_X86_64
+    // left zero unless current_time_ns() goes by the TSC alone
+    get_tsc_ns_conversion(&constants.tsc_ns_mult, &constants.tsc_ns_shift);
+#endif
+
+    size_t written;
+    if (vmo->Write(&constants, VDSO_DATA_START, sizeof(constants), &written) < 0 ||
+        written != sizeof(constants))
+        return false;
+#endif
+    return true;
+}
+
 // Get a handle to a VM object, with full rights except perhaps for writing.
 static mx_status_t get_vmo_handle(utils::RefPtr<VmObject> vmo, bool readonly,
                                   HandleUniquePtr* ptr) {
@@ -156,22 +188,15 @@ static HandleUniquePtr make_bootstrap_pipe(
     ASSERT(kernel_pipe);
 
     // Now pack up the bytes and handles to write down the pipe.
-    AllocChecker ac;
-    utils::Array<uint8_t> buffer(new (&ac) uint8_t[num_bytes], num_bytes);
-    if (!ac.check())
-        return nullptr;
-    memcpy(buffer.get(), bytes, buffer.size());
-
-    utils::Array<Handle*> handle_list(new (&ac) Handle*[num_handles],
-                                      num_handles);
-    if (!ac.check())
+    utils::unique_ptr<MessagePacket> msg;
+    if (MessagePacket::Create(num_bytes, num_handles, &msg) != NO_ERROR)
         return nullptr;
+    memcpy(msg->data(), bytes, num_bytes);
     for (uint32_t i = 0; i < num_handles; ++i)
-        handle_list[i] = handles[i].release();
+        msg->handles()[i] = handles[i].release();
 
     // Here it goes!
-    mx_status_t status = kernel_pipe->Write(utils::move(buffer),
-                                            utils::move(handle_list));
+    mx_status_t status = kernel_pipe->Write(&msg);
     if (status != NO_ERROR)
         return nullptr;
 
@@ -238,7 +263,7 @@ static int attempt_userboot(const void* bootfs, size_t bfslen) {
     auto vdso_vmo = make_vmo_from_memory(vdso_image, VDSO_CODE_END);
     auto userboot_vmo = make_vmo_from_memory(userboot_image,
                                              USERBOOT_CODE_END);
-    if (!vdso_vmo || !userboot_vmo)
+    if (!vdso_vmo || !userboot_vmo || !write_vdso_constants(vdso_vmo))
         return ERR_NO_MEMORY;
 
     HandleUniquePtr handles[BOOTSTRAP_HANDLES];
@@ -304,8 +329,9 @@ static int attempt_userboot(const void* bootfs, size_t bfslen) {
         if (!handle)
             return ERR_NO_MEMORY;
 
-        hv = proc->MapHandleToValue(handle.get());
-        proc->AddHandle(utils::move(handle));
+        hv = proc->AddHandle(utils::move(handle));
+        if (hv < 0)
+            return hv;
     }
 
     dprintf(SPEW, "userboot: %-23s @ %#" PRIxPTR "\n", "entry point", entry);
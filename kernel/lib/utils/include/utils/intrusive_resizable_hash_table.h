@@ -0,0 +1,312 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <assert.h>
+#include <new.h>
+#include <stdint.h>
+#include <utils/intrusive_container_utils.h>
+#include <utils/intrusive_hash_table.h>
+#include <utils/intrusive_pointer_traits.h>
+#include <utils/intrusive_single_list.h>
+
+namespace utils {
+
+// DefaultResizableHashTraits defines the default hash function of a
+// ResizableHashTable. Unlike DefaultHashTraits it does not reduce the hash to
+// a bucket index; the table does that itself, for whatever number of buckets
+// it has at the time. Users only need a static GetHash method in ObjType
+// taking a const reference to a KeyType, as for HashTable. The table mixes
+// the result, so a plain identity hash of a counter or an address is fine.
+template <typename KeyType, typename ObjType>
+struct DefaultResizableHashTraits {
+    static uint64_t GetHash(const KeyType& key) {
+        return static_cast<uint64_t>(ObjType::GetHash(key));
+    }
+};
+
+// ResizableHashTable<> is an intrusive hash table, like HashTable<>, whose
+// number of buckets grows with the number of elements in it, so lookups stay
+// short whether it holds ten elements or a hundred thousand.
+//
+// Growing is incremental. Once the elements outnumber the buckets by
+// kMaxLoadFactor the table allocates a bucket array four times the size, and
+// from then on each insert, find or erase moves a few of the old buckets'
+// elements over until the old array is empty and can be freed. Nothing ever
+// walks the whole table at once. Until the first growth the buckets live
+// inline in the table, so small tables never allocate, and inserting never
+// fails: if a bigger array can't be had the table just stays as it is. The
+// table goes back to its inline buckets when it is emptied.
+//
+// It offers the associative subset of the HashTable interface (insert, find,
+// erase, find_if, erase_if, clear and size) plus for_each(), without
+// iterators, since elements move between buckets behind the user's back.
+template <typename  _KeyType,
+          typename  _PtrType,
+          typename  _BucketType = SinglyLinkedList<_PtrType>,
+          typename  _KeyTraits  = DefaultKeyedObjectTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType>,
+          typename  _HashTraits = DefaultResizableHashTraits<
+                                    _KeyType,
+                                    typename internal::ContainerPtrTraits<_PtrType>::ValueType>>
+class ResizableHashTable {
+public:
+    // Pointer types/traits
+    using PtrType      = _PtrType;
+    using PtrTraits    = internal::ContainerPtrTraits<PtrType>;
+    using ValueType    = typename PtrTraits::ValueType;
+
+    // Key types/traits
+    using KeyType      = _KeyType;
+    using KeyTraits    = _KeyTraits;
+    using HashTraits   = _HashTraits;
+
+    // Bucket types/traits
+    using BucketType   = _BucketType;
+    using NodeTraits   = typename BucketType::NodeTraits;
+
+    static constexpr uint kInlineBucketShift = 3;
+    static constexpr size_t kInlineBuckets = 1u << kInlineBucketShift;
+    // elements per bucket, on average, before the table grows
+    static constexpr size_t kMaxLoadFactor = 2;
+    // grow by this many bits of index at a time
+    static constexpr uint kGrowShift = 2;
+    // old buckets emptied per operation while growing
+    static constexpr size_t kMigrateStep = 2;
+
+    ResizableHashTable() {}
+    ~ResizableHashTable() {
+        DEBUG_ASSERT(PtrTraits::IsManaged || is_empty());
+        clear();
+    }
+
+    void insert(const PtrType& ptr) { insert(PtrType(ptr)); }
+    void insert(PtrType&& ptr) {
+        DEBUG_ASSERT(ptr != nullptr);
+        Migrate();
+        HashType hash = GetHash(KeyTraits::GetKey(*ptr));
+        buckets_[Index(hash, shift_)].push_front(utils::move(ptr));
+        ++count_;
+        MaybeGrow();
+    }
+
+    const PtrType& find(const KeyType& key) {
+        Migrate();
+        return BucketFor(GetHash(key)).find_if(
+            [key](const ValueType& other) -> bool {
+                return KeyTraits::EqualTo(key, KeyTraits::GetKey(other));
+            });
+    }
+
+    PtrType erase(const KeyType& key) {
+        Migrate();
+        BucketType& bucket = BucketFor(GetHash(key));
+        PtrType ret = internal::KeyEraseUtils<BucketType, KeyTraits>::erase(bucket, key);
+        if (ret != nullptr)
+            Erased();
+        return ret;
+    }
+
+    PtrType erase(ValueType& obj) {
+        Migrate();
+        BucketType& bucket = BucketFor(GetHash(KeyTraits::GetKey(obj)));
+        PtrType ret = internal::DirectEraseUtils<BucketType>::erase(bucket, obj);
+        if (ret != nullptr)
+            Erased();
+        return ret;
+    }
+
+    void clear() {
+        for (size_t i = migrate_ndx_; i < old_bucket_count(); i++)
+            old_buckets_[i].clear();
+        for (size_t i = 0; i < bucket_count(); i++)
+            buckets_[i].clear();
+        count_ = 0;
+        Reset();
+    }
+
+    size_t size()         const { return count_; }
+    bool   is_empty()     const { return count_ == 0; }
+    size_t bucket_count() const { return (size_t)1 << shift_; }
+
+    // Find the first member satisfying |fn|, erase it and return it.
+    // Returns nullptr if no member satisfies the predicate.
+    template <typename UnaryFn>
+    PtrType erase_if(UnaryFn fn) {
+        PtrType ret(nullptr);
+        ForEachBucket([&fn, &ret](BucketType& bucket) -> bool {
+            ret = bucket.erase_if(fn);
+            return ret != nullptr;
+        });
+        if (ret != nullptr)
+            Erased();
+        return ret;
+    }
+
+    // Find the first member satisfying |fn| and return a const& to the
+    // PtrType which refers to it, or nullptr if no member satisfies it.
+    template <typename UnaryFn>
+    const PtrType& find_if(UnaryFn fn) {
+        static PtrType null_ptr;
+        const PtrType* ret = &null_ptr;
+        ForEachBucket([&fn, &ret](BucketType& bucket) -> bool {
+            const PtrType& ptr = bucket.find_if(fn);
+            if (ptr == nullptr)
+                return false;
+            ret = &ptr;
+            return true;
+        });
+        return *ret;
+    }
+
+    // Call |fn| on every member, in no particular order. |fn| must not
+    // change the table.
+    template <typename Fn>
+    void for_each(Fn fn) {
+        ForEachBucket([&fn](BucketType& bucket) -> bool {
+            for (auto& obj : bucket)
+                fn(obj);
+            return false;
+        });
+    }
+
+private:
+    using HashType = uint64_t;
+
+    ResizableHashTable(const ResizableHashTable&) = delete;
+    ResizableHashTable& operator=(const ResizableHashTable&) = delete;
+
+    static HashType GetHash(const KeyType& key) { return HashTraits::GetHash(key); }
+
+    // Fibonacci hashing: the top |shift| bits of the hash times 2^64 / phi.
+    // Growing by kGrowShift bits sends the elements of old bucket i to new
+    // buckets i << kGrowShift and up, never anywhere else.
+    static size_t Index(HashType hash, uint shift) {
+        return static_cast<size_t>((hash * 0x9e3779b97f4a7c15ull) >> (64 - shift));
+    }
+
+    size_t old_bucket_count() const { return old_buckets_ ? ((size_t)1 << old_shift_) : 0; }
+
+    // The bucket holding elements with |hash|, which is still the old one if
+    // it hasn't been moved over yet.
+    BucketType& BucketFor(HashType hash) {
+        if (old_buckets_) {
+            size_t old_ndx = Index(hash, old_shift_);
+            if (old_ndx >= migrate_ndx_)
+                return old_buckets_[old_ndx];
+        }
+        return buckets_[Index(hash, shift_)];
+    }
+
+    // Call |fn| on every bucket that can hold elements until it returns true.
+    template <typename BucketFn>
+    void ForEachBucket(BucketFn fn) {
+        if (is_empty())
+            return;
+        for (size_t i = migrate_ndx_; i < old_bucket_count(); i++) {
+            if (!old_buckets_[i].is_empty() && fn(old_buckets_[i]))
+                return;
+        }
+        for (size_t i = 0; i < bucket_count(); i++) {
+            if (!buckets_[i].is_empty() && fn(buckets_[i]))
+                return;
+        }
+    }
+
+    // Move the elements of the next few old buckets to the new array.
+    void Migrate(size_t steps = kMigrateStep) {
+        if (!old_buckets_)
+            return;
+
+        size_t old_count = old_bucket_count();
+        for (; steps && migrate_ndx_ < old_count; steps--, migrate_ndx_++) {
+            BucketType& old_bucket = old_buckets_[migrate_ndx_];
+            while (!old_bucket.is_empty()) {
+                PtrType ptr = old_bucket.pop_front();
+                HashType hash = GetHash(KeyTraits::GetKey(*ptr));
+                buckets_[Index(hash, shift_)].push_front(utils::move(ptr));
+            }
+        }
+
+        if (migrate_ndx_ == old_count)
+            FreeOldBuckets();
+    }
+
+    void MaybeGrow() {
+        if (count_ <= bucket_count() * kMaxLoadFactor)
+            return;
+        // still on the last growth? finish it before starting another
+        if (old_buckets_)
+            Migrate(old_bucket_count());
+        if (shift_ + kGrowShift > 8 * sizeof(size_t) - 2)
+            return;
+
+        size_t new_count = bucket_count() << kGrowShift;
+        AllocChecker ac;
+        BucketType* new_buckets = new (&ac) BucketType[new_count];
+        if (!ac.check())
+            return;
+
+        old_buckets_ = buckets_;
+        old_shift_ = shift_;
+        migrate_ndx_ = 0;
+        buckets_ = new_buckets;
+        shift_ += kGrowShift;
+    }
+
+    void Erased() {
+        if (--count_ == 0)
+            Reset();
+    }
+
+    // Go back to the inline buckets. The table must be empty.
+    void Reset() {
+        FreeOldBuckets();
+        if (buckets_ != inline_buckets_)
+            delete[] buckets_;
+        buckets_ = inline_buckets_;
+        shift_ = kInlineBucketShift;
+    }
+
+    void FreeOldBuckets() {
+        if (old_buckets_ && old_buckets_ != inline_buckets_)
+            delete[] old_buckets_;
+        old_buckets_ = nullptr;
+        old_shift_ = 0;
+        migrate_ndx_ = 0;
+    }
+
+    size_t count_ = 0;
+
+    BucketType* buckets_ = inline_buckets_;
+    uint shift_ = kInlineBucketShift;
+
+    // the buckets being emptied into |buckets_| while growing, or nullptr.
+    // Those below |migrate_ndx_| are empty already.
+    BucketType* old_buckets_ = nullptr;
+    uint old_shift_ = 0;
+    size_t migrate_ndx_ = 0;
+
+    BucketType inline_buckets_[kInlineBuckets];
+};
+
+// Explicit declaration of constexpr storage.
+#define RESIZABLE_HASH_TABLE_PROP(_type, _name) \
+template <typename KeyType, typename PtrType, typename BucketType, typename KeyTraits, \
+          typename HashTraits> \
+constexpr _type ResizableHashTable<KeyType, PtrType, BucketType, KeyTraits, HashTraits>::_name
+
+RESIZABLE_HASH_TABLE_PROP(uint, kInlineBucketShift);
+RESIZABLE_HASH_TABLE_PROP(size_t, kInlineBuckets);
+RESIZABLE_HASH_TABLE_PROP(size_t, kMaxLoadFactor);
+RESIZABLE_HASH_TABLE_PROP(uint, kGrowShift);
+RESIZABLE_HASH_TABLE_PROP(size_t, kMigrateStep);
+
+#undef RESIZABLE_HASH_TABLE_PROP
+
+}  // namespace utils
@@ -0,0 +1,151 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <assert.h>
+
+namespace utils {
+
+// Lock-free intrusive multiple producer, single consumer FIFO queue of raw T*.
+//
+// Any number of threads may Push() at once, with interrupts enabled or not,
+// while one thread at a time takes elements out with Pop() or PopAll(). The
+// queue never allocates; the link lives in the element, found through the
+// traits, the same way as for the other intrusive containers. The queue does
+// not own its elements.
+//
+// Producers push onto a shared stack with a single atomic exchange-and-link.
+// The consumer takes the whole stack at once when it runs out of elements and
+// reverses it into its own private list, so elements come out in the order
+// they went in, and there is no ABA problem since nobody pops the shared
+// stack one element at a time.
+//
+// Example usage
+//
+//    struct Work : public utils::MpscQueueable<Work> { ... };
+//
+//    utils::MpscQueue<Work> queue;
+//
+//    // any cpu
+//    if (queue.Push(work))
+//        wake_consumer();    the queue was empty
+//
+//    // the consumer
+//    while (Work* work = queue.Pop())
+//        work->Run();
+//
+
+// MpscQueueNodeState<T>
+//
+// The state needed to be a member of an MpscQueue<T>.
+template <typename T>
+struct MpscQueueNodeState {
+    constexpr MpscQueueNodeState() { }
+
+    T* next_ = nullptr;
+};
+
+// DefaultMpscQueueTraits<T>
+//
+// Finds the node state of a T in its mpsc_node_state_ member. Derive from
+// MpscQueueable<T> to get one, or provide other traits.
+template <typename T>
+struct DefaultMpscQueueTraits {
+    static MpscQueueNodeState<T>& node_state(T& obj) { return obj.mpsc_node_state_; }
+};
+
+// MpscQueueable<T>
+//
+// A helper class which makes it simple to exist on an MpscQueue.
+template <typename T>
+struct MpscQueueable {
+private:
+    friend struct DefaultMpscQueueTraits<T>;
+    MpscQueueNodeState<T> mpsc_node_state_;
+};
+
+template <typename T, typename NodeTraits = DefaultMpscQueueTraits<T>>
+class MpscQueue {
+public:
+    constexpr MpscQueue() { }
+    ~MpscQueue() {
+        DEBUG_ASSERT(is_empty());
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Safe from any thread. Returns true if the queue was empty as far as
+    // producers can tell, which is when a sleeping consumer needs waking.
+    bool Push(T* obj) {
+        DEBUG_ASSERT(obj);
+        T* head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        do {
+            NodeTraits::node_state(*obj).next_ = head;
+        } while (!__atomic_compare_exchange_n(&head_, &head, obj, true,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return head == nullptr;
+    }
+
+    // Consumer only. Returns the oldest element, or nullptr if there is none.
+    T* Pop() {
+        if (!pending_) {
+            pending_ = Reverse(__atomic_exchange_n(&head_, nullptr, __ATOMIC_ACQUIRE));
+            if (!pending_)
+                return nullptr;
+        }
+
+        T* obj = pending_;
+        auto& ns = NodeTraits::node_state(*obj);
+        pending_ = ns.next_;
+        ns.next_ = nullptr;
+        return obj;
+    }
+
+    // Consumer only. Takes everything queued at once and returns it, oldest
+    // first, chained through the node state. The caller must clear each
+    // next_ link before pushing that element anywhere again.
+    T* PopAll() {
+        T* first = Reverse(__atomic_exchange_n(&head_, nullptr, __ATOMIC_ACQUIRE));
+        if (!pending_)
+            return first;
+
+        T* last = pending_;
+        while (NodeTraits::node_state(*last).next_)
+            last = NodeTraits::node_state(*last).next_;
+        NodeTraits::node_state(*last).next_ = first;
+
+        first = pending_;
+        pending_ = nullptr;
+        return first;
+    }
+
+    // Exact for the consumer, a hint for anybody else.
+    bool is_empty() const {
+        return !pending_ && !__atomic_load_n(&head_, __ATOMIC_RELAXED);
+    }
+
+private:
+    static T* Reverse(T* obj) {
+        T* prev = nullptr;
+        while (obj) {
+            auto& ns = NodeTraits::node_state(*obj);
+            T* next = ns.next_;
+            ns.next_ = prev;
+            prev = obj;
+            obj = next;
+        }
+        return prev;
+    }
+
+    // pushed elements, newest first, shared with the producers
+    T* head_ = nullptr;
+    // elements taken by the consumer but not yet popped, oldest first
+    T* pending_ = nullptr;
+};
+
+}  // namespace utils
@@ -22,6 +22,20 @@ protected:
         // TODO(jamesr): Replace uses of GCC builtins with something safer.
         __atomic_fetch_add(&ref_count_, 1, __ATOMIC_RELAXED);
     }
+    // Takes a reference unless the last one is already gone, that is unless the
+    // object is being destroyed. For objects also reachable through a lookup
+    // structure that the destructor takes them out of. Returns whether the
+    // reference was taken.
+    bool AddRefMaybeInDestructor() __WARN_UNUSED_RESULT {
+        DEBUG_ASSERT(adopted_);
+        int count = __atomic_load_n(&ref_count_, __ATOMIC_RELAXED);
+        while (count > 0) {
+            if (__atomic_compare_exchange_n(&ref_count_, &count, count + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return true;
+        }
+        return false;
+    }
     // Returns true if the object should self-delete.
     bool Release() __WARN_UNUSED_RESULT {
         DEBUG_ASSERT(adopted_);
@@ -0,0 +1,96 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <arch/defines.h>
+#include <compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils {
+
+// Bounded lock-free single producer, single consumer ring of T.
+//
+// One thread at a time may Push() while one thread at a time Pop()s, without
+// any lock between the two. Elements are copied in and out, so T should be
+// small and cheap to copy, for instance a pointer. |kCapacity| must be a
+// power of two. Unlike FifoBuffer the storage is inline, so a ring can live
+// in a per cpu structure or any other object without a separate allocation.
+//
+// The producer owns tail_ and the consumer head_; each only reads the
+// other's, and they sit on separate cache lines so the two sides don't
+// bounce one line back and forth.
+//
+// Example usage
+//
+//    utils::SpscRing<Packet*, 64> ring;
+//
+//    // producer
+//    if (!ring.Push(packet))
+//        ...full, drop or fall back to something slower
+//
+//    // consumer
+//    Packet* packet;
+//    while (ring.Pop(&packet))
+//        Process(packet);
+//
+template <typename T, size_t kCapacity>
+class SpscRing {
+public:
+    static_assert(kCapacity > 0 && (kCapacity & (kCapacity - 1)) == 0,
+                  "capacity must be a power of two");
+
+    SpscRing() { }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer only. Returns false if the ring is full.
+    bool Push(const T& val) {
+        size_t tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        size_t head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        if (tail - head == kCapacity)
+            return false;
+
+        slots_[tail & kMask] = val;
+        __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty.
+    bool Pop(T* val) {
+        size_t head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        size_t tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        if (head == tail)
+            return false;
+
+        *val = slots_[head & kMask];
+        __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Exact for either side about its own end, a hint otherwise.
+    size_t size() const {
+        // head first, so it can't be seen past the tail
+        size_t head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) - head;
+    }
+    bool is_empty() const { return size() == 0; }
+    bool is_full() const { return size() == kCapacity; }
+
+    static constexpr size_t capacity() { return kCapacity; }
+
+private:
+    static constexpr size_t kMask = kCapacity - 1;
+
+    // free running counts of elements pushed and popped
+    size_t head_ __ALIGNED(CACHE_LINE) = 0;
+    size_t tail_ __ALIGNED(CACHE_LINE) = 0;
+    T slots_[kCapacity] __ALIGNED(CACHE_LINE);
+};
+
+}  // namespace utils
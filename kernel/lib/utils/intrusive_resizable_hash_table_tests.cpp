@@ -0,0 +1,212 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <new.h>
+
+#include <platform.h>
+#include <unittest.h>
+#include <utils/intrusive_double_list.h>
+#include <utils/intrusive_hash_table.h>
+#include <utils/intrusive_resizable_hash_table.h>
+#include <utils/unique_ptr.h>
+
+namespace {
+
+struct Obj : public utils::SinglyLinkedListable<Obj*> {
+    uint64_t key = 0;
+
+    uint64_t GetKey() const { return key; }
+    static uint64_t GetHash(uint64_t key) { return key; }
+};
+
+using ObjTable = utils::ResizableHashTable<uint64_t, Obj*>;
+
+static bool rht_basic(void* context) {
+    BEGIN_TEST;
+
+    ObjTable table;
+    Obj objs[4];
+    for (size_t i = 0; i < 4; i++)
+        objs[i].key = i * 1000;
+
+    EXPECT_TRUE(table.is_empty(), "should be empty");
+    EXPECT_EQ(nullptr, table.find(0), "found in empty table");
+    EXPECT_EQ(nullptr, table.erase(0), "erased from empty table");
+
+    for (size_t i = 0; i < 4; i++)
+        table.insert(&objs[i]);
+    EXPECT_EQ(4u, table.size(), "wrong size");
+    EXPECT_EQ(ObjTable::kInlineBuckets, table.bucket_count(), "should not have grown");
+
+    for (size_t i = 0; i < 4; i++)
+        EXPECT_EQ(&objs[i], table.find(i * 1000), "not found");
+    EXPECT_EQ(nullptr, table.find(1), "found a missing key");
+
+    EXPECT_EQ(&objs[1], table.erase(1000u), "erase by key");
+    EXPECT_EQ(&objs[2], table.erase(objs[2]), "erase by object");
+    EXPECT_EQ(nullptr, table.find(1000), "found an erased key");
+    EXPECT_EQ(2u, table.size(), "wrong size");
+
+    EXPECT_EQ(&objs[3], table.find_if([](const Obj& obj) { return obj.key == 3000; }),
+              "find_if");
+    EXPECT_EQ(&objs[0], table.erase_if([](const Obj& obj) { return obj.key == 0; }),
+              "erase_if");
+    EXPECT_EQ(nullptr, table.erase_if([](const Obj& obj) { return obj.key == 0; }),
+              "erase_if of a missing key");
+
+    table.clear();
+    EXPECT_TRUE(table.is_empty(), "should be empty");
+
+    END_TEST;
+}
+
+static bool rht_grow(void* context) {
+    BEGIN_TEST;
+
+    constexpr size_t kCount = 10000;
+    AllocChecker ac;
+    Obj* objs = new (&ac) Obj[kCount];
+    REQUIRE_TRUE(ac.check(), "");
+
+    ObjTable table;
+    bool all_found = true;
+    for (size_t i = 0; i < kCount; i++) {
+        objs[i].key = i;
+        table.insert(&objs[i]);
+
+        // everything inserted so far stays findable while buckets move
+        if ((i % 97) == 0) {
+            for (size_t j = 0; j <= i; j += 13) {
+                if (table.find(j) != &objs[j])
+                    all_found = false;
+            }
+        }
+    }
+    EXPECT_TRUE(all_found, "lost an element while growing");
+    EXPECT_EQ(kCount, table.size(), "wrong size");
+    EXPECT_GE(table.bucket_count(), kCount / ObjTable::kMaxLoadFactor, "did not grow");
+
+    // erase every other element, then the rest
+    for (size_t i = 0; i < kCount; i += 2)
+        EXPECT_EQ(&objs[i], table.erase(i), "erase failed");
+    EXPECT_EQ(kCount / 2, table.size(), "wrong size");
+    for (size_t i = 0; i < kCount; i++) {
+        if (table.find(i) != ((i & 1) ? &objs[i] : nullptr))
+            all_found = false;
+    }
+    EXPECT_TRUE(all_found, "wrong elements left");
+
+    for (size_t i = 1; i < kCount; i += 2)
+        EXPECT_EQ(&objs[i], table.erase(objs[i]), "erase failed");
+    EXPECT_TRUE(table.is_empty(), "should be empty");
+    EXPECT_EQ(ObjTable::kInlineBuckets, table.bucket_count(), "should be back inline");
+
+    delete[] objs;
+    END_TEST;
+}
+
+struct ManagedObj {
+    using NodeState = utils::DoublyLinkedListNodeState<utils::unique_ptr<ManagedObj>>;
+    struct Traits {
+        static NodeState& node_state(ManagedObj& obj) { return obj.node_state; }
+    };
+
+    explicit ManagedObj(uint64_t key, size_t* live) : key(key), live(live) { (*live)++; }
+    ~ManagedObj() { (*live)--; }
+
+    uint64_t GetKey() const { return key; }
+    static uint64_t GetHash(uint64_t key) { return key; }
+
+    uint64_t key;
+    size_t* live;
+    NodeState node_state;
+};
+
+static bool rht_managed(void* context) {
+    BEGIN_TEST;
+
+    size_t live = 0;
+    {
+        utils::ResizableHashTable<uint64_t, utils::unique_ptr<ManagedObj>,
+                                  utils::DoublyLinkedList<utils::unique_ptr<ManagedObj>,
+                                                          ManagedObj::Traits>> table;
+        for (uint64_t i = 0; i < 500; i++) {
+            AllocChecker ac;
+            utils::unique_ptr<ManagedObj> obj(new (&ac) ManagedObj(i << 32, &live));
+            REQUIRE_TRUE(ac.check(), "");
+            table.insert(utils::move(obj));
+        }
+        EXPECT_EQ(500u, live, "wrong number of objects");
+
+        size_t visited = 0;
+        table.for_each([&visited](ManagedObj& obj) { visited++; });
+        EXPECT_EQ(500u, visited, "for_each missed objects");
+
+        utils::unique_ptr<ManagedObj> obj = table.erase(7ull << 32);
+        EXPECT_TRUE(obj != nullptr, "erase failed");
+        EXPECT_TRUE(table.find(7ull << 32) == nullptr, "found an erased key");
+        obj.reset();
+        EXPECT_EQ(499u, live, "erased object not freed");
+    }
+    EXPECT_EQ(0u, live, "table did not free its objects");
+
+    END_TEST;
+}
+
+// Time lookups in a fixed HashTable with 37 buckets and in a resizable one
+// as the number of elements goes up.
+static bool rht_benchmark(void* context) {
+    BEGIN_TEST;
+
+    constexpr size_t kMaxCount = 20000;
+    constexpr size_t kLookups = 20000;
+    AllocChecker ac;
+    Obj* objs = new (&ac) Obj[kMaxCount];
+    REQUIRE_TRUE(ac.check(), "");
+    for (size_t i = 0; i < kMaxCount; i++)
+        objs[i].key = i * 4096;
+
+    for (size_t count = 100; count <= kMaxCount; count *= 10) {
+        if (count > kMaxCount)
+            count = kMaxCount;
+
+        utils::HashTable<uint64_t, Obj*> fixed;
+        ObjTable resizable;
+        for (size_t i = 0; i < count; i++)
+            fixed.insert(&objs[i]);
+
+        lk_bigtime_t start = current_time_hires();
+        for (size_t i = 0; i < kLookups; i++)
+            fixed.find(objs[i % count].key);
+        lk_bigtime_t fixed_time = current_time_hires() - start;
+        fixed.clear();
+
+        for (size_t i = 0; i < count; i++)
+            resizable.insert(&objs[i]);
+
+        start = current_time_hires();
+        for (size_t i = 0; i < kLookups; i++)
+            resizable.find(objs[i % count].key);
+        lk_bigtime_t resizable_time = current_time_hires() - start;
+        resizable.clear();
+
+        unittest_printf("%6zu elements: %llu us fixed, %llu us resizable (%zu buckets)\n",
+                        count, fixed_time, resizable_time, resizable.bucket_count());
+    }
+
+    delete[] objs;
+    END_TEST;
+}
+
+}  // namespace
+
+UNITTEST_START_TESTCASE(resizable_hash_table_tests)
+UNITTEST("Resizable hash table basic", rht_basic)
+UNITTEST("Resizable hash table grow", rht_grow)
+UNITTEST("Resizable hash table managed", rht_managed)
+UNITTEST("Resizable hash table benchmark", rht_benchmark)
+UNITTEST_END_TESTCASE(resizable_hash_table_tests, "rhttests", "Resizable Hash Table Tests",
+                      NULL, NULL);
@@ -0,0 +1,151 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <new.h>
+
+#include <kernel/thread.h>
+#include <unittest.h>
+#include <utils/mpsc_queue.h>
+
+namespace {
+
+struct Item : public utils::MpscQueueable<Item> {
+    uint32_t producer = 0;
+    uint32_t seq = 0;
+};
+
+static bool mpsc_queue_basic(void* context) {
+    BEGIN_TEST;
+
+    utils::MpscQueue<Item> queue;
+    Item items[8];
+
+    EXPECT_TRUE(queue.is_empty(), "should be empty");
+    EXPECT_EQ(nullptr, queue.Pop(), "pop from empty queue");
+
+    EXPECT_TRUE(queue.Push(&items[0]), "first push should see an empty queue");
+    for (size_t i = 1; i < 4; i++)
+        EXPECT_FALSE(queue.Push(&items[i]), "queue should not be empty");
+
+    EXPECT_EQ(&items[0], queue.Pop(), "wrong order");
+    EXPECT_EQ(&items[1], queue.Pop(), "wrong order");
+
+    // pushed while the consumer still holds older elements
+    for (size_t i = 4; i < 8; i++)
+        queue.Push(&items[i]);
+
+    for (size_t i = 2; i < 8; i++)
+        EXPECT_EQ(&items[i], queue.Pop(), "wrong order");
+
+    EXPECT_TRUE(queue.is_empty(), "should be empty");
+    EXPECT_EQ(nullptr, queue.Pop(), "pop from empty queue");
+
+    END_TEST;
+}
+
+static bool mpsc_queue_pop_all(void* context) {
+    BEGIN_TEST;
+
+    utils::MpscQueue<Item> queue;
+    Item items[6];
+
+    EXPECT_EQ(nullptr, queue.PopAll(), "pop all from empty queue");
+
+    for (size_t i = 0; i < 3; i++)
+        queue.Push(&items[i]);
+    EXPECT_EQ(&items[0], queue.Pop(), "wrong order");
+    for (size_t i = 3; i < 6; i++)
+        queue.Push(&items[i]);
+
+    size_t count = 0;
+    Item* item = queue.PopAll();
+    while (item) {
+        count++;
+        EXPECT_EQ(&items[count], item, "wrong order");
+        auto& ns = utils::DefaultMpscQueueTraits<Item>::node_state(*item);
+        item = ns.next_;
+        ns.next_ = nullptr;
+    }
+    EXPECT_EQ(5u, count, "wrong count");
+    EXPECT_TRUE(queue.is_empty(), "should be empty");
+
+    END_TEST;
+}
+
+constexpr uint32_t kProducers = 4;
+constexpr uint32_t kItemsPerProducer = 1000;
+
+struct ProducerArgs {
+    utils::MpscQueue<Item>* queue;
+    Item* items;
+    uint32_t id;
+};
+
+static int producer_thread(void* arg) {
+    auto args = static_cast<ProducerArgs*>(arg);
+    for (uint32_t i = 0; i < kItemsPerProducer; i++) {
+        Item* item = &args->items[i];
+        item->producer = args->id;
+        item->seq = i;
+        args->queue->Push(item);
+        if ((i % 64) == 0)
+            thread_yield();
+    }
+    return 0;
+}
+
+static bool mpsc_queue_threads(void* context) {
+    BEGIN_TEST;
+
+    utils::MpscQueue<Item> queue;
+    AllocChecker ac;
+    Item* items = new (&ac) Item[kProducers * kItemsPerProducer];
+    REQUIRE_TRUE(ac.check(), "");
+
+    ProducerArgs args[kProducers];
+    thread_t* threads[kProducers];
+    for (uint32_t i = 0; i < kProducers; i++) {
+        args[i] = {&queue, &items[i * kItemsPerProducer], i};
+        threads[i] = thread_create("mpsc producer", &producer_thread, &args[i],
+                                   DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(threads[i]);
+    }
+
+    // every element shows up exactly once, in order for each producer
+    uint32_t next_seq[kProducers] = {};
+    uint32_t total = 0;
+    bool in_order = true;
+    while (total < kProducers * kItemsPerProducer) {
+        Item* item = queue.Pop();
+        if (!item) {
+            thread_yield();
+            continue;
+        }
+        if (item->seq != next_seq[item->producer])
+            in_order = false;
+        next_seq[item->producer] = item->seq + 1;
+        total++;
+    }
+
+    for (uint32_t i = 0; i < kProducers; i++)
+        thread_join(threads[i], NULL, INFINITE_TIME);
+
+    EXPECT_TRUE(in_order, "elements out of order");
+    EXPECT_TRUE(queue.is_empty(), "should be empty");
+    for (uint32_t i = 0; i < kProducers; i++)
+        EXPECT_EQ(kItemsPerProducer, next_seq[i], "missing elements");
+
+    delete[] items;
+    END_TEST;
+}
+
+}  // namespace
+
+UNITTEST_START_TESTCASE(mpsc_queue_tests)
+UNITTEST("MPSC queue basic", mpsc_queue_basic)
+UNITTEST("MPSC queue pop all", mpsc_queue_pop_all)
+UNITTEST("MPSC queue threads", mpsc_queue_threads)
+UNITTEST_END_TESTCASE(mpsc_queue_tests, "mpsctests", "MPSC Queue Tests", NULL, NULL);
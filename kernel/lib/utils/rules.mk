@@ -21,9 +21,12 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/intrusive_doubly_linked_list_tests.cpp \
     $(LOCAL_DIR)/intrusive_hash_table_dll_tests.cpp \
     $(LOCAL_DIR)/intrusive_hash_table_sll_tests.cpp \
+    $(LOCAL_DIR)/intrusive_resizable_hash_table_tests.cpp \
     $(LOCAL_DIR)/intrusive_singly_linked_list_tests.cpp \
+    $(LOCAL_DIR)/mpsc_queue_tests.cpp \
     $(LOCAL_DIR)/ref_counted_tests.cpp \
     $(LOCAL_DIR)/ref_ptr_tests.cpp \
+    $(LOCAL_DIR)/spsc_ring_tests.cpp \
     $(LOCAL_DIR)/unique_ptr_tests.cpp \
 
 include make/module.mk
@@ -0,0 +1,95 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/thread.h>
+#include <unittest.h>
+#include <utils/spsc_ring.h>
+
+namespace {
+
+static bool spsc_ring_basic(void* context) {
+    BEGIN_TEST;
+
+    utils::SpscRing<uint32_t, 8> ring;
+    uint32_t val = 0;
+
+    EXPECT_TRUE(ring.is_empty(), "should be empty");
+    EXPECT_FALSE(ring.Pop(&val), "pop from empty ring");
+
+    // go around a few times so the indices wrap
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    for (int loop = 0; loop < 5; loop++) {
+        while (ring.Push(pushed))
+            pushed++;
+        EXPECT_TRUE(ring.is_full(), "should be full");
+        EXPECT_EQ(8u, ring.size(), "wrong size");
+
+        for (int i = 0; i < 5; i++) {
+            EXPECT_TRUE(ring.Pop(&val), "pop failed");
+            EXPECT_EQ(popped, val, "wrong order");
+            popped++;
+        }
+        EXPECT_EQ(3u, ring.size(), "wrong size");
+    }
+
+    while (ring.Pop(&val)) {
+        EXPECT_EQ(popped, val, "wrong order");
+        popped++;
+    }
+    EXPECT_EQ(pushed, popped, "lost elements");
+    EXPECT_TRUE(ring.is_empty(), "should be empty");
+
+    END_TEST;
+}
+
+constexpr uint32_t kElements = 20000;
+
+static int spsc_producer(void* arg) {
+    auto ring = static_cast<utils::SpscRing<uint32_t, 16>*>(arg);
+    for (uint32_t i = 0; i < kElements;) {
+        if (ring->Push(i))
+            i++;
+        else
+            thread_yield();
+    }
+    return 0;
+}
+
+static bool spsc_ring_threads(void* context) {
+    BEGIN_TEST;
+
+    utils::SpscRing<uint32_t, 16> ring;
+    thread_t* producer = thread_create("spsc producer", &spsc_producer, &ring,
+                                       DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(producer);
+
+    bool in_order = true;
+    for (uint32_t expected = 0; expected < kElements;) {
+        uint32_t val;
+        if (!ring.Pop(&val)) {
+            thread_yield();
+            continue;
+        }
+        if (val != expected)
+            in_order = false;
+        expected++;
+    }
+
+    thread_join(producer, NULL, INFINITE_TIME);
+
+    EXPECT_TRUE(in_order, "elements out of order");
+    EXPECT_TRUE(ring.is_empty(), "should be empty");
+
+    END_TEST;
+}
+
+}  // namespace
+
+UNITTEST_START_TESTCASE(spsc_ring_tests)
+UNITTEST("SPSC ring basic", spsc_ring_basic)
+UNITTEST("SPSC ring threads", spsc_ring_threads)
+UNITTEST_END_TESTCASE(spsc_ring_tests, "spsctests", "SPSC Ring Tests", NULL, NULL);
@@ -117,6 +117,9 @@ BOOTSERVER := $(BUILDDIR)/tools/bootserver
 LOGLISTENER := $(BUILDDIR)/tools/loglistener
 NETRUNCMD := $(BUILDDIR)/tools/netruncmd
 
+# compress the files in the bootfs image; set empty to store them as is
+MKBOOTFS_FLAGS ?= -c
+
 $(BUILDDIR)/tools/%: system/tools/%.c
 	@echo compiling $@
 	@$(MKDIR)
@@ -132,7 +135,7 @@ USER_MANIFEST_DEPS := $(foreach x,$(USER_MANIFEST_LINES),$(lastword $(subst =,$(
 $(USER_BOOTFS): $(MKBOOTFS) $(BOOTSERVER) $(LOGLISTENER) $(NETRUNCMD) $(USER_MANIFEST) $(USER_MANIFEST_DEPS)
 	@echo generating $@
 	@$(MKDIR)
-	$(NOECHO)$(MKBOOTFS) -o $(USER_BOOTFS) $(USER_MANIFEST)
+	$(NOECHO)$(MKBOOTFS) $(MKBOOTFS_FLAGS) -o $(USER_BOOTFS) $(USER_MANIFEST)
 
 GENERATED += $(USER_BOOTFS)
 
@@ -147,6 +147,10 @@ unsigned int remap_interrupt(unsigned int vector) {
     return vector;
 }
 
+status_t set_interrupt_affinity(unsigned int vector, mp_cpu_mask_t cpu_mask) {
+    return ERR_NOT_SUPPORTED;
+}
+
 void register_int_handler(unsigned int vector, int_handler handler, void* arg) {
     if (vector >= MAX_INT)
         panic("register_int_handler: vector out of range %d\n", vector);
@@ -9,6 +9,15 @@
 #include <compiler.h>
 #include <debug.h>
 #include <trace.h>
+#include <platform/debug.h>
+
+/* Default implementation of string output, a character at a time. */
+__WEAK void platform_dputs(const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        platform_dputc(str[i]);
+    }
+}
 
 /* Default implementation of panic time getc/putc.
  * Just calls through to the underlying dputc/dgetc implementation
@@ -14,6 +14,11 @@
  * chooses not to implement.
  */
 
+__WEAK uint64_t current_time_ns(void)
+{
+    return current_time_hires() * 1000;
+}
+
 __WEAK void platform_init_mmu_mappings(void)
 {
 }
@@ -8,12 +8,14 @@
 
 #include <assert.h>
 #include <err.h>
+#include <string.h>
 #include <trace.h>
 
 #include <lk/init.h>
 
 #include <arch/x86/apic.h>
 #include <kernel/port.h>
+#include <kernel/vm.h>
 #include <platform/pc/acpi.h>
 
 #include "acpi_ec.h"
@@ -204,6 +206,200 @@ void platform_init_acpi(void)
 /* initialize ACPI tables as soon as we have a working VM */
 LK_INIT_HOOK(acpi_tables, &platform_init_acpi_tables, LK_INIT_LEVEL_VM + 1);
 
+/* NUMA affinity from the SRAT. The memory arenas are split by node before the
+ * pmm is up, long before the tables above are, so the SRAT is found and read
+ * by hand through the kernel's initial physical mapping. Proximity domains are
+ * numbered into nodes in the order they turn up. */
+#define NUMA_MAX_MEM_RANGES 32
+#define NUMA_MAX_CPUS 256
+
+extern uint32_t bootloader_acpi_rsdp;
+
+struct numa_mem_range {
+    uint64_t base;
+    uint64_t end;
+    uint node;
+};
+
+struct numa_cpu {
+    uint32_t apic_id;
+    uint node;
+};
+
+static struct numa_mem_range numa_mem_ranges[NUMA_MAX_MEM_RANGES];
+static uint numa_mem_range_count;
+static struct numa_cpu numa_cpus[NUMA_MAX_CPUS];
+static uint numa_cpu_count;
+static uint32_t numa_domains[PMM_MAX_NODES];
+static uint numa_node_count;
+
+static uint numa_domain_to_node(uint32_t domain)
+{
+    for (uint i = 0; i < numa_node_count; i++) {
+        if (numa_domains[i] == domain)
+            return i;
+    }
+    if (numa_node_count == PMM_MAX_NODES) {
+        TRACEF("too many NUMA domains, folding domain %u into node 0\n", domain);
+        return 0;
+    }
+    numa_domains[numa_node_count] = domain;
+    return numa_node_count++;
+}
+
+static const void *acpi_early_map(uint64_t pa, size_t len)
+{
+    if (len == 0 || pa + len < pa)
+        return NULL;
+    void *va = paddr_to_kvaddr(pa);
+    if (!va || paddr_to_kvaddr(pa + len - 1) != (uint8_t *)va + len - 1)
+        return NULL;
+    return va;
+}
+
+static bool acpi_early_checksum(const void *ptr, size_t len)
+{
+    const uint8_t *p = ptr;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++)
+        sum += p[i];
+    return sum == 0;
+}
+
+static const ACPI_TABLE_RSDP *acpi_early_find_rsdp(void)
+{
+    if (bootloader_acpi_rsdp)
+        return acpi_early_map(bootloader_acpi_rsdp, sizeof(ACPI_TABLE_RSDP));
+
+    /* the BIOS read only area, on 16 byte boundaries */
+    for (uint64_t pa = 0xe0000; pa < 0x100000; pa += 16) {
+        const ACPI_TABLE_RSDP *rsdp = acpi_early_map(pa, sizeof(ACPI_TABLE_RSDP));
+        if (rsdp && !memcmp(rsdp->Signature, ACPI_SIG_RSDP, sizeof(rsdp->Signature)) &&
+                acpi_early_checksum(rsdp, ACPI_RSDP_CHECKSUM_LENGTH))
+            return rsdp;
+    }
+    return NULL;
+}
+
+static const ACPI_TABLE_HEADER *acpi_early_map_table(uint64_t pa)
+{
+    const ACPI_TABLE_HEADER *hdr = acpi_early_map(pa, sizeof(*hdr));
+    if (!hdr || hdr->Length < sizeof(*hdr))
+        return NULL;
+    return acpi_early_map(pa, hdr->Length);
+}
+
+static const ACPI_TABLE_HEADER *acpi_early_find_table(const char *sig)
+{
+    const ACPI_TABLE_RSDP *rsdp = acpi_early_find_rsdp();
+    if (!rsdp)
+        return NULL;
+
+    bool xsdt = rsdp->Revision >= 2 && rsdp->XsdtPhysicalAddress;
+    const ACPI_TABLE_HEADER *sdt = acpi_early_map_table(
+            xsdt ? rsdp->XsdtPhysicalAddress : rsdp->RsdtPhysicalAddress);
+    if (!sdt)
+        return NULL;
+
+    size_t entry_size = xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+    size_t count = (sdt->Length - sizeof(*sdt)) / entry_size;
+    const uint8_t *entries = (const uint8_t *)(sdt + 1);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t pa = 0;
+        memcpy(&pa, entries + i * entry_size, entry_size);
+
+        const ACPI_TABLE_HEADER *table = acpi_early_map_table(pa);
+        if (table && !memcmp(table->Signature, sig, ACPI_NAME_SIZE))
+            return table;
+    }
+    return NULL;
+}
+
+void platform_init_numa_early(void)
+{
+    const ACPI_TABLE_HEADER *srat = acpi_early_find_table(ACPI_SIG_SRAT);
+    if (!srat) {
+        LTRACEF("no SRAT, treating memory as uniform\n");
+        return;
+    }
+
+    const uint8_t *p = (const uint8_t *)srat + sizeof(ACPI_TABLE_SRAT);
+    const uint8_t *end = (const uint8_t *)srat + srat->Length;
+    while (p + sizeof(ACPI_SUBTABLE_HEADER) <= end) {
+        const ACPI_SUBTABLE_HEADER *sub = (const ACPI_SUBTABLE_HEADER *)p;
+        if (sub->Length < sizeof(*sub) || p + sub->Length > end)
+            break;
+
+        switch (sub->Type) {
+        case ACPI_SRAT_TYPE_CPU_AFFINITY: {
+            const ACPI_SRAT_CPU_AFFINITY *cpu = (const ACPI_SRAT_CPU_AFFINITY *)sub;
+            if (!(cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY) || numa_cpu_count == NUMA_MAX_CPUS)
+                break;
+            uint32_t domain = cpu->ProximityDomainLo;
+            if (srat->Revision >= 2) {
+                domain |= (uint32_t)cpu->ProximityDomainHi[0] << 8 |
+                          (uint32_t)cpu->ProximityDomainHi[1] << 16 |
+                          (uint32_t)cpu->ProximityDomainHi[2] << 24;
+            }
+            numa_cpus[numa_cpu_count].apic_id = cpu->ApicId;
+            numa_cpus[numa_cpu_count].node = numa_domain_to_node(domain);
+            numa_cpu_count++;
+            break;
+        }
+        case ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY: {
+            const ACPI_SRAT_X2APIC_CPU_AFFINITY *cpu =
+                    (const ACPI_SRAT_X2APIC_CPU_AFFINITY *)sub;
+            if (!(cpu->Flags & ACPI_SRAT_CPU_USE_AFFINITY) || numa_cpu_count == NUMA_MAX_CPUS)
+                break;
+            numa_cpus[numa_cpu_count].apic_id = cpu->ApicId;
+            numa_cpus[numa_cpu_count].node = numa_domain_to_node(cpu->ProximityDomain);
+            numa_cpu_count++;
+            break;
+        }
+        case ACPI_SRAT_TYPE_MEMORY_AFFINITY: {
+            const ACPI_SRAT_MEM_AFFINITY *mem = (const ACPI_SRAT_MEM_AFFINITY *)sub;
+            if (!(mem->Flags & ACPI_SRAT_MEM_ENABLED) || mem->Length == 0 ||
+                    numa_mem_range_count == NUMA_MAX_MEM_RANGES)
+                break;
+            struct numa_mem_range *r = &numa_mem_ranges[numa_mem_range_count++];
+            r->base = mem->BaseAddress;
+            r->end = mem->BaseAddress + mem->Length;
+            r->node = numa_domain_to_node(mem->ProximityDomain);
+            break;
+        }
+        }
+
+        p += sub->Length;
+    }
+
+    LTRACEF("SRAT: %u nodes, %u memory ranges, %u cpus\n",
+            numa_node_count, numa_mem_range_count, numa_cpu_count);
+}
+
+uint platform_mem_numa_node(uint64_t base, uint64_t *size)
+{
+    uint node = 0;
+    for (uint i = 0; i < numa_mem_range_count; i++) {
+        const struct numa_mem_range *r = &numa_mem_ranges[i];
+        if (base >= r->base && base < r->end) {
+            node = r->node;
+            *size = MIN(*size, r->end - base);
+        } else if (r->base > base) {
+            *size = MIN(*size, r->base - base);
+        }
+    }
+    return node;
+}
+
+uint platform_cpu_numa_node(uint32_t apic_id)
+{
+    for (uint i = 0; i < numa_cpu_count; i++) {
+        if (numa_cpus[i].apic_id == apic_id)
+            return numa_cpus[i].node;
+    }
+    return 0;
+}
+
 /* @brief Switch interrupts to APIC model (controls IRQ routing) */
 static ACPI_STATUS acpi_set_apic_irq_mode(void)
 {
@@ -8,6 +8,7 @@
 #include <stdarg.h>
 #include <reg.h>
 #include <stdio.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <arch/x86.h>
@@ -25,6 +26,19 @@ static const int uart_io_port = 0x3f8;
 
 cbuf_t console_input_buf;
 
+/* Transmit ring, emptied into the uart's fifo a fifo's worth at a time from
+ * the transmit holding register empty interrupt. Until that interrupt is
+ * hooked up, and when the ring is full, writers feed the fifo directly.
+ */
+#define UART_TX_BUF_SIZE 4096
+static char uart_tx_buf[UART_TX_BUF_SIZE];
+static size_t uart_tx_head;
+static size_t uart_tx_tail;
+static spin_lock_t uart_tx_lock = SPIN_LOCK_INITIAL_VALUE;
+static bool uart_tx_irq;
+static size_t uart_fifo_depth = 1;
+static uint8_t uart_ier;
+
 enum handler_return platform_drain_debug_uart_rx(void)
 {
     unsigned char c;
@@ -39,9 +53,53 @@ enum handler_return platform_drain_debug_uart_rx(void)
     return resched ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
 
+static bool uart_tx_ready(void)
+{
+    return inp(uart_io_port + 5) & (1<<5);
+}
+
+/* Move up to a fifo's worth from the ring to an empty transmit fifo, and
+ * stop asking for the interrupt once the ring is empty. Called with
+ * uart_tx_lock held.
+ */
+static void uart_tx_fill_locked(void)
+{
+    for (size_t i = 0; i < uart_fifo_depth && uart_tx_tail != uart_tx_head; i++) {
+        outp(uart_io_port + 0, uart_tx_buf[uart_tx_tail]);
+        uart_tx_tail = (uart_tx_tail + 1) % UART_TX_BUF_SIZE;
+    }
+
+    uint8_t ier = uart_ier;
+    if (uart_tx_tail == uart_tx_head)
+        ier &= ~(1<<1);
+    else
+        ier |= (1<<1);
+    if (ier != uart_ier) {
+        uart_ier = ier;
+        outp(uart_io_port + 1, ier);
+    }
+}
+
+/* Spin until the ring is empty. Called with uart_tx_lock held. */
+static void uart_tx_flush_locked(void)
+{
+    while (uart_tx_tail != uart_tx_head) {
+        while (!uart_tx_ready())
+            ;
+        uart_tx_fill_locked();
+    }
+}
+
 static enum handler_return uart_irq_handler(void *arg)
 {
-    return platform_drain_debug_uart_rx();
+    enum handler_return ret = platform_drain_debug_uart_rx();
+
+    spin_lock(&uart_tx_lock);
+    if (uart_tx_ready())
+        uart_tx_fill_locked();
+    spin_unlock(&uart_tx_lock);
+
+    return ret;
 }
 
 void platform_init_debug_early(void)
@@ -55,6 +113,10 @@ void platform_init_debug_early(void)
     outp(uart_io_port + 1, divisor >> 8); // msb
     outp(uart_io_port + 3, 3); // 8N1
     outp(uart_io_port + 2, 0x07); // enable FIFO, clear, 14-byte threshold
+
+    /* a 16550A reports its fifo as enabled, earlier parts have none */
+    if ((inp(uart_io_port + 2) & 0xc0) == 0xc0)
+        uart_fifo_depth = 16;
 }
 
 void platform_init_debug(void)
@@ -66,23 +128,74 @@ void platform_init_debug(void)
     register_int_handler(irq, uart_irq_handler, NULL);
     unmask_interrupt(irq);
 
-    outp(uart_io_port + 1, 0x1); // enable receive data available interrupt
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&uart_tx_lock, state);
+    uart_ier = 0x1; // enable receive data available interrupt
+    outp(uart_io_port + 1, uart_ier);
+    uart_tx_irq = true;
+    spin_unlock_irqrestore(&uart_tx_lock, state);
 }
 
-static void debug_uart_putc(char c)
+static void debug_uart_putc_locked(char c)
 {
-    while ((inp(uart_io_port + 5) & (1<<6)) == 0)
-        ;
-    outp(uart_io_port + 0, c);
+    if (!uart_tx_irq) {
+        while ((inp(uart_io_port + 5) & (1<<6)) == 0)
+            ;
+        outp(uart_io_port + 0, c);
+        return;
+    }
+
+    size_t next = (uart_tx_head + 1) % UART_TX_BUF_SIZE;
+    if (next == uart_tx_tail) {
+        /* full: make room by waiting for the uart here */
+        while (!uart_tx_ready())
+            ;
+        uart_tx_fill_locked();
+    }
+    uart_tx_buf[uart_tx_head] = c;
+    uart_tx_head = next;
+}
+
+void platform_dputs(const char *str, size_t len)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&uart_tx_lock, state);
+    for (size_t i = 0; i < len; i++) {
+        char c = str[i];
+        if (c == '\n') {
+            cputc('\r');
+            debug_uart_putc_locked('\r');
+        }
+        cputc(c);
+        debug_uart_putc_locked(c);
+    }
+    /* if the fifo is idle there's no interrupt coming, so start it off */
+    if (uart_tx_irq && uart_tx_ready())
+        uart_tx_fill_locked();
+    spin_unlock_irqrestore(&uart_tx_lock, state);
 }
 
 void platform_dputc(char c)
 {
-    if (c == '\n')
-        platform_dputc('\r');
+    platform_dputs(&c, 1);
+}
 
+/* At panic time the interrupt may never come: push out what's queued and
+ * write straight to the uart.
+ */
+void platform_pputc(char c)
+{
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&uart_tx_lock, state);
+    uart_tx_flush_locked();
+    uart_tx_irq = false;
+    if (c == '\n') {
+        cputc('\r');
+        debug_uart_putc_locked('\r');
+    }
     cputc(c);
-    debug_uart_putc(c);
+    debug_uart_putc_locked(c);
+    spin_unlock_irqrestore(&uart_tx_lock, state);
 }
 
 int platform_dgetc(char *c, bool wait)
@@ -70,6 +70,14 @@ status_t platform_find_pcie_config(struct acpi_pcie_config *config);
 status_t platform_find_pcie_legacy_irq_mapping(struct acpi_pcie_irq_mapping *root_bus_map);
 status_t platform_find_hpet(struct acpi_hpet_descriptor *hpet);
 
+// Read the NUMA topology out of the SRAT. Called before the pmm is set up.
+void platform_init_numa_early(void);
+// The NUMA node of the memory at |base|, trimming |size| so the range
+// [base, base + size) lies within the node. Node 0 if there's no SRAT.
+uint platform_mem_numa_node(uint64_t base, uint64_t *size);
+// The NUMA node of the cpu with local APIC id |apic_id|.
+uint platform_cpu_numa_node(uint32_t apic_id);
+
 // Powers off the machine.  Returns on failure
 void acpi_poweroff(void);
 // Reboots the machine.  Returns on failure
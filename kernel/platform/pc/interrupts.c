@@ -16,6 +16,7 @@
 #include <arch/x86.h>
 #include <arch/x86/interrupts.h>
 #include <arch/x86/apic.h>
+#include <arch/x86/mp.h>
 #include <lk/init.h>
 #include <kernel/spinlock.h>
 #include "platform_p.h"
@@ -238,6 +239,10 @@ unsigned int remap_interrupt(unsigned int vector) {
     return apic_io_isa_to_global(vector);
 }
 
+status_t set_interrupt_affinity(unsigned int vector, mp_cpu_mask_t cpu_mask) {
+    return ERR_NOT_SUPPORTED;
+}
+
 #ifdef WITH_DEV_PCIE
 status_t x86_alloc_msi_block(uint requested_irqs,
                              bool can_target_64bit,
@@ -295,6 +300,32 @@ status_t x86_alloc_msi_block(uint requested_irqs,
     return res;
 }
 
+status_t x86_get_msi_cpu_target(const pcie_msi_block_t* block,
+                                uint                    msi_id,
+                                uint                    cpu_num,
+                                uint64_t*               out_tgt_addr) {
+    DEBUG_ASSERT(block && block->allocated);
+    DEBUG_ASSERT(msi_id < block->num_irq);
+    DEBUG_ASSERT(out_tgt_addr);
+
+    uint32_t apic_id = x86_cpu_num_to_apic_id(cpu_num);
+    if (apic_id == INVALID_APIC_ID)
+        return ERR_INVALID_ARGS;
+
+    // Same format as the block's default target, only the Dest ID differs.
+    // Physical destination mode only has room for an 8 bit APIC ID.
+    if (apic_id > 0xFF)
+        return ERR_NOT_SUPPORTED;
+
+    uint32_t tgt_addr = 0xFEE00000;                 // base addr
+    tgt_addr |= apic_id << 12;                      // Dest ID == cpu_num's local APIC ID
+    tgt_addr |= 0x08;                               // Redir hint == 1
+    tgt_addr &= ~0x04;                              // Dest Mode == Physical
+
+    *out_tgt_addr = tgt_addr;
+    return NO_ERROR;
+}
+
 void x86_free_msi_block(pcie_msi_block_t* block) {
     DEBUG_ASSERT(block);
     DEBUG_ASSERT(block->allocated);
@@ -8,6 +8,7 @@
 #include <trace.h>
 #include <kernel/vm.h>
 #include "platform_p.h"
+#include <platform/pc/acpi.h>
 #include <platform/multiboot.h>
 
 #define LOCAL_TRACE 0
@@ -17,7 +18,7 @@ extern multiboot_info_t *_multiboot_info;
 extern void *_zero_page_boot_params;
 
 /* statically allocate an array of pmm_arena_ts to be filled in at boot time */
-#define PMM_ARENAS 16
+#define PMM_ARENAS 32
 static pmm_arena_t mem_arenas[PMM_ARENAS];
 
 struct addr_range {
@@ -128,23 +129,28 @@ static int mem_arena_init(boot_addr_range_t *range)
         while (size && used < PMM_ARENAS) {
             pmm_arena_t *arena = &mem_arenas[used];
 
+            /* keep each arena within one NUMA node */
+            uint64_t run = size;
+            arena->numa_node = platform_mem_numa_node(base, &run);
+            run = MAX(ROUNDDOWN(run, PAGE_SIZE), PAGE_SIZE);
+
             arena->base = base;
-            arena->size = size;
+            arena->size = run;
 
             if ((uint64_t)arena->base != base) {
                 LTRACEF("Range base %#llx is too high.\n", base);
                 break;
             }
-            if ((uint64_t)arena->size != size) {
-                LTRACEF("Range size %#llx is too large, splitting it.\n", size);
+            if ((uint64_t)arena->size != run) {
+                LTRACEF("Range size %#llx is too large, splitting it.\n", run);
                 arena->size = -PAGE_SIZE;
             }
 
             size -= arena->size;
             base += arena->size;
 
-            LTRACEF("Adding pmm range at %#lx of %#lx bytes.\n",
-                    arena->base, arena->size);
+            LTRACEF("Adding pmm range at %#lx of %#lx bytes on node %u.\n",
+                    arena->base, arena->size, arena->numa_node);
 
             arena->name = "memory";
             arena->priority = 1;
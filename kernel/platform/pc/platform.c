@@ -12,6 +12,7 @@
 #include <trace.h>
 #include <arch/x86/apic.h>
 #include <arch/x86/mmu.h>
+#include <arch/x86/mp.h>
 #include <platform.h>
 #include "platform_p.h"
 #include <platform/pc.h>
@@ -39,6 +40,10 @@ extern status_t x86_alloc_msi_block(uint requested_irqs,
                                     bool is_msix,
                                     pcie_msi_block_t* out_block);
 extern void x86_free_msi_block(pcie_msi_block_t* block);
+extern status_t x86_get_msi_cpu_target(const pcie_msi_block_t* block,
+                                       uint                    msi_id,
+                                       uint                    cpu_num,
+                                       uint64_t*               out_tgt_addr);
 extern void x86_register_msi_handler(const pcie_msi_block_t* block,
                                      uint                    msi_id,
                                      int_handler             handler,
@@ -240,6 +245,9 @@ void platform_early_init(void)
     /* if the bootloader has framebuffer info, use it for early console */
     platform_early_display_init();
 
+    /* find the NUMA nodes, so the arenas can be split along them */
+    platform_init_numa_early();
+
     /* initialize physical memory arenas */
     platform_mem_init();
 
@@ -291,6 +299,12 @@ void platform_init_smp(void)
 
     x86_init_smp(apic_ids, num_cpus);
 
+    for (uint i = 0; i < num_cpus; ++i) {
+        int cpu = x86_apic_id_to_cpu_num(apic_ids[i]);
+        if (cpu >= 0)
+            pmm_set_cpu_node(cpu, platform_cpu_numa_node(apic_ids[i]));
+    }
+
     for (uint i = 0; i < num_cpus - 1; ++i) {
         if (apic_ids[i] == bsp_apic_id) {
             apic_ids[i] = apic_ids[num_cpus - 1];
@@ -407,6 +421,7 @@ void platform_init_pcie(void) {
         .free_msi_block       = x86_free_msi_block,
         .register_msi_handler = x86_register_msi_handler,
         .mask_unmask_msi      = NULL,
+        .get_msi_cpu_target   = x86_get_msi_cpu_target,
     };
 
     status = pcie_init(&PCIE_INIT_INFO);
@@ -17,6 +17,7 @@
 #include <arch/x86/apic.h>
 #include <arch/x86/feature.h>
 #include <lk/init.h>
+#include <kernel/mp.h>
 #include <kernel/thread.h>
 #include <kernel/spinlock.h>
 #include <platform.h>
@@ -60,10 +61,30 @@ static uint8_t apic_divisor = 0;
 // TSC timer calibration values
 static uint64_t tsc_ticks_per_ms;
 
+// TSC ticks convert to nanoseconds as (tsc * tsc_ns_mult) >> tsc_ns_shift,
+// which saves a division on every clock read.  The vDSO does the same.
+static uint64_t tsc_ns_mult;
+static uint32_t tsc_ns_shift;
+
+// Set if the CPUs' TSCs were seen out of step, in which case the clock is
+// kept from going backwards by never returning less than it last did.
+static bool tsc_unsynced;
+static volatile unsigned long long tsc_last_ns;
+
 uint64_t get_tsc_ticks_per_ms(void) {
     return tsc_ticks_per_ms;
 }
 
+// The TSC to nanoseconds conversion, if it is one every CPU agrees on.
+bool get_tsc_ns_conversion(uint64_t *mult, uint32_t *shift) {
+    if (!invariant_tsc || tsc_unsynced) {
+        return false;
+    }
+    *mult = tsc_ns_mult;
+    *shift = tsc_ns_shift;
+    return true;
+}
+
 #define INTERNAL_FREQ 1193182ULL
 #define INTERNAL_FREQ_3X 3579546ULL
 
@@ -75,34 +96,58 @@ uint64_t get_tsc_ticks_per_ms(void) {
 
 #define LOCAL_TRACE 0
 
-lk_time_t current_time(void)
+static inline uint64_t tsc_to_ns(uint64_t tsc)
 {
-    lk_time_t time;
+    // the 128 bit product, shifted, in two halves
+    uint64_t hi = tsc >> 32;
+    uint64_t lo = (uint32_t)tsc;
+    return ((hi * tsc_ns_mult) << (32 - tsc_ns_shift)) +
+           ((lo * tsc_ns_mult) >> tsc_ns_shift);
+}
 
-    if (invariant_tsc) {
-        uint64_t tsc = rdtsc();
-        time = tsc / tsc_ticks_per_ms;
-    } else {
-        // XXX slight race
-        time = (lk_time_t) (timer_current_time >> 32);
+static void init_tsc_ns_conversion(void)
+{
+    // as much precision as keeps the multiplier to 32 bits, which the low
+    // half's product needs.  rounded up, so that the clock has reached a
+    // TSC deadline's time by the time it fires.
+    uint32_t shift = 32;
+    uint64_t mult;
+    while ((mult = ((1000000ULL << shift) + tsc_ticks_per_ms - 1) /
+                   tsc_ticks_per_ms) > UINT32_MAX) {
+        shift--;
     }
-
-    return time;
+    tsc_ns_mult = mult;
+    tsc_ns_shift = shift;
 }
 
-lk_bigtime_t current_time_hires(void)
+uint64_t current_time_ns(void)
 {
-    lk_bigtime_t time;
-
     if (invariant_tsc) {
-        uint64_t tsc = rdtsc();
-        time = tsc / (tsc_ticks_per_ms / 1000);
+        uint64_t ns = tsc_to_ns(rdtsc());
+        if (unlikely(tsc_unsynced)) {
+            unsigned long long last = atomic_load_u64(&tsc_last_ns);
+            do {
+                if (ns <= last) {
+                    return last;
+                }
+            } while (!atomic_cmpxchg_u64(&tsc_last_ns, &last, ns));
+        }
+        return ns;
     } else {
         // XXX slight race
-        time = (lk_bigtime_t) ((timer_current_time >> 22) * 1000) >> 10;
+        return ((timer_current_time >> 22) * 1000000) >> 10;
     }
+}
 
-    return time;
+// The coarser clocks are the same one, so they always agree.
+lk_time_t current_time(void)
+{
+    return current_time_ns() / 1000000;
+}
+
+lk_bigtime_t current_time_hires(void)
+{
+    return current_time_ns() / 1000;
 }
 
 // The PIT timer will keep track of wall time if we aren't using the TSC
@@ -283,10 +328,27 @@ static void calibrate_apic_timer(void)
             apic_ticks_per_ms, apic_divisor);
 }
 
+// The TSC frequency, when the CPU enumerates it exactly as a ratio of its
+// crystal clock.  Returns 0 if it doesn't.
+static uint64_t cpuid_tsc_ticks_per_ms(void)
+{
+    const struct cpuid_leaf *leaf = x86_get_cpuid_leaf(X86_CPUID_TSC);
+    if (!leaf || leaf->a == 0 || leaf->b == 0 || leaf->c == 0) {
+        return 0;
+    }
+    return (uint64_t)leaf->c * leaf->b / leaf->a / 1000;
+}
+
 static void calibrate_tsc(void)
 {
     ASSERT(arch_ints_disabled());
 
+    tsc_ticks_per_ms = cpuid_tsc_ticks_per_ms();
+    if (tsc_ticks_per_ms != 0) {
+        LTRACEF("TSC from CPUID: %llu ticks/ms\n", tsc_ticks_per_ms);
+        return;
+    }
+
     bool use_hpet = hpet_is_present();
     TRACEF("Calibrating TSC with %s\n", use_hpet ? "HPET" : "PIT");
 
@@ -341,6 +403,7 @@ void platform_init_timer(uint level)
 
     if (invariant_tsc) {
         calibrate_tsc();
+        init_tsc_ns_conversion();
         // Program PIT in the software strobe configuration, but do not load
         // the count.  This will pause the PIT.
         outp(I8253_CONTROL_REG, 0x38);
@@ -355,6 +418,50 @@ void platform_init_timer(uint level)
 }
 LK_INIT_HOOK(timer, &platform_init_timer, LK_INIT_LEVEL_VM + 3);
 
+#if WITH_SMP
+#define TSC_SYNC_ROUNDS 10000
+
+static spin_lock_t tsc_sync_lock = SPIN_LOCK_INITIAL_VALUE;
+static uint64_t tsc_sync_last;
+static uint64_t tsc_sync_max_warp;
+
+// Every CPU takes turns reading its TSC under a lock, so the reads are
+// ordered in time and any that goes backwards shows two TSCs out of step.
+static void tsc_sync_task(void *context)
+{
+    for (int i = 0; i < TSC_SYNC_ROUNDS; i++) {
+        spin_lock(&tsc_sync_lock);
+        // keep rdtsc from being executed ahead of the lock
+        __asm__ volatile("lfence" ::: "memory");
+        uint64_t tsc = rdtsc();
+        if (tsc < tsc_sync_last && tsc_sync_last - tsc > tsc_sync_max_warp) {
+            tsc_sync_max_warp = tsc_sync_last - tsc;
+        }
+        tsc_sync_last = tsc;
+        spin_unlock(&tsc_sync_lock);
+    }
+}
+
+static void platform_check_tsc_sync(uint level)
+{
+    if (!invariant_tsc || arch_max_num_cpus() == 1) {
+        return;
+    }
+
+    mp_sync_exec(MP_CPU_ALL, tsc_sync_task, NULL);
+
+    if (tsc_sync_max_warp != 0) {
+        printf("WARNING: TSCs are out of step by up to %llu ns, "
+               "keeping the clock monotonic in software\n",
+               tsc_to_ns(tsc_sync_max_warp));
+        tsc_last_ns = tsc_to_ns(rdtsc());
+        tsc_unsynced = true;
+    }
+}
+// after the APs are up
+LK_INIT_HOOK(tsc_sync, &platform_check_tsc_sync, LK_INIT_LEVEL_PLATFORM);
+#endif
+
 status_t platform_set_oneshot_timer(platform_timer_callback callback,
                                     void *arg, lk_time_t interval)
 {
@@ -364,21 +471,20 @@ status_t platform_set_oneshot_timer(platform_timer_callback callback,
     t_callback[cpu] = callback;
     callback_arg[cpu] = arg;
 
-    if (interval > MAX_TIMER_INTERVAL)
-        interval = MAX_TIMER_INTERVAL;
     if (interval < 1) interval = 1;
 
     if (use_tsc_deadline) {
-        if (UINT64_MAX / interval < tsc_ticks_per_ms) {
-            return ERR_INVALID_ARGS;
-        }
-        uint64_t tsc_interval = interval * tsc_ticks_per_ms;
-        uint64_t deadline = rdtsc() + tsc_interval;
+        // The deadline is in the same units current_time() is derived from,
+        // and has no range limit to clamp the interval to.
+        uint64_t deadline = rdtsc() + (uint64_t)interval * tsc_ticks_per_ms;
         LTRACEF("Scheduling oneshot timer: %llu deadline\n", deadline);
         apic_timer_set_tsc_deadline(deadline, false /* unmasked */);
         return NO_ERROR;
     }
 
+    if (interval > MAX_TIMER_INTERVAL)
+        interval = MAX_TIMER_INTERVAL;
+
     uint8_t extra_divisor = 1;
     while (apic_ticks_per_ms > UINT32_MAX / interval / extra_divisor) {
         extra_divisor *= 2;
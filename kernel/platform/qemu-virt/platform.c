@@ -65,6 +65,7 @@ static pcie_init_info_t PCIE_INIT_INFO = {
     .free_msi_block       = arm_gicv2m_free_msi_block,
     .register_msi_handler = arm_gicv2m_register_msi_handler,
     .mask_unmask_msi      = arm_gicv2m_mask_unmask_msi,
+    .get_msi_cpu_target   = arm_gicv2m_get_msi_cpu_target,
 };
 
 /* initial memory mappings. parsed by start.S */
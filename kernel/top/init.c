@@ -12,7 +12,9 @@
  * initialized.
  */
 #include <arch/ops.h>
+#include <kernel/cmdline.h>
 #include <lk/init.h>
+#include <platform.h>
 
 #include <assert.h>
 #include <compiler.h>
@@ -28,6 +30,17 @@
 extern const struct lk_init_struct __start_lk_init[] __WEAK;
 extern const struct lk_init_struct __stop_lk_init[] __WEAK;
 
+/* print when each hook ran and how long it took, from once the platform has
+ * handed over the commandline */
+static bool init_timeline;
+
+static void init_timeline_hook(uint level)
+{
+    init_timeline = cmdline_get_bool("kernel.init_timeline", false);
+}
+
+LK_INIT_HOOK(init_timeline, init_timeline_hook, LK_INIT_LEVEL_PLATFORM_EARLY);
+
 void lk_init_level(enum lk_init_flags required_flag, uint start_level, uint stop_level)
 {
     LTRACEF("flags %#x, start_level %#x, stop_level %#x\n",
@@ -51,6 +64,8 @@ void lk_init_level(enum lk_init_flags required_flag, uint start_level, uint stop
             /* reject the easy ones */
             if (!(ptr->flags & required_flag))
                 continue;
+            if ((ptr->flags & LK_INIT_FLAG_DEFERRED) && !(required_flag & LK_INIT_FLAG_DEFERRED))
+                continue;
             if (ptr->level > stop_level)
                 continue;
             if (ptr->level < last_called_level)
@@ -83,7 +98,16 @@ void lk_init_level(enum lk_init_flags required_flag, uint start_level, uint stop
                    arch_curr_cpu_num(), found->hook, found->name, found->level, found->flags);
         }
 #endif
+        bool timed = init_timeline;
+        lk_bigtime_t start = timed ? current_time_hires() : 0;
         found->hook(found->level);
+        if (timed) {
+            lk_bigtime_t now = current_time_hires();
+            printf("INIT: [%5llu.%06llu] cpu %u %s level %#x%s took %llu us\n",
+                   start / 1000000, start % 1000000, arch_curr_cpu_num(), found->name,
+                   found->level, (found->flags & LK_INIT_FLAG_DEFERRED) ? " (deferred)" : "",
+                   now - start);
+        }
         last_called_level = found->level;
         last = found;
     }
@@ -112,6 +112,12 @@ void lk_main(ulong arg0, ulong arg1, ulong arg2, ulong arg3)
     thread_become_idle();
 }
 
+static int deferred_init(void *arg)
+{
+    lk_init_level(LK_INIT_FLAG_DEFERRED, LK_INIT_LEVEL_EARLIEST, LK_INIT_LEVEL_LAST);
+    return 0;
+}
+
 static int bootstrap2(void *arg)
 {
     dprintf(SPEW, "top of bootstrap2()\n");
@@ -135,6 +141,12 @@ static int bootstrap2(void *arg)
 
     lk_primary_cpu_init_level(LK_INIT_LEVEL_APPS, LK_INIT_LEVEL_LAST);
 
+    // the hooks nothing above waited on, run alongside userspace starting
+    // up and free to land on any cpu
+    thread_t *t = thread_create("deferred_init", &deferred_init, NULL,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+
     return 0;
 }
 
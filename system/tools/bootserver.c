@@ -10,10 +10,12 @@
 #include <sys/time.h>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <errno.h>
@@ -73,6 +75,8 @@ static int io(int s, nbmsg* msg, size_t len, nbmsg* ack) {
         }
         if (ack->cmd == NB_ACK)
             return 0;
+        if (ack->cmd & NB_ERROR)
+            return -1;
         fprintf(stderr, "?");
         goto again;
     }
@@ -102,6 +106,187 @@ static ssize_t xread(xferdata *xd, void* data, size_t len) {
     }
 }
 
+// proposed for windowed transfers, the block size being the data that
+// fits a jumbo frame
+#define WINDOW NB_WINDOW_MAX
+#define BLOCKSIZE 8192
+#define RESEND_MS 250
+#define RESENDS 5
+
+typedef struct {
+    size_t len;
+    bool acked;
+    // resent as soon as a later block is acked, rather than on timeout
+    bool gap;
+    int sends;
+    uint64_t sent;
+    nbmsg msg;
+} xferblock;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int xsend(int s, xferblock* b) {
+    b->msg.cookie = cookie++;
+    b->sends++;
+    b->sent = now_ms();
+    b->gap = false;
+    for (;;) {
+        if (write(s, &b->msg, sizeof(nbmsg) + b->len) >= 0) {
+            return 0;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS)) {
+            fprintf(stderr, "\n%s: socket write error %d\n", appname, errno);
+            return -1;
+        }
+    }
+}
+
+static int xfer_windowed(int s, xferdata* xd, const nbxfer* params) {
+    uint32_t window = params->window;
+    uint32_t blocksize = params->blocksize;
+    size_t blocklen = sizeof(xferblock) + blocksize;
+    char* blocks = calloc(window, blocklen);
+    char ackbuf[2048];
+    nbmsg* ack = (void*)ackbuf;
+    // everything before base is acked, and next is where reading is up to
+    uint32_t base = 0;
+    uint32_t next = 0;
+    uint32_t count = 0;
+    bool eof = false;
+    int status = -1;
+
+    if (blocks == NULL) {
+        fprintf(stderr, "\n%s: out of memory\n", appname);
+        return -1;
+    }
+#define BLOCK(off) ((xferblock*)(blocks + (((off) / blocksize) % window) * blocklen))
+
+    for (;;) {
+        while (!eof && (next - base < window * blocksize)) {
+            xferblock* b = BLOCK(next);
+            ssize_t r = xread(xd, b->msg.data, blocksize);
+            if (r < 0) {
+                fprintf(stderr, "\n%s: error: reading\n", appname);
+                goto done;
+            }
+            if (r < blocksize) {
+                eof = true;
+                if (r == 0) {
+                    break;
+                }
+            }
+            b->msg.magic = NB_MAGIC;
+            b->msg.cmd = NB_DATA;
+            b->msg.arg = next;
+            b->len = r;
+            b->acked = false;
+            b->sends = 0;
+            next += r;
+            if (xsend(s, b)) {
+                goto done;
+            }
+        }
+        if (base == next) {
+            break;
+        }
+
+        // the oldest send not yet acked times out first
+        uint64_t now = now_ms();
+        uint64_t deadline = UINT64_MAX;
+        for (uint32_t off = base; off != next; off += BLOCK(off)->len) {
+            xferblock* b = BLOCK(off);
+            if (!b->acked && (b->sent + RESEND_MS < deadline)) {
+                deadline = b->sent + RESEND_MS;
+            }
+        }
+        struct pollfd pfd = {
+            .fd = s,
+            .events = POLLIN,
+        };
+        int ms = (deadline > now) ? (int)(deadline - now) : 0;
+        if (poll(&pfd, 1, ms) > 0) {
+            ssize_t r = read(s, ack, sizeof(ackbuf));
+            if (r < 0) {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    continue;
+                }
+                fprintf(stderr, "\n%s: socket read error %d\n", appname, errno);
+                goto done;
+            }
+            if ((r < sizeof(nbmsg) + sizeof(uint32_t)) || (ack->magic != NB_MAGIC)) {
+                fprintf(stderr, "Z");
+                continue;
+            }
+            if (ack->cmd != NB_ACK) {
+                fprintf(stderr, "\n%s: error %08x from target\n", appname, ack->cmd);
+                goto done;
+            }
+            if ((ack->arg - base > next - base) || ((ack->arg % blocksize) && (ack->arg != next))) {
+                fprintf(stderr, "A");
+                continue;
+            }
+            uint32_t map;
+            memcpy(&map, ack->data, sizeof(map));
+            while (base != ack->arg) {
+                xferblock* b = BLOCK(base);
+                b->acked = true;
+                base += b->len;
+                count += b->len;
+                if (count >= (32 * 1024)) {
+                    count = 0;
+                    fprintf(stderr, "#");
+                }
+            }
+            if (base == next) {
+                continue;
+            }
+            // base itself is missing, and so is any unmapped block that
+            // comes before a mapped one
+            uint32_t last = 0;
+            uint32_t off = base + BLOCK(base)->len;
+            for (uint32_t n = 0; (n < 32) && (off != next); n++) {
+                xferblock* b = BLOCK(off);
+                if (map & (1u << n)) {
+                    b->acked = true;
+                    last = off;
+                }
+                off += b->len;
+            }
+            for (off = base; off < last; off += BLOCK(off)->len) {
+                xferblock* b = BLOCK(off);
+                if (!b->acked && (b->sends == 1)) {
+                    b->gap = true;
+                }
+            }
+        }
+
+        now = now_ms();
+        for (uint32_t off = base; off != next; off += BLOCK(off)->len) {
+            xferblock* b = BLOCK(off);
+            if (b->acked || (!b->gap && (now < b->sent + RESEND_MS))) {
+                continue;
+            }
+            if (b->sends > RESENDS) {
+                fprintf(stderr, "\n%s: timed out\n", appname);
+                goto done;
+            }
+            fprintf(stderr, "T");
+            if (xsend(s, b)) {
+                goto done;
+            }
+        }
+    }
+    status = 0;
+done:
+#undef BLOCK
+    free(blocks);
+    return status;
+}
+
 static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, bool boot) {
     xferdata xd;
     char msgbuf[2048];
@@ -138,6 +323,30 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
         goto done;
     }
 
+    nbxfer params = {
+        .window = WINDOW,
+        .blocksize = BLOCKSIZE,
+    };
+    msg->cmd = NB_SEND_FILE_WINDOWED;
+    msg->arg = 0;
+    memcpy(msg->data, &params, sizeof(params));
+    strcpy((char*)msg->data + sizeof(params), name);
+    memset(ackbuf, 0, sizeof(ackbuf));
+    if (io(s, msg, sizeof(nbmsg) + sizeof(params) + strlen(name) + 1, ack) == 0) {
+        memcpy(&params, ack->data, sizeof(params));
+        if ((params.window == 0) || (params.window > WINDOW) ||
+            (params.blocksize == 0) || (params.blocksize > BLOCKSIZE)) {
+            fprintf(stderr, "%s: bad transfer parameters\n", appname);
+            goto done;
+        }
+        if (xfer_windowed(s, &xd, &params)) {
+            fprintf(stderr, "\n%s: error: sending '%s'\n", appname, fn);
+            goto done;
+        }
+        goto sent;
+    }
+
+    // the target only does one block at a time
     msg->cmd = NB_SEND_FILE;
     msg->arg = 0;
     strcpy((void*)msg->data, name);
@@ -169,6 +378,7 @@ static int xfer(struct sockaddr_in6* addr, const char* fn, const char* name, boo
         msg->arg += r;
     } while (r != 0);
 
+sent:
     status = 0;
 
     if (boot) {
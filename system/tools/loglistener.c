@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,27 +18,72 @@
 #include <errno.h>
 #include <stdint.h>
 
-#define MAX_LOG_DATA 1280
-
-typedef struct logpacket {
-    uint32_t magic;
-    uint32_t seqno;
-    char data[MAX_LOG_DATA];
-} logpacket_t;
+#include <system/netboot.h>
 
 static const char* appname;
 
+// packets that arrived ahead of a gap, held until it's filled
+typedef struct {
+    bool valid;
+    int len;
+    logpacket_t pkt;
+} logslot;
+
+static logslot slots[DEBUGLOG_WINDOW];
+// the next packet to print, zero until the first one arrives
+static uint32_t expected = 0;
+
+static void print_packet(logpacket_t* pkt, int len) {
+    fwrite(pkt->data, 1, len - 8, stdout);
+}
+
+// Takes in a packet, returns true if it shows a gap before it.
+static bool receive_packet(logpacket_t* pkt, int len) {
+    int32_t ahead = pkt->seqno - expected;
+    if ((expected == 0) || (ahead < -DEBUGLOG_WINDOW) || (ahead >= DEBUGLOG_WINDOW)) {
+        // a new sender, or one that restarted
+        memset(slots, 0, sizeof(slots));
+        expected = pkt->seqno;
+        ahead = 0;
+    }
+    if (ahead < 0) {
+        // already printed, the ack was lost
+        return false;
+    }
+    if (ahead > 0) {
+        logslot* slot = &slots[pkt->seqno % DEBUGLOG_WINDOW];
+        slot->valid = true;
+        slot->len = len;
+        memcpy(&slot->pkt, pkt, len);
+        return true;
+    }
+    print_packet(pkt, len);
+    expected++;
+    for (;;) {
+        logslot* slot = &slots[expected % DEBUGLOG_WINDOW];
+        if (!slot->valid || (slot->pkt.seqno != expected)) {
+            break;
+        }
+        print_packet(&slot->pkt, slot->len);
+        slot->valid = false;
+        expected++;
+    }
+    fflush(stdout);
+    return false;
+}
+
 int main(int argc, char** argv) {
     struct sockaddr_in6 addr;
     char tmp[INET6_ADDRSTRLEN];
     int r, s, n = 1;
-    uint32_t last_seqno = 0;
+    // the gap last asked to be resent
+    uint32_t resend_seqno = 0;
 
     appname = argv[0];
 
     memset(&addr, 0, sizeof(addr));
     addr.sin6_family = AF_INET6;
-    addr.sin6_port = htons(33337);
+    addr.sin6_port = htons(DEBUGLOG_PORT);
 
     s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
     if (s < 0) {
@@ -58,28 +104,40 @@ int main(int argc, char** argv) {
     for (;;) {
         struct sockaddr_in6 ra;
         socklen_t rlen;
-        char buf[4096 + 1];
+        char buf[4096];
         logpacket_t* pkt = (void*)buf;
         rlen = sizeof(ra);
-        r = recvfrom(s, buf, 4096, 0, (void*)&ra, &rlen);
+        r = recvfrom(s, buf, sizeof(buf), 0, (void*)&ra, &rlen);
         if (r < 0) {
             fprintf(stderr, "%s: socket read error %d\n", appname, r);
             break;
         }
-        if (r < 8)
+        if ((r < 8) || (r > sizeof(logpacket_t)))
             continue;
         if ((ra.sin6_addr.s6_addr[0] != 0xFE) || (ra.sin6_addr.s6_addr[1] != 0x80)) {
             fprintf(stderr, "ignoring non-link-local message\n");
             continue;
         }
-        if (pkt->magic != 0xaeae1123)
+        if (pkt->magic != DEBUGLOG_MAGIC)
             continue;
-        if (pkt->seqno != last_seqno) {
-            buf[r] = 0;
-            printf("%s", pkt->data);
-            last_seqno = pkt->seqno;
+
+        logack_t ack = {
+            .magic = DEBUGLOG_MAGIC,
+            .flags = 0,
+        };
+        if (receive_packet(pkt, r)) {
+            // ask once for each gap, after that it's up to the sender's timeout
+            if (resend_seqno != expected) {
+                resend_seqno = expected;
+                ack.flags = DEBUGLOG_RESEND;
+            }
+        } else {
+            // everything up to this packet is in, so its echo means the
+            // same to a sender that only understands those
+            sendto(s, buf, 8, 0, (struct sockaddr*)&ra, rlen);
         }
-        sendto(s, buf, 8, 0, (struct sockaddr*)&ra, rlen);
+        ack.seqno = expected - 1;
+        sendto(s, &ack, sizeof(ack), 0, (struct sockaddr*)&ra, rlen);
     }
 
     return 0;
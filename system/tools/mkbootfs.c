@@ -14,7 +14,10 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include <system/bootfs.h>
+
 int verbose = 0;
+int compress = 0;
 
 char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
 
@@ -27,7 +30,10 @@ char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
 //   fileoffset (32bit le)
 //   namedata   (namelength bytes, includes \0)
 //
-// - fileoffsets must be page aligned (multiple of 4096)
+// - fileoffsets must be page aligned (multiple of 4096), and carry the
+//   BOOTFS_FLAG_* bits in their low bits
+// - compressed files are stored as a bootfs_lz4_frame_t (see
+//   system/bootfs.h), and filesize is their decompressed size
 
 #define FSENTRYSZ 12
 
@@ -41,6 +47,10 @@ struct fsentry {
     uint32_t length;
 
     char *srcpath;
+
+    // the compressed file, if it is stored compressed
+    uint8_t *frame;
+    uint32_t framelen;
 };
 typedef struct fs {
     fsentry *first;
@@ -223,6 +233,161 @@ fail:
     return -1;
 }
 
+#define PAGEALIGN(n) (((n) + 4095) & (~4095))
+#define PAGEFILL(n) (PAGEALIGN(n) - (n))
+
+// Compress a block in the LZ4 block format, greedily taking the last match
+// seen for each 4 byte sequence. Returns the compressed size, or 0 if it
+// wouldn't be smaller than the block.
+#define LZ4_HASH_BITS 14
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5   // the block must end with this many literals
+#define LZ4_MATCH_LIMIT 12    // and no match may start closer to its end
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+size_t lz4_compress_block(const uint8_t *src, size_t len, uint8_t *dst) {
+    static uint32_t table[1 << LZ4_HASH_BITS];
+    const uint8_t *anchor = src;
+    const uint8_t *ip = src;
+    uint8_t *op = dst;
+    // worst case growth of a sequence is its length bytes, keep clear of that
+    uint8_t *olimit = dst + len - 16 - len / 255;
+
+    if (len < LZ4_MATCH_LIMIT + 1 || len < 64)
+        return 0;
+
+    memset(table, 0, sizeof(table));
+    while (ip <= src + len - LZ4_MATCH_LIMIT) {
+        uint32_t seq = read32(ip);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        uint32_t cand = table[h];
+        table[h] = (ip - src) + 1;
+        if (cand == 0 || read32(src + cand - 1) != seq) {
+            ip++;
+            continue;
+        }
+
+        const uint8_t *match = src + cand - 1;
+        size_t mlen = LZ4_MIN_MATCH;
+        while (ip + mlen < src + len - LZ4_LAST_LITERALS && ip[mlen] == match[mlen])
+            mlen++;
+
+        size_t lit = ip - anchor;
+        if (op + 1 + lit + lit / 255 + 2 + mlen / 255 + 1 > olimit)
+            return 0;
+        uint8_t *token = op++;
+        *token = ((lit < 15) ? lit : 15) << 4;
+        if (lit >= 15)
+            op = put_length(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+        size_t off = ip - match;
+        *op++ = off;
+        *op++ = off >> 8;
+        size_t ml = mlen - LZ4_MIN_MATCH;
+        *token |= (ml < 15) ? ml : 15;
+        if (ml >= 15)
+            op = put_length(op, ml - 15);
+
+        ip += mlen;
+        anchor = ip;
+    }
+
+    size_t lit = src + len - anchor;
+    if (op + 1 + lit + lit / 255 + 1 > olimit)
+        return 0;
+    *op++ = ((lit < 15) ? lit : 15) << 4;
+    if (lit >= 15)
+        op = put_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+// Read a file in and store it in e->frame if it compresses to less space.
+int compress_entry(fsentry *e) {
+    uint32_t blocks = (e->length + BOOTFS_LZ4_BLOCK_SIZE - 1) / BOOTFS_LZ4_BLOCK_SIZE;
+    size_t hdrlen = sizeof(bootfs_lz4_frame_t) + (blocks + 1) * sizeof(uint32_t);
+    uint8_t *data = NULL;
+    bootfs_lz4_frame_t *frame = NULL;
+    int fd = -1;
+
+    if (e->length == 0)
+        return 0;
+    if ((data = malloc(e->length)) == NULL)
+        goto oops;
+    // no block grows, since ones that would are stored as they are
+    if ((frame = malloc(hdrlen + e->length)) == NULL)
+        goto oops;
+    if ((fd = open(e->srcpath, O_RDONLY)) < 0) {
+        fprintf(stderr, "error: cannot open '%s'\n", e->srcpath);
+        goto oops;
+    }
+    for (size_t n = 0; n < e->length; ) {
+        ssize_t r = read(fd, data + n, e->length - n);
+        if (r <= 0) {
+            fprintf(stderr, "error: failed reading '%s'\n", e->srcpath);
+            goto oops;
+        }
+        n += r;
+    }
+    close(fd);
+    fd = -1;
+
+    frame->magic = BOOTFS_LZ4_MAGIC;
+    frame->block_size = BOOTFS_LZ4_BLOCK_SIZE;
+    frame->block_count = blocks;
+    frame->reserved = 0;
+    size_t off = hdrlen;
+    for (uint32_t i = 0; i < blocks; i++) {
+        size_t pos = (size_t)i * BOOTFS_LZ4_BLOCK_SIZE;
+        size_t len = e->length - pos;
+        if (len > BOOTFS_LZ4_BLOCK_SIZE)
+            len = BOOTFS_LZ4_BLOCK_SIZE;
+        frame->offset[i] = off;
+        size_t clen = lz4_compress_block(data + pos, len, (uint8_t *)frame + off);
+        if (clen == 0) {
+            memcpy((uint8_t *)frame + off, data + pos, len);
+            clen = len;
+        }
+        off += clen;
+    }
+    frame->offset[blocks] = off;
+    free(data);
+
+    // only worth it if it saves a page
+    if (PAGEALIGN(off) >= PAGEALIGN(e->length)) {
+        free(frame);
+        return 0;
+    }
+    if (verbose) {
+        fprintf(stderr, "%s: %u -> %zu bytes\n", e->name, e->length, off);
+    }
+    e->frame = (uint8_t *)frame;
+    e->framelen = off;
+    return 0;
+oops:
+    if (fd >= 0)
+        close(fd);
+    free(data);
+    free(frame);
+    return -1;
+}
+
 int copydata(int fd, const char *fn, size_t len) {
     char buf[4*1024*1024];
     int r, fdi;
@@ -253,9 +418,6 @@ oops:
     return -1;
 }
 
-#define PAGEALIGN(n) (((n) + 4095) & (~4095))
-#define PAGEFILL(n) (PAGEALIGN(n) - (n))
-
 char fill[4096];
 
 int export_userfs(const char *fn, fs *fs, unsigned hsz) {
@@ -275,7 +437,7 @@ int export_userfs(const char *fn, fs *fs, unsigned hsz) {
         uint32_t hdr[3];
         hdr[0] = e->namelen;
         hdr[1] = e->length;
-        hdr[2] = e->offset;
+        hdr[2] = e->offset | (e->frame ? BOOTFS_FLAG_COMPRESSED : 0);
         if (write(fd, hdr, sizeof(hdr)) != sizeof(hdr)) goto ioerr;
         if (write(fd, e->name, e->namelen) != e->namelen) goto ioerr;
     }
@@ -292,11 +454,16 @@ int export_userfs(const char *fn, fs *fs, unsigned hsz) {
         if (verbose) {
             fprintf(stderr, "%08x %08x %s\n", e->offset, e->length, e->name);
         }
-        if (copydata(fd, e->srcpath, e->length)) {
-            close(fd);
-            return -1;
+        if (e->frame) {
+            if (write(fd, e->frame, e->framelen) != e->framelen) goto ioerr;
+            n = PAGEFILL(e->framelen);
+        } else {
+            if (copydata(fd, e->srcpath, e->length)) {
+                close(fd);
+                return -1;
+            }
+            n = PAGEFILL(e->length);
         }
-        n = PAGEFILL(e->length);
         if (n) {
             if (write(fd, fill, n) != n) goto ioerr;
         }
@@ -325,6 +492,8 @@ int main(int argc, char **argv) {
             break;
         if (!strcmp(cmd,"-v")) {
             verbose = 1;
+        } else if (!strcmp(cmd,"-c")) {
+            compress = 1;
         } else if (!strcmp(cmd,"-o")) {
             if (argc < 2) {
               fprintf(stderr, "no output file given\n");
@@ -334,7 +503,7 @@ int main(int argc, char **argv) {
             argc--;
             argv++;
         } else if (!strcmp(cmd,"-h")) {
-            fprintf(stderr, "usage: mkbootfs [-v] [-o <fsimage>] <manifests>...\n");
+            fprintf(stderr, "usage: mkbootfs [-v] [-c] [-o <fsimage>] <manifests>...\n");
             return 0;
         } else {
             fprintf(stderr, "unknown option: %s\n", cmd);
@@ -372,8 +541,11 @@ int main(int argc, char **argv) {
 
     off = PAGEALIGN(hsz);
     for (e = fs.first; e != NULL; e = e->next) {
+        if (compress && compress_entry(e) < 0) {
+            return -1;
+        }
         e->offset = off;
-        off += PAGEALIGN(e->length);
+        off += PAGEALIGN(e->frame ? e->framelen : e->length);
         if (off > INT32_MAX) {
             fprintf(stderr, "error: userfs too large\n");
             return -1;
@@ -7,6 +7,10 @@
 #include <ddk/binding.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <system/listnode.h>
+
+#include "devmgr.h"
 
 static uint32_t dev_get_prop(mx_device_t* dev, uint32_t id) {
     const mx_device_prop_t* props = dev->props;
@@ -121,4 +125,197 @@ next_instruction:
 
     // default if we leave the program is no-match
     return false;
-}
\ No newline at end of file
+}
+
+// Index of driver binding programs, so a new device only runs the programs
+// of drivers that could match it. Most programs start by requiring one
+// property to have one value (usually BIND_PROTOCOL), and a driver is filed
+// under that property and value. Drivers whose programs require nothing
+// recognizable are on the unkeyed list and are always candidates.
+
+#define BIND_INDEX_PROPS 4
+#define BIND_INDEX_BUCKETS 32
+
+typedef struct bind_key {
+    struct list_node node;
+    uint32_t prop;
+    uint32_t value;
+    uint32_t count;
+    struct list_node drivers;
+} bind_key_t;
+
+typedef struct bind_entry {
+    struct list_node node;
+    struct list_node inode;
+    mx_driver_t* drv;
+    bind_key_t* key;
+    uint32_t seq;
+} bind_entry_t;
+
+static struct list_node bind_entries = LIST_INITIAL_VALUE(bind_entries);
+static struct list_node bind_unkeyed = LIST_INITIAL_VALUE(bind_unkeyed);
+static uint32_t bind_unkeyed_count;
+static struct list_node bind_buckets[BIND_INDEX_BUCKETS];
+static uint32_t bind_props[BIND_INDEX_PROPS];
+static uint32_t bind_prop_count;
+static uint32_t bind_seq;
+
+static struct list_node* bind_bucket(uint32_t prop, uint32_t value) {
+    struct list_node* bucket = &bind_buckets[(prop * 31 + value) % BIND_INDEX_BUCKETS];
+    if (bucket->next == NULL) {
+        list_initialize(bucket);
+    }
+    return bucket;
+}
+
+static bind_key_t* bind_key_find(uint32_t prop, uint32_t value) {
+    bind_key_t* key;
+    list_for_every_entry (bind_bucket(prop, value), key, bind_key_t, node) {
+        if ((key->prop == prop) && (key->value == value)) {
+            return key;
+        }
+    }
+    return NULL;
+}
+
+// Find a property the program can only match with one value of: one tested
+// by a leading ABORT_IF(NE), or by a MATCH_IF(EQ) that is the whole program.
+// BIND_PROTOCOL is preferred, as every device has one.
+static bool bind_program_key(mx_driver_t* drv, uint32_t* prop, uint32_t* value) {
+    const mx_bind_inst_t* ip = drv->binding;
+    const mx_bind_inst_t* end = ip + (drv->binding_size / sizeof(mx_bind_inst_t));
+    bool found = false;
+
+    for (; ip < end; ip++) {
+        uint32_t op = BINDINST_OP(ip->op);
+        uint32_t cc = BINDINST_CC(ip->op);
+        uint32_t pid = BINDINST_PB(ip->op);
+        if (op == OP_LABEL) {
+            continue;
+        }
+        bool required = (op == OP_ABORT) && (cc == COND_NE);
+        required |= (op == OP_MATCH) && (cc == COND_EQ) && (ip + 1 == end);
+        if (!required || (pid == BIND_FLAGS)) {
+            break;
+        }
+        if (!found || (pid == BIND_PROTOCOL)) {
+            *prop = pid;
+            *value = ip->arg;
+            found = true;
+        }
+        if (pid == BIND_PROTOCOL) {
+            break;
+        }
+    }
+    return found;
+}
+
+// Called with the devmgr lock held.
+mx_status_t devmgr_bind_index_add(mx_driver_t* drv) {
+    bind_entry_t* entry;
+    if ((entry = calloc(1, sizeof(bind_entry_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    entry->drv = drv;
+    entry->seq = bind_seq++;
+
+    uint32_t prop, value;
+    if (bind_program_key(drv, &prop, &value)) {
+        unsigned n;
+        for (n = 0; n < bind_prop_count; n++) {
+            if (bind_props[n] == prop) {
+                break;
+            }
+        }
+        if (n == bind_prop_count && n < BIND_INDEX_PROPS) {
+            bind_props[bind_prop_count++] = prop;
+        }
+        if (n < bind_prop_count) {
+            bind_key_t* key = bind_key_find(prop, value);
+            if (key == NULL) {
+                if ((key = calloc(1, sizeof(bind_key_t))) == NULL) {
+                    free(entry);
+                    return ERR_NO_MEMORY;
+                }
+                key->prop = prop;
+                key->value = value;
+                list_initialize(&key->drivers);
+                list_add_tail(bind_bucket(prop, value), &key->node);
+            }
+            entry->key = key;
+        }
+    }
+
+    if (entry->key) {
+        list_add_tail(&entry->key->drivers, &entry->inode);
+        entry->key->count++;
+    } else {
+        list_add_tail(&bind_unkeyed, &entry->inode);
+        bind_unkeyed_count++;
+    }
+    list_add_tail(&bind_entries, &entry->node);
+    return NO_ERROR;
+}
+
+// Called with the devmgr lock held.
+void devmgr_bind_index_remove(mx_driver_t* drv) {
+    bind_entry_t* entry;
+    list_for_every_entry (&bind_entries, entry, bind_entry_t, node) {
+        if (entry->drv == drv) {
+            list_delete(&entry->node);
+            list_delete(&entry->inode);
+            if (entry->key) {
+                entry->key->count--;
+            } else {
+                bind_unkeyed_count--;
+            }
+            free(entry);
+            return;
+        }
+    }
+}
+
+// Returns the drivers whose binding programs might match dev, in the order
+// they were added, as a malloc'd array of *count entries. Returns NULL if
+// that can't be allocated. Called with the devmgr lock held.
+mx_driver_t** devmgr_bind_candidates(mx_device_t* dev, size_t* count) {
+    struct list_node* lists[BIND_INDEX_PROPS + 1];
+    bind_entry_t* next[BIND_INDEX_PROPS + 1];
+    unsigned nlists = 0;
+    size_t total = bind_unkeyed_count;
+
+    lists[nlists++] = &bind_unkeyed;
+    for (unsigned n = 0; n < bind_prop_count; n++) {
+        bind_key_t* key = bind_key_find(bind_props[n], dev_get_prop(dev, bind_props[n]));
+        if (key != NULL) {
+            lists[nlists++] = &key->drivers;
+            total += key->count;
+        }
+    }
+
+    mx_driver_t** drivers;
+    if ((drivers = malloc((total ? total : 1) * sizeof(mx_driver_t*))) == NULL) {
+        return NULL;
+    }
+    for (unsigned n = 0; n < nlists; n++) {
+        next[n] = list_peek_head_type(lists[n], bind_entry_t, inode);
+    }
+
+    // each list is in the order drivers were added, merge them
+    size_t i;
+    for (i = 0; i < total; i++) {
+        unsigned pick = nlists;
+        for (unsigned n = 0; n < nlists; n++) {
+            if (next[n] && (pick == nlists || next[n]->seq < next[pick]->seq)) {
+                pick = n;
+            }
+        }
+        if (pick == nlists) {
+            break;
+        }
+        drivers[i] = next[pick]->drv;
+        next[pick] = list_next_type(lists[pick], &next[pick]->inode, bind_entry_t, inode);
+    }
+    *count = i;
+    return drivers;
+}
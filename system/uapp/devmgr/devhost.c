@@ -25,9 +25,10 @@
 
 // devhost rpc wrappers
 
-static mx_status_t devhost_rpc(mx_handle_t h, devhost_msg_t* msg, mx_handle_t harg) {
+static mx_status_t devhost_rpc(mx_handle_t h, devhost_msg_t* msg,
+                               mx_handle_t* handles, uint32_t hcount) {
     mx_status_t r;
-    if ((r = mx_message_write(h, msg, sizeof(*msg), &harg, harg ? 1 : 0, 0)) < 0) {
+    if ((r = mx_message_write(h, msg, sizeof(*msg), handles, hcount, 0)) < 0) {
         return r;
     }
     mx_signals_state_t pending;
@@ -59,6 +60,15 @@ mx_status_t devhost_add(mx_device_t* dev, mx_device_t* parent) {
         free(ios);
         return r;
     }
+    // block devices also get an iotxn ring, for drivers stacked in devmgr
+    mx_handle_t handles[3] = { h[1] };
+    uint32_t hcount = 1;
+    if (dev->protocol_id == MX_PROTOCOL_BLOCK) {
+        if (devhost_ioring_create(dev, &handles[1], &handles[2]) == NO_ERROR) {
+            hcount = 3;
+        }
+    }
+
     //printf("devhost_add(%p, %p)\n", dev, parent);
     devhost_msg_t msg;
     msg.op = DH_OP_ADD;
@@ -66,7 +76,7 @@ mx_status_t devhost_add(mx_device_t* dev, mx_device_t* parent) {
     msg.device_id = parent->remote_id;
     msg.protocol_id = dev->protocol_id;
     memcpy(msg.namedata, dev->namedata, sizeof(dev->namedata));
-    r = devhost_rpc(devhost_handle, &msg, h[1]);
+    r = devhost_rpc(devhost_handle, &msg, handles, hcount);
     //printf("devhost_add() %d\n", r);
     if (r == NO_ERROR) {
         //printf("devhost: dev=%p remoted\n", dev);
@@ -90,7 +100,16 @@ mx_status_t devhost_remove(mx_device_t* dev) {
     memset(&msg, 0, sizeof(msg));
     msg.op = DH_OP_REMOVE;
     msg.device_id = (uintptr_t)dev->remote_id;
-    return devhost_rpc(devhost_handle, &msg, 0);
+    return devhost_rpc(devhost_handle, &msg, NULL, 0);
+}
+
+// No driver here took dev, so devmgr may bind one to its proxy.
+mx_status_t devhost_unbound(mx_device_t* dev) {
+    devhost_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.op = DH_OP_UNBOUND;
+    msg.device_id = (uintptr_t)dev->remote_id;
+    return devhost_rpc(devhost_handle, &msg, NULL, 0);
 }
 
 #if LIBDRIVER
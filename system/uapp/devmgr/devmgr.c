@@ -21,6 +21,7 @@
 #include <mxio/dispatcher.h>
 #include <mxio/remoteio.h>
 
+#include <runtime/cond.h>
 #include <runtime/mutex.h>
 #include <runtime/thread.h>
 
@@ -245,6 +246,82 @@ void dev_ref_release(mx_device_t* dev) {
     }
 }
 
+// Devices are matched with drivers by a pool of threads rather than inside
+// device_add(), so a driver waiting on hardware in bind() doesn't hold up
+// binding the devices that were added after. A device is only queued once
+// its device_add() is done, which its children's device_add() can't start
+// before. Drivers don't expect bind() to run twice at once, so each driver
+// binds one device at a time.
+#define BIND_THREADS 4
+
+static struct list_node bind_queue = LIST_INITIAL_VALUE(bind_queue);
+static mxr_cond_t bind_queue_cond = MXR_COND_INIT;
+static unsigned bind_threads;
+
+// per driver bind timing, for dmctl's binds command
+typedef struct bind_stats {
+    struct list_node node;
+    mx_driver_t* drv;
+    bool binding;
+    uint32_t count;
+    uint32_t failed;
+    mx_time_t total;
+    mx_time_t max;
+} bind_stats_t;
+
+static struct list_node bind_stats_list = LIST_INITIAL_VALUE(bind_stats_list);
+static mxr_cond_t bind_done_cond = MXR_COND_INIT;
+
+static bind_stats_t* bind_stats_get(mx_driver_t* drv) {
+    bind_stats_t* bs;
+    list_for_every_entry (&bind_stats_list, bs, bind_stats_t, node) {
+        if (bs->drv == drv) {
+            return bs;
+        }
+    }
+    if ((bs = calloc(1, sizeof(bind_stats_t))) != NULL) {
+        bs->drv = drv;
+        list_add_tail(&bind_stats_list, &bs->node);
+    }
+    return bs;
+}
+
+// Calls drv's bind() for dev, after any other bind() of drv has returned.
+// Called with the lock held, which is dropped meanwhile.
+static mx_status_t devmgr_driver_bind(mx_driver_t* drv, mx_device_t* dev) {
+    bind_stats_t* bs = bind_stats_get(drv);
+    if (bs != NULL) {
+        while (bs->binding) {
+            mxr_cond_wait(&bind_done_cond, &__devmgr_api_lock);
+        }
+        if (device_is_bound(dev)) {
+            // someone else bound it while we waited
+            return ERR_BAD_STATE;
+        }
+        bs->binding = true;
+    }
+
+    DM_UNLOCK();
+    mx_time_t t = mx_current_time();
+    mx_status_t status = drv->ops.bind(drv, dev);
+    t = mx_current_time() - t;
+    DM_LOCK();
+
+    if (bs != NULL) {
+        bs->binding = false;
+        bs->count++;
+        if (status < 0) {
+            bs->failed++;
+        }
+        bs->total += t;
+        if (t > bs->max) {
+            bs->max = t;
+        }
+        mxr_cond_broadcast(&bind_done_cond);
+    }
+    return status;
+}
+
 static mx_status_t devmgr_driver_probe(mx_device_t* dev) {
     mx_status_t status;
 
@@ -274,10 +351,7 @@ static mx_status_t devmgr_device_probe(mx_device_t* dev, mx_driver_t* drv) {
 
     // Determine if we should remote-host this driver
     if ((status = devmgr_host_process(dev, drv)) == ERR_NOT_SUPPORTED) {
-        DM_UNLOCK();
-        status = drv->ops.bind(drv, dev);
-        DM_LOCK();
-        if (status < 0) {
+        if ((status = devmgr_driver_bind(drv, dev)) < 0) {
             return status;
         }
         dev->owner = drv;
@@ -292,6 +366,61 @@ static mx_status_t devmgr_device_probe(mx_device_t* dev, mx_driver_t* drv) {
     return NO_ERROR;
 }
 
+// Find dev a driver, or failing that put it on the unmatched list for
+// drivers added later. Called with the lock held.
+static void devmgr_device_bind(mx_device_t* dev) {
+    if (!device_is_bound(dev)) {
+        // first, look for a specific driver binary for this device
+        if (devmgr_driver_probe(dev) < 0) {
+            // if not found, probe the built-in drivers that might match
+            size_t count;
+            mx_driver_t** drivers = devmgr_bind_candidates(dev, &count);
+            if (drivers != NULL) {
+                for (size_t n = 0; n < count; n++) {
+                    if (devmgr_device_probe(dev, drivers[n]) == NO_ERROR) {
+                        break;
+                    }
+                }
+                free(drivers);
+            } else {
+                mx_driver_t* drv = NULL;
+                list_for_every_entry (&driver_list, drv, mx_driver_t, node) {
+                    if (devmgr_device_probe(dev, drv) == NO_ERROR) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // if no driver is bound, add the device to the unmatched list
+    if (!device_is_bound(dev) && !(dev->flags & DEV_FLAG_DEAD)) {
+        list_add_tail(&unmatched_device_list, &dev->unode);
+
+        // let devmgr try its drivers on the device's proxy
+        if (devmgr_is_remote && dev->remote_id) {
+            devhost_unbound(dev);
+        }
+    }
+}
+
+static int devmgr_bind_thread(void* arg) {
+    DM_LOCK();
+    for (;;) {
+        mx_device_t* dev = list_remove_head_type(&bind_queue, mx_device_t, unode);
+        if (dev == NULL) {
+            mxr_cond_wait(&bind_queue_cond, &__devmgr_api_lock);
+            continue;
+        }
+        // removing the device while it binds must not free it
+        dev_ref_acquire(dev);
+        devmgr_device_bind(dev);
+        dev_ref_release(dev);
+    }
+    DM_UNLOCK();
+    return 0;
+}
+
 mx_status_t devmgr_device_init(mx_device_t* dev, mx_driver_t* driver,
                                const char* name, mx_protocol_device_t* ops) {
     xprintf("devmgr: init '%s' drv=%p, ops=%p\n", safename(name), driver, ops);
@@ -325,9 +454,26 @@ mx_status_t devmgr_device_create(mx_device_t** out, mx_driver_t* driver,
     return status;
 }
 
+static void devmgr_device_queue_bind(mx_device_t* dev) {
+    if (bind_threads > 0) {
+        // device_remove() takes it off the queue, like the unmatched list
+        list_add_tail(&bind_queue, &dev->unode);
+        mxr_cond_signal(&bind_queue_cond);
+    } else {
+        devmgr_device_bind(dev);
+    }
+}
+
 void devmgr_device_set_bindable(mx_device_t* dev, bool bindable) {
     if (bindable) {
+        bool was_unbindable = dev->flags & DEV_FLAG_UNBINDABLE;
         dev->flags &= ~DEV_FLAG_UNBINDABLE;
+
+        // a device that was already added gets its chance to bind now
+        if (was_unbindable && (dev->parent != NULL) && !device_is_bound(dev) &&
+            !(dev->flags & (DEV_FLAG_BUSY | DEV_FLAG_DEAD)) && !list_in_list(&dev->unode)) {
+            devmgr_device_queue_bind(dev);
+        }
     } else {
         dev->flags |= DEV_FLAG_UNBINDABLE;
     }
@@ -411,7 +557,8 @@ mx_status_t devmgr_device_add(mx_device_t* dev, mx_device_t* parent) {
 
     if (dev->flags & DEV_FLAG_REMOTE) {
         xprintf("dev %p is REMOTE\n", dev);
-        // for now devhost'd devices are openable but not bindable
+        // devhost'd devices are bindable only once their devhost reports
+        // that none of its drivers took them (see rpc-devhost.c)
         dev->flags |= DEV_FLAG_UNBINDABLE;
     }
 
@@ -433,23 +580,7 @@ mx_status_t devmgr_device_add(mx_device_t* dev, mx_device_t* parent) {
 #endif
 
     if ((dev->flags & DEV_FLAG_UNBINDABLE) == 0) {
-        if (!device_is_bound(dev)) {
-            // first, look for a specific driver binary for this device
-            if (devmgr_driver_probe(dev) < 0) {
-                // if not found, probe all built-in drivers
-                mx_driver_t* drv = NULL;
-                list_for_every_entry (&driver_list, drv, mx_driver_t, node) {
-                    if (devmgr_device_probe(dev, drv) == NO_ERROR) {
-                        break;
-                    }
-                }
-            }
-        }
-
-        // if no driver is bound, add the device to the unmatched list
-        if (!device_is_bound(dev)) {
-            list_add_tail(&unmatched_device_list, &dev->unode);
-        }
+        devmgr_device_queue_bind(dev);
     }
 
     dev->flags &= (~DEV_FLAG_BUSY);
@@ -569,6 +700,10 @@ mx_status_t devmgr_driver_add(mx_driver_t* drv) {
     }
 
     // add the driver to the driver list
+    mx_status_t status;
+    if ((status = devmgr_bind_index_add(drv)) < 0) {
+        return status;
+    }
     list_add_tail(&driver_list, &drv->node);
 
     // probe unmatched devices with the driver and initialize if the probe is successful
@@ -610,7 +745,16 @@ void devmgr_init(bool devhost) {
     }
 #endif
 
-    mxio_dispatcher_create(&devmgr_rio_dispatcher, mxrio_handler);
+    mxio_dispatcher_create(&devmgr_rio_dispatcher, mxrio_bulk_handler);
+
+    for (unsigned n = 0; n < BIND_THREADS; n++) {
+        mxr_thread_t* t;
+        if (mxr_thread_create(devmgr_bind_thread, NULL, "devmgr-bind", &t) < 0) {
+            break;
+        }
+        mxr_thread_detach(t);
+        bind_threads++;
+    }
 }
 
 void devmgr_init_builtin_drivers(void) {
@@ -707,9 +851,24 @@ void devmgr_dump(void) {
     DM_UNLOCK();
 }
 
+static void devmgr_dump_binds(void) {
+    bind_stats_t* bs;
+    DM_LOCK();
+    printf("---- Driver Binds ----\n");
+    printf("%-24s %6s %6s %10s %10s\n", "driver", "binds", "failed", "total(us)", "max(us)");
+    list_for_every_entry (&bind_stats_list, bs, bind_stats_t, node) {
+        printf("%-24s %6u %6u %10llu %10llu\n", safename(bs->drv->name),
+               bs->count, bs->failed, (unsigned long long)(bs->total / 1000),
+               (unsigned long long)(bs->max / 1000));
+    }
+    printf("---- End Driver Binds ----\n");
+    DM_UNLOCK();
+}
+
 mx_status_t devmgr_control(const char* cmd) {
     if (!strcmp(cmd, "help")) {
         printf("dump   - dump device tree\n"
+               "binds  - show how long each driver's binds took\n"
                "lsof   - list open remoteio files and devices\n"
                "crash  - crash the device manager\n"
                );
@@ -719,6 +878,10 @@ mx_status_t devmgr_control(const char* cmd) {
         devmgr_dump();
         return NO_ERROR;
     }
+    if (!strcmp(cmd, "binds")) {
+        devmgr_dump_binds();
+        return NO_ERROR;
+    }
     if (!strcmp(cmd, "lsof")) {
         vfs_dump_handles();
         return NO_ERROR;
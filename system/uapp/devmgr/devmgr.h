@@ -7,6 +7,7 @@
 #include "device-internal.h"
 #include <ddk/device.h>
 #include <ddk/driver.h>
+#include <ddk/iotxn.h>
 
 #include <magenta/types.h>
 
@@ -42,6 +43,9 @@ mx_status_t devmgr_device_close(mx_device_t* dev);
 mx_status_t devmgr_control(const char* cmd);
 
 bool devmgr_is_bindable(mx_driver_t* drv, mx_device_t* dev);
+mx_status_t devmgr_bind_index_add(mx_driver_t* drv);
+void devmgr_bind_index_remove(mx_driver_t* drv);
+mx_driver_t** devmgr_bind_candidates(mx_device_t* dev, size_t* count);
 
 // Internals
 void devmgr_init(bool hostproc);
@@ -76,6 +80,64 @@ struct devhost_msg {
 #define DH_OP_STATUS 0
 #define DH_OP_ADD 1
 #define DH_OP_REMOVE 2
+#define DH_OP_UNBOUND 3
+
+// DH_OP_ADD carries the device's remoteio pipe and, for block devices, the
+// VMO and event of an iotxn ring, which lets drivers in devmgr stack on the
+// device once DH_OP_UNBOUND says no driver in the devhost took it.
+//
+// The VMO starts with an ioring_t. Each of its slots has IORING_DATA_SIZE
+// bytes of data at IORING_DATA_OFFSET. devmgr owns a slot from posting a
+// submission for it until the devhost posts its completion, so neither
+// queue can overflow. IORING_SIGNAL_SQ and IORING_SIGNAL_CQ are user
+// signals on the event, the doorbells for each queue.
+
+#define IORING_SLOTS 8
+#define IORING_DATA_SIZE (64 * 1024)
+#define IORING_DATA_OFFSET 4096
+#define IORING_VMO_SIZE (IORING_DATA_OFFSET + IORING_SLOTS * IORING_DATA_SIZE)
+
+#define IORING_SIGNAL_SQ MX_SIGNAL_USER0
+#define IORING_SIGNAL_CQ MX_SIGNAL_USER1
+
+typedef struct {
+    uint32_t opcode;
+    uint32_t slot;
+    uint64_t offset;
+    uint64_t length;
+} ioring_sqe_t;
+
+typedef struct {
+    uint32_t slot;
+    int32_t status;
+    uint64_t actual;
+} ioring_cqe_t;
+
+typedef struct {
+    // set by the devhost before the ring is handed over
+    uint64_t size;
+    uint64_t block_size;
+
+    // each index is only written by one side
+    uint32_t sq_head; // devhost
+    uint32_t sq_tail; // devmgr
+    uint32_t cq_head; // devmgr
+    uint32_t cq_tail; // devhost
+
+    ioring_sqe_t sq[IORING_SLOTS];
+    ioring_cqe_t cq[IORING_SLOTS];
+} ioring_t;
+
+typedef struct devmgr_ioring devmgr_ioring_t;
+
+// devmgr side of a ring, for proxies
+mx_status_t devmgr_ioring_create(devmgr_ioring_t** out, mx_handle_t vmo, mx_handle_t event);
+void devmgr_ioring_queue(devmgr_ioring_t* rc, iotxn_t* txn);
+mx_off_t devmgr_ioring_get_size(devmgr_ioring_t* rc);
+uint64_t devmgr_ioring_get_block_size(devmgr_ioring_t* rc);
+
+// devhost side, serving dev's iotxns
+mx_status_t devhost_ioring_create(mx_device_t* dev, mx_handle_t* vmo, mx_handle_t* event);
 
 mx_status_t devmgr_host_process(mx_device_t* dev, mx_driver_t* drv);
 mx_status_t devmgr_handler(mx_handle_t h, void* cb, void* cookie);
@@ -83,6 +145,7 @@ mx_status_t devmgr_handler(mx_handle_t h, void* cb, void* cookie);
 // routines devhost uses to talk to devmgr
 mx_status_t devhost_add(mx_device_t* dev, mx_device_t* parent);
 mx_status_t devhost_remove(mx_device_t* dev);
+mx_status_t devhost_unbound(mx_device_t* dev);
 
 extern bool devmgr_is_remote;
 extern mx_handle_t devhost_handle;
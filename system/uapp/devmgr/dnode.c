@@ -13,6 +13,77 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Every dnode with a parent is also in one hash table keyed by parent and
+// name, so dn_lookup() doesn't scan directories with many entries. The
+// children lists remain for readdir. The table starts out static and
+// doubles once it holds more entries than buckets.
+#define DN_HASH_MIN_BUCKETS 256
+
+static dnode_t* dn_hash_static[DN_HASH_MIN_BUCKETS];
+static dnode_t** dn_hash = dn_hash_static;
+static size_t dn_hash_buckets = DN_HASH_MIN_BUCKETS;
+static size_t dn_hash_count;
+
+static uint32_t dn_hash_of(dnode_t* parent, const char* name, size_t len) {
+    // FNV-1a over the parent pointer and the name
+    uint32_t h = 2166136261u;
+    uintptr_t p = (uintptr_t)parent;
+    for (size_t n = 0; n < sizeof(p); n++) {
+        h = (h ^ (uint8_t)(p >> (n * 8))) * 16777619u;
+    }
+    while (len-- > 0) {
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    }
+    return h;
+}
+
+static void dn_hash_grow(void) {
+    size_t buckets = dn_hash_buckets * 2;
+    dnode_t** table = calloc(buckets, sizeof(dnode_t*));
+    if (table == NULL) {
+        // chains just get longer
+        return;
+    }
+    for (size_t n = 0; n < dn_hash_buckets; n++) {
+        dnode_t* dn = dn_hash[n];
+        while (dn != NULL) {
+            dnode_t* next = dn->hash_next;
+            dn->hash_next = table[dn->hash & (buckets - 1)];
+            table[dn->hash & (buckets - 1)] = dn;
+            dn = next;
+        }
+    }
+    if (dn_hash != dn_hash_static) {
+        free(dn_hash);
+    }
+    dn_hash = table;
+    dn_hash_buckets = buckets;
+}
+
+static void dn_hash_insert(dnode_t* dn) {
+    if (dn_hash_count >= dn_hash_buckets) {
+        dn_hash_grow();
+    }
+    dn->hash = dn_hash_of(dn->parent, dn->name, DN_NAME_LEN(dn->flags));
+    dnode_t** bucket = &dn_hash[dn->hash & (dn_hash_buckets - 1)];
+    dn->hash_next = *bucket;
+    *bucket = dn;
+    dn_hash_count++;
+}
+
+static void dn_hash_remove(dnode_t* dn) {
+    dnode_t** link = &dn_hash[dn->hash & (dn_hash_buckets - 1)];
+    while (*link != NULL) {
+        if (*link == dn) {
+            *link = dn->hash_next;
+            dn->hash_next = NULL;
+            dn_hash_count--;
+            return;
+        }
+        link = &(*link)->hash_next;
+    }
+}
+
 // create a new dnode and attach it to a vnode
 mx_status_t dn_create(dnode_t** out, const char* name, size_t len, vnode_t* vn) {
     dnode_t* dn;
@@ -59,8 +130,20 @@ void dn_release(dnode_t* dn) {
 #endif
 
 void dn_delete(dnode_t* dn) {
+    // detach any children, which are otherwise still found in the
+    // hash under this dnode's address once it is reused
+    dnode_t* child;
+    while ((child = list_remove_head_type(&dn->children, dnode_t, dn_entry)) != NULL) {
+        dn_hash_remove(child);
+        child->parent = NULL;
+    }
+
     // detach from parent
     if (dn->parent) {
+        if (dn->parent->readdir_hint == dn) {
+            dn->parent->readdir_hint = NULL;
+        }
+        dn_hash_remove(dn);
         list_delete(&dn->dn_entry);
         dn->parent = NULL;
     }
@@ -91,7 +174,9 @@ void dn_add_child(dnode_t* parent, dnode_t* child) {
     }
 
     child->parent = parent;
+    child->seq = ++parent->next_seq;
     list_add_tail(&parent->children, &child->dn_entry);
+    dn_hash_insert(child);
 }
 
 mx_status_t dn_lookup(dnode_t* parent, dnode_t** out, const char* name, size_t len) {
@@ -104,7 +189,11 @@ mx_status_t dn_lookup(dnode_t* parent, dnode_t** out, const char* name, size_t l
         *out = parent->parent;
         return NO_ERROR;
     }
-    list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
+    uint32_t hash = dn_hash_of(parent, name, len);
+    for (dn = dn_hash[hash & (dn_hash_buckets - 1)]; dn != NULL; dn = dn->hash_next) {
+        if ((dn->hash != hash) || (dn->parent != parent)) {
+            continue;
+        }
         if (DN_NAME_LEN(dn->flags) != len) {
             continue;
         }
@@ -117,32 +206,68 @@ mx_status_t dn_lookup(dnode_t* parent, dnode_t** out, const char* name, size_t l
     return ERR_NOT_FOUND;
 }
 
-mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
+// Children are listed in the order they were added, which is also the
+// order of their seq numbers, and the cookie holds the seq of the last one
+// returned. So listing carries on correctly when that child has been
+// deleted meanwhile. The parent remembers where the last call stopped, so
+// a listing in progress resumes there instead of searching from the start.
+static mx_status_t _dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len,
+                               bool with_attr) {
     vdircookie_t* c = cookie;
-    dnode_t* last = c->p;
     size_t pos = 0;
     char* ptr = data;
-    bool search = (last != NULL);
     mx_status_t r;
     dnode_t* dn;
 
-    list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
-        if (search) {
-            if (dn == last) {
-                search = false;
+    dnode_t* last = parent->readdir_hint;
+    if ((c->n == 0) || (last == NULL) || (last->seq != c->n)) {
+        last = NULL;
+        list_for_every_entry(&parent->children, dn, dnode_t, dn_entry) {
+            if (dn->seq > c->n) {
+                break;
+            }
+            last = dn;
+        }
+    }
+    if (last == NULL) {
+        dn = list_peek_head_type(&parent->children, dnode_t, dn_entry);
+    } else {
+        dn = list_next_type(&parent->children, &last->dn_entry, dnode_t, dn_entry);
+    }
+
+    for (; dn != NULL; dn = list_next_type(&parent->children, &dn->dn_entry, dnode_t, dn_entry)) {
+        uint32_t vtype = ((dn->flags & DN_TYPE_MASK) == DN_TYPE_DIR) ? V_TYPE_DIR : V_TYPE_FILE;
+        if (with_attr) {
+            vnattr_t attr;
+            if ((dn->vnode == NULL) || (dn->vnode->ops->getattr(dn->vnode, &attr) < 0)) {
+                memset(&attr, 0, sizeof(attr));
+                attr.mode = vtype;
             }
+            r = vfs_fill_dirent_attr((void*)(ptr + pos), len - pos,
+                                     dn->name, DN_NAME_LEN(dn->flags),
+                                     VTYPE_TO_DTYPE(vtype), &attr);
         } else {
-            uint32_t vtype = ((dn->flags & DN_TYPE_MASK) == DN_TYPE_DIR) ? V_TYPE_DIR : V_TYPE_FILE;
             r = vfs_fill_dirent((void*)(ptr + pos), len - pos,
                                 dn->name, DN_NAME_LEN(dn->flags),
                                 VTYPE_TO_DTYPE(vtype));
-            if (r < 0) {
-                break;
-            }
-            last = dn;
-            pos += r;
         }
+        if (r < 0) {
+            break;
+        }
+        last = dn;
+        pos += r;
+    }
+    if (last != NULL) {
+        c->n = last->seq;
+        parent->readdir_hint = last;
     }
-    c->p = last;
     return pos;
 }
+
+mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len) {
+    return _dn_readdir(parent, cookie, data, len, false);
+}
+
+mx_status_t dn_readdir_attr(dnode_t* parent, void* cookie, void* data, size_t len) {
+    return _dn_readdir(parent, cookie, data, len, true);
+}
@@ -29,6 +29,11 @@ struct dnode {
     list_node_t children;
     list_node_t dn_entry; // entry in parent's list
     list_node_t vn_entry; // entry in vnode's list
+    dnode_t* hash_next;   // entry in the lookup hash, see dnode.c
+    uint32_t hash;
+    uint32_t seq;         // order among its parent's children, see dn_readdir()
+    uint32_t next_seq;
+    dnode_t* readdir_hint;
     char namedata[DN_NAME_INLINE + 1];
 };
 
@@ -47,3 +52,4 @@ mx_status_t dn_lookup(dnode_t* dn, dnode_t** out, const char* name, size_t len);
 void dn_add_child(dnode_t* parent, dnode_t* child);
 
 mx_status_t dn_readdir(dnode_t* parent, void* cookie, void* data, size_t len);
+mx_status_t dn_readdir_attr(dnode_t* parent, void* cookie, void* data, size_t len);
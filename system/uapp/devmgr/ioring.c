@@ -0,0 +1,350 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "devmgr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ddk/device.h>
+#include <ddk/iotxn.h>
+#include <ddk/protocol/block.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+
+#include <runtime/mutex.h>
+#include <runtime/thread.h>
+
+#include <system/listnode.h>
+
+// iotxn rings between a devhost and devmgr, see devmgr.h for the layout.
+// Like proxies, rings last as long as the devhost.
+
+static inline uint32_t ring_load(uint32_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void ring_store(uint32_t* p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static void* ring_data(ioring_t* ring, uint32_t slot) {
+    return (void*)ring + IORING_DATA_OFFSET + slot * IORING_DATA_SIZE;
+}
+
+static mx_status_t ring_map(mx_handle_t vmo, ioring_t** out) {
+    uintptr_t addr;
+    mx_status_t r = mx_process_vm_map(0, vmo, 0, IORING_VMO_SIZE, &addr,
+                                      MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    if (r < 0) {
+        return r;
+    }
+    *out = (ioring_t*)addr;
+    return NO_ERROR;
+}
+
+// Wait for a doorbell, then clear it before the queue is drained, so
+// entries posted while draining ring it again.
+static mx_status_t ring_wait(mx_handle_t event, mx_signals_t signal) {
+    mx_signals_state_t pending;
+    mx_status_t r;
+    if ((r = mx_handle_wait_one(event, signal, MX_TIME_INFINITE, &pending)) < 0) {
+        return r;
+    }
+    return mx_object_signal(event, 0, signal);
+}
+
+
+// devhost side: submissions become iotxns queued on the device, which are
+// copied into their slots when they complete.
+
+typedef struct {
+    mx_device_t* dev;
+    ioring_t* ring;
+    mx_handle_t event;
+    // serializes posting completions, which drivers may do from any thread
+    mxr_mutex_t lock;
+} ioring_server_t;
+
+static void ioring_server_complete(iotxn_t* txn) {
+    ioring_server_t* srv = txn->context;
+    ioring_t* ring = srv->ring;
+    uint32_t slot = *iotxn_to(txn, uint32_t);
+
+    if ((txn->opcode == IOTXN_OP_READ) && (txn->status == NO_ERROR)) {
+        txn->ops->copyfrom(txn, ring_data(ring, slot), txn->actual, 0);
+    }
+
+    mxr_mutex_lock(&srv->lock);
+    uint32_t tail = ring->cq_tail;
+    ioring_cqe_t* cqe = &ring->cq[tail % IORING_SLOTS];
+    cqe->slot = slot;
+    cqe->status = txn->status;
+    cqe->actual = txn->actual;
+    ring_store(&ring->cq_tail, tail + 1);
+    mxr_mutex_unlock(&srv->lock);
+
+    mx_object_signal(srv->event, IORING_SIGNAL_CQ, 0);
+    txn->ops->release(txn);
+}
+
+static void ioring_server_fail(ioring_server_t* srv, uint32_t slot, mx_status_t status) {
+    ioring_t* ring = srv->ring;
+    mxr_mutex_lock(&srv->lock);
+    uint32_t tail = ring->cq_tail;
+    ioring_cqe_t* cqe = &ring->cq[tail % IORING_SLOTS];
+    cqe->slot = slot;
+    cqe->status = status;
+    cqe->actual = 0;
+    ring_store(&ring->cq_tail, tail + 1);
+    mxr_mutex_unlock(&srv->lock);
+    mx_object_signal(srv->event, IORING_SIGNAL_CQ, 0);
+}
+
+static void ioring_server_queue(ioring_server_t* srv, ioring_sqe_t* sqe) {
+    if (sqe->slot >= IORING_SLOTS) {
+        // nothing to complete, devmgr doesn't own such a slot
+        return;
+    }
+    if ((sqe->length > IORING_DATA_SIZE) ||
+        ((sqe->opcode != IOTXN_OP_READ) && (sqe->opcode != IOTXN_OP_WRITE))) {
+        ioring_server_fail(srv, sqe->slot, ERR_INVALID_ARGS);
+        return;
+    }
+
+    // always a full slot's worth, so that one preallocated is reused
+    iotxn_t* txn;
+    mx_status_t r;
+    if ((r = iotxn_alloc(&txn, 0, IORING_DATA_SIZE, sizeof(uint32_t))) < 0) {
+        ioring_server_fail(srv, sqe->slot, r);
+        return;
+    }
+    txn->opcode = sqe->opcode;
+    txn->offset = sqe->offset;
+    txn->length = sqe->length;
+    txn->complete_cb = ioring_server_complete;
+    txn->context = srv;
+    *iotxn_to(txn, uint32_t) = sqe->slot;
+    if (txn->opcode == IOTXN_OP_WRITE) {
+        txn->ops->copyto(txn, ring_data(srv->ring, sqe->slot), txn->length, 0);
+    }
+    iotxn_queue(srv->dev, txn);
+}
+
+static int ioring_server_thread(void* arg) {
+    ioring_server_t* srv = arg;
+    ioring_t* ring = srv->ring;
+
+    while (ring_wait(srv->event, IORING_SIGNAL_SQ) == NO_ERROR) {
+        uint32_t tail = ring_load(&ring->sq_tail);
+        uint32_t head = ring->sq_head;
+        while (head != tail) {
+            // devmgr may scribble on the ring, only trust our copy
+            ioring_sqe_t sqe = ring->sq[head % IORING_SLOTS];
+            ring_store(&ring->sq_head, ++head);
+            ioring_server_queue(srv, &sqe);
+        }
+    }
+    printf("devhost: ioring for '%s' stopped\n", srv->dev->name);
+    return 0;
+}
+
+mx_status_t devhost_ioring_create(mx_device_t* dev, mx_handle_t* vmo, mx_handle_t* event) {
+    ioring_server_t* srv;
+    if ((srv = calloc(1, sizeof(ioring_server_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    srv->dev = dev;
+    srv->lock = MXR_MUTEX_INIT;
+
+    mx_status_t r;
+    mx_handle_t h;
+    if ((h = mx_vm_object_create(IORING_VMO_SIZE)) < 0) {
+        r = h;
+        goto fail0;
+    }
+    if ((r = ring_map(h, &srv->ring)) < 0) {
+        goto fail1;
+    }
+    if ((srv->event = mx_event_create(0)) < 0) {
+        r = srv->event;
+        goto fail2;
+    }
+    if ((*event = mx_handle_duplicate(srv->event, MX_RIGHT_SAME_RIGHTS)) < 0) {
+        r = *event;
+        goto fail3;
+    }
+
+    srv->ring->size = dev->ops->get_size(dev);
+    if (dev->ops->ioctl(dev, BLOCK_OP_GET_BLOCKSIZE, NULL, 0, &srv->ring->block_size,
+                        sizeof(srv->ring->block_size)) < 0) {
+        srv->ring->block_size = 0;
+    }
+
+    // at most one iotxn per slot is in flight
+    if ((r = iotxn_prealloc(IORING_SLOTS, IORING_DATA_SIZE, sizeof(uint32_t))) < 0) {
+        goto fail4;
+    }
+
+    mxr_thread_t* t;
+    if ((r = mxr_thread_create(ioring_server_thread, srv, "devhost-ioring", &t)) < 0) {
+        goto fail4;
+    }
+    mxr_thread_detach(t);
+
+    // the mapping keeps the ring alive, devmgr gets our handle to it
+    *vmo = h;
+    return NO_ERROR;
+
+fail4:
+    mx_handle_close(*event);
+fail3:
+    mx_handle_close(srv->event);
+fail2:
+    mx_process_vm_unmap(0, (uintptr_t)srv->ring, IORING_VMO_SIZE);
+fail1:
+    mx_handle_close(h);
+fail0:
+    free(srv);
+    return r;
+}
+
+
+// devmgr side: iotxns queued on a proxy are copied into free slots and
+// submitted, or wait in order for a slot if all are in use.
+
+struct devmgr_ioring {
+    ioring_t* ring;
+    mx_handle_t event;
+
+    mxr_mutex_t lock;
+    iotxn_t* txns[IORING_SLOTS];
+    list_node_t queued;
+};
+
+// Called with the lock held.
+static void ioring_submit_locked(devmgr_ioring_t* rc) {
+    ioring_t* ring = rc->ring;
+    bool posted = false;
+    uint32_t slot = 0;
+
+    while (!list_is_empty(&rc->queued)) {
+        while ((slot < IORING_SLOTS) && (rc->txns[slot] != NULL)) {
+            slot++;
+        }
+        if (slot == IORING_SLOTS) {
+            break;
+        }
+        iotxn_t* txn = list_remove_head_type(&rc->queued, iotxn_t, node);
+        rc->txns[slot] = txn;
+        if (txn->opcode == IOTXN_OP_WRITE) {
+            txn->ops->copyfrom(txn, ring_data(ring, slot), txn->length, 0);
+        }
+
+        uint32_t tail = ring->sq_tail;
+        ioring_sqe_t* sqe = &ring->sq[tail % IORING_SLOTS];
+        sqe->opcode = txn->opcode;
+        sqe->slot = slot;
+        sqe->offset = txn->offset;
+        sqe->length = txn->length;
+        ring_store(&ring->sq_tail, tail + 1);
+        posted = true;
+    }
+    if (posted) {
+        mx_object_signal(rc->event, IORING_SIGNAL_SQ, 0);
+    }
+}
+
+static int ioring_client_thread(void* arg) {
+    devmgr_ioring_t* rc = arg;
+    ioring_t* ring = rc->ring;
+
+    while (ring_wait(rc->event, IORING_SIGNAL_CQ) == NO_ERROR) {
+        list_node_t done = LIST_INITIAL_VALUE(done);
+
+        mxr_mutex_lock(&rc->lock);
+        uint32_t tail = ring_load(&ring->cq_tail);
+        uint32_t head = ring->cq_head;
+        while (head != tail) {
+            ioring_cqe_t cqe = ring->cq[head % IORING_SLOTS];
+            ring_store(&ring->cq_head, ++head);
+
+            iotxn_t* txn;
+            if ((cqe.slot >= IORING_SLOTS) || ((txn = rc->txns[cqe.slot]) == NULL)) {
+                printf("devmgr: ioring completion for bad slot %u\n", cqe.slot);
+                continue;
+            }
+            rc->txns[cqe.slot] = NULL;
+            txn->status = cqe.status;
+            txn->actual = 0;
+            if (cqe.status == NO_ERROR) {
+                txn->actual = (cqe.actual < txn->length) ? cqe.actual : txn->length;
+            }
+            if ((txn->opcode == IOTXN_OP_READ) && (txn->actual > 0)) {
+                txn->ops->copyto(txn, ring_data(ring, cqe.slot), txn->actual, 0);
+            }
+            list_add_tail(&done, &txn->node);
+        }
+        // the slots are free again once their data is out
+        ioring_submit_locked(rc);
+        mxr_mutex_unlock(&rc->lock);
+
+        iotxn_t* txn;
+        while ((txn = list_remove_head_type(&done, iotxn_t, node)) != NULL) {
+            txn->ops->complete(txn, txn->status, txn->actual);
+        }
+    }
+    printf("devmgr: ioring stopped\n");
+    return 0;
+}
+
+mx_status_t devmgr_ioring_create(devmgr_ioring_t** out, mx_handle_t vmo, mx_handle_t event) {
+    devmgr_ioring_t* rc;
+    if ((rc = calloc(1, sizeof(devmgr_ioring_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    rc->lock = MXR_MUTEX_INIT;
+    rc->event = event;
+    list_initialize(&rc->queued);
+
+    mx_status_t r;
+    if ((r = ring_map(vmo, &rc->ring)) < 0) {
+        free(rc);
+        return r;
+    }
+    mxr_thread_t* t;
+    if ((r = mxr_thread_create(ioring_client_thread, rc, "devmgr-ioring", &t)) < 0) {
+        mx_process_vm_unmap(0, (uintptr_t)rc->ring, IORING_VMO_SIZE);
+        free(rc);
+        return r;
+    }
+    mxr_thread_detach(t);
+
+    // the mapping keeps the ring alive
+    mx_handle_close(vmo);
+    *out = rc;
+    return NO_ERROR;
+}
+
+void devmgr_ioring_queue(devmgr_ioring_t* rc, iotxn_t* txn) {
+    if ((txn->length > IORING_DATA_SIZE) ||
+        ((txn->opcode != IOTXN_OP_READ) && (txn->opcode != IOTXN_OP_WRITE))) {
+        txn->ops->complete(txn, ERR_INVALID_ARGS, 0);
+        return;
+    }
+    mxr_mutex_lock(&rc->lock);
+    list_add_tail(&rc->queued, &txn->node);
+    ioring_submit_locked(rc);
+    mxr_mutex_unlock(&rc->lock);
+}
+
+mx_off_t devmgr_ioring_get_size(devmgr_ioring_t* rc) {
+    return rc->ring->size;
+}
+
+uint64_t devmgr_ioring_get_block_size(devmgr_ioring_t* rc) {
+    return rc->ring->block_size;
+}
@@ -9,6 +9,7 @@
 
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,8 +24,11 @@
 #include <mxio/remoteio.h>
 #include <mxio/util.h>
 
+#include <runtime/thread.h>
 #include <runtime/tls.h>
 
+#include <system/bootfs.h>
+
 #include "vfs.h"
 
 typedef struct bootfile bootfile_t;
@@ -35,15 +39,171 @@ struct bootfile {
     size_t len;
 };
 
+// Compressed bootfs files are unpacked into vmos of their own at boot, a
+// range of blocks at a time by a few threads.
+#define UNPACK_BLOCKS_PER_JOB 16
+#define UNPACK_MAX_THREADS 8
+
+typedef struct unpack_file unpack_file_t;
+struct unpack_file {
+    unpack_file_t* next;
+    char* path;
+    const uint8_t* frame;
+    size_t frame_len;
+    size_t len;
+    uint32_t blocks;
+    mx_handle_t vmo;
+    uint8_t* data;
+    bool failed;
+};
+
+typedef struct unpack_job {
+    unpack_file_t* file;
+    uint32_t first;
+    uint32_t count;
+} unpack_job_t;
+
+typedef struct unpack_work {
+    unpack_job_t* jobs;
+    size_t job_count;
+    size_t next_job;
+} unpack_work_t;
+
 struct callback_data {
+    mx_handle_t vmo;
     uint8_t* bootfs;
+    size_t len;
     unsigned int file_count;
+    unpack_file_t* unpack;
+    size_t unpack_jobs;
 };
 
-static void callback(void* arg, const char* path, size_t off, size_t len) {
+static void queue_unpack(struct callback_data* cd, const char* path, size_t off, size_t len) {
+    const uint8_t* frame = cd->bootfs + off;
+    size_t frame_len = cd->len - off;
+    int64_t blocks = (off < cd->len) ? bootfs_lz4_blocks(frame, frame_len, len) : -1;
+    if (blocks <= 0) {
+        printf("devmgr: bootfs: bad compressed file %s\n", path);
+        return;
+    }
+
+    unpack_file_t* file = calloc(1, sizeof(*file));
+    if (file == NULL || (file->path = strdup(path)) == NULL) {
+        free(file);
+        return;
+    }
+    file->frame = frame;
+    file->frame_len = frame_len;
+    file->len = len;
+    file->blocks = blocks;
+    if ((file->vmo = mx_vm_object_create(len)) < 0)
+        goto fail;
+    uintptr_t addr;
+    if (mx_process_vm_map(0, file->vmo, 0, len, &addr,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE) < 0) {
+        mx_handle_close(file->vmo);
+        goto fail;
+    }
+    file->data = (uint8_t*)addr;
+
+    file->next = cd->unpack;
+    cd->unpack = file;
+    cd->unpack_jobs += (blocks + UNPACK_BLOCKS_PER_JOB - 1) / UNPACK_BLOCKS_PER_JOB;
+    return;
+fail:
+    printf("devmgr: bootfs: no memory to unpack %s\n", path);
+    free(file->path);
+    free(file);
+}
+
+static int unpack_thread(void* arg) {
+    unpack_work_t* work = arg;
+    size_t n;
+    while ((n = __atomic_fetch_add(&work->next_job, 1, __ATOMIC_RELAXED)) < work->job_count) {
+        unpack_job_t* job = &work->jobs[n];
+        unpack_file_t* file = job->file;
+        uint8_t* dst = file->data + (size_t)job->first * BOOTFS_LZ4_BLOCK_SIZE;
+        if (bootfs_lz4_decode(file->frame, file->frame_len, file->len,
+                              job->first, job->count, dst) < 0)
+            file->failed = true;
+    }
+    return 0;
+}
+
+// Unpack the queued files, and add the ones that came out whole.
+static void unpack_files(struct callback_data* cd) {
+    unpack_work_t work = {
+        .jobs = calloc(cd->unpack_jobs, sizeof(unpack_job_t)),
+        .job_count = cd->unpack_jobs,
+    };
+    if (work.jobs == NULL) {
+        for (unpack_file_t* file = cd->unpack; file != NULL; file = file->next)
+            file->failed = true;
+        work.job_count = 0;
+    }
+
+    size_t n = 0;
+    for (unpack_file_t* file = work.jobs ? cd->unpack : NULL; file != NULL; file = file->next) {
+        for (uint32_t first = 0; first < file->blocks; first += UNPACK_BLOCKS_PER_JOB) {
+            work.jobs[n].file = file;
+            work.jobs[n].first = first;
+            work.jobs[n].count = file->blocks - first;
+            if (work.jobs[n].count > UNPACK_BLOCKS_PER_JOB)
+                work.jobs[n].count = UNPACK_BLOCKS_PER_JOB;
+            n++;
+        }
+    }
+
+    // this thread takes a share of the jobs too
+    mxr_thread_t* threads[UNPACK_MAX_THREADS];
+    unsigned int thread_count = 0;
+    unsigned int want = mx_num_cpus();
+    if (want > UNPACK_MAX_THREADS)
+        want = UNPACK_MAX_THREADS;
+    if (want > work.job_count)
+        want = work.job_count;
+    while (thread_count + 1 < want &&
+           mxr_thread_create(unpack_thread, &work, "devmgr-unpack",
+                             &threads[thread_count]) == NO_ERROR)
+        thread_count++;
+    unpack_thread(&work);
+    for (unsigned int i = 0; i < thread_count; i++)
+        mxr_thread_join(threads[i], NULL);
+    free(work.jobs);
+
+    unpack_file_t* next;
+    for (unpack_file_t* file = cd->unpack; file != NULL; file = next) {
+        next = file->next;
+        mx_handle_t ro = MX_HANDLE_INVALID;
+        if (!file->failed) {
+            // the data is served as is from here on, so seal it
+            mx_process_vm_protect(0, (uintptr_t)file->data, file->len, MX_VM_FLAG_PERM_READ);
+            ro = mx_handle_duplicate(file->vmo, MX_RIGHT_READ | MX_RIGHT_EXECUTE |
+                                                MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER);
+        }
+        mx_handle_close(file->vmo);
+        if (ro > 0 && bootfs_add_file(file->path, file->data, file->len, ro, 0) == NO_ERROR) {
+            ++cd->file_count;
+        } else {
+            printf("devmgr: bootfs: failed to unpack %s\n", file->path);
+            if (ro > 0)
+                mx_handle_close(ro);
+            mx_process_vm_unmap(0, (uintptr_t)file->data, 0);
+        }
+        free(file->path);
+        free(file);
+    }
+    cd->unpack = NULL;
+}
+
+static void callback(void* arg, const char* path, size_t off, size_t len, uint32_t flags) {
     struct callback_data* cd = arg;
     //printf("bootfs: %s @%zd (%zd bytes)\n", path, off, len);
-    bootfs_add_file(path, cd->bootfs + off, len);
+    if (flags & BOOTFS_FLAG_COMPRESSED) {
+        queue_unpack(cd, path, off, len);
+        return;
+    }
+    bootfs_add_file(path, cd->bootfs + off, len, cd->vmo, off);
     ++cd->file_count;
 }
 
@@ -146,9 +306,13 @@ static unsigned int setup_bootfs_vmo(unsigned int n, mx_handle_t vmo) {
         return 0;
     }
     struct callback_data cd = {
+        .vmo = vmo,
         .bootfs = (void*)addr,
+        .len = size,
     };
     bootfs_parse(cd.bootfs, size, &callback, &cd);
+    if (cd.unpack)
+        unpack_files(&cd);
     return cd.file_count;
 }
 
@@ -158,8 +322,19 @@ static void setup_bootfs(void) {
          (vmo = mxio_get_startup_handle(
              MX_HND_INFO(MX_HND_TYPE_BOOTFS_VMO, n))) != MX_HANDLE_INVALID;
         ++n) {
-        unsigned int count = setup_bootfs_vmo(n, vmo);
+        // the files hand out slices of the image, which must not be
+        // writable through them
+        mx_handle_t ro = mx_handle_duplicate(vmo, MX_RIGHT_READ | MX_RIGHT_EXECUTE |
+                                                  MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER);
         mx_handle_close(vmo);
+        if (ro < 0) {
+            cprintf("devmgr: failed to duplicate bootfs #%u (%d)\n", n, ro);
+            continue;
+        }
+        // kept open for the life of the files when there are any
+        unsigned int count = setup_bootfs_vmo(n, ro);
+        if (count == 0)
+            mx_handle_close(ro);
         if (count > 0)
             printf("devmgr: bootfs #%u contains %u file%s\n",
                    n, count, (count == 1) ? "" : "s");
@@ -11,6 +11,8 @@
 
 #include <ddk/device.h>
 #include <ddk/driver.h>
+#include <ddk/iotxn.h>
+#include <ddk/protocol/block.h>
 
 #include <magenta/syscalls.h>
 #include <magenta/types.h>
@@ -37,8 +39,11 @@ typedef struct proxy proxy_t;
 struct proxy {
     mx_device_t device;
     list_node_t node;
+    devmgr_ioring_t* ring;
 };
 
+#define get_proxy(dev) containerof(dev, proxy_t, device)
+
 static mx_status_t proxy_release(mx_device_t* dev) {
     return ERR_NOT_SUPPORTED;
 }
@@ -47,6 +52,44 @@ static mx_protocol_device_t proxy_device_proto = {
     .release = proxy_release,
 };
 
+// proxies of block devices with an iotxn ring can have drivers stacked on them
+
+static void proxy_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
+    devmgr_ioring_queue(get_proxy(dev)->ring, txn);
+}
+
+static mx_off_t proxy_get_size(mx_device_t* dev) {
+    return devmgr_ioring_get_size(get_proxy(dev)->ring);
+}
+
+static ssize_t proxy_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen,
+                           void* reply, size_t max) {
+    devmgr_ioring_t* ring = get_proxy(dev)->ring;
+    switch (op) {
+    case BLOCK_OP_GET_SIZE: {
+        uint64_t* size = reply;
+        if (max < sizeof(*size)) return ERR_NOT_ENOUGH_BUFFER;
+        *size = devmgr_ioring_get_size(ring);
+        return sizeof(*size);
+    }
+    case BLOCK_OP_GET_BLOCKSIZE: {
+        uint64_t* blksize = reply;
+        if (max < sizeof(*blksize)) return ERR_NOT_ENOUGH_BUFFER;
+        if ((*blksize = devmgr_ioring_get_block_size(ring)) == 0) return ERR_NOT_SUPPORTED;
+        return sizeof(*blksize);
+    }
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+}
+
+static mx_protocol_device_t proxy_ring_device_proto = {
+    .release = proxy_release,
+    .iotxn_queue = proxy_iotxn_queue,
+    .get_size = proxy_get_size,
+    .ioctl = proxy_ioctl,
+};
+
 struct devhost {
     mx_handle_t handle;
     // message pipe the devhost uses to make requests of devmgr;
@@ -72,7 +115,8 @@ static mx_device_t* devhost_id_to_dev(devhost_t* dh, uintptr_t id) {
     return NULL;
 }
 
-static mx_status_t devhost_remote_add(devhost_t* dh, devhost_msg_t* msg, mx_handle_t h) {
+static mx_status_t devhost_remote_add(devhost_t* dh, devhost_msg_t* msg,
+                                      mx_handle_t* handles, uint32_t hcount) {
     mx_status_t r = NO_ERROR;
     mx_device_t* dev;
 
@@ -87,15 +131,23 @@ static mx_status_t devhost_remote_add(devhost_t* dh, devhost_msg_t* msg, mx_hand
         goto fail0;
     }
     proxy_t* proxy;
-    if ((proxy = malloc(sizeof(proxy_t))) == NULL) {
+    if ((proxy = calloc(1, sizeof(proxy_t))) == NULL) {
         r = ERR_NO_MEMORY;
         goto fail0;
     }
-    if ((r = devmgr_device_init(&proxy->device, &proxy_driver,
-                                msg->namedata, &proxy_device_proto)) < 0) {
+    if (hcount == 3) {
+        if ((r = devmgr_ioring_create(&proxy->ring, handles[1], handles[2])) < 0) {
+            printf("devmgr: remote %p ioring failed %d\n", dh, r);
+            goto fail1;
+        }
+        // the ring owns them now
+        hcount = 1;
+    }
+    if ((r = devmgr_device_init(&proxy->device, &proxy_driver, msg->namedata,
+                                proxy->ring ? &proxy_ring_device_proto : &proxy_device_proto)) < 0) {
         goto fail1;
     }
-    proxy->device.remote = h;
+    proxy->device.remote = handles[0];
     proxy->device.flags |= DEV_FLAG_REMOTE;
     proxy->device.protocol_id = msg->protocol_id;
     if ((r = devmgr_device_add(&proxy->device, dev)) < 0) {
@@ -111,7 +163,9 @@ static mx_status_t devhost_remote_add(devhost_t* dh, devhost_msg_t* msg, mx_hand
 fail1:
     free(proxy);
 fail0:
-    mx_handle_close(h);
+    for (uint32_t n = 0; n < hcount; n++) {
+        mx_handle_close(handles[n]);
+    }
     return r;
 }
 
@@ -127,6 +181,19 @@ static mx_status_t devhost_remote_remove(devhost_t* dh, devhost_msg_t* msg) {
     return devmgr_device_remove(dev);
 }
 
+static mx_status_t devhost_remote_unbound(devhost_t* dh, devhost_msg_t* msg) {
+    mx_device_t* dev = devhost_id_to_dev(dh, msg->device_id);
+    if (dev == NULL) {
+        return ERR_NOT_FOUND;
+    }
+
+    // without a ring, there's nothing for a driver here to talk to
+    if (get_proxy(dev)->ring != NULL) {
+        devmgr_device_set_bindable(dev, true);
+    }
+    return NO_ERROR;
+}
+
 static void devhost_remote_died(devhost_t* dh) {
     printf("devmgr: remote %p died\n", dh);
 }
@@ -135,7 +202,7 @@ static void devhost_remote_died(devhost_t* dh) {
 mx_status_t devmgr_handler(mx_handle_t h, void* cb, void* cookie) {
     devhost_t* dh = cookie;
     devhost_msg_t msg;
-    mx_handle_t hnd;
+    mx_handle_t hnd[3];
     mx_status_t r;
 
     if (h == 0) {
@@ -144,8 +211,8 @@ mx_status_t devmgr_handler(mx_handle_t h, void* cb, void* cookie) {
     }
 
     uint32_t dsz = sizeof(msg);
-    uint32_t hcount = 1;
-    if ((r = mx_message_read(h, &msg, &dsz, &hnd, &hcount, 0)) < 0) {
+    uint32_t hcount = countof(hnd);
+    if ((r = mx_message_read(h, &msg, &dsz, hnd, &hcount, 0)) < 0) {
         if (r == ERR_BAD_STATE) {
             return ERR_DISPATCHER_NO_WORK;
         }
@@ -156,11 +223,11 @@ mx_status_t devmgr_handler(mx_handle_t h, void* cb, void* cookie) {
     }
     switch (msg.op) {
     case DH_OP_ADD:
-        if (hcount != 1) {
+        if ((hcount != 1) && (hcount != 3)) {
             goto fail;
         }
         DM_LOCK();
-        msg.arg = devhost_remote_add(dh, &msg, hnd);
+        msg.arg = devhost_remote_add(dh, &msg, hnd, hcount);
         DM_UNLOCK();
         break;
     case DH_OP_REMOVE:
@@ -171,6 +238,14 @@ mx_status_t devmgr_handler(mx_handle_t h, void* cb, void* cookie) {
         msg.arg = devhost_remote_remove(dh, &msg);
         DM_UNLOCK();
         break;
+    case DH_OP_UNBOUND:
+        if (hcount != 0) {
+            goto fail;
+        }
+        DM_LOCK();
+        msg.arg = devhost_remote_unbound(dh, &msg);
+        DM_UNLOCK();
+        break;
     default:
         goto fail;
     }
@@ -181,8 +256,8 @@ mx_status_t devmgr_handler(mx_handle_t h, void* cb, void* cookie) {
     return NO_ERROR;
 fail:
     printf("devmgr_handler: error %d\n", r);
-    if (hcount) {
-        mx_handle_close(hnd);
+    for (uint32_t n = 0; n < hcount; n++) {
+        mx_handle_close(hnd[n]);
     }
     return ERR_IO;
 }
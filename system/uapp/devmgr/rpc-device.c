@@ -178,6 +178,73 @@ static ssize_t do_sync_io(mx_device_t* dev, uint32_t opcode, void* buf, size_t c
     return actual;
 }
 
+// Bulk transfers keep up to BULK_TXNS iotxns of BULK_TXN_SIZE queued on
+// the device, each over its piece of the client's vmo, so a device that
+// can use the vmo's pages moves the data with no copy, and the device is
+// kept busy.
+#define BULK_TXN_SIZE (64 * 1024)
+#define BULK_TXNS 4
+
+typedef struct {
+    iotxn_t* txn;
+    mxr_completion_t completion;
+} bulk_slot_t;
+
+static ssize_t do_bulk_io(mx_device_t* dev, uint32_t opcode, mx_handle_t vmo, size_t count, mx_off_t off) {
+    bulk_slot_t slots[BULK_TXNS];
+    unsigned head = 0;
+    unsigned inflight = 0;
+    size_t queued = 0;
+    size_t done = 0;
+    bool stop = false;
+    mx_status_t r = NO_ERROR;
+
+    for (;;) {
+        while (!stop && (inflight < BULK_TXNS) && (queued < count)) {
+            bulk_slot_t* slot = &slots[(head + inflight) % BULK_TXNS];
+            size_t xfer = ((count - queued) > BULK_TXN_SIZE) ? BULK_TXN_SIZE : (count - queued);
+            if ((r = iotxn_alloc_vmo(&slot->txn, 0, vmo, queued, xfer, 0)) != NO_ERROR) {
+                stop = true;
+                break;
+            }
+            iotxn_t* txn = slot->txn;
+            slot->completion = MXR_COMPLETION_INIT;
+            txn->opcode = opcode;
+            txn->offset = off + queued;
+            txn->length = xfer;
+            txn->complete_cb = sync_io_complete;
+            txn->context = &slot->completion;
+            dev->ops->iotxn_queue(dev, txn);
+            queued += xfer;
+            inflight++;
+        }
+        if (inflight == 0) {
+            break;
+        }
+
+        // finish them in order, so that done only counts bytes
+        // moved with none missing before them
+        bulk_slot_t* slot = &slots[head];
+        iotxn_t* txn = slot->txn;
+        mxr_completion_wait(&slot->completion, MX_TIME_INFINITE);
+        head = (head + 1) % BULK_TXNS;
+        inflight--;
+        if (stop) {
+            // an earlier one fell short, this one doesn't count
+        } else if (txn->status != NO_ERROR) {
+            r = txn->status;
+            stop = true;
+        } else {
+            done += txn->actual;
+            // stop at a short read or write, such as at the end of the device
+            stop = (txn->actual < txn->length);
+        }
+        txn->ops->release(txn);
+    }
+
+    return done ? (ssize_t)done : r;
+}
+
 mx_status_t devmgr_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
     iostate_t* ios = cookie;
     mx_device_t* dev = ios->dev;
@@ -185,6 +252,28 @@ mx_status_t devmgr_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
     int32_t arg = msg->arg;
     msg->datalen = 0;
 
+    if (msg->op & MXRIO_BULK) {
+        // handle[0] is the client's vmo, which remains the caller's
+        uint32_t op = MXRIO_OP(msg->op);
+        uint32_t opcode = ((op == MXRIO_READ) || (op == MXRIO_READ_AT)) ? IOTXN_OP_READ : IOTXN_OP_WRITE;
+        if ((op == MXRIO_READ_AT) || (op == MXRIO_WRITE_AT)) {
+            if (msg->arg2.off < 0) {
+                return ERR_INVALID_ARGS;
+            }
+            mx_status_t r = do_bulk_io(dev, opcode, msg->handle[0], arg, msg->arg2.off);
+            if (r >= 0) {
+                msg->arg2.off += r;
+            }
+            return r;
+        }
+        mx_status_t r = do_bulk_io(dev, opcode, msg->handle[0], arg, ios->io_off);
+        if (r >= 0) {
+            ios->io_off += r;
+            msg->arg2.off = ios->io_off;
+        }
+        return r;
+    }
+
     for (unsigned i = 0; i < msg->hcount; i++) {
         mx_handle_close(msg->handle[i]);
     }
@@ -234,6 +323,27 @@ mx_status_t devmgr_rio_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
         }
         return r;
     }
+    case MXRIO_READ_AT: {
+        if (msg->arg2.off < 0) {
+            return ERR_INVALID_ARGS;
+        }
+        mx_status_t r = do_sync_io(dev, IOTXN_OP_READ, msg->data, arg, msg->arg2.off);
+        if (r >= 0) {
+            msg->arg2.off += r;
+            msg->datalen = r;
+        }
+        return r;
+    }
+    case MXRIO_WRITE_AT: {
+        if (msg->arg2.off < 0) {
+            return ERR_INVALID_ARGS;
+        }
+        mx_status_t r = do_sync_io(dev, IOTXN_OP_WRITE, msg->data, len, msg->arg2.off);
+        if (r >= 0) {
+            msg->arg2.off += r;
+        }
+        return r;
+    }
     case MXRIO_SEEK: {
         size_t end, n;
         end = dev->ops->get_size(dev);
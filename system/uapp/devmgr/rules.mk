@@ -28,6 +28,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/rpc-device.c \
     $(LOCAL_DIR)/rpc-devhost.c \
     $(LOCAL_DIR)/devhost.c \
+    $(LOCAL_DIR)/ioring.c \
     $(LOCAL_DIR)/dmctl.c \
     $(LOCAL_DIR)/api.c \
     $(LOCAL_DIR)/vfs.c \
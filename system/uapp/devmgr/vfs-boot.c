@@ -9,7 +9,10 @@
 
 #include <ddk/device.h>
 
+#include <magenta/syscalls.h>
+
 #include <mxio/debug.h>
+#include <mxio/io.h>
 #include <mxio/vfs.h>
 
 #include <stdlib.h>
@@ -22,6 +25,10 @@ struct vnboot {
     vnode_t vn;
     void* data;
     size_t datalen;
+
+    // read-only bootfs image vmo holding the data, page aligned at vmo_off
+    mx_handle_t vmo;
+    size_t vmo_off;
 };
 
 mx_status_t vnb_get_node(vnode_t** out, mx_device_t* dev);
@@ -63,6 +70,30 @@ static mx_status_t vnb_create(vnode_t* vn, vnode_t** out, const char* name, size
     return ERR_NOT_SUPPORTED;
 }
 
+static ssize_t vnb_ioctl(vnode_t* vn, uint32_t op, const void* in_data, size_t in_len,
+                         void* out_data, size_t out_len) {
+    vnboot_t* vnb = vn->pdata;
+    switch (op) {
+    case IOCTL_FILE_GET_VMO: {
+        if (vn->dnode != NULL) {
+            return ERR_NOT_FILE;
+        }
+        if (out_len < sizeof(mx_handle_t)) {
+            return ERR_INVALID_ARGS;
+        }
+        // a window onto the image's own pages, so there's nothing to copy
+        mx_handle_t vmo = mx_vm_object_slice(vnb->vmo, vnb->vmo_off, vnb->datalen);
+        if (vmo < 0) {
+            return vmo;
+        }
+        memcpy(out_data, &vmo, sizeof(mx_handle_t));
+        return sizeof(mx_handle_t);
+    }
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+}
+
 static vnode_ops_t vn_boot_ops = {
     .release = vnb_release,
     .open = memfs_open,
@@ -72,8 +103,9 @@ static vnode_ops_t vn_boot_ops = {
     .lookup = memfs_lookup,
     .getattr = vnb_getattr,
     .readdir = memfs_readdir,
+    .readdir_attr = memfs_readdir_attr,
     .create = vnb_create,
-    .ioctl = memfs_ioctl,
+    .ioctl = vnb_ioctl,
     .unlink = memfs_unlink,
 };
 
@@ -96,7 +128,8 @@ static vnboot_t vnb_root = {
 
 static mx_status_t _vnb_create(vnboot_t* parent, vnboot_t** out,
                                const char* name, size_t namelen,
-                               void* data, size_t datalen) {
+                               void* data, size_t datalen,
+                               mx_handle_t vmo, size_t vmo_off) {
     if (parent->vn.dnode == NULL) {
         return ERR_NOT_DIR;
     }
@@ -114,6 +147,8 @@ static mx_status_t _vnb_create(vnboot_t* parent, vnboot_t** out,
 
     vnb->data = data;
     vnb->datalen = datalen;
+    vnb->vmo = vmo;
+    vnb->vmo_off = vmo_off;
 
     dnode_t* dn;
     mx_status_t r;
@@ -157,10 +192,11 @@ static mx_status_t _vnb_mkdir(vnboot_t* parent, vnboot_t** out, const char* name
     }
 
     // create a new directory
-    return _vnb_create(parent, out, name, namelen, NULL, 0);
+    return _vnb_create(parent, out, name, namelen, NULL, 0, MX_HANDLE_INVALID, 0);
 }
 
-mx_status_t bootfs_add_file(const char* path, void* data, size_t len) {
+mx_status_t bootfs_add_file(const char* path, void* data, size_t len,
+                            mx_handle_t vmo, size_t vmo_off) {
     vnboot_t* vnb = &vnb_root;
     mx_status_t r;
     if ((path[0] == '/') || (path[0] == 0))
@@ -170,7 +206,7 @@ mx_status_t bootfs_add_file(const char* path, void* data, size_t len) {
         if (nextpath == NULL) {
             if (path[0] == 0)
                 return ERR_INVALID_ARGS;
-            return _vnb_create(vnb, &vnb, path, strlen(path), data, len);
+            return _vnb_create(vnb, &vnb, path, strlen(path), data, len, vmo, vmo_off);
         } else {
             if (nextpath == path)
                 return ERR_INVALID_ARGS;
@@ -61,6 +61,7 @@ static vnode_ops_t vn_device_ops = {
     .lookup = memfs_lookup,
     .getattr = vnd_getattr,
     .readdir = memfs_readdir,
+    .readdir_attr = memfs_readdir_attr,
     .create = vnd_create,
     .ioctl = memfs_ioctl,
     .unlink = vnd_unlink,
@@ -6,7 +6,10 @@
 
 #include <ddk/device.h>
 
+#include <magenta/syscalls.h>
+
 #include <mxio/debug.h>
+#include <mxio/io.h>
 #include <mxio/vfs.h>
 
 #include <fcntl.h>
@@ -19,14 +22,16 @@
 
 #define MXDEBUG 0
 
-#define MAXBLOCKS 64
-#define BLOCKSIZE 8192
-
 typedef struct mnode mnode_t;
 struct mnode {
     vnode_t vn;
     size_t datalen;
-    uint8_t* block[MAXBLOCKS];
+    mx_time_t modify_time;
+
+    // a file's contents, created when first needed, and grown
+    // ahead of datalen so that appends rarely resize it
+    mx_handle_t vmo;
+    size_t vmo_size;
 };
 
 mx_status_t mem_get_node(vnode_t** out, mx_device_t* dev);
@@ -35,10 +40,8 @@ static void mem_release(vnode_t* vn) {
     printf("memfs: vn %p destroyed\n", vn);
 
     mnode_t* mem = vn->pdata;
-    for (int i = 0; i < MAXBLOCKS; i++) {
-        if (mem->block[i]) {
-            free(mem->block[i]);
-        }
+    if (mem->vmo > 0) {
+        mx_handle_close(mem->vmo);
     }
     free(mem);
 }
@@ -57,68 +60,83 @@ mx_status_t memfs_close(vnode_t* vn) {
     return NO_ERROR;
 }
 
-static ssize_t mem_read(vnode_t* vn, void* _data, size_t len, size_t off) {
+// make sure the vmo exists and holds at least size bytes
+static mx_status_t mem_reserve(mnode_t* mem, size_t size) {
+    if (mem->vmo <= 0) {
+        mx_handle_t vmo;
+        if ((vmo = mx_vm_object_create(size)) < 0) {
+            return vmo;
+        }
+        mem->vmo = vmo;
+        mem->vmo_size = size;
+    } else if (size > mem->vmo_size) {
+        // pages are only committed when written, so this costs no memory
+        size_t grow = mem->vmo_size * 2;
+        if (grow < size) {
+            grow = size;
+        }
+        mx_status_t r;
+        if ((r = mx_vm_object_set_size(mem->vmo, grow)) < 0) {
+            return r;
+        }
+        mem->vmo_size = grow;
+    }
+    return NO_ERROR;
+}
+
+static ssize_t mem_read(vnode_t* vn, void* data, size_t len, size_t off) {
     mnode_t* mem = vn->pdata;
-    uint8_t* data = _data;
-    ssize_t count = 0;
     if (off >= mem->datalen)
         return 0;
     if (len > (mem->datalen - off))
         len = mem->datalen - off;
+    return mx_vm_object_read(mem->vmo, data, off, len);
+}
 
-    size_t bno = off / BLOCKSIZE;
-    off = off % BLOCKSIZE;
-    while (len > 0) {
-        size_t xfer = (BLOCKSIZE - off);
-        if (len < xfer)
-            xfer = len;
-        if (mem->block[bno] == NULL) {
-            xprintf("mem_read: hole at %zu\n", bno);
-            memset(data, 0, xfer);
-        } else {
-            memcpy(data, mem->block[bno] + off, xfer);
-        }
-        data += xfer;
-        len -= xfer;
-        count += xfer;
-        bno++;
-        off = 0;
+static ssize_t mem_write(vnode_t* vn, const void* data, size_t len, size_t off) {
+    mnode_t* mem = vn->pdata;
+    if (len == 0)
+        return 0;
+    if ((off + len) < off)
+        return ERR_INVALID_ARGS;
+
+    mx_status_t r;
+    if ((r = mem_reserve(mem, off + len)) < 0) {
+        return r;
+    }
+    ssize_t count = mx_vm_object_write(mem->vmo, data, off, len);
+    if (count > 0) {
+        if ((off + count) > mem->datalen)
+            mem->datalen = off + count;
+        mem->modify_time = mx_current_time();
     }
     return count;
 }
 
-static ssize_t mem_write(vnode_t* vn, const void* _data, size_t len, size_t off) {
+static ssize_t mem_ioctl(vnode_t* vn, uint32_t op, const void* in_data, size_t in_len,
+                         void* out_data, size_t out_len) {
     mnode_t* mem = vn->pdata;
-    const uint8_t* data = _data;
-    ssize_t count = 0;
-    size_t bno = off / BLOCKSIZE;
-    off = off % BLOCKSIZE;
-    while (len > 0) {
-        size_t xfer = (BLOCKSIZE - off);
-        if (len < xfer)
-            xfer = len;
-        if (bno >= MAXBLOCKS) {
-            return count ? count : ERR_NO_MEMORY;
+    switch (op) {
+    case IOCTL_FILE_GET_VMO: {
+        if (out_len < sizeof(mx_handle_t)) {
+            return ERR_INVALID_ARGS;
         }
-        if (mem->block[bno] == NULL) {
-            xprintf("mem_write: alloc at %zu\n", bno);
-            if ((mem->block[bno] = calloc(1, BLOCKSIZE)) == NULL) {
-                return count ? count : ERR_NO_MEMORY;
-            }
+        mx_status_t r;
+        if ((r = mem_reserve(mem, mem->datalen)) < 0) {
+            return r;
         }
-        memcpy(mem->block[bno] + off, data, xfer);
-
-        size_t pos = bno * BLOCKSIZE + off + xfer;
-        if (pos > mem->datalen)
-            mem->datalen = pos;
-
-        data += xfer;
-        len -= xfer;
-        count += xfer;
-        bno++;
-        off = 0;
+        // the file's own pages, so a mapping sees later writes
+        mx_handle_t vmo = mx_handle_duplicate(mem->vmo, MX_RIGHT_READ | MX_RIGHT_EXECUTE |
+                                              MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER);
+        if (vmo < 0) {
+            return vmo;
+        }
+        memcpy(out_data, &vmo, sizeof(mx_handle_t));
+        return sizeof(mx_handle_t);
+    }
+    default:
+        return ERR_NOT_SUPPORTED;
     }
-    return count;
 }
 
 ssize_t memfs_read_none(vnode_t* vn, void* data, size_t len, size_t off) {
@@ -150,6 +168,7 @@ static mx_status_t mem_getattr(vnode_t* vn, vnattr_t* attr) {
     } else {
         attr->mode = V_TYPE_DIR | V_IRUSR;
     }
+    attr->modify_time = mem->modify_time;
     return NO_ERROR;
 }
 
@@ -161,6 +180,13 @@ mx_status_t memfs_readdir(vnode_t* parent, void* cookie, void* data, size_t len)
     return dn_readdir(parent->dnode, cookie, data, len);
 }
 
+mx_status_t memfs_readdir_attr(vnode_t* parent, void* cookie, void* data, size_t len) {
+    if (parent->dnode == NULL) {
+        return ERR_NOT_FOUND;
+    }
+    return dn_readdir_attr(parent->dnode, cookie, data, len);
+}
+
 static mx_status_t _mem_create(mnode_t* parent, mnode_t** out,
                                const char* name, size_t namelen,
                                bool isdir);
@@ -209,7 +235,9 @@ static vnode_ops_t vn_mem_ops = {
     .lookup = memfs_lookup,
     .getattr = mem_getattr,
     .readdir = memfs_readdir,
+    .readdir_attr = memfs_readdir_attr,
     .create = mem_create,
+    .ioctl = mem_ioctl,
     .unlink = memfs_unlink,
 };
 
@@ -222,7 +250,9 @@ static vnode_ops_t vn_mem_ops_dir = {
     .lookup = memfs_lookup,
     .getattr = mem_getattr,
     .readdir = memfs_readdir,
+    .readdir_attr = memfs_readdir_attr,
     .create = mem_create,
+    .ioctl = memfs_ioctl,
     .unlink = memfs_unlink,
 };
 
@@ -259,6 +289,7 @@ static mx_status_t _mem_create(mnode_t* parent, mnode_t** out,
 
     mem->vn.ops = &vn_mem_ops;
     mem->vn.pdata = mem;
+    mem->modify_time = mx_current_time();
     list_initialize(&mem->vn.dn_list);
 
     mx_status_t r;
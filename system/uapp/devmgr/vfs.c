@@ -170,6 +170,24 @@ mx_status_t vfs_fill_dirent(vdirent_t* de, size_t delen,
     return sz;
 }
 
+mx_status_t vfs_fill_dirent_attr(vdirent_attr_t* de, size_t delen,
+                                 const char* name, size_t len, uint32_t type,
+                                 const vnattr_t* attr) {
+    size_t sz = sizeof(vdirent_attr_t) + len + 1;
+
+    // round up to uint64 aligned, for attr
+    if (sz & 7)
+        sz = (sz + 7) & (~7);
+    if (sz > delen)
+        return ERR_TOO_BIG;
+    de->size = sz;
+    de->type = type;
+    de->attr = *attr;
+    memcpy(de->name, name, len);
+    de->name[len] = 0;
+    return sz;
+}
+
 static mx_status_t vfs_get_handles(vnode_t* vn, bool as_dir, mx_handle_t* hnds, uint32_t* ids, const char* trackfn) {
     mx_status_t r;
     if (vn->flags & V_FLAG_DEVICE && !as_dir) {
@@ -308,6 +326,27 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         }
         return r;
     }
+    case MXRIO_READ_AT: {
+        if (msg->arg2.off < 0) {
+            return ERR_INVALID_ARGS;
+        }
+        ssize_t r = vn->ops->read(vn, msg->data, arg, msg->arg2.off);
+        if (r >= 0) {
+            msg->arg2.off += r;
+            msg->datalen = r;
+        }
+        return r;
+    }
+    case MXRIO_WRITE_AT: {
+        if (msg->arg2.off < 0) {
+            return ERR_INVALID_ARGS;
+        }
+        ssize_t r = vn->ops->write(vn, msg->data, len, msg->arg2.off);
+        if (r >= 0) {
+            msg->arg2.off += r;
+        }
+        return r;
+    }
     case MXRIO_SEEK: {
         vnattr_t attr;
         mx_status_t r;
@@ -388,6 +427,22 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
         }
         return r;
     }
+    case MXRIO_READDIR_ATTR: {
+        if (arg > MXIO_CHUNK_SIZE) {
+            return ERR_INVALID_ARGS;
+        }
+        if (vn->ops->readdir_attr == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        mx_status_t r;
+        mxr_mutex_lock(&vfs_lock);
+        r = vn->ops->readdir_attr(vn, &ios->dircookie, msg->data, arg);
+        mxr_mutex_unlock(&vfs_lock);
+        if (r >= 0) {
+            msg->datalen = r;
+        }
+        return r;
+    }
     case MXRIO_IOCTL: {
         if (len > MXIO_IOCTL_MAX_INPUT) {
             return ERR_INVALID_ARGS;
@@ -397,6 +452,10 @@ static mx_status_t _vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie)
 
         ssize_t r = vn->ops->ioctl(vn, msg->arg2.op, in_buf, len, msg->data, arg);
         if (r >= 0) {
+            if (msg->arg2.op == IOCTL_FILE_GET_VMO) {
+                msg->hcount = 1;
+                memcpy(msg->handle, msg->data, sizeof(mx_handle_t));
+            }
             msg->arg2.off = 0;
             msg->datalen = r;
         }
@@ -24,7 +24,9 @@ mx_status_t devfs_remove(vnode_t* vn);
 
 // boot fs
 vnode_t* bootfs_get_root(void);
-mx_status_t bootfs_add_file(const char* path, void* data, size_t len);
+// data is the file's contents in the mapped image vmo, at vmo_off
+mx_status_t bootfs_add_file(const char* path, void* data, size_t len,
+                            mx_handle_t vmo, size_t vmo_off);
 
 // memory fs
 vnode_t* memfs_get_root(void);
@@ -38,6 +40,7 @@ mx_status_t memfs_open(vnode_t** _vn, uint32_t flags);
 mx_status_t memfs_close(vnode_t* vn);
 mx_status_t memfs_lookup(vnode_t* parent, vnode_t** out, const char* name, size_t len);
 mx_status_t memfs_readdir(vnode_t* parent, void* cookie, void* data, size_t len);
+mx_status_t memfs_readdir_attr(vnode_t* parent, void* cookie, void* data, size_t len);
 ssize_t memfs_read_none(vnode_t* vn, void* data, size_t len, size_t off);
 ssize_t memfs_write_none(vnode_t* vn, const void* data, size_t len, size_t off);
 mx_status_t memfs_unlink(vnode_t* vn, const char* name, size_t len);
@@ -19,10 +19,16 @@ int main(int argc, char** argv) {
         printf("dlog: cannot open log\n");
     }
 
-    char buf[MX_LOG_RECORD_MAX];
-    mx_log_record_t* rec = (mx_log_record_t*)buf;
+    // records are read as many at a time as fit
+    uint64_t buf[4096 / sizeof(uint64_t)];
     for (;;) {
-        if (mx_log_read(h, MX_LOG_RECORD_MAX, rec, tail ? MX_LOG_FLAG_WAIT : 0) > 0) {
+        int count = mx_log_read(h, sizeof(buf), buf,
+                                MX_LOG_FLAG_MANY | (tail ? MX_LOG_FLAG_WAIT : 0));
+        if (count <= 0) {
+            break;
+        }
+        mx_log_record_t* rec = (mx_log_record_t*)buf;
+        while (count-- > 0) {
             char tmp[64];
             snprintf(tmp, 64, "[%05d.%03d] %c ",
                      (int)(rec->timestamp / 1000000000ULL),
@@ -33,8 +39,7 @@ int main(int argc, char** argv) {
             if ((rec->datalen == 0) || (rec->data[rec->datalen - 1] != '\n')) {
                 write(1, "\n", 1);
             }
-        } else {
-            break;
+            rec = (mx_log_record_t*)((char*)rec + MX_LOG_RECORD_SIZE(rec));
         }
     }
     return 0;
@@ -0,0 +1,85 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/syscalls.h>
+#include <mxio/util.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// read() from 1 to 2 * ncpus threads at once, each on an fd of its own
+// bound to a null mxio, so that the time is all in looking the fd up.
+// Reads per second should grow with the threads up to the cpus.
+
+#define MAX_THREADS 64
+#define READS 1000000
+
+static pthread_barrier_t barrier;
+
+static void fail(const char* what, int status) {
+    printf("fd-bench: %s failed (%d)\n", what, status);
+    exit(1);
+}
+
+static void* reader(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    char c;
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < READS; i++) {
+        read(fd, &c, 1);
+    }
+    return NULL;
+}
+
+static void bench_read(int threads) {
+    pthread_t t[MAX_THREADS];
+    int fds[MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        mxio_t* io = mxio_null_create();
+        if (io == NULL) {
+            fail("null create", ERR_NO_MEMORY);
+        }
+        if ((fds[i] = mxio_bind_to_fd(io, -1, 0)) < 0) {
+            fail("bind", fds[i]);
+        }
+    }
+
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&t[i], NULL, reader, (void*)(intptr_t)fds[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    mx_time_t start = mx_current_time();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(t[i], NULL);
+    }
+    mx_time_t elapsed = mx_current_time() - start;
+    pthread_barrier_destroy(&barrier);
+
+    for (int i = 0; i < threads; i++) {
+        close(fds[i]);
+    }
+
+    uint64_t reads = (uint64_t)threads * READS;
+    if (elapsed == 0) {
+        elapsed = 1;
+    }
+    printf("%3d threads %10llu reads %6llu ns/read/thread %10llu reads/s\n", threads,
+           (unsigned long long)reads,
+           (unsigned long long)(elapsed / READS),
+           (unsigned long long)(reads * 1000000000ULL / elapsed));
+}
+
+int main(int argc, char** argv) {
+    int max = 2 * mx_num_cpus();
+    if (max > MAX_THREADS) {
+        max = MAX_THREADS;
+    }
+    for (int threads = 1; threads <= max; threads *= 2) {
+        bench_read(threads);
+    }
+    return 0;
+}
@@ -0,0 +1,425 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+
+// File I/O through mxio, against a directory of any filesystem or a single
+// file or block device. Every phase runs on all the threads at once, each
+// on files (or a slice of the device) of its own, and times every operation.
+
+#define MAX_THREADS 32
+#define MAX_NAMES 4096
+
+typedef struct {
+    const char* path;
+    bool is_dir;
+    bool read_only;
+    int threads;
+    size_t io_size;
+    uint64_t file_size;
+    int count;
+} config_t;
+
+static config_t cfg = {
+    .threads = 1,
+    .io_size = 8192,
+    .file_size = 4 * 1024 * 1024,
+    .count = 256,
+};
+
+// what's already in a read only directory, for the read and stat phases
+static char* names[MAX_NAMES];
+static int name_count;
+
+typedef struct {
+    int id;
+    int fd;
+    uint8_t* buf;
+    // latencies in ns of this thread's operations in the current phase
+    mx_time_t* lat;
+    int lat_count;
+    int lat_max;
+    uint64_t bytes;
+    int errors;
+    unsigned seed;
+} worker_t;
+
+typedef bool (*phase_fn)(worker_t* w);
+
+static worker_t workers[MAX_THREADS];
+static pthread_barrier_t barrier;
+static phase_fn current_phase;
+
+static void record(worker_t* w, mx_time_t start, ssize_t bytes) {
+    if (bytes < 0) {
+        w->errors++;
+        return;
+    }
+    if (w->lat_count == w->lat_max) {
+        int max = w->lat_max ? w->lat_max * 2 : 1024;
+        mx_time_t* lat = realloc(w->lat, max * sizeof(mx_time_t));
+        if (lat == NULL) {
+            return;
+        }
+        w->lat = lat;
+        w->lat_max = max;
+    }
+    w->lat[w->lat_count++] = mx_current_time() - start;
+    w->bytes += bytes;
+}
+
+static void file_name(char* out, size_t len, int thread, int n) {
+    snprintf(out, len, "%s/fsbench.%d.%d", cfg.path, thread, n);
+}
+
+static void data_name(char* out, size_t len, int thread) {
+    snprintf(out, len, "%s/fsbench.%d.data", cfg.path, thread);
+}
+
+// the file or the part of the device a thread does its data phases on
+static uint64_t data_base(worker_t* w) {
+    return cfg.is_dir ? 0 : w->id * cfg.file_size;
+}
+
+static bool open_data(worker_t* w, int flags) {
+    char name[PATH_MAX];
+    if (cfg.is_dir) {
+        if (cfg.read_only) {
+            if (name_count == 0) {
+                return false;
+            }
+            snprintf(name, sizeof(name), "%s/%s", cfg.path, names[w->id % name_count]);
+        } else {
+            data_name(name, sizeof(name), w->id);
+        }
+    } else {
+        snprintf(name, sizeof(name), "%s", cfg.path);
+    }
+    w->fd = open(name, flags, 0644);
+    return w->fd >= 0;
+}
+
+static void close_data(worker_t* w) {
+    close(w->fd);
+    w->fd = -1;
+}
+
+static bool phase_write_seq(worker_t* w) {
+    if (!open_data(w, O_RDWR | (cfg.is_dir ? O_CREAT : 0))) {
+        return false;
+    }
+    uint64_t base = data_base(w);
+    for (uint64_t off = 0; off + cfg.io_size <= cfg.file_size; off += cfg.io_size) {
+        mx_time_t t = mx_current_time();
+        record(w, t, pwrite(w->fd, w->buf, cfg.io_size, base + off));
+    }
+    close_data(w);
+    return true;
+}
+
+static bool phase_read_seq(worker_t* w) {
+    if (!open_data(w, O_RDONLY)) {
+        return false;
+    }
+    uint64_t base = data_base(w);
+    for (uint64_t off = 0; off + cfg.io_size <= cfg.file_size; off += cfg.io_size) {
+        mx_time_t t = mx_current_time();
+        ssize_t r = pread(w->fd, w->buf, cfg.io_size, base + off);
+        record(w, t, r);
+        if (r < (ssize_t)cfg.io_size) {
+            // a read only file may be shorter than file_size
+            break;
+        }
+    }
+    close_data(w);
+    return true;
+}
+
+static uint64_t random_offset(worker_t* w) {
+    uint64_t blocks = cfg.file_size / cfg.io_size;
+    uint64_t r = ((uint64_t)rand_r(&w->seed) << 31) | rand_r(&w->seed);
+    return data_base(w) + (r % blocks) * cfg.io_size;
+}
+
+static bool phase_write_rand(worker_t* w) {
+    if (!open_data(w, O_RDWR)) {
+        return false;
+    }
+    for (int i = 0; i < cfg.count; i++) {
+        uint64_t off = random_offset(w);
+        mx_time_t t = mx_current_time();
+        record(w, t, pwrite(w->fd, w->buf, cfg.io_size, off));
+    }
+    close_data(w);
+    return true;
+}
+
+static bool phase_read_rand(worker_t* w) {
+    if (!open_data(w, O_RDONLY)) {
+        return false;
+    }
+    for (int i = 0; i < cfg.count; i++) {
+        uint64_t off = random_offset(w);
+        mx_time_t t = mx_current_time();
+        record(w, t, pread(w->fd, w->buf, cfg.io_size, off));
+    }
+    close_data(w);
+    return true;
+}
+
+static bool phase_create(worker_t* w) {
+    char name[PATH_MAX];
+    for (int i = 0; i < cfg.count; i++) {
+        file_name(name, sizeof(name), w->id, i);
+        mx_time_t t = mx_current_time();
+        int fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) {
+            close(fd);
+        }
+        record(w, t, fd < 0 ? -1 : 0);
+    }
+    return true;
+}
+
+static bool phase_stat(worker_t* w) {
+    char name[PATH_MAX];
+    int n = cfg.read_only ? name_count : cfg.count;
+    for (int i = 0; i < n; i++) {
+        if (cfg.read_only) {
+            snprintf(name, sizeof(name), "%s/%s", cfg.path, names[i]);
+        } else {
+            file_name(name, sizeof(name), w->id, i);
+        }
+        struct stat s;
+        mx_time_t t = mx_current_time();
+        record(w, t, stat(name, &s));
+    }
+    return true;
+}
+
+// one op is a pass over the whole directory
+static bool phase_readdir(worker_t* w) {
+    for (int i = 0; i < 16; i++) {
+        mx_time_t t = mx_current_time();
+        DIR* dir = opendir(cfg.path);
+        if (dir == NULL) {
+            record(w, t, -1);
+            continue;
+        }
+        while (readdir(dir) != NULL) {
+        }
+        closedir(dir);
+        record(w, t, 0);
+    }
+    return true;
+}
+
+static bool phase_unlink(worker_t* w) {
+    char name[PATH_MAX];
+    for (int i = 0; i < cfg.count; i++) {
+        file_name(name, sizeof(name), w->id, i);
+        mx_time_t t = mx_current_time();
+        record(w, t, unlink(name));
+    }
+    return true;
+}
+
+static void* worker_main(void* arg) {
+    worker_t* w = arg;
+    for (;;) {
+        pthread_barrier_wait(&barrier);
+        if (current_phase == NULL) {
+            break;
+        }
+        if (!current_phase(w)) {
+            w->errors++;
+        }
+        pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+static int cmp_time(const void* a, const void* b) {
+    mx_time_t x = *(const mx_time_t*)a;
+    mx_time_t y = *(const mx_time_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void run_phase(const char* name, phase_fn fn) {
+    for (int i = 0; i < cfg.threads; i++) {
+        workers[i].lat_count = 0;
+        workers[i].bytes = 0;
+        workers[i].errors = 0;
+    }
+
+    current_phase = fn;
+    mx_time_t t = mx_current_time();
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    t = mx_current_time() - t;
+
+    int ops = 0;
+    int errors = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < cfg.threads; i++) {
+        ops += workers[i].lat_count;
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+    }
+    mx_time_t* all = malloc((ops ? ops : 1) * sizeof(mx_time_t));
+    if (all == NULL) {
+        printf("fsbench: out of memory\n");
+        return;
+    }
+    int n = 0;
+    for (int i = 0; i < cfg.threads; i++) {
+        memcpy(all + n, workers[i].lat, workers[i].lat_count * sizeof(mx_time_t));
+        n += workers[i].lat_count;
+    }
+    qsort(all, ops, sizeof(mx_time_t), cmp_time);
+
+    if (t == 0) {
+        t = 1;
+    }
+#define PCT(p) (unsigned long long)(ops ? all[(ops - 1) * (p) / 100] / 1000 : 0)
+    printf("%-10s %7d %10llu %8llu %7llu %7llu %7llu %7llu %6d\n", name, ops,
+           (unsigned long long)ops * 1000000000ULL / t,
+           (unsigned long long)(bytes * 1000000000ULL / t / (1024 * 1024)),
+           PCT(50), PCT(90), PCT(99), PCT(100), errors);
+#undef PCT
+    free(all);
+}
+
+static void list_names(void) {
+    DIR* dir = opendir(cfg.path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL && name_count < MAX_NAMES) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        names[name_count++] = strdup(de->d_name);
+    }
+    closedir(dir);
+}
+
+static int usage(void) {
+    fprintf(stderr,
+            "usage: fsbench [options] <path>\n"
+            "  <path> is a directory to work in, or a file or block device\n"
+            "  -t <n>     threads (default 1, at most %d)\n"
+            "  -s <size>  bytes per read or write (default 8192)\n"
+            "  -f <size>  bytes of file, or of device, per thread (default 4M)\n"
+            "  -n <n>     random ops and files created per thread (default 256)\n"
+            "  -r         read only, for bootfs or a device with data to keep\n",
+            MAX_THREADS);
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    for (int opt; (opt = getopt(argc, argv, "t:s:f:n:r")) != -1;) {
+        switch (opt) {
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 's':
+            cfg.io_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            cfg.file_size = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            cfg.count = atoi(optarg);
+            break;
+        case 'r':
+            cfg.read_only = true;
+            break;
+        default:
+            return usage();
+        }
+    }
+    if ((optind != argc - 1) || (cfg.threads < 1) || (cfg.threads > MAX_THREADS) ||
+        (cfg.io_size == 0) || (cfg.file_size < cfg.io_size) || (cfg.count < 1)) {
+        return usage();
+    }
+    cfg.path = argv[optind];
+
+    struct stat s;
+    if (stat(cfg.path, &s) < 0) {
+        fprintf(stderr, "fsbench: cannot stat '%s'\n", cfg.path);
+        return -1;
+    }
+    cfg.is_dir = S_ISDIR(s.st_mode);
+    if (cfg.is_dir && cfg.read_only) {
+        list_names();
+    }
+
+    pthread_barrier_init(&barrier, NULL, cfg.threads + 1);
+    pthread_t threads[MAX_THREADS];
+    for (int i = 0; i < cfg.threads; i++) {
+        workers[i].id = i;
+        workers[i].fd = -1;
+        workers[i].seed = i + 1;
+        workers[i].buf = malloc(cfg.io_size);
+        if (workers[i].buf == NULL) {
+            fprintf(stderr, "fsbench: out of memory\n");
+            return -1;
+        }
+        memset(workers[i].buf, 0x5a + i, cfg.io_size);
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+
+    printf("%s: %d threads, %zu byte ios, %llu bytes per thread\n", cfg.path, cfg.threads,
+           cfg.io_size, (unsigned long long)cfg.file_size);
+    printf("%-10s %7s %10s %8s %7s %7s %7s %7s %6s\n", "phase", "ops", "ops/s", "MB/s",
+           "p50 us", "p90 us", "p99 us", "max us", "errors");
+    if (!cfg.read_only) {
+        run_phase("write-seq", phase_write_seq);
+    }
+    run_phase("read-seq", phase_read_seq);
+    if (!cfg.read_only || !cfg.is_dir) {
+        if (!cfg.read_only) {
+            run_phase("write-rand", phase_write_rand);
+        }
+        run_phase("read-rand", phase_read_rand);
+    }
+    if (cfg.is_dir) {
+        if (!cfg.read_only) {
+            run_phase("create", phase_create);
+        }
+        run_phase("readdir", phase_readdir);
+        run_phase("stat", phase_stat);
+        if (!cfg.read_only) {
+            run_phase("unlink", phase_unlink);
+            for (int i = 0; i < cfg.threads; i++) {
+                char name[PATH_MAX];
+                data_name(name, sizeof(name), i);
+                unlink(name);
+            }
+        }
+    }
+
+    current_phase = NULL;
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < cfg.threads; i++) {
+        pthread_join(threads[i], NULL);
+        free(workers[i].buf);
+        free(workers[i].lat);
+    }
+    return 0;
+}
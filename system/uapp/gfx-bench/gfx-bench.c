@@ -0,0 +1,70 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gfx/gfx.h>
+#include <magenta/syscalls.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// a 4K screen's worth of pixels
+#define WIDTH 3840
+#define HEIGHT 2160
+
+#define ITERATIONS 20
+
+static void report(const char* what, gfx_surface* surface, mx_time_t t) {
+    uint64_t bytes = (uint64_t)WIDTH * HEIGHT * surface->pixelsize * ITERATIONS;
+    printf("%-10s %2ubpp %8llu us/frame %6llu MB/s\n", what, surface->pixelsize * 8,
+           (unsigned long long)(t / 1000 / ITERATIONS),
+           (unsigned long long)((bytes * 1000) / (t ? t : 1)));
+}
+
+static void bench(gfx_format format) {
+    gfx_surface* surface = gfx_create_surface(NULL, WIDTH, HEIGHT, WIDTH, format, 0);
+    gfx_surface* other = gfx_create_surface(NULL, WIDTH, HEIGHT, WIDTH, format, 0);
+    if ((surface == NULL) || (other == NULL)) {
+        printf("gfx-bench: cannot create surfaces\n");
+        exit(1);
+    }
+    gfx_fillrect(other, 0, 0, WIDTH, HEIGHT, 0x80406080);
+
+    mx_time_t t = mx_current_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        gfx_fillrect(surface, 0, 0, WIDTH, HEIGHT, 0xff000000 | i);
+    }
+    report("fill", surface, mx_current_time() - t);
+
+    // as the console scrolls, a line of text at a time
+    t = mx_current_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        gfx_copyrect(surface, 0, 16, WIDTH, HEIGHT - 16, 0, 0);
+    }
+    report("scroll", surface, mx_current_time() - t);
+
+    t = mx_current_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        gfx_surface_blend(surface, other, 0, 0);
+    }
+    report("blend", surface, mx_current_time() - t);
+
+    t = mx_current_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (unsigned y = 0; y + font9x16.height <= HEIGHT; y += font9x16.height) {
+            for (unsigned x = 0; x + font9x16.width <= WIDTH; x += font9x16.width) {
+                gfx_putchar(surface, &font9x16, 'A' + (x + y) % 26, x, y, 0xffffffff, 0xff000000);
+            }
+        }
+    }
+    report("text", surface, mx_current_time() - t);
+
+    gfx_surface_destroy(other);
+    gfx_surface_destroy(surface);
+}
+
+int main(int argc, char** argv) {
+    bench(GFX_FORMAT_ARGB_8888);
+    bench(GFX_FORMAT_RGB_565);
+    bench(GFX_FORMAT_MONO);
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+#include <magenta/syscalls-ddk.h>
+
+static const char* tag_name(uint32_t tag) {
+    switch (tag) {
+    case MX_KTRACE_TAG_SYSCALL_ENTER: return "syscall-enter";
+    case MX_KTRACE_TAG_SYSCALL_EXIT: return "syscall-exit";
+    case MX_KTRACE_TAG_CONTEXT_SWITCH: return "context-switch";
+    case MX_KTRACE_TAG_PAGE_FAULT: return "page-fault";
+    case MX_KTRACE_TAG_IRQ_ENTER: return "irq-enter";
+    case MX_KTRACE_TAG_IRQ_EXIT: return "irq-exit";
+    case MX_KTRACE_TAG_MSG_SEND: return "msg-send";
+    case MX_KTRACE_TAG_MSG_RECV: return "msg-recv";
+    default: return "?";
+    }
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: ktrace start <grpmask>   trace the groups in grpmask\n"
+                    "       ktrace stop\n"
+                    "       ktrace rewind             empty the trace, once stopped\n"
+                    "       ktrace save <file>        write the whole trace vmo to file\n"
+                    "       ktrace dump               print the records, once stopped\n");
+    return -1;
+}
+
+static mx_handle_t get_vmo(mx_ktrace_header_t* hdr) {
+    mx_handle_t vmo;
+    mx_status_t status = mx_ktrace_control(MX_KTRACE_ACTION_GET_VMO, 0, &vmo);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "ktrace: cannot get the trace vmo: %d\n", status);
+        return status;
+    }
+    if (mx_vm_object_read(vmo, hdr, 0, sizeof(*hdr)) != (mx_ssize_t)sizeof(*hdr) ||
+        hdr->magic != MX_KTRACE_MAGIC || hdr->version != MX_KTRACE_VERSION) {
+        fprintf(stderr, "ktrace: bad trace header\n");
+        mx_handle_close(vmo);
+        return ERR_BAD_STATE;
+    }
+    return vmo;
+}
+
+static int save(const char* path) {
+    mx_ktrace_header_t hdr;
+    mx_handle_t vmo = get_vmo(&hdr);
+    if (vmo < 0)
+        return -1;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        fprintf(stderr, "ktrace: cannot open '%s'\n", path);
+        mx_handle_close(vmo);
+        return -1;
+    }
+
+    uint64_t size;
+    mx_vm_object_get_size(vmo, &size);
+
+    static char buf[64 * 1024];
+    int ret = 0;
+    for (uint64_t off = 0; off < size;) {
+        mx_ssize_t n = mx_vm_object_read(vmo, buf, off, sizeof(buf));
+        if (n <= 0 || write(fd, buf, n) != n) {
+            fprintf(stderr, "ktrace: error writing '%s'\n", path);
+            ret = -1;
+            break;
+        }
+        off += n;
+    }
+    close(fd);
+    mx_handle_close(vmo);
+    return ret;
+}
+
+static int dump(void) {
+    mx_ktrace_header_t hdr;
+    mx_handle_t vmo = get_vmo(&hdr);
+    if (vmo < 0)
+        return -1;
+
+    uint64_t ring_size = hdr.records_per_cpu * hdr.record_size;
+    for (uint32_t cpu = 0; cpu < hdr.num_cpus; cpu++) {
+        // only the last records_per_cpu records survive a wrap
+        uint64_t n = hdr.written[cpu];
+        uint64_t first = (n > hdr.records_per_cpu) ? n - hdr.records_per_cpu : 0;
+        for (uint64_t i = first; i < n; i++) {
+            uint64_t off = MX_KTRACE_HEADER_SIZE + cpu * ring_size +
+                           (i & (hdr.records_per_cpu - 1)) * hdr.record_size;
+            mx_ktrace_record_t rec;
+            if (mx_vm_object_read(vmo, &rec, off, sizeof(rec)) != (mx_ssize_t)sizeof(rec))
+                break;
+            printf("%2u %16" PRIu64 " %016" PRIx64 " %-15s %#10x %#" PRIx64 "\n",
+                   cpu, rec.ts, rec.thread, tag_name(rec.tag), rec.a, rec.b);
+        }
+    }
+    mx_handle_close(vmo);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2)
+        return usage();
+
+    mx_status_t status;
+    if (!strcmp(argv[1], "start") && argc == 3) {
+        status = mx_ktrace_control(MX_KTRACE_ACTION_START, strtoul(argv[2], NULL, 0), NULL);
+    } else if (!strcmp(argv[1], "stop")) {
+        status = mx_ktrace_control(MX_KTRACE_ACTION_STOP, 0, NULL);
+    } else if (!strcmp(argv[1], "rewind")) {
+        status = mx_ktrace_control(MX_KTRACE_ACTION_REWIND, 0, NULL);
+    } else if (!strcmp(argv[1], "save") && argc == 3) {
+        return save(argv[2]);
+    } else if (!strcmp(argv[1], "dump")) {
+        return dump();
+    } else {
+        return usage();
+    }
+
+    if (status != NO_ERROR) {
+        fprintf(stderr, "ktrace: %s failed: %d\n", argv[1], status);
+        return -1;
+    }
+    return 0;
+}
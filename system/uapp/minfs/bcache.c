@@ -2,10 +2,16 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 
@@ -20,29 +26,25 @@
 
 #define BLOCK_FLAGS 0xF
 
-static int readblk(int fd, uint32_t bno, void* data) {
-    off_t off = bno * MINFS_BLOCK_SIZE;
-    trace(IO, "readblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
-        return -1;
-    }
-    if (read(fd, data, MINFS_BLOCK_SIZE) != MINFS_BLOCK_SIZE) {
-        error("minfs: cannot read block %u\n", bno);
+// Runs of blocks move in a single positional request, which
+// the remoteio client sends as bulk transfers once large enough.
+static int readblk(int fd, uint32_t bno, uint32_t count, void* data) {
+    off_t off = (off_t)bno * MINFS_BLOCK_SIZE;
+    size_t len = (size_t)count * MINFS_BLOCK_SIZE;
+    trace(IO, "readblk() bno=%u count=%u off=%#llx\n", bno, count, (unsigned long long)off);
+    if (pread(fd, data, len, off) != (ssize_t)len) {
+        error("minfs: cannot read blocks %u..%u\n", bno, bno + count - 1);
         return -1;
     }
     return 0;
 }
 
-static int writeblk(int fd, uint32_t bno, void* data) {
-    off_t off = bno * MINFS_BLOCK_SIZE;
-    trace(IO, "writeblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
-    if (lseek(fd, off, SEEK_SET) < 0) {
-        error("minfs: cannot seek to block %u\n", bno);
-        return -1;
-    }
-    if (write(fd, data, MINFS_BLOCK_SIZE) != MINFS_BLOCK_SIZE) {
-        error("minfs: cannot write block %u\n", bno);
+static int writeblk(int fd, uint32_t bno, uint32_t count, const void* data) {
+    off_t off = (off_t)bno * MINFS_BLOCK_SIZE;
+    size_t len = (size_t)count * MINFS_BLOCK_SIZE;
+    trace(IO, "writeblk() bno=%u count=%u off=%#llx\n", bno, count, (unsigned long long)off);
+    if (pwrite(fd, data, len, off) != (ssize_t)len) {
+        error("minfs: cannot write blocks %u..%u\n", bno, bno + count - 1);
         return -1;
     }
     return 0;
@@ -56,17 +58,70 @@ struct block {
     void* data;
 };
 
+// Dirty blocks are written back by a flusher thread rather than when
+// they are put. It writes them in block order, each run of consecutive
+// ones as a single request, once BCACHE_FLUSH_SECS have passed or half
+// the dirty limit is reached. bcache_put() waits for it when the limit
+// is exceeded, and bcache_sync() waits for everything to be written.
+//
+// Any number of filesystem threads may use the cache. Getting a block
+// that is busy waits for it to be put, and a miss keeps the block it
+// is filling busy while the lock is dropped for the read, so one slow
+// read holds up only the threads that want that block.
+// Blocks being written back stay cached, and are not reused until the
+// write is done, so the disk is never read behind a newer cached copy.
 struct bcache {
     list_node_t list_busy;  // between bcache_get() and bcache_put()
     list_node_t list_dirty; // waiting for write
+    list_node_t list_writeback; // being written, not busy or dirty again
     list_node_t list_lru;   // available for re-use
     list_node_t list_free;  // never been used
     list_node_t hash[MINFS_BUCKETS];
     int fd;
     uint32_t blocksize;
     uint32_t blockmax;
+    void* rabuf;            // BCACHE_READAHEAD blocks, or NULL
+    void* wbbuf;            // BCACHE_FLUSH_MAX blocks being written
+    uint32_t block_count;   // allocated
+    uint32_t block_target;  // what the cache shrinks back to
+    uint32_t block_max;     // and grows to at most
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead;
+    uint64_t evictions;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    // for the flusher, there is work to do
+    pthread_cond_t cleaned; // from the flusher, a flush finished
+    pthread_cond_t idle;    // a busy block was put, or failed to load
+    uint32_t dirty_count;   // blocks on list_dirty
+    uint32_t dirty_max;
+    uint32_t waiters;       // threads waiting for a flush to finish
+    bool flushing;
+    bool ra_busy;           // rabuf is in use by a load
+    uint32_t writing;       // disk writes in progress
+    uint32_t write_gen;     // disk writes started
+    mx_status_t wb_status;  // first write back error since the last sync
 };
 
+// A cache miss also reads the blocks after the one wanted, up to
+// BCACHE_READAHEAD in all and stopping at one already cached,
+// so that walking a file or table costs one request per run.
+#define BCACHE_READAHEAD 16
+
+// When every block is busy, rather than dirty or being written back,
+// the cache grows, to at most BCACHE_GROWTH times the size it was
+// created with. It shrinks back as blocks come free, and a get fails
+// only when it is at its largest or memory can't be had.
+#define BCACHE_GROWTH 8
+
+// Dirty data is limited to BCACHE_DIRTY_BYTES or half the cache,
+// whichever is less, and each flush writes at most BCACHE_FLUSH_MAX
+// blocks, which is one bulk transfer.
+#define BCACHE_DIRTY_BYTES (1024 * 1024)
+#define BCACHE_FLUSH_MAX 128
+#define BCACHE_FLUSH_SECS 1
+
 #define bno_hash(bno) fnv_1a_tiny(bno, MINFS_HASH_BITS)
 
 static_assert((1<<MINFS_HASH_BITS) == MINFS_BUCKETS,
@@ -90,6 +145,221 @@ static const char* modestr(uint32_t mode) {
 }
 
 #define BLOCK_BUSY 0x10
+#define BLOCK_WRITEBACK 0x20
+
+static block_t* bcache_lookup(bcache_t* bc, uint32_t bno) {
+    block_t* blk;
+    list_for_every_entry(bc->hash + bno_hash(bno), blk, block_t, hashnode) {
+        if (blk->bno == bno) {
+            return blk;
+        }
+    }
+    return NULL;
+}
+
+// Take a block not in use to hold bno, preferring ones never used.
+static block_t* bcache_reuse(bcache_t* bc, uint32_t bno) {
+    block_t* blk;
+    if ((blk = list_remove_head_type(&bc->list_free, block_t, listnode)) != NULL) {
+        // nothing extra to do
+    } else if ((blk = list_remove_head_type(&bc->list_lru, block_t, listnode)) != NULL) {
+        // remove from hash, bno to be reassigned
+        list_delete(&blk->hashnode);
+        bc->evictions++;
+    } else {
+        return NULL;
+    }
+    blk->bno = bno;
+    list_add_tail(bc->hash + bno_hash(bno), &blk->hashnode);
+    return blk;
+}
+
+// Disk writes that bypass the cached copies, or leave none behind, are
+// bracketed by these, so that reads made with the lock dropped can tell
+// whether what they read may already be out of date.
+static void bcache_write_begin(bcache_t* bc) {
+    bc->writing++;
+    bc->write_gen++;
+}
+
+static void bcache_write_end(bcache_t* bc) {
+    bc->writing--;
+    pthread_cond_broadcast(&bc->cleaned);
+}
+
+// Fill blk, which is busy, from disk, caching the blocks read ahead along
+// with it as the least recently used ones. The disk copy of anything not
+// cached is current. Called with the lock held, which is dropped while
+// reading. Read-ahead blocks are only kept if no write started meanwhile
+// and nobody else cached them first.
+static int bcache_load(bcache_t* bc, block_t* blk) {
+    uint32_t count = 1;
+    if ((bc->rabuf != NULL) && !bc->ra_busy && (bc->writing == 0)) {
+        while ((count < BCACHE_READAHEAD) && ((blk->bno + count) < bc->blockmax) &&
+               (bcache_lookup(bc, blk->bno + count) == NULL)) {
+            count++;
+        }
+    }
+    bc->misses++;
+    if (count == 1) {
+        pthread_mutex_unlock(&bc->lock);
+        int r = readblk(bc->fd, blk->bno, 1, blk->data);
+        pthread_mutex_lock(&bc->lock);
+        return r;
+    }
+    uint32_t gen = bc->write_gen;
+    bc->ra_busy = true;
+    pthread_mutex_unlock(&bc->lock);
+    int r = readblk(bc->fd, blk->bno, count, bc->rabuf);
+    if (r == 0) {
+        memcpy(blk->data, bc->rabuf, bc->blocksize);
+    }
+    pthread_mutex_lock(&bc->lock);
+    if ((r == 0) && (gen == bc->write_gen)) {
+        for (uint32_t n = 1; n < count; n++) {
+            block_t* ra;
+            if (bcache_lookup(bc, blk->bno + n) != NULL) {
+                continue;
+            }
+            if ((ra = bcache_reuse(bc, blk->bno + n)) == NULL) {
+                break;
+            }
+            memcpy(ra->data, bc->rabuf + n * bc->blocksize, bc->blocksize);
+            list_add_tail(&bc->list_lru, &ra->listnode);
+            bc->readahead++;
+        }
+    }
+    bc->ra_busy = false;
+    return r;
+}
+
+static block_t* bcache_alloc(bcache_t* bc) {
+    block_t* blk;
+    if ((blk = calloc(1, sizeof(block_t))) == NULL) {
+        return NULL;
+    }
+    if ((blk->data = malloc(bc->blocksize)) == NULL) {
+        free(blk);
+        return NULL;
+    }
+    bc->block_count++;
+    return blk;
+}
+
+// Add a block to hold bno, if the cache may grow and memory allows.
+static block_t* bcache_grow(bcache_t* bc, uint32_t bno) {
+    block_t* blk;
+    if ((bc->block_count >= bc->block_max) || ((blk = bcache_alloc(bc)) == NULL)) {
+        return NULL;
+    }
+    trace(BCACHE, "bcache_grow() to %u blocks\n", bc->block_count);
+    blk->bno = bno;
+    list_add_tail(bc->hash + bno_hash(bno), &blk->hashnode);
+    return blk;
+}
+
+// Free least recently used blocks until the cache is back to its
+// target size, or there are none.
+static void bcache_shrink(bcache_t* bc) {
+    block_t* blk;
+    while ((bc->block_count > bc->block_target) &&
+           ((blk = list_remove_head_type(&bc->list_lru, block_t, listnode)) != NULL)) {
+        list_delete(&blk->hashnode);
+        free(blk->data);
+        free(blk);
+        bc->block_count--;
+        bc->evictions++;
+    }
+}
+
+static int bno_cmp(const void* a, const void* b) {
+    uint32_t x = (*(block_t* const*)a)->bno;
+    uint32_t y = (*(block_t* const*)b)->bno;
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+// Write back up to BCACHE_FLUSH_MAX dirty blocks. Called by the flusher
+// with the lock held, which is dropped while writing.
+static void bcache_flush_locked(bcache_t* bc) {
+    block_t* blks[BCACHE_FLUSH_MAX];
+    uint32_t count = 0;
+    block_t* blk;
+    while ((count < BCACHE_FLUSH_MAX) &&
+           ((blk = list_remove_head_type(&bc->list_dirty, block_t, listnode)) != NULL)) {
+        blk->flags = (blk->flags & (~BLOCK_DIRTY)) | BLOCK_WRITEBACK;
+        list_add_tail(&bc->list_writeback, &blk->listnode);
+        blks[count++] = blk;
+    }
+    bc->dirty_count -= count;
+    qsort(blks, count, sizeof(block_t*), bno_cmp);
+    for (uint32_t n = 0; n < count; n++) {
+        memcpy(bc->wbbuf + n * bc->blocksize, blks[n]->data, bc->blocksize);
+    }
+    bc->flushing = true;
+    bcache_write_begin(bc);
+    pthread_mutex_unlock(&bc->lock);
+
+    mx_status_t status = NO_ERROR;
+    uint32_t run;
+    for (uint32_t n = 0; n < count; n += run) {
+        for (run = 1; (n + run) < count; run++) {
+            if (blks[n + run]->bno != (blks[n]->bno + run)) {
+                break;
+            }
+        }
+        trace(BCACHE, "bcache_flush() bno=%u count=%u\n", blks[n]->bno, run);
+        if (writeblk(bc->fd, blks[n]->bno, run, bc->wbbuf + n * bc->blocksize) < 0) {
+            error("block write error!\n");
+            status = ERR_IO;
+        }
+    }
+
+    pthread_mutex_lock(&bc->lock);
+    bc->flushing = false;
+    if (bc->wb_status == NO_ERROR) {
+        bc->wb_status = status;
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        blk = blks[n];
+        blk->flags &= (~BLOCK_WRITEBACK);
+        // busy or dirty again ones are where they belong already
+        if (!(blk->flags & (BLOCK_BUSY | BLOCK_DIRTY))) {
+            list_delete(&blk->listnode);
+            list_add_tail(&bc->list_lru, &blk->listnode);
+        }
+    }
+    bcache_shrink(bc);
+    bcache_write_end(bc);
+}
+
+static void* bcache_flusher(void* arg) {
+    bcache_t* bc = arg;
+    pthread_mutex_lock(&bc->lock);
+    for (;;) {
+        while (bc->dirty_count == 0) {
+            pthread_cond_wait(&bc->wake, &bc->lock);
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += BCACHE_FLUSH_SECS;
+        while (((bc->dirty_count * 2) < bc->dirty_max) && (bc->waiters == 0)) {
+            if (pthread_cond_timedwait(&bc->wake, &bc->lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        bcache_flush_locked(bc);
+    }
+    return NULL;
+}
+
+// Have the flusher write blocks back now, and wait for it to.
+// Called with the lock held.
+static void bcache_wait_cleaned(bcache_t* bc) {
+    bc->waiters++;
+    pthread_cond_signal(&bc->wake);
+    pthread_cond_wait(&bc->cleaned, &bc->lock);
+    bc->waiters--;
+}
 
 static block_t* _bcache_get(bcache_t* bc, uint32_t bno, void** data, uint32_t mode) {
     trace(BCACHE,"bcache_get() bno=%u %s\n",bno,modestr(mode));
@@ -97,71 +367,132 @@ static block_t* _bcache_get(bcache_t* bc, uint32_t bno, void** data, uint32_t mo
         return NULL;
     }
     block_t* blk;
-    uint32_t bucket = bno_hash(bno);
-    list_for_every_entry(bc->hash + bucket, blk, block_t, hashnode) {
-        if (blk->bno == bno) {
+    for (;;) {
+        // it may be gone, or cached by someone else, once we've waited
+        if ((blk = bcache_lookup(bc, bno)) != NULL) {
             if (blk->flags & BLOCK_BUSY) {
-                panic("bno %u is busy\n", bno);
+                pthread_cond_wait(&bc->idle, &bc->lock);
+                continue;
             }
-            // remove from dirty or lru
+            // remove from dirty, writeback, or lru
             list_delete(&blk->listnode);
-            goto done;
+            if (blk->flags & BLOCK_DIRTY) {
+                bc->dirty_count--;
+            }
+            bc->hits++;
+            break;
         }
-    }
-    if (mode == MODE_FIND) {
-        blk = NULL;
-    } else {
-        if ((blk = list_remove_head_type(&bc->list_free, block_t, listnode)) != NULL) {
-            // nothing extra to do
-        } else if ((blk = list_remove_head_type(&bc->list_lru, block_t, listnode)) != NULL) {
-            // remove from hash, bno to be reassigned
-            list_delete(&blk->hashnode);
-        } else {
-            panic("bcache: out of blocks\n");
+        if (mode == MODE_FIND) {
+            return NULL;
         }
-        blk->bno = bno;
-        list_add_tail(bc->hash + bucket, &blk->hashnode);
-        if (mode == MODE_ZERO) {
-            blk->flags |= BLOCK_DIRTY;
-            memset(blk->data, 0, bc->blocksize);
-        } else {
-            if (readblk(bc->fd, bno, blk->data) < 0) {
-                panic("bcache: bno %u read error!\n", bno);
+        // prefer waiting for blocks to be written back to growing
+        if ((blk = bcache_reuse(bc, bno)) == NULL) {
+            if ((bc->dirty_count > 0) || bc->flushing) {
+                bcache_wait_cleaned(bc);
+                continue;
+            }
+            if ((blk = bcache_grow(bc, bno)) == NULL) {
+                error("bcache: out of blocks\n");
+                return NULL;
             }
         }
-    }
-done:
-    if (blk) {
+        // busy while it is filled, so nobody else takes or reads it
         blk->flags |= BLOCK_BUSY;
         list_add_tail(&bc->list_busy, &blk->listnode);
+        if (mode == MODE_ZERO) {
+            blk->flags |= BLOCK_DIRTY;
+            memset(blk->data, 0, bc->blocksize);
+        } else if (bcache_load(bc, blk) < 0) {
+            error("bcache: bno %u read error!\n", bno);
+            list_delete(&blk->listnode);
+            list_delete(&blk->hashnode);
+            blk->flags = 0;
+            list_add_head(&bc->list_free, &blk->listnode);
+            pthread_cond_broadcast(&bc->idle);
+            return NULL;
+        }
         *data = blk->data;
+        return blk;
     }
-    //printf("get(%u) %p\n", bno, blk);
+    blk->flags |= BLOCK_BUSY;
+    list_add_tail(&bc->list_busy, &blk->listnode);
+    *data = blk->data;
     return blk;
 }
 
-block_t* bcache_get(bcache_t* bc, uint32_t bno, void** bdata) {
-    return _bcache_get(bc, bno, bdata, MODE_LOAD);
-}
-
-block_t* bcache_get_zero(bcache_t* bc, uint32_t bno, void** bdata) {
-    return _bcache_get(bc, bno, bdata, MODE_ZERO);
-}
-
-void bcache_put(bcache_t* bc, block_t* blk, uint32_t flags) {
+static void _bcache_put(bcache_t* bc, block_t* blk, uint32_t flags) {
     trace(BCACHE, "bcache_put() bno=%u%s\n", blk->bno, (flags & BLOCK_DIRTY) ? " DIRTY" : "");
     if (!(blk->flags & BLOCK_BUSY)) {
         panic("bcache_put() bno=%u NOT BUSY!\n", blk->bno);
     }
+    // off the busy list
+    list_delete(&blk->listnode);
+    blk->flags &= (~BLOCK_BUSY);
+    pthread_cond_broadcast(&bc->idle);
     if ((flags | blk->flags) & BLOCK_DIRTY) {
-        if (writeblk(bc->fd, blk->bno, blk->data) < 0) {
-            error("block write error!\n");
+        blk->flags |= BLOCK_DIRTY;
+        list_add_tail(&bc->list_dirty, &blk->listnode);
+        bc->dirty_count++;
+        // start the flusher's clock on the first one
+        if (bc->dirty_count == 1) {
+            pthread_cond_signal(&bc->wake);
+        }
+        while (bc->dirty_count > bc->dirty_max) {
+            bcache_wait_cleaned(bc);
         }
-        blk->flags &= (~(BLOCK_DIRTY|BLOCK_BUSY));
+    } else if (blk->flags & BLOCK_WRITEBACK) {
+        list_add_tail(&bc->list_writeback, &blk->listnode);
     } else {
-        blk->flags &= (~BLOCK_BUSY);
+        list_add_tail(&bc->list_lru, &blk->listnode);
+        bcache_shrink(bc);
+    }
+}
+
+block_t* bcache_get(bcache_t* bc, uint32_t bno, void** bdata) {
+    pthread_mutex_lock(&bc->lock);
+    block_t* blk = _bcache_get(bc, bno, bdata, MODE_LOAD);
+    pthread_mutex_unlock(&bc->lock);
+    return blk;
+}
+
+block_t* bcache_get_zero(bcache_t* bc, uint32_t bno, void** bdata) {
+    pthread_mutex_lock(&bc->lock);
+    block_t* blk = _bcache_get(bc, bno, bdata, MODE_ZERO);
+    pthread_mutex_unlock(&bc->lock);
+    return blk;
+}
+
+void bcache_put(bcache_t* bc, block_t* blk, uint32_t flags) {
+    pthread_mutex_lock(&bc->lock);
+    _bcache_put(bc, blk, flags);
+    pthread_mutex_unlock(&bc->lock);
+}
+
+mx_status_t bcache_sync(bcache_t* bc) {
+    trace(BCACHE, "bcache_sync()\n");
+    pthread_mutex_lock(&bc->lock);
+    while ((bc->dirty_count > 0) || bc->flushing) {
+        bcache_wait_cleaned(bc);
     }
-    list_add_tail(&bc->list_lru, &blk->listnode);
+    mx_status_t status = bc->wb_status;
+    bc->wb_status = NO_ERROR;
+    pthread_mutex_unlock(&bc->lock);
+    return status;
+}
+
+void bcache_get_stats(bcache_t* bc, mxio_cache_stats_t* stats) {
+    pthread_mutex_lock(&bc->lock);
+    stats->hits = bc->hits;
+    stats->misses = bc->misses;
+    stats->readahead = bc->readahead;
+    stats->evictions = bc->evictions;
+    stats->block_size = bc->blocksize;
+    stats->blocks = bc->block_count;
+    stats->blocks_target = bc->block_target;
+    stats->blocks_max = bc->block_max;
+    stats->busy = list_length(&bc->list_busy);
+    stats->dirty = bc->dirty_count;
+    pthread_mutex_unlock(&bc->lock);
 }
 
 mx_status_t bcache_read(bcache_t* bc, uint32_t bno, void* data, uint32_t off, uint32_t len) {
@@ -170,14 +501,91 @@ mx_status_t bcache_read(bcache_t* bc, uint32_t bno, void* data, uint32_t off, ui
         return -1;
     }
     void* bdata;
-    block_t* blk = bcache_get(bc, bno, &bdata);
+    pthread_mutex_lock(&bc->lock);
+    block_t* blk = _bcache_get(bc, bno, &bdata, MODE_LOAD);
     if (blk != NULL) {
         memcpy(data, bdata + off, len);
-        bcache_put(bc, blk, 0);
-        return 0;
-    } else {
-        return ERR_IO;
+        _bcache_put(bc, blk, 0);
+    }
+    pthread_mutex_unlock(&bc->lock);
+    return (blk != NULL) ? 0 : ERR_IO;
+}
+
+// Multi-block reads go straight to the disk, then take any cached
+// copies, which may be newer. The read is made with the lock dropped,
+// and made again if a write started meanwhile, since a block written
+// back and evicted under it would leave neither copy current.
+// Writes update the cached copies of the blocks they cover, which no
+// longer need writing back, except for ones being written back now,
+// whose older data may land after these. The caller keeps others from
+// using the blocks a write covers until it is done.
+mx_status_t bcache_read_blocks(bcache_t* bc, uint32_t bno, uint32_t count, void* data) {
+    trace(BCACHE, "bcache_read_blocks() bno=%u count=%u\n", bno, count);
+    if ((bno >= bc->blockmax) || (count > (bc->blockmax - bno))) {
+        return ERR_OUT_OF_RANGE;
+    }
+    mx_status_t status = NO_ERROR;
+    pthread_mutex_lock(&bc->lock);
+    for (;;) {
+        while (bc->writing > 0) {
+            pthread_cond_wait(&bc->cleaned, &bc->lock);
+        }
+        uint32_t gen = bc->write_gen;
+        pthread_mutex_unlock(&bc->lock);
+        int r = readblk(bc->fd, bno, count, data);
+        pthread_mutex_lock(&bc->lock);
+        if (r < 0) {
+            status = ERR_IO;
+            break;
+        }
+        if (gen == bc->write_gen) {
+            for (uint32_t n = 0; n < count; n++) {
+                block_t* blk;
+                if ((blk = bcache_lookup(bc, bno + n)) != NULL) {
+                    memcpy(data + n * bc->blocksize, blk->data, bc->blocksize);
+                }
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bc->lock);
+    return status;
+}
+
+mx_status_t bcache_write_blocks(bcache_t* bc, uint32_t bno, uint32_t count, const void* data) {
+    trace(BCACHE, "bcache_write_blocks() bno=%u count=%u\n", bno, count);
+    if ((bno >= bc->blockmax) || (count > (bc->blockmax - bno))) {
+        return ERR_OUT_OF_RANGE;
+    }
+    pthread_mutex_lock(&bc->lock);
+    for (uint32_t n = 0; n < count; n++) {
+        block_t* blk;
+        while (((blk = bcache_lookup(bc, bno + n)) != NULL) && (blk->flags & BLOCK_BUSY)) {
+            pthread_cond_wait(&bc->idle, &bc->lock);
+        }
+        if (blk == NULL) {
+            continue;
+        }
+        memcpy(blk->data, data + n * bc->blocksize, bc->blocksize);
+        if ((blk->flags & BLOCK_WRITEBACK) && !(blk->flags & BLOCK_DIRTY)) {
+            list_delete(&blk->listnode);
+            blk->flags |= BLOCK_DIRTY;
+            list_add_tail(&bc->list_dirty, &blk->listnode);
+            bc->dirty_count++;
+        } else if (!(blk->flags & BLOCK_WRITEBACK) && (blk->flags & BLOCK_DIRTY)) {
+            list_delete(&blk->listnode);
+            blk->flags &= (~BLOCK_DIRTY);
+            list_add_tail(&bc->list_lru, &blk->listnode);
+            bc->dirty_count--;
+        }
     }
+    bcache_write_begin(bc);
+    pthread_mutex_unlock(&bc->lock);
+    mx_status_t status = (writeblk(bc->fd, bno, count, data) < 0) ? ERR_IO : NO_ERROR;
+    pthread_mutex_lock(&bc->lock);
+    bcache_write_end(bc);
+    pthread_mutex_unlock(&bc->lock);
+    return status;
 }
 
 int bcache_create(bcache_t** out, int fd, uint32_t blockmax, uint32_t blocksize, uint32_t num) {
@@ -188,25 +596,48 @@ int bcache_create(bcache_t** out, int fd, uint32_t blockmax, uint32_t blocksize,
     bc->fd = fd;
     bc->blockmax = blockmax;
     bc->blocksize = blocksize;
+    // without it every miss reads just the one block
+    bc->rabuf = malloc(BCACHE_READAHEAD * blocksize);
+    if ((bc->wbbuf = malloc(BCACHE_FLUSH_MAX * blocksize)) == NULL) {
+        free(bc->rabuf);
+        free(bc);
+        return -1;
+    }
     list_initialize(&bc->list_busy);
     list_initialize(&bc->list_dirty);
+    list_initialize(&bc->list_writeback);
     list_initialize(&bc->list_lru);
     list_initialize(&bc->list_free);
     for (int n = 0; n < MINFS_BUCKETS; n++) {
         list_initialize(bc->hash + n);
     }
-    while (num > 0) {
+    while (bc->block_count < num) {
         block_t* blk;
-        if ((blk = calloc(1, sizeof(block_t))) == NULL) {
-            break;
-        }
-        if ((blk->data = malloc(bc->blocksize)) == NULL) {
-            free(blk);
+        if ((blk = bcache_alloc(bc)) == NULL) {
             break;
         }
         list_add_tail(&bc->list_free, &blk->listnode);
-        num--;
     }
+    bc->block_target = bc->block_count;
+    bc->block_max = num * BCACHE_GROWTH;
+    bc->dirty_max = BCACHE_DIRTY_BYTES / blocksize;
+    if (bc->dirty_max > (bc->block_target / 2)) {
+        bc->dirty_max = bc->block_target / 2;
+    }
+    if (bc->dirty_max == 0) {
+        bc->dirty_max = 1;
+    }
+
+    pthread_mutex_init(&bc->lock, NULL);
+    pthread_cond_init(&bc->wake, NULL);
+    pthread_cond_init(&bc->cleaned, NULL);
+    pthread_cond_init(&bc->idle, NULL);
+    pthread_t t;
+    if (pthread_create(&t, NULL, bcache_flusher, bc) != 0) {
+        error("minfs: cannot start block cache flusher\n");
+        return -1;
+    }
+    pthread_detach(t);
     *out = bc;
     return 0;
 }
@@ -18,10 +18,30 @@ mx_status_t bitmap_init(bitmap_t* bm, uint32_t max) {
     bm->bitcount = max;
     bm->mapcount = (max + 63) / 64;
 
+    // and for a summary bit per word of each level below
+    uint32_t sumcount = 0;
+    bm->levels = 1;
+    bm->words[0] = bm->mapcount;
+    while ((bm->words[bm->levels - 1] > 1) && (bm->levels < BITMAP_LEVELS)) {
+        bm->words[bm->levels] = (bm->words[bm->levels - 1] + 63) / 64;
+        sumcount += bm->words[bm->levels];
+        bm->levels++;
+    }
+
     if ((bm->map = calloc(bm->mapcount, 64)) == NULL) {
         return ERR_NO_MEMORY;
     }
+    uint64_t* sum = NULL;
+    if ((sumcount > 0) && ((sum = calloc(sumcount, sizeof(uint64_t))) == NULL)) {
+        free(bm->map);
+        return ERR_NO_MEMORY;
+    }
     bm->end = bm->map + bm->mapcount;
+    bm->level[0] = bm->map;
+    for (uint32_t n = 1; n < bm->levels; n++) {
+        bm->level[n] = sum;
+        sum += bm->words[n];
+    }
     return NO_ERROR;
 }
 
@@ -35,38 +55,83 @@ mx_status_t bitmap_resize(bitmap_t* bm, uint32_t max) {
 
 void bitmap_destroy(bitmap_t* bm) {
     free(bm->map);
+    if (bm->levels > 1) {
+        free(bm->level[1]);
+    }
+}
+
+void bitmap_word_full(bitmap_t* bm, uint32_t n) {
+    for (uint32_t l = 1; l < bm->levels; l++) {
+        uint64_t* w = bm->level[l] + (n >> 6);
+        if ((*w |= (1ULL << (n & 63))) != ~0ULL) {
+            break;
+        }
+        n >>= 6;
+    }
+}
+
+void bitmap_word_free(bitmap_t* bm, uint32_t n) {
+    for (uint32_t l = 1; l < bm->levels; l++) {
+        uint64_t* w = bm->level[l] + (n >> 6);
+        bool full = (*w == ~0ULL);
+        *w &= ~(1ULL << (n & 63));
+        if (!full) {
+            break;
+        }
+        n >>= 6;
+    }
+}
+
+void bitmap_update(bitmap_t* bm) {
+    for (uint32_t l = 1; l < bm->levels; l++) {
+        memset(bm->level[l], 0, bm->words[l] * sizeof(uint64_t));
+    }
+    for (uint32_t n = 0; n < bm->mapcount; n++) {
+        if (bm->map[n] == ~0ULL) {
+            bitmap_word_full(bm, n);
+        }
+    }
 }
 
 static void bitmap_zero(bitmap_t* bm) {
     memset(bm->map, 0, bm->bitcount / 8);
+    bitmap_update(bm);
 }
 
-// minbit specifies a bit number which is the minimum to allocate at
-// to avoid making all allocations suffer, we round to the nearest
-// multiple of the sub-bitmap storage unit (a uint64_t).
-uint32_t bitmap_alloc(bitmap_t* bm, uint32_t minbit) {
-    uint64_t* bits = bm->map + ((minbit + 63) >> 6);
-    uint64_t* end = bm->end;
-    while (bits < end) {
-        uint64_t v = *bits;
-        uint32_t n;
-        if ((n = __builtin_ffsll(~v)) != 0) {
-            n--;
-            uint32_t ret = ((bits - bm->map) << 6) + n;
-            // If this is end-1, and the map is full
-            // we might attempt to use a bit past the
-            // end.  Ensure that we do not.
-            if (ret >= bm->bitcount) {
+// The first clear bit at or after bit pos of level l, a word at a time,
+// going up a level to skip each run of full words.
+static uint32_t bitmap_find(bitmap_t* bm, uint32_t l, uint64_t pos) {
+    uint64_t bits = (l == 0) ? bm->bitcount : bm->words[l - 1];
+    uint64_t* level = bm->level[l];
+    while (pos < bits) {
+        // ignore the bits before pos in its word
+        uint64_t v = level[pos >> 6] | ((1ULL << (pos & 63)) - 1);
+        if (v != ~0ULL) {
+            pos = (pos & ~63ULL) + __builtin_ctzll(~v);
+            return (pos < bits) ? (uint32_t)pos : BITMAP_FAIL;
+        }
+        uint64_t next = (pos >> 6) + 1;
+        if ((l + 1) < bm->levels) {
+            if ((next = bitmap_find(bm, l + 1, next)) == BITMAP_FAIL) {
                 break;
             }
-            *bits = v | (1ULL << n);
-            return ret;
         }
-        bits++;
+        pos = next << 6;
     }
     return BITMAP_FAIL;
 }
 
+// minbit specifies a bit number which is the minimum to allocate at
+// to avoid making all allocations suffer, we round to the nearest
+// multiple of the sub-bitmap storage unit (a uint64_t).
+uint32_t bitmap_alloc(bitmap_t* bm, uint32_t minbit) {
+    uint32_t n = bitmap_find(bm, 0, ((uint64_t)minbit + 63) & ~63ULL);
+    if (n != BITMAP_FAIL) {
+        bitmap_set(bm, n);
+    }
+    return n;
+}
+
 #define FAIL_IF(c) do { if (c) { error("fail: %s\n", #c); return -1; } } while (0)
 
 int do_bitmap_test(void) {
@@ -110,10 +175,34 @@ int do_bitmap_test(void) {
     for (n = 0; n < 10; n++) {
         bm.map[n] = -1;
     }
+    bitmap_update(&bm);
     FAIL_IF(bitmap_alloc(&bm, 0) != 640);
 
     memset(bm.map, 0xFF, bm.bitcount / 8);
+    bitmap_update(&bm);
+    FAIL_IF(bitmap_alloc(&bm, 0) != BITMAP_FAIL);
+    bitmap_destroy(&bm);
+
+    // large enough for three levels, to check full words are skipped
+    // over and found again once freed
+    if (bitmap_init(&bm, 64 * 64 * 64)) {
+        error("init failed\n");
+        return -1;
+    }
+    FAIL_IF(bm.levels != 3);
+    for (n = 0; n < 64 * 64 * 64 - 100; n++) {
+        FAIL_IF(bitmap_alloc(&bm, 0) != n);
+    }
+    FAIL_IF(bm.level[2][0] != 0x7FFFFFFFFFFFFFFFULL);
+    FAIL_IF(bitmap_alloc(&bm, 4096) != n);
+    bitmap_clr(&bm, 70000);
+    bitmap_clr(&bm, 5);
+    FAIL_IF(bitmap_alloc(&bm, 64) != 70000);
+    FAIL_IF(bitmap_alloc(&bm, 0) != 5);
+    FAIL_IF(bitmap_alloc(&bm, 0) != n + 1);
+    bitmap_resize(&bm, n + 2);
     FAIL_IF(bitmap_alloc(&bm, 0) != BITMAP_FAIL);
+    bitmap_destroy(&bm);
 
     warn("bitmap: ok\n");
     return 0;
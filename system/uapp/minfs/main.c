@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -165,7 +167,12 @@ found:
 
     for (unsigned i = 0; i < sizeof(CMDS) / sizeof(CMDS[0]); i++) {
         if (!strcmp(cmd, CMDS[i].name)) {
-            return CMDS[i].func(bc);
+            int r = CMDS[i].func(bc);
+            if (bcache_sync(bc) < 0) {
+                fprintf(stderr, "error: cannot write back block cache\n");
+                return -1;
+            }
+            return r;
         }
     }
     return -1;
@@ -2,30 +2,61 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <system/listnode.h>
+
 #include "minfs-private.h"
 
+// Directories are checked by this many threads, each taking the next
+// directory from a shared queue, to which the directories it finds
+// are added rather than recursed into.
+#define CHECK_THREADS 4
+
+// The inode table is read up front, this many blocks at a time.
+#define CHECK_READ_BLOCKS 128
+
+typedef struct check_work {
+    list_node_t node;
+    uint32_t ino;
+    uint32_t parent;
+} check_work_t;
+
 typedef struct check {
+    minfs_t* fs;
+    minfs_inode_t* inodes; // the whole inode table, or NULL to read through the cache
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
     bitmap_t checked_inodes;
+    list_node_t queue;
+    uint32_t busy;         // queued or being checked
+    mx_status_t status;    // first error, which stops the check
 } check_t;
 
 static mx_status_t check_inode(check_t* chk, minfs_t* fs, uint32_t ino, uint32_t parent);
 
-static mx_status_t get_inode(minfs_t* fs, minfs_inode_t* inode, uint32_t ino) {
+static mx_status_t get_inode(check_t* chk, minfs_t* fs, minfs_inode_t* inode, uint32_t ino) {
     if (ino >= fs->info.inode_count) {
         error("check: ino %u out of range (>=%u)\n",
               ino, fs->info.inode_count);
         return ERR_OUT_OF_RANGE;
     }
-    mx_status_t status;
-    uint32_t bno_of_ino = fs->info.ino_block + ino / MINFS_INODES_PER_BLOCK;
-    uint32_t off_of_ino = (ino % MINFS_INODES_PER_BLOCK) * MINFS_INODE_SIZE;
-    if ((status = bcache_read(fs->bc, bno_of_ino, inode, off_of_ino, MINFS_INODE_SIZE)) < 0) {
-        return status;
+    if (chk->inodes != NULL) {
+        memcpy(inode, &chk->inodes[ino], MINFS_INODE_SIZE);
+    } else {
+        mx_status_t status;
+        uint32_t bno_of_ino = fs->info.ino_block + ino / MINFS_INODES_PER_BLOCK;
+        uint32_t off_of_ino = (ino % MINFS_INODES_PER_BLOCK) * MINFS_INODE_SIZE;
+        if ((status = bcache_read(fs->bc, bno_of_ino, inode, off_of_ino, MINFS_INODE_SIZE)) < 0) {
+            return status;
+        }
     }
     if ((inode->magic != MINFS_MAGIC_FILE) && (inode->magic != MINFS_MAGIC_DIR)) {
         error("check: ino %u has bad magic %#x\n", ino, inode->magic);
@@ -34,6 +65,50 @@ static mx_status_t get_inode(minfs_t* fs, minfs_inode_t* inode, uint32_t ino) {
     return NO_ERROR;
 }
 
+// Read the inode table with large sequential reads. Without the memory
+// for it, inodes are read through the cache one at a time instead.
+static void load_inodes(check_t* chk, minfs_t* fs) {
+    uint32_t inoblks = (fs->info.inode_count + MINFS_INODES_PER_BLOCK - 1) / MINFS_INODES_PER_BLOCK;
+    void* table;
+    if ((table = malloc((size_t)inoblks * MINFS_BLOCK_SIZE)) == NULL) {
+        warn("check: no memory for inode table, reading it a block at a time\n");
+        return;
+    }
+    for (uint32_t n = 0; n < inoblks; n += CHECK_READ_BLOCKS) {
+        uint32_t count = inoblks - n;
+        if (count > CHECK_READ_BLOCKS) {
+            count = CHECK_READ_BLOCKS;
+        }
+        if (bcache_read_blocks(fs->bc, fs->info.ino_block + n, count,
+                               table + (size_t)n * MINFS_BLOCK_SIZE) < 0) {
+            warn("check: failed reading inode table, reading it a block at a time\n");
+            free(table);
+            return;
+        }
+    }
+    chk->inodes = table;
+}
+
+// Queue an inode to be checked, unless it has been already.
+// Called with the lock held.
+static mx_status_t queue_inode_locked(check_t* chk, uint32_t ino, uint32_t parent) {
+    if (bitmap_get(&chk->checked_inodes, ino)) {
+        // we've been here before
+        return NO_ERROR;
+    }
+    check_work_t* work;
+    if ((work = malloc(sizeof(check_work_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    bitmap_set(&chk->checked_inodes, ino);
+    work->ino = ino;
+    work->parent = parent;
+    list_add_tail(&chk->queue, &work->node);
+    chk->busy++;
+    pthread_cond_signal(&chk->wake);
+    return NO_ERROR;
+}
+
 #define CD_DUMP 1
 #define CD_RECURSE 2
 
@@ -41,10 +116,18 @@ static mx_status_t get_inode_nth_bno(minfs_t* fs, minfs_inode_t* inode, uint32_t
     if (n < MINFS_DIRECT) {
         *bno_out = inode->dnum[n];
         return NO_ERROR;
-    } else {
-        //TODO
+    }
+    n -= MINFS_DIRECT;
+    uint32_t i = n / MINFS_BLOCK_PTRS;
+    if (i >= MINFS_INDIRECT) {
         return ERR_OUT_OF_RANGE;
     }
+    if (inode->inum[i] == 0) {
+        *bno_out = 0;
+        return NO_ERROR;
+    }
+    return bcache_read(fs->bc, inode->inum[i], bno_out,
+                       (n % MINFS_BLOCK_PTRS) * sizeof(uint32_t), sizeof(uint32_t));
 }
 
 static mx_status_t check_directory(check_t* chk, minfs_t* fs, minfs_inode_t* inode,
@@ -106,7 +189,15 @@ static mx_status_t check_directory(check_t* chk, minfs_t* fs, minfs_inode_t* ino
                          ino, eno, de->ino, de->type, de->namelen, de->name);
                 }
                 if (flags & CD_RECURSE) {
-                    if ((status = check_inode(chk, fs, de->ino, ino)) < 0) {
+                    if (de->ino >= fs->info.inode_count) {
+                        error("check: ino#%u: de[%u]: ino %u out of range (>=%u)\n",
+                              ino, eno, de->ino, fs->info.inode_count);
+                        return ERR_OUT_OF_RANGE;
+                    }
+                    pthread_mutex_lock(&chk->lock);
+                    status = queue_inode_locked(chk, de->ino, ino);
+                    pthread_mutex_unlock(&chk->lock);
+                    if (status < 0) {
                         return status;
                     }
                 }
@@ -129,27 +220,21 @@ static mx_status_t check_directory(check_t* chk, minfs_t* fs, minfs_inode_t* ino
 }
 
 mx_status_t check_inode(check_t* chk, minfs_t* fs, uint32_t ino, uint32_t parent) {
-    if (bitmap_get(&chk->checked_inodes, ino)) {
-        // we've been here before
-        return NO_ERROR;
-    }
-    bitmap_set(&chk->checked_inodes, ino);
     if (!bitmap_get(&fs->inode_map, ino)) {
         warn("check: ino#%u: not marked in-use\n", ino);
     }
     mx_status_t status;
     minfs_inode_t inode;
-    if ((status = get_inode(fs, &inode, ino)) < 0) {
+    if ((status = get_inode(chk, fs, &inode, ino)) < 0) {
         error("check: ino#%u: not readable\n", ino);
         return status;
     }
     if (inode.magic == MINFS_MAGIC_DIR) {
         info("ino#%u: DIR blks=%u links=%u\n",
              ino, inode.block_count, inode.link_count);
-        if ((status = check_directory(chk, fs, &inode, ino, parent, CD_DUMP)) < 0) {
-            return status;
-        }
-        if ((status = check_directory(chk, fs, &inode, ino, parent, CD_RECURSE)) < 0) {
+        // entries are dumped as they are found, and the inodes they
+        // name are queued to be checked after this directory
+        if ((status = check_directory(chk, fs, &inode, ino, parent, CD_DUMP | CD_RECURSE)) < 0) {
             return status;
         }
     } else {
@@ -161,6 +246,67 @@ mx_status_t check_inode(check_t* chk, minfs_t* fs, uint32_t ino, uint32_t parent
     return NO_ERROR;
 }
 
+static void* check_worker(void* arg) {
+    check_t* chk = arg;
+    pthread_mutex_lock(&chk->lock);
+    for (;;) {
+        check_work_t* work;
+        while ((chk->busy > 0) && (chk->status == NO_ERROR) &&
+               ((work = list_remove_head_type(&chk->queue, check_work_t, node)) == NULL)) {
+            pthread_cond_wait(&chk->wake, &chk->lock);
+        }
+        if ((chk->busy == 0) || (chk->status != NO_ERROR)) {
+            break;
+        }
+        pthread_mutex_unlock(&chk->lock);
+
+        mx_status_t status = check_inode(chk, chk->fs, work->ino, work->parent);
+        free(work);
+
+        pthread_mutex_lock(&chk->lock);
+        if ((status < 0) && (chk->status == NO_ERROR)) {
+            chk->status = status;
+        }
+        // the last one done, or the first to fail, lets the others go
+        if ((--chk->busy == 0) || (status < 0)) {
+            pthread_cond_broadcast(&chk->wake);
+        }
+    }
+    pthread_mutex_unlock(&chk->lock);
+    return NULL;
+}
+
+// Check every inode reachable from the root, with CHECK_THREADS threads
+// including this one.
+static mx_status_t check_tree(check_t* chk) {
+    pthread_mutex_lock(&chk->lock);
+    mx_status_t status = queue_inode_locked(chk, 1, 1);
+    pthread_mutex_unlock(&chk->lock);
+    if (status < 0) {
+        return status;
+    }
+
+    pthread_t threads[CHECK_THREADS - 1];
+    unsigned count;
+    for (count = 0; count < (CHECK_THREADS - 1); count++) {
+        if (pthread_create(&threads[count], NULL, check_worker, chk) != 0) {
+            warn("check: cannot start thread %u\n", count);
+            break;
+        }
+    }
+    check_worker(chk);
+    for (unsigned n = 0; n < count; n++) {
+        pthread_join(threads[n], NULL);
+    }
+
+    // work left behind by a failure
+    check_work_t* work;
+    while ((work = list_remove_head_type(&chk->queue, check_work_t, node)) != NULL) {
+        free(work);
+    }
+    return chk->status;
+}
+
 mx_status_t minfs_check(bcache_t* bc) {
     mx_status_t status;
 
@@ -174,9 +320,13 @@ mx_status_t minfs_check(bcache_t* bc) {
     }
 
     check_t chk;
+    memset(&chk, 0, sizeof(chk));
     if ((status = bitmap_init(&chk.checked_inodes, info.inode_count)) < 0) {
         return status;
     }
+    pthread_mutex_init(&chk.lock, NULL);
+    pthread_cond_init(&chk.wake, NULL);
+    list_initialize(&chk.queue);
     minfs_t* fs;
     if ((status = minfs_create(&fs, bc, &info)) < 0) {
         return status;
@@ -184,9 +334,13 @@ mx_status_t minfs_check(bcache_t* bc) {
     if (minfs_load_bitmaps(fs)) {
         return -1;
     }
+    chk.fs = fs;
+    load_inodes(&chk, fs);
 
     //TODO: check root not a directory
-    if ((status = check_inode(&chk, fs, 1, 1)) < 0) {
+    status = check_tree(&chk);
+    free(chk.inodes);
+    if (status < 0) {
         return status;
     }
 
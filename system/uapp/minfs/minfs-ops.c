@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,58 +16,140 @@
 #include "minfs-private.h"
 
 
-// obtain the nth block of a vnode
-static block_t* vn_get_block(minfs_vnode_t* vn, uint32_t n, void** bdata) {
-    if (n < MINFS_DIRECT) {
-        n = vn->inode.dnum[n];
-        if (n != 0) {
-            return bcache_get(vn->fs->bc, n, bdata);
+mx_status_t minfs_alloc_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno) {
+    uint32_t bno;
+    pthread_mutex_lock(&fs->lock);
+    // take the hinted block itself if it's free, so files grow in
+    // contiguous runs rather than starting over at a bitmap word boundary
+    if ((hint >= fs->info.dat_block) && (hint < fs->info.block_count) &&
+        !bitmap_get(&fs->block_map, hint)) {
+        bitmap_set(&fs->block_map, hint);
+        bno = hint;
+    } else {
+        bno = bitmap_alloc(&fs->block_map, hint);
+        if ((bno == BITMAP_FAIL) && (hint != 0)) {
+            bno = bitmap_alloc(&fs->block_map, 0);
+        }
+        if (bno == BITMAP_FAIL) {
+            pthread_mutex_unlock(&fs->lock);
+            return ERR_NO_RESOURCES;
         }
-    }
-    //TODO: indirect blocks
-    return NULL;
-}
-
-static inline void vn_put_block(minfs_vnode_t* vn, block_t* blk) {
-    bcache_put(vn->fs->bc, blk, 0);
-}
-
-static inline void vn_put_block_dirty(minfs_vnode_t* vn, block_t* blk) {
-    bcache_put(vn->fs->bc, blk, BLOCK_DIRTY);
-}
-
-block_t* minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** bdata) {
-    uint32_t bno = bitmap_alloc(&fs->block_map, hint);
-    if ((bno == BITMAP_FAIL) && (hint != 0)) {
-        bno = bitmap_alloc(&fs->block_map, 0);
-    }
-    if (bno == BITMAP_FAIL) {
-        return NULL;
     }
 
-    // obtain the block of the alloc bitmap we need
+    // commit the bitmap
     block_t* block_abm;
     void* bdata_abm;
     if ((block_abm = bcache_get(fs->bc, fs->info.abm_block + (bno / MINFS_BLOCK_BITS), &bdata_abm)) == NULL) {
         bitmap_clr(&fs->block_map, bno);
+        pthread_mutex_unlock(&fs->lock);
+        return ERR_IO;
+    }
+    memcpy(bdata_abm, fs->block_map.map + ((bno / MINFS_BLOCK_BITS) * (MINFS_BLOCK_BITS / 64)), MINFS_BLOCK_SIZE);
+    bcache_put(fs->bc, block_abm, BLOCK_DIRTY);
+    pthread_mutex_unlock(&fs->lock);
+    *out_bno = bno;
+    return NO_ERROR;
+}
+
+block_t* minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** bdata) {
+    uint32_t bno;
+    if (minfs_alloc_block(fs, hint, &bno) < 0) {
         return NULL;
     }
 
     // obtain the block we're allocating
     block_t* block;
     if ((block = bcache_get_zero(fs->bc, bno, bdata)) == NULL) {
-        bitmap_clr(&fs->block_map, bno);
-        bcache_put(fs->bc, block_abm, 0);
         return NULL;
     }
-
-    // commit the bitmap
-    memcpy(bdata_abm, fs->block_map.map + ((bno / MINFS_BLOCK_BITS) * (MINFS_BLOCK_BITS / 64)), MINFS_BLOCK_SIZE);
-    bcache_put(fs->bc, block_abm, BLOCK_DIRTY);
     *out_bno = bno;
     return block;
 }
 
+// Find the disk block holding block n of a vnode, 0 for a hole. With alloc
+// set, a hole is filled with a new block, after hint if that is free, and
+// *created is set. The caller must sync the inode if it changed.
+static mx_status_t vn_map_block(minfs_vnode_t* vn, uint32_t n, bool alloc,
+                                uint32_t hint, uint32_t* out_bno, bool* created) {
+    minfs_t* fs = vn->fs;
+    mx_status_t status;
+    uint32_t bno;
+
+    if (created) {
+        *created = false;
+    }
+    if (n < MINFS_DIRECT) {
+        if (((bno = vn->inode.dnum[n]) == 0) && alloc) {
+            if ((status = minfs_alloc_block(fs, hint, &bno)) < 0) {
+                return status;
+            }
+            vn->inode.dnum[n] = bno;
+            vn->inode.block_count++;
+            if (created) {
+                *created = true;
+            }
+        }
+        *out_bno = bno;
+        return NO_ERROR;
+    }
+
+    n -= MINFS_DIRECT;
+    uint32_t i = n / MINFS_BLOCK_PTRS;
+    if (i >= MINFS_INDIRECT) {
+        return ERR_OUT_OF_RANGE;
+    }
+
+    block_t* iblk;
+    uint32_t* ientry;
+    if (vn->inode.inum[i] == 0) {
+        if (!alloc) {
+            *out_bno = 0;
+            return NO_ERROR;
+        }
+        if ((iblk = minfs_new_block(fs, hint, &vn->inode.inum[i], (void**)&ientry)) == NULL) {
+            return ERR_NO_RESOURCES;
+        }
+        // leave the data block its place next to the previous one
+        hint = vn->inode.inum[i] + 1;
+    } else if ((iblk = bcache_get(fs->bc, vn->inode.inum[i], (void**)&ientry)) == NULL) {
+        return ERR_IO;
+    }
+
+    uint32_t flags = 0;
+    if (((bno = ientry[n % MINFS_BLOCK_PTRS]) == 0) && alloc) {
+        if ((status = minfs_alloc_block(fs, hint, &bno)) < 0) {
+            bcache_put(fs->bc, iblk, 0);
+            return status;
+        }
+        ientry[n % MINFS_BLOCK_PTRS] = bno;
+        vn->inode.block_count++;
+        flags = BLOCK_DIRTY;
+        if (created) {
+            *created = true;
+        }
+    }
+    bcache_put(fs->bc, iblk, flags);
+    *out_bno = bno;
+    return NO_ERROR;
+}
+
+// obtain the nth block of a vnode
+static block_t* vn_get_block(minfs_vnode_t* vn, uint32_t n, void** bdata) {
+    uint32_t bno;
+    if ((vn_map_block(vn, n, false, 0, &bno, NULL) < 0) || (bno == 0)) {
+        return NULL;
+    }
+    return bcache_get(vn->fs->bc, bno, bdata);
+}
+
+static inline void vn_put_block(minfs_vnode_t* vn, block_t* blk) {
+    bcache_put(vn->fs->bc, blk, 0);
+}
+
+static inline void vn_put_block_dirty(minfs_vnode_t* vn, block_t* blk) {
+    bcache_put(vn->fs->bc, blk, BLOCK_DIRTY);
+}
+
 
 
 #define DIR_CB_NEXT 0
@@ -181,16 +265,149 @@ static mx_status_t fs_close(vnode_t* _vn) {
     return NO_ERROR;
 }
 
+// The count of whole blocks, starting at file block n which is at bno on
+// disk, that follow it on disk and fit in len bytes. With alloc set, holes
+// in the range are filled, after the blocks before them where possible.
+static uint32_t vn_block_run(minfs_vnode_t* vn, uint32_t n, uint32_t bno,
+                             size_t len, bool alloc) {
+    uint32_t count = 1;
+    while ((count + 1) * (size_t)MINFS_BLOCK_SIZE <= len) {
+        uint32_t next;
+        if ((vn_map_block(vn, n + count, alloc, bno + count, &next, NULL) < 0) ||
+            (next != bno + count)) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
 static ssize_t fs_read(vnode_t* _vn, void* data, size_t len, size_t off) {
     minfs_vnode_t* vn = to_minvn(_vn);
     trace(MINFS, "minfs_read() vn=%p(#%u) len=%zd off=%zd\n", vn, vn->ino, len, off);
-    return ERR_NOT_SUPPORTED;
+    if (vn->inode.magic != MINFS_MAGIC_FILE) {
+        return ERR_NOT_SUPPORTED;
+    }
+    pthread_rwlock_rdlock(&vn->lock);
+    if (off >= vn->inode.size) {
+        pthread_rwlock_unlock(&vn->lock);
+        return 0;
+    }
+    if (len > (vn->inode.size - off)) {
+        len = vn->inode.size - off;
+    }
+
+    size_t done = 0;
+    mx_status_t status = NO_ERROR;
+    while (done < len) {
+        uint32_t n = (off + done) / MINFS_BLOCK_SIZE;
+        size_t boff = (off + done) % MINFS_BLOCK_SIZE;
+        size_t xfer = MINFS_BLOCK_SIZE - boff;
+        if (xfer > (len - done)) {
+            xfer = len - done;
+        }
+
+        uint32_t bno;
+        if ((status = vn_map_block(vn, n, false, 0, &bno, NULL)) < 0) {
+            break;
+        }
+        if (bno == 0) {
+            memset(data + done, 0, xfer);
+        } else if (boff == 0 && xfer == MINFS_BLOCK_SIZE) {
+            // read whole blocks straight into the caller's buffer,
+            // as many at a time as are contiguous on disk
+            uint32_t count = vn_block_run(vn, n, bno, len - done, false);
+            if ((status = bcache_read_blocks(vn->fs->bc, bno, count, data + done)) < 0) {
+                break;
+            }
+            xfer = count * MINFS_BLOCK_SIZE;
+        } else if ((status = bcache_read(vn->fs->bc, bno, data + done, boff, xfer)) < 0) {
+            break;
+        }
+        done += xfer;
+    }
+    pthread_rwlock_unlock(&vn->lock);
+    return done ? (ssize_t)done : status;
 }
 
 static ssize_t fs_write(vnode_t* _vn, const void* data, size_t len, size_t off) {
     minfs_vnode_t* vn = to_minvn(_vn);
     trace(MINFS, "minfs_write() vn=%p(#%u) len=%zd off=%zd\n", vn, vn->ino, len, off);
-    return ERR_NOT_SUPPORTED;
+    if (vn->inode.magic != MINFS_MAGIC_FILE) {
+        return ERR_NOT_SUPPORTED;
+    }
+    // the size has to fit in the inode
+    if (off >= UINT32_MAX) {
+        return ERR_OUT_OF_RANGE;
+    }
+    if (len > (UINT32_MAX - off)) {
+        len = UINT32_MAX - off;
+    }
+
+    pthread_rwlock_wrlock(&vn->lock);
+
+    // new blocks go after the one before the write, if there is one
+    uint32_t hint = 0;
+    if (off >= MINFS_BLOCK_SIZE) {
+        if ((vn_map_block(vn, off / MINFS_BLOCK_SIZE - 1, false, 0, &hint, NULL) == NO_ERROR) &&
+            (hint != 0)) {
+            hint++;
+        }
+    }
+
+    uint32_t block_count = vn->inode.block_count;
+    size_t done = 0;
+    mx_status_t status = NO_ERROR;
+    while (done < len) {
+        uint32_t n = (off + done) / MINFS_BLOCK_SIZE;
+        size_t boff = (off + done) % MINFS_BLOCK_SIZE;
+        size_t xfer = MINFS_BLOCK_SIZE - boff;
+        if (xfer > (len - done)) {
+            xfer = len - done;
+        }
+
+        uint32_t bno;
+        bool created;
+        if ((status = vn_map_block(vn, n, true, hint, &bno, &created)) < 0) {
+            break;
+        }
+        if (boff == 0 && xfer == MINFS_BLOCK_SIZE) {
+            // write whole blocks straight from the caller's buffer,
+            // allocating the ones that follow contiguously if we can
+            uint32_t count = vn_block_run(vn, n, bno, len - done, true);
+            if ((status = bcache_write_blocks(vn->fs->bc, bno, count, data + done)) < 0) {
+                break;
+            }
+            xfer = count * MINFS_BLOCK_SIZE;
+            hint = bno + count;
+        } else {
+            // a new block has nothing on disk worth reading
+            block_t* blk;
+            void* bdata;
+            if (created) {
+                blk = bcache_get_zero(vn->fs->bc, bno, &bdata);
+            } else {
+                blk = bcache_get(vn->fs->bc, bno, &bdata);
+            }
+            if (blk == NULL) {
+                status = ERR_IO;
+                break;
+            }
+            memcpy(bdata + boff, data + done, xfer);
+            vn_put_block_dirty(vn, blk);
+            hint = bno + 1;
+        }
+        done += xfer;
+    }
+
+    if ((off + done) > vn->inode.size) {
+        vn->inode.size = off + done;
+    }
+    if ((done > 0) || (vn->inode.block_count != block_count)) {
+        minfs_sync_vnode(vn);
+    }
+    pthread_rwlock_unlock(&vn->lock);
+    return done ? (ssize_t)done : status;
 }
 
 static mx_status_t fs_lookup(vnode_t* _vn, vnode_t** out, const char* name, size_t len) {
@@ -205,7 +422,10 @@ static mx_status_t fs_lookup(vnode_t* _vn, vnode_t** out, const char* name, size
         .len = len,
     };
     mx_status_t status;
-    if ((status = vn_dir_for_each(vn, &args, cb_dir_find)) < 0) {
+    pthread_rwlock_rdlock(&vn->lock);
+    status = vn_dir_for_each(vn, &args, cb_dir_find);
+    pthread_rwlock_unlock(&vn->lock);
+    if (status < 0) {
         return status;
     }
     if ((status = minfs_get_vnode(vn->fs, &vn, args.ino)) < 0) {
@@ -244,7 +464,9 @@ static mx_status_t fs_create(vnode_t* _vn, vnode_t** out,
     };
     // ensure file does not exist
     mx_status_t status;
+    pthread_rwlock_wrlock(&vndir->lock);
     if ((status = vn_dir_for_each(vndir, &args, cb_dir_find)) != ERR_NOT_FOUND) {
+        pthread_rwlock_unlock(&vndir->lock);
         return ERR_IO; //TODO: err exists
     }
 
@@ -254,6 +476,7 @@ static mx_status_t fs_create(vnode_t* _vn, vnode_t** out,
     // mint a new inode and vnode for it
     minfs_vnode_t* vn;
     if ((status = minfs_new_vnode(vndir->fs, &vn, type)) < 0) {
+        pthread_rwlock_unlock(&vndir->lock);
         return status;
     }
 
@@ -263,6 +486,7 @@ static mx_status_t fs_create(vnode_t* _vn, vnode_t** out,
     args.reclen = SIZEOF_MINFS_DIRENT(len);
     if ((status = vn_dir_for_each(vndir, &args, cb_dir_append)) < 0) {
         error("minfs_create() dir append failed %d\n", status);
+        pthread_rwlock_unlock(&vndir->lock);
         return status;
     }
     if (type == MINFS_TYPE_DIR) {
@@ -277,13 +501,23 @@ static mx_status_t fs_create(vnode_t* _vn, vnode_t** out,
         vn->inode.size = MINFS_BLOCK_SIZE;
         minfs_sync_vnode(vn);
     }
+    pthread_rwlock_unlock(&vndir->lock);
     *out = &vn->vnode;
     return NO_ERROR;
 }
 
 static ssize_t fs_ioctl(vnode_t* vn, uint32_t op, const void* in_buf,
                             size_t in_len, void* out_buf, size_t out_len) {
-    return ERR_NOT_SUPPORTED;
+    switch (op) {
+    case IOCTL_FS_GET_CACHE_STATS:
+        if (out_len < sizeof(mxio_cache_stats_t)) {
+            return ERR_NOT_ENOUGH_BUFFER;
+        }
+        bcache_get_stats(to_minvn(vn)->fs->bc, out_buf);
+        return sizeof(mxio_cache_stats_t);
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
 }
 
 static mx_status_t fs_unlink(vnode_t* _vn, const char* name, size_t len) {
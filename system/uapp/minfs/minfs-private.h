@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <pthread.h>
+
 #include "vfs.h"
 #include "minfs.h"
 
@@ -15,7 +17,12 @@ typedef struct minfs_vnode minfs_vnode_t;
 
 extern vnode_ops_t minfs_ops;
 
+// Requests are served from several threads. The fs lock covers the
+// allocation bitmaps and the vnode hash, and each vnode's lock its
+// inode and, for directories, its entries: held shared to read them,
+// exclusive to change them.
 struct minfs {
+    pthread_mutex_t lock;
     bitmap_t block_map;
     bitmap_t inode_map;
     bcache_t* bc;
@@ -30,6 +37,7 @@ struct minfs_vnode {
     list_node_t hashnode;
     minfs_t* fs;
     uint32_t ino;
+    pthread_rwlock_t lock;
 
     vnode_t vnode;
     minfs_inode_t inode;
@@ -47,6 +55,9 @@ mx_status_t minfs_new_vnode(minfs_t* fs, minfs_vnode_t** out, uint32_t type);
 // delete the inode backing a vnode
 mx_status_t minfs_del_vnode(minfs_vnode_t* vn);
 
+// allocate a new data block, at hint if it is free
+mx_status_t minfs_alloc_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno);
+
 // allocate a new data block and bcache_get_zero() it
 block_t* minfs_new_block(minfs_t* fs, uint32_t hint, uint32_t* out_bno, void** bdata);
 
@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -67,8 +69,10 @@ void minfs_sync_vnode(minfs_vnode_t* vn) {
 }
 
 mx_status_t minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out) {
+    pthread_mutex_lock(&fs->lock);
     uint32_t ino = bitmap_alloc(&fs->inode_map, 0);
     if (ino == BITMAP_FAIL) {
+        pthread_mutex_unlock(&fs->lock);
         return ERR_NO_RESOURCES;
     }
 
@@ -79,6 +83,7 @@ mx_status_t minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out
     void* bdata_ibm;
     if ((block_ibm = bcache_get(fs->bc, bno_of_ibm, &bdata_ibm)) == NULL) {
         bitmap_clr(&fs->inode_map, ino);
+        pthread_mutex_unlock(&fs->lock);
         return ERR_IO;
     }
 
@@ -91,6 +96,7 @@ mx_status_t minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out
     if ((block_ino = bcache_get(fs->bc, bno_of_ino, &bdata_ino)) == NULL) {
         bitmap_clr(&fs->inode_map, ino);
         bcache_put(fs->bc, block_ibm, 0);
+        pthread_mutex_unlock(&fs->lock);
         return ERR_IO;
     }
 
@@ -103,6 +109,7 @@ mx_status_t minfs_ino_alloc(minfs_t* fs, minfs_inode_t* inode, uint32_t* ino_out
     // commit blocks to disk
     bcache_put(fs->bc, block_ibm, BLOCK_DIRTY);
     bcache_put(fs->bc, block_ino, BLOCK_DIRTY);
+    pthread_mutex_unlock(&fs->lock);
 
     *ino_out = ino;
     return NO_ERROR;
@@ -125,7 +132,10 @@ mx_status_t minfs_new_vnode(minfs_t* fs, minfs_vnode_t** out, uint32_t type) {
         return ERR_NO_RESOURCES;
     }
     vn->fs = fs;
+    pthread_rwlock_init(&vn->lock, NULL);
+    pthread_mutex_lock(&fs->lock);
     list_add_tail(fs->vnode_hash + INO_HASH(vn->ino), &vn->hashnode);
+    pthread_mutex_unlock(&fs->lock);
 
     trace(MINFS, "new_vnode() %p(#%u) { magic=%#08x }\n",
           vn, vn->ino, vn->inode.magic);
@@ -139,17 +149,29 @@ mx_status_t minfs_del_vnode(minfs_vnode_t* vn) {
     return ERR_NOT_SUPPORTED;
 }
 
+static minfs_vnode_t* minfs_find_vnode(minfs_t* fs, uint32_t ino) {
+    minfs_vnode_t* vn;
+    list_for_every_entry(fs->vnode_hash + INO_HASH(ino), vn, minfs_vnode_t, hashnode) {
+        if (vn->ino == ino) {
+            return vn;
+        }
+    }
+    return NULL;
+}
+
+// The inode is read without the fs lock held, so another thread
+// may get the same one meanwhile, in which case its vnode is used.
 mx_status_t minfs_get_vnode(minfs_t* fs, minfs_vnode_t** out, uint32_t ino) {
     if ((ino < 1) || (ino >= fs->info.inode_count)) {
         return ERR_OUT_OF_RANGE;
     }
     minfs_vnode_t* vn;
-    uint32_t bucket = INO_HASH(ino);
-    list_for_every_entry(fs->vnode_hash + bucket, vn, minfs_vnode_t, hashnode) {
-        if (vn->ino == ino) {
-            *out = vn;
-            return NO_ERROR;
-        }
+    pthread_mutex_lock(&fs->lock);
+    vn = minfs_find_vnode(fs, ino);
+    pthread_mutex_unlock(&fs->lock);
+    if (vn != NULL) {
+        *out = vn;
+        return NO_ERROR;
     }
     if ((vn = calloc(1, sizeof(minfs_vnode_t))) == NULL) {
         return ERR_NO_MEMORY;
@@ -158,6 +180,7 @@ mx_status_t minfs_get_vnode(minfs_t* fs, minfs_vnode_t** out, uint32_t ino) {
     uint32_t ino_per_blk = fs->info.block_size / MINFS_INODE_SIZE;
     if ((status = bcache_read(fs->bc, fs->info.ino_block + ino / ino_per_blk, &vn->inode,
                               MINFS_INODE_SIZE * (ino % ino_per_blk), MINFS_INODE_SIZE)) < 0) {
+        free(vn);
         return status;
     }
     trace(MINFS, "get_vnode() %p(#%u) { magic=%#08x size=%u blks=%u dn=%u,%u,%u,%u... }\n",
@@ -168,7 +191,19 @@ mx_status_t minfs_get_vnode(minfs_t* fs, minfs_vnode_t** out, uint32_t ino) {
     vn->ino = ino;
     vn->vnode.refcount = 1;
     vn->vnode.ops = &minfs_ops;
-    list_add_tail(fs->vnode_hash + bucket, &vn->hashnode);
+    pthread_rwlock_init(&vn->lock, NULL);
+
+    pthread_mutex_lock(&fs->lock);
+    minfs_vnode_t* other;
+    if ((other = minfs_find_vnode(fs, ino)) != NULL) {
+        pthread_mutex_unlock(&fs->lock);
+        pthread_rwlock_destroy(&vn->lock);
+        free(vn);
+        *out = other;
+        return NO_ERROR;
+    }
+    list_add_tail(fs->vnode_hash + INO_HASH(ino), &vn->hashnode);
+    pthread_mutex_unlock(&fs->lock);
 
     *out = vn;
     return NO_ERROR;
@@ -211,6 +246,7 @@ mx_status_t minfs_create(minfs_t** out, bcache_t* bc, minfs_info_t* info) {
     if (fs == NULL) {
         return ERR_NO_MEMORY;
     }
+    pthread_mutex_init(&fs->lock, NULL);
     for (int n = 0; n < MINFS_BUCKETS; n++) {
         list_initialize(fs->vnode_hash + n);
     }
@@ -244,19 +280,16 @@ mx_status_t minfs_create(minfs_t** out, bcache_t* bc, minfs_info_t* info) {
 void minfs_destroy(minfs_t* fs) {
 }
 
+// Each bitmap is read in one request, then summarized for allocation.
 mx_status_t minfs_load_bitmaps(minfs_t* fs) {
-    for (uint32_t n = 0; n < fs->abmblks; n++) {
-        uint32_t mno = n * (MINFS_BLOCK_SIZE / 64);
-        if (bcache_read(fs->bc, fs->info.abm_block + n, fs->block_map.map + mno, 0, MINFS_BLOCK_SIZE)) {
-            error("minfs: failed reading alloc bitmap\n");
-        }
+    if (bcache_read_blocks(fs->bc, fs->info.abm_block, fs->abmblks, fs->block_map.map) < 0) {
+        error("minfs: failed reading alloc bitmap\n");
     }
-    for (uint32_t n = 0; n < fs->ibmblks; n++) {
-        uint32_t mno = n * (MINFS_BLOCK_SIZE / 64);
-        if (bcache_read(fs->bc, fs->info.ibm_block + n, fs->inode_map.map + mno, 0, MINFS_BLOCK_SIZE)) {
-            error("minfs: failed reading inode bitmap\n");
-        }
+    if (bcache_read_blocks(fs->bc, fs->info.ibm_block, fs->ibmblks, fs->inode_map.map) < 0) {
+        error("minfs: failed reading inode bitmap\n");
     }
+    bitmap_update(&fs->block_map);
+    bitmap_update(&fs->inode_map);
     return NO_ERROR;
 }
 
@@ -22,6 +22,7 @@
 
 #define MINFS_DIRECT         16
 #define MINFS_INDIRECT       32
+#define MINFS_BLOCK_PTRS     (MINFS_BLOCK_SIZE / sizeof(uint32_t))
 
 #define MINFS_TYPE_FILE      8
 #define MINFS_TYPE_DIR       4
@@ -98,6 +99,10 @@ typedef struct {
 // - reclen must be a multiple of 4
 
 
+// - file block n is dnum[n] for n < MINFS_DIRECT, after which each
+//   inum[] names a block holding MINFS_BLOCK_PTRS more block numbers
+// - a block number of 0 is a hole, which reads as zeros
+
 // blocksize   8K    16K    32K
 // 16 dir =  128K   256K   512K
 // 32 ind =  512M  1024M  2048M
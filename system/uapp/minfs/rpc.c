@@ -23,6 +23,11 @@ typedef struct iostate {
     size_t io_off;
 } iostate_t;
 
+// Requests are served by this many threads, the one that calls
+// vfs_rpc_server() among them. Each connection's requests are still
+// handled one at a time, in order.
+#define VFS_RPC_THREADS 4
+
 static mxio_dispatcher_t* vfs_dispatcher;
 
 static mx_status_t vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie);
@@ -95,6 +100,10 @@ mx_handle_t vfs_rpc_server(vnode_t* vn, const char* where) {
     }
     //TODO: ref count
     //vn_acquire(vn);
+    if ((r = mxio_dispatcher_start_threads(vfs_dispatcher, VFS_RPC_THREADS - 1)) < 0) {
+        error("minfs: cannot start rpc threads: %d\n", r);
+        return r;
+    }
     mxio_dispatcher_run(vfs_dispatcher);
     return NO_ERROR;
 }
@@ -165,6 +174,27 @@ static mx_status_t vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
         }
         return r;
     }
+    case MXRIO_READ_AT: {
+        if (msg->arg2.off < 0) {
+            return ERR_INVALID_ARGS;
+        }
+        ssize_t r = vn->ops->read(vn, msg->data, arg, msg->arg2.off);
+        if (r >= 0) {
+            msg->arg2.off += r;
+            msg->datalen = r;
+        }
+        return r;
+    }
+    case MXRIO_WRITE_AT: {
+        if (msg->arg2.off < 0) {
+            return ERR_INVALID_ARGS;
+        }
+        ssize_t r = vn->ops->write(vn, msg->data, len, msg->arg2.off);
+        if (r >= 0) {
+            msg->arg2.off += r;
+        }
+        return r;
+    }
     case MXRIO_SEEK: {
         vnattr_t attr;
         mx_status_t r;
@@ -242,6 +272,19 @@ static mx_status_t vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
         }
         return r;
     }
+    case MXRIO_READDIR_ATTR: {
+        if (arg > MXIO_CHUNK_SIZE) {
+            return ERR_INVALID_ARGS;
+        }
+        if (vn->ops->readdir_attr == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        mx_status_t r;
+        if ((r = vn->ops->readdir_attr(vn, &ios->dircookie, msg->data, arg)) >= 0) {
+            msg->datalen = r;
+        }
+        return r;
+    }
     case MXRIO_IOCTL: {
         if (len > MXIO_IOCTL_MAX_INPUT) {
             return ERR_INVALID_ARGS;
@@ -264,12 +307,12 @@ static mx_status_t vfs_handler(mxrio_msg_t* msg, mx_handle_t rh, void* cookie) {
 }
 
 void vn_release(vnode_t* vn) {
-    if (vn->refcount == 0) {
+    uint32_t refcount = __atomic_fetch_sub(&vn->refcount, 1, __ATOMIC_SEQ_CST);
+    if (refcount == 0) {
         printf("vn %p: ref underflow\n", vn);
         *((int*) 0) = 0;
     }
-    vn->refcount--;
-    if (vn->refcount == 0) {
+    if (refcount == 1) {
         vn->ops->release(vn);
     }
 }
\ No newline at end of file
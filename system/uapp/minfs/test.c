@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -23,6 +24,39 @@ int run_fs_tests(void) {
     fd = TRY(open("(@)hello.txt", O_CREAT | O_RDWR, 0644));
     printf("fd %d\n", fd);
 
+    // spans the direct blocks into the first indirect block,
+    // with partial blocks at both ends
+    static char pattern[300 * 1024];
+    static char check[sizeof(pattern)];
+    for (size_t n = 0; n < sizeof(pattern); n++) {
+        pattern[n] = (char)(n * 7 + (n >> 13));
+    }
+    fd = TRY(open("(@)data.bin", O_CREAT | O_RDWR, 0644));
+    TRY(write(fd, "x", 1));
+    if (TRY(write(fd, pattern, sizeof(pattern))) != sizeof(pattern)) {
+        printf("short write\n");
+        exit(1);
+    }
+    TRY(close(fd));
+    fd = TRY(open("(@)data.bin", O_RDWR));
+    if ((TRY(read(fd, check, 1)) != 1) || (check[0] != 'x')) {
+        printf("bad first byte\n");
+        exit(1);
+    }
+    if (TRY(read(fd, check, sizeof(check))) != sizeof(check)) {
+        printf("short read\n");
+        exit(1);
+    }
+    if (memcmp(pattern, check, sizeof(check))) {
+        printf("read back differs\n");
+        exit(1);
+    }
+    if (TRY(read(fd, check, sizeof(check))) != 0) {
+        printf("read past end\n");
+        exit(1);
+    }
+    TRY(close(fd));
+
     TRY(mkdir("(@)folder-one", 0755));
     TRY(mkdir("(@)folder-one/folder-two", 0755));
     TRY(mkdir("(@)folder-one/folder-two/folder-three", 0755));
@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <magenta/types.h>
+#include <mxio/io.h>
 #include <mxio/vfs.h>
 
 
@@ -32,12 +33,22 @@ mx_handle_t vfs_rpc_server(vnode_t* vn, const char* where);
 
 // Allocation Bitmap (bitmap.c)
 
+// Above the map are summary levels, in which a set bit means the
+// word it stands for in the level below is full, so that finding a
+// free bit skips 64 full words per summary bit, and 4096 per bit of
+// the level above that. Enough levels are kept to bring the top one
+// down to a single word.
+#define BITMAP_LEVELS 6
+
 typedef struct bitmap bitmap_t;
 struct bitmap {
     uint32_t bitcount;
     uint32_t mapcount;
     uint64_t *map;
     uint64_t *end;
+    uint32_t levels;                 // including the map itself
+    uint64_t* level[BITMAP_LEVELS];  // level[0] is map
+    uint32_t words[BITMAP_LEVELS];   // in each level
 };
 
 mx_status_t bitmap_init(bitmap_t* bm, uint32_t maxbits);
@@ -50,14 +61,27 @@ void bitmap_destroy(bitmap_t* bm);
 // to a maximum allowed bit smaller than the storage)
 mx_status_t bitmap_resize(bitmap_t* bm, uint32_t maxbits);
 
+// Recompute the summary levels, after changing the map directly
+// rather than through bitmap_set(), bitmap_clr(), or bitmap_alloc().
+void bitmap_update(bitmap_t* bm);
+
+// Record that word n of the map has become full, or no longer is.
+void bitmap_word_full(bitmap_t* bm, uint32_t n);
+void bitmap_word_free(bitmap_t* bm, uint32_t n);
+
 static inline void bitmap_set(bitmap_t* bm, uint32_t n) {
     if (n < bm->bitcount) {
-        bm->map[n >> 6] |= (1ULL << (n & 63));
+        if ((bm->map[n >> 6] |= (1ULL << (n & 63))) == ~0ULL) {
+            bitmap_word_full(bm, n >> 6);
+        }
     }
 }
 
 static inline void bitmap_clr(bitmap_t* bm, uint32_t n) {
     if (n < bm->bitcount) {
+        if (bm->map[n >> 6] == ~0ULL) {
+            bitmap_word_free(bm, n >> 6);
+        }
         bm->map[n >> 6] &= ~((1ULL << (n & 63)));
     }
 }
@@ -99,11 +123,24 @@ block_t* bcache_get(bcache_t* bc, uint32_t bno, void** bdata);
 block_t* bcache_get_zero(bcache_t* bc, uint32_t bno, void** block);
 
 // release a block back to the cache
-// flags *must* contain BLOCK_DIRTY if it was modified
+// flags *must* contain BLOCK_DIRTY if it was modified,
+// in which case it is written back later
 void bcache_put(bcache_t* bc, block_t* blk, uint32_t flags);
 
+// wait for all dirty blocks to be written back, returning
+// an error if any write since the last sync failed
+mx_status_t bcache_sync(bcache_t* bc);
+
+// fill out stats, see IOCTL_FS_GET_CACHE_STATS
+void bcache_get_stats(bcache_t* bc, mxio_cache_stats_t* stats);
+
 mx_status_t bcache_read(bcache_t* bc, uint32_t bno, void* data, uint32_t off, uint32_t len);
 
+// transfer count contiguous blocks directly between the disk and data,
+// without holding them in the cache
+mx_status_t bcache_read_blocks(bcache_t* bc, uint32_t bno, uint32_t count, void* data);
+mx_status_t bcache_write_blocks(bcache_t* bc, uint32_t bno, uint32_t count, const void* data);
+
 uint32_t bcache_max_block(bcache_t* bc);
 
 
@@ -15,6 +15,7 @@
 
 #include <launchpad/launchpad.h>
 #include <magenta/syscalls.h>
+#include <mxio/io.h>
 #include <mxio/vfs.h>
 #include <ddk/hexdump.h>
 #include <system/listnode.h>
@@ -101,8 +102,6 @@ static const char* modestr(uint32_t mode) {
 static int mxc_ls(int argc, char** argv) {
     const char* dirn;
     struct stat s;
-    char tmp[2048];
-    size_t dirln;
     struct dirent* de;
     DIR* dir;
 
@@ -115,7 +114,6 @@ static int mxc_ls(int argc, char** argv) {
     } else {
         dirn = argv[1];
     }
-    dirln = strlen(dirn);
 
     if (argc > 2) {
         fprintf(stderr, "usage: ls [ <directory> ]\n");
@@ -125,12 +123,7 @@ static int mxc_ls(int argc, char** argv) {
         fprintf(stderr, "error: cannot open '%s'\n", dirn);
         return -1;
     }
-    while((de = readdir(dir)) != NULL) {
-        memset(&s, 0, sizeof(struct stat));
-        if ((strlen(de->d_name) + dirln + 2) <= sizeof(tmp)) {
-            snprintf(tmp, sizeof(tmp), "%s/%s", dirn, de->d_name);
-            stat(tmp, &s);
-        }
+    while((de = mxio_readdir_stat(dir, &s)) != NULL) {
         printf("%s %8llu %s\n", modestr(s.st_mode), s.st_size, de->d_name);
     }
     closedir(dir);
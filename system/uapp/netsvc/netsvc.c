@@ -24,35 +24,49 @@
 
 static mx_handle_t loghandle;
 
+// records read ahead of the lines asked for, a bufferful at a time
+static uint64_t logbuf[4096 / sizeof(uint64_t)];
+static mx_log_record_t* lognext;
+static int logcount;
+
 int get_log_line(char* out) {
-    char buf[MX_LOG_RECORD_MAX + 1];
-    mx_log_record_t* rec = (mx_log_record_t*)buf;
-    if (mx_log_read(loghandle, MX_LOG_RECORD_MAX, rec, 0) > 0) {
-        if (rec->datalen && (rec->data[rec->datalen - 1] == '\n')) {
-            rec->datalen--;
+    if (logcount == 0) {
+        logcount = mx_log_read(loghandle, sizeof(logbuf), logbuf, MX_LOG_FLAG_MANY);
+        if (logcount <= 0) {
+            logcount = 0;
+            return 0;
         }
-        rec->data[rec->datalen] = 0;
-        snprintf(out, MAX_LOG_LINE, "[%05d.%03d] %c %s\n",
-                 (int)(rec->timestamp / 1000000000ULL),
-                 (int)((rec->timestamp / 1000000ULL) % 1000ULL),
-                 (rec->flags & MX_LOG_FLAG_KERNEL) ? 'K' : 'U',
-                 rec->data);
-        return strlen(out);
-    } else {
-        return 0;
+        lognext = (mx_log_record_t*)logbuf;
     }
-}
-
-#define MAX_LOG_DATA 1280
+    mx_log_record_t* rec = lognext;
+    lognext = (mx_log_record_t*)((char*)rec + MX_LOG_RECORD_SIZE(rec));
+    logcount--;
 
-typedef struct logpacket {
-    uint32_t magic;
-    uint32_t seqno;
-    char data[MAX_LOG_DATA];
-} logpacket_t;
+    int datalen = rec->datalen;
+    if (datalen && (rec->data[datalen - 1] == '\n')) {
+        datalen--;
+    }
+    snprintf(out, MAX_LOG_LINE, "[%05d.%03d] %c %.*s\n",
+             (int)(rec->timestamp / 1000000000ULL),
+             (int)((rec->timestamp / 1000000ULL) % 1000ULL),
+             (rec->flags & MX_LOG_FLAG_KERNEL) ? 'K' : 'U',
+             datalen, rec->data);
+    return strlen(out);
+}
 
+// packets acked + 1 up to seqno - 1 are in flight
+static logpacket_t logpkts[DEBUGLOG_WINDOW];
+static size_t loglens[DEBUGLOG_WINDOW];
 static volatile uint32_t seqno = 1;
-static volatile uint32_t pending = 0;
+static volatile uint32_t acked = 0;
+// one until the listener shows it acks cumulatively
+static volatile uint32_t logwindow = 1;
+static volatile bool logresend = false;
+
+static void log_send(uint32_t n) {
+    udp6_send(&logpkts[n % DEBUGLOG_WINDOW], loglens[n % DEBUGLOG_WINDOW],
+              &ip6_ll_all_nodes, DEBUGLOG_PORT, DEBUGLOG_ACK_PORT);
+}
 
 void run_command(const char* cmd) {
     printf("net cmd: %s\n", cmd);
@@ -132,19 +146,30 @@ void udp6_recv(void* data, size_t len,
     }
 
     if (dport == DEBUGLOG_ACK_PORT) {
-        if ((len != 8) || mcast) {
+        if (((len != 8) && (len != sizeof(logack_t))) || mcast) {
             return;
         }
-        logpacket_t* pkt = data;
-        if ((pkt->magic != 0xaeae1123) || (pkt->seqno != seqno)) {
+        logack_t* ack = data;
+        if (ack->magic != DEBUGLOG_MAGIC) {
             return;
         }
-        if (pending) {
-            seqno++;
-            pending = 0;
-            // ensure we stop polling
-            netifc_set_timer(0);
+        // only acks of what is in flight count
+        uint32_t n = ack->seqno - acked;
+        if (n > seqno - 1 - acked) {
+            return;
+        }
+        if (len == sizeof(logack_t)) {
+            logwindow = DEBUGLOG_WINDOW;
+            if (ack->flags & DEBUGLOG_RESEND) {
+                logresend = true;
+            }
         }
+        if ((n == 0) && !logresend) {
+            return;
+        }
+        acked = ack->seqno;
+        // ensure we stop polling
+        netifc_set_timer(0);
     }
 }
 
@@ -152,8 +177,7 @@ void udp6_recv(void* data, size_t len,
 
 int main(int argc, char** argv) {
     mx_time_t delay = TIME_MS(200);
-    logpacket_t pkt;
-    int len = 0;
+    mx_time_t logsent = 0;
     if ((loghandle = mx_log_create(MX_LOG_FLAG_READABLE)) < 0) {
         return -1;
     }
@@ -172,29 +196,35 @@ int main(int argc, char** argv) {
 
     printf("netsvc: start\n");
     for (;;) {
-        if (pending == 0) {
-            pkt.magic = 0xaeae1123;
-            pkt.seqno = seqno;
-            len = 0;
+        // fill the window with whatever has been logged
+        while (seqno - 1 - acked < logwindow) {
+            logpacket_t* pkt = &logpkts[seqno % DEBUGLOG_WINDOW];
+            int len = 0;
             while (len < (MAX_LOG_DATA - MAX_LOG_LINE)) {
-                int r = get_log_line(pkt.data + len);
+                int r = get_log_line(pkt->data + len);
                 if (r > 0) {
                     len += r;
                 } else {
                     break;
                 }
             }
-            if (len) {
-                len += 8;
-                pending = 1;
-                goto transmit;
+            if (len == 0) {
+                break;
             }
+            pkt->magic = DEBUGLOG_MAGIC;
+            pkt->seqno = seqno;
+            loglens[seqno % DEBUGLOG_WINDOW] = 8 + len;
+            log_send(seqno++);
+            logsent = mx_current_time();
         }
-        if (netifc_timer_expired()) {
-        transmit:
-            if (pending) {
-                udp6_send(&pkt, 8 + len, &ip6_ll_all_nodes, DEBUGLOG_PORT, DEBUGLOG_ACK_PORT);
+        // resend what's in flight when asked to, or when it goes unacked
+        if ((acked + 1 != seqno) &&
+            (logresend || (mx_current_time() - logsent >= TIME_MS(100)))) {
+            logresend = false;
+            for (uint32_t n = acked + 1; n != seqno; n++) {
+                log_send(n);
             }
+            logsent = mx_current_time();
         }
         //TODO: wakeup early for log traffic too
         netifc_set_timer(100);
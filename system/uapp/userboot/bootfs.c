@@ -9,6 +9,7 @@
 
 #include <magenta/syscalls.h>
 #include <string.h>
+#include <system/bootfs.h>
 
 #pragma GCC visibility pop
 
@@ -19,6 +20,7 @@ void bootfs_mount(mx_handle_t log, mx_handle_t vmo, struct bootfs *fs) {
     uintptr_t addr = 0;
     status = mx_process_vm_map(0, vmo, 0, size, &addr, MX_VM_FLAG_PERM_READ);
     check(log, status, "mx_process_vm_map failed on bootfs vmo\n");
+    fs->vmo = vmo;
     fs->contents =  (const void*)addr;
     fs->len = size;
 }
@@ -74,6 +76,35 @@ static struct bootfs_file bootfs_search(mx_handle_t log,
     return runt;
 }
 
+// Compressed files get a vmo of their own, filled in here.
+static mx_handle_t bootfs_open_compressed(mx_handle_t log, struct bootfs *fs,
+                                          struct bootfs_file file) {
+    const uint8_t* frame = &fs->contents[file.offset];
+    size_t frame_len = fs->len - file.offset;
+    int64_t blocks = bootfs_lz4_blocks(frame, frame_len, file.size);
+    if (blocks < 0)
+        fail(log, ERR_INVALID_ARGS, "bogus compressed file in bootfs!\n");
+
+    mx_handle_t vmo = mx_vm_object_create(file.size);
+    if (vmo < 0)
+        fail(log, vmo, "mx_vm_object_create failed\n");
+    if (file.size == 0)
+        return vmo;
+
+    uintptr_t addr = 0;
+    mx_status_t status = mx_process_vm_map(0, vmo, 0, file.size, &addr,
+                                           MX_VM_FLAG_PERM_READ |
+                                           MX_VM_FLAG_PERM_WRITE);
+    check(log, status, "mx_process_vm_map failed on decompressed file\n");
+    if (bootfs_lz4_decode(frame, frame_len, file.size, 0, blocks,
+                          (uint8_t*)addr) < 0)
+        fail(log, ERR_IO, "corrupt compressed file in bootfs!\n");
+    status = mx_process_vm_unmap(0, addr, 0);
+    check(log, status, "mx_process_vm_unmap failed\n");
+
+    return vmo;
+}
+
 mx_handle_t bootfs_open(mx_handle_t log,
                         struct bootfs *fs, const char* filename) {
     print(log, "searching bootfs for \"", filename, "\"\n", NULL);
@@ -81,12 +112,24 @@ mx_handle_t bootfs_open(mx_handle_t log,
     struct bootfs_file file = bootfs_search(log, fs, filename);
     if (file.offset == 0 && file.size == 0)
         fail(log, ERR_INVALID_ARGS, "file not found\n");
+    uint32_t flags = file.offset & BOOTFS_FLAGS_MASK;
+    file.offset -= flags;
     if (file.offset > fs->len)
         fail(log, ERR_INVALID_ARGS, "bogus offset in bootfs header!\n");
+
+    if (flags & BOOTFS_FLAG_COMPRESSED)
+        return bootfs_open_compressed(log, fs, file);
+
     if (fs->len - file.offset < file.size)
         fail(log, ERR_INVALID_ARGS, "bogus size in bootfs header!\n");
 
-    mx_handle_t vmo = mx_vm_object_create(file.size);
+    // mkbootfs page aligns every file, so the file can share the image's
+    // pages rather than get a copy of them
+    mx_handle_t vmo = mx_vm_object_slice(fs->vmo, file.offset, file.size);
+    if (vmo >= 0)
+        return vmo;
+
+    vmo = mx_vm_object_create(file.size);
     if (vmo < 0)
         fail(log, vmo, "mx_vm_object_create failed\n");
     mx_ssize_t n = mx_vm_object_write(vmo, &fs->contents[file.offset],
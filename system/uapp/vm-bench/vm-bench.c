@@ -0,0 +1,204 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/syscalls.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <system/compiler.h>
+
+// Page faults, mapping and vm object copies as seen from userspace. The
+// kernel console's vm_bench does the same without the syscalls in the way.
+
+#define PAGE 4096u
+
+#define PERM (MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE)
+
+static void report(const char* what, uint64_t count, const char* unit, mx_time_t t) {
+    if (t == 0) {
+        t = 1;
+    }
+    printf("%-24s %8llu %-8s %10llu ns/%s %10llu %s/s\n", what, (unsigned long long)count, unit,
+           (unsigned long long)(t / count), unit,
+           (unsigned long long)(count * 1000000000ULL / t), unit);
+}
+
+static void fail(const char* what, mx_status_t status) {
+    printf("vm-bench: %s failed (%d)\n", what, status);
+    exit(1);
+}
+
+static uintptr_t map(mx_handle_t vmo, size_t len, uint32_t flags) {
+    uintptr_t ptr;
+    mx_status_t status = mx_process_vm_map(0, vmo, 0, len, &ptr, flags);
+    if (status < 0) {
+        fail("map", status);
+    }
+    return ptr;
+}
+
+// touch every page of a fresh vm object
+static mx_time_t fault_pages(size_t pages) {
+    mx_handle_t vmo = mx_vm_object_create(pages * PAGE);
+    if (vmo < 0) {
+        fail("vm object create", vmo);
+    }
+    volatile uint8_t* p = (volatile uint8_t*)map(vmo, pages * PAGE, PERM);
+
+    mx_time_t t = mx_current_time();
+    for (size_t i = 0; i < pages; i++) {
+        p[i * PAGE] = 1;
+    }
+    t = mx_current_time() - t;
+
+    mx_process_vm_unmap(0, (uintptr_t)p, pages * PAGE);
+    mx_handle_close(vmo);
+    return t;
+}
+
+static void bench_faults(void) {
+    static const size_t pages[] = {16, 256, 4096};
+    for (size_t i = 0; i < countof(pages); i++) {
+        report("fault", pages[i], "page", fault_pages(pages[i]));
+    }
+}
+
+// map and unmap one page of a vm object, count times each, with spinner
+// threads running so that unmapping has other cpus' tlbs to shoot down
+static volatile bool spinning;
+
+static void* spinner(void* arg) {
+    while (spinning) {
+        __asm__ volatile("" ::: "memory");
+    }
+    return NULL;
+}
+
+static void bench_map_unmap(size_t spinners) {
+    static const size_t regions[] = {1, 64, 1024};
+    mx_handle_t vmo = mx_vm_object_create(PAGE);
+    if (vmo < 0) {
+        fail("vm object create", vmo);
+    }
+
+    pthread_t threads[spinners ? spinners : 1];
+    spinning = true;
+    for (size_t i = 0; i < spinners; i++) {
+        pthread_create(&threads[i], NULL, spinner, NULL);
+    }
+
+    for (size_t r = 0; r < countof(regions); r++) {
+        size_t count = regions[r];
+        uintptr_t* ptrs = calloc(count, sizeof(uintptr_t));
+        if (!ptrs) {
+            fail("alloc", ERR_NO_MEMORY);
+        }
+
+        mx_time_t t = mx_current_time();
+        for (size_t i = 0; i < count; i++) {
+            ptrs[i] = map(vmo, PAGE, PERM | MX_VM_FLAG_MAP_POPULATE);
+        }
+        t = mx_current_time() - t;
+        char what[32];
+        snprintf(what, sizeof(what), "map (%zu spinning)", spinners);
+        report(what, count, "region", t);
+
+        t = mx_current_time();
+        for (size_t i = 0; i < count; i++) {
+            mx_process_vm_unmap(0, ptrs[i], PAGE);
+        }
+        t = mx_current_time() - t;
+        snprintf(what, sizeof(what), "unmap (%zu spinning)", spinners);
+        report(what, count, "region", t);
+
+        free(ptrs);
+    }
+
+    spinning = false;
+    for (size_t i = 0; i < spinners; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    mx_handle_close(vmo);
+}
+
+static void bench_vmo_read_write(void) {
+    const size_t size = 16 * 1024 * 1024;
+    const size_t chunk = 64 * 1024;
+    mx_handle_t vmo = mx_vm_object_create(size);
+    if (vmo < 0) {
+        fail("vm object create", vmo);
+    }
+    uint8_t* buf = malloc(chunk);
+    if (!buf) {
+        fail("alloc", ERR_NO_MEMORY);
+    }
+    memset(buf, 0x5a, chunk);
+
+    // the first pass commits the pages, the second is the copy alone
+    for (int pass = 0; pass < 2; pass++) {
+        mx_time_t t = mx_current_time();
+        for (size_t off = 0; off < size; off += chunk) {
+            mx_vm_object_write(vmo, buf, off, chunk);
+        }
+        t = mx_current_time() - t;
+        report(pass ? "vmo write" : "vmo write (commit)", size / 1024, "KB", t);
+    }
+
+    mx_time_t t = mx_current_time();
+    for (size_t off = 0; off < size; off += chunk) {
+        mx_vm_object_read(vmo, buf, off, chunk);
+    }
+    t = mx_current_time() - t;
+    report("vmo read", size / 1024, "KB", t);
+
+    free(buf);
+    mx_handle_close(vmo);
+}
+
+// every thread faults in its own vm object, all in the one aspace at once
+#define SCALE_PAGES 1024
+
+static pthread_barrier_t scale_barrier;
+
+static void* fault_thread(void* arg) {
+    pthread_barrier_wait(&scale_barrier);
+    fault_pages(SCALE_PAGES);
+    return NULL;
+}
+
+static void bench_fault_scaling(void) {
+    unsigned cpus = mx_num_cpus();
+    for (unsigned n = 1; n <= cpus; n *= 2) {
+        pthread_t threads[n];
+        pthread_barrier_init(&scale_barrier, NULL, n + 1);
+        for (unsigned i = 0; i < n; i++) {
+            pthread_create(&threads[i], NULL, fault_thread, NULL);
+        }
+
+        mx_time_t t = mx_current_time();
+        pthread_barrier_wait(&scale_barrier);
+        for (unsigned i = 0; i < n; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        t = mx_current_time() - t;
+        pthread_barrier_destroy(&scale_barrier);
+
+        char what[32];
+        snprintf(what, sizeof(what), "fault x%u threads", n);
+        report(what, (uint64_t)n * SCALE_PAGES, "page", t);
+    }
+}
+
+int main(int argc, char** argv) {
+    bench_faults();
+    bench_map_unmap(0);
+    if (mx_num_cpus() > 1) {
+        bench_map_unmap(mx_num_cpus() - 1);
+    }
+    bench_vmo_read_write();
+    bench_fault_scaling();
+    return 0;
+}
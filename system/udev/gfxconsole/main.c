@@ -95,7 +95,8 @@ static int vc_input_thread(void* arg) {
     assert(listener->fd >= 0);
     xprintf("vc: input thread started for %s\n", listener->dev_name);
 
-    uint8_t report_buf[8];
+    // a batch of reports at a time
+    uint8_t reports[sizeof(boot_kbd_report_t) * 16];
     hid_keys_t key_state[2];
     hid_keys_t key_delta;
     memset(&key_state[0], 0, sizeof(hid_keys_t));
@@ -106,134 +107,134 @@ static int vc_input_thread(void* arg) {
 
     for (;;) {
         mxio_wait_fd(listener->fd, MXIO_EVT_READABLE, NULL, MX_TIME_INFINITE);
-        int r = read(listener->fd, report_buf, sizeof(report_buf));
+        int r = read(listener->fd, reports, sizeof(reports));
         if (r < 0) {
             break; // will be restarted by poll thread if needed
         }
-        if ((size_t)(r) != sizeof(report_buf)) {
-            continue;
-        }
-        // eat the input if there is no active vc
-        if (!active_vc) continue;
-        // process the key
-        int consumed = 0;
-        uint8_t keycode;
-        hid_kbd_parse_report(report_buf, &key_state[cur_idx]);
-
-        hid_kbd_pressed_keys(&key_state[prev_idx], &key_state[cur_idx], &key_delta);
-        hid_for_every_key(&key_delta, keycode) {
-            switch (keycode) {
-            // modifier keys are special
-            case HID_USAGE_KEY_LEFT_SHIFT:
-                modifiers |= MOD_LSHIFT;
-                break;
-            case HID_USAGE_KEY_RIGHT_SHIFT:
-                modifiers |= MOD_RSHIFT;
-                break;
-            case HID_USAGE_KEY_LEFT_ALT:
-                modifiers |= MOD_LALT;
-                break;
-            case HID_USAGE_KEY_RIGHT_ALT:
-                modifiers |= MOD_RALT;
-                break;
-            case HID_USAGE_KEY_LEFT_CTRL:
-                modifiers |= MOD_LCTRL;
-                break;
-            case HID_USAGE_KEY_RIGHT_CTRL:
-                modifiers |= MOD_RCTRL;
-                break;
-
-            case HID_USAGE_KEY_F1:
-                vc_set_active_console(active_vc_index == 0 ? vc_count - 1 : active_vc_index - 1);
-                consumed = 1;
-                break;
-            case HID_USAGE_KEY_F2:
-                vc_set_active_console(active_vc_index == vc_count - 1 ? 0 : active_vc_index + 1);
-                consumed = 1;
-                break;
+        for (int off = 0; off + (int)sizeof(boot_kbd_report_t) <= r; off += sizeof(boot_kbd_report_t)) {
+            uint8_t* report_buf = reports + off;
+            // eat the input if there is no active vc
+            if (!active_vc) continue;
+            // process the key
+            int consumed = 0;
+            uint8_t keycode;
+            hid_kbd_parse_report(report_buf, &key_state[cur_idx]);
+
+            hid_kbd_pressed_keys(&key_state[prev_idx], &key_state[cur_idx], &key_delta);
+            hid_for_every_key(&key_delta, keycode) {
+                switch (keycode) {
+                // modifier keys are special
+                case HID_USAGE_KEY_LEFT_SHIFT:
+                    modifiers |= MOD_LSHIFT;
+                    break;
+                case HID_USAGE_KEY_RIGHT_SHIFT:
+                    modifiers |= MOD_RSHIFT;
+                    break;
+                case HID_USAGE_KEY_LEFT_ALT:
+                    modifiers |= MOD_LALT;
+                    break;
+                case HID_USAGE_KEY_RIGHT_ALT:
+                    modifiers |= MOD_RALT;
+                    break;
+                case HID_USAGE_KEY_LEFT_CTRL:
+                    modifiers |= MOD_LCTRL;
+                    break;
+                case HID_USAGE_KEY_RIGHT_CTRL:
+                    modifiers |= MOD_RCTRL;
+                    break;
 
-            case HID_USAGE_KEY_UP:
-                if (modifiers & MOD_LALT || modifiers & MOD_RALT) {
-                    vc_device_scroll_viewport(active_vc, -1);
+                case HID_USAGE_KEY_F1:
+                    vc_set_active_console(active_vc_index == 0 ? vc_count - 1 : active_vc_index - 1);
                     consumed = 1;
-                }
-                break;
-            case HID_USAGE_KEY_DOWN:
-                if (modifiers & MOD_LALT || modifiers & MOD_RALT) {
-                    vc_device_scroll_viewport(active_vc, 1);
-                    consumed = 1;
-                }
-                break;
-            case HID_USAGE_KEY_PAGEUP:
-                if (modifiers & MOD_LSHIFT || modifiers & MOD_RSHIFT) {
-                    vc_device_scroll_viewport(active_vc, -(active_vc->rows / 2));
-                    consumed = 1;
-                }
-                break;
-            case HID_USAGE_KEY_PAGEDOWN:
-                if (modifiers & MOD_LSHIFT || modifiers & MOD_RSHIFT) {
-                    vc_device_scroll_viewport(active_vc, active_vc->rows / 2);
+                    break;
+                case HID_USAGE_KEY_F2:
+                    vc_set_active_console(active_vc_index == vc_count - 1 ? 0 : active_vc_index + 1);
                     consumed = 1;
-                }
-                break;
+                    break;
 
-            case HID_USAGE_KEY_DELETE:
-                // Provide a CTRL-ALT-DEL reboot sequence
-                if ((modifiers & (MOD_LCTRL | MOD_RCTRL)) &&
-                    (modifiers & (MOD_LALT | MOD_RALT))) {
-                    // TODO: make this real
-                    mx_debug_send_command("reboot", strlen("reboot"));
-                    consumed = 1;
-                }
-                break;
+                case HID_USAGE_KEY_UP:
+                    if (modifiers & MOD_LALT || modifiers & MOD_RALT) {
+                        vc_device_scroll_viewport(active_vc, -1);
+                        consumed = 1;
+                    }
+                    break;
+                case HID_USAGE_KEY_DOWN:
+                    if (modifiers & MOD_LALT || modifiers & MOD_RALT) {
+                        vc_device_scroll_viewport(active_vc, 1);
+                        consumed = 1;
+                    }
+                    break;
+                case HID_USAGE_KEY_PAGEUP:
+                    if (modifiers & MOD_LSHIFT || modifiers & MOD_RSHIFT) {
+                        vc_device_scroll_viewport(active_vc, -(active_vc->rows / 2));
+                        consumed = 1;
+                    }
+                    break;
+                case HID_USAGE_KEY_PAGEDOWN:
+                    if (modifiers & MOD_LSHIFT || modifiers & MOD_RSHIFT) {
+                        vc_device_scroll_viewport(active_vc, active_vc->rows / 2);
+                        consumed = 1;
+                    }
+                    break;
 
-            // eat everything else
-            default:; // nothing
+                case HID_USAGE_KEY_DELETE:
+                    // Provide a CTRL-ALT-DEL reboot sequence
+                    if ((modifiers & (MOD_LCTRL | MOD_RCTRL)) &&
+                        (modifiers & (MOD_LALT | MOD_RALT))) {
+                        // TODO: make this real
+                        mx_debug_send_command("reboot", strlen("reboot"));
+                        consumed = 1;
+                    }
+                    break;
+
+                // eat everything else
+                default:; // nothing
+                }
             }
-        }
 
-        hid_kbd_released_keys(&key_state[prev_idx], &key_state[cur_idx], &key_delta);
-        hid_for_every_key(&key_delta, keycode) {
-            switch (keycode) {
-            // modifier keys are special
-            case HID_USAGE_KEY_LEFT_SHIFT:
-                modifiers &= ~MOD_LSHIFT;
-                break;
-            case HID_USAGE_KEY_RIGHT_SHIFT:
-                modifiers &= ~MOD_RSHIFT;
-                break;
-            case HID_USAGE_KEY_LEFT_ALT:
-                modifiers &= ~MOD_LALT;
-                break;
-            case HID_USAGE_KEY_RIGHT_ALT:
-                modifiers &= ~MOD_RALT;
-                break;
-            case HID_USAGE_KEY_LEFT_CTRL:
-                modifiers &= ~MOD_LCTRL;
-                break;
-            case HID_USAGE_KEY_RIGHT_CTRL:
-                modifiers &= ~MOD_RCTRL;
-                break;
+            hid_kbd_released_keys(&key_state[prev_idx], &key_state[cur_idx], &key_delta);
+            hid_for_every_key(&key_delta, keycode) {
+                switch (keycode) {
+                // modifier keys are special
+                case HID_USAGE_KEY_LEFT_SHIFT:
+                    modifiers &= ~MOD_LSHIFT;
+                    break;
+                case HID_USAGE_KEY_RIGHT_SHIFT:
+                    modifiers &= ~MOD_RSHIFT;
+                    break;
+                case HID_USAGE_KEY_LEFT_ALT:
+                    modifiers &= ~MOD_LALT;
+                    break;
+                case HID_USAGE_KEY_RIGHT_ALT:
+                    modifiers &= ~MOD_RALT;
+                    break;
+                case HID_USAGE_KEY_LEFT_CTRL:
+                    modifiers &= ~MOD_LCTRL;
+                    break;
+                case HID_USAGE_KEY_RIGHT_CTRL:
+                    modifiers &= ~MOD_RCTRL;
+                    break;
 
-            default:; // nothing
+                default:; // nothing
+                }
             }
-        }
 
-        if (!consumed) {
-            // TODO: decouple char device from actual device
-            // TODO: ensure active vc can't change while this is going on
-            mxr_mutex_lock(&active_vc->fifo.lock);
-            if ((mx_hid_fifo_size(&active_vc->fifo) == 0) && (active_vc->charcount == 0)) {
-                active_vc->flags |= VC_FLAG_RESETSCROLL;
-                device_state_set(&active_vc->device, DEV_STATE_READABLE);
+            if (!consumed) {
+                // TODO: decouple char device from actual device
+                // TODO: ensure active vc can't change while this is going on
+                mxr_mutex_lock(&active_vc->fifo.lock);
+                if ((mx_hid_fifo_size(&active_vc->fifo) == 0) && (active_vc->charcount == 0)) {
+                    active_vc->flags |= VC_FLAG_RESETSCROLL;
+                    device_state_set(&active_vc->device, DEV_STATE_READABLE);
+                }
+                mx_hid_fifo_write(&active_vc->fifo, report_buf, sizeof(boot_kbd_report_t));
+                mxr_mutex_unlock(&active_vc->fifo.lock);
             }
-            mx_hid_fifo_write(&active_vc->fifo, report_buf, sizeof(report_buf));
-            mxr_mutex_unlock(&active_vc->fifo.lock);
-        }
 
-        // swap key states
-        cur_idx = 1 - cur_idx;
-        prev_idx = 1 - prev_idx;
+            // swap key states
+            cur_idx = 1 - cur_idx;
+            prev_idx = 1 - prev_idx;
+        }
     }
     close(listener->fd);
     listener->fd = -1;
@@ -590,15 +591,11 @@ static ssize_t vc_device_read(mx_device_t* dev, void* buf, size_t count, mx_off_
 static ssize_t vc_device_write(mx_device_t* dev, const void* buf, size_t count, mx_off_t off) {
     vc_device_t* vc = get_vc_device(dev);
     mxr_mutex_lock(&vc->lock);
-    vc->invy0 = vc->rows + 1;
-    vc->invy1 = -1;
     const uint8_t* str = (const uint8_t*)buf;
     for (size_t i = 0; i < count; i++) {
         vc->textcon.putc(&vc->textcon, str[i]);
     }
-    if (vc->invy1 >= 0) {
-        vc_gfx_invalidate(vc, 0, vc->invy0, vc->columns, vc->invy1 - vc->invy0);
-    }
+    vc_device_flush(vc);
     if (!vc->active && !(vc->flags & VC_FLAG_HASINPUT)) {
         vc->flags |= VC_FLAG_HASINPUT;
         vc_device_write_status(vc);
@@ -638,6 +635,18 @@ static ssize_t vc_device_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, s
     case DISPLAY_OP_FLUSH_FB:
         vc_gfx_invalidate_all(vc);
         return NO_ERROR;
+    case DISPLAY_OP_FLUSH_FB_REGION: {
+        if (cmdlen < sizeof(ioctl_display_region_t)) {
+            return ERR_INVALID_ARGS;
+        }
+        const ioctl_display_region_t* rect = cmd;
+        if ((rect->x > vc->gfx->width) || (rect->width > vc->gfx->width - rect->x) ||
+            (rect->y > vc->gfx->height) || (rect->height > vc->gfx->height - rect->y)) {
+            return ERR_INVALID_ARGS;
+        }
+        vc_gfx_invalidate_region(vc, rect->x, rect->y, rect->width, rect->height);
+        return NO_ERROR;
+    }
     default:
         return ERR_NOT_SUPPORTED;
     }
@@ -708,16 +717,18 @@ static int vc_log_reader_thread(void* arg) {
     char buf[MX_LOG_RECORD_MAX];
     mx_log_record_t* rec = (mx_log_record_t*)buf;
     while (mx_log_read(h, MX_LOG_RECORD_MAX, rec, MX_LOG_FLAG_WAIT) > 0) {
-        char tmp[64];
-        snprintf(tmp, 64, "[%05d.%03d] %c ",
-                 (int)(rec->timestamp / 1000000000ULL),
-                 (int)((rec->timestamp / 1000000ULL) % 1000ULL),
-                 (rec->flags & MX_LOG_FLAG_KERNEL) ? 'K' : 'U');
-        vc_device_write(dev, tmp, strlen(tmp), 0);
-        vc_device_write(dev, rec->data, rec->datalen, 0);
+        // one write per record, so the screen is updated once
+        char tmp[64 + MX_LOG_RECORD_MAX + 1];
+        size_t len = snprintf(tmp, 64, "[%05d.%03d] %c ",
+                              (int)(rec->timestamp / 1000000000ULL),
+                              (int)((rec->timestamp / 1000000ULL) % 1000ULL),
+                              (rec->flags & MX_LOG_FLAG_KERNEL) ? 'K' : 'U');
+        memcpy(tmp + len, rec->data, rec->datalen);
+        len += rec->datalen;
         if ((rec->datalen == 0) || (rec->data[rec->datalen - 1] != '\n')) {
-            vc_device_write(dev, "\n", 1, 0);
+            tmp[len++] = '\n';
         }
+        vc_device_write(dev, tmp, len, 0);
     }
     return 0;
 }
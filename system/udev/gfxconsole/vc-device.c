@@ -63,6 +63,14 @@ static mx_status_t vc_device_setup(vc_device_t* dev) {
         return ERR_NO_MEMORY;
     }
 
+    // allocate the dirty spans
+    dev->dirty = calloc(dev->rows, sizeof(vc_dirty_t));
+    if (!dev->dirty) {
+        free(dev->scrollback_buf);
+        free(dev->text_buf);
+        return ERR_NO_MEMORY;
+    }
+
     // set up the default palette
     memcpy(&dev->palette, default_palette, sizeof(default_palette));
     dev->front_color = DEFAULT_FRONT_COLOR;
@@ -90,7 +98,8 @@ static void vc_device_invalidate(void* cookie, int x0, int y0, int w, int h) {
     }
 }
 
-// implement tc callbacks:
+// Output is drawn lazily: textcon callbacks only mark cells dirty and
+// note scrolls, and vc_device_flush() draws and copies out the lot.
 
 static inline void vc_invalidate_lines(vc_device_t* dev, int y, int h) {
     if (y < dev->invy0) {
@@ -102,6 +111,68 @@ static inline void vc_invalidate_lines(vc_device_t* dev, int y, int h) {
     }
 }
 
+static void vc_dirty_cells(vc_device_t* dev, int x, int y, int w) {
+    if ((y < 0) || (y >= (int)dev->rows)) {
+        return;
+    }
+    vc_dirty_t* d = &dev->dirty[y];
+    if (d->x0 >= d->x1) {
+        d->x0 = x;
+        d->x1 = x + w;
+    } else {
+        d->x0 = MIN(d->x0, x);
+        d->x1 = MAX(d->x1, x + w);
+    }
+    vc_invalidate_lines(dev, y, 1);
+}
+
+// moves the rows of gfx by the scrolls noted since the last flush,
+// in one copy
+static void vc_device_scroll_gfx(vc_device_t* dev) {
+    int y0 = dev->scroll_y0;
+    int y1 = dev->scroll_y1;
+    int delta = ABS(dev->scroll_dir);
+    if (delta < y1 - y0) {
+        if (dev->scroll_dir > 0) {
+            gfx_copyrect(dev->gfx, 0, (y0 + delta) * dev->charh, dev->gfx->width,
+                         (y1 - y0 - delta) * dev->charh, 0, y0 * dev->charh);
+        } else {
+            gfx_copyrect(dev->gfx, 0, y0 * dev->charh, dev->gfx->width,
+                         (y1 - y0 - delta) * dev->charh, 0, (y0 + delta) * dev->charh);
+        }
+    }
+    dev->scroll_dir = 0;
+}
+
+void vc_device_flush(vc_device_t* dev) {
+    if (dev->invy1 <= dev->invy0) {
+        return;
+    }
+    if (dev->scroll_dir) {
+        vc_device_scroll_gfx(dev);
+    }
+    for (int y = dev->invy0; y < dev->invy1; y++) {
+        vc_dirty_t* d = &dev->dirty[y];
+        if (d->x0 >= d->x1) {
+            continue;
+        }
+        for (int x = d->x0; x < d->x1; x++) {
+            vc_gfx_draw_char(dev, dev->text_buf[x + y * dev->columns], x, y);
+        }
+        if (!dev->hide_cursor && (y == (int)dev->y) &&
+            (d->x0 <= (int)dev->x) && ((int)dev->x < d->x1)) {
+            gfx_fillrect(dev->gfx, dev->x * dev->charw, dev->y * dev->charh, dev->charw, dev->charh,
+                         palette_to_color(dev, dev->front_color));
+        }
+        d->x0 = d->x1 = 0;
+    }
+    vc_gfx_invalidate(dev, 0, dev->invy0, dev->columns, dev->invy1 - dev->invy0);
+    dev->invy0 = dev->rows + 1;
+    dev->invy1 = -1;
+}
+
+// implement tc callbacks:
+
 static void vc_tc_invalidate(void* cookie, int x0, int y0, int w, int h) {
     vc_device_t* dev = cookie;
     if (dev->flags & VC_FLAG_RESETSCROLL) {
@@ -110,18 +181,16 @@ static void vc_tc_invalidate(void* cookie, int x0, int y0, int w, int h) {
     }
     if (dev->vpy < 0)
         return;
-    vc_device_invalidate(cookie, x0, y0, w, h);
-    vc_invalidate_lines(dev, y0, h);
+    for (int y = y0; y < y0 + h; y++) {
+        vc_dirty_cells(dev, x0, y, w);
+    }
 }
 
 static void vc_tc_movecursor(void* cookie, int x, int y) {
     vc_device_t* dev = cookie;
     if (!dev->hide_cursor) {
-        vc_device_invalidate(cookie, dev->x, dev->y, 1, 1);
-        vc_invalidate_lines(dev, dev->y, 1);
-        gfx_fillrect(dev->gfx, x * dev->charw, y * dev->charh, dev->charw, dev->charh,
-                     palette_to_color(dev, dev->front_color));
-        vc_invalidate_lines(dev, y, 1);
+        vc_dirty_cells(dev, dev->x, dev->y, 1);
+        vc_dirty_cells(dev, x, y, 1);
     }
     dev->x = x;
     dev->y = y;
@@ -146,23 +215,36 @@ static void vc_tc_pushline(void* cookie, int y) {
 // textbuf must be updated before calling scroll
 static void vc_tc_scroll(void* cookie, int y0, int y1, int dir) {
     vc_device_t* dev = cookie;
-    if (dev->vpy < 0)
+    if ((dev->vpy < 0) || (dir == 0) || (y1 <= y0))
         return;
-    // invalidate the cursor before copying
-    vc_device_invalidate(cookie, dev->x, dev->y, 1, 1);
-    int delta = ABS(dir);
+    // the cursor is drawn in gfx, and moves with the rows
+    vc_dirty_cells(dev, dev->x, dev->y, 1);
+    // scrolls of the same region in the same direction add up
+    if (dev->scroll_dir && ((dev->scroll_y0 != y0) || (dev->scroll_y1 != y1) ||
+                            ((dev->scroll_dir > 0) != (dir > 0)))) {
+        vc_device_scroll_gfx(dev);
+    }
+    int h = y1 - y0;
+    int delta = MIN(ABS(dir), h);
+    dev->scroll_y0 = y0;
+    dev->scroll_y1 = y1;
+    dev->scroll_dir = MAX(MIN(dev->scroll_dir + dir, h), -h);
+    // the spans move with the rows they belong to, and the rows
+    // scrolled in are drawn in full
+    vc_dirty_t* d = dev->dirty;
+    int ynew;
     if (dir > 0) {
-        gfx_copyrect(dev->gfx, 0, (y0 + delta) * dev->charh,
-                     dev->gfx->width, (y1 - y0 - delta) * dev->charh, 0, y0);
-        vc_device_invalidate(cookie, 0, y1 - delta, dev->columns, delta);
+        memmove(d + y0, d + y0 + delta, (h - delta) * sizeof(vc_dirty_t));
+        ynew = y1 - delta;
     } else {
-        gfx_copyrect(dev->gfx, 0, y0, dev->gfx->width, (y1 - y0 - delta) * dev->charh,
-                     0, (y0 + delta) * dev->charh);
-        vc_device_invalidate(cookie, 0, y0, dev->columns, delta);
+        memmove(d + y0 + delta, d + y0, (h - delta) * sizeof(vc_dirty_t));
+        ynew = y0;
     }
-    vc_device_write_status(dev);
-    vc_gfx_invalidate_status(dev);
-    vc_invalidate_lines(dev, 0, dev->rows);
+    for (int y = ynew; y < ynew + delta; y++) {
+        d[y].x0 = 0;
+        d[y].x1 = dev->columns;
+    }
+    vc_invalidate_lines(dev, y0, h);
 }
 
 static void vc_tc_setparam(void* cookie, int param, uint8_t* arg, size_t arglen) {
@@ -176,17 +258,13 @@ static void vc_tc_setparam(void* cookie, int param, uint8_t* arg, size_t arglen)
     case TC_SHOW_CURSOR:
         if (dev->hide_cursor) {
             dev->hide_cursor = false;
-            vc_tc_movecursor(dev, dev->x, dev->y);
-            gfx_fillrect(dev->gfx, dev->x * dev->charw, dev->y * dev->charh, dev->charw, dev->charh,
-                         palette_to_color(dev, dev->front_color));
-            vc_invalidate_lines(dev, dev->y, 1);
+            vc_dirty_cells(dev, dev->x, dev->y, 1);
         }
         break;
     case TC_HIDE_CURSOR:
         if (!dev->hide_cursor) {
             dev->hide_cursor = true;
-            vc_device_invalidate(cookie, dev->x, dev->y, 1, 1);
-            vc_invalidate_lines(dev, dev->y, 1);
+            vc_dirty_cells(dev, dev->x, dev->y, 1);
         }
     default:; // nothing
     }
@@ -198,6 +276,11 @@ static void vc_device_reset(vc_device_t* dev) {
     dev->y = 0;
     // reset the viewport position
     dev->vpy = 0;
+    // nothing is pending, the whole screen is drawn below
+    memset(dev->dirty, 0, dev->rows * sizeof(vc_dirty_t));
+    dev->invy0 = dev->rows + 1;
+    dev->invy1 = -1;
+    dev->scroll_dir = 0;
 
     tc_init(&dev->textcon, dev->columns, dev->rows, dev->text_buf, dev->front_color, dev->back_color);
     dev->textcon.cookie = dev;
@@ -275,6 +358,8 @@ int vc_device_get_scrollback_lines(vc_device_t* dev) {
 }
 
 void vc_device_scroll_viewport(vc_device_t* dev, int dir) {
+    // gfx has to match the text buffer before it's moved
+    vc_device_flush(dev);
     int vpy = MAX(MIN(dev->vpy + dir, 0), -vc_device_get_scrollback_lines(dev));
     int delta = ABS(dev->vpy - vpy);
     if (delta == 0)
@@ -366,6 +451,9 @@ void vc_device_free(vc_device_t* device) {
     if (device->gfx_vmo)
         mx_handle_close(device->gfx_vmo);
     if (device->gfx)
-        free(device->gfx);
+        gfx_surface_destroy(device->gfx);
+    free(device->dirty);
+    free(device->scrollback_buf);
+    free(device->text_buf);
     free(device);
 }
@@ -27,15 +27,26 @@ void vc_gfx_invalidate_status(vc_device_t* dev) {
     gfx_flush_rows(dev->hw_gfx, 0, dev->st_gfx->height);
 }
 
-void vc_gfx_invalidate(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
+// in pixels
+void vc_gfx_invalidate_region(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
     if (!dev->active)
         return;
-    unsigned desty = dev->st_gfx->height + y * dev->charh;
+    unsigned desty = dev->st_gfx->height + y;
+    if ((x == 0) && (w == dev->gfx->width)) {
+        gfx_copylines(dev->hw_gfx, dev->gfx, y, desty, h);
+    } else {
+        gfx_blend(dev->hw_gfx, dev->gfx, x, y, w, h, x, desty);
+    }
+    gfx_flush_rows(dev->hw_gfx, desty, desty + h);
+}
+
+// in character cells
+void vc_gfx_invalidate(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h) {
     if ((x == 0) && (w == dev->columns)) {
-        gfx_copylines(dev->hw_gfx, dev->gfx, y * dev->charh, desty, h * dev->charh);
+        // whole lines, even if the width isn't a multiple of the cell
+        w = dev->gfx->width;
     } else {
-        gfx_blend(dev->hw_gfx, dev->gfx, x * dev->charw, y * dev->charh,
-                  w * dev->charw, h * dev->charh, x * dev->charw, desty);
+        w *= dev->charw;
     }
-    gfx_flush_rows(dev->hw_gfx, desty, desty + h * dev->charh);
+    vc_gfx_invalidate_region(dev, x * dev->charw, y * dev->charh, w, h * dev->charh);
 }
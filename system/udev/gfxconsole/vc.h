@@ -22,6 +22,11 @@ typedef uint16_t vc_char_t;
 
 #define MAX_COLOR 0xf
 
+// columns [x0, x1) of a row to draw from the text buffer, clean if x0 >= x1
+typedef struct vc_dirty {
+    int x0, x1;
+} vc_dirty_t;
+
 typedef struct vc_device {
     mx_device_t device;
 
@@ -57,8 +62,12 @@ typedef struct vc_device {
     unsigned scrollback_rows;
     // number of rows in scrollback
 
+    vc_dirty_t* dirty;
+    // cells not yet drawn into gfx, one span per row
     int invy0, invy1;
-    // offscreen invalid lines, tracked during textcon drawing
+    // lines of gfx not yet copied to hw_gfx
+    int scroll_y0, scroll_y1, scroll_dir;
+    // textcon scrolls not yet applied to gfx, all within one region
 
     unsigned x, y;
     // cursor
@@ -104,6 +113,7 @@ void vc_get_status_line(char* str, int n);
 
 void vc_device_write_status(vc_device_t* dev);
 void vc_device_render(vc_device_t* dev);
+void vc_device_flush(vc_device_t* dev);
 int vc_device_get_scrollback_lines(vc_device_t* dev);
 void vc_device_scroll_viewport(vc_device_t* dev, int dir);
 
@@ -112,6 +122,7 @@ void vc_device_scroll_viewport(vc_device_t* dev, int dir);
 void vc_gfx_invalidate_all(vc_device_t* dev);
 void vc_gfx_invalidate_status(vc_device_t* dev);
 void vc_gfx_invalidate(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h);
+void vc_gfx_invalidate_region(vc_device_t* dev, unsigned x, unsigned y, unsigned w, unsigned h);
 void vc_gfx_draw_char(vc_device_t* dev, vc_char_t ch, unsigned x, unsigned y);
 
 static inline uint32_t palette_to_color(vc_device_t* dev, uint8_t color) {
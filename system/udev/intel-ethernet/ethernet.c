@@ -17,6 +17,8 @@
 #include <magenta/syscalls.h>
 #include <magenta/syscalls-ddk.h>
 #include <magenta/types.h>
+#include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,8 +28,25 @@ typedef mx_status_t status_t;
 
 #define INTERVAL 10000000000ULL
 
+// The rx buffers live in a VMO that can be shared with a client, after a
+// page for the ring state. Buffers are half a page, so none straddles two.
+#define ETH_VMO_RXB_OFFSET PAGE_SIZE
+#define ETH_VMO_TXB_OFFSET (ETH_VMO_RXB_OFFSET + ETH_RXBUF_SIZE * ETH_RXBUF_COUNT)
+#define ETH_VMO_SIZE (ETH_VMO_TXB_OFFSET + ETH_TXBUF_SIZE * ETH_TXBUF_COUNT)
+
+static_assert(sizeof(eth_rings_t) + sizeof(eth_ring_entry_t) * (ETH_RXBUF_COUNT + ETH_TXBUF_COUNT)
+              <= ETH_VMO_RXB_OFFSET, "ring state too large");
+
 typedef struct ethernet_device ethernet_device_t;
 
+// Each open of the device makes an instance, so that the rings can be
+// taken back when the client they were given to closes the device.
+typedef struct {
+    mx_device_t dev;
+    ethernet_device_t* edev;
+    list_node_t node;
+} eth_instance_t;
+
 struct ethernet_device {
     ethdev_t eth;
     mxr_mutex_t lock;
@@ -37,9 +56,127 @@ struct ethernet_device {
     mx_handle_t ioh;
     mx_handle_t irqh;
     mxr_thread_t* thread;
+    bool batched;
+    eth_stats_t stats;
+
+    mx_handle_t vmo;
+    void* vmo_base;
+    mx_paddr_t pages[ETH_VMO_SIZE / PAGE_SIZE];
+
+    // open instances, under the lock
+    list_node_t instances;
+
+    // set once the rings are handed out, to the instance they went to.
+    // The indices the driver moves are kept here as well, the copies in
+    // the VMO are only published
+    eth_rings_t* rings;
+    eth_instance_t* rings_owner;
+    uint32_t rx_head;
+    uint32_t rx_returned;
+    uint32_t tx_next;
+    uint32_t tx_tail;
 };
 
 #define get_eth_device(d) containerof(d, ethernet_device_t, dev)
+#define get_eth_instance(d) containerof(d, eth_instance_t, dev)
+
+#define RX_ENTRY(rings, n) (&(rings)->entries[(n) & (ETH_RXBUF_COUNT - 1)])
+#define TX_ENTRY(rings, n) (&(rings)->entries[ETH_RXBUF_COUNT + ((n) & (ETH_TXBUF_COUNT - 1))])
+
+// Readiness goes to the instance with the rings, or to every instance
+// while frames are copied. Called with the lock held.
+static void eth_state_set_clr(ethernet_device_t* edev, mx_signals_t set, mx_signals_t clr) {
+    if (edev->rings_owner != NULL) {
+        device_state_set_clr(&edev->rings_owner->dev, set, clr);
+        return;
+    }
+    eth_instance_t* inst;
+    list_for_every_entry (&edev->instances, inst, eth_instance_t, node) {
+        device_state_set_clr(&inst->dev, set, clr);
+    }
+}
+
+// Give hw back the rx buffers the client is done with, then publish the
+// frames received since. Called with the lock held.
+static void eth_rings_rx(ethernet_device_t* edev) {
+    eth_rings_t* rings = edev->rings;
+
+    // the client can only give back what it was handed
+    uint32_t tail = __atomic_load_n(&rings->rx_tail, __ATOMIC_ACQUIRE);
+    if ((tail - edev->rx_returned) > (edev->rx_head - edev->rx_returned)) {
+        tail = edev->rx_head;
+    }
+    while (edev->rx_returned != tail) {
+        eth_rx_return(&edev->eth);
+        edev->rx_returned++;
+    }
+
+    mx_status_t r;
+    uint32_t n;
+    while ((r = eth_rx_take(&edev->eth, &n)) >= 0) {
+        eth_ring_entry_t* entry = RX_ENTRY(rings, edev->rx_head);
+        entry->offset = ETH_VMO_RXB_OFFSET + ETH_RXBUF_SIZE * n;
+        entry->length = r;
+        entry->flags = 0;
+        edev->rx_head++;
+        edev->stats.rx_frames++;
+    }
+    __atomic_store_n(&rings->rx_head, edev->rx_head, __ATOMIC_RELEASE);
+
+    // while the client has frames, further ones are picked up
+    // when it kicks rather than by interrupt
+    if (edev->rx_head != edev->rx_returned) {
+        eth_disable_irq(&edev->eth, ETH_IRQ_RX);
+        eth_state_set_clr(edev, DEV_STATE_READABLE, 0);
+    } else {
+        eth_state_set_clr(edev, 0, DEV_STATE_READABLE);
+        eth_enable_irq(&edev->eth, ETH_IRQ_RX);
+    }
+}
+
+// Publish the tx entries hw has finished with, then queue the ones the
+// client has added since. Called with the lock held.
+static mx_status_t eth_rings_tx(ethernet_device_t* edev) {
+    eth_rings_t* rings = edev->rings;
+
+    edev->tx_tail += eth_tx_reclaim(&edev->eth);
+    __atomic_store_n(&rings->tx_tail, edev->tx_tail, __ATOMIC_RELEASE);
+
+    mx_status_t r = NO_ERROR;
+    uint32_t head = __atomic_load_n(&rings->tx_head, __ATOMIC_ACQUIRE);
+    if ((head - edev->tx_tail) > ETH_TXBUF_COUNT) {
+        r = ERR_INVALID_ARGS;
+        head = edev->tx_next;
+    }
+    while (edev->tx_next != head) {
+        // the client may change the entry under us, so check a copy
+        eth_ring_entry_t entry = *TX_ENTRY(rings, edev->tx_next);
+        if ((entry.offset < ETH_VMO_RXB_OFFSET) || (entry.offset >= ETH_VMO_SIZE) ||
+            ((entry.offset & (PAGE_SIZE - 1)) + entry.length > PAGE_SIZE)) {
+            r = ERR_INVALID_ARGS;
+            break;
+        }
+        mx_paddr_t phys = edev->pages[entry.offset / PAGE_SIZE] + (entry.offset & (PAGE_SIZE - 1));
+        mx_status_t status = eth_tx_queue(&edev->eth, phys, entry.length);
+        if (status == ERR_NO_RESOURCES) {
+            // hw ring is full, the rest go once some complete
+            edev->stats.tx_full++;
+            break;
+        } else if (status < 0) {
+            r = status;
+            break;
+        }
+        edev->tx_next++;
+        edev->stats.tx_frames++;
+    }
+
+    if ((head - edev->tx_tail) < ETH_TXBUF_COUNT) {
+        eth_state_set_clr(edev, DEV_STATE_WRITABLE, 0);
+    } else {
+        eth_state_set_clr(edev, 0, DEV_STATE_WRITABLE);
+    }
+    return r;
+}
 
 static int irq_thread(void* arg) {
     ethernet_device_t* edev = arg;
@@ -50,38 +187,89 @@ static int irq_thread(void* arg) {
             break;
         }
         mxr_mutex_lock(&edev->lock);
-        if (eth_handle_irq(&edev->eth) & ETH_IRQ_RX) {
-            device_state_set(&edev->dev, DEV_STATE_READABLE);
+        edev->stats.irqs++;
+        unsigned irq = eth_handle_irq(&edev->eth);
+        if (edev->rings) {
+            if (irq & ETH_IRQ_RX) {
+                eth_rings_rx(edev);
+            }
+            if (irq & ETH_IRQ_TX) {
+                eth_rings_tx(edev);
+            }
+        } else {
+            if (irq & ETH_IRQ_RX) {
+                // the reader polls until the ring is empty, no
+                // rx interrupts until then
+                eth_disable_irq(&edev->eth, ETH_IRQ_RX);
+                eth_state_set_clr(edev, DEV_STATE_READABLE, 0);
+            }
+            if (irq & ETH_IRQ_TX) {
+                // refill free_frames now rather than on the next send
+                eth_tx_reclaim(&edev->eth);
+            }
         }
         mxr_mutex_unlock(&edev->lock);
     }
     return 0;
 }
 
-static mx_status_t eth_recv(mx_device_t* dev, void* data, size_t len) {
+static mx_status_t eth_recv_common(mx_device_t* dev, void* data, uint16_t* csum) {
     ethernet_device_t* edev = get_eth_device(dev);
     mx_status_t r = ERR_BAD_STATE;
     mxr_mutex_lock(&edev->lock);
-    r = eth_rx(&edev->eth, data);
-    if (r <= 0) {
-        device_state_clr(dev, DEV_STATE_READABLE);
+    if (edev->rings == NULL) {
+        r = eth_rx(&edev->eth, data, csum);
+        if (r > 0) {
+            edev->stats.rx_frames++;
+        } else {
+            eth_state_set_clr(edev, 0, DEV_STATE_READABLE);
+            eth_enable_irq(&edev->eth, ETH_IRQ_RX);
+        }
     }
     mxr_mutex_unlock(&edev->lock);
     return r;
 }
 
-static mx_status_t eth_send(mx_device_t* dev, const void* data, size_t len) {
+static mx_status_t eth_recv(mx_device_t* dev, void* data, size_t len) {
+    return eth_recv_common(dev, data, NULL);
+}
+
+static mx_status_t eth_recv_csum(mx_device_t* dev, void* data, size_t len, eth_batch_hdr_t* hdr) {
+    mx_status_t r = eth_recv_common(dev, data, &hdr->csum);
+    if (r >= ETH_RX_CSUM_START) {
+        hdr->flags |= ETH_BATCH_CSUM;
+        hdr->csum_start = ETH_RX_CSUM_START;
+    }
+    return r;
+}
+
+static mx_status_t eth_send_common(mx_device_t* dev, const void* data, size_t len, unsigned css, unsigned cso) {
     ethernet_device_t* edev = get_eth_device(dev);
     if (len > ETH_TXBUF_DSIZE) {
         return ERR_INVALID_ARGS;
     }
-    mx_status_t r = len;
+    mx_status_t r = ERR_BAD_STATE;
     mxr_mutex_lock(&edev->lock);
-    r = eth_tx(&edev->eth, data, len);
+    if (edev->rings == NULL) {
+        r = eth_tx(&edev->eth, data, len, css, cso);
+        if (r >= 0) {
+            edev->stats.tx_frames++;
+        } else if (r == ERR_NO_MEMORY) {
+            edev->stats.tx_full++;
+        }
+    }
     mxr_mutex_unlock(&edev->lock);
     return r;
 }
 
+static mx_status_t eth_send(mx_device_t* dev, const void* data, size_t len) {
+    return eth_send_common(dev, data, len, 0, 0);
+}
+
+static mx_status_t eth_send_csum(mx_device_t* dev, const void* data, const eth_batch_hdr_t* hdr) {
+    return eth_send_common(dev, data, hdr->length, hdr->csum_start, hdr->csum_start + hdr->csum);
+}
+
 static mx_status_t eth_get_mac_addr(mx_device_t* dev, uint8_t* out_addr) {
     ethernet_device_t* edev = get_eth_device(dev);
     memcpy(out_addr, edev->eth.mac, sizeof(edev->eth.mac));
@@ -96,12 +284,19 @@ static size_t eth_get_mtu(mx_device_t* dev) {
     return ETH_RXBUF_SIZE;
 }
 
+static uint32_t eth_get_features(mx_device_t* dev) {
+    return ETH_FEATURE_TX_CSUM | ETH_FEATURE_RX_CSUM;
+}
+
 static ethernet_protocol_t ethernet_ops = {
     .send = eth_send,
     .recv = eth_recv,
     .get_mac_addr = eth_get_mac_addr,
     .is_online = eth_is_online,
     .get_mtu = eth_get_mtu,
+    .get_features = eth_get_features,
+    .send_csum = eth_send_csum,
+    .recv_csum = eth_recv_csum,
 };
 
 // simplified read/write interface
@@ -112,6 +307,9 @@ static ssize_t eth_read(mx_device_t* dev, void* data, size_t len, mx_off_t off)
         eth_get_mac_addr(dev, data);
         return len;
     }
+    if (get_eth_device(dev)->batched) {
+        return ethernet_read_batch(dev, &ethernet_ops, data, len);
+    }
     if (len < eth_get_mtu(dev)) {
         return ERR_NOT_ENOUGH_BUFFER;
     }
@@ -119,23 +317,198 @@ static ssize_t eth_read(mx_device_t* dev, void* data, size_t len, mx_off_t off)
 }
 
 static ssize_t eth_write(mx_device_t* dev, const void* data, size_t len, mx_off_t off) {
+    if (get_eth_device(dev)->batched) {
+        return ethernet_write_batch(dev, &ethernet_ops, data, len);
+    }
     return eth_send(dev, data, len);
 }
 
+// Called with the lock held when the instance with the rings goes away.
+// The rx buffers it still held go back to hw. Frames it queued for tx
+// are left to finish, eth_tx_reclaim() tells them from copied ones.
+static void eth_rings_take_back(ethernet_device_t* edev) {
+    while (edev->rx_returned != edev->rx_head) {
+        eth_rx_return(&edev->eth);
+        edev->rx_returned++;
+    }
+    edev->rings = NULL;
+    edev->rings_owner = NULL;
+
+    // readers that copy pick up from here
+    eth_enable_irq(&edev->eth, ETH_IRQ_RX);
+    eth_state_set_clr(edev, DEV_STATE_READABLE, 0);
+}
+
+// inst is the instance the ioctl came through, NULL for the device itself
+static ssize_t eth_ioctl_common(ethernet_device_t* edev, eth_instance_t* inst, uint32_t op,
+                                const void* cmd, size_t cmdlen, void* reply, size_t max) {
+    switch (op) {
+    case ETHERNET_OP_GET_RINGS: {
+        if (max < sizeof(ioctl_ethernet_get_rings_t)) {
+            return ERR_NOT_ENOUGH_BUFFER;
+        }
+        if (inst == NULL) {
+            return ERR_NOT_SUPPORTED;
+        }
+        ioctl_ethernet_get_rings_t* rings = reply;
+        mxr_mutex_lock(&edev->lock);
+        if (edev->rings != NULL) {
+            mxr_mutex_unlock(&edev->lock);
+            return ERR_ALREADY_BOUND;
+        }
+        // the pages stay pinned for the NIC by our lookup, so a client that
+        // decommits them only loses its own view of the buffers
+        mx_rights_t rights = MX_RIGHT_READ | MX_RIGHT_WRITE | MX_RIGHT_TRANSFER;
+        if ((rings->vmo = mx_handle_duplicate(edev->vmo, rights)) < 0) {
+            mxr_mutex_unlock(&edev->lock);
+            return rings->vmo;
+        }
+        rings->size = ETH_VMO_SIZE;
+
+        edev->rings = edev->vmo_base;
+        edev->rings_owner = inst;
+        edev->rings->rx_count = ETH_RXBUF_COUNT;
+        edev->rings->tx_count = ETH_TXBUF_COUNT;
+        edev->rings->tx_offset = ETH_VMO_TXB_OFFSET;
+        edev->rings->buf_size = ETH_TXBUF_SIZE;
+        // carry on from where an earlier client left the indices, with
+        // the frames it queued that hw hasn't finished counted as in use
+        edev->tx_tail = edev->tx_next - edev->eth.tx_queued;
+        edev->rings->rx_head = edev->rx_head;
+        edev->rings->rx_tail = edev->rx_returned;
+        edev->rings->tx_head = edev->tx_next;
+        edev->rings->tx_tail = edev->tx_tail;
+        // frames already received are the first ones handed over
+        eth_rings_rx(edev);
+        eth_rings_tx(edev);
+        mxr_mutex_unlock(&edev->lock);
+        return sizeof(ioctl_ethernet_get_rings_t);
+    }
+    case ETHERNET_OP_GET_STATS: {
+        if (max < sizeof(eth_stats_t)) {
+            return ERR_NOT_ENOUGH_BUFFER;
+        }
+        mxr_mutex_lock(&edev->lock);
+        edev->stats.rx_missed += eth_missed_frames(&edev->eth);
+        memcpy(reply, &edev->stats, sizeof(eth_stats_t));
+        mxr_mutex_unlock(&edev->lock);
+        return sizeof(eth_stats_t);
+    }
+    case ETHERNET_OP_GET_FEATURES:
+        if (max < sizeof(uint32_t)) {
+            return ERR_NOT_ENOUGH_BUFFER;
+        }
+        *(uint32_t*)reply = eth_get_features(&edev->dev);
+        return sizeof(uint32_t);
+    case ETHERNET_OP_SET_BATCHED:
+        if (cmdlen < sizeof(uint32_t)) {
+            return ERR_INVALID_ARGS;
+        }
+        edev->batched = (*(const uint32_t*)cmd != 0);
+        return NO_ERROR;
+    case ETHERNET_OP_KICK_RINGS: {
+        mx_status_t r = ERR_BAD_STATE;
+        mxr_mutex_lock(&edev->lock);
+        if (edev->rings != NULL) {
+            eth_rings_rx(edev);
+            r = eth_rings_tx(edev);
+        }
+        mxr_mutex_unlock(&edev->lock);
+        return r;
+    }
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+}
+
+static ssize_t eth_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen, void* reply, size_t max) {
+    return eth_ioctl_common(get_eth_device(dev), NULL, op, cmd, cmdlen, reply, max);
+}
+
+static ssize_t eth_instance_read(mx_device_t* dev, void* data, size_t len, mx_off_t off) {
+    return eth_read(&get_eth_instance(dev)->edev->dev, data, len, off);
+}
+
+static ssize_t eth_instance_write(mx_device_t* dev, const void* data, size_t len, mx_off_t off) {
+    return eth_write(&get_eth_instance(dev)->edev->dev, data, len, off);
+}
+
+static ssize_t eth_instance_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen,
+                                  void* reply, size_t max) {
+    eth_instance_t* inst = get_eth_instance(dev);
+    return eth_ioctl_common(inst->edev, inst, op, cmd, cmdlen, reply, max);
+}
+
+static mx_status_t eth_instance_release(mx_device_t* dev) {
+    eth_instance_t* inst = get_eth_instance(dev);
+    ethernet_device_t* edev = inst->edev;
+    mxr_mutex_lock(&edev->lock);
+    list_delete(&inst->node);
+    if (edev->rings_owner == inst) {
+        eth_rings_take_back(edev);
+    }
+    mxr_mutex_unlock(&edev->lock);
+    free(inst);
+    return NO_ERROR;
+}
+
+static mx_protocol_device_t instance_ops = {
+    .release = eth_instance_release,
+    .read = eth_instance_read,
+    .write = eth_instance_write,
+    .ioctl = eth_instance_ioctl,
+};
+
+static mx_status_t eth_open(mx_device_t* dev, mx_device_t** dev_out, uint32_t flags) {
+    ethernet_device_t* edev = get_eth_device(dev);
+    eth_instance_t* inst;
+    if ((inst = calloc(1, sizeof(eth_instance_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    inst->edev = edev;
+
+    mx_status_t r;
+    if ((r = device_init(&inst->dev, edev->dev.driver, "intel-ethernet", &instance_ops)) < 0) {
+        free(inst);
+        return r;
+    }
+    inst->dev.protocol_id = MX_PROTOCOL_ETHERNET;
+    inst->dev.protocol_ops = &ethernet_ops;
+    if ((r = device_add_instance(&inst->dev, dev)) < 0) {
+        free(inst);
+        return r;
+    }
+
+    mxr_mutex_lock(&edev->lock);
+    list_add_tail(&edev->instances, &inst->node);
+    // a copying reader may have frames waiting already
+    if (edev->rings == NULL) {
+        device_state_set(&inst->dev, DEV_STATE_READABLE);
+    }
+    mxr_mutex_unlock(&edev->lock);
+
+    *dev_out = &inst->dev;
+    return NO_ERROR;
+}
+
 static mx_status_t eth_release(mx_device_t* dev) {
     ethernet_device_t* edev = get_eth_device(dev);
     eth_reset_hw(&edev->eth);
     edev->pci->enable_bus_master(edev->pcidev, true);
     mx_handle_close(edev->irqh);
     mx_handle_close(edev->ioh);
+    mx_process_vm_unmap(0, (uintptr_t)edev->vmo_base, 0);
+    mx_handle_close(edev->vmo);
     free(dev);
     return ERR_NOT_SUPPORTED;
 }
 
 static mx_protocol_device_t device_ops = {
+    .open = eth_open,
     .release = eth_release,
     .read = eth_read,
     .write = eth_write,
+    .ioctl = eth_ioctl,
 };
 
 static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev) {
@@ -144,6 +517,7 @@ static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev) {
         return ERR_NO_MEMORY;
     }
     edev->lock = MXR_MUTEX_INIT;
+    list_initialize(&edev->instances);
 
     pci_protocol_t* pci;
     if (device_get_protocol(dev, MX_PROTOCOL_PCI, (void**)&pci)) {
@@ -198,7 +572,30 @@ static mx_status_t eth_bind(mx_driver_t* drv, mx_device_t* dev) {
         goto fail;
     }
 
-    eth_setup_buffers(&edev->eth, iomem, iophys);
+    // rx buffers, and tx buffers for a client using the rings
+    if ((edev->vmo = mx_vm_object_create(ETH_VMO_SIZE)) < 0) {
+        printf("eth: cannot create vmo %d\n", edev->vmo);
+        edev->vmo = 0;
+        goto fail;
+    }
+    uintptr_t ptr;
+    if ((r = mx_process_vm_map(0, edev->vmo, 0, ETH_VMO_SIZE, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE)) < 0) {
+        printf("eth: cannot map vmo %d\n", r);
+        goto fail;
+    }
+    edev->vmo_base = (void*)ptr;
+    if ((r = mx_vm_object_lookup(edev->vmo, 0, ETH_VMO_SIZE, edev->pages, countof(edev->pages))) < 0) {
+        printf("eth: cannot lookup vmo pages %d\n", r);
+        goto fail;
+    }
+    uint64_t rxb_phys[ETH_RXBUF_COUNT];
+    for (int n = 0; n < ETH_RXBUF_COUNT; n++) {
+        size_t off = ETH_VMO_RXB_OFFSET + ETH_RXBUF_SIZE * n;
+        rxb_phys[n] = edev->pages[off / PAGE_SIZE] + (off & (PAGE_SIZE - 1));
+    }
+
+    eth_setup_buffers(&edev->eth, iomem, iophys, edev->vmo_base + ETH_VMO_RXB_OFFSET, rxb_phys);
     eth_init_hw(&edev->eth);
 
     if (device_init(&edev->dev, drv, "intel-ethernet", &device_ops)) {
@@ -221,6 +618,12 @@ fail:
         mx_handle_close(edev->irqh);
         mx_handle_close(edev->ioh);
     }
+    if (edev->vmo_base) {
+        mx_process_vm_unmap(0, (uintptr_t)edev->vmo_base, 0);
+    }
+    if (edev->vmo) {
+        mx_handle_close(edev->vmo);
+    }
     free(edev);
     return ERR_NOT_SUPPORTED;
 }
@@ -15,6 +15,7 @@
 #define IE_TXCW      0x0178 // TX Config Word
 #define IE_RXCW      0x0180 // RX Config Word
 #define IE_ICR       0x00C0 // Interrupt Cause Read
+#define IE_ITR       0x00C4 // Interrupt Throttling
 #define IE_ICS       0x00C8 // Interrupt Cause Set
 #define IE_IMS       0x00D0 // Interrupt Mask Set / Read
 #define IE_IMC       0x00D8 // Interrupt Mask Clear
@@ -25,7 +26,8 @@
 #define IE_RDLEN     0x2808 // RX Descriptor Length
 #define IE_RDH       0x2810 // RX Descriptor Head
 #define IE_RDT       0x2818 // RX Descriptor Tail
-#define IE_RDTR      0x3820 // RX Delay Timer
+#define IE_RDTR      0x2820 // RX Delay Timer
+#define IE_RADV      0x282C // RX Absolute Interrupt Delay
 
 #define IE_TCTL      0x0400 // Transmit Control
 #define IE_TIPG      0x0410 // TX IPG
@@ -35,11 +37,14 @@
 #define IE_TDH       0x3810 // TX Descriptor Head
 #define IE_TDT       0x3818 // TX Descriptor Tail
 #define IE_TIDV      0x3820 // TX Interrupt Delay Value
+#define IE_TADV      0x382C // TX Absolute Interrupt Delay
 
 #define IE_TXDMAC    0x3000 // TX DMA Control
 #define IE_TXDCTL    0x3828 // TX Descriptor Control
 #define IE_RXDCTL    0x2828 // RX Descriptor Control
 
+#define IE_MPC       0x4010 // Missed Packets Count (clears on read)
+
 #define IE_RXCSUM    0x5000 // RX Checksum Control
 #define IE_MTA(n)    (0x5200 + ((n) * 4)) // RX Multicast Table Array [0:127]
 #define IE_RAL(n)    (0x5400 + ((n) * 8)) // RX Address Low
@@ -43,7 +43,20 @@ unsigned eth_handle_irq(ethdev_t* eth) {
     return readl(IE_ICR);
 }
 
-status_t eth_rx(ethdev_t* eth, void* data) {
+void eth_enable_irq(ethdev_t* eth, unsigned irqs) {
+    // causes that came in while masked fire once unmasked
+    writel(irqs, IE_IMS);
+}
+
+void eth_disable_irq(ethdev_t* eth, unsigned irqs) {
+    writel(irqs, IE_IMC);
+}
+
+uint32_t eth_missed_frames(ethdev_t* eth) {
+    return readl(IE_MPC);
+}
+
+status_t eth_rx(ethdev_t* eth, void* data, uint16_t* csum) {
     uint32_t n = eth->rx_rd_ptr;
     uint64_t info = eth->rxd[n].info;
 
@@ -59,38 +72,105 @@ status_t eth_rx(ethdev_t* eth, void* data) {
     } else {
         memcpy(data, eth->rxb + ETH_RXBUF_SIZE * n, r);
     }
+    if (csum) {
+        // hw stores the complement of the sum, with the bytes swapped
+        uint16_t chk = IE_RXD_CHK(info);
+        *csum = ~((chk >> 8) | (chk << 8));
+    }
 
     // make buffer available to hw
     eth->rxd[n].info = 0;
     writel(n, IE_RDT);
     n = (n + 1) & (ETH_RXBUF_COUNT - 1);
     eth->rx_rd_ptr = n;
+    eth->rx_ret_ptr = n;
 
     return r;
 }
 
-status_t eth_tx(ethdev_t* eth, const void* data, size_t len) {
-    if ((len < 64) || (len > ETH_TXBUF_DSIZE)) {
-        return ERR_INVALID_ARGS;
+status_t eth_rx_take(ethdev_t* eth, uint32_t* index) {
+    uint32_t n = eth->rx_rd_ptr;
+    uint64_t info = eth->rxd[n].info;
+
+    if (!(info & IE_RXD_DONE)) {
+        return ERR_BAD_STATE;
     }
 
-    // reclaim completed buffers from hw
+    *index = n;
+    eth->rx_rd_ptr = (n + 1) & (ETH_RXBUF_COUNT - 1);
+
+    // should not be possible, but pass it on empty rather
+    // than stall the ring
+    mx_status_t r = IE_RXD_LEN(info);
+    return (r > ETH_RXBUF_SIZE) ? 0 : r;
+}
+
+void eth_rx_return(ethdev_t* eth) {
+    uint32_t n = eth->rx_ret_ptr;
+    eth->rxd[n].info = 0;
+    writel(n, IE_RDT);
+    eth->rx_ret_ptr = (n + 1) & (ETH_RXBUF_COUNT - 1);
+}
+
+unsigned eth_tx_reclaim(ethdev_t* eth) {
+    // frames sent by eth_tx() go back on the free list,
+    // those from eth_tx_queue() are counted
+    unsigned count = 0;
     uint32_t n = eth->tx_rd_ptr;
     for (;;) {
         uint64_t info = eth->txd[n].info;
         if (!(info & IE_TXD_DONE)) {
             break;
         }
-        framebuf_t* frame = list_remove_head_type(&eth->busy_frames, framebuf_t, node);
-        if (frame == NULL) {
-            panic();
+        // busy frames are in the order they were queued, and the two
+        // kinds can be interleaved once the rings are taken back, so
+        // tell them apart by address
+        framebuf_t* frame = list_peek_head_type(&eth->busy_frames, framebuf_t, node);
+        if ((frame != NULL) && (eth->txd[n].addr == frame->phys)) {
+            list_delete(&frame->node);
+            list_add_tail(&eth->free_frames, &frame->node);
+        } else {
+            eth->tx_queued--;
+            count++;
         }
-        // TODO: verify that this is the matching buffer to txd[n] addr?
-        list_add_tail(&eth->free_frames, &frame->node);
         eth->txd[n].info = 0;
         n = (n + 1) & (ETH_TXBUF_COUNT - 1);
     }
     eth->tx_rd_ptr = n;
+    return count;
+}
+
+status_t eth_tx_queue(ethdev_t* eth, uint64_t phys, size_t len) {
+    if ((len < 64) || (len > ETH_TXBUF_SIZE)) {
+        return ERR_INVALID_ARGS;
+    }
+
+    uint32_t n = eth->tx_wr_ptr;
+    if (((n + 1) & (ETH_TXBUF_COUNT - 1)) == eth->tx_rd_ptr) {
+        return ERR_NO_RESOURCES;
+    }
+    eth->txd[n].addr = phys;
+    eth->txd[n].info = IE_TXD_LEN(len) | IE_TXD_EOP | IE_TXD_IFCS | IE_TXD_RS | IE_TXD_IDE;
+    eth->tx_queued++;
+
+    // inform hw of buffer availability
+    n = (n + 1) & (ETH_TXBUF_COUNT - 1);
+    eth->tx_wr_ptr = n;
+    writel(n, IE_TDT);
+
+    return len;
+}
+
+status_t eth_tx(ethdev_t* eth, const void* data, size_t len, unsigned css, unsigned cso) {
+    if ((len < 64) || (len > ETH_TXBUF_DSIZE)) {
+        return ERR_INVALID_ARGS;
+    }
+    if ((css > ETH_TX_CSUM_MAX) || (cso > ETH_TX_CSUM_MAX)) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // reclaim completed buffers from hw
+    eth_tx_reclaim(eth);
 
     // obtain buffer, copy into it, setup descriptor
     framebuf_t *frame = list_remove_head_type(&eth->free_frames, framebuf_t, node);
@@ -98,10 +178,13 @@ status_t eth_tx(ethdev_t* eth, const void* data, size_t len) {
         return ERR_NO_MEMORY;
     }
 
-    n = eth->tx_wr_ptr;
+    uint32_t n = eth->tx_wr_ptr;
     memcpy(frame->data, data, len);
     eth->txd[n].addr = frame->phys;
-    eth->txd[n].info = IE_TXD_LEN(len) | IE_TXD_EOP | IE_TXD_IFCS | IE_TXD_RS;
+    eth->txd[n].info = IE_TXD_LEN(len) | IE_TXD_EOP | IE_TXD_IFCS | IE_TXD_RS | IE_TXD_IDE;
+    if (cso) {
+        eth->txd[n].info |= IE_TXD_IC | IE_TXD_CSS(css) | IE_TXD_CSO(cso);
+    }
     list_add_tail(&eth->busy_frames, &frame->node);
 
     // inform hw of buffer availability
@@ -143,7 +226,9 @@ void eth_init_hw(ethdev_t* eth) {
 
     // setup rx ring
     eth->rx_rd_ptr = 0;
-    writel(0, IE_RXCSUM);
+    eth->rx_ret_ptr = 0;
+    // sum every frame from ETH_RX_CSUM_START on
+    writel(ETH_RX_CSUM_START, IE_RXCSUM);
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_RXDCTL);
     writel(eth->rxd_phys, IE_RDBAL);
     writel(eth->rxd_phys >> 32, IE_RDBAH);
@@ -154,19 +239,27 @@ void eth_init_hw(ethdev_t* eth) {
     // setup tx ring
     eth->tx_wr_ptr = 0;
     eth->tx_rd_ptr = 0;
+    eth->tx_queued = 0;
     writel((4 << 0) | (1 << 8) | (1 << 16) | (1 << 24), IE_TXDCTL);
     writel(eth->txd_phys, IE_TDBAL);
     writel(eth->txd_phys >> 32, IE_TDBAH);
     writel(ETH_TXBUF_COUNT * 16, IE_TDLEN);
     writel(IE_TCTL_CT(15) | IE_TCTL_COLD_FD | IE_TCTL_EN, IE_TCTL);
 
+    // moderate irqs, tx completions are batched up by the
+    // delay timers and everything is throttled by ITR
+    writel(ETH_TX_DELAY, IE_TIDV);
+    writel(ETH_TX_ABS_DELAY, IE_TADV);
+    writel(ETH_ITR_INTERVAL, IE_ITR);
+
     // disable all irqs (write to "clear" mask)
     writel(0xFFFF, IE_IMC);
-    // enable rx irq (write to "set" mask)
-    writel(IE_INT_RXT0, IE_IMS);
+    // enable rx and tx irqs (write to "set" mask)
+    writel(IE_INT_RXT0 | IE_INT_TXDW, IE_IMS);
 }
 
-void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
+void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys,
+                       void* rxb, const uint64_t* rxb_phys) {
     printf("eth: iomem @%p (phys %lx)\n", iomem, iophys);
 
     list_initialize(&eth->free_frames);
@@ -184,13 +277,9 @@ void eth_setup_buffers(ethdev_t* eth, void* iomem, mx_paddr_t iophys) {
     iophys += ETH_DRING_SIZE;
     memset(eth->txd, 0, ETH_DRING_SIZE);
 
-    eth->rxb = iomem;
-    eth->rxb_phys = iophys;
-    iomem += ETH_RXBUF_SIZE * ETH_RXBUF_COUNT;
-    iophys += ETH_RXBUF_SIZE * ETH_RXBUF_COUNT;
-
+    eth->rxb = rxb;
     for (int n = 0; n < ETH_RXBUF_COUNT; n++) {
-        eth->rxd[n].addr = eth->rxb_phys + ETH_RXBUF_SIZE * n;
+        eth->rxd[n].addr = rxb_phys[n];
     }
     for (int n = 0; n < ETH_TXBUF_COUNT - 1; n++) {
         framebuf_t *txb = iomem;
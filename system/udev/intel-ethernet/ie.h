@@ -25,17 +25,20 @@ struct ethdev {
 
     uint32_t tx_wr_ptr;
     uint32_t tx_rd_ptr;
+    // frames from eth_tx_queue() hw hasn't finished with
+    uint32_t tx_queued;
     uint32_t rx_rd_ptr;
+    // next rx buffer to give back to hw
+    uint32_t rx_ret_ptr;
 
     list_node_t free_frames;
     list_node_t busy_frames;
 
-    // base physical addresses for
-    // tx/rx rings and rx buffers
+    // base physical addresses for tx/rx rings
     // store as 64bit integer to match hw register size
     uint64_t txd_phys;
     uint64_t rxd_phys;
-    uint64_t rxb_phys;
+    // rx buffers, need not be physically contiguous
     void* rxb;
 
     uint8_t mac[6];
@@ -45,24 +48,58 @@ struct ethdev {
 #define ETH_RXBUF_COUNT 32
 
 #define ETH_TXBUF_SIZE  2048
-#define ETH_TXBUF_COUNT 8
+#define ETH_TXBUF_COUNT 32
 #define ETH_TXBUF_HSIZE 128
 #define ETH_TXBUF_DSIZE (ETH_TXBUF_SIZE - ETH_TXBUF_HSIZE)
 
 #define ETH_DRING_SIZE 2048
 
-#define ETH_ALLOC ((ETH_RXBUF_SIZE * ETH_RXBUF_COUNT) + \
-                   (ETH_TXBUF_SIZE * ETH_TXBUF_COUNT) + \
+// past the ethernet header
+#define ETH_RX_CSUM_START 14
+// largest css and cso the tx descriptor holds
+#define ETH_TX_CSUM_MAX 255
+
+// at most one interrupt per ETH_ITR_INTERVAL * 256ns, about 8000 a second
+#define ETH_ITR_INTERVAL 488
+// tx completions are reported ETH_TX_DELAY us after the last frame
+// is sent, or ETH_TX_ABS_DELAY us after the first, in 1.024us units
+#define ETH_TX_DELAY     64
+#define ETH_TX_ABS_DELAY 256
+
+// rings and tx frame buffers, the rx buffers are allocated separately
+#define ETH_ALLOC ((ETH_TXBUF_SIZE * ETH_TXBUF_COUNT) + \
                    (ETH_DRING_SIZE * 2))
 
 status_t eth_reset_hw(ethdev_t* eth);
-void eth_setup_buffers(ethdev_t* eth, void* iomem, uintptr_t iophys);
+// rxb_phys holds the physical address of each of the ETH_RXBUF_COUNT
+// buffers at rxb
+void eth_setup_buffers(ethdev_t* eth, void* iomem, uintptr_t iophys,
+                       void* rxb, const uint64_t* rxb_phys);
 void eth_init_hw(ethdev_t* eth);
 
 void eth_dump_regs(ethdev_t* eth);
 
-status_t eth_rx(ethdev_t* eth, void* data);
-status_t eth_tx(ethdev_t* eth, const void* data, size_t len);
+// eth_rx() sets *csum, if not NULL, to the one's complement sum of the
+// frame from ETH_RX_CSUM_START to its end. eth_tx() has hw sum the frame
+// from css to its end and store the complement at cso, unless cso is 0.
+status_t eth_rx(ethdev_t* eth, void* data, uint16_t* csum);
+status_t eth_tx(ethdev_t* eth, const void* data, size_t len, unsigned css, unsigned cso);
+
+// Zero copy variants. eth_rx_take() returns the length of the next
+// received frame, leaving it in rx buffer *index, and eth_rx_return()
+// gives the oldest taken buffer back to hw. eth_tx_queue() sends the
+// frame at phys, and eth_tx_reclaim() returns how many of those frames
+// hw has finished with, tx_queued how many it hasn't yet.
+status_t eth_rx_take(ethdev_t* eth, uint32_t* index);
+void eth_rx_return(ethdev_t* eth);
+status_t eth_tx_queue(ethdev_t* eth, uint64_t phys, size_t len);
+unsigned eth_tx_reclaim(ethdev_t* eth);
 
 #define ETH_IRQ_RX IE_INT_RXT0
+#define ETH_IRQ_TX IE_INT_TXDW
 unsigned eth_handle_irq(ethdev_t* eth);
+void eth_enable_irq(ethdev_t* eth, unsigned irqs);
+void eth_disable_irq(ethdev_t* eth, unsigned irqs);
+
+// frames dropped by hw for lack of rx buffers since the last call
+uint32_t eth_missed_frames(ethdev_t* eth);
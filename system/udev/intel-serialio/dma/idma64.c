@@ -0,0 +1,67 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <intel-serialio/reg.h>
+
+#include "idma64.h"
+
+#define CH_REG(dma, channel, reg) \
+    ((dma)->regs + (channel) * IDMA64_CH_LENGTH + (reg))
+
+// the mask and enable registers take a write enable bit for each bit
+#define WE_SET(bits) (((bits) << 8) | (bits))
+#define WE_CLEAR(bits) ((bits) << 8)
+
+void idma64_init(idma64_t* dma, void* regs) {
+    dma->regs = regs;
+
+    uint32_t all = (1 << IDMA64_CHANNELS) - 1;
+    writel(WE_CLEAR(all), dma->regs + IDMA64_CH_EN);
+    writel(all, dma->regs + IDMA64_CLEAR(IDMA64_TFR));
+    writel(all, dma->regs + IDMA64_CLEAR(IDMA64_ERROR));
+    writel(WE_SET(all), dma->regs + IDMA64_MASK(IDMA64_TFR));
+    writel(WE_SET(all), dma->regs + IDMA64_MASK(IDMA64_ERROR));
+    writel(IDMA64_CFG_DMA_EN, dma->regs + IDMA64_CFG);
+}
+
+void idma64_start(idma64_t* dma, int channel, mx_paddr_t src, mx_paddr_t dst,
+                  uint32_t count, int width, bool to_device, int per) {
+    uint32_t ctl = IDMA64C_CTLL_INT_EN |
+                   IDMA64C_CTLL_DST_WIDTH(width) | IDMA64C_CTLL_SRC_WIDTH(width) |
+                   IDMA64C_CTLL_DST_MSIZE(0) | IDMA64C_CTLL_SRC_MSIZE(0);
+    uint32_t cfg;
+    if (to_device) {
+        ctl |= IDMA64C_CTLL_FC_M2P | IDMA64C_CTLL_DST_FIX;
+        cfg = IDMA64C_CFGH_DST_PER(per);
+    } else {
+        ctl |= IDMA64C_CTLL_FC_P2M | IDMA64C_CTLL_SRC_FIX;
+        cfg = IDMA64C_CFGH_SRC_PER(per);
+    }
+
+    writel(src, CH_REG(dma, channel, IDMA64C_SAR));
+    writel((uint64_t)src >> 32, CH_REG(dma, channel, IDMA64C_SAR + 4));
+    writel(dst, CH_REG(dma, channel, IDMA64C_DAR));
+    writel((uint64_t)dst >> 32, CH_REG(dma, channel, IDMA64C_DAR + 4));
+    writel(0, CH_REG(dma, channel, IDMA64C_LLP));
+    writel(0, CH_REG(dma, channel, IDMA64C_LLP + 4));
+    writel(ctl, CH_REG(dma, channel, IDMA64C_CTL_LO));
+    writel(count, CH_REG(dma, channel, IDMA64C_CTL_HI));
+    writel(0, CH_REG(dma, channel, IDMA64C_CFG_LO));
+    writel(cfg, CH_REG(dma, channel, IDMA64C_CFG_HI));
+    writel(WE_SET(1 << channel), dma->regs + IDMA64_CH_EN);
+}
+
+void idma64_stop(idma64_t* dma, int channel) {
+    writel(WE_CLEAR(1 << channel), dma->regs + IDMA64_CH_EN);
+}
+
+uint32_t idma64_irq(idma64_t* dma) {
+    if (!readl(dma->regs + IDMA64_STATUS_INT))
+        return 0;
+    uint32_t done = readl(dma->regs + IDMA64_STATUS(IDMA64_TFR));
+    uint32_t failed = readl(dma->regs + IDMA64_STATUS(IDMA64_ERROR));
+    writel(done, dma->regs + IDMA64_CLEAR(IDMA64_TFR));
+    writel(failed, dma->regs + IDMA64_CLEAR(IDMA64_ERROR));
+    return done | (failed << IDMA64_CHANNELS);
+}
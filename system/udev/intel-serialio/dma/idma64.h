@@ -0,0 +1,84 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <magenta/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// The DMA engine private to a Sunrise Point serialio function, at an offset
+// in its own register window. It has two channels, each doing one block
+// between memory and the function's FIFO, and interrupts on the function's
+// interrupt line.
+
+#define IDMA64_CHANNELS 2
+#define IDMA64_CH_LENGTH 0x58
+#define IDMA64_MAX_BLOCK ((1 << 17) - 1)
+
+// per channel registers
+#define IDMA64C_SAR 0x00
+#define IDMA64C_DAR 0x08
+#define IDMA64C_LLP 0x10
+#define IDMA64C_CTL_LO 0x18
+#define IDMA64C_CTL_HI 0x1c
+#define IDMA64C_CFG_LO 0x40
+#define IDMA64C_CFG_HI 0x44
+
+#define IDMA64C_CTLL_INT_EN (1 << 0)
+#define IDMA64C_CTLL_DST_WIDTH(x) ((x) << 1)
+#define IDMA64C_CTLL_SRC_WIDTH(x) ((x) << 4)
+#define IDMA64C_CTLL_DST_FIX (1 << 8)
+#define IDMA64C_CTLL_SRC_FIX (1 << 10)
+#define IDMA64C_CTLL_DST_MSIZE(x) ((x) << 11)
+#define IDMA64C_CTLL_SRC_MSIZE(x) ((x) << 14)
+#define IDMA64C_CTLL_FC_M2P (1 << 20)
+#define IDMA64C_CTLL_FC_P2M (2 << 20)
+
+#define IDMA64C_CTLH_DONE (1 << 17)
+
+#define IDMA64C_CFGH_SRC_PER(x) ((x) << 0)
+#define IDMA64C_CFGH_DST_PER(x) ((x) << 4)
+
+// transfer widths, as log2 of the bytes
+#define IDMA64_WIDTH_8 0
+#define IDMA64_WIDTH_32 2
+
+// common registers, an interrupt type apart
+enum {
+    IDMA64_TFR = 0,
+    IDMA64_ERROR = 4,
+};
+#define IDMA64_RAW(x) (0x2c0 + (x) * 8)
+#define IDMA64_STATUS(x) (0x2e8 + (x) * 8)
+#define IDMA64_MASK(x) (0x310 + (x) * 8)
+#define IDMA64_CLEAR(x) (0x338 + (x) * 8)
+#define IDMA64_STATUS_INT 0x360
+#define IDMA64_CFG 0x398
+#define IDMA64_CH_EN 0x3a0
+
+#define IDMA64_CFG_DMA_EN (1 << 0)
+
+// the function's request lines
+#define IDMA64_PER_TX 0
+#define IDMA64_PER_RX 1
+
+typedef struct idma64 {
+    void* regs;
+} idma64_t;
+
+// Enable the engine, interrupting when a channel finishes or errors.
+void idma64_init(idma64_t* dma, void* regs);
+
+// Move count items of 2^width bytes from memory at src to the function's
+// FIFO register at dst, or the other way if to_device is false, with the
+// request line per pacing it.
+void idma64_start(idma64_t* dma, int channel, mx_paddr_t src, mx_paddr_t dst,
+                  uint32_t count, int width, bool to_device, int per);
+
+void idma64_stop(idma64_t* dma, int channel);
+
+// Clear and return the channels that have finished, and those that have
+// errored shifted up by IDMA64_CHANNELS.
+uint32_t idma64_irq(idma64_t* dma);
@@ -23,6 +23,7 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 DRIVER_SRCS += \
     $(LOCAL_DIR)/serialio.c \
     $(LOCAL_DIR)/dma/dma.c \
+    $(LOCAL_DIR)/dma/idma64.c \
     $(LOCAL_DIR)/i2c/controller.c \
     $(LOCAL_DIR)/i2c/slave.c \
     $(LOCAL_DIR)/sdio/sdio.c \
@@ -11,8 +11,11 @@
 #include <intel-serialio/reg.h>
 #include <intel-serialio/serialio.h>
 #include <magenta/syscalls.h>
+#include <magenta/syscalls-ddk.h>
 #include <magenta/types.h>
+#include <runtime/completion.h>
 #include <runtime/mutex.h>
+#include <runtime/thread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -268,9 +271,13 @@ mx_status_t intel_serialio_i2c_reset_controller(
     intel_serialio_i2c_device_t* device) {
     mx_status_t status = NO_ERROR;
 
-    // Reset the device.
+    // Reset the device, and its DMA engine if it has one.
     RMWREG32(device->soft_reset, 0, 2, 0x0);
     RMWREG32(device->soft_reset, 0, 2, 0x3);
+    if (device->has_dma) {
+        RMWREG32(device->soft_reset, 2, 1, 0x1);
+        idma64_init(&device->dma, device->dma.regs);
+    }
 
     // Disable the controller.
     RMWREG32(&device->regs->i2c_en, I2C_EN_ENABLE, 1, 0);
@@ -291,8 +298,8 @@ mx_status_t intel_serialio_i2c_reset_controller(
         (speed << CTL_SPEED) |
         (CTL_MASTER_MODE_ENABLED << CTL_MASTER_MODE);
 
-    //XXX Do we need this?
-    *REG32(&device->regs->intr_mask) = INTR_STOP_DETECTION;
+    // Interrupts are unmasked only for the length of a DMA transfer.
+    *REG32(&device->regs->intr_mask) = 0;
 
     *REG32(&device->regs->rx_tl) = 0;
     *REG32(&device->regs->tx_tl) = 0;
@@ -308,6 +315,10 @@ static mx_status_t intel_serialio_i2c_device_specific_init(
         uint16_t device_ids[16];
         // Offset of the soft reset register
         size_t reset_offset;
+        // Offsets of the private DMA engine and the register the function
+        // uses to recognize its own bus address, or 0 if there's no engine
+        size_t dma_offset;
+        size_t remap_offset;
         // Internal controller frequency, in hertz
         uint32_t controller_clock_frequency;
     } dev_props[] = {
@@ -319,6 +330,8 @@ static mx_status_t intel_serialio_i2c_device_specific_init(
                 INTEL_SUNRISE_POINT_SERIALIO_I2C3_DID,
             },
             .reset_offset = 0x204,
+            .dma_offset = 0x800,
+            .remap_offset = 0x240,
             .controller_clock_frequency = 120 * 1000 * 1000,
         },
         {
@@ -345,6 +358,14 @@ static mx_status_t intel_serialio_i2c_device_specific_init(
             device->controller_freq = dev_props[i].controller_clock_frequency;
             device->soft_reset = (void*)device->regs +
                                  dev_props[i].reset_offset;
+            if (dev_props[i].dma_offset) {
+                volatile uint32_t* remap = (void*)device->regs +
+                                           dev_props[i].remap_offset;
+                remap[0] = device->regs_phys;
+                remap[1] = (uint64_t)device->regs_phys >> 32;
+                device->dma.regs = (void*)device->regs +
+                                   dev_props[i].dma_offset;
+            }
             return NO_ERROR;
         }
     }
@@ -352,6 +373,108 @@ static mx_status_t intel_serialio_i2c_device_specific_init(
     return ERR_NOT_SUPPORTED;
 }
 
+mx_status_t intel_serialio_i2c_queue_txn(
+    intel_serialio_i2c_device_t* controller, intel_serialio_i2c_txn_t* txn) {
+    mxr_mutex_lock(&controller->txn_lock);
+    list_add_tail(&controller->txn_list, &txn->node);
+    mxr_mutex_unlock(&controller->txn_lock);
+    mxr_completion_signal(&controller->worker_completion);
+
+    mxr_completion_wait(&txn->done, MX_TIME_INFINITE);
+    return txn->status;
+}
+
+static int intel_serialio_i2c_worker_thread(void* arg) {
+    intel_serialio_i2c_device_t* device = arg;
+    for (;;) {
+        for (;;) {
+            mxr_mutex_lock(&device->txn_lock);
+            intel_serialio_i2c_txn_t* txn = list_remove_head_type(
+                &device->txn_list, intel_serialio_i2c_txn_t, node);
+            mxr_mutex_unlock(&device->txn_lock);
+            if (!txn)
+                break;
+
+            mxr_mutex_lock(&device->mutex);
+            txn->status = intel_serialio_i2c_slave_do_transfer(
+                device, txn->slave, txn->segments, txn->segment_count);
+            mxr_mutex_unlock(&device->mutex);
+            mxr_completion_signal(&txn->done);
+        }
+        mxr_completion_wait(&device->worker_completion, MX_TIME_INFINITE);
+        mxr_completion_reset(&device->worker_completion);
+    }
+    return 0;
+}
+
+static int intel_serialio_i2c_irq_thread(void* arg) {
+    intel_serialio_i2c_device_t* device = arg;
+    mx_status_t status;
+    for (;;) {
+        status = device->pci->pci_wait_interrupt(device->irq_handle);
+        if (status) {
+            xprintf("i2c: error %d waiting for interrupt\n", status);
+            continue;
+        }
+        // clear what the controller and its DMA engine raised and pass it on
+        // to the transfer waiting in the worker thread
+        uint32_t intr_stat = *REG32(&device->regs->intr_stat);
+        if (intr_stat & (0x1 << INTR_STOP_DETECTION))
+            *REG32(&device->regs->clr_stop_det);
+        if (intr_stat & (0x1 << INTR_TX_ABORT))
+            *REG32(&device->regs->clr_tx_abort);
+        __atomic_fetch_or(&device->irq_status, intr_stat, __ATOMIC_SEQ_CST);
+        if (device->has_dma) {
+            __atomic_fetch_or(&device->dma_status, idma64_irq(&device->dma),
+                              __ATOMIC_SEQ_CST);
+        }
+        mxr_completion_signal(&device->irq_completion);
+    }
+    return 0;
+}
+
+// Get an interrupt and, if the controller has a DMA engine, buffers for it.
+// Without either, transfers go through the FIFO a byte at a time.
+static void intel_serialio_i2c_dma_init(intel_serialio_i2c_device_t* device,
+                                        mx_device_t* dev) {
+    pci_protocol_t* pci = device->pci;
+
+    mx_status_t status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_MSI, 1);
+    if (status < 0)
+        status = pci->set_irq_mode(dev, MX_PCIE_IRQ_MODE_LEGACY, 1);
+    if (status < 0)
+        goto no_dma;
+
+    device->irq_handle = pci->map_interrupt(dev, 0);
+    if (device->irq_handle < 0)
+        goto no_dma;
+
+    if (!device->dma.regs)
+        goto no_dma;
+
+    status = pci->enable_bus_master(dev, true);
+    if (status < 0)
+        goto no_dma;
+
+    const size_t words = I2C_DMA_MAX_BYTES;
+    void* mem;
+    mx_paddr_t mem_phys;
+    status = mx_alloc_device_memory(2 * words * sizeof(uint32_t), &mem_phys,
+                                    &mem);
+    if (status < 0)
+        goto no_dma;
+
+    device->dma_tx = mem;
+    device->dma_tx_phys = mem_phys;
+    device->dma_rx = device->dma_tx + words;
+    device->dma_rx_phys = mem_phys + words * sizeof(uint32_t);
+    device->has_dma = true;
+    return;
+
+no_dma:
+    device->dma.regs = NULL;
+}
+
 mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     pci_protocol_t* pci;
     if (device_get_protocol(dev, MX_PROTOCOL_PCI, (void**)&pci))
@@ -365,8 +488,11 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     if (!device)
         return ERR_NO_MEMORY;
 
+    memset(device, 0, sizeof(*device));
     list_initialize(&device->slave_list);
-    memset(&device->mutex, 0, sizeof(device->mutex));
+    list_initialize(&device->txn_list);
+    device->pci = pci;
+    device->irq_handle = MX_HANDLE_INVALID;
 
     const pci_config_t* pci_config;
     mx_handle_t config_handle = pci->get_config(dev, &pci_config);
@@ -383,6 +509,11 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
         goto fail;
     }
 
+    // The DMA engine reaches the FIFO at its bus address.
+    device->regs_phys = pci_config->base_addresses[0] & ~0xf;
+    if ((pci_config->base_addresses[0] & 0x6) == 0x4)
+        device->regs_phys |= (uint64_t)pci_config->base_addresses[1] << 32;
+
     // Run the bus at standard speed by default.
     device->bus_freq = I2C_MAX_STANDARD_SPEED_HZ;
 
@@ -390,6 +521,8 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     if (status < 0)
         goto fail;
 
+    intel_serialio_i2c_dma_init(device, dev);
+
     char name[MX_DEVICE_NAME_MAX];
     snprintf(name, sizeof(name), "i2c-bus-%04x", pci_config->device_id);
     status = device_init(&device->device, drv, name,
@@ -403,14 +536,25 @@ mx_status_t intel_serialio_bind_i2c(mx_driver_t* drv, mx_device_t* dev) {
     if (status < 0)
         goto fail;
 
+    if (device->irq_handle > 0) {
+        status = mxr_thread_create(intel_serialio_i2c_irq_thread, device,
+                                   "i2c-irq", &device->irq_thread);
+        if (status < 0)
+            goto fail;
+    }
+    status = mxr_thread_create(intel_serialio_i2c_worker_thread, device,
+                               "i2c-worker", &device->worker_thread);
+    if (status < 0)
+        goto fail;
+
     status = device_add(&device->device, dev);
     if (status < 0)
         goto fail;
 
     xprintf(
         "initialized intel serialio i2c driver, "
-        "reg=%#x regsize=%#x\n",
-        device->regs, device->regs_size);
+        "reg=%#x regsize=%#x dma=%d\n",
+        device->regs, device->regs_size, device->has_dma);
 
     mx_handle_close(config_handle);
     return NO_ERROR;
@@ -4,11 +4,17 @@
 
 #pragma once
 
+#include <ddk/protocol/i2c.h>
+#include <ddk/protocol/pci.h>
 #include <magenta/types.h>
+#include <runtime/completion.h>
 #include <runtime/mutex.h>
+#include <runtime/thread.h>
 #include <stdint.h>
 #include <system/listnode.h>
 
+#include "../dma/idma64.h"
+
 typedef struct __attribute__((packed)) intel_serialio_i2c_regs {
     uint32_t ctl;
     uint32_t tar_add;
@@ -112,6 +118,11 @@ enum {
     I2C_STA_ACTIVITY = 0,
 };
 
+enum {
+    DMA_CTRL_TDMAE = 1,
+    DMA_CTRL_RDMAE = 0,
+};
+
 enum {
     DATA_CMD_RESTART = 10,
     DATA_CMD_STOP = 9,
@@ -123,11 +134,29 @@ enum {
     DATA_CMD_DAT = 0,
 };
 
+// Transfers of fewer bytes than this, or more than fit in the DMA buffers,
+// move through the FIFO a byte at a time.
+#define I2C_DMA_MIN_BYTES 32
+// Each byte moved is a command word out, and a read is a word back in.
+#define I2C_DMA_MAX_BYTES 2048
+
+// A transfer queued on the controller, which its worker thread runs.
+typedef struct intel_serialio_i2c_txn {
+    list_node_t node;
+    struct intel_serialio_i2c_slave_device* slave;
+    i2c_slave_segment_t* segments;
+    int segment_count;
+    mx_status_t status;
+    mxr_completion_t done;
+} intel_serialio_i2c_txn_t;
+
 typedef struct intel_serialio_i2c_device {
     mx_device_t device;
 
     intel_serialio_i2c_regs* regs;
     volatile uint32_t* soft_reset;
+    // the bus address of the registers, for the DMA engine to reach data_cmd
+    mx_paddr_t regs_phys;
 
     uint64_t regs_size;
     mx_handle_t regs_handle;
@@ -138,10 +167,37 @@ typedef struct intel_serialio_i2c_device {
     struct list_node slave_list;
 
     mxr_mutex_t mutex;
+
+    // transfers waiting for the worker thread
+    mxr_mutex_t txn_lock;
+    list_node_t txn_list;
+    mxr_thread_t* worker_thread;
+    mxr_completion_t worker_completion;
+
+    // interrupts, if the controller has one: the irq thread ors what it has
+    // cleared into these and signals irq_completion
+    pci_protocol_t* pci;
+    mx_handle_t irq_handle;
+    mxr_thread_t* irq_thread;
+    mxr_completion_t irq_completion;
+    uint32_t irq_status;
+    uint32_t dma_status;
+
+    // the private DMA engine and its buffers, if the controller has both
+    bool has_dma;
+    idma64_t dma;
+    uint32_t* dma_tx;
+    uint32_t* dma_rx;
+    mx_paddr_t dma_tx_phys;
+    mx_paddr_t dma_rx_phys;
 } intel_serialio_i2c_device_t;
 
 mx_status_t intel_serialio_i2c_reset_controller(
     intel_serialio_i2c_device_t* controller);
 
+// Queue a transfer and wait for the worker thread to run it.
+mx_status_t intel_serialio_i2c_queue_txn(
+    intel_serialio_i2c_device_t* controller, intel_serialio_i2c_txn_t* txn);
+
 #define get_intel_serialio_i2c_device(dev) \
     containerof(dev, intel_serialio_i2c_device_t, device)
@@ -6,6 +6,7 @@
 #include <ddk/driver.h>
 #include <ddk/protocol/i2c.h>
 #include <intel-serialio/reg.h>
+#include <magenta/syscalls.h>
 #include <magenta/types.h>
 #include <mxio/util.h>
 #include <system/listnode.h>
@@ -56,52 +57,10 @@ static int rx_fifo_empty(intel_serialio_i2c_device_t *controller) {
     return !(*REG32(&controller->regs->i2c_sta) & (0x1 << I2C_STA_RFNE));
 }
 
-static mx_status_t intel_serialio_i2c_slave_transfer(
-    mx_device_t *dev, i2c_slave_segment_t *segments, int segment_count) {
-    mx_status_t status = NO_ERROR;
-
-    intel_serialio_i2c_slave_device_t *slave =
-        get_intel_serialio_i2c_slave_device(dev);
-
-    if (!dev->parent) {
-        printf("Orphaned I2C slave.\n");
-        status = ERR_BAD_STATE;
-        goto transfer_finish_2;
-    }
-
-    intel_serialio_i2c_device_t* controller =
-        get_intel_serialio_i2c_device(dev->parent);
-
-    uint32_t ctl_addr_mode_bit;
-    uint32_t tar_add_addr_mode_bit;
-    if (slave->chip_address_width == I2C_7BIT_ADDRESS) {
-        ctl_addr_mode_bit = CTL_ADDRESSING_MODE_7BIT;
-        tar_add_addr_mode_bit = TAR_ADD_WIDTH_7BIT;
-    } else if (slave->chip_address_width == I2C_10BIT_ADDRESS) {
-        ctl_addr_mode_bit = CTL_ADDRESSING_MODE_10BIT;
-        tar_add_addr_mode_bit = TAR_ADD_WIDTH_10BIT;
-    } else {
-        printf("Bad address width.\n");
-        status = ERR_INVALID_ARGS;
-        goto transfer_finish_2;
-    }
-
-    mxr_mutex_lock(&controller->mutex);
-
-    if (!WAIT_FOR(bus_is_idle(controller))) {
-        status = ERR_TIMED_OUT;
-        goto transfer_finish_1;
-    }
-
-    // Set the target adress value and width.
-    RMWREG32(&controller->regs->ctl, CTL_ADDRESSING_MODE, 1, ctl_addr_mode_bit);
-    *REG32(&controller->regs->tar_add) =
-        (tar_add_addr_mode_bit << TAR_ADD_WIDTH) |
-        (slave->chip_address << TAR_ADD_IC_TAR);
-
-    // Enable the controller.
-    RMWREG32(&controller->regs->i2c_en, I2C_EN_ENABLE, 1, 1);
-
+// Move the bytes through the FIFO a byte at a time.
+static mx_status_t intel_serialio_i2c_pio_transfer(
+    intel_serialio_i2c_device_t* controller,
+    i2c_slave_segment_t* segments, int segment_count) {
     int last_read = 0;
     if (segment_count)
         last_read = segments->read;
@@ -150,33 +109,200 @@ static mx_status_t intel_serialio_i2c_slave_transfer(
         segments++;
     }
 
+    return NO_ERROR;
+}
+
+// Have the DMA engine feed the same command words to the FIFO, and take the
+// bytes read back out of it, then sleep until the controller interrupts at
+// the stop.
+static mx_status_t intel_serialio_i2c_dma_transfer(
+    intel_serialio_i2c_device_t* controller,
+    i2c_slave_segment_t* segments, int segment_count) {
+    mx_status_t status = NO_ERROR;
+
+    uint32_t tx_count = 0;
+    uint32_t rx_count = 0;
+    int last_read = segments->read;
+    for (int i = 0; i < segment_count; i++) {
+        uint32_t restart = last_read == segments[i].read;
+        for (int j = 0; j < segments[i].len; j++) {
+            uint32_t cmd = (restart << DATA_CMD_RESTART);
+            restart = 0;
+            if (segments[i].read) {
+                cmd |= (DATA_CMD_CMD_READ << DATA_CMD_CMD);
+                rx_count++;
+            } else {
+                cmd |= (segments[i].buf[j] << DATA_CMD_DAT);
+                cmd |= (DATA_CMD_CMD_WRITE << DATA_CMD_CMD);
+            }
+            if (j == segments[i].len - 1 && i == segment_count - 1)
+                cmd |= (0x1 << DATA_CMD_STOP);
+            controller->dma_tx[tx_count++] = cmd;
+        }
+        last_read = segments[i].read;
+    }
+
+    __atomic_store_n(&controller->irq_status, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&controller->dma_status, 0, __ATOMIC_SEQ_CST);
+    mxr_completion_reset(&controller->irq_completion);
+    *REG32(&controller->regs->intr_mask) =
+        (0x1 << INTR_STOP_DETECTION) | (0x1 << INTR_TX_ABORT);
+
+    mx_paddr_t data_cmd = controller->regs_phys +
+                          offsetof(intel_serialio_i2c_regs, data_cmd);
+    if (rx_count) {
+        idma64_start(&controller->dma, 1, data_cmd, controller->dma_rx_phys,
+                     rx_count, IDMA64_WIDTH_32, false, IDMA64_PER_RX);
+    }
+    idma64_start(&controller->dma, 0, controller->dma_tx_phys, data_cmd,
+                 tx_count, IDMA64_WIDTH_32, true, IDMA64_PER_TX);
+
+    // Ask for more commands once the TX FIFO is down to a few, and for each
+    // byte read.
+    *REG32(&controller->regs->dma_tdlr) = 4;
+    *REG32(&controller->regs->dma_rdlr) = 0;
+    *REG32(&controller->regs->dma_ctrl) =
+        (0x1 << DMA_CTRL_TDMAE) | ((rx_count ? 0x1 : 0x0) << DMA_CTRL_RDMAE);
+
+    // The stop, or an abort, and the last byte read landing in memory.
+    const mx_time_t deadline = mx_current_time() + timeout_ns;
+    for (;;) {
+        uint32_t irq_status =
+            __atomic_load_n(&controller->irq_status, __ATOMIC_SEQ_CST);
+        uint32_t dma_status =
+            __atomic_load_n(&controller->dma_status, __ATOMIC_SEQ_CST);
+        if ((irq_status & (0x1 << INTR_TX_ABORT)) ||
+            (dma_status >> IDMA64_CHANNELS)) {
+            status = ERR_IO;
+            break;
+        }
+        if ((irq_status & (0x1 << INTR_STOP_DETECTION)) &&
+            (!rx_count || (dma_status & (0x1 << 1)))) {
+            break;
+        }
+        mx_time_t now = mx_current_time();
+        if (now >= deadline ||
+            mxr_completion_wait(&controller->irq_completion, deadline - now) ==
+                ERR_TIMED_OUT) {
+            status = ERR_TIMED_OUT;
+            break;
+        }
+        mxr_completion_reset(&controller->irq_completion);
+    }
+
+    *REG32(&controller->regs->dma_ctrl) = 0;
+    *REG32(&controller->regs->intr_mask) = 0;
+    idma64_stop(&controller->dma, 0);
+    idma64_stop(&controller->dma, 1);
+
+    if (status != NO_ERROR)
+        return status;
+
+    const uint32_t* rx = controller->dma_rx;
+    for (int i = 0; i < segment_count; i++) {
+        if (!segments[i].read)
+            continue;
+        for (int j = 0; j < segments[i].len; j++)
+            segments[i].buf[j] = *rx++ >> DATA_CMD_DAT;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t intel_serialio_i2c_slave_do_transfer(
+    intel_serialio_i2c_device_t* controller,
+    intel_serialio_i2c_slave_device_t* slave,
+    i2c_slave_segment_t* segments, int segment_count) {
+    mx_status_t status = NO_ERROR;
+
+    uint32_t ctl_addr_mode_bit;
+    uint32_t tar_add_addr_mode_bit;
+    if (slave->chip_address_width == I2C_7BIT_ADDRESS) {
+        ctl_addr_mode_bit = CTL_ADDRESSING_MODE_7BIT;
+        tar_add_addr_mode_bit = TAR_ADD_WIDTH_7BIT;
+    } else if (slave->chip_address_width == I2C_10BIT_ADDRESS) {
+        ctl_addr_mode_bit = CTL_ADDRESSING_MODE_10BIT;
+        tar_add_addr_mode_bit = TAR_ADD_WIDTH_10BIT;
+    } else {
+        printf("Bad address width.\n");
+        return ERR_INVALID_ARGS;
+    }
+
+    size_t bytes = 0;
+    for (int i = 0; i < segment_count; i++)
+        bytes += segments[i].len;
+
+    if (!WAIT_FOR(bus_is_idle(controller))) {
+        status = ERR_TIMED_OUT;
+        goto transfer_finish;
+    }
+
+    // Set the target adress value and width.
+    RMWREG32(&controller->regs->ctl, CTL_ADDRESSING_MODE, 1, ctl_addr_mode_bit);
+    *REG32(&controller->regs->tar_add) =
+        (tar_add_addr_mode_bit << TAR_ADD_WIDTH) |
+        (slave->chip_address << TAR_ADD_IC_TAR);
+
+    // Enable the controller.
+    RMWREG32(&controller->regs->i2c_en, I2C_EN_ENABLE, 1, 1);
+
+    if (controller->has_dma && bytes >= I2C_DMA_MIN_BYTES &&
+        bytes <= I2C_DMA_MAX_BYTES) {
+        status = intel_serialio_i2c_dma_transfer(controller, segments,
+                                                 segment_count);
+    } else {
+        status = intel_serialio_i2c_pio_transfer(controller, segments,
+                                                 segment_count);
+    }
+    if (status < 0)
+        goto transfer_finish;
+
     // Clear out the stop detect interrupt signal.
     if (!DO_UNTIL(!stop_detected(controller),
                   *REG32(&controller->regs->clr_stop_det))) {
         status = ERR_TIMED_OUT;
-        goto transfer_finish_1;
+        goto transfer_finish;
     }
 
     if (!WAIT_FOR(bus_is_idle(controller))) {
         status = ERR_TIMED_OUT;
-        goto transfer_finish_1;
+        goto transfer_finish;
     }
 
     // Read the data_cmd register to pull data out of the RX FIFO.
     if (!DO_UNTIL(rx_fifo_empty(controller),
                   *REG32(&controller->regs->data_cmd))) {
         status = ERR_TIMED_OUT;
-        goto transfer_finish_1;
+        goto transfer_finish;
     }
 
-transfer_finish_1:
+transfer_finish:
     if (status < 0)
         intel_serialio_i2c_reset_controller(controller);
-    mxr_mutex_unlock(&controller->mutex);
-transfer_finish_2:
     return status;
 }
 
+static mx_status_t intel_serialio_i2c_slave_transfer(
+    mx_device_t *dev, i2c_slave_segment_t *segments, int segment_count) {
+    intel_serialio_i2c_slave_device_t *slave =
+        get_intel_serialio_i2c_slave_device(dev);
+
+    if (!dev->parent) {
+        printf("Orphaned I2C slave.\n");
+        return ERR_BAD_STATE;
+    }
+
+    intel_serialio_i2c_device_t* controller =
+        get_intel_serialio_i2c_device(dev->parent);
+
+    intel_serialio_i2c_txn_t txn = {
+        .slave = slave,
+        .segments = segments,
+        .segment_count = segment_count,
+        .done = MXR_COMPLETION_INIT,
+    };
+    return intel_serialio_i2c_queue_txn(controller, &txn);
+}
+
 // Implement the char protocol for the slave devices.
 
 static ssize_t intel_serialio_i2c_slave_read(
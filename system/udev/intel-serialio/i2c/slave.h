@@ -9,6 +9,8 @@
 #include <system/listnode.h>
 #include <stdint.h>
 
+#include "controller.h"
+
 typedef struct intel_serialio_i2c_slave_device {
     mx_device_t device;
 
@@ -22,5 +24,11 @@ mx_status_t intel_serialio_i2c_slave_device_init(
     mx_device_t* cont, intel_serialio_i2c_slave_device_t* slave,
     uint8_t width, uint16_t address);
 
+// Run a transfer on the bus, with the controller lock held.
+mx_status_t intel_serialio_i2c_slave_do_transfer(
+    intel_serialio_i2c_device_t* controller,
+    intel_serialio_i2c_slave_device_t* slave,
+    i2c_slave_segment_t* segments, int segment_count);
+
 #define get_intel_serialio_i2c_slave_device(dev) \
     containerof(dev, intel_serialio_i2c_slave_device_t, device)
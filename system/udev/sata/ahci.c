@@ -15,6 +15,7 @@
 #include <runtime/thread.h>
 #include <system/listnode.h>
 #include <assert.h>
+#include <sys/param.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -57,15 +58,33 @@ typedef struct ahci_port {
     int nr; // 0-based
     int flags;
 
+    // issues the port's commands and handles its interrupts
+    mxr_thread_t* worker_thread;
+    mxr_completion_t worker_completion;
+    // interrupt status for the worker thread to handle, set by the irq thread
+    uint32_t irq_status;
+
     ahci_port_reg_t* regs;
     ahci_cl_t* cl;
     ahci_fis_t* fis;
-    ahci_ct_t* ct;
-
-    iotxn_t* running;
+    ahci_ct_t* ct[AHCI_MAX_COMMANDS]; // each followed by its PRDT
 
-    mxr_mutex_t lock; // protects txn_list
+    mxr_mutex_t lock; // protects the fields below, except running
     list_node_t txn_list;
+
+    // block scheduling
+    uint32_t sched_flags;
+    uint64_t next_lba; // where the elevator goes on from
+    block_queue_stats_t stats;
+
+    // commands issued to the device, by slot
+    iotxn_t* running[AHCI_MAX_COMMANDS];
+    uint32_t running_mask;
+    // set while a non-queued command is running, which may
+    // not run alongside any other
+    bool exclusive;
+    // how many queued commands may be running at once
+    int max_commands;
 } ahci_port_t;
 
 typedef struct ahci_device {
@@ -80,9 +99,6 @@ typedef struct ahci_device {
     mx_handle_t irq_handle;
     mxr_thread_t* irq_thread;
 
-    mxr_thread_t* worker_thread;
-    mxr_completion_t worker_completion;
-
     ahci_port_t ports[AHCI_MAX_PORTS];
 } ahci_device_t;
 
@@ -172,31 +188,63 @@ static void ahci_port_reset(ahci_port_t* port) {
     ahci_write(&port->regs->serr, ahci_read(&port->regs->serr));
 }
 
-static bool ahci_port_cmd_busy(ahci_port_t* port, int slot) {
-    return (ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci)) & slot;
+static bool ahci_cmd_is_queued(uint8_t cmd) {
+    return (cmd == SATA_CMD_READ_FPDMA_QUEUED) || (cmd == SATA_CMD_WRITE_FPDMA_QUEUED);
 }
 
-static mx_status_t ahci_port_do_txn(ahci_port_t* port, iotxn_t* txn) {
-    assert(port->running == NULL);
-    assert(!ahci_port_cmd_busy(port, 0));
+// the number of prds for the first length bytes of sg, or -1 if sg is too
+// short or doesn't satisfy the controller's word alignment
+static int ahci_sg_prds(iotxn_sg_t* sg, uint32_t sg_count, mx_off_t length) {
+    int prds = 0;
+    for (uint32_t n = 0; n < sg_count && length > 0; n++) {
+        size_t len = MIN(sg[n].length, length);
+        if ((sg[n].paddr & 1) || (len & 1)) {
+            return -1;
+        }
+        prds += (len + AHCI_PRD_MAX_SIZE - 1) / AHCI_PRD_MAX_SIZE;
+        length -= len;
+    }
+    return (length == 0) ? prds : -1;
+}
 
+// Build the command for txn in slot, which the port's worker thread
+// has found free, and issue it.
+static mx_status_t ahci_port_do_txn(ahci_port_t* port, int slot, iotxn_t* txn) {
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    mx_paddr_t phys;
-    txn->ops->physmap(txn, &phys);
 
-    //xprintf("ahci.%d: do_txn cmd=0x%x device=0x%x lba=0x%llx count=%u phys=0x%lx data_sz=0x%llx offset=0x%llx\n", port->nr, pdata->cmd, pdata->device, pdata->lba, pdata->count, phys, txn->length, txn->offset);
+    // describe the data with a prd per physically contiguous piece, up to
+    // AHCI_PRD_MAX_SIZE each, so it can be dma'd in place, the data of any
+    // txns merged into this one following its own
+    bool use_sg = true;
+    int prds = 0;
+    for (iotxn_t* t = txn; t != NULL; t = sata_iotxn_pdata(t)->next) {
+        iotxn_sg_t* sg;
+        uint32_t sg_count;
+        int n;
+        if ((t->ops->physmap_sg(t, &sg, &sg_count) < 0) ||
+            ((n = ahci_sg_prds(sg, sg_count, t->length)) < 0)) {
+            use_sg = false;
+            break;
+        }
+        prds += n;
+    }
+    if (prds > AHCI_MAX_PRDS) {
+        use_sg = false;
+    }
+
+    //xprintf("ahci.%d: do_txn slot=%d cmd=0x%x device=0x%x lba=0x%llx count=%u use_sg=%d data_sz=0x%llx offset=0x%llx\n", port->nr, slot, pdata->cmd, pdata->device, pdata->lba, pdata->count, use_sg, txn->length, txn->offset);
 
     // build the command
-    ahci_cl_t* cl = port->cl;
+    ahci_cl_t* cl = port->cl + slot;
+    ahci_ct_t* ct = port->ct[slot];
     // don't clear the cl since we set up ctba/ctbau at init
     cl->prdtl_flags_cfl = 0;
     cl->cfl = 5; // 20 bytes
-    cl->w = pdata->cmd == SATA_CMD_WRITE_DMA_EXT ? 1 : 0;
-    cl->prdtl = txn->length / AHCI_PRD_MAX_SIZE + 1;
+    cl->w = (pdata->cmd == SATA_CMD_WRITE_DMA_EXT) || (pdata->cmd == SATA_CMD_WRITE_FPDMA_QUEUED) ? 1 : 0;
     cl->prdbc = 0;
-    memset(port->ct, 0, sizeof(ahci_ct_t));
+    memset(ct, 0, sizeof(ahci_ct_t));
 
-    uint8_t* cfis = port->ct->cfis;
+    uint8_t* cfis = ct->cfis;
     cfis[0] = 0x27; // host-to-device
     cfis[1] = 0x80; // command
     cfis[2] = pdata->cmd;
@@ -212,36 +260,90 @@ static mx_status_t ahci_port_do_txn(ahci_port_t* port, iotxn_t* txn) {
         cfis[10] = (pdata->lba >> 40) & 0xff;
         cfis[12] = pdata->count & 0xff;
         cfis[13] = (pdata->count >> 8) & 0xff;
+    } else if (ahci_cmd_is_queued(pdata->cmd)) {
+        // the count goes in the features field and the tag in the count field
+        cfis[3] = pdata->count & 0xff;
+        cfis[4] = pdata->lba & 0xff;
+        cfis[5] = (pdata->lba >> 8) & 0xff;
+        cfis[6] = (pdata->lba >> 16) & 0xff;
+        cfis[8] = (pdata->lba >> 24) & 0xff;
+        cfis[9] = (pdata->lba >> 32) & 0xff;
+        cfis[10] = (pdata->lba >> 40) & 0xff;
+        cfis[11] = (pdata->count >> 8) & 0xff;
+        cfis[12] = slot << 3;
     }
 
-    ahci_prd_t* prd;
-    for (int i = 0; i < cl->prdtl - 1; i++) {
-        prd = (ahci_prd_t*)((void*)port->ct + sizeof(ahci_ct_t)) + i;
-        prd->dba = LO32(phys);
-        prd->dbau = HI32(phys);
-        prd->dbc = ((txn->length - 1) & 0x3fffff); // 0-based byte count
-
-        phys += AHCI_PRD_MAX_SIZE;
+    ahci_prd_t* prd = (ahci_prd_t*)((void*)ct + sizeof(ahci_ct_t));
+    int i = 0;
+    for (iotxn_t* t = txn; t != NULL; t = sata_iotxn_pdata(t)->next) {
+        iotxn_sg_t single;
+        iotxn_sg_t* sg;
+        uint32_t sg_count;
+        if (use_sg) {
+            t->ops->physmap_sg(t, &sg, &sg_count);
+        } else {
+            // fall back to one contiguous buffer
+            t->ops->physmap(t, &single.paddr);
+            single.length = t->length;
+            sg = &single;
+            sg_count = 1;
+        }
+        mx_off_t remaining = t->length;
+        for (uint32_t n = 0; n < sg_count && remaining > 0; n++) {
+            mx_paddr_t phys = sg[n].paddr;
+            size_t length = MIN(sg[n].length, remaining);
+            remaining -= length;
+            while (length > 0) {
+                size_t chunk = MIN(length, AHCI_PRD_MAX_SIZE);
+                prd[i].dba = LO32(phys);
+                prd[i].dbau = HI32(phys);
+                prd[i].dbc = ((chunk - 1) & 0x3fffff); // 0-based byte count
+                phys += chunk;
+                length -= chunk;
+                i++;
+            }
+        }
     }
     // interrupt on last prd completion
-    prd = (ahci_prd_t*)((void*)port->ct + sizeof(ahci_ct_t)) + cl->prdtl - 1;
-    prd->dba = LO32(phys);
-    prd->dbau = HI32(phys);
-    prd->dbc = (1 << 31) | ((txn->length - 1) & 0x3fffff); // interrupt on completion
+    prd[i - 1].dbc |= (1 << 31);
+    cl->prdtl = i;
 
     // start command
-    port->running = txn;
-    ahci_write(&port->regs->ci, 0x1);
+    mxr_mutex_lock(&port->lock);
+    if (ahci_cmd_is_queued(pdata->cmd)) {
+        ahci_write(&port->regs->sact, 1u << slot);
+    }
+    ahci_write(&port->regs->ci, 1u << slot);
+    port->running[slot] = txn;
+    port->running_mask |= (1u << slot);
+    mxr_mutex_unlock(&port->lock);
     return NO_ERROR;
 }
 
-static void ahci_port_complete_txn(ahci_device_t* dev, int nr, mx_status_t status) {
-    ahci_port_t* port = &dev->ports[nr];
-    iotxn_t* txn = port->running;
-    port->running = NULL;
-    txn->ops->complete(txn, status, txn->length); // TODO read out the actual bytes transferred
-    // hit the worker thread to do the next txn
-    mxr_completion_signal(&dev->worker_completion);
+// Take the txns out of the slots in mask, so the slots can be reused once
+// the lock is dropped. Called with the port lock held.
+static void ahci_port_take_txns(ahci_port_t* port, uint32_t mask, iotxn_t** txns) {
+    port->running_mask &= ~mask;
+    for (int slot = 0; slot < AHCI_MAX_COMMANDS; slot++) {
+        if (mask & (1u << slot)) {
+            txns[slot] = port->running[slot];
+            port->running[slot] = NULL;
+        } else {
+            txns[slot] = NULL;
+        }
+    }
+}
+
+// Complete the txns taken out of their slots, and those merged into them.
+static void ahci_port_complete_txns(iotxn_t** txns, mx_status_t status) {
+    for (int slot = 0; slot < AHCI_MAX_COMMANDS; slot++) {
+        iotxn_t* txn = txns[slot];
+        while (txn != NULL) {
+            iotxn_t* next = sata_iotxn_pdata(txn)->next;
+            txn->ops->complete(txn, status, txn->length); // TODO read out the actual bytes transferred
+            txn = next;
+        }
+    }
 }
 
 static mx_status_t ahci_port_initialize(ahci_port_t* port) {
@@ -251,8 +353,10 @@ static mx_status_t ahci_port_initialize(ahci_port_t* port) {
         return ERR_BUSY;
     }
 
-    // allocate memory for the command list, FIS receive area, command table and PRDT
-    size_t mem_sz = sizeof(ahci_fis_t) + sizeof(ahci_cl_t) + 0xec + 0x74 + sizeof(ahci_ct_t) + sizeof(ahci_prd_t) * AHCI_MAX_PRDS; // TODO 1 command at a time for now
+    // allocate memory for the command list, FIS receive area, and a command table
+    // and PRDT for each command slot
+    size_t ct_sz = sizeof(ahci_ct_t) + sizeof(ahci_prd_t) * AHCI_MAX_PRDS;
+    size_t mem_sz = sizeof(ahci_cl_t) * AHCI_MAX_COMMANDS + sizeof(ahci_fis_t) + ct_sz * AHCI_MAX_COMMANDS;
     mx_paddr_t mem_phys;
     void* mem;
     mx_status_t status = mx_alloc_device_memory(mem_sz, &mem_phys, &mem);
@@ -262,29 +366,33 @@ static mx_status_t ahci_port_initialize(ahci_port_t* port) {
     }
 
     // clear memory area
-    // order is command list (1024-byte aligned) / 0xec bytes padding
-    //          FIS receive area (256-byte aligned) / 0x74 bytes padding
-    //          command table + PRDT (127-byte aligned)
+    // order is command list (1024-byte aligned, 1024 bytes)
+    //          FIS receive area (256-byte aligned, 256 bytes)
+    //          command table + PRDT for each slot (128-byte aligned)
     memset(mem, 0, mem_sz);
 
     // command list
     ahci_write(&port->regs->clb, LO32(mem_phys));
     ahci_write(&port->regs->clbu, HI32(mem_phys));
-    mem_phys += sizeof(ahci_cl_t) + 0xec; // alignment padding
+    mem_phys += sizeof(ahci_cl_t) * AHCI_MAX_COMMANDS;
     port->cl = mem;
-    mem += sizeof(ahci_cl_t) + 0xec;
+    mem += sizeof(ahci_cl_t) * AHCI_MAX_COMMANDS;
 
     // FIS receive area
     ahci_write(&port->regs->fb, LO32(mem_phys));
     ahci_write(&port->regs->fbu, HI32(mem_phys));
-    mem_phys += sizeof(ahci_fis_t) + 0x74; // alignment padding
+    mem_phys += sizeof(ahci_fis_t);
     port->fis = mem;
-    mem += sizeof(ahci_fis_t) + 0x74;
-
-    // command table, followed by PRDT
-    port->cl[0].ctba = LO32(mem_phys);
-    port->cl[0].ctbau = HI32(mem_phys);
-    port->ct = mem;
+    mem += sizeof(ahci_fis_t);
+
+    // command tables, each followed by its PRDT
+    for (int i = 0; i < AHCI_MAX_COMMANDS; i++) {
+        port->cl[i].ctba = LO32(mem_phys);
+        port->cl[i].ctbau = HI32(mem_phys);
+        port->ct[i] = mem;
+        mem_phys += ct_sz;
+        mem += ct_sz;
+    }
 
     // clear port interrupts
     ahci_write(&port->regs->is, ahci_read(&port->regs->is));
@@ -336,6 +444,105 @@ static void ahci_hba_reset(ahci_device_t* dev) {
 
 // public api:
 
+int ahci_port_set_queue_depth(mx_device_t* dev, int nr, int depth) {
+    ahci_device_t* device = get_ahci_device(dev);
+    ahci_port_t* port = &device->ports[nr];
+
+    uint32_t cap = ahci_read(&device->regs->cap);
+    if (!(cap & AHCI_CAP_SNCQ)) {
+        return 1;
+    }
+    depth = MIN(depth, (int)AHCI_CAP_NCS(cap));
+
+    mxr_mutex_lock(&port->lock);
+    port->max_commands = depth;
+    mxr_mutex_unlock(&port->lock);
+    return depth;
+}
+
+void ahci_port_set_scheduler(mx_device_t* dev, int nr, uint32_t flags) {
+    ahci_port_t* port = &get_ahci_device(dev)->ports[nr];
+    mxr_mutex_lock(&port->lock);
+    port->sched_flags = flags;
+    mxr_mutex_unlock(&port->lock);
+}
+
+void ahci_port_get_stats(mx_device_t* dev, int nr, block_queue_stats_t* stats) {
+    ahci_port_t* port = &get_ahci_device(dev)->ports[nr];
+    mxr_mutex_lock(&port->lock);
+    *stats = port->stats;
+    mxr_mutex_unlock(&port->lock);
+}
+
+static bool ahci_cmd_is_rw(uint8_t cmd) {
+    return (cmd == SATA_CMD_READ_DMA_EXT) || (cmd == SATA_CMD_WRITE_DMA_EXT) || ahci_cmd_is_queued(cmd);
+}
+
+static bool ahci_cmd_is_write(uint8_t cmd) {
+    return (cmd == SATA_CMD_WRITE_DMA_EXT) || (cmd == SATA_CMD_WRITE_FPDMA_QUEUED);
+}
+
+// Whether txn must stay behind one of the waiting txns from first up to,
+// not including, last, because their blocks overlap and one of them
+// writes, or that one isn't a read or write. Called with the port lock held.
+static bool ahci_port_txn_conflicts(ahci_port_t* port, iotxn_t* txn, list_node_t* first, list_node_t* last) {
+    sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+    for (list_node_t* node = first; node != last; node = node->next) {
+        sata_pdata_t* opdata = sata_iotxn_pdata(containerof(node, iotxn_t, node));
+        if (!ahci_cmd_is_rw(opdata->cmd)) {
+            return true;
+        }
+        if ((ahci_cmd_is_write(pdata->cmd) || ahci_cmd_is_write(opdata->cmd)) &&
+            (pdata->lba < opdata->lba + opdata->blocks) && (opdata->lba < pdata->lba + pdata->blocks)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Merge txn into a waiting txn for the blocks just before or after its own,
+// so they go to the device in one command. Called with the port lock held.
+static bool ahci_port_merge_txn(ahci_port_t* port, iotxn_t* txn) {
+    sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+    iotxn_t* other;
+    list_for_every_entry (&port->txn_list, other, iotxn_t, node) {
+        sata_pdata_t* opdata = sata_iotxn_pdata(other);
+        if ((opdata->cmd != pdata->cmd) || (opdata->merged + pdata->merged + 1 > AHCI_MAX_MERGE) ||
+            (opdata->blocks + pdata->blocks > SATA_MAX_BLOCKS)) {
+            continue;
+        }
+        // merging moves txn up to other's place in the queue
+        if ((pdata->lba + pdata->blocks == opdata->lba || opdata->lba + opdata->blocks == pdata->lba) &&
+            ahci_port_txn_conflicts(port, txn, other->node.next, &port->txn_list)) {
+            continue;
+        }
+        if (opdata->lba + opdata->blocks == pdata->lba) {
+            // txn's data follows other's
+            iotxn_t* last = other;
+            while (sata_iotxn_pdata(last)->next != NULL) {
+                last = sata_iotxn_pdata(last)->next;
+            }
+            sata_iotxn_pdata(last)->next = txn;
+            opdata->blocks += pdata->blocks;
+            opdata->count = opdata->blocks;
+            opdata->merged += pdata->merged + 1;
+            return true;
+        }
+        if (pdata->lba + pdata->blocks == opdata->lba) {
+            // other's data follows txn's, txn takes its place in the queue
+            pdata->next = other;
+            pdata->blocks += opdata->blocks;
+            pdata->count = pdata->blocks;
+            pdata->merged += opdata->merged + 1;
+            pdata->queued_at = opdata->queued_at;
+            list_add_before(&other->node, &txn->node);
+            list_delete(&other->node);
+            return true;
+        }
+    }
+    return false;
+}
+
 void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
     ahci_device_t* device = get_ahci_device(dev);
@@ -344,76 +551,175 @@ void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     assert(pdata->port < AHCI_MAX_PORTS);
     assert(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT));
 
+    pdata->next = NULL;
+    pdata->blocks = (pdata->count == 0) ? SATA_MAX_BLOCKS : pdata->count;
+    pdata->merged = 0;
+    pdata->queued_at = mx_current_time();
+
     // put the cmd on the queue
     mxr_mutex_lock(&port->lock);
-    list_add_tail(&port->txn_list, &txn->node);
+    port->stats.queued++;
+    if ((port->sched_flags & AHCI_SCHED_MERGE) && ahci_cmd_is_rw(pdata->cmd) &&
+        ahci_port_merge_txn(port, txn)) {
+        port->stats.merged++;
+    } else {
+        list_add_tail(&port->txn_list, &txn->node);
+        port->stats.depth++;
+        port->stats.max_depth = MAX(port->stats.max_depth, port->stats.depth);
+    }
     mxr_mutex_unlock(&port->lock);
 
-    // hit the worker thread
-    mxr_completion_signal(&device->worker_completion);
+    // hit the port's worker thread
+    mxr_completion_signal(&port->worker_completion);
 }
 
 // worker thread (for iotxn queue):
 
-static int ahci_worker_thread(void* arg) {
-    ahci_device_t* dev = (ahci_device_t*)arg;
-    ahci_port_t* port;
-    list_node_t* node;
-    for (;;) {
-        // iterate all the ports and run commands
-        for (int i = 0; i < AHCI_MAX_PORTS; i++) {
-            port = &dev->ports[i];
-            if (!(port->flags & (AHCI_PORT_FLAG_IMPLEMENTED | AHCI_PORT_FLAG_PRESENT))) continue;
-
-            // check for port busy
-            // FIXME multiple commands
-            if (ahci_port_cmd_busy(port, 0)) continue;
-
-            // run the next command if not busy
-            mxr_mutex_lock(&port->lock);
-            node = list_remove_head(&port->txn_list);
-            mxr_mutex_unlock(&port->lock);
-
-            if (!node) continue;
-
-            ahci_port_do_txn(port, containerof(node, iotxn_t, node));
+// The waiting txn to send next. Txns go in the order they were queued,
+// unless the port has an elevator, which takes the one with the lowest
+// lba at or after where the last one ended, wrapping around, or one that
+// has waited past the deadline. Txns aren't taken ahead of others they
+// conflict with. Called with the port lock held.
+static list_node_t* ahci_port_pick_txn(ahci_port_t* port) {
+    iotxn_t* head = list_peek_head_type(&port->txn_list, iotxn_t, node);
+    if ((head == NULL) || !(port->sched_flags & AHCI_SCHED_ELEVATOR) ||
+        !ahci_cmd_is_rw(sata_iotxn_pdata(head)->cmd) ||
+        (mx_current_time() - sata_iotxn_pdata(head)->queued_at > AHCI_SCHED_DEADLINE)) {
+        return head ? &head->node : NULL;
+    }
+    iotxn_t* ahead = NULL;
+    iotxn_t* lowest = NULL;
+    iotxn_t* txn;
+    list_for_every_entry (&port->txn_list, txn, iotxn_t, node) {
+        sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+        if (!ahci_cmd_is_rw(pdata->cmd)) {
+            break;
+        }
+        if (ahci_port_txn_conflicts(port, txn, port->txn_list.next, &txn->node)) {
+            continue;
+        }
+        if ((pdata->lba >= port->next_lba) &&
+            ((ahead == NULL) || (pdata->lba < sata_iotxn_pdata(ahead)->lba))) {
+            ahead = txn;
+        }
+        if ((lowest == NULL) || (pdata->lba < sata_iotxn_pdata(lowest)->lba)) {
+            lowest = txn;
         }
-        // wait here until more commands are queued, or a port becomes idle
-        mxr_completion_wait(&dev->worker_completion, MX_TIME_INFINITE);
-        mxr_completion_reset(&dev->worker_completion);
     }
-    return 0;
+    return ahead ? &ahead->node : &lowest->node;
 }
 
-// irq handler:
-
-static void ahci_port_irq(ahci_device_t* dev, int nr) {
-    ahci_port_t* port = &dev->ports[nr];
-    // clear interrupt
-    uint32_t is = ahci_read(&port->regs->is);
-    ahci_write(&port->regs->is, is);
-    if (is & AHCI_PORT_INT_DHR) { // RFIS rcv
-        if (port->running) {
-            ahci_port_complete_txn(dev, nr, NO_ERROR);
+// Take the next txn that can be issued on the port and the slot to run it
+// in, or return NULL. Queued commands run alongside each other, up to
+// max_commands at once, and a non-queued command runs alone.
+static iotxn_t* ahci_port_next_txn(ahci_port_t* port, int* slot) {
+    iotxn_t* txn = NULL;
+    mxr_mutex_lock(&port->lock);
+    list_node_t* node = ahci_port_pick_txn(port);
+    if (node && !port->exclusive) {
+        txn = containerof(node, iotxn_t, node);
+        if (ahci_cmd_is_queued(sata_iotxn_pdata(txn)->cmd)) {
+            uint32_t free = ~port->running_mask;
+            if (port->max_commands < AHCI_MAX_COMMANDS) {
+                free &= (1u << port->max_commands) - 1;
+            }
+            if (free) {
+                *slot = __builtin_ctz(free);
+            } else {
+                txn = NULL;
+            }
+        } else if (port->running_mask == 0) {
+            *slot = 0;
+            port->exclusive = true;
+        } else {
+            txn = NULL;
         }
-    }
-    if (is & AHCI_PORT_INT_PS) { // PSFIS rcv
-        if (port->running) {
-            ahci_port_complete_txn(dev, nr, NO_ERROR);
+        if (txn) {
+            list_delete(node);
+            sata_pdata_t* pdata = sata_iotxn_pdata(txn);
+            port->next_lba = pdata->lba + pdata->blocks;
+            port->stats.depth--;
+            port->stats.commands++;
         }
     }
+    mxr_mutex_unlock(&port->lock);
+    return txn;
+}
+
+// Handle the port interrupt status the irq thread has passed on.
+static void ahci_port_irq(ahci_port_t* port, uint32_t is) {
     if (is & AHCI_PORT_INT_PRC) { // PhyRdy change
         uint32_t serr = ahci_read(&port->regs->serr);
         ahci_write(&port->regs->serr, serr & ~0x1);
     }
     if (is & AHCI_PORT_INT_TFE) { // taskfile error
-        if (port->running) {
-            // the current command errored
-            ahci_port_complete_txn(dev, nr, ERR_INTERNAL);
+        // the device doesn't say which queued command errored without
+        // reading its error log, so fail every command still running and
+        // restart the port to clear the error. the port is held exclusive
+        // while it restarts, so nothing is issued on it, but the lock isn't
+        // held across waiting for the dma engine to stop.
+        iotxn_t* done[AHCI_MAX_COMMANDS];
+        iotxn_t* failed[AHCI_MAX_COMMANDS];
+        mxr_mutex_lock(&port->lock);
+        uint32_t active = ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci);
+        ahci_port_take_txns(port, port->running_mask & ~active, done);
+        ahci_port_take_txns(port, port->running_mask, failed);
+        port->exclusive = true;
+        mxr_mutex_unlock(&port->lock);
+
+        ahci_port_disable(port);
+        ahci_write(&port->regs->serr, ahci_read(&port->regs->serr));
+        ahci_write(&port->regs->is, ahci_read(&port->regs->is));
+        ahci_port_enable(port);
+
+        mxr_mutex_lock(&port->lock);
+        port->exclusive = false;
+        mxr_mutex_unlock(&port->lock);
+        ahci_port_complete_txns(done, NO_ERROR);
+        ahci_port_complete_txns(failed, ERR_INTERNAL);
+        return;
+    }
+    if (is & (AHCI_PORT_INT_DHR | AHCI_PORT_INT_PS | AHCI_PORT_INT_SDB)) { // RFIS, PSFIS or SDBFIS rcv
+        // a command is done once the device has cleared its bit in
+        // ci and, for a queued command, in sact
+        iotxn_t* done[AHCI_MAX_COMMANDS];
+        mxr_mutex_lock(&port->lock);
+        uint32_t active = ahci_read(&port->regs->sact) | ahci_read(&port->regs->ci);
+        uint32_t mask = port->running_mask & ~active;
+        ahci_port_take_txns(port, mask, done);
+        if (mask && (port->running_mask == 0)) {
+            port->exclusive = false;
+        }
+        mxr_mutex_unlock(&port->lock);
+        if (mask) {
+            ahci_port_complete_txns(done, NO_ERROR);
         }
     }
 }
 
+static int ahci_port_worker_thread(void* arg) {
+    ahci_port_t* port = (ahci_port_t*)arg;
+    for (;;) {
+        // complete what the port has finished, then run as many commands
+        // as it takes
+        uint32_t is = __atomic_exchange_n(&port->irq_status, 0, __ATOMIC_SEQ_CST);
+        if (is) {
+            ahci_port_irq(port, is);
+        }
+        iotxn_t* txn;
+        int slot;
+        while ((txn = ahci_port_next_txn(port, &slot)) != NULL) {
+            ahci_port_do_txn(port, slot, txn);
+        }
+        // wait here until more commands are queued, or the port interrupts
+        mxr_completion_wait(&port->worker_completion, MX_TIME_INFINITE);
+        mxr_completion_reset(&port->worker_completion);
+    }
+    return 0;
+}
+
+// irq handler:
+
 static int ahci_irq_thread(void* arg) {
     ahci_device_t* dev = (ahci_device_t*)arg;
     mx_status_t status;
@@ -423,11 +729,18 @@ static int ahci_irq_thread(void* arg) {
             xprintf("ahci: error %d waiting for interrupt\n", status);
             continue;
         }
+        // clear the interrupts and pass them on to the ports' worker
+        // threads, so ports run in parallel and their completions don't
+        // wait on each other
         uint32_t is = ahci_read(&dev->regs->is);
         ahci_write(&dev->regs->is, is);
         for (int i = 0; is && i < AHCI_MAX_PORTS; i++) {
             if (is & 0x1) {
-                ahci_port_irq(dev, i);
+                ahci_port_t* port = &dev->ports[i];
+                uint32_t port_is = ahci_read(&port->regs->is);
+                ahci_write(&port->regs->is, port_is);
+                __atomic_fetch_or(&port->irq_status, port_is, __ATOMIC_SEQ_CST);
+                mxr_completion_signal(&port->worker_completion);
             }
             is >>= 1;
         }
@@ -463,10 +776,20 @@ static mx_status_t ahci_initialize(ahci_device_t* dev) {
 
         port->flags = AHCI_PORT_FLAG_IMPLEMENTED;
         port->regs = &dev->regs->ports[i];
+        port->lock = MXR_MUTEX_INIT;
+        port->max_commands = 1;
         list_initialize(&port->txn_list);
 
         status = ahci_port_initialize(port);
         if (status) goto fail;
+
+        // start the port's worker thread
+        port->worker_completion = MXR_COMPLETION_INIT;
+        status = mxr_thread_create(ahci_port_worker_thread, port, "ahci-port", &port->worker_thread);
+        if (status < 0) {
+            xprintf("ahci.%d: error %d in worker thread create\n", port->nr, status);
+            goto fail;
+        }
     }
 
     // clear hba interrupts
@@ -587,14 +910,6 @@ static mx_status_t ahci_bind(mx_driver_t* drv, mx_device_t* dev) {
         goto fail;
     }
 
-    // start worker thread (for iotxn queue)
-    device->worker_completion = MXR_COMPLETION_INIT;
-    status = mxr_thread_create(ahci_worker_thread, device, "ahci-worker", &device->worker_thread);
-    if (status < 0) {
-        xprintf("ahci: error %d in worker thread create\n", status);
-        goto fail;
-    }
-
     // add the device for the controller
     device_add(&device->device, dev);
 
@@ -6,14 +6,27 @@
 
 #include <ddk/device.h>
 #include <ddk/driver.h>
+#include <ddk/protocol/block.h>
 #include <ddk/protocol/pci.h>
 
 #define AHCI_MAX_PORTS    32
 #define AHCI_MAX_COMMANDS 32
-#define AHCI_MAX_PRDS     128 // just a random choice, hardware max is 64k-1
+#define AHCI_MAX_PRDS     512 // enough for 2mb in scattered pages, hardware max is 64k-1
 
 #define AHCI_PRD_MAX_SIZE 0x400000 // 4mb
 
+// txns merged into one command at most, each fits in a few prds
+#define AHCI_MAX_MERGE    32
+
+// block scheduling, see ahci_port_set_scheduler()
+#define AHCI_SCHED_MERGE    (1 << 0) // merge txns for adjacent blocks into one command
+#define AHCI_SCHED_ELEVATOR (1 << 1) // send txns in order of lba, for rotational disks
+// how long a txn waits before the elevator takes it regardless of its lba
+#define AHCI_SCHED_DEADLINE (500ull * 1000 * 1000) // 500ms
+
+#define AHCI_CAP_SNCQ   (1 << 30)
+#define AHCI_CAP_NCS(cap) ((((cap) >> 8) & 0x1f) + 1) // number of command slots
+
 #define AHCI_PORT_INT_CPD (1 << 31)
 #define AHCI_PORT_INT_TFE (1 << 30)
 #define AHCI_PORT_INT_HBF (1 << 29)
@@ -158,3 +171,12 @@ static_assert(sizeof(ahci_ct_t) == 0x80, "unexpected command table header size")
 static_assert(sizeof(ahci_prd_t) == 0x10, "unexpected prd entry size");
 
 void ahci_iotxn_queue(mx_device_t* dev, iotxn_t* txn);
+
+// Allow up to depth queued commands to run at once on a port, as far as the
+// controller supports native command queuing. Returns the depth allowed.
+int ahci_port_set_queue_depth(mx_device_t* dev, int port, int depth);
+
+// Choose how txns waiting on a port are scheduled, AHCI_SCHED_* flags.
+void ahci_port_set_scheduler(mx_device_t* dev, int port, uint32_t flags);
+
+void ahci_port_get_stats(mx_device_t* dev, int port, block_queue_stats_t* stats);
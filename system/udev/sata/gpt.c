@@ -11,6 +11,7 @@
 #include <magenta/types.h>
 #include <runtime/completion.h>
 #include <runtime/mutex.h>
+#include <runtime/thread.h>
 #include <sys/param.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -88,6 +89,9 @@ static ssize_t gpt_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
         utf16_to_cstring(name, device->gpt_entry.name, MIN((max - 1) * 2, GPT_NAME_LEN));
         return strnlen(name, GPT_NAME_LEN / 2);
     }
+    case BLOCK_OP_GET_QUEUE_STATS:
+        // the queue belongs to the whole disk
+        return dev->parent->ops->ioctl(dev->parent, op, cmd, cmdlen, reply, max);
     default:
         return ERR_NOT_SUPPORTED;
     }
@@ -125,24 +129,25 @@ static void gpt_read_sync_complete(iotxn_t* txn) {
     mxr_completion_signal((mxr_completion_t*)txn->context);
 }
 
-static mx_status_t gpt_bind(mx_driver_t* drv, mx_device_t* dev) {
+typedef struct gpt_bind_info {
+    mx_driver_t* drv;
+    mx_device_t* dev;
     uint64_t blksize;
-    ssize_t rc = dev->ops->ioctl(dev, BLOCK_OP_GET_BLOCKSIZE, NULL, 0, &blksize, sizeof(blksize));
-    if (rc < 0) {
-        xprintf("gpt: Error %zd getting blksize for dev=%s\n", rc, dev->name);
-        return rc;
-    }
+} gpt_bind_info_t;
 
-    // sanity check the default txn size with the block size
-    if (TXN_SIZE % blksize) {
-        xprintf("gpt: default txn size=%d is not aligned to blksize=%llu!\n", TXN_SIZE, blksize);
-    }
+static int gpt_bind_thread(void* arg) {
+    gpt_bind_info_t* info = (gpt_bind_info_t*)arg;
+    mx_driver_t* drv = info->drv;
+    mx_device_t* dev = info->dev;
+    uint64_t blksize = info->blksize;
+    free(info);
 
     // allocate an iotxn to read the partition table
     iotxn_t* txn;
     mx_status_t status = iotxn_alloc(&txn, 0, TXN_SIZE, 0);
     if (status != NO_ERROR) {
         xprintf("gpt: error %d allocating iotxn\n", status);
+        return status;
     }
 
     mxr_completion_t completion = MXR_COMPLETION_INIT;
@@ -159,7 +164,9 @@ static mx_status_t gpt_bind(mx_driver_t* drv, mx_device_t* dev) {
 
     if (txn->status != NO_ERROR) {
         xprintf("gpt: error %d reading partition header\n", txn->status);
-        return txn->status;
+        status = txn->status;
+        txn->ops->release(txn);
+        return status;
     }
 
     // read the header
@@ -233,6 +240,40 @@ static mx_status_t gpt_bind(mx_driver_t* drv, mx_device_t* dev) {
     return NO_ERROR;
 }
 
+static mx_status_t gpt_bind(mx_driver_t* drv, mx_device_t* dev) {
+    uint64_t blksize;
+    ssize_t rc = dev->ops->ioctl(dev, BLOCK_OP_GET_BLOCKSIZE, NULL, 0, &blksize, sizeof(blksize));
+    if (rc < 0) {
+        xprintf("gpt: Error %zd getting blksize for dev=%s\n", rc, dev->name);
+        return rc;
+    }
+
+    // sanity check the default txn size with the block size
+    if (TXN_SIZE % blksize) {
+        xprintf("gpt: default txn size=%d is not aligned to blksize=%llu!\n", TXN_SIZE, blksize);
+    }
+
+    gpt_bind_info_t* info = malloc(sizeof(gpt_bind_info_t));
+    if (!info) {
+        return ERR_NO_MEMORY;
+    }
+    info->drv = drv;
+    info->dev = dev;
+    info->blksize = blksize;
+
+    // read the partition table on a thread of its own, so a disk that is slow to
+    // spin up doesn't hold up binding the devices after it
+    mxr_thread_t* thread;
+    mx_status_t status = mxr_thread_create(gpt_bind_thread, info, "gpt_bind_thread", &thread);
+    if (status != NO_ERROR) {
+        free(info);
+        return status;
+    }
+    mxr_thread_detach(thread);
+
+    return NO_ERROR;
+}
+
 static mx_bind_inst_t binding[] = {
     BI_MATCH_IF(EQ, BIND_PROTOCOL, MX_PROTOCOL_BLOCK),
 };
@@ -36,6 +36,7 @@
 
 #define SATA_FLAG_DMA   (1 << 0)
 #define SATA_FLAG_LBA48 (1 << 1)
+#define SATA_FLAG_NCQ   (1 << 2)
 
 typedef struct sata_device {
     mx_device_t device;
@@ -127,6 +128,24 @@ static mx_status_t sata_device_identify(sata_device_t* dev, mx_device_t* control
     } else {
         xprintf("  CHS unsupported!\n");
     }
+
+    // native command queuing lets the device take many commands at once
+    if ((flags & SATA_FLAG_DMA) && (*(devinfo + SATA_DEVINFO_SATA_CAP) & (1 << 8))) {
+        int depth = (*(devinfo + SATA_DEVINFO_QUEUE_DEPTH) & 0x1f) + 1;
+        depth = ahci_port_set_queue_depth(controller, dev->port, depth);
+        if (depth > 1) {
+            flags |= SATA_FLAG_NCQ;
+            xprintf("  NCQ depth=%d\n", depth);
+        }
+    }
+
+    // merge requests for adjacent blocks, and on a rotational disk (rate 1
+    // is a solid state one) also send them in order of lba
+    uint32_t sched = AHCI_SCHED_MERGE;
+    if (*(devinfo + SATA_DEVINFO_ROTATION_RATE) != 1) {
+        sched |= AHCI_SCHED_ELEVATOR;
+    }
+    ahci_port_set_scheduler(controller, dev->port, sched);
     dev->flags = flags;
 
     return NO_ERROR;
@@ -150,6 +169,12 @@ static ssize_t sata_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t
          *blksize = device->sector_sz;
          return sizeof(*blksize);
     }
+    case BLOCK_OP_GET_QUEUE_STATS: {
+        block_queue_stats_t* stats = reply;
+        if (max < sizeof(*stats)) return ERR_NOT_ENOUGH_BUFFER;
+        ahci_port_get_stats(dev->parent, device->port, stats);
+        return sizeof(*stats);
+    }
     default:
         return ERR_NOT_SUPPORTED;
     }
@@ -165,11 +190,16 @@ static void sata_iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
         return;
     }
 
-    // constrain to device capacity
+    // constrain to device capacity, and to what one command can transfer
     txn->length = MIN(txn->length, device->capacity - txn->offset);
+    txn->length = MIN(txn->length, SATA_MAX_BLOCKS * device->sector_sz);
 
     sata_pdata_t* pdata = sata_iotxn_pdata(txn);
-    pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    if (device->flags & SATA_FLAG_NCQ) {
+        pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_FPDMA_QUEUED : SATA_CMD_WRITE_FPDMA_QUEUED;
+    } else {
+        pdata->cmd = txn->opcode == IOTXN_OP_READ ? SATA_CMD_READ_DMA_EXT : SATA_CMD_WRITE_DMA_EXT;
+    }
     pdata->device = 0x40;
     pdata->lba = txn->offset / device->sector_sz;
     pdata->count = txn->length / device->sector_sz;
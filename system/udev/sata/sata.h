@@ -11,12 +11,15 @@
 #define SATA_CMD_READ_DMA_EXT    0x25
 #define SATA_CMD_WRITE_DMA       0xca
 #define SATA_CMD_WRITE_DMA_EXT   0x35
+#define SATA_CMD_READ_FPDMA_QUEUED  0x60
+#define SATA_CMD_WRITE_FPDMA_QUEUED 0x61
 
 #define SATA_DEVINFO_SERIAL              10
 #define SATA_DEVINFO_FW_REV              23
 #define SATA_DEVINFO_MODEL_ID            27
 #define SATA_DEVINFO_CAP                 49
 #define SATA_DEVINFO_LBA_CAPACITY        60
+#define SATA_DEVINFO_QUEUE_DEPTH         75
 #define SATA_DEVINFO_SATA_CAP            76
 #define SATA_DEVINFO_SATA_CAP2           77
 #define SATA_DEVINFO_MAJOR_VERS          80
@@ -24,6 +27,9 @@
 #define SATA_DEVINFO_LBA_CAPACITY_2      100
 #define SATA_DEVINFO_SECTOR_SIZE         106
 #define SATA_DEVINFO_LOGICAL_SECTOR_SIZE 117
+#define SATA_DEVINFO_ROTATION_RATE       217
+
+#define SATA_MAX_BLOCKS 65536 // a count of 0 in the command means 65536
 
 #define SATA_DEVINFO_SERIAL_LEN   20
 #define SATA_DEVINFO_FW_REV_LEN   8
@@ -35,8 +41,17 @@ typedef struct sata_pdata {
     uint8_t cmd;
     uint8_t device;
     int port;
+
+    // filled in by ahci while the txn is queued
+    // txns merged into this one's command, whose data follows its own
+    iotxn_t* next;
+    uint32_t blocks; // in blocks, including merged txns
+    uint32_t merged; // number of merged txns
+    mx_time_t queued_at;
 } sata_pdata_t;
 
+static_assert(sizeof(sata_pdata_t) <= sizeof(((iotxn_t*)0)->protocol_data), "sata_pdata_t too large");
+
 #define sata_iotxn_pdata(txn) iotxn_pdata(txn, sata_pdata_t)
 
 mx_status_t sata_bind(mx_device_t* dev, int port);
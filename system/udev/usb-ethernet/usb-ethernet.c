@@ -19,7 +19,7 @@
 
 #include "asix.h"
 
-#define READ_REQ_COUNT 8
+#define READ_REQ_COUNT 32
 #define WRITE_REQ_COUNT 4
 #define INTR_REQ_COUNT 4
 #define USB_BUF_SIZE 2048
@@ -54,6 +54,9 @@ typedef struct {
     // the last signals we reported
     mx_signals_t signals;
 
+    // reads and writes move batches of frames
+    bool batched;
+
     mxr_mutex_t mutex;
 } usb_ethernet_t;
 #define get_usb_ethernet(dev) containerof(dev, usb_ethernet_t, device)
@@ -174,14 +177,17 @@ static void queue_interrupt_requests_locked(usb_ethernet_t* eth) {
     }
 }
 
-static void usb_ethernet_read_complete(usb_request_t* request) {
+static void usb_ethernet_read_complete(list_node_t* requests) {
+    usb_request_t* request = list_peek_head_type(requests, usb_request_t, node);
     usb_ethernet_t* eth = (usb_ethernet_t*)request->client_data;
 
     mxr_mutex_lock(&eth->mutex);
-    if (request->status == NO_ERROR) {
-        list_add_tail(&eth->completed_reads, &request->node);
-    } else {
-        requeue_read_request_locked(eth, request);
+    while ((request = list_remove_head_type(requests, usb_request_t, node)) != NULL) {
+        if (request->status == NO_ERROR) {
+            list_add_tail(&eth->completed_reads, &request->node);
+        } else {
+            requeue_read_request_locked(eth, request);
+        }
     }
     update_signals_locked(eth);
     mxr_mutex_unlock(&eth->mutex);
@@ -212,10 +218,13 @@ static void usb_ethernet_interrupt_complete(usb_request_t* request) {
         if (online && !was_online) {
             // Now that we are online, queue all our read requests
             usb_request_t* req;
-            usb_request_t* prev;
-            list_for_every_entry_safe (&eth->free_read_reqs, req, prev, usb_request_t, node) {
-                list_delete(&req->node);
-                requeue_read_request_locked(eth, req);
+            list_for_every_entry (&eth->free_read_reqs, req, usb_request_t, node) {
+                req->transfer_length = req->buffer_length;
+            }
+            mx_status_t status = eth->device_protocol->queue_requests(eth->usb_device,
+                                                                      &eth->free_read_reqs);
+            if (status != NO_ERROR) {
+                printf("bulk read failed %d\n", status);
             }
             update_signals_locked(eth);
         }
@@ -355,6 +364,9 @@ static ssize_t eth_read(mx_device_t* dev, void* data, size_t len, mx_off_t off)
         usb_ethernet_get_mac_addr(dev, data);
         return len;
     }
+    if (get_usb_ethernet(dev)->batched) {
+        return ethernet_read_batch(dev, &usb_ethernet_proto, data, len);
+    }
     if (len < usb_ethernet_get_mtu(dev)) {
         return ERR_NOT_ENOUGH_BUFFER;
     }
@@ -362,13 +374,36 @@ static ssize_t eth_read(mx_device_t* dev, void* data, size_t len, mx_off_t off)
 }
 
 static ssize_t eth_write(mx_device_t* dev, const void* data, size_t len, mx_off_t off) {
+    if (get_usb_ethernet(dev)->batched) {
+        return ethernet_write_batch(dev, &usb_ethernet_proto, data, len);
+    }
     return usb_ethernet_send(dev, data, len);
 }
 
+static ssize_t eth_ioctl(mx_device_t* dev, uint32_t op, const void* cmd, size_t cmdlen, void* reply, size_t max) {
+    switch (op) {
+    case ETHERNET_OP_GET_FEATURES:
+        if (max < sizeof(uint32_t)) {
+            return ERR_NOT_ENOUGH_BUFFER;
+        }
+        *(uint32_t*)reply = 0;
+        return sizeof(uint32_t);
+    case ETHERNET_OP_SET_BATCHED:
+        if (cmdlen < sizeof(uint32_t)) {
+            return ERR_INVALID_ARGS;
+        }
+        get_usb_ethernet(dev)->batched = (*(const uint32_t*)cmd != 0);
+        return NO_ERROR;
+    default:
+        return ERR_NOT_SUPPORTED;
+    }
+}
+
 static mx_protocol_device_t usb_ethernet_device_proto = {
     .release = usb_ethernet_release,
     .read = eth_read,
     .write = eth_write,
+    .ioctl = eth_ioctl,
 };
 
 static int usb_ethernet_start_thread(void* arg) {
@@ -536,7 +571,7 @@ static mx_status_t usb_ethernet_bind(mx_driver_t* driver, mx_device_t* device) {
         usb_request_t* req = protocol->alloc_request(device, bulk_in, USB_BUF_SIZE);
         if (!req)
             return ERR_NO_MEMORY;
-        req->complete_cb = usb_ethernet_read_complete;
+        req->complete_batch_cb = usb_ethernet_read_complete;
         req->client_data = eth;
         list_add_head(&eth->free_read_reqs, &req->node);
     }
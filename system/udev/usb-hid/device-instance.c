@@ -154,9 +154,24 @@ static ssize_t usb_hid_read_instance(mx_device_t* dev, void* buf, size_t count,
         return ERR_CHANNEL_CLOSED;
     }
 
+    // as many whole reports as fit, so a device that reports often
+    // doesn't cost a read per report
     size_t left;
+    ssize_t r = 0;
     mxr_mutex_lock(&hid->fifo.lock);
-    ssize_t r = mx_hid_fifo_read(&hid->fifo, buf, count);
+    while (hid->report_tail != hid->report_head) {
+        uint16_t* len = &hid->report_lens[hid->report_tail % HID_MAX_QUEUED_REPORTS];
+        if (*len > count - r) {
+            if (r == 0) {
+                // a report bigger than the buffer goes out in pieces
+                r = mx_hid_fifo_read(&hid->fifo, buf, count);
+                *len -= r;
+            }
+            break;
+        }
+        r += mx_hid_fifo_read(&hid->fifo, (uint8_t*)buf + r, *len);
+        hid->report_tail++;
+    }
     left = mx_hid_fifo_size(&hid->fifo);
     if (left == 0) {
         device_state_clr(&hid->dev, DEV_STATE_READABLE);
@@ -169,7 +169,13 @@ void usb_hid_process_req(usb_hid_dev_t* hid, const uint8_t* buf, uint16_t len) {
     foreach_instance(hid, instance) {
         mxr_mutex_lock(&instance->fifo.lock);
         bool was_empty = mx_hid_fifo_size(&instance->fifo) == 0;
-        ssize_t wrote = mx_hid_fifo_write(&instance->fifo, buf, len);
+        ssize_t wrote = ERR_NOT_ENOUGH_BUFFER;
+        if (instance->report_head - instance->report_tail < HID_MAX_QUEUED_REPORTS) {
+            wrote = mx_hid_fifo_write(&instance->fifo, buf, len);
+        }
+        if (wrote > 0) {
+            instance->report_lens[instance->report_head++ % HID_MAX_QUEUED_REPORTS] = len;
+        }
         if (wrote <= 0) {
             printf("could not write to usb-hid fifo (ret=%zd)\n", wrote);
         } else {
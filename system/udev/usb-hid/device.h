@@ -69,6 +69,11 @@ typedef struct {
     uint32_t flags;
 
     mx_hid_fifo_t fifo;
+    // lengths of the reports in the fifo, which reads hand out whole
+#define HID_MAX_QUEUED_REPORTS 256
+    uint16_t report_lens[HID_MAX_QUEUED_REPORTS];
+    uint32_t report_head;
+    uint32_t report_tail;
 
     struct list_node node;
 } usb_hid_dev_instance_t;
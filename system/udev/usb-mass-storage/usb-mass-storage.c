@@ -21,10 +21,13 @@
 
 #include "ums-hw.h"
 
-#define READ_REQ_COUNT 8
-#define WRITE_REQ_COUNT 4
+#define READ_REQ_COUNT 16
+#define WRITE_REQ_COUNT 16
 #define INTR_REQ_COUNT 4
 #define USB_BUF_SIZE 0x8000
+// most data moved by one command, whose data stage is split into
+// requests of USB_BUF_SIZE that are all queued together
+#define UMS_MAX_TRANSFER (8 * USB_BUF_SIZE)
 #define INTR_REQ_SIZE 8
 #define MSD_COMMAND_BLOCK_WRAPPER_SIZE 31
 #define MSD_COMMAND_STATUS_WRAPPER_SIZE 13
@@ -43,7 +46,6 @@ typedef struct {
     usb_device_protocol_t* usb_p;
     mx_driver_t* driver;
 
-    bool busy;
     uint8_t tag;
     uint32_t total_blocks;
     uint32_t block_size;
@@ -59,7 +61,6 @@ typedef struct {
     list_node_t free_read_reqs;
     list_node_t free_write_reqs;
     list_node_t free_intr_reqs;
-    list_node_t queued_reqs;
 
     // list of received packets not yet read by upper layer
     list_node_t completed_reads;
@@ -152,17 +153,11 @@ static usb_request_t* get_free_read(ums_t* msd) {
 }
 
 static mx_status_t ums_queue_request(ums_t* msd, usb_request_t* request) {
-    // necessary to make this function because MSD cannot deal with out of order requests
+    // the host controller runs the requests for each endpoint in order, so
+    // a command's CBW, data and CSW requests can all be queued at once,
+    // with the bulk in requests waiting for the device to send
     DEBUG_PRINT(("in queue request\n"));
-    if (!(msd->busy)) {
-        DEBUG_PRINT(("not busy case\n"));
-        msd->busy = true;
-        return msd->usb_p->queue_request(msd->udev, request);
-    } else {
-        DEBUG_PRINT(("busy case\n"));
-        list_add_tail(&msd->queued_reqs, &request->node);
-        return 0;
-    }
+    return msd->usb_p->queue_request(msd->udev, request);
 }
 
 static mx_status_t ums_send_cbw(ums_t* msd, uint32_t tag, uint32_t transfer_length, uint8_t flags,
@@ -203,26 +198,41 @@ static mx_status_t ums_recv_csw(ums_t* msd) {
     return ums_queue_request(msd, csw_request);
 }
 
-static mx_status_t ums_queue_read(ums_t* msd, uint16_t transfer_length) {
-    // read request sense response
-    list_node_t* read_node = list_remove_head(&msd->free_read_reqs);
-    if (!read_node) {
+static mx_status_t ums_queue_read(ums_t* msd, uint32_t transfer_length) {
+    // one request for each USB_BUF_SIZE of the data stage
+    if (list_length(&msd->free_read_reqs) < (transfer_length + USB_BUF_SIZE - 1) / USB_BUF_SIZE) {
         return ERR_NOT_ENOUGH_BUFFER;
     }
-    usb_request_t* read_request = containerof(read_node, usb_request_t, node);
-    read_request->transfer_length = transfer_length;
-    return ums_queue_request(msd, read_request);
+    while (transfer_length > 0) {
+        list_node_t* read_node = list_remove_head(&msd->free_read_reqs);
+        usb_request_t* read_request = containerof(read_node, usb_request_t, node);
+        read_request->transfer_length = (transfer_length > USB_BUF_SIZE) ? USB_BUF_SIZE : transfer_length;
+        transfer_length -= read_request->transfer_length;
+        mx_status_t status = ums_queue_request(msd, read_request);
+        if (status < 0) {
+            return status;
+        }
+    }
+    return NO_ERROR;
 }
 
-static mx_status_t ums_queue_write(ums_t* msd, uint16_t transfer_length, const void* data) {
-    list_node_t* write_node = list_remove_head(&msd->free_write_reqs);
-    if (!write_node) {
+static mx_status_t ums_queue_write(ums_t* msd, uint32_t transfer_length, const void* data) {
+    if (list_length(&msd->free_write_reqs) < (transfer_length + USB_BUF_SIZE - 1) / USB_BUF_SIZE) {
         return ERR_NOT_ENOUGH_BUFFER;
     }
-    usb_request_t* write_request = containerof(write_node, usb_request_t, node);
-    write_request->transfer_length = transfer_length;
-    memcpy(write_request->buffer, data, (size_t)transfer_length);
-    return ums_queue_request(msd, write_request);
+    while (transfer_length > 0) {
+        list_node_t* write_node = list_remove_head(&msd->free_write_reqs);
+        usb_request_t* write_request = containerof(write_node, usb_request_t, node);
+        write_request->transfer_length = (transfer_length > USB_BUF_SIZE) ? USB_BUF_SIZE : transfer_length;
+        memcpy(write_request->buffer, data, write_request->transfer_length);
+        data += write_request->transfer_length;
+        transfer_length -= write_request->transfer_length;
+        mx_status_t status = ums_queue_request(msd, write_request);
+        if (status < 0) {
+            return status;
+        }
+    }
+    return NO_ERROR;
 }
 
 // return true if valid CSW, else false
@@ -251,34 +261,15 @@ static csw_status_t ums_verify_csw(usb_request_t* csw_request, usb_request_t* da
     return CSW_SUCCESS;
 }
 
-static mx_status_t ums_next_request(ums_t* msd) {
-    DEBUG_PRINT(("Trying to dequeue next request\n"));
-    DEBUG_PRINT(("number of requests in list: %d\n", (int)(list_length(&msd->queued_reqs))));
-    list_node_t* node = list_remove_head(&msd->queued_reqs);
-    if (!node) {
-        DEBUG_PRINT(("no more nodes\n"));
-        msd->busy = false;
-        return 0;
-    }
-    DEBUG_PRINT(("got node, queuing request\n"));
-    usb_request_t* request = containerof(node, usb_request_t, node);
-    mx_status_t status = msd->usb_p->queue_request(msd->udev, request);
-    return status;
-}
-
 static void ums_read_complete(usb_request_t* request) {
     DEBUG_PRINT(("STARTING READ COMPLETE\n"));
 
     ums_t* msd = (ums_t*)request->client_data;
 
+    // failed ones too, ums_recv() reports the error
     mxr_mutex_lock(&msd->mutex);
-    if (request->status == NO_ERROR) {
-        list_add_tail(&msd->completed_reads, &request->node);
-        mxr_completion_signal(&(msd->read_completion));
-    } else {
-        list_add_head(&msd->queued_reqs, &request->node);
-    }
-    ums_next_request(msd);
+    list_add_tail(&msd->completed_reads, &request->node);
+    mxr_completion_signal(&(msd->read_completion));
     mxr_mutex_unlock(&msd->mutex);
     DEBUG_PRINT(("ENDING READ COMPLETE\n"));
 }
@@ -289,13 +280,8 @@ static void ums_csw_complete(usb_request_t* request) {
     ums_t* msd = (ums_t*)request->client_data;
 
     mxr_mutex_lock(&msd->mutex);
-    if (request->status == NO_ERROR) {
-        //TODO: verify csw against info
-        list_add_tail(&msd->free_csw_reqs, &request->node);
-    } else {
-        list_add_head(&msd->queued_reqs, &request->node);
-    }
-    ums_next_request(msd);
+    //TODO: verify csw against info
+    list_add_tail(&msd->free_csw_reqs, &request->node);
     mxr_mutex_unlock(&msd->mutex);
     DEBUG_PRINT(("ENDING CSW COMPLETE\n"));
 }
@@ -306,7 +292,6 @@ static void ums_write_complete(usb_request_t* request) {
     // FIXME what to do with error here?
     mxr_mutex_lock(&msd->mutex);
     list_add_tail(&msd->free_write_reqs, &request->node);
-    ums_next_request(msd);
     mxr_mutex_unlock(&msd->mutex);
     DEBUG_PRINT(("ENDING WRITE COMPLETE\n"));
 }
@@ -661,7 +646,7 @@ mx_status_t ums_write12(mx_device_t* device, uint8_t lun, uint32_t lba, uint32_t
     uint32_t* lba_ptr = (uint32_t*)&(command[2]);
     *lba_ptr = htobe32(lba);
     // set transfer length
-    uint32_t* transfer_len_ptr = (uint32_t*)&(command[7]);
+    uint32_t* transfer_len_ptr = (uint32_t*)&(command[6]);
     *transfer_len_ptr = htobe32(num_blocks);
     status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_OUT, lun,
                             MS_WRITE12_COMMAND_LENGTH, command);
@@ -699,7 +684,7 @@ mx_status_t ums_write16(mx_device_t* device, uint8_t lun, uint64_t lba, uint32_t
     uint64_t* lba_ptr = (uint64_t*)&(command[2]);
     *lba_ptr = htobe64(lba);
     // set transfer length
-    uint32_t* transfer_len_ptr = (uint32_t*)&(command[7]);
+    uint32_t* transfer_len_ptr = (uint32_t*)&(command[10]);
     *transfer_len_ptr = htobe32(num_blocks);
     status = ums_send_cbw(msd, (msd->tag)++, transfer_length, USB_DIR_OUT, lun,
                             MS_WRITE16_COMMAND_LENGTH, command);
@@ -744,31 +729,37 @@ out:
     return status;
 }
 
+// Collect the data of the read requests queued for a command's length
+// bytes, which complete in the order they were queued.
 mx_status_t ums_recv(mx_device_t* device, void* buffer, size_t length) {
     DEBUG_PRINT(("start of ums_recv\n"));
     ums_t* msd = get_ums(device);
     mx_status_t status = NO_ERROR;
     mxr_mutex_lock(&msd->mutex);
 
-    list_node_t* node = list_remove_head(&msd->completed_reads);
-    if (!node) {
-        mxr_mutex_unlock(&msd->mutex);
-        DEBUG_PRINT(("before wait\n"));
-        mx_status_t wait_status = mxr_completion_wait(&(msd->read_completion), MX_TIME_INFINITE);
-        DEBUG_PRINT(("after wait\n"));
-        mxr_mutex_lock(&msd->mutex);
-        if (wait_status == ERR_TIMED_OUT) {
-            DEBUG_PRINT(("no node :(\n"));
-            // is this right error code to use?
-            status = ERR_NOT_FOUND;
-            goto out;
+    while (length > 0) {
+        list_node_t* node;
+        while ((node = list_remove_head(&msd->completed_reads)) == NULL) {
+            // reset under the lock, so a completion can't be missed
+            mxr_completion_reset(&(msd->read_completion));
+            mxr_mutex_unlock(&msd->mutex);
+            DEBUG_PRINT(("before wait\n"));
+            mxr_completion_wait(&(msd->read_completion), MX_TIME_INFINITE);
+            DEBUG_PRINT(("after wait\n"));
+            mxr_mutex_lock(&msd->mutex);
+        }
+        usb_request_t* request = containerof(node, usb_request_t, node);
+        size_t count = (length > USB_BUF_SIZE) ? USB_BUF_SIZE : length;
+        if (request->status != NO_ERROR) {
+            status = request->status;
+        } else {
+            memcpy(buffer, request->buffer, (request->transfer_length < count) ? request->transfer_length : count);
         }
-        mxr_completion_reset(&(msd->read_completion));
-        node = list_remove_head(&msd->completed_reads);
+        list_add_tail(&msd->free_read_reqs, &request->node);
+        buffer += count;
+        length -= count;
     }
-    usb_request_t* request = containerof(node, usb_request_t, node);
-    memcpy(buffer, request->buffer, request->transfer_length);
-out:
+
     DEBUG_PRINT(("got to recv out\n"));
     mxr_mutex_unlock(&msd->mutex);
     return status;
@@ -802,29 +793,34 @@ static ssize_t ums_read(mx_device_t* dev, void* data, size_t len, mx_off_t off)
     }
     // TODO: deal with lun
     uint8_t lun = 0;
-    switch (get_ums(dev)->read_flag) {
-    case USE_READ10:
-        ums_read10(dev, lun, off/block_size, len/block_size);
-        break;
-    case USE_READ12:
-        ums_read12(dev, lun, off/block_size, len/block_size);
-        break;
-    case USE_READ16:
-        ums_read16(dev, lun, off/block_size, len/block_size);
-        break;
-    }
     DEBUG_PRINT(("data: %p\n", data));
-    DEBUG_PRINT(("len: %d\n", (uint8_t)len));
+    DEBUG_PRINT(("len: %d\n", (uint32_t)len));
     DEBUG_PRINT(("block size: %d\n", block_size));
 
-    for (int i = 0; i < 18; i++) {
-        DEBUG_PRINT(("%02x ", ((unsigned char*)(data))[i]));
-    }
-    DEBUG_PRINT(("\n"));
-    ums_recv(dev, data, len);
-    DEBUG_PRINT(("data post recv in read\n"));
-    for (int i = 0; i < 18; i++) {
-        DEBUG_PRINT(("%02x ", ((unsigned char*)(data))[i]));
+    // up to UMS_MAX_TRANSFER a command
+    size_t done = 0;
+    while (done < len) {
+        size_t count = (len - done > UMS_MAX_TRANSFER) ? UMS_MAX_TRANSFER : len - done;
+        mx_off_t lba = (off + done) / block_size;
+        mx_status_t status = ERR_NOT_SUPPORTED;
+        switch (get_ums(dev)->read_flag) {
+        case USE_READ10:
+            status = ums_read10(dev, lun, lba, count / block_size);
+            break;
+        case USE_READ12:
+            status = ums_read12(dev, lun, lba, count / block_size);
+            break;
+        case USE_READ16:
+            status = ums_read16(dev, lun, lba, count / block_size);
+            break;
+        }
+        if (status == NO_ERROR) {
+            status = ums_recv(dev, data + done, count);
+        }
+        if (status != NO_ERROR) {
+            return done ? (ssize_t)done : status;
+        }
+        done += count;
     }
     DEBUG_PRINT(("returning this size: %d\n", (uint32_t)(len)));
     return len;
@@ -845,16 +841,27 @@ static ssize_t ums_write(mx_device_t* dev, const void* data, size_t len, mx_off_
         return 0;
     }
 
-    switch (get_ums(dev)->read_flag) {
-    case USE_READ10:
-        ums_write10(dev, lun, off/block_size, len/block_size, data);
-        break;
-    case USE_READ12:
-        ums_write12(dev, lun, off/block_size, len/block_size, data);
-        break;
-    case USE_READ16:
-        ums_write16(dev, lun, off/block_size, len/block_size, data);
-        break;
+    // up to UMS_MAX_TRANSFER a command
+    size_t done = 0;
+    while (done < len) {
+        size_t count = (len - done > UMS_MAX_TRANSFER) ? UMS_MAX_TRANSFER : len - done;
+        mx_off_t lba = (off + done) / block_size;
+        mx_status_t status = ERR_NOT_SUPPORTED;
+        switch (get_ums(dev)->read_flag) {
+        case USE_READ10:
+            status = ums_write10(dev, lun, lba, count / block_size, data + done);
+            break;
+        case USE_READ12:
+            status = ums_write12(dev, lun, lba, count / block_size, data + done);
+            break;
+        case USE_READ16:
+            status = ums_write16(dev, lun, lba, count / block_size, data + done);
+            break;
+        }
+        if (status != NO_ERROR) {
+            return done ? (ssize_t)done : status;
+        }
+        done += count;
     }
     return len;
 }
@@ -954,7 +961,6 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
     list_initialize(&msd->free_csw_reqs);
     list_initialize(&msd->free_write_reqs);
     list_initialize(&msd->free_intr_reqs);
-    list_initialize(&msd->queued_reqs);
     list_initialize(&msd->completed_reads);
     list_initialize(&msd->completed_csws);
 
@@ -1005,7 +1011,6 @@ static mx_status_t ums_bind(mx_driver_t* driver, mx_device_t* device) {
     ums_get_max_lun(msd, (void*)&lun);
     DEBUG_PRINT(("Max lun is: %02x\n", (unsigned char)lun));
 
-    msd->busy = false;
     msd->tag = 8;
     msd->read_completion = MXR_COMPLETION_INIT;
     mxr_thread_t* thread;
@@ -0,0 +1,87 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <magenta/types.h>
+#include <system/compiler.h>
+
+__BEGIN_CDECLS
+
+// An event loop for services, built on an IO port. Each source is bound to
+// the port when it is added, so a wakeup goes straight to the handler for
+// its source however many sources the loop has.
+//
+// The loop runs on the caller's thread with async_loop_run(), or on a pool
+// of its own with async_loop_start_threads(), or both. Handlers for
+// different sources may then run at the same time, but those for any one
+// source are only ever called one at a time.
+typedef struct async_loop async_loop_t;
+
+// Names a source added to a loop, for async_loop_remove()
+typedef uint64_t async_id_t;
+
+// Called when a handle asserts some of the signals it was added with.
+// Bindings are edge triggered, so a handler for a message pipe must read
+// until the pipe is empty to hear about the next message.
+typedef void (*async_handle_cb_t)(async_loop_t* loop, void* cookie,
+                                  mx_handle_t h, mx_signals_t signals);
+
+// Called when a PCI interrupt fires. |count| is how many times it fired
+// since the handler was last called, and |timestamp| when the first of
+// those was. Legacy interrupts must be re-enabled with
+// mx_pci_interrupt_complete() before they fire again.
+typedef void (*async_interrupt_cb_t)(async_loop_t* loop, void* cookie,
+                                     mx_handle_t h, uint32_t count, mx_time_t timestamp);
+
+// Called when a timer expires
+typedef void (*async_timer_cb_t)(async_loop_t* loop, void* cookie);
+
+// Called for work handed to the loop with async_loop_post()
+typedef void (*async_task_cb_t)(async_loop_t* loop, void* cookie);
+
+mx_status_t async_loop_create(async_loop_t** out);
+
+// Start count threads running the loop. Can only be done once.
+mx_status_t async_loop_start_threads(async_loop_t* loop, uint32_t count, const char* name);
+
+// Run the loop on the current thread until async_loop_quit()
+mx_status_t async_loop_run(async_loop_t* loop);
+
+// Make every thread running the loop return once it finishes the handler
+// it is in, if any. Handlers can call this.
+void async_loop_quit(async_loop_t* loop);
+
+// Quit the loop, wait for the threads it started, and free it. Sources
+// still added are removed. Any threads in async_loop_run() must have
+// returned first.
+void async_loop_destroy(async_loop_t* loop);
+
+// Call cb whenever h asserts any of signals. The caller keeps h, and must
+// not close it until the source is removed.
+mx_status_t async_loop_add_handle(async_loop_t* loop, mx_handle_t h, mx_signals_t signals,
+                                  async_handle_cb_t cb, void* cookie, async_id_t* out_id);
+
+// Call cb whenever the PCI interrupt h fires. The caller keeps h, and must
+// not close it until the source is removed.
+mx_status_t async_loop_add_interrupt(async_loop_t* loop, mx_handle_t h,
+                                     async_interrupt_cb_t cb, void* cookie, async_id_t* out_id);
+
+// Call cb once delay nanoseconds from now, and then every period
+// nanoseconds if period is not zero. Each expiry may be up to slack late,
+// see mx_timer_set(). A one-shot timer is removed after it fires.
+mx_status_t async_loop_add_timer(async_loop_t* loop, mx_time_t delay, mx_time_t period,
+                                 mx_time_t slack, async_timer_cb_t cb, void* cookie,
+                                 async_id_t* out_id);
+
+// Stop calling the source's handler. Returns ERR_NOT_FOUND if the source
+// is already gone. A handler can remove its own source, after which it
+// won't be called again once it returns. Removed from another thread, the
+// handler may still be running when this returns.
+mx_status_t async_loop_remove(async_loop_t* loop, async_id_t id);
+
+// Call cb(loop, cookie) on one of the loop's threads
+mx_status_t async_loop_post(async_loop_t* loop, async_task_cb_t cb, void* cookie);
+
+__END_CDECLS
@@ -0,0 +1,445 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <async/loop.h>
+#include <magenta/syscalls.h>
+
+#include <runtime/mutex.h>
+#include <runtime/thread.h>
+
+typedef enum {
+    SOURCE_HANDLE,
+    SOURCE_INTERRUPT,
+    SOURCE_TIMER,
+} source_type_t;
+
+typedef struct {
+    source_type_t type;
+    mx_handle_t h;
+    async_id_t id;
+    uint32_t slot;
+    bool oneshot;
+    void* cb;
+    void* cookie;
+
+    // set while a thread is running this source's handler, other threads
+    // leave what they saw in pending for it
+    bool busy;
+    bool removed;
+    mx_signals_t pending_signals;
+    uint32_t pending_count;
+    mx_time_t pending_time;
+} source_t;
+
+// Packets are keyed by slot and generation rather than by source pointer,
+// so that one still in the port for a source that has since been removed
+// is recognized and dropped, whichever thread dequeues it.
+typedef struct {
+    source_t* source;
+    uint32_t gen;
+    uint32_t next_free;
+} slot_t;
+
+#define NO_SLOT ((uint32_t)-1)
+#define MIN_SLOTS 16
+
+#define KEY(slot, gen) (((uint64_t)(gen) << 32) | (slot))
+#define KEY_SLOT(key) ((uint32_t)(key))
+#define KEY_GEN(key) ((uint32_t)((key) >> 32))
+
+// keys of the loop's own packets, which no source can have
+#define KEY_TASK KEY(NO_SLOT, 0)
+#define KEY_QUIT KEY(NO_SLOT, 1)
+
+typedef struct {
+    mx_packet_header_t hdr;
+    async_task_cb_t cb;
+    void* cookie;
+} task_packet_t;
+
+typedef union {
+    mx_packet_header_t hdr;
+    mx_io_packet_t io;
+    mx_interrupt_packet_t interrupt;
+    task_packet_t task;
+    uint8_t bytes[MX_IO_PORT_MAX_PKT_SIZE];
+} packet_t;
+
+struct async_loop {
+    mxr_mutex_t lock;
+    slot_t* slots;
+    uint32_t slot_count;
+    uint32_t free_slot;
+    bool quit;
+    mxr_thread_t** threads;
+    uint32_t thread_count;
+    mx_handle_t ioport;
+};
+
+// Take a slot for source, growing the table if none is free.
+// Called with the lock held.
+static mx_status_t alloc_slot(async_loop_t* loop, source_t* source) {
+    if (loop->free_slot == NO_SLOT) {
+        uint32_t count = loop->slot_count ? loop->slot_count * 2 : MIN_SLOTS;
+        slot_t* slots = realloc(loop->slots, count * sizeof(slot_t));
+        if (slots == NULL) {
+            return ERR_NO_MEMORY;
+        }
+        for (uint32_t n = loop->slot_count; n < count; n++) {
+            slots[n].source = NULL;
+            slots[n].gen = 0;
+            slots[n].next_free = (n + 1 < count) ? n + 1 : NO_SLOT;
+        }
+        loop->free_slot = loop->slot_count;
+        loop->slots = slots;
+        loop->slot_count = count;
+    }
+    source->slot = loop->free_slot;
+    loop->free_slot = loop->slots[source->slot].next_free;
+    loop->slots[source->slot].source = source;
+    return NO_ERROR;
+}
+
+// Retire source's slot, after which packets bound for it are ignored.
+// Called with the lock held.
+static void free_slot(async_loop_t* loop, source_t* source) {
+    slot_t* slot = &loop->slots[source->slot];
+    slot->source = NULL;
+    slot->gen++;
+    slot->next_free = loop->free_slot;
+    loop->free_slot = source->slot;
+}
+
+// Stop the port delivering packets for a source whose slot is retired.
+static void unbind_source(async_loop_t* loop, source_type_t type, mx_handle_t h, uint64_t key) {
+    if (type == SOURCE_TIMER) {
+        // the timer is ours, and closing it unbinds it
+        mx_handle_close(h);
+    } else {
+        mx_io_port_bind(loop->ioport, key, h, 0u);
+    }
+}
+
+static mx_status_t add_source(async_loop_t* loop, source_t* source, mx_signals_t signals,
+                              async_id_t* out_id) {
+    mx_status_t r;
+
+    mxr_mutex_lock(&loop->lock);
+    if ((r = alloc_slot(loop, source)) == NO_ERROR) {
+        source->id = KEY(source->slot, loop->slots[source->slot].gen);
+        if ((r = mx_io_port_bind(loop->ioport, source->id, source->h, signals)) < 0) {
+            free_slot(loop, source);
+        } else if (out_id) {
+            *out_id = source->id;
+        }
+    }
+    mxr_mutex_unlock(&loop->lock);
+    return r;
+}
+
+// Find the source a packet is for and make it busy. Returns NULL if it is
+// gone, or if another thread is running it and will see the packet.
+static source_t* claim_source(async_loop_t* loop, const packet_t* packet) {
+    uint32_t slot = KEY_SLOT(packet->hdr.key);
+    source_t* source = NULL;
+
+    mxr_mutex_lock(&loop->lock);
+    if ((slot < loop->slot_count) && (loop->slots[slot].gen == KEY_GEN(packet->hdr.key))) {
+        source = loop->slots[slot].source;
+    }
+    if (source != NULL) {
+        if (source->type == SOURCE_INTERRUPT) {
+            if (source->pending_count == 0) {
+                source->pending_time = packet->interrupt.timestamp;
+            }
+            source->pending_count += packet->hdr.extra;
+        } else {
+            source->pending_signals |= packet->io.signals;
+            source->pending_count++;
+        }
+        if (source->busy) {
+            source = NULL;
+        } else {
+            source->busy = true;
+        }
+    }
+    mxr_mutex_unlock(&loop->lock);
+    return source;
+}
+
+// Returns true with what the handler should be called for next, or false
+// once there's nothing left, after which the source is no longer busy.
+// A source removed while busy is freed here.
+static bool take_pending(async_loop_t* loop, source_t* source, mx_signals_t* signals,
+                         uint32_t* count, mx_time_t* timestamp) {
+    mxr_mutex_lock(&loop->lock);
+    bool removed = source->removed;
+    bool pending = !removed && (source->pending_count != 0);
+    if (pending) {
+        *signals = source->pending_signals;
+        *count = source->pending_count;
+        *timestamp = source->pending_time;
+        source->pending_signals = 0;
+        source->pending_count = 0;
+    } else {
+        source->busy = false;
+    }
+    mxr_mutex_unlock(&loop->lock);
+
+    if (removed) {
+        free(source);
+    }
+    return pending;
+}
+
+static void run_source(async_loop_t* loop, source_t* source) {
+    mx_signals_t signals;
+    uint32_t count;
+    mx_time_t timestamp;
+
+    while (take_pending(loop, source, &signals, &count, &timestamp)) {
+        switch (source->type) {
+        case SOURCE_HANDLE:
+            ((async_handle_cb_t)source->cb)(loop, source->cookie, source->h, signals);
+            break;
+        case SOURCE_INTERRUPT:
+            ((async_interrupt_cb_t)source->cb)(loop, source->cookie, source->h, count, timestamp);
+            break;
+        case SOURCE_TIMER:
+            ((async_timer_cb_t)source->cb)(loop, source->cookie);
+            if (source->oneshot) {
+                // it may already have been removed by the handler
+                async_loop_remove(loop, source->id);
+            }
+            break;
+        }
+    }
+}
+
+static void dispatch(async_loop_t* loop, const packet_t* packet) {
+    if (packet->hdr.type == MX_IO_PORT_PKT_TYPE_USER) {
+        if (packet->hdr.key == KEY_TASK) {
+            packet->task.cb(loop, packet->task.cookie);
+        }
+        return;
+    }
+    if ((packet->hdr.type != MX_IO_PORT_PKT_TYPE_IOSN) &&
+        (packet->hdr.type != MX_IO_PORT_PKT_TYPE_INTERRUPT)) {
+        return;
+    }
+
+    source_t* source = claim_source(loop, packet);
+    if (source != NULL) {
+        run_source(loop, source);
+    }
+}
+
+mx_status_t async_loop_run(async_loop_t* loop) {
+    for (;;) {
+        packet_t packet;
+        mx_status_t r = mx_io_port_wait(loop->ioport, MX_TIME_INFINITE, &packet, sizeof(packet));
+        if (r < 0) {
+            return r;
+        }
+        if ((packet.hdr.type == MX_IO_PORT_PKT_TYPE_USER) && (packet.hdr.key == KEY_QUIT)) {
+            // pass it on to the next thread
+            mx_io_port_queue(loop->ioport, &packet.hdr, sizeof(packet.hdr));
+            return NO_ERROR;
+        }
+        dispatch(loop, &packet);
+    }
+}
+
+static int async_loop_thread(void* arg) {
+    async_loop_run(arg);
+    return 0;
+}
+
+mx_status_t async_loop_create(async_loop_t** out) {
+    async_loop_t* loop;
+    if ((loop = calloc(1, sizeof(*loop))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    loop->lock = MXR_MUTEX_INIT;
+    loop->free_slot = NO_SLOT;
+    if ((loop->ioport = mx_io_port_create(0u)) < 0) {
+        mx_status_t r = loop->ioport;
+        free(loop);
+        return r;
+    }
+    *out = loop;
+    return NO_ERROR;
+}
+
+mx_status_t async_loop_start_threads(async_loop_t* loop, uint32_t count, const char* name) {
+    if (count == 0) {
+        return ERR_INVALID_ARGS;
+    }
+
+    mxr_mutex_lock(&loop->lock);
+    if (loop->threads != NULL) {
+        mxr_mutex_unlock(&loop->lock);
+        return ERR_BAD_STATE;
+    }
+    if ((loop->threads = calloc(count, sizeof(mxr_thread_t*))) == NULL) {
+        mxr_mutex_unlock(&loop->lock);
+        return ERR_NO_MEMORY;
+    }
+    for (; loop->thread_count < count; loop->thread_count++) {
+        if (mxr_thread_create(async_loop_thread, loop, name ? name : "async-loop",
+                              &loop->threads[loop->thread_count])) {
+            break;
+        }
+    }
+    mxr_mutex_unlock(&loop->lock);
+
+    return (loop->thread_count == 0) ? ERR_NO_RESOURCES : NO_ERROR;
+}
+
+void async_loop_quit(async_loop_t* loop) {
+    mxr_mutex_lock(&loop->lock);
+    bool first = !loop->quit;
+    loop->quit = true;
+    mxr_mutex_unlock(&loop->lock);
+
+    if (first) {
+        mx_packet_header_t hdr = {KEY_QUIT, 0u, 0u};
+        mx_io_port_queue(loop->ioport, &hdr, sizeof(hdr));
+    }
+}
+
+void async_loop_destroy(async_loop_t* loop) {
+    async_loop_quit(loop);
+    for (uint32_t n = 0; n < loop->thread_count; n++) {
+        mxr_thread_join(loop->threads[n], NULL);
+    }
+    free(loop->threads);
+
+    // nothing is running any more, so no source is busy
+    for (uint32_t n = 0; n < loop->slot_count; n++) {
+        source_t* source = loop->slots[n].source;
+        if (source != NULL) {
+            unbind_source(loop, source->type, source->h, source->id);
+            free(source);
+        }
+    }
+    free(loop->slots);
+    mx_handle_close(loop->ioport);
+    free(loop);
+}
+
+mx_status_t async_loop_add_handle(async_loop_t* loop, mx_handle_t h, mx_signals_t signals,
+                                  async_handle_cb_t cb, void* cookie, async_id_t* out_id) {
+    if (signals == 0) {
+        return ERR_INVALID_ARGS;
+    }
+
+    source_t* source;
+    if ((source = calloc(1, sizeof(source_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    source->type = SOURCE_HANDLE;
+    source->h = h;
+    source->cb = cb;
+    source->cookie = cookie;
+
+    mx_status_t r = add_source(loop, source, signals, out_id);
+    if (r < 0) {
+        free(source);
+    }
+    return r;
+}
+
+mx_status_t async_loop_add_interrupt(async_loop_t* loop, mx_handle_t h,
+                                     async_interrupt_cb_t cb, void* cookie, async_id_t* out_id) {
+    source_t* source;
+    if ((source = calloc(1, sizeof(source_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    source->type = SOURCE_INTERRUPT;
+    source->h = h;
+    source->cb = cb;
+    source->cookie = cookie;
+
+    // any signals bind an interrupt
+    mx_status_t r = add_source(loop, source, MX_SIGNAL_SIGNALED, out_id);
+    if (r < 0) {
+        free(source);
+    }
+    return r;
+}
+
+mx_status_t async_loop_add_timer(async_loop_t* loop, mx_time_t delay, mx_time_t period,
+                                 mx_time_t slack, async_timer_cb_t cb, void* cookie,
+                                 async_id_t* out_id) {
+    source_t* source;
+    if ((source = calloc(1, sizeof(source_t))) == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    source->type = SOURCE_TIMER;
+    source->oneshot = (period == 0);
+    source->cb = cb;
+    source->cookie = cookie;
+
+    mx_status_t r;
+    if ((source->h = mx_timer_create(0u)) < 0) {
+        r = source->h;
+        free(source);
+        return r;
+    }
+
+    // bound before it is set, so that the expiry can't be missed
+    async_id_t id;
+    if ((r = add_source(loop, source, MX_SIGNAL_SIGNALED, &id)) < 0) {
+        mx_handle_close(source->h);
+        free(source);
+        return r;
+    }
+    if ((r = mx_timer_set(source->h, mx_current_time() + delay, period, slack)) < 0) {
+        async_loop_remove(loop, id);
+        return r;
+    }
+    if (out_id) {
+        *out_id = id;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t async_loop_remove(async_loop_t* loop, async_id_t id) {
+    uint32_t slot = KEY_SLOT(id);
+    source_t* source = NULL;
+
+    mxr_mutex_lock(&loop->lock);
+    if ((slot < loop->slot_count) && (loop->slots[slot].gen == KEY_GEN(id))) {
+        source = loop->slots[slot].source;
+    }
+    if (source == NULL) {
+        mxr_mutex_unlock(&loop->lock);
+        return ERR_NOT_FOUND;
+    }
+    free_slot(loop, source);
+
+    // a busy source is freed by the thread running it, so take what we
+    // need before letting go of the lock
+    source_type_t type = source->type;
+    mx_handle_t h = source->h;
+    bool busy = source->busy;
+    source->removed = true;
+    mxr_mutex_unlock(&loop->lock);
+
+    unbind_source(loop, type, h, id);
+    if (!busy) {
+        free(source);
+    }
+    return NO_ERROR;
+}
+
+mx_status_t async_loop_post(async_loop_t* loop, async_task_cb_t cb, void* cookie) {
+    task_packet_t packet = {{KEY_TASK, 0u, 0u}, cb, cookie};
+    return mx_io_port_queue(loop->ioport, &packet, sizeof(packet));
+}
@@ -0,0 +1,19 @@
+# Copyright 2016 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := userlib
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/loop.c \
+
+MODULE_STATIC_LIBS := ulib/runtime
+MODULE_LIBS := ulib/magenta ulib/musl
+
+MODULE_EXPORT := async
+
+include make/module.mk
@@ -86,14 +86,34 @@ struct iotxn {
     uint8_t extra[0];
 };
 
+// one physically contiguous piece of an iotxn's data
+typedef struct {
+    mx_paddr_t paddr;
+    size_t length;
+} iotxn_sg_t;
+
 #define iotxn_to(txn, type) ((type*) (txn)->extra)
 #define iotxn_pdata(txn, type) ((type*) (txn)->protocol_data)
 
 
 // create a new iotxn with payload space of data_size
 // and extra storage space of extra_size
+// released iotxns are reused, and the payload of a reused one
+// is not cleared, only the iotxn itself and its extra storage
 mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size);
 
+// create a new iotxn whose payload is length bytes of a vmo at offset,
+// with extra storage space of extra_size
+// the vmo handle is not duplicated, the caller must keep it open
+// until the iotxn is released
+mx_status_t iotxn_alloc_vmo(iotxn_t** out, uint32_t flags, mx_handle_t vmo,
+                            uint64_t offset, size_t length, size_t extra_size);
+
+// allocate count iotxns of the given sizes up front, for drivers
+// that keep a fixed number in flight, so that iotxn_alloc() of
+// those sizes never has to allocate memory
+mx_status_t iotxn_prealloc(size_t count, size_t data_size, size_t extra_size);
+
 // queue an iotxn against a device
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn);
 
@@ -126,6 +146,12 @@ struct iotxn_ops {
     // be the buffer itself, or a temporary, depending on conditions.
     void (*physmap)(iotxn_t* txn, mx_paddr_t* addr);
 
+    // physmap_sg() returns a list of the physically contiguous pieces of
+    // the iotxn's buffer data, in order, so that a processor that can do
+    // scatter-gather DMA need not have the data copied to a contiguous
+    // temporary. The list is valid until the iotxn is released.
+    mx_status_t (*physmap_sg)(iotxn_t* txn, iotxn_sg_t** sg, uint32_t* count);
+
     // mmap() returns a void* pointing at the data in the iotxn's buffer.
     // This may have to do an expensive memory map operation or copy data
     // to a local buffer.  copyfrom(), copyto(), or physmap() are almost
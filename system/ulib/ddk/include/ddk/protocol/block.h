@@ -2,7 +2,21 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
-#define BLOCK_OP_GET_SIZE      1
-#define BLOCK_OP_GET_BLOCKSIZE 2
-#define BLOCK_OP_GET_GUID      3
-#define BLOCK_OP_GET_NAME      4
+#pragma once
+
+#include <stdint.h>
+
+#define BLOCK_OP_GET_SIZE        1
+#define BLOCK_OP_GET_BLOCKSIZE   2
+#define BLOCK_OP_GET_GUID        3
+#define BLOCK_OP_GET_NAME        4
+#define BLOCK_OP_GET_QUEUE_STATS 5
+
+// reply to BLOCK_OP_GET_QUEUE_STATS, for the whole disk
+typedef struct block_queue_stats {
+    uint64_t queued;    // requests queued to the disk
+    uint64_t merged;    // requests merged into a neighbour's command
+    uint64_t commands;  // commands sent to the disk
+    uint32_t depth;     // requests waiting to be sent now
+    uint32_t max_depth; // most requests ever waiting at once
+} block_queue_stats_t;
@@ -53,3 +53,12 @@ typedef struct {
 } ioctl_display_get_fb_t;
 
 #define DISPLAY_OP_FLUSH_FB 2
+
+// copies only a rectangle of the framebuffer, in pixels, to the display
+#define DISPLAY_OP_FLUSH_FB_REGION 3
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} ioctl_display_region_t;
@@ -7,6 +7,9 @@
 #include <ddk/driver.h>
 #include <hw/usb.h>
 #include <stdbool.h>
+#include <sys/types.h>
+
+typedef struct eth_batch_hdr eth_batch_hdr_t;
 
 typedef struct ethernet_protocol {
     mx_status_t (*send)(mx_device_t* device, const void* buffer, size_t length);
@@ -15,6 +18,112 @@ typedef struct ethernet_protocol {
     mx_status_t (*get_mac_addr)(mx_device_t* device, uint8_t* out_addr);
     bool (*is_online)(mx_device_t* device);
     size_t (*get_mtu)(mx_device_t* device);
+
+    // optional: returns the ETH_FEATURE_* flags
+    uint32_t (*get_features)(mx_device_t* device);
+    // optional, for ETH_FEATURE_TX_CSUM and ETH_FEATURE_RX_CSUM: send and
+    // recv that take and fill in the checksum fields of hdr
+    mx_status_t (*send_csum)(mx_device_t* device, const void* buffer, const eth_batch_hdr_t* hdr);
+    mx_status_t (*recv_csum)(mx_device_t* device, void* buffer, size_t length, eth_batch_hdr_t* hdr);
 } ethernet_protocol_t;
 
 #define ETH_MAC_SIZE 6
+
+// The hardware computes checksums, as described by eth_batch_hdr_t.
+#define ETH_FEATURE_TX_CSUM (1u << 0)
+#define ETH_FEATURE_RX_CSUM (1u << 1)
+
+// returns the ETH_FEATURE_* flags as a uint32_t
+#define ETHERNET_OP_GET_FEATURES 4
+
+// Batched reads and writes. After ETHERNET_OP_SET_BATCHED with a
+// nonzero uint32_t, the device's read and write move runs of frames,
+// each preceded by an eth_batch_hdr_t and padded to ETH_BATCH_ALIGN,
+// rather than a single frame. A read returns as many received frames as
+// fit, and a write returns how much of the batch was sent.
+#define ETHERNET_OP_SET_BATCHED 2
+
+#define ETH_BATCH_ALIGN 4
+
+// With ETH_BATCH_CSUM on a frame written, the frame is summed from
+// csum_start to its end and the complement of the sum is stored at
+// csum_start + csum. The caller puts the pseudo header sum there first.
+// With ETH_BATCH_CSUM on a frame read, csum is the sum of the frame from
+// csum_start to its end. Sums are the 16 bit one's complement sums of
+// Internet checksums, of the words as they lie in memory.
+#define ETH_BATCH_CSUM (1u << 0)
+
+struct eth_batch_hdr {
+    uint16_t length;
+    uint16_t flags;
+    uint16_t csum_start;
+    uint16_t csum;
+};
+
+#define ETH_BATCH_NEXT(length) \
+    ((sizeof(eth_batch_hdr_t) + (length) + ETH_BATCH_ALIGN - 1) & ~(ETH_BATCH_ALIGN - 1))
+
+#define ETHERNET_OP_GET_STATS 3
+typedef struct {
+    uint64_t irqs;
+    uint64_t rx_frames;
+    // dropped by the hardware for lack of rx buffers
+    uint64_t rx_missed;
+    uint64_t tx_frames;
+    // sends refused for lack of a free tx buffer
+    uint64_t tx_full;
+} eth_stats_t;
+
+// Common read and write for drivers in batched mode, built on the
+// driver's own send and recv. A checksum the driver can't offload is
+// done here.
+ssize_t ethernet_read_batch(mx_device_t* dev, ethernet_protocol_t* proto, void* data, size_t len);
+ssize_t ethernet_write_batch(mx_device_t* dev, ethernet_protocol_t* proto, const void* data, size_t len);
+
+// Shared rings, for moving frames without copies or an RPC for each.
+//
+// ETHERNET_OP_GET_RINGS returns a VMO that starts with an eth_rings_t,
+// followed by its rx entries and then its tx entries. The frames the
+// entries describe are in the same VMO, at offset from its start.
+//
+// The driver fills rx entries with received frames and advances rx_head.
+// The client advances rx_tail once it is done with them, handing the
+// buffers back. The client fills tx entries with frames in the tx
+// buffers and advances tx_head. The driver advances tx_tail once the
+// hardware is done with them. Indices run freely, entry i being at
+// i % count, and only the side named above moves each one.
+//
+// After moving rx_tail or tx_head the client does ETHERNET_OP_KICK_RINGS,
+// once for any number of frames. The device is DEV_STATE_READABLE while
+// there are rx entries to consume and DEV_STATE_WRITABLE while there are
+// tx entries free. The ordinary send and recv paths stop working once the
+// rings are handed out, until the client that has them closes the device.
+// The rings then go to whoever asks next, with the indices where they were.
+
+// same value as IOCTL_DEVICE_GET_HANDLE, so the handle is transferred
+#define ETHERNET_OP_GET_RINGS 0x7FFF0001
+typedef struct {
+    mx_handle_t vmo;
+    uint64_t size;
+} ioctl_ethernet_get_rings_t;
+
+#define ETHERNET_OP_KICK_RINGS 1
+
+typedef struct eth_ring_entry {
+    uint32_t offset;
+    uint16_t length;
+    uint16_t flags;
+} eth_ring_entry_t;
+
+typedef struct eth_rings {
+    uint32_t rx_count;
+    uint32_t tx_count;
+    uint32_t rx_head;
+    uint32_t rx_tail;
+    uint32_t tx_head;
+    uint32_t tx_tail;
+    // tx_count buffers of buf_size bytes for the client's frames
+    uint32_t tx_offset;
+    uint32_t buf_size;
+    eth_ring_entry_t entries[];
+} eth_rings_t;
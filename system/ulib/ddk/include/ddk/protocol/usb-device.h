@@ -63,6 +63,10 @@ typedef struct usb_request {
     uint16_t transfer_length; // number of bytes to transfer
     mx_status_t status;
     void (*complete_cb)(struct usb_request* request);
+    // if set, called instead of complete_cb with all the requests for this endpoint that
+    // completed together, linked through their nodes. the list is only valid during the call,
+    // and can be passed straight back to queue_requests.
+    void (*complete_batch_cb)(list_node_t* requests);
     usb_endpoint_t* endpoint;
     void* client_data; // for client use
     void* driver_data; // for driver use
@@ -76,6 +80,9 @@ typedef struct usb_device_protocol {
     void (*free_request)(mx_device_t* dev, usb_request_t* request);
 
     mx_status_t (*queue_request)(mx_device_t* dev, usb_request_t* request);
+    // queue a list of requests linked through their nodes. an endpoint keeps several requests
+    // in flight, and those it has no room for yet wait in order behind them.
+    mx_status_t (*queue_requests)(mx_device_t* dev, list_node_t* requests);
     mx_status_t (*control)(mx_device_t* dev, uint8_t request_type, uint8_t request, uint16_t value,
                            uint16_t index, void* data, uint16_t length);
 
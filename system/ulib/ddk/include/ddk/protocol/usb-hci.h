@@ -12,6 +12,9 @@ typedef struct usb_hci_protocol {
     void (*free_request)(mx_device_t* dev, usb_request_t* request);
 
     int (*queue_request)(mx_device_t* hcidev, int devaddr, usb_request_t* request);
+    /* queue_requests(): Queue a list of requests linked through their nodes, in order.
+                         On error the requests not yet queued are left on the list. */
+    int (*queue_requests)(mx_device_t* hcidev, int devaddr, list_node_t* requests);
     int (*control)(mx_device_t* hcidev, int devaddr, usb_setup_t* devreq, int data_length,
                    uint8_t* data);
 
@@ -5,6 +5,7 @@
 #include <ddk/iotxn.h>
 #include <ddk/device.h>
 #include <magenta/syscalls-ddk.h>
+#include <runtime/mutex.h>
 #include <sys/param.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -21,6 +22,8 @@
 #endif
 
 #define IOTXN_FLAG_CLONE (1 << 0)
+#define IOTXN_FLAG_VMO   (1 << 1)
+#define IOTXN_FLAG_PINNED (1 << 2) // vmo pages pinned by physmap_sg()
 
 typedef struct iotxn_priv iotxn_priv_t;
 
@@ -29,7 +32,7 @@ struct iotxn_priv {
     mx_size_t data_size;
     void* data;
     mx_paddr_t data_phys;
-    mx_size_t vmo_offset;
+    uint64_t vmo_offset;
     mx_handle_t vmo;
 
     uint32_t flags;
@@ -43,15 +46,107 @@ struct iotxn_priv {
     mx_size_t buffer_size;
     mx_paddr_t buffer_phys;
 
-    // 64-bytes at this point on 64-bit systems
+    // contiguous copy of a vmo's data made by physmap() or mmap()
+    iotxn_t* bounce;
+
+    // list returned by physmap_sg(), sg_inline if the data is contiguous
+    iotxn_sg_t* sg;
+    uint32_t sg_count;
+    iotxn_sg_t sg_inline;
+
+    // 104-bytes at this point on 64-bit systems
 
     iotxn_t txn; // must be at the end for extra data, only valid if not a clone
 };
 
 #define get_priv(iotxn) containerof(iotxn, iotxn_priv_t, txn)
 
-static list_node_t free_list = LIST_INITIAL_VALUE(free_list);
-static list_node_t clone_list = LIST_INITIAL_VALUE(clone_list); // free list for clones
+// Released iotxns are kept for reuse in pools of size classes, four
+// to each power of two from POOL_MIN_SIZE up to POOL_MAX_SIZE, and
+// every buffer is made the size of its class, so any one in a class
+// fits and getting one is taking the first. Larger ones are kept
+// apart and searched first-fit. Clones and vmo iotxns, whose buffer
+// is only their extra data, have pools of their own.
+#define POOL_MIN_SHIFT 9
+#define POOL_MAX_SHIFT 20
+#define POOL_MIN_SIZE (1u << POOL_MIN_SHIFT)
+#define POOL_MAX_SIZE (1u << POOL_MAX_SHIFT)
+#define POOL_CLASSES (1 + (POOL_MAX_SHIFT - POOL_MIN_SHIFT) * 4)
+
+typedef struct {
+    list_node_t classes[POOL_CLASSES];
+    list_node_t large;
+} iotxn_pool_t;
+
+static iotxn_pool_t txn_pool;
+static iotxn_pool_t clone_pool;
+static mxr_mutex_t pool_lock = MXR_MUTEX_INIT;
+static bool pool_ready;
+
+// The class for a buffer of size bytes, and the size of its buffers.
+// Returns POOL_CLASSES for one too large to pool.
+static uint32_t pool_class(size_t size, size_t* class_size) {
+    if (size <= POOL_MIN_SIZE) {
+        *class_size = POOL_MIN_SIZE;
+        return 0;
+    }
+    if (size > POOL_MAX_SIZE) {
+        *class_size = size;
+        return POOL_CLASSES;
+    }
+    // 2^shift < size <= 2^(shift+1), in quarters of 2^shift
+    uint32_t shift = 63 - __builtin_clzll(size - 1);
+    size_t step = (size_t)1 << (shift - 2);
+    size_t quarter = (size - 1 - ((size_t)1 << shift)) / step;
+    *class_size = ((size_t)1 << shift) + (quarter + 1) * step;
+    return 1 + (shift - POOL_MIN_SHIFT) * 4 + quarter;
+}
+
+// Called with pool_lock held.
+static void pool_init_locked(void) {
+    if (pool_ready) {
+        return;
+    }
+    for (uint32_t n = 0; n < POOL_CLASSES; n++) {
+        list_initialize(&txn_pool.classes[n]);
+        list_initialize(&clone_pool.classes[n]);
+    }
+    list_initialize(&txn_pool.large);
+    list_initialize(&clone_pool.large);
+    pool_ready = true;
+}
+
+// Take a pooled iotxn with a buffer of at least size bytes, or NULL.
+static iotxn_priv_t* pool_get(iotxn_pool_t* pool, size_t size) {
+    size_t class_size;
+    uint32_t n = pool_class(size, &class_size);
+    iotxn_t* txn = NULL;
+    mxr_mutex_lock(&pool_lock);
+    pool_init_locked();
+    if (n < POOL_CLASSES) {
+        txn = list_remove_head_type(&pool->classes[n], iotxn_t, node);
+    } else {
+        iotxn_t* t;
+        list_for_every_entry (&pool->large, t, iotxn_t, node) {
+            if (get_priv(t)->buffer_size >= size) {
+                list_delete(&t->node);
+                txn = t;
+                break;
+            }
+        }
+    }
+    mxr_mutex_unlock(&pool_lock);
+    return txn ? get_priv(txn) : NULL;
+}
+
+static void pool_put(iotxn_pool_t* pool, iotxn_priv_t* priv) {
+    size_t class_size;
+    uint32_t n = pool_class(priv->buffer_size, &class_size);
+    mxr_mutex_lock(&pool_lock);
+    pool_init_locked();
+    list_add_head((n < POOL_CLASSES) ? &pool->classes[n] : &pool->large, &priv->txn.node);
+    mxr_mutex_unlock(&pool_lock);
+}
 
 static void iotxn_complete(iotxn_t* txn, mx_status_t status, size_t actual) {
     txn->actual = actual;
@@ -83,45 +178,52 @@ static void iotxn_mmap(iotxn_t* txn, void** data) {
     *data = priv->data;
 }
 
-static mx_status_t iotxn_clone(iotxn_t* txn, iotxn_t** out, size_t extra_size) {
+static mx_status_t iotxn_physmap_sg(iotxn_t* txn, iotxn_sg_t** sg, uint32_t* count) {
     iotxn_priv_t* priv = get_priv(txn);
-    iotxn_t* clone = NULL;
-    iotxn_priv_t* cpriv = NULL;
-    // look in clone list first for something that fits
-    bool found = false;
-    list_for_every_entry (&clone_list, clone, iotxn_t, node) {
-        cpriv = get_priv(clone);
-        if (cpriv->buffer_size >= extra_size) {
-            found = true;
-            break;
+    priv->sg_inline.paddr = priv->data_phys;
+    priv->sg_inline.length = priv->data_size;
+    *sg = &priv->sg_inline;
+    *count = 1;
+    return NO_ERROR;
+}
+
+// An iotxn with no data buffer of its own, from the clone pool or
+// the heap, since it doesn't have to be in contiguous memory.
+static iotxn_priv_t* header_get(size_t extra_size) {
+    iotxn_priv_t* priv = pool_get(&clone_pool, extra_size);
+    if (priv == NULL) {
+        size_t class_size;
+        pool_class(extra_size, &class_size);
+        if ((priv = calloc(1, sizeof(iotxn_priv_t) + class_size)) == NULL) {
+            xprintf("iotxn: out of memory\n");
+            return NULL;
         }
+        priv->buffer_size = class_size;
     }
-    // found one that fits, skip allocation
-    if (found) {
-        list_delete(&clone->node);
-        if (cpriv->buffer_size) memset(cpriv + sizeof(iotxn_priv_t), 0, cpriv->buffer_size);
-        goto out;
-    }
-    // didn't find one that fits, allocate a new one
-    size_t sz = sizeof(iotxn_priv_t) + extra_size;
-    cpriv = calloc(1, sz); // cloned iotxn's don't have to be in contiguous memory
-    if (!cpriv) {
-        xprintf("iotxn: out of memory\n");
+    return priv;
+}
+
+static mx_status_t iotxn_clone(iotxn_t* txn, iotxn_t** out, size_t extra_size) {
+    iotxn_priv_t* priv = get_priv(txn);
+    // use a pooled one if there is one, only the header needs clearing
+    iotxn_priv_t* cpriv = header_get(extra_size);
+    if (cpriv == NULL) {
         return ERR_NO_MEMORY;
     }
-    memset(cpriv, 0, sizeof(iotxn_priv_t));
-
-    // copy properties to the new iotxn
-    cpriv->buffer_size = extra_size;
-out:
-    cpriv->flags |= IOTXN_FLAG_CLONE;
+    cpriv->flags = IOTXN_FLAG_CLONE;
     // copy data payload metadata to the clone so the api can just work
     cpriv->data_size = priv->data_size;
     cpriv->data = priv->data;
     cpriv->data_phys = priv->data_phys;
     cpriv->vmo_offset = priv->vmo_offset;
     cpriv->vmo = priv->vmo;
+    cpriv->extra_size = extra_size;
+    // the clone maps the data for itself
+    cpriv->bounce = NULL;
+    cpriv->sg = NULL;
+    cpriv->sg_count = 0;
     memcpy(&cpriv->txn, txn, sizeof(iotxn_t));
+    memset(cpriv->txn.extra, 0, extra_size);
     cpriv->txn.complete_cb = NULL; // clear the complete cb
     *out = &cpriv->txn;
     return NO_ERROR;
@@ -130,11 +232,18 @@ out:
 static void iotxn_release(iotxn_t* txn) {
     xprintf("iotxn_release: txn=%p\n", txn);
     iotxn_priv_t* priv = get_priv(txn);
-    if (priv->flags & IOTXN_FLAG_CLONE) {
-        list_add_tail(&clone_list, &txn->node);
-    } else {
-        list_add_tail(&free_list, &txn->node);
+    if (priv->bounce) {
+        priv->bounce->ops->release(priv->bounce);
+    }
+    if (priv->sg != &priv->sg_inline) {
+        free(priv->sg);
+    }
+    if (priv->flags & IOTXN_FLAG_PINNED) {
+        // the device is done with the pages, so the vmo may free them again
+        mx_vm_object_unpin(priv->vmo, priv->vmo_offset, priv->data_size);
     }
+    bool header_only = priv->flags & (IOTXN_FLAG_CLONE | IOTXN_FLAG_VMO);
+    pool_put(header_only ? &clone_pool : &txn_pool, priv);
 }
 
 static iotxn_ops_t ops = {
@@ -142,44 +251,182 @@ static iotxn_ops_t ops = {
     .copyfrom = iotxn_copyfrom,
     .copyto = iotxn_copyto,
     .physmap = iotxn_physmap,
+    .physmap_sg = iotxn_physmap_sg,
     .mmap = iotxn_mmap,
     .clone = iotxn_clone,
     .release = iotxn_release,
 };
 
-mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size) {
-    xprintf("iotxn_alloc: flags=0x%x data_size=0x%zx extra_size=0x%zx\n", flags, data_size, extra_size);
-    iotxn_t* txn = NULL;
-    iotxn_priv_t* priv = NULL;
-    // look in free list first for something that fits
-    bool found = false;
-    list_for_every_entry (&free_list, txn, iotxn_t, node) {
-        priv = get_priv(txn);
-        if (priv->buffer_size >= data_size + extra_size) {
-            found = true;
-            break;
-        }
+// A vmo iotxn's data stays in the vmo. copyfrom() and copyto() go to
+// it directly and physmap_sg() returns its pages. physmap() and mmap()
+// need the data in one piece, so make a contiguous copy, which is then
+// the data until the iotxn completes, and is written back to the vmo
+// on completion of a read.
+static mx_status_t iotxn_vmo_bounce(iotxn_priv_t* priv) {
+    if (priv->bounce) {
+        return NO_ERROR;
+    }
+    iotxn_t* bounce;
+    mx_status_t status = iotxn_alloc(&bounce, 0, priv->data_size, 0);
+    if (status < 0) {
+        return status;
+    }
+    mx_ssize_t r = mx_vm_object_read(priv->vmo, get_priv(bounce)->data,
+                                     priv->vmo_offset, priv->data_size);
+    if (r < 0) {
+        bounce->ops->release(bounce);
+        return r;
     }
-    // found one that fits, skip allocation
-    if (found) {
-        list_delete(&txn->node);
-        memset(&txn, 0, sizeof(iotxn_t) + priv->buffer_size);
-        goto out;
+    priv->bounce = bounce;
+    return NO_ERROR;
+}
+
+static void iotxn_vmo_complete(iotxn_t* txn, mx_status_t status, size_t actual) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (priv->bounce && (txn->opcode == IOTXN_OP_READ) && (status == NO_ERROR)) {
+        mx_vm_object_write(priv->vmo, get_priv(priv->bounce)->data, priv->vmo_offset,
+                           MIN(actual, priv->data_size));
     }
-    // didn't find one that fits, allocate a new one
-    size_t sz = sizeof(iotxn_priv_t) + data_size + extra_size;
+    iotxn_complete(txn, status, actual);
+}
+
+static void iotxn_vmo_copyfrom(iotxn_t* txn, void* data, size_t length, size_t offset) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (priv->bounce) {
+        iotxn_copyfrom(priv->bounce, data, length, offset);
+    } else if (offset < priv->data_size) {
+        size_t count = MIN(length, priv->data_size - offset);
+        mx_vm_object_read(priv->vmo, data, priv->vmo_offset + offset, count);
+    }
+}
+
+static void iotxn_vmo_copyto(iotxn_t* txn, const void* data, size_t length, size_t offset) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (priv->bounce) {
+        iotxn_copyto(priv->bounce, data, length, offset);
+    } else if (offset < priv->data_size) {
+        size_t count = MIN(length, priv->data_size - offset);
+        mx_vm_object_write(priv->vmo, data, priv->vmo_offset + offset, count);
+    }
+}
+
+static void iotxn_vmo_physmap(iotxn_t* txn, mx_paddr_t* addr) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (iotxn_vmo_bounce(priv) < 0) {
+        printf("iotxn: no memory for contiguous copy of vmo\n");
+        *addr = 0;
+        return;
+    }
+    iotxn_physmap(priv->bounce, addr);
+}
+
+static void iotxn_vmo_mmap(iotxn_t* txn, void** data) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (iotxn_vmo_bounce(priv) < 0) {
+        printf("iotxn: no memory for contiguous copy of vmo\n");
+        *data = NULL;
+        return;
+    }
+    iotxn_mmap(priv->bounce, data);
+}
+
+static mx_status_t iotxn_vmo_physmap_sg(iotxn_t* txn, iotxn_sg_t** sg, uint32_t* count) {
+    iotxn_priv_t* priv = get_priv(txn);
+    if (priv->bounce) {
+        // the copy is the data now
+        return iotxn_physmap_sg(priv->bounce, sg, count);
+    }
+    if (priv->sg == NULL && priv->data_size > 0) {
+        size_t page_offset = priv->vmo_offset & (PAGE_SIZE - 1);
+        size_t pages = (page_offset + priv->data_size + PAGE_SIZE - 1) / PAGE_SIZE;
+        mx_paddr_t* paddrs = malloc(pages * sizeof(mx_paddr_t));
+        iotxn_sg_t* list = malloc(pages * sizeof(iotxn_sg_t));
+        if (paddrs == NULL || list == NULL) {
+            free(paddrs);
+            free(list);
+            return ERR_NO_MEMORY;
+        }
+        mx_status_t status = mx_vm_object_lookup(priv->vmo, priv->vmo_offset, priv->data_size,
+                                                 paddrs, pages);
+        if (status < 0) {
+            free(paddrs);
+            free(list);
+            return status;
+        }
+        // pages that are physically adjacent make one entry
+        uint32_t n = 0;
+        size_t remaining = priv->data_size;
+        for (size_t i = 0; i < pages; i++) {
+            mx_paddr_t paddr = paddrs[i] + page_offset;
+            size_t length = MIN(PAGE_SIZE - page_offset, remaining);
+            if (n > 0 && list[n - 1].paddr + list[n - 1].length == paddr) {
+                list[n - 1].length += length;
+            } else {
+                list[n].paddr = paddr;
+                list[n].length = length;
+                n++;
+            }
+            remaining -= length;
+            page_offset = 0;
+        }
+        free(paddrs);
+        priv->sg = list;
+        priv->sg_count = n;
+        priv->flags |= IOTXN_FLAG_PINNED;
+    }
+    *sg = priv->sg;
+    *count = priv->sg_count;
+    return NO_ERROR;
+}
+
+static iotxn_ops_t vmo_ops = {
+    .complete = iotxn_vmo_complete,
+    .copyfrom = iotxn_vmo_copyfrom,
+    .copyto = iotxn_vmo_copyto,
+    .physmap = iotxn_vmo_physmap,
+    .physmap_sg = iotxn_vmo_physmap_sg,
+    .mmap = iotxn_vmo_mmap,
+    .clone = iotxn_clone,
+    .release = iotxn_release,
+};
+
+// A new iotxn's buffer is rounded up to its size class, so that it
+// fits any request of that class once released.
+static mx_status_t iotxn_new(iotxn_priv_t** out, size_t size) {
+    size_t class_size;
+    pool_class(size, &class_size);
+    size_t sz = sizeof(iotxn_priv_t) + class_size;
+    iotxn_priv_t* priv;
     mx_paddr_t phys;
     mx_status_t status = mx_alloc_device_memory(sz, &phys, (void**)&priv);
     if (status < 0) {
         xprintf("iotxn: out of memory\n");
         return status;
     }
-    memset(priv, 0, sz);
-
     // layout is iotxn_priv_t | extra_size | data
-    priv->buffer_size = data_size + extra_size;
+    priv->buffer_size = class_size;
     priv->buffer_phys = phys;
-out:
+    *out = priv;
+    return NO_ERROR;
+}
+
+mx_status_t iotxn_alloc(iotxn_t** out, uint32_t flags, size_t data_size, size_t extra_size) {
+    xprintf("iotxn_alloc: flags=0x%x data_size=0x%zx extra_size=0x%zx\n", flags, data_size, extra_size);
+    // look in the pool first for something that fits
+    iotxn_priv_t* priv = pool_get(&txn_pool, data_size + extra_size);
+    bool found = (priv != NULL);
+    if (!found) {
+        mx_status_t status;
+        if ((status = iotxn_new(&priv, data_size + extra_size)) < 0) {
+            return status;
+        }
+    }
+    // the data is the requester's to fill, only the header is cleared
+    mx_size_t buffer_size = priv->buffer_size;
+    mx_paddr_t buffer_phys = priv->buffer_phys;
+    memset(priv, 0, sizeof(iotxn_priv_t) + extra_size);
+    priv->buffer_size = buffer_size;
+    priv->buffer_phys = buffer_phys;
     priv->data_size = data_size;
     priv->extra_size = extra_size;
     priv->data = (void*)priv + sizeof(iotxn_priv_t) + extra_size;
@@ -190,6 +437,39 @@ out:
     return NO_ERROR;
 }
 
+mx_status_t iotxn_alloc_vmo(iotxn_t** out, uint32_t flags, mx_handle_t vmo,
+                            uint64_t offset, size_t length, size_t extra_size) {
+    xprintf("iotxn_alloc_vmo: flags=0x%x vmo=%d offset=0x%llx length=0x%zx extra_size=0x%zx\n",
+            flags, vmo, offset, length, extra_size);
+    iotxn_priv_t* priv = header_get(extra_size);
+    if (priv == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    mx_size_t buffer_size = priv->buffer_size;
+    memset(priv, 0, sizeof(iotxn_priv_t) + extra_size);
+    priv->buffer_size = buffer_size;
+    priv->flags = IOTXN_FLAG_VMO;
+    priv->data_size = length;
+    priv->vmo = vmo;
+    priv->vmo_offset = offset;
+    priv->extra_size = extra_size;
+    priv->txn.ops = &vmo_ops;
+    *out = &priv->txn;
+    return NO_ERROR;
+}
+
+mx_status_t iotxn_prealloc(size_t count, size_t data_size, size_t extra_size) {
+    for (size_t n = 0; n < count; n++) {
+        iotxn_priv_t* priv;
+        mx_status_t status;
+        if ((status = iotxn_new(&priv, data_size + extra_size)) < 0) {
+            return status;
+        }
+        pool_put(&txn_pool, priv);
+    }
+    return NO_ERROR;
+}
+
 void iotxn_queue(mx_device_t* dev, iotxn_t* txn) {
     dev->ops->iotxn_queue(dev, txn);
 }
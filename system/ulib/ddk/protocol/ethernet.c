@@ -0,0 +1,107 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <ddk/protocol/ethernet.h>
+#include <string.h>
+
+// one's complement sum of the 16 bit words at data
+static uint16_t csum(const void* data, size_t len, uint64_t sum) {
+    const uint8_t* p = data;
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        sum += word;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t word;
+        memcpy(&word, p, 2);
+        sum += word;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        uint16_t word = 0;
+        memcpy(&word, p, 1);
+        sum += word;
+    }
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return sum;
+}
+
+ssize_t ethernet_read_batch(mx_device_t* dev, ethernet_protocol_t* proto, void* data, size_t len) {
+    size_t mtu = proto->get_mtu(dev);
+    size_t count = 0;
+
+    // only while a whole frame is sure to fit, recv may not check
+    while (len - count >= sizeof(eth_batch_hdr_t) + mtu) {
+        eth_batch_hdr_t* hdr = data + count;
+        mx_status_t r;
+        hdr->flags = 0;
+        if (proto->recv_csum) {
+            r = proto->recv_csum(dev, hdr + 1, mtu, hdr);
+        } else {
+            r = proto->recv(dev, hdr + 1, mtu);
+        }
+        if (r < 0) {
+            if (count == 0) {
+                return r;
+            }
+            break;
+        }
+        hdr->length = r;
+        count += ETH_BATCH_NEXT(r);
+        if (count > len) {
+            // the padding of the last frame
+            count = len;
+        }
+    }
+    if (count == 0) {
+        return ERR_NOT_ENOUGH_BUFFER;
+    }
+    return count;
+}
+
+ssize_t ethernet_write_batch(mx_device_t* dev, ethernet_protocol_t* proto, const void* data, size_t len) {
+    size_t count = 0;
+
+    while (len - count >= sizeof(eth_batch_hdr_t)) {
+        const eth_batch_hdr_t* hdr = data + count;
+        if (hdr->length > len - count - sizeof(eth_batch_hdr_t)) {
+            break;
+        }
+        uint8_t* frame = (uint8_t*)(hdr + 1);
+        mx_status_t r;
+        if (!(hdr->flags & ETH_BATCH_CSUM)) {
+            r = proto->send(dev, frame, hdr->length);
+        } else if ((hdr->csum_start + hdr->csum + 2u > hdr->length) || (hdr->csum & 1)) {
+            r = ERR_INVALID_ARGS;
+        } else {
+            r = proto->send_csum ? proto->send_csum(dev, frame, hdr) : ERR_NOT_SUPPORTED;
+            if (r == ERR_NOT_SUPPORTED) {
+                // finish it in place, the batch is ours to change
+                uint16_t* field = (uint16_t*)(frame + hdr->csum_start + hdr->csum);
+                *field = ~csum(frame + hdr->csum_start, hdr->length - hdr->csum_start, 0);
+                r = proto->send(dev, frame, hdr->length);
+            }
+        }
+        if (r < 0) {
+            if (count == 0) {
+                return r;
+            }
+            break;
+        }
+        count += ETH_BATCH_NEXT(hdr->length);
+        if (count > len) {
+            count = len;
+        }
+    }
+    if (count == 0) {
+        return ERR_INVALID_ARGS;
+    }
+    return count;
+}
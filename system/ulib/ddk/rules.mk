@@ -13,6 +13,7 @@ MODULE_DEFINES := LIBDDK=1
 MODULE_SRCS += \
     $(LOCAL_DIR)/common/hid.c \
     $(LOCAL_DIR)/common/usb.c \
+    $(LOCAL_DIR)/protocol/ethernet.c \
     $(LOCAL_DIR)/protocol/input.c \
     $(LOCAL_DIR)/io-alloc.c \
     $(LOCAL_DIR)/iotxn.c \
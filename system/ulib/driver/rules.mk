@@ -15,6 +15,7 @@ MODULE_DEFINES += LIBDRIVER=1
 MODULE_SRCS := \
 	$(LOCAL_DIR)/devmgr.c \
 	$(LOCAL_DIR)/devhost.c \
+	$(LOCAL_DIR)/ioring.c \
 	$(LOCAL_DIR)/binding.c \
 	$(LOCAL_DIR)/rpc-device.c \
 	$(LOCAL_DIR)/api.c \
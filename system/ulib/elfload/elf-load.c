@@ -139,81 +139,25 @@ static mx_status_t choose_load_bias(mx_handle_t proc,
     return NO_ERROR;
 }
 
-static mx_status_t load_segment(mx_handle_t proc, mx_handle_t vmo,
-                                uintptr_t bias, const elf_phdr_t* ph) {
-    const uint32_t flags =
-        // TODO(mcgrathr): This should use the copy-on-write flag, but
-        // it doesn't exist yet.  Instead, for now this eagerly copies
-        // the data into a new VMO.
-        MX_VM_FLAG_FIXED |
-        ((ph->p_flags & PF_R) ? MX_VM_FLAG_PERM_READ : 0) |
-        ((ph->p_flags & PF_W) ? MX_VM_FLAG_PERM_WRITE : 0) |
-        ((ph->p_flags & PF_X) ? MX_VM_FLAG_PERM_EXECUTE : 0);
-
-    // The p_vaddr can start in the middle of a page, but the
-    // semantics are that all the whole pages containing the
-    // p_vaddr+p_filesz range are mapped in.
-    uintptr_t start = (uintptr_t)ph->p_vaddr + bias;
-    uintptr_t end = start + ph->p_memsz;
-    start &= -PAGE_SIZE;
-    end = (end + PAGE_SIZE - 1) & -PAGE_SIZE;
-    size_t size = end - start;
-
-    // Nothing to do for an empty segment (degenerate case).
-    if (size == 0)
-        return NO_ERROR;
-
-    uintptr_t file_start = (uintptr_t)ph->p_offset;
-    uintptr_t file_end = file_start + ph->p_filesz;
-    const size_t partial_page = file_end & (PAGE_SIZE - 1);
-    file_start &= -PAGE_SIZE;
-    file_end &= -PAGE_SIZE;
-
-#if 1
-    // TODO(mcgrathr): Temporary hack to avoid modifying the file VMO.
-    // This will go away when we have copy-on-write.
-    if (ph->p_flags & PF_W) {
-        uintptr_t data_end =
-            (ph->p_offset + ph->p_filesz + PAGE_SIZE - 1) & -PAGE_SIZE;
-        const size_t data_size = data_end - file_start;
-        if (data_size > 0) {
-            mx_handle_t copy_vmo = mx_vm_object_create(data_size);
-            if (copy_vmo < 0)
-                return copy_vmo;
-            uintptr_t window = 0;
-            mx_status_t status = mx_process_vm_map(
-                0, vmo, file_start, data_size, &window, MX_VM_FLAG_PERM_READ);
-            if (status < 0) {
-                mx_handle_close(copy_vmo);
-                return status;
-            }
-            mx_ssize_t n = mx_vm_object_write(copy_vmo, (void*)window,
-                                              0, data_size);
-            mx_process_vm_unmap(0, window, 0);
-            if (n >= 0 && n != (mx_ssize_t)data_size)
-                n = ERR_IO;
-            if (n < 0) {
-                mx_handle_close(copy_vmo);
-                return n;
-            }
-            vmo = copy_vmo;                 // Leak the handle.
-            file_end -= file_start;
-            file_start = 0;
-        }
-    }
-#endif
-
+// Map a segment whose file data starts at file_start in vmo, with bss
+// after file_end if the segment is larger than its file data.
+static mx_status_t map_segment(mx_handle_t proc, mx_handle_t vmo,
+                               uintptr_t file_start, uintptr_t file_end,
+                               size_t partial_page, uintptr_t start,
+                               size_t size, const elf_phdr_t* ph,
+                               uint32_t flags,
+                               elf_load_map_func_t map, void* map_arg) {
     if (ph->p_filesz == ph->p_memsz)
         // Straightforward segment, map all the whole pages from the file.
-        return mx_process_vm_map(proc, vmo, file_start, size, &start, flags);
+        return (*map)(map_arg, proc, vmo, file_start, size, &start, flags);
 
     const size_t file_size = file_end - file_start;
 
     // This segment has some bss, so things are more complicated.
     // Only the leading portion is directly mapped in from the file.
     if (file_size > 0) {
-        mx_status_t status = mx_process_vm_map(proc, vmo, file_start,
-                                               file_size, &start, flags);
+        mx_status_t status = (*map)(map_arg, proc, vmo, file_start,
+                                    file_size, &start, flags);
         if (status != NO_ERROR)
             return status;
         start += file_size;
@@ -250,18 +194,90 @@ static mx_status_t load_segment(mx_handle_t proc, mx_handle_t vmo,
         }
     }
 
-    mx_status_t status = mx_process_vm_map(proc, bss_vmo, 0,
-                                           size, &start, flags);
+    mx_status_t status = (*map)(map_arg, proc, bss_vmo, 0,
+                                size, &start, flags);
     mx_handle_close(bss_vmo);
 
     return status;
 }
 
+static mx_status_t load_segment(mx_handle_t proc, mx_handle_t vmo,
+                                uintptr_t bias, const elf_phdr_t* ph,
+                                elf_load_map_func_t map, void* map_arg) {
+    const uint32_t flags =
+        MX_VM_FLAG_FIXED |
+        ((ph->p_flags & PF_R) ? MX_VM_FLAG_PERM_READ : 0) |
+        ((ph->p_flags & PF_W) ? MX_VM_FLAG_PERM_WRITE : 0) |
+        ((ph->p_flags & PF_X) ? MX_VM_FLAG_PERM_EXECUTE : 0);
+
+    // The p_vaddr can start in the middle of a page, but the
+    // semantics are that all the whole pages containing the
+    // p_vaddr+p_filesz range are mapped in.
+    uintptr_t start = (uintptr_t)ph->p_vaddr + bias;
+    uintptr_t end = start + ph->p_memsz;
+    start &= -PAGE_SIZE;
+    end = (end + PAGE_SIZE - 1) & -PAGE_SIZE;
+    size_t size = end - start;
+
+    // Nothing to do for an empty segment (degenerate case).
+    if (size == 0)
+        return NO_ERROR;
+
+    uintptr_t file_start = (uintptr_t)ph->p_offset;
+    uintptr_t file_end = file_start + ph->p_filesz;
+    const size_t partial_page = file_end & (PAGE_SIZE - 1);
+    file_start &= -PAGE_SIZE;
+    file_end &= -PAGE_SIZE;
+
+    // Writable segments get a copy-on-write clone of the file data, so
+    // the file VMO itself is never modified.  Pages are only copied if
+    // the process touches them.
+    mx_handle_t cow_vmo = MX_HANDLE_INVALID;
+    if (ph->p_flags & PF_W) {
+        uintptr_t data_end =
+            (ph->p_offset + ph->p_filesz + PAGE_SIZE - 1) & -PAGE_SIZE;
+        const size_t data_size = data_end - file_start;
+        if (data_size > 0) {
+            cow_vmo = mx_vm_object_clone(vmo, file_start, data_size);
+            if (cow_vmo < 0)
+                return cow_vmo;
+            vmo = cow_vmo;
+            file_end -= file_start;
+            file_start = 0;
+        }
+    }
+
+    // The mappings hold their own references, so the clone handle can
+    // go as soon as they are in place.
+    mx_status_t status = map_segment(proc, vmo, file_start, file_end,
+                                     partial_page, start, size, ph, flags,
+                                     map, map_arg);
+    if (cow_vmo != MX_HANDLE_INVALID)
+        mx_handle_close(cow_vmo);
+    return status;
+}
+
+static mx_status_t direct_map(void* map_arg, mx_handle_t proc,
+                              mx_handle_t vmo, uint64_t offset,
+                              mx_size_t len, uintptr_t* ptr, uint32_t flags) {
+    return mx_process_vm_map(proc, vmo, offset, len, ptr, flags);
+}
+
 mx_status_t elf_load_map_segments(mx_handle_t proc,
                                   const elf_load_header_t* header,
                                   const elf_phdr_t phdrs[],
                                   mx_handle_t vmo,
                                   mx_vaddr_t* base, mx_vaddr_t* entry) {
+    return elf_load_map_segments_etc(proc, header, phdrs, vmo, base, entry,
+                                     &direct_map, NULL);
+}
+
+mx_status_t elf_load_map_segments_etc(mx_handle_t proc,
+                                      const elf_load_header_t* header,
+                                      const elf_phdr_t phdrs[],
+                                      mx_handle_t vmo,
+                                      mx_vaddr_t* base, mx_vaddr_t* entry,
+                                      elf_load_map_func_t map, void* map_arg) {
     mx_status_t status = NO_ERROR;
 
     uintptr_t bias = 0;
@@ -270,7 +286,7 @@ mx_status_t elf_load_map_segments(mx_handle_t proc,
 
     for (uint_fast16_t i = 0; status == NO_ERROR && i < header->e_phnum; ++i) {
         if (phdrs[i].p_type == PT_LOAD)
-            status = load_segment(proc, vmo, bias, &phdrs[i]);
+            status = load_segment(proc, vmo, bias, &phdrs[i], map, map_arg);
     }
 
     if (status == NO_ERROR) {
@@ -52,6 +52,22 @@ mx_status_t elf_load_map_segments(mx_handle_t proc,
                                   mx_handle_t vmo,
                                   mx_vaddr_t* bias, mx_vaddr_t* entry);
 
+// Called by elf_load_map_segments_etc in place of mx_process_vm_map for
+// each mapping of the image, with the same arguments after map_arg.
+typedef mx_status_t (*elf_load_map_func_t)(void* map_arg, mx_handle_t proc,
+                                           mx_handle_t vmo, uint64_t offset,
+                                           mx_size_t len, uintptr_t* ptr,
+                                           uint32_t flags);
+
+// Same as elf_load_map_segments, but mapping through a hook that can
+// see every mapping made.
+mx_status_t elf_load_map_segments_etc(mx_handle_t proc,
+                                      const elf_load_header_t* header,
+                                      const elf_phdr_t* phdrs,
+                                      mx_handle_t vmo,
+                                      mx_vaddr_t* bias, mx_vaddr_t* entry,
+                                      elf_load_map_func_t map, void* map_arg);
+
 // Locate the PT_INTERP program header and extract its bounds in the file.
 // Returns false if there was no PT_INTERP.
 bool elf_load_find_interp(const elf_phdr_t* phdrs, size_t phnum,
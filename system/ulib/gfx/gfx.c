@@ -197,6 +197,98 @@ MKPUTCHAR(putchar8, uint8_t)
 MKPUTCHAR(putchar16, uint16_t)
 MKPUTCHAR(putchar32, uint32_t)
 
+// Text is mostly the same few characters in the same few colors, so
+// glyphs are drawn once into tiles in the surface's format and copied
+// from there after. Slots are picked by character and colors, and a
+// glyph that lands in a used slot replaces the one there.
+
+#define GLYPH_CACHE_SIZE 256 // power of two
+
+typedef struct glyph_key {
+    uint32_t fg;
+    uint32_t bg;
+    uint32_t ch; // character + 1, 0 for an empty slot
+} glyph_key_t;
+
+struct gfx_glyph_cache {
+    const gfx_font* font;
+    size_t tile_len;
+    glyph_key_t keys[GLYPH_CACHE_SIZE];
+    uint8_t tiles[];
+};
+
+// loads and stores through these needn't be aligned
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) unaligned_word_t;
+typedef uint32_t __attribute__((__may_alias__, __aligned__(1))) unaligned_u32_t;
+
+// Copies len bytes, a word at a time, to and from any alignment.
+static inline void copy_span(uint8_t* dest, const uint8_t* src, size_t len) {
+    for (; len >= 8; len -= 8) {
+        *(unaligned_word_t*)dest = *(const unaligned_word_t*)src;
+        dest += 8;
+        src += 8;
+    }
+    if (len >= 4) {
+        *(unaligned_u32_t*)dest = *(const unaligned_u32_t*)src;
+        dest += 4;
+        src += 4;
+        len -= 4;
+    }
+    while (len--) {
+        *dest++ = *src++;
+    }
+}
+
+static inline unsigned glyph_slot(unsigned ch, unsigned fg, unsigned bg) {
+    uint32_t h = (fg * 0x9e3779b1u) ^ (bg * 0x85ebca6bu);
+    return (ch ^ (h >> 24)) & (GLYPH_CACHE_SIZE - 1);
+}
+
+// Returns the glyph's tile, drawing it first if it isn't there, or NULL
+// if there's no memory for the cache. Colors are in the surface's format.
+static const uint8_t* glyph_tile(gfx_surface* surface, const gfx_font* font, unsigned ch, unsigned fg, unsigned bg) {
+    gfx_glyph_cache* cache = surface->glyphs;
+    if (unlikely((cache == NULL) || (cache->font != font))) {
+        free(cache);
+        size_t tile_len = font->width * font->height * surface->pixelsize;
+        cache = calloc(1, sizeof(gfx_glyph_cache) + GLYPH_CACHE_SIZE * tile_len);
+        surface->glyphs = cache;
+        if (cache == NULL) {
+            return NULL;
+        }
+        cache->font = font;
+        cache->tile_len = tile_len;
+    }
+
+    unsigned slot = glyph_slot(ch, fg, bg);
+    glyph_key_t* key = &cache->keys[slot];
+    uint8_t* tile = cache->tiles + slot * cache->tile_len;
+    if ((key->ch != ch + 1) || (key->fg != fg) || (key->bg != bg)) {
+        // the format's own putchar draws it, into a surface that's the tile
+        gfx_surface tmp = {
+            .ptr = tile,
+            .stride = font->width,
+        };
+        surface->putchar(&tmp, font, ch, 0, 0, fg, bg);
+        key->ch = ch + 1;
+        key->fg = fg;
+        key->bg = bg;
+    }
+    return tile;
+}
+
+static void blit_glyph(gfx_surface* surface, const gfx_font* font, const uint8_t* tile, unsigned x, unsigned y) {
+    size_t pitch = surface->stride * surface->pixelsize;
+    size_t len = font->width * surface->pixelsize;
+    uint8_t* dest = (uint8_t*)surface->ptr + (x + y * surface->stride) * surface->pixelsize;
+
+    for (unsigned i = font->height; i > 0; i--) {
+        copy_span(dest, tile, len);
+        dest += pitch;
+        tile += len;
+    }
+}
+
 void gfx_putchar(gfx_surface* surface, const gfx_font* font, unsigned ch, unsigned x, unsigned y, unsigned fg, unsigned bg) {
     if (unlikely(ch > 127)) {
         return;
@@ -211,157 +303,105 @@ void gfx_putchar(gfx_surface* surface, const gfx_font* font, unsigned ch, unsign
         fg = surface->translate_color(fg);
         bg = surface->translate_color(bg);
     }
-    surface->putchar(surface, font, ch, x, y, fg, bg);
-}
-
-static void copyrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint8_t* src = &((const uint8_t*)surface->ptr)[x + y * surface->stride];
-    uint8_t* dest = &((uint8_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
-
-    if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
+    const uint8_t* tile = glyph_tile(surface, font, ch, fg, bg);
+    if (tile) {
+        blit_glyph(surface, font, tile, x, y);
     } else {
-        // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
+        surface->putchar(surface, font, ch, x, y, fg, bg);
     }
 }
 
-static void fillrect8(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
-    uint8_t* dest = &((uint8_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
-
-    uint8_t color8 = (uint8_t)(surface->translate_color(color));
-
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color8;
-            dest++;
-        }
-        dest += stride_diff;
+// Fill and copy work on whole rows of bytes, so one version serves every
+// pixel size.
+
+// stores through this may alias the pixels' own types
+typedef uint64_t __attribute__((__may_alias__)) pixelword_t;
+
+// A pixel value repeated to fill 64 bits.
+static uint64_t pixel_pattern(unsigned color, unsigned pixelsize) {
+    uint64_t pattern = color;
+    switch (pixelsize) {
+    case 1:
+        pattern = (uint8_t)pattern;
+        pattern |= pattern << 8;
+    // fall through
+    case 2:
+        pattern = (uint16_t)pattern;
+        pattern |= pattern << 16;
+    // fall through
+    default:
+        pattern = (uint32_t)pattern;
+        pattern |= pattern << 32;
     }
+    return pattern;
 }
 
-static void copyrect16(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint16_t* src = &((const uint16_t*)surface->ptr)[x + y * surface->stride];
-    uint16_t* dest = &((uint16_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
-
-    if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
-        }
-    } else {
-        // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
-        }
+// Fills len bytes from dest, which is on a pixel boundary, with pattern,
+// a word at a time once dest is aligned. Pixels are little endian.
+static void fill_span(uint8_t* dest, uint64_t pattern, size_t len) {
+    while (((uintptr_t)dest & 7) && len) {
+        *dest++ = (uint8_t)pattern;
+        pattern = (pattern >> 8) | (pattern << 56);
+        len--;
     }
-}
-
-static void fillrect16(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
-    uint16_t* dest = &((uint16_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
-
-    uint16_t color16 = (uint16_t)(surface->translate_color(color));
-
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color16;
-            dest++;
-        }
-        dest += stride_diff;
+    pixelword_t* word = (pixelword_t*)dest;
+    for (; len >= 32; len -= 32) {
+        word[0] = pattern;
+        word[1] = pattern;
+        word[2] = pattern;
+        word[3] = pattern;
+        word += 4;
+    }
+    for (; len >= 8; len -= 8) {
+        *word++ = pattern;
+    }
+    dest = (uint8_t*)word;
+    while (len--) {
+        *dest++ = (uint8_t)pattern;
+        pattern >>= 8;
     }
 }
 
-static void copyrect32(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
-    // copy
-    const uint32_t* src = &((const uint32_t*)surface->ptr)[x + y * surface->stride];
-    uint32_t* dest = &((uint32_t*)surface->ptr)[x2 + y2 * surface->stride];
-    unsigned stride_diff = surface->stride - width;
+static void copyrect(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned x2, unsigned y2) {
+    size_t pitch = surface->stride * surface->pixelsize;
+    size_t len = width * surface->pixelsize;
+    const uint8_t* src = (const uint8_t*)surface->ptr + (x + y * surface->stride) * surface->pixelsize;
+    uint8_t* dest = (uint8_t*)surface->ptr + (x2 + y2 * surface->stride) * surface->pixelsize;
 
+    // take rows in the order that doesn't overwrite ones yet to be copied,
+    // memmove sees to overlap within a row
     if (dest < src) {
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += stride_diff;
-            src += stride_diff;
+        for (unsigned i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest += pitch;
+            src += pitch;
         }
     } else {
         // copy backwards
-        src += height * surface->stride + width;
-        dest += height * surface->stride + width;
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest--;
-                src--;
-            }
-            dest -= stride_diff;
-            src -= stride_diff;
+        src += (height - 1) * pitch;
+        dest += (height - 1) * pitch;
+        for (unsigned i = 0; i < height; i++) {
+            memmove(dest, src, len);
+            dest -= pitch;
+            src -= pitch;
         }
     }
 }
 
-static void fillrect32(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
-    uint32_t* dest = &((uint32_t*)surface->ptr)[x + y * surface->stride];
-    unsigned stride_diff = surface->stride - width;
+static void fillrect(gfx_surface* surface, unsigned x, unsigned y, unsigned width, unsigned height, unsigned color) {
+    size_t pitch = surface->stride * surface->pixelsize;
+    size_t len = width * surface->pixelsize;
+    uint8_t* dest = (uint8_t*)surface->ptr + (x + y * surface->stride) * surface->pixelsize;
 
-    unsigned i, j;
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            *dest = color;
-            dest++;
-        }
-        dest += stride_diff;
+    // colors come in in ARGB 8888 form, flatten them
+    if (surface->translate_color) {
+        color = surface->translate_color(color);
+    }
+    uint64_t pattern = pixel_pattern(color, surface->pixelsize);
+
+    for (unsigned i = 0; i < height; i++) {
+        fill_span(dest, pattern, len);
+        dest += pitch;
     }
 }
 
@@ -417,9 +457,6 @@ void gfx_line(gfx_surface* surface, unsigned x1, unsigned y1, unsigned x2, unsig
 }
 
 uint32_t alpha32_add_ignore_destalpha(uint32_t dest, uint32_t src) {
-    uint32_t cdest[3];
-    uint32_t csrc[3];
-
     uint32_t srca;
     uint32_t srcainv;
 
@@ -432,24 +469,23 @@ uint32_t alpha32_add_ignore_destalpha(uint32_t dest, uint32_t src) {
     srca++;
     srcainv = (255 - srca);
 
-    cdest[0] = (dest >> 16) & 0xff;
-    cdest[1] = (dest >> 8) & 0xff;
-    cdest[2] = (dest >> 0) & 0xff;
-
-    csrc[0] = (src >> 16) & 0xff;
-    csrc[1] = (src >> 8) & 0xff;
-    csrc[2] = (src >> 0) & 0xff;
-
-    //    if (srca > 0)
-    //        printf("s %d %d %d d %d %d %d a %d ai %d\n", csrc[0], csrc[1], csrc[2], cdest[0], cdest[1], cdest[2], srca, srcainv);
+    // red and blue together, then green: a channel times an alpha fits
+    // in 16 bits, so the products don't run into each other
+    uint32_t rb = (((src & 0xff00ff) * srca) >> 8) & 0xff00ff;
+    rb += (((dest & 0xff00ff) * srcainv) >> 8) & 0xff00ff;
+    uint32_t g = (((src & 0xff00) * srca) >> 8) & 0xff00;
+    g += (((dest & 0xff00) * srcainv) >> 8) & 0xff00;
 
-    uint32_t cres[3];
-
-    cres[0] = ((csrc[0] * srca) / 256) + ((cdest[0] * srcainv) / 256);
-    cres[1] = ((csrc[1] * srca) / 256) + ((cdest[1] * srcainv) / 256);
-    cres[2] = ((csrc[2] * srca) / 256) + ((cdest[2] * srcainv) / 256);
+    return (srca << 24) | rb | g;
+}
 
-    return (srca << 24) | (cres[0] << 16) | (cres[1] << 8) | (cres[2]);
+// Copies height rows of len bytes between surfaces.
+static void copy_rows(uint8_t* dest, size_t dest_pitch, const uint8_t* src, size_t src_pitch, size_t len, unsigned height) {
+    for (unsigned i = 0; i < height; i++) {
+        memmove(dest, src, len);
+        dest += dest_pitch;
+        src += src_pitch;
+    }
 }
 
 /**
@@ -490,26 +526,7 @@ void gfx_blend(gfx_surface* target, gfx_surface* source, unsigned srcx, unsigned
         height = source->height - srcy;
 
     // XXX total hack to deal with various blends
-    if (source->format == GFX_FORMAT_RGB_565 && target->format == GFX_FORMAT_RGB_565) {
-        // 16 bit to 16 bit
-        const uint16_t* src = &((const uint16_t*)source->ptr)[srcx + srcy * source->stride];
-        uint16_t* dest = &((uint16_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
-        }
-    } else if (source->format == GFX_FORMAT_ARGB_8888 && target->format == GFX_FORMAT_ARGB_8888) {
+    if (source->format == GFX_FORMAT_ARGB_8888 && target->format == GFX_FORMAT_ARGB_8888) {
         // both are 32 bit modes, both alpha
         const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
         uint32_t* dest = &((uint32_t*)target->ptr)[destx + desty * target->stride];
@@ -529,44 +546,17 @@ void gfx_blend(gfx_surface* target, gfx_surface* source, unsigned srcx, unsigned
             dest += dest_stride_diff;
             src += source_stride_diff;
         }
-    } else if (source->format == GFX_FORMAT_RGB_x888 && target->format == GFX_FORMAT_RGB_x888) {
-        // both are 32 bit modes, no alpha
-        const uint32_t* src = &((const uint32_t*)source->ptr)[srcx + srcy * source->stride];
-        uint32_t* dest = &((uint32_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
-        }
-    } else if (source->format == GFX_FORMAT_MONO && target->format == GFX_FORMAT_MONO) {
-        // both are 8 bit modes, no alpha
-        const uint8_t* src = &((const uint8_t*)source->ptr)[srcx + srcy * source->stride];
-        uint8_t* dest = &((uint8_t*)target->ptr)[destx + desty * target->stride];
-        unsigned dest_stride_diff = target->stride - width;
-        unsigned source_stride_diff = source->stride - width;
-
-        xprintf("w %u h %u dstride %u sstride %u\n", width, height, dest_stride_diff, source_stride_diff);
-
-        unsigned i, j;
-        for (i = 0; i < height; i++) {
-            for (j = 0; j < width; j++) {
-                *dest = *src;
-                dest++;
-                src++;
-            }
-            dest += dest_stride_diff;
-            src += source_stride_diff;
-        }
+    } else if ((source->format == GFX_FORMAT_RGB_565 && target->format == GFX_FORMAT_RGB_565) ||
+               (source->format == GFX_FORMAT_RGB_x888 && target->format == GFX_FORMAT_RGB_x888) ||
+               (source->format == GFX_FORMAT_MONO && target->format == GFX_FORMAT_MONO)) {
+        // same format, no alpha
+        xprintf("w %u h %u dstride %u sstride %u\n", width, height, target->stride, source->stride);
+
+        copy_rows((uint8_t*)target->ptr + (destx + desty * target->stride) * target->pixelsize,
+                  target->stride * target->pixelsize,
+                  (const uint8_t*)source->ptr + (srcx + srcy * source->stride) * source->pixelsize,
+                  source->stride * source->pixelsize,
+                  width * source->pixelsize, height);
     } else {
         xprintf("gfx_surface_blend: unimplemented colorspace combination (source %d target %d)\n", source->format, target->format);
         assert(0);
@@ -638,13 +628,14 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
     surface->height = height;
     surface->stride = stride;
     surface->alpha = MAX_ALPHA;
+    surface->glyphs = NULL;
 
     // set up some function pointers
     switch (format) {
     case GFX_FORMAT_RGB_565:
         surface->translate_color = &ARGB8888_to_RGB565;
-        surface->copyrect = &copyrect16;
-        surface->fillrect = &fillrect16;
+        surface->copyrect = &copyrect;
+        surface->fillrect = &fillrect;
         surface->putpixel = &putpixel16;
         surface->putchar = &putchar16;
         surface->pixelsize = 2;
@@ -653,8 +644,8 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
     case GFX_FORMAT_RGB_x888:
     case GFX_FORMAT_ARGB_8888:
         surface->translate_color = NULL;
-        surface->copyrect = &copyrect32;
-        surface->fillrect = &fillrect32;
+        surface->copyrect = &copyrect;
+        surface->fillrect = &fillrect;
         surface->putpixel = &putpixel32;
         surface->putchar = &putchar32;
         surface->pixelsize = 4;
@@ -662,8 +653,8 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
         break;
     case GFX_FORMAT_MONO:
         surface->translate_color = &ARGB8888_to_Luma;
-        surface->copyrect = &copyrect8;
-        surface->fillrect = &fillrect8;
+        surface->copyrect = &copyrect;
+        surface->fillrect = &fillrect;
         surface->putpixel = &putpixel8;
         surface->putchar = &putchar8;
         surface->pixelsize = 1;
@@ -671,8 +662,8 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
         break;
     case GFX_FORMAT_RGB_332:
         surface->translate_color = &ARGB8888_to_RGB332;
-        surface->copyrect = &copyrect8;
-        surface->fillrect = &fillrect8;
+        surface->copyrect = &copyrect;
+        surface->fillrect = &fillrect;
         surface->putpixel = &putpixel8;
         surface->putchar = &putchar8;
         surface->pixelsize = 1;
@@ -680,8 +671,8 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
         break;
     case GFX_FORMAT_RGB_2220:
         surface->translate_color = &ARGB8888_to_RGB2220;
-        surface->copyrect = &copyrect8;
-        surface->fillrect = &fillrect8;
+        surface->copyrect = &copyrect;
+        surface->fillrect = &fillrect;
         surface->putpixel = &putpixel8;
         surface->putchar = &putchar8;
         surface->pixelsize = 1;
@@ -714,6 +705,7 @@ int gfx_init_surface(gfx_surface* surface, void* ptr, unsigned width, unsigned h
 void gfx_surface_destroy(struct gfx_surface* surface) {
     if (surface->flags & GFX_FLAG_FREE_ON_DESTROY)
         free(surface->ptr);
+    free(surface->glyphs);
     free(surface);
 }
 
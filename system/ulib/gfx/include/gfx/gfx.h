@@ -33,6 +33,7 @@ typedef enum {
 
 typedef struct gfx_surface gfx_surface;
 typedef struct gfx_font gfx_font;
+typedef struct gfx_glyph_cache gfx_glyph_cache;
 
 /**
  * @brief  Describe a graphics drawing surface
@@ -61,6 +62,9 @@ struct gfx_surface {
     void (*putpixel)(gfx_surface*, unsigned x, unsigned y, unsigned color);
     void (*putchar)(gfx_surface*, const gfx_font*, unsigned ch, unsigned x, unsigned y, unsigned fg, unsigned bg);
     void (*flush)(unsigned starty, unsigned endy);
+
+    // glyphs already drawn in the surface's format, made on first use
+    gfx_glyph_cache* glyphs;
 };
 
 struct gfx_font {
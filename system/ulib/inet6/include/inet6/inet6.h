@@ -106,6 +106,11 @@ struct ndp_n_hdr {
 #define NDP_N_REDIRECTED_HDR 4
 #define NDP_N_MTU 5
 
+// ndp_n_hdr_t flags, in host order
+#define NDP_N_ROUTER 0x80000000
+#define NDP_N_SOLICITED 0x40000000
+#define NDP_N_OVERRIDE 0x20000000
+
 #ifndef ntohs
 #define ntohs(n) _swap16(n)
 #define htons(n) _swap16(n)
@@ -131,12 +136,31 @@ char* ip6toa(char* _out, void* ip6addr);
 // provided by inet6.c
 void ip6_init(void* macaddr);
 void eth_recv(void* data, size_t len);
+// as eth_recv, for an interface that computed the one's complement
+// sum csum of the frame from csum_start to its end
+void eth_recv_csum(void* data, size_t len, size_t csum_start, uint16_t csum);
+
+// call periodically to resolve and age neighbors, returns the number
+// of milliseconds until it next needs calling, or -1 if it can wait
+int ip6_poll(void);
+
+// one's complement sum of the 16 bit words at data, added to sum
+uint16_t ip6_csum(const void* data, size_t len, uint16_t sum);
+// a checksum updated for one of the words it covers changing (RFC 1624)
+uint16_t ip6_csum_update(uint16_t csum, uint16_t old_word, uint16_t new_word);
 
 // provided by interface driver
 void* eth_get_buffer(size_t len);
 void eth_put_buffer(void* ptr);
 int eth_send(void* data, size_t len);
 int eth_add_mcast_filter(const mac_addr_t* addr);
+// monotonic time in milliseconds
+uint64_t eth_time_ms(void);
+// nonzero if eth_send_csum() can be used: it sends a frame having the
+// interface sum it from csum_start to its end and store the complement
+// at csum_start + csum_offset, where the pseudo-header sum is put first
+int eth_csum_offload(void);
+int eth_send_csum(void* data, size_t len, size_t csum_start, size_t csum_offset);
 
 // call to transmit a UDP packet
 int udp6_send(const void* data, size_t len,
@@ -159,9 +183,11 @@ void udp6_recv(void* data, size_t len,
 //
 // It responds to PINGs.
 //
-// It can only transmit to multicast addresses or to the address it
-// last received a packet from (general usecase is to reply to a UDP
-// packet from the UDP callback, which this supports)
+// It keeps a cache of link local neighbors, learned from the packets
+// they send and from neighbor solicitations and advertisements, and
+// solicits the ones it doesn't know. Packets to an unresolved neighbor
+// are held (a couple per neighbor) until it answers or ip6_poll() gives
+// up on it.
 //
 // It does not currently do duplicate address detection, which is
 // probably the most severe bug.
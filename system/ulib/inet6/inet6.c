@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -82,10 +83,6 @@ ip6_addr_t ll_ip6_addr;
 mac_addr_t snm_mac_addr;
 ip6_addr_t snm_ip6_addr;
 
-// cache for the last source addresses we've seen
-static mac_addr_t rx_mac_addr;
-static ip6_addr_t rx_ip6_addr;
-
 void ip6_init(void* macaddr) {
     char tmp[IP6TOAMAX];
     mac_addr_t all;
@@ -108,40 +105,55 @@ void ip6_init(void* macaddr) {
     printf("snmaddr: %s\n", ip6toa(tmp, &snm_ip6_addr));
 }
 
-static int resolve_ip6(mac_addr_t* _mac, const ip6_addr_t* _ip) {
-    const uint8_t* ip = _ip->u8;
-
-    // Multicast addresses are a simple transform
-    if (ip[0] == 0xFF) {
-        multicast_from_ip6(_mac, _ip);
-        return 0;
-    }
-
-    // Trying to send to the IP that we last received a packet from?
-    // Assume their mac address has not changed
-    if (ip6_addr_eq(_ip, &rx_ip6_addr)) {
-        memcpy(_mac, &rx_mac_addr, sizeof(rx_mac_addr));
-        return 0;
+static uint16_t csum_fold(uint64_t sum) {
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
     }
-
-    // We don't know how to find peers or routers yet, so give up...
-    return -1;
+    return sum;
 }
 
-static uint16_t checksum(const void* _data, size_t len, uint16_t _sum) {
-    uint32_t sum = _sum;
-    const uint16_t* data = _data;
+uint16_t ip6_csum(const void* _data, size_t len, uint16_t _sum) {
+    // 64 bits at a time, carries wrapping around as they would
+    // have in 16 bits, since 2^64 == 1 (mod 0xFFFF)
+    uint64_t sum = _sum;
+    const uint8_t* data = _data;
+    while (len >= 32) {
+        uint64_t w[4];
+        memcpy(w, data, sizeof(w));
+        for (int n = 0; n < 4; n++) {
+            sum += w[n];
+            sum += (sum < w[n]);
+        }
+        data += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, data, 8);
+        sum += w;
+        sum += (sum < w);
+        data += 8;
+        len -= 8;
+    }
+    // the rest can't overflow
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
     while (len > 1) {
-        sum += *data++;
+        uint16_t w;
+        memcpy(&w, data, 2);
+        sum += w;
+        data += 2;
         len -= 2;
     }
     if (len) {
-        sum += (*data & 0xFF);
+        sum += *data;
     }
-    while (sum > 0xFFFF) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    return sum;
+    return csum_fold(sum);
+}
+
+uint16_t ip6_csum_update(uint16_t csum, uint16_t old_word, uint16_t new_word) {
+    // RFC 1624: HC' = ~(~HC + ~m + m')
+    uint32_t sum = (uint16_t)~csum + (uint16_t)~old_word + new_word;
+    return ~csum_fold(sum);
 }
 
 typedef struct {
@@ -157,13 +169,23 @@ typedef struct {
     uint8_t data[0];
 } udp_pkt_t;
 
-static unsigned ip6_checksum(ip6_hdr_t* ip, unsigned type, size_t length) {
+// Sum of the pseudo-header and the payload. hwsum is the payload's sum
+// if the interface computed it, or negative.
+static uint16_t ip6_sum(ip6_hdr_t* ip, unsigned type, size_t length, int hwsum) {
     uint16_t sum;
 
     // length and protocol field for pseudo-header
-    sum = checksum(&ip->length, 2, htons(type));
-    // src/dst for pseudo-header + payload
-    sum = checksum(&ip->src, 32 + length, sum);
+    sum = ip6_csum(&ip->length, 2, htons(type));
+    if (hwsum < 0) {
+        // src/dst for pseudo-header + payload
+        return ip6_csum(&ip->src, 32 + length, sum);
+    }
+    sum = ip6_csum(&ip->src, 32, sum);
+    return csum_fold((uint32_t)sum + hwsum);
+}
+
+static unsigned ip6_checksum(ip6_hdr_t* ip, unsigned type, size_t length) {
+    uint16_t sum = ip6_sum(ip, type, length, -1);
 
     // 0 is illegal, so 0xffff remains 0xffff
     if (sum != 0xffff) {
@@ -173,14 +195,9 @@ static unsigned ip6_checksum(ip6_hdr_t* ip, unsigned type, size_t length) {
     }
 }
 
-static int ip6_setup(ip6_pkt_t* p, const ip6_addr_t* daddr, size_t length, uint8_t type) {
-    mac_addr_t dmac;
-
-    if (resolve_ip6(&dmac, daddr))
-        return -1;
-
+// The destination mac is left to ip6_send().
+static void ip6_setup(ip6_pkt_t* p, const ip6_addr_t* daddr, size_t length, uint8_t type) {
     // ethernet header
-    memcpy(p->eth + 2, &dmac, ETH_ADDR_LEN);
     memcpy(p->eth + 8, &ll_mac_addr, ETH_ADDR_LEN);
     p->eth[14] = (ETH_IP6 >> 8) & 0xFF;
     p->eth[15] = ETH_IP6 & 0xFF;
@@ -192,8 +209,330 @@ static int ip6_setup(ip6_pkt_t* p, const ip6_addr_t* daddr, size_t length, uint8
     p->ip6.hop_limit = 255;
     p->ip6.src = ll_ip6_addr;
     p->ip6.dst = *daddr;
+}
+
+// Convert IPv6 Address to its Solicited Node Multicast Address
+static void snmaddr_from_ip6(ip6_addr_t* _snm, const ip6_addr_t* _ip) {
+    uint8_t* snm = _snm->u8;
+    const uint8_t* ip = _ip->u8;
+    snm[0] = 0xFF;
+    snm[1] = 0x02;
+    memset(snm + 2, 0, 9);
+    snm[11] = 0x01;
+    snm[12] = 0xFF;
+    snm[13] = ip[13];
+    snm[14] = ip[14];
+    snm[15] = ip[15];
+}
+
+static int icmp6_send(const void* data, size_t length, const ip6_addr_t* daddr);
+
+// Hand a frame with its destination filled in to the interface. A nonzero
+// csum_offset is that of the transport checksum, for the interface to finish.
+static int ip6_xmit(void* data, size_t len, size_t csum_offset) {
+    if (csum_offset) {
+        return eth_send_csum(data, len, ETH_HDR_LEN + IP6_HDR_LEN, csum_offset);
+    }
+    return eth_send(data, len);
+}
+
+// neighbor cache
+#define NDP_CACHE_SIZE 32
+#define NDP_HASH_SIZE 16 // a power of two
+
+// frames held for a neighbor while its address is resolved
+#define NDP_MAX_PENDING 2
+#define NDP_MAX_SOLICIT 3
+#define NDP_RETRANS_MS 1000
+// how long an advertisement is believed for, after which the entry is
+// stale: still used, but probed with a unicast solicitation
+#define NDP_REACHABLE_MS 30000
+// how long an unused stale entry is kept
+#define NDP_STALE_MS (10 * 60 * 1000)
+
+#define NDP_FREE 0
+#define NDP_INCOMPLETE 1
+#define NDP_REACHABLE 2
+#define NDP_STALE 3
+
+typedef struct {
+    void* data;
+    size_t len;
+    size_t csum_offset;
+} ndp_frame_t;
+
+typedef struct ndp_entry ndp_entry_t;
+struct ndp_entry {
+    ndp_entry_t* next;
+    ip6_addr_t ip;
+    mac_addr_t mac;
+    uint8_t state;
+    // solicitations sent and not yet answered
+    uint8_t tries;
+    uint8_t npending;
+    // of the last advertisement or solicitation
+    uint64_t time;
+    uint64_t used;
+    ndp_frame_t pending[NDP_MAX_PENDING];
+};
+
+static ndp_entry_t ndp_cache[NDP_CACHE_SIZE];
+static ndp_entry_t* ndp_hash[NDP_HASH_SIZE];
+
+static unsigned ndp_bucket(const ip6_addr_t* ip) {
+    // link local addresses only differ in their interface identifier
+    uint32_t h = ip->u32[2] ^ ip->u32[3];
+    h ^= h >> 16;
+    h ^= h >> 8;
+    return h & (NDP_HASH_SIZE - 1);
+}
+
+static ndp_entry_t* ndp_lookup(const ip6_addr_t* ip) {
+    for (ndp_entry_t* e = ndp_hash[ndp_bucket(ip)]; e != NULL; e = e->next) {
+        if (ip6_addr_eq(&e->ip, ip)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void ndp_remove(ndp_entry_t* e) {
+    ndp_entry_t** link = &ndp_hash[ndp_bucket(&e->ip)];
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+    for (unsigned n = 0; n < e->npending; n++) {
+        eth_put_buffer(e->pending[n].data);
+    }
+    e->npending = 0;
+    e->state = NDP_FREE;
+}
+
+// Returns a new INCOMPLETE entry for ip, evicting the least recently
+// used resolved entry if the cache is full.
+static ndp_entry_t* ndp_create(const ip6_addr_t* ip, uint64_t now) {
+    ndp_entry_t* e = NULL;
+    for (unsigned n = 0; n < NDP_CACHE_SIZE; n++) {
+        ndp_entry_t* x = ndp_cache + n;
+        if (x->state == NDP_FREE) {
+            e = x;
+            break;
+        }
+        // entries being resolved go away soon enough by themselves
+        if ((x->state != NDP_INCOMPLETE) && ((e == NULL) || (x->used < e->used))) {
+            e = x;
+        }
+    }
+    if (e == NULL) {
+        return NULL;
+    }
+    if (e->state != NDP_FREE) {
+        ndp_remove(e);
+    }
+    e->ip = *ip;
+    e->state = NDP_INCOMPLETE;
+    e->tries = 0;
+    e->time = now;
+    e->used = now;
+    unsigned b = ndp_bucket(ip);
+    e->next = ndp_hash[b];
+    ndp_hash[b] = e;
+    return e;
+}
+
+static void ndp_solicit(ndp_entry_t* e) {
+    struct {
+        ndp_n_hdr_t hdr;
+        uint8_t opt[8];
+    } msg;
+    ip6_addr_t dst;
+
+    msg.hdr.type = ICMP6_NDP_N_SOLICIT;
+    msg.hdr.code = 0;
+    msg.hdr.checksum = 0;
+    msg.hdr.flags = 0;
+    memcpy(msg.hdr.target, &e->ip, sizeof(ip6_addr_t));
+    msg.opt[0] = NDP_N_SRC_LL_ADDR;
+    msg.opt[1] = 1;
+    memcpy(msg.opt + 2, &ll_mac_addr, ETH_ADDR_LEN);
+
+    // unresolved addresses are asked after on their solicited-node
+    // multicast address, stale ones are asked directly
+    if (e->state == NDP_INCOMPLETE) {
+        snmaddr_from_ip6(&dst, &e->ip);
+    } else {
+        dst = e->ip;
+    }
+    icmp6_send(&msg, sizeof(msg), &dst);
+}
+
+// Records the neighbor's link address and sends what was waiting for it.
+static void ndp_set(ndp_entry_t* e, const mac_addr_t* mac, uint8_t state) {
+    memcpy(&e->mac, mac, ETH_ADDR_LEN);
+    e->state = state;
+    e->tries = 0;
+    e->time = eth_time_ms();
+    for (unsigned n = 0; n < e->npending; n++) {
+        ndp_frame_t* f = e->pending + n;
+        memcpy(f->data, mac, ETH_ADDR_LEN);
+        ip6_xmit(f->data, f->len, f->csum_offset);
+    }
+    e->npending = 0;
+}
+
+// A link address heard from the neighbor rather than advertised for it
+// is taken as stale (RFC 4861 7.2.3), which is enough to reply with.
+static void ndp_learn(const ip6_addr_t* ip, const mac_addr_t* mac) {
+    // only unicast sources, not the unspecified address
+    if ((ip->u8[0] == 0xFF) || ((ip->u64[0] | ip->u64[1]) == 0)) {
+        return;
+    }
+    ndp_entry_t* e = ndp_lookup(ip);
+    if ((e == NULL) && ((e = ndp_create(ip, eth_time_ms())) == NULL)) {
+        return;
+    }
+    if ((e->state == NDP_INCOMPLETE) || memcmp(&e->mac, mac, ETH_ADDR_LEN)) {
+        ndp_set(e, mac, NDP_STALE);
+    }
+}
 
-    return 0;
+// Takes in an advertisement for ip (RFC 4861 7.2.5), mac being its
+// target link address option if it had one.
+static void ndp_advertised(const ip6_addr_t* ip, const mac_addr_t* mac, uint32_t flags) {
+    ndp_entry_t* e = ndp_lookup(ip);
+    uint8_t state = (flags & NDP_N_SOLICITED) ? NDP_REACHABLE : NDP_STALE;
+
+    // nobody asked, and there's nothing to update
+    if (e == NULL) {
+        return;
+    }
+    if (e->state == NDP_INCOMPLETE) {
+        if (mac != NULL) {
+            ndp_set(e, mac, state);
+        }
+        return;
+    }
+    if ((mac != NULL) && memcmp(&e->mac, mac, ETH_ADDR_LEN)) {
+        if (flags & NDP_N_OVERRIDE) {
+            ndp_set(e, mac, state);
+        }
+    } else if (state == NDP_REACHABLE) {
+        e->state = NDP_REACHABLE;
+        e->tries = 0;
+        e->time = eth_time_ms();
+    }
+}
+
+// Returns the link address option of the given type, if there is one.
+static const mac_addr_t* ndp_option(ndp_n_hdr_t* ndp, size_t len, uint8_t type) {
+    const uint8_t* opt = ndp->options;
+    len -= sizeof(ndp_n_hdr_t);
+    // option lengths are in units of 8 bytes
+    while (len >= 8) {
+        size_t n = opt[1] * 8;
+        if ((n == 0) || (n > len)) {
+            return NULL;
+        }
+        if (opt[0] == type) {
+            return (const void*)(opt + 2);
+        }
+        opt += n;
+        len -= n;
+    }
+    return NULL;
+}
+
+// Sends a frame to a unicast neighbor, or holds it until the neighbor is
+// resolved. The frame is the interface's either way.
+static int ndp_send(void* data, size_t len, size_t csum_offset, const ip6_addr_t* ip) {
+    uint64_t now = eth_time_ms();
+    ndp_entry_t* e = ndp_lookup(ip);
+
+    if (e == NULL) {
+        if ((e = ndp_create(ip, now)) == NULL) {
+            goto drop;
+        }
+        e->tries = 1;
+        ndp_solicit(e);
+    }
+    e->used = now;
+    if (e->state == NDP_INCOMPLETE) {
+        if (e->npending == NDP_MAX_PENDING) {
+            goto drop;
+        }
+        ndp_frame_t* f = e->pending + e->npending++;
+        f->data = data;
+        f->len = len;
+        f->csum_offset = csum_offset;
+        return 0;
+    }
+    if ((e->state == NDP_REACHABLE) && (now - e->time >= NDP_REACHABLE_MS)) {
+        e->state = NDP_STALE;
+    }
+    if ((e->state == NDP_STALE) && (e->tries == 0)) {
+        // tries is set first, as the solicitation comes back through here
+        e->tries = 1;
+        e->time = now;
+        ndp_solicit(e);
+    }
+    memcpy(data, &e->mac, ETH_ADDR_LEN);
+    return ip6_xmit(data, len, csum_offset);
+
+drop:
+    eth_put_buffer(data);
+    return -1;
+}
+
+int ip6_poll(void) {
+    uint64_t now = eth_time_ms();
+    int next = -1;
+
+    for (unsigned n = 0; n < NDP_CACHE_SIZE; n++) {
+        ndp_entry_t* e = ndp_cache + n;
+        switch (e->state) {
+        case NDP_REACHABLE:
+            if (now - e->time >= NDP_REACHABLE_MS) {
+                e->state = NDP_STALE;
+            }
+            break;
+        case NDP_STALE:
+            if ((e->tries == 0) && (now - e->used >= NDP_STALE_MS)) {
+                ndp_remove(e);
+            }
+            break;
+        }
+        // resolving or probing
+        if (((e->state == NDP_INCOMPLETE) || (e->state == NDP_STALE)) && (e->tries > 0)) {
+            if (now - e->time >= NDP_RETRANS_MS) {
+                if (e->tries == NDP_MAX_SOLICIT) {
+                    ndp_remove(e);
+                    continue;
+                }
+                e->tries++;
+                e->time = now;
+                ndp_solicit(e);
+            }
+            int ms = NDP_RETRANS_MS - (now - e->time);
+            if ((next < 0) || (ms < next)) {
+                next = ms;
+            }
+        }
+    }
+    return next;
+}
+
+// Sends a packet set up by ip6_setup(), having resolved its destination.
+static int ip6_send(ip6_pkt_t* p, size_t length, size_t csum_offset) {
+    void* data = p->eth + 2;
+    size_t len = ETH_HDR_LEN + IP6_HDR_LEN + length;
+
+    // Multicast addresses are a simple transform
+    if (p->ip6.dst.u8[0] == 0xFF) {
+        multicast_from_ip6(data, &p->ip6.dst);
+        return ip6_xmit(data, len, csum_offset);
+    }
+    return ndp_send(data, len, csum_offset, &p->ip6.dst);
 }
 
 #define UDP6_MAX_PAYLOAD (ETH_MTU - ETH_HDR_LEN - IP6_HDR_LEN - UDP_HDR_LEN)
@@ -206,8 +545,7 @@ int udp6_send(const void* data, size_t dlen, const ip6_addr_t* daddr, uint16_t d
         return -1;
     if (dlen > UDP6_MAX_PAYLOAD)
         goto fail;
-    if (ip6_setup((void*)p, daddr, length, HDR_UDP))
-        goto fail;
+    ip6_setup((void*)p, daddr, length, HDR_UDP);
 
     // udp header
     p->udp.src_port = htons(sport);
@@ -216,8 +554,14 @@ int udp6_send(const void* data, size_t dlen, const ip6_addr_t* daddr, uint16_t d
     p->udp.checksum = 0;
 
     memcpy(p->data, data, dlen);
+    if (eth_csum_offload()) {
+        // the interface sums the rest on top of the pseudo-header
+        p->udp.checksum = ip6_csum(&p->ip6.length, 2, htons(HDR_UDP));
+        p->udp.checksum = ip6_csum(&p->ip6.src, 32, p->udp.checksum);
+        return ip6_send((void*)p, length, offsetof(udp_hdr_t, checksum));
+    }
     p->udp.checksum = ip6_checksum(&p->ip6, HDR_UDP, length);
-    return eth_send(p->eth + 2, ETH_HDR_LEN + IP6_HDR_LEN + length);
+    return ip6_send((void*)p, length, 0);
 
 fail:
     eth_put_buffer(p);
@@ -235,20 +579,19 @@ static int icmp6_send(const void* data, size_t length, const ip6_addr_t* daddr)
         return -1;
     if (length > ICMP6_MAX_PAYLOAD)
         goto fail;
-    if (ip6_setup(p, daddr, length, HDR_ICMP6))
-        goto fail;
+    ip6_setup(p, daddr, length, HDR_ICMP6);
 
     icmp = (void*)p->data;
     memcpy(icmp, data, length);
     icmp->checksum = ip6_checksum(&p->ip6, HDR_ICMP6, length);
-    return eth_send(p->eth + 2, ETH_HDR_LEN + IP6_HDR_LEN + length);
+    return ip6_send(p, length, 0);
 
 fail:
     eth_put_buffer(p);
     return -1;
 }
 
-void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
+void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len, int hwsum) {
     udp_hdr_t* udp = _data;
     uint16_t sum, n;
 
@@ -259,8 +602,7 @@ void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
     if (udp->checksum == 0xFFFF)
         udp->checksum = 0;
 
-    sum = checksum(&ip->length, 2, htons(HDR_UDP));
-    sum = checksum(&ip->src, 32 + len, sum);
+    sum = ip6_sum(ip, HDR_UDP, len, hwsum);
     if (sum != 0xFFFF)
         BAD("Checksum Incorrect");
 
@@ -276,7 +618,7 @@ void _udp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
               (void*)&ip->src, ntohs(udp->src_port));
 }
 
-void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
+void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len, int hwsum) {
     icmp6_hdr_t* icmp = _data;
     uint16_t sum;
 
@@ -285,8 +627,7 @@ void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
     if (icmp->checksum == 0xFFFF)
         icmp->checksum = 0;
 
-    sum = checksum(&ip->length, 2, htons(HDR_ICMP6));
-    sum = checksum(&ip->src, 32 + len, sum);
+    sum = ip6_sum(ip, HDR_ICMP6, len, hwsum);
     if (sum != 0xFFFF)
         BAD("Checksum Incorrect");
 
@@ -301,9 +642,16 @@ void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
             BAD("Bogus NDP Message");
         if (ndp->code != 0)
             BAD("Bogus NDP Code");
+        if (ip->hop_limit != 255)
+            BAD("Bogus NDP Hop Limit");
         if (!ip6_addr_eq((ip6_addr_t*) ndp->target, &ll_ip6_addr))
             BAD("NDP Not For Me");
 
+        const mac_addr_t* mac = ndp_option(ndp, len, NDP_N_SRC_LL_ADDR);
+        if (mac != NULL) {
+            ndp_learn(&ip->src, mac);
+        }
+
         msg.hdr.type = ICMP6_NDP_N_ADVERTISE;
         msg.hdr.code = 0;
         msg.hdr.checksum = 0;
@@ -317,6 +665,21 @@ void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
         return;
     }
 
+    if (icmp->type == ICMP6_NDP_N_ADVERTISE) {
+        ndp_n_hdr_t* ndp = _data;
+
+        if (len < sizeof(ndp_n_hdr_t))
+            BAD("Bogus NDP Message");
+        if (ndp->code != 0)
+            BAD("Bogus NDP Code");
+        if (ip->hop_limit != 255)
+            BAD("Bogus NDP Hop Limit");
+
+        ndp_advertised((ip6_addr_t*) ndp->target,
+                       ndp_option(ndp, len, NDP_N_TGT_LL_ADDR), ntohl(ndp->flags));
+        return;
+    }
+
     if (icmp->type == ICMP6_ECHO_REQUEST) {
         icmp->checksum = 0;
         icmp->type = ICMP6_ECHO_REPLY;
@@ -327,10 +690,12 @@ void icmp6_recv(ip6_hdr_t* ip, void* _data, size_t len) {
     BAD("ICMP6 Unhandled");
 }
 
-void eth_recv(void* _data, size_t len) {
+// csum_start is negative unless the interface summed the frame
+static void ip6_recv(void* _data, size_t len, int csum_start, uint16_t csum) {
     uint8_t* data = _data;
     ip6_hdr_t* ip;
     uint32_t n;
+    int hwsum = -1;
 
     if (len < (ETH_HDR_LEN + IP6_HDR_LEN))
         BAD("Bogus Header Len");
@@ -352,6 +717,12 @@ void eth_recv(void* _data, size_t len) {
     if (n > len)
         BAD("IP6 Length Mismatch");
 
+    // the interface's sum is only of use if it covers just the ip6
+    // header and payload, then taking out the header leaves the payload's
+    if ((csum_start == ETH_HDR_LEN) && (len == n)) {
+        hwsum = csum_fold((uint32_t)csum + (uint16_t)~ip6_csum(ip, IP6_HDR_LEN, 0));
+    }
+
     // ignore any trailing data in the ethernet frame
     len = n;
 
@@ -362,22 +733,29 @@ void eth_recv(void* _data, size_t len) {
         return;
     }
 
-    // stash the sender's info to simplify replies
-    memcpy(&rx_mac_addr, (uint8_t*)_data + 6, ETH_ADDR_LEN);
-    rx_ip6_addr = ip->src;
+    // note the sender's link address to simplify replies
+    ndp_learn(&ip->src, (mac_addr_t*)((uint8_t*)_data + 6));
 
     switch (ip->next_header) {
     case HDR_ICMP6:
-        icmp6_recv(ip, data, len);
+        icmp6_recv(ip, data, len, hwsum);
         break;
     case HDR_UDP:
-        _udp6_recv(ip, data, len);
+        _udp6_recv(ip, data, len, hwsum);
         break;
     default:
         BAD("Unhandled IP6");
     }
 }
 
+void eth_recv(void* data, size_t len) {
+    ip6_recv(data, len, -1, 0);
+}
+
+void eth_recv_csum(void* data, size_t len, size_t csum_start, uint16_t csum) {
+    ip6_recv(data, len, csum_start, csum);
+}
+
 char* ip6toa(char* _out, void* ip6addr) {
     const uint8_t* x = ip6addr;
     const uint8_t* end = x + 16;
@@ -6,11 +6,14 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 
 #include <magenta/syscalls.h>
 
+#include <ddk/protocol/ethernet.h>
+
 #include <inet6/inet6.h>
 #include <inet6/netifc.h>
 
@@ -18,6 +21,20 @@
 
 static int netfd = -1;
 static uint8_t netmac[6];
+// the device reads and writes batches of frames
+static bool netbatched;
+// ETH_FEATURE_* of the device, only of use in batches
+static uint32_t netfeatures;
+
+// the device's shared rings, if it has them, in which case the tx
+// buffers are the ones eth_get_buffer() hands out
+static eth_rings_t* netrings;
+static mx_handle_t netvmo = MX_HANDLE_INVALID;
+static uint64_t netvmo_size;
+// tx entries before this have had their buffers reclaimed
+static uint32_t nettx_reclaimed;
+// set while working through received frames, which kicks once at the end
+static bool netkick_deferred;
 
 #define MAX_FILTER 8
 
@@ -34,11 +51,16 @@ struct eth_buffer {
 
 static eth_buffer_t* eth_buffers = NULL;
 
+static void eth_tx_reclaim(void);
+
 void* eth_get_buffer(size_t sz) {
     eth_buffer_t* buf;
     if (sz > ETH_BUFFER_SIZE) {
         return NULL;
     }
+    if ((eth_buffers == NULL) && netrings) {
+        eth_tx_reclaim();
+    }
     if (eth_buffers == NULL) {
         printf("out of buffers\n");
         return NULL;
@@ -60,7 +82,68 @@ void eth_put_buffer(void* data) {
     eth_buffers = buf;
 }
 
+static void eth_kick_rings(void) {
+    mxio_ioctl(netfd, ETHERNET_OP_KICK_RINGS, NULL, 0, NULL, 0);
+}
+
+// Puts back the buffers of the frames the device has finished sending.
+static void eth_tx_reclaim(void) {
+    uint32_t tail = __atomic_load_n(&netrings->tx_tail, __ATOMIC_ACQUIRE);
+    while (nettx_reclaimed != tail) {
+        eth_ring_entry_t* entry = &netrings->entries[netrings->rx_count +
+                                                     (nettx_reclaimed % netrings->tx_count)];
+        eth_put_buffer((uint8_t*)netrings + entry->offset);
+        nettx_reclaimed++;
+    }
+}
+
+// The frame is already in a tx buffer, so it's only queued.
+static int eth_send_ring(void* data, size_t len) {
+    uint32_t head = netrings->tx_head;
+    // every queued frame holds a buffer, and there are only as many
+    // buffers as entries, so there's always room
+    eth_ring_entry_t* entry = &netrings->entries[netrings->rx_count + (head % netrings->tx_count)];
+    entry->offset = (uint8_t*)data - (uint8_t*)netrings;
+    entry->length = len;
+    entry->flags = 0;
+    __atomic_store_n(&netrings->tx_head, head + 1, __ATOMIC_RELEASE);
+    if (!netkick_deferred) {
+        eth_kick_rings();
+    }
+    return len;
+}
+
+static int eth_send_batch(void* data, size_t len, uint16_t flags, size_t csum_start, size_t csum_offset) {
+    uint8_t batch[sizeof(eth_batch_hdr_t) + ETH_BUFFER_SIZE];
+    eth_batch_hdr_t* hdr = (eth_batch_hdr_t*)batch;
+    hdr->length = len;
+    hdr->flags = flags;
+    hdr->csum_start = csum_start;
+    hdr->csum = csum_offset;
+    memcpy(hdr + 1, data, len);
+    int r = write(netfd, batch, sizeof(eth_batch_hdr_t) + len);
+    if (r > 0) {
+        r = len;
+    }
+    eth_put_buffer(data);
+    return r;
+}
+
+int eth_csum_offload(void) {
+    return netbatched && (netfeatures & ETH_FEATURE_TX_CSUM);
+}
+
+int eth_send_csum(void* data, size_t len, size_t csum_start, size_t csum_offset) {
+    return eth_send_batch(data, len, ETH_BATCH_CSUM, csum_start, csum_offset);
+}
+
 int eth_send(void* data, size_t len) {
+    if (netrings) {
+        return eth_send_ring(data, len);
+    }
+    if (netbatched) {
+        return eth_send_batch(data, len, 0, 0, 0);
+    }
     int r = write(netfd, data, len);
     eth_put_buffer(data);
     return r;
@@ -74,6 +157,10 @@ static volatile uint64_t net_timer = 0;
 
 #define TIMER_MS(n) (((uint64_t)(n)) * 1000000ULL)
 
+uint64_t eth_time_ms(void) {
+    return mx_current_time() / TIMER_MS(1);
+}
+
 void netifc_set_timer(uint32_t ms) {
     net_timer = mx_current_time() + TIMER_MS(ms);
 }
@@ -116,6 +203,41 @@ int netifc_open(void) {
         return -1;
     }
     ip6_init(netmac);
+
+    ioctl_ethernet_get_rings_t rings;
+    if (mxio_ioctl(netfd, ETHERNET_OP_GET_RINGS, NULL, 0, &rings, sizeof(rings)) == sizeof(rings)) {
+        uintptr_t ptr;
+        mx_status_t r = mx_process_vm_map(0, rings.vmo, 0, rings.size, &ptr,
+                                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+        if (r < 0) {
+            printf("netifc: cannot map rings (%d)\n", r);
+            mx_handle_close(rings.vmo);
+            close(netfd);
+            netfd = -1;
+            return -1;
+        }
+        netrings = (eth_rings_t*)ptr;
+        netvmo = rings.vmo;
+        netvmo_size = rings.size;
+        nettx_reclaimed = netrings->tx_tail;
+        // eth_put_buffer() finds a buffer's header by alignment
+        for (uint32_t i = 0; i < netrings->tx_count; i++) {
+            uint32_t off = netrings->tx_offset + i * netrings->buf_size;
+            if ((off & 31) || (netrings->buf_size < sizeof(eth_buffer_t) + ETH_BUFFER_SIZE)) {
+                break;
+            }
+            eth_buffer_t* eb = (eth_buffer_t*)((uint8_t*)netrings + off);
+            eb->magic = ETH_BUFFER_MAGIC;
+            eth_put_buffer(eb->data);
+        }
+        return 0;
+    }
+
+    uint32_t batched = 1;
+    netbatched = (mxio_ioctl(netfd, ETHERNET_OP_SET_BATCHED, &batched, sizeof(batched), NULL, 0) >= 0);
+    if (mxio_ioctl(netfd, ETHERNET_OP_GET_FEATURES, NULL, 0, &netfeatures, sizeof(netfeatures)) < 0) {
+        netfeatures = 0;
+    }
     for (int i = 0; i < 8; i++) {
         char* buffer = malloc(sizeof(eth_buffer_t) + ETH_BUFFER_SIZE + 32);
         buffer = (char*)((((uintptr_t)buffer) + 31) & (~31));
@@ -129,6 +251,13 @@ int netifc_open(void) {
 }
 
 void netifc_close(void) {
+    if (netrings) {
+        eth_buffers = NULL;
+        mx_process_vm_unmap(0, (uintptr_t)netrings, netvmo_size);
+        mx_handle_close(netvmo);
+        netrings = NULL;
+        netvmo = MX_HANDLE_INVALID;
+    }
     close(netfd);
     netfd = -1;
 }
@@ -137,22 +266,73 @@ int netifc_active(void) {
     return (netfd >= 0);
 }
 
-void netifc_poll(void) {
-    uint8_t buffer[2048];
+// Works through the received frames in the rings, and hands their
+// buffers back with one kick for the lot, replies included.
+static void netifc_poll_rings(void) {
+    uint32_t tail = netrings->rx_tail;
+    uint32_t head;
+
+    eth_tx_reclaim();
+    netkick_deferred = true;
+    while ((head = __atomic_load_n(&netrings->rx_head, __ATOMIC_ACQUIRE)) != tail) {
+        while (tail != head) {
+            eth_ring_entry_t* entry = &netrings->entries[tail % netrings->rx_count];
+            eth_recv((uint8_t*)netrings + entry->offset, entry->length);
+            tail++;
+        }
+        __atomic_store_n(&netrings->rx_tail, tail, __ATOMIC_RELEASE);
+    }
+    netkick_deferred = false;
+    eth_kick_rings();
+}
+
+// The same through read(), a batch or a frame at a time.
+static void netifc_poll_read(void) {
+    // one RPC's worth of frames at a time
+    uint8_t buffer[MXIO_CHUNK_SIZE];
     int r;
 
-    for (;;) {
-        while ((r = read(netfd, buffer, sizeof(buffer))) > 0) {
+    while ((r = read(netfd, buffer, netbatched ? sizeof(buffer) : 2048)) > 0) {
+        if (!netbatched) {
             eth_recv(buffer, r);
+            continue;
+        }
+        int off = 0;
+        while (off + (int)sizeof(eth_batch_hdr_t) <= r) {
+            eth_batch_hdr_t* hdr = (eth_batch_hdr_t*)(buffer + off);
+            if (hdr->length > r - off - sizeof(eth_batch_hdr_t)) {
+                break;
+            }
+            if (hdr->flags & ETH_BATCH_CSUM) {
+                eth_recv_csum(hdr + 1, hdr->length, hdr->csum_start, hdr->csum);
+            } else {
+                eth_recv(hdr + 1, hdr->length);
+            }
+            off += ETH_BATCH_NEXT(hdr->length);
+        }
+    }
+}
+
+void netifc_poll(void) {
+    for (;;) {
+        if (netrings) {
+            netifc_poll_rings();
+        } else {
+            netifc_poll_read();
         }
+        mx_time_t timeout = MX_TIME_INFINITE;
         if (net_timer) {
             mx_time_t now = mx_current_time();
             if (now > net_timer) {
                 break;
             }
-            mxio_wait_fd(netfd, MXIO_EVT_READABLE, NULL, net_timer - now + TIMER_MS(1));
-        } else {
-            mxio_wait_fd(netfd, MXIO_EVT_READABLE, NULL, MX_TIME_INFINITE);
+            timeout = net_timer - now + TIMER_MS(1);
+        }
+        // wake up for neighbor solicitations too
+        int ms = ip6_poll();
+        if ((ms >= 0) && (TIMER_MS(ms) < timeout)) {
+            timeout = TIMER_MS(ms);
         }
+        mxio_wait_fd(netfd, MXIO_EVT_READABLE, NULL, timeout);
     }
 }
@@ -70,3 +70,11 @@ mx_status_t elf_load_finish(mx_handle_t proc, elf_load_info_t* info,
     return elf_load_map_segments(proc, &info->header, info->phdrs, vmo,
                                  base, entry);
 }
+
+mx_status_t elf_load_finish_etc(mx_handle_t proc, elf_load_info_t* info,
+                                mx_handle_t vmo,
+                                mx_vaddr_t* base, mx_vaddr_t* entry,
+                                elf_load_map_func_t map, void* map_arg) {
+    return elf_load_map_segments_etc(proc, &info->header, info->phdrs, vmo,
+                                     base, entry, map, map_arg);
+}
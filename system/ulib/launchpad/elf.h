@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <elfload/elfload.h>
 #include <magenta/types.h>
 #include <stddef.h>
 
@@ -30,4 +31,11 @@ mx_status_t elf_load_finish(mx_handle_t proc, elf_load_info_t* info,
                             mx_handle_t vmo,
                             mx_vaddr_t* base, mx_vaddr_t* entry);
 
+// Same, but each mapping is made by calling map(map_arg, ...) in
+// place of mx_process_vm_map.
+mx_status_t elf_load_finish_etc(mx_handle_t proc, elf_load_info_t* info,
+                                mx_handle_t vmo,
+                                mx_vaddr_t* base, mx_vaddr_t* entry,
+                                elf_load_map_func_t map, void* map_arg);
+
 #pragma GCC visibility pop
@@ -13,9 +13,20 @@
 __BEGIN_CDECLS
 
 // Opaque type representing launchpad state.
-// Use of this object is not thread-safe.
+// Use of this object is not thread-safe, but separate launchpads
+// can be set up and started on separate threads at the same time.
 typedef struct launchpad launchpad_t;
 
+// Opaque type holding the work launchpad_elf_load does on an
+// executable that doesn't depend on the process: the file's VM
+// object and ELF headers, and if it has a PT_INTERP, the dynamic
+// linker's VM object and headers.  It isn't changed once created,
+// so one bundle can be loaded by any number of launchpads on any
+// number of threads.  Starting the same program over and over that
+// way skips the header reads and the loader service round trip
+// that each launchpad_elf_load call makes.
+typedef struct launchpad_bundle launchpad_bundle_t;
+
 // Create a new process and a launchpad that will set it up.
 mx_status_t launchpad_create(const char* name, launchpad_t** lp);
 
@@ -78,6 +89,60 @@ mx_status_t launchpad_elf_load_basic(launchpad_t* lp, mx_handle_t vmo);
 // bootstrap message.
 mx_status_t launchpad_elf_load(launchpad_t* lp, mx_handle_t vmo);
 
+// Create a bundle for the ELF file image found in a VM object.  The
+// VM object handle follows the rules of launchpad_elf_load_basic.
+// A PT_INTERP string is looked up through the loader service handle
+// given, which is not consumed; if it's MX_HANDLE_INVALID, a
+// mxio_loader_service is started for the lookup and shut down after.
+mx_status_t launchpad_bundle_create(mx_handle_t vmo, mx_handle_t loader_svc,
+                                    launchpad_bundle_t** bundle);
+
+// Free a bundle.  No launchpad_elf_load_bundle call may be using it,
+// but processes already loaded from it are unaffected.
+void launchpad_bundle_destroy(launchpad_bundle_t* bundle);
+
+// Load the process from a bundle, with the same results as
+// launchpad_elf_load on the bundle's file.  The bundle is not
+// consumed.  The executable's VM object handle sent to the dynamic
+// linker is a duplicate of the one in the bundle.
+mx_status_t launchpad_elf_load_bundle(launchpad_t* lp,
+                                      const launchpad_bundle_t* bundle);
+
+// Opaque type holding a loaded process image that hasn't been
+// started: every mapping made by the load calls on a launchpad from
+// launchpad_create_for_template, and the resulting entry point and
+// dynamic linker state.  Like a bundle, it isn't changed once
+// created and can be used on any number of threads at once.
+typedef struct launchpad_template launchpad_template_t;
+
+// Same as launchpad_create, but the launchpad records every mapping
+// the load calls make (launchpad_elf_load and friends, and
+// launchpad_load_vdso), for launchpad_template_create.  Its process
+// is meant to be a model only and never started.
+mx_status_t launchpad_create_for_template(const char* name,
+                                          launchpad_t** lp);
+
+// Capture the image loaded into a launchpad from
+// launchpad_create_for_template.  Only the loaded image is captured,
+// not the handles, arguments or environment.  The launchpad stops
+// recording, and should be destroyed once done with.
+mx_status_t launchpad_template_create(launchpad_t* lp,
+                                      launchpad_template_t** tmpl);
+
+// Free a template.  Processes created from it are unaffected.
+void launchpad_template_destroy(launchpad_template_t* tmpl);
+
+// Create a new process and a launchpad for it, with the template's
+// image already loaded as if by the calls that loaded the template.
+// Read-only memory is shared with the template, and each process
+// gets a copy-on-write clone of the writable memory, so nothing is
+// read or copied until the process touches it.  The handles,
+// arguments and environment are set up as usual before
+// launchpad_start.
+mx_status_t launchpad_create_from_template(const char* name,
+                                           const launchpad_template_t* tmpl,
+                                           launchpad_t** lp);
+
 // Load an extra ELF file image into the process.  This is similar
 // to launchpad_elf_load_basic, but it does not consume the VM
 // object handle, does affect the state of the launchpad's
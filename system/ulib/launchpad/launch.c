@@ -40,8 +40,7 @@ mx_handle_t finish_launch(launchpad_t* lp, mx_status_t status,
         proc = launchpad_start(lp);
     } else {
         // Consume the handles on error.
-        for (uint32_t i = 0; i < handle_count; ++i)
-            mx_handle_close(handles[i]);
+        mx_handle_close_many(handles, handle_count);
         proc = status;
     }
     launchpad_destroy(lp);
@@ -23,6 +23,16 @@ enum special_handles {
     HND_SPECIAL_COUNT
 };
 
+// One mapping made while loading a template's image.  The vmo is our
+// own handle to what was mapped.
+struct launchpad_mapping {
+    mx_handle_t vmo;
+    uint64_t offset;
+    mx_size_t len;
+    uintptr_t addr;
+    uint32_t flags;
+};
+
 struct launchpad {
     uint32_t argc;
     uint32_t envc;
@@ -41,20 +51,32 @@ struct launchpad {
 
     mx_handle_t special_handles[HND_SPECIAL_COUNT];
     bool loader_message;
+
+    // set for launchpad_create_for_template, which records every
+    // mapping of the image
+    bool recording;
+    struct launchpad_mapping* maps;
+    size_t map_count;
+    size_t map_alloc;
 };
 
 // We always install the process handle as the first in the message.
 #define lp_proc(lp) ((lp)->handles[0])
 
 static void close_handles(mx_handle_t* handles, size_t count) {
-    for (size_t i = 0; i < count; ++i) {
-        if (handles[i] != MX_HANDLE_INVALID) {
-            mx_handle_close(handles[i]);
-        }
-    }
+    // MX_HANDLE_INVALID entries are skipped
+    if (count > 0)
+        mx_handle_close_many(handles, count);
+}
+
+static void free_mappings(struct launchpad_mapping* maps, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        mx_handle_close(maps[i].vmo);
+    free(maps);
 }
 
 void launchpad_destroy(launchpad_t* lp) {
+    free_mappings(lp->maps, lp->map_count);
     close_handles(lp->special_handles, HND_SPECIAL_COUNT);
     close_handles(lp->handles, lp->handle_count);
     free(lp->handles);
@@ -230,6 +252,52 @@ mx_status_t launchpad_add_pipe(launchpad_t* lp, int* fd_out, int target_fd) {
     return NO_ERROR;
 }
 
+static mx_status_t record_mapping(void* arg, mx_handle_t proc,
+                                  mx_handle_t vmo, uint64_t offset,
+                                  mx_size_t len, uintptr_t* ptr,
+                                  uint32_t flags) {
+    launchpad_t* lp = arg;
+
+    if (lp->map_count == lp->map_alloc) {
+        size_t alloc = lp->map_alloc == 0 ? 8 : lp->map_alloc * 2;
+        struct launchpad_mapping* maps =
+            realloc(lp->maps, alloc * sizeof(maps[0]));
+        if (maps == NULL)
+            return ERR_NO_MEMORY;
+        lp->maps = maps;
+        lp->map_alloc = alloc;
+    }
+
+    mx_handle_t dup = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS);
+    if (dup < 0)
+        return dup;
+
+    mx_status_t status = mx_process_vm_map(proc, vmo, offset, len,
+                                           ptr, flags);
+    if (status != NO_ERROR) {
+        mx_handle_close(dup);
+        return status;
+    }
+
+    lp->maps[lp->map_count++] = (struct launchpad_mapping){
+        .vmo = dup,
+        .offset = offset,
+        .len = len,
+        .addr = *ptr,
+        .flags = flags,
+    };
+    return NO_ERROR;
+}
+
+static mx_status_t lp_elf_load_finish(launchpad_t* lp, elf_load_info_t* elf,
+                                      mx_handle_t vmo,
+                                      mx_vaddr_t* base, mx_vaddr_t* entry) {
+    if (lp->recording)
+        return elf_load_finish_etc(lp_proc(lp), elf, vmo, base, entry,
+                                   &record_mapping, lp);
+    return elf_load_finish(lp_proc(lp), elf, vmo, base, entry);
+}
+
 mx_status_t launchpad_elf_load_basic(launchpad_t* lp, mx_handle_t vmo) {
     if (vmo < 0)
         return vmo;
@@ -239,7 +307,7 @@ mx_status_t launchpad_elf_load_basic(launchpad_t* lp, mx_handle_t vmo) {
     elf_load_info_t* elf;
     mx_status_t status = elf_load_start(vmo, &elf);
     if (status == NO_ERROR)
-        status = elf_load_finish(lp_proc(lp), elf, vmo, NULL, &lp->entry);
+        status = lp_elf_load_finish(lp, elf, vmo, NULL, &lp->entry);
     elf_load_destroy(elf);
 
     if (status == NO_ERROR) {
@@ -260,7 +328,7 @@ mx_status_t launchpad_elf_load_extra(launchpad_t* lp, mx_handle_t vmo,
     elf_load_info_t* elf;
     mx_status_t status = elf_load_start(vmo, &elf);
     if (status == NO_ERROR)
-        status = elf_load_finish(lp_proc(lp), elf, vmo, base, entry);
+        status = lp_elf_load_finish(lp, elf, vmo, base, entry);
     elf_load_destroy(elf);
 
     return status;
@@ -337,6 +405,14 @@ static mx_status_t setup_loader_svc(launchpad_t* lp) {
     return NO_ERROR;
 }
 
+// Hand the executable to the dynamic linker loaded in its place.
+static void set_exec_vmo(launchpad_t* lp, mx_handle_t vmo) {
+    if (lp->special_handles[HND_EXEC_VMO] != MX_HANDLE_INVALID)
+        mx_handle_close(lp->special_handles[HND_EXEC_VMO]);
+    lp->special_handles[HND_EXEC_VMO] = vmo;
+    lp->loader_message = true;
+}
+
 // Consumes 'vmo' on success, not on failure.
 static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
                                  const char* interp, size_t interp_len) {
@@ -353,18 +429,14 @@ static mx_status_t handle_interp(launchpad_t* lp, mx_handle_t vmo,
     elf_load_info_t* elf;
     status = elf_load_start(interp_vmo, &elf);
     if (status == NO_ERROR) {
-        status = elf_load_finish(lp_proc(lp), elf, interp_vmo,
+        status = lp_elf_load_finish(lp, elf, interp_vmo,
                                  NULL, &lp->entry);
         elf_load_destroy(elf);
     }
     mx_handle_close(interp_vmo);
 
-    if (status == NO_ERROR) {
-        if (lp->special_handles[HND_EXEC_VMO] != MX_HANDLE_INVALID)
-            mx_handle_close(lp->special_handles[HND_EXEC_VMO]);
-        lp->special_handles[HND_EXEC_VMO] = vmo;
-        lp->loader_message = true;
-    }
+    if (status == NO_ERROR)
+        set_exec_vmo(lp, vmo);
 
     return status;
 }
@@ -383,7 +455,7 @@ mx_status_t launchpad_elf_load(launchpad_t* lp, mx_handle_t vmo) {
         status = elf_load_get_interp(elf, vmo, &interp, &interp_len);
         if (status == NO_ERROR) {
             if (interp == NULL) {
-                status = elf_load_finish(lp_proc(lp), elf, vmo,
+                status = lp_elf_load_finish(lp, elf, vmo,
                                          NULL, &lp->entry);
                 if (status == NO_ERROR) {
                     lp->loader_message = false;
@@ -399,6 +471,231 @@ mx_status_t launchpad_elf_load(launchpad_t* lp, mx_handle_t vmo) {
     return status;
 }
 
+struct launchpad_bundle {
+    mx_handle_t exec_vmo;
+    elf_load_info_t* exec_elf;
+    // MX_HANDLE_INVALID and NULL if there's no PT_INTERP
+    mx_handle_t interp_vmo;
+    elf_load_info_t* interp_elf;
+};
+
+void launchpad_bundle_destroy(launchpad_bundle_t* bundle) {
+    if (bundle->interp_vmo != MX_HANDLE_INVALID)
+        mx_handle_close(bundle->interp_vmo);
+    if (bundle->interp_elf != NULL)
+        elf_load_destroy(bundle->interp_elf);
+    if (bundle->exec_vmo != MX_HANDLE_INVALID)
+        mx_handle_close(bundle->exec_vmo);
+    if (bundle->exec_elf != NULL)
+        elf_load_destroy(bundle->exec_elf);
+    free(bundle);
+}
+
+static mx_status_t bundle_load_interp(launchpad_bundle_t* bundle,
+                                      mx_handle_t loader_svc,
+                                      const char* interp, size_t interp_len) {
+    bool own_svc = (loader_svc == MX_HANDLE_INVALID);
+    if (own_svc) {
+        loader_svc = mxio_loader_service(NULL, NULL);
+        if (loader_svc < 0)
+            return loader_svc;
+    }
+
+    mx_handle_t interp_vmo = loader_svc_rpc(
+        loader_svc, LOADER_SVC_OP_LOAD_OBJECT, interp, interp_len);
+
+    if (own_svc) {
+        // closing our end shuts the service thread down
+        mx_handle_close(loader_svc);
+    }
+
+    if (interp_vmo < 0)
+        return interp_vmo;
+    bundle->interp_vmo = interp_vmo;
+    return elf_load_start(interp_vmo, &bundle->interp_elf);
+}
+
+mx_status_t launchpad_bundle_create(mx_handle_t vmo, mx_handle_t loader_svc,
+                                    launchpad_bundle_t** result) {
+    if (vmo < 0)
+        return vmo;
+    if (vmo == MX_HANDLE_INVALID)
+        return ERR_INVALID_ARGS;
+
+    launchpad_bundle_t* bundle = calloc(1, sizeof(*bundle));
+    if (bundle == NULL)
+        return ERR_NO_MEMORY;
+
+    mx_status_t status = elf_load_start(vmo, &bundle->exec_elf);
+    if (status == NO_ERROR) {
+        char* interp;
+        size_t interp_len;
+        status = elf_load_get_interp(bundle->exec_elf, vmo,
+                                     &interp, &interp_len);
+        if (status == NO_ERROR && interp != NULL) {
+            status = bundle_load_interp(bundle, loader_svc,
+                                        interp, interp_len);
+            free(interp);
+        }
+    }
+
+    if (status != NO_ERROR) {
+        // the caller keeps the vmo on failure
+        launchpad_bundle_destroy(bundle);
+        return status;
+    }
+
+    bundle->exec_vmo = vmo;
+    *result = bundle;
+    return NO_ERROR;
+}
+
+mx_status_t launchpad_elf_load_bundle(launchpad_t* lp,
+                                      const launchpad_bundle_t* bundle) {
+    if (bundle->interp_vmo == MX_HANDLE_INVALID) {
+        mx_status_t status = lp_elf_load_finish(lp, bundle->exec_elf,
+                                             bundle->exec_vmo,
+                                             NULL, &lp->entry);
+        if (status == NO_ERROR)
+            lp->loader_message = false;
+        return status;
+    }
+
+    mx_status_t status = setup_loader_svc(lp);
+    if (status != NO_ERROR)
+        return status;
+
+    mx_handle_t vmo = mx_handle_duplicate(bundle->exec_vmo,
+                                          MX_RIGHT_SAME_RIGHTS);
+    if (vmo < 0)
+        return vmo;
+
+    status = lp_elf_load_finish(lp, bundle->interp_elf,
+                             bundle->interp_vmo, NULL, &lp->entry);
+    if (status == NO_ERROR) {
+        set_exec_vmo(lp, vmo);
+    } else {
+        mx_handle_close(vmo);
+    }
+    return status;
+}
+
+struct launchpad_template {
+    struct launchpad_mapping* maps;
+    size_t map_count;
+    mx_vaddr_t entry;
+    mx_vaddr_t vdso_base;
+    // for the dynamic linker, or MX_HANDLE_INVALID
+    mx_handle_t exec_vmo;
+};
+
+mx_status_t launchpad_create_for_template(const char* name,
+                                          launchpad_t** lp) {
+    mx_status_t status = launchpad_create(name, lp);
+    if (status == NO_ERROR)
+        (*lp)->recording = true;
+    return status;
+}
+
+mx_status_t launchpad_template_create(launchpad_t* lp,
+                                      launchpad_template_t** result) {
+    if (!lp->recording || lp->entry == 0)
+        return ERR_BAD_STATE;
+
+    launchpad_template_t* tmpl = calloc(1, sizeof(*tmpl));
+    if (tmpl == NULL)
+        return ERR_NO_MEMORY;
+
+    tmpl->exec_vmo = MX_HANDLE_INVALID;
+    if (lp->loader_message &&
+        lp->special_handles[HND_EXEC_VMO] != MX_HANDLE_INVALID) {
+        tmpl->exec_vmo = mx_handle_duplicate(
+            lp->special_handles[HND_EXEC_VMO], MX_RIGHT_SAME_RIGHTS);
+        if (tmpl->exec_vmo < 0) {
+            mx_status_t status = tmpl->exec_vmo;
+            free(tmpl);
+            return status;
+        }
+    }
+
+    tmpl->maps = lp->maps;
+    tmpl->map_count = lp->map_count;
+    tmpl->entry = lp->entry;
+    tmpl->vdso_base = lp->vdso_base;
+
+    lp->maps = NULL;
+    lp->map_count = 0;
+    lp->map_alloc = 0;
+    lp->recording = false;
+
+    *result = tmpl;
+    return NO_ERROR;
+}
+
+void launchpad_template_destroy(launchpad_template_t* tmpl) {
+    free_mappings(tmpl->maps, tmpl->map_count);
+    if (tmpl->exec_vmo != MX_HANDLE_INVALID)
+        mx_handle_close(tmpl->exec_vmo);
+    free(tmpl);
+}
+
+static mx_status_t map_from_template(mx_handle_t proc,
+                                     const struct launchpad_mapping* map) {
+    mx_handle_t vmo = map->vmo;
+    uint64_t offset = map->offset;
+    uintptr_t addr = map->addr;
+
+    // Each process gets its own copy-on-write clone of writable memory.
+    // The template's copy is never written, since its process never runs.
+    if (map->flags & MX_VM_FLAG_PERM_WRITE) {
+        vmo = mx_vm_object_clone(map->vmo, map->offset, map->len);
+        if (vmo < 0)
+            return vmo;
+        offset = 0;
+    }
+
+    mx_status_t status = mx_process_vm_map(proc, vmo, offset, map->len,
+                                           &addr, map->flags);
+    if (vmo != map->vmo)
+        mx_handle_close(vmo);
+    return status;
+}
+
+mx_status_t launchpad_create_from_template(const char* name,
+                                           const launchpad_template_t* tmpl,
+                                           launchpad_t** result) {
+    launchpad_t* lp;
+    mx_status_t status = launchpad_create(name, &lp);
+    if (status != NO_ERROR)
+        return status;
+
+    for (size_t i = 0; status == NO_ERROR && i < tmpl->map_count; ++i)
+        status = map_from_template(lp_proc(lp), &tmpl->maps[i]);
+
+    if (status == NO_ERROR && tmpl->exec_vmo != MX_HANDLE_INVALID) {
+        status = setup_loader_svc(lp);
+        if (status == NO_ERROR) {
+            mx_handle_t vmo = mx_handle_duplicate(tmpl->exec_vmo,
+                                                  MX_RIGHT_SAME_RIGHTS);
+            if (vmo < 0) {
+                status = vmo;
+            } else {
+                set_exec_vmo(lp, vmo);
+            }
+        }
+    }
+
+    if (status != NO_ERROR) {
+        launchpad_destroy(lp);
+        return status;
+    }
+
+    lp->entry = tmpl->entry;
+    lp->vdso_base = tmpl->vdso_base;
+    *result = lp;
+    return NO_ERROR;
+}
+
 static mx_handle_t vdso_vmo = MX_HANDLE_INVALID;
 static mxr_mutex_t vdso_mutex = MXR_MUTEX_INIT;
 static void vdso_lock(void) {
@@ -444,11 +741,13 @@ mx_status_t launchpad_add_vdso_vmo(launchpad_t* lp) {
 mx_status_t launchpad_load_vdso(launchpad_t* lp, mx_handle_t vmo) {
     if (vmo != MX_HANDLE_INVALID)
         return launchpad_elf_load_extra(lp, vmo, &lp->vdso_base, NULL);
-    vdso_lock();
-    vmo = vdso_get_vmo();
+    // Load from our own handle rather than holding the lock across
+    // the load, which would serialize launches on other threads.
+    vmo = launchpad_get_vdso_vmo();
     mx_status_t status = launchpad_elf_load_extra(lp, vmo,
                                                   &lp->vdso_base, NULL);
-    vdso_unlock();
+    if (vmo > 0)
+        mx_handle_close(vmo);
     return status;
 }
 
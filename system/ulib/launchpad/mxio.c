@@ -21,10 +21,8 @@ static mx_status_t add_mxio(launchpad_t* lp,
     if (status > 0) {
         size_t n = status;
         status = launchpad_add_handles(lp, n, handles, types);
-        if (status != NO_ERROR) {
-            for (size_t i = 0; i < n; ++i)
-                mx_handle_close(handles[i]);
-        }
+        if (status != NO_ERROR)
+            mx_handle_close_many(handles, n);
     }
     return status;
 }
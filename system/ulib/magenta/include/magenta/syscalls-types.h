@@ -102,6 +102,14 @@ typedef enum {
     MX_INFO_HANDLE_VALID,
     MX_INFO_HANDLE_BASIC,
     MX_INFO_PROCESS,
+    MX_INFO_PROCESS_MEMORY,
+    MX_INFO_VMO,
+    MX_INFO_MSG_PIPE,
+    MX_INFO_SYSCALL_STATS,
+    MX_INFO_THREAD_STATS,
+    MX_INFO_PROCESS_STATS,
+    MX_INFO_PROCESS_HANDLE_STATS,
+    MX_INFO_OBJECT_STATS,
 } mx_handle_info_topic_t;
 
 typedef enum {
@@ -120,6 +128,7 @@ typedef enum {
     MX_OBJ_TYPE_PCI_INT             = 12,
     MX_OBJ_TYPE_LOG                 = 13,
     MX_OBJ_TYPE_WAIT_SET            = 14,
+    MX_OBJ_TYPE_TIMER               = 15,
     MX_OBJ_TYPE_LAST
 } mx_obj_type_t;
 
@@ -141,6 +150,151 @@ typedef struct mx_process_info {
     int return_code;
 } mx_process_info_t;
 
+// Returned for topic MX_INFO_PROCESS_MEMORY
+typedef struct mx_process_memory_info {
+    uint64_t mapped_bytes;        // address space covered by mappings
+    uint64_t committed_bytes;     // pages of mapped vm objects present in the mappings
+} mx_process_memory_info_t;
+
+// Returned for topic MX_INFO_VMO
+typedef struct mx_vmo_info {
+    uint64_t size;
+    uint64_t committed_bytes;     // pages held by the vm object itself
+    uint64_t compressed_bytes;    // pages the kernel holds compressed instead
+    uint64_t compressed_stored_bytes; // kernel memory those take up
+} mx_vmo_info_t;
+
+// Returned for topic MX_INFO_MSG_PIPE
+typedef struct mx_msg_pipe_info {
+    uint64_t queued_bytes;        // waiting to be read on this end
+    uint64_t peer_queued_bytes;   // written from this end, waiting on the other
+    uint32_t queued_messages;
+    uint32_t peer_queued_messages;
+} mx_msg_pipe_info_t;
+
+// Returned for topic MX_INFO_SYSCALL_STATS, one per syscall. The counts
+// are kernel-wide, whatever the handle; kernels not built with
+// SYSCALL_STATS fail the topic with ERR_NOT_SUPPORTED.
+#define MX_SYSCALL_STATS_BUCKETS 8
+typedef struct mx_syscall_stats {
+    uint32_t num;                 // syscall number
+    uint32_t reserved;
+    uint64_t count;               // calls made
+    uint64_t cycles;              // cycles from entry to return, summed
+    // calls by cycles taken: <256, <1K, <4K, ... and the rest in the last
+    uint32_t histogram[MX_SYSCALL_STATS_BUCKETS];
+} mx_syscall_stats_t;
+
+// Returned for topics MX_INFO_THREAD_STATS and MX_INFO_PROCESS_STATS, the
+// latter summed over the threads the process has had. Times are in
+// nanoseconds, at the kernel's microsecond resolution.
+typedef struct mx_thread_stats {
+    mx_time_t runtime;            // on a cpu
+    mx_time_t ready_time;         // runnable, waiting for a cpu
+    mx_time_t blocked_time;       // all of the below
+    mx_time_t futex_time;
+    mx_time_t port_time;          // in mx_io_port_wait
+    mx_time_t handle_time;        // waiting on handle signals, pipes and the rest
+    mx_time_t mutex_time;         // on kernel mutexes, in syscalls
+    mx_time_t sleep_time;
+    mx_time_t other_time;
+    uint64_t context_switches;
+    uint64_t preemptions;         // switches while still runnable
+} mx_thread_stats_t;
+
+// Returned for topic MX_INFO_PROCESS_HANDLE_STATS, the handles the process
+// holds by the type of their object.
+typedef struct mx_process_handle_stats {
+    uint32_t handle_count[MX_OBJ_TYPE_LAST]; // indexed by mx_obj_type_t
+} mx_process_handle_stats_t;
+
+// Returned for topic MX_INFO_OBJECT_STATS, one per object type from
+// MX_OBJ_TYPE_PROCESS on, as many as fit. The counts are kernel-wide,
+// whatever the handle, and only cover objects that have had a handle.
+// Polling them gives the rates objects are made and destroyed at, and
+// their difference how many are alive.
+typedef struct mx_object_stats {
+    uint32_t type;                // mx_obj_type_t
+    uint32_t reserved;
+    uint64_t created;             // since boot
+    uint64_t destroyed;
+} mx_object_stats_t;
+
+// Deadline scheduling terms for a thread, see MX_PROP_THREAD_DEADLINE. The
+// thread gets |runtime| of cpu time in every |period|, to be used within
+// |deadline| of each period starting. In nanoseconds; a runtime of 0 means
+// the thread is scheduled by priority.
+typedef struct mx_thread_deadline {
+    mx_time_t runtime;
+    mx_time_t deadline;
+    mx_time_t period;
+} mx_thread_deadline_t;
+
+// Defines and structures related to mx_ktrace_control()
+// Trace points are enabled by group.
+#define MX_KTRACE_GRP_SYSCALL       0x001u
+#define MX_KTRACE_GRP_SCHED         0x002u
+#define MX_KTRACE_GRP_PAGE_FAULT    0x004u
+#define MX_KTRACE_GRP_IRQ           0x008u
+#define MX_KTRACE_GRP_IPC           0x010u
+#define MX_KTRACE_GRP_SAMPLE        0x020u  // cpu profiling, where supported
+#define MX_KTRACE_GRP_ALL           0x03fu
+
+// A tag names an event, and the group it's in.
+#define MX_KTRACE_TAG(grp, event)   (((uint32_t)(grp) << 16) | (event))
+#define MX_KTRACE_TAG_GROUP(tag)    ((tag) >> 16)
+#define MX_KTRACE_TAG_EVENT(tag)    ((tag) & 0xffffu)
+
+// The meaning of a record's a and b for each event.
+#define MX_KTRACE_TAG_SYSCALL_ENTER MX_KTRACE_TAG(MX_KTRACE_GRP_SYSCALL, 1)     // number, -
+#define MX_KTRACE_TAG_SYSCALL_EXIT  MX_KTRACE_TAG(MX_KTRACE_GRP_SYSCALL, 2)     // number, return
+#define MX_KTRACE_TAG_CONTEXT_SWITCH MX_KTRACE_TAG(MX_KTRACE_GRP_SCHED, 1)      // old state, new thread
+#define MX_KTRACE_TAG_PAGE_FAULT    MX_KTRACE_TAG(MX_KTRACE_GRP_PAGE_FAULT, 1)  // flags, address
+#define MX_KTRACE_TAG_IRQ_ENTER     MX_KTRACE_TAG(MX_KTRACE_GRP_IRQ, 1)         // vector, -
+#define MX_KTRACE_TAG_IRQ_EXIT      MX_KTRACE_TAG(MX_KTRACE_GRP_IRQ, 2)         // vector, -
+#define MX_KTRACE_TAG_MSG_SEND      MX_KTRACE_TAG(MX_KTRACE_GRP_IPC, 1)         // bytes, pipe koid
+#define MX_KTRACE_TAG_MSG_RECV      MX_KTRACE_TAG(MX_KTRACE_GRP_IPC, 2)         // bytes, pipe koid
+#define MX_KTRACE_TAG_SAMPLE_PC     MX_KTRACE_TAG(MX_KTRACE_GRP_SAMPLE, 1)      // thread koid, pc
+#define MX_KTRACE_TAG_SAMPLE_CALLER MX_KTRACE_TAG(MX_KTRACE_GRP_SAMPLE, 2)      // depth, return address
+
+// A SAMPLE_PC record is taken every so many cpu cycles, with the koid of the
+// user thread that was running or 0 for a kernel thread. If the pc is in the
+// kernel, it is followed by a SAMPLE_CALLER record for each frame of the
+// kernel stack that could be walked, on the same cpu.
+
+typedef struct mx_ktrace_record {
+    uint64_t ts;                  // nanoseconds since boot
+    uint64_t thread;              // kernel thread running at the time
+    uint32_t tag;
+    uint32_t a;
+    uint64_t b;
+} mx_ktrace_record_t;
+
+// The trace vmo holds this header in its first MX_KTRACE_HEADER_SIZE bytes,
+// followed by a ring of records_per_cpu records for each cpu in turn. The
+// counts are brought up to date when tracing is stopped.
+#define MX_KTRACE_MAGIC             0x6b747263u // "ktrc"
+#define MX_KTRACE_VERSION           1u
+#define MX_KTRACE_MAX_CPUS          32u
+#define MX_KTRACE_HEADER_SIZE       4096u
+typedef struct mx_ktrace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_cpus;
+    uint32_t record_size;
+    uint64_t records_per_cpu;     // a power of two
+    uint64_t grpmask;             // groups traced
+    // records each cpu wrote since the last rewind. Those past
+    // records_per_cpu have overwritten the oldest ones; record n of a cpu
+    // is at index n % records_per_cpu of its ring.
+    uint64_t written[MX_KTRACE_MAX_CPUS];
+} mx_ktrace_header_t;
+
+// actions for mx_ktrace_control()
+#define MX_KTRACE_ACTION_START      1u  // trace the groups in options
+#define MX_KTRACE_ACTION_STOP       2u
+#define MX_KTRACE_ACTION_REWIND     3u  // empty the rings, once stopped
+#define MX_KTRACE_ACTION_GET_VMO    4u  // a read-only handle to the trace vmo
 
 // Defines and structures related to mx_pci_*()
 // Info returned to dev manager for PCIe devices when probing.
@@ -194,6 +348,12 @@ typedef struct mx_log_record {
 
 #define MX_LOG_FLAG_WAIT      0x80000000
 #define MX_LOG_FLAG_READABLE  0x40000000
+// Read as many records as fit rather than one, and return how many. Each
+// record starts MX_LOG_RECORD_SIZE() bytes after the one before it.
+#define MX_LOG_FLAG_MANY      0x20000000
+
+#define MX_LOG_RECORD_SIZE(rec) \
+    ((sizeof(mx_log_record_t) + (rec)->datalen + 7) & ~(size_t)7)
 
 // Defines and structures for mx_io_port_*()
 
@@ -203,6 +363,19 @@ typedef struct mx_log_record {
 #define MX_IO_PORT_PKT_TYPE_IOSN      1u
 #define MX_IO_PORT_PKT_TYPE_USER      2u
 #define MX_IO_PORT_PKT_TYPE_EXCEPTION 3u
+// Sent by a port with a bounded depth, see MX_PROP_IO_PORT_DEPTH, after it
+// had to drop packets for lack of room. |hdr.extra| holds how many.
+#define MX_IO_PORT_PKT_TYPE_OVERFLOW  4u
+// Sent for a PCI interrupt bound to the port, see mx_interrupt_packet_t.
+#define MX_IO_PORT_PKT_TYPE_INTERRUPT 5u
+// Sent for a page of an object made by mx_pager_create() that is wanted but
+// hasn't been supplied, see mx_pager_packet_t.
+#define MX_IO_PORT_PKT_TYPE_PAGER     6u
+
+// The most packets mx_io_port_wait_many() takes at once
+#define MX_IO_PORT_WAIT_MANY_MAX      64u
+// The deepest a port can be made, see MX_PROP_IO_PORT_DEPTH
+#define MX_IO_PORT_MAX_DEPTH          4096u
 
 typedef struct mx_packet_header {
     uint64_t key;
@@ -218,11 +391,34 @@ typedef struct mx_io_packet {
     uint32_t reserved;
 } mx_io_packet_t;
 
+// |hdr.extra| holds how many times the interrupt fired since the last packet
+// for it was read, and |timestamp| when the first of those was.
+typedef struct mx_interrupt_packet {
+    mx_packet_header_t hdr;
+    mx_time_t timestamp;
+} mx_interrupt_packet_t;
+
+// |hdr.key| is the key given to mx_pager_create(). The |length| bytes at the
+// page aligned |offset| into the object are wanted, and should be supplied
+// with mx_pager_supply().
+typedef struct mx_pager_packet {
+    mx_packet_header_t hdr;
+    uint64_t offset;
+    uint64_t length;
+} mx_pager_packet_t;
+
 typedef struct mx_exception_packet {
     mx_packet_header_t hdr;
     mx_exception_report_t report;
 } mx_exception_packet_t;
 
+// Options for mx_wait_set_add_etc(). An EDGE entry is reported once each
+// time it becomes ready rather than on every wait while it stays ready. A
+// ONESHOT entry is reported once and then not again until
+// mx_wait_set_rearm().
+#define MX_WAIT_SET_ENTRY_EDGE          1u
+#define MX_WAIT_SET_ENTRY_ONESHOT       2u
+
 // Structures for mx_wait_set_*()
 typedef struct mx_wait_set_result {
     uint64_t cookie;
@@ -231,13 +427,128 @@ typedef struct mx_wait_set_result {
     mx_signals_state_t signals_state;
 } mx_wait_set_result_t;
 
+// Arguments to mx_message_call(). The kernel stamps a transaction id over
+// the first four bytes of the message written, and the reply is the message
+// the other side writes back starting with the same id. Ids always have the
+// top bit set.
+typedef struct mx_message_call_args {
+    const void* wr_bytes;
+    const mx_handle_t* wr_handles;
+    void* rd_bytes;
+    mx_handle_t* rd_handles;
+    uint32_t wr_num_bytes;
+    uint32_t wr_num_handles;
+    uint32_t rd_num_bytes;
+    uint32_t rd_num_handles;
+} mx_message_call_args_t;
+
+// One message for mx_message_read_many() and mx_message_write_many(). On
+// reads the sizes are those of the buffers going in and those of the message
+// read coming out.
+typedef struct mx_message_vec {
+    void* bytes;
+    mx_handle_t* handles;
+    uint32_t num_bytes;
+    uint32_t num_handles;
+} mx_message_vec_t;
+
+// The most messages mx_message_read_many() and mx_message_write_many() take at once
+#define MX_MESSAGE_BATCH_MAX 64u
+
+// One mapping for mx_process_vm_map_many(), with the arguments of
+// mx_process_vm_map(). ptr is the address to map at going in, with
+// MX_VM_FLAG_FIXED, and the address mapped at coming out.
+typedef struct mx_vm_map_entry {
+    mx_handle_t vmo;
+    uint32_t flags;
+    uint64_t offset;
+    mx_size_t len;
+    uintptr_t ptr;
+} mx_vm_map_entry_t;
+
+// The most mappings mx_process_vm_map_many() makes at once
+#define MX_VM_MAP_BATCH_MAX 64u
+
+// Options for mx_data_pipe_create(). With shared cursors both ends map the
+// ring with mx_data_pipe_map() and move data through it without making any
+// syscalls, keeping its cursors in an mx_data_pipe_control_t mapped next to
+// it. mx_data_pipe_read() and friends aren't available on such a pipe.
+#define MX_DATA_PIPE_SHARED_CURSORS     1u
+
+// The control page of a data pipe with shared cursors. Each count only ever
+// grows and is only written by its own end; data lives at count % size in
+// the ring. The kernel doesn't see the counts change: READABLE and WRITABLE
+// are only brought up to date by mx_data_pipe_sync().
+//
+// To wait for data, the consumer sets |consumer_waiting|, checks the counts
+// again, and if the ring is still empty calls mx_data_pipe_sync() then waits
+// for READABLE. The producer, after advancing |write_count|, clears
+// |consumer_waiting| if it was set and calls mx_data_pipe_sync(). Waiting for
+// room works the same way the other way around.
+typedef struct mx_data_pipe_control {
+    volatile uint64_t write_count;
+    uint8_t reserved0[56];
+    volatile uint64_t read_count;
+    uint8_t reserved1[56];
+    volatile uint32_t consumer_waiting;
+    volatile uint32_t producer_waiting;
+} mx_data_pipe_control_t;
+
+// One buffer of an mx_data_pipe_writev() or mx_data_pipe_readv()
+typedef struct mx_iovec {
+    void* buffer;
+    mx_size_t size;
+} mx_iovec_t;
+
+// Flags for mx_data_pipe_writev() and mx_data_pipe_readv(): move everything
+// the buffers ask for or nothing at all
+#define MX_DATA_PIPE_ALL_OR_NONE        1u
+
+// The most buffers mx_data_pipe_writev() and mx_data_pipe_readv() take at once
+#define MX_DATA_PIPE_IOVEC_MAX          16u
+
 // Buffer size limits on the cprng syscalls
 #define MX_CPRNG_DRAW_MAX_LEN        256
 #define MX_CPRNG_ADD_ENTROPY_MAX_LEN 256
 
+// Priority inheriting futexes, see mx_futex_wait_pi(). The futex value holds
+// the handle of the owning thread. Handle values never have the top bit set,
+// so userspace may use it to note that the futex has waiters.
+#define MX_FUTEX_PI_OWNER_MASK         0x7fffffff
+#define MX_FUTEX_PI_WAITERS            0x80000000u
+
 // Object properties.
 
 #define MX_PROP_BAD_HANDLE_POLICY      1u
+// Caps on the messages waiting to be read on a message pipe handle, 0 for
+// none. Writes to a full pipe fail with ERR_NOT_READY, and the writer's end
+// isn't WRITABLE until the reader catches up.
+#define MX_PROP_MSG_PIPE_MAX_MESSAGES  2u
+#define MX_PROP_MSG_PIPE_MAX_BYTES     3u
+// Number of packets an io port preallocates and can hold, 0 for no bound.
+// Can be set once, before anything is queued. Once it is full, queueing
+// fails with ERR_NOT_READY, and packets for bound handles are dropped and
+// counted in an MX_IO_PORT_PKT_TYPE_OVERFLOW packet.
+#define MX_PROP_IO_PORT_DEPTH          4u
+// A thread's deadline scheduling terms, an mx_thread_deadline_t. Setting
+// them needs MX_RIGHT_WRITE on the thread, and fails with ERR_NO_RESOURCES
+// if no cpu has that much of its time left to reserve.
+#define MX_PROP_THREAD_DEADLINE        5u
+// The cpus a thread may run on, a uint32_t with a bit per cpu. New threads
+// may run on any cpu. Bits past the last cpu are ignored, and a mask naming
+// no cpu is ERR_INVALID_ARGS. Setting it needs MX_RIGHT_WRITE on the thread.
+#define MX_PROP_THREAD_AFFINITY        6u
+// How late the timeouts of a thread's sleeps and waits may expire, an
+// mx_time_t in ns, so that the kernel can serve timeouts with nearby
+// deadlines with one wakeup. 0, the default, for none. Kept to the ms,
+// rounded down. Setting it needs MX_RIGHT_WRITE on the thread.
+#define MX_PROP_THREAD_TIMER_SLACK     7u
+// Whether the kernel may compress pages of a vm object that go untouched
+// for a while, when it is booted with kernel.page-store, a uint32_t that is
+// 1 (the default) or 0. Setting it to 0 brings any compressed pages back.
+// Objects whose physical addresses have been looked up can't be set back
+// to 1, which fails with ERR_BAD_STATE. Setting it needs MX_RIGHT_WRITE.
+#define MX_PROP_VMO_COMPRESSIBLE       8u
 
 #define MX_POLICY_BAD_HANDLE_IGNORE    0u
 #define MX_POLICY_BAD_HANDLE_LOG       1u
@@ -58,6 +58,16 @@ typedef uint32_t mx_rights_t;
 #define MX_VM_FLAG_PERM_READ      (1u << 1)
 #define MX_VM_FLAG_PERM_WRITE     (1u << 2)
 #define MX_VM_FLAG_PERM_EXECUTE   (1u << 3)
+#define MX_VM_FLAG_MAP_POPULATE   (1u << 4)
+#define MX_VM_FLAG_MAP_SEQUENTIAL (1u << 5)
+
+// operations to vm object range routines
+#define MX_VMO_OP_COMMIT          1u
+#define MX_VMO_OP_DECOMMIT        2u
+
+// options to cache flush routines
+#define MX_CACHE_FLUSH_DATA       (1u << 0)
+#define MX_CACHE_FLUSH_INVALIDATE (1u << 1)
 
 // flags to message pipe routines
 #define MX_FLAG_REPLY_PIPE        (1u << 0)
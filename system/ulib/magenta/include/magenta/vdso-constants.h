@@ -0,0 +1,32 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+// The vDSO has a page of read-only data, starting at its DATA_START
+// symbol, that the kernel fills in before handing the vDSO out. The
+// vDSO code reads it to answer some calls without entering the kernel.
+// A field left zero means the kernel has no value for it, and the call
+// falls back to the real system call. This is also what happens when
+// the library is loaded other than as the vDSO the kernel prepared.
+
+#define VDSO_CONSTANTS_MAX_NUM_CPUS 0
+#define VDSO_CONSTANTS_TSC_NS_SHIFT 4
+#define VDSO_CONSTANTS_TSC_NS_MULT 8
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+typedef struct {
+    // What mx_num_cpus() returns.
+    uint32_t max_num_cpus;
+    // mx_current_time() is (TSC * tsc_ns_mult) >> tsc_ns_shift, with a 128
+    // bit product, if the kernel keeps time with an invariant TSC that all
+    // CPUs agree on.
+    uint32_t tsc_ns_shift;
+    uint64_t tsc_ns_mult;
+} vdso_constants_t;
+
+#endif
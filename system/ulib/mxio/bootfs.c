@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include <magenta/types.h>
+#include <system/bootfs.h>
 
 #define BOOTFS_MAX_NAME_LEN 256
 
@@ -21,14 +22,16 @@ static const char FSMAGIC[16] = "[BOOTFS]\0\0\0\0\0\0\0\0";
 //   fileoffset (32bit le)
 //   namedata   (namelength bytes, includes \0)
 //
-// - fileoffsets must be page aligned (multiple of 4096)
+// - fileoffsets must be page aligned (multiple of 4096), and carry the
+//   BOOTFS_FLAG_* bits in their low bits
 
 #define NLEN 0
 #define FSIZ 1
 #define FOFF 2
 
 void bootfs_parse(void* _data, size_t len,
-                  void (*cb)(void*, const char* fn, size_t off, size_t len),
+                  void (*cb)(void*, const char* fn, size_t off, size_t len,
+                             uint32_t flags),
                   void* cb_arg) {
     uint8_t* data = _data;
     uint8_t* end = data + len;
@@ -53,8 +56,9 @@ void bootfs_parse(void* _data, size_t len,
             break;
         }
 
-        // require correct alignment
-        if (header[FOFF] & 4095) {
+        // require correct alignment, with only flags we know in the low bits
+        uint32_t flags = header[FOFF] & BOOTFS_FLAGS_MASK;
+        if (flags & ~BOOTFS_FLAG_COMPRESSED) {
             break;
         }
 
@@ -65,6 +69,6 @@ void bootfs_parse(void* _data, size_t len,
         data += header[NLEN];
         name[header[NLEN] - 1] = 0;
 
-        (*cb)(cb_arg, name, header[FOFF], header[FSIZ]);
+        (*cb)(cb_arg, name, header[FOFF] - flags, header[FSIZ], flags);
     }
 }
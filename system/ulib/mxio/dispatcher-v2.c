@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,7 +10,6 @@
 #include <magenta/syscalls.h>
 #include <mxio/debug.h>
 #include <mxio/dispatcher.h>
-#include <system/listnode.h>
 
 #include <runtime/thread.h>
 #include <runtime/mutex.h>
@@ -17,97 +17,186 @@
 #define MXDEBUG 0
 
 typedef struct {
-    list_node_t node;
     mx_handle_t h;
-    uint32_t flags;
+    uint32_t slot;
     void* cb;
     void* cookie;
+
+    // set while a thread is running this handler's callbacks,
+    // other threads leave the signals they saw in pending for it
+    bool busy;
+    mx_signals_t pending;
 } handler_t;
 
-#define FLAG_DISCONNECTED 1
+// Packets are keyed by slot and generation rather than by handler
+// pointer, so that one still in the port for a handler that has since
+// gone away is recognized and dropped, whichever thread dequeues it.
+typedef struct {
+    handler_t* handler;
+    uint32_t gen;
+    uint32_t next_free;
+} slot_t;
+
+#define NO_SLOT ((uint32_t)-1)
+#define MIN_SLOTS 16
+
+#define KEY(slot, gen) (((uint64_t)(gen) << 32) | (slot))
+#define KEY_SLOT(key) ((uint32_t)(key))
+#define KEY_GEN(key) ((uint32_t)((key) >> 32))
 
 struct mxio_dispatcher {
     mxr_mutex_t lock;
-    list_node_t list;
+    slot_t* slots;
+    uint32_t slot_count;
+    uint32_t free_slot;
+    uint32_t threads;
+    bool started;
     mx_handle_t ioport;
     mxio_dispatcher_cb_t cb;
-    mxr_thread_t* t;
 };
 
 static void mxio_dispatcher_destroy(mxio_dispatcher_t* md) {
     mx_handle_close(md->ioport);
+    free(md->slots);
     free(md);
 }
 
+// Take a slot for handler, growing the table if none is free.
+// Called with the lock held.
+static mx_status_t alloc_slot(mxio_dispatcher_t* md, handler_t* handler) {
+    if (md->free_slot == NO_SLOT) {
+        uint32_t count = md->slot_count ? md->slot_count * 2 : MIN_SLOTS;
+        slot_t* slots = realloc(md->slots, count * sizeof(slot_t));
+        if (slots == NULL) {
+            return ERR_NO_MEMORY;
+        }
+        for (uint32_t n = md->slot_count; n < count; n++) {
+            slots[n].handler = NULL;
+            slots[n].gen = 0;
+            slots[n].next_free = (n + 1 < count) ? n + 1 : NO_SLOT;
+        }
+        md->free_slot = md->slot_count;
+        md->slots = slots;
+        md->slot_count = count;
+    }
+    handler->slot = md->free_slot;
+    md->free_slot = md->slots[handler->slot].next_free;
+    md->slots[handler->slot].handler = handler;
+    return NO_ERROR;
+}
+
+// Retire handler's slot, after which packets bound for it are ignored.
+// Called with the lock held.
+static void free_slot(mxio_dispatcher_t* md, handler_t* handler) {
+    slot_t* slot = &md->slots[handler->slot];
+    slot->handler = NULL;
+    slot->gen++;
+    slot->next_free = md->free_slot;
+    md->free_slot = handler->slot;
+}
+
 static void destroy_handler(mxio_dispatcher_t* md, handler_t* handler) {
     mxr_mutex_lock(&md->lock);
-    list_delete(&handler->node);
+    free_slot(md, handler);
     mxr_mutex_unlock(&md->lock);
+    // closing the handle also unbinds it from the port
     mx_handle_close(handler->h);
     free(handler);
 }
 
-static void disconnect_handler(mxio_dispatcher_t* md, handler_t* handler) {
-    // unbind, so we get no further messages
-    mx_io_port_bind(md->ioport, (uint64_t)(uintptr_t)handler, handler->h, 0);
+// Find the handler a packet is for and make it busy. Returns NULL if it
+// is gone, or if another thread is running it and will see the signals.
+static handler_t* claim_handler(mxio_dispatcher_t* md, uint64_t key, mx_signals_t signals) {
+    uint32_t slot = KEY_SLOT(key);
+    handler_t* handler = NULL;
 
-    // send a synthetic message so we know when it's safe to destroy
-    mx_io_packet_t packet;
-    packet.hdr.key = (uint64_t)(uintptr_t)handler;
-    packet.signals = MX_SIGNAL_SIGNALED;
-    mx_io_port_queue(md->ioport, &packet, sizeof(packet));
+    mxr_mutex_lock(&md->lock);
+    if ((slot < md->slot_count) && (md->slots[slot].gen == KEY_GEN(key))) {
+        handler = md->slots[slot].handler;
+    }
+    if (handler != NULL) {
+        if (handler->busy) {
+            handler->pending |= signals;
+            handler = NULL;
+        } else {
+            handler->busy = true;
+        }
+    }
+    mxr_mutex_unlock(&md->lock);
+    return handler;
+}
+
+// Returns the signals other threads saw meanwhile, if any,
+// otherwise the handler is no longer busy.
+static mx_signals_t release_handler(mxio_dispatcher_t* md, handler_t* handler) {
+    mxr_mutex_lock(&md->lock);
+    mx_signals_t pending = handler->pending;
+    handler->pending = 0;
+    if (pending == 0) {
+        handler->busy = false;
+    }
+    mxr_mutex_unlock(&md->lock);
+    return pending;
+}
 
-    // flag so we know to ignore further events
-    handler->flags |= FLAG_DISCONNECTED;
+// Returns false if the handler was destroyed.
+static bool run_handler(mxio_dispatcher_t* md, handler_t* handler, mx_signals_t signals) {
+    mx_status_t r;
+    if (signals & MX_SIGNAL_READABLE) {
+        // binds are edge triggered, so we must drain all
+        // readable messages to hear about the next one
+        for (;;) {
+            if ((r = md->cb(handler->h, handler->cb, handler->cookie)) != 0) {
+                if (r == ERR_DISPATCHER_NO_WORK) {
+                    // no more messages to read
+                    break;
+                }
+                if (r < 0) {
+                    // synthesize a close
+                    md->cb(0, handler->cb, handler->cookie);
+                }
+                destroy_handler(md, handler);
+                return false;
+            }
+        }
+    }
+    if (signals & MX_SIGNAL_PEER_CLOSED) {
+        // synthesize a close
+        md->cb(0, handler->cb, handler->cookie);
+        destroy_handler(md, handler);
+        return false;
+    }
+    return true;
 }
 
 static int mxio_dispatcher_thread(void* _md) {
     mxio_dispatcher_t* md = _md;
     mx_status_t r;
 
-again:
     for (;;) {
         mx_io_packet_t packet;
-        if ((r = mx_io_port_wait(md->ioport, &packet, sizeof(packet))) < 0) {
+        if ((r = mx_io_port_wait(md->ioport, MX_TIME_INFINITE, &packet, sizeof(packet))) < 0) {
             printf("dispatcher: ioport wait failed %d\n", r);
             break;
         }
-        handler_t* handler = (void*)(uintptr_t)packet.hdr.key;
-        if (handler->flags & FLAG_DISCONNECTED) {
-            // handler is awaiting gc
-            // ignore events for it until we get the synthetic "destroy" event
-            if (packet.signals & MX_SIGNAL_SIGNALED) {
-                destroy_handler(md, handler);
-            }
+        handler_t* handler = claim_handler(md, packet.hdr.key, packet.signals);
+        if (handler == NULL) {
             continue;
         }
-        if (packet.signals & MX_SIGNAL_READABLE) {
-            // for now we must drain all readable messages
-            // due to limitations of io ports
-            for (;;) {
-                if ((r = md->cb(handler->h, handler->cb, handler->cookie)) != 0) {
-                    if (r == ERR_DISPATCHER_NO_WORK) {
-                        // no more messages to read
-                        break;
-                    }
-                    if (r < 0) {
-                        // synthesize a close
-                        md->cb(0, handler->cb, handler->cookie);
-                    }
-                    disconnect_handler(md, handler);
-                    goto again;
-                }
-            }
-        }
-        if (packet.signals & MX_SIGNAL_PEER_CLOSED) {
-            // synthesize a close
-            md->cb(0, handler->cb, handler->cookie);
-            disconnect_handler(md, handler);
+        mx_signals_t signals = packet.signals;
+        while (run_handler(md, handler, signals) &&
+               ((signals = release_handler(md, handler)) != 0)) {
+            ;
         }
     }
 
     printf("dispatcher: FATAL ERROR, EXITING\n");
-    mxio_dispatcher_destroy(md);
+    mxr_mutex_lock(&md->lock);
+    bool last = (--md->threads == 0);
+    mxr_mutex_unlock(&md->lock);
+    if (last) {
+        mxio_dispatcher_destroy(md);
+    }
     return NO_ERROR;
 }
 
@@ -117,36 +206,56 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
         return ERR_NO_MEMORY;
     }
     xprintf("mxio_dispatcher_create: %p\n", md);
-    list_initialize(&md->list);
     md->lock = MXR_MUTEX_INIT;
+    md->free_slot = NO_SLOT;
     if ((md->ioport = mx_io_port_create(0u)) < 0) {
+        mx_status_t r = md->ioport;
         free(md);
-        return md->ioport;
+        return r;
     }
     md->cb = cb;
     *out = md;
     return NO_ERROR;
 }
 
-mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md) {
-    mx_status_t r;
+mx_status_t mxio_dispatcher_start_threads(mxio_dispatcher_t* md, uint32_t count) {
+    if (count == 0) {
+        return ERR_INVALID_ARGS;
+    }
+
     mxr_mutex_lock(&md->lock);
-    if (md->t == NULL) {
-        if (mxr_thread_create(mxio_dispatcher_thread, md, "mxio-dispatcher", &md->t)) {
-            mxio_dispatcher_destroy(md);
-            r = ERR_NO_RESOURCES;
-        } else {
-            mxr_thread_detach(md->t);
-            r = NO_ERROR;
+    if (md->started) {
+        mxr_mutex_unlock(&md->lock);
+        return ERR_BAD_STATE;
+    }
+    md->started = true;
+    uint32_t n;
+    for (n = 0; n < count; n++) {
+        mxr_thread_t* t;
+        md->threads++;
+        if (mxr_thread_create(mxio_dispatcher_thread, md, "mxio-dispatcher", &t)) {
+            md->threads--;
+            break;
         }
-    } else {
-        r = ERR_BAD_STATE;
+        mxr_thread_detach(t);
     }
     mxr_mutex_unlock(&md->lock);
-    return r;
+
+    if (n == 0) {
+        mxio_dispatcher_destroy(md);
+        return ERR_NO_RESOURCES;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md) {
+    return mxio_dispatcher_start_threads(md, 1);
 }
 
 void mxio_dispatcher_run(mxio_dispatcher_t* md) {
+    mxr_mutex_lock(&md->lock);
+    md->threads++;
+    mxr_mutex_unlock(&md->lock);
     mxio_dispatcher_thread(md);
 }
 
@@ -154,19 +263,20 @@ mx_status_t mxio_dispatcher_add(mxio_dispatcher_t* md, mx_handle_t h, void* cb,
     handler_t* handler;
     mx_status_t r;
 
-    if ((handler = malloc(sizeof(handler_t))) == NULL) {
+    if ((handler = calloc(1, sizeof(handler_t))) == NULL) {
         return ERR_NO_MEMORY;
     }
     handler->h = h;
-    handler->flags = 0;
     handler->cb = cb;
     handler->cookie = cookie;
 
     mxr_mutex_lock(&md->lock);
-    list_add_tail(&md->list, &handler->node);
-    if ((r = mx_io_port_bind(md->ioport, (uint64_t)(uintptr_t)handler, h,
-                             MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED)) < 0) {
-        list_delete(&handler->node);
+    if ((r = alloc_slot(md, handler)) == NO_ERROR) {
+        uint64_t key = KEY(handler->slot, md->slots[handler->slot].gen);
+        if ((r = mx_io_port_bind(md->ioport, key, h,
+                                 MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED)) < 0) {
+            free_slot(md, handler);
+        }
     }
     mxr_mutex_unlock(&md->lock);
 
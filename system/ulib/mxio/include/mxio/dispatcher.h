@@ -29,6 +29,12 @@ mx_status_t mxio_dispatcher_create(mxio_dispatcher_t** out, mxio_dispatcher_cb_t
 // create a thread for a dispatcher and start it running
 mx_status_t mxio_dispatcher_start(mxio_dispatcher_t* md);
 
+// create count threads for a dispatcher and start them running
+//
+// Callbacks for different handles may then run at the same time, but
+// those for any one handle are still only ever called one at a time.
+mx_status_t mxio_dispatcher_start_threads(mxio_dispatcher_t* md, uint32_t count);
+
 // run the dispatcher loop on the current thread, never to return
 void mxio_dispatcher_run(mxio_dispatcher_t* md);
 
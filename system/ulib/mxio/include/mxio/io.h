@@ -7,6 +7,9 @@
 // for ssize_t
 #include <unistd.h>
 
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include <magenta/types.h>
 #include <system/compiler.h>
 
@@ -44,6 +47,16 @@ __BEGIN_CDECLS
 // wait until one or more events are pending
 mx_status_t mxio_wait_fd(int fd, uint32_t events, uint32_t* pending, mx_time_t timeout);
 
+// keep the results of stat() on absolute paths for up to ttl nanoseconds,
+// or stop doing so if ttl is 0. Metadata changed by other processes may
+// be seen that much late; changes made through mxio here empty the cache.
+void mxio_set_stat_cache_ttl(mx_time_t ttl);
+
+// like readdir(), but also fills out *s for the entry returned. Where the
+// filesystem supports it the attributes come with the names, otherwise
+// each entry is opened and stat()ed.
+struct dirent* mxio_readdir_stat(DIR* dir, struct stat* s);
+
 // invoke a raw mxio ioctl
 ssize_t mxio_ioctl(int fd, int op, const void* in_buf, size_t in_len, void* out_buf, size_t out_len);
 
@@ -53,4 +66,26 @@ mx_status_t mxio_pipe_half(mx_handle_t* handle, uint32_t* type);
 
 #define IOCTL_DEVICE_GET_HANDLE 0x7FFF0001
 
+// returns a read-only vmo holding the file's contents, for filesystems
+// that have one. It may be larger than the file, whose size is given by
+// stat(), and may be shared with the filesystem, showing later writes.
+#define IOCTL_FILE_GET_VMO 0x7FFF0002
+
+// returns a mxio_cache_stats_t for the block cache of the filesystem
+// the file is on, for filesystems that have one
+#define IOCTL_FS_GET_CACHE_STATS 0x7FFF0003
+
+typedef struct mxio_cache_stats {
+    uint64_t hits;          // blocks found in the cache
+    uint64_t misses;        // blocks read in from disk
+    uint64_t readahead;     // blocks read in ahead of a miss
+    uint64_t evictions;     // blocks dropped to make room or to shrink
+    uint32_t block_size;
+    uint32_t blocks;        // blocks the cache holds now,
+    uint32_t blocks_target; // shrinking back to this many when idle,
+    uint32_t blocks_max;    // and growing to at most this many
+    uint32_t busy;
+    uint32_t dirty;
+} mxio_cache_stats_t;
+
 __END_CDECLS
\ No newline at end of file
@@ -29,15 +29,26 @@ __BEGIN_CDECLS
 #define MXRIO_READDIR      0x00000009
 #define MXRIO_IOCTL        0x0000000a
 #define MXRIO_UNLINK       0x0000000b
-#define MXRIO_NUM_OPS      12
+#define MXRIO_READDIR_ATTR 0x0000000c
+#define MXRIO_READ_AT      0x0000000d
+#define MXRIO_WRITE_AT     0x0000000e
+#define MXRIO_NUM_OPS      15
 
 #define MXRIO_OP(n)        ((n) & 0xFFFF)
 #define MXRIO_REPLY_PIPE   0x01000000
+#define MXRIO_BULK         0x02000000
+
+// READ, WRITE, READ_AT and WRITE_AT may carry MXRIO_BULK to move up to MXRIO_BULK_MAX bytes
+// through a VMO in one round trip. Clients use it for transfers of at
+// least MXRIO_BULK_MIN bytes.
+#define MXRIO_BULK_MIN     (4 * MXIO_CHUNK_SIZE)
+#define MXRIO_BULK_MAX     (1024 * 1024)
 
 #define MXRIO_OPNAMES { \
     "status", "close", "clone", "open", \
     "misc", "read", "write", "seek", \
-    "stat", "readdir", "ioctl", "unlink" }
+    "stat", "readdir", "ioctl", "unlink", \
+    "readdir_attr", "read_at", "write_at" }
 
 typedef struct mxrio_msg mxrio_msg_t;
 
@@ -59,6 +70,12 @@ void mxrio_server(mx_handle_t h, mxrio_cb_t cb, void* cookie);
 // a mxio_dispatcher_handler suitable for use with a mxio_dispatcher
 mx_status_t mxrio_handler(mx_handle_t h, void* cb, void* cookie);
 
+// as above, but MXRIO_BULK reads and writes reach the callback whole
+// rather than as chunks: msg.op keeps MXRIO_BULK, arg is the length and
+// handle[0] the VMO, which the callback must neither close nor keep.
+// It returns the bytes moved, and may set arg2.off.
+mx_status_t mxrio_bulk_handler(mx_handle_t h, void* cb, void* cookie);
+
 // create a thread to service mxio remote io traffic
 mx_status_t mxrio_handler_create(mx_handle_t h, mxrio_cb_t cb, void* cookie);
 
@@ -70,6 +87,7 @@ mx_status_t mxrio_handler_create(mx_handle_t h, mxrio_cb_t cb, void* cookie);
 mx_status_t mxrio_txn_handoff(mx_handle_t srv, mx_handle_t rh, mxrio_msg_t* msg);
 
 struct mxrio_msg {
+    uint32_t txid;                     // transaction id, see mx_message_call()
     uint32_t magic;                    // MXRIO_MAGIC
     uint32_t op;                       // opcode
     uint32_t datalen;                  // size of data[]
@@ -102,13 +120,16 @@ struct mxrio_msg {
 // READDIR   maxreply   0       -                0           <vndirent_t[]>  -
 // IOCTL     out_len    opcode  <in_bytes>       0           <out_bytes>     -
 // UNLINK    0          0       <name>           0           -               -
+// READDIR_ATTR maxreply 0      -                0           <vdirent_attr_t[]> -
+// READ_AT   maxread    offset  -                endoffset   <bytes>         -
+// WRITE_AT  0          offset  <bytes>          endoffset   -               -
+// READ***   maxread    0       -                newoffset   -               vmo
+// WRITE***  len        0       -                newoffset   -               -
 //
 // proposed:
 //
 // LSTAT     maxreply   0       -                0           <vnattr_t>      -
 // MKDIR     0          0       <name>           0           -               -
-// READ_AT   maxread    offset  -                newoffset   <bytes>         -
-// WRITE_AT  0          offset  <bytes>          newoffset   -               -
 // RENAME*   name1len   0       <name1><name2>   0           -               -
 // SYMLINK   namelen    0       <name><path>     0           -               -
 // READLINK  maxreply   0       -                0           <path>          -
@@ -120,6 +141,9 @@ struct mxrio_msg {
 // on response arg32 is always mx_status, and may be positive for read/write calls
 // * handle[0] used to pass reference to second directory handle
 // ** handle[0] used to pass reference to target object
+// *** with MXRIO_BULK, handle[0] is a VMO the bytes are read into or written from,
+//     READ_AT and WRITE_AT likewise, with the offset in arg2
+// READ_AT and WRITE_AT leave the seek offset alone, endoffset is just past the bytes moved
 
 // allow for de-featuring this if it proves problematic
 // TODO: make permanent if not
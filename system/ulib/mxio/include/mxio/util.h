@@ -22,8 +22,12 @@ mx_status_t mxio_clone_root(mx_handle_t* handles, uint32_t* types);
 mx_status_t mxio_clone_fd(int fd, int newfd, mx_handle_t* handles, uint32_t* types);
 mx_status_t mxio_pipe_pair_raw(mx_handle_t* handles, uint32_t* types);
 
+// Calls |cb| for each file in a bootfs image. |flags| are BOOTFS_FLAG_*
+// bits from <system/bootfs.h>; a compressed file's |len| is its size once
+// decompressed.
 void bootfs_parse(void* _data, size_t len,
-                  void (*cb)(void*, const char* fn, size_t off, size_t len),
+                  void (*cb)(void*, const char* fn, size_t off, size_t len,
+                             uint32_t flags),
                   void* cb_arg);
 
 
@@ -23,6 +23,7 @@ typedef struct dnode dnode_t;
 
 typedef struct vnattr vnattr_t;
 typedef struct vdirent vdirent_t;
+typedef struct vdirent_attr vdirent_attr_t;
 
 typedef struct vdircookie {
     uint64_t n;
@@ -61,6 +62,10 @@ struct vnode_ops {
     // the readdir implementation to maintain state across calls.
     // To "rewind" and start from the beginning, cookie may be zero'd.
 
+    mx_status_t (*readdir_attr)(vnode_t* vn, void* cookie, void* dirents, size_t len);
+    // As readdir, but fills out vdirent_attr_t entries, which carry each
+    // child's attributes as well. Optional, and shares readdir's cookie.
+
     mx_status_t (*create)(vnode_t* vn, vnode_t** out, const char* name, size_t len, uint32_t mode);
     // Create a new node under vn.
     // Name is len bytes long, and does not include a null terminator.
@@ -78,6 +83,7 @@ struct vnattr {
     uint32_t reserved;
     uint64_t inode;
     uint64_t size;
+    uint64_t modify_time;  // mx_time_t of the last change, 0 if not tracked
 };
 
 struct vnode {
@@ -141,8 +147,16 @@ struct vdirent {
     char name[0];
 };
 
+struct vdirent_attr {
+    uint32_t size;
+    uint32_t type;
+    vnattr_t attr;
+    char name[0];
+};
+
+// atomic, for filesystems serving requests from several threads
 static inline void vn_acquire(vnode_t* vn) {
-    vn->refcount++;
+    __atomic_fetch_add(&vn->refcount, 1, __ATOMIC_SEQ_CST);
 }
 
 void vn_release(vnode_t* vn);
@@ -152,4 +166,9 @@ void vn_release(vnode_t* vn);
 mx_status_t vfs_fill_dirent(vdirent_t* de, size_t delen,
                             const char* name, size_t len, uint32_t type);
 
+// as above, for readdir_attr, returns offset to next vdirent_attr_t
+mx_status_t vfs_fill_dirent_attr(vdirent_attr_t* de, size_t delen,
+                                 const char* name, size_t len, uint32_t type,
+                                 const vnattr_t* attr);
+
 __END_CDECLS
@@ -4,12 +4,15 @@
 
 #include <mxio/util.h>
 #include <mxio/debug.h>
+#include <mxio/io.h>
 
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -17,6 +20,7 @@
 #include <magenta/types.h>
 #include <magenta/syscalls.h>
 
+#include <runtime/mutex.h>
 #include <runtime/thread.h>
 
 static void log_printf(mx_handle_t log, const char* fmt, ...) {
@@ -35,6 +39,127 @@ static void log_printf(mx_handle_t log, const char* fmt, ...) {
     mx_log_write(log, len, buf, 0u);
 }
 
+// Every process start asks for libc and friends again, so the default
+// loader keeps the VMOs it has read, shared by all the loader service
+// threads, and hands out read-only duplicates. An entry is only used while
+// the file still stats the same. The loaders clone or copy writable
+// segments rather than map the VMO writable, so sharing it is safe.
+
+#define MAX_CACHED_OBJECTS 32
+
+// What we can tell about a file's contents without reading it.
+typedef struct file_id {
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} file_id_t;
+
+typedef struct cached_object cached_object_t;
+struct cached_object {
+    cached_object_t* next;
+    file_id_t id;
+    mx_handle_t vmo;
+    char name[];
+};
+
+// most recently used first
+static cached_object_t* object_cache;
+static size_t object_cache_count;
+static mxr_mutex_t object_cache_lock = MXR_MUTEX_INIT;
+
+static const mx_rights_t object_rights =
+    MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_EXECUTE;
+
+static void file_id_get(const struct stat* s, file_id_t* id) {
+    memset(id, 0, sizeof(*id));
+    id->ino = s->st_ino;
+    id->size = s->st_size;
+    id->mtime = s->st_mtim;
+}
+
+static bool file_id_equal(const file_id_t* a, const file_id_t* b) {
+    return (a->ino == b->ino) && (a->size == b->size) &&
+           (a->mtime.tv_sec == b->mtime.tv_sec) &&
+           (a->mtime.tv_nsec == b->mtime.tv_nsec);
+}
+
+// Returns a duplicate of the cached VMO for |name| if it is still current,
+// dropping it if it is not.
+static mx_handle_t object_cache_lookup(const char* name, const file_id_t* id) {
+    mx_handle_t vmo = MX_HANDLE_INVALID;
+
+    mxr_mutex_lock(&object_cache_lock);
+    cached_object_t** link = &object_cache;
+    for (cached_object_t* obj = *link; obj != NULL; link = &obj->next, obj = *link) {
+        if (strcmp(obj->name, name))
+            continue;
+        *link = obj->next;
+        if (!file_id_equal(&obj->id, id)) {
+            object_cache_count--;
+            mx_handle_close(obj->vmo);
+            free(obj);
+        } else if ((vmo = mx_handle_duplicate(obj->vmo, object_rights)) < 0) {
+            object_cache_count--;
+            mx_handle_close(obj->vmo);
+            free(obj);
+        } else {
+            obj->next = object_cache;
+            object_cache = obj;
+        }
+        break;
+    }
+    mxr_mutex_unlock(&object_cache_lock);
+
+    return vmo;
+}
+
+// Takes over |vmo|, returning a duplicate to hand out.
+static mx_handle_t object_cache_insert(const char* name, const file_id_t* id, mx_handle_t vmo) {
+    mx_handle_t dup = mx_handle_duplicate(vmo, object_rights);
+    if (dup < 0) {
+        mx_handle_close(vmo);
+        return dup;
+    }
+
+    size_t len = strlen(name) + 1;
+    cached_object_t* obj = malloc(sizeof(*obj) + len);
+    if (obj == NULL) {
+        // still good, just not cached
+        mx_handle_close(vmo);
+        return dup;
+    }
+    obj->id = *id;
+    obj->vmo = vmo;
+    memcpy(obj->name, name, len);
+
+    mxr_mutex_lock(&object_cache_lock);
+    // a racing lookup may have got here first; keep the newest
+    cached_object_t** link = &object_cache;
+    for (cached_object_t* old = *link; old != NULL; link = &old->next, old = *link) {
+        if (!strcmp(old->name, name)) {
+            *link = old->next;
+            object_cache_count--;
+            mx_handle_close(old->vmo);
+            free(old);
+            break;
+        }
+    }
+    obj->next = object_cache;
+    object_cache = obj;
+    if (++object_cache_count > MAX_CACHED_OBJECTS) {
+        cached_object_t** last = &object_cache;
+        while ((*last)->next != NULL)
+            last = &(*last)->next;
+        object_cache_count--;
+        mx_handle_close((*last)->vmo);
+        free(*last);
+        *last = NULL;
+    }
+    mxr_mutex_unlock(&object_cache_lock);
+
+    return dup;
+}
+
 // 8K is the max io size of the mxio layer right now
 
 static mx_handle_t default_load_object(void* ignored, const char* fn) {
@@ -57,6 +182,20 @@ static mx_handle_t default_load_object(void* ignored, const char* fn) {
         goto fail;
     }
 
+    file_id_t id;
+    file_id_get(&s, &id);
+    if ((vmo = object_cache_lookup(path, &id)) > 0) {
+        close(fd);
+        return vmo;
+    }
+
+    // bootfs can hand out the file's pages directly
+    if ((mxio_ioctl(fd, IOCTL_FILE_GET_VMO, NULL, 0, &vmo, sizeof(vmo)) == sizeof(vmo)) &&
+        (vmo > 0)) {
+        close(fd);
+        return object_cache_insert(path, &id, vmo);
+    }
+
     if ((vmo = mx_vm_object_create(s.st_size)) < 0) {
         err = vmo;
         goto fail;
@@ -79,7 +218,7 @@ static mx_handle_t default_load_object(void* ignored, const char* fn) {
         size -= xfer;
     }
     close(fd);
-    return vmo;
+    return object_cache_insert(path, &id, vmo);
 
 fail:
     close(fd);
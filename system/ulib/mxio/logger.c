@@ -85,6 +85,8 @@ static mx_status_t log_clone(mxio_t* io, mx_handle_t* handles, uint32_t* types)
 static mxio_ops_t log_io_ops = {
     .read = mxio_default_read,
     .write = log_write,
+    .read_at = mxio_default_read_at,
+    .write_at = mxio_default_write_at,
     .seek = mxio_default_seek,
     .misc = mxio_default_misc,
     .close = log_close,
@@ -25,6 +25,14 @@ ssize_t mxio_default_write(mxio_t* io, const void* _data, size_t len) {
     return len;
 }
 
+ssize_t mxio_default_read_at(mxio_t* io, void* _data, size_t len, off_t offset) {
+    return ERR_NOT_SUPPORTED;
+}
+
+ssize_t mxio_default_write_at(mxio_t* io, const void* _data, size_t len, off_t offset) {
+    return ERR_NOT_SUPPORTED;
+}
+
 off_t mxio_default_seek(mxio_t* io, off_t offset, int whence) {
     return ERR_NOT_SUPPORTED;
 }
@@ -57,6 +65,8 @@ ssize_t mxio_default_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
 static mxio_ops_t mx_null_ops = {
     .read = mxio_default_read,
     .write = mxio_default_write,
+    .read_at = mxio_default_read_at,
+    .write_at = mxio_default_write_at,
     .seek = mxio_default_seek,
     .misc = mxio_default_misc,
     .close = mxio_default_close,
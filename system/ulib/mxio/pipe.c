@@ -151,6 +151,8 @@ static mx_status_t mx_pipe_wait(mxio_t* io, uint32_t _events, uint32_t* _pending
 static mxio_ops_t mx_pipe_ops = {
     .read = mx_pipe_read,
     .write = mx_pipe_write,
+    .read_at = mxio_default_read_at,
+    .write_at = mxio_default_write_at,
     .seek = mxio_default_seek,
     .misc = mxio_default_misc,
     .close = mx_pipe_close,
@@ -192,6 +194,193 @@ int mxio_pipe_pair(mxio_t** _a, mxio_t** _b) {
     return 0;
 }
 
+// pipe() hands out the two ends of a data pipe, which carries a byte
+// stream, so reads and writes of any size move as much as the ring has
+// data or room for in one syscall rather than one message per chunk.
+typedef struct mx_datapipe {
+    mxio_t io;
+    mx_handle_t h;
+} mx_datapipe_t;
+
+// Waits for signal, returning ERR_CHANNEL_CLOSED if the other end
+// went away instead.
+static mx_status_t mx_datapipe_wait_for(mx_handle_t h, mx_signals_t signal) {
+    mx_signals_state_t pending;
+    mx_status_t r;
+    if ((r = mx_handle_wait_one(h, signal | MX_SIGNAL_PEER_CLOSED,
+                                MX_TIME_INFINITE, &pending)) < 0) {
+        return r;
+    }
+    if (pending.satisfied & signal) {
+        return NO_ERROR;
+    }
+    return ERR_CHANNEL_CLOSED;
+}
+
+static ssize_t mx_datapipe_write(mxio_t* io, const void* _data, size_t len) {
+    mx_datapipe_t* p = (mx_datapipe_t*)io;
+    const uint8_t* data = _data;
+    mx_ssize_t r = 0;
+    ssize_t count = 0;
+
+    while (len > 0) {
+        r = mx_data_pipe_write(p->h, 0, len, data);
+        if (r == ERR_NOT_READY) {
+            if ((r = mx_datapipe_wait_for(p->h, MX_SIGNAL_WRITABLE)) < 0) {
+                break;
+            }
+            continue;
+        }
+        if (r < 0) {
+            break;
+        }
+        len -= r;
+        count += r;
+        data += r;
+    }
+
+    // prioritize partial write results over errors
+    return count ? count : r;
+}
+
+static ssize_t mx_datapipe_read(mxio_t* io, void* _data, size_t len) {
+    mx_datapipe_t* p = (mx_datapipe_t*)io;
+    uint8_t* data = _data;
+    mx_ssize_t r = 0;
+    ssize_t count = 0;
+
+    // like any pipe, return once there's something, but take what
+    // follows a wrap of the ring too
+    while (len > 0) {
+        r = mx_data_pipe_read(p->h, 0, len, data);
+        if (r == ERR_NOT_READY) {
+            if (count > 0) {
+                break;
+            }
+            if ((r = mx_datapipe_wait_for(p->h, MX_SIGNAL_READABLE)) < 0) {
+                // the writer is gone and the ring is empty
+                r = (r == ERR_CHANNEL_CLOSED) ? 0 : r;
+                break;
+            }
+            continue;
+        }
+        if (r < 0) {
+            break;
+        }
+        len -= r;
+        count += r;
+        data += r;
+    }
+
+    return count ? count : r;
+}
+
+static ssize_t mx_datapipe_bad_read(mxio_t* io, void* data, size_t len) {
+    return ERR_BAD_HANDLE;
+}
+
+static ssize_t mx_datapipe_bad_write(mxio_t* io, const void* data, size_t len) {
+    return ERR_BAD_HANDLE;
+}
+
+static mx_status_t mx_datapipe_close(mxio_t* io) {
+    mx_datapipe_t* p = (mx_datapipe_t*)io;
+    mx_handle_t h = p->h;
+    p->h = 0;
+    mx_handle_close(h);
+    return 0;
+}
+
+static mx_status_t mx_datapipe_wait(mxio_t* io, uint32_t _events, uint32_t* _pending, mx_time_t timeout) {
+    mx_datapipe_t* p = (void*)io;
+    uint32_t events = 0;
+    mx_status_t r;
+    mx_signals_state_t pending;
+
+    // a closed writer means end of file, which reads can see at once
+    if (_events & MXIO_EVT_READABLE) {
+        events |= MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED;
+    }
+    if (_events & MXIO_EVT_WRITABLE) {
+        events |= MX_SIGNAL_WRITABLE;
+    }
+    if ((r = mx_handle_wait_one(p->h, events, timeout, &pending)) < 0) {
+        return r;
+    }
+    if (_pending) {
+        uint32_t out = 0;
+        if (pending.satisfied & (MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED)) {
+            out |= (_events & MXIO_EVT_READABLE);
+        }
+        if (pending.satisfied & MX_SIGNAL_WRITABLE) {
+            out |= MXIO_EVT_WRITABLE;
+        }
+        *_pending = out;
+    }
+    return NO_ERROR;
+}
+
+static mxio_ops_t mx_datapipe_producer_ops = {
+    .read = mx_datapipe_bad_read,
+    .write = mx_datapipe_write,
+    .read_at = mxio_default_read_at,
+    .write_at = mxio_default_write_at,
+    .seek = mxio_default_seek,
+    .misc = mxio_default_misc,
+    .close = mx_datapipe_close,
+    .open = mxio_default_open,
+    .clone = mxio_default_clone,
+    .wait = mx_datapipe_wait,
+    .ioctl = mxio_default_ioctl,
+};
+
+static mxio_ops_t mx_datapipe_consumer_ops = {
+    .read = mx_datapipe_read,
+    .write = mx_datapipe_bad_write,
+    .read_at = mxio_default_read_at,
+    .write_at = mxio_default_write_at,
+    .seek = mxio_default_seek,
+    .misc = mxio_default_misc,
+    .close = mx_datapipe_close,
+    .open = mxio_default_open,
+    .clone = mxio_default_clone,
+    .wait = mx_datapipe_wait,
+    .ioctl = mxio_default_ioctl,
+};
+
+static mxio_t* mxio_datapipe_create(mx_handle_t h, mxio_ops_t* ops) {
+    mx_datapipe_t* p = calloc(1, sizeof(*p));
+    if (p == NULL)
+        return NULL;
+    p->io.ops = ops;
+    p->io.magic = MXIO_MAGIC;
+    p->io.refcount = 1;
+    p->h = h;
+    return &p->io;
+}
+
+int mxio_datapipe_pair(mxio_t** _rd, mxio_t** _wr) {
+    mx_handle_t consumer;
+    mx_handle_t producer;
+    mxio_t *rd, *wr;
+    if ((producer = mx_data_pipe_create(0, 1, 0, &consumer)) < 0)
+        return producer;
+    if ((rd = mxio_datapipe_create(consumer, &mx_datapipe_consumer_ops)) == NULL) {
+        mx_handle_close(consumer);
+        mx_handle_close(producer);
+        return ERR_NO_MEMORY;
+    }
+    if ((wr = mxio_datapipe_create(producer, &mx_datapipe_producer_ops)) == NULL) {
+        mx_datapipe_close(rd);
+        mxio_free(rd);
+        mx_handle_close(producer);
+        return ERR_NO_MEMORY;
+    }
+    *_rd = rd;
+    *_wr = wr;
+    return 0;
+}
+
 mx_status_t mxio_pipe_pair_raw(mx_handle_t* handles, uint32_t* types) {
     mx_status_t r;
     if ((r = mx_message_pipe_create(handles, 0)) < 0) {
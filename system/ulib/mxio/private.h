@@ -27,6 +27,8 @@ typedef struct mxio mxio_t;
 typedef struct mxio_ops {
     ssize_t (*read)(mxio_t* io, void* data, size_t len);
     ssize_t (*write)(mxio_t* io, const void* data, size_t len);
+    ssize_t (*read_at)(mxio_t* io, void* data, size_t len, off_t offset);
+    ssize_t (*write_at)(mxio_t* io, const void* data, size_t len, off_t offset);
     off_t (*seek)(mxio_t* io, off_t offset, int whence);
     mx_status_t (*misc)(mxio_t* io, uint32_t op, uint32_t maxreply, void* data, size_t len);
     mx_status_t (*close)(mxio_t* io);
@@ -100,6 +102,9 @@ mxio_t* mxio_pipe_create(mx_handle_t h);
 // creates a message port and pair of simple io mxio_t's
 int mxio_pipe_pair(mxio_t** a, mxio_t** b);
 
+// creates a data pipe and mxio_t's for its reading and writing ends
+int mxio_datapipe_pair(mxio_t** rd, mxio_t** wr);
+
 // create a mxio (if possible) from type and handles
 mx_status_t mxio_from_handles(uint32_t type, mx_handle_t* handles, int hcount, mxio_t** out);
 
@@ -119,6 +124,8 @@ static inline void mxio_release(mxio_t* io) {
 // unsupported / do-nothing hooks shared by implementations
 ssize_t mxio_default_read(mxio_t* io, void* _data, size_t len);
 ssize_t mxio_default_write(mxio_t* io, const void* _data, size_t len);
+ssize_t mxio_default_read_at(mxio_t* io, void* _data, size_t len, off_t offset);
+ssize_t mxio_default_write_at(mxio_t* io, const void* _data, size_t len, off_t offset);
 off_t mxio_default_seek(mxio_t* io, off_t offset, int whence);
 mx_status_t mxio_default_misc(mxio_t* io, uint32_t op, uint32_t arg, void* data, size_t len);
 mx_status_t mxio_default_close(mxio_t* io);
@@ -21,6 +21,9 @@
 
 #define MXDEBUG 0
 
+// the server turned down a bulk transfer, only send it chunks
+#define MXRIO_FLAG_NO_BULK 1
+
 typedef struct mxrio mxrio_t;
 struct mxrio {
     // base mxio io object
@@ -37,6 +40,14 @@ struct mxrio {
     // TODO: replace with reply-pipes to allow
     // true multithreaded io
     mxr_mutex_t lock;
+
+    // read-ahead state, see mxrio_read()
+    mxr_mutex_t ra_lock;
+    mxrio_msg_t* ra_msg;
+    bool ra_pending;
+    uint32_t ra_off;
+    uint32_t ra_count;
+    uint32_t ra_streak;
 };
 
 static const char* _opnames[] = MXRIO_OPNAMES;
@@ -72,8 +83,98 @@ static void discard_handles(mx_handle_t* handles, unsigned count) {
     }
 }
 
-mx_status_t mxrio_handler(mx_handle_t h, void* _cb, void* cookie) {
-    mxrio_cb_t cb = _cb;
+static bool is_read_op(uint32_t op) {
+    return (op == MXRIO_READ) || (op == MXRIO_READ_AT);
+}
+
+// Run a bulk read or write as back to back chunk sized ones, so callbacks
+// never see more than MXIO_CHUNK_SIZE bytes, moving the data through the
+// VMO. READ_AT and WRITE_AT chunks each carry their own offset. With
+// cb_bulk the callback is given the whole transfer instead, see
+// mxrio_bulk_handler(). A read hands the VMO back with the reply.
+static mx_status_t mxrio_bulk(mxrio_msg_t* msg, mxrio_cb_t cb, void* cookie, bool cb_bulk) {
+    uint32_t op = MXRIO_OP(msg->op);
+    bool is_read = is_read_op(op);
+    bool positional = (op == MXRIO_READ_AT) || (op == MXRIO_WRITE_AT);
+    if ((!is_read && (op != MXRIO_WRITE) && (op != MXRIO_WRITE_AT)) || (msg->hcount != 1)) {
+        discard_handles(msg->handle, msg->hcount);
+        msg->hcount = 0;
+        return ERR_NOT_SUPPORTED;
+    }
+    mx_handle_t vmo = msg->handle[0];
+    if ((msg->datalen != 0) || (msg->arg < 0) || (msg->arg > MXRIO_BULK_MAX)) {
+        mx_handle_close(vmo);
+        msg->hcount = 0;
+        return ERR_INVALID_ARGS;
+    }
+
+    uint32_t len = msg->arg;
+    uint32_t done = 0;
+    int64_t start = msg->arg2.off;
+    int64_t off = 0;
+    mx_status_t r = NO_ERROR;
+    if (cb_bulk) {
+        // the vmo stays ours, the callback only moves the bytes
+        if ((r = cb(msg, 0, cookie)) > (mx_status_t)len) {
+            r = ERR_IO;
+        }
+        off = msg->arg2.off;
+        len = 0;
+    }
+    while (done < len) {
+        uint32_t xfer = ((len - done) > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : (len - done);
+        memset(msg, 0, MXRIO_HDR_SZ);
+        msg->magic = MXRIO_MAGIC;
+        msg->op = op;
+        if (positional) {
+            msg->arg2.off = start + done;
+        }
+        if (is_read) {
+            msg->arg = xfer;
+        } else {
+            if ((r = mx_vm_object_read(vmo, msg->data, done, xfer)) != (mx_ssize_t)xfer) {
+                r = (r < 0) ? r : ERR_IO;
+                break;
+            }
+            msg->datalen = xfer;
+        }
+        if ((r = cb(msg, 0, cookie)) < 0) {
+            break;
+        }
+        if ((r > (mx_status_t)xfer) || (is_read && (r > (mx_status_t)msg->datalen))) {
+            r = ERR_IO;
+            break;
+        }
+        if (is_read && (r > 0) &&
+            (mx_vm_object_write(vmo, msg->data, done, r) != r)) {
+            r = ERR_IO;
+            break;
+        }
+        off = msg->arg2.off;
+        done += r;
+        // stop at short read or write
+        if (r < (mx_status_t)xfer) {
+            break;
+        }
+    }
+
+    // a partial transfer is reported like a short read
+    if (done > 0) {
+        r = done;
+    }
+    memset(msg, 0, MXRIO_HDR_SZ);
+    msg->magic = MXRIO_MAGIC;
+    msg->arg2.off = off;
+    if ((r >= 0) && is_read) {
+        msg->handle[0] = vmo;
+        msg->hcount = 1;
+    } else {
+        mx_handle_close(vmo);
+    }
+    return r;
+}
+
+static mx_status_t mxrio_handle(mx_handle_t h, mxrio_cb_t cb, void* cookie, bool cb_bulk) {
     mxrio_msg_t msg;
     mx_status_t r;
 
@@ -118,11 +219,15 @@ mx_status_t mxrio_handler(mx_handle_t h, void* _cb, void* cookie) {
     xprintf("handle_rio: op=%s arg=%d len=%u hsz=%d\n",
             opname(msg.op), msg.arg, msg.datalen, msg.hcount);
 
-    msg.arg = cb(&msg, (rh != h) ? rh : 0, cookie);
-    if (msg.arg == ERR_DISPATCHER_INDIRECT) {
-        // callback is handling the reply itself
-        // and took ownership of the reply handle
-        return 0;
+    if (msg.op & MXRIO_BULK) {
+        msg.arg = mxrio_bulk(&msg, cb, cookie, cb_bulk);
+    } else {
+        msg.arg = cb(&msg, (rh != h) ? rh : 0, cookie);
+        if (msg.arg == ERR_DISPATCHER_INDIRECT) {
+            // callback is handling the reply itself
+            // and took ownership of the reply handle
+            return 0;
+        }
     }
     if ((msg.arg < 0) || !is_message_valid(&msg)) {
         // in the event of an error response or bad message
@@ -157,6 +262,14 @@ mx_status_t mxrio_handler(mx_handle_t h, void* _cb, void* cookie) {
     }
 }
 
+mx_status_t mxrio_handler(mx_handle_t h, void* cb, void* cookie) {
+    return mxrio_handle(h, cb, cookie, false);
+}
+
+mx_status_t mxrio_bulk_handler(mx_handle_t h, void* cb, void* cookie) {
+    return mxrio_handle(h, cb, cookie, true);
+}
+
 void mxrio_server(mx_handle_t h, mxrio_cb_t cb, void* cookie) {
     mx_signals_state_t pending;
     mx_status_t r;
@@ -208,6 +321,84 @@ mx_status_t mxrio_txn_handoff(mx_handle_t srv, mx_handle_t rh, mxrio_msg_t* msg)
 #define mxrio_txn_locked mxrio_txn
 #endif
 
+#if WITH_REPLY_PIPE
+// The reply end of a reply pipe always comes back attached to the reply,
+// so a pipe that was answered can be kept and used for the next open or
+// clone instead of creating a new one each time.
+#define MAX_CACHED_REPLY_PIPES 4
+
+static mxr_mutex_t reply_pipe_lock = MXR_MUTEX_INIT;
+static mx_handle_t reply_pipe_cache[MAX_CACHED_REPLY_PIPES][2];
+static unsigned reply_pipe_count;
+
+static mx_status_t reply_pipe_get(mx_handle_t rpipe[2]) {
+    mxr_mutex_lock(&reply_pipe_lock);
+    if (reply_pipe_count > 0) {
+        reply_pipe_count--;
+        rpipe[0] = reply_pipe_cache[reply_pipe_count][0];
+        rpipe[1] = reply_pipe_cache[reply_pipe_count][1];
+        mxr_mutex_unlock(&reply_pipe_lock);
+        return NO_ERROR;
+    }
+    mxr_mutex_unlock(&reply_pipe_lock);
+    return mx_message_pipe_create(rpipe, MX_FLAG_REPLY_PIPE);
+}
+
+static void reply_pipe_put(mx_handle_t rpipe[2]) {
+    mxr_mutex_lock(&reply_pipe_lock);
+    if (reply_pipe_count < MAX_CACHED_REPLY_PIPES) {
+        reply_pipe_cache[reply_pipe_count][0] = rpipe[0];
+        reply_pipe_cache[reply_pipe_count][1] = rpipe[1];
+        reply_pipe_count++;
+        mxr_mutex_unlock(&reply_pipe_lock);
+        return;
+    }
+    mxr_mutex_unlock(&reply_pipe_lock);
+    mx_handle_close(rpipe[0]);
+    mx_handle_close(rpipe[1]);
+}
+
+// Opens and clones may be handed off to another server, which answers
+// through a reply pipe. Everything else is answered on the pipe it came in
+// on, so it can go out as a single mx_message_call().
+static mx_status_t mxrio_call(mxrio_t* rio, mxrio_msg_t* msg) {
+    mx_message_call_args_t args = {
+        .wr_bytes = msg,
+        .wr_handles = msg->handle,
+        .rd_bytes = msg,
+        .rd_handles = msg->handle,
+        .wr_num_bytes = MXRIO_HDR_SZ + msg->datalen,
+        .wr_num_handles = msg->hcount,
+        .rd_num_bytes = MXRIO_HDR_SZ + MXIO_CHUNK_SIZE,
+        .rd_num_handles = MXIO_MAX_HANDLES,
+    };
+
+    uint32_t dsize = 0;
+    uint32_t hcount = 0;
+    mx_status_t r;
+    if ((r = mx_message_call(rio->h, 0, MX_TIME_INFINITE, &args, &dsize, &hcount)) < 0) {
+        // handles that did go out are no longer ours, closing them is harmless
+        discard_handles(msg->handle, msg->hcount);
+        msg->hcount = 0;
+        return r;
+    }
+    msg->hcount = hcount;
+
+    // check for protocol errors
+    if (!is_message_reply_valid(msg, dsize) ||
+        (MXRIO_OP(msg->op) != MXRIO_STATUS)) {
+        r = ERR_IO;
+    } else if ((r = msg->arg) >= 0) {
+        return r;
+    }
+
+    // on a remote error there are never any handles
+    discard_handles(msg->handle, msg->hcount);
+    msg->hcount = 0;
+    return r;
+}
+#endif
+
 // on success, msg->hcount indicates number of valid handles in msg->handle
 // on error there are never any handles
 static mx_status_t mxrio_txn_locked(mxrio_t* rio, mxrio_msg_t* msg) {
@@ -216,6 +407,12 @@ static mx_status_t mxrio_txn_locked(mxrio_t* rio, mxrio_msg_t* msg) {
         return ERR_INVALID_ARGS;
     }
 
+#if WITH_REPLY_PIPE
+    if ((MXRIO_OP(msg->op) != MXRIO_OPEN) && (MXRIO_OP(msg->op) != MXRIO_CLONE)) {
+        return mxrio_call(rio, msg);
+    }
+#endif
+
     xprintf("txn h=%x op=%d len=%u\n", rio->h, msg->op, msg->datalen);
     uint32_t dsize = MXRIO_HDR_SZ + msg->datalen;
 
@@ -223,7 +420,7 @@ static mx_status_t mxrio_txn_locked(mxrio_t* rio, mxrio_msg_t* msg) {
 
 #if WITH_REPLY_PIPE
     mx_handle_t rpipe[2];
-    if ((r = mx_message_pipe_create(rpipe, MX_FLAG_REPLY_PIPE)) < 0) {
+    if ((r = reply_pipe_get(rpipe)) < 0) {
         return r;
     }
     msg->op |= MXRIO_REPLY_PIPE;
@@ -255,9 +452,12 @@ static mx_status_t mxrio_txn_locked(mxrio_t* rio, mxrio_msg_t* msg) {
     }
 #if WITH_REPLY_PIPE
     // the kernel ensures that the reply pipe endpoint is
-    // returned as the last handle in the attached handles
+    // returned as the last handle in the attached handles,
+    // having it back means the pipe is idle and can be reused
     msg->hcount--;
-    mx_handle_close(msg->handle[msg->hcount]);
+    rpipe[1] = msg->handle[msg->hcount];
+    reply_pipe_put(rpipe);
+    rh = 0;
 #endif
     // check for protocol errors
     if (!is_message_reply_valid(msg, dsize) ||
@@ -275,7 +475,9 @@ fail_discard_handles:
     msg->hcount = 0;
 done:
 #if WITH_REPLY_PIPE
-    mx_handle_close(rh);
+    if (rh != 0) {
+        mx_handle_close(rh);
+    }
 #endif
     return r;
 }
@@ -303,7 +505,8 @@ static ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
         return ERR_INVALID_ARGS;
     }
 
-    if ((op == IOCTL_DEVICE_GET_HANDLE) && (out_len < sizeof(mx_handle_t))) {
+    bool get_handle = (op == IOCTL_DEVICE_GET_HANDLE) || (op == IOCTL_FILE_GET_VMO);
+    if (get_handle && (out_len < sizeof(mx_handle_t))) {
         return ERR_INVALID_ARGS;
     }
 
@@ -324,7 +527,7 @@ static ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     }
 
     memcpy(out_buf, msg.data, copy_len);
-    if (op == IOCTL_DEVICE_GET_HANDLE) {
+    if (get_handle) {
         if (msg.hcount > 0) {
             memcpy(out_buf, msg.handle, sizeof(mx_handle_t));
             discard_handles(msg.handle + 1, msg.hcount - 1);
@@ -338,72 +541,95 @@ static ssize_t mxrio_ioctl(mxio_t* io, uint32_t op, const void* in_buf,
     return r;
 }
 
-static ssize_t mxrio_write(mxio_t* io, const void* _data, size_t len) {
-    mxrio_t* rio = (mxrio_t*)io;
-    const uint8_t* data = _data;
-    ssize_t count = 0;
-    mx_status_t r = 0;
+// Move len bytes, at most MXRIO_BULK_MAX, in one round trip through a VMO.
+// off is only used by READ_AT and WRITE_AT.
+static mx_status_t mxrio_bulk_txn(mxrio_t* rio, uint32_t op, void* data, size_t len, off_t off) {
     mxrio_msg_t msg;
-    ssize_t xfer;
-
-    while (len > 0) {
-        xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
-
-        memset(&msg, 0, MXRIO_HDR_SZ);
-        msg.op = MXRIO_WRITE;
-        msg.datalen = xfer;
-        memcpy(msg.data, data, xfer);
+    mx_status_t r;
 
-        if ((r = mxrio_txn(rio, &msg)) < 0) {
-            break;
-        }
-        discard_handles(msg.handle, msg.hcount);
+    memset(&msg, 0, MXRIO_HDR_SZ);
+    msg.op = op | MXRIO_BULK;
+    msg.arg = len;
+    msg.arg2.off = off;
+    if ((msg.handle[0] = mx_vm_object_create(len)) < 0) {
+        return msg.handle[0];
+    }
+    msg.hcount = 1;
+    if (!is_read_op(op) &&
+        ((r = mx_vm_object_write(msg.handle[0], data, 0, len)) != (mx_ssize_t)len)) {
+        mx_handle_close(msg.handle[0]);
+        return (r < 0) ? r : ERR_IO;
+    }
 
-        if (r > xfer) {
+    if ((r = mxrio_txn(rio, &msg)) < 0) {
+        return r;
+    }
+    if (r > (mx_status_t)len) {
+        r = ERR_IO;
+    } else if (is_read_op(op)) {
+        // the server hands the VMO back holding what it read
+        if ((msg.hcount < 1) || (mx_vm_object_read(msg.handle[0], data, 0, r) != r)) {
             r = ERR_IO;
-            break;
-        }
-        count += r;
-        data += r;
-        len -= r;
-        // stop at short read
-        if (r < xfer) {
-            break;
         }
     }
-    return count ? count : r;
+    discard_handles(msg.handle, msg.hcount);
+    return r;
 }
 
-static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
-    mxrio_t* rio = (mxrio_t*)io;
-    uint8_t* data = _data;
+// Move len bytes with op as chunks, or as bulk transfers where there are
+// enough of them, stopping at the first short one. READ_AT and WRITE_AT
+// start at off, READ and WRITE at the server's offset.
+static ssize_t mxrio_io(mxrio_t* rio, uint32_t op, uint8_t* data, size_t len, off_t off) {
+    bool positional = (op == MXRIO_READ_AT) || (op == MXRIO_WRITE_AT);
     ssize_t count = 0;
     mx_status_t r = 0;
     mxrio_msg_t msg;
     ssize_t xfer;
 
     while (len > 0) {
-        xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
+        if ((len >= MXRIO_BULK_MIN) && !(rio->flags & MXRIO_FLAG_NO_BULK)) {
+            xfer = (len > MXRIO_BULK_MAX) ? MXRIO_BULK_MAX : len;
+            r = mxrio_bulk_txn(rio, op, data, xfer, positional ? off + count : 0);
+            if (r == ERR_NOT_SUPPORTED) {
+                rio->flags |= MXRIO_FLAG_NO_BULK;
+                continue;
+            }
+            if (r < 0) {
+                break;
+            }
+        } else {
+            xfer = (len > MXIO_CHUNK_SIZE) ? MXIO_CHUNK_SIZE : len;
 
-        memset(&msg, 0, MXRIO_HDR_SZ);
-        msg.op = MXRIO_READ;
-        msg.arg = xfer;
+            memset(&msg, 0, MXRIO_HDR_SZ);
+            msg.op = op;
+            if (positional) {
+                msg.arg2.off = off + count;
+            }
+            if (is_read_op(op)) {
+                msg.arg = xfer;
+            } else {
+                msg.datalen = xfer;
+                memcpy(msg.data, data, xfer);
+            }
 
-        if ((r = mxrio_txn(rio, &msg)) < 0) {
-            break;
-        }
-        discard_handles(msg.handle, msg.hcount);
+            if ((r = mxrio_txn(rio, &msg)) < 0) {
+                break;
+            }
+            discard_handles(msg.handle, msg.hcount);
 
-        if ((r > (int)msg.datalen) || (r > xfer)) {
-            r = ERR_IO;
-            break;
+            if ((r > xfer) || (is_read_op(op) && (r > (int)msg.datalen))) {
+                r = ERR_IO;
+                break;
+            }
+            if (is_read_op(op)) {
+                memcpy(data, msg.data, r);
+            }
         }
-        memcpy(data, msg.data, r);
         count += r;
         data += r;
         len -= r;
 
-        // stop at short read
+        // stop at short read or write
         if (r < xfer) {
             break;
         }
@@ -411,8 +637,7 @@ static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
     return count ? count : r;
 }
 
-static off_t mxrio_seek(mxio_t* io, off_t offset, int whence) {
-    mxrio_t* rio = (mxrio_t*)io;
+static off_t mxrio_seek_locked(mxrio_t* rio, off_t offset, int whence) {
     mxrio_msg_t msg;
     mx_status_t r;
 
@@ -429,6 +654,163 @@ static off_t mxrio_seek(mxio_t* io, off_t offset, int whence) {
     return msg.arg2.off;
 }
 
+// Sequential reads are pipelined: after MXRIO_READAHEAD_STREAK reads in a
+// row that were satisfied in full, the next chunk is asked for before the
+// caller wants it. Its reply has no mx_message_call() transaction id, so it
+// waits in the pipe until the next read picks it up. Anything else that
+// uses or moves the offset first drops what was read ahead and seeks the
+// server back. Objects with an event handle are never read ahead, since a
+// read on them may block until input arrives.
+#define MXRIO_READAHEAD_STREAK 2
+
+static void mxrio_ra_start(mxrio_t* rio) {
+    if ((rio->ra_msg == NULL) &&
+        ((rio->ra_msg = malloc(sizeof(mxrio_msg_t))) == NULL)) {
+        return;
+    }
+    mxrio_msg_t* msg = rio->ra_msg;
+    memset(msg, 0, MXRIO_HDR_SZ);
+    msg->magic = MXRIO_MAGIC;
+    msg->op = MXRIO_READ;
+    msg->arg = MXIO_CHUNK_SIZE;
+    if (mx_message_write(rio->h, msg, MXRIO_HDR_SZ, NULL, 0, 0) == NO_ERROR) {
+        rio->ra_pending = true;
+    }
+}
+
+// Collect the reply to the read-ahead in flight. A failed read-ahead
+// is forgotten, the next read asks again.
+static void mxrio_ra_wait(mxrio_t* rio) {
+    mxrio_msg_t* msg = rio->ra_msg;
+    rio->ra_pending = false;
+    rio->ra_off = 0;
+    rio->ra_count = 0;
+
+    mx_signals_state_t pending;
+    if ((mx_handle_wait_one(rio->h, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                            MX_TIME_INFINITE, &pending) < 0) ||
+        !(pending.satisfied & MX_SIGNAL_READABLE)) {
+        return;
+    }
+    uint32_t dsize = MXRIO_HDR_SZ + MXIO_CHUNK_SIZE;
+    msg->hcount = MXIO_MAX_HANDLES + 1;
+    if (mx_message_read(rio->h, msg, &dsize, msg->handle, &msg->hcount, 0) < 0) {
+        return;
+    }
+    discard_handles(msg->handle, msg->hcount);
+    msg->hcount = 0;
+    if (is_message_reply_valid(msg, dsize) && (MXRIO_OP(msg->op) == MXRIO_STATUS) &&
+        (msg->arg > 0) && ((uint32_t)msg->arg <= msg->datalen)) {
+        rio->ra_count = msg->arg;
+    }
+}
+
+// Forget any read-ahead, returning how far the server's offset
+// is past the caller's. Called with ra_lock held.
+static uint32_t mxrio_ra_drop(mxrio_t* rio) {
+    if (rio->ra_pending) {
+        mxrio_ra_wait(rio);
+    }
+    uint32_t ahead = rio->ra_count - rio->ra_off;
+    rio->ra_off = 0;
+    rio->ra_count = 0;
+    rio->ra_streak = 0;
+    return ahead;
+}
+
+// Forget any read-ahead, putting the server's offset back where
+// the caller thinks it is.
+static void mxrio_ra_discard(mxrio_t* rio) {
+    mxr_mutex_lock(&rio->ra_lock);
+    uint32_t ahead = mxrio_ra_drop(rio);
+    if (ahead > 0) {
+        mxrio_seek_locked(rio, -(off_t)ahead, SEEK_CUR);
+    }
+    mxr_mutex_unlock(&rio->ra_lock);
+}
+
+static ssize_t mxrio_write(mxio_t* io, const void* data, size_t len) {
+    mxrio_t* rio = (mxrio_t*)io;
+    // the write goes where the caller thinks the offset is
+    mxrio_ra_discard(rio);
+    return mxrio_io(rio, MXRIO_WRITE, (uint8_t*)data, len, 0);
+}
+
+static ssize_t mxrio_write_at(mxio_t* io, const void* data, size_t len, off_t offset) {
+    mxrio_t* rio = (mxrio_t*)io;
+    // what was read ahead may be what is being overwritten
+    mxrio_ra_discard(rio);
+    return mxrio_io(rio, MXRIO_WRITE_AT, (uint8_t*)data, len, offset);
+}
+
+static ssize_t mxrio_read_at(mxio_t* io, void* data, size_t len, off_t offset) {
+    return mxrio_io((mxrio_t*)io, MXRIO_READ_AT, data, len, offset);
+}
+
+static ssize_t mxrio_read(mxio_t* io, void* _data, size_t len) {
+    mxrio_t* rio = (mxrio_t*)io;
+    uint8_t* data = _data;
+    size_t want = len;
+    ssize_t count = 0;
+    mx_status_t r = 0;
+    ssize_t xfer;
+
+    mxr_mutex_lock(&rio->ra_lock);
+    if (rio->ra_pending) {
+        mxrio_ra_wait(rio);
+    }
+    if (rio->ra_off < rio->ra_count) {
+        xfer = rio->ra_count - rio->ra_off;
+        if ((size_t)xfer > len) {
+            xfer = len;
+        }
+        memcpy(data, rio->ra_msg->data + rio->ra_off, xfer);
+        rio->ra_off += xfer;
+        count += xfer;
+        data += xfer;
+        len -= xfer;
+        // a short read-ahead means the end was reached
+        if ((rio->ra_off == rio->ra_count) && (rio->ra_count < MXIO_CHUNK_SIZE)) {
+            len = 0;
+        }
+    }
+
+    if (len > 0) {
+        ssize_t n = mxrio_io(rio, MXRIO_READ, data, len, 0);
+        if (n < 0) {
+            r = n;
+        } else {
+            count += n;
+        }
+    }
+
+    if ((r >= 0) && (count == (ssize_t)want) && (rio->e == 0)) {
+        if (++rio->ra_streak >= MXRIO_READAHEAD_STREAK) {
+#if WITH_REPLY_PIPE
+            if ((rio->ra_off == rio->ra_count) && !rio->ra_pending) {
+                mxrio_ra_start(rio);
+            }
+#endif
+        }
+    } else {
+        rio->ra_streak = 0;
+    }
+    mxr_mutex_unlock(&rio->ra_lock);
+    return count ? count : r;
+}
+
+static off_t mxrio_seek(mxio_t* io, off_t offset, int whence) {
+    mxrio_t* rio = (mxrio_t*)io;
+    mxr_mutex_lock(&rio->ra_lock);
+    uint32_t ahead = mxrio_ra_drop(rio);
+    if (whence == SEEK_CUR) {
+        offset -= ahead;
+    }
+    off_t r = mxrio_seek_locked(rio, offset, whence);
+    mxr_mutex_unlock(&rio->ra_lock);
+    return r;
+}
+
 static mx_status_t mxrio_close(mxio_t* io) {
     mxrio_t* rio = (mxrio_t*)io;
     mxrio_msg_t msg;
@@ -441,6 +823,14 @@ static mx_status_t mxrio_close(mxio_t* io) {
         discard_handles(msg.handle, msg.hcount);
     }
 
+    mxr_mutex_lock(&rio->ra_lock);
+    free(rio->ra_msg);
+    rio->ra_msg = NULL;
+    rio->ra_pending = false;
+    rio->ra_off = 0;
+    rio->ra_count = 0;
+    mxr_mutex_unlock(&rio->ra_lock);
+
     mx_handle_t h = rio->h;
     rio->h = 0;
     mx_handle_close(h);
@@ -593,6 +983,8 @@ static mx_status_t mxrio_wait(mxio_t* io, uint32_t events, uint32_t* _pending, m
 static mxio_ops_t mx_remote_ops = {
     .read = mxrio_read,
     .write = mxrio_write,
+    .read_at = mxrio_read_at,
+    .write_at = mxrio_write_at,
     .misc = mxrio_misc,
     .seek = mxrio_seek,
     .close = mxrio_close,
@@ -612,6 +1004,7 @@ mxio_t* mxio_remote_create(mx_handle_t h, mx_handle_t e) {
     rio->h = h;
     rio->e = e;
     rio->lock = MXR_MUTEX_INIT;
+    rio->ra_lock = MXR_MUTEX_INIT;
     return &rio->io;
 }
 
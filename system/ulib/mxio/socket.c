@@ -17,6 +17,8 @@ typedef struct mx_socket {
 static mxio_ops_t mx_socket_ops = {
     .read = mxio_default_read,
     .write = mxio_default_write,
+    .read_at = mxio_default_read_at,
+    .write_at = mxio_default_write_at,
     .seek = mxio_default_seek,
     .misc = mxio_default_misc,
     .close = mxio_default_close,
@@ -42,6 +42,65 @@ mxio_state_t __mxio_global_state = {
     .cwd_path = "/",
 };
 
+// fd lookups take no lock. A lookup counts itself in, in its fd's bucket
+// and the current generation, for as long as it holds a table slot's mxio
+// without a reference of its own. Whatever takes an mxio out of a slot
+// (with mxio_lock held) then waits out a grace period on the slot's bucket
+// before dropping the table's reference, so a lookup never acquires a
+// freed mxio.
+//
+// Sets on other fds start generations without waiting on this bucket, so
+// a lookup here may be counted under either parity. The grace period
+// starts a generation and drains the bucket's count for the one before,
+// twice over, which covers both.
+#define MXIO_READER_BUCKETS 32
+
+typedef struct {
+    int32_t count[2];
+} __attribute__((aligned(64))) mxio_readers_t;
+
+static mxio_readers_t mxio_readers[MXIO_READER_BUCKETS];
+static uint32_t mxio_generation;
+
+static mxio_t* mxio_fdtab_get(int fd) {
+    int32_t* count;
+    for (;;) {
+        uint32_t gen = __atomic_load_n(&mxio_generation, __ATOMIC_SEQ_CST);
+        count = &mxio_readers[fd % MXIO_READER_BUCKETS].count[gen & 1];
+        __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&mxio_generation, __ATOMIC_SEQ_CST) == gen) {
+            break;
+        }
+        // a new generation started before we were counted in
+        __atomic_fetch_sub(count, 1, __ATOMIC_SEQ_CST);
+    }
+    mxio_t* io = __atomic_load_n(&mxio_fdtab[fd], __ATOMIC_SEQ_CST);
+    if (io != NULL) {
+        mxio_acquire(io);
+    }
+    __atomic_fetch_sub(count, 1, __ATOMIC_RELEASE);
+    return io;
+}
+
+// Empty or replace a slot, and wait out the lookups that may have seen its
+// old mxio. Called with mxio_lock held.
+static void mxio_fdtab_set(int fd, mxio_t* io) {
+    mxio_t* old = __atomic_exchange_n(&mxio_fdtab[fd], io, __ATOMIC_SEQ_CST);
+    if (old == NULL) {
+        return;
+    }
+    // lookups counted in after a flip see the new slot, so each pass only
+    // has to drain the parity that was current before it
+    mxio_readers_t* readers = &mxio_readers[fd % MXIO_READER_BUCKETS];
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t gen = __atomic_fetch_add(&mxio_generation, 1, __ATOMIC_SEQ_CST);
+        int32_t* count = &readers->count[gen & 1];
+        while (__atomic_load_n(count, __ATOMIC_ACQUIRE) != 0) {
+            mx_nanosleep(0);
+        }
+    }
+}
+
 void mxio_install_root(mxio_t* root) {
     mxr_mutex_lock(&mxio_lock);
     if (mxio_root_init) {
@@ -79,6 +138,8 @@ int mxio_bind_to_fd(mxio_t* io, int fd, int starting_fd) {
     }
 
 ok:
+    io->dupcount++;
+    mxio_fdtab_set(fd, io);
     if (io_to_close) {
         io_to_close->dupcount--;
         if (io_to_close->dupcount > 0) {
@@ -87,8 +148,6 @@ ok:
             io_to_close = NULL;
         }
     }
-    io->dupcount++;
-    mxio_fdtab[fd] = io;
 fail:
     mxr_mutex_unlock(&mxio_lock);
     if (io_to_close) {
@@ -99,17 +158,10 @@ fail:
 }
 
 mxio_t* __mxio_fd_to_io(int fd) {
-    mxio_t* io = NULL;
-    mxr_mutex_lock(&mxio_lock);
     if ((fd < 0) || (fd >= MAX_MXIO_FD)) {
-        io = NULL;
-    } else {
-        if ((io = mxio_fdtab[fd]) != NULL) {
-            mxio_acquire(io);
-        }
+        return NULL;
     }
-    mxr_mutex_unlock(&mxio_lock);
-    return io;
+    return mxio_fdtab_get(fd);
 }
 
 static void mxio_exit(void) {
@@ -117,7 +169,7 @@ static void mxio_exit(void) {
     for (int fd = 0; fd < MAX_MXIO_FD; fd++) {
         mxio_t* io = mxio_fdtab[fd];
         if (io) {
-            mxio_fdtab[fd] = NULL;
+            mxio_fdtab_set(fd, NULL);
             io->dupcount--;
             if (io->dupcount == 0) {
                 io->ops->close(io);
@@ -343,6 +395,15 @@ mx_status_t mxio_wait_fd(int fd, uint32_t events, uint32_t* pending, mx_time_t t
     return r;
 }
 
+static void attr_to_stat(const vnattr_t* attr, struct stat* s) {
+    memset(s, 0, sizeof(struct stat));
+    s->st_mode = attr->mode;
+    s->st_size = attr->size;
+    s->st_ino = attr->inode;
+    s->st_mtim.tv_sec = attr->modify_time / 1000000000u;
+    s->st_mtim.tv_nsec = attr->modify_time % 1000000000u;
+}
+
 int mxio_stat(mxio_t* io, struct stat* s) {
     vnattr_t attr;
     int r = io->ops->misc(io, MXRIO_STAT, sizeof(attr), &attr, 0);
@@ -352,13 +413,84 @@ int mxio_stat(mxio_t* io, struct stat* s) {
     if (r < (int)sizeof(attr)) {
         return ERR_IO;
     }
-    memset(s, 0, sizeof(struct stat));
-    s->st_mode = attr.mode;
-    s->st_size = attr.size;
-    s->st_ino = attr.inode;
+    attr_to_stat(&attr, s);
     return 0;
 }
 
+// stat() by path costs an open, a stat and a close. With a nonzero
+// mxio_set_stat_cache_ttl(), results for absolute paths are kept for that
+// long, for processes that can live with slightly stale metadata. Anything
+// done through mxio that may change metadata empties the cache.
+#define STAT_CACHE_SIZE 32
+#define STAT_CACHE_PATH_MAX 128
+
+typedef struct {
+    mx_time_t expires;
+    struct stat s;
+    char path[STAT_CACHE_PATH_MAX];
+} stat_cache_entry_t;
+
+static mxr_mutex_t stat_cache_lock = MXR_MUTEX_INIT;
+static stat_cache_entry_t stat_cache[STAT_CACHE_SIZE];
+static unsigned stat_cache_next;
+static uint32_t stat_cache_gen;
+static mx_time_t stat_cache_ttl;
+
+static void stat_cache_flush_locked(void) {
+    for (unsigned n = 0; n < STAT_CACHE_SIZE; n++) {
+        stat_cache[n].expires = 0;
+    }
+    stat_cache_gen++;
+}
+
+static void stat_cache_flush(void) {
+    if (stat_cache_ttl == 0) {
+        return;
+    }
+    mxr_mutex_lock(&stat_cache_lock);
+    stat_cache_flush_locked();
+    mxr_mutex_unlock(&stat_cache_lock);
+}
+
+void mxio_set_stat_cache_ttl(mx_time_t ttl) {
+    mxr_mutex_lock(&stat_cache_lock);
+    stat_cache_ttl = ttl;
+    stat_cache_flush_locked();
+    mxr_mutex_unlock(&stat_cache_lock);
+}
+
+// Returns true if fn was found. Otherwise *gen is set
+// for passing to stat_cache_insert() later.
+static bool stat_cache_lookup(const char* fn, struct stat* s, uint32_t* gen) {
+    bool found = false;
+    mxr_mutex_lock(&stat_cache_lock);
+    *gen = stat_cache_gen;
+    mx_time_t now = mx_current_time();
+    for (unsigned n = 0; n < STAT_CACHE_SIZE; n++) {
+        if ((stat_cache[n].expires > now) && !strcmp(stat_cache[n].path, fn)) {
+            memcpy(s, &stat_cache[n].s, sizeof(struct stat));
+            found = true;
+            break;
+        }
+    }
+    mxr_mutex_unlock(&stat_cache_lock);
+    return found;
+}
+
+// The result is dropped if the cache was flushed since the lookup,
+// as it may predate whatever caused the flush.
+static void stat_cache_insert(const char* fn, const struct stat* s, uint32_t gen) {
+    mxr_mutex_lock(&stat_cache_lock);
+    if (gen == stat_cache_gen) {
+        stat_cache_entry_t* e = &stat_cache[stat_cache_next];
+        stat_cache_next = (stat_cache_next + 1) % STAT_CACHE_SIZE;
+        e->expires = mx_current_time() + stat_cache_ttl;
+        memcpy(&e->s, s, sizeof(struct stat));
+        strcpy(e->path, fn);
+    }
+    mxr_mutex_unlock(&stat_cache_lock);
+}
+
 // TODO: determine complete correct mapping
 static int status_to_errno(mx_status_t status) {
     switch (status) {
@@ -454,6 +586,46 @@ ssize_t writev(int fd, const struct iovec* iov, int num) {
     return count;
 }
 
+ssize_t preadv(int fd, const struct iovec* iov, int num, off_t offset) {
+    ssize_t count = 0;
+    ssize_t r;
+    while (num > 0) {
+        if (iov->iov_len != 0) {
+            r = pread(fd, iov->iov_base, iov->iov_len, offset + count);
+            if (r < 0) {
+                return count ? count : r;
+            }
+            if ((size_t)r < iov->iov_len) {
+                return count + r;
+            }
+            count += r;
+        }
+        iov++;
+        num--;
+    }
+    return count;
+}
+
+ssize_t pwritev(int fd, const struct iovec* iov, int num, off_t offset) {
+    ssize_t count = 0;
+    ssize_t r;
+    while (num > 0) {
+        if (iov->iov_len != 0) {
+            r = pwrite(fd, iov->iov_base, iov->iov_len, offset + count);
+            if (r < 0) {
+                return count ? count : r;
+            }
+            if ((size_t)r < iov->iov_len) {
+                return count + r;
+            }
+            count += r;
+        }
+        iov++;
+        num--;
+    }
+    return count;
+}
+
 int unlinkat(int fd, const char* path, int flag) {
     return ERROR(ERR_NOT_SUPPORTED);
 }
@@ -483,9 +655,41 @@ ssize_t write(int fd, const void* buf, size_t count) {
     }
     ssize_t r = STATUS(io->ops->write(io, buf, count));
     mxio_release(io);
+    stat_cache_flush();
     return r;
 }
 
+// pread and pwrite leave the fd's offset alone. Objects
+// without one, such as pipes, don't support them.
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    if ((buf == NULL) || (offset < 0)) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
+    }
+    ssize_t r = io->ops->read_at(io, buf, count, offset);
+    mxio_release(io);
+    return (r == ERR_NOT_SUPPORTED) ? ERRNO(ESPIPE) : STATUS(r);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    if ((buf == NULL) || (offset < 0)) {
+        return ERRNO(EINVAL);
+    }
+
+    mxio_t* io = fd_to_io(fd);
+    if (io == NULL) {
+        return ERRNO(EBADF);
+    }
+    ssize_t r = io->ops->write_at(io, buf, count, offset);
+    mxio_release(io);
+    stat_cache_flush();
+    return (r == ERR_NOT_SUPPORTED) ? ERRNO(ESPIPE) : STATUS(r);
+}
+
 int close(int fd) {
     mxr_mutex_lock(&mxio_lock);
     if ((fd < 0) || (fd >= MAX_MXIO_FD) || (mxio_fdtab[fd] == NULL)) {
@@ -494,7 +698,7 @@ int close(int fd) {
     }
     mxio_t* io = mxio_fdtab[fd];
     io->dupcount--;
-    mxio_fdtab[fd] = NULL;
+    mxio_fdtab_set(fd, NULL);
     if (io->dupcount > 0) {
         // still alive in other fdtab slots
         mxr_mutex_unlock(&mxio_lock);
@@ -598,16 +802,6 @@ off_t lseek(int fd, off_t offset, int whence) {
     return r;
 }
 
-static int getdirents(int fd, void* ptr, size_t len) {
-    mxio_t* io = fd_to_io(fd);
-    if (io == NULL) {
-        return ERRNO(EBADF);
-    }
-    int r = STATUS(io->ops->misc(io, MXRIO_READDIR, len, ptr, 0));
-    mxio_release(io);
-    return r;
-}
-
 int unlink(const char* path) {
     const char* name;
     mxio_t* io;
@@ -618,6 +812,7 @@ int unlink(const char* path) {
     r = io->ops->misc(io, MXRIO_UNLINK, 0, (void*) name, strlen(name));
     io->ops->close(io);
     mxio_release(io);
+    stat_cache_flush();
     return STATUS(r);
 }
 
@@ -633,7 +828,11 @@ int open(const char* path, int flags, ...) {
         mode = va_arg(ap, uint32_t) & 0777;
         va_end(ap);
     }
-    if ((r = __mxio_open(&io, path, flags, mode)) < 0) {
+    r = __mxio_open(&io, path, flags, mode);
+    if (flags & (O_CREAT | O_TRUNC)) {
+        stat_cache_flush();
+    }
+    if (r < 0) {
         return ERROR(r);
     }
     if ((fd = mxio_bind_to_fd(io, -1, 0)) < 0) {
@@ -650,7 +849,9 @@ int mkdir(const char* path, mode_t mode) {
 
     mode = (mode & 0777) | S_IFDIR;
 
-    if ((r = __mxio_open(&io, path, O_CREAT|O_EXCL|O_RDWR, mode)) < 0) {
+    r = __mxio_open(&io, path, O_CREAT|O_EXCL|O_RDWR, mode);
+    stat_cache_flush();
+    if (r < 0) {
         return ERROR(r);
     }
     io->ops->close(io);
@@ -673,12 +874,22 @@ int stat(const char* fn, struct stat* s) {
     mxio_t* io;
     mx_status_t r;
 
+    bool cacheable = (stat_cache_ttl != 0) && (fn[0] == '/') &&
+                     (strlen(fn) < STAT_CACHE_PATH_MAX);
+    uint32_t gen;
+    if (cacheable && stat_cache_lookup(fn, s, &gen)) {
+        return 0;
+    }
+
     if ((r = __mxio_open(&io, fn, 0, 0)) < 0) {
         return ERROR(r);
     }
     r = mxio_stat(io, s);
     mxio_close(io);
     mxio_release(io);
+    if (cacheable && (r == NO_ERROR)) {
+        stat_cache_insert(fn, s, gen);
+    }
     return STATUS(r);
 }
 
@@ -688,7 +899,7 @@ int pipe2(int pipefd[2], int flags) {
         return ERRNO(EINVAL);
     }
     mxio_t *a, *b;
-    int r = mxio_pipe_pair(&a, &b);
+    int r = mxio_datapipe_pair(&a, &b);
     if (r < 0) {
         return ERROR(r);
     }
@@ -830,7 +1041,11 @@ struct __dirstream {
     int fd;
     size_t size;
     uint8_t* ptr;
-    uint8_t data[DIR_BUFSIZE];
+    // data holds vdirent_attr_t rather than vdirent_t entries
+    bool attr;
+    // the directory's server can't do MXRIO_READDIR_ATTR
+    bool no_attr;
+    uint8_t data[DIR_BUFSIZE] __ALIGNED(8);
     struct dirent de;
 };
 
@@ -854,32 +1069,94 @@ int closedir(DIR* dir) {
     return 0;
 }
 
-struct dirent *readdir(DIR* dir) {
-    mxr_mutex_lock(&dir->lock);
+// Returns the next entry, refilling the buffer as needed. With want_attr
+// the buffer is refilled with entries carrying attributes where the server
+// supports that, and *attr is set if the entry returned has them.
+// Called with the lock held.
+static struct dirent* readdir_locked(DIR* dir, bool want_attr, vnattr_t** attr) {
     struct dirent* de = &dir->de;
+    *attr = NULL;
     for (;;) {
-        if (dir->size >= sizeof(vdirent_t)) {
+        size_t hdrsize = dir->attr ? sizeof(vdirent_attr_t) : sizeof(vdirent_t);
+        if (dir->size >= hdrsize) {
             vdirent_t* vde = (void*) dir->ptr;
             if (dir->size >= vde->size) {
                 de->d_ino = 0;
                 de->d_off = 0;
                 de->d_reclen = 0;
                 de->d_type = vde->type;
-                strcpy(de->d_name, vde->name);
+                if (dir->attr) {
+                    vdirent_attr_t* vdea = (void*) dir->ptr;
+                    strcpy(de->d_name, vdea->name);
+                    *attr = &vdea->attr;
+                } else {
+                    strcpy(de->d_name, vde->name);
+                }
                 dir->ptr += vde->size;
                 dir->size -= vde->size;
                 break;
             }
             dir->size = 0;
         }
-        int r = getdirents(dir->fd, dir->data, DIR_BUFSIZE);
+        mxio_t* io = fd_to_io(dir->fd);
+        if (io == NULL) {
+            return NULL;
+        }
+        mx_status_t r = ERR_NOT_SUPPORTED;
+        dir->attr = want_attr && !dir->no_attr;
+        if (dir->attr) {
+            r = io->ops->misc(io, MXRIO_READDIR_ATTR, DIR_BUFSIZE, dir->data, 0);
+            if (r == ERR_NOT_SUPPORTED) {
+                dir->no_attr = true;
+                dir->attr = false;
+            }
+        }
+        if (!dir->attr) {
+            r = io->ops->misc(io, MXRIO_READDIR, DIR_BUFSIZE, dir->data, 0);
+        }
+        mxio_release(io);
         if (r > 0) {
             dir->ptr = dir->data;
             dir->size = r;
             continue;
         }
-        de = NULL;
-        break;
+        if (r < 0) {
+            errno = status_to_errno(r);
+        }
+        return NULL;
+    }
+    return de;
+}
+
+struct dirent *readdir(DIR* dir) {
+    vnattr_t* attr;
+    mxr_mutex_lock(&dir->lock);
+    struct dirent* de = readdir_locked(dir, false, &attr);
+    mxr_mutex_unlock(&dir->lock);
+    return de;
+}
+
+struct dirent* mxio_readdir_stat(DIR* dir, struct stat* s) {
+    vnattr_t* attr;
+    mxr_mutex_lock(&dir->lock);
+    struct dirent* de = readdir_locked(dir, true, &attr);
+    if (de != NULL) {
+        if (attr != NULL) {
+            attr_to_stat(attr, s);
+        } else {
+            // the server only lists names, so look this one up
+            mxio_t* io = fd_to_io(dir->fd);
+            mxio_t* child;
+            memset(s, 0, sizeof(struct stat));
+            if (io != NULL) {
+                if (io->ops->open(io, de->d_name, 0, 0, &child) == NO_ERROR) {
+                    mxio_stat(child, s);
+                    mxio_close(child);
+                    mxio_release(child);
+                }
+                mxio_release(io);
+            }
+        }
     }
     mxr_mutex_unlock(&dir->lock);
     return de;
@@ -0,0 +1,52 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <runtime/cond.h>
+
+#include <magenta/syscalls.h>
+#include <system/atomic.h>
+#include <stddef.h>
+
+#include "mutex_internal.h"
+
+mx_status_t mxr_cond_timedwait(mxr_cond_t* cond, mxr_mutex_t* mutex, mx_time_t timeout) {
+    int seq = atomic_load(&cond->seq);
+    __atomic_store_n(&cond->mutex, mutex, __ATOMIC_SEQ_CST);
+
+    mxr_mutex_unlock(mutex);
+    // ERR_BUSY means the condition was signalled before we got to sleep.
+    mx_status_t status = mx_futex_wait(&cond->seq, seq, timeout);
+
+    // We may have been requeued onto the mutex, in which case there can be
+    // more waiters behind us, so take it in a way that wakes the next one.
+    mxr_mutex_lock_contested(mutex);
+    return status == ERR_TIMED_OUT ? ERR_TIMED_OUT : NO_ERROR;
+}
+
+void mxr_cond_wait(mxr_cond_t* cond, mxr_mutex_t* mutex) {
+    mxr_cond_timedwait(cond, mutex, MX_TIME_INFINITE);
+}
+
+void mxr_cond_signal(mxr_cond_t* cond) {
+    atomic_add(&cond->seq, 1);
+    mx_futex_wake(&cond->seq, 1);
+}
+
+void mxr_cond_broadcast(mxr_cond_t* cond) {
+    mxr_mutex_t* mutex = __atomic_load_n(&cond->mutex, __ATOMIC_SEQ_CST);
+    int seq = atomic_add(&cond->seq, 1) + 1;
+
+    if (mutex == NULL) {
+        // nobody has ever waited
+        mx_futex_wake(&cond->seq, 0x7FFFFFFF);
+        return;
+    }
+
+    // Waking them all would only have them pile up on the mutex. Wake one
+    // and move the rest over to the mutex's futex, marking it so that
+    // unlocking it wakes them one by one.
+    mxr_mutex_mark_contested(mutex);
+    while (mx_futex_requeue(&cond->seq, 1, seq, &mutex->futex, 0x7FFFFFFF) == ERR_BUSY)
+        seq = atomic_load(&cond->seq);
+}
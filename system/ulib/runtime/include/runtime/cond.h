@@ -0,0 +1,42 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <magenta/types.h>
+#include <runtime/mutex.h>
+#include <stddef.h>
+#include <system/compiler.h>
+
+__BEGIN_CDECLS
+
+typedef struct {
+    int seq;
+    mxr_mutex_t* mutex;
+} mxr_cond_t;
+
+#define MXR_COND_INIT ((mxr_cond_t){0, NULL})
+
+#pragma GCC visibility push(hidden)
+
+// Atomically unlocks the mutex and waits for the condition to be
+// signalled, then takes the mutex again. All waiters on a condition
+// must use the same mutex. Wakeups can be spurious.
+void mxr_cond_wait(mxr_cond_t* cond, mxr_mutex_t* mutex);
+
+// As mxr_cond_wait, but gives up waiting for the signal once the
+// timeout expires and returns ERR_TIMED_OUT. The mutex is held again
+// on return either way.
+mx_status_t mxr_cond_timedwait(mxr_cond_t* cond, mxr_mutex_t* mutex, mx_time_t timeout);
+
+// Wakes at least one waiter, if there are any.
+void mxr_cond_signal(mxr_cond_t* cond);
+
+// Wakes all waiters. Only one is actually woken; the rest are moved
+// onto the mutex's futex and woken one at a time as it is unlocked.
+void mxr_cond_broadcast(mxr_cond_t* cond);
+
+#pragma GCC visibility pop
+
+__END_CDECLS
@@ -7,14 +7,16 @@
 #include <magenta/syscalls.h>
 #include <system/atomic.h>
 
-// TODO(kulakowski) Reintroduce (correctly) optimization counting waiters.
+#include "mutex_internal.h"
 
 // These values have to be as such. UNLOCKED == 0 allows locks to be
-// statically allocated, and the ordering of the values is relied upon
-// in the atomic decrement in the unlock routine.
+// statically allocated. CONTESTED means there may be threads blocked
+// on the futex, so whoever unlocks has to wake one of them. Threads
+// only ever sleep while the futex holds CONTESTED.
 enum {
     UNLOCKED = 0,
     LOCKED = 1,
+    CONTESTED = 2,
 };
 
 mx_status_t mxr_mutex_trylock(mxr_mutex_t* mutex) {
@@ -24,23 +26,23 @@ mx_status_t mxr_mutex_trylock(mxr_mutex_t* mutex) {
     return NO_ERROR;
 }
 
-mx_status_t mxr_mutex_timedlock(mxr_mutex_t* mutex, mx_time_t timeout) {
-    for (;;) {
-        switch (atomic_swap(&mutex->futex, LOCKED)) {
-        case UNLOCKED:
-            return NO_ERROR;
-        case LOCKED: {
-            mx_status_t status = mx_futex_wait(&mutex->futex, LOCKED, timeout);
-            if (status == ERR_BUSY) {
-                continue;
-            }
-            if (status != NO_ERROR) {
-                return status;
-            }
-            continue;
-        }
-        }
+// Take the lock the slow way, leaving it CONTESTED. A thread that got
+// here by being woken off the futex can't know whether others are still
+// asleep on it, so it has to assume they are.
+static mx_status_t lock_contested(mxr_mutex_t* mutex, mx_time_t timeout) {
+    while (atomic_swap(&mutex->futex, CONTESTED) != UNLOCKED) {
+        mx_status_t status = mx_futex_wait(&mutex->futex, CONTESTED, timeout);
+        if (status != NO_ERROR && status != ERR_BUSY)
+            return status;
     }
+    return NO_ERROR;
+}
+
+mx_status_t mxr_mutex_timedlock(mxr_mutex_t* mutex, mx_time_t timeout) {
+    int futex_value = UNLOCKED;
+    if (atomic_cmpxchg(&mutex->futex, &futex_value, LOCKED))
+        return NO_ERROR;
+    return lock_contested(mutex, timeout);
 }
 
 void mxr_mutex_lock(mxr_mutex_t* mutex) {
@@ -49,9 +51,22 @@ void mxr_mutex_lock(mxr_mutex_t* mutex) {
         __builtin_trap();
 }
 
-void mxr_mutex_unlock(mxr_mutex_t* mutex) {
-    atomic_store(&mutex->futex, UNLOCKED);
-    mx_status_t status = mx_futex_wake(&mutex->futex, 0x7FFFFFFF);
-    if (status != NO_ERROR)
+void mxr_mutex_lock_contested(mxr_mutex_t* mutex) {
+    if (lock_contested(mutex, MX_TIME_INFINITE) != NO_ERROR)
         __builtin_trap();
 }
+
+void mxr_mutex_mark_contested(mxr_mutex_t* mutex) {
+    int futex_value = LOCKED;
+    atomic_cmpxchg(&mutex->futex, &futex_value, CONTESTED);
+}
+
+void mxr_mutex_unlock(mxr_mutex_t* mutex) {
+    // Only one waiter is woken. It takes the lock CONTESTED, so its own
+    // unlock passes the wakeup on to the next.
+    if (atomic_swap(&mutex->futex, UNLOCKED) == CONTESTED) {
+        mx_status_t status = mx_futex_wake(&mutex->futex, 1);
+        if (status != NO_ERROR)
+            __builtin_trap();
+    }
+}
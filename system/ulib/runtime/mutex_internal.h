@@ -0,0 +1,20 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <runtime/mutex.h>
+
+#pragma GCC visibility push(hidden)
+
+// Blocks until the lock is obtained, leaving it marked as having
+// waiters. For threads that may have been requeued onto the mutex's
+// futex rather than having come to it through mxr_mutex_lock.
+void mxr_mutex_lock_contested(mxr_mutex_t* mutex);
+
+// Marks a held mutex as having waiters, so that unlocking it wakes
+// one. Must be done before requeueing threads onto its futex.
+void mxr_mutex_mark_contested(mxr_mutex_t* mutex);
+
+#pragma GCC visibility pop
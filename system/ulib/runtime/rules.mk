@@ -10,6 +10,7 @@ MODULE_TYPE := userlib
 
 MODULE_SRCS := \
     $(LOCAL_DIR)/completion.c \
+    $(LOCAL_DIR)/cond.c \
     $(LOCAL_DIR)/message.c \
     $(LOCAL_DIR)/mutex.c \
     $(LOCAL_DIR)/once.c \
@@ -38,7 +38,25 @@ struct mxr_thread {
     mx_tls_root_t tls_root;
 };
 
+// Pages of joined and detached threads are kept here, up to a limit,
+// so creating a thread doesn't have to go back to the vm each time.
+#define MAX_CACHED_THREAD_PAGES 16
+
+static mxr_mutex_t thread_page_cache_lock = MXR_MUTEX_INIT;
+static mxr_thread_t* thread_page_cache[MAX_CACHED_THREAD_PAGES];
+static size_t thread_page_cache_count;
+
 static mx_status_t allocate_thread_page(mxr_thread_t** thread_out) {
+    mxr_thread_t* thread = NULL;
+    mxr_mutex_lock(&thread_page_cache_lock);
+    if (thread_page_cache_count > 0)
+        thread = thread_page_cache[--thread_page_cache_count];
+    mxr_mutex_unlock(&thread_page_cache_lock);
+    if (thread != NULL) {
+        *thread_out = thread;
+        return NO_ERROR;
+    }
+
     // TODO(kulakowski) Pull out this allocation function out
     // somewhere once we have the ability to hint to the vm how and
     // where to allocate threads, stacks, heap etc.
@@ -69,6 +87,14 @@ static mx_status_t allocate_thread_page(mxr_thread_t** thread_out) {
 }
 
 static mx_status_t deallocate_thread_page(mxr_thread_t* thread) {
+    mxr_mutex_lock(&thread_page_cache_lock);
+    if (thread_page_cache_count < MAX_CACHED_THREAD_PAGES) {
+        thread_page_cache[thread_page_cache_count++] = thread;
+        mxr_mutex_unlock(&thread_page_cache_lock);
+        return NO_ERROR;
+    }
+    mxr_mutex_unlock(&thread_page_cache_lock);
+
     // TODO(kulakowski) Track process handle.
     mx_handle_t self_handle = 0;
     uintptr_t mapping = (uintptr_t)thread;
@@ -149,6 +175,7 @@ mx_status_t mxr_thread_create(mxr_thread_entry_t entry, void* arg, const char* n
 
     thread->entry = entry;
     thread->arg = arg;
+    thread->errno_value = 0;
     thread->state_lock = MXR_MUTEX_INIT;
     thread->state = JOINABLE;
 
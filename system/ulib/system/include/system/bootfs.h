@@ -0,0 +1,150 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <system/compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+__BEGIN_CDECLS;
+
+// File offsets in bootfs records are page aligned, so their low bits are
+// free to carry flags about the file.
+#define BOOTFS_FLAGS_MASK       4095u
+
+// The file is stored as a bootfs_lz4_frame_t at the (page aligned) offset,
+// and the record's size is the size of the file once decompressed.
+#define BOOTFS_FLAG_COMPRESSED  1u
+
+#define BOOTFS_LZ4_MAGIC        0x345a4c42u // "BLZ4"
+
+// At most 64k, so that match offsets always fit in 16 bits.
+#define BOOTFS_LZ4_BLOCK_SIZE   65536u
+
+// A compressed file is cut into blocks of block_size bytes (the last one
+// may be short), each compressed on its own in the LZ4 block format, so
+// any range of them can be decompressed without the others. Block i's
+// compressed bytes are [offset[i], offset[i + 1]) from the start of the
+// frame. A block that didn't shrink is stored as is.
+typedef struct bootfs_lz4_frame {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t reserved;
+    uint32_t offset[];
+} bootfs_lz4_frame_t;
+
+// Decompress one LZ4 block of exactly |dst_len| bytes. Returns 0, or -1 if
+// the block is corrupt.
+static inline int bootfs_lz4_decode_block(const uint8_t* src, size_t src_len,
+                                          uint8_t* dst, size_t dst_len) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_len;
+
+    for (;;) {
+        if (ip == iend)
+            return -1;
+        unsigned token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned b;
+            do {
+                if (ip == iend)
+                    return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit)
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        // the last sequence is only literals
+        if (ip == iend)
+            return (op == oend) ? 0 : -1;
+
+        if (iend - ip < 2)
+            return -1;
+        size_t off = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - dst))
+            return -1;
+
+        size_t len = token & 15;
+        if (len == 15) {
+            unsigned b;
+            do {
+                if (ip == iend)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += 4;
+        if ((size_t)(oend - op) < len)
+            return -1;
+
+        // the match may overlap what it is copying
+        const uint8_t* match = op - off;
+        while (len--)
+            *op++ = *match++;
+    }
+}
+
+// The number of blocks in the frame of a compressed file of |size| bytes,
+// or -1 if the frame's header doesn't fit in |frame_len| bytes or doesn't
+// match the size.
+static inline int64_t bootfs_lz4_blocks(const void* frame, size_t frame_len, size_t size) {
+    const bootfs_lz4_frame_t* hdr = (const bootfs_lz4_frame_t*)frame;
+    if (frame_len < sizeof(*hdr) || hdr->magic != BOOTFS_LZ4_MAGIC)
+        return -1;
+    if (hdr->block_size == 0 || hdr->block_size > BOOTFS_LZ4_BLOCK_SIZE)
+        return -1;
+    if (hdr->block_count != (size + hdr->block_size - 1) / hdr->block_size)
+        return -1;
+    if ((frame_len - sizeof(*hdr)) / sizeof(uint32_t) <= hdr->block_count)
+        return -1;
+    return hdr->block_count;
+}
+
+// Decompress blocks [first, first + count) of a frame checked with
+// bootfs_lz4_blocks() into |dst|, which is where block |first| goes.
+// Returns 0, or -1 if the frame is corrupt.
+static inline int bootfs_lz4_decode(const void* frame, size_t frame_len, size_t size,
+                                    uint32_t first, uint32_t count, uint8_t* dst) {
+    const bootfs_lz4_frame_t* hdr = (const bootfs_lz4_frame_t*)frame;
+    size_t start = sizeof(*hdr) + (hdr->block_count + 1) * sizeof(uint32_t);
+    if (first > hdr->block_count || count > hdr->block_count - first)
+        return -1;
+
+    for (uint32_t i = first; i < first + count; i++) {
+        uint32_t begin = hdr->offset[i];
+        uint32_t end = hdr->offset[i + 1];
+        if (begin < start || begin > end || end > frame_len)
+            return -1;
+
+        size_t pos = (size_t)i * hdr->block_size;
+        size_t len = size - pos;
+        if (len > hdr->block_size)
+            len = hdr->block_size;
+
+        const uint8_t* src = (const uint8_t*)frame + begin;
+        if (end - begin == len) {
+            memcpy(dst, src, len);
+        } else if (bootfs_lz4_decode_block(src, end - begin, dst, len) < 0) {
+            return -1;
+        }
+        dst += len;
+    }
+    return 0;
+}
+
+__END_CDECLS;
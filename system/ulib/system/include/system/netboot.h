@@ -20,6 +20,7 @@
 #define NB_BOOT               4 // arg=0
 #define NB_QUERY              5 // arg=0, data=hostname (or "*")
 #define NB_SHELL_CMD          6 // arg=0, data=command string
+#define NB_SEND_FILE_WINDOWED 7 // arg=0, data=nbxfer + filename
 
 #define NB_ACK                0
 
@@ -38,8 +39,54 @@ typedef struct nbmsg_t {
 	uint8_t  data[0];
 } nbmsg;
 
+// Windowed transfers
+//
+// NB_SEND_FILE_WINDOWED proposes a window and block size, and the NB_ACK
+// to it carries the ones the receiver accepts, neither larger than
+// proposed. A receiver that doesn't know the command leaves the sender
+// to fall back to NB_SEND_FILE.
+//
+// The sender then keeps up to window NB_DATA messages in flight. Each
+// carries blocksize bytes (the last one fewer) and its offset in arg,
+// always a multiple of blocksize. Each NB_DATA is answered by an NB_ACK
+// whose arg is the offset up to which all data has arrived, and whose
+// data is a uint32_t in which bit n is set if the block at
+// arg + (n + 1) * blocksize has arrived as well. The sender resends
+// only the blocks that haven't. The transfer ends with the next command.
+typedef struct nbxfer_t {
+	uint32_t window;
+	uint32_t blocksize;
+} nbxfer;
+
+#define NB_WINDOW_MAX         33 // the first gap and a 32 bit map past it
+
 int netboot_init(void *buf, size_t len);
 int netboot_poll(void);
 
 #define DEBUGLOG_PORT         33337
 #define DEBUGLOG_ACK_PORT     33338
+
+#define DEBUGLOG_MAGIC        0xaeae1123
+
+#define MAX_LOG_DATA          1280
+
+typedef struct logpacket {
+	uint32_t magic;
+	uint32_t seqno;
+	char data[MAX_LOG_DATA];
+} logpacket_t;
+
+// A listener may ack a packet by echoing its first 8 bytes, which has
+// netsvc send one packet at a time. A logack_t instead acks every packet
+// up to and including seqno, and lets netsvc keep DEBUGLOG_WINDOW packets
+// in flight. With DEBUGLOG_RESEND, the listener has seen a gap after
+// seqno and asks for the packets after it again.
+typedef struct logack {
+	uint32_t magic;
+	uint32_t seqno;
+	uint32_t flags;
+} logack_t;
+
+#define DEBUGLOG_RESEND       1
+
+#define DEBUGLOG_WINDOW       8
@@ -0,0 +1,37 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <system/compiler.h>
+
+__BEGIN_CDECLS
+
+// Batch single precision math: y[i] = f(x[i]) for i < n, a vector register
+// of elements at a time. SSE2 or AVX2 (whichever the cpu has) on x86-64,
+// NEON on arm64, and the scalar libm functions elsewhere. y may be x, but
+// the arrays mustn't otherwise overlap.
+//
+// Results are within the ulps of the correctly rounded result given for
+// each function, and are bit for bit the same whichever vector unit did
+// them. Arguments outside the range given are left to the scalar libm
+// function, as are results of pow that aren't normal numbers, so
+// infinities, NaNs, zeros and subnormals come out as they do from libm.
+// errno and the floating point exception flags are not meaningful after.
+
+// exp: 1 ulp, over [-87, 88]
+void vexpf(float* y, const float* x, size_t n);
+
+// log: 1 ulp, over the normal positive numbers
+void vlogf(float* y, const float* x, size_t n);
+
+// sin and cos: 1 ulp, over [-2^28, 2^28]
+void vsinf(float* y, const float* x, size_t n);
+void vcosf(float* y, const float* x, size_t n);
+
+// z[i] = pow(x[i], y[i]): 1 ulp, for normal positive x and finite y
+void vpowf(float* z, const float* x, const float* y, size_t n);
+
+__END_CDECLS
@@ -0,0 +1,34 @@
+# Copyright 2016 The Fuchsia Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+MODULE := $(LOCAL_DIR)
+
+MODULE_TYPE := userlib
+
+MODULE_SRCS += \
+    $(LOCAL_DIR)/vecmath.c \
+
+ifeq ($(ARCH),arm64)
+MODULE_SRCS += \
+    $(LOCAL_DIR)/vecmath-neon.c \
+
+else ifeq ($(SUBARCH),x86-64)
+MODULE_SRCS += \
+    $(LOCAL_DIR)/vecmath-avx2.c \
+    $(LOCAL_DIR)/vecmath-sse2.c \
+
+endif
+
+# no fused multiply-adds, so every vector unit rounds the same
+MODULE_CFLAGS += -ffp-contract=off
+
+MODULE_EXPORT := vecmath
+
+MODULE_SO_NAME := vecmath
+
+MODULE_LIBS := ulib/musl
+
+include make/module.mk
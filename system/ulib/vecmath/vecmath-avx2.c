@@ -0,0 +1,72 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <immintrin.h>
+
+#include "vecmath-priv.h"
+
+// only ever called once vecmath.c has seen the cpu has avx2
+#define VLANES 8
+#define V_FN static inline __attribute__((target("avx2")))
+#define V_ENTRY __attribute__((target("avx2")))
+#define V_NAME(f) f##_avx2
+
+typedef __m256 vf;
+typedef __m256i vi;
+typedef __m256d vd;
+typedef __m256i vl;
+
+V_FN vf vf_load(const float* p) { return _mm256_loadu_ps(p); }
+V_FN void vf_store(float* p, vf x) { _mm256_storeu_ps(p, x); }
+V_FN vf vf_dup(float x) { return _mm256_set1_ps(x); }
+V_FN vf vf_add(vf a, vf b) { return _mm256_add_ps(a, b); }
+V_FN vf vf_sub(vf a, vf b) { return _mm256_sub_ps(a, b); }
+V_FN vf vf_mul(vf a, vf b) { return _mm256_mul_ps(a, b); }
+V_FN vi vf_lt(vf a, vf b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+V_FN vi vf_le(vf a, vf b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+V_FN vf vf_sel(vi m, vf a, vf b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(m)); }
+V_FN vi vf_as_vi(vf x) { return _mm256_castps_si256(x); }
+V_FN vi vf_to_vi(vf x) { return _mm256_cvttps_epi32(x); }
+
+V_FN vi vi_dup(int32_t x) { return _mm256_set1_epi32(x); }
+V_FN vi vi_add(vi a, vi b) { return _mm256_add_epi32(a, b); }
+V_FN vi vi_sub(vi a, vi b) { return _mm256_sub_epi32(a, b); }
+V_FN vi vi_and(vi a, vi b) { return _mm256_and_si256(a, b); }
+V_FN vi vi_or(vi a, vi b) { return _mm256_or_si256(a, b); }
+V_FN vi vi_xor(vi a, vi b) { return _mm256_xor_si256(a, b); }
+V_FN vi vi_eq(vi a, vi b) { return _mm256_cmpeq_epi32(a, b); }
+#define vi_shl(a, n) _mm256_slli_epi32(a, n)
+#define vi_shr(a, n) _mm256_srli_epi32(a, n)
+V_FN unsigned vi_bits(vi m) { return _mm256_movemask_ps(_mm256_castsi256_ps(m)); }
+V_FN vf vi_as_vf(vi x) { return _mm256_castsi256_ps(x); }
+V_FN vf vi_to_vf(vi x) { return _mm256_cvtepi32_ps(x); }
+
+V_FN void vf_to_vd(vf x, vd* lo, vd* hi) {
+    *lo = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+    *hi = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+}
+V_FN vf vd_to_vf(vd lo, vd hi) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)),
+                                _mm256_cvtpd_ps(hi), 1);
+}
+V_FN vd vd_dup(double x) { return _mm256_set1_pd(x); }
+V_FN vd vd_add(vd a, vd b) { return _mm256_add_pd(a, b); }
+V_FN vd vd_sub(vd a, vd b) { return _mm256_sub_pd(a, b); }
+V_FN vd vd_mul(vd a, vd b) { return _mm256_mul_pd(a, b); }
+V_FN vd vd_div(vd a, vd b) { return _mm256_div_pd(a, b); }
+V_FN vl vd_lt(vd a, vd b) { return _mm256_castpd_si256(_mm256_cmp_pd(a, b, _CMP_LT_OQ)); }
+V_FN vd vd_sel(vl m, vd a, vd b) { return _mm256_blendv_pd(b, a, _mm256_castsi256_pd(m)); }
+V_FN vl vd_as_vl(vd x) { return _mm256_castpd_si256(x); }
+
+V_FN vl vl_dup(int64_t x) { return _mm256_set1_epi64x(x); }
+V_FN vl vl_add(vl a, vl b) { return _mm256_add_epi64(a, b); }
+V_FN vl vl_sub(vl a, vl b) { return _mm256_sub_epi64(a, b); }
+V_FN vl vl_and(vl a, vl b) { return _mm256_and_si256(a, b); }
+V_FN vl vl_or(vl a, vl b) { return _mm256_or_si256(a, b); }
+V_FN vl vl_xor(vl a, vl b) { return _mm256_xor_si256(a, b); }
+#define vl_shl(a, n) _mm256_slli_epi64(a, n)
+#define vl_shr(a, n) _mm256_srli_epi64(a, n)
+V_FN vd vl_as_vd(vl x) { return _mm256_castsi256_pd(x); }
+
+#include "vecmath-impl.h"
@@ -0,0 +1,289 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// The functions, written once against a small set of vector operations that
+// vecmath-sse2.c, vecmath-avx2.c and vecmath-neon.c each define before
+// including this:
+//
+//   vf, vi       VLANES floats, and as many 32 bit ints or lane masks
+//   vd, vl       VLANES / 2 doubles, and as many 64 bit ints or lane masks
+//   V_FN         what to declare each function here with
+//   V_ENTRY      and each entry point
+//   V_NAME(f)    the name to give the entry point f
+//
+// The polynomials for exp and log are Cephes'.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VLANES_MASK ((1u << VLANES) - 1)
+
+V_FN vf vf_round(vf x) {
+    // |x| < 2^22, in the default rounding mode
+    const vf magic = vf_dup(0x1.8p23f);
+    return vf_sub(vf_add(x, magic), magic);
+}
+
+// lanes where lo <= x <= hi, which NaNs are never
+V_FN vi vf_in(vf x, float lo, float hi) {
+    return vi_and(vf_le(vf_dup(lo), x), vf_le(x, vf_dup(hi)));
+}
+
+V_FN vf v_exp(vf x, unsigned* special) {
+    vi ok = vf_in(x, -87.0f, 88.0f);
+    *special = ~vi_bits(ok) & VLANES_MASK;
+    x = vf_sel(ok, x, vf_dup(0.0f));
+
+    // x = n ln2 + r, |r| <= ln2 / 2, with ln2 in two parts
+    vf fn = vf_round(vf_mul(x, vf_dup(1.44269504088896341f)));
+    vf r = vf_sub(x, vf_mul(fn, vf_dup(0.693359375f)));
+    r = vf_sub(r, vf_mul(fn, vf_dup(-2.12194440e-4f)));
+
+    vf p = vf_dup(1.9875691500e-4f);
+    p = vf_add(vf_mul(p, r), vf_dup(1.3981999507e-3f));
+    p = vf_add(vf_mul(p, r), vf_dup(8.3334519073e-3f));
+    p = vf_add(vf_mul(p, r), vf_dup(4.1665795894e-2f));
+    p = vf_add(vf_mul(p, r), vf_dup(1.6666665459e-1f));
+    p = vf_add(vf_mul(p, r), vf_dup(5.0000001201e-1f));
+    p = vf_add(vf_add(vf_mul(p, vf_mul(r, r)), r), vf_dup(1.0f));
+
+    // times 2^n, which the range keeps a normal number
+    vi n = vf_to_vi(fn);
+    return vf_mul(p, vi_as_vf(vi_shl(vi_add(n, vi_dup(127)), 23)));
+}
+
+V_FN vf v_log(vf x, unsigned* special) {
+    vi ok = vf_in(x, 0x1p-126f, 0x1.fffffep127f);
+    *special = ~vi_bits(ok) & VLANES_MASK;
+    x = vf_sel(ok, x, vf_dup(1.0f));
+
+    // x = 2^e m, sqrt(1/2) <= m < sqrt(2)
+    vi bits = vf_as_vi(x);
+    vi e = vi_sub(vi_shr(bits, 23), vi_dup(126));
+    vf m = vi_as_vf(vi_or(vi_and(bits, vi_dup(0x007fffff)), vi_dup(0x3f000000)));
+    vi small = vf_lt(m, vf_dup(0.707106781186547524f));
+    e = vi_add(e, small);
+    m = vf_sub(vf_add(m, vf_sel(small, m, vf_dup(0.0f))), vf_dup(1.0f));
+    vf fe = vi_to_vf(e);
+
+    vf z = vf_mul(m, m);
+    vf p = vf_dup(7.0376836292e-2f);
+    p = vf_add(vf_mul(p, m), vf_dup(-1.1514610310e-1f));
+    p = vf_add(vf_mul(p, m), vf_dup(1.1676998740e-1f));
+    p = vf_add(vf_mul(p, m), vf_dup(-1.2420140846e-1f));
+    p = vf_add(vf_mul(p, m), vf_dup(1.4249322787e-1f));
+    p = vf_add(vf_mul(p, m), vf_dup(-1.6668057665e-1f));
+    p = vf_add(vf_mul(p, m), vf_dup(2.0000714765e-1f));
+    p = vf_add(vf_mul(p, m), vf_dup(-2.4999993993e-1f));
+    p = vf_add(vf_mul(p, m), vf_dup(3.3333331174e-1f));
+    p = vf_mul(vf_mul(p, m), z);
+
+    // log(x) = e ln2 + log(1 + m), with ln2 in two parts
+    p = vf_add(p, vf_mul(fe, vf_dup(-2.12194440e-4f)));
+    p = vf_sub(p, vf_mul(z, vf_dup(0.5f)));
+    return vf_add(vf_add(m, p), vf_mul(fe, vf_dup(0.693359375f)));
+}
+
+// sin(x) when cos is false, cos(x) when it's true, for |x| < 2^28 pi/2. As
+// third_party/lib/libm's sinf and cosf do it, in double precision: x less the
+// nearest multiple n of pi/2, pi/2 in two parts, then their kernels.
+V_FN vd vd_sincos(vd x, bool cos) {
+    vd k = vd_add(vd_mul(x, vd_dup(6.36619772367581382433e-01)), vd_dup(0x1.8p52));
+    vd fn = vd_sub(k, vd_dup(0x1.8p52));
+    vl n = vl_sub(vd_as_vl(k), vl_dup(0x4338000000000000));
+    x = vd_sub(vd_sub(x, vd_mul(fn, vd_dup(1.57079631090164184570e+00))),
+               vd_mul(fn, vd_dup(1.58932547735281966916e-08)));
+
+    vd z = vd_mul(x, x);
+    vd w = vd_mul(z, z);
+
+    vd zx = vd_mul(z, x);
+    vd s = vd_add(vd_dup(-0x15555554cbac77.0p-55), vd_mul(z, vd_dup(0x111110896efbb2.0p-59)));
+    vd r = vd_add(vd_dup(-0x1a00f9e2cae774.0p-65), vd_mul(z, vd_dup(0x16cd878c3b46a7.0p-71)));
+    s = vd_add(vd_add(x, vd_mul(zx, s)), vd_mul(vd_mul(zx, w), r));
+
+    vd c = vd_add(vd_dup(1.0), vd_mul(z, vd_dup(-0x1ffffffd0c5e81.0p-54)));
+    r = vd_add(vd_dup(-0x16c087e80f1e27.0p-62), vd_mul(z, vd_dup(0x199342e0ee5069.0p-68)));
+    c = vd_add(vd_add(c, vd_mul(w, vd_dup(0x155553e1053a42.0p-57))), vd_mul(vd_mul(w, z), r));
+
+    // sin in quadrants 0 and 2, cos in 1 and 3, negated in 2 and 3, and
+    // cos(x) = sin(x + pi/2)
+    if (cos)
+        n = vl_add(n, vl_dup(1));
+    vl use_cos = vl_sub(vl_dup(0), vl_and(n, vl_dup(1)));
+    vl sign = vl_shl(vl_and(n, vl_dup(2)), 62);
+    return vl_as_vd(vl_xor(vd_as_vl(vd_sel(use_cos, c, s)), sign));
+}
+
+V_FN vf v_sincos(vf x, bool cos, unsigned* special) {
+    vi ok = vf_in(x, -0x1p28f, 0x1p28f);
+    *special = ~vi_bits(ok) & VLANES_MASK;
+    x = vf_sel(ok, x, vf_dup(0.0f));
+
+    vd lo, hi;
+    vf_to_vd(x, &lo, &hi);
+    vf r = vd_to_vf(vd_sincos(lo, cos), vd_sincos(hi, cos));
+    if (cos)
+        return r;
+
+    // sin(x) rounds to x, and keeps the sign of a zero
+    vf ax = vi_as_vf(vi_and(vf_as_vi(x), vi_dup(INT32_MAX)));
+    return vf_sel(vf_lt(ax, vf_dup(0x1p-12f)), x, r);
+}
+
+V_FN vf v_sin(vf x, unsigned* special) {
+    return v_sincos(x, false, special);
+}
+
+V_FN vf v_cos(vf x, unsigned* special) {
+    return v_sincos(x, true, special);
+}
+
+// log2(x) for normal positive x, to around 2^-50
+V_FN vd vd_log2(vd x) {
+    // x = 2^e m, sqrt(1/2) <= m < sqrt(2)
+    vl bits = vd_as_vl(x);
+    vl e = vl_sub(vl_shr(bits, 52), vl_dup(1023));
+    vd m = vl_as_vd(vl_or(vl_and(bits, vl_dup(0x000fffffffffffff)),
+                          vl_dup(0x3ff0000000000000)));
+    vl big = vd_lt(vd_dup(1.41421356237309505), m);
+    m = vd_sel(big, vd_mul(m, vd_dup(0.5)), m);
+    e = vl_sub(e, big);
+    // as a double, by way of 1.5 * 2^52 + e
+    vd fe = vd_sub(vl_as_vd(vl_add(e, vl_dup(0x4338000000000000))), vd_dup(0x1.8p52));
+
+    // log(m) = 2 atanh(s), |s| < 0.172
+    vd s = vd_div(vd_sub(m, vd_dup(1.0)), vd_add(m, vd_dup(1.0)));
+    vd z = vd_mul(s, s);
+    vd p = vd_dup(1.0 / 19);
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 17));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 15));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 13));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 11));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 9));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 7));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 5));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0 / 3));
+    p = vd_add(vd_mul(p, z), vd_dup(1.0));
+    return vd_add(fe, vd_mul(vd_mul(p, s), vd_dup(2.88539008177792681)));
+}
+
+// 2^x for |x| <= 1000, to around 2^-50
+V_FN vd vd_exp2(vd x) {
+    // x = n + f, |f| <= 1/2, with n rounded by way of 1.5 * 2^52 + n
+    vd k = vd_add(x, vd_dup(0x1.8p52));
+    vd f = vd_sub(x, vd_sub(k, vd_dup(0x1.8p52)));
+    vl n = vl_sub(vd_as_vl(k), vl_dup(0x4338000000000000));
+
+    // e^(f ln2), |f ln2| < 0.347
+    vd g = vd_mul(f, vd_dup(0.693147180559945309));
+    vd p = vd_dup(1.0 / 479001600);
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 39916800));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 3628800));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 362880));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 40320));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 5040));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 720));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 120));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 24));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 6));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0 / 2));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0));
+    p = vd_add(vd_mul(p, g), vd_dup(1.0));
+    return vd_mul(p, vl_as_vd(vl_shl(vl_add(n, vl_dup(1023)), 52)));
+}
+
+V_FN vd vd_pow(vd x, vd y) {
+    // out of float range either way, and 2^t stays a double
+    vd t = vd_mul(y, vd_log2(x));
+    t = vd_sel(vd_lt(t, vd_dup(-200.0)), vd_dup(-200.0), t);
+    t = vd_sel(vd_lt(vd_dup(200.0), t), vd_dup(200.0), t);
+    return vd_exp2(t);
+}
+
+V_FN vf v_pow(vf x, vf y, unsigned* special) {
+    vi ok = vi_and(vf_in(x, 0x1p-126f, 0x1.fffffep127f),
+                   vf_in(y, -0x1.fffffep127f, 0x1.fffffep127f));
+    x = vf_sel(ok, x, vf_dup(1.0f));
+    y = vf_sel(ok, y, vf_dup(1.0f));
+
+    vd xlo, xhi, ylo, yhi;
+    vf_to_vd(x, &xlo, &xhi);
+    vf_to_vd(y, &ylo, &yhi);
+    vf r = vd_to_vf(vd_pow(xlo, ylo), vd_pow(xhi, yhi));
+
+    // results that aren't normal floats are libm's to get right
+    ok = vi_and(ok, vf_in(r, 0x1p-126f, 0x1.fffffep127f));
+    *special = ~vi_bits(ok) & VLANES_MASK;
+    return r;
+}
+
+// The entry points. A block with special lanes is put together in out[], as
+// y may be x, and the tail is done as a whole block padded out with ones.
+
+#define V_MAP1(f, kernel, scalar)                                               \
+    V_ENTRY void V_NAME(f)(float* y, const float* x, size_t n) {                \
+        float in[VLANES], out[VLANES];                                          \
+        unsigned special;                                                       \
+        for (; n >= VLANES; n -= VLANES, x += VLANES, y += VLANES) {            \
+            vf r = kernel(vf_load(x), &special);                                \
+            if (!special) {                                                     \
+                vf_store(y, r);                                                 \
+                continue;                                                       \
+            }                                                                   \
+            vf_store(out, r);                                                   \
+            for (unsigned i = 0; i < VLANES; i++) {                             \
+                if (special & (1u << i))                                        \
+                    out[i] = scalar(x[i]);                                      \
+            }                                                                   \
+            memcpy(y, out, sizeof(out));                                        \
+        }                                                                       \
+        if (n) {                                                                \
+            for (unsigned i = 0; i < VLANES; i++)                               \
+                in[i] = i < n ? x[i] : 1.0f;                                    \
+            vf_store(out, kernel(vf_load(in), &special));                       \
+            for (unsigned i = 0; i < n; i++) {                                  \
+                if (special & (1u << i))                                        \
+                    out[i] = scalar(in[i]);                                     \
+            }                                                                   \
+            memcpy(y, out, n * sizeof(float));                                  \
+        }                                                                       \
+    }
+
+V_MAP1(vexpf, v_exp, expf)
+V_MAP1(vlogf, v_log, logf)
+V_MAP1(vsinf, v_sin, sinf)
+V_MAP1(vcosf, v_cos, cosf)
+
+V_ENTRY void V_NAME(vpowf)(float* z, const float* x, const float* y, size_t n) {
+    float xin[VLANES], yin[VLANES], out[VLANES];
+    unsigned special;
+    for (; n >= VLANES; n -= VLANES, x += VLANES, y += VLANES, z += VLANES) {
+        vf r = v_pow(vf_load(x), vf_load(y), &special);
+        if (!special) {
+            vf_store(z, r);
+            continue;
+        }
+        vf_store(out, r);
+        for (unsigned i = 0; i < VLANES; i++) {
+            if (special & (1u << i))
+                out[i] = powf(x[i], y[i]);
+        }
+        memcpy(z, out, sizeof(out));
+    }
+    if (n) {
+        for (unsigned i = 0; i < VLANES; i++) {
+            xin[i] = i < n ? x[i] : 1.0f;
+            yin[i] = i < n ? y[i] : 1.0f;
+        }
+        vf_store(out, v_pow(vf_load(xin), vf_load(yin), &special));
+        for (unsigned i = 0; i < n; i++) {
+            if (special & (1u << i))
+                out[i] = powf(xin[i], yin[i]);
+        }
+        memcpy(z, out, n * sizeof(float));
+    }
+}
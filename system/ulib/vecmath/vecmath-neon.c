@@ -0,0 +1,71 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <arm_neon.h>
+
+#include "vecmath-priv.h"
+
+#define VLANES 4
+#define V_FN static inline
+#define V_ENTRY
+#define V_NAME(f) f##_neon
+
+typedef float32x4_t vf;
+typedef int32x4_t vi;
+typedef float64x2_t vd;
+typedef int64x2_t vl;
+
+V_FN vf vf_load(const float* p) { return vld1q_f32(p); }
+V_FN void vf_store(float* p, vf x) { vst1q_f32(p, x); }
+V_FN vf vf_dup(float x) { return vdupq_n_f32(x); }
+V_FN vf vf_add(vf a, vf b) { return vaddq_f32(a, b); }
+V_FN vf vf_sub(vf a, vf b) { return vsubq_f32(a, b); }
+V_FN vf vf_mul(vf a, vf b) { return vmulq_f32(a, b); }
+V_FN vi vf_lt(vf a, vf b) { return vreinterpretq_s32_u32(vcltq_f32(a, b)); }
+V_FN vi vf_le(vf a, vf b) { return vreinterpretq_s32_u32(vcleq_f32(a, b)); }
+V_FN vf vf_sel(vi m, vf a, vf b) { return vbslq_f32(vreinterpretq_u32_s32(m), a, b); }
+V_FN vi vf_as_vi(vf x) { return vreinterpretq_s32_f32(x); }
+V_FN vi vf_to_vi(vf x) { return vcvtq_s32_f32(x); }
+
+V_FN vi vi_dup(int32_t x) { return vdupq_n_s32(x); }
+V_FN vi vi_add(vi a, vi b) { return vaddq_s32(a, b); }
+V_FN vi vi_sub(vi a, vi b) { return vsubq_s32(a, b); }
+V_FN vi vi_and(vi a, vi b) { return vandq_s32(a, b); }
+V_FN vi vi_or(vi a, vi b) { return vorrq_s32(a, b); }
+V_FN vi vi_xor(vi a, vi b) { return veorq_s32(a, b); }
+V_FN vi vi_eq(vi a, vi b) { return vreinterpretq_s32_u32(vceqq_s32(a, b)); }
+#define vi_shl(a, n) vshlq_n_s32(a, n)
+#define vi_shr(a, n) vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), n))
+V_FN unsigned vi_bits(vi m) {
+    static const uint32_t lanes[4] = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(vreinterpretq_u32_s32(m), vld1q_u32(lanes)));
+}
+V_FN vf vi_as_vf(vi x) { return vreinterpretq_f32_s32(x); }
+V_FN vf vi_to_vf(vi x) { return vcvtq_f32_s32(x); }
+
+V_FN void vf_to_vd(vf x, vd* lo, vd* hi) {
+    *lo = vcvt_f64_f32(vget_low_f32(x));
+    *hi = vcvt_high_f64_f32(x);
+}
+V_FN vf vd_to_vf(vd lo, vd hi) { return vcvt_high_f32_f64(vcvt_f32_f64(lo), hi); }
+V_FN vd vd_dup(double x) { return vdupq_n_f64(x); }
+V_FN vd vd_add(vd a, vd b) { return vaddq_f64(a, b); }
+V_FN vd vd_sub(vd a, vd b) { return vsubq_f64(a, b); }
+V_FN vd vd_mul(vd a, vd b) { return vmulq_f64(a, b); }
+V_FN vd vd_div(vd a, vd b) { return vdivq_f64(a, b); }
+V_FN vl vd_lt(vd a, vd b) { return vreinterpretq_s64_u64(vcltq_f64(a, b)); }
+V_FN vd vd_sel(vl m, vd a, vd b) { return vbslq_f64(vreinterpretq_u64_s64(m), a, b); }
+V_FN vl vd_as_vl(vd x) { return vreinterpretq_s64_f64(x); }
+
+V_FN vl vl_dup(int64_t x) { return vdupq_n_s64(x); }
+V_FN vl vl_add(vl a, vl b) { return vaddq_s64(a, b); }
+V_FN vl vl_sub(vl a, vl b) { return vsubq_s64(a, b); }
+V_FN vl vl_and(vl a, vl b) { return vandq_s64(a, b); }
+V_FN vl vl_or(vl a, vl b) { return vorrq_s64(a, b); }
+V_FN vl vl_xor(vl a, vl b) { return veorq_s64(a, b); }
+#define vl_shl(a, n) vshlq_n_s64(a, n)
+#define vl_shr(a, n) vreinterpretq_s64_u64(vshrq_n_u64(vreinterpretq_u64_s64(a), n))
+V_FN vd vl_as_vd(vl x) { return vreinterpretq_f64_s64(x); }
+
+#include "vecmath-impl.h"
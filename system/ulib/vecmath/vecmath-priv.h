@@ -0,0 +1,24 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// each vector unit's versions of the functions in vecmath.h, which pick one
+
+#define VECMATH_DECLARE(suffix)                                                 \
+    void vexpf_##suffix(float* y, const float* x, size_t n);                    \
+    void vlogf_##suffix(float* y, const float* x, size_t n);                    \
+    void vsinf_##suffix(float* y, const float* x, size_t n);                    \
+    void vcosf_##suffix(float* y, const float* x, size_t n);                    \
+    void vpowf_##suffix(float* z, const float* x, const float* y, size_t n);
+
+#if defined(__x86_64__)
+VECMATH_DECLARE(sse2)
+VECMATH_DECLARE(avx2)
+#elif defined(__aarch64__)
+VECMATH_DECLARE(neon)
+#endif
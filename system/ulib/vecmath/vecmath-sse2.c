@@ -0,0 +1,74 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <emmintrin.h>
+
+#include "vecmath-priv.h"
+
+#define VLANES 4
+#define V_FN static inline
+#define V_ENTRY
+#define V_NAME(f) f##_sse2
+
+typedef __m128 vf;
+typedef __m128i vi;
+typedef __m128d vd;
+typedef __m128i vl;
+
+V_FN vf vf_load(const float* p) { return _mm_loadu_ps(p); }
+V_FN void vf_store(float* p, vf x) { _mm_storeu_ps(p, x); }
+V_FN vf vf_dup(float x) { return _mm_set1_ps(x); }
+V_FN vf vf_add(vf a, vf b) { return _mm_add_ps(a, b); }
+V_FN vf vf_sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+V_FN vf vf_mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+V_FN vi vf_lt(vf a, vf b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+V_FN vi vf_le(vf a, vf b) { return _mm_castps_si128(_mm_cmple_ps(a, b)); }
+V_FN vf vf_sel(vi m, vf a, vf b) {
+    __m128 mask = _mm_castsi128_ps(m);
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+V_FN vi vf_as_vi(vf x) { return _mm_castps_si128(x); }
+V_FN vi vf_to_vi(vf x) { return _mm_cvttps_epi32(x); }
+
+V_FN vi vi_dup(int32_t x) { return _mm_set1_epi32(x); }
+V_FN vi vi_add(vi a, vi b) { return _mm_add_epi32(a, b); }
+V_FN vi vi_sub(vi a, vi b) { return _mm_sub_epi32(a, b); }
+V_FN vi vi_and(vi a, vi b) { return _mm_and_si128(a, b); }
+V_FN vi vi_or(vi a, vi b) { return _mm_or_si128(a, b); }
+V_FN vi vi_xor(vi a, vi b) { return _mm_xor_si128(a, b); }
+V_FN vi vi_eq(vi a, vi b) { return _mm_cmpeq_epi32(a, b); }
+#define vi_shl(a, n) _mm_slli_epi32(a, n)
+#define vi_shr(a, n) _mm_srli_epi32(a, n)
+V_FN unsigned vi_bits(vi m) { return _mm_movemask_ps(_mm_castsi128_ps(m)); }
+V_FN vf vi_as_vf(vi x) { return _mm_castsi128_ps(x); }
+V_FN vf vi_to_vf(vi x) { return _mm_cvtepi32_ps(x); }
+
+V_FN void vf_to_vd(vf x, vd* lo, vd* hi) {
+    *lo = _mm_cvtps_pd(x);
+    *hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+}
+V_FN vf vd_to_vf(vd lo, vd hi) { return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)); }
+V_FN vd vd_dup(double x) { return _mm_set1_pd(x); }
+V_FN vd vd_add(vd a, vd b) { return _mm_add_pd(a, b); }
+V_FN vd vd_sub(vd a, vd b) { return _mm_sub_pd(a, b); }
+V_FN vd vd_mul(vd a, vd b) { return _mm_mul_pd(a, b); }
+V_FN vd vd_div(vd a, vd b) { return _mm_div_pd(a, b); }
+V_FN vl vd_lt(vd a, vd b) { return _mm_castpd_si128(_mm_cmplt_pd(a, b)); }
+V_FN vd vd_sel(vl m, vd a, vd b) {
+    __m128d mask = _mm_castsi128_pd(m);
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+V_FN vl vd_as_vl(vd x) { return _mm_castpd_si128(x); }
+
+V_FN vl vl_dup(int64_t x) { return _mm_set1_epi64x(x); }
+V_FN vl vl_add(vl a, vl b) { return _mm_add_epi64(a, b); }
+V_FN vl vl_sub(vl a, vl b) { return _mm_sub_epi64(a, b); }
+V_FN vl vl_and(vl a, vl b) { return _mm_and_si128(a, b); }
+V_FN vl vl_or(vl a, vl b) { return _mm_or_si128(a, b); }
+V_FN vl vl_xor(vl a, vl b) { return _mm_xor_si128(a, b); }
+#define vl_shl(a, n) _mm_slli_epi64(a, n)
+#define vl_shr(a, n) _mm_srli_epi64(a, n)
+V_FN vd vl_as_vd(vl x) { return _mm_castsi128_pd(x); }
+
+#include "vecmath-impl.h"
@@ -0,0 +1,89 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <vecmath/vecmath.h>
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "vecmath-priv.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+
+// avx2, and the os saving the ymm registers; racy, but always to the same
+static int avx2 = -1;
+
+static bool have_avx2(void) {
+    if (avx2 < 0) {
+        unsigned a, b, c, d;
+        bool ok = false;
+        if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_OSXSAVE) && (c & bit_AVX)) {
+            uint32_t xcr0_lo, xcr0_hi;
+            __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            if ((xcr0_lo & 6) == 6 && __get_cpuid_max(0, NULL) >= 7) {
+                __cpuid_count(7, 0, a, b, c, d);
+                ok = b & bit_AVX2;
+            }
+        }
+        avx2 = ok;
+    }
+    return avx2;
+}
+
+#define VECMATH(f, ...) (have_avx2() ? f##_avx2(__VA_ARGS__) : f##_sse2(__VA_ARGS__))
+#elif defined(__aarch64__)
+#define VECMATH(f, ...) f##_neon(__VA_ARGS__)
+#endif
+
+#ifdef VECMATH
+
+void vexpf(float* y, const float* x, size_t n) {
+    VECMATH(vexpf, y, x, n);
+}
+
+void vlogf(float* y, const float* x, size_t n) {
+    VECMATH(vlogf, y, x, n);
+}
+
+void vsinf(float* y, const float* x, size_t n) {
+    VECMATH(vsinf, y, x, n);
+}
+
+void vcosf(float* y, const float* x, size_t n) {
+    VECMATH(vcosf, y, x, n);
+}
+
+void vpowf(float* z, const float* x, const float* y, size_t n) {
+    VECMATH(vpowf, z, x, y, n);
+}
+
+#else // no vector unit to use
+
+void vexpf(float* y, const float* x, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] = expf(x[i]);
+}
+
+void vlogf(float* y, const float* x, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] = logf(x[i]);
+}
+
+void vsinf(float* y, const float* x, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] = sinf(x[i]);
+}
+
+void vcosf(float* y, const float* x, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] = cosf(x[i]);
+}
+
+void vpowf(float* z, const float* x, const float* y, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        z[i] = powf(x[i], y[i]);
+}
+
+#endif
@@ -0,0 +1,152 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <async/loop.h>
+#include <magenta/syscalls.h>
+#include <runtime/completion.h>
+#include <unittest/unittest.h>
+
+typedef struct {
+    int calls;
+    uint32_t bytes;
+    bool closed;
+} pipe_state_t;
+
+static void pipe_cb(async_loop_t* loop, void* cookie, mx_handle_t h, mx_signals_t signals) {
+    pipe_state_t* state = cookie;
+    state->calls++;
+
+    // drain the pipe, the binding being edge triggered
+    if (signals & MX_SIGNAL_READABLE) {
+        char buf[64];
+        uint32_t num_bytes = sizeof(buf);
+        while (mx_message_read(h, buf, &num_bytes, NULL, NULL, 0u) == NO_ERROR) {
+            state->bytes += num_bytes;
+            num_bytes = sizeof(buf);
+        }
+    }
+    if (signals & MX_SIGNAL_PEER_CLOSED) {
+        state->closed = true;
+        async_loop_quit(loop);
+    }
+}
+
+static bool handle_test(void) {
+    BEGIN_TEST;
+
+    async_loop_t* loop;
+    ASSERT_EQ(async_loop_create(&loop), NO_ERROR, "");
+
+    mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0u), NO_ERROR, "");
+
+    pipe_state_t state = {0};
+    async_id_t id;
+    EXPECT_EQ(async_loop_add_handle(loop, pipe[0], MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                    pipe_cb, &state, &id), NO_ERROR, "");
+
+    EXPECT_EQ(mx_message_write(pipe[1], "hello", 5u, NULL, 0u, 0u), NO_ERROR, "");
+    EXPECT_EQ(mx_message_write(pipe[1], "world", 5u, NULL, 0u, 0u), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+
+    EXPECT_EQ(async_loop_run(loop), NO_ERROR, "");
+    EXPECT_GT(state.calls, 0, "handler not called");
+    EXPECT_EQ(state.bytes, 10u, "messages not all read");
+    EXPECT_TRUE(state.closed, "close not seen");
+
+    EXPECT_EQ(async_loop_remove(loop, id), NO_ERROR, "");
+    EXPECT_EQ(async_loop_remove(loop, id), ERR_NOT_FOUND, "removed twice");
+
+    async_loop_destroy(loop);
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+
+    END_TEST;
+}
+
+typedef struct {
+    int calls;
+    int quit_after;
+} timer_state_t;
+
+static void timer_cb(async_loop_t* loop, void* cookie) {
+    timer_state_t* state = cookie;
+    if (++state->calls == state->quit_after) {
+        async_loop_quit(loop);
+    }
+}
+
+static bool timer_test(void) {
+    BEGIN_TEST;
+
+    async_loop_t* loop;
+    ASSERT_EQ(async_loop_create(&loop), NO_ERROR, "");
+
+    // a one-shot timer is gone once it has fired
+    timer_state_t oneshot = {0, 1};
+    async_id_t id;
+    EXPECT_EQ(async_loop_add_timer(loop, 1000000u, 0u, 0u, timer_cb, &oneshot, &id),
+              NO_ERROR, "");
+    EXPECT_EQ(async_loop_run(loop), NO_ERROR, "");
+    EXPECT_EQ(oneshot.calls, 1, "");
+    EXPECT_EQ(async_loop_remove(loop, id), ERR_NOT_FOUND, "one-shot timer kept");
+    async_loop_destroy(loop);
+
+    ASSERT_EQ(async_loop_create(&loop), NO_ERROR, "");
+    timer_state_t periodic = {0, 3};
+    EXPECT_EQ(async_loop_add_timer(loop, 0u, 1000000u, 0u, timer_cb, &periodic, &id),
+              NO_ERROR, "");
+    EXPECT_EQ(async_loop_run(loop), NO_ERROR, "");
+    EXPECT_EQ(periodic.calls, 3, "");
+    EXPECT_EQ(async_loop_remove(loop, id), NO_ERROR, "periodic timer gone");
+    async_loop_destroy(loop);
+
+    END_TEST;
+}
+
+#define TASKS 100
+
+typedef struct {
+    int done;
+    mxr_completion_t completion;
+} task_state_t;
+
+static void task_cb(async_loop_t* loop, void* cookie) {
+    task_state_t* state = cookie;
+    if (__atomic_add_fetch(&state->done, 1, __ATOMIC_SEQ_CST) == TASKS) {
+        mxr_completion_signal(&state->completion);
+    }
+}
+
+static bool worker_pool_test(void) {
+    BEGIN_TEST;
+
+    async_loop_t* loop;
+    ASSERT_EQ(async_loop_create(&loop), NO_ERROR, "");
+    EXPECT_EQ(async_loop_start_threads(loop, 4u, "async-test"), NO_ERROR, "");
+    EXPECT_EQ(async_loop_start_threads(loop, 1u, "async-test"), ERR_BAD_STATE, "started twice");
+
+    task_state_t state = {0, MXR_COMPLETION_INIT};
+    for (int i = 0; i < TASKS; i++) {
+        EXPECT_EQ(async_loop_post(loop, task_cb, &state), NO_ERROR, "");
+    }
+    EXPECT_EQ(mxr_completion_wait(&state.completion, MX_TIME_INFINITE), NO_ERROR, "");
+    EXPECT_EQ(state.done, TASKS, "");
+
+    // joins the threads
+    async_loop_destroy(loop);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(async_tests)
+RUN_TEST(handle_test)
+RUN_TEST(timer_test)
+RUN_TEST(worker_pool_test)
+END_TEST_CASE(async_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
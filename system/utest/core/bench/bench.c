@@ -0,0 +1,414 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <magenta/syscalls.h>
+#include <runtime/thread.h>
+
+// Microbenchmarks of the IPC primitives the core tests cover.
+//
+// Each one runs either with both ends driven by the one thread ("local"),
+// which is the cost of the syscalls alone, or with the other end on a
+// second thread ("remote"), which adds the wakeup and, with more than one
+// cpu, the trip to wherever the scheduler put it.
+//
+// One line of comma separated values per run, after a header line:
+//   name,mode,size,handles,iterations,ns_per_op,mb_per_s
+
+static uint32_t iterations = 10000;
+
+static mx_handle_t events[8];
+
+static void fail(const char* what, mx_status_t status) {
+    printf("core-bench: %s failed (%d)\n", what, status);
+    exit(1);
+}
+
+static void report(const char* name, bool remote, uint32_t size, uint32_t handles, mx_time_t t) {
+    uint64_t bytes = (uint64_t)size * iterations;
+    printf("%s,%s,%u,%u,%u,%llu,%llu\n", name, remote ? "remote" : "local", size, handles,
+           iterations, (unsigned long long)(t / iterations),
+           (unsigned long long)((bytes * 1000) / (t ? t : 1)));
+}
+
+static void wait_for(mx_handle_t h, mx_signals_t signals) {
+    mx_status_t status = mx_handle_wait_one(h, signals, MX_TIME_INFINITE, NULL);
+    if (status < 0) {
+        fail("wait", status);
+    }
+}
+
+static mxr_thread_t* start(mxr_thread_entry_t entry, void* arg) {
+    mxr_thread_t* thread;
+    mx_status_t status = mxr_thread_create(entry, arg, "core-bench", &thread);
+    if (status < 0) {
+        fail("thread create", status);
+    }
+    return thread;
+}
+
+static void join(mxr_thread_t* thread) {
+    if (thread) {
+        mxr_thread_join(thread, NULL);
+    }
+}
+
+// message pipes: a message out and the same back, handles included
+
+typedef struct {
+    mx_handle_t pipe;
+    uint32_t size;
+    uint32_t handles;
+    uint8_t* buffer;
+} msg_args_t;
+
+static void msg_recv(mx_handle_t pipe, msg_args_t* args, mx_handle_t* handles) {
+    uint32_t size = args->size;
+    uint32_t count = args->handles;
+    wait_for(pipe, MX_SIGNAL_READABLE);
+    mx_status_t status = mx_message_read(pipe, args->buffer, &size, handles, &count, 0);
+    if (status < 0) {
+        fail("message read", status);
+    }
+}
+
+static void msg_send(mx_handle_t pipe, msg_args_t* args, mx_handle_t* handles) {
+    mx_status_t status = mx_message_write(pipe, args->buffer, args->size, handles, args->handles, 0);
+    if (status < 0) {
+        fail("message write", status);
+    }
+}
+
+static int msg_echo(void* arg) {
+    msg_args_t* args = arg;
+    mx_handle_t handles[countof(events)];
+    for (uint32_t i = 0; i < iterations; i++) {
+        msg_recv(args->pipe, args, handles);
+        msg_send(args->pipe, args, handles);
+    }
+    return 0;
+}
+
+static void bench_msgpipe(bool remote, uint32_t size, uint32_t handles) {
+    mx_handle_t pipe[2];
+    mx_status_t status = mx_message_pipe_create(pipe, 0);
+    if (status < 0) {
+        fail("message pipe create", status);
+    }
+    mx_handle_t hv[countof(events)];
+    memcpy(hv, events, sizeof(hv));
+
+    msg_args_t mine = {pipe[0], size, handles, malloc(size + 1)};
+    msg_args_t theirs = {pipe[1], size, handles, malloc(size + 1)};
+    if (!mine.buffer || !theirs.buffer) {
+        fail("buffer alloc", ERR_NO_MEMORY);
+    }
+    memset(mine.buffer, 0x5a, size);
+
+    mxr_thread_t* thread = remote ? start(msg_echo, &theirs) : NULL;
+    mx_time_t t = mx_current_time();
+    for (uint32_t i = 0; i < iterations; i++) {
+        msg_send(pipe[0], &mine, hv);
+        if (!remote) {
+            msg_recv(pipe[1], &theirs, hv);
+            msg_send(pipe[1], &theirs, hv);
+        }
+        msg_recv(pipe[0], &mine, hv);
+    }
+    report("msgpipe", remote, size, handles, mx_current_time() - t);
+    join(thread);
+
+    // the handles came back to us, possibly renumbered
+    memcpy(events, hv, sizeof(hv));
+    mx_handle_close(pipe[0]);
+    mx_handle_close(pipe[1]);
+    free(mine.buffer);
+    free(theirs.buffer);
+}
+
+// data pipes: one way throughput, in chunks of size
+
+#define DATA_PIPE_CAPACITY (64u * 1024u)
+
+typedef struct {
+    mx_handle_t consumer;
+    uint32_t size;
+    uint64_t total;
+} data_args_t;
+
+// returns how much was moved, zero if the pipe has to be waited on
+static mx_size_t data_write(mx_handle_t producer, const void* buffer, mx_size_t size) {
+    mx_ssize_t r = mx_data_pipe_write(producer, 0, size, buffer);
+    if (r == ERR_NOT_READY) {
+        return 0;
+    }
+    if (r < 0) {
+        fail("data pipe write", r);
+    }
+    return r;
+}
+
+static mx_size_t data_read(mx_handle_t consumer, void* buffer, mx_size_t size) {
+    mx_ssize_t r = mx_data_pipe_read(consumer, 0, size, buffer);
+    if (r == ERR_NOT_READY) {
+        return 0;
+    }
+    if (r < 0) {
+        fail("data pipe read", r);
+    }
+    return r;
+}
+
+static int data_drain(void* arg) {
+    data_args_t* args = arg;
+    uint8_t* buffer = malloc(args->size);
+    for (uint64_t moved = 0; moved < args->total;) {
+        mx_size_t r = data_read(args->consumer, buffer, args->size);
+        if (r == 0) {
+            wait_for(args->consumer, MX_SIGNAL_READABLE);
+        }
+        moved += r;
+    }
+    free(buffer);
+    return 0;
+}
+
+static void bench_datapipe(bool remote, uint32_t size) {
+    mx_handle_t consumer;
+    mx_handle_t producer = mx_data_pipe_create(0, 1, DATA_PIPE_CAPACITY, &consumer);
+    if (producer < 0) {
+        fail("data pipe create", producer);
+    }
+    uint8_t* buffer = malloc(size);
+    if (!buffer) {
+        fail("buffer alloc", ERR_NO_MEMORY);
+    }
+    memset(buffer, 0x5a, size);
+
+    data_args_t args = {consumer, size, (uint64_t)size * iterations};
+    mxr_thread_t* thread = remote ? start(data_drain, &args) : NULL;
+    mx_time_t t = mx_current_time();
+    for (uint64_t moved = 0; moved < args.total;) {
+        mx_size_t r = data_write(producer, buffer, size);
+        if (!remote) {
+            // a chunk never overfills the pipe, so it's all there
+            data_read(consumer, buffer, r);
+        } else if (r == 0) {
+            wait_for(producer, MX_SIGNAL_WRITABLE);
+        }
+        moved += r;
+    }
+    join(thread);
+    report("datapipe", remote, size, 0, mx_current_time() - t);
+
+    mx_handle_close(producer);
+    mx_handle_close(consumer);
+    free(buffer);
+}
+
+// io ports: a packet queued and one back on a second port
+
+typedef struct {
+    mx_packet_header_t hdr;
+    uint64_t param[4];
+} user_packet_t;
+
+static void port_pass(mx_handle_t from, mx_handle_t to) {
+    user_packet_t pkt;
+    mx_status_t status = mx_io_port_wait(from, MX_TIME_INFINITE, &pkt, sizeof(pkt));
+    if (status < 0) {
+        fail("io port wait", status);
+    }
+    if ((status = mx_io_port_queue(to, &pkt, sizeof(pkt))) < 0) {
+        fail("io port queue", status);
+    }
+}
+
+static mx_handle_t ports[2];
+
+static int port_echo(void* arg) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        port_pass(ports[0], ports[1]);
+    }
+    return 0;
+}
+
+static void bench_ioport(bool remote) {
+    for (int i = 0; i < 2; i++) {
+        if ((ports[i] = mx_io_port_create(0)) < 0) {
+            fail("io port create", ports[i]);
+        }
+    }
+    user_packet_t pkt = {{1, 0, 0}, {0}};
+
+    mxr_thread_t* thread = remote ? start(port_echo, NULL) : NULL;
+    mx_time_t t = mx_current_time();
+    for (uint32_t i = 0; i < iterations; i++) {
+        mx_status_t status = mx_io_port_queue(ports[0], &pkt, sizeof(pkt));
+        if (status < 0) {
+            fail("io port queue", status);
+        }
+        if (!remote) {
+            port_pass(ports[0], ports[1]);
+        }
+        if ((status = mx_io_port_wait(ports[1], MX_TIME_INFINITE, &pkt, sizeof(pkt))) < 0) {
+            fail("io port wait", status);
+        }
+    }
+    report("ioport", remote, sizeof(pkt), 0, mx_current_time() - t);
+    join(thread);
+
+    mx_handle_close(ports[0]);
+    mx_handle_close(ports[1]);
+}
+
+// events: one signalled, the other back; straight or through a wait set
+
+typedef struct {
+    mx_handle_t event[2];
+    mx_handle_t wait_set[2];
+} signal_args_t;
+
+static void signal_wait(signal_args_t* args, int which) {
+    if (args->wait_set[which] != MX_HANDLE_INVALID) {
+        mx_wait_set_result_t result;
+        uint32_t num_results = 1;
+        uint32_t max_results;
+        mx_status_t status = mx_wait_set_wait(args->wait_set[which], MX_TIME_INFINITE,
+                                              &num_results, &result, &max_results);
+        if (status < 0) {
+            fail("wait set wait", status);
+        }
+    } else {
+        wait_for(args->event[which], MX_SIGNAL_SIGNALED);
+    }
+    mx_event_reset(args->event[which]);
+}
+
+static int signal_echo(void* arg) {
+    signal_args_t* args = arg;
+    for (uint32_t i = 0; i < iterations; i++) {
+        signal_wait(args, 0);
+        mx_event_signal(args->event[1]);
+    }
+    return 0;
+}
+
+static void bench_signal(const char* name, bool remote, bool wait_set) {
+    signal_args_t args = {};
+    for (int i = 0; i < 2; i++) {
+        if ((args.event[i] = mx_event_create(0)) < 0) {
+            fail("event create", args.event[i]);
+        }
+        if (!wait_set) {
+            continue;
+        }
+        if ((args.wait_set[i] = mx_wait_set_create()) < 0) {
+            fail("wait set create", args.wait_set[i]);
+        }
+        mx_status_t status = mx_wait_set_add(args.wait_set[i], args.event[i], MX_SIGNAL_SIGNALED, i);
+        if (status < 0) {
+            fail("wait set add", status);
+        }
+    }
+
+    mxr_thread_t* thread = remote ? start(signal_echo, &args) : NULL;
+    mx_time_t t = mx_current_time();
+    for (uint32_t i = 0; i < iterations; i++) {
+        mx_event_signal(args.event[0]);
+        if (!remote) {
+            signal_wait(&args, 0);
+            mx_event_signal(args.event[1]);
+        }
+        signal_wait(&args, 1);
+    }
+    report(name, remote, 0, 0, mx_current_time() - t);
+    join(thread);
+
+    for (int i = 0; i < 2; i++) {
+        mx_handle_close(args.event[i]);
+        if (wait_set) {
+            mx_handle_close(args.wait_set[i]);
+        }
+    }
+}
+
+// futexes: a word flipped and handed over each way
+
+static int futex_word;
+
+static void futex_await(int value) {
+    int current;
+    while ((current = __atomic_load_n(&futex_word, __ATOMIC_ACQUIRE)) != value) {
+        mx_futex_wait(&futex_word, current, MX_TIME_INFINITE);
+    }
+}
+
+static void futex_set(int value) {
+    __atomic_store_n(&futex_word, value, __ATOMIC_RELEASE);
+    mx_futex_wake(&futex_word, 1);
+}
+
+static int futex_echo(void* arg) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        futex_await(1);
+        futex_set(0);
+    }
+    return 0;
+}
+
+static void bench_futex(bool remote) {
+    futex_word = 0;
+
+    mxr_thread_t* thread = remote ? start(futex_echo, NULL) : NULL;
+    mx_time_t t = mx_current_time();
+    for (uint32_t i = 0; i < iterations; i++) {
+        futex_set(1);
+        if (!remote) {
+            futex_set(0);
+        }
+        futex_await(0);
+    }
+    report("futex", remote, sizeof(futex_word), 0, mx_current_time() - t);
+    join(thread);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 0);
+        if (iterations == 0) {
+            printf("usage: core-bench [iterations]\n");
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < countof(events); i++) {
+        if ((events[i] = mx_event_create(0)) < 0) {
+            fail("event create", events[i]);
+        }
+    }
+
+    printf("name,mode,size,handles,iterations,ns_per_op,mb_per_s\n");
+    for (int remote = 0; remote < 2; remote++) {
+        static const uint32_t sizes[] = {0, 64, 1024, 4096, 65536};
+        for (size_t i = 0; i < countof(sizes); i++) {
+            bench_msgpipe(remote, sizes[i], 0);
+        }
+        bench_msgpipe(remote, 64, 1);
+        bench_msgpipe(remote, 64, countof(events));
+
+        static const uint32_t chunks[] = {64, 4096, 32768};
+        for (size_t i = 0; i < countof(chunks); i++) {
+            bench_datapipe(remote, chunks[i]);
+        }
+
+        bench_ioport(remote);
+        bench_signal("event", remote, false);
+        bench_signal("waitset", remote, true);
+        bench_futex(remote);
+    }
+    return 0;
+}
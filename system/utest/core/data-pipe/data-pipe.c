@@ -434,6 +434,222 @@ static bool consumer_signals_when_producer_closed(void) {
     END_TEST;
 }
 
+// One end of a data pipe with shared cursors, as mapped by mx_data_pipe_map().
+typedef struct shared_end {
+    mx_handle_t handle;
+    uint8_t* buffer;
+    mx_data_pipe_control_t* control;
+    mx_size_t size;
+} shared_end_t;
+
+#define SHARED_TOTAL KB_(256)
+
+static uint8_t shared_byte(uint64_t offset) {
+    return (uint8_t)(offset * 7u + (offset >> 8));
+}
+
+// Wait until |count| moves away from |seen|, setting |waiting| so the other
+// end knows to sync for us.
+static void shared_wait(shared_end_t* end, volatile uint64_t* count, uint64_t seen,
+                        volatile uint32_t* waiting, mx_signals_t signal) {
+    __atomic_store_n(waiting, 1u, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(count, __ATOMIC_SEQ_CST) != seen)
+        return;
+    mx_data_pipe_sync(end->handle);
+    mx_handle_wait_one(end->handle, signal | MX_SIGNAL_PEER_CLOSED, MX_TIME_INFINITE, NULL);
+}
+
+// Publish a new |count|, and sync for the other end if it is waiting on it.
+static void shared_publish(shared_end_t* end, volatile uint64_t* count, uint64_t value,
+                           volatile uint32_t* waiting) {
+    __atomic_store_n(count, value, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(waiting, 0u, __ATOMIC_SEQ_CST))
+        mx_data_pipe_sync(end->handle);
+}
+
+static int shared_producer_thread(void* arg) {
+    shared_end_t* end = (shared_end_t*)arg;
+    mx_data_pipe_control_t* control = end->control;
+
+    uint64_t written = 0u;
+    while (written < SHARED_TOTAL) {
+        uint64_t read = __atomic_load_n(&control->read_count, __ATOMIC_ACQUIRE);
+        uint64_t room = end->size - (written - read);
+        if (room == 0u) {
+            shared_wait(end, &control->read_count, read, &control->producer_waiting,
+                        MX_SIGNAL_WRITABLE);
+            continue;
+        }
+
+        // odd sized chunks so that they straddle the end of the ring
+        uint64_t n = room < 1000u ? room : 1000u;
+        if (n > SHARED_TOTAL - written)
+            n = SHARED_TOTAL - written;
+        for (uint64_t i = 0; i < n; i++)
+            end->buffer[(written + i) % end->size] = shared_byte(written + i);
+        written += n;
+
+        shared_publish(end, &control->write_count, written, &control->consumer_waiting);
+    }
+    mx_thread_exit();
+}
+
+static bool shared_cursors_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t consumer;
+    mx_handle_t producer = mx_data_pipe_create(MX_DATA_PIPE_SHARED_CURSORS, 1u, KB_(4),
+                                               &consumer);
+    ASSERT_GT(producer, 0, "could not create data pipe producer");
+
+    char buffer[16];
+    EXPECT_EQ(mx_data_pipe_write(producer, 0u, 10u, "0123456789"), ERR_BAD_STATE,
+              "the ring is driven from user space");
+    EXPECT_EQ(mx_data_pipe_read(consumer, 0u, sizeof(buffer), buffer), ERR_BAD_STATE, "");
+
+    static shared_end_t producer_end, consumer_end;
+    uintptr_t ring, control;
+    mx_ssize_t size = mx_data_pipe_map(producer, 0u, &ring, &control);
+    ASSERT_EQ(size, KB_(4), "failed to map producer");
+    producer_end = (shared_end_t){ producer, (uint8_t*)ring, (mx_data_pipe_control_t*)control,
+                                   (mx_size_t)size };
+    size = mx_data_pipe_map(consumer, 0u, &ring, &control);
+    ASSERT_EQ(size, KB_(4), "failed to map consumer");
+    consumer_end = (shared_end_t){ consumer, (uint8_t*)ring, (mx_data_pipe_control_t*)control,
+                                   (mx_size_t)size };
+
+    const char* name = "shared producer";
+    mx_handle_t thread = mx_thread_create(shared_producer_thread, &producer_end, name,
+                                          strlen(name) + 1);
+    ASSERT_GT(thread, 0, "thread_create");
+
+    mx_data_pipe_control_t* ctl = consumer_end.control;
+    uint64_t consumed = 0u;
+    bool match = true;
+    while (consumed < SHARED_TOTAL) {
+        uint64_t available = __atomic_load_n(&ctl->write_count, __ATOMIC_ACQUIRE) - consumed;
+        if (available == 0u) {
+            shared_wait(&consumer_end, &ctl->write_count, consumed, &ctl->consumer_waiting,
+                        MX_SIGNAL_READABLE);
+            continue;
+        }
+
+        for (uint64_t i = 0; i < available; i++) {
+            if (consumer_end.buffer[(consumed + i) % consumer_end.size] !=
+                shared_byte(consumed + i))
+                match = false;
+        }
+        consumed += available;
+
+        shared_publish(&consumer_end, &ctl->read_count, consumed, &ctl->producer_waiting);
+    }
+    EXPECT_TRUE(match, "data came through wrong");
+
+    EXPECT_EQ(mx_handle_wait_one(thread, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL),
+              NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(thread), NO_ERROR, "");
+
+    // once synced the kernel's idea of the ring matches the cursors
+    EXPECT_EQ(mx_data_pipe_sync(consumer), NO_ERROR, "");
+    EXPECT_EQ(get_satisfied_signals(consumer), 0u, "ring should be empty");
+    EXPECT_EQ(get_satisfied_signals(producer), MX_SIGNAL_WRITABLE, "ring should have room");
+
+    EXPECT_EQ(mx_handle_close(producer), NO_ERROR, "");
+    EXPECT_EQ(mx_data_pipe_sync(consumer), ERR_CHANNEL_CLOSED, "producer is gone");
+    EXPECT_EQ(mx_handle_close(consumer), NO_ERROR, "");
+
+    // a plain data pipe has nothing to map
+    producer = mx_data_pipe_create(0u, 1u, KB_(4), &consumer);
+    ASSERT_GT(producer, 0, "could not create data pipe producer");
+    EXPECT_EQ(mx_data_pipe_map(producer, 0u, &ring, &control), ERR_BAD_STATE, "");
+    EXPECT_EQ(mx_data_pipe_sync(consumer), ERR_BAD_STATE, "");
+    EXPECT_EQ(mx_handle_close(producer), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(consumer), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static uint8_t vec_out[KB_(4)];
+static uint8_t vec_in[KB_(4)];
+
+static bool vectored_elements_test(void) {
+    BEGIN_TEST;
+    mx_handle_t producer;
+    mx_handle_t consumer;
+
+    // the capacity has to be whole elements
+    producer = mx_data_pipe_create(0u, 0u, 120u, &consumer);
+    EXPECT_EQ(producer, ERR_INVALID_ARGS, "");
+    producer = mx_data_pipe_create(0u, 12u, 100u, &consumer);
+    EXPECT_EQ(producer, ERR_INVALID_ARGS, "");
+
+    // a 4k ring of 12-byte elements holds 341 of them
+    producer = mx_data_pipe_create(0u, 12u, 120u, &consumer);
+    ASSERT_GT(producer, 0, "could not create data pipe producer");
+
+    fill_region(vec_out, sizeof(vec_out), 7u);
+    EXPECT_EQ(mx_data_pipe_write(producer, 0u, 10u, vec_out), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_data_pipe_write(producer, 0u, 4092u, vec_out), 4092, "");
+    EXPECT_EQ(mx_data_pipe_write(producer, 0u, 12u, vec_out), ERR_NOT_READY, "");
+
+    // move both cursors to 12 bytes before the end of the ring
+    EXPECT_EQ(mx_data_pipe_read(consumer, 0u, 4080u, vec_in), 4080, "");
+    EXPECT_EQ(mx_data_pipe_read(consumer, 0u, 12u, vec_in), 12, "");
+    EXPECT_EQ(mx_data_pipe_write(producer, 0u, 4080u, vec_out), 4080, "");
+    EXPECT_EQ(mx_data_pipe_read(consumer, 0u, 4080u, vec_in), 4080, "");
+
+    // buffers that don't add up to whole elements
+    mx_iovec_t iov[3] = {
+        {vec_out, 10u},
+        {vec_out + 10, 1u},
+    };
+    EXPECT_EQ(mx_data_pipe_writev(producer, 0u, iov, 2u), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_data_pipe_writev(producer, 0u, iov, 0u), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_data_pipe_writev(producer, 2u, iov, 2u), ERR_INVALID_ARGS, "");
+
+    // the first buffer goes round the end of the ring
+    iov[0].buffer = vec_out;
+    iov[0].size = 24u;
+    iov[1].buffer = vec_out + 24;
+    iov[1].size = 24u;
+    EXPECT_EQ(mx_data_pipe_writev(producer, 0u, iov, 2u), 48, "");
+
+    memset(vec_in, 0, sizeof(vec_in));
+    iov[0].buffer = vec_in;
+    iov[0].size = 12u;
+    iov[1].buffer = vec_in + 12;
+    iov[1].size = 30u;
+    iov[2].buffer = vec_in + 42;
+    iov[2].size = 6u;
+    EXPECT_EQ(mx_data_pipe_readv(consumer, 0u, iov, 3u), 48, "");
+    EXPECT_TRUE(test_region(vec_in, 48u, 7u), "");
+    EXPECT_EQ(mx_data_pipe_readv(consumer, 0u, iov, 3u), ERR_NOT_READY, "");
+
+    // with ALL_OR_NONE a write that doesn't fit moves nothing
+    EXPECT_EQ(mx_data_pipe_write(producer, 0u, 4080u, vec_out), 4080, "");
+    iov[0].buffer = vec_out;
+    iov[0].size = 12u;
+    iov[1].buffer = vec_out + 12;
+    iov[1].size = 12u;
+    EXPECT_EQ(mx_data_pipe_writev(producer, MX_DATA_PIPE_ALL_OR_NONE, iov, 2u),
+              ERR_NOT_READY, "");
+    EXPECT_EQ(mx_data_pipe_writev(producer, 0u, iov, 2u), 12, "");
+
+    // and the same going the other way
+    iov[0].buffer = vec_in;
+    iov[0].size = 4092u;
+    iov[1].buffer = vec_in;
+    iov[1].size = 12u;
+    EXPECT_EQ(mx_data_pipe_readv(consumer, MX_DATA_PIPE_ALL_OR_NONE, iov, 2u),
+              ERR_NOT_READY, "");
+    EXPECT_EQ(mx_data_pipe_readv(consumer, MX_DATA_PIPE_ALL_OR_NONE, iov, 1u), 4092, "");
+    EXPECT_TRUE(test_region(vec_in, 4080u, 7u), "");
+
+    EXPECT_EQ(mx_handle_close(producer), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(consumer), NO_ERROR, "");
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(data_pipe_tests)
 RUN_TEST(create_destroy_test)
 RUN_TEST(simple_read_write)
@@ -444,6 +660,8 @@ RUN_TEST(begin_write_read_large_request)
 RUN_TEST(loop_write_read)
 RUN_TEST(loop_begin_write_read)
 RUN_TEST(consumer_signals_when_producer_closed)
+RUN_TEST(shared_cursors_test)
+RUN_TEST(vectored_elements_test)
 END_TEST_CASE(data_pipe_tests)
 
 #ifndef BUILD_COMBINED_TESTS
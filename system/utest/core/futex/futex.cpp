@@ -399,6 +399,133 @@ static int signal_thread3(void* arg) {
     return 0;
 }
 
+static bool test_futex_wait_pi_bad_owner() {
+    BEGIN_TEST;
+    int futex_value = 0;
+    mx_status_t rc = mx_futex_wait_pi(&futex_value, futex_value, 0);
+    ASSERT_EQ(rc, ERR_BAD_HANDLE, "PI futex wait without an owner should fail");
+
+    // Waiting on a futex we own ourselves would never return.
+    futex_value = mxr_thread_get_handle(NULL);
+    rc = mx_futex_wait_pi(&futex_value, futex_value, MX_TIME_INFINITE);
+    ASSERT_EQ(rc, ERR_INVALID_ARGS, "PI futex wait on ourselves should fail");
+
+    // Lending priority needs a handle with the read right.
+    mx_handle_t owner = mx_handle_duplicate(mxr_thread_get_handle(NULL), MX_RIGHT_TRANSFER);
+    ASSERT_GT(owner, 0, "Error duplicating thread handle");
+    futex_value = owner;
+    rc = mx_futex_wait_pi(&futex_value, futex_value, 0);
+    EXPECT_EQ(rc, ERR_ACCESS_DENIED, "PI futex wait without the read right should fail");
+    EXPECT_EQ(mx_handle_close(owner), NO_ERROR, "Error closing thread handle");
+    END_TEST;
+}
+
+struct PiWaiter {
+    volatile int* futex_addr;
+    int owner_value;
+    mx_time_t timeout;
+    volatile bool about_to_wait;
+    mx_status_t result;
+};
+
+static int pi_waiter_thread(void* arg) {
+    PiWaiter* waiter = reinterpret_cast<PiWaiter*>(arg);
+    waiter->about_to_wait = true;
+    waiter->result = mx_futex_wait_pi(const_cast<int*>(waiter->futex_addr),
+                                      waiter->owner_value, waiter->timeout);
+    return 0;
+}
+
+// Check that PI futex waits are woken by futex_wake() and time out like
+// ordinary futex waits, with the current thread as the owner.
+static bool test_futex_wait_pi() {
+    BEGIN_TEST;
+    volatile int futex_value = mxr_thread_get_handle(NULL) | MX_FUTEX_PI_WAITERS;
+
+    for (int i = 0; i < 2; i++) {
+        bool timed = (i == 1);
+        PiWaiter waiter = {&futex_value, futex_value,
+                           timed ? 100 * 1000 * 1000 : MX_TIME_INFINITE, false, ERR_BAD_STATE};
+        mxr_thread_t* thread;
+        ASSERT_EQ(mxr_thread_create(pi_waiter_thread, &waiter, "pi_waiter", &thread), NO_ERROR,
+                  "Error during thread creation");
+        while (!waiter.about_to_wait) {
+            sched_yield();
+        }
+        struct timespec wait_time = {0, 200 * 1000000 /* nanoseconds */};
+        EXPECT_EQ(nanosleep(&wait_time, NULL), 0, "Error in nanosleep");
+
+        if (!timed) {
+            EXPECT_EQ(mx_futex_wake(const_cast<int*>(&futex_value), 1), NO_ERROR,
+                      "error during futex wake");
+        }
+        EXPECT_EQ(mxr_thread_join(thread, NULL), NO_ERROR, "Error during join");
+        EXPECT_EQ(waiter.result, timed ? ERR_TIMED_OUT : NO_ERROR, "wrong PI wait result");
+    }
+    END_TEST;
+}
+
+struct SharedWaiter {
+    int* futex_addr;
+    volatile bool about_to_wait;
+    mx_status_t result;
+};
+
+static int shared_waiter_thread(void* arg) {
+    SharedWaiter* waiter = reinterpret_cast<SharedWaiter*>(arg);
+    waiter->about_to_wait = true;
+    waiter->result = mx_futex_wait_shared(waiter->futex_addr, 0, MX_TIME_INFINITE);
+    return 0;
+}
+
+// Check that shared futexes are named by the vm object they live in rather
+// than by their address: a wait through one mapping of a vmo is woken through
+// another.
+static bool test_futex_shared() {
+    BEGIN_TEST;
+    const size_t len = 4096u;
+    mx_handle_t vmo = mx_vm_object_create(len);
+    ASSERT_GT(vmo, 0, "vm_object_create");
+
+    uintptr_t map_a;
+    uintptr_t map_b;
+    ASSERT_EQ(mx_process_vm_map(0, vmo, 0, len, &map_a,
+                                MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE), NO_ERROR, "vm_map");
+    ASSERT_EQ(mx_process_vm_map(0, vmo, 0, len, &map_b,
+                                MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE), NO_ERROR, "vm_map");
+    ASSERT_NEQ(map_a, map_b, "mappings should differ");
+
+    int* futex_a = reinterpret_cast<int*>(map_a + 64);
+    int* futex_b = reinterpret_cast<int*>(map_b + 64);
+    *futex_a = 0;
+
+    EXPECT_EQ(mx_futex_wait_shared(futex_b, 1, MX_TIME_INFINITE), ERR_BUSY, "value mismatch");
+    EXPECT_EQ(mx_futex_wait_shared(futex_b, 0, 0), ERR_TIMED_OUT, "timeout");
+    EXPECT_EQ(mx_futex_wait_shared(nullptr, 0, 0), ERR_INVALID_ARGS, "null address");
+    EXPECT_EQ(mx_futex_wake_shared(reinterpret_cast<int*>(map_b + 65), 1), ERR_INVALID_ARGS,
+              "misaligned address");
+
+    SharedWaiter waiter = {futex_a, false, ERR_BAD_STATE};
+    mxr_thread_t* thread;
+    ASSERT_EQ(mxr_thread_create(shared_waiter_thread, &waiter, "shared_waiter", &thread),
+              NO_ERROR, "Error during thread creation");
+    while (!waiter.about_to_wait) {
+        sched_yield();
+    }
+    struct timespec wait_time = {0, 100 * 1000000 /* nanoseconds */};
+    EXPECT_EQ(nanosleep(&wait_time, NULL), 0, "Error in nanosleep");
+
+    *futex_b = 1;
+    EXPECT_EQ(mx_futex_wake_shared(futex_b, 1), NO_ERROR, "shared wake");
+    EXPECT_EQ(mxr_thread_join(thread, NULL), NO_ERROR, "Error during join");
+    EXPECT_EQ(waiter.result, NO_ERROR, "wrong shared wait result");
+
+    EXPECT_EQ(mx_process_vm_unmap(0, map_a, 0), NO_ERROR, "vm_unmap");
+    EXPECT_EQ(mx_process_vm_unmap(0, map_b, 0), NO_ERROR, "vm_unmap");
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "handle_close");
+    END_TEST;
+}
+
 static bool test_event_signalling() {
     BEGIN_TEST;
     mxr_thread_t *handle1, *handle2, *handle3;
@@ -437,6 +564,9 @@ RUN_TEST(test_futex_requeue_value_mismatch);
 RUN_TEST(test_futex_requeue_same_addr);
 RUN_TEST(test_futex_requeue);
 RUN_TEST(test_futex_requeue_unqueued_on_timeout);
+RUN_TEST(test_futex_wait_pi_bad_owner);
+RUN_TEST(test_futex_wait_pi);
+RUN_TEST(test_futex_shared);
 RUN_TEST(test_event_signalling);
 END_TEST_CASE(futex_tests)
 
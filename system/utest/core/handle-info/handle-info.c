@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <magenta/syscalls.h>
 #include <unittest/unittest.h>
@@ -85,8 +86,273 @@ bool handle_rights_test(void) {
     END_TEST;
 }
 
+bool handle_reuse_test(void) {
+    BEGIN_TEST;
+
+    // a closed handle's value must not resolve to whatever takes its place
+    mx_handle_t event = mx_event_create(0u);
+    EXPECT_GT(event, 0, "event_create");
+    EXPECT_EQ(mx_handle_close(event), NO_ERROR, "handle_close");
+
+    mx_handle_t reused = mx_event_create(0u);
+    EXPECT_GT(reused, 0, "event_create");
+    EXPECT_NEQ(reused, event, "closed value handed out again");
+    EXPECT_EQ(mx_handle_get_info(event, MX_INFO_HANDLE_VALID, NULL, 0u), ERR_BAD_HANDLE,
+              "stale value should be invalid");
+    EXPECT_EQ(mx_handle_close(reused), NO_ERROR, "handle_close");
+
+    // enough handles to grow the table a few times
+    enum { kCount = 1000 };
+    static mx_handle_t handles[kCount];
+    for (int i = 0; i < kCount; i++) {
+        handles[i] = mx_event_create(0u);
+        EXPECT_GT(handles[i], 0, "event_create");
+    }
+    for (int i = 0; i < kCount; i++) {
+        EXPECT_EQ(mx_handle_get_info(handles[i], MX_INFO_HANDLE_VALID, NULL, 0u), NO_ERROR,
+                  "handle should be valid");
+    }
+    for (int i = 0; i < kCount; i++)
+        EXPECT_EQ(mx_handle_close(handles[i]), NO_ERROR, "handle_close");
+    for (int i = 0; i < kCount; i++) {
+        EXPECT_EQ(mx_handle_get_info(handles[i], MX_INFO_HANDLE_VALID, NULL, 0u),
+                  ERR_BAD_HANDLE, "closed handle should be invalid");
+    }
+
+    END_TEST;
+}
+
+enum { kLookupThreads = 4 };
+
+static volatile mx_handle_t racing_handle;
+static volatile int racing_done;
+
+// Look up whatever racing_handle holds while the main thread closes and
+// recreates it. Every lookup must either fail cleanly or find the event.
+static int lookup_thread_func(void* arg) {
+    int* failures = arg;
+    while (!racing_done) {
+        mx_handle_basic_info_t info;
+        mx_status_t status = mx_handle_get_info(racing_handle, MX_INFO_HANDLE_BASIC,
+                                                &info, sizeof(info));
+        if (status == NO_ERROR) {
+            if (info.type != MX_OBJ_TYPE_EVENT)
+                ++*failures;
+        } else if (status != ERR_BAD_HANDLE) {
+            ++*failures;
+        }
+    }
+    mx_thread_exit();
+}
+
+bool handle_lookup_race_test(void) {
+    BEGIN_TEST;
+
+    racing_done = 0;
+    racing_handle = mx_event_create(0u);
+    ASSERT_GT(racing_handle, 0, "event_create");
+
+    static int failures[kLookupThreads];
+    mx_handle_t threads[kLookupThreads];
+    for (int i = 0; i < kLookupThreads; i++) {
+        const char* name = "lookup";
+        failures[i] = 0;
+        threads[i] = mx_thread_create(lookup_thread_func, &failures[i], name, strlen(name) + 1);
+        ASSERT_GT(threads[i], 0, "thread_create");
+    }
+
+    for (int i = 0; i < 10000; i++) {
+        mx_handle_t old = racing_handle;
+        racing_handle = mx_event_create(0u);
+        ASSERT_GT(racing_handle, 0, "event_create");
+        ASSERT_EQ(mx_handle_close(old), NO_ERROR, "handle_close");
+    }
+    racing_done = 1;
+
+    for (int i = 0; i < kLookupThreads; i++) {
+        ASSERT_EQ(mx_handle_wait_one(threads[i], MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL),
+                  NO_ERROR, "thread wait");
+        EXPECT_EQ(mx_handle_close(threads[i]), NO_ERROR, "handle_close");
+        EXPECT_EQ(failures[i], 0, "lookup saw a bad result");
+    }
+    EXPECT_EQ(mx_handle_close(racing_handle), NO_ERROR, "handle_close");
+
+    END_TEST;
+}
+
+bool handle_many_test(void) {
+    BEGIN_TEST;
+
+    enum { kCount = 64 };
+    static mx_handle_t events[kCount];
+    static mx_handle_t dups[kCount];
+    for (int i = 0; i < kCount; i++) {
+        events[i] = mx_event_create(0u);
+        ASSERT_GT(events[i], 0, "event_create");
+    }
+
+    EXPECT_EQ(mx_handle_duplicate_many(events, kCount, MX_RIGHT_READ, dups), NO_ERROR,
+              "handle_duplicate_many");
+    for (int i = 0; i < kCount; i++) {
+        mx_handle_basic_info_t info;
+        EXPECT_EQ(mx_handle_get_info(dups[i], MX_INFO_HANDLE_BASIC, &info, sizeof(info)),
+                  (mx_ssize_t)sizeof(info), "duplicate should be valid");
+        EXPECT_EQ(info.rights, (mx_rights_t)MX_RIGHT_READ, "wrong set of rights");
+    }
+
+    // all or nothing: a bad handle anywhere fails the whole batch
+    mx_handle_t bad[2] = {events[0], dups[0]};
+    mx_handle_t out[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
+    EXPECT_EQ(mx_handle_duplicate_many(bad, 2, MX_RIGHT_SAME_RIGHTS, out), ERR_ACCESS_DENIED,
+              "duplicate without MX_RIGHT_DUPLICATE");
+    EXPECT_EQ(out[0], MX_HANDLE_INVALID, "nothing should be returned");
+
+    EXPECT_EQ(mx_handle_close_many(dups, kCount), NO_ERROR, "handle_close_many");
+    for (int i = 0; i < kCount; i++) {
+        EXPECT_EQ(mx_handle_get_info(dups[i], MX_INFO_HANDLE_VALID, NULL, 0u),
+                  ERR_BAD_HANDLE, "closed handle should be invalid");
+    }
+
+    // invalid entries are skipped, stale ones are reported after the rest are closed
+    EXPECT_EQ(mx_handle_close(events[1]), NO_ERROR, "handle_close");
+    events[1] = MX_HANDLE_INVALID;
+    EXPECT_EQ(mx_handle_close_many(events, kCount), NO_ERROR, "handle_close_many");
+    EXPECT_EQ(mx_handle_close_many(events, kCount), ERR_BAD_HANDLE, "handles already closed");
+
+    END_TEST;
+}
+
+bool syscall_stats_test(void) {
+    BEGIN_TEST;
+
+    static mx_syscall_stats_t stats[512];
+    mx_handle_t event = mx_event_create(0u);
+    mx_ssize_t size = mx_handle_get_info(event, MX_INFO_SYSCALL_STATS, stats, sizeof(stats));
+    // only kernels built with SYSCALL_STATS keep these
+    if (size != ERR_NOT_SUPPORTED) {
+        ASSERT_GT(size, 0, "expected some stats");
+        EXPECT_EQ(size % sizeof(stats[0]), 0u, "partial record");
+
+        bool found = false;
+        for (mx_ssize_t i = 0; i < size / (mx_ssize_t)sizeof(stats[0]); i++) {
+            if (stats[i].count > 0u)
+                found = true;
+        }
+        EXPECT_TRUE(found, "event_create at least should be counted");
+    }
+    EXPECT_EQ(mx_handle_close(event), NO_ERROR, "handle_close");
+
+    END_TEST;
+}
+
+static int stats_thread_fn(void* arg) {
+    mx_handle_t event = *(mx_handle_t*)arg;
+    mx_handle_wait_one(event, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
+    mx_nanosleep(10 * 1000 * 1000);
+    mx_thread_exit();
+    return 0;
+}
+
+bool thread_stats_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t event = mx_event_create(0u);
+    ASSERT_GT(event, 0, "event_create");
+    const char name[] = "stats";
+    mx_handle_t thread = mx_thread_create(stats_thread_fn, &event, name, sizeof(name));
+    ASSERT_GT(thread, 0, "thread_create");
+
+    mx_nanosleep(10 * 1000 * 1000);
+    EXPECT_EQ(mx_event_signal(event), NO_ERROR, "signal");
+    ASSERT_EQ(mx_handle_wait_one(thread, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL), NO_ERROR,
+              "join");
+
+    mx_thread_stats_t stats;
+    ASSERT_EQ(mx_handle_get_info(thread, MX_INFO_THREAD_STATS, &stats, sizeof(stats)),
+              (mx_ssize_t)sizeof(stats), "thread stats");
+    EXPECT_GT(stats.handle_time, 0u, "waited on the event");
+    EXPECT_GT(stats.sleep_time, 0u, "slept");
+    EXPECT_GE(stats.blocked_time, stats.handle_time + stats.sleep_time, "blocked total");
+    EXPECT_GE(stats.context_switches, 2u, "switched out to wait and to sleep");
+
+    EXPECT_EQ(mx_handle_get_info(thread, MX_INFO_PROCESS_STATS, &stats, sizeof(stats)),
+              ERR_WRONG_TYPE, "not a process");
+    EXPECT_EQ(mx_handle_get_info(event, MX_INFO_THREAD_STATS, &stats, sizeof(stats)),
+              ERR_WRONG_TYPE, "not a thread");
+
+    EXPECT_EQ(mx_handle_close(thread), NO_ERROR, "handle_close");
+    EXPECT_EQ(mx_handle_close(event), NO_ERROR, "handle_close");
+
+    END_TEST;
+}
+
+static bool get_event_stats(mx_handle_t handle, mx_object_stats_t* out) {
+    mx_object_stats_t stats[MX_OBJ_TYPE_LAST];
+    mx_ssize_t size = mx_handle_get_info(handle, MX_INFO_OBJECT_STATS, stats, sizeof(stats));
+    for (mx_ssize_t i = 0; i < size / (mx_ssize_t)sizeof(stats[0]); i++) {
+        if (stats[i].type == MX_OBJ_TYPE_EVENT) {
+            *out = stats[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool object_stats_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t event = mx_event_create(0u);
+    ASSERT_GT(event, 0, "event_create");
+
+    mx_object_stats_t before;
+    ASSERT_TRUE(get_event_stats(event, &before), "no stats for events");
+    EXPECT_GT(before.created, before.destroyed, "at least this event is alive");
+
+    mx_handle_t other = mx_event_create(0u);
+    ASSERT_GT(other, 0, "event_create");
+    EXPECT_EQ(mx_handle_close(other), NO_ERROR, "handle_close");
+
+    mx_object_stats_t after;
+    ASSERT_TRUE(get_event_stats(event, &after), "no stats for events");
+    EXPECT_GT(after.created, before.created, "creation counted");
+    EXPECT_GT(after.destroyed, before.destroyed, "destruction counted");
+
+    // only whole records are returned
+    mx_object_stats_t one[2];
+    EXPECT_EQ(mx_handle_get_info(event, MX_INFO_OBJECT_STATS, one, sizeof(one[0]) + 1),
+              (mx_ssize_t)sizeof(one[0]), "one record");
+    EXPECT_EQ(one[0].type, (uint32_t)MX_OBJ_TYPE_PROCESS, "records start at processes");
+
+    mx_process_handle_stats_t handle_stats;
+    EXPECT_EQ(mx_handle_get_info(event, MX_INFO_PROCESS_HANDLE_STATS, &handle_stats,
+                                 sizeof(handle_stats)),
+              ERR_WRONG_TYPE, "not a process");
+
+    const char name[] = "handle-stats";
+    mx_handle_t proc = mx_process_create(name, sizeof(name));
+    ASSERT_GT(proc, 0, "process_create");
+    EXPECT_EQ(mx_handle_get_info(proc, MX_INFO_PROCESS_HANDLE_STATS, &handle_stats, 4u),
+              ERR_NOT_ENOUGH_BUFFER, "bad struct size validation");
+    ASSERT_EQ(mx_handle_get_info(proc, MX_INFO_PROCESS_HANDLE_STATS, &handle_stats,
+                                 sizeof(handle_stats)),
+              (mx_ssize_t)sizeof(handle_stats), "process handle stats");
+    for (int i = 0; i < MX_OBJ_TYPE_LAST; i++)
+        EXPECT_EQ(handle_stats.handle_count[i], 0u, "a new process holds no handles");
+
+    EXPECT_EQ(mx_handle_close(proc), NO_ERROR, "handle_close");
+    EXPECT_EQ(mx_handle_close(event), NO_ERROR, "handle_close");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(handle_info_tests)
 RUN_TEST(handle_info_test)
+RUN_TEST(handle_reuse_test)
+RUN_TEST(handle_lookup_race_test)
+RUN_TEST(handle_many_test)
+RUN_TEST(syscall_stats_test)
+RUN_TEST(thread_stats_test)
+RUN_TEST(object_stats_test)
 END_TEST_CASE(handle_info_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -241,8 +241,51 @@ bool handle_wait_test(void) {
     END_TEST;
 }
 
+// Waits that are already satisfied, unsatisfiable or that don't block return at once, with the
+// same results as ones that had to wait.
+bool handle_wait_ready_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ev[2] = {mx_event_create(0u), mx_event_create(0u)};
+    ASSERT_GT(ev[0], 0, "mx_event_create() failed");
+    ASSERT_GT(ev[1], 0, "mx_event_create() failed");
+
+    mx_signals_state_t state;
+    EXPECT_EQ(mx_handle_wait_one(ev[0], MX_SIGNAL_SIGNALED, 0u, &state), ERR_TIMED_OUT, "");
+    EXPECT_EQ(state.satisfied, 0u, "");
+
+    ASSERT_EQ(mx_event_signal(ev[1]), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_wait_one(ev[1], MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, &state), NO_ERROR,
+              "");
+    EXPECT_EQ(state.satisfied, MX_SIGNAL_SIGNALED, "");
+
+    // Events can never be readable.
+    EXPECT_EQ(mx_handle_wait_one(ev[0], MX_SIGNAL_READABLE, MX_TIME_INFINITE, NULL),
+              ERR_BAD_STATE, "");
+
+    mx_signals_t signals[2] = {MX_SIGNAL_SIGNALED, MX_SIGNAL_SIGNALED};
+    mx_signals_state_t states[2];
+    uint32_t index = (uint32_t)-1;
+    EXPECT_EQ(mx_handle_wait_many(2u, ev, signals, MX_TIME_INFINITE, &index, states), NO_ERROR,
+              "");
+    EXPECT_EQ(index, 1u, "wrong handle reported");
+    EXPECT_EQ(states[0].satisfied, 0u, "");
+    EXPECT_EQ(states[1].satisfied, MX_SIGNAL_SIGNALED, "");
+
+    ASSERT_EQ(mx_event_reset(ev[1]), NO_ERROR, "");
+    index = (uint32_t)-1;
+    EXPECT_EQ(mx_handle_wait_many(2u, ev, signals, 0u, &index, states), ERR_TIMED_OUT, "");
+    EXPECT_EQ(index, (uint32_t)-1, "no index on timeout");
+
+    EXPECT_EQ(mx_handle_close(ev[0]), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(ev[1]), NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(handle_wait_tests)
 RUN_TEST(handle_wait_test);
+RUN_TEST(handle_wait_ready_test);
 END_TEST_CASE(handle_wait_tests)
 
 #ifndef BUILD_COMBINED_TESTS
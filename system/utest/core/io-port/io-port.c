@@ -32,7 +32,7 @@ static int thread_consumer(void* arg)
     mx_status_t status;
 
     while (true) {
-        status = mx_io_port_wait(tinfo->io_port, &us_pkt, sizeof(us_pkt));
+        status = mx_io_port_wait(tinfo->io_port, MX_TIME_INFINITE, &us_pkt, sizeof(us_pkt));
 
         if (status < 0) {
             tinfo->error = status;
@@ -71,7 +71,7 @@ static bool basic_test(void)
     status = mx_io_port_queue(io_port, &in, sizeof(in));
     EXPECT_EQ(status, NO_ERROR, "");
 
-    status = mx_io_port_wait(io_port, &out, sizeof(out));
+    status = mx_io_port_wait(io_port, MX_TIME_INFINITE, &out, sizeof(out));
     EXPECT_EQ(status, NO_ERROR, "");
 
     EXPECT_EQ(out.hdr.key, 33u, "key mismatch");
@@ -155,6 +155,103 @@ static bool thread_pool_test(void)
     END_TEST;
 }
 
+static bool wait_timeout_test(void)
+{
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t io_port = mx_io_port_create(0u);
+    EXPECT_GT(io_port, 0, "could not create ioport");
+
+    mx_user_packet_t us_pkt = {{7u, 0u, 0u}, {0}};
+
+    status = mx_io_port_wait(io_port, 0u, &us_pkt, sizeof(us_pkt));
+    EXPECT_EQ(status, ERR_TIMED_OUT, "empty port should time out at once");
+    status = mx_io_port_wait(io_port, 1000u * 1000u, &us_pkt, sizeof(us_pkt));
+    EXPECT_EQ(status, ERR_TIMED_OUT, "empty port should time out");
+
+    status = mx_io_port_queue(io_port, &us_pkt, sizeof(us_pkt));
+    EXPECT_EQ(status, NO_ERROR, "");
+
+    // a buffer too small for the packet leaves it queued
+    mx_packet_header_t hdr;
+    status = mx_io_port_wait(io_port, 0u, &hdr, sizeof(hdr));
+    EXPECT_EQ(status, ERR_NOT_ENOUGH_BUFFER, "");
+    status = mx_io_port_wait(io_port, 0u, &us_pkt, sizeof(us_pkt));
+    EXPECT_EQ(status, NO_ERROR, "packet should still be there");
+    EXPECT_EQ(us_pkt.hdr.key, 7u, "key mismatch");
+
+    status = mx_handle_close(io_port);
+    EXPECT_EQ(status, NO_ERROR, "failed to close ioport");
+
+    END_TEST;
+}
+
+typedef struct handoff_info {
+    mx_handle_t io_port;
+    volatile mx_status_t status;
+    uint64_t key;
+} handoff_info_t;
+
+static int thread_wait_once(void* arg)
+{
+    handoff_info_t* info = arg;
+
+    mx_user_packet_t us_pkt;
+    info->status = mx_io_port_wait(info->io_port, MX_TIME_INFINITE, &us_pkt, sizeof(us_pkt));
+    info->key = us_pkt.hdr.key;
+    return 0;
+}
+
+// Every blocked thread gets exactly one packet, and no packet goes to two.
+static bool wake_one_test(void)
+{
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t io_port = mx_io_port_create(0u);
+    EXPECT_GT(io_port, 0, "could not create ioport");
+
+    handoff_info_t info[NUM_IO_THREADS];
+    mxr_thread_t* threads[NUM_IO_THREADS];
+    for (size_t ix = 0; ix != NUM_IO_THREADS; ++ix) {
+        info[ix].io_port = io_port;
+        info[ix].status = ERR_BAD_STATE;
+        info[ix].key = UINT64_MAX;
+        status = mxr_thread_create(thread_wait_once, &info[ix], "waiter", &threads[ix]);
+        EXPECT_EQ(status, 0, "could not create thread");
+    }
+
+    // give the threads time to block
+    mx_nanosleep(10u * 1000u * 1000u);
+
+    mx_user_packet_t us_pkt = {0};
+    for (size_t ix = 0; ix != NUM_IO_THREADS; ++ix) {
+        us_pkt.hdr.key = ix;
+        status = mx_io_port_queue(io_port, &us_pkt, sizeof(us_pkt));
+        EXPECT_EQ(status, NO_ERROR, "");
+    }
+
+    uint32_t seen = 0u;
+    for (size_t ix = 0; ix != NUM_IO_THREADS; ++ix) {
+        status = mxr_thread_join(threads[ix], NULL);
+        EXPECT_EQ(status, NO_ERROR, "failed to wait");
+        EXPECT_EQ(info[ix].status, NO_ERROR, "wait failed");
+        ASSERT_LT(info[ix].key, (uint64_t)NUM_IO_THREADS, "bad key");
+        EXPECT_EQ(seen & (1u << info[ix].key), 0u, "packet delivered twice");
+        seen |= 1u << info[ix].key;
+    }
+
+    // nothing is left over
+    status = mx_io_port_wait(io_port, 0u, &us_pkt, sizeof(us_pkt));
+    EXPECT_EQ(status, ERR_TIMED_OUT, "");
+
+    status = mx_handle_close(io_port);
+    EXPECT_EQ(status, NO_ERROR, "failed to close ioport");
+
+    END_TEST;
+}
+
 static bool bind_basic_test(void)
 {
     BEGIN_TEST;
@@ -213,7 +310,7 @@ static int io_reply_thread(void* arg)
     // Wait for the other thread to poke at the events and send each key/signal back to
     // the thread via a message pipe.
     while (true) {
-        status = mx_io_port_wait(info->io_port, &io_pkt, sizeof(io_pkt));
+        status = mx_io_port_wait(info->io_port, MX_TIME_INFINITE, &io_pkt, sizeof(io_pkt));
         if (status != NO_ERROR) {
             info->error = status;
             break;
@@ -307,12 +404,149 @@ static bool bind_events_test(void)
     END_TEST;
 }
 
+static bool bind_edge_test(void)
+{
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t ioport = mx_io_port_create(0u);
+    EXPECT_GT(ioport, 0, "could not create io port");
+
+    mx_handle_t h[2];
+    status = mx_message_pipe_create(h, 0);
+    EXPECT_EQ(status, NO_ERROR, "could not create pipes");
+
+    // a message already there when we bind is reported
+    uint32_t msg = 1u;
+    status = mx_message_write(h[1], &msg, sizeof(msg), NULL, 0, 0u);
+    EXPECT_EQ(status, NO_ERROR, "");
+    status = mx_io_port_bind(ioport, 7u, h[0], MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED);
+    EXPECT_EQ(status, NO_ERROR, "failed to bind pipe");
+
+    mx_io_packet_t io_pkt;
+    status = mx_io_port_wait(ioport, 0u, &io_pkt, sizeof(io_pkt));
+    EXPECT_EQ(status, NO_ERROR, "expected a packet for the bind");
+    EXPECT_EQ(io_pkt.hdr.key, 7u, "key mismatch");
+    EXPECT_EQ(io_pkt.signals, MX_SIGNAL_READABLE, "");
+
+    // more messages while it stays readable make no more packets
+    status = mx_message_write(h[1], &msg, sizeof(msg), NULL, 0, 0u);
+    EXPECT_EQ(status, NO_ERROR, "");
+    status = mx_io_port_wait(ioport, 0u, &io_pkt, sizeof(io_pkt));
+    EXPECT_EQ(status, ERR_TIMED_OUT, "pipe was readable already");
+
+    // drain it; the next message is a new edge
+    for (int ix = 0; ix != 2; ++ix) {
+        uint32_t bytes = sizeof(msg);
+        status = mx_message_read(h[0], &msg, &bytes, NULL, NULL, 0u);
+        EXPECT_EQ(status, NO_ERROR, "");
+    }
+    status = mx_message_write(h[1], &msg, sizeof(msg), NULL, 0, 0u);
+    EXPECT_EQ(status, NO_ERROR, "");
+    status = mx_io_port_wait(ioport, 0u, &io_pkt, sizeof(io_pkt));
+    EXPECT_EQ(status, NO_ERROR, "expected a packet for the new message");
+    EXPECT_EQ(io_pkt.signals, MX_SIGNAL_READABLE, "");
+    status = mx_io_port_wait(ioport, 0u, &io_pkt, sizeof(io_pkt));
+    EXPECT_EQ(status, ERR_TIMED_OUT, "one packet per edge");
+
+    // the peer going away is an edge of its own
+    status = mx_handle_close(h[1]);
+    EXPECT_EQ(status, NO_ERROR, "");
+    status = mx_io_port_wait(ioport, 0u, &io_pkt, sizeof(io_pkt));
+    EXPECT_EQ(status, NO_ERROR, "expected a packet for the close");
+    EXPECT_EQ(io_pkt.signals & MX_SIGNAL_PEER_CLOSED, MX_SIGNAL_PEER_CLOSED, "");
+    EXPECT_EQ(io_pkt.signals & MX_SIGNAL_READABLE, MX_SIGNAL_READABLE, "message left unread");
+
+    status = mx_handle_close(h[0]);
+    EXPECT_EQ(status, NO_ERROR, "");
+    status = mx_handle_close(ioport);
+    EXPECT_EQ(status, NO_ERROR, "failed to close io port");
+
+    END_TEST;
+}
+
+static bool depth_and_wait_many_test(void)
+{
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t ioport = mx_io_port_create(0u);
+    EXPECT_GT(ioport, 0, "could not create io port");
+
+    uint32_t depth = 0u;
+    status = mx_object_get_property(ioport, MX_PROP_IO_PORT_DEPTH, &depth, sizeof(depth));
+    EXPECT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(depth, 0u, "ports start out unbounded");
+
+    depth = MX_IO_PORT_MAX_DEPTH + 1u;
+    status = mx_object_set_property(ioport, MX_PROP_IO_PORT_DEPTH, &depth, sizeof(depth));
+    EXPECT_EQ(status, ERR_TOO_BIG, "");
+    depth = 3u;
+    status = mx_object_set_property(ioport, MX_PROP_IO_PORT_DEPTH, &depth, sizeof(depth));
+    EXPECT_EQ(status, NO_ERROR, "failed to set depth");
+    status = mx_object_set_property(ioport, MX_PROP_IO_PORT_DEPTH, &depth, sizeof(depth));
+    EXPECT_EQ(status, ERR_BAD_STATE, "depth can only be set once");
+
+    // fill it up
+    mx_user_packet_t pkt = {{0u, 0u, 0u}, {0u}};
+    for (uint64_t ix = 0; ix != 3u; ++ix) {
+        pkt.hdr.key = ix;
+        status = mx_io_port_queue(ioport, &pkt, sizeof(pkt));
+        EXPECT_EQ(status, NO_ERROR, "");
+    }
+    status = mx_io_port_queue(ioport, &pkt, sizeof(pkt));
+    EXPECT_EQ(status, ERR_NOT_READY, "port should be full");
+
+    // a signal from a bound event has nowhere to go either
+    mx_handle_t event = mx_event_create(0u);
+    EXPECT_GT(event, 0, "could not create event");
+    status = mx_io_port_bind(ioport, 100u, event, MX_SIGNAL_SIGNALED);
+    EXPECT_EQ(status, NO_ERROR, "failed to bind event");
+    status = mx_event_signal(event);
+    EXPECT_EQ(status, NO_ERROR, "failed to signal event");
+
+    mx_user_packet_t out[8];
+    uint32_t actual = 0u;
+    status = mx_io_port_wait_many(ioport, MX_TIME_INFINITE, out, sizeof(out[0]), 0u, &actual);
+    EXPECT_EQ(status, ERR_INVALID_ARGS, "");
+    status = mx_io_port_wait_many(ioport, MX_TIME_INFINITE, out, sizeof(out[0]),
+                                  MX_IO_PORT_WAIT_MANY_MAX + 1u, &actual);
+    EXPECT_EQ(status, ERR_TOO_BIG, "");
+
+    status = mx_io_port_wait_many(ioport, MX_TIME_INFINITE, out, sizeof(out[0]), 8u, &actual);
+    EXPECT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(actual, 4u, "expected three packets and the overflow");
+    for (uint32_t ix = 0; ix != 3u; ++ix) {
+        EXPECT_EQ(out[ix].hdr.key, ix, "packets out of order");
+        EXPECT_EQ(out[ix].hdr.type, MX_IO_PORT_PKT_TYPE_USER, "");
+    }
+    EXPECT_EQ(out[3].hdr.type, MX_IO_PORT_PKT_TYPE_OVERFLOW, "");
+    EXPECT_GE(out[3].hdr.extra, 1u, "the event's packet should have been dropped");
+
+    // the pool has all its packets back
+    for (uint64_t ix = 0; ix != 3u; ++ix) {
+        status = mx_io_port_queue(ioport, &pkt, sizeof(pkt));
+        EXPECT_EQ(status, NO_ERROR, "");
+    }
+
+    status = mx_handle_close(event);
+    EXPECT_EQ(status, NO_ERROR, "failed to close event");
+    status = mx_handle_close(ioport);
+    EXPECT_EQ(status, NO_ERROR, "failed to close io port");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(io_port_tests)
 RUN_TEST(basic_test)
 RUN_TEST(queue_and_close_test)
 RUN_TEST(thread_pool_test)
+RUN_TEST(wait_timeout_test)
+RUN_TEST(wake_one_test)
 RUN_TEST(bind_basic_test)
 RUN_TEST(bind_events_test)
+RUN_TEST(bind_edge_test)
+RUN_TEST(depth_and_wait_many_test)
 END_TEST_CASE(io_port_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -183,6 +183,32 @@ bool mprotect_test() {
     END_TEST;
 }
 
+bool cache_flush_test() {
+    BEGIN_TEST;
+
+    size_t len = getpagesize() * 2;
+    uint8_t* addr = (uint8_t*)mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    ASSERT_NEQ(MAP_FAILED, addr, "mmap failed to map");
+    addr[0] = 1;
+
+    // a range that crosses a page, only one of which has been touched
+    uint8_t* start = addr + getpagesize() - 16;
+    EXPECT_EQ(NO_ERROR, mx_cache_flush(start, 32, MX_CACHE_FLUSH_DATA), "clean");
+    EXPECT_EQ(NO_ERROR, mx_cache_flush(start, 32, MX_CACHE_FLUSH_INVALIDATE), "invalidate");
+    EXPECT_EQ(NO_ERROR, mx_cache_flush(start, 32, MX_CACHE_FLUSH_DATA | MX_CACHE_FLUSH_INVALIDATE),
+              "clean and invalidate");
+    EXPECT_EQ(1u, addr[0], "contents kept");
+
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_cache_flush(addr, len, 0), "no options");
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_cache_flush(addr, len, 1u << 2), "bad options");
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_cache_flush((void*)0, len, MX_CACHE_FLUSH_DATA),
+              "not a user address");
+
+    EXPECT_EQ(0, munmap(addr, len), "munmap failed");
+
+    END_TEST;
+}
+
 }
 
 BEGIN_TEST_CASE(memory_mapping_tests)
@@ -192,6 +218,7 @@ RUN_TEST(mmap_offset_test);
 RUN_TEST(mmap_prot_test);
 RUN_TEST(mmap_flags_test);
 RUN_TEST(mprotect_test);
+RUN_TEST(cache_flush_test);
 END_TEST_CASE(memory_mapping_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -7,6 +7,7 @@
 #include <unittest/unittest.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 mx_handle_t _pipe[4];
@@ -274,12 +275,454 @@ bool message_pipe_duplicate_handles(void) {
     END_TEST;
 }
 
+bool message_pipe_large_message(void) {
+    BEGIN_TEST;
+
+    mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0), NO_ERROR, "");
+
+    // bigger than a message packet holds inline, in both bytes and handles
+    enum { kBytes = 4096, kHandles = 20 };
+    static uint8_t bytes[kBytes];
+    for (int i = 0; i < kBytes; i++)
+        bytes[i] = (uint8_t)i;
+    mx_handle_t handles[kHandles];
+    for (int i = 0; i < kHandles; i++) {
+        handles[i] = mx_event_create(0u);
+        ASSERT_GT(handles[i], 0, "failed to create event");
+    }
+
+    ASSERT_EQ(mx_message_write(pipe[0], bytes, kBytes, handles, kHandles, 0u), NO_ERROR, "");
+
+    static uint8_t read_bytes[kBytes];
+    mx_handle_t read_handles[kHandles];
+    uint32_t num_bytes = kBytes;
+    uint32_t num_handles = kHandles;
+    ASSERT_EQ(mx_message_read(pipe[1], read_bytes, &num_bytes, read_handles, &num_handles, 0u),
+              NO_ERROR, "");
+    EXPECT_EQ(num_bytes, (uint32_t)kBytes, "wrong size");
+    EXPECT_EQ(num_handles, (uint32_t)kHandles, "wrong handle count");
+    EXPECT_EQ(memcmp(bytes, read_bytes, kBytes), 0, "bytes differ");
+
+    for (int i = 0; i < kHandles; i++) {
+        EXPECT_EQ(mx_handle_get_info(read_handles[i], MX_INFO_HANDLE_VALID, NULL, 0u), NO_ERROR,
+                  "received handle should be valid");
+        EXPECT_EQ(mx_handle_close(read_handles[i]), NO_ERROR, "");
+    }
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+
+    END_TEST;
+}
+
+// Messages from four pages up are kept in pages of their own, which move
+// into a page aligned reader's mapping rather than being copied.
+bool message_pipe_page_sized_message(void) {
+    BEGIN_TEST;
+
+    mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0), NO_ERROR, "");
+
+    enum { kPageSize = 4096, kBytes = 12 * kPageSize + 100 };
+    static uint8_t bytes[kBytes];
+    for (int i = 0; i < kBytes; i++)
+        bytes[i] = (uint8_t)(i * 7);
+
+    // once for a page aligned buffer in a mapping of our own and once for
+    // one that isn't aligned
+    const mx_size_t len = 16 * kPageSize;
+    mx_handle_t vmo = mx_vm_object_create(len);
+    ASSERT_GT(vmo, 0, "vm_object_create");
+    uintptr_t map;
+    ASSERT_EQ(mx_process_vm_map(0, vmo, 0, len, &map,
+                                MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE), NO_ERROR, "vm_map");
+    // something to replace
+    memset((void*)map, 0xaa, len);
+
+    uint8_t* buffers[2] = {(uint8_t*)map, (uint8_t*)map + 8};
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(mx_message_write(pipe[0], bytes, kBytes, NULL, 0u, 0u), NO_ERROR, "");
+
+        uint32_t num_bytes = kBytes;
+        ASSERT_EQ(mx_message_read(pipe[1], buffers[i], &num_bytes, NULL, NULL, 0u), NO_ERROR, "");
+        EXPECT_EQ(num_bytes, (uint32_t)kBytes, "wrong size");
+        EXPECT_EQ(memcmp(bytes, buffers[i], kBytes), 0, "bytes differ");
+    }
+
+    // the rest of the mapping is left alone
+    EXPECT_EQ(((uint8_t*)map)[8 + kBytes], 0xaa, "past the message");
+
+    // and the vmo sees what was read into the mapping
+    uint8_t first[16];
+    EXPECT_EQ(mx_vm_object_read(vmo, first, 8, sizeof(first)), (mx_ssize_t)sizeof(first),
+              "vm_object_read");
+    EXPECT_EQ(memcmp(first, bytes, sizeof(first)), 0, "vmo differs");
+
+    EXPECT_EQ(mx_process_vm_unmap(0, map, 0), NO_ERROR, "vm_unmap");
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+
+    END_TEST;
+}
+
+bool message_pipe_read_write_many(void) {
+    BEGIN_TEST;
+
+    mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0), NO_ERROR, "");
+    mx_handle_t event = mx_event_create(0u);
+    ASSERT_GT(event, 0, "failed to create event");
+
+    // ten messages of 4 * (i + 1) bytes, the fourth carrying the event
+    enum { kCount = 10 };
+    uint32_t data[kCount][kCount];
+    mx_message_vec_t vecs[kCount];
+    for (uint32_t i = 0; i < kCount; i++) {
+        for (uint32_t j = 0; j < kCount; j++)
+            data[i][j] = i * 100u + j;
+        vecs[i] = (mx_message_vec_t){ data[i], NULL, (i + 1) * 4u, 0u };
+    }
+    vecs[3].handles = &event;
+    vecs[3].num_handles = 1u;
+    ASSERT_EQ(mx_message_write_many(pipe[0], vecs, kCount, 0u), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(event), ERR_BAD_HANDLE, "event should have been sent");
+
+    EXPECT_EQ(mx_message_write_many(pipe[0], vecs, 0u, 0u), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_message_write_many(pipe[0], vecs, MX_MESSAGE_BATCH_MAX + 1u, 0u), ERR_TOO_BIG,
+              "");
+
+    // the first read stops at the message with a handle, which it has no room for
+    uint32_t out[kCount][kCount];
+    mx_handle_t received = MX_HANDLE_INVALID;
+    for (uint32_t i = 0; i < kCount; i++)
+        vecs[i] = (mx_message_vec_t){ out[i], NULL, sizeof(out[i]), 0u };
+    uint32_t actual_count = 0u;
+    ASSERT_EQ(mx_message_read_many(pipe[1], vecs, kCount, &actual_count, 0u), NO_ERROR, "");
+    ASSERT_EQ(actual_count, 3u, "should stop at the message with a handle");
+    for (uint32_t i = 0; i < actual_count; i++) {
+        EXPECT_EQ(vecs[i].num_bytes, (i + 1) * 4u, "wrong size");
+        EXPECT_EQ(vecs[i].num_handles, 0u, "");
+        EXPECT_EQ(out[i][i], i * 101u, "wrong contents");
+    }
+
+    // too small for the next message, which is left queued
+    vecs[0] = (mx_message_vec_t){ out[0], NULL, sizeof(out[0]), 0u };
+    EXPECT_EQ(mx_message_read_many(pipe[1], vecs, 1u, &actual_count, 0u),
+              ERR_NOT_ENOUGH_BUFFER, "");
+    EXPECT_EQ(vecs[0].num_bytes, 16u, "size of the next message");
+    EXPECT_EQ(vecs[0].num_handles, 1u, "handles of the next message");
+
+    for (uint32_t i = 0; i < kCount; i++)
+        vecs[i] = (mx_message_vec_t){ out[i], NULL, sizeof(out[i]), 0u };
+    vecs[0].handles = &received;
+    vecs[0].num_handles = 1u;
+    ASSERT_EQ(mx_message_read_many(pipe[1], vecs, kCount, &actual_count, 0u), NO_ERROR, "");
+    ASSERT_EQ(actual_count, kCount - 3u, "should get the rest");
+    EXPECT_EQ(vecs[0].num_handles, 1u, "");
+    EXPECT_GT(received, 0, "should have received the event");
+    for (uint32_t i = 0; i < actual_count; i++)
+        EXPECT_EQ(vecs[i].num_bytes, (i + 4) * 4u, "wrong size");
+
+    EXPECT_EQ(mx_message_read_many(pipe[1], vecs, kCount, &actual_count, 0u), ERR_BAD_STATE,
+              "nothing left to read");
+
+    // a batch to a closed pipe leaves all the handles where they were
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+    vecs[0] = (mx_message_vec_t){ data[0], &received, 4u, 1u };
+    EXPECT_EQ(mx_message_write_many(pipe[0], vecs, 1u, 0u), ERR_BAD_STATE, "");
+    EXPECT_EQ(mx_handle_close(received), NO_ERROR, "handle should have been put back");
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool pipe_writable(mx_handle_t handle) {
+    return (get_satisfied_signals(handle) & MX_SIGNAL_WRITABLE) != 0u;
+}
+
+bool message_pipe_queue_limits(void) {
+    BEGIN_TEST;
+
+    mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0), NO_ERROR, "");
+
+    // at most three messages or 100 bytes waiting to be read on pipe[1]
+    uint32_t value = 3u;
+    ASSERT_EQ(mx_object_set_property(pipe[1], MX_PROP_MSG_PIPE_MAX_MESSAGES, &value,
+                                     sizeof(value)), NO_ERROR, "");
+    value = 100u;
+    ASSERT_EQ(mx_object_set_property(pipe[1], MX_PROP_MSG_PIPE_MAX_BYTES, &value,
+                                     sizeof(value)), NO_ERROR, "");
+    value = 0u;
+    ASSERT_EQ(mx_object_get_property(pipe[1], MX_PROP_MSG_PIPE_MAX_MESSAGES, &value,
+                                     sizeof(value)), NO_ERROR, "");
+    EXPECT_EQ(value, 3u, "");
+
+    uint8_t buffer[128] = {};
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(pipe_writable(pipe[0]), "should be writable below the cap");
+        ASSERT_EQ(mx_message_write(pipe[0], buffer, 10u, NULL, 0u, 0u), NO_ERROR, "");
+    }
+    EXPECT_FALSE(pipe_writable(pipe[0]), "message cap reached");
+    EXPECT_EQ(mx_message_write(pipe[0], buffer, 10u, NULL, 0u, 0u), ERR_NOT_READY,
+              "write past the cap");
+    EXPECT_TRUE(pipe_writable(pipe[1]), "the other direction isn't capped");
+
+    mx_msg_pipe_info_t info;
+    ASSERT_EQ(mx_handle_get_info(pipe[0], MX_INFO_MSG_PIPE, &info, sizeof(info)),
+              (mx_ssize_t)sizeof(info), "");
+    EXPECT_EQ(info.peer_queued_messages, 3u, "");
+    EXPECT_EQ(info.peer_queued_bytes, 30u, "");
+    EXPECT_EQ(info.queued_messages, 0u, "");
+    ASSERT_EQ(mx_handle_get_info(pipe[1], MX_INFO_MSG_PIPE, &info, sizeof(info)),
+              (mx_ssize_t)sizeof(info), "");
+    EXPECT_EQ(info.queued_messages, 3u, "");
+    EXPECT_EQ(info.queued_bytes, 30u, "");
+
+    // reading one makes room again
+    uint32_t num_bytes = sizeof(buffer);
+    ASSERT_EQ(mx_message_read(pipe[1], buffer, &num_bytes, NULL, NULL, 0u), NO_ERROR, "");
+    EXPECT_TRUE(pipe_writable(pipe[0]), "should be writable once drained");
+
+    // down to one message, then a big one fills the byte cap
+    num_bytes = sizeof(buffer);
+    ASSERT_EQ(mx_message_read(pipe[1], buffer, &num_bytes, NULL, NULL, 0u), NO_ERROR, "");
+    ASSERT_EQ(mx_message_write(pipe[0], buffer, 100u, NULL, 0u, 0u), NO_ERROR, "");
+    EXPECT_FALSE(pipe_writable(pipe[0]), "byte cap reached");
+    EXPECT_EQ(mx_message_write(pipe[0], buffer, 1u, NULL, 0u, 0u), ERR_NOT_READY, "");
+
+    // lifting the caps opens it right up
+    value = 0u;
+    ASSERT_EQ(mx_object_set_property(pipe[1], MX_PROP_MSG_PIPE_MAX_MESSAGES, &value,
+                                     sizeof(value)), NO_ERROR, "");
+    ASSERT_EQ(mx_object_set_property(pipe[1], MX_PROP_MSG_PIPE_MAX_BYTES, &value,
+                                     sizeof(value)), NO_ERROR, "");
+    EXPECT_TRUE(pipe_writable(pipe[0]), "no caps left");
+    EXPECT_EQ(mx_message_write(pipe[0], buffer, 1u, NULL, 0u, 0u), NO_ERROR, "");
+
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+
+    END_TEST;
+}
+
+// Bounce a message of |size| bytes, with an event along for the ride if
+// |pass_handle|, between the ends of a pipe and report the time per trip.
+static bool round_trip(uint32_t size, bool pass_handle) {
+    enum { kTrips = 10000 };
+    static uint8_t buffer[4096];
+
+    mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0), NO_ERROR, "");
+    mx_handle_t event = MX_HANDLE_INVALID;
+    if (pass_handle) {
+        event = mx_event_create(0u);
+        ASSERT_GT(event, 0, "failed to create event");
+    }
+
+    mx_time_t start = mx_current_time();
+    for (int i = 0; i < kTrips; i++) {
+        for (int side = 0; side < 2; side++) {
+            uint32_t num_handles = pass_handle ? 1u : 0u;
+            ASSERT_EQ(mx_message_write(pipe[side], buffer, size, &event, num_handles, 0u),
+                      NO_ERROR, "");
+
+            uint32_t num_bytes = size;
+            ASSERT_EQ(mx_message_read(pipe[1 - side], buffer, &num_bytes, &event, &num_handles,
+                                      0u),
+                      NO_ERROR, "");
+            ASSERT_EQ(num_bytes, size, "wrong size");
+        }
+    }
+    mx_time_t elapsed = mx_current_time() - start;
+
+    unittest_printf("%5u bytes, %u handles: %llu ns per round trip\n", size,
+                    pass_handle ? 1u : 0u, (unsigned long long)(elapsed / kTrips));
+
+    if (pass_handle) {
+        EXPECT_EQ(mx_handle_close(event), NO_ERROR, "");
+    }
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+    return true;
+}
+
+bool message_pipe_round_trip_benchmark(void) {
+    BEGIN_TEST;
+
+    // the first three fit in a message packet, the last doesn't
+    EXPECT_TRUE(round_trip(64u, false), "");
+    EXPECT_TRUE(round_trip(256u, false), "");
+    EXPECT_TRUE(round_trip(256u, true), "");
+    EXPECT_TRUE(round_trip(4096u, false), "");
+
+    END_TEST;
+}
+
+// Answers calls on the pipe it is given with value + 1, first writing a
+// plain message which shouldn't be taken for the reply.
+static int call_server_thread(void* arg) {
+    mx_handle_t pipe = *(mx_handle_t*)arg;
+    for (;;) {
+        mx_signals_state_t state;
+        mx_status_t status = mx_handle_wait_one(pipe, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                                MX_TIME_INFINITE, &state);
+        if (status != NO_ERROR || !(state.satisfied & MX_SIGNAL_READABLE))
+            break;
+
+        uint32_t msg[2];
+        uint32_t num_bytes = sizeof(msg);
+        if (mx_message_read(pipe, msg, &num_bytes, NULL, NULL, 0u) != NO_ERROR)
+            break;
+
+        uint32_t plain[2] = { 0u, msg[1] };
+        mx_message_write(pipe, plain, sizeof(plain), NULL, 0u, 0u);
+
+        msg[1]++;
+        mx_message_write(pipe, msg, sizeof(msg), NULL, 0u, 0u);
+    }
+    mx_thread_exit();
+}
+
+bool message_pipe_call_test(void) {
+    BEGIN_TEST;
+
+    static mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0), NO_ERROR, "");
+
+    // nobody is answering yet
+    uint32_t request[2] = { 0u, 1u };
+    uint32_t reply[2] = { 0u, 0u };
+    mx_message_call_args_t args = {
+        .wr_bytes = request,
+        .rd_bytes = reply,
+        .wr_num_bytes = sizeof(request),
+        .rd_num_bytes = sizeof(reply),
+    };
+    uint32_t actual_bytes = 0;
+    uint32_t actual_handles = 0;
+    EXPECT_EQ(mx_message_call(pipe[0], 0u, 1000 * 1000, &args, &actual_bytes, &actual_handles),
+              ERR_TIMED_OUT, "call without a server should time out");
+    uint32_t num_bytes = sizeof(request);
+    ASSERT_EQ(mx_message_read(pipe[1], request, &num_bytes, NULL, NULL, 0u), NO_ERROR,
+              "timed out request should still have been sent");
+    EXPECT_NEQ(request[0] & 0x80000000u, 0u, "transaction id should be stamped in");
+
+    const char* name = "call server";
+    mx_handle_t thread = mx_thread_create(call_server_thread, &pipe[1], name, strlen(name) + 1);
+    ASSERT_GT(thread, 0, "thread_create");
+
+    for (uint32_t i = 0; i < 100; i++) {
+        request[1] = i;
+        ASSERT_EQ(mx_message_call(pipe[0], 0u, MX_TIME_INFINITE, &args, &actual_bytes,
+                                  &actual_handles),
+                  NO_ERROR, "call");
+        EXPECT_EQ(actual_bytes, (uint32_t)sizeof(reply), "reply size");
+        EXPECT_EQ(actual_handles, 0u, "reply handles");
+        EXPECT_EQ(reply[1], i + 1, "wrong reply");
+
+        // the plain message went through the read queue
+        uint32_t plain[2];
+        num_bytes = sizeof(plain);
+        ASSERT_EQ(mx_message_read(pipe[0], plain, &num_bytes, NULL, NULL, 0u), NO_ERROR,
+                  "plain message should be readable");
+        EXPECT_EQ(plain[1], i, "wrong plain message");
+    }
+
+    // a call needs room for the transaction id
+    args.wr_num_bytes = 2u;
+    EXPECT_EQ(mx_message_call(pipe[0], 0u, MX_TIME_INFINITE, &args, NULL, NULL),
+              ERR_INVALID_ARGS, "too short to call with");
+
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+    args.wr_num_bytes = sizeof(request);
+    EXPECT_EQ(mx_message_call(pipe[0], 0u, MX_TIME_INFINITE, &args, NULL, NULL),
+              ERR_BAD_STATE, "call with the other side closed");
+
+    EXPECT_EQ(mx_handle_wait_one(thread, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL),
+              NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(thread), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+
+    END_TEST;
+}
+
+// Echoes every message on the pipe it is given back until the peer closes.
+static int echo_server_thread(void* arg) {
+    mx_handle_t pipe = *(mx_handle_t*)arg;
+    for (;;) {
+        mx_signals_state_t state;
+        mx_status_t status = mx_handle_wait_one(pipe, MX_SIGNAL_READABLE | MX_SIGNAL_PEER_CLOSED,
+                                                MX_TIME_INFINITE, &state);
+        if (status != NO_ERROR || !(state.satisfied & MX_SIGNAL_READABLE))
+            break;
+
+        uint8_t msg[64];
+        uint32_t num_bytes = sizeof(msg);
+        if (mx_message_read(pipe, msg, &num_bytes, NULL, NULL, 0u) != NO_ERROR)
+            break;
+        mx_message_write(pipe, msg, num_bytes, NULL, 0u, 0u);
+    }
+    mx_thread_exit();
+}
+
+// Time calls to a server on another thread, which is where the caller handing
+// its cpu over to the server on the way into the wait pays off.
+bool message_pipe_call_benchmark(void) {
+    BEGIN_TEST;
+    enum { kCalls = 10000 };
+
+    static mx_handle_t pipe[2];
+    ASSERT_EQ(mx_message_pipe_create(pipe, 0), NO_ERROR, "");
+
+    const char* name = "echo server";
+    mx_handle_t thread = mx_thread_create(echo_server_thread, &pipe[1], name, strlen(name) + 1);
+    ASSERT_GT(thread, 0, "thread_create");
+
+    uint8_t request[64] = {};
+    uint8_t reply[64];
+    mx_message_call_args_t args = {
+        .wr_bytes = request,
+        .rd_bytes = reply,
+        .wr_num_bytes = sizeof(request),
+        .rd_num_bytes = sizeof(reply),
+    };
+
+    mx_time_t start = mx_current_time();
+    for (int i = 0; i < kCalls; i++) {
+        uint32_t actual_bytes = 0;
+        ASSERT_EQ(mx_message_call(pipe[0], 0u, MX_TIME_INFINITE, &args, &actual_bytes, NULL),
+                  NO_ERROR, "call");
+        ASSERT_EQ(actual_bytes, (uint32_t)sizeof(reply), "reply size");
+    }
+    mx_time_t elapsed = mx_current_time() - start;
+
+    unittest_printf("%u bytes: %llu ns per call\n", (uint32_t)sizeof(request),
+                    (unsigned long long)(elapsed / kCalls));
+
+    EXPECT_EQ(mx_handle_close(pipe[0]), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_wait_one(thread, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL),
+              NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(thread), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pipe[1]), NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(message_pipe_tests)
 RUN_TEST(message_pipe_test)
 RUN_TEST(message_pipe_read_error_test)
 RUN_TEST(message_pipe_close_test)
 RUN_TEST(message_pipe_non_transferable)
 RUN_TEST(message_pipe_duplicate_handles)
+RUN_TEST(message_pipe_large_message)
+RUN_TEST(message_pipe_page_sized_message)
+RUN_TEST(message_pipe_read_write_many)
+RUN_TEST(message_pipe_queue_limits)
+RUN_TEST(message_pipe_round_trip_benchmark)
+RUN_TEST(message_pipe_call_test)
+RUN_TEST(message_pipe_call_benchmark)
 END_TEST_CASE(message_pipe_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -0,0 +1,83 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/syscalls.h>
+#include <runtime/cond.h>
+#include <runtime/mutex.h>
+#include <runtime/thread.h>
+#include <unittest/unittest.h>
+#include <stdbool.h>
+
+#define NUM_WAITERS 8
+
+static mxr_mutex_t mutex = MXR_MUTEX_INIT;
+static mxr_cond_t cond = MXR_COND_INIT;
+static int waiting = 0;
+static int woken = 0;
+static bool go = false;
+
+static int cond_waiter(void* arg) {
+    mxr_mutex_lock(&mutex);
+    waiting++;
+    while (!go)
+        mxr_cond_wait(&cond, &mutex);
+    woken++;
+    mxr_mutex_unlock(&mutex);
+    return 0;
+}
+
+static bool test_broadcast(void) {
+    BEGIN_TEST;
+    mxr_thread_t* threads[NUM_WAITERS];
+
+    for (int i = 0; i < NUM_WAITERS; i++)
+        ASSERT_EQ(mxr_thread_create(cond_waiter, NULL, "waiter", &threads[i]), NO_ERROR,
+                  "failed to create thread");
+
+    // wait for them all to block on the condition
+    for (;;) {
+        mxr_mutex_lock(&mutex);
+        bool all_waiting = (waiting == NUM_WAITERS);
+        if (all_waiting) {
+            go = true;
+            mxr_cond_broadcast(&cond);
+        }
+        mxr_mutex_unlock(&mutex);
+        if (all_waiting)
+            break;
+        mx_nanosleep(1000 * 1000);
+    }
+
+    for (int i = 0; i < NUM_WAITERS; i++)
+        mxr_thread_join(threads[i], NULL);
+
+    EXPECT_EQ(woken, NUM_WAITERS, "not every waiter woke up");
+    END_TEST;
+}
+
+static bool test_timedwait(void) {
+    BEGIN_TEST;
+    mxr_mutex_t m = MXR_MUTEX_INIT;
+    mxr_cond_t c = MXR_COND_INIT;
+
+    mxr_mutex_lock(&m);
+    EXPECT_EQ(mxr_cond_timedwait(&c, &m, 1000 * 1000), ERR_TIMED_OUT, "wait should time out");
+    // the mutex is held again
+    EXPECT_EQ(mxr_mutex_trylock(&m), ERR_BUSY, "mutex not relocked");
+    mxr_mutex_unlock(&m);
+    EXPECT_EQ(mxr_mutex_trylock(&m), NO_ERROR, "mutex not unlocked");
+    mxr_mutex_unlock(&m);
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(mxr_cond_tests)
+RUN_TEST(test_broadcast)
+RUN_TEST(test_timedwait)
+END_TEST_CASE(mxr_cond_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -8,8 +8,9 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_TYPE := userapp-static
 
+# the benchmarks are a program of their own, core-bench
 MODULE_SRCS += \
-    $(wildcard $(LOCAL_DIR)/*/*.c) \
+    $(filter-out $(LOCAL_DIR)/bench/%,$(wildcard $(LOCAL_DIR)/*/*.c)) \
     $(wildcard $(LOCAL_DIR)/*/*.cpp) \
     $(LOCAL_DIR)/main.c \
 
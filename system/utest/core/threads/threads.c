@@ -53,8 +53,113 @@ bool threads_test(void) {
     END_TEST;
 }
 
+bool thread_deadline_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t handle = mx_thread_create(thread_1, NULL, "thread 1", 9);
+    ASSERT_GT(handle, 0, "Error while creating thread");
+
+    // 1ms due within 5ms, every 10ms
+    mx_thread_deadline_t deadline = {
+        .runtime = 1000 * 1000,
+        .deadline = 5 * 1000 * 1000,
+        .period = 10 * 1000 * 1000,
+    };
+    mx_status_t status = mx_object_set_property(handle, MX_PROP_THREAD_DEADLINE,
+                                                &deadline, sizeof(deadline));
+    EXPECT_EQ(status, NO_ERROR, "Error setting deadline");
+
+    mx_thread_deadline_t got;
+    status = mx_object_get_property(handle, MX_PROP_THREAD_DEADLINE, &got, sizeof(got));
+    EXPECT_EQ(status, NO_ERROR, "Error getting deadline");
+    EXPECT_EQ(got.runtime, deadline.runtime, "Wrong runtime");
+    EXPECT_EQ(got.deadline, deadline.deadline, "Wrong deadline");
+    EXPECT_EQ(got.period, deadline.period, "Wrong period");
+
+    mx_thread_deadline_t bad = deadline;
+    bad.runtime = bad.deadline + 1;
+    status = mx_object_set_property(handle, MX_PROP_THREAD_DEADLINE, &bad, sizeof(bad));
+    EXPECT_EQ(status, ERR_INVALID_ARGS, "Runtime past the deadline should fail");
+
+    // no cpu gives up all of its time
+    bad = deadline;
+    bad.runtime = bad.deadline = bad.period;
+    status = mx_object_set_property(handle, MX_PROP_THREAD_DEADLINE, &bad, sizeof(bad));
+    EXPECT_EQ(status, ERR_NO_RESOURCES, "Reserving a whole cpu should fail");
+
+    mx_handle_wait_one(handle, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
+    mx_handle_close(handle);
+
+    END_TEST;
+}
+
+bool thread_affinity_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t handle = mx_thread_create(thread_1, NULL, "thread 1", 9);
+    ASSERT_GT(handle, 0, "Error while creating thread");
+
+    uint32_t affinity = 0;
+    mx_status_t status = mx_object_get_property(handle, MX_PROP_THREAD_AFFINITY,
+                                                &affinity, sizeof(affinity));
+    EXPECT_EQ(status, NO_ERROR, "Error getting affinity");
+    EXPECT_NEQ(affinity & 1u, 0u, "New threads should be able to run on cpu 0");
+
+    // every machine has a cpu 0
+    affinity = 1u;
+    status = mx_object_set_property(handle, MX_PROP_THREAD_AFFINITY, &affinity, sizeof(affinity));
+    EXPECT_EQ(status, NO_ERROR, "Error setting affinity");
+    affinity = 0;
+    status = mx_object_get_property(handle, MX_PROP_THREAD_AFFINITY, &affinity, sizeof(affinity));
+    EXPECT_EQ(status, NO_ERROR, "Error getting affinity");
+    EXPECT_EQ(affinity, 1u, "Wrong affinity");
+
+    affinity = 0;
+    status = mx_object_set_property(handle, MX_PROP_THREAD_AFFINITY, &affinity, sizeof(affinity));
+    EXPECT_EQ(status, ERR_INVALID_ARGS, "An empty affinity should fail");
+
+    mx_handle_wait_one(handle, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
+    mx_handle_close(handle);
+
+    END_TEST;
+}
+
+bool thread_timer_slack_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t handle = mx_thread_create(thread_1, NULL, "thread 1", 9);
+    ASSERT_GT(handle, 0, "Error while creating thread");
+
+    mx_time_t slack = 1u;
+    mx_status_t status = mx_object_get_property(handle, MX_PROP_THREAD_TIMER_SLACK,
+                                                &slack, sizeof(slack));
+    EXPECT_EQ(status, NO_ERROR, "Error getting timer slack");
+    EXPECT_EQ(slack, 0u, "New threads should have no timer slack");
+
+    // kept to the ms
+    slack = 5500u * 1000u;
+    status = mx_object_set_property(handle, MX_PROP_THREAD_TIMER_SLACK, &slack, sizeof(slack));
+    EXPECT_EQ(status, NO_ERROR, "Error setting timer slack");
+    slack = 0u;
+    status = mx_object_get_property(handle, MX_PROP_THREAD_TIMER_SLACK, &slack, sizeof(slack));
+    EXPECT_EQ(status, NO_ERROR, "Error getting timer slack");
+    EXPECT_EQ(slack, 5u * 1000u * 1000u, "Wrong timer slack");
+
+    uint32_t small = 0u;
+    status = mx_object_set_property(handle, MX_PROP_THREAD_TIMER_SLACK, &small, sizeof(small));
+    EXPECT_EQ(status, ERR_NOT_ENOUGH_BUFFER, "Timer slack is an mx_time_t");
+
+    mx_handle_wait_one(handle, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, NULL);
+    mx_handle_close(handle);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(threads_tests)
 RUN_TEST(threads_test)
+RUN_TEST(thread_deadline_test)
+RUN_TEST(thread_affinity_test)
+RUN_TEST(thread_timer_slack_test)
 END_TEST_CASE(threads_tests)
 
 #ifndef BUILD_COMBINED_TESTS
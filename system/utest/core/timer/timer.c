@@ -0,0 +1,132 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+
+#include <magenta/syscalls.h>
+
+#include <unittest/unittest.h>
+
+#define MS(n) ((mx_time_t)(n) * 1000u * 1000u)
+
+static bool timer_create_test(void) {
+    BEGIN_TEST;
+
+    EXPECT_EQ(mx_timer_create(1u), ERR_INVALID_ARGS, "options must be 0");
+
+    mx_handle_t timer = mx_timer_create(0u);
+    ASSERT_GT(timer, 0, "mx_timer_create() failed");
+
+    mx_handle_basic_info_t info;
+    ASSERT_EQ(mx_handle_get_info(timer, MX_INFO_HANDLE_BASIC, &info, sizeof(info)),
+              (mx_ssize_t)sizeof(info), "");
+    EXPECT_EQ(info.type, (uint32_t)MX_OBJ_TYPE_TIMER, "");
+
+    mx_handle_t event = mx_event_create(0u);
+    ASSERT_GT(event, 0, "mx_event_create() failed");
+    EXPECT_EQ(mx_timer_set(event, 0u, 0u, 0u), ERR_WRONG_TYPE, "");
+    EXPECT_EQ(mx_timer_set(timer, 0u, 1000u, 0u), ERR_INVALID_ARGS, "period under 1ms");
+
+    EXPECT_EQ(mx_handle_close(event), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(timer), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool timer_oneshot_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t timer = mx_timer_create(0u);
+    ASSERT_GT(timer, 0, "mx_timer_create() failed");
+
+    mx_signals_state_t state;
+    EXPECT_EQ(mx_handle_wait_one(timer, MX_SIGNAL_SIGNALED, 0u, &state), ERR_TIMED_OUT,
+              "unset timer is signaled");
+
+    mx_time_t deadline = mx_current_time() + MS(20);
+    ASSERT_EQ(mx_timer_set(timer, deadline, 0u, 0u), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_wait_one(timer, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, &state),
+              NO_ERROR, "");
+    EXPECT_GE(mx_current_time(), deadline, "timer fired early");
+
+    // stays signaled until set again
+    EXPECT_EQ(mx_handle_wait_one(timer, MX_SIGNAL_SIGNALED, 0u, &state), NO_ERROR, "");
+    ASSERT_EQ(mx_timer_set(timer, mx_current_time() + MS(1000), 0u, MS(10)), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_wait_one(timer, MX_SIGNAL_SIGNALED, 0u, &state), ERR_TIMED_OUT,
+              "set did not clear the signal");
+
+    // a deadline in the past fires right away
+    ASSERT_EQ(mx_timer_set(timer, 0u, 0u, 0u), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_wait_one(timer, MX_SIGNAL_SIGNALED, MX_TIME_INFINITE, &state),
+              NO_ERROR, "");
+
+    EXPECT_EQ(mx_handle_close(timer), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool timer_cancel_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t timer = mx_timer_create(0u);
+    ASSERT_GT(timer, 0, "mx_timer_create() failed");
+
+    ASSERT_EQ(mx_timer_set(timer, mx_current_time() + MS(20), 0u, 0u), NO_ERROR, "");
+    EXPECT_EQ(mx_timer_cancel(timer), NO_ERROR, "");
+
+    mx_signals_state_t state;
+    EXPECT_EQ(mx_handle_wait_one(timer, MX_SIGNAL_SIGNALED, MS(50), &state), ERR_TIMED_OUT,
+              "cancelled timer fired");
+
+    // closing an armed timer is fine too
+    ASSERT_EQ(mx_timer_set(timer, mx_current_time() + MS(5), MS(5), 0u), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(timer), NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool timer_periodic_io_port_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t timer = mx_timer_create(0u);
+    ASSERT_GT(timer, 0, "mx_timer_create() failed");
+
+    mx_handle_t io_port = mx_io_port_create(0u);
+    ASSERT_GT(io_port, 0, "mx_io_port_create() failed");
+
+    const uint64_t key = 7u;
+    ASSERT_EQ(mx_io_port_bind(io_port, key, timer, MX_SIGNAL_SIGNALED), NO_ERROR, "");
+
+    mx_time_t start = mx_current_time();
+    ASSERT_EQ(mx_timer_set(timer, start + MS(10), MS(10), 0u), NO_ERROR, "");
+
+    // every period shows up as its own packet
+    for (int i = 0; i < 3; i++) {
+        mx_io_packet_t pkt;
+        ASSERT_EQ(mx_io_port_wait(io_port, MX_TIME_INFINITE, &pkt, sizeof(pkt)), NO_ERROR, "");
+        EXPECT_EQ(pkt.hdr.type, MX_IO_PORT_PKT_TYPE_IOSN, "");
+        EXPECT_EQ(pkt.hdr.key, key, "");
+        EXPECT_EQ(pkt.signals, MX_SIGNAL_SIGNALED, "");
+    }
+    EXPECT_GE(mx_current_time(), start + MS(30), "periods too short");
+
+    EXPECT_EQ(mx_timer_cancel(timer), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(timer), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(io_port), NO_ERROR, "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(timer_tests)
+RUN_TEST(timer_create_test)
+RUN_TEST(timer_oneshot_test)
+RUN_TEST(timer_cancel_test)
+RUN_TEST(timer_periodic_io_port_test)
+END_TEST_CASE(timer_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -0,0 +1,43 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/syscalls.h>
+#include <unittest/unittest.h>
+
+bool vdso_current_time_test(void) {
+    BEGIN_TEST;
+
+    // answered from the vDSO when it can be, so it has to keep up with
+    // the kernel's clock
+    mx_time_t last = mx_current_time();
+    for (int i = 0; i < 1000; i++) {
+        mx_time_t now = mx_current_time();
+        EXPECT_GE(now, last, "time went backwards");
+        last = now;
+    }
+
+    const mx_time_t sleep = 10 * 1000 * 1000;
+    mx_time_t before = mx_current_time();
+    EXPECT_EQ(mx_nanosleep(sleep), NO_ERROR, "nanosleep");
+    EXPECT_GE(mx_current_time() - before, sleep, "slept less than asked for");
+
+    END_TEST;
+}
+
+bool vdso_num_cpus_test(void) {
+    BEGIN_TEST;
+    EXPECT_GT(mx_num_cpus(), 0u, "no cpus");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(vdso_tests)
+RUN_TEST(vdso_current_time_test)
+RUN_TEST(vdso_num_cpus_test)
+END_TEST_CASE(vdso_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -415,6 +415,78 @@ bool wait_set_wait_cancelled_test(void) {
     END_TEST;
 }
 
+bool wait_set_edge_oneshot_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t ev[2] = {mx_event_create(0u), mx_event_create(0u)};
+    ASSERT_GT(ev[0], 0, "mx_event_create() failed");
+    ASSERT_GT(ev[1], 0, "mx_event_create() failed");
+
+    mx_handle_t ws = mx_wait_set_create();
+    ASSERT_GT(ws, 0, "mx_wait_set_create() failed");
+
+    EXPECT_EQ(mx_wait_set_add_etc(ws, ev[0], MX_SIGNAL_SIGNALED, 1u, 4u), ERR_INVALID_ARGS,
+              "unknown options");
+
+    const uint64_t edge = 1u;
+    EXPECT_EQ(mx_wait_set_add_etc(ws, ev[0], MX_SIGNAL_SIGNALED, edge, MX_WAIT_SET_ENTRY_EDGE),
+              NO_ERROR, "");
+    const uint64_t oneshot = 2u;
+    EXPECT_EQ(mx_wait_set_add_etc(ws, ev[1], MX_SIGNAL_SIGNALED, oneshot,
+                                  MX_WAIT_SET_ENTRY_ONESHOT), NO_ERROR, "");
+
+    // Only one-shot entries can be rearmed.
+    EXPECT_EQ(mx_wait_set_rearm(ws, edge), ERR_BAD_STATE, "");
+    EXPECT_EQ(mx_wait_set_rearm(ws, 3u), ERR_NOT_FOUND, "");
+
+    ASSERT_EQ(mx_event_signal(ev[0]), NO_ERROR, "");
+    ASSERT_EQ(mx_event_signal(ev[1]), NO_ERROR, "");
+
+    mx_wait_set_result_t results[5] = {};
+    uint32_t num_results = 5u;
+    uint32_t max_results = (uint32_t)-1;
+    ASSERT_EQ(mx_wait_set_wait(ws, 0u, &num_results, results, &max_results), NO_ERROR, "");
+    ASSERT_EQ(num_results, 2u, "wrong num_results from mx_wait_set_wait()");
+    EXPECT_EQ(max_results, 2u, "wrong max_results from mx_wait_set_wait()");
+    EXPECT_TRUE(check_results(num_results, results, edge, NO_ERROR, MX_SIGNAL_SIGNALED,
+                              MX_SIGNAL_SIGNALED | MX_SIGNAL_USER_ALL), "");
+    EXPECT_TRUE(check_results(num_results, results, oneshot, NO_ERROR, MX_SIGNAL_SIGNALED,
+                              MX_SIGNAL_SIGNALED | MX_SIGNAL_USER_ALL), "");
+
+    // Both are still signaled, but neither is newly ready.
+    num_results = 5u;
+    EXPECT_EQ(mx_wait_set_wait(ws, 0u, &num_results, results, NULL), ERR_TIMED_OUT, "");
+
+    // Going unsatisfied and back is a new edge, but the one-shot entry stays quiet.
+    ASSERT_EQ(mx_event_reset(ev[0]), NO_ERROR, "");
+    ASSERT_EQ(mx_event_reset(ev[1]), NO_ERROR, "");
+    ASSERT_EQ(mx_event_signal(ev[0]), NO_ERROR, "");
+    ASSERT_EQ(mx_event_signal(ev[1]), NO_ERROR, "");
+    num_results = 5u;
+    ASSERT_EQ(mx_wait_set_wait(ws, 0u, &num_results, results, NULL), NO_ERROR, "");
+    ASSERT_EQ(num_results, 1u, "wrong num_results from mx_wait_set_wait()");
+    EXPECT_EQ(results[0].cookie, edge, "");
+
+    // Rearming reports the one-shot entry again, since it is still signaled.
+    EXPECT_EQ(mx_wait_set_rearm(ws, oneshot), NO_ERROR, "");
+    num_results = 5u;
+    ASSERT_EQ(mx_wait_set_wait(ws, 0u, &num_results, results, NULL), NO_ERROR, "");
+    ASSERT_EQ(num_results, 1u, "wrong num_results from mx_wait_set_wait()");
+    EXPECT_EQ(results[0].cookie, oneshot, "");
+
+    // Closing the edge triggered handle is reported even though it was already reported ready.
+    EXPECT_EQ(mx_handle_close(ev[0]), NO_ERROR, "");
+    num_results = 5u;
+    ASSERT_EQ(mx_wait_set_wait(ws, 0u, &num_results, results, NULL), NO_ERROR, "");
+    ASSERT_EQ(num_results, 1u, "wrong num_results from mx_wait_set_wait()");
+    EXPECT_TRUE(check_results(num_results, results, edge, ERR_CANCELLED, 0u, 0u), "");
+
+    EXPECT_EQ(mx_handle_close(ws), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(ev[1]), NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(wait_set_tests)
 RUN_TEST(wait_set_create_test)
 RUN_TEST(wait_set_add_remove_test)
@@ -423,6 +495,7 @@ RUN_TEST(wait_set_wait_single_thread_1_test)
 RUN_TEST(wait_set_wait_single_thread_2_test)
 RUN_TEST(wait_set_wait_threaded_test)
 RUN_TEST(wait_set_wait_cancelled_test)
+RUN_TEST(wait_set_edge_oneshot_test)
 END_TEST_CASE(wait_set_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -126,7 +126,7 @@ static bool test_received_exception(mx_handle_t eport,
                                     mx_koid_t* tid)
 {
     mx_exception_packet_t packet;
-    ASSERT_EQ(mx_io_port_wait(eport, &packet, sizeof(packet)), NO_ERROR, "mx_io_port_wait failed");
+    ASSERT_EQ(mx_io_port_wait(eport, MX_TIME_INFINITE, &packet, sizeof(packet)), NO_ERROR, "mx_io_port_wait failed");
     const mx_exception_report_t* report = &packet.report;
 
     EXPECT_EQ(packet.hdr.key, 0u, "bad report key");
@@ -415,6 +415,40 @@ static bool thread_handler_test(void)
     END_TEST;
 }
 
+// Resume the crashed thread through the port its report came in on.
+
+static bool exception_resume_test(void)
+{
+    BEGIN_TEST;
+    unittest_printf("exception resume test\n");
+
+    mx_handle_t child, our_pipe;
+    start_test_child(&child, &our_pipe);
+    mx_handle_t eport = tu_io_port_create(0);
+    tu_set_exception_port(child, eport, 0);
+
+    send_msg(our_pipe, MSG_CRASH);
+    mx_exception_packet_t packet;
+    ASSERT_EQ(mx_io_port_wait(eport, MX_TIME_INFINITE, &packet, sizeof(packet)), NO_ERROR,
+              "mx_io_port_wait failed");
+    mx_koid_t pid = packet.report.context.pid;
+    mx_koid_t tid = packet.report.context.tid;
+
+    mx_handle_t other_port = tu_io_port_create(0);
+    EXPECT_EQ(mx_exception_resume(other_port, pid, tid, MX_EXCEPTION_STATUS_NOT_HANDLED),
+              ERR_ACCESS_DENIED, "resume through the wrong port");
+    tu_handle_close(other_port);
+
+    EXPECT_EQ(mx_exception_resume(eport, pid, tid, MX_EXCEPTION_STATUS_NOT_HANDLED),
+              NO_ERROR, "mx_exception_resume failed");
+    tu_wait_signalled(child);
+
+    tu_handle_close(child);
+    tu_handle_close(eport);
+    tu_handle_close(our_pipe);
+    END_TEST;
+}
+
 static bool process_gone_notification_test(void)
 {
     BEGIN_TEST;
@@ -476,6 +510,7 @@ RUN_TEST(thread_set_close_set_test);
 RUN_TEST(system_handler_test);
 RUN_TEST(process_handler_test);
 RUN_TEST(thread_handler_test);
+RUN_TEST(exception_resume_test);
 RUN_TEST(process_gone_notification_test);
 RUN_TEST(thread_gone_notification_test);
 END_TEST_CASE(exceptions_tests)
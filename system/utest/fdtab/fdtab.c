@@ -0,0 +1,100 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <magenta/syscalls.h>
+#include <mxio/util.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <unittest/unittest.h>
+
+// Readers look fds up without taking mxio_lock, so replacing or closing an
+// fd has to wait out the readers that may still hold its old mxio, even
+// while sets on other fds are moving the lookup generation along. Freed
+// mxios have their ops cleared, so a reader that gets hold of one crashes.
+
+#define READERS 4
+#define ITERATIONS 20000
+
+static int target_fd;
+static int stop;
+static int bad_reads;
+
+static void* reader(void* arg) {
+    char c;
+    while (!__atomic_load_n(&stop, __ATOMIC_SEQ_CST)) {
+        ssize_t r = read(target_fd, &c, 1);
+        if (r != 0 && !(r < 0 && errno == EBADF)) {
+            __atomic_fetch_add(&bad_reads, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    return NULL;
+}
+
+static int bind_null(int fd, int starting_fd) {
+    mxio_t* io = mxio_null_create();
+    if (io == NULL) {
+        return -1;
+    }
+    return mxio_bind_to_fd(io, fd, starting_fd);
+}
+
+bool replace_while_reading_test(void) {
+    BEGIN_TEST;
+
+    target_fd = bind_null(-1, 0);
+    ASSERT_GE(target_fd, 0, "could not bind target fd");
+    // a nearby fd, so in another bucket, whose sets start generations
+    // without waiting on the target's
+    int other_fd = bind_null(-1, target_fd + 1);
+    ASSERT_GE(other_fd, 0, "could not bind other fd");
+    int src_fd = bind_null(-1, 0);
+    ASSERT_GE(src_fd, 0, "could not bind source fd");
+
+    __atomic_store_n(&stop, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&bad_reads, 0, __ATOMIC_SEQ_CST);
+
+    pthread_t threads[READERS];
+    for (int i = 0; i < READERS; i++) {
+        ASSERT_EQ(pthread_create(&threads[i], NULL, reader, NULL), 0, "pthread_create failed");
+    }
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        // move the generation along from another fd
+        EXPECT_EQ(close(other_fd), 0, "close other fd failed");
+        EXPECT_EQ(dup2(src_fd, other_fd), other_fd, "dup2 other fd failed");
+
+        // and free the mxio the readers are using, by replacing it with a
+        // fresh one or by closing the fd
+        if (i % 2) {
+            EXPECT_EQ(bind_null(target_fd, 0), target_fd, "replace target fd failed");
+        } else {
+            EXPECT_EQ(close(target_fd), 0, "close target fd failed");
+            EXPECT_EQ(dup2(src_fd, target_fd), target_fd, "dup2 target fd failed");
+            EXPECT_EQ(bind_null(target_fd, 0), target_fd, "replace target fd failed");
+        }
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    EXPECT_EQ(__atomic_load_n(&bad_reads, __ATOMIC_SEQ_CST), 0, "reads of a replaced fd failed");
+
+    close(target_fd);
+    close(other_fd);
+    close(src_fd);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(fdtab_tests)
+RUN_TEST(replace_while_reading_test)
+END_TEST_CASE(fdtab_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,57 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unittest/unittest.h>
+
+// Large allocations get a mapping of their own, which free keeps around
+// for reuse: committed with whatever was written to it, or past a limit,
+// with all but its first page decommitted. Enough of them to go over the
+// limit covers both kinds.
+#define LARGE_SIZE (1024 * 1024)
+#define LARGE_COUNT 12
+
+static bool all_zero(const unsigned char* p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool calloc_after_free_test(void) {
+    BEGIN_TEST;
+
+    void* p[LARGE_COUNT];
+    for (int i = 0; i < LARGE_COUNT; i++) {
+        p[i] = malloc(LARGE_SIZE);
+        ASSERT_NEQ(p[i], NULL, "malloc failed");
+        memset(p[i], 0xa5, LARGE_SIZE);
+    }
+    for (int i = 0; i < LARGE_COUNT; i++) {
+        free(p[i]);
+    }
+
+    for (int i = 0; i < LARGE_COUNT; i++) {
+        p[i] = calloc(1, LARGE_SIZE);
+        ASSERT_NEQ(p[i], NULL, "calloc failed");
+        EXPECT_TRUE(all_zero(p[i], LARGE_SIZE), "calloc returned old data");
+    }
+    for (int i = 0; i < LARGE_COUNT; i++) {
+        free(p[i]);
+    }
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(malloc_tests)
+RUN_TEST(calloc_after_free_test)
+END_TEST_CASE(malloc_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
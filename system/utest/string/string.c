@@ -0,0 +1,140 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unittest/unittest.h>
+
+// The vectorized string routines read whole aligned blocks, so every
+// alignment and length is checked against a byte at a time version, as are
+// strings that end at a page boundary.
+
+#define PAGE 4096
+#define MAX_LEN 256
+
+static size_t ref_strlen(const char* s) {
+    const char* p = s;
+    while (*p)
+        p++;
+    return p - s;
+}
+
+static const void* ref_memchr(const void* s, int c, size_t n) {
+    const unsigned char* p = s;
+    for (; n; n--, p++) {
+        if (*p == (unsigned char)c)
+            return p;
+    }
+    return NULL;
+}
+
+static int ref_memcmp(const void* a, const void* b, size_t n) {
+    const unsigned char *l = a, *r = b;
+    for (; n; n--, l++, r++) {
+        if (*l != *r)
+            return *l - *r;
+    }
+    return 0;
+}
+
+static const char* ref_strchrnul(const char* s, int c) {
+    while (*s && *s != (char)c)
+        s++;
+    return s;
+}
+
+static int ref_strcmp(const char* l, const char* r) {
+    for (; *l == *r && *l; l++, r++)
+        ;
+    return *(const unsigned char*)l - *(const unsigned char*)r;
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+// len bytes without a 'z', the last one high, then the terminator
+static void fill(char* s, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        s[i] = 'a' + i % 25;
+    if (len)
+        s[len - 1] = (char)0xe0;
+    s[len] = 0;
+}
+
+// whether every routine agrees with its reference on a and b
+static bool check(const char* a, const char* b, size_t len) {
+    if (strlen(a) != ref_strlen(a))
+        return false;
+    for (int c = 0; c < 256; c += 0x1f) {
+        if (memchr(a, c, len) != ref_memchr(a, c, len) ||
+            strchrnul(a, c) != ref_strchrnul(a, c))
+            return false;
+    }
+    return memchr(a, 0, len + 1) == ref_memchr(a, 0, len + 1) &&
+           strchr(a, 'z') == NULL &&
+           sign(memcmp(a, b, len)) == sign(ref_memcmp(a, b, len)) &&
+           sign(strcmp(a, b)) == sign(ref_strcmp(a, b)) &&
+           sign(strcmp(b, a)) == sign(ref_strcmp(b, a));
+}
+
+bool alignment_test(void) {
+    BEGIN_TEST;
+
+    static char abuf[64 + MAX_LEN + 1];
+    static char bbuf[64 + MAX_LEN + 1];
+    for (size_t align = 0; align < 64; align++) {
+        for (size_t len = 0; len < MAX_LEN; len++) {
+            char* a = abuf + align;
+            char* b = bbuf + (align * 7) % 64;
+            fill(a, len);
+            fill(b, len);
+            ASSERT_TRUE(check(a, b, len), "equal strings");
+            if (len) {
+                // differing at the start, the middle and the end
+                b[0]++;
+                ASSERT_TRUE(check(a, b, len), "differing at the start");
+                b[0]--;
+                b[len / 2] = 'z';
+                ASSERT_TRUE(check(a, b, len), "differing in the middle");
+                b[len / 2] = a[len / 2];
+                b[len - 1] = 0x10;
+                ASSERT_TRUE(check(a, b, len), "differing at the end");
+            }
+        }
+    }
+
+    END_TEST;
+}
+
+bool page_end_test(void) {
+    BEGIN_TEST;
+
+    // strings ending at the end of a page, as they would before an unmapped one
+    char* buf = aligned_alloc(PAGE, 3 * PAGE);
+    ASSERT_TRUE(buf != NULL, "alloc");
+    for (size_t len = 0; len < MAX_LEN; len++) {
+        for (size_t skew = 0; skew < 17; skew += 8) {
+            char* a = buf + PAGE - len - 1;
+            char* b = buf + 3 * PAGE - len - 1 - skew;
+            fill(a, len);
+            fill(b, len);
+            ASSERT_TRUE(check(a, b, len), "at a page end");
+        }
+    }
+    free(buf);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(string_tests)
+RUN_TEST(alignment_test)
+RUN_TEST(page_end_test)
+END_TEST_CASE(string_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -0,0 +1,158 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unittest/unittest.h>
+#include <vecmath/vecmath.h>
+
+// Everything in range is checked against the double precision libm function,
+// and everything out of it against the float one, which it should match bit
+// for bit. Every length up to a few vectors is tried, in place as well.
+
+#define COUNT 4099
+
+typedef void (*batch_fn)(float* y, const float* x, size_t n);
+
+static float in[COUNT], out[COUNT];
+
+static float random_in(float lo, float hi) {
+    return lo + (hi - lo) * ((float)rand() / (float)RAND_MAX);
+}
+
+static double ulps(float got, double want) {
+    if ((float)want == got)
+        return 0.0;
+    int e;
+    frexp(want, &e);
+    return fabs(got - want) / ldexp(1.0, e - 24);
+}
+
+static bool same(float a, float b) {
+    return (isnan(a) && isnan(b)) || !memcmp(&a, &b, sizeof(a));
+}
+
+static bool check_accuracy(batch_fn f, double (*ref)(double), float lo, float hi) {
+    for (size_t i = 0; i < COUNT; i++)
+        in[i] = random_in(lo, hi);
+    f(out, in, COUNT);
+    for (size_t i = 0; i < COUNT; i++) {
+        if (ulps(out[i], ref(in[i])) > 1.0) {
+            unittest_printf("f(%a) = %a, not %a\n", in[i], out[i], ref(in[i]));
+            return false;
+        }
+    }
+    return true;
+}
+
+static const float specials[] = {
+    0.0f, -0.0f, INFINITY, -INFINITY, NAN, 0x1p-140f, -0x1p-140f, -1.0f,
+    100.0f, -100.0f, 1e30f, -1e30f, 0x1p29f, 3e38f,
+};
+
+static bool check_specials(batch_fn f, float (*ref)(float)) {
+    size_t n = countof(specials);
+    f(out, specials, n);
+    for (size_t i = 0; i < n; i++) {
+        if (!same(out[i], ref(specials[i]))) {
+            unittest_printf("f(%a) = %a, not %a\n", specials[i], out[i], ref(specials[i]));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_lengths(batch_fn f) {
+    float whole[64], part[64];
+    for (size_t i = 0; i < 64; i++)
+        in[i] = random_in(-10.0f, 10.0f);
+    f(whole, in, 64);
+    for (size_t n = 0; n < 64; n++) {
+        memcpy(part, in, n * sizeof(float));
+        f(part, part, n);
+        for (size_t i = 0; i < n; i++) {
+            if (!same(part[i], whole[i]))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool exp_test(void) {
+    BEGIN_TEST;
+    EXPECT_TRUE(check_accuracy(vexpf, exp, -87.0f, 88.0f), "accuracy");
+    EXPECT_TRUE(check_accuracy(vexpf, exp, -1.0f, 1.0f), "accuracy near 0");
+    EXPECT_TRUE(check_specials(vexpf, expf), "special values");
+    EXPECT_TRUE(check_lengths(vexpf), "lengths");
+    END_TEST;
+}
+
+bool log_test(void) {
+    BEGIN_TEST;
+    EXPECT_TRUE(check_accuracy(vlogf, log, 0x1p-126f, 1e38f), "accuracy");
+    EXPECT_TRUE(check_accuracy(vlogf, log, 0.5f, 2.0f), "accuracy near 1");
+    EXPECT_TRUE(check_specials(vlogf, logf), "special values");
+    EXPECT_TRUE(check_lengths(vlogf), "lengths");
+    END_TEST;
+}
+
+bool sin_test(void) {
+    BEGIN_TEST;
+    EXPECT_TRUE(check_accuracy(vsinf, sin, -8.0f, 8.0f), "accuracy");
+    EXPECT_TRUE(check_accuracy(vsinf, sin, -0x1p28f, 0x1p28f), "accuracy, large");
+    EXPECT_TRUE(check_specials(vsinf, sinf), "special values");
+    EXPECT_TRUE(check_lengths(vsinf), "lengths");
+    END_TEST;
+}
+
+bool cos_test(void) {
+    BEGIN_TEST;
+    EXPECT_TRUE(check_accuracy(vcosf, cos, -8.0f, 8.0f), "accuracy");
+    EXPECT_TRUE(check_accuracy(vcosf, cos, -0x1p28f, 0x1p28f), "accuracy, large");
+    EXPECT_TRUE(check_specials(vcosf, cosf), "special values");
+    EXPECT_TRUE(check_lengths(vcosf), "lengths");
+    END_TEST;
+}
+
+bool pow_test(void) {
+    BEGIN_TEST;
+    static float x[COUNT], y[COUNT], z[COUNT];
+    for (size_t i = 0; i < COUNT; i++) {
+        x[i] = expf(random_in(-20.0f, 20.0f));
+        y[i] = random_in(-30.0f, 30.0f);
+    }
+    vpowf(z, x, y, COUNT);
+    for (size_t i = 0; i < COUNT; i++) {
+        double want = pow(x[i], y[i]);
+        // out of float range, or near enough to it for libm to round
+        if (fabs(want) < 0x1p-126 || fabs(want) > 0x1p127)
+            want = powf(x[i], y[i]);
+        EXPECT_TRUE(ulps(z[i], want) <= 1.0, "accuracy");
+    }
+
+    // x < 0, x = 0 and the like are libm's
+    size_t n = countof(specials);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = specials[i];
+        y[i] = i & 1 ? 3.0f : 0.5f;
+    }
+    vpowf(z, x, y, n);
+    for (size_t i = 0; i < n; i++)
+        EXPECT_TRUE(same(z[i], powf(x[i], y[i])), "special values");
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(vecmath_tests)
+RUN_TEST(exp_test)
+RUN_TEST(log_test)
+RUN_TEST(sin_test)
+RUN_TEST(cos_test)
+RUN_TEST(pow_test)
+END_TEST_CASE(vecmath_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -4,6 +4,7 @@
 
 #include <ctype.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -72,6 +73,454 @@ bool vmo_read_write_test(void) {
     END_TEST;
 }
 
+bool vmo_map_flags_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_handle_t vmo;
+
+    const size_t len = PAGE_SIZE * 64;
+    const uint32_t map_flags[] = {
+        MX_VM_FLAG_MAP_POPULATE,
+        MX_VM_FLAG_MAP_SEQUENTIAL,
+        MX_VM_FLAG_MAP_POPULATE | MX_VM_FLAG_MAP_SEQUENTIAL,
+    };
+
+    for (size_t i = 0; i < countof(map_flags); i++) {
+        vmo = mx_vm_object_create(len);
+        EXPECT_LT(0, vmo, "vm_object_create");
+
+        uintptr_t ptr;
+        status = mx_process_vm_map(0, vmo, 0, len, &ptr,
+                                   MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE | map_flags[i]);
+        EXPECT_EQ(NO_ERROR, status, "vm_map");
+        EXPECT_NEQ(0u, ptr, "vm_map");
+
+        // every page should read back as zero and hold what we write to it
+        for (size_t off = 0; off < len; off += PAGE_SIZE) {
+            volatile uint8_t* p = (volatile uint8_t*)(ptr + off);
+            EXPECT_EQ(0u, *p, "zero filled");
+            *p = (uint8_t)(off / PAGE_SIZE);
+        }
+
+        uint8_t buf[1];
+        for (size_t off = 0; off < len; off += PAGE_SIZE) {
+            mx_ssize_t sstatus = mx_vm_object_read(vmo, buf, off, sizeof(buf));
+            EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read");
+            EXPECT_EQ((uint8_t)(off / PAGE_SIZE), buf[0], "mapped write visible");
+        }
+
+        status = mx_process_vm_unmap(0, ptr, 0);
+        EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+        status = mx_handle_close(vmo);
+        EXPECT_EQ(NO_ERROR, status, "handle_close");
+    }
+
+    END_TEST;
+}
+
+bool vmo_map_many_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+
+    // three objects, each filled with its own byte, mapped in one call
+    enum { kCount = 3 };
+    const size_t len = PAGE_SIZE * 2;
+    mx_handle_t vmos[kCount];
+    mx_vm_map_entry_t entries[kCount];
+    for (int i = 0; i < kCount; i++) {
+        vmos[i] = mx_vm_object_create(len);
+        ASSERT_LT(0, vmos[i], "vm_object_create");
+
+        uint8_t buf[PAGE_SIZE];
+        memset(buf, 0x10 + i, sizeof(buf));
+        mx_ssize_t sstatus = mx_vm_object_write(vmos[i], buf, PAGE_SIZE, sizeof(buf));
+        EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_write");
+
+        entries[i] = (mx_vm_map_entry_t){
+            .vmo = vmos[i],
+            .flags = MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+            .offset = i == 1 ? PAGE_SIZE : 0,
+            .len = i == 1 ? PAGE_SIZE : len,
+        };
+    }
+    status = mx_process_vm_map_many(0, entries, kCount, 0);
+    ASSERT_EQ(NO_ERROR, status, "vm_map_many");
+    for (int i = 0; i < kCount; i++) {
+        EXPECT_NEQ(0u, entries[i].ptr, "mapped address");
+        const volatile uint8_t* p = (const volatile uint8_t*)entries[i].ptr;
+        EXPECT_EQ(0x10 + i, p[i == 1 ? 0 : PAGE_SIZE], "mapped contents");
+    }
+
+    // move them around, the first two to where the last two were and the
+    // last to where the first still is; that fails, and the two that were
+    // mapped come out again, so they map at the same spots once it's free
+    uintptr_t first = entries[0].ptr;
+    uintptr_t second = entries[1].ptr;
+    uintptr_t third = entries[2].ptr;
+    status = mx_process_vm_unmap(0, second, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+    status = mx_process_vm_unmap(0, third, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+    for (int i = 0; i < kCount; i++)
+        entries[i].flags |= MX_VM_FLAG_FIXED;
+    entries[0].ptr = third;
+    entries[1].ptr = second;
+    entries[2].ptr = first;
+    status = mx_process_vm_map_many(0, entries, kCount, 0);
+    EXPECT_NEQ(NO_ERROR, status, "overlapping mapping");
+    EXPECT_EQ(third, entries[0].ptr, "not written back");
+
+    status = mx_process_vm_unmap(0, first, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+    entries[2].ptr = first;
+    status = mx_process_vm_map_many(0, entries, kCount, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_map_many after undo");
+    for (int i = 0; i < kCount; i++) {
+        status = mx_process_vm_unmap(0, entries[i].ptr, 0);
+        EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+    }
+
+    entries[2].vmo = MX_HANDLE_INVALID;
+    status = mx_process_vm_map_many(0, entries, kCount, 0);
+    EXPECT_EQ(ERR_BAD_HANDLE, status, "bad handle");
+
+    status = mx_process_vm_map_many(0, entries, 0, 0);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "no entries");
+    status = mx_process_vm_map_many(0, entries, MX_VM_MAP_BATCH_MAX + 1, 0);
+    EXPECT_EQ(ERR_TOO_BIG, status, "too many entries");
+
+    for (int i = 0; i < kCount; i++) {
+        status = mx_handle_close(vmos[i]);
+        EXPECT_EQ(NO_ERROR, status, "handle_close");
+    }
+
+    END_TEST;
+}
+
+bool vmo_clone_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_ssize_t sstatus;
+
+    const size_t len = PAGE_SIZE * 4;
+    mx_handle_t vmo = mx_vm_object_create(len);
+    EXPECT_LT(0, vmo, "vm_object_create");
+
+    char buf[PAGE_SIZE];
+    for (size_t i = 0; i < len / PAGE_SIZE; i++) {
+        memset(buf, 'a' + (int)i, sizeof(buf));
+        sstatus = mx_vm_object_write(vmo, buf, i * PAGE_SIZE, sizeof(buf));
+        EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_write");
+    }
+
+    // unaligned offsets can't be cloned
+    mx_handle_t clone = mx_vm_object_clone(vmo, 1, len);
+    EXPECT_EQ(ERR_INVALID_ARGS, clone, "vm_object_clone unaligned");
+
+    // clone the last three pages and check the clone sees the parent's data
+    clone = mx_vm_object_clone(vmo, PAGE_SIZE, len - PAGE_SIZE);
+    EXPECT_LT(0, clone, "vm_object_clone");
+
+    sstatus = mx_vm_object_read(clone, buf, 0, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read clone");
+    EXPECT_EQ('b', buf[0], "clone shares parent data");
+
+    // writing to the clone leaves the parent alone
+    memset(buf, 'x', sizeof(buf));
+    sstatus = mx_vm_object_write(clone, buf, 0, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_write clone");
+    sstatus = mx_vm_object_read(vmo, buf, PAGE_SIZE, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read");
+    EXPECT_EQ('b', buf[0], "parent unchanged by clone write");
+
+    // and so does writing through a mapping of it
+    uintptr_t ptr;
+    status = mx_process_vm_map(0, clone, 0, len - PAGE_SIZE, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    EXPECT_EQ(NO_ERROR, status, "vm_map clone");
+    volatile char* p = (volatile char*)ptr;
+    EXPECT_EQ('x', p[0], "mapped clone sees its own write");
+    EXPECT_EQ('c', p[PAGE_SIZE], "mapped clone sees parent data");
+    p[PAGE_SIZE] = 'y';
+    sstatus = mx_vm_object_read(vmo, buf, PAGE_SIZE * 2, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read");
+    EXPECT_EQ('c', buf[0], "parent unchanged by mapped clone write");
+    status = mx_process_vm_unmap(0, ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    // writing to the parent through a mapping leaves the clone with the old data, even once
+    // the page has been read through the mapping first
+    status = mx_process_vm_map(0, vmo, 0, len, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    EXPECT_EQ(NO_ERROR, status, "vm_map");
+    p = (volatile char*)ptr;
+    EXPECT_EQ('d', p[PAGE_SIZE * 3], "mapped parent data");
+    p[PAGE_SIZE * 3] = 'w';
+    sstatus = mx_vm_object_read(clone, buf, PAGE_SIZE * 2, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read clone");
+    EXPECT_EQ('d', buf[0], "clone unchanged by mapped parent write");
+    status = mx_process_vm_unmap(0, ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    // and so does writing to it directly
+    memset(buf, 'z', sizeof(buf));
+    sstatus = mx_vm_object_write(vmo, buf, PAGE_SIZE * 3, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_write");
+    sstatus = mx_vm_object_read(clone, buf, PAGE_SIZE * 2, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read clone");
+    EXPECT_EQ('d', buf[0], "clone unchanged by parent write");
+
+    // the clone outlives the handle to its parent
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+    sstatus = mx_vm_object_read(clone, buf, PAGE_SIZE * 2, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read clone");
+    EXPECT_EQ('d', buf[0], "clone keeps parent data alive");
+
+    status = mx_handle_close(clone);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_slice_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_ssize_t sstatus;
+
+    const size_t len = PAGE_SIZE * 4;
+    mx_handle_t vmo = mx_vm_object_create(len);
+    EXPECT_LT(0, vmo, "vm_object_create");
+
+    char buf[PAGE_SIZE];
+    for (size_t i = 0; i < len / PAGE_SIZE; i++) {
+        memset(buf, 'a' + (int)i, sizeof(buf));
+        sstatus = mx_vm_object_write(vmo, buf, i * PAGE_SIZE, sizeof(buf));
+        EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_write");
+    }
+
+    mx_handle_t slice = mx_vm_object_slice(vmo, 1, PAGE_SIZE);
+    EXPECT_EQ(ERR_INVALID_ARGS, slice, "vm_object_slice unaligned");
+    slice = mx_vm_object_slice(vmo, PAGE_SIZE, len);
+    EXPECT_EQ(ERR_OUT_OF_RANGE, slice, "vm_object_slice past the end");
+
+    slice = mx_vm_object_slice(vmo, PAGE_SIZE, PAGE_SIZE * 2);
+    EXPECT_LT(0, slice, "vm_object_slice");
+
+    uint64_t size;
+    status = mx_vm_object_get_size(slice, &size);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_get_size slice");
+    EXPECT_EQ(PAGE_SIZE * 2, size, "slice size");
+
+    // writes through either object show up in the other
+    sstatus = mx_vm_object_read(slice, buf, 0, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read slice");
+    EXPECT_EQ('b', buf[0], "slice sees parent data");
+
+    uintptr_t ptr;
+    status = mx_process_vm_map(0, slice, 0, PAGE_SIZE * 2, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    EXPECT_EQ(NO_ERROR, status, "vm_map slice");
+    volatile char* p = (volatile char*)ptr;
+    EXPECT_EQ('c', p[PAGE_SIZE], "mapped slice sees parent data");
+    p[PAGE_SIZE] = 'y';
+    sstatus = mx_vm_object_read(vmo, buf, PAGE_SIZE * 2, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read");
+    EXPECT_EQ('y', buf[0], "parent sees mapped slice write");
+
+    // the parent's pages can't be pulled out from under the mapping
+    status = mx_vm_object_op(vmo, MX_VMO_OP_DECOMMIT, 0, len);
+    EXPECT_EQ(ERR_BAD_STATE, status, "vm_object_op decommit parent of slice");
+    status = mx_vm_object_op(slice, MX_VMO_OP_DECOMMIT, 0, PAGE_SIZE);
+    EXPECT_EQ(ERR_NOT_SUPPORTED, status, "vm_object_op decommit slice");
+
+    status = mx_process_vm_unmap(0, ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    // a slice of a read-only handle is read-only
+    mx_handle_t ro = mx_handle_duplicate(vmo, MX_RIGHT_READ | MX_RIGHT_DUPLICATE);
+    EXPECT_LT(0, ro, "handle_duplicate");
+    mx_handle_t ro_slice = mx_vm_object_slice(ro, 0, PAGE_SIZE);
+    EXPECT_LT(0, ro_slice, "vm_object_slice read-only");
+    sstatus = mx_vm_object_write(ro_slice, buf, 0, sizeof(buf));
+    EXPECT_EQ(ERR_ACCESS_DENIED, sstatus, "vm_object_write read-only slice");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(ro_slice), "handle_close");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(ro), "handle_close");
+
+    // the slice outlives the handle to its parent
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+    sstatus = mx_vm_object_read(slice, buf, PAGE_SIZE, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read slice");
+    EXPECT_EQ('y', buf[0], "slice keeps parent data alive");
+
+    status = mx_handle_close(slice);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_decommit_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_ssize_t sstatus;
+
+    const size_t len = PAGE_SIZE * 4;
+    mx_handle_t vmo = mx_vm_object_create(len);
+    EXPECT_LT(0, vmo, "vm_object_create");
+
+    status = mx_vm_object_op(vmo, MX_VMO_OP_COMMIT, 0, len);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_op commit");
+
+    uintptr_t ptr;
+    status = mx_process_vm_map(0, vmo, 0, len, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE);
+    EXPECT_EQ(NO_ERROR, status, "vm_map");
+    volatile char* p = (volatile char*)ptr;
+    for (size_t i = 0; i < len / PAGE_SIZE; i++)
+        p[i * PAGE_SIZE] = 'a' + (char)i;
+
+    // decommitting pulls the pages out from under the mapping, leaving zeroes behind
+    status = mx_vm_object_op(vmo, MX_VMO_OP_DECOMMIT, PAGE_SIZE, PAGE_SIZE * 2);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_op decommit");
+    EXPECT_EQ('a', p[0], "page before the range kept");
+    EXPECT_EQ(0, p[PAGE_SIZE], "mapped page decommitted");
+    EXPECT_EQ(0, p[PAGE_SIZE * 2], "mapped page decommitted");
+    EXPECT_EQ('d', p[PAGE_SIZE * 3], "page after the range kept");
+
+    char c = 'x';
+    sstatus = mx_vm_object_read(vmo, &c, PAGE_SIZE * 2, 1);
+    EXPECT_EQ(1, sstatus, "vm_object_read");
+    EXPECT_EQ(0, c, "object page decommitted");
+
+    // the range can be used again afterwards
+    p[PAGE_SIZE] = 'y';
+    sstatus = mx_vm_object_read(vmo, &c, PAGE_SIZE, 1);
+    EXPECT_EQ(1, sstatus, "vm_object_read");
+    EXPECT_EQ('y', c, "decommitted page faulted back in");
+
+    status = mx_process_vm_unmap(0, ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    status = mx_vm_object_op(vmo, MX_VMO_OP_DECOMMIT, len, PAGE_SIZE);
+    EXPECT_EQ(ERR_OUT_OF_RANGE, status, "vm_object_op out of range");
+    status = mx_vm_object_op(vmo, 0, 0, len);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "vm_object_op bad op");
+
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_low_memory_event_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+
+    mx_handle_t event = mx_vm_low_memory_event();
+    EXPECT_LT(0, event, "vm_low_memory_event");
+
+    // anyone can wait on it, but only the kernel gets to change it
+    mx_signals_state_t state;
+    status = mx_handle_wait_one(event, MX_SIGNAL_SIGNALED, 0u, &state);
+    EXPECT_TRUE(status == NO_ERROR || status == ERR_TIMED_OUT, "handle_wait_one");
+    EXPECT_TRUE(state.satisfiable & MX_SIGNAL_SIGNALED, "low memory event can be signaled");
+
+    status = mx_event_signal(event);
+    EXPECT_EQ(ERR_ACCESS_DENIED, status, "event_signal");
+    status = mx_object_signal(event, MX_SIGNAL_USER0, 0u);
+    EXPECT_EQ(ERR_ACCESS_DENIED, status, "object_signal");
+
+    status = mx_handle_close(event);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_memory_info_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_ssize_t sstatus;
+
+    // a fresh process has nothing mapped, so its totals only reflect what we do to it
+    static const char name[] = "vmo_memory_info";
+    mx_handle_t proc = mx_process_create(name, sizeof(name));
+    EXPECT_LT(0, proc, "process_create");
+
+    mx_process_memory_info_t proc_info;
+    sstatus = mx_handle_get_info(proc, MX_INFO_PROCESS_MEMORY, &proc_info, sizeof(proc_info));
+    EXPECT_EQ((mx_ssize_t)sizeof(proc_info), sstatus, "get_info process memory");
+    EXPECT_EQ(0u, proc_info.mapped_bytes, "nothing mapped");
+    EXPECT_EQ(0u, proc_info.committed_bytes, "nothing committed");
+
+    const size_t len = PAGE_SIZE * 4;
+    mx_handle_t vmo = mx_vm_object_create(len);
+    EXPECT_LT(0, vmo, "vm_object_create");
+
+    mx_vmo_info_t vmo_info;
+    sstatus = mx_handle_get_info(vmo, MX_INFO_VMO, &vmo_info, sizeof(vmo_info));
+    EXPECT_EQ((mx_ssize_t)sizeof(vmo_info), sstatus, "get_info vmo");
+    EXPECT_EQ(len, vmo_info.size, "vmo size");
+    EXPECT_EQ(0u, vmo_info.committed_bytes, "vmo starts empty");
+
+    uintptr_t ptr;
+    status = mx_process_vm_map(proc, vmo, 0, len, &ptr,
+                               MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE |
+                               MX_VM_FLAG_MAP_POPULATE);
+    EXPECT_EQ(NO_ERROR, status, "vm_map");
+
+    sstatus = mx_handle_get_info(proc, MX_INFO_PROCESS_MEMORY, &proc_info, sizeof(proc_info));
+    EXPECT_EQ((mx_ssize_t)sizeof(proc_info), sstatus, "get_info process memory");
+    EXPECT_EQ(len, proc_info.mapped_bytes, "mapping counted");
+    EXPECT_EQ(len, proc_info.committed_bytes, "populated pages counted");
+
+    sstatus = mx_handle_get_info(vmo, MX_INFO_VMO, &vmo_info, sizeof(vmo_info));
+    EXPECT_EQ((mx_ssize_t)sizeof(vmo_info), sstatus, "get_info vmo");
+    EXPECT_EQ(len, vmo_info.committed_bytes, "vmo pages counted");
+
+    // decommitting takes the pages out of both
+    status = mx_vm_object_op(vmo, MX_VMO_OP_DECOMMIT, PAGE_SIZE, PAGE_SIZE * 2);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_op decommit");
+
+    sstatus = mx_handle_get_info(proc, MX_INFO_PROCESS_MEMORY, &proc_info, sizeof(proc_info));
+    EXPECT_EQ((mx_ssize_t)sizeof(proc_info), sstatus, "get_info process memory");
+    EXPECT_EQ(len, proc_info.mapped_bytes, "mapping still counted");
+    EXPECT_EQ(PAGE_SIZE * 2u, proc_info.committed_bytes, "decommitted pages dropped");
+
+    sstatus = mx_handle_get_info(vmo, MX_INFO_VMO, &vmo_info, sizeof(vmo_info));
+    EXPECT_EQ((mx_ssize_t)sizeof(vmo_info), sstatus, "get_info vmo");
+    EXPECT_EQ(PAGE_SIZE * 2u, vmo_info.committed_bytes, "decommitted pages dropped");
+
+    status = mx_process_vm_unmap(proc, ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    sstatus = mx_handle_get_info(proc, MX_INFO_PROCESS_MEMORY, &proc_info, sizeof(proc_info));
+    EXPECT_EQ((mx_ssize_t)sizeof(proc_info), sstatus, "get_info process memory");
+    EXPECT_EQ(0u, proc_info.mapped_bytes, "unmapped");
+    EXPECT_EQ(0u, proc_info.committed_bytes, "unmapped");
+
+    // the topics only apply to their own object types
+    sstatus = mx_handle_get_info(vmo, MX_INFO_PROCESS_MEMORY, &proc_info, sizeof(proc_info));
+    EXPECT_EQ(ERR_WRONG_TYPE, sstatus, "process topic on a vmo");
+    sstatus = mx_handle_get_info(proc, MX_INFO_VMO, &vmo_info, sizeof(vmo_info));
+    EXPECT_EQ(ERR_WRONG_TYPE, sstatus, "vmo topic on a process");
+
+    status = mx_handle_close(vmo);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+    status = mx_handle_close(proc);
+    EXPECT_EQ(NO_ERROR, status, "handle_close");
+
+    END_TEST;
+}
+
 bool vmo_resize_test(void) {
     BEGIN_TEST;
 
@@ -117,10 +566,178 @@ bool vmo_resize_test(void) {
     END_TEST;
 }
 
+typedef struct pager_server {
+    mx_handle_t port;
+    mx_handle_t vmo;
+    int requests;
+} pager_server_t;
+
+// Supplies each page of the object with its index in 'a'... and fails the
+// fourth, until a user packet comes in.
+static void* pager_server(void* arg) {
+    pager_server_t* server = arg;
+
+    for (;;) {
+        mx_pager_packet_t packet;
+        if (mx_io_port_wait(server->port, MX_TIME_INFINITE, &packet, sizeof(packet)) != NO_ERROR)
+            break;
+        if (packet.hdr.type != MX_IO_PORT_PKT_TYPE_PAGER)
+            break;
+        server->requests++;
+
+        if (packet.hdr.key != 7u || packet.length != PAGE_SIZE)
+            continue;
+        size_t index = packet.offset / PAGE_SIZE;
+        if (index == 3) {
+            mx_pager_supply(server->vmo, packet.offset, packet.length, NULL);
+            continue;
+        }
+        char buf[PAGE_SIZE];
+        memset(buf, 'a' + (int)index, sizeof(buf));
+        mx_pager_supply(server->vmo, packet.offset, sizeof(buf), buf);
+    }
+
+    return NULL;
+}
+
+bool vmo_pager_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+    mx_ssize_t sstatus;
+
+    mx_handle_t port = mx_io_port_create(0u);
+    ASSERT_LT(0, port, "io_port_create");
+
+    const size_t len = PAGE_SIZE * 4;
+    mx_handle_t vmo = mx_pager_create(port, 7u, len);
+    ASSERT_LT(0, vmo, "pager_create");
+
+    // pages can be supplied before anyone asks for them
+    char buf[PAGE_SIZE];
+    memset(buf, 'c', sizeof(buf));
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_pager_supply(vmo, 1, sizeof(buf), buf), "supply unaligned");
+    EXPECT_EQ(ERR_OUT_OF_RANGE, mx_pager_supply(vmo, len, sizeof(buf), buf),
+              "supply past the end");
+    status = mx_pager_supply(vmo, PAGE_SIZE * 2, sizeof(buf), buf);
+    EXPECT_EQ(NO_ERROR, status, "supply");
+
+    pager_server_t server = { port, vmo, 0 };
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, pager_server, &server), "pthread_create");
+
+    // a fault waits for the server
+    uintptr_t ptr;
+    status = mx_process_vm_map(0, vmo, 0, len, &ptr, MX_VM_FLAG_PERM_READ);
+    EXPECT_EQ(NO_ERROR, status, "vm_map");
+    volatile char* p = (volatile char*)ptr;
+    EXPECT_EQ('a', p[0], "faulted page");
+    EXPECT_EQ('a', p[PAGE_SIZE - 1], "faulted page");
+
+    sstatus = mx_vm_object_read(vmo, buf, PAGE_SIZE * 2, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read");
+    EXPECT_EQ('c', buf[0], "supplied page");
+
+    sstatus = mx_vm_object_read(vmo, buf, PAGE_SIZE, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read");
+    EXPECT_EQ('b', buf[0], "read page");
+
+    // the server fails the last page
+    sstatus = mx_vm_object_read(vmo, buf, PAGE_SIZE * 3, sizeof(buf));
+    EXPECT_GT(0, sstatus, "vm_object_read failed page");
+
+    status = mx_process_vm_unmap(0, ptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm_unmap");
+
+    mx_pager_packet_t quit = {{0u, MX_IO_PORT_PKT_TYPE_USER, 0u}, 0u, 0u};
+    status = mx_io_port_queue(port, &quit, sizeof(quit));
+    EXPECT_EQ(NO_ERROR, status, "io_port_queue");
+    pthread_join(thread, NULL);
+    EXPECT_EQ(3, server.requests, "one request per page not supplied");
+
+    // only objects made by pager_create take pages
+    mx_handle_t plain = mx_vm_object_create(len);
+    EXPECT_LT(0, plain, "vm_object_create");
+    EXPECT_EQ(ERR_NOT_SUPPORTED, mx_pager_supply(plain, 0, sizeof(buf), buf), "supply plain");
+
+    mx_handle_close(plain);
+    mx_handle_close(vmo);
+    mx_handle_close(port);
+
+    END_TEST;
+}
+
+bool vmo_compressible_test(void) {
+    BEGIN_TEST;
+
+    mx_status_t status;
+
+    const size_t len = PAGE_SIZE * 4;
+    mx_handle_t vmo = mx_vm_object_create(len);
+    ASSERT_LT(0, vmo, "vm_object_create");
+
+    uint32_t value = 0u;
+    status = mx_object_get_property(vmo, MX_PROP_VMO_COMPRESSIBLE, &value, sizeof(value));
+    EXPECT_EQ(NO_ERROR, status, "get_property");
+    EXPECT_EQ(1u, value, "compressible by default");
+
+    char buf[PAGE_SIZE];
+    memset(buf, 'x', sizeof(buf));
+    mx_ssize_t sstatus = mx_vm_object_write(vmo, buf, PAGE_SIZE, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_write");
+
+    // opting out leaves nothing compressed
+    value = 0u;
+    status = mx_object_set_property(vmo, MX_PROP_VMO_COMPRESSIBLE, &value, sizeof(value));
+    EXPECT_EQ(NO_ERROR, status, "set_property");
+    status = mx_object_get_property(vmo, MX_PROP_VMO_COMPRESSIBLE, &value, sizeof(value));
+    EXPECT_EQ(NO_ERROR, status, "get_property");
+    EXPECT_EQ(0u, value, "opted out");
+
+    mx_vmo_info_t info;
+    sstatus = mx_handle_get_info(vmo, MX_INFO_VMO, &info, sizeof(info));
+    EXPECT_EQ((mx_ssize_t)sizeof(info), sstatus, "get_info vmo");
+    EXPECT_EQ(0u, info.compressed_bytes, "nothing compressed");
+    EXPECT_EQ(0u, info.compressed_stored_bytes, "nothing compressed");
+    EXPECT_EQ((uint64_t)PAGE_SIZE, info.committed_bytes, "written page committed");
+
+    memset(buf, 0, sizeof(buf));
+    sstatus = mx_vm_object_read(vmo, buf, PAGE_SIZE, sizeof(buf));
+    EXPECT_EQ((mx_ssize_t)sizeof(buf), sstatus, "vm_object_read");
+    EXPECT_EQ('x', buf[PAGE_SIZE - 1], "contents kept");
+
+    value = 2u;
+    status = mx_object_set_property(vmo, MX_PROP_VMO_COMPRESSIBLE, &value, sizeof(value));
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "set_property bad value");
+    value = 1u;
+    status = mx_object_set_property(vmo, MX_PROP_VMO_COMPRESSIBLE, &value, sizeof(value));
+    EXPECT_EQ(NO_ERROR, status, "set_property back");
+
+    // setting it takes the write right
+    mx_handle_t ro = mx_handle_duplicate(vmo, MX_RIGHT_READ);
+    ASSERT_LT(0, ro, "handle_duplicate");
+    status = mx_object_set_property(ro, MX_PROP_VMO_COMPRESSIBLE, &value, sizeof(value));
+    EXPECT_EQ(ERR_ACCESS_DENIED, status, "set_property read only");
+
+    mx_handle_close(ro);
+    mx_handle_close(vmo);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(vmo_tests)
 RUN_TEST(vmo_create_test);
 RUN_TEST(vmo_read_write_test);
+RUN_TEST(vmo_map_flags_test);
+RUN_TEST(vmo_map_many_test);
+RUN_TEST(vmo_clone_test);
+RUN_TEST(vmo_slice_test);
+RUN_TEST(vmo_decommit_test);
+RUN_TEST(vmo_low_memory_event_test);
+RUN_TEST(vmo_memory_info_test);
 RUN_TEST(vmo_resize_test);
+RUN_TEST(vmo_pager_test);
+RUN_TEST(vmo_compressible_test);
 END_TEST_CASE(vmo_tests)
 
 int main(int argc, char** argv) {
@@ -59,6 +59,85 @@ local uLong adler32_combine_ OF((uLong adler1, uLong adler2, z_off64_t len2));
 #  define MOD63(a) a %= BASE
 #endif
 
+/* ========================================================================
+ * 32 bytes at a time with vector registers, where the build can use them:
+ * not in the kernel. Over k blocks of 32, with the sums at a and b before,
+ *   a += the sum of the bytes
+ *   b += 32 k a + 32 (the sum over blocks of the bytes in the blocks before)
+ *        + the sum over the columns i of (32 - i) times the bytes in column i
+ * The column sums are 16 bits a lane, which VEC_BLOCKS blocks can't overflow.
+ */
+#define VEC_BLOCKS (NMAX / 32)
+
+#if defined(__x86_64__) && !WITH_NO_FP
+#  define ADLER32_VEC
+#  include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !WITH_NO_FP
+#  define ADLER32_VEC
+#  include <arm_neon.h>
+#endif
+
+#ifdef ADLER32_VEC
+local void adler32_vec(unsigned long *adler, unsigned long *sum2, const Bytef *buf, unsigned blocks)
+{
+    uint32_t s1[4], s2[4];
+    uint16_t cols[32];
+    unsigned k = blocks;
+
+#if defined(__x86_64__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vs1 = zero, vs2 = zero;
+    __m128i c0 = zero, c1 = zero, c2 = zero, c3 = zero;
+    do {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)buf);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+        vs2 = _mm_add_epi32(vs2, vs1);
+        vs1 = _mm_add_epi32(vs1, _mm_add_epi32(_mm_sad_epu8(v0, zero), _mm_sad_epu8(v1, zero)));
+        c0 = _mm_add_epi16(c0, _mm_unpacklo_epi8(v0, zero));
+        c1 = _mm_add_epi16(c1, _mm_unpackhi_epi8(v0, zero));
+        c2 = _mm_add_epi16(c2, _mm_unpacklo_epi8(v1, zero));
+        c3 = _mm_add_epi16(c3, _mm_unpackhi_epi8(v1, zero));
+        buf += 32;
+    } while (--k);
+    _mm_storeu_si128((__m128i *)s1, vs1);
+    _mm_storeu_si128((__m128i *)s2, vs2);
+    _mm_storeu_si128((__m128i *)&cols[0], c0);
+    _mm_storeu_si128((__m128i *)&cols[8], c1);
+    _mm_storeu_si128((__m128i *)&cols[16], c2);
+    _mm_storeu_si128((__m128i *)&cols[24], c3);
+#else
+    uint32x4_t vs1 = vdupq_n_u32(0), vs2 = vdupq_n_u32(0);
+    uint16x8_t c0 = vdupq_n_u16(0), c1 = c0, c2 = c0, c3 = c0;
+    do {
+        uint8x16_t v0 = vld1q_u8(buf);
+        uint8x16_t v1 = vld1q_u8(buf + 16);
+        vs2 = vaddq_u32(vs2, vs1);
+        vs1 = vpadalq_u16(vs1, vpadalq_u8(vpaddlq_u8(v0), v1));
+        c0 = vaddw_u8(c0, vget_low_u8(v0));
+        c1 = vaddw_u8(c1, vget_high_u8(v0));
+        c2 = vaddw_u8(c2, vget_low_u8(v1));
+        c3 = vaddw_u8(c3, vget_high_u8(v1));
+        buf += 32;
+    } while (--k);
+    vst1q_u32(s1, vs1);
+    vst1q_u32(s2, vs2);
+    vst1q_u16(&cols[0], c0);
+    vst1q_u16(&cols[8], c1);
+    vst1q_u16(&cols[16], c2);
+    vst1q_u16(&cols[24], c3);
+#endif
+
+    uint64_t a = *adler, b = *sum2;
+    b += 32 * (uint64_t)blocks * a;
+    b += 32 * ((uint64_t)s2[0] + s2[1] + s2[2] + s2[3]);
+    for (int i = 0; i < 32; i++)
+        b += (uint64_t)(32 - i) * cols[i];
+    a += (uint64_t)s1[0] + s1[1] + s1[2] + s1[3];
+    *adler = a % BASE;
+    *sum2 = b % BASE;
+}
+#endif /* ADLER32_VEC */
+
 /* ========================================================================= */
 uLong ZEXPORT adler32(adler, buf, len)
     uLong adler;
@@ -99,6 +178,15 @@ uLong ZEXPORT adler32(adler, buf, len)
         return adler | (sum2 << 16);
     }
 
+#ifdef ADLER32_VEC
+    while (len >= 32) {
+        n = len / 32 < VEC_BLOCKS ? len / 32 : VEC_BLOCKS;
+        adler32_vec(&adler, &sum2, buf, n);
+        buf += n * 32;
+        len -= n * 32;
+    }
+#endif
+
     /* do length NMAX blocks -- requires just one modulo operation */
     while (len >= NMAX) {
         len -= NMAX;
@@ -371,6 +371,11 @@ static mx_status_t usb_queue_request(mx_device_t* device, usb_request_t* request
     return dev->hci_protocol->queue_request(dev->hcidev, dev->address, request);
 }
 
+static mx_status_t usb_queue_requests(mx_device_t* device, list_node_t* requests) {
+    usb_device_t* dev = get_usb_device(device);
+    return dev->hci_protocol->queue_requests(dev->hcidev, dev->address, requests);
+}
+
 static usb_speed_t usb_get_speed(mx_device_t* device) {
     usb_device_t* dev = get_usb_device(device);
     return dev->speed;
@@ -387,6 +392,7 @@ usb_device_protocol_t _device_protocol = {
     .control = usb_control,
     .get_config = usb_get_config,
     .queue_request = usb_queue_request,
+    .queue_requests = usb_queue_requests,
     .get_speed = usb_get_speed,
     .get_address = usb_get_address,
 };
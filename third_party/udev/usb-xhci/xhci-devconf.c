@@ -486,13 +486,21 @@ void xhci_destroy_dev(mx_device_t* hcidev, const int slot_id) {
         return;
     }
 
-    // complete all pending requests
-    usb_request_t* request;
-    list_for_every_entry(&xhci->devices[slot_id]->req_queue, request, usb_request_t, node) {
-        request->status = ERR_CHANNEL_CLOSED;
-        request->complete_cb(request);
+    // complete all queued and pending requests
+    usbdev_t* const dev = xhci->devices[slot_id];
+    list_node_t closed = LIST_INITIAL_VALUE(closed);
+    mxr_mutex_lock(&xhci->mutex);
+    for (int ep = 0; ep < NUM_EPS; ep++) {
+        usb_request_t* request;
+        while ((request = list_remove_head_type(&dev->ep_queued[ep], usb_request_t, node)) ||
+               (request = list_remove_head_type(&dev->ep_pending[ep], usb_request_t, node))) {
+            request->status = ERR_CHANNEL_CLOSED;
+            list_add_tail(&closed, &request->node);
+        }
+        dev->ep_used_trbs[ep] = 0;
     }
-    list_initialize(&xhci->devices[slot_id]->req_queue);
+    mxr_mutex_unlock(&xhci->mutex);
+    xhci_complete_requests(&closed);
 
     inputctx_t* const ic = xhci_make_inputctx(xhci, CTXSIZE(xhci));
     if (!ic) {
@@ -92,13 +92,16 @@ xhci_handle_transfer_event(xhci_t* const xhci) {
     const trb_t* const ev = xhci->er.cur;
     const int cc = TRB_GET(CC, ev);
     const int id = TRB_GET(ID, ev);
+    const int ep = TRB_GET(EP, ev);
 
-    if (id && id <= xhci->max_slots_en) {
+    if (id && id <= xhci->max_slots_en && ep < NUM_EPS) {
+        usbdev_t* const dev = xhci->devices[id];
         trb_t* driver_trb = (trb_t*)xhci_phys_to_virt(xhci, (mx_paddr_t)ev->ptr_low);
+        // requests complete in ring order, so this is almost always the first
         usb_request_t* request;
-        usb_request_t* temp;
-        list_for_every_entry_safe (&xhci->devices[id]->req_queue, request, temp, usb_request_t, node) {
+        list_for_every_entry (&dev->ep_queued[ep], request, usb_request_t, node) {
             if (request->driver_data == driver_trb) {
+                dev->ep_used_trbs[ep] -= xhci_request_trbs(request);
                 if (cc == CC_SUCCESS || cc == CC_SHORT_PACKET) {
                     request->status = NO_ERROR;
                     request->transfer_length = TRB_GET(EVTL, ev);
@@ -108,6 +111,9 @@ xhci_handle_transfer_event(xhci_t* const xhci) {
                 }
                 list_delete(&request->node);
                 list_add_tail(&xhci->completed_reqs, &request->node);
+
+                // the space it held on the ring can take more
+                xhci_start_requests_locked(xhci, id, ep);
                 break;
             }
         }
@@ -315,7 +315,11 @@ typedef struct usbdev {
     usb_speed_t speed;
     struct usb_xhci* hci;
 
-    list_node_t req_queue;
+    // per endpoint, the requests on its transfer ring in ring order, the
+    // ring's TRBs they take up, and the requests waiting for room on it
+    list_node_t ep_queued[NUM_EPS];
+    int ep_used_trbs[NUM_EPS];
+    list_node_t ep_pending[NUM_EPS];
 } usbdev_t;
 
 typedef union devctx {
@@ -612,6 +616,13 @@ usb_hub_protocol_t xhci_rh_hub_protocol;
 
 void xhci_poll(xhci_t* xhci);
 
+// put an endpoint's pending requests on its ring while they fit, must hold mutex
+void xhci_start_requests_locked(xhci_t* xhci, int slot_id, int ep_id);
+// hand completed requests back to their owners, batching where they ask for it
+void xhci_complete_requests(list_node_t* requests);
+// the TRBs a request takes up on a transfer ring
+int xhci_request_trbs(const usb_request_t* request);
+
 #if ARCH_X86_32 || ARCH_X86_64
 #define wmb() __asm__ volatile("sfence")
 #else
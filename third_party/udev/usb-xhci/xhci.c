@@ -47,6 +47,7 @@ static void xhci_stop(xhci_t* xhci);
 static void xhci_reset(xhci_t* xhci);
 static void xhci_reinit(xhci_t* xhci);
 static int xhci_queue_request(mx_device_t* hcidev, int devaddr, usb_request_t* request);
+static int xhci_queue_requests(mx_device_t* hcidev, int devaddr, list_node_t* requests);
 static int xhci_control(mx_device_t* hcidev, int devaddr, usb_setup_t* devreq,
                         int dalen, uint8_t* data);
 
@@ -114,7 +115,10 @@ usbdev_t* init_device_entry(usb_xhci_t* hci, int i) {
     dev->hub = -1;
     dev->port = -1;
     dev->hci = hci;
-    list_initialize(&dev->req_queue);
+    for (int ep = 0; ep < NUM_EPS; ep++) {
+        list_initialize(&dev->ep_queued[ep]);
+        list_initialize(&dev->ep_pending[ep]);
+    }
 
     return dev;
 }
@@ -160,6 +164,7 @@ usb_hci_protocol_t _xhci_protocol = {
     .alloc_request = xhci_alloc_request,
     .free_request = xhci_free_request,
     .queue_request = xhci_queue_request,
+    .queue_requests = xhci_queue_requests,
     .control = xhci_control,
     .set_address = xhci_set_address,
     .finish_device_config = xhci_finish_device_config,
@@ -187,11 +192,31 @@ void xhci_poll(xhci_t* xhci) {
     }
     mxr_mutex_unlock(&xhci->mutex);
 
+    xhci_complete_requests(&completed_reqs);
+}
+
+void xhci_complete_requests(list_node_t* requests) {
     usb_request_t* request;
-    usb_request_t* prev;
-    list_for_every_entry_safe (&completed_reqs, request, prev, usb_request_t, node) {
-        list_delete(&request->node);
-        request->complete_cb(request);
+    while ((request = list_remove_head_type(requests, usb_request_t, node)) != NULL) {
+        if (!request->complete_batch_cb) {
+            request->complete_cb(request);
+            continue;
+        }
+
+        // gather the others for the same endpoint and callback, keeping
+        // them in the order they completed
+        list_node_t batch = LIST_INITIAL_VALUE(batch);
+        list_add_tail(&batch, &request->node);
+        usb_request_t* other;
+        usb_request_t* temp;
+        list_for_every_entry_safe (requests, other, temp, usb_request_t, node) {
+            if (other->complete_batch_cb == request->complete_batch_cb &&
+                other->endpoint == request->endpoint) {
+                list_delete(&other->node);
+                list_add_tail(&batch, &other->node);
+            }
+        }
+        request->complete_batch_cb(&batch);
     }
 }
 
@@ -494,6 +519,15 @@ xhci_reset_endpoint(xhci_t* xhci, int slot_id, usb_endpoint_t* const ep) {
             return 1;
         }
         xhci_init_cycle_ring(xhci, tr, TRANSFER_RING_SIZE);
+
+        // the requests that were on the ring are gone with it
+        usb_request_t* request;
+        while ((request = list_remove_head_type(&dev->ep_queued[ep_id], usb_request_t, node))) {
+            request->status = ERR_IO;
+            request->transfer_length = 0;
+            list_add_tail(&xhci->completed_reqs, &request->node);
+        }
+        dev->ep_used_trbs[ep_id] = 0;
     }
 
     xhci_debug("Finished resetting ID %d EP %d (ep state: %d)\n",
@@ -712,48 +746,125 @@ int xhci_get_descriptor(usbdev_t* dev, int rtype, int desc_type, int desc_idx,
     return xhci_control(&dev->hci->hcidev, dev->address, &dr, len, data);
 }
 
+int xhci_request_trbs(const usb_request_t* request) {
+    // a TRB for each 64k aligned piece of the buffer, and one for the event data
+    const size_t off = (size_t)request->buffer & 0xffff;
+    const size_t pieces = request->transfer_length ? (off + request->transfer_length + 0xffff) >> 16 : 1;
+    return pieces + 1;
+}
+
 static int
-xhci_queue_request(mx_device_t* hcidev, int slot_id, usb_request_t* request) {
+xhci_check_request(usb_request_t* request) {
     if (request->endpoint->type != USB_ENDPOINT_BULK && request->endpoint->type != USB_ENDPOINT_INTERRUPT) {
         return ERR_NOT_SUPPORTED;
     }
 
-    xhci_t* xhci = get_xhci(hcidev);
-    uint8_t* data = request->buffer;
-    size_t size = request->transfer_length;
-    usb_endpoint_t* ep = request->endpoint;
-
-    const int ep_id = xhci_ep_id(ep);
-    epctx_t* const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
-    transfer_ring_t* const tr = xhci->dev[slot_id].transfer_rings[ep_id];
-
-    const size_t off = (size_t)data & 0xffff;
+    const size_t off = (size_t)request->buffer & 0xffff;
     if ((off + request->transfer_length) > ((TRANSFER_RING_SIZE - 2) << 16)) {
         xhci_debug("Unsupported transfer size\n");
         return ERR_TOO_BIG;
     }
+    return NO_ERROR;
+}
 
-    mxr_mutex_lock(&xhci->mutex);
+// must hold mutex when calling this
+static int
+xhci_add_request_locked(xhci_t* xhci, int slot_id, usb_request_t* request) {
+    const int ep_id = xhci_ep_id(request->endpoint);
+    epctx_t* const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
 
     /* Reset endpoint if it's not running */
     const unsigned ep_state = EC_GET(STATE, epctx);
     if (ep_state > 1) {
-        if (xhci_reset_endpoint(xhci, slot_id, ep)) {
-            mxr_mutex_unlock(&xhci->mutex);
+        if (xhci_reset_endpoint(xhci, slot_id, request->endpoint)) {
             return ERR_BAD_STATE;
         }
     }
 
-    /* Enqueue transfer and ring doorbell */
+    list_add_tail(&xhci->devices[slot_id]->ep_pending[ep_id], &request->node);
+    return ep_id;
+}
+
+void xhci_start_requests_locked(xhci_t* xhci, int slot_id, int ep_id) {
+    usbdev_t* dev = xhci->devices[slot_id];
+    epctx_t* const epctx = xhci->dev[slot_id].ctx.ep[ep_id];
+    transfer_ring_t* const tr = xhci->dev[slot_id].transfer_rings[ep_id];
     const unsigned mps = EC_GET(MPS, epctx);
-    const unsigned dir = (ep->direction == USB_ENDPOINT_OUT) ? TRB_DIR_OUT : TRB_DIR_IN;
-    request->driver_data = (void*)xhci_enqueue_td(xhci, tr, ep_id, mps, size, data, dir);
-    xhci->dbreg[slot_id] = ep_id;
+    bool started = false;
 
-    list_add_tail(&xhci->devices[slot_id]->req_queue, &request->node);
+    // one TRB of the ring is the link back to its start
+    usb_request_t* request;
+    while ((request = list_peek_head_type(&dev->ep_pending[ep_id], usb_request_t, node)) != NULL) {
+        const int trbs = xhci_request_trbs(request);
+        if (dev->ep_used_trbs[ep_id] + trbs > TRANSFER_RING_SIZE - 1) {
+            break;
+        }
+        list_delete(&request->node);
+
+        const unsigned dir = (request->endpoint->direction == USB_ENDPOINT_OUT) ? TRB_DIR_OUT : TRB_DIR_IN;
+        request->driver_data = (void*)xhci_enqueue_td(xhci, tr, ep_id, mps, request->transfer_length,
+                                                      request->buffer, dir);
+        dev->ep_used_trbs[ep_id] += trbs;
+        list_add_tail(&dev->ep_queued[ep_id], &request->node);
+        started = true;
+    }
+
+    /* Ring the doorbell once for everything added */
+    if (started) {
+        xhci->dbreg[slot_id] = ep_id;
+    }
+}
+
+static int
+xhci_queue_request(mx_device_t* hcidev, int slot_id, usb_request_t* request) {
+    xhci_t* xhci = get_xhci(hcidev);
+
+    int ret = xhci_check_request(request);
+    if (ret != NO_ERROR) {
+        return ret;
+    }
 
+    mxr_mutex_lock(&xhci->mutex);
+    const int ep_id = xhci_add_request_locked(xhci, slot_id, request);
+    if (ep_id >= 0) {
+        xhci_start_requests_locked(xhci, slot_id, ep_id);
+    }
     mxr_mutex_unlock(&xhci->mutex);
-    return NO_ERROR;
+    return (ep_id < 0) ? ep_id : NO_ERROR;
+}
+
+static int
+xhci_queue_requests(mx_device_t* hcidev, int slot_id, list_node_t* requests) {
+    xhci_t* xhci = get_xhci(hcidev);
+
+    usb_request_t* request;
+    list_for_every_entry (requests, request, usb_request_t, node) {
+        int ret = xhci_check_request(request);
+        if (ret != NO_ERROR) {
+            return ret;
+        }
+    }
+
+    // requests for one endpoint all go on its ring before its doorbell is rung
+    uint32_t eps = 0;
+    int ret = NO_ERROR;
+    mxr_mutex_lock(&xhci->mutex);
+    while ((request = list_remove_head_type(requests, usb_request_t, node)) != NULL) {
+        const int ep_id = xhci_add_request_locked(xhci, slot_id, request);
+        if (ep_id < 0) {
+            list_add_head(requests, &request->node);
+            ret = ep_id;
+            break;
+        }
+        eps |= 1u << ep_id;
+    }
+    for (int ep_id = 0; ep_id < NUM_EPS; ep_id++) {
+        if (eps & (1u << ep_id)) {
+            xhci_start_requests_locked(xhci, slot_id, ep_id);
+        }
+    }
+    mxr_mutex_unlock(&xhci->mutex);
+    return ret;
 }
 
 static trb_t*
@@ -17,6 +17,18 @@ void* memalign(size_t, size_t);
 
 size_t malloc_usable_size(void*);
 
+struct malloc_stats {
+    size_t heap_bytes;            // obtained from the system for the heap
+    size_t mmapped_bytes;         // in live allocations too large for the heap
+    size_t mmap_count;            // number of those allocations
+    size_t tcache_flushes;        // batches returned from thread caches to the heap
+    size_t large_retained_bytes;  // freed large allocations kept mapped
+    size_t large_committed_bytes; // the part of those still committed
+};
+
+// Snapshot of the allocator's counters, for profiling.
+void malloc_get_stats(struct malloc_stats*);
+
 #ifdef __cplusplus
 }
 #endif
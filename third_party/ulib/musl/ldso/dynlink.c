@@ -243,21 +243,18 @@ static Sym* gnu_lookup_filtered(uint32_t h1, uint32_t* hashtab, struct dso* dso,
 #define ARCH_SYM_REJECT_UND(s) 0
 #endif
 
-static struct symdef find_sym(struct dso* dso, const char* s, int need_def) {
-    uint32_t h = 0, gh, gho, *ght;
-    size_t ghm = 0;
+static struct symdef find_sym_hashed(struct dso* dso, const char* s, uint32_t gh,
+                                     int need_def) {
+    uint32_t h = 0, *ght;
+    int maskbits = 8 * sizeof(size_t);
+    uint32_t gho = gh / maskbits;
+    size_t ghm = 1ul << gh % maskbits;
     struct symdef def = {0};
     for (; dso; dso = dso->next) {
         Sym* sym;
         if (!dso->global)
             continue;
         if ((ght = dso->ghashtab)) {
-            if (!ghm) {
-                gh = gnu_hash(s);
-                int maskbits = 8 * sizeof ghm;
-                gho = gh / maskbits;
-                ghm = 1ul << gh % maskbits;
-            }
             sym = gnu_lookup_filtered(gh, ght, dso, s, gho, ghm);
         } else {
             if (!h)
@@ -287,6 +284,37 @@ static struct symdef find_sym(struct dso* dso, const char* s, int need_def) {
     return def;
 }
 
+static struct symdef find_sym(struct dso* dso, const char* s, int need_def) {
+    return find_sym_hashed(dso, s, gnu_hash(s), need_def);
+}
+
+/* Results of the lookups made while relocating one batch of DSOs.
+ * Nothing can change which global DSOs there are or their order
+ * during a batch, so a name resolves the same way every time, and
+ * the libc symbols that most DSOs refer to are only searched for
+ * once. Direct mapped by GNU hash; a collision just evicts. */
+#define SYMCACHE_SIZE 1024
+struct symcache_entry {
+    const char* name;
+    uint32_t gh;
+    int need_def;
+    struct symdef def;
+};
+static struct symcache_entry* symcache;
+
+static struct symdef find_sym_cached(struct dso* dso, const char* s, int need_def) {
+    uint32_t gh = gnu_hash(s);
+    struct symcache_entry* e = &symcache[gh % SYMCACHE_SIZE];
+    if (e->name && e->gh == gh && e->need_def == need_def && !strcmp(e->name, s))
+        return e->def;
+    struct symdef def = find_sym_hashed(dso, s, gh, need_def);
+    e->name = s;
+    e->gh = gh;
+    e->need_def = need_def;
+    e->def = def;
+    return def;
+}
+
 __attribute__((__visibility__("hidden"))) ptrdiff_t __tlsdesc_static(void), __tlsdesc_dynamic(void);
 
 static void do_relocs(struct dso* dso, size_t* rel, size_t rel_size, size_t stride) {
@@ -324,8 +352,12 @@ static void do_relocs(struct dso* dso, size_t* rel, size_t rel_size, size_t stri
             sym = syms + sym_index;
             name = strings + sym->st_name;
             ctx = type == REL_COPY ? head->next : head;
-            def = (sym->st_info & 0xf) == STT_SECTION ? (struct symdef){.dso = dso, .sym = sym}
-                                                      : find_sym(ctx, name, type == REL_PLT);
+            if ((sym->st_info & 0xf) == STT_SECTION)
+                def = (struct symdef){.dso = dso, .sym = sym};
+            else if (symcache && ctx == head)
+                def = find_sym_cached(ctx, name, type == REL_PLT);
+            else
+                def = find_sym(ctx, name, type == REL_PLT);
             if (!def.sym && (sym->st_shndx != SHN_UNDEF || sym->st_info >> 4 != STB_WEAK)) {
                 error("Error relocating %s: %s: symbol not found", dso->name, name);
                 if (runtime)
@@ -976,6 +1008,12 @@ static void do_mips_relocs(struct dso* p, size_t* got) {
 
 static void reloc_all(struct dso* p) {
     size_t dyn[DYN_CNT];
+
+    /* Only once there's a heap, which is after ldso relocates itself.
+     * Without one, every lookup just searches. */
+    if (head != &ldso)
+        symcache = calloc(SYMCACHE_SIZE, sizeof *symcache);
+
     for (; p; p = p->next) {
         if (p->relocated)
             continue;
@@ -1000,6 +1038,11 @@ static void reloc_all(struct dso* p) {
 
         p->relocated = 1;
     }
+
+    if (symcache) {
+        free(symcache);
+        symcache = 0;
+    }
 }
 
 static void kernel_mapped_dso(struct dso* p) {
@@ -1545,6 +1588,9 @@ static void* dlopen_internal(mx_handle_t vmo, const char* file, int mode) {
 
     rtld_fail = &jb;
     if (setjmp(*rtld_fail)) {
+        /* A relocation failure leaves reloc_all's cache behind. */
+        free(symcache);
+        symcache = 0;
         /* Clean up anything new that was (partially) loaded */
         if (p && p->deps)
             for (i = 0; p->deps[i]; i++)
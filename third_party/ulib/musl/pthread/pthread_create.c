@@ -20,12 +20,53 @@ static void dummy_0(void) {}
 weak_alias(dummy_0, __acquire_ptc);
 weak_alias(dummy_0, __dl_thread_cleanup);
 weak_alias(dummy_0, __do_orphaned_stdio_locks);
+weak_alias(dummy_0, __malloc_thread_cleanup);
 weak_alias(dummy_0, __pthread_tsd_run_dtors);
 weak_alias(dummy_0, __release_ptc);
 
 void* __mmap(void*, size_t, int, int, int, off_t);
 int __munmap(void*, size_t);
 
+/* Mappings of joined threads are kept here, up to a limit, so that
+ * creating threads under bursty load doesn't go back to the vm each
+ * time. Every mapping in a process is the same size unless a thread
+ * is created before the tls root is set up, so entries of another
+ * size are simply not reused. */
+#define MAX_CACHED_THREAD_MAPS 16
+
+static mxr_mutex_t thread_map_cache_lock = MXR_MUTEX_INIT;
+static pthread_t thread_map_cache[MAX_CACHED_THREAD_MAPS];
+static size_t thread_map_cache_count;
+
+static void* thread_map_get(size_t len) {
+    void* map = NULL;
+    mxr_mutex_lock(&thread_map_cache_lock);
+    for (size_t i = thread_map_cache_count; i > 0; --i) {
+        if (thread_map_cache[i - 1]->map_size == len) {
+            map = thread_map_cache[i - 1];
+            thread_map_cache[i - 1] = thread_map_cache[--thread_map_cache_count];
+            break;
+        }
+    }
+    mxr_mutex_unlock(&thread_map_cache_lock);
+    if (map != NULL) {
+        memset(map, 0, len);
+        return map;
+    }
+    return __mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+}
+
+void __pthread_release_map(pthread_t thread) {
+    mxr_mutex_lock(&thread_map_cache_lock);
+    if (thread_map_cache_count < MAX_CACHED_THREAD_MAPS) {
+        thread_map_cache[thread_map_cache_count++] = thread;
+        mxr_mutex_unlock(&thread_map_cache_lock);
+        return;
+    }
+    mxr_mutex_unlock(&thread_map_cache_lock);
+    __munmap(thread->map_base, thread->map_size);
+}
+
 static int thread_entry(void* arg) {
     struct __mx_thread_info* ei = arg;
     if (ei->tls) {
@@ -33,6 +74,7 @@ static int thread_entry(void* arg) {
         mxr_tls_set(MXR_TLS_SLOT_ERRNO, &ei->errno_value);
     }
     ei->func(ei->arg);
+    __malloc_thread_cleanup();
     mx_thread_exit();
     return 0;
 }
@@ -55,8 +97,7 @@ int pthread_create(pthread_t* restrict res, const pthread_attr_t* restrict attrp
         len = ROUND(sizeof(struct pthread));
     }
 
-    void* map = __mmap(NULL, len, PROT_READ | PROT_WRITE,
-                       MAP_PRIVATE | MAP_ANON, -1, 0);
+    void* map = thread_map_get(len);
     if (map == MAP_FAILED)
         return ERR_NO_MEMORY;
     pthread_t thread = map;
@@ -83,7 +124,7 @@ int pthread_create(pthread_t* restrict res, const pthread_attr_t* restrict attrp
     handle = mx_thread_create(thread_entry, &thread->mx_thread_info,
                               name, strlen(name));
     if (handle < 0) {
-        __munmap(map, len);
+        __pthread_release_map(thread);
         return handle;
     } else {
         thread->self = thread;
@@ -151,6 +192,7 @@ _Noreturn void pthread_exit(void* result) {
 
     __do_orphaned_stdio_locks();
     __dl_thread_cleanup();
+    __malloc_thread_cleanup();
 
     if (self->detached && self->map_base) {
         /* Detached threads must avoid the kernel clear_child_tid
@@ -4,8 +4,6 @@
 
 #include <magenta/syscalls.h>
 
-int __munmap(void*, size_t);
-
 int pthread_join(pthread_t t, void** res) {
     struct pthread* thread = (struct pthread*)t;
     mx_status_t r = mx_handle_wait_one(thread->handle,
@@ -14,7 +12,8 @@ int pthread_join(pthread_t t, void** res) {
     if (r != 0)
         return -1;
 
-    __munmap(thread, thread->map_size);
+    mx_handle_close(thread->handle);
+    __pthread_release_map(thread);
 
     return 0;
 }
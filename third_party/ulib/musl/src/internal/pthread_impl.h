@@ -126,6 +126,8 @@ int __clone(int (*)(void*), void*, int, void*, ...);
 int __libc_sigaction(int, const struct sigaction*, struct sigaction*);
 int __libc_sigprocmask(int, const sigset_t*, sigset_t*);
 void __unmapself(void*, size_t);
+void __pthread_release_map(pthread_t);
+void __malloc_thread_cleanup(void);
 
 void __vm_wait(void);
 void __vm_lock(void);
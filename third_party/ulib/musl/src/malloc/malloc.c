@@ -4,12 +4,15 @@
 #include "malloc_impl.h"
 #include <errno.h>
 #include <limits.h>
+#include <malloc.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
+#include <magenta/syscalls.h>
 #include <runtime/mutex.h>
+#include <runtime/tls.h>
 
 #if defined(__GNUC__) && defined(__PIC__)
 #define inline inline __attribute__((always_inline))
@@ -17,7 +20,6 @@
 
 void* __mmap(void*, size_t, int, int, int, off_t);
 int __munmap(void*, size_t);
-void* __mremap(void*, size_t, size_t, int, ...);
 int __madvise(void*, size_t, int);
 
 struct bin {
@@ -40,6 +42,56 @@ static struct {
 
 #define FREE_FILL 0x77
 
+/* Each thread keeps recently freed small chunks of the first
+ * TCACHE_BINS exact-size bins for itself, so most small mallocs and
+ * frees never touch the shared bins or their locks. Cached chunks
+ * stay marked in use, so neighbours never coalesce with them. When a
+ * bin holds TCACHE_COUNT chunks, half of them go back to the shared
+ * bins in one batch. */
+#define TCACHE_BINS 16
+#define TCACHE_COUNT 8
+
+struct tcache {
+    struct chunk* head[TCACHE_BINS];
+    unsigned char count[TCACHE_BINS];
+};
+
+static volatile int tcache_slot = MXR_TLS_SLOT_INVALID;
+static volatile int tcache_flushes;
+
+static struct {
+    mxr_mutex_t lock;
+    struct malloc_stats s;
+} stats;
+
+/* Allocations over MMAP_THRESHOLD get a vmo of their own, whose handle
+ * is kept in the unused space at the start of the mapping, along with
+ * how many bytes from the start may still hold old data. Freed ones
+ * of up to LARGE_CACHE_MAX bytes are kept mapped for reuse, so that
+ * large buffers churning through malloc and free don't each cost a
+ * vmo, a map and an unmap. Past LARGE_COMMIT_MAX bytes of them, the
+ * pages of a retained mapping are decommitted, all but the first. */
+#define LARGE_CACHE_SLOTS 8
+#define LARGE_CACHE_MAX (8 << 20)
+#define LARGE_COMMIT_MAX (8 << 20)
+
+struct large_mapping {
+    char* base;
+    size_t len;
+    mx_handle_t vmo;
+    int committed;
+};
+
+static struct {
+    mxr_mutex_t lock;
+    struct large_mapping slots[LARGE_CACHE_SLOTS];
+    int count;
+    size_t committed;
+} large_cache;
+
+#define LARGE_VMO(base) (*(mx_handle_t*)(base))
+#define LARGE_DIRTY(base) (*(size_t*)((char*)(base) + sizeof(size_t)))
+
 #define BIN_TO_CHUNK(i) (MEM_TO_CHUNK(&mal.bins[i].head))
 
 /* Synchronization tools */
@@ -158,6 +210,10 @@ static struct chunk* expand_heap(size_t n) {
         w->psize = 0 | C_INUSE;
     }
 
+    mxr_mutex_lock(&stats.lock);
+    stats.s.heap_bytes += n;
+    mxr_mutex_unlock(&stats.lock);
+
     /* Record new heap end and fill in footer. */
     end = (char*)p + n;
     w = MEM_TO_CHUNK(end);
@@ -267,6 +323,8 @@ static int pretrim(struct chunk* self, size_t n, int i, int j) {
     return 1;
 }
 
+static void shared_free(void* p);
+
 static void trim(struct chunk* self, size_t n) {
     size_t n1 = CHUNK_SIZE(self);
     struct chunk *next, *split;
@@ -282,27 +340,121 @@ static void trim(struct chunk* self, size_t n) {
     next->psize = n1 - n | C_INUSE;
     self->csize = n | C_INUSE;
 
-    free(CHUNK_TO_MEM(split));
+    shared_free(CHUNK_TO_MEM(split));
 }
 
-void* malloc(size_t n) {
-    struct chunk* c;
-    int i, j;
+/* Take the smallest retained mapping of at least len bytes, as long as
+ * it's not so much bigger that most of it would go to waste. */
+static struct large_mapping large_cache_take(size_t len) {
+    struct large_mapping m = {0};
+    int best = -1;
+    mxr_mutex_lock(&large_cache.lock);
+    for (int i = 0; i < large_cache.count; i++) {
+        size_t l = large_cache.slots[i].len;
+        if (l >= len && l - len <= len / 4 &&
+            (best < 0 || l < large_cache.slots[best].len))
+            best = i;
+    }
+    if (best >= 0) {
+        m = large_cache.slots[best];
+        large_cache.slots[best] = large_cache.slots[--large_cache.count];
+        if (m.committed)
+            large_cache.committed -= m.len;
+    }
+    mxr_mutex_unlock(&large_cache.lock);
+    return m;
+}
 
-    if (adjust_size(&n) < 0)
-        return 0;
+static void large_unmap(struct large_mapping* m) {
+    __munmap(m->base, m->len);
+    mx_handle_close(m->vmo);
+}
+
+static void* large_malloc(size_t n) {
+    struct chunk* c;
+    size_t len = n + OVERHEAD + PAGE_SIZE - 1 & -PAGE_SIZE;
+    struct large_mapping m = large_cache_take(len);
 
-    if (n > MMAP_THRESHOLD) {
-        size_t len = n + OVERHEAD + PAGE_SIZE - 1 & -PAGE_SIZE;
-        char* base = __mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (base == (void*)-1)
+    if (!m.base) {
+        m.vmo = mx_vm_object_create(len);
+        if (m.vmo < 0)
             return 0;
-        c = (void*)(base + SIZE_ALIGN - OVERHEAD);
-        c->csize = len - (SIZE_ALIGN - OVERHEAD);
-        c->psize = SIZE_ALIGN - OVERHEAD;
-        return CHUNK_TO_MEM(c);
+        uintptr_t ptr = 0;
+        if (mx_process_vm_map(libc.proc, m.vmo, 0, len, &ptr,
+                              MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE) < 0) {
+            mx_handle_close(m.vmo);
+            return 0;
+        }
+        m.base = (char*)ptr;
+        m.len = len;
+        LARGE_VMO(m.base) = m.vmo;
+        LARGE_DIRTY(m.base) = 0;
+    } else {
+        /* A retained mapping keeps what was written to it, or just its
+         * first page if the rest was decommitted; calloc zeroes that. */
+        LARGE_DIRTY(m.base) = m.committed ? m.len : PAGE_SIZE;
+    }
+
+    mxr_mutex_lock(&stats.lock);
+    stats.s.mmapped_bytes += m.len;
+    stats.s.mmap_count++;
+    mxr_mutex_unlock(&stats.lock);
+    c = (void*)(m.base + SIZE_ALIGN - OVERHEAD);
+    c->csize = m.len - (SIZE_ALIGN - OVERHEAD);
+    c->psize = SIZE_ALIGN - OVERHEAD;
+    return CHUNK_TO_MEM(c);
+}
+
+static void large_free(struct chunk* self) {
+    size_t extra = self->psize;
+    struct large_mapping m;
+    m.base = (char*)self - extra;
+    m.len = CHUNK_SIZE(self) + extra;
+    /* Crash on double free */
+    if (extra & 1)
+        a_crash();
+    m.vmo = LARGE_VMO(m.base);
+
+    mxr_mutex_lock(&stats.lock);
+    stats.s.mmapped_bytes -= m.len;
+    stats.s.mmap_count--;
+    mxr_mutex_unlock(&stats.lock);
+
+    if (m.len > LARGE_CACHE_MAX) {
+        large_unmap(&m);
+        return;
     }
 
+    /* Decommit before the mapping goes in the cache, where another
+     * thread could take it. The committed total is only a hint here. */
+    m.committed = large_cache.committed + m.len <= LARGE_COMMIT_MAX;
+    if (!m.committed)
+        mx_vm_object_op(m.vmo, MX_VMO_OP_DECOMMIT, PAGE_SIZE, m.len - PAGE_SIZE);
+
+    struct large_mapping victim = {0};
+    mxr_mutex_lock(&large_cache.lock);
+    if (large_cache.count == LARGE_CACHE_SLOTS) {
+        victim = large_cache.slots[0];
+        large_cache.slots[0] = large_cache.slots[--large_cache.count];
+        if (victim.committed)
+            large_cache.committed -= victim.len;
+    }
+    large_cache.slots[large_cache.count++] = m;
+    if (m.committed)
+        large_cache.committed += m.len;
+    mxr_mutex_unlock(&large_cache.lock);
+
+    if (victim.base)
+        large_unmap(&victim);
+}
+
+static void* shared_malloc(size_t n) {
+    struct chunk* c;
+    int i, j;
+
+    if (n > MMAP_THRESHOLD)
+        return large_malloc(n);
+
     i = bin_index_up(n);
     for (;;) {
         uint64_t mask = mal.binmap & -(1ULL << i);
@@ -336,9 +488,84 @@ void* malloc(size_t n) {
     return CHUNK_TO_MEM(c);
 }
 
+/* Returns the calling thread's cache, creating it if create is set.
+ * Returns 0 if the thread can't have one: before tls is set up, or if
+ * the cache slot is past the ones the thread's tls root has room for. */
+static struct tcache* get_tcache(int create) {
+    mx_tls_root_t* root = mxr_tls_root_get();
+    if (!root)
+        return 0;
+    int slot = tcache_slot;
+    if (slot == (int)MXR_TLS_SLOT_INVALID) {
+        if (!create)
+            return 0;
+        int new_slot = mxr_tls_allocate();
+        if (new_slot == (int)MXR_TLS_SLOT_INVALID)
+            return 0;
+        /* If another thread won the race, its slot is used and this
+         * one is wasted, as slots can't be freed. */
+        slot = a_cas(&tcache_slot, MXR_TLS_SLOT_INVALID, new_slot);
+        if (slot == (int)MXR_TLS_SLOT_INVALID)
+            slot = new_slot;
+    }
+    if ((uint32_t)slot >= root->maxslots)
+        return 0;
+    struct tcache* tc = root->slots[slot];
+    if (!tc && create) {
+        size_t n = sizeof(*tc);
+        if (adjust_size(&n) < 0)
+            return 0;
+        tc = shared_malloc(n);
+        if (!tc)
+            return 0;
+        memset(tc, 0, sizeof(*tc));
+        root->slots[slot] = tc;
+    }
+    return tc;
+}
+
+/* Hand up to count of bin i's cached chunks back to the shared bins. */
+static void tcache_flush(struct tcache* tc, int i, int count) {
+    a_inc(&tcache_flushes);
+    while (count-- > 0 && tc->count[i]) {
+        struct chunk* c = tc->head[i];
+        tc->head[i] = c->next;
+        tc->count[i]--;
+        shared_free(CHUNK_TO_MEM(c));
+    }
+}
+
+void* malloc(size_t n) {
+    if (adjust_size(&n) < 0)
+        return 0;
+
+    size_t i = n / SIZE_ALIGN - 1;
+    if (i < TCACHE_BINS) {
+        struct tcache* tc = get_tcache(0);
+        if (tc && tc->count[i]) {
+            struct chunk* c = tc->head[i];
+            tc->head[i] = c->next;
+            tc->count[i]--;
+            return CHUNK_TO_MEM(c);
+        }
+    }
+
+    return shared_malloc(n);
+}
+
 void* __malloc0(size_t n) {
     void* p = malloc(n);
-    if (p && !IS_MMAPPED(MEM_TO_CHUNK(p))) {
+    if (p && IS_MMAPPED(MEM_TO_CHUNK(p))) {
+        /* only the part of a reused mapping that may hold old data */
+        struct chunk* c = MEM_TO_CHUNK(p);
+        char* base = (char*)c - c->psize;
+        char* dirty_end = base + LARGE_DIRTY(base);
+        if (dirty_end <= (char*)p)
+            n = 0;
+        else if (n > (size_t)(dirty_end - (char*)p))
+            n = dirty_end - (char*)p;
+    }
+    if (p) {
         size_t* z;
         n = (n + sizeof *z - 1) / sizeof *z;
         for (z = p; n; n--, z++)
@@ -364,26 +591,20 @@ void* realloc(void* p, size_t n) {
 
     if (IS_MMAPPED(self)) {
         size_t extra = self->psize;
-        char* base = (char*)self - extra;
         size_t oldlen = n0 + extra;
         size_t newlen = n + extra;
         /* Crash on realloc of freed chunk */
         if (extra & 1)
             a_crash();
-        if (newlen < PAGE_SIZE && (new = malloc(n))) {
-            memcpy(new, p, n - OVERHEAD);
-            free(p);
-            return new;
-        }
-        newlen = (newlen + PAGE_SIZE - 1) & -PAGE_SIZE;
-        if (oldlen == newlen)
+        /* Shrink in place unless most of the mapping would be wasted;
+         * otherwise move to a fresh chunk. */
+        if (newlen <= oldlen && newlen > oldlen / 2 && n > MMAP_THRESHOLD)
             return p;
-        base = __mremap(base, oldlen, newlen, MREMAP_MAYMOVE);
-        if (base == (void*)-1)
-            return newlen < oldlen ? p : 0;
-        self = (void*)(base + extra);
-        self->csize = newlen - extra;
-        return CHUNK_TO_MEM(self);
+        if (!(new = malloc(n - OVERHEAD)))
+            return newlen <= oldlen ? p : 0;
+        memcpy(new, p, (n < n0 ? n : n0) - OVERHEAD);
+        free(p);
+        return new;
     }
 
     next = NEXT_CHUNK(self);
@@ -423,26 +644,15 @@ void* realloc(void* p, size_t n) {
     return new;
 }
 
-// This is static so __donate_heap (below) can call it without PLT
-// indirection.  The public name free is an alias for this.
-static void internal_free(void* p) {
+static void shared_free(void* p) {
     struct chunk* self = MEM_TO_CHUNK(p);
     struct chunk* next;
     size_t final_size, new_size, size;
     int reclaim = 0;
     int i;
 
-    if (!p)
-        return;
-
     if (IS_MMAPPED(self)) {
-        size_t extra = self->psize;
-        char* base = (char*)self - extra;
-        size_t len = CHUNK_SIZE(self) + extra;
-        /* Crash on double free */
-        if (extra & 1)
-            a_crash();
-        __munmap(base, len);
+        large_free(self);
         return;
     }
 
@@ -513,8 +723,61 @@ static void internal_free(void* p) {
     unlock_bin(i);
 }
 
+// The public name free is an alias for this.
+static void internal_free(void* p) {
+    if (!p)
+        return;
+
+    struct chunk* self = MEM_TO_CHUNK(p);
+    size_t i = CHUNK_SIZE(self) / SIZE_ALIGN - 1;
+    if (!IS_MMAPPED(self) && i < TCACHE_BINS) {
+        /* Crash on corrupted footer (likely from buffer overflow) */
+        if (NEXT_CHUNK(self)->psize != self->csize)
+            a_crash();
+        struct tcache* tc = get_tcache(1);
+        if (tc) {
+#if LK_DEBUGLEVEL > 1
+            memset(p, FREE_FILL, CHUNK_SIZE(self) - OVERHEAD);
+#endif
+            if (tc->count[i] == TCACHE_COUNT)
+                tcache_flush(tc, i, TCACHE_COUNT / 2);
+            self->next = tc->head[i];
+            tc->head[i] = self;
+            tc->count[i]++;
+            return;
+        }
+    }
+
+    shared_free(p);
+}
+
 void free(void*) __attribute__((alias("internal_free")));
 
+// Called as a thread exits, to give its cached chunks back.
+void __malloc_thread_cleanup(void) {
+    struct tcache* tc = get_tcache(0);
+    if (!tc)
+        return;
+    mxr_tls_set(tcache_slot, 0);
+    for (int i = 0; i < TCACHE_BINS; i++)
+        tcache_flush(tc, i, TCACHE_COUNT);
+    shared_free(tc);
+}
+
+void malloc_get_stats(struct malloc_stats* s) {
+    mxr_mutex_lock(&stats.lock);
+    *s = stats.s;
+    mxr_mutex_unlock(&stats.lock);
+    s->tcache_flushes = tcache_flushes;
+
+    s->large_retained_bytes = 0;
+    mxr_mutex_lock(&large_cache.lock);
+    for (int i = 0; i < large_cache.count; i++)
+        s->large_retained_bytes += large_cache.slots[i].len;
+    s->large_committed_bytes = large_cache.committed;
+    mxr_mutex_unlock(&large_cache.lock);
+}
+
 // "Donate" a memory block to the heap by setting up a minimal malloc
 // structure and then freeing it.
 void __donate_heap(void* startptr, void* endptr) {
@@ -528,5 +791,5 @@ void __donate_heap(void* startptr, void* endptr) {
     MEM_TO_CHUNK(start)->psize = 0 | C_INUSE;
     MEM_TO_CHUNK(start)->csize = z->psize = (end - start + OVERHEAD) | C_INUSE;
     z->csize = 0 | C_INUSE;
-    internal_free((void*)start);
+    shared_free((void*)start);
 }
@@ -58,6 +58,7 @@ void* __mmap(void* start, size_t len, int prot, int flags, int fd, off_t off) {
         mx_flags |= (prot & PROT_WRITE) ? MX_VM_FLAG_PERM_WRITE : 0;
         mx_flags |= (prot & PROT_EXEC) ? MX_VM_FLAG_PERM_EXECUTE : 0;
         mx_flags |= (flags & MAP_FIXED) ? MX_VM_FLAG_FIXED : 0;
+        mx_flags |= (flags & MAP_POPULATE) ? MX_VM_FLAG_MAP_POPULATE : 0;
 
         uintptr_t ptr = (uintptr_t)start;
         mx_status_t status = mx_process_vm_map(libc.proc, vmo, 0, len,
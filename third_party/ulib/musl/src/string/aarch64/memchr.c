@@ -0,0 +1,35 @@
+#include <arm_neon.h>
+#include <stdint.h>
+#include <string.h>
+
+// NEON, reading aligned 16 byte blocks which may start before src and end
+// after src + n but never cross into another page.
+
+static inline uint64_t nibble_mask(uint8x16_t eq) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+void* memchr(const void* src, int c, size_t n) {
+    const unsigned char* s = src;
+    if (!n)
+        return 0;
+
+    uintptr_t off = (uintptr_t)s & 15;
+    const unsigned char* p = s - off;
+    // the bytes from p to the end, which n can be too big to add to
+    size_t left = n > SIZE_MAX - off ? SIZE_MAX : n + off;
+    const uint8x16_t k = vdupq_n_u8((uint8_t)c);
+    uint64_t mask = nibble_mask(vceqq_u8(vld1q_u8(p), k));
+    mask = (mask >> (off * 4)) << (off * 4);
+    for (;;) {
+        if (mask) {
+            size_t i = __builtin_ctzll(mask) >> 2;
+            return i < left ? (void*)(p + i) : 0;
+        }
+        if (left <= 16)
+            return 0;
+        left -= 16;
+        p += 16;
+        mask = nibble_mask(vceqq_u8(vld1q_u8(p), k));
+    }
+}
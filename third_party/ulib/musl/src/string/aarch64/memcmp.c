@@ -0,0 +1,23 @@
+#include <arm_neon.h>
+#include <stdint.h>
+#include <string.h>
+
+// NEON, 16 bytes at a time while there are that many left on both sides.
+
+static inline uint64_t nibble_mask(uint8x16_t eq) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+int memcmp(const void* vl, const void* vr, size_t n) {
+    const unsigned char *l = vl, *r = vr;
+    for (; n >= 16; n -= 16, l += 16, r += 16) {
+        uint64_t diff = ~nibble_mask(vceqq_u8(vld1q_u8(l), vld1q_u8(r)));
+        if (diff) {
+            unsigned i = __builtin_ctzll(diff) >> 2;
+            return l[i] - r[i];
+        }
+    }
+    for (; n && *l == *r; n--, l++, r++)
+        ;
+    return n ? *l - *r : 0;
+}
@@ -0,0 +1,30 @@
+#include "libc.h"
+#include <arm_neon.h>
+#include <stdint.h>
+#include <string.h>
+
+// NEON, looking for c and the terminator together in aligned 16 byte blocks.
+
+static inline uint64_t nibble_mask(uint8x16_t eq) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+char* __strchrnul(const char* s, int c) {
+    uintptr_t off = (uintptr_t)s & 15;
+    const uint8_t* p = (const uint8_t*)(s - off);
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t k = vdupq_n_u8((uint8_t)c);
+    uint8x16_t v = vld1q_u8(p);
+    uint64_t mask = nibble_mask(vorrq_u8(vceqq_u8(v, zero), vceqq_u8(v, k))) >> (off * 4);
+    if (mask)
+        return (char*)s + (__builtin_ctzll(mask) >> 2);
+    for (;;) {
+        p += 16;
+        v = vld1q_u8(p);
+        mask = nibble_mask(vorrq_u8(vceqq_u8(v, zero), vceqq_u8(v, k)));
+        if (mask)
+            return (char*)p + (__builtin_ctzll(mask) >> 2);
+    }
+}
+
+weak_alias(__strchrnul, strchrnul);
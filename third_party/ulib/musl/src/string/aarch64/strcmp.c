@@ -0,0 +1,36 @@
+#include <arm_neon.h>
+#include <stdint.h>
+#include <string.h>
+
+// NEON. The two strings are rarely aligned alike, so this takes unaligned 16
+// byte loads from both, and a byte at a time wherever a load would cross
+// into the next page, past which either string may end.
+
+#define PAGE_SIZE 4096
+#define LOAD_OK(p) (((uintptr_t)(p) & (PAGE_SIZE - 1)) <= PAGE_SIZE - 16)
+
+static inline uint64_t nibble_mask(uint8x16_t eq) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+int strcmp(const char* l, const char* r) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    for (;;) {
+        if (LOAD_OK(l) && LOAD_OK(r)) {
+            uint8x16_t a = vld1q_u8((const uint8_t*)l);
+            uint8x16_t b = vld1q_u8((const uint8_t*)r);
+            uint64_t stop = nibble_mask(vorrq_u8(vmvnq_u8(vceqq_u8(a, b)), vceqq_u8(a, zero)));
+            if (stop) {
+                unsigned i = __builtin_ctzll(stop) >> 2;
+                return *(unsigned char*)(l + i) - *(unsigned char*)(r + i);
+            }
+            l += 16;
+            r += 16;
+        } else {
+            if (*l != *r || !*l)
+                return *(unsigned char*)l - *(unsigned char*)r;
+            l++;
+            r++;
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#include <arm_neon.h>
+#include <stdint.h>
+#include <string.h>
+
+// NEON, which every arm64 has. An aligned 16 byte load never crosses a page,
+// so reading past the end of the string within one is safe. There is no
+// movemask, so a comparison is narrowed to four bits a byte.
+
+static inline uint64_t nibble_mask(uint8x16_t eq) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+size_t strlen(const char* s) {
+    uintptr_t off = (uintptr_t)s & 15;
+    const uint8_t* p = (const uint8_t*)(s - off);
+    const uint8x16_t zero = vdupq_n_u8(0);
+    uint64_t mask = nibble_mask(vceqq_u8(vld1q_u8(p), zero)) >> (off * 4);
+    if (mask)
+        return __builtin_ctzll(mask) >> 2;
+    for (;;) {
+        p += 16;
+        mask = nibble_mask(vceqq_u8(vld1q_u8(p), zero));
+        if (mask)
+            return (const char*)p + (__builtin_ctzll(mask) >> 2) - s;
+    }
+}
@@ -4,8 +4,6 @@ LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/bzero.c \
     $(GET_LOCAL_DIR)/index.c \
     $(GET_LOCAL_DIR)/memccpy.c \
-    $(GET_LOCAL_DIR)/memchr.c \
-    $(GET_LOCAL_DIR)/memcmp.c \
     $(GET_LOCAL_DIR)/memmem.c \
     $(GET_LOCAL_DIR)/mempcpy.c \
     $(GET_LOCAL_DIR)/memrchr.c \
@@ -16,15 +14,12 @@ LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/strcasestr.c \
     $(GET_LOCAL_DIR)/strcat.c \
     $(GET_LOCAL_DIR)/strchr.c \
-    $(GET_LOCAL_DIR)/strchrnul.c \
-    $(GET_LOCAL_DIR)/strcmp.c \
     $(GET_LOCAL_DIR)/strcpy.c \
     $(GET_LOCAL_DIR)/strcspn.c \
     $(GET_LOCAL_DIR)/strdup.c \
     $(GET_LOCAL_DIR)/strerror_r.c \
     $(GET_LOCAL_DIR)/strlcat.c \
     $(GET_LOCAL_DIR)/strlcpy.c \
-    $(GET_LOCAL_DIR)/strlen.c \
     $(GET_LOCAL_DIR)/strncasecmp.c \
     $(GET_LOCAL_DIR)/strncat.c \
     $(GET_LOCAL_DIR)/strncmp.c \
@@ -70,23 +65,40 @@ LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/wmemmove.c \
     $(GET_LOCAL_DIR)/wmemset.c \
 
+# memchr, memcmp, strchrnul, strcmp and strlen use NEON on arm64 and SSE2
+# on x86-64, both of which every cpu of the architecture has.
 ifeq ($(ARCH),arm64)
 LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/memcpy.c \
     $(GET_LOCAL_DIR)/memmove.c \
     $(GET_LOCAL_DIR)/memset.c \
+    $(GET_LOCAL_DIR)/aarch64/memchr.c \
+    $(GET_LOCAL_DIR)/aarch64/memcmp.c \
+    $(GET_LOCAL_DIR)/aarch64/strchrnul.c \
+    $(GET_LOCAL_DIR)/aarch64/strcmp.c \
+    $(GET_LOCAL_DIR)/aarch64/strlen.c \
 
 else ifeq ($(ARCH),arm)
 LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/memcpy.c \
     $(GET_LOCAL_DIR)/memmove.c \
     $(GET_LOCAL_DIR)/memset.c \
+    $(GET_LOCAL_DIR)/memchr.c \
+    $(GET_LOCAL_DIR)/memcmp.c \
+    $(GET_LOCAL_DIR)/strchrnul.c \
+    $(GET_LOCAL_DIR)/strcmp.c \
+    $(GET_LOCAL_DIR)/strlen.c \
 
 else ifeq ($(SUBARCH),x86-64)
 LOCAL_SRCS += \
     $(GET_LOCAL_DIR)/x86_64/memcpy.s \
     $(GET_LOCAL_DIR)/x86_64/memmove.s \
     $(GET_LOCAL_DIR)/x86_64/memset.s \
+    $(GET_LOCAL_DIR)/x86_64/memchr.c \
+    $(GET_LOCAL_DIR)/x86_64/memcmp.c \
+    $(GET_LOCAL_DIR)/x86_64/strchrnul.c \
+    $(GET_LOCAL_DIR)/x86_64/strcmp.c \
+    $(GET_LOCAL_DIR)/x86_64/strlen.c \
 
 else
 error Unsupported architecture for musl build!
@@ -0,0 +1,31 @@
+#include <emmintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+// SSE2, reading aligned 16 byte blocks which may start before src and end
+// after src + n but never cross into another page.
+
+void* memchr(const void* src, int c, size_t n) {
+    const unsigned char* s = src;
+    if (!n)
+        return 0;
+
+    uintptr_t off = (uintptr_t)s & 15;
+    const unsigned char* p = s - off;
+    // the bytes from p to the end, which n can be too big to add to
+    size_t left = n > SIZE_MAX - off ? SIZE_MAX : n + off;
+    const __m128i k = _mm_set1_epi8((char)c);
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)p), k));
+    mask = (mask >> off) << off;
+    for (;;) {
+        if (mask) {
+            size_t i = __builtin_ctz(mask);
+            return i < left ? (void*)(p + i) : 0;
+        }
+        if (left <= 16)
+            return 0;
+        left -= 16;
+        p += 16;
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*)p), k));
+    }
+}
@@ -0,0 +1,20 @@
+#include <emmintrin.h>
+#include <string.h>
+
+// SSE2, 16 bytes at a time while there are that many left on both sides.
+
+int memcmp(const void* vl, const void* vr, size_t n) {
+    const unsigned char *l = vl, *r = vr;
+    for (; n >= 16; n -= 16, l += 16, r += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)l);
+        __m128i b = _mm_loadu_si128((const __m128i*)r);
+        unsigned diff = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+        if (diff) {
+            unsigned i = __builtin_ctz(diff);
+            return l[i] - r[i];
+        }
+    }
+    for (; n && *l == *r; n--, l++, r++)
+        ;
+    return n ? *l - *r : 0;
+}
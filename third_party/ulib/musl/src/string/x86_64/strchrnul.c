@@ -0,0 +1,26 @@
+#include "libc.h"
+#include <emmintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+// SSE2, looking for c and the terminator together in aligned 16 byte blocks.
+
+char* __strchrnul(const char* s, int c) {
+    uintptr_t off = (uintptr_t)s & 15;
+    const __m128i* p = (const __m128i*)(s - off);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k = _mm_set1_epi8((char)c);
+    __m128i v = _mm_load_si128(p);
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero),
+                                                   _mm_cmpeq_epi8(v, k))) >> off;
+    if (mask)
+        return (char*)s + __builtin_ctz(mask);
+    for (;;) {
+        v = _mm_load_si128(++p);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, k)));
+        if (mask)
+            return (char*)p + __builtin_ctz(mask);
+    }
+}
+
+weak_alias(__strchrnul, strchrnul);
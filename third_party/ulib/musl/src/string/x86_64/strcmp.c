@@ -0,0 +1,33 @@
+#include <emmintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+// SSE2. The two strings are rarely aligned alike, so this takes unaligned 16
+// byte loads from both, and a byte at a time wherever a load would cross
+// into the next page, past which either string may end.
+
+#define PAGE_SIZE 4096
+#define LOAD_OK(p) (((uintptr_t)(p) & (PAGE_SIZE - 1)) <= PAGE_SIZE - 16)
+
+int strcmp(const char* l, const char* r) {
+    const __m128i zero = _mm_setzero_si128();
+    for (;;) {
+        if (LOAD_OK(l) && LOAD_OK(r)) {
+            __m128i a = _mm_loadu_si128((const __m128i*)l);
+            __m128i b = _mm_loadu_si128((const __m128i*)r);
+            unsigned stop = (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff) |
+                            _mm_movemask_epi8(_mm_cmpeq_epi8(a, zero));
+            if (stop) {
+                unsigned i = __builtin_ctz(stop);
+                return *(unsigned char*)(l + i) - *(unsigned char*)(r + i);
+            }
+            l += 16;
+            r += 16;
+        } else {
+            if (*l != *r || !*l)
+                return *(unsigned char*)l - *(unsigned char*)r;
+            l++;
+            r++;
+        }
+    }
+}
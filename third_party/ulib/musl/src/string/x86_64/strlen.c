@@ -0,0 +1,20 @@
+#include <emmintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+// SSE2, which every x86-64 has. An aligned 16 byte load never crosses a page,
+// so reading past the end of the string within one is safe.
+
+size_t strlen(const char* s) {
+    uintptr_t off = (uintptr_t)s & 15;
+    const __m128i* p = (const __m128i*)(s - off);
+    const __m128i zero = _mm_setzero_si128();
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(p), zero)) >> off;
+    if (mask)
+        return __builtin_ctz(mask);
+    for (;;) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(++p), zero));
+        if (mask)
+            return (const char*)p + __builtin_ctz(mask) - s;
+    }
+}